@@ -0,0 +1,94 @@
+/* getdelim.c - time toylib's xgetdelim() against the C library's getdelim()
+ *
+ * Both read the same file of lines a number of times over, so the only
+ * difference is how each finds the delimiter and copies the line out.
+ * Writes the two results as JSON in the form run.sh uses.
+ *
+ *	getdelim [-n passes] [-d delim] file
+ *
+ * This is a host program: xgetdelim() only needs the C library, so the
+ * Makefile copies it out of toylib/portability.c into xgetdelim.h rather
+ * than linking all of toylib.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xgetdelim.h"
+
+static long long usec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec*1000000LL+ts.tv_nsec/1000;
+}
+
+// Read all of f passes times with get(), returning the wall time. The line
+// buffer is kept across passes as a caller of either would.
+static long long timeit(FILE *f, int passes, int delim, long long *bytes,
+  ssize_t (*get)(char **, size_t *, int, FILE *))
+{
+  char *line = 0;
+  size_t size = 0;
+  ssize_t len;
+  long long start = usec(), total = 0;
+  int i;
+
+  for (i = 0; i<passes; i++) {
+    rewind(f);
+    while (0<(len = get(&line, &size, delim, f))) total += len;
+  }
+  start = usec()-start;
+  free(line);
+  *bytes = total;
+
+  return start;
+}
+
+int main(int argc, char *argv[])
+{
+  long long bytes, t1, t2, b2;
+  int passes = 20, delim = '\n', opt;
+  FILE *f;
+
+  while (-1 != (opt = getopt(argc, argv, "n:d:"))) {
+    if (opt == 'n') passes = atoi(optarg);
+    else if (opt == 'd') delim = *optarg;
+    else {
+      fprintf(stderr, "usage: getdelim [-n passes] [-d delim] file\n");
+      return 1;
+    }
+  }
+  if (optind+1 != argc || !(f = fopen(argv[optind], "r"))) {
+    fprintf(stderr, "getdelim: %s: %s\n", optind<argc ? argv[optind] : "",
+      optind<argc ? strerror(errno) : "no file");
+    return 1;
+  }
+
+  // Once through first so both start with the file in the page cache.
+  timeit(f, 1, delim, &bytes, getdelim);
+  t1 = timeit(f, passes, delim, &bytes, xgetdelim);
+  t2 = timeit(f, passes, delim, &b2, getdelim);
+  fclose(f);
+  if (bytes != b2) {
+    fprintf(stderr, "getdelim: xgetdelim read %lld bytes, getdelim %lld\n",
+      bytes, b2);
+    return 1;
+  }
+
+  printf("{\n  \"results\": [\n"
+    "    {\"group\": \"toylib\", \"name\": \"xgetdelim\", \"count\": %lld, "
+    "\"unit\": \"bytes\", \"usec\": %lld},\n"
+    "    {\"group\": \"libc\", \"name\": \"getdelim\", \"count\": %lld, "
+    "\"unit\": \"bytes\", \"usec\": %lld}\n  ]\n}\n", bytes, t1, b2, t2);
+
+  return 0;
+}
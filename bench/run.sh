@@ -0,0 +1,289 @@
+#!/bin/sh
+#
+# Benchmarks for shellbox, run by the shellbox being measured, on the
+# host or copied onto a target.  Writes JSON to standard output: one
+# result per benchmark with the group it is in, its count of iterations
+# or bytes and the wall time it took in microseconds, as measured by
+# "shellstat -t".  A benchmark whose toy isn't built in is listed as
+# skipped.
+#
+#	sh run.sh [group ...] >bench.json
+#
+# The groups are shell (the interpreter itself), toylib (primitives,
+# through the toys that are thin wrappers round them) and commands
+# (whole toys over generated text).  BENCH_SCALE multiplies every count
+# and BENCH_DIR is where the corpora are made, /tmp by default.
+
+scale=${BENCH_SCALE:-1}
+dir=${BENCH_DIR:-/tmp}/shellbox-bench.$$
+sep=
+
+if ! shellstat -t >/dev/null 2>&1; then
+	echo "run.sh: this shell has no shellstat -t" >&2
+	exit 1
+fi
+mkdir -p "$dir" || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# $T is the clock, in microseconds.
+now() {
+	shellstat -t >"$dir/clock"
+	read T <"$dir/clock"
+}
+
+# emit group name count unit usec
+emit() {
+	printf '%s\n    {"group": "%s", "name": "%s", "count": %s, "unit": "%s", "usec": %s}' \
+		"$sep" "$1" "$2" "$3" "$4" "$5"
+	sep=,
+}
+
+skip() {
+	printf '%s\n    {"group": "%s", "name": "%s", "skipped": true}' \
+		"$sep" "$1" "$2"
+	sep=,
+}
+
+# run group name count unit command...
+run() {
+	_g=$1 _n=$2 _c=$3 _u=$4
+	shift 4
+	now
+	_t=$T
+	"$@"
+	now
+	emit "$_g" "$_n" "$_c" "$_u" $((T - _t))
+}
+
+# Is the toy there?  A program of the same name would be timed
+# instead, so look for the compiled-in command itself.
+have() {
+	type "$1" >"$dir/type" 2>&1
+	read _t <"$dir/type"
+	case $_t in
+	*"compiled-in command"*|*"shell builtin"*)
+		return 0;;
+	esac
+	return 1
+}
+
+# The benchmarks' own output mustn't mix with the results.
+quiet() {
+	"$@" >/dev/null
+}
+
+# from file command...
+from() {
+	_f=$1
+	shift
+	"$@" <"$_f" >/dev/null
+}
+
+# $S is the size of the file.
+size() {
+	wc -c <"$1" >"$dir/size"
+	read S <"$dir/size"
+	S=$((S))
+}
+
+
+# --- the shell ----------------------------------------------------------
+
+varloop() {
+	i=0
+	while [ $i -lt $1 ]; do
+		x=$i
+		y=$x.$x
+		z=${y%.*}
+		i=$((i + 1))
+	done
+}
+
+f() {
+	r=$1
+}
+
+funcloop() {
+	i=0
+	while [ $i -lt $1 ]; do
+		f $i
+		i=$((i + 1))
+	done
+}
+
+caseloop() {
+	i=0
+	while [ $i -lt $1 ]; do
+		for w in alpha beta.c gamma.h delta_1 epsilon; do
+			case $w in
+			*.c|*.h)	r=source;;
+			[a-c]*)		r=early;;
+			*_[0-9])	r=numbered;;
+			*)		r=other;;
+			esac
+		done
+		i=$((i + 1))
+	done
+}
+
+arithloop() {
+	i=0 a=1 b=0
+	while [ $i -lt $1 ]; do
+		a=$(( (a * 1103515245 + 12345) % 2147483648 ))
+		b=$(( b ^ (a >> 3) | (i << 2) & 0xffff ))
+		i=$((i + 1))
+	done
+}
+
+toyloop() {
+	i=0
+	while [ $i -lt $1 ]; do
+		cat </dev/null
+		i=$((i + 1))
+	done
+}
+
+substloop() {
+	i=0
+	while [ $i -lt $1 ]; do
+		x=$(uname)
+		i=$((i + 1))
+	done
+}
+
+shell() {
+	n=$((20000 * scale))
+	run shell var_loop $n iterations varloop $n
+	run shell function_calls $n iterations funcloop $n
+	run shell case_glob $((n / 5)) iterations caseloop $((n / 5))
+	run shell arithmetic $n iterations arithloop $n
+	n=$((2000 * scale))
+	if have cat; then
+		run shell toy_launch $n iterations toyloop $n
+	else
+		skip shell toy_launch
+	fi
+	if have uname; then
+		run shell toy_substitution $n iterations substloop $n
+	else
+		skip shell toy_substitution
+	fi
+}
+
+
+# --- corpora ------------------------------------------------------------
+
+# Made once.  The numbers are counted by the shell, seq not being
+# built in everywhere; sed and rev must be there.
+corpus() {
+	[ -f "$dir/text" ] && return
+	i=1
+	while [ $i -le $((100000 * scale)) ]; do
+		echo $i
+		i=$((i + 1))
+	done >"$dir/seq"
+	sed 's/.*/& the quick brown fox & jumps over the lazy dog/' \
+		"$dir/seq" >"$dir/text"
+	rev "$dir/seq" >"$dir/numbers"
+	mkdir -p "$dir/tree"
+	i=0
+	while [ $i -lt $((20 * scale)) ]; do
+		mkdir -p "$dir/tree/d$i/a/b"
+		for j in 1 2 3 4 5 6 7 8 9 10; do
+			: >"$dir/tree/d$i/f$j"
+			: >"$dir/tree/d$i/a/b/g$j"
+		done
+		i=$((i + 1))
+	done
+}
+
+
+# --- toylib -------------------------------------------------------------
+
+primitive() {
+	_n=$1 _toy=$2
+	shift 2
+	if have $_toy; then
+		run toylib $_n $bytes bytes "$@"
+	else
+		skip toylib $_n
+	fi
+}
+
+then_rm() {
+	"$@" && rm -rf "$dir/copy"
+}
+
+toylib() {
+	corpus
+	size "$dir/text"
+	bytes=$S
+	# more than tail is asked for is the whole file, sent in one go
+	primitive xsendfile.tail tail quiet tail -c $bytes "$dir/text"
+	primitive xcopy.cat cat quiet cat "$dir/text"
+	primitive xcopy.tee tee from "$dir/text" tee /dev/null
+	primitive xgetdelim.xargs xargs from "$dir/text" xargs -n 1000 true
+	if have uuencode; then
+		uuencode text <"$dir/text" >"$dir/text.uu"
+		primitive get_line.uudecode uudecode \
+			uudecode -o /dev/null "$dir/text.uu"
+	else
+		skip toylib get_line.uudecode
+	fi
+	primitive crc.cksum cksum quiet cksum "$dir/text"
+	primitive md5.md5sum md5sum quiet md5sum "$dir/text"
+	primitive sha1.sha1sum sha1sum quiet sha1sum "$dir/text"
+	files=$((220 * scale))
+	for t in cp du; do
+		if ! have $t; then
+			skip toylib dirtree_read.$t
+			continue
+		fi
+		case $t in
+		cp)	run toylib dirtree_read.cp_r $files files \
+				then_rm cp -r "$dir/tree" "$dir/copy";;
+		du)	run toylib human_readable.du_h $files files \
+				quiet du -ah "$dir/tree";;
+		esac
+	done
+}
+
+
+# --- commands -----------------------------------------------------------
+
+toy() {
+	_n=$1 _toy=$2 _in=$3
+	shift 3
+	if have $_toy; then
+		size "$_in"
+		run commands $_n $S bytes from "$_in" "$@"
+	else
+		skip commands $_n
+	fi
+}
+
+commands() {
+	corpus
+	toy sort_text sort "$dir/text" sort
+	toy sort_numeric sort "$dir/numbers" sort -n
+	toy grep_fixed grep "$dir/text" grep -F lazy
+	toy grep_regex grep "$dir/text" grep -E '[0-9]+5 the'
+	toy sed_subst sed "$dir/text" sed 's/quick \([a-z]*\)/\1 slow/'
+	toy wc wc "$dir/text" wc
+	toy gzip gzip "$dir/text" gzip -c
+}
+
+
+[ $# -gt 0 ] || set -- shell toylib commands
+printf '{\n  "shell": "shellbox",\n  "system": "%s",\n  "scale": %s,\n  "results": [' \
+	"$(uname -srm)" $scale
+for group; do
+	case $group in
+	shell|toylib|commands)
+		$group;;
+	*)
+		echo "run.sh: no group $group" >&2
+		exit 1;;
+	esac
+done
+printf '\n  ]\n}\n'
@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+# The training run for a profile guided build, see platform/rtems/Makefile.
+# The benchmarks at a small scale, then the kinds of script a shellbox
+# spends its life running: a boot out of an rc directory, and pipelines
+# crunching a log.  Everything it makes goes under BENCH_DIR, /tmp by
+# default; BENCH_SCALE makes the run longer.
+#
+#	sh train.sh
+
+scale=${BENCH_SCALE:-1}
+dir=${BENCH_DIR:-/tmp}/shellbox-train.$$
+case $0 in
+*/*)	here=${0%/*};;
+*)	here=.;;
+esac
+
+mkdir -p "$dir/rc.d" "$dir/etc" "$dir/run" || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# In a subshell of this shell, so nothing has to be exec()ed.
+(set --; BENCH_DIR=$dir; . "$here/run.sh") >/dev/null
+
+
+# --- a boot -------------------------------------------------------------
+
+printf '%s\n' 'hostname=box' 'net=static' 'addr=10.0.0.2' 'log=on' \
+	'# comment' '' 'services=syslog crond telnetd' >"$dir/etc/rc.conf"
+
+# rc script name requires...
+rcscript() {
+	_s=$dir/rc.d/$1
+	shift
+	{
+		echo '#!/bin/sh'
+		echo "# requires: $*"
+		echo "ETC=$dir/etc RUN=$dir/run"
+		cat <<'EOF'
+while read -r line; do
+	case $line in
+	''|'#'*)	continue;;
+	*=*)		eval "conf_${line%%=*}=\${line#*=}";;
+	esac
+done <"$ETC/rc.conf"
+name=${0##*/}
+[ -d "$RUN/$name" ] || mkdir -p "$RUN/$name"
+for s in $conf_services; do
+	case $s in
+	sys*)	echo "$s $conf_log" >"$RUN/$name/$s";;
+	*d)	[ -f "$RUN/$name/$s" ] || : >"$RUN/$name/$s";;
+	esac
+done
+i=0
+while [ $i -lt 50 ]; do
+	v=$(( (i * 31 + ${#name}) % 7 ))
+	test $v -gt 3 && echo "$name $i $v" >>"$RUN/$name/log"
+	i=$((i + 1))
+done
+EOF
+	} >"$_s"
+	chmod +x "$_s"
+}
+
+rcscript S10mount
+rcscript S20hostname S10mount
+rcscript S30syslog S10mount
+rcscript S40net S20hostname
+rcscript S50crond S30syslog
+rcscript S60telnetd S40net S30syslog
+rcscript S70local S50crond S60telnetd
+
+i=0
+while [ $i -lt $((10 * scale)) ]; do
+	runparts -q "$dir/rc.d" >/dev/null 2>&1
+	rm -rf "$dir/run"
+	mkdir "$dir/run"
+	i=$((i + 1))
+done
+
+
+# --- a log --------------------------------------------------------------
+
+i=0
+while [ $i -lt $((20000 * scale)) ]; do
+	case $((i % 7)) in
+	0)	lvl=err;;
+	1|2)	lvl=warn;;
+	*)	lvl=info;;
+	esac
+	echo "Oct 14 12:$((i / 60 % 60)):$((i % 60)) box daemon$((i % 13))[$((100 + i % 50))]: $lvl: request $i took $((i * 7 % 1000))ms"
+	i=$((i + 1))
+done >"$dir/log"
+
+# A pipeline whose stages have redirections of their own has to fork,
+# so they're redirected from outside.
+log=$dir/log
+{
+	grep -c ': err:' "$log"
+	grep ': err:' "$log" | sed 's/.*\(daemon[0-9]*\).*/\1/' | sort |
+		uniq -c | sort -rn
+	cat "$log" | grep -v ': info:' | cut -d' ' -f5 | sort -u | wc -l
+	sed -n '/took [0-9]\{3\}ms/p' "$log" | tail -n 100 | wc -l
+} >/dev/null
+n=0
+while read -r mon day time host proc lvl rest; do
+	case $lvl in
+	err:)	n=$((n + 1));;
+	esac
+done <"$log"
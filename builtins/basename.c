@@ -0,0 +1,95 @@
+/*
+ * This file contains code for the basename and dirname builtins, which
+ * scripts run so often (in $(...) inside a loop, mostly) that starting
+ * the toys for them is most of the cost.  The answer goes straight into
+ * the shell's own output, so a command substitution needs no thread or
+ * pipe either.
+ */
+
+#include <string.h>
+
+#include "bltin.h"
+
+
+/*
+ * Strip trailing slashes from name, but leave a name that is nothing
+ * else as one of them.  Returns a pointer to the last character left.
+ */
+
+static char *
+lastchar(char *name)
+{
+	char *p;
+
+	if (!*name)
+		return name;
+	p = name + strlen(name) - 1;
+	while (p > name && *p == '/')
+		p--;
+	return p;
+}
+
+
+int
+basenamecmd(int argc, char **argv)
+{
+	char *name, *suffix, *base, *end;
+	size_t len;
+
+	nextopt(nullstr);
+	argv = argptr;
+	if (!argv[0] || (argv[1] && argv[2])) {
+		warnx("usage: basename string [suffix]");
+		return 1;
+	}
+	name = argv[0];
+	suffix = argv[1];
+
+	if (*name) {
+		end = lastchar(name);
+		end[1] = '\0';
+		for (base = end ; base > name && base[-1] != '/' ; base--)
+			;
+		len = strlen(base);
+		/* a suffix goes, unless it's all there is */
+		if (suffix && *base != '/') {
+			size_t sl = strlen(suffix);
+
+			if (len > sl && !strcmp(base + len - sl, suffix))
+				base[len - sl] = '\0';
+		}
+		name = base;
+	}
+	out1str(name);
+	out1c('\n');
+	return 0;
+}
+
+
+int
+dirnamecmd(int argc, char **argv)
+{
+	char *name, *p;
+
+	nextopt(nullstr);
+	argv = argptr;
+	if (!argv[0]) {
+		warnx("usage: dirname PATH");
+		return 1;
+	}
+	name = argv[0];
+
+	p = lastchar(name);
+	while (p >= name && *p != '/')
+		p--;
+	if (p < name)
+		name = ".";
+	else {
+		while (p > name && *p == '/')
+			p--;
+		p[1] = '\0';
+	}
+	out1str(name);
+	out1c('\n');
+	return 0;
+}
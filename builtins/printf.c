@@ -40,6 +40,34 @@
 #include <string.h>
 #include <unistd.h>
 
+/*
+ * A format is compiled once into the literal text before each conversion,
+ * its escapes already decoded, and the conversion ready to hand to printf.
+ * The last entry ends the format; if it has a spec, the format is bad
+ * there.  Scripts tend to use the same few formats over and over, in a
+ * loop, so the last few compiled are kept.
+ */
+struct pfconv {
+	char	*lit;		/* literal text before the conversion */
+	size_t	 litlen;
+	char	*spec;		/* e.g. "%-8.3jd" */
+	char	 conv;		/* its conversion character, 0 at the end */
+	char	 nstar;		/* how many '*'s take an argument */
+	char	 plain;		/* no flags, width or precision */
+};
+
+struct pformat {
+	char	*text;
+	struct pfconv *convs;
+	int	 nconv;
+};
+
+#define PFCACHE	4
+
+static struct pformat *getformat(char *);
+static void	 freeformat(struct pformat *);
+static char	*pfspec(const char *, const char *, const char *);
+static void	 pfint(intmax_t);
 static int	 conv_escape_str(char *);
 static char	*conv_escape(char *, int *);
 static int	 getchr(void);
@@ -47,12 +75,8 @@ static double	 getdouble(void);
 static intmax_t	 getintmax(void);
 static uintmax_t getuintmax(void);
 static char	*getstr(void);
-static char	*mklong(const char *, const char *);
 static void      check_conversion(const char *, const char *);
 
-static int	rval;
-static char  **gargv;
-
 #define isodigit(c)	((c) >= '0' && (c) <= '7')
 #define octtobin(c)	((c) - '0')
 
@@ -60,6 +84,12 @@ static char  **gargv;
 #include "system.h"
 #include "output.h"
 
+static SHTLS struct pformat pfcache[PFCACHE];
+static SHTLS int pfnext;
+
+static SHTLS int	rval;
+static SHTLS char  **gargv;
+
 #define PF(f, func) { \
 	switch ((char *)param - (char *)array) { \
 	default: \
@@ -77,111 +107,78 @@ static char  **gargv;
 int printfcmd(int argc, char *argv[])
 {
     (void)argc;
+	struct pformat *format;
+	struct pfconv *cv;
 	char *fmt;
-	char *format;
-	int ch;
 
 	rval = 0;
 
 	nextopt(nullstr);
 
 	argv = argptr;
-	format = *argv;
+	fmt = *argv;
 
-	if (!format) {
+	if (!fmt) {
 		warnx("usage: printf format [arg ...]");
 		goto err;
 	}
 
 	gargv = ++argv;
+	format = getformat(fmt);
 
-#define SKIP1	"#-+ 0"
-#define SKIP2	"*0123456789"
 	do {
 		/*
-		 * Basic algorithm is to scan the format string for conversion
-		 * specifications -- once one is found, find out if the field
-		 * width or precision is a '*'; if it is, gather up value. 
 		 * Note, format strings are reused as necessary to use up the
 		 * provided arguments, arguments of zero/null string are 
 		 * provided to use up the format string.
 		 */
-
-		/* find next format specification */
-		for (fmt = format; (ch = *fmt++) ;) {
-			char *start;
-			char nextch;
+		for (cv = format->convs ;; cv++) {
 			int array[2];
 			int *param;
 
-			if (ch == '\\') {
-				int c_ch;
-				fmt = conv_escape(fmt, &c_ch);
-				ch = c_ch;
-				goto pc;
-			}
-			if (ch != '%' || (*fmt == '%' && (++fmt || 1))) {
-pc:
-				putchar(ch);
-				continue;
-			}
+			if (cv->litlen)
+				outmem(cv->lit, cv->litlen, out1);
+			if (!cv->conv)
+				break;
 
-			/* Ok - we've found a format specification,
-			   Save its address for a later printf(). */
-			start = fmt - 1;
+			/* gather up '*' field width and precision */
 			param = array;
-
-			/* skip to field width */
-			fmt += strspn(fmt, SKIP1);
-			if (*fmt == '*')
+			if (cv->nstar > 0)
 				*param++ = getintmax();
-
-			/* skip to possible '.', get following precision */
-			fmt += strspn(fmt, SKIP2);
-			if (*fmt == '.')
-				++fmt;
-			if (*fmt == '*')
+			if (cv->nstar > 1)
 				*param++ = getintmax();
 
-			fmt += strspn(fmt, SKIP2);
-
-			ch = *fmt;
-			if (!ch) {
-				warnx("missing format character");
-				goto err;
-			}
-			/* null terminate format string to we can use it
-			   as an argument to printf. */
-			nextch = fmt[1];
-			fmt[1] = 0;
-			switch (ch) {
+			switch (cv->conv) {
 
 			case 'b': {
 				int done = conv_escape_str(getstr());
 				char *p = stackblock();
-				*fmt = 's';
-				PF(start, p);
+				PF(cv->spec, p);
 				/* escape if a \c was encountered */
 				if (done)
 					goto out;
-				*fmt = 'b';
 				break;
 			}
 			case 'c': {
 				int p = getchr();
-				PF(start, p);
+				PF(cv->spec, p);
 				break;
 			}
 			case 's': {
 				char *p = getstr();
-				PF(start, p);
+				if (cv->plain)
+					out1str(p);
+				else
+					PF(cv->spec, p);
 				break;
 			}
 			case 'd':
 			case 'i': {
 				intmax_t p = getintmax();
-				char *f = mklong(start, fmt);
-				PF(f, p);
+				if (cv->plain)
+					pfint(p);
+				else
+					PF(cv->spec, p);
 				break;
 			}
 			case 'o':
@@ -189,24 +186,22 @@ pc:
 			case 'x':
 			case 'X': {
 				uintmax_t p = getuintmax();
-				char *f = mklong(start, fmt);
-				PF(f, p);
+				PF(cv->spec, p);
 				break;
 			}
-			case 'e':
-			case 'E':
-			case 'f':
-			case 'g':
-			case 'G': {
+			default: {
 				double p = getdouble();
-				PF(start, p);
+				PF(cv->spec, p);
 				break;
 			}
-			default:
-				warnx("%s: invalid directive", start);
-				goto err;
 			}
-			*++fmt = nextch;
+		}
+		if (cv->spec) {
+			if (*cv->spec)
+				warnx("%s: invalid directive", cv->spec);
+			else
+				warnx("missing format character");
+			goto err;
 		}
 	} while (gargv != argv && *gargv);
 
@@ -217,6 +212,107 @@ err:
 }
 
 
+/*
+ * The compiled form of text, from the cache if it's been used lately.
+ */
+static struct pformat *
+getformat(char *text)
+{
+	struct pformat *f;
+	struct pfconv *cv;
+	char *fmt, *start, *lit;
+	int ch, i, size;
+
+	for (i = 0 ; i < PFCACHE ; i++)
+		if (pfcache[i].text && !strcmp(pfcache[i].text, text))
+			return &pfcache[i];
+
+	INTOFF;
+	f = &pfcache[pfnext];
+	pfnext = (pfnext + 1) % PFCACHE;
+	freeformat(f);
+	size = 4;
+	f->convs = ckmalloc(size * sizeof(*f->convs));
+	f->nconv = 0;
+
+#define SKIP1	"#-+ 0"
+#define SKIP2	"*0123456789"
+	fmt = text;
+	for (;;) {
+		if (f->nconv == size)
+			f->convs = ckrealloc(f->convs,
+			    (size *= 2) * sizeof(*f->convs));
+		cv = &f->convs[f->nconv++];
+		cv->lit = NULL;
+		cv->spec = NULL;
+		cv->conv = 0;
+		cv->nstar = 0;
+
+		/* literal text up to the next conversion */
+		STARTSTACKSTR(lit);
+		while ((ch = *fmt++)) {
+			if (ch == '\\') {
+				int c_ch;
+				fmt = conv_escape(fmt, &c_ch);
+				ch = c_ch;
+			} else if (ch == '%' && !(*fmt == '%' && (++fmt || 1)))
+				break;
+			STPUTC(ch, lit);
+		}
+		cv->litlen = lit - (char *)stackblock();
+		cv->lit = ckmalloc(cv->litlen + 1);
+		memcpy(cv->lit, stackblock(), cv->litlen);
+		if (!ch)
+			break;
+
+		start = fmt - 1;
+
+		/* skip to field width */
+		fmt += strspn(fmt, SKIP1);
+		if (*fmt == '*')
+			cv->nstar++;
+
+		/* skip to possible '.', get following precision */
+		fmt += strspn(fmt, SKIP2);
+		if (*fmt == '.')
+			++fmt;
+		if (*fmt == '*')
+			cv->nstar++;
+
+		fmt += strspn(fmt, SKIP2);
+
+		ch = *fmt;
+		if (!ch) {
+			cv->spec = nullstr;
+			break;
+		}
+		cv->plain = fmt == start + 1;
+		cv->conv = ch;
+		switch (ch) {
+		case 'd': case 'i':
+		case 'o': case 'u': case 'x': case 'X':
+			cv->spec = pfspec(start, fmt, PRIdMAX);
+			break;
+		case 'b': case 'c': case 's':
+		case 'e': case 'E': case 'f': case 'g': case 'G':
+			cv->spec = pfspec(start, fmt, "s");
+			break;
+		default:
+			cv->spec = pfspec(start, fmt, "s");
+			cv->conv = 0;
+			break;
+		}
+		/* %b prints the string its argument's escapes make */
+		cv->spec[strlen(cv->spec) - 1] = ch == 'b' ? 's' : ch;
+		if (!cv->conv)
+			break;
+		fmt++;
+	}
+	/* only now is it complete enough to be found */
+	f->text = savestr(text);
+	INTON;
+	return f;
+}
 /*
  * Print SysV echo(1) style escape string 
  *	Halts processing string if a \c escape is encountered.
@@ -315,11 +411,31 @@ out:
 	return str;
 }
 
+static void
+freeformat(struct pformat *f)
+{
+	int i;
+
+	if (!f->convs)
+		return;
+	for (i = 0 ; i < f->nconv ; i++) {
+		ckfree(f->convs[i].lit);
+		if (f->convs[i].spec != nullstr)
+			ckfree(f->convs[i].spec);
+	}
+	ckfree(f->convs);
+	ckfree(f->text);
+	f->convs = NULL;
+	f->text = NULL;
+}
+
 static char *
-mklong(const char *str, const char *ch)
+pfspec(const char *start, const char *ch, const char *mod)
 {
 	/*
-	 * Replace a string like "%92.3u" with "%92.3"PRIuMAX.
+	 * Copy a spec like "%92.3u" up to its conversion character,
+	 * adding mod: with PRIdMAX it becomes "%92.3"PRIdMAX, for the
+	 * caller to replace the final 'd' with the conversion character.
 	 *
 	 * Although C99 does not guarantee it, we assume PRIiMAX,
 	 * PRIoMAX, PRIuMAX, PRIxMAX, and PRIXMAX are all the same
@@ -328,15 +444,32 @@ mklong(const char *str, const char *ch)
 	 */
 
 	char *copy;
-	size_t len;	
-
-	len = ch - str + sizeof(PRIdMAX);
-	STARTSTACKSTR(copy);
-	copy = makestrspace(len, copy);
-	memcpy(copy, str, len - sizeof(PRIdMAX));
-	memcpy(copy + len - sizeof(PRIdMAX), PRIdMAX, sizeof(PRIdMAX));
-	copy[len - 2] = *ch;
-	return (copy);	
+	size_t len, mlen;
+
+	len = ch - start;
+	mlen = strlen(mod);
+	copy = ckmalloc(len + mlen + 1);
+	memcpy(copy, start, len);
+	memcpy(copy + len, mod, mlen + 1);
+	return (copy);
+}
+
+/*
+ * A plain %d, without going through printf.
+ */
+static void
+pfint(intmax_t n)
+{
+	char buf[sizeof(n) * 3 + 2];
+	char *p = buf + sizeof(buf);
+	uintmax_t u = n < 0 ? -(uintmax_t)n : (uintmax_t)n;
+
+	do
+		*--p = '0' + u % 10;
+	while (u /= 10);
+	if (n < 0)
+		*--p = '-';
+	outmem(p, buf + sizeof(buf) - p, out1);
 }
 
 static int
@@ -133,8 +133,8 @@ static struct t_op {
 	{0,	0,	0}
 };
 
-static char **t_wp;
-static struct t_op const *t_wp_op;
+static SHTLS char **t_wp;
+static SHTLS struct t_op const *t_wp_op;
 
 static void syntax(const char *, const char *);
 static int oexpr(enum token);
@@ -225,6 +225,111 @@ eval:
 	return res;
 }
 
+/*
+ * For the parser: if s is a binary operator, return something to hand
+ * testfast for "[ a s b ]" or "test a s b", otherwise 0.
+ */
+int
+testbinop(const char *s)
+{
+	const struct t_op *op;
+
+	op = getop(s);
+	if (!op || op->op_type != BINOP)
+		return 0;
+	return op - ops + 1;
+}
+
+/*
+ * Parse a plain decimal number that can't overflow.  Anything else is
+ * left for getn to accept or complain about.
+ */
+static int
+fastn(const char *s, intmax_t *np)
+{
+	const char *p;
+	intmax_t n;
+
+	p = s + (*s == '-');
+	if (!*p || strlen(p) > 18)
+		return -1;
+	for (n = 0; *p; p++) {
+		if (*p < '0' || *p > '9')
+			return -1;
+		n = n * 10 + *p - '0';
+	}
+	*np = *s == '-' ? -n : n;
+	return 0;
+}
+
+/*
+ * Evaluate a test the parser found with testbinop, if after expansion
+ * it is still three operands with that operator in the middle, and so
+ * exactly what testcmd would do.  Returns the exit status, or -1 to
+ * have testcmd run after all, which it will for anything that might be
+ * an error.
+ */
+int
+testfast(int opno, int argc, char **argv)
+{
+	const struct t_op *op;
+	const char *a, *b;
+	intmax_t m, n;
+	int res;
+
+	if (*argv[0] == '[') {
+		if (argc != 5 || *argv[4] != ']')
+			return -1;
+	} else if (argc != 4)
+		return -1;
+	op = ops + opno - 1;
+	if (strcmp(argv[2], op->op_text))
+		return -1;
+	a = argv[1];
+	b = argv[3];
+
+	switch (op->op_num) {
+	case STREQ:
+		res = strcmp(a, b) == 0;
+		break;
+	case STRNE:
+		res = strcmp(a, b) != 0;
+		break;
+	case STRLT:
+		res = strcmp(a, b) < 0;
+		break;
+	case STRGT:
+		res = strcmp(a, b) > 0;
+		break;
+	default:
+		if (fastn(a, &m) || fastn(b, &n))
+			return -1;
+		switch (op->op_num) {
+		case INTEQ:
+			res = m == n;
+			break;
+		case INTNE:
+			res = m != n;
+			break;
+		case INTGE:
+			res = m >= n;
+			break;
+		case INTGT:
+			res = m > n;
+			break;
+		case INTLE:
+			res = m <= n;
+			break;
+		case INTLT:
+			res = m < n;
+			break;
+		default:
+			return -1;
+		}
+	}
+	return !res;
+}
+
 static void
 syntax(const char *op, const char *msg)
 {
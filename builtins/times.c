@@ -11,20 +11,46 @@
 #include "bltin.h"
 #endif
 #include "system.h"
+#include "stats.h"
 
-int timescmd() {
+/*
+ * times [-m | -v]
+ *
+ * -v adds what each toy run in the shell used, and -m prints all of it
+ * as key=value lines, times in microseconds.
+ */
+
+int timescmd(int argc, char **argv) {
 	struct tms buf;
 	long int clk_tck = sysconf(_SC_CLK_TCK);
+	int keys = 0, verbose = 0;
+	int c;
 
+	while ((c = nextopt("mv")) != '\0') {
+		if (c == 'm')
+			keys = 1;
+		else
+			verbose = 1;
+	}
 	times(&buf);
-	printf("%dm%fs %dm%fs\n%dm%fs %dm%fs\n",
-	       (int) (buf.tms_utime / clk_tck / 60),
-	       ((double) buf.tms_utime) / clk_tck,
-	       (int) (buf.tms_stime / clk_tck / 60),
-	       ((double) buf.tms_stime) / clk_tck,
-	       (int) (buf.tms_cutime / clk_tck / 60),
-	       ((double) buf.tms_cutime) / clk_tck,
-	       (int) (buf.tms_cstime / clk_tck / 60),
-	       ((double) buf.tms_cstime) / clk_tck);
+	if (keys)
+		printf("user_usec=%lld\nsys_usec=%lld\n"
+		       "children_user_usec=%lld\nchildren_sys_usec=%lld\n",
+		       (long long) buf.tms_utime * 1000000 / clk_tck,
+		       (long long) buf.tms_stime * 1000000 / clk_tck,
+		       (long long) buf.tms_cutime * 1000000 / clk_tck,
+		       (long long) buf.tms_cstime * 1000000 / clk_tck);
+	else
+		printf("%dm%fs %dm%fs\n%dm%fs %dm%fs\n",
+		       (int) (buf.tms_utime / clk_tck / 60),
+		       ((double) buf.tms_utime) / clk_tck,
+		       (int) (buf.tms_stime / clk_tck / 60),
+		       ((double) buf.tms_stime) / clk_tck,
+		       (int) (buf.tms_cutime / clk_tck / 60),
+		       ((double) buf.tms_cutime) / clk_tck,
+		       (int) (buf.tms_cstime / clk_tck / 60),
+		       ((double) buf.tms_cstime) / clk_tck);
+	if (keys || verbose)
+		toytimes(keys);
 	return 0;
 }
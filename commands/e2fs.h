@@ -70,9 +70,19 @@ struct ext2_group
   uint16_t free_blocks_count;  // How many free blocks in this group?
   uint16_t free_inodes_count;  // How many free inodes in this group?
   uint16_t used_dirs_count;    // How many directories?
-  uint16_t reserved[7];        // pad to 32 bytes
+  // For EXT4_FEATURE_RO_COMPAT_GDT_CSUM (uninit_bg)
+  uint16_t flags;              // EXT4_BG_* below
+  uint32_t exclude_bitmap;
+  uint16_t block_bitmap_csum;
+  uint16_t inode_bitmap_csum;
+  uint16_t itable_unused;      // Inodes at the end of table never used
+  uint16_t checksum;           // crc16 of uuid, group number and the above
 };
 
+#define EXT4_BG_INODE_UNINIT 0x0001  // Inode table and bitmap not in use
+#define EXT4_BG_BLOCK_UNINIT 0x0002  // Block bitmap not in use
+#define EXT4_BG_INODE_ZEROED 0x0004  // Inode table has been zeroed
+
 struct ext2_dentry {
   uint32_t inode;         // Inode number
   uint16_t rec_len;       // Directory entry length
@@ -117,6 +127,7 @@ struct ext2_inode {
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
 #define EXT2_FEATURE_RO_COMPAT_BTREE_DIR	0x0004
+#define EXT4_FEATURE_RO_COMPAT_GDT_CSUM		0x0010
 
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT2_FEATURE_INCOMPAT_FILETYPE		0x0002
@@ -14,6 +14,14 @@
 #define USE_TOYBOX_ON_ANDROID(...)
 #define CFG_TOYBOX_FORK 1
 #define USE_TOYBOX_FORK(...) __VA_ARGS__
+#define CFG_TOYBOX_THREADS 1
+#define USE_TOYBOX_THREADS(...) __VA_ARGS__
+#define CFG_TOYBOX_COPYFILE 1
+#define USE_TOYBOX_COPYFILE(...) __VA_ARGS__
+#define CFG_TOYBOX_TRACE 1
+#define USE_TOYBOX_TRACE(...) __VA_ARGS__
+#define CFG_TOYBOX_FSYNC 0
+#define USE_TOYBOX_FSYNC(...)
 #define CFG_BASENAME 1
 #define USE_BASENAME(...) __VA_ARGS__
 #define CFG_CAL 1
@@ -504,6 +512,10 @@
 #define USE_MD5SUM(...) __VA_ARGS__
 #define CFG_SHA1SUM 1
 #define USE_SHA1SUM(...) __VA_ARGS__
+#define CFG_SHA256SUM 1
+#define USE_SHA256SUM(...) __VA_ARGS__
+#define CFG_SHA512SUM 1
+#define USE_SHA512SUM(...) __VA_ARGS__
 #define CFG_MKNOD 1
 #define USE_MKNOD(...) __VA_ARGS__
 #define CFG_MKNOD_Z 0
@@ -301,9 +301,9 @@
 #undef FOR_count
 #endif
 
-// cp <2(preserve):;RHLPprdaslvnF(remove-destination)fi[-HLPd][-ni] <2(preserve):;RHLPprdaslvnF(remove-destination)fi[-HLPd][-ni]
+// cp <2(preserve):;(sparse):j#<1RHLPprdaslvnF(remove-destination)fi[-HLPd][-ni] <2(preserve):;(sparse):j#<1RHLPprdaslvnF(remove-destination)fi[-HLPd][-ni]
 #undef OPTSTR_cp
-#define OPTSTR_cp "<2(preserve):;RHLPprdaslvnF(remove-destination)fi[-HLPd][-ni]"
+#define OPTSTR_cp "<2(preserve):;(sparse):j#<1RHLPprdaslvnF(remove-destination)fi[-HLPd][-ni]"
 #ifdef CLEANUP_cp
 #undef CLEANUP_cp
 #undef FOR_cp
@@ -323,6 +323,8 @@
 #undef FLAG_L
 #undef FLAG_H
 #undef FLAG_R
+#undef FLAG_j
+#undef FLAG_sparse
 #undef FLAG_preserve
 #endif
 
@@ -429,7 +431,7 @@
 #undef FLAG_H
 #endif
 
-// dhcp   V:H:F:x*r:O*A#<0T#<0t#<0s:p:i:SBRCaovqnbf
+// dhcp   (no-wait-offer)l:V:H:F:x*r:O*A#<0T#<0t#<0s:p:i:SBRCaovqnbf
 #undef OPTSTR_dhcp
 #define OPTSTR_dhcp  0 
 #ifdef CLEANUP_dhcp
@@ -458,9 +460,11 @@
 #undef FLAG_F
 #undef FLAG_H
 #undef FLAG_V
+#undef FLAG_l
+#undef FLAG_no_wait_offer
 #endif
 
-// dhcpd   >1P#<0>65535fi:S46[!46]
+// dhcpd   >1P#<0>65535fi:S46
 #undef OPTSTR_dhcpd
 #define OPTSTR_dhcpd  0 
 #ifdef CLEANUP_dhcpd
@@ -521,9 +525,9 @@
 #undef FOR_dirname
 #endif
 
-// dmesg trs#<1n#c[!tr] trs#<1n#c[!tr]
+// dmesg WTf:l:wtrs#<1n#c[!Ttr] WTf:l:wtrs#<1n#c[!Ttr]
 #undef OPTSTR_dmesg
-#define OPTSTR_dmesg "trs#<1n#c[!tr]"
+#define OPTSTR_dmesg "WTf:l:wtrs#<1n#c[!Ttr]"
 #ifdef CLEANUP_dmesg
 #undef CLEANUP_dmesg
 #undef FOR_dmesg
@@ -532,6 +536,11 @@
 #undef FLAG_s
 #undef FLAG_r
 #undef FLAG_t
+#undef FLAG_w
+#undef FLAG_l
+#undef FLAG_f
+#undef FLAG_T
+#undef FLAG_W
 #endif
 
 // dos2unix    
@@ -814,9 +823,9 @@
 #undef FLAG_t
 #endif
 
-// grep ZzEFHabhinorsvwclqe*f*m#x[!wx][!EFw] ZzEFHabhinorsvwclqe*f*m#x[!wx][!EFw]
+// grep (unordered)ZzEFHabhinorsvwclqe*f*m#x[!wx][!EF] (unordered)ZzEFHabhinorsvwclqe*f*m#x[!wx][!EF]
 #undef OPTSTR_grep
-#define OPTSTR_grep "ZzEFHabhinorsvwclqe*f*m#x[!wx][!EFw]"
+#define OPTSTR_grep "(unordered)ZzEFHabhinorsvwclqe*f*m#x[!wx][!EF]"
 #ifdef CLEANUP_grep
 #undef CLEANUP_grep
 #undef FOR_grep
@@ -842,6 +851,7 @@
 #undef FLAG_E
 #undef FLAG_z
 #undef FLAG_Z
+#undef FLAG_unordered
 #endif
 
 // groupadd   <1>2g#<0S
@@ -1037,12 +1047,14 @@
 #undef FOR_init
 #endif
 
-// inotifyd <2 <2
+// inotifyd <2bw#<0 <2bw#<0
 #undef OPTSTR_inotifyd
-#define OPTSTR_inotifyd "<2"
+#define OPTSTR_inotifyd "<2bw#<0"
 #ifdef CLEANUP_inotifyd
 #undef CLEANUP_inotifyd
 #undef FOR_inotifyd
+#undef FLAG_w
+#undef FLAG_b
 #endif
 
 // insmod <1 <1
@@ -1212,7 +1224,7 @@
 #undef FOR_load_policy
 #endif
 
-// logger   st:p:
+// logger   f:st:p:
 #undef OPTSTR_logger
 #define OPTSTR_logger  0 
 #ifdef CLEANUP_logger
@@ -1221,6 +1233,7 @@
 #undef FLAG_p
 #undef FLAG_t
 #undef FLAG_s
+#undef FLAG_f
 #endif
 
 // login >1f:ph: >1f:ph:
@@ -1242,9 +1255,9 @@
 #undef FOR_logname
 #endif
 
-// losetup >2S(sizelimit)#s(show)ro#j:fdca[!afj] >2S(sizelimit)#s(show)ro#j:fdca[!afj]
+// losetup >2(direct-io)(sector-size)#<512>4096S(sizelimit)#s(show)ro#j:fdca[!afj] >2(direct-io)(sector-size)#<512>4096S(sizelimit)#s(show)ro#j:fdca[!afj]
 #undef OPTSTR_losetup
-#define OPTSTR_losetup ">2S(sizelimit)#s(show)ro#j:fdca[!afj]"
+#define OPTSTR_losetup ">2(direct-io)(sector-size)#<512>4096S(sizelimit)#s(show)ro#j:fdca[!afj]"
 #ifdef CLEANUP_losetup
 #undef CLEANUP_losetup
 #undef FOR_losetup
@@ -1259,11 +1272,13 @@
 #undef FLAG_s
 #undef FLAG_sizelimit
 #undef FLAG_S
+#undef FLAG_sector_size
+#undef FLAG_direct_io
 #endif
 
-// ls (color):;ZgoACFHLRSacdfhiklmnpqrstux1[-Cxm1][-Cxml][-Cxmo][-Cxmg][-cu][-ftS][-HL] (color):;ZgoACFHLRSacdfhiklmnpqrstux1[-Cxm1][-Cxml][-Cxmo][-Cxmg][-cu][-ftS][-HL]
+// ls (color):;ZgoACFHLRSUacdfhiklmnpqrstux1[-Cxm1][-Cxml][-Cxmo][-Cxmg][-cu][-ftSU][-HL] (color):;ZgoACFHLRSUacdfhiklmnpqrstux1[-Cxm1][-Cxml][-Cxmo][-Cxmg][-cu][-ftSU][-HL]
 #undef OPTSTR_ls
-#define OPTSTR_ls "(color):;ZgoACFHLRSacdfhiklmnpqrstux1[-Cxm1][-Cxml][-Cxmo][-Cxmg][-cu][-ftS][-HL]"
+#define OPTSTR_ls "(color):;ZgoACFHLRSUacdfhiklmnpqrstux1[-Cxm1][-Cxml][-Cxmo][-Cxmg][-cu][-ftSU][-HL]"
 #ifdef CLEANUP_ls
 #undef CLEANUP_ls
 #undef FOR_ls
@@ -1285,6 +1300,7 @@
 #undef FLAG_d
 #undef FLAG_c
 #undef FLAG_a
+#undef FLAG_U
 #undef FLAG_S
 #undef FLAG_R
 #undef FLAG_L
@@ -1360,22 +1376,25 @@
 #undef FLAG_d
 #endif
 
-// md5sum b b
+// md5sum (fail-fast)cb[!bc] (fail-fast)cb[!bc]
 #undef OPTSTR_md5sum
-#define OPTSTR_md5sum "b"
+#define OPTSTR_md5sum "(fail-fast)cb[!bc]"
 #ifdef CLEANUP_md5sum
 #undef CLEANUP_md5sum
 #undef FOR_md5sum
 #undef FLAG_b
+#undef FLAG_c
+#undef FLAG_fail_fast
 #endif
 
-// mdev   s
+// mdev   ms
 #undef OPTSTR_mdev
 #define OPTSTR_mdev  0 
 #ifdef CLEANUP_mdev
 #undef CLEANUP_mdev
 #undef FOR_mdev
 #undef FLAG_s
+#undef FLAG_m
 #endif
 
 // mix c:d:l#r# c:d:l#r#
@@ -1402,12 +1421,13 @@
 #undef FLAG_Z
 #endif
 
-// mke2fs   <1>2g:Fnqm#N#i#b#
+// mke2fs   <1>2g:Fnqm#N#i#b#E:
 #undef OPTSTR_mke2fs
 #define OPTSTR_mke2fs  0 
 #ifdef CLEANUP_mke2fs
 #undef CLEANUP_mke2fs
 #undef FOR_mke2fs
+#undef FLAG_E
 #undef FLAG_b
 #undef FLAG_i
 #undef FLAG_N
@@ -1548,19 +1568,21 @@
 #undef FLAG_v
 #endif
 
-// nbd_client <3>3ns <3>3ns
+// nbd_client <3>3N:C#<1>16ns <3>3N:C#<1>16ns
 #undef OPTSTR_nbd_client
-#define OPTSTR_nbd_client "<3>3ns"
+#define OPTSTR_nbd_client "<3>3N:C#<1>16ns"
 #ifdef CLEANUP_nbd_client
 #undef CLEANUP_nbd_client
 #undef FOR_nbd_client
 #undef FLAG_s
 #undef FLAG_n
+#undef FLAG_C
+#undef FLAG_N
 #endif
 
-// netcat ^tlLw#p#s:q#f: ^tlLw#p#s:q#f:
+// netcat ^tklLDI#O#w#p#s:q#f: ^tklLDI#O#w#p#s:q#f:
 #undef OPTSTR_netcat
-#define OPTSTR_netcat "^tlLw#p#s:q#f:"
+#define OPTSTR_netcat "^tklLDI#O#w#p#s:q#f:"
 #ifdef CLEANUP_netcat
 #undef CLEANUP_netcat
 #undef FOR_netcat
@@ -1569,8 +1591,12 @@
 #undef FLAG_s
 #undef FLAG_p
 #undef FLAG_w
+#undef FLAG_O
+#undef FLAG_I
+#undef FLAG_D
 #undef FLAG_L
 #undef FLAG_l
+#undef FLAG_k
 #undef FLAG_t
 #endif
 
@@ -1770,7 +1796,7 @@
 #undef FLAG_s
 #endif
 
-// ping   <1>1t#<0>255c#<0s#<0>65535I:W#<0w#<0q46[-46]
+// ping   <1i#<0=1000t#<0>255c#<0s#<0>65535I:W#<0=10w#<0q46[-46]
 #undef OPTSTR_ping
 #define OPTSTR_ping  0 
 #ifdef CLEANUP_ping
@@ -1785,6 +1811,7 @@
 #undef FLAG_s
 #undef FLAG_c
 #undef FLAG_t
+#undef FLAG_i
 #endif
 
 // pivot_root <2>2 <2>2
@@ -1823,13 +1850,14 @@
 #undef FOR_printf
 #endif
 
-// ps P(ppid)*aAdeflo*p(pid)*s*t*u*U*g*G*wZ[!ol][+Ae] P(ppid)*aAdeflo*p(pid)*s*t*u*U*g*G*wZ[!ol][+Ae]
+// ps P(ppid)*aAdeflo*p(pid)*s*t*u*U*g*G*wTZ[!ol][+Ae] P(ppid)*aAdeflo*p(pid)*s*t*u*U*g*G*wTZ[!ol][+Ae]
 #undef OPTSTR_ps
-#define OPTSTR_ps "P(ppid)*aAdeflo*p(pid)*s*t*u*U*g*G*wZ[!ol][+Ae]"
+#define OPTSTR_ps "P(ppid)*aAdeflo*p(pid)*s*t*u*U*g*G*wTZ[!ol][+Ae]"
 #ifdef CLEANUP_ps
 #undef CLEANUP_ps
 #undef FOR_ps
 #undef FLAG_Z
+#undef FLAG_T
 #undef FLAG_w
 #undef FLAG_G
 #undef FLAG_g
@@ -1869,12 +1897,14 @@
 #undef FLAG_a
 #endif
 
-// readahead    
+// readahead ml: ml:
 #undef OPTSTR_readahead
-#define OPTSTR_readahead  0 
+#define OPTSTR_readahead "ml:"
 #ifdef CLEANUP_readahead
 #undef CLEANUP_readahead
 #undef FOR_readahead
+#undef FLAG_l
+#undef FLAG_m
 #endif
 
 // readlink <1>1fenq[-fe] <1>1fenq[-fe]
@@ -2067,18 +2097,42 @@
 #undef FLAG_c
 #endif
 
-// sha1sum b b
+// sha1sum (fail-fast)cb[!bc] (fail-fast)cb[!bc]
 #undef OPTSTR_sha1sum
-#define OPTSTR_sha1sum "b"
+#define OPTSTR_sha1sum "(fail-fast)cb[!bc]"
 #ifdef CLEANUP_sha1sum
 #undef CLEANUP_sha1sum
 #undef FOR_sha1sum
 #undef FLAG_b
+#undef FLAG_c
+#undef FLAG_fail_fast
 #endif
 
-// shred <1zxus#<1n#<1o#<0f <1zxus#<1n#<1o#<0f
+// sha256sum (fail-fast)cb[!bc] (fail-fast)cb[!bc]
+#undef OPTSTR_sha256sum
+#define OPTSTR_sha256sum "(fail-fast)cb[!bc]"
+#ifdef CLEANUP_sha256sum
+#undef CLEANUP_sha256sum
+#undef FOR_sha256sum
+#undef FLAG_b
+#undef FLAG_c
+#undef FLAG_fail_fast
+#endif
+
+// sha512sum (fail-fast)cb[!bc] (fail-fast)cb[!bc]
+#undef OPTSTR_sha512sum
+#define OPTSTR_sha512sum "(fail-fast)cb[!bc]"
+#ifdef CLEANUP_sha512sum
+#undef CLEANUP_sha512sum
+#undef FOR_sha512sum
+#undef FLAG_b
+#undef FLAG_c
+#undef FLAG_fail_fast
+#endif
+
+// shred <1(discard)zxus#<1n#<1o#<0f <1(discard)zxus#<1n#<1o#<0f
 #undef OPTSTR_shred
-#define OPTSTR_shred "<1zxus#<1n#<1o#<0f"
+#define OPTSTR_shred "<1(discard)zxus#<1n#<1o#<0f"
 #ifdef CLEANUP_shred
 #undef CLEANUP_shred
 #undef FOR_shred
@@ -2089,6 +2143,7 @@
 #undef FLAG_u
 #undef FLAG_x
 #undef FLAG_z
+#undef FLAG_discard
 #endif
 
 // skeleton   (walrus)(blubber):;(also):e@d*c#b:a
@@ -2126,9 +2181,9 @@
 #undef FOR_sleep
 #endif
 
-// sort gS:T:mo:k*t:xbMcszdfirun gS:T:mo:k*t:xbMcszdfirun
+// sort (unique-unordered)(parallel)#<1gS:T:mo:k*t:xbMcszdfirun (unique-unordered)(parallel)#<1gS:T:mo:k*t:xbMcszdfirun
 #undef OPTSTR_sort
-#define OPTSTR_sort "gS:T:mo:k*t:xbMcszdfirun"
+#define OPTSTR_sort "(unique-unordered)(parallel)#<1gS:T:mo:k*t:xbMcszdfirun"
 #ifdef CLEANUP_sort
 #undef CLEANUP_sort
 #undef FOR_sort
@@ -2151,17 +2206,21 @@
 #undef FLAG_T
 #undef FLAG_S
 #undef FLAG_g
+#undef FLAG_parallel
+#undef FLAG_unique_unordered
 #endif
 
-// split >2a#<1=2>9b#<1l#<1 >2a#<1=2>9b#<1l#<1
+// split >2(parallel)a#<1=2>9b#<1l#<1n#<1 >2(parallel)a#<1=2>9b#<1l#<1n#<1
 #undef OPTSTR_split
-#define OPTSTR_split ">2a#<1=2>9b#<1l#<1"
+#define OPTSTR_split ">2(parallel)a#<1=2>9b#<1l#<1n#<1"
 #ifdef CLEANUP_split
 #undef CLEANUP_split
 #undef FOR_split
+#undef FLAG_n
 #undef FLAG_l
 #undef FLAG_b
 #undef FLAG_a
+#undef FLAG_parallel
 #endif
 
 // stat c:f c:f
@@ -2174,9 +2233,9 @@
 #undef FLAG_c
 #endif
 
-// strings an#=4<1fo an#=4<1fo
+// strings t:an#=4<1fo t:an#=4<1fo
 #undef OPTSTR_strings
-#define OPTSTR_strings "an#=4<1fo"
+#define OPTSTR_strings "t:an#=4<1fo"
 #ifdef CLEANUP_strings
 #undef CLEANUP_strings
 #undef FOR_strings
@@ -2184,6 +2243,7 @@
 #undef FLAG_f
 #undef FLAG_n
 #undef FLAG_a
+#undef FLAG_t
 #endif
 
 // su lmpc:s: lmpc:s:
@@ -2259,7 +2319,7 @@
 #undef FLAG_n
 #endif
 
-// syslogd   >0l#<1>8=8R:b#<0>99=1s#<0=200m#<0>71582787=20O:p:f:a:nSKLD
+// syslogd   >0WB#<1=256t#<0l#<1>8=8R:b#<0>99=1s#<0=200m#<0>71582787=20O:p:f:a:nSKLD
 #undef OPTSTR_syslogd
 #define OPTSTR_syslogd  0 
 #ifdef CLEANUP_syslogd
@@ -2279,6 +2339,9 @@
 #undef FLAG_b
 #undef FLAG_R
 #undef FLAG_l
+#undef FLAG_t
+#undef FLAG_B
+#undef FLAG_W
 #endif
 
 // tac    
@@ -2289,23 +2352,25 @@
 #undef FOR_tac
 #endif
 
-// tail ?fc-n-[-cn] ?fc-n-[-cn]
+// tail ?Ffc-n-[-cn] ?Ffc-n-[-cn]
 #undef OPTSTR_tail
-#define OPTSTR_tail "?fc-n-[-cn]"
+#define OPTSTR_tail "?Ffc-n-[-cn]"
 #ifdef CLEANUP_tail
 #undef CLEANUP_tail
 #undef FOR_tail
 #undef FLAG_n
 #undef FLAG_c
 #undef FLAG_f
+#undef FLAG_F
 #endif
 
-// tar   &(no-recursion)(numeric-owner)(no-same-permissions)(overwrite)(exclude)*(to-command):o(no-same-owner)p(same-permissions)k(keep-old)c(create)|h(dereference)x(extract)|t(list)|v(verbose)z(gzip)O(to-stdout)m(touch)X(exclude-from)*T(files-from)*C(directory):f(file):[!txc]
+// tar   &(index):(jobs)#<1>64(no-recursion)(numeric-owner)(no-same-permissions)(overwrite)(exclude)*(to-command):S(sparse)J(xz)j(bzip2)o(no-same-owner)p(same-permissions)k(keep-old)c(create)|h(dereference)x(extract)|t(list)|v(verbose)z(gzip)O(to-stdout)m(touch)X(exclude-from)*T(files-from)*C(directory):f(file):b#<1>2048=20[!txc]
 #undef OPTSTR_tar
 #define OPTSTR_tar  0 
 #ifdef CLEANUP_tar
 #undef CLEANUP_tar
 #undef FOR_tar
+#undef FLAG_b
 #undef FLAG_file
 #undef FLAG_f
 #undef FLAG_directory
@@ -2342,6 +2407,14 @@
 #undef FLAG_no_same_permissions
 #undef FLAG_numeric_owner
 #undef FLAG_no_recursion
+#undef FLAG_jobs
+#undef FLAG_index
+#undef FLAG_bzip2
+#undef FLAG_j
+#undef FLAG_xz
+#undef FLAG_J
+#undef FLAG_sparse
+#undef FLAG_S
 #endif
 
 // taskset <1^pa <1^pa
@@ -2424,7 +2497,7 @@
 #undef FLAG_i
 #endif
 
-// tftp   <1b#<8>65464r:l:g|p|[!gp]
+// tftp   <1w#<1>65535=1b#<8>65464=512r:l:g|p|[!gp]
 #undef OPTSTR_tftp
 #define OPTSTR_tftp  0 
 #ifdef CLEANUP_tftp
@@ -2435,9 +2508,10 @@
 #undef FLAG_l
 #undef FLAG_r
 #undef FLAG_b
+#undef FLAG_w
 #endif
 
-// tftpd   rcu:l
+// tftpd   rcDFm#<1=256p#<1>65535=69u:l
 #undef OPTSTR_tftpd
 #define OPTSTR_tftpd  0 
 #ifdef CLEANUP_tftpd
@@ -2445,17 +2519,23 @@
 #undef FOR_tftpd
 #undef FLAG_l
 #undef FLAG_u
+#undef FLAG_p
+#undef FLAG_m
+#undef FLAG_F
+#undef FLAG_D
 #undef FLAG_c
 #undef FLAG_r
 #endif
 
-// time <1^p <1^p
+// time <1^mvp <1^mvp
 #undef OPTSTR_time
-#define OPTSTR_time "<1^p"
+#define OPTSTR_time "<1^mvp"
 #ifdef CLEANUP_time
 #undef CLEANUP_time
 #undef FOR_time
 #undef FLAG_p
+#undef FLAG_v
+#undef FLAG_m
 #endif
 
 // timeout <2^vk:s:  <2^vk:s: 
@@ -2516,7 +2596,7 @@
 #undef FLAG_C
 #endif
 
-// traceroute   <1>2i:f#<1>255=1z#<0>86400=0g*w#<0>86400=5t#<0>255=0s:q#<1>255=3p#<1>65535=33434m#<1>255=30rvndlIUF64
+// traceroute   <1>2N#<1=16i:f#<1>255=1z#<0>86400=0g*w#<0>86400=5t#<0>255=0s:q#<1>255=3p#<1>65535=33434m#<1>255=30rvndlIUF64
 #undef OPTSTR_traceroute
 #define OPTSTR_traceroute  0 
 #ifdef CLEANUP_traceroute
@@ -2542,6 +2622,7 @@
 #undef FLAG_z
 #undef FLAG_f
 #undef FLAG_i
+#undef FLAG_N
 #endif
 
 // true    
@@ -2603,9 +2684,9 @@
 #undef FLAG_o
 #endif
 
-// uniq f#s#w#zicdu f#s#w#zicdu
+// uniq (unsorted)f#s#w#zicdu (unsorted)f#s#w#zicdu
 #undef OPTSTR_uniq
-#define OPTSTR_uniq "f#s#w#zicdu"
+#define OPTSTR_uniq "(unsorted)f#s#w#zicdu"
 #ifdef CLEANUP_uniq
 #undef CLEANUP_uniq
 #undef FOR_uniq
@@ -2617,6 +2698,7 @@
 #undef FLAG_w
 #undef FLAG_s
 #undef FLAG_f
+#undef FLAG_unsorted
 #endif
 
 // unix2dos    
@@ -2717,13 +2799,15 @@
 #undef FOR_vconfig
 #endif
 
-// vmstat >2n >2n
+// vmstat >2cjn[!cj] >2cjn[!cj]
 #undef OPTSTR_vmstat
-#define OPTSTR_vmstat ">2n"
+#define OPTSTR_vmstat ">2cjn[!cj]"
 #ifdef CLEANUP_vmstat
 #undef CLEANUP_vmstat
 #undef FOR_vmstat
 #undef FLAG_n
+#undef FLAG_j
+#undef FLAG_c
 #endif
 
 // w    
@@ -2734,7 +2818,7 @@
 #undef FOR_w
 #endif
 
-// watch   ^<1n#<0=2te
+// watch   ^<1n:te
 #undef OPTSTR_watch
 #define OPTSTR_watch  0 
 #ifdef CLEANUP_watch
@@ -2775,9 +2859,9 @@
 #undef FLAG_a
 #endif
 
-// xargs ^I:E:L#ptxrn#<1s#0 ^I:E:L#ptxrn#<1s#0
+// xargs ^P#<0I:E:L#ptxrn#<1s#0 ^P#<0I:E:L#ptxrn#<1s#0
 #undef OPTSTR_xargs
-#define OPTSTR_xargs "^I:E:L#ptxrn#<1s#0"
+#define OPTSTR_xargs "^P#<0I:E:L#ptxrn#<1s#0"
 #ifdef CLEANUP_xargs
 #undef CLEANUP_xargs
 #undef FOR_xargs
@@ -2791,25 +2875,31 @@
 #undef FLAG_L
 #undef FLAG_E
 #undef FLAG_I
+#undef FLAG_P
 #endif
 
-// xxd >1c#<1>4096=16l#g#<1=2 >1c#<1>4096=16l#g#<1=2
+// xxd >1c#<1>4096=16l#g#<1=2ipr >1c#<1>4096=16l#g#<1=2ipr
 #undef OPTSTR_xxd
-#define OPTSTR_xxd ">1c#<1>4096=16l#g#<1=2"
+#define OPTSTR_xxd ">1c#<1>4096=16l#g#<1=2ipr"
 #ifdef CLEANUP_xxd
 #undef CLEANUP_xxd
 #undef FOR_xxd
+#undef FLAG_r
+#undef FLAG_p
+#undef FLAG_i
 #undef FLAG_g
 #undef FLAG_l
 #undef FLAG_c
 #endif
 
-// xzcat    
+// xzcat (offset)#<0(length)#<0 (offset)#<0(length)#<0
 #undef OPTSTR_xzcat
-#define OPTSTR_xzcat  0 
+#define OPTSTR_xzcat "(offset)#<0(length)#<0"
 #ifdef CLEANUP_xzcat
 #undef CLEANUP_xzcat
 #undef FOR_xzcat
+#undef FLAG_length
+#undef FLAG_offset
 #endif
 
 // yes    
@@ -3091,7 +3181,9 @@
 #define FLAG_L (1<<12)
 #define FLAG_H (1<<13)
 #define FLAG_R (1<<14)
-#define FLAG_preserve (1<<15)
+#define FLAG_j (1<<15)
+#define FLAG_sparse (1<<16)
+#define FLAG_preserve (1<<17)
 #endif
 
 #ifdef FOR_cpio
@@ -3208,6 +3300,8 @@
 #define FLAG_F (FORCED_FLAG<<20)
 #define FLAG_H (FORCED_FLAG<<21)
 #define FLAG_V (FORCED_FLAG<<22)
+#define FLAG_l (FORCED_FLAG<<23)
+#define FLAG_no_wait_offer (FORCED_FLAG<<24)
 #endif
 
 #ifdef FOR_dhcpd
@@ -3274,6 +3368,11 @@
 #define FLAG_s (1<<2)
 #define FLAG_r (1<<3)
 #define FLAG_t (1<<4)
+#define FLAG_w (1<<5)
+#define FLAG_l (1<<6)
+#define FLAG_f (1<<7)
+#define FLAG_T (1<<8)
+#define FLAG_W (1<<9)
 #endif
 
 #ifdef FOR_dos2unix
@@ -3530,6 +3629,7 @@
 #define FLAG_E (1<<19)
 #define FLAG_z (1<<20)
 #define FLAG_Z (1<<21)
+#define FLAG_unordered (1<<22)
 #endif
 
 #ifdef FOR_groupadd
@@ -3695,6 +3795,8 @@
 #ifndef TT
 #define TT this.inotifyd
 #endif
+#define FLAG_w (1<<0)
+#define FLAG_b (1<<1)
 #endif
 
 #ifdef FOR_insmod
@@ -3841,6 +3943,7 @@
 #define FLAG_p (FORCED_FLAG<<0)
 #define FLAG_t (FORCED_FLAG<<1)
 #define FLAG_s (FORCED_FLAG<<2)
+#define FLAG_f (FORCED_FLAG<<3)
 #endif
 
 #ifdef FOR_login
@@ -3873,6 +3976,8 @@
 #define FLAG_s (1<<7)
 #define FLAG_sizelimit (1<<8)
 #define FLAG_S (1<<8)
+#define FLAG_sector_size (1<<9)
+#define FLAG_direct_io (1<<10)
 #endif
 
 #ifdef FOR_ls
@@ -3897,17 +4002,18 @@
 #define FLAG_d (1<<15)
 #define FLAG_c (1<<16)
 #define FLAG_a (1<<17)
-#define FLAG_S (1<<18)
-#define FLAG_R (1<<19)
-#define FLAG_L (1<<20)
-#define FLAG_H (1<<21)
-#define FLAG_F (1<<22)
-#define FLAG_C (1<<23)
-#define FLAG_A (1<<24)
-#define FLAG_o (1<<25)
-#define FLAG_g (1<<26)
-#define FLAG_Z (1<<27)
-#define FLAG_color (1<<28)
+#define FLAG_U (1<<18)
+#define FLAG_S (1<<19)
+#define FLAG_R (1<<20)
+#define FLAG_L (1<<21)
+#define FLAG_H (1<<22)
+#define FLAG_F (1<<23)
+#define FLAG_C (1<<24)
+#define FLAG_A (1<<25)
+#define FLAG_o (1<<26)
+#define FLAG_g (1<<27)
+#define FLAG_Z (1<<28)
+#define FLAG_color (1<<29)
 #endif
 
 #ifdef FOR_lsattr
@@ -3965,6 +4071,8 @@
 #define TT this.md5sum
 #endif
 #define FLAG_b (1<<0)
+#define FLAG_c (1<<1)
+#define FLAG_fail_fast (1<<2)
 #endif
 
 #ifdef FOR_mdev
@@ -3972,6 +4080,7 @@
 #define TT this.mdev
 #endif
 #define FLAG_s (FORCED_FLAG<<0)
+#define FLAG_m (FORCED_FLAG<<1)
 #endif
 
 #ifdef FOR_mix
@@ -3998,14 +4107,15 @@
 #ifndef TT
 #define TT this.mke2fs
 #endif
-#define FLAG_b (FORCED_FLAG<<0)
-#define FLAG_i (FORCED_FLAG<<1)
-#define FLAG_N (FORCED_FLAG<<2)
-#define FLAG_m (FORCED_FLAG<<3)
-#define FLAG_q (FORCED_FLAG<<4)
-#define FLAG_n (FORCED_FLAG<<5)
-#define FLAG_F (FORCED_FLAG<<6)
-#define FLAG_g (FORCED_FLAG<<7)
+#define FLAG_E (FORCED_FLAG<<0)
+#define FLAG_b (FORCED_FLAG<<1)
+#define FLAG_i (FORCED_FLAG<<2)
+#define FLAG_N (FORCED_FLAG<<3)
+#define FLAG_m (FORCED_FLAG<<4)
+#define FLAG_q (FORCED_FLAG<<5)
+#define FLAG_n (FORCED_FLAG<<6)
+#define FLAG_F (FORCED_FLAG<<7)
+#define FLAG_g (FORCED_FLAG<<8)
 #endif
 
 #ifdef FOR_mkfifo
@@ -4122,6 +4232,8 @@
 #endif
 #define FLAG_s (1<<0)
 #define FLAG_n (1<<1)
+#define FLAG_C (1<<2)
+#define FLAG_N (1<<3)
 #endif
 
 #ifdef FOR_netcat
@@ -4133,9 +4245,13 @@
 #define FLAG_s (1<<2)
 #define FLAG_p (1<<3)
 #define FLAG_w (1<<4)
-#define FLAG_L (1<<5)
-#define FLAG_l (1<<6)
-#define FLAG_t (1<<7)
+#define FLAG_O (1<<5)
+#define FLAG_I (1<<6)
+#define FLAG_D (1<<7)
+#define FLAG_L (1<<8)
+#define FLAG_l (1<<9)
+#define FLAG_k (1<<10)
+#define FLAG_t (1<<11)
 #endif
 
 #ifdef FOR_netstat
@@ -4317,6 +4433,7 @@
 #define FLAG_s (FORCED_FLAG<<6)
 #define FLAG_c (FORCED_FLAG<<7)
 #define FLAG_t (FORCED_FLAG<<8)
+#define FLAG_i (FORCED_FLAG<<9)
 #endif
 
 #ifdef FOR_pivot_root
@@ -4352,24 +4469,25 @@
 #define TT this.ps
 #endif
 #define FLAG_Z (1<<0)
-#define FLAG_w (1<<1)
-#define FLAG_G (1<<2)
-#define FLAG_g (1<<3)
-#define FLAG_U (1<<4)
-#define FLAG_u (1<<5)
-#define FLAG_t (1<<6)
-#define FLAG_s (1<<7)
-#define FLAG_pid (1<<8)
-#define FLAG_p (1<<8)
-#define FLAG_o (1<<9)
-#define FLAG_l (1<<10)
-#define FLAG_f (1<<11)
-#define FLAG_e (1<<12)
-#define FLAG_d (1<<13)
-#define FLAG_A (1<<14)
-#define FLAG_a (1<<15)
-#define FLAG_ppid (1<<16)
-#define FLAG_P (1<<16)
+#define FLAG_T (1<<1)
+#define FLAG_w (1<<2)
+#define FLAG_G (1<<3)
+#define FLAG_g (1<<4)
+#define FLAG_U (1<<5)
+#define FLAG_u (1<<6)
+#define FLAG_t (1<<7)
+#define FLAG_s (1<<8)
+#define FLAG_pid (1<<9)
+#define FLAG_p (1<<9)
+#define FLAG_o (1<<10)
+#define FLAG_l (1<<11)
+#define FLAG_f (1<<12)
+#define FLAG_e (1<<13)
+#define FLAG_d (1<<14)
+#define FLAG_A (1<<15)
+#define FLAG_a (1<<16)
+#define FLAG_ppid (1<<17)
+#define FLAG_P (1<<17)
 #endif
 
 #ifdef FOR_pwd
@@ -4391,6 +4509,8 @@
 #ifndef TT
 #define TT this.readahead
 #endif
+#define FLAG_l (1<<0)
+#define FLAG_m (1<<1)
 #endif
 
 #ifdef FOR_readlink
@@ -4550,6 +4670,26 @@
 #define TT this.sha1sum
 #endif
 #define FLAG_b (1<<0)
+#define FLAG_c (1<<1)
+#define FLAG_fail_fast (1<<2)
+#endif
+
+#ifdef FOR_sha256sum
+#ifndef TT
+#define TT this.sha256sum
+#endif
+#define FLAG_b (1<<0)
+#define FLAG_c (1<<1)
+#define FLAG_fail_fast (1<<2)
+#endif
+
+#ifdef FOR_sha512sum
+#ifndef TT
+#define TT this.sha512sum
+#endif
+#define FLAG_b (1<<0)
+#define FLAG_c (1<<1)
+#define FLAG_fail_fast (1<<2)
 #endif
 
 #ifdef FOR_shred
@@ -4563,6 +4703,7 @@
 #define FLAG_u (1<<4)
 #define FLAG_x (1<<5)
 #define FLAG_z (1<<6)
+#define FLAG_discard (1<<7)
 #endif
 
 #ifdef FOR_skeleton
@@ -4617,15 +4758,19 @@
 #define FLAG_T (1<<16)
 #define FLAG_S (1<<17)
 #define FLAG_g (1<<18)
+#define FLAG_parallel (1<<19)
+#define FLAG_unique_unordered (1<<20)
 #endif
 
 #ifdef FOR_split
 #ifndef TT
 #define TT this.split
 #endif
-#define FLAG_l (1<<0)
-#define FLAG_b (1<<1)
-#define FLAG_a (1<<2)
+#define FLAG_n (1<<0)
+#define FLAG_l (1<<1)
+#define FLAG_b (1<<2)
+#define FLAG_a (1<<3)
+#define FLAG_parallel (1<<4)
 #endif
 
 #ifdef FOR_stat
@@ -4644,6 +4789,7 @@
 #define FLAG_f (1<<1)
 #define FLAG_n (1<<2)
 #define FLAG_a (1<<3)
+#define FLAG_t (1<<4)
 #endif
 
 #ifdef FOR_su
@@ -4723,6 +4869,9 @@
 #define FLAG_b (FORCED_FLAG<<11)
 #define FLAG_R (FORCED_FLAG<<12)
 #define FLAG_l (FORCED_FLAG<<13)
+#define FLAG_t (FORCED_FLAG<<14)
+#define FLAG_B (FORCED_FLAG<<15)
+#define FLAG_W (FORCED_FLAG<<16)
 #endif
 
 #ifdef FOR_tac
@@ -4738,48 +4887,58 @@
 #define FLAG_n (1<<0)
 #define FLAG_c (1<<1)
 #define FLAG_f (1<<2)
+#define FLAG_F (1<<3)
 #endif
 
 #ifdef FOR_tar
 #ifndef TT
 #define TT this.tar
 #endif
-#define FLAG_file (FORCED_FLAG<<0)
-#define FLAG_f (FORCED_FLAG<<0)
-#define FLAG_directory (FORCED_FLAG<<1)
-#define FLAG_C (FORCED_FLAG<<1)
-#define FLAG_files_from (FORCED_FLAG<<2)
-#define FLAG_T (FORCED_FLAG<<2)
-#define FLAG_exclude_from (FORCED_FLAG<<3)
-#define FLAG_X (FORCED_FLAG<<3)
-#define FLAG_touch (FORCED_FLAG<<4)
-#define FLAG_m (FORCED_FLAG<<4)
-#define FLAG_to_stdout (FORCED_FLAG<<5)
-#define FLAG_O (FORCED_FLAG<<5)
-#define FLAG_gzip (FORCED_FLAG<<6)
-#define FLAG_z (FORCED_FLAG<<6)
-#define FLAG_verbose (FORCED_FLAG<<7)
-#define FLAG_v (FORCED_FLAG<<7)
-#define FLAG_list (FORCED_FLAG<<8)
-#define FLAG_t (FORCED_FLAG<<8)
-#define FLAG_extract (FORCED_FLAG<<9)
-#define FLAG_x (FORCED_FLAG<<9)
-#define FLAG_dereference (FORCED_FLAG<<10)
-#define FLAG_h (FORCED_FLAG<<10)
-#define FLAG_create (FORCED_FLAG<<11)
-#define FLAG_c (FORCED_FLAG<<11)
-#define FLAG_keep_old (FORCED_FLAG<<12)
-#define FLAG_k (FORCED_FLAG<<12)
-#define FLAG_same_permissions (FORCED_FLAG<<13)
-#define FLAG_p (FORCED_FLAG<<13)
-#define FLAG_no_same_owner (FORCED_FLAG<<14)
-#define FLAG_o (FORCED_FLAG<<14)
-#define FLAG_to_command (FORCED_FLAG<<15)
-#define FLAG_exclude (FORCED_FLAG<<16)
-#define FLAG_overwrite (FORCED_FLAG<<17)
-#define FLAG_no_same_permissions (FORCED_FLAG<<18)
-#define FLAG_numeric_owner (FORCED_FLAG<<19)
-#define FLAG_no_recursion (FORCED_FLAG<<20)
+#define FLAG_b (FORCED_FLAG<<0)
+#define FLAG_file (FORCED_FLAG<<1)
+#define FLAG_f (FORCED_FLAG<<1)
+#define FLAG_directory (FORCED_FLAG<<2)
+#define FLAG_C (FORCED_FLAG<<2)
+#define FLAG_files_from (FORCED_FLAG<<3)
+#define FLAG_T (FORCED_FLAG<<3)
+#define FLAG_exclude_from (FORCED_FLAG<<4)
+#define FLAG_X (FORCED_FLAG<<4)
+#define FLAG_touch (FORCED_FLAG<<5)
+#define FLAG_m (FORCED_FLAG<<5)
+#define FLAG_to_stdout (FORCED_FLAG<<6)
+#define FLAG_O (FORCED_FLAG<<6)
+#define FLAG_gzip (FORCED_FLAG<<7)
+#define FLAG_z (FORCED_FLAG<<7)
+#define FLAG_verbose (FORCED_FLAG<<8)
+#define FLAG_v (FORCED_FLAG<<8)
+#define FLAG_list (FORCED_FLAG<<9)
+#define FLAG_t (FORCED_FLAG<<9)
+#define FLAG_extract (FORCED_FLAG<<10)
+#define FLAG_x (FORCED_FLAG<<10)
+#define FLAG_dereference (FORCED_FLAG<<11)
+#define FLAG_h (FORCED_FLAG<<11)
+#define FLAG_create (FORCED_FLAG<<12)
+#define FLAG_c (FORCED_FLAG<<12)
+#define FLAG_keep_old (FORCED_FLAG<<13)
+#define FLAG_k (FORCED_FLAG<<13)
+#define FLAG_same_permissions (FORCED_FLAG<<14)
+#define FLAG_p (FORCED_FLAG<<14)
+#define FLAG_no_same_owner (FORCED_FLAG<<15)
+#define FLAG_o (FORCED_FLAG<<15)
+#define FLAG_bzip2 (FORCED_FLAG<<16)
+#define FLAG_j (FORCED_FLAG<<16)
+#define FLAG_xz (FORCED_FLAG<<17)
+#define FLAG_J (FORCED_FLAG<<17)
+#define FLAG_sparse (FORCED_FLAG<<18)
+#define FLAG_S (FORCED_FLAG<<18)
+#define FLAG_to_command (FORCED_FLAG<<19)
+#define FLAG_exclude (FORCED_FLAG<<20)
+#define FLAG_overwrite (FORCED_FLAG<<21)
+#define FLAG_no_same_permissions (FORCED_FLAG<<22)
+#define FLAG_numeric_owner (FORCED_FLAG<<23)
+#define FLAG_no_recursion (FORCED_FLAG<<24)
+#define FLAG_jobs (FORCED_FLAG<<25)
+#define FLAG_index (FORCED_FLAG<<26)
 #endif
 
 #ifdef FOR_taskset
@@ -4857,6 +5016,7 @@
 #define FLAG_l (FORCED_FLAG<<2)
 #define FLAG_r (FORCED_FLAG<<3)
 #define FLAG_b (FORCED_FLAG<<4)
+#define FLAG_w (FORCED_FLAG<<5)
 #endif
 
 #ifdef FOR_tftpd
@@ -4865,8 +5025,12 @@
 #endif
 #define FLAG_l (FORCED_FLAG<<0)
 #define FLAG_u (FORCED_FLAG<<1)
-#define FLAG_c (FORCED_FLAG<<2)
-#define FLAG_r (FORCED_FLAG<<3)
+#define FLAG_p (FORCED_FLAG<<2)
+#define FLAG_m (FORCED_FLAG<<3)
+#define FLAG_F (FORCED_FLAG<<4)
+#define FLAG_D (FORCED_FLAG<<5)
+#define FLAG_c (FORCED_FLAG<<6)
+#define FLAG_r (FORCED_FLAG<<7)
 #endif
 
 #ifdef FOR_time
@@ -4874,6 +5038,8 @@
 #define TT this.time
 #endif
 #define FLAG_p (1<<0)
+#define FLAG_v (1<<1)
+#define FLAG_m (1<<2)
 #endif
 
 #ifdef FOR_timeout
@@ -4948,6 +5114,7 @@
 #define FLAG_z (FORCED_FLAG<<17)
 #define FLAG_f (FORCED_FLAG<<18)
 #define FLAG_i (FORCED_FLAG<<19)
+#define FLAG_N (FORCED_FLAG<<20)
 #endif
 
 #ifdef FOR_true
@@ -5011,6 +5178,7 @@
 #define FLAG_w (1<<5)
 #define FLAG_s (1<<6)
 #define FLAG_f (1<<7)
+#define FLAG_unsorted (1<<8)
 #endif
 
 #ifdef FOR_unix2dos
@@ -5096,6 +5264,8 @@
 #define TT this.vmstat
 #endif
 #define FLAG_n (1<<0)
+#define FLAG_j (1<<1)
+#define FLAG_c (1<<2)
 #endif
 
 #ifdef FOR_w
@@ -5151,21 +5321,27 @@
 #define FLAG_L (1<<7)
 #define FLAG_E (1<<8)
 #define FLAG_I (1<<9)
+#define FLAG_P (1<<10)
 #endif
 
 #ifdef FOR_xxd
 #ifndef TT
 #define TT this.xxd
 #endif
-#define FLAG_g (1<<0)
-#define FLAG_l (1<<1)
-#define FLAG_c (1<<2)
+#define FLAG_r (1<<0)
+#define FLAG_p (1<<1)
+#define FLAG_i (1<<2)
+#define FLAG_g (1<<3)
+#define FLAG_l (1<<4)
+#define FLAG_c (1<<5)
 #endif
 
 #ifdef FOR_xzcat
 #ifndef TT
 #define TT this.xzcat
 #endif
+#define FLAG_length (1<<0)
+#define FLAG_offset (1<<1)
 #endif
 
 #ifdef FOR_yes
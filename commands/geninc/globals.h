@@ -36,6 +36,15 @@ struct skeleton_data {
 struct dmesg_data {
   long level;
   long size;
+  char *levels;
+  char *facs;
+
+  char *out;
+  unsigned lmask, fmask;
+  int outlen;
+  long long boot;
+  time_t last;
+  char when[32];
 };
 
 // toys/lsb/killall.c
@@ -52,13 +61,10 @@ struct killall_data {
 // toys/lsb/md5sum.c
 
 struct md5sum_data {
-  unsigned state[5];
-  unsigned oldstate[5];
-  uint64_t count;
-  union {
-    char c[64];
-    unsigned i[16];
-  } buffer;
+  void *type;
+  char *buf;
+  struct hash_job *jobs;
+  int count, bad, failed, unread;
 };
 
 // toys/lsb/mknod.c
@@ -103,6 +109,9 @@ struct pidof_data {
 struct seq_data {
   char *sep;
   char *fmt;
+
+  char *buf;
+  long len;
 };
 
 // toys/lsb/su.c
@@ -131,6 +140,8 @@ struct acpi_data {
 
 struct base64_data {
   long columns;
+
+  char *buf;
 };
 
 // toys/other/blockdev.c
@@ -139,6 +150,12 @@ struct blockdev_data {
   long bsz;
 };
 
+// toys/other/count.c
+
+struct count_data {
+  unsigned long long size;
+};
+
 // toys/other/dos2unix.c
 
 struct dos2unix_data {
@@ -161,10 +178,11 @@ struct free_data {
 // toys/other/hexedit.c
 
 struct hexedit_data {
-  char *data;
-  long long len, base;
-  int numlen, undo, undolen;
+  char *win;
+  long long len, base, winpos;
+  int numlen, undo, undolen, fd, winlen, dirtylen;
   unsigned height;
+  struct hexedit_page **dirty;
 };
 
 // toys/other/hwclock.c
@@ -181,6 +199,17 @@ struct ifconfig_data {
   int sockfd;
 };
 
+// toys/other/inotifyd.c
+
+struct inotifyd_data {
+  long w;
+
+  char *batch;
+  long len, size;
+  struct inotifyd_seen *seen;
+  long used, slots;
+};
+
 // toys/other/ionice.c
 
 struct ionice_data {
@@ -204,19 +233,26 @@ struct losetup_data {
   char *jfile;
   long offset;
   long size;
+  long sector_size;
 
   int openflags;
   dev_t jdev;
   ino_t jino;
 };
 
+// toys/other/lsusb.c
+
+struct lsusb_data {
+  struct hwids *ids;
+};
+
 // toys/other/lspci.c
 
 struct lspci_data {
   char *ids;
   long numeric;
 
-  FILE *db;
+  struct hwids *db;
 };
 
 // toys/other/makedevs.c
@@ -252,6 +288,13 @@ struct modinfo_data {
   long mod;
 };
 
+// toys/other/nbd_client.c
+
+struct nbd_client_data {
+  long C;
+  char *N;
+};
+
 // toys/other/netcat.c
 
 struct netcat_data {
@@ -260,6 +303,10 @@ struct netcat_data {
   char *source_address;  // -s Bind to a specific source address.
   long port;             // -p Bind to a specific source port.
   long wait;             // -w Wait # seconds for a connection.
+  long sndbuf;           // -O Socket send buffer size.
+  long rcvbuf;           // -I Socket receive buffer size.
+
+  int pipefd[2];
 };
 
 // toys/other/nsenter.c
@@ -275,6 +322,15 @@ struct oneit_data {
   char *console;
 };
 
+// toys/other/readahead.c
+
+struct readahead_data {
+  char *l;
+
+  struct readahead_req *reqs;
+  long count;
+};
+
 // toys/other/shred.c
 
 struct shred_data {
@@ -282,7 +338,8 @@ struct shred_data {
   long iterations;
   long size;
 
-  int ufd;
+  char *buf;
+  unsigned chacha[16];
 };
 
 // toys/other/stat.c
@@ -296,8 +353,8 @@ struct stat_data {
     struct statfs sf;
 #endif
   } stat;
-  struct passwd *user_name;
-  struct group *group_name;
+  char *user_name;
+  char *group_name;
 };
 
 // toys/other/swapon.c
@@ -314,6 +371,16 @@ struct switch_root_data {
   dev_t rootdev;
 };
 
+// toys/other/sysctl.c
+
+struct sysctl_data {
+  int root, ndirs, count;
+  struct sysctl_dir *dirs[256];
+  struct sysctl_job *jobs;
+  char *file;
+  long line;
+};
+
 // toys/other/timeout.c
 
 struct timeout_data {
@@ -341,6 +408,9 @@ struct xxd_data {
   long g;
   long l;
   long c;
+
+  char *obuf;
+  long olen;
 };
 
 // toys/pending/arp.c
@@ -353,6 +423,8 @@ struct arp_data {
     
     int sockfd;
     char *device;
+    char *host_ip;
+    int entries, disp;
 };
 
 // toys/pending/arping.c
@@ -378,6 +450,12 @@ struct bootchartd_data {
   int is_login;
 
   void *head;
+  char *ring, *scratch;
+  long ring_size, used, scratch_len;
+  struct bootchart_src *src;
+  int ring_mode, nsrc, dead, *live, *pids, nlive, pidmax, stat_fd, disk_fd,
+      up_fd;
+  DIR *proc;
 };
 
 // toys/pending/brctl.c
@@ -400,11 +478,14 @@ struct compress_data {
 
   // Compressed data buffer
   char *data;
-  unsigned pos, len;
+  unsigned pos, len, flushed;
   int infd, outfd;
 
-  // Tables only used for deflation
-  unsigned short *hashhead, *hashchain;
+  // Tables only used for deflation: fixed huffman codes (bit reversed) and
+  // their lengths for literal/length then distance symbols, and which
+  // symbol each length and distance (see deflate_dist()) uses.
+  unsigned short fixcode[288+30];
+  char fixlen[288+30], lencode[259], distcode[512];
 };
 
 // toys/pending/crond.c
@@ -417,6 +498,8 @@ struct crond_data {
 
   time_t crontabs_dir_mtime;
   uint8_t flagd;
+  struct _job **heap, **run;
+  int heaplen, heapsize, nrun, runsize, sigpipe[2], ifd, tfd;
 };
 
 // toys/pending/crontab.c
@@ -447,6 +530,7 @@ struct dhcp_data {
     char *fdn_name;
     char *hostname;
     char *vendor_cls;
+    char *lease_file;
 };
 
 // toys/pending/dhcpd.c
@@ -465,6 +549,7 @@ struct diff_data {
 
   int dir_num, size, is_binary, status, change, len[2];
   int *offset[2];
+  char *same;
 };
 
 // toys/pending/dumpleases.c
@@ -497,7 +582,7 @@ struct fold_data {
 // toys/pending/fsck.c
 
 struct fsck_data {
-  int fd_num;
+  long fd_num;
   char *t_list;
 
   struct double_list *devices;
@@ -520,6 +605,9 @@ struct ftpget_data {
   FILE *sockfp;
   int c;
   int isget;
+  int datafd;
+  long long size, offset, done;
+  unsigned long long start, shown;
 #ifndef __rtems__
   char buf[sizeof(struct sockaddr_storage)];
 #endif
@@ -560,6 +648,8 @@ struct iconv_data {
   char *to;
 
   void *ic;
+  char *buf;
+  int in, out;
 };
 
 // toys/pending/ip.c
@@ -568,6 +658,9 @@ struct ip_data {
   char stats, singleline, flush, *filter_dev, gbuf[8192];
   int sockfd, connected, from_ok, route_cmd;
   int8_t addressfamily, is_addr;
+  char *batch, force, failed;
+  unsigned seq, pending;
+  long lineno, *lines;
 };
 
 // toys/pending/ipcrm.c
@@ -600,7 +693,8 @@ struct klogd_data {
 struct last_data {
   char *file;
 
-  struct arg_list *list;
+  struct utmpx **seen;
+  unsigned long seen_size, seen_used;
 };
 
 // toys/pending/logger.c
@@ -608,6 +702,10 @@ struct last_data {
 struct logger_data {
   char *priority_arg;
   char *ident;
+  char *file;
+
+  int fd, pri, count, len[64];
+  char *batch, stamp[16];
 };
 
 // toys/pending/lsof.c
@@ -620,12 +718,25 @@ struct lsof_data {
   struct double_list *files;
   int last_shown_pid;
   int shown_header;
+  struct inodeset sockets;
+  int sockets_read;
+};
+
+// toys/pending/mdev.c
+
+struct mdev_data {
+  char *conf;
+  long conflen;
+
+  struct mdev_dev *devs;
+  long count;
 };
 
 // toys/pending/mke2fs.c
 
 struct mke2fs_data {
   // Command line arguments.
+  char *extended;
   long blocksize;
   long bytes_per_inode;
   long inodes;           // Total inodes in filesystem.
@@ -648,6 +759,12 @@ struct mke2fs_data {
   unsigned nextgroup;    // Next group we'll be allocating from
   int fsfd;              // File descriptor of filesystem (to output to).
 
+  // Output
+  char *buf;             // Writes waiting to go out, MKE2FS_BUF at most
+  unsigned buflen;
+  off_t pos, size;       // Where buf goes, and the old length of a file
+  int isblk, isreg, lazy, discard;
+
   struct ext2_superblock sb;
 };
 
@@ -700,8 +817,11 @@ struct ping_data {
   long size;
   long count;
   long ttl;
+  long interval;
 
-  int sock;
+  int sock, family, ident, hashsize, ntargets;
+  struct ping_target *targets, **hash;
+  char *packet, *rpkt;
 };
 
 // toys/pending/route.c
@@ -735,24 +855,38 @@ struct syslogd_data {
   long rot_count;
   char *remote_log;
   long log_prio;
+  long flush_ms;
+  long queue_kb;
 
   struct unsocks *lsocks;  // list of listen sockets
   struct logfile *lfiles;  // list of write logfiles
   int sigfd[2];
+  char *hostname, *arena, *batch, stamp[26];
+  long arena_len;
+  time_t stamp_time;
+  struct logfile **routes;
+  unsigned *route;
 };
 
 // toys/pending/tar.c
 
 struct tar_data {
+  long blocks;
   char *fname;
   char *dir;
   struct arg_list *inc_file;
   struct arg_list *exc_file;
   char *tocmd;
   struct arg_list *exc;
+  long jobs;
+  char *index;
 
   struct arg_list *inc, *pass;
-  void *inodes, *handle;
+  struct inodeset inodes;
+  struct double_list *idx;
+  void *handle, *pool, *dirs, *codec;
+  char *zargv[3];
+  pid_t codec_pid;
 };
 
 // toys/pending/tcpsvd.c
@@ -767,6 +901,11 @@ struct tcpsvd_data {
   int maxc;
   int count_all;
   int udp;
+  int hashsize;
+  int seq;
+  int notify[2];
+  struct tcpsvd_peer **peers, *free_peers;
+  struct tcpsvd_conn **conns, *free_conns;
 };
 
 // toys/pending/telnet.c
@@ -797,8 +936,9 @@ struct telnetd_data {
     char *host_addr;
     long w_sec;
 
-    int gmax_fd;
     pid_t fork_pid;
+    int sessions, pfdsize, sigpipe[2];
+    struct pollfd *pfd;
 };
 
 // toys/pending/tftp.c
@@ -807,6 +947,7 @@ struct tftp_data {
   char *local_file;
   char *remote_file;
   long block_size;
+  long window_size;
 
 #ifndef __rtems__
   struct sockaddr_storage inaddr;
@@ -818,9 +959,14 @@ struct tftp_data {
 
 struct tftpd_data {
   char *user;
+  long port;
+  long max;
 
-  long sfd;
   struct passwd *pw;
+  struct tftpd_xfer *xfers;
+  struct tftpd_map *maps;
+  char *rpkt;
+  int count;
 };
 
 // toys/pending/top.c
@@ -843,7 +989,9 @@ struct top_data {
 // toys/pending/tr.c
 
 struct tr_data {
-  short map[256]; //map of chars
+  // low byte is what a char translates to, 0x100 deletes it, 0x200 means
+  // runs of this char get squeezed when it's output
+  short map[256];
   int len1, len2;
 };
 
@@ -860,6 +1008,7 @@ struct traceroute_data {
   long pause_time;
   long first_ttl;
   char *iface;
+  long squeries;
 
   uint32_t gw_list[9];
   int recv_sock;
@@ -885,7 +1034,19 @@ struct useradd_data {
 // toys/pending/watch.c
 
 struct watch_data {
-  int interval;
+  char *interval;
+
+  char **screen;
+  unsigned rows, cols;
+};
+
+// toys/pending/xzcat.c
+
+struct xzcat_data {
+  long length;
+  long offset;
+
+  long long pos, end;
 };
 
 // toys/posix/chgrp.c
@@ -903,12 +1064,6 @@ struct chmod_data {
   char *mode;
 };
 
-// toys/posix/cksum.c
-
-struct cksum_data {
-  unsigned crc_table[256];
-};
-
 // toys/posix/cmp.c
 
 struct cmp_data {
@@ -927,6 +1082,8 @@ struct cp_data {
       char *mode;
     } i;
     struct {
+      long jobs;
+      char *sparse;
       char *preserve;
     } c;
   };
@@ -936,7 +1093,9 @@ struct cp_data {
   int (*callback)(struct dirtree *try);
   uid_t uid;
   gid_t gid;
-  int pflags;
+  int pflags, holes;
+  struct inodeset links;
+  void *pool;
 };
 
 // toys/posix/cpio.c
@@ -945,6 +1104,13 @@ struct cpio_data {
   char *archive;
   char *pass;
   char *fmt;
+
+  struct inodeset links;
+  char *buf;
+  long pos, len;
+  int afd, eof;
+  struct cpio_file *ahead;
+  struct cpio_link *pending, **tail;
 };
 
 // toys/posix/cut.c
@@ -957,7 +1123,9 @@ struct cut_data {
 
   void *slist_head;
   unsigned nelem;
-  void (*do_cut)(int fd);
+  int *ranges, nranges, tty;
+  char *obuf;
+  long olen;
 };
 
 // toys/posix/date.c
@@ -986,9 +1154,9 @@ struct df_data {
 struct du_data {
   long maxdepth;
 
-  long depth, total;
+  long total;
   dev_t st_dev;
-  void *inodes;
+  struct inodeset inodes;
 };
 
 // toys/posix/expand.c
@@ -1004,8 +1172,9 @@ struct expand_data {
 struct find_data {
   char **filter;
   struct double_list *argdata;
-  int topdir, xdev, depth, envsize;
+  int topdir, xdev, depth, envsize, print;
   time_t now;
+  void *expr;
 };
 
 // toys/posix/grep.c
@@ -1014,6 +1183,15 @@ struct grep_data {
   long m;
   struct arg_list *f;
   struct arg_list *e;
+
+  struct fixed *fixed;
+  char *regex;
+  FILE *out, *sink;
+  char *buf;
+  long size;
+  int binary, *stop;
+  struct grep_pool *pool;
+  struct grep_job *job;
 };
 
 // toys/posix/head.c
@@ -1044,7 +1222,7 @@ struct ls_data {
   struct dirtree *files, *singledir;
 
   unsigned screen_width;
-  int nl_title;
+  int nl_title, stream;
   char uid_buf[12], gid_buf[12];
 };
 
@@ -1082,6 +1260,8 @@ struct nl_data {
 
   // Count of consecutive blank lines for -l has to persist between files
   long lcount;
+  struct ascii_count count;
+  char clip;
 };
 
 // toys/posix/od.c
@@ -1115,7 +1295,9 @@ struct patch_data {
   long oldline, oldlen, newline, newlen;
   long linenum;
   int context, state, filein, fileout, filepatch, hunknum;
-  char *tempname;
+  char *tempname, *obuf;
+  long olen;
+  struct linebuf lb;
 };
 
 // toys/posix/ps.c
@@ -1135,7 +1317,7 @@ struct ps_data {
   unsigned width;
   dev_t tty;
   void *fields;
-  long bits;
+  long long bits;
   long long ticks;
   size_t header_len;
 };
@@ -1155,10 +1337,10 @@ struct sed_data {
   // processed pattern list
   struct double_list *pattern;
 
-  char *nextline, *remember;
+  char *nextline, *remember, *spare[2], *obuf;
   void *restart, *lastregex;
-  long nextlen, rememberlen, count;
-  int fdout, noeol;
+  long nextlen, rememberlen, count, sparesize[2], olen;
+  int fdout, noeol, ofd;
   unsigned xx;
 };
 
@@ -1168,16 +1350,20 @@ struct sort_data {
   char *key_separator;
   struct arg_list *raw_keys;
   char *outfile;
-  char *ignore1, ignore2;   // GNU compatability NOPs for -S and -T.
+  char *tmpdir, *bufsize;
+  long parallel;
 
-  void *key_list;
-  int linecount;
-  char **lines;
+  void *key_list, **lines, *last, **hash;
+  int nkeys, linecount, linemax, outfd, nruns, levelfd[16];
+  struct sort_run *runs;
+  long size, used, outlen, hashmask, hashcount;
+  char end;
 };
 
 // toys/posix/split.c
 
 struct split_data {
+  long number;
   long lines;
   long bytes;
   long suflen;
@@ -1189,6 +1375,9 @@ struct split_data {
 
 struct strings_data {
   long num;
+  char *t;
+
+  char *fmt;
 };
 
 // toys/posix/tail.c
@@ -1197,7 +1386,9 @@ struct tail_data {
   long lines;
   long bytes;
 
-  int file_no;
+  int file_no, ffd, nfiles, last;
+  struct tail_file *files;
+  char *buf;
 };
 
 // toys/posix/tee.c
@@ -1221,6 +1412,10 @@ struct uniq_data {
   long nchars;
   long nfields;
   long repeats;
+
+  void *seen;
+  unsigned *slot;
+  long nseen, size;
 };
 
 // toys/posix/uudecode.c
@@ -1233,6 +1428,7 @@ struct uudecode_data {
 
 struct wc_data {
   unsigned long totals[3];
+  char *buf;
 };
 
 // toys/posix/xargs.c
@@ -1243,12 +1439,15 @@ struct xargs_data {
   long L;
   char *eofstr;
   char *I;
+  long P;
 
   long entries, bytes;
   char delim;
+  int stop;
+  void *jobs, *pfd;
 };
 
-extern union global_union {
+union global_union {
 	struct getprop_data getprop;
 	struct hello_data hello;
 	struct skeleton_data skeleton;
@@ -1266,27 +1465,33 @@ extern union global_union {
 	struct acpi_data acpi;
 	struct base64_data base64;
 	struct blockdev_data blockdev;
+	struct count_data count;
 	struct dos2unix_data dos2unix;
 	struct fallocate_data fallocate;
 	struct free_data free;
 	struct hexedit_data hexedit;
 	struct hwclock_data hwclock;
 	struct ifconfig_data ifconfig;
+	struct inotifyd_data inotifyd;
 	struct ionice_data ionice;
 	struct login_data login;
 	struct losetup_data losetup;
 	struct lspci_data lspci;
+	struct lsusb_data lsusb;
 	struct makedevs_data makedevs;
 	struct mix_data mix;
 	struct mkpasswd_data mkpasswd;
 	struct modinfo_data modinfo;
+	struct nbd_client_data nbd_client;
 	struct netcat_data netcat;
 	struct nsenter_data nsenter;
 	struct oneit_data oneit;
+	struct readahead_data readahead;
 	struct shred_data shred;
 	struct stat_data stat;
 	struct swapon_data swapon;
 	struct switch_root_data switch_root;
+	struct sysctl_data sysctl;
 	struct timeout_data timeout;
 	struct truncate_data truncate;
 	struct xxd_data xxd;
@@ -1318,6 +1523,7 @@ extern union global_union {
 	struct last_data last;
 	struct logger_data logger;
 	struct lsof_data lsof;
+	struct mdev_data mdev;
 	struct mke2fs_data mke2fs;
 	struct modprobe_data modprobe;
 	struct more_data more;
@@ -1340,9 +1546,9 @@ extern union global_union {
 	struct traceroute_data traceroute;
 	struct useradd_data useradd;
 	struct watch_data watch;
+	struct xzcat_data xzcat;
 	struct chgrp_data chgrp;
 	struct chmod_data chmod;
-	struct cksum_data cksum;
 	struct cmp_data cmp;
 	struct cp_data cp;
 	struct cpio_data cpio;
@@ -1377,4 +1583,4 @@ extern union global_union {
 	struct uudecode_data uudecode;
 	struct wc_data wc;
 	struct xargs_data xargs;
-} this;
+};
@@ -0,0 +1,389 @@
+// Perfect hash of the command names in newtoys.h, for toy_find(). Generated
+// along with newtoys.h (entry 0 is left out like toy_find() always has).
+
+#define TOYHASH_BUCKETS 64
+#define TOYHASH_SLOTS 256
+
+// How many enabled commands come before each newtoys.h entry
+enum {
+  TOYHASH_0 = 0,
+  TOYHASH_1 = TOYHASH_0 USE_SH(+1),
+  TOYHASH_2 = TOYHASH_1 USE_SH(+1),
+  TOYHASH_3 = TOYHASH_2 USE_TRUE(+1),
+  TOYHASH_4 = TOYHASH_3 USE_ACPI(+1),
+  TOYHASH_5 = TOYHASH_4 USE_GROUPADD(+1),
+  TOYHASH_6 = TOYHASH_5 USE_USERADD(+1),
+  TOYHASH_7 = TOYHASH_6 USE_ARP(+1),
+  TOYHASH_8 = TOYHASH_7 USE_ARPING(+1),
+  TOYHASH_9 = TOYHASH_8 USE_BASE64(+1),
+  TOYHASH_10 = TOYHASH_9 USE_BASENAME(+1),
+  TOYHASH_11 = TOYHASH_10 USE_BLKID(+1),
+  TOYHASH_12 = TOYHASH_11 USE_BOOTCHARTD(+1),
+  TOYHASH_13 = TOYHASH_12 USE_BRCTL(+1),
+  TOYHASH_14 = TOYHASH_13 USE_BUNZIP2(+1),
+  TOYHASH_15 = TOYHASH_14 USE_BZCAT(+1),
+  TOYHASH_16 = TOYHASH_15 USE_CAL(+1),
+  TOYHASH_17 = TOYHASH_16 USE_CAT(+1),
+  TOYHASH_18 = TOYHASH_17 USE_CATV(+1),
+  TOYHASH_19 = TOYHASH_18 USE_SH(+1),
+  TOYHASH_20 = TOYHASH_19 USE_CHCON(+1),
+  TOYHASH_21 = TOYHASH_20 USE_CHGRP(+1),
+  TOYHASH_22 = TOYHASH_21 USE_CHMOD(+1),
+  TOYHASH_23 = TOYHASH_22 USE_CHOWN(+1),
+  TOYHASH_24 = TOYHASH_23 USE_CHROOT(+1),
+  TOYHASH_25 = TOYHASH_24 USE_CHVT(+1),
+  TOYHASH_26 = TOYHASH_25 USE_CKSUM(+1),
+  TOYHASH_27 = TOYHASH_26 USE_CLEAR(+1),
+  TOYHASH_28 = TOYHASH_27 USE_CMP(+1),
+  TOYHASH_29 = TOYHASH_28 USE_COMM(+1),
+  TOYHASH_30 = TOYHASH_29 USE_COMPRESS(+1),
+  TOYHASH_31 = TOYHASH_30 USE_COUNT(+1),
+  TOYHASH_32 = TOYHASH_31 USE_CP(+1),
+  TOYHASH_33 = TOYHASH_32 USE_CPIO(+1),
+  TOYHASH_34 = TOYHASH_33 USE_CROND(+1),
+  TOYHASH_35 = TOYHASH_34 USE_CRONTAB(+1),
+  TOYHASH_36 = TOYHASH_35 USE_CUT(+1),
+  TOYHASH_37 = TOYHASH_36 USE_DD(+1),
+  TOYHASH_38 = TOYHASH_37 USE_DEALLOCVT(+1),
+  TOYHASH_39 = TOYHASH_38 USE_GROUPDEL(+1),
+  TOYHASH_40 = TOYHASH_39 USE_USERDEL(+1),
+  TOYHASH_41 = TOYHASH_40 USE_DHCP(+1),
+  TOYHASH_42 = TOYHASH_41 USE_DHCPD(+1),
+  TOYHASH_43 = TOYHASH_42 USE_DIFF(+1),
+  TOYHASH_44 = TOYHASH_43 USE_DIRNAME(+1),
+  TOYHASH_45 = TOYHASH_44 USE_DOS2UNIX(+1),
+  TOYHASH_46 = TOYHASH_45 USE_DU(+1),
+  TOYHASH_47 = TOYHASH_46 USE_DUMPLEASES(+1),
+  TOYHASH_48 = TOYHASH_47 USE_ECHO(+1),
+  TOYHASH_49 = TOYHASH_48 USE_EGREP(+1),
+  TOYHASH_50 = TOYHASH_49 USE_SH(+1),
+  TOYHASH_51 = TOYHASH_50 USE_EXPAND(+1),
+  TOYHASH_52 = TOYHASH_51 USE_EXPR(+1),
+  TOYHASH_53 = TOYHASH_52 USE_FACTOR(+1),
+  TOYHASH_54 = TOYHASH_53 USE_FALSE(+1),
+  TOYHASH_55 = TOYHASH_54 USE_FDISK(+1),
+  TOYHASH_56 = TOYHASH_55 USE_FGREP(+1),
+  TOYHASH_57 = TOYHASH_56 USE_FIND(+1),
+  TOYHASH_58 = TOYHASH_57 USE_FOLD(+1),
+  TOYHASH_59 = TOYHASH_58 USE_FSCK(+1),
+  TOYHASH_60 = TOYHASH_59 USE_FSTYPE(+1),
+  TOYHASH_61 = TOYHASH_60 USE_FSYNC(+1),
+  TOYHASH_62 = TOYHASH_61 USE_FTPGET(+1),
+  TOYHASH_63 = TOYHASH_62 USE_FTPGET(+1),
+  TOYHASH_64 = TOYHASH_63 USE_GETENFORCE(+1),
+  TOYHASH_65 = TOYHASH_64 USE_GETPROP(+1),
+  TOYHASH_66 = TOYHASH_65 USE_GETTY(+1),
+  TOYHASH_67 = TOYHASH_66 USE_GREP(+1),
+  TOYHASH_68 = TOYHASH_67 USE_GROUPADD(+1),
+  TOYHASH_69 = TOYHASH_68 USE_GROUPDEL(+1),
+  TOYHASH_70 = TOYHASH_69 USE_GUNZIP(+1),
+  TOYHASH_71 = TOYHASH_70 USE_GZIP(+1),
+  TOYHASH_72 = TOYHASH_71 USE_HEAD(+1),
+  TOYHASH_73 = TOYHASH_72 USE_HELLO(+1),
+  TOYHASH_74 = TOYHASH_73 USE_HELP(+1),
+  TOYHASH_75 = TOYHASH_74 USE_HEXEDIT(+1),
+  TOYHASH_76 = TOYHASH_75 USE_HOST(+1),
+  TOYHASH_77 = TOYHASH_76 USE_ICONV(+1),
+  TOYHASH_78 = TOYHASH_77 USE_INIT(+1),
+  TOYHASH_79 = TOYHASH_78 USE_INSTALL(+1),
+  TOYHASH_80 = TOYHASH_79 USE_IP(+1),
+  TOYHASH_81 = TOYHASH_80 USE_IP(+1),
+  TOYHASH_82 = TOYHASH_81 USE_IPCRM(+1),
+  TOYHASH_83 = TOYHASH_82 USE_IPCS(+1),
+  TOYHASH_84 = TOYHASH_83 USE_IP(+1),
+  TOYHASH_85 = TOYHASH_84 USE_IP(+1),
+  TOYHASH_86 = TOYHASH_85 USE_IP(+1),
+  TOYHASH_87 = TOYHASH_86 USE_IP(+1),
+  TOYHASH_88 = TOYHASH_87 USE_KLOGD(+1),
+  TOYHASH_89 = TOYHASH_88 USE_LAST(+1),
+  TOYHASH_90 = TOYHASH_89 USE_LINK(+1),
+  TOYHASH_91 = TOYHASH_90 USE_LN(+1),
+  TOYHASH_92 = TOYHASH_91 USE_LOAD_POLICY(+1),
+  TOYHASH_93 = TOYHASH_92 USE_LOGGER(+1),
+  TOYHASH_94 = TOYHASH_93 USE_LS(+1),
+  TOYHASH_95 = TOYHASH_94 USE_LSOF(+1),
+  TOYHASH_96 = TOYHASH_95 USE_MDEV(+1),
+  TOYHASH_97 = TOYHASH_96 USE_MKDIR(+1),
+  TOYHASH_98 = TOYHASH_97 USE_MKE2FS(+1),
+  TOYHASH_99 = TOYHASH_98 USE_MKFIFO(+1),
+  TOYHASH_100 = TOYHASH_99 USE_MODPROBE(+1),
+  TOYHASH_101 = TOYHASH_100 USE_MORE(+1),
+  TOYHASH_102 = TOYHASH_101 USE_MV(+1),
+  TOYHASH_103 = TOYHASH_102 USE_NETSTAT(+1),
+  TOYHASH_104 = TOYHASH_103 USE_NL(+1),
+  TOYHASH_105 = TOYHASH_104 USE_NOHUP(+1),
+  TOYHASH_106 = TOYHASH_105 USE_OD(+1),
+  TOYHASH_107 = TOYHASH_106 USE_OPENVT(+1),
+  TOYHASH_108 = TOYHASH_107 USE_PASTE(+1),
+  TOYHASH_109 = TOYHASH_108 USE_PATCH(+1),
+  TOYHASH_110 = TOYHASH_109 USE_PGREP(+1),
+  TOYHASH_111 = TOYHASH_110 USE_PING(+1),
+  TOYHASH_112 = TOYHASH_111 USE_PGREP(+1),
+  TOYHASH_113 = TOYHASH_112 USE_PRINTENV(+1),
+  TOYHASH_114 = TOYHASH_113 USE_PRINTF(+1),
+  TOYHASH_115 = TOYHASH_114 USE_PS(+1),
+  TOYHASH_116 = TOYHASH_115 USE_PWD(+1),
+  TOYHASH_117 = TOYHASH_116 USE_PWDX(+1),
+  TOYHASH_118 = TOYHASH_117 USE_READLINK(+1),
+  TOYHASH_119 = TOYHASH_118 USE_REALPATH(+1),
+  TOYHASH_120 = TOYHASH_119 USE_RESTORECON(+1),
+  TOYHASH_121 = TOYHASH_120 USE_REV(+1),
+  TOYHASH_122 = TOYHASH_121 USE_RM(+1),
+  TOYHASH_123 = TOYHASH_122 USE_RMDIR(+1),
+  TOYHASH_124 = TOYHASH_123 USE_ROUTE(+1),
+  TOYHASH_125 = TOYHASH_124 USE_RUNCON(+1),
+  TOYHASH_126 = TOYHASH_125 USE_SED(+1),
+  TOYHASH_127 = TOYHASH_126 USE_SETENFORCE(+1),
+  TOYHASH_128 = TOYHASH_127 USE_SETPROP(+1),
+  TOYHASH_129 = TOYHASH_128 USE_SETSID(+1),
+  TOYHASH_130 = TOYHASH_129 USE_SH(+1),
+  TOYHASH_131 = TOYHASH_130 USE_SHRED(+1),
+  TOYHASH_132 = TOYHASH_131 USE_SKELETON(+1),
+  TOYHASH_133 = TOYHASH_132 USE_SKELETON_ALIAS(+1),
+  TOYHASH_134 = TOYHASH_133 USE_SLEEP(+1),
+  TOYHASH_135 = TOYHASH_134 USE_SORT(+1),
+  TOYHASH_136 = TOYHASH_135 USE_SPLIT(+1),
+  TOYHASH_137 = TOYHASH_136 USE_STRINGS(+1),
+  TOYHASH_138 = TOYHASH_137 USE_SULOGIN(+1),
+  TOYHASH_139 = TOYHASH_138 USE_SYSCTL(+1),
+  TOYHASH_140 = TOYHASH_139 USE_SYSLOGD(+1),
+  TOYHASH_141 = TOYHASH_140 USE_TAC(+1),
+  TOYHASH_142 = TOYHASH_141 USE_TAIL(+1),
+  TOYHASH_143 = TOYHASH_142 USE_TAR(+1),
+  TOYHASH_144 = TOYHASH_143 USE_TCPSVD(+1),
+  TOYHASH_145 = TOYHASH_144 USE_TEE(+1),
+  TOYHASH_146 = TOYHASH_145 USE_TELNET(+1),
+  TOYHASH_147 = TOYHASH_146 USE_TELNETD(+1),
+  TOYHASH_148 = TOYHASH_147 USE_TEST(+1),
+  TOYHASH_149 = TOYHASH_148 USE_TEST_HUMAN_READABLE(+1),
+  TOYHASH_150 = TOYHASH_149 USE_TFTP(+1),
+  TOYHASH_151 = TOYHASH_150 USE_TFTPD(+1),
+  TOYHASH_152 = TOYHASH_151 USE_TIME(+1),
+  TOYHASH_153 = TOYHASH_152 USE_TIMEOUT(+1),
+  TOYHASH_154 = TOYHASH_153 USE_TOP(+1),
+  TOYHASH_155 = TOYHASH_154 USE_TOUCH(+1),
+  TOYHASH_156 = TOYHASH_155 USE_SH(+1),
+  TOYHASH_157 = TOYHASH_156 USE_TR(+1),
+  TOYHASH_158 = TOYHASH_157 USE_TRACEROUTE(+1),
+  TOYHASH_159 = TOYHASH_158 USE_TRACEROUTE(+1),
+  TOYHASH_160 = TOYHASH_159 USE_TRUE(+1),
+  TOYHASH_161 = TOYHASH_160 USE_TRUNCATE(+1),
+  TOYHASH_162 = TOYHASH_161 USE_TTY(+1),
+  TOYHASH_163 = TOYHASH_162 USE_TCPSVD(+1),
+  TOYHASH_164 = TOYHASH_163 USE_UNAME(+1),
+  TOYHASH_165 = TOYHASH_164 USE_UNIQ(+1),
+  TOYHASH_166 = TOYHASH_165 USE_UNIX2DOS(+1),
+  TOYHASH_167 = TOYHASH_166 USE_UNLINK(+1),
+  TOYHASH_168 = TOYHASH_167 USE_USERADD(+1),
+  TOYHASH_169 = TOYHASH_168 USE_USERDEL(+1),
+  TOYHASH_170 = TOYHASH_169 USE_USLEEP(+1),
+  TOYHASH_171 = TOYHASH_170 USE_UUDECODE(+1),
+  TOYHASH_172 = TOYHASH_171 USE_UUENCODE(+1),
+  TOYHASH_173 = TOYHASH_172 USE_VMSTAT(+1),
+  TOYHASH_174 = TOYHASH_173 USE_WATCH(+1),
+  TOYHASH_175 = TOYHASH_174 USE_WC(+1),
+  TOYHASH_176 = TOYHASH_175 USE_WHICH(+1),
+  TOYHASH_177 = TOYHASH_176 USE_WHO(+1),
+  TOYHASH_178 = TOYHASH_177 USE_XARGS(+1),
+  TOYHASH_179 = TOYHASH_178 USE_XXD(+1),
+  TOYHASH_180 = TOYHASH_179 USE_XZCAT(+1),
+  TOYHASH_181 = TOYHASH_180 USE_YES(+1),
+  TOYHASH_182 = TOYHASH_181 USE_ZCAT(+1),
+  TOYHASH_COUNT = TOYHASH_182
+};
+
+static const unsigned short toyhash_disp[TOYHASH_BUCKETS] = {
+  0, 0, 1, 1, 7, 3, 15, 1,
+  4, 1, 8, 8, 0, 1, 2, 4,
+  2, 8, 1, 12, 4, 1, 8, 5,
+  3, 7, 1, 34, 1, 5, 6, 2,
+  5, 1, 2, 1, 28, 3, 1, 1,
+  2, 1, 6, 6, 2, 4, 20, 7,
+  0, 8, 5, 2, 7, 1, 1, 8,
+  3, 2, 1, 4, 10, 5, 2, 9,
+};
+
+// 1 + toy_list[] index of the command in each slot, 0 for none
+static const unsigned short toyhash_slot[TOYHASH_SLOTS] = {
+  [1] = 0 USE_UUENCODE(+1+TOYHASH_171), // uuencode
+  [2] = 0 USE_SETPROP(+1+TOYHASH_127), // setprop
+  [3] = 0 USE_GETENFORCE(+1+TOYHASH_63), // getenforce
+  [4] = 0 USE_COMPRESS(+1+TOYHASH_29), // compress
+  [5] = 0 USE_MKDIR(+1+TOYHASH_96), // mkdir
+  [7] = 0 USE_ZCAT(+1+TOYHASH_181), // zcat
+  [8] = 0 USE_GROUPDEL(+1+TOYHASH_38), // delgroup
+  [9] = 0 USE_TELNET(+1+TOYHASH_145), // telnet
+  [10] = 0 USE_DIFF(+1+TOYHASH_42), // diff
+  [16] = 0 USE_DIRNAME(+1+TOYHASH_43), // dirname
+  [19] = 0 USE_TFTP(+1+TOYHASH_149), // tftp
+  [20] = 0 USE_TEST_HUMAN_READABLE(+1+TOYHASH_148), // test_human_readable
+  [21] = 0 USE_TAIL(+1+TOYHASH_141), // tail
+  [22] = 0 USE_PASTE(+1+TOYHASH_107), // paste
+  [23] = 0 USE_PATCH(+1+TOYHASH_108), // patch
+  [25] = 0 USE_MODPROBE(+1+TOYHASH_99), // modprobe
+  [27] = 0 USE_HEAD(+1+TOYHASH_71), // head
+  [28] = 0 USE_TEST(+1+TOYHASH_147), // test
+  [30] = 0 USE_HELP(+1+TOYHASH_73), // help
+  [32] = 0 USE_IP(+1+TOYHASH_79), // ip
+  [33] = 0 USE_FACTOR(+1+TOYHASH_52), // factor
+  [35] = 0 USE_INSTALL(+1+TOYHASH_78), // install
+  [36] = 0 USE_WATCH(+1+TOYHASH_173), // watch
+  [37] = 0 USE_DHCPD(+1+TOYHASH_41), // dhcpd
+  [38] = 0 USE_SKELETON(+1+TOYHASH_131), // skeleton
+  [39] = 0 USE_ARPING(+1+TOYHASH_7), // arping
+  [41] = 0 USE_GREP(+1+TOYHASH_66), // grep
+  [48] = 0 USE_TRACEROUTE(+1+TOYHASH_157), // traceroute
+  [49] = 0 USE_EGREP(+1+TOYHASH_48), // egrep
+  [50] = 0 USE_MORE(+1+TOYHASH_100), // more
+  [51] = 0 USE_USERDEL(+1+TOYHASH_39), // deluser
+  [53] = 0 USE_DD(+1+TOYHASH_36), // dd
+  [54] = 0 USE_GETPROP(+1+TOYHASH_64), // getprop
+  [55] = 0 USE_USERADD(+1+TOYHASH_5), // adduser
+  [56] = 0 USE_HELLO(+1+TOYHASH_72), // hello
+  [57] = 0 USE_FIND(+1+TOYHASH_56), // find
+  [58] = 0 USE_WHICH(+1+TOYHASH_175), // which
+  [59] = 0 USE_GROUPADD(+1+TOYHASH_4), // addgroup
+  [60] = 0 USE_PING(+1+TOYHASH_110), // ping
+  [61] = 0 USE_RUNCON(+1+TOYHASH_124), // runcon
+  [62] = 0 USE_PWDX(+1+TOYHASH_116), // pwdx
+  [63] = 0 USE_FDISK(+1+TOYHASH_54), // fdisk
+  [66] = 0 USE_FSYNC(+1+TOYHASH_60), // fsync
+  [67] = 0 USE_GUNZIP(+1+TOYHASH_69), // gunzip
+  [69] = 0 USE_USERADD(+1+TOYHASH_167), // useradd
+  [70] = 0 USE_SH(+1+TOYHASH_18), // cd
+  [73] = 0 USE_BUNZIP2(+1+TOYHASH_13), // bunzip2
+  [74] = 0 USE_UNAME(+1+TOYHASH_163), // uname
+  [76] = 0 USE_GETTY(+1+TOYHASH_65), // getty
+  [77] = 0 USE_READLINK(+1+TOYHASH_117), // readlink
+  [78] = 0 USE_TELNETD(+1+TOYHASH_146), // telnetd
+  [79] = 0 USE_FSTYPE(+1+TOYHASH_59), // fstype
+  [80] = 0 USE_OD(+1+TOYHASH_105), // od
+  [81] = 0 USE_TRUE(+1+TOYHASH_159), // true
+  [82] = 0 USE_SH(+1+TOYHASH_1), // -toysh
+  [83] = 0 USE_CP(+1+TOYHASH_31), // cp
+  [85] = 0 USE_CKSUM(+1+TOYHASH_25), // cksum
+  [86] = 0 USE_CHCON(+1+TOYHASH_19), // chcon
+  [87] = 0 USE_CUT(+1+TOYHASH_35), // cut
+  [88] = 0 USE_IP(+1+TOYHASH_85), // iprule
+  [89] = 0 USE_SH(+1+TOYHASH_129), // sh
+  [92] = 0 USE_GROUPDEL(+1+TOYHASH_68), // groupdel
+  [94] = 0 USE_UNLINK(+1+TOYHASH_166), // unlink
+  [95] = 0 USE_CHMOD(+1+TOYHASH_21), // chmod
+  [96] = 0 USE_DOS2UNIX(+1+TOYHASH_44), // dos2unix
+  [97] = 0 USE_MKE2FS(+1+TOYHASH_97), // mke2fs
+  [98] = 0 USE_IP(+1+TOYHASH_83), // iplink
+  [99] = 0 USE_BASE64(+1+TOYHASH_8), // base64
+  [101] = 0 USE_TCPSVD(+1+TOYHASH_143), // tcpsvd
+  [103] = 0 USE_SH(+1+TOYHASH_49), // exit
+  [104] = 0 USE_REALPATH(+1+TOYHASH_118), // realpath
+  [105] = 0 USE_CROND(+1+TOYHASH_33), // crond
+  [106] = 0 USE_PGREP(+1+TOYHASH_109), // pgrep
+  [107] = 0 USE_XARGS(+1+TOYHASH_177), // xargs
+  [108] = 0 USE_FALSE(+1+TOYHASH_53), // false
+  [109] = 0 USE_USLEEP(+1+TOYHASH_169), // usleep
+  [110] = 0 USE_CHVT(+1+TOYHASH_24), // chvt
+  [111] = 0 USE_FGREP(+1+TOYHASH_55), // fgrep
+  [112] = 0 USE_TAC(+1+TOYHASH_140), // tac
+  [114] = 0 USE_FTPGET(+1+TOYHASH_62), // ftpput
+  [115] = 0 USE_CMP(+1+TOYHASH_27), // cmp
+  [116] = 0 USE_EXPAND(+1+TOYHASH_50), // expand
+  [117] = 0 USE_DEALLOCVT(+1+TOYHASH_37), // deallocvt
+  [118] = 0 USE_COUNT(+1+TOYHASH_30), // count
+  [119] = 0 USE_TIMEOUT(+1+TOYHASH_152), // timeout
+  [120] = 0 USE_GROUPADD(+1+TOYHASH_67), // groupadd
+  [121] = 0 USE_REV(+1+TOYHASH_120), // rev
+  [123] = 0 USE_RM(+1+TOYHASH_121), // rm
+  [124] = 0 USE_CLEAR(+1+TOYHASH_26), // clear
+  [126] = 0 USE_BLKID(+1+TOYHASH_10), // blkid
+  [127] = 0 USE_MDEV(+1+TOYHASH_95), // mdev
+  [128] = 0 USE_EXPR(+1+TOYHASH_51), // expr
+  [129] = 0 USE_SPLIT(+1+TOYHASH_135), // split
+  [130] = 0 USE_STRINGS(+1+TOYHASH_136), // strings
+  [131] = 0 USE_LOGGER(+1+TOYHASH_92), // logger
+  [134] = 0 USE_GZIP(+1+TOYHASH_70), // gzip
+  [135] = 0 USE_WHO(+1+TOYHASH_176), // who
+  [136] = 0 USE_UUDECODE(+1+TOYHASH_170), // uudecode
+  [137] = 0 USE_PRINTENV(+1+TOYHASH_112), // printenv
+  [138] = 0 USE_LAST(+1+TOYHASH_88), // last
+  [139] = 0 USE_OPENVT(+1+TOYHASH_106), // openvt
+  [143] = 0 USE_CHGRP(+1+TOYHASH_20), // chgrp
+  [145] = 0 USE_RESTORECON(+1+TOYHASH_119), // restorecon
+  [146] = 0 USE_DU(+1+TOYHASH_45), // du
+  [147] = 0 USE_BASENAME(+1+TOYHASH_9), // basename
+  [148] = 0 USE_DUMPLEASES(+1+TOYHASH_46), // dumpleases
+  [149] = 0 USE_SULOGIN(+1+TOYHASH_137), // sulogin
+  [150] = 0 USE_PRINTF(+1+TOYHASH_113), // printf
+  [153] = 0 USE_PWD(+1+TOYHASH_115), // pwd
+  [154] = 0 USE_UNIQ(+1+TOYHASH_164), // uniq
+  [155] = 0 USE_MV(+1+TOYHASH_101), // mv
+  [156] = 0 USE_LN(+1+TOYHASH_90), // ln
+  [157] = 0 USE_UNIX2DOS(+1+TOYHASH_165), // unix2dos
+  [158] = 0 USE_SYSLOGD(+1+TOYHASH_139), // syslogd
+  [159] = 0 USE_FTPGET(+1+TOYHASH_61), // ftpget
+  [160] = 0 USE_TEE(+1+TOYHASH_144), // tee
+  [161] = 0 USE_CATV(+1+TOYHASH_17), // catv
+  [162] = 0 USE_LINK(+1+TOYHASH_89), // link
+  [166] = 0 USE_CRONTAB(+1+TOYHASH_34), // crontab
+  [167] = 0 USE_SED(+1+TOYHASH_125), // sed
+  [172] = 0 USE_NOHUP(+1+TOYHASH_104), // nohup
+  [173] = 0 USE_BZCAT(+1+TOYHASH_14), // bzcat
+  [176] = 0 USE_IP(+1+TOYHASH_80), // ipaddr
+  [177] = 0 USE_CHROOT(+1+TOYHASH_23), // chroot
+  [178] = 0 USE_BOOTCHARTD(+1+TOYHASH_11), // bootchartd
+  [179] = 0 USE_NL(+1+TOYHASH_103), // nl
+  [180] = 0 USE_ROUTE(+1+TOYHASH_123), // route
+  [181] = 0 USE_SETSID(+1+TOYHASH_128), // setsid
+  [182] = 0 USE_USERDEL(+1+TOYHASH_168), // userdel
+  [183] = 0 USE_ECHO(+1+TOYHASH_47), // echo
+  [185] = 0 USE_TIME(+1+TOYHASH_151), // time
+  [186] = 0 USE_KLOGD(+1+TOYHASH_87), // klogd
+  [187] = 0 USE_IPCS(+1+TOYHASH_82), // ipcs
+  [188] = 0 USE_YES(+1+TOYHASH_180), // yes
+  [190] = 0 USE_RMDIR(+1+TOYHASH_122), // rmdir
+  [191] = 0 USE_SETENFORCE(+1+TOYHASH_126), // setenforce
+  [192] = 0 USE_PGREP(+1+TOYHASH_111), // pkill
+  [193] = 0 USE_ICONV(+1+TOYHASH_76), // iconv
+  [194] = 0 USE_SKELETON_ALIAS(+1+TOYHASH_132), // skeleton_alias
+  [195] = 0 USE_TTY(+1+TOYHASH_161), // tty
+  [196] = 0 USE_PS(+1+TOYHASH_114), // ps
+  [198] = 0 USE_FOLD(+1+TOYHASH_57), // fold
+  [199] = 0 USE_TRUNCATE(+1+TOYHASH_160), // truncate
+  [200] = 0 USE_COMM(+1+TOYHASH_28), // comm
+  [201] = 0 USE_ACPI(+1+TOYHASH_3), // acpi
+  [202] = 0 USE_IP(+1+TOYHASH_84), // iproute
+  [203] = 0 USE_IPCRM(+1+TOYHASH_81), // ipcrm
+  [206] = 0 USE_CAT(+1+TOYHASH_16), // cat
+  [207] = 0 USE_LOAD_POLICY(+1+TOYHASH_91), // load_policy
+  [208] = 0 USE_BRCTL(+1+TOYHASH_12), // brctl
+  [209] = 0 USE_WC(+1+TOYHASH_174), // wc
+  [210] = 0 USE_LSOF(+1+TOYHASH_94), // lsof
+  [211] = 0 USE_TRUE(+1+TOYHASH_2), // :
+  [212] = 0 USE_INIT(+1+TOYHASH_77), // init
+  [214] = 0 USE_TFTPD(+1+TOYHASH_150), // tftpd
+  [215] = 0 USE_IP(+1+TOYHASH_86), // iptunnel
+  [217] = 0 USE_CHOWN(+1+TOYHASH_22), // chown
+  [218] = 0 USE_XXD(+1+TOYHASH_178), // xxd
+  [219] = 0 USE_CAL(+1+TOYHASH_15), // cal
+  [220] = 0 USE_XZCAT(+1+TOYHASH_179), // xzcat
+  [224] = 0 USE_CPIO(+1+TOYHASH_32), // cpio
+  [226] = 0 USE_NETSTAT(+1+TOYHASH_102), // netstat
+  [227] = 0 USE_LS(+1+TOYHASH_93), // ls
+  [231] = 0 USE_DHCP(+1+TOYHASH_40), // dhcp
+  [232] = 0 USE_TAR(+1+TOYHASH_142), // tar
+  [234] = 0 USE_TOP(+1+TOYHASH_153), // top
+  [236] = 0 USE_FSCK(+1+TOYHASH_58), // fsck
+  [237] = 0 USE_ARP(+1+TOYHASH_6), // arp
+  [238] = 0 USE_TOUCH(+1+TOYHASH_154), // touch
+  [240] = 0 USE_HOST(+1+TOYHASH_75), // host
+  [241] = 0 USE_VMSTAT(+1+TOYHASH_172), // vmstat
+  [243] = 0 USE_TCPSVD(+1+TOYHASH_162), // udpsvd
+  [244] = 0 USE_SYSCTL(+1+TOYHASH_138), // sysctl
+  [245] = 0 USE_SLEEP(+1+TOYHASH_133), // sleep
+  [246] = 0 USE_MKFIFO(+1+TOYHASH_98), // mkfifo
+  [247] = 0 USE_TR(+1+TOYHASH_156), // tr
+  [248] = 0 USE_SHRED(+1+TOYHASH_130), // shred
+  [251] = 0 USE_SH(+1+TOYHASH_155), // toysh
+  [252] = 0 USE_SORT(+1+TOYHASH_134), // sort
+  [253] = 0 USE_HEXEDIT(+1+TOYHASH_74), // hexedit
+  [254] = 0 USE_TRACEROUTE(+1+TOYHASH_158), // traceroute6
+};
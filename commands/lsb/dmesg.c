@@ -5,32 +5,167 @@
  * http://refspecs.linuxfoundation.org/LSB_4.1.0/LSB-Core-generic/LSB-Core-generic/dmesg.html
 
 // We care that FLAG_c is 1, so keep c at the end.
-USE_DMESG(NEWTOY(dmesg, "trs#<1n#c[!tr]", TOYFLAG_BIN))
+USE_DMESG(NEWTOY(dmesg, "WTf:l:wtrs#<1n#c[!Ttr]", TOYFLAG_BIN))
 
 config DMESG
   bool "dmesg"
   default y
   help
-    usage: dmesg [-c] [-r|-t] [-n LEVEL] [-s SIZE]
+    usage: dmesg [-cTrtWw] [-f FACILITY,...] [-l LEVEL,...] [-n LEVEL] [-s SIZE]
 
     Print or control the kernel ring buffer.
 
     -c	Clear the ring buffer after printing
+    -f	Only show these facilities (kern, user, daemon... or numbers)
+    -l	Only show these levels (emerg, alert, crit, err, warn, notice, info,
+    	debug or 0-7)
     -n	Set kernel logging LEVEL (1-9)
     -r	Raw output (with <level markers>)
     -s	Show the last SIZE many bytes
+    -T	Show wall clock times (can be off across a suspend)
     -t	Don't print kernel's timestamps
+    -w	Keep waiting for more messages
+    -W	Like -w but only show messages from now on
 */
 
 #define FOR_dmesg
 #include "toys.h"
 #include <sys/klog.h>
+#include <poll.h>
 
 GLOBALS(
   long level;
   long size;
+  char *levels;
+  char *facs;
+
+  char *out;
+  unsigned lmask, fmask;
+  int outlen;
+  long long boot;
+  time_t last;
+  char when[32];
 )
 
+#define DMESG_OUT 65536
+
+static char *dmesg_levels[] = {"emerg", "alert", "crit", "err", "warn",
+  "notice", "info", "debug"};
+static char *dmesg_facs[] = {"kern", "user", "mail", "daemon", "auth",
+  "syslog", "lpr", "news", "uucp", "cron", "authpriv", "ftp", "", "", "", "",
+  "local0", "local1", "local2", "local3", "local4", "local5", "local6",
+  "local7"};
+
+// Turn a comma separated list of names (or numbers) into a bitmask.
+static unsigned dmesg_mask(char *list, char **names, int count)
+{
+  unsigned mask = 0;
+  char *s, *ss;
+  int i, len;
+
+  for (s = list; *s; s = ss+!!*ss) {
+    len = (ss = strchrnul(s, ','))-s;
+    for (i = 0; i<count; i++)
+      if (*names[i] && strlen(names[i]) == len && !strncmp(s, names[i], len))
+        break;
+    if (i == count && isdigit(*s)) i = atoi(s);
+    if (i >= count) error_exit("bad '%.*s'", len, s);
+    mask |= 1<<i;
+  }
+
+  return mask;
+}
+
+static int dmesg_want(unsigned pri)
+{
+  return (TT.lmask&(1<<(pri&7))) && (pri>>3 > 31 || (TT.fmask&(1<<(pri>>3))));
+}
+
+static void dmesg_flush(void)
+{
+  if (TT.outlen) txwrite(1, TT.out, TT.outlen);
+  TT.outlen = 0;
+}
+
+// Format one record into the output buffer. The kernel escapes control
+// characters (a multi-line message's newlines among them) as \xNN.
+static void dmesg_show(unsigned pri, unsigned long long usec, char *msg,
+  int len)
+{
+  char *out, *end = msg+len;
+  time_t t;
+
+  if (!dmesg_want(pri)) return;
+  if (TT.outlen+len+sizeof(TT.when)+32 > DMESG_OUT) dmesg_flush();
+  out = TT.out+TT.outlen;
+  if (toys.optflags&FLAG_r) out += sprintf(out, "<%u>", pri);
+  if (toys.optflags&FLAG_T) {
+    // Consecutive messages are mostly in the same second.
+    if ((t = TT.boot+usec/1000000) != TT.last || !*TT.when) {
+      strftime(TT.when, sizeof(TT.when), "%a %b %e %T %Y", localtime(&t));
+      TT.last = t;
+    }
+    out += sprintf(out, "[%s] ", TT.when);
+  } else if (!(toys.optflags&FLAG_t))
+    out += sprintf(out, "[%5llu.%06llu] ", usec/1000000, usec%1000000);
+  if (toys.optflags&FLAG_r) out = mempcpy(out, msg, len);
+  else while (msg<end) {
+    if (*msg == '\\' && msg+3<end && msg[1] == 'x' && isxdigit(msg[2])
+      && isxdigit(msg[3]))
+    {
+      *out++ = strtol((char [3]){msg[2], msg[3], 0}, 0, 16);
+      msg += 4;
+    } else *out++ = *msg++;
+  }
+  *out++ = '\n';
+  TT.outlen = out-TT.out;
+}
+
+// Read /dev/kmsg, a record per read(), until there's nothing more for now.
+// Each batch is formatted into one buffer and written at once, and for -T
+// finds when the kernel's clock started once.
+static void dmesg_kmsg(int fd)
+{
+  struct timespec real, mono;
+  struct pollfd pfd;
+  unsigned long long usec;
+  unsigned pri;
+  char *buf = xmalloc(8192), *msg, *s;
+  int len;
+
+  TT.out = xmalloc(DMESG_OUT);
+  if (toys.optflags&FLAG_W) lseek(fd, 0, SEEK_END);
+  // Start after what the last dmesg -c cleared.
+  else lseek(fd, 0, SEEK_DATA);
+
+  for (;;) {
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    TT.boot = real.tv_sec-mono.tv_sec-(real.tv_nsec<mono.tv_nsec);
+
+    // "PRI,SEQ,USEC,FLAGS;MESSAGE\n" then " KEY=VALUE" lines we don't show.
+    // EPIPE means the kernel overwrote records before we got to them.
+    while (0<(len = read(fd, buf, 8191)) || (len<0 && errno == EPIPE)) {
+      if (len<0) continue;
+      buf[len] = 0;
+      if (2 != sscanf(buf, "%u,%*u,%llu", &pri, &usec)
+        || !(msg = strchr(buf, ';'))) continue;
+      if (!(s = strchr(++msg, '\n'))) s = buf+len;
+      dmesg_show(pri, usec, msg, s-msg);
+    }
+    if (len<0 && errno != EAGAIN && errno != EINTR) perror_exit("/dev/kmsg");
+    dmesg_flush();
+    if (!(toys.optflags&(FLAG_w|FLAG_W))) break;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);
+  }
+  if (CFG_TOYBOX_FREE) {
+    free(buf);
+    free(TT.out);
+  }
+}
+
 void dmesg_main(void)
 {
   // For -n just tell kernel to which messages to keep.
@@ -38,7 +173,22 @@ void dmesg_main(void)
     if (klogctl(8, NULL, TT.level)) perror_exit("klogctl");
   } else {
     char *data, *to, *from;
-    int size;
+    int size, fd = -1;
+
+    TT.lmask = TT.levels ? dmesg_mask(TT.levels, dmesg_levels, 8) : ~0;
+    TT.fmask = TT.facs ? dmesg_mask(TT.facs, dmesg_facs, 24) : ~0;
+
+    // /dev/kmsg has everything, and can wait for more. -s means klogctl.
+    if (!(toys.optflags&FLAG_s) || (toys.optflags&(FLAG_T|FLAG_w|FLAG_W)))
+      fd = open("/dev/kmsg", O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    if (fd != -1) {
+      dmesg_kmsg(fd);
+      close(fd);
+      if ((toys.optflags&FLAG_c) && klogctl(5, 0, 0)) perror_exit("klogctl");
+
+      return;
+    }
+    if (toys.optflags&(FLAG_T|FLAG_w|FLAG_W)) perror_exit("/dev/kmsg");
 
     // Figure out how much data we need, and fetch it.
     size = TT.size;
@@ -48,22 +198,31 @@ void dmesg_main(void)
     if (size < 0) perror_exit("klogctl");
     data[size] = 0;
 
-    // Filter out level markers and optionally time markers
-    if (!(toys.optflags & FLAG_r)) while ((from - data) < size) {
-      if (from == data || from[-1] == '\n') {
-        char *to;
+    // Filter out level markers and optionally time markers, and lines
+    // -l and -f don't want.
+    if (TT.levels || TT.facs || !(toys.optflags & FLAG_r))
+      while ((from - data) < size) {
+        if (from == data || from[-1] == '\n') {
+          char *to;
 
-        if (*from == '<' && (to = strchr(from, '>'))) from = ++to;
-        if ((toys.optflags&FLAG_t) && *from == '[' && (to = strchr(from, ']')))
-          from = to+1+(to[1]==' ');
+          if (*from == '<' && (to = strchr(from, '>'))) {
+            if (!dmesg_want(atoi(from+1))) {
+              from = (to = strchr(to, '\n')) ? to+1 : data+size;
+              continue;
+            }
+            if (!(toys.optflags & FLAG_r)) from = ++to;
+          }
+          if ((toys.optflags&FLAG_t) && *from == '['
+            && (to = strchr(from, ']'))) from = to+1+(to[1]==' ');
+        }
+        *(to++) = *(from++);
       }
-      *(to++) = *(from++);
-    } else to = data+size;
+    else to = data+size;
 
     // Write result. The odds of somebody requesting a buffer of size 3 and
     // getting "<1>" are remote, but don't segfault if they do.
     if (to != data) {
-      txwrite(1, data, to-data);
+      txwrite(fileno(stdout), data, to-data);
       if (to[-1] != '\n') xputc('\n');
     }
     if (CFG_TOYBOX_FREE) free(data);
@@ -1,55 +1,152 @@
-/* md5sum.c - Calculate RFC 1321 md5 hash and sha1 hash.
+/* md5sum.c - Calculate RFC 1321 md5 hash and sha1/sha2 hashes.
  *
  * Copyright 2012 Rob Landley <rob@landley.net>
  *
  * See http://refspecs.linuxfoundation.org/LSB_4.1.0/LSB-Core-generic/LSB-Core-generic/md5sum.html
  * and http://www.ietf.org/rfc/rfc1321.txt
+ * and http://csrc.nist.gov/publications/fips/fips180-4/fips-180-4.pdf
  *
  * They're combined this way to share infrastructure, and because md5sum is
  * and LSB standard command, sha1sum is just a good idea.
 
-USE_MD5SUM(NEWTOY(md5sum, "b", TOYFLAG_USR|TOYFLAG_BIN))
-USE_SHA1SUM(NEWTOY(sha1sum, "b", TOYFLAG_USR|TOYFLAG_BIN))
+USE_MD5SUM(NEWTOY(md5sum, "(fail-fast)cb[!bc]", TOYFLAG_USR|TOYFLAG_BIN))
+USE_SHA1SUM(NEWTOY(sha1sum, "(fail-fast)cb[!bc]", TOYFLAG_USR|TOYFLAG_BIN))
+USE_SHA256SUM(NEWTOY(sha256sum, "(fail-fast)cb[!bc]", TOYFLAG_USR|TOYFLAG_BIN))
+USE_SHA512SUM(NEWTOY(sha512sum, "(fail-fast)cb[!bc]", TOYFLAG_USR|TOYFLAG_BIN))
 
 config MD5SUM
   bool "md5sum"
   default y
   help
-    usage: md5sum [FILE]...
+    usage: md5sum [-bc] [--fail-fast] [FILE]...
 
     Calculate md5 hash for each input file, reading from stdin if none.
     Output one hash (16 hex digits) for each input file, followed by
     filename.
 
     -b	brief (hash only, no filename)
+    -c	check the hashes FILEs list (as this prints them) and say which match
+    --fail-fast	with -c stop at the first one that doesn't
 
 config SHA1SUM
   bool "sha1sum"
   default y
   help
-    usage: sha1sum [FILE]...
+    usage: sha1sum [-bc] [--fail-fast] [FILE]...
 
     calculate sha1 hash for each input file, reading from stdin if none.
     Output one hash (20 hex digits) for each input file, followed by
     filename.
 
     -b	brief (hash only, no filename)
+    -c	check the hashes FILEs list (as this prints them) and say which match
+    --fail-fast	with -c stop at the first one that doesn't
+
+config SHA256SUM
+  bool "sha256sum"
+  default y
+  help
+    usage: sha256sum [-bc] [--fail-fast] [FILE]...
+
+    calculate sha256 hash for each input file, reading from stdin if none.
+    Output one hash (32 hex digits) for each input file, followed by
+    filename.
+
+    -b	brief (hash only, no filename)
+    -c	check the hashes FILEs list (as this prints them) and say which match
+    --fail-fast	with -c stop at the first one that doesn't
+
+config SHA512SUM
+  bool "sha512sum"
+  default y
+  help
+    usage: sha512sum [-bc] [--fail-fast] [FILE]...
+
+    calculate sha512 hash for each input file, reading from stdin if none.
+    Output one hash (64 hex digits) for each input file, followed by
+    filename.
+
+    -b	brief (hash only, no filename)
+    -c	check the hashes FILEs list (as this prints them) and say which match
+    --fail-fast	with -c stop at the first one that doesn't
 */
 
 #define FOR_md5sum
 #include "toys.h"
 
 GLOBALS(
-  unsigned state[5];
-  unsigned oldstate[5];
+  void *type;
+  char *buf;
+  struct hash_job *jobs;
+  int count, bad, failed, unread;
+)
+
+// Read this much of a file at a time.
+#define HASH_READ (128*1024)
+
+// A file to hash, and with -c the hash it should have.
+struct hash_job {
+  char *name, out[129], want[129];
+  int err, done;
+};
+
+// Hash in progress. The state is 4 (md5), 5 (sha1) or 8 (sha256) 32 bit
+// words or 8 64 bit words (sha512), the buffer a partial block.
+
+struct hash {
+  struct hash_type *type;
+  union {
+    unsigned i32[16];
+    uint64_t i64[8];
+  } state;
   uint64_t count;
   union {
-    char c[64];
-    unsigned i[16];
+    char c[128];
+    uint64_t i64[16];
   } buffer;
-)
+};
+
+// Mix blocks of data into state. The transforms read the data a byte at a
+// time (well, a word at a time through memcpy) so it needn't be aligned.
+
+struct hash_type {
+  char *name;
+  void (*transform)(void *state, char *data, unsigned blocks);
+  void *init;
+  unsigned char block, digest;
+  char le, wide;
+};
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+#define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+#define ror64(value, bits) (((value) >> (bits)) | ((value) << (64 - (bits))))
+
+static unsigned get_le32(char *p)
+{
+  unsigned u;
+
+  memcpy(&u, p, 4);
+
+  return SWAP_LE32(u);
+}
+
+static unsigned get_be32(char *p)
+{
+  unsigned u;
+
+  memcpy(&u, p, 4);
+
+  return SWAP_BE32(u);
+}
+
+static uint64_t get_be64(char *p)
+{
+  uint64_t u;
+
+  memcpy(&u, p, 8);
+
+  return SWAP_BE64(u);
+}
 
 // for(i=0; i<64; i++) md5table[i] = abs(sin(i+1))*(1<<32);  But calculating
 // that involves not just floating point but pulling in -lm (and arguing with
@@ -76,173 +173,717 @@ static const uint8_t md5rot[64] = {
   6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
 };
 
-// Mix next 64 bytes of data into md5 hash
-
-static void md5_transform(void)
+static void md5_transform(void *state, char *data, unsigned blocks)
 {
-  unsigned x[4], *b = TT.buffer.i;
+  unsigned x[4], b[16], *st = state;
   int i;
 
-  memcpy(x, TT.state, sizeof(x));
-
-  for (i=0; i<64; i++) {
-    unsigned int in, temp, swap;
-    if (i<16) {
-      in = i;
-      temp = x[1];
-      temp = (temp & x[2]) | ((~temp) & x[3]);
-    } else if (i<32) {
-      in = (1+(5*i))&15;
-      temp = x[3];
-      temp = (x[1] & temp) | (x[2] & ~temp);
-    } else if (i<48) {
-      in = (3*i+5)&15;
-      temp = x[1] ^ x[2] ^ x[3];
-    } else {
-      in = (7*i)&15;
-      temp = x[2] ^ (x[1] | ~x[3]);
+  for (; blocks--; data += 64) {
+    for (i=0; i<16; i++) b[i] = get_le32(data+4*i);
+    memcpy(x, st, sizeof(x));
+
+    for (i=0; i<64; i++) {
+      unsigned int in, temp, swap;
+      if (i<16) {
+        in = i;
+        temp = x[1];
+        temp = (temp & x[2]) | ((~temp) & x[3]);
+      } else if (i<32) {
+        in = (1+(5*i))&15;
+        temp = x[3];
+        temp = (x[1] & temp) | (x[2] & ~temp);
+      } else if (i<48) {
+        in = (3*i+5)&15;
+        temp = x[1] ^ x[2] ^ x[3];
+      } else {
+        in = (7*i)&15;
+        temp = x[2] ^ (x[1] | ~x[3]);
+      }
+      temp += x[0] + b[in] + md5table[i];
+      swap = x[3];
+      x[3] = x[2];
+      x[2] = x[1];
+      x[1] += rol(temp, md5rot[i]);
+      x[0] = swap;
     }
-    temp += x[0] + b[in] + md5table[i];
-    swap = x[3];
-    x[3] = x[2];
-    x[2] = x[1];
-    x[1] += rol(temp, md5rot[i]);
-    x[0] = swap;
+    for (i=0; i<4; i++) st[i] += x[i];
   }
-  for (i=0; i<4; i++) TT.state[i] += x[i];
 }
 
-// Mix next 64 bytes of data into sha1 hash.
-
 static const unsigned rconsts[]={0x5A827999,0x6ED9EBA1,0x8F1BBCDC,0xCA62C1D6};
 
-static void sha1_transform(void)
+static void sha1_transform(void *state, char *data, unsigned blocks)
 {
   int i, j, k, count;
-  unsigned *block = TT.buffer.i;
+  unsigned block[16], oldstate[5], *st = state;
   unsigned *rot[5], *temp;
 
-  // Copy context->state[] to working vars
-  for (i=0; i<5; i++) {
-    TT.oldstate[i] = TT.state[i];
-    rot[i] = TT.state + i;
+  for (; blocks--; data += 64) {
+    // Copy context->state[] to working vars
+    for (i=0; i<5; i++) {
+      oldstate[i] = st[i];
+      rot[i] = st + i;
+    }
+    // 4 rounds of 20 operations each.
+    for (i=count=0; i<4; i++) {
+      for (j=0; j<20; j++) {
+        unsigned work;
+
+        work = *rot[2] ^ *rot[3];
+        if (!i) work = (work & *rot[1]) ^ *rot[3];
+        else {
+          if (i==2) work = ((*rot[1]|*rot[2])&*rot[3])|(*rot[1]&*rot[2]);
+          else work ^= *rot[1];
+        }
+
+        if (!i && j<16) work += block[count] = get_be32(data+4*count);
+        else
+          work += block[count&15] = rol(block[(count+13)&15]
+                ^ block[(count+8)&15] ^ block[(count+2)&15] ^ block[count&15], 1);
+        *rot[4] += work + rol(*rot[0],5) + rconsts[i];
+        *rot[1] = rol(*rot[1],30);
+
+        // Rotate by one for next time.
+        temp = rot[4];
+        for (k=4; k; k--) rot[k] = rot[k-1];
+        *rot = temp;
+        count++;
+      }
+    }
+    // Add the previous values of state[]
+    for (i=0; i<5; i++) st[i] += oldstate[i];
   }
-  // 4 rounds of 20 operations each.
-  for (i=count=0; i<4; i++) {
-    for (j=0; j<20; j++) {
-      unsigned work;
+}
 
-      work = *rot[2] ^ *rot[3];
-      if (!i) work = (work & *rot[1]) ^ *rot[3];
-      else {
-        if (i==2) work = ((*rot[1]|*rot[2])&*rot[3])|(*rot[1]&*rot[2]);
-        else work ^= *rot[1];
-      }
+// The sha2 round constants are the fractional parts of the cube roots of
+// the first 64 (or 80) primes.
+
+static const unsigned sha256table[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t sha512table[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+  0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+  0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+  0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+  0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+  0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+  0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+  0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+  0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+  0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+  0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+  0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+  0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+  0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+  0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+  0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+  0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+  0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+  0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+  0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+  0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+// Both sha2 transforms are the same shape with different word sizes, round
+// counts, and rotations.
 
-      if (!i && j<16)
-        work += block[count] = (rol(block[count],24)&0xFF00FF00)
-                             | (rol(block[count],8)&0x00FF00FF);
-      else
-        work += block[count&15] = rol(block[(count+13)&15]
-              ^ block[(count+8)&15] ^ block[(count+2)&15] ^ block[count&15], 1);
-      *rot[4] += work + rol(*rot[0],5) + rconsts[i];
-      *rot[1] = rol(*rot[1],30);
-
-      // Rotate by one for next time.
-      temp = rot[4];
-      for (k=4; k; k--) rot[k] = rot[k-1];
-      *rot = temp;
-      count++;
+static void sha256_transform(void *state, char *data, unsigned blocks)
+{
+  unsigned w[64], *st = state, a, b, c, d, e, f, g, h, s0, s1, t1, t2;
+  int i;
+
+  for (; blocks--; data += 64) {
+    for (i=0; i<16; i++) w[i] = get_be32(data+4*i);
+    for (; i<64; i++) {
+      s0 = ror(w[i-15], 7) ^ ror(w[i-15], 18) ^ (w[i-15] >> 3);
+      s1 = ror(w[i-2], 17) ^ ror(w[i-2], 19) ^ (w[i-2] >> 10);
+      w[i] = w[i-16] + s0 + w[i-7] + s1;
     }
+    a = st[0]; b = st[1]; c = st[2]; d = st[3];
+    e = st[4]; f = st[5]; g = st[6]; h = st[7];
+    for (i=0; i<64; i++) {
+      s1 = ror(e, 6) ^ ror(e, 11) ^ ror(e, 25);
+      t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256table[i] + w[i];
+      s0 = ror(a, 2) ^ ror(a, 13) ^ ror(a, 22);
+      t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+    st[4] += e; st[5] += f; st[6] += g; st[7] += h;
   }
-  // Add the previous values of state[]
-  for (i=0; i<5; i++) TT.state[i] += TT.oldstate[i];
 }
 
-// Fill the 64-byte working buffer and call transform() when full.
+static void sha512_transform(void *state, char *data, unsigned blocks)
+{
+  uint64_t w[80], *st = state, a, b, c, d, e, f, g, h, s0, s1, t1, t2;
+  int i;
+
+  for (; blocks--; data += 128) {
+    for (i=0; i<16; i++) w[i] = get_be64(data+8*i);
+    for (; i<80; i++) {
+      s0 = ror64(w[i-15], 1) ^ ror64(w[i-15], 8) ^ (w[i-15] >> 7);
+      s1 = ror64(w[i-2], 19) ^ ror64(w[i-2], 61) ^ (w[i-2] >> 6);
+      w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    a = st[0]; b = st[1]; c = st[2]; d = st[3];
+    e = st[4]; f = st[5]; g = st[6]; h = st[7];
+    for (i=0; i<80; i++) {
+      s1 = ror64(e, 14) ^ ror64(e, 18) ^ ror64(e, 41);
+      t1 = h + s1 + ((e & f) ^ (~e & g)) + sha512table[i] + w[i];
+      s0 = ror64(a, 28) ^ ror64(a, 34) ^ ror64(a, 39);
+      t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+    st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+  }
+}
 
-static void hash_update(char *data, unsigned int len, void (*transform)(void))
+// Processors with sha instructions do sha1 and sha256 several times faster.
+// These get built with the instructions enabled just for themselves, and
+// hash_pick() only uses them when the processor it's running on has them.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define HASH_SHANI 1
+
+#define SHANI __attribute__((target("sha,sse4.1,ssse3")))
+
+// Four rounds, g of 20, with the message schedule for later ones folded in.
+#define SHA1NI(g) do { \
+  if (g<4) msg[g&3] = _mm_shuffle_epi8(_mm_loadu_si128((void *)(data+16*g)), \
+    mask); \
+  if (!g) e[0] = _mm_add_epi32(e[0], msg[0]); \
+  else e[g&1] = _mm_sha1nexte_epu32(e[g&1], msg[g&3]); \
+  e[(g+1)&1] = abcd; \
+  if (g>2 && g<19) msg[(g+1)&3] = _mm_sha1msg2_epu32(msg[(g+1)&3], msg[g&3]); \
+  abcd = _mm_sha1rnds4_epu32(abcd, e[g&1], g/5); \
+  if (g && g<17) msg[(g-1)&3] = _mm_sha1msg1_epu32(msg[(g-1)&3], msg[g&3]); \
+  if (g>1 && g<18) msg[(g-2)&3] = _mm_xor_si128(msg[(g-2)&3], msg[g&3]); \
+} while (0)
+
+static SHANI void sha1_shani(void *state, char *data, unsigned blocks)
 {
-  unsigned int i, j;
+  __m128i abcd, e[2], msg[4], abcd_save, e_save,
+    mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  unsigned *st = state;
+
+  abcd = _mm_shuffle_epi32(_mm_loadu_si128((void *)st), 0x1b);
+  e[0] = _mm_set_epi32(st[4], 0, 0, 0);
+  for (; blocks--; data += 64) {
+    abcd_save = abcd;
+    e_save = e[0];
+    SHA1NI(0); SHA1NI(1); SHA1NI(2); SHA1NI(3); SHA1NI(4);
+    SHA1NI(5); SHA1NI(6); SHA1NI(7); SHA1NI(8); SHA1NI(9);
+    SHA1NI(10); SHA1NI(11); SHA1NI(12); SHA1NI(13); SHA1NI(14);
+    SHA1NI(15); SHA1NI(16); SHA1NI(17); SHA1NI(18); SHA1NI(19);
+    e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+  _mm_storeu_si128((void *)st, _mm_shuffle_epi32(abcd, 0x1b));
+  st[4] = _mm_extract_epi32(e[0], 3);
+}
 
-  j = TT.count & 63;
-  TT.count += len;
+// Four rounds, g of 16, again with the schedule for later ones.
+#define SHA256NI(g) do { \
+  if (g<4) msg[g&3] = _mm_shuffle_epi8(_mm_loadu_si128((void *)(data+16*g)), \
+    mask); \
+  m = _mm_add_epi32(msg[g&3], _mm_loadu_si128((void *)(sha256table+4*g))); \
+  s1 = _mm_sha256rnds2_epu32(s1, s0, m); \
+  if (g>2 && g<15) { \
+    msg[(g+1)&3] = _mm_add_epi32(msg[(g+1)&3], \
+      _mm_alignr_epi8(msg[g&3], msg[(g-1)&3], 4)); \
+    msg[(g+1)&3] = _mm_sha256msg2_epu32(msg[(g+1)&3], msg[g&3]); \
+  } \
+  s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(m, 0x0e)); \
+  if (g && g<13) msg[(g-1)&3] = _mm_sha256msg1_epu32(msg[(g-1)&3], msg[g&3]); \
+} while (0)
+
+static SHANI void sha256_shani(void *state, char *data, unsigned blocks)
+{
+  __m128i s0, s1, m, msg[4], s0_save, s1_save,
+    mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  unsigned *st = state;
+
+  // The instructions want the state as ABEF and CDGH.
+  m = _mm_shuffle_epi32(_mm_loadu_si128((void *)st), 0xb1);
+  s1 = _mm_shuffle_epi32(_mm_loadu_si128((void *)(st+4)), 0x1b);
+  s0 = _mm_alignr_epi8(m, s1, 8);
+  s1 = _mm_blend_epi16(s1, m, 0xf0);
+  for (; blocks--; data += 64) {
+    s0_save = s0;
+    s1_save = s1;
+    SHA256NI(0); SHA256NI(1); SHA256NI(2); SHA256NI(3);
+    SHA256NI(4); SHA256NI(5); SHA256NI(6); SHA256NI(7);
+    SHA256NI(8); SHA256NI(9); SHA256NI(10); SHA256NI(11);
+    SHA256NI(12); SHA256NI(13); SHA256NI(14); SHA256NI(15);
+    s0 = _mm_add_epi32(s0, s0_save);
+    s1 = _mm_add_epi32(s1, s1_save);
+  }
+  m = _mm_shuffle_epi32(s0, 0x1b);
+  s1 = _mm_shuffle_epi32(s1, 0xb1);
+  _mm_storeu_si128((void *)st, _mm_blend_epi16(m, s1, 0xf0));
+  _mm_storeu_si128((void *)(st+4), _mm_alignr_epi8(s1, m, 8));
+}
 
-  for (;;) {
-    // Grab next chunk of data, return if it's not enough to process a frame
-    i = 64 - j;
-    if (i>len) i = len;
-    memcpy(TT.buffer.c+j, data, i);
-    if (j+i != 64) break;
-
-    // Process a frame
-    if (IS_BIG_ENDIAN)
-      for (j=0; j<16; j++) TT.buffer.i[j] = SWAP_LE32(TT.buffer.i[j]);
-    transform();
-    j=0;
-    data += i;
-    len -= i;
+static int hash_shani(void)
+{
+  unsigned a, b, c, d;
+
+  if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) || !(c & bit_SSE4_1))
+    return 0;
+
+  return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1<<29));
+}
+
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define HASH_ARMV8 1
+
+#define ARMV8 __attribute__((target("+crypto")))
+
+static uint32x4_t armv8_load(char *data)
+{
+  return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8((void *)data)));
+}
+
+// Four rounds, g of 20.
+#define SHA1V8(g) do { \
+  e[(g+1)&1] = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+  if (g<5) abcd = vsha1cq_u32(abcd, e[g&1], t[g&1]); \
+  else if (g<10 || g>14) abcd = vsha1pq_u32(abcd, e[g&1], t[g&1]); \
+  else abcd = vsha1mq_u32(abcd, e[g&1], t[g&1]); \
+  if (g<18) t[g&1] = vaddq_u32(msg[(g+2)&3], vdupq_n_u32(rconsts[(g+2)/5])); \
+  if (g && g<18) msg[(g-1)&3] = vsha1su1q_u32(msg[(g-1)&3], msg[(g+2)&3]); \
+  if (g<17) msg[g&3] = vsha1su0q_u32(msg[g&3], msg[(g+1)&3], msg[(g+2)&3]); \
+} while (0)
+
+static ARMV8 void sha1_armv8(void *state, char *data, unsigned blocks)
+{
+  uint32x4_t abcd, abcd_save, msg[4], t[2];
+  unsigned *st = state, e[2], e_save;
+  int i;
+
+  abcd = vld1q_u32(st);
+  e[0] = st[4];
+  for (; blocks--; data += 64) {
+    abcd_save = abcd;
+    e_save = e[0];
+    for (i = 0; i<4; i++) msg[i] = armv8_load(data+16*i);
+    t[0] = vaddq_u32(msg[0], vdupq_n_u32(rconsts[0]));
+    t[1] = vaddq_u32(msg[1], vdupq_n_u32(rconsts[0]));
+    SHA1V8(0); SHA1V8(1); SHA1V8(2); SHA1V8(3); SHA1V8(4);
+    SHA1V8(5); SHA1V8(6); SHA1V8(7); SHA1V8(8); SHA1V8(9);
+    SHA1V8(10); SHA1V8(11); SHA1V8(12); SHA1V8(13); SHA1V8(14);
+    SHA1V8(15); SHA1V8(16); SHA1V8(17); SHA1V8(18); SHA1V8(19);
+    e[0] += e_save;
+    abcd = vaddq_u32(abcd, abcd_save);
   }
+  vst1q_u32(st, abcd);
+  st[4] = e[0];
 }
 
-// Callback for loopfiles()
+// Four rounds, g of 16.
+#define SHA256V8(g) do { \
+  if (g<12) msg[g&3] = vsha256su0q_u32(msg[g&3], msg[(g+1)&3]); \
+  tmp = s0; \
+  if (g<15) t[(g+1)&1] = vaddq_u32(msg[(g+1)&3], vld1q_u32(sha256table+4*(g+1))); \
+  s0 = vsha256hq_u32(s0, s1, t[g&1]); \
+  s1 = vsha256h2q_u32(s1, tmp, t[g&1]); \
+  if (g<12) msg[g&3] = vsha256su1q_u32(msg[g&3], msg[(g+2)&3], msg[(g+3)&3]); \
+} while (0)
+
+static ARMV8 void sha256_armv8(void *state, char *data, unsigned blocks)
+{
+  uint32x4_t s0, s1, s0_save, s1_save, tmp, msg[4], t[2];
+  unsigned *st = state;
+  int i;
+
+  s0 = vld1q_u32(st);
+  s1 = vld1q_u32(st+4);
+  for (; blocks--; data += 64) {
+    s0_save = s0;
+    s1_save = s1;
+    for (i = 0; i<4; i++) msg[i] = armv8_load(data+16*i);
+    t[0] = vaddq_u32(msg[0], vld1q_u32(sha256table));
+    SHA256V8(0); SHA256V8(1); SHA256V8(2); SHA256V8(3);
+    SHA256V8(4); SHA256V8(5); SHA256V8(6); SHA256V8(7);
+    SHA256V8(8); SHA256V8(9); SHA256V8(10); SHA256V8(11);
+    SHA256V8(12); SHA256V8(13); SHA256V8(14); SHA256V8(15);
+    s0 = vaddq_u32(s0, s0_save);
+    s1 = vaddq_u32(s1, s1_save);
+  }
+  vst1q_u32(st, s0);
+  vst1q_u32(st+4, s1);
+}
+#endif
+
+static unsigned md5_init[] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+  0xC3D2E1F0};
+static unsigned sha256_init[] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+  0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+static uint64_t sha512_init[] = {0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+  0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL,
+  0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+
+// sha1 uses all five md5_init words, md5 the first 4.
+static struct hash_type hash_types[] = {
+  {"md5sum", md5_transform, md5_init, 64, 16, 1, 0},
+  {"sha1sum", sha1_transform, md5_init, 64, 20, 0, 0},
+  {"sha256sum", sha256_transform, sha256_init, 64, 32, 0, 0},
+  {"sha512sum", sha512_transform, sha512_init, 128, 64, 0, 1}
+};
 
-static void do_hash(int fd, char *name)
+static void hash_init(struct hash *h, struct hash_type *type)
 {
-  uint64_t count;
-  int i, sha1=toys.which->name[0]=='s';;
-  char buf;
-  void (*transform)(void);
+  memset(h, 0, sizeof(*h));
+  h->type = type;
+  memcpy(&h->state, type->init, type->wide ? 64 : type->digest);
+}
 
-  /* SHA1 initialization constants  (md5sum uses first 4) */
-  TT.state[0] = 0x67452301;
-  TT.state[1] = 0xEFCDAB89;
-  TT.state[2] = 0x98BADCFE;
-  TT.state[3] = 0x10325476;
-  TT.state[4] = 0xC3D2E1F0;
-  TT.count = 0;
+// Top up a partial block, then transform whole blocks straight out of data,
+// and keep what's left over for next time.
 
-  transform = sha1 ? sha1_transform : md5_transform;
-  for (;;) {
-    i = read(fd, toybuf, sizeof(toybuf));
-    if (i<1) break;
-    hash_update(toybuf, i, transform);
+static void hash_update(struct hash *h, char *data, unsigned len)
+{
+  unsigned size = h->type->block, used = h->count & (size-1), i;
+
+  h->count += len;
+  if (used) {
+    i = size-used;
+    if (i>len) i = len;
+    memcpy(h->buffer.c+used, data, i);
+    if (used+i != size) return;
+    h->type->transform(&h->state, h->buffer.c, 1);
+    data += i;
+    len -= i;
   }
+  if ((i = len/size)) h->type->transform(&h->state, data, i);
+  memcpy(h->buffer.c, data+i*size, len-i*size);
+}
 
-  count = TT.count << 3;
+// Pad out the last block and write the hash into out as hex digits.
+
+static void hash_final(struct hash *h, char *out)
+{
+  unsigned size = h->type->block, lensize = size/8, i;
+  uint64_t count = h->count << 3;
+  char buf = 0x80, len[16];
 
   // End the message by appending a "1" bit to the data, ending with the
-  // message size (in bits, big endian), and adding enough zero bits in
-  // between to pad to the end of the next 64-byte frame.
+  // message size (in bits, big endian except for md5), and adding enough
+  // zero bits in between to pad to the end of the next block.
   //
   // Since our input up to now has been in whole bytes, we can deal with
   // bytes here too.
 
-  buf = 0x80;
+  memset(len, 0, sizeof(len));
+  if (h->type->le) count = SWAP_LE64(count);
+  else {
+    // sha512 counts bits in 128 bits, of which we need 3 more than 64.
+    if (lensize == 16) len[7] = h->count >> 61;
+    count = SWAP_BE64(count);
+  }
+  memcpy(len+lensize-8, &count, 8);
   do {
-    hash_update(&buf, 1, transform);
+    hash_update(h, &buf, 1);
     buf = 0;
-  } while ((TT.count & 63) != 56);
-  count = sha1 ? SWAP_BE64(count) : SWAP_LE64(count);
-  hash_update((void *)&count, 8, transform);
+  } while ((h->count & (size-1)) != size-lensize);
+  hash_update(h, len, lensize);
 
-  if (sha1)
-    for (i = 0; i < 20; i++)
-      printf("%02x", 255&(TT.state[i>>2] >> ((3-(i & 3)) * 8)));
-  else for (i=0; i<4; i++) printf("%08x", bswap_32(TT.state[i]));
+  for (i = 0; i<h->type->digest; i++) {
+    if (h->type->wide) buf = h->state.i64[i>>3] >> ((7-(i&7))*8);
+    else buf = h->state.i32[i>>2] >> ((h->type->le ? i&3 : 3-(i&3))*8);
+    out += sprintf(out, "%02x", 255&buf);
+  }
 
   // Wipe variables. Cryptographer paranoia.
-  memset(&TT, 0, sizeof(TT));
+  memset(h, 0, sizeof(*h));
+}
+
+// Hash everything fd has into out, or return errno.
+
+static int hash_fd(struct hash_type *type, int fd, char *buf, char *out)
+{
+  struct hash h;
+  int i;
+
+  hash_init(&h, type);
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  while (0<(i = read(fd, buf, HASH_READ))) hash_update(&h, buf, i);
+  if (i) return errno;
+  hash_final(&h, out);
+
+  return 0;
+}
+
+// Use the sha instructions if this processor has them, and they get the
+// right answer: one block of all zeroes.
+
+static void hash_pick(struct hash_type *type)
+{
+  void (*fast)(void *state, char *data, unsigned blocks) = 0;
+  struct hash_type try = *type;
+  char zero[64], out[2][65];
+  struct hash h;
+  int i;
+
+#if HASH_SHANI
+  if (hash_shani())
+    fast = type->transform == sha1_transform ? sha1_shani
+      : type->transform == sha256_transform ? sha256_shani : 0;
+#elif HASH_ARMV8
+  unsigned long hwcap = getauxval(AT_HWCAP);
+
+  if (type->transform == sha1_transform && (hwcap & HWCAP_SHA1))
+    fast = sha1_armv8;
+  if (type->transform == sha256_transform && (hwcap & HWCAP_SHA2))
+    fast = sha256_armv8;
+#endif
+  if (!fast) return;
+
+  memset(zero, 0, sizeof(zero));
+  for (i = 0; i<2; i++) {
+    if (i) try.transform = fast;
+    hash_init(&h, &try);
+    hash_update(&h, zero, 64);
+    hash_final(&h, out[i]);
+  }
+  if (!strcmp(*out, out[1])) type->transform = fast;
+}
+
+static void hash_file(struct hash_type *type, struct hash_job *job, char *buf)
+{
+  int fd = strcmp(job->name, "-") ? open(job->name, O_RDONLY|O_CLOEXEC) : 0;
+
+  if (fd == -1) job->err = errno;
+  else {
+    job->err = hash_fd(type, fd, buf, job->out);
+    if (fd) close(fd);
+  }
+}
+
+#if CFG_TOYBOX_THREADS
+// Workers take files in order, each as soon as it's done with the last, so
+// they're always working ahead of the one this thread is waiting to report.
+
+#define HASH_THREADS 8
+
+struct hash_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  struct hash_type *type;
+  struct hash_job *jobs;
+  int count, next, stop;
+};
+
+static void *hash_worker(void *arg)
+{
+  struct hash_pool *hp = arg;
+  struct hash_job *job;
+  char *buf = malloc(HASH_READ);
+  int i;
+
+  while (buf && !__atomic_load_n(&hp->stop, __ATOMIC_RELAXED)
+      && (i = __atomic_fetch_add(&hp->next, 1, __ATOMIC_RELAXED)) < hp->count)
+  {
+    hash_file(hp->type, job = hp->jobs+i, buf);
+    pthread_mutex_lock(&hp->lock);
+    job->done = 1;
+    pthread_cond_broadcast(&hp->ready);
+    pthread_mutex_unlock(&hp->lock);
+  }
+  free(buf);
+
+  return 0;
+}
+#endif
+
+// Hash count files and report() each, in order, stopping early if it says
+// to. With several CPUs the files are hashed on a pool of threads, and this
+// one hashes whatever's next if no worker's got to it yet.
+
+static void hash_list(struct hash_job *jobs, int count,
+  int (*report)(struct hash_job *job))
+{
+  int i;
+#if CFG_TOYBOX_THREADS
+  struct hash_pool hp;
+  pthread_t tid[HASH_THREADS];
+  pthread_attr_t attr;
+  int n = sysconf(_SC_NPROCESSORS_ONLN), threads = 0, j;
+
+  if (n > HASH_THREADS) n = HASH_THREADS;
+  if (n > count) n = count;
+  memset(&hp, 0, sizeof(hp));
+  hp.type = TT.type;
+  hp.jobs = jobs;
+  hp.count = count;
+  if (n > 1) {
+    pthread_mutex_init(&hp.lock, 0);
+    pthread_cond_init(&hp.ready, 0);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    while (threads < n-1
+      && !toy_worker_create(tid+threads, &attr, hash_worker, &hp)) threads++;
+    pthread_attr_destroy(&attr);
+  }
+#endif
+
+  for (i = 0; i<count; i++) {
+#if CFG_TOYBOX_THREADS
+    if (threads) {
+      // Take this one unless a worker already has.
+      j = i;
+      if (__atomic_compare_exchange_n(&hp.next, &j, i+1, 0, __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED)) hash_file(TT.type, jobs+i, TT.buf);
+      else {
+        pthread_mutex_lock(&hp.lock);
+        while (!jobs[i].done) pthread_cond_wait(&hp.ready, &hp.lock);
+        pthread_mutex_unlock(&hp.lock);
+      }
+    } else
+#endif
+    hash_file(TT.type, jobs+i, TT.buf);
+    if (report(jobs+i)) break;
+  }
 
-  printf((toys.optflags & FLAG_b) ? "\n" : "  %s\n", name);
+#if CFG_TOYBOX_THREADS
+  if (threads) {
+    __atomic_store_n(&hp.stop, 1, __ATOMIC_RELAXED);
+    for (j = 0; j<threads; j++) pthread_join(tid[j], 0);
+  }
+  if (n > 1) {
+    pthread_cond_destroy(&hp.ready);
+    pthread_mutex_destroy(&hp.lock);
+  }
+#endif
+}
+
+static int hash_print(struct hash_job *job)
+{
+  if ((errno = job->err)) perror_msg("%s", job->name);
+  else printf((toys.optflags & FLAG_b) ? "%s\n" : "%s  %s\n", job->out,
+    job->name);
+
+  return 0;
+}
+
+// Callback for loopfiles(): add the "HASH  NAME" (or "HASH *NAME") lines of
+// a -c list to TT.jobs.
+
+static void hash_checklist(int fd, char *name)
+{
+  struct hash_job *job;
+  struct linebuf lb;
+  char *line, *s;
+  long len;
+  int hex = 2*((struct hash_type *)TT.type)->digest;
+
+  linebuf_init(&lb, fd);
+  while ((line = get_linebuf(&lb, &len, '\n', LINEBUF_CHOMP))) {
+    for (s = line; isxdigit(*s); s++);
+    if (s-line != hex || *s != ' ' || (s[1] != ' ' && s[1] != '*') || !s[2]) {
+      TT.bad++;
+      continue;
+    }
+    if (!(TT.count&255))
+      TT.jobs = xrealloc(TT.jobs, (TT.count+256)*sizeof(struct hash_job));
+    job = TT.jobs+TT.count++;
+    memset(job, 0, sizeof(struct hash_job));
+    memcpy(job->want, line, hex);
+    job->name = xstrdup(s+2);
+  }
+  linebuf_done(&lb);
+}
+
+static int hash_check(struct hash_job *job)
+{
+  char *how = 0;
+
+  if ((errno = job->err)) {
+    perror_msg("%s", job->name);
+    how = " open or read";
+    TT.unread++;
+  } else if (strcasecmp(job->out, job->want)) {
+    how = "";
+    TT.failed++;
+  }
+  printf("%s: %s%s\n", job->name, how ? "FAILED" : "OK", how ? how : "");
+
+  return how && (toys.optflags & FLAG_fail_fast);
 }
 
 void md5sum_main(void)
 {
-  loopfiles(toys.optargs, do_hash);
+  struct hash_type *type = hash_types;
+  char **arg = toys.optc ? toys.optargs : (char *[]){"-", 0};
+  int i;
+
+  while (strcmp(type->name, toys.which->name)) type++;
+  hash_pick(TT.type = type);
+  TT.buf = xmalloc(HASH_READ);
+
+  if (toys.optflags & FLAG_c) {
+    loopfiles(toys.optargs, hash_checklist);
+    hash_list(TT.jobs, TT.count, hash_check);
+    if (TT.bad) error_msg("WARNING: %d lines improperly formatted", TT.bad);
+    if (TT.unread)
+      error_msg("WARNING: %d of %d listed files could not be read", TT.unread,
+        TT.count);
+    if (TT.failed)
+      error_msg("WARNING: %d of %d computed checksums did NOT match",
+        TT.failed, TT.count);
+    if (CFG_TOYBOX_FREE) {
+      for (i = 0; i<TT.count; i++) free(TT.jobs[i].name);
+      free(TT.jobs);
+    }
+  } else {
+    for (i = 0; arg[i]; i++);
+    TT.jobs = xzalloc(i*sizeof(struct hash_job));
+    for (TT.count = 0; TT.count<i; TT.count++)
+      TT.jobs[TT.count].name = arg[TT.count];
+    hash_list(TT.jobs, TT.count, hash_print);
+    if (CFG_TOYBOX_FREE) free(TT.jobs);
+  }
+  if (CFG_TOYBOX_FREE) free(TT.buf);
 }
 
 void sha1sum_main(void)
 {
   md5sum_main();
 }
+
+void sha256sum_main(void)
+{
+  md5sum_main();
+}
+
+void sha512sum_main(void)
+{
+  md5sum_main();
+}
@@ -15,7 +15,7 @@ config SEQ
 
     Count from first to last, by increment. Omitted arguments default
     to 1. Two arguments are used as first and last. Arguments can be
-    negative or floating point.
+    negative or floating point, integers print in full.
 
     -f	Use fmt_str as a printf-style floating point format string
     -s	Use sep_str as separator, default is a newline character
@@ -27,8 +27,13 @@ config SEQ
 GLOBALS(
   char *sep;
   char *fmt;
+
+  char *buf;
+  long len;
 )
 
+#define SEQ_BUF 65536
+
 // Ensure there's one %f escape with correct attributes
 static void insanitize(char *f)
 {
@@ -50,6 +55,49 @@ static void insanitize(char *f)
   if (*s || !found) error_exit("bad -f '%s'@%d", f, s-f+1);
 }
 
+// Collect output in a big buffer, writing it out when it fills.
+static void seq_add(char *s, long len)
+{
+  if (TT.len+len > SEQ_BUF) {
+    txwrite(1, TT.buf, TT.len);
+    TT.len = 0;
+    if (len > SEQ_BUF) {
+      txwrite(1, s, len);
+
+      return;
+    }
+  }
+  memcpy(TT.buf+TT.len, s, len);
+  TT.len += len;
+}
+
+// Counting up from 0 or more by a whole number, step the digits in ascii
+// rather than formatting each number.
+static void seq_count(unsigned long long first, unsigned long long increment,
+  unsigned long long last, char *sep)
+{
+  struct ascii_count ac;
+  unsigned long long n;
+  long seplen = strlen(sep);
+
+  TT.buf = xmalloc(SEQ_BUF);
+  ascii_count_init(&ac, first, increment);
+  for (n = first; n<=last; n += increment) {
+    if (n != first) seq_add(sep, seplen);
+    seq_add(ascii_count_str(&ac), ac.len);
+    ascii_count_next(&ac);
+  }
+  if (n != first) seq_add("\n", 1);
+  txwrite(1, TT.buf, TT.len);
+  if (CFG_TOYBOX_FREE) free(TT.buf);
+}
+
+// Whole number a double can hold exactly?
+static int seq_int(double d)
+{
+  return d == (long long)d && d < (1LL<<53) && d > -(1LL<<53);
+}
+
 void seq_main(void)
 {
   double first, increment, last, dd;
@@ -66,8 +114,16 @@ void seq_main(void)
     default: last = atof(toys.optargs[toys.optc-1]);
   }
 
-  if (toys.optflags & FLAG_f) insanitize(fmt_str = TT.fmt);
   if (toys.optflags & FLAG_s) sep_str = TT.sep;
+  if (toys.optflags & FLAG_f) insanitize(fmt_str = TT.fmt);
+  else if (seq_int(first) && seq_int(increment) && seq_int(last)) {
+    if (first>=0 && increment>0) {
+      seq_count(first, increment, last, sep_str);
+
+      return;
+    }
+    fmt_str = "%.0f";
+  }
 
   // Yes, we're looping on a double.  Yes rounding errors can accumulate if
   // you use a non-integer increment.  Deal with it.
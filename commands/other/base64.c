@@ -24,58 +24,48 @@ config BASE64
 
 GLOBALS(
   long columns;
+
+  char *buf;
 )
 
+// Read this much at a time: a multiple of 3 bytes, which encode to 64k.
+#define BASE64_READ (3*16384)
+#define BASE64_ENC (BASE64_READ/3*4)
+
 static void do_base64(int fd, char *name)
 {
-  (void)name;
-  int out = 0, bits = 0, x = 0, i, len;
-  char *buf = toybuf+128;
+  int state = 0, carry = 0, x = 0, len, n, i, j;
+  char *in = TT.buf, *enc = in+BASE64_READ, *wrap = enc+BASE64_ENC, *s, *o;
 
   for (;;) {
-    if (!(len = xread(fd, buf, sizeof(toybuf)-128))) {
-      if (!(toys.optflags & FLAG_d)) {
-        if (bits) {
-          putchar(toybuf[out<<(6-bits)]);
-          x++;
-        }
-        while (x++&3)  putchar('=');
-        if (x != 1) xputc('\n');
-      }
+    len = xread(fd, in+carry, BASE64_READ-carry);
 
-      return;
-    }
-    for (i=0; i<len; i++) {
-      if (toys.optflags & FLAG_d) {
-        if (buf[i] == '=') return;
-
-        if ((x = stridx(toybuf, buf[i])) != -1) {
-          out = (out<<6) + x;
-          bits += 6;
-          if (bits >= 8) {
-            putchar(out >> (bits -= 8));
-            out &= (1<<bits)-1;
-            if (ferror(stdout)) perror_exit(0);
-          }
+    if (toys.optflags & FLAG_d) {
+      if (0>(n = base64_decode(enc, in, len, &state, toys.optflags & FLAG_i)))
+        error_exit("bad input");
+      txwrite(1, enc, n);
+      if (!len || state == -1) return;
 
-          continue;
-        }
-        if (buf[i] == '\n' || (toys.optflags & FLAG_i)) continue;
+      continue;
+    }
 
-        break;
-      } else {
-        out = (out<<8) + buf[i];
-        bits += 8;
-        while (bits >= 6) {
-          putchar(toybuf[out >> (bits -= 6)]);
-          out &= (1<<bits)-1;
-          if (TT.columns == ++x) {
-            xputc('\n');
-            x = 0;
-          }
-        }
+    // Encode whole groups of 3 bytes until the end, then wrap the lines.
+    i = len ? (len+carry)%3 : 0;
+    n = base64_encode(enc, in, len+carry-i);
+    for (s = enc, o = wrap; n; n -= j, s += j, x += j) {
+      if (x == TT.columns) {
+        *o++ = '\n';
+        x = 0;
       }
+      if ((j = TT.columns-x) > n) j = n;
+      memcpy(o, s, j);
+      o += j;
     }
+    if (!len && x) *o++ = '\n';
+    txwrite(1, wrap, o-wrap);
+    if (!len) return;
+    memmove(in, in+len+carry-i, i);
+    carry = i;
   }
 }
 
@@ -83,6 +73,7 @@ void base64_main(void)
 {
   if (!TT.columns) TT.columns = 76;
 
-  base64_init(toybuf);
+  TT.buf = xmalloc(BASE64_READ+BASE64_ENC+BASE64_ENC+BASE64_ENC/TT.columns+2);
   loopfiles(toys.optargs, do_base64);
+  if (CFG_TOYBOX_FREE) free(TT.buf);
 }
@@ -13,7 +13,9 @@ config BLKID
   help
     usage: blkid DEV...
 
-    Prints type, label and UUID of filesystem on a block device or image.
+    Prints type, label and UUID of filesystem on a block device or image,
+    or with no DEV on every partition in /proc/partitions. What was found
+    on each block device is kept in /run/blkid.cache until it changes.
 
 config FSTYPE
   bool "fstype"
@@ -57,113 +59,317 @@ static const struct fstype fstypes[] = {
   {"vfat", 0x31544146, 4, 54, 39+(4<<24), 11, 43}     // fat1
 };
 
-static void do_blkid(int fd, char *name)
-{
-  int off, i, j;
-  char *type;
+// Every offset in fstypes[] falls within the first 17 pages, so one read of
+// that much answers all of them.
+#define BLKID_SPAN (17*4096)
+#define BLKID_THREADS 8
 
-  off = i = 0;
+// What we know about a block device from earlier runs, one line each:
+// "NAME RDEV SIZE DISKSEQ PROBED TYPE LABEL=... UUID=...", TYPE "-" if there
+// was nothing recognizable. An entry is good until the device's size or
+// diskseq (bumped by the kernel when media changes) differ, or the device
+// node is written to (mkfs, tune2fs), which updates its mtime.
+#define BLKID_CACHE "/run/blkid.cache"
 
-  for (;;) {
-    int pass = 0, len;
+struct blkid_dev {
+  char *name, *type, *info;
+  int fd, cached;
+  struct stat st;
+  unsigned long long size, seq;
+  long long probed;
+};
 
-    // Read next block of data
-    len = readall(fd, toybuf, sizeof(toybuf));
-    if (len != sizeof(toybuf)) return;
+// Identify the filesystem from the start of the device, reading it into
+// buf (BLKID_SPAN bytes). This runs in worker threads, where an error_exit()
+// would leave the caller waiting for the device, so without memory for the
+// label and UUID it just skips them.
+static void blkid_probe(struct blkid_dev *dev, unsigned char *buf)
+{
+  const struct fstype *fs = 0;
+  char *s;
+  int len, blk, i, j;
 
-    // Iterate through types in range
-    for (i=0; (size_t)i < sizeof(fstypes)/sizeof(struct fstype); i++) {
-      uint64_t test;
+  len = readall(dev->fd, buf, BLKID_SPAN);
 
-      // Skip tests not in this 4k block
-      if (fstypes[i].magic_offset > off+(int)sizeof(toybuf)) {
-        pass++;
-        continue;
-      }
-      if (fstypes[i].magic_offset < off) continue;
+  // Earlier pages win, then earlier entries in the table.
+  for (blk = 0; !fs && blk*4096<len; blk++) {
+    for (i = 0; i<ARRAY_LEN(fstypes); i++) {
+      uint64_t test = 0;
+
+      if (fstypes[i].magic_offset/4096 != blk
+          || fstypes[i].magic_offset+fstypes[i].magic_len > len) continue;
 
       // Populate 64 bit little endian magic value
-      test = 0;
       for (j = 0; j < fstypes[i].magic_len; j++)
-        test += ((uint64_t)toybuf[j+fstypes[i].magic_offset-off])<<(8*j);
-      if (test == fstypes[i].magic) break;
-    }
-
-    if (i == ARRAY_LEN(fstypes)) {
-      off += len;
-      if (pass) continue;
-      return;
+        test += ((uint64_t)buf[j+fstypes[i].magic_offset])<<(8*j);
+      if (test == fstypes[i].magic) {
+        fs = fstypes+i;
+        break;
+      }
     }
-    break;
   }
+  if (!fs) return;
 
   // distinguish ext2/3/4
-  type = fstypes[i].name;
-  if (!i) {
-    if (toybuf[1116]&4) type = "ext3";
-    if (toybuf[1120]&64) type = "ext4";
+  dev->type = fs->name;
+  if (fs == fstypes+1 && len>1120) {
+    if (buf[1116]&4) dev->type = "ext3";
+    if (buf[1120]&64) dev->type = "ext4";
   }
 
   // Could special case NTFS here...
 
-  // Output for fstype
-  if (*toys.which->name == 'f') {
-    puts(type);
+  if (!(s = dev->info = calloc(1, fs->label_len+64))) return;
+  if (fs->label_len && fs->label_off+fs->label_len <= len)
+    s += sprintf(s, " LABEL=\"%.*s\"", fs->label_len, buf+fs->label_off);
+
+  if (fs->uuid_off) {
+    int bits = 0x550, size = fs->uuid_off >> 24,
+        uoff = fs->uuid_off & ((1<<24)-1);
+
+    if (size) bits = 4*(size == 4);
+    else size = 16;
+
+    if (uoff+size <= len) {
+      s += sprintf(s, " UUID=\"");
+      for (j = 0; j < size; j++)
+        s += sprintf(s, "-%02x"+!(bits & (1<<j)), buf[uoff+j]);
+      strcpy(s, "\"");
+    }
+  }
+}
+
+#if CFG_TOYBOX_THREADS
+// The devices to probe, and a read buffer for each thread allocated before
+// any start.
+struct blkid_work {
+  pthread_mutex_t lock;
+  struct blkid_dev **devs;
+  unsigned char *bufs;
+  int count, next, slots;
+};
+
+static void *blkid_thread(void *arg)
+{
+  struct blkid_work *work = arg;
+  unsigned char *buf;
+  int i;
+
+  pthread_mutex_lock(&work->lock);
+  buf = work->bufs+BLKID_SPAN*work->slots++;
+  pthread_mutex_unlock(&work->lock);
+  for (;;) {
+    pthread_mutex_lock(&work->lock);
+    i = work->next++;
+    pthread_mutex_unlock(&work->lock);
+    if (i>=work->count) return 0;
+    blkid_probe(work->devs[i], buf);
+  }
+}
+#endif
+
+// Probe everything the cache couldn't answer for, a few devices at once
+// since each one is mostly waiting on its disk.
+static void blkid_probe_all(struct blkid_dev **devs, int count)
+{
+#if CFG_TOYBOX_THREADS
+  struct blkid_work work;
+  pthread_attr_t attr;
+  pthread_t tid[BLKID_THREADS];
+  int threads = 0, n = count<BLKID_THREADS+1 ? count : BLKID_THREADS+1;
+
+  if (!count) return;
+  memset(&work, 0, sizeof(work));
+  pthread_mutex_init(&work.lock, 0);
+  work.devs = devs;
+  work.count = count;
+  work.bufs = xmalloc(n*BLKID_SPAN);
+  if (count>1) {
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    while (threads<n-1)
+      if (toy_worker_create(tid+threads, &attr, blkid_thread, &work)) break;
+      else threads++;
+    pthread_attr_destroy(&attr);
+  }
+  blkid_thread(&work);
+  while (threads--) pthread_join(tid[threads], 0);
+  pthread_mutex_destroy(&work.lock);
+  free(work.bufs);
+#else
+  unsigned char *buf = xmalloc(BLKID_SPAN);
+  int i;
+
+  for (i = 0; i<count; i++) blkid_probe(devs[i], buf);
+  free(buf);
+#endif
+}
+
+// The disk sequence number is on the whole disk, not its partitions.
+static unsigned long long blkid_diskseq(dev_t rdev)
+{
+  char path[64], buf[32], *up;
+
+  for (up = ""; ; up = "../") {
+    sprintf(path, "/sys/dev/block/%ld:%ld/%sdiskseq", (long)major(rdev),
+      (long)minor(rdev), up);
+    if (readfile(path, buf, sizeof(buf))) return strtoull(buf, 0, 10);
+    if (*up) return 0;
+  }
+}
+
+// Look for a cache line that still describes dev, and take it out of the
+// list so saving doesn't write it twice.
+static void blkid_lookup(struct blkid_dev *dev, char **lines, int nlines)
+{
+  unsigned long long rdev, size, seq;
+  long long probed;
+  int i, n, len = strlen(dev->name);
+  char *s, *type;
+
+  for (i = 0; i<nlines; i++) {
+    s = lines[i];
+    if (!s || strncmp(s, dev->name, len) || s[len] != ' ') continue;
+    n = 0;
+    if (4 != sscanf(s+len, " %llx %llu %llu %lld %n", &rdev, &size, &seq,
+        &probed, &n) || !n) continue;
+    lines[i] = 0;
+    if (rdev != dev->st.st_rdev || size != dev->size || seq != dev->seq
+        || dev->st.st_mtime >= probed) return;
+    dev->cached = 1;
+    dev->probed = probed;
+    type = s+len+n;
+    if ((s = strchr(type, ' '))) {
+      dev->info = xstrdup(s);
+      *s = 0;
+    }
+    if (strcmp(type, "-")) dev->type = type;
+
     return;
   }
+}
 
-  // output for blkid
-  printf("%s:",name);
+// Rewrite the cache with this run's answers and the lines nobody asked about.
+static void blkid_save(struct blkid_dev *devs, int count, char **lines,
+  int nlines)
+{
+  char *tmp = xstrdup(BLKID_CACHE ".XXXXXX");
+  FILE *fp = 0;
+  int fd, i;
 
-  if (fstypes[i].label_len)
-    printf(" LABEL=\"%.*s\"", fstypes[i].label_len,
-           toybuf+fstypes[i].label_off-off);
+  if (-1 != (fd = mkstemp(tmp))) {
+    fchmod(fd, 0644);
+    if (!(fp = fdopen(fd, "w"))) close(fd);
+  }
+  if (fp) {
+    for (i = 0; i<nlines; i++) if (lines[i]) fprintf(fp, "%s\n", lines[i]);
+    for (i = 0; i<count; i++) {
+      struct blkid_dev *dev = devs+i;
 
-  if (fstypes[i].uuid_off) {
-    int bits = 0x550, size = fstypes[i].uuid_off >> 24,
-        uoff = (fstypes[i].uuid_off & ((1<<24)-1))-off;
+      if (dev->fd == -1 || !S_ISBLK(dev->st.st_mode)
+          || (dev->info && strchr(dev->info, '\n'))) continue;
+      fprintf(fp, "%s %llx %llu %llu %lld %s%s\n", dev->name,
+        (unsigned long long)dev->st.st_rdev, dev->size, dev->seq,
+        dev->probed, dev->type ? dev->type : "-", dev->info ? dev->info : "");
+    }
+  }
+  if (fd != -1 && (!fp || fclose(fp) || rename(tmp, BLKID_CACHE))) unlink(tmp);
+  free(tmp);
+}
 
-    if (size) bits = 4*(size == 4);
-    else size = 16;
+// Identify each of names, from the cache where it's still good, printing
+// them in the order given.
+static void blkid_run(char **names, int count, int scan)
+{
+  struct blkid_dev *devs = xzalloc(count*sizeof(*devs)), *dev,
+    **todo = xmalloc(count*sizeof(*todo));
+  char *data, **lines = 0, *s;
+  int i, nlines = 0, ntodo = 0, save = 0;
+  long long now = time(0);
+
+  if ((data = readfile(BLKID_CACHE, 0, 0))) {
+    for (s = data; *s; s++) nlines += *s == '\n';
+    lines = xmalloc((nlines+1)*sizeof(*lines));
+    for (nlines = 0, s = data; *s; nlines++) {
+      lines[nlines] = s;
+      if (!(s = strchr(s, '\n'))) break;
+      *s++ = 0;
+    }
+  }
+
+  for (i = 0; i<count; i++) {
+    dev = devs+i;
+    dev->name = names[i];
+    if (!strcmp(dev->name, "-")) dev->fd = 0;
+    else if (-1 == (dev->fd = open(dev->name, O_RDONLY|O_CLOEXEC))) {
+#ifdef ENOMEDIUM
+      if (!scan || errno != ENOMEDIUM)
+#endif
+        perror_msg("%s", dev->name);
+      if (!scan) toys.exitval = 1;
+      continue;
+    }
+    fstat(dev->fd, &dev->st);
+    if (S_ISBLK(dev->st.st_mode)) {
+      dev->size = lseek(dev->fd, 0, SEEK_END);
+      lseek(dev->fd, 0, SEEK_SET);
+      dev->seq = blkid_diskseq(dev->st.st_rdev);
+      blkid_lookup(dev, lines, nlines);
+    }
+    if (!dev->cached) {
+      dev->probed = now;
+      todo[ntodo++] = dev;
+      save |= S_ISBLK(dev->st.st_mode);
+    }
+  }
+  blkid_probe_all(todo, ntodo);
 
-    printf(" UUID=\"");
-    for (j = 0; j < size; j++) printf("-%02x"+!(bits & (1<<j)), toybuf[uoff+j]);
-    printf("\"");
+  for (i = 0; i<count; i++) {
+    dev = devs+i;
+    if (dev->fd == -1) continue;
+    if (dev->type) {
+      // Output for fstype
+      if (*toys.which->name == 'f') puts(dev->type);
+      // output for blkid
+      else printf("%s:%s TYPE=\"%s\"\n", dev->name,
+        dev->info ? dev->info : "", dev->type);
+    }
+    if (dev->fd) close(dev->fd);
   }
+  if (save) blkid_save(devs, count, lines, nlines);
 
-  printf(" TYPE=\"%s\"\n", type);
+  for (i = 0; i<count; i++) free(devs[i].info);
+  free(devs);
+  free(todo);
+  free(lines);
+  free(data);
 }
 
 void blkid_main(void)
 {
-  if (*toys.optargs) loopfiles(toys.optargs, do_blkid);
+  if (*toys.optargs) blkid_run(toys.optargs, toys.optc, 0);
   else {
     unsigned int ma, mi, sz;
-    int fd;
-    char *name = toybuf, *buffer = toybuf+1024, device[32];
+    char *name = toybuf, *buffer = toybuf+1024, **devices = 0;
     FILE *fp = xfopen("/proc/partitions", "r");
+    int count = 0;
 
     while (fgets(buffer, 1024, fp)) {
       *name = 0;
       if (sscanf(buffer, " %u %u %u %[^\n ]", &ma, &mi, &sz, name) != 4)
         continue;
 
-      sprintf(device, "/dev/%.20s", name);
-      if (-1 == (fd = open(device, O_RDONLY))) {
-#ifdef ENOMEDIUM
-        if (errno != ENOMEDIUM) 
-#endif
-                perror_msg("%s", device);
-      } else {
-        do_blkid(fd, device);
-        close(fd);
-      }
+      if (!(count&31)) devices = xrealloc(devices, (count+32)*sizeof(char *));
+      devices[count++] = xmprintf("/dev/%.20s", name);
     }
-    if (CFG_TOYBOX_FREE) fclose(fp);
+    fclose(fp);
+    blkid_run(devices, count, 1);
+    while (count--) free(devices[count]);
+    free(devices);
   }
 }
 
 void fstype_main(void)
 {
-  loopfiles(toys.optargs, do_blkid);
+  blkid_run(toys.optargs, toys.optc, 0);
 }
@@ -41,7 +41,9 @@ config BZCAT
 #define FOR_bunzip2
 #include "toys.h"
 
-#define THREADS 1
+// Most blocks to undo the burrows-wheeler transform of at once, one thread
+// each (up to the number of processors).
+#define THREADS 4
 
 // Constants for huffman coding
 #define MAX_GROUPS               6
@@ -75,6 +77,14 @@ struct bwdata {
   int writePos, writeRun, writeCount, writeCurrent;
   unsigned int dataCRC, headerCRC;
   unsigned int *dbuf;
+
+  // Block contents after undoing burrows-wheeler, before the final run
+  // length decoding (which can expand it 50 times, so that's left for output)
+  unsigned char *block;
+#if CFG_TOYBOX_THREADS
+  pthread_t tid;
+  int started;
+#endif
 };
 
 // Structure holding all the housekeeping data, including IO buffers and
@@ -89,7 +99,7 @@ struct bunzip_data {
   char outbuf[IOBUF_SIZE];
   int outbufPos;
 
-  unsigned int totalCRC;
+  unsigned int totalCRC, streamCRC;
 
   // First pass decompression data (Huffman and MTF decoding)
   char selectors[32768];                  // nSelectors=15 bits
@@ -97,11 +107,11 @@ struct bunzip_data {
   int symTotal, groupCount, nSelectors;
   unsigned char symToByte[256], mtfSymbol[256];
 
-  // The CRC values stored in the block header and calculated from the data
-  unsigned int crc32Table[256];
-
-  // Second pass decompression data (burrows-wheeler transform)
+  // Second pass decompression data (burrows-wheeler transform). Blocks are
+  // huffman decoded in order, then queued in bwdata[first...] (wrapping at
+  // threads) while their transforms are undone in the background.
   unsigned int dbufSize;
+  int threads, first, queued, error;
   struct bwdata bwdata[THREADS];
 };
 
@@ -131,7 +141,8 @@ static unsigned int get_bits(struct bunzip_data *bd, char bits_wanted)
     }
 
     // Grab next 8 bits of input from buffer.
-    bd->inbufBits = (bd->inbufBits<<8) | bd->inbuf[bd->inbufPos++];
+    bd->inbufBits = (bd->inbufBits<<8)
+      | (unsigned char)bd->inbuf[bd->inbufPos++];
     bd->inbufBitCount += 8;
   }
 
@@ -447,9 +458,8 @@ static void flush_bunzip_outbuf(struct bunzip_data *bd, int out_fd)
   }
 }
 
-static void burrows_wheeler_prep(struct bunzip_data *bd, struct bwdata *bw)
+static void burrows_wheeler_prep(struct bwdata *bw)
 {
-  (void)bd;
   int ii, jj;
   unsigned int *dbuf = bw->dbuf;
   int *byteCount = bw->byteCount;
@@ -491,52 +501,112 @@ static void burrows_wheeler_prep(struct bunzip_data *bd, struct bwdata *bw)
   }
 }
 
-// Decompress a block of text to intermediate buffer
-static int read_bunzip_data(struct bunzip_data *bd)
+// Undo burrows-wheeler transform on intermediate buffer, into bw->block.
+// This only touches bw, so it can run in its own thread.
+//
+// Burrows-wheeler transform is described at:
+// http://dogma.net/markn/articles/bwt/bwt.htm
+// http://marknelson.us/1996/09/01/bwt/
+
+static void *burrows_wheeler(void *arg)
+{
+  struct bwdata *bw = arg;
+  unsigned int *dbuf = bw->dbuf;
+  unsigned char *block = bw->block;
+  int count, pos;
+
+  burrows_wheeler_prep(bw);
+
+  // Follow sequence vector to undo Burrows-Wheeler transform. This is the
+  // other "tight inner loop", and it's a series of dependent cache misses.
+  for (pos = bw->writePos, count = 0; count < bw->writeCount; count++) {
+    pos = dbuf[pos];
+    block[count] = pos;
+    pos >>= 8;
+  }
+  bw->writePos = 0;
+
+  return 0;
+}
+
+// Decompress a block of text to intermediate buffer, and start undoing its
+// burrows-wheeler transform in the background.
+static int read_bunzip_data(struct bunzip_data *bd, struct bwdata *bw)
 {
-  int rc = read_block_header(bd, bd->bwdata);
-  if (!rc) rc=read_huffman_data(bd, bd->bwdata);
+  int rc = read_block_header(bd, bw);
+
+  if (!rc) rc = read_huffman_data(bd, bw);
+  if (rc) return rc;
+
+#if CFG_TOYBOX_THREADS
+  if (bd->threads > 1) {
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    bw->started = !toy_worker_create(&bw->tid, &attr, burrows_wheeler, bw);
+    pthread_attr_destroy(&attr);
+    if (bw->started) return 0;
+  }
+#endif
+  burrows_wheeler(bw);
 
-  // First thing that can be done by a background thread.
-  burrows_wheeler_prep(bd, bd->bwdata);
+  return 0;
+}
+
+// Wait for a queued block's burrows-wheeler transform to finish.
+static void bunzip_wait(struct bwdata *bw)
+{
+#if CFG_TOYBOX_THREADS
+  if (bw->started) pthread_join(bw->tid, 0);
+  bw->started = 0;
+#endif
+}
 
-  return rc;
+// CRC the output from *start to the end of outbuf, so it's done a buffer
+// at a time instead of a byte at a time.
+static void bunzip_crc(struct bunzip_data *bd, struct bwdata *bw, int *start)
+{
+  bw->dataCRC = crc_update(bw->dataCRC, bd->outbuf+*start,
+    bd->outbufPos-*start, 0);
+  *start = bd->outbufPos;
 }
 
-// Undo burrows-wheeler transform on intermediate buffer to produce output.
+// Undo the final run length encoding of each block in order to produce output.
 // If !len, write up to len bytes of data to buf.  Otherwise write to out_fd.
 // Returns len ? bytes written : 0.  Notice all errors are negative #'s.
-//
-// Burrows-wheeler transform is described at:
-// http://dogma.net/markn/articles/bwt/bwt.htm
-// http://marknelson.us/1996/09/01/bwt/
 
-static int write_bunzip_data(struct bunzip_data *bd, struct bwdata *bw,
-  int out_fd, char *outbuf, int len)
+static int write_bunzip_data(struct bunzip_data *bd, int out_fd, char *outbuf,
+  int len)
 {
-  unsigned int *dbuf = bw->dbuf;
-  int count, pos, current, run, copies, outbyte, previous, gotcount = 0;
+  struct bwdata *bw;
+  unsigned char *block;
+  int count, pos, current, run, copies, outbyte, previous, gotcount = 0,
+    crcpos, i;
 
   for (;;) {
-    // If last read was short due to end of file, return last block now
-    if (bw->writeCount < 0) return bw->writeCount;
-
-    // If we need to refill dbuf, do it.
-    if (!bw->writeCount) {
-      int i = read_bunzip_data(bd);
-      if (i) {
-        if (i == RETVAL_LAST_BLOCK) {
-          bw->writeCount = i;
-          return gotcount;
-        } else return i;
-      }
+    // Keep up to bd->threads blocks in flight, read in order. On error (or
+    // the end of stream block) stop reading but still write what's queued.
+    while (!bd->error && bd->queued < bd->threads) {
+      bw = bd->bwdata+(bd->first+bd->queued)%bd->threads;
+      if ((i = read_bunzip_data(bd, bw))) {
+        if (i == RETVAL_LAST_BLOCK) bd->streamCRC = bw->headerCRC;
+        bd->error = i;
+      } else bd->queued++;
     }
 
+    // Finished?
+    if (!bd->queued) return gotcount ? gotcount : bd->error;
+    bw = bd->bwdata+bd->first;
+    bunzip_wait(bw);
+
     // loop generating output
+    block = bw->block;
     count = bw->writeCount;
     pos = bw->writePos;
     current = bw->writeCurrent;
     run = bw->writeRun;
+    crcpos = bd->outbufPos;
     while (count) {
 
       // If somebody (like tar) wants a certain number of bytes of
@@ -544,11 +614,8 @@ static int write_bunzip_data(struct bunzip_data *bd, struct bwdata *bw,
       if (len && bd->outbufPos >= len) goto dataus_interruptus;
       count--;
 
-      // Follow sequence vector to undo Burrows-Wheeler transform.
       previous = current;
-      pos = dbuf[pos];
-      current = pos&0xff;
-      pos >>= 8;
+      current = block[pos++];
 
       // Whenever we see 3 consecutive copies of the same byte,
       // the 4th is a repeat count
@@ -563,25 +630,29 @@ static int write_bunzip_data(struct bunzip_data *bd, struct bwdata *bw,
 
       // Output bytes to buffer, flushing to file if necessary
       while (copies--) {
-        if (bd->outbufPos == IOBUF_SIZE) flush_bunzip_outbuf(bd, out_fd);
+        if (bd->outbufPos == IOBUF_SIZE) {
+          bunzip_crc(bd, bw, &crcpos);
+          flush_bunzip_outbuf(bd, out_fd);
+          crcpos = 0;
+        }
         bd->outbuf[bd->outbufPos++] = outbyte;
-        bw->dataCRC = (bw->dataCRC << 8)
-                ^ bd->crc32Table[(bw->dataCRC >> 24) ^ outbyte];
       }
       if (current != previous) run=0;
     }
 
     // decompression of this block completed successfully
+    bunzip_crc(bd, bw, &crcpos);
     bw->dataCRC = ~(bw->dataCRC);
     bd->totalCRC = ((bd->totalCRC << 1) | (bd->totalCRC >> 31)) ^ bw->dataCRC;
 
-    // if this block had a crc error, force file level crc error.
-    if (bw->dataCRC != bw->headerCRC) {
-      bd->totalCRC = bw->headerCRC+1;
+    // if this block had a crc error, stop here.
+    if (bw->dataCRC != bw->headerCRC) return RETVAL_DATA_ERROR;
 
-      return RETVAL_LAST_BLOCK;
-    }
+    // Its slot can take the next block.
+    bd->first = (bd->first+1)%bd->threads;
+    bd->queued--;
 dataus_interruptus:
+    bunzip_crc(bd, bw, &crcpos);
     bw->writeCount = count;
     if (len) {
       gotcount += bd->outbufPos;
@@ -624,8 +695,6 @@ static int start_bunzip(struct bunzip_data **bdp, int src_fd, char *inbuf,
     bd->in_fd = src_fd;
   }
 
-  crc_init(bd->crc32Table, 0);
-
   // Ensure that file starts with "BZh".
   for (i=0;i<3;i++) if ((char)get_bits(bd,8)!="BZh"[i]) return RETVAL_NOT_BZIP_DATA;
 
@@ -633,9 +702,16 @@ static int start_bunzip(struct bunzip_data **bdp, int src_fd, char *inbuf,
   // uncompressed data. Allocate intermediate buffer for block.
   i = get_bits(bd, 8);
   if (i<'1' || i>'9') return RETVAL_NOT_BZIP_DATA;
-  bd->dbufSize = 100000*(i-'0')*THREADS;
-  for (i=0; i<THREADS; i++)
-    bd->bwdata[i].dbuf = xmalloc(bd->dbufSize * sizeof(int));
+  bd->dbufSize = 100000*(i-'0');
+  bd->threads = 1;
+#if CFG_TOYBOX_THREADS
+  if ((bd->threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1) bd->threads = 1;
+  if (bd->threads > THREADS) bd->threads = THREADS;
+#endif
+  for (i=0; i<bd->threads; i++) {
+    bd->bwdata[i].dbuf = xmalloc(bd->dbufSize * (sizeof(int)+1));
+    bd->bwdata[i].block = (void *)(bd->bwdata[i].dbuf+bd->dbufSize);
+  }
 
   return 0;
 }
@@ -649,12 +725,18 @@ static char *bunzipStream(int src_fd, int dst_fd)
   int i, j;
 
   if (!(i = start_bunzip(&bd,src_fd, 0, 0))) {
-    i = write_bunzip_data(bd,bd->bwdata, dst_fd, 0, 0);
-    if (i==RETVAL_LAST_BLOCK && bd->bwdata[0].headerCRC==bd->totalCRC) i = 0;
+    i = write_bunzip_data(bd, dst_fd, 0, 0);
+    if (i==RETVAL_LAST_BLOCK) {
+      if (bd->streamCRC==bd->totalCRC) i = 0;
+      else i = RETVAL_DATA_ERROR;
+    }
   }
   flush_bunzip_outbuf(bd, dst_fd);
 
-  for (j=0; j<THREADS; j++) free(bd->bwdata[j].dbuf);
+  for (j=0; j<bd->threads; j++) {
+    bunzip_wait(bd->bwdata+j);
+    free(bd->bwdata[j].dbuf);
+  }
   free(bd);
 
   return bunzip_errors[-i];
@@ -663,7 +745,7 @@ static char *bunzipStream(int src_fd, int dst_fd)
 static void do_bzcat(int fd, char *name)
 {
   (void)name;
-  char *err = bunzipStream(fd, 1);
+  char *err = bunzipStream(fd, fileno(stdout));
 
   if (err) error_exit(err);
 }
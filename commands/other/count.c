@@ -13,20 +13,24 @@ config COUNT
     Copy stdin to stdout, displaying simple progress indicator to stderr.
 */
 
+#define FOR_count
 #include "toys.h"
 
+GLOBALS(
+  unsigned long long size;
+)
+
+static void count_block(int out, char *buf, long len)
+{
+  char num[32];
+
+  TT.size += len;
+  txwrite(out, buf, len);
+  txwrite(2, num, sprintf(num, "%llu bytes\r", TT.size));
+}
+
 void count_main(void)
 {
-  uint64_t size = 0;
-  int len;
-  char buf[32];
-
-  for (;;) {
-    len = xread(0, toybuf, sizeof(toybuf));
-    if (!len) break;
-    size += len;
-    txwrite(1, toybuf, len);
-    txwrite(2, buf, sprintf(buf, "%"PRIu64" bytes\r", size));
-  }
+  if (xcopy(fileno(stdin), fileno(stdout), count_block)) perror_exit("read");
   txwrite(2, "\n", 1);
 }
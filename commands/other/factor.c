@@ -12,77 +12,375 @@ config FACTOR
   help
     usage: factor NUMBER...
 
-    Factor integers.
+    Factor integers, up to 64 bits. With no arguments, factor the numbers
+    on stdin.
 */
 
 #include "toys.h"
 #include "xfuncs.h"
 
-static void factor(char *s)
+// Numbers are taken this many at a time, factored (on a pool of threads if
+// there's more than one CPU) and then printed in order.
+#define FACTOR_BATCH 1024
+
+// Trial division goes this far, anything left over is for Pollard's rho.
+#define FACTOR_TRIAL 1024
+
+struct factor_job {
+  char *s;
+  unsigned long long n, f[64];
+  int count, neg, bad, done;
+};
+
+// Montgomery form modulo an odd n: x is kept as x*2^64 mod n, so that
+// multiplying needs no division.
+struct mont {
+  unsigned long long n, ninv, one, r2;
+};
+
+// Multiply 64x64 bits, returning the high half and leaving the low in *lo.
+static unsigned long long mul128(unsigned long long a, unsigned long long b,
+  unsigned long long *lo)
 {
-  long l, ll;
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 p = (unsigned __int128)a*b;
 
-  for (;;) {
-    char *err = s;
+  *lo = p;
 
-    while(isspace(*s)) s++;
-    if (!*s) return;
+  return p>>64;
+#else
+  unsigned long long al = a&0xffffffff, ah = a>>32, bl = b&0xffffffff,
+    bh = b>>32, ll = al*bl, lh = al*bh, hl = ah*bl,
+    mid = (ll>>32)+(lh&0xffffffff)+(hl&0xffffffff);
 
-    l = strtol(s, &s, 0);
-    if (*s && !isspace(*s)) {
-      error_msg("%s: not integer", err);
+  *lo = (mid<<32)|(ll&0xffffffff);
 
-      return;
-    }
+  return ah*bh+(lh>>32)+(hl>>32)+(mid>>32);
+#endif
+}
 
-    printf("%ld:", l);
+static unsigned long long mont_mul(struct mont *m, unsigned long long a,
+  unsigned long long b)
+{
+  unsigned long long lo, hi = mul128(a, b, &lo), mlo, mhi, t;
+  int over;
 
-    // Negative numbers have -1 as a factor
-    if (l < 0) {
-      printf(" -1");
-      l *= -1;
-    }
+  // Add the multiple of n that clears the low half, and keep the high half.
+  // The low halves add up to 0 mod 2^64, carrying one unless lo was 0.
+  mhi = mul128(lo*m->ninv, m->n, &mlo);
+  t = hi+mhi;
+  over = t<hi;
+  if (lo && !++t) over = 1;
+  if (over || t >= m->n) t -= m->n;
 
-    // Nothing below 4 has factors
-    if (l < 4) {
-      printf(" %ld\n", l);
-      continue;
-    }
+  return t;
+}
+
+static unsigned long long mont_add(struct mont *m, unsigned long long a,
+  unsigned long long b)
+{
+  return a >= m->n-b ? a-(m->n-b) : a+b;
+}
+
+static void mont_init(struct mont *m, unsigned long long n)
+{
+  unsigned long long x = n;
+  int i;
+
+  // Newton's method doubles the correct low bits of 1/n each time.
+  for (i = 0; i<5; i++) x *= 2-n*x;
+  m->n = n;
+  m->ninv = -x;
+  m->one = -n%n;
+  for (m->r2 = m->one, i = 0; i<64; i++) m->r2 = mont_add(m, m->r2, m->r2);
+}
+
+static unsigned long long mont_pow(struct mont *m, unsigned long long x,
+  unsigned long long e)
+{
+  unsigned long long r = m->one;
+
+  for (; e; e >>= 1) {
+    if (e&1) r = mont_mul(m, r, x);
+    x = mont_mul(m, x, x);
+  }
+
+  return r;
+}
+
+static unsigned long long gcd(unsigned long long a, unsigned long long b)
+{
+  int shift;
+
+  if (!a || !b) return a|b;
+  shift = __builtin_ctzll(a|b);
+  a >>= __builtin_ctzll(a);
+  do {
+    b >>= __builtin_ctzll(b);
+    if (a > b) {
+      unsigned long long t = a;
 
-    // Special case factors of 2
-    while (l && !(l&1)) {
-      printf(" 2");
-      l >>= 1;
+      a = b;
+      b = t;
     }
+  } while ((b -= a));
 
-    // test odd numbers.
-    for (ll=3; ;ll += 2) {
-      long lll = ll*ll;
+  return a<<shift;
+}
 
-      if (lll>l || lll<ll) {
-        if (l>1) printf(" %ld", l);
-        break;
-      }
-      while (!(l%ll)) {
-        printf(" %ld", ll);
-        l /= ll;
+// Miller-Rabin with the first 12 primes as witnesses, which gets every
+// number under 2^64 right.
+static int factor_prime(struct mont *m)
+{
+  static char bases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+  unsigned long long d = m->n-1, x, mone = m->n-m->one;
+  int s = 0, i, j;
+
+  for (; !(d&1); s++) d >>= 1;
+  for (i = 0; i<ARRAY_LEN(bases); i++) {
+    x = mont_pow(m, mont_mul(m, bases[i], m->r2), d);
+    if (x == m->one || x == mone) continue;
+    for (j = 1; j<s && x != mone; j++) x = mont_mul(m, x, x);
+    if (x != mone) return 0;
+  }
+
+  return 1;
+}
+
+// Brent's version of Pollard's rho: find a factor of the odd composite
+// m->n by walking x -> x*x+c until it cycles mod one of the factors. The
+// differences are multiplied up so gcd() only runs every 128 steps.
+static unsigned long long factor_rho(struct mont *m)
+{
+  unsigned long long x, y, ys, q, g, c;
+  long r, k, i;
+
+  for (c = 1;; c++) {
+    y = 2;
+    q = m->one;
+    g = 1;
+    for (r = 1; g == 1; r *= 2) {
+      x = y;
+      for (i = 0; i<r; i++) y = mont_add(m, mont_mul(m, y, y), c);
+      for (k = 0; k<r && g == 1; k += 128) {
+        ys = y;
+        for (i = 0; i<128 && i<r-k; i++) {
+          y = mont_add(m, mont_mul(m, y, y), c);
+          q = mont_mul(m, q, x>y ? x-y : y-x);
+        }
+        g = gcd(q, m->n);
       }
     }
+
+    // Overshot, so go back over the last batch a step at a time.
+    if (g == m->n) do {
+      ys = mont_add(m, mont_mul(m, ys, ys), c);
+      g = gcd(x>ys ? x-ys : ys-x, m->n);
+    } while (g == 1);
+    if (g != m->n) return g;
+  }
+}
+
+// Add the prime factors of odd n, which has none below FACTOR_TRIAL.
+static void factor_big(struct factor_job *job, unsigned long long n)
+{
+  struct mont m;
+  unsigned long long d;
+
+  mont_init(&m, n);
+  if (factor_prime(&m)) job->f[job->count++] = n;
+  else {
+    factor_big(job, d = factor_rho(&m));
+    factor_big(job, n/d);
+  }
+}
+
+static void factor_job(struct factor_job *job)
+{
+  static char wheel[] = {4, 2, 4, 2, 4, 6, 2, 6};
+  unsigned long long n = job->n, f;
+  int i, j, w = 0;
+
+  job->count = 0;
+  if (job->bad) return;
+
+  // Nothing below 4 has factors
+  if (n < 4) {
+    job->f[job->count++] = n;
+    return;
+  }
+
+  // 2, 3 and 5, then the numbers that aren't a multiple of any of them.
+  for (i = 0; i<3; i++) for (f = "\2\3\5"[i]; !(n%f); n /= f)
+    job->f[job->count++] = f;
+  for (f = 7; f <= FACTOR_TRIAL && f*f <= n; f += wheel[w++&7])
+    for (; !(n%f); n /= f) job->f[job->count++] = f;
+  if (n == 1) return;
+  if (f*f > n) {
+    job->f[job->count++] = n;
+    return;
+  }
+
+  // What rho finds comes out in any order.
+  i = job->count;
+  factor_big(job, n);
+  for (; i<job->count; i++) for (j = i; j && job->f[j-1] > job->f[j]; j--) {
+    f = job->f[j];
+    job->f[j] = job->f[j-1];
+    job->f[j-1] = f;
+  }
+}
+
+#if CFG_TOYBOX_THREADS
+// As in md5sum, workers take numbers in order and this thread does whatever
+// is next if no worker's got to it yet.
+
+#define FACTOR_THREADS 8
+
+struct factor_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  struct factor_job *jobs;
+  int count, next;
+};
+
+static void *factor_worker(void *arg)
+{
+  struct factor_pool *fp = arg;
+  struct factor_job *job;
+  int i;
+
+  while ((i = __atomic_fetch_add(&fp->next, 1, __ATOMIC_RELAXED)) < fp->count)
+  {
+    factor_job(job = fp->jobs+i);
+    pthread_mutex_lock(&fp->lock);
+    job->done = 1;
+    pthread_cond_broadcast(&fp->ready);
+    pthread_mutex_unlock(&fp->lock);
+  }
+
+  return 0;
+}
+#endif
+
+static void factor_print(struct factor_job *job)
+{
+  int i;
+
+  if (job->bad)
+    error_msg("%s: %s", job->s, job->bad>1 ? "too big" : "not integer");
+  else {
+    printf("%s%llu:", job->neg ? "-" : "", job->n);
+    // Negative numbers have -1 as a factor
+    if (job->neg) printf(" -1");
+    for (i = 0; i<job->count; i++) printf(" %llu", job->f[i]);
     xputc('\n');
   }
+  free(job->s);
+}
+
+// Factor and print count jobs.
+static void factor_list(struct factor_job *jobs, int count)
+{
+  int i;
+#if CFG_TOYBOX_THREADS
+  struct factor_pool fp;
+  pthread_t tid[FACTOR_THREADS];
+  pthread_attr_t attr;
+  int n = sysconf(_SC_NPROCESSORS_ONLN), threads = 0, j;
+
+  if (n > FACTOR_THREADS) n = FACTOR_THREADS;
+  if (n > count) n = count;
+  memset(&fp, 0, sizeof(fp));
+  fp.jobs = jobs;
+  fp.count = count;
+  if (n > 1) {
+    pthread_mutex_init(&fp.lock, 0);
+    pthread_cond_init(&fp.ready, 0);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    while (threads < n-1
+      && !toy_worker_create(tid+threads, &attr, factor_worker, &fp)) threads++;
+    pthread_attr_destroy(&attr);
+  }
+#endif
+
+  for (i = 0; i<count; i++) {
+#if CFG_TOYBOX_THREADS
+    if (threads) {
+      j = i;
+      if (__atomic_compare_exchange_n(&fp.next, &j, i+1, 0, __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED)) factor_job(jobs+i);
+      else {
+        pthread_mutex_lock(&fp.lock);
+        while (!jobs[i].done) pthread_cond_wait(&fp.ready, &fp.lock);
+        pthread_mutex_unlock(&fp.lock);
+      }
+    } else
+#endif
+    factor_job(jobs+i);
+    factor_print(jobs+i);
+  }
+
+#if CFG_TOYBOX_THREADS
+  for (j = 0; j<threads; j++) pthread_join(tid[j], 0);
+  if (n > 1) {
+    pthread_cond_destroy(&fp.ready);
+    pthread_mutex_destroy(&fp.lock);
+  }
+#endif
+}
+
+// Add the numbers in s to jobs, factoring them whenever there's a batch.
+// Batches (and threads) span all of argv but only one line of stdin, since
+// someone may be waiting on this line's answer before sending the next.
+static int factor_add(struct factor_job *jobs, int count, char *s)
+{
+  struct factor_job *job;
+  char *start;
+
+  for (;;) {
+    while (isspace(*s)) s++;
+    if (!*s) return count;
+    if (count == FACTOR_BATCH) {
+      factor_list(jobs, count);
+      count = 0;
+    }
+    job = jobs+count++;
+    memset(job, 0, sizeof(*job));
+    start = s;
+    if ((job->neg = *s == '-')) s++;
+    errno = 0;
+    job->n = isdigit(*s) ? strtoull(s, &s, 0) : 0;
+    if (!isdigit(start[job->neg]) || (*s && !isspace(*s))) job->bad = 1;
+    else if (errno) job->bad = 2;
+    if (!job->n) job->neg = 0;
+    while (*s && !isspace(*s)) s++;
+    job->s = xstrndup(start, s-start);
+
+    // An error ends the line.
+    if (job->bad) return count;
+  }
 }
 
 void factor_main(void)
 {
+  struct factor_job *jobs = xmalloc(FACTOR_BATCH*sizeof(struct factor_job));
+
   if (toys.optc) {
     char **ss;
+    int count = 0;
 
-    for (ss = toys.optargs; *ss; ss++) factor(*ss);
+    for (ss = toys.optargs; *ss; ss++) count = factor_add(jobs, count, *ss);
+    factor_list(jobs, count);
   } else for (;;) {
     char *s = 0;
     size_t len = 0;
 
     if (-1 == xgetline(&s, &len, stdin)) break;
-    factor(s);
+    factor_list(jobs, factor_add(jobs, 0, s));
+    free(s);
+    xflush();
   }
+  if (CFG_TOYBOX_FREE) free(jobs);
 }
@@ -12,23 +12,116 @@ config HEXEDIT
   help
     usage: hexedit FILENAME
 
-    Hexadecimal file editor.
+    Hexadecimal file editor. Edits are written back when you quit.
 
     -r	Read only (display but don't edit)
+
+    Keys: arrows, page up/down and home/end move, hex digits edit, u undoes,
+    g goes to a hex offset, and q or escape quits.
 */
 
 #define FOR_hexedit
 #include "toys.h"
 
 GLOBALS(
-  char *data;
-  long long len, base;
-  int numlen, undo, undolen;
+  char *win;
+  long long len, base, winpos;
+  int numlen, undo, undolen, fd, winlen, dirtylen;
   unsigned height;
+  struct hexedit_page **dirty;
 )
 
 #define UNDO_LEN (sizeof(toybuf)/(sizeof(long long)+1))
 
+// The file's read through a window this big around what's on screen, so
+// a multi-gigabyte file or a whole disk costs no more than a small one.
+#define HEXEDIT_WIN 65536
+
+// Edited pages are copied aside (sorted in TT.dirty), and only they get
+// written back.
+#define HEXEDIT_PAGE 4096
+
+struct hexedit_page {
+  long long pos;
+  char data[HEXEDIT_PAGE];
+};
+
+// Find the page of edits containing pos, adding it if add is set.
+static struct hexedit_page *hexedit_page(long long pos, int add);
+
+// Return a pointer to the byte at pos, with any edits.
+static char *hexedit_byte(long long pos)
+{
+  struct hexedit_page *hp;
+
+  if (TT.dirtylen && (hp = hexedit_page(pos, 0)))
+    return hp->data+(pos&(HEXEDIT_PAGE-1));
+  if (pos<TT.winpos || pos>=TT.winpos+TT.winlen) {
+    TT.winpos = pos-HEXEDIT_WIN/4;
+    if (TT.winpos<0) TT.winpos = 0;
+    TT.winpos &= ~(long long)(HEXEDIT_PAGE-1);
+    TT.winlen = pread(TT.fd, TT.win, HEXEDIT_WIN, TT.winpos);
+    if (TT.winlen<0) TT.winlen = 0;
+
+    // What can't be read (a bad block, say) shows up as zeroes.
+    if (pos>=TT.winpos+TT.winlen) {
+      memset(TT.win+TT.winlen, 0, HEXEDIT_WIN-TT.winlen);
+      TT.winlen = HEXEDIT_WIN;
+    }
+  }
+
+  return TT.win+(pos-TT.winpos);
+}
+
+static struct hexedit_page *hexedit_page(long long pos, int add)
+{
+  struct hexedit_page *hp;
+  int lo = 0, hi = TT.dirtylen, mid, i;
+
+  pos &= ~(long long)(HEXEDIT_PAGE-1);
+  while (lo<hi) {
+    mid = (lo+hi)/2;
+    if (TT.dirty[mid]->pos<pos) lo = mid+1;
+    else hi = mid;
+  }
+  if (lo<TT.dirtylen && TT.dirty[lo]->pos==pos) return TT.dirty[lo];
+  if (!add) return 0;
+
+  hp = xzalloc(sizeof(struct hexedit_page));
+  for (i = 0; i<HEXEDIT_PAGE && pos+i<TT.len; i++)
+    hp->data[i] = *hexedit_byte(pos+i);
+  hp->pos = pos;
+  if (!(TT.dirtylen&63))
+    TT.dirty = xrealloc(TT.dirty, (TT.dirtylen+64)*sizeof(*TT.dirty));
+  memmove(TT.dirty+lo+1, TT.dirty+lo, (TT.dirtylen++-lo)*sizeof(*TT.dirty));
+
+  return TT.dirty[lo] = hp;
+}
+
+// Return a pointer to the byte at pos that can be edited.
+static char *hexedit_edit(long long pos)
+{
+  return hexedit_page(pos, 1)->data+(pos&(HEXEDIT_PAGE-1));
+}
+
+// Write the edited pages back to the file.
+static void hexedit_save(void)
+{
+  struct hexedit_page *hp;
+  long long len;
+  int i;
+
+  for (i = 0; i<TT.dirtylen; i++) {
+    hp = TT.dirty[i];
+    if ((len = TT.len-hp->pos)>HEXEDIT_PAGE) len = HEXEDIT_PAGE;
+    if (len != pwrite(TT.fd, hp->data, len, hp->pos))
+      perror_msg("write %s at %llX", *toys.optargs, hp->pos);
+    if (CFG_TOYBOX_FREE) free(hp);
+  }
+  if (TT.dirtylen && fsync(TT.fd)) perror_msg("%s", *toys.optargs);
+  if (CFG_TOYBOX_FREE) free(TT.dirty);
+}
+
 // Render all characters printable, using color to distinguish.
 static void draw_char(char broiled)
 {
@@ -90,9 +183,9 @@ static void draw_line(long long yy)
 
   if (yy<TT.len) {
     printf("\r%0*llX ", TT.numlen, yy);
-    for (x=0; x<xx; x++) printf(" %02X", TT.data[yy+x]);
+    for (x=0; x<xx; x++) printf(" %02X", (unsigned char)*hexedit_byte(yy+x));
     printf("%*s", 2+3*(16-xx), "");
-    for (x=0; x<xx; x++) draw_char(TT.data[yy+x]);
+    for (x=0; x<xx; x++) draw_char(*hexedit_byte(yy+x));
     printf("%*s", 16-xx, "");
   }
   tty_esc("K");
@@ -113,14 +206,14 @@ static void draw_page(void)
 // side: 0 = editing left, 1 = editing right, 2 = clear, 3 = read only
 static void highlight(int xx, int yy, int side)
 {
-  char cc = TT.data[16*(TT.base+yy)+xx];
+  char cc = *hexedit_byte(16*(TT.base+yy)+xx);
   int i;
 
   // Display cursor
   tty_jump(2+TT.numlen+3*xx, yy);
   tty_esc("0m");
   if (side!=2) tty_esc("7m");
-  if (side>1) printf("%02X", cc);
+  if (side>1) printf("%02X", (unsigned char)cc);
   else for (i=0; i<2;) {
     if (side==i) tty_esc("32m");
     printf("%X", (cc>>(4*(1&++i)))&15);
@@ -130,13 +223,45 @@ static void highlight(int xx, int yy, int side)
   draw_char(cc);
 }
 
+// Read a hex offset on the bottom line, returning -1 if cancelled.
+static long long hexedit_goto(char *keybuf)
+{
+  long long off = 0;
+  int key, len = 0;
+
+  for (;;) {
+    tty_jump(0, TT.height);
+    tty_esc("K");
+    printf("Go to: ");
+    if (len) printf("%llX", off);
+    xprintf("");
+    key = scan_key(keybuf, 1);
+    if (key=='\r' || key=='\n') break;
+    if (key==-1 || key==3 || key==4 || key==27) {
+      len = 0;
+      break;
+    }
+    if ((key==127 || key==8) && len) {
+      off >>= 4;
+      len--;
+    } else if (isxdigit(key) && len<15) {
+      off = (off<<4)+(isdigit(key) ? key-'0' : (key|32)-'a'+10);
+      len++;
+    }
+  }
+  draw_tail();
+
+  return len ? off : -1;
+}
+
 void hexedit_main(void)
 {
   long long pos = 0, y;
-  int x, i, side = 0, key, ro = toys.optflags&FLAG_r,
-      fd = xopen(*toys.optargs, ro ? O_RDONLY : O_RDWR);
+  int x, i, side = 0, key, ro = toys.optflags&FLAG_r;
   char keybuf[16];
 
+  TT.fd = xopen(*toys.optargs, ro ? O_RDONLY : O_RDWR);
+
   *keybuf = 0;
 
   // Terminal setup
@@ -149,13 +274,12 @@ void hexedit_main(void)
   fflush(0);
   set_terminal(1, 1, 0);
 
-  if ((TT.len = fdlength(fd))<0) error_exit("bad length");
-  if (sizeof(long)==32 && TT.len>SIZE_MAX) TT.len = SIZE_MAX;
+  if ((TT.len = fdlength(TT.fd))<0) error_exit("bad length");
   // count file length hex in digits, rounded up to multiple of 4
   for (pos = TT.len, TT.numlen = 0; pos; pos >>= 4, TT.numlen++);
   TT.numlen += (4-TT.numlen)&3;
 
-  TT.data = mmap(0, TT.len, PROT_READ|(PROT_WRITE*!ro), MAP_SHARED, fd, 0);
+  TT.win = xmalloc(HEXEDIT_WIN);
   draw_page();
 
   for (;;) {
@@ -210,15 +334,15 @@ void hexedit_main(void)
         long long *ll = (long long *)toybuf;
 
         ll[TT.undo] = pos;
-        toybuf[(sizeof(long long)*UNDO_LEN)+TT.undo++] = TT.data[pos];
+        toybuf[(sizeof(long long)*UNDO_LEN)+TT.undo++] = *hexedit_byte(pos);
         if (TT.undolen < (int)UNDO_LEN) TT.undolen++;
         TT.undo %= UNDO_LEN;
       }
 
       i = key - '0';
       if (i>9) i -= 7;
-      TT.data[pos] &= 15<<(4*side);
-      TT.data[pos] |= i<<(4*!side);
+      *hexedit_edit(pos) &= 15<<(4*side);
+      *hexedit_edit(pos) |= i<<(4*!side);
 
       if (++side==2) {
         highlight(x, y, side);
@@ -233,7 +357,7 @@ void hexedit_main(void)
         TT.undolen--;
         if (!TT.undo) TT.undo = UNDO_LEN;
         pos = ll[--TT.undo];
-        TT.data[pos] = toybuf[sizeof(long long)*UNDO_LEN+TT.undo];
+        *hexedit_edit(pos) = toybuf[sizeof(long long)*UNDO_LEN+TT.undo];
       }
     } else if (key==KEY_UP) pos -= 16;
     else if (key==KEY_DOWN) pos += 16;
@@ -245,8 +369,10 @@ void hexedit_main(void)
     else if (key==KEY_PGDN) pos += 16*TT.height;
     else if (key==KEY_HOME) pos = 0;
     else if (key==KEY_END) pos = TT.len-1;
+    else if (key=='g' && (y = hexedit_goto(keybuf))>=0) pos = y;
   }
-  munmap(TT.data, TT.len);
-  close(fd);
   tty_reset();
+  if (!ro) hexedit_save();
+  if (CFG_TOYBOX_FREE) free(TT.win);
+  close(TT.fd);
 }
@@ -51,6 +51,7 @@ config IFCONFIG
 
 #include <net/if_arp.h>
 #include <net/ethernet.h>
+#include <linux/rtnetlink.h>
 
 GLOBALS(
   int sockfd;
@@ -93,9 +94,20 @@ int get_addrinfo(char *host, sa_family_t af, void *addr)
   return len;
 }
 
-static void display_ifconfig(char *name, int always, unsigned long long val[])
+// One interface (or IPv4 alias label) to display, from netlink dumps.
+struct ifc {
+  struct ifc *next;
+  char name[IFNAMSIZ];
+  int index, type, flags, mtu, txqlen, hwlen, hasv4;
+  unsigned char hw[32];
+  struct in_addr v4[4];  // addr, P-t-P, Bcast, Mask
+  struct rtnl_link_ifmap map;
+  unsigned long long *val;
+  struct string_list *v6, **v6tail;
+};
+
+static void display_ifconfig(struct ifc *ifc, int always)
 {
-  struct ifreq ifre;
   struct {
     int type;
     char *title;
@@ -104,104 +116,37 @@ static void display_ifconfig(char *name, int always, unsigned long long val[])
     {ARPHRD_PPP, "Point-to-Point Protocol"}, {ARPHRD_INFINIBAND, "InfiniBand"},
     {ARPHRD_SIT, "IPv6-in-IPv4"}, {-1, "UNSPEC"}
   };
+  struct string_list *sl;
+  unsigned long long *val = ifc->val;
   int i;
-  char *pp;
-  FILE *fp;
-  short flags;
+  short flags = ifc->flags;
 
-  xstrncpy(ifre.ifr_name, name, IFNAMSIZ);
-  if (ioctl(TT.sockfd, SIOCGIFFLAGS, &ifre)<0) perror_exit("%s", name);
-  flags = ifre.ifr_flags;
   if (!always && !(flags & IFF_UP)) return;
 
-  // query hardware type and hardware address
-  i = ioctl(TT.sockfd, SIOCGIFHWADDR, &ifre);
-
   for (i=0; i < (sizeof(types)/sizeof(*types))-1; i++)
-    if (ifre.ifr_hwaddr.sa_family == types[i].type) break;
+    if (ifc->type == types[i].type) break;
 
-  xprintf("%-9s Link encap:%s  ", name, types[i].title);
-  if(i >= 0 && ifre.ifr_hwaddr.sa_family == ARPHRD_ETHER) {
+  xprintf("%-9s Link encap:%s  ", ifc->name, types[i].title);
+  if (ifc->type == ARPHRD_ETHER) {
     xprintf("HWaddr ");
-    for (i=0; i<6; i++) xprintf(":%02x"+!i, ifre.ifr_hwaddr.sa_data[i]);
+    for (i=0; i<6; i++) xprintf(":%02x"+!i, ifc->hw[i]);
   }
   xputc('\n');
 
   // If an address is assigned record that.
 
-  ifre.ifr_addr.sa_family = AF_INET;
-  memset(&ifre.ifr_addr, 0, sizeof(ifre.ifr_addr));
-  ioctl(TT.sockfd, SIOCGIFADDR, &ifre);
-  pp = (char *)&ifre.ifr_addr;
-  for (i = 0; i<sizeof(ifre.ifr_addr); i++) if (pp[i]) break;
-
-  if (i != sizeof(ifre.ifr_addr)) {
-    struct sockaddr_in *si = (struct sockaddr_in *)&ifre.ifr_addr;
-    struct {
-      char *name;
-      int flag, ioctl;
-    } addr[] = {
-      {"addr", 0, 0},
-      {"P-t-P", IFF_POINTOPOINT, SIOCGIFDSTADDR},
-      {"Bcast", IFF_BROADCAST, SIOCGIFBRDADDR},
-      {"Mask", 0, SIOCGIFNETMASK}
-    };
-
-    xprintf("%10c%s", ' ', (si->sin_family == AF_INET) ? "inet" :
-        (si->sin_family == AF_INET6) ? "inet6" : "unspec");
-
-    for (i=0; i < sizeof(addr)/sizeof(*addr); i++) {
-      if (!addr[i].flag || (flags & addr[i].flag)) {
-        if (addr[i].ioctl && ioctl(TT.sockfd, addr[i].ioctl, &ifre))
-          si->sin_family = 0;
-        xprintf(" %s:%s ", addr[i].name,
-          (si->sin_family == 0xFFFF || !si->sin_family)
-            ? "[NOT SET]" : inet_ntoa(si->sin_addr));
-      }
-    }
+  if (ifc->hasv4) {
+    char *name[] = {"addr", "P-t-P", "Bcast", "Mask"};
+    int flag[] = {0, IFF_POINTOPOINT, IFF_BROADCAST, 0};
 
+    xprintf("%10c%s", ' ', "inet");
+    for (i=0; i < ARRAY_LEN(name); i++)
+      if (!flag[i] || (flags & flag[i]))
+        xprintf(" %s:%s ", name[i], inet_ntoa(ifc->v4[i]));
     xputc('\n');
   }
 
-  fp = fopen(pp = "/proc/net/if_inet6", "r");
-  if (fp) {
-    char iface_name[IFNAMSIZ];
-    int plen, iscope;
-
-    while (fgets(toybuf, sizeof(toybuf), fp)) {
-      int nitems;
-      char ipv6_addr[40];
-
-      nitems = sscanf(toybuf, "%32s %*08x %02x %02x %*02x %15s\n",
-                      ipv6_addr, &plen, &iscope, iface_name);
-      if (nitems<0 && feof(fp)) break;
-      if (nitems != 4) perror_exit("bad %s", pp);
-
-      if (!strcmp(name, iface_name)) {
-        struct sockaddr_in6 s6;
-        char *ptr = ipv6_addr+sizeof(ipv6_addr)-1;
-
-        // convert giant hex string into colon-spearated ipv6 address by
-        // inserting ':' every 4 characters. 
-        for (i = 32; i; i--)
-          if ((*(ptr--) = ipv6_addr[i])) if (!(i&3)) *(ptr--) = ':';
-
-        // Convert to binary and back to get abbreviated :: version
-        if (inet_pton(AF_INET6, ipv6_addr, (void *)&s6.sin6_addr) > 0) {
-          if (inet_ntop(AF_INET6, &s6.sin6_addr, toybuf, sizeof(toybuf))) {
-            char *scopes[] = {"Global","Host","Link","Site","Compat"},
-                 *scope = "Unknown";
-
-            for (i=0; i < sizeof(scopes)/sizeof(*scopes); i++)
-              if (iscope == (!!i)<<(i+3)) scope = scopes[i];
-            xprintf("%10cinet6 addr: %s/%d Scope: %s\n",
-                    ' ', toybuf, plen, scope);
-          }
-        }
-      }
-    }
-    fclose(fp);
-  }
+  for (sl = ifc->v6; sl; sl = sl->next) xprintf("%s", sl->str);
 
   xprintf("%10c", ' ');
 
@@ -219,11 +164,9 @@ static void display_ifconfig(char *name, int always, unsigned long long val[])
     }
   } else xprintf("[NO FLAGS] ");
 
-  if (ioctl(TT.sockfd, SIOCGIFMTU, &ifre) < 0) ifre.ifr_mtu = 0;
-  xprintf(" MTU:%d", ifre.ifr_mtu);
-  if (ioctl(TT.sockfd, SIOCGIFMETRIC, &ifre) < 0) ifre.ifr_metric = 0;
-  if (!ifre.ifr_metric) ifre.ifr_metric = 1;
-  xprintf("  Metric:%d", ifre.ifr_metric);
+  // Linux has never stored a metric, SIOCGIFMETRIC always said 0.
+  xprintf(" MTU:%d", ifc->mtu);
+  xprintf("  Metric:%d", 1);
 
   // non-virtual interface
 
@@ -233,12 +176,8 @@ static void display_ifconfig(char *name, int always, unsigned long long val[])
       "collisions", "carrier", 0, "txqueuelen"};
     signed char order[] = {-1, 1, 2, 3, 4, 5, -1, 9, 10, 11, 12, 14, -1,
       13, 16, -1, 0, 8};
-    int i;
-
-    // Query txqueuelen
-    if (ioctl(TT.sockfd, SIOCGIFTXQLEN, &ifre) >= 0) val[16] = ifre.ifr_qlen;
-    else val[16] = -1;
 
+    val[16] = ifc->txqlen;
     for (i = 0; i < sizeof(order); i++) {
       int j = order[i];
 
@@ -248,90 +187,211 @@ static void display_ifconfig(char *name, int always, unsigned long long val[])
   }
   xputc('\n');
 
-  if(!ioctl(TT.sockfd, SIOCGIFMAP, &ifre) && (ifre.ifr_map.irq ||
-      ifre.ifr_map.mem_start || ifre.ifr_map.dma || ifre.ifr_map.base_addr))
+  // Same truncation the struct ifmap of SIOCGIFMAP did.
+  if (ifc->map.irq || ifc->map.mem_start || ifc->map.dma
+      || ifc->map.base_addr)
   {
     xprintf("%10c", ' ');
-    if(ifre.ifr_map.irq) xprintf("Interrupt:%d ", ifre.ifr_map.irq);
-    if(ifre.ifr_map.base_addr >= 0x100) // IO_MAP_INDEX
-      xprintf("Base address:0x%x ", ifre.ifr_map.base_addr);
-    if(ifre.ifr_map.mem_start)
-      xprintf("Memory:%lx-%lx ", ifre.ifr_map.mem_start, ifre.ifr_map.mem_end);
-    if(ifre.ifr_map.dma) xprintf("DMA chan:%x ", ifre.ifr_map.dma);
+    if ((unsigned char)ifc->map.irq)
+      xprintf("Interrupt:%d ", (unsigned char)ifc->map.irq);
+    if ((unsigned short)ifc->map.base_addr >= 0x100) // IO_MAP_INDEX
+      xprintf("Base address:0x%x ", (unsigned short)ifc->map.base_addr);
+    if (ifc->map.mem_start)
+      xprintf("Memory:%lx-%lx ", (unsigned long)ifc->map.mem_start,
+        (unsigned long)ifc->map.mem_end);
+    if (ifc->map.dma) xprintf("DMA chan:%x ", ifc->map.dma);
     xputc('\n');
   }
   xputc('\n');
 }
 
-static void show_iface(char *iface_name)
+static struct ifc *find_ifc(struct ifc *list, int index, char *name)
 {
-  char *name;
-  struct string_list *ifaces = 0, *sl;
-  int i, j;
-  FILE *fp;
-
-  fp = xfopen("/proc/net/dev", "r");
+  for (; list; list = list->next)
+    if (name ? !strcmp(list->name, name) : list->index == index) break;
 
-  for (i=0; fgets(toybuf, sizeof(toybuf), fp); i++) {
-    char *buf = toybuf;
-    unsigned long long val[17];
+  return list;
+}
 
-    if (i<2) continue;
+// RTM_GETLINK: the interface itself, in kernel order, with the counters the
+// kernel would have summed into /proc/net/dev columns.
+static void ifc_link(struct nlmsghdr *nlh, void *arg)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+  struct ifc ***tail = arg, *ifc;
+  struct rtattr *tb[IFLA_MAX+1];
+  struct rtnl_link_stats64 st;
+
+  if (nlh->nlmsg_type != RTM_NEWLINK) return;
+  netlink_attrs(nlh, sizeof(*ifi), tb, IFLA_MAX);
+  if (!tb[IFLA_IFNAME]) return;
+
+  ifc = xzalloc(sizeof(*ifc));
+  ifc->v6tail = &ifc->v6;
+  xstrncpy(ifc->name, RTA_DATA(tb[IFLA_IFNAME]), sizeof(ifc->name));
+  ifc->index = ifi->ifi_index;
+  ifc->type = ifi->ifi_type;
+  ifc->flags = ifi->ifi_flags;
+  if (tb[IFLA_MTU]) ifc->mtu = *(unsigned *)RTA_DATA(tb[IFLA_MTU]);
+  if (tb[IFLA_TXQLEN]) ifc->txqlen = *(unsigned *)RTA_DATA(tb[IFLA_TXQLEN]);
+  if (tb[IFLA_ADDRESS]) {
+    ifc->hwlen = RTA_PAYLOAD(tb[IFLA_ADDRESS]);
+    if (ifc->hwlen > sizeof(ifc->hw)) ifc->hwlen = sizeof(ifc->hw);
+    memcpy(ifc->hw, RTA_DATA(tb[IFLA_ADDRESS]), ifc->hwlen);
+  }
+  if (tb[IFLA_MAP] && RTA_PAYLOAD(tb[IFLA_MAP]) >= sizeof(ifc->map))
+    memcpy(&ifc->map, RTA_DATA(tb[IFLA_MAP]), sizeof(ifc->map));
+  if (tb[IFLA_STATS64]) {
+    unsigned long long *val = ifc->val = xzalloc(17*sizeof(*val));
+    int len = RTA_PAYLOAD(tb[IFLA_STATS64]);
+
+    // Newer kernels append fields, older ones send fewer.
+    memset(&st, 0, sizeof(st));
+    memcpy(&st, RTA_DATA(tb[IFLA_STATS64]), len<sizeof(st) ? len : sizeof(st));
+    val[0] = st.rx_bytes;
+    val[1] = st.rx_packets;
+    val[2] = st.rx_errors;
+    val[3] = st.rx_dropped+st.rx_missed_errors;
+    val[4] = st.rx_fifo_errors;
+    val[5] = st.rx_length_errors+st.rx_over_errors+st.rx_crc_errors
+      +st.rx_frame_errors;
+    val[6] = st.rx_compressed;
+    val[7] = st.multicast;
+    val[8] = st.tx_bytes;
+    val[9] = st.tx_packets;
+    val[10] = st.tx_errors;
+    val[11] = st.tx_dropped;
+    val[12] = st.tx_fifo_errors;
+    val[13] = st.collisions;
+    val[14] = st.tx_carrier_errors+st.tx_aborted_errors+st.tx_window_errors
+      +st.tx_heartbeat_errors;
+    val[15] = st.tx_compressed;
+  }
 
-    while (isspace(*buf)) buf++;
-    name = strsep(&buf, ":");
-    if(!buf) error_exit("bad name %s", name);
+  **tail = ifc;
+  *tail = &ifc->next;
+}
 
-    errno = 0;
-    for (j=0; j<16 && !errno; j++) val[j] = strtoll(buf, &buf, 0);
-    if (errno) perror_exit("bad %s at %s", name, buf);
+// RTM_GETADDR: the first IPv4 address labeled with an interface's name is
+// what SIOCGIFADDR reported. Other labels are aliases ("eth0:1") sharing the
+// interface's settings, listed after all the interfaces like SIOCGIFCONF.
+// IPv6 addresses all get a line, as in /proc/net/if_inet6.
+static void ifc_addr(struct nlmsghdr *nlh, void *arg)
+{
+  struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+  struct ifc **lists = arg, *ifc, *alias;
+  struct rtattr *tb[IFA_MAX+1];
+  char *label;
+  int i;
 
-    if (iface_name) {
-      if (!strcmp(iface_name, name)) {
-        display_ifconfig(iface_name, 1, val);
+  if (nlh->nlmsg_type != RTM_NEWADDR) return;
+  netlink_attrs(nlh, sizeof(*ifa), tb, IFA_MAX);
+  if (!(ifc = find_ifc(*lists, ifa->ifa_index, 0))) return;
+
+  if (ifa->ifa_family == AF_INET6) {
+    struct string_list *sl;
+    unsigned *a6;
+    char *scope;
+
+    if (!tb[IFA_ADDRESS]) return;
+    a6 = RTA_DATA(tb[IFA_ADDRESS]);
+    inet_ntop(AF_INET6, a6, toybuf, INET6_ADDRSTRLEN);
+
+    // The kernel's address scopes, with IPv4 compatible ::a.b.c.d split out
+    // of global like the if_inet6 scope bits did.
+    if (!a6[0] && !a6[1] && !a6[2] && a6[3] && a6[3] != htonl(1))
+      scope = "Compat";
+    else if (ifa->ifa_scope == RT_SCOPE_UNIVERSE) scope = "Global";
+    else if (ifa->ifa_scope == RT_SCOPE_HOST) scope = "Host";
+    else if (ifa->ifa_scope == RT_SCOPE_LINK) scope = "Link";
+    else if (ifa->ifa_scope == RT_SCOPE_SITE) scope = "Site";
+    else scope = "Unknown";
+    sprintf(toybuf+64, "%10cinet6 addr: %s/%d Scope: %s\n",
+      ' ', toybuf, ifa->ifa_prefixlen, scope);
+    sl = xmalloc(sizeof(*sl)+strlen(toybuf+64)+1);
+    strcpy(sl->str, toybuf+64);
+    sl->next = 0;
+    *ifc->v6tail = sl;
+    ifc->v6tail = &sl->next;
 
-        return;
-      }
-    } else {
-      sl = xmalloc(sizeof(*sl)+strlen(name)+1);
-      strcpy(sl->str, name);
-      sl->next = ifaces;
-      ifaces = sl;
+    return;
+  }
 
-      display_ifconfig(sl->str, toys.optflags & FLAG_a, val);
+  if (ifa->ifa_family != AF_INET || !tb[IFA_LOCAL]) return;
+  label = tb[IFA_LABEL] ? RTA_DATA(tb[IFA_LABEL]) : ifc->name;
+  if (strcmp(label, ifc->name)) {
+    if (!(alias = find_ifc(lists[1], 0, label))) {
+      alias = xmalloc(sizeof(*alias));
+      memcpy(alias, ifc, sizeof(*alias));
+      xstrncpy(alias->name, label, sizeof(alias->name));
+      alias->hasv4 = 0;
+      alias->val = 0;
+      alias->v6 = 0;
+      alias->next = 0;
+      *(struct ifc **)lists[2] = alias;
+      lists[2] = (void *)&alias->next;
     }
+    ifc = alias;
   }
-  fclose(fp);
-
-  if (iface_name) display_ifconfig(iface_name, 1, 0);
-  else {
-    struct ifconf ifcon;
-    struct ifreq *ifre;
-    int num;
-
-    // Loop until buffer's big enough
-    ifcon.ifc_buf = NULL;
-    for (num = 30;;num += 10) {
-      ifcon.ifc_len = sizeof(struct ifreq)*num;
-      ifcon.ifc_buf = xrealloc(ifcon.ifc_buf, ifcon.ifc_len);
-      xioctl(TT.sockfd, SIOCGIFCONF, &ifcon);
-      if (ifcon.ifc_len != sizeof(struct ifreq)*num) break;
-    }
-
-    ifre = ifcon.ifc_req;
-    for(num = 0; num < ifcon.ifc_len && ifre; num += sizeof(struct ifreq), ifre++)
-    {
-      // Skip duplicates
-      for(sl = ifaces; sl; sl = sl->next)
-        if(!strcmp(sl->str, ifre->ifr_name)) break;
+  if (ifc->hasv4++) return;
+
+  memset(ifc->v4, 0, sizeof(ifc->v4));
+  memcpy(ifc->v4, RTA_DATA(tb[IFA_LOCAL]), 4);
+  if (tb[IFA_ADDRESS]) memcpy(ifc->v4+1, RTA_DATA(tb[IFA_ADDRESS]), 4);
+  if (tb[IFA_BROADCAST]) memcpy(ifc->v4+2, RTA_DATA(tb[IFA_BROADCAST]), 4);
+  i = ifa->ifa_prefixlen;
+  ifc->v4[3].s_addr = i ? htonl(~0U<<(32-i)) : 0;
+}
 
-      if(!sl) display_ifconfig(ifre->ifr_name, toys.optflags & FLAG_a, 0);
-    }
+static void show_iface(char *iface_name)
+{
+  struct ifc *lists[3] = {0, 0, 0}, **tail = lists, *ifc;
+  struct ifinfomsg ifi;
+  struct ifaddrmsg ifa;
+  int i;
 
-    free(ifcon.ifc_buf);
+  // One dump of each table, not a dozen ioctls per interface.
+  memset(&ifi, 0, sizeof(ifi));
+  if (!netlink_dump(RTM_GETLINK, &ifi, sizeof(ifi), ifc_link, &tail))
+    perror_exit("netlink");
+  lists[2] = (void *)(lists+1);
+  for (i = 0; i<2; i++) {
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = i ? AF_INET6 : AF_INET;
+    netlink_dump(RTM_GETADDR, &ifa, sizeof(ifa), ifc_addr, lists);
   }
+  lists[2] = 0;
 
-  llist_traverse(ifaces, free);
+  if (iface_name) {
+    char *colon;
+
+    if (!(ifc = find_ifc(*lists, 0, iface_name))
+      && !(ifc = find_ifc(lists[1], 0, iface_name)))
+    {
+      // An alias without an address still shows its interface, like ioctls.
+      if ((colon = strchr(iface_name, ':'))) *colon = 0;
+      if (!colon || !(ifc = find_ifc(*lists, 0, iface_name))) {
+        errno = ENODEV;
+        perror_exit("%s", iface_name);
+      }
+      *colon = ':';
+      xstrncpy(ifc->name, iface_name, sizeof(ifc->name));
+      ifc->hasv4 = 0;
+      ifc->val = 0;
+      ifc->v6 = 0;
+    }
+    display_ifconfig(ifc, 1);
+  } else for (i = 0; i<2; i++)
+    for (ifc = lists[i]; ifc; ifc = ifc->next)
+      display_ifconfig(ifc, toys.optflags & FLAG_a);
+
+  // Aliases don't own their counters or IPv6 lines, see ifc_addr().
+  if (CFG_TOYBOX_FREE) for (i = 0; i<2; i++) while ((ifc = lists[i])) {
+    lists[i] = ifc->next;
+    free(ifc->val);
+    llist_traverse(ifc->v6, free);
+    free(ifc);
+  }
 }
 
 // Encode offset and size of field into an int, and make result negative
@@ -5,13 +5,13 @@
  *
  * No Standard.
 
-USE_INOTIFYD(NEWTOY(inotifyd, "<2", TOYFLAG_USR|TOYFLAG_BIN))
+USE_INOTIFYD(NEWTOY(inotifyd, "<2bw#<0", TOYFLAG_USR|TOYFLAG_BIN))
 
 config INOTIFYD
   bool "inotifyd"
   default y
   help
-    usage: inotifyd PROG FILE[:MASK] ...
+    usage: inotifyd [-b] [-w MS] PROG FILE[:MASK] ...
 
     When a filesystem event matching MASK occurs to a FILE, run PROG as:
 
@@ -19,6 +19,12 @@ config INOTIFYD
 
     If PROG is "-" events are sent to stdout.
 
+    -b	Batch: run PROG once for all queued events, with no arguments and
+    	one "EVENTS<tab>FILE[<tab>DIRFILE]" line per event on stdin.
+    	Repeats of the same line within one batch are dropped.
+    -w	Keep collecting a batch for MS milliseconds after its first event
+    	(implies -b)
+
     This file is:
       a  accessed    c  modified    e  metadata change  w  closed (writable)
       r  opened      D  deleted     M  moved            0  closed (unwritable)
@@ -34,11 +40,91 @@ config INOTIFYD
 #include "toys.h"
 #include <sys/inotify.h>
 
+GLOBALS(
+  long w;
+
+  char *batch;
+  long len, size;
+  struct inotifyd_seen *seen;
+  long used, slots;
+)
+
+// A line in the batch: hash and 1+offset of its start, 0 for an empty slot
+struct inotifyd_seen {
+  unsigned hash;
+  long off;
+};
+
+// Find the slot for a line with this hash starting at batch+off, which is
+// either the one holding an identical line or the empty one to put it in.
+static struct inotifyd_seen *inotifyd_slot(unsigned hash, long off, long len)
+{
+  struct inotifyd_seen *seen;
+  long i;
+
+  for (i = hash&(TT.slots-1); (seen = TT.seen+i)->off; i = (i+1)&(TT.slots-1))
+    if (seen->hash == hash && !memcmp(TT.batch+seen->off-1, TT.batch+off, len))
+      break;
+
+  return seen;
+}
+
+// Append an event line to the batch, unless it's already in it.
+static void inotifyd_add(char *events, char *file, char *name)
+{
+  struct inotifyd_seen *seen, *old;
+  unsigned hash = 2166136261U;
+  long len, i, j;
+
+  len = strlen(events)+strlen(file)+(name ? strlen(name)+1 : 0)+2;
+  if (TT.len+len+1 > TT.size)
+    TT.batch = xrealloc(TT.batch, TT.size = 2*(TT.len+len+1)+4096);
+  sprintf(TT.batch+TT.len, "%s\t%s%s%s\n", events, file, "\t"+!name,
+    name ? name : "");
+  for (i = 0; i<len; i++) hash = (hash^TT.batch[TT.len+i])*16777619;
+
+  // Keep the table no more than half full.
+  if (2*(TT.used+1) > TT.slots) {
+    old = TT.seen;
+    i = TT.slots;
+    TT.seen = xzalloc((TT.slots = TT.slots ? 2*TT.slots : 256)*sizeof(*old));
+    while (i--) if (old[i].off) {
+      for (j = old[i].hash; TT.seen[j&(TT.slots-1)].off; j++);
+      TT.seen[j&(TT.slots-1)] = old[i];
+    }
+    free(old);
+  }
+  if ((seen = inotifyd_slot(hash, TT.len, len))->off) return;
+  seen->hash = hash;
+  seen->off = TT.len+1;
+  TT.used++;
+  TT.len += len;
+}
+
+// Hand the batch to PROG on its stdin, or with "-" to our stdout.
+static void inotifyd_run(char *prog)
+{
+  int pid, fd;
+
+  if (!TT.len) return;
+  if (*prog == '-' && !prog[1]) {
+    txwrite(1, TT.batch, TT.len);
+  } else {
+    pid = xpopen((char *[]){prog, 0}, &fd, 0);
+    writeall(fd, TT.batch, TT.len);
+    xpclose(pid, fd);
+  }
+  TT.len = TT.used = 0;
+  memset(TT.seen, 0, TT.slots*sizeof(*TT.seen));
+}
+
 void inotifyd_main(void)
 {
   struct pollfd fds;
-  char *prog_args[5], **ss = toys.optargs;
+  char *prog_args[5], **ss = toys.optargs, *buf = 0;
   char *masklist ="acew0rmyndDM uox";
+  unsigned long long until = 0;
+  int batch = toys.optflags & (FLAG_b|FLAG_w), bufsize = 0, wait;
 
   fds.events = POLLIN;
 
@@ -56,7 +142,7 @@ void inotifyd_main(void)
     if (!masks) mask = 0xfff; // default to all
     else{
       *masks++ = 0;
-      for (*masks++ = 0; *masks; masks++) {
+      for (; *masks; masks++) {
         i = stridx(masklist, *masks);;
         if (i == -1) error_exit("bad mask '%c'", *masks);
         mask |= 1<<i;
@@ -68,22 +154,40 @@ void inotifyd_main(void)
     if (inotify_add_watch(fds.fd, path, mask) < 0) perror_exit("%s", path);
   }
 
+  // A dead PROG shouldn't take us with it when we write its batch.
+  if (batch) xsignal(SIGPIPE, SIG_IGN);
+
   for (;;) {
     int ret = 0, len;
-    void *buf = 0;
     struct inotify_event *event;
 
-    // Read next event(s)
-    ret = poll(&fds, 1, -1);
+    // Wait for events, or while a batch is collecting, until it's due.
+    wait = -1;
+    if (TT.len) {
+      unsigned long long ms = millitime();
+
+      wait = (ms<until) ? until-ms : 0;
+    }
+    ret = poll(&fds, 1, wait);
     if (ret < 0 && errno == EINTR) continue;
-    if (ret <= 0) break;
+    if (!ret) {
+      inotifyd_run(*prog_args);
+      continue;
+    }
+    if (ret < 0) break;
+
+    // Read every event queued so far in one go.
     xioctl(fds.fd, FIONREAD, &len);
-    event = buf = xmalloc(len);
-    len = readall(fds.fd, buf, len);
+    if (len > bufsize) buf = xrealloc(buf, bufsize = len+4096);
+    len = read(fds.fd, buf, bufsize);
+    if (len < 0 && errno == EINTR) continue;
+    if (len < 1) break;
+    if (batch && !TT.len) until = millitime()+TT.w;
+    event = (void *)buf;
 
     // Loop through set of events.
     for (;;) {
-      int left = len - (((char *)event)-(char *)buf),
+      int left = len - (((char *)event)-buf),
           size = sizeof(struct inotify_event);
 
       // Don't dereference event if ->len is off end of bufer
@@ -97,7 +201,10 @@ void inotifyd_main(void)
           if (event->mask & (1<<(m-masklist))) *s++ = *m;
         *s = 0;
 
-        if (**prog_args == '-' && !prog_args[0][1]) {
+        if (batch) {
+          inotifyd_add(toybuf, toys.optargs[event->wd],
+            event->len ? event->name : 0);
+        } else if (**prog_args == '-' && !prog_args[0][1]) {
           xprintf("%s\t%s\t%s\n" + 3*!event->len, toybuf,
               toys.optargs[event->wd], event->name);
         } else {
@@ -108,19 +215,20 @@ void inotifyd_main(void)
         }
 
         if (event->mask & IN_IGNORED) {
-          if (--toys.optc <= 0) {
-            free(buf);
-
-            goto done;
-          }
+          if (--toys.optc <= 0) goto done;
           inotify_rm_watch(fds.fd, event->wd);
         }
       }
       event = (void*)(size + (char*)event);
     }
-    free(buf);
   }
 
 done:
+  inotifyd_run(*prog_args);
+  if (CFG_TOYBOX_FREE) {
+    free(buf);
+    free(TT.batch);
+    free(TT.seen);
+  }
   toys.exitval = !!toys.signal;
 }
@@ -15,19 +15,11 @@ config INSMOD
 
 #include "toys.h"
 
-#include <sys/syscall.h>
-#define init_module(mod, len, opts) syscall(__NR_init_module, mod, len, opts)
-
 void insmod_main(void)
 {
-  char * buf = NULL;
-  int len, res, i;
+  int res, i;
   int fd = xopen(*toys.optargs, O_RDONLY);
 
-  len = fdlength(fd);
-  buf = xmalloc(len);
-  xreadall(fd, buf, len);
-
   i = 1;
   while(toys.optargs[i] &&
     strlen(toybuf) + strlen(toys.optargs[i]) + 2 < sizeof(toybuf))
@@ -36,11 +28,8 @@ void insmod_main(void)
     strcat(toybuf, " ");
   }
 
-  res = init_module(buf, len, toybuf);
-  if (CFG_TOYBOX_FREE) {
-    if (buf != toybuf) free(buf);
-    close(fd);
-  }
+  res = load_module(fd, *toys.optargs, toybuf);
+  if (CFG_TOYBOX_FREE) close(fd);
 
   if (res) perror_exit("failed to load %s", toys.optargs[0]);
 }
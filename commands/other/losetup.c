@@ -4,13 +4,13 @@
  *
  * No standard. (Sigh.)
 
-USE_LOSETUP(NEWTOY(losetup, ">2S(sizelimit)#s(show)ro#j:fdca[!afj]", TOYFLAG_SBIN))
+USE_LOSETUP(NEWTOY(losetup, ">2(direct-io)(sector-size)#<512>4096S(sizelimit)#s(show)ro#j:fdca[!afj]", TOYFLAG_SBIN))
 
 config LOSETUP
   bool "losetup"
   default y
   help
-    usage: losetup [-cdrs] [-o OFFSET] [-S SIZE] {-d DEVICE...|-j FILE|-af|{DEVICE FILE}}
+    usage: losetup [-cdrs] [-o OFFSET] [-S SIZE] [--direct-io] [--sector-size SIZE] {-d DEVICE...|-j FILE|-af|{DEVICE FILE}}
 
     Associate a loopback device with a file, or show current file (if any)
     associated with a loop device.
@@ -29,6 +29,8 @@ config LOSETUP
     -o	Start assocation at OFFSET into FILE
     -r	Read only
     -S	Limit SIZE of loopback association (alias --sizelimit)
+    --direct-io	Read and write FILE with O_DIRECT, so it isn't cached twice
+    --sector-size	Logical sector SIZE of the device (512 to 4096)
 */
 
 #define FOR_losetup
@@ -39,6 +41,7 @@ GLOBALS(
   char *jfile;
   long offset;
   long size;
+  long sector_size;
 
   int openflags;
   dev_t jdev;
@@ -55,6 +58,67 @@ todo: basic /dev file association
     https://lkml.org/lkml/2011/7/26/148
 */
 
+// Ask /dev/loop-control for an unused loop device (it makes one if need be)
+// and write its name at the start of toybuf. Returns NULL if it can't.
+static char *loop_free(void)
+{
+  int i, cfd = open("/dev/loop-control", O_RDWR);
+  char *device = 0;
+
+  // We assume /dev is devtmpfs so device creation has no lag. Otherwise
+  // just preallocate loop devices and stay within them.
+
+  // mount -o loop depends on found device being at the start of toybuf.
+  if (cfd != -1) {
+    if (0 <= (i = ioctl(cfd, 0x4C82))) // LOOP_CTL_GET_FREE
+      sprintf(device = toybuf, "/dev/loop%d", i);
+    close(cfd);
+  }
+
+  return device;
+}
+
+// Attach ffd to lfd with the offset, size and flags from the command line.
+// Returns 0 or -1 with errno set.
+static int loop_attach(int lfd, int ffd, struct loop_info64 *loop)
+{
+  // struct loop_config, which older headers don't have.
+  struct {
+    unsigned fd, block_size;
+    struct loop_info64 info;
+    unsigned long long reserved[8];
+  } cfg;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.fd = ffd;
+  cfg.block_size = TT.sector_size;
+  cfg.info = *loop;
+  if (toys.optflags & FLAG_direct_io) cfg.info.lo_flags |= 16; // DIRECT_IO
+
+  // LOOP_CONFIGURE sets it all at once, so nothing sees the device half set
+  // up and a read only file doesn't have its page cache read twice. Before
+  // Linux 5.8 it takes a call per setting.
+  if (!ioctl(lfd, 0x4C0A, &cfg)) return 0;
+  if (errno != EINVAL && errno != ENOTTY) return -1;
+  if (ioctl(lfd, LOOP_SET_FD, ffd)) return -1;
+  if (ioctl(lfd, LOOP_SET_STATUS64, loop)
+    || (TT.sector_size && ioctl(lfd, 0x4C09, TT.sector_size))) // SET_BLOCK_SIZE
+  {
+    int err = errno;
+
+    ioctl(lfd, LOOP_CLR_FD, 0);
+    errno = err;
+
+    return -1;
+  }
+
+  // Not every filesystem can do direct I/O, so losing it isn't fatal.
+  if ((toys.optflags & FLAG_direct_io) && ioctl(lfd, 0x4C08, 1)) // DIRECT_IO
+    perror_msg("direct-io");
+
+  return 0;
+}
+
 // -f: *device is NULL
 
 // Perform requested operation on one device. Returns 1 if handled, 0 if error
@@ -67,19 +131,7 @@ static void loopback_setup(char *device, char *file)
   // Open file (ffd) and loop device (lfd)
 
   if (file) ffd = xopen(file, TT.openflags);
-  if (!device) {
-    int i, cfd = open("/dev/loop-control", O_RDWR);
-
-    // We assume /dev is devtmpfs so device creation has no lag. Otherwise
-    // just preallocate loop devices and stay within them.
-
-    // mount -o loop depends on found device being at the start of toybuf.
-    if (cfd != -1) {
-      if (0 <= (i = ioctl(cfd, 0x4C82))) // LOOP_CTL_GET_FREE
-        sprintf(device = toybuf, "/dev/loop%d", i);
-      close(cfd);
-    }
-  }
+  if (!device) device = loop_free();
 
   if (device) lfd = open(device, TT.openflags);
 
@@ -107,14 +159,22 @@ static void loopback_setup(char *device, char *file)
   // Associate file with this device?
   } else if (file) {
     char *s = xabspath(file, 1);
+    int tries = 0;
 
     if (!s) perror_exit("file"); // already opened, but if deleted since...
-    if (ioctl(lfd, LOOP_SET_FD, ffd)) perror_exit("%s=%s", device, file);
     loop->lo_offset = TT.offset;
     loop->lo_sizelimit = TT.size;
     xstrncpy((char *)loop->lo_file_name, s, LO_NAME_SIZE);
     s[LO_NAME_SIZE-1] = 0;
-    if (ioctl(lfd, LOOP_SET_STATUS64, loop)) perror_exit("%s=%s", device, file);
+
+    // With -f another losetup can take the free device before we do, so
+    // try the next free one.
+    while (loop_attach(lfd, ffd, loop)) {
+      if (errno != EBUSY || !(flags & FLAG_f) || ++tries == 16 || !loop_free())
+        perror_exit("%s=%s", device, file);
+      close(lfd);
+      lfd = xopen(device, TT.openflags);
+    }
     if (flags & FLAG_s) printf("%s", device);
     free(s);
   } else if (flags & FLAG_f) printf("%s", device);
@@ -35,7 +35,7 @@ GLOBALS(
   char *ids;
   long numeric;
 
-  FILE *db;
+  struct hwids *db;
 )
 
 static int do_lspci(struct dirtree *new)
@@ -77,23 +77,10 @@ static int do_lspci(struct dirtree *new)
 
   if (CFG_LSPCI_TEXT && TT.db) {
     if (TT.numeric != 1) {
-      char *s;
-
-      fseek(TT.db, 0, SEEK_SET);
-      while (!vbig || !dbig) {
-        s = p;
-        if (!fgets(s, sizeof(toybuf)-(p-toybuf)-1, TT.db)) break;
-        while (isspace(*s)) s++;
-        if (*s == '#') continue;
-        if (vbig && s == p) break;
-        if (strstart(&s, vbig ? device : vendor)) {
-          if (vbig) dbig = s+2;
-          else vbig = s+2;
-          s += strlen(s);
-          s[-1] = 0; // trim ending newline
-          p = s + 1;
-        }
-      }
+      int id = strtol(vendor, 0, 16), len = (sizeof(toybuf)-(p-toybuf))/2;
+
+      if ((vbig = hwids_name(TT.db, id, -1, p, len)))
+        dbig = hwids_name(TT.db, id, strtol(device, 0, 16), p+len, len);
     }
 
     if (TT.numeric > 1) {
@@ -123,9 +110,10 @@ void lspci_main(void)
 {
   if (CFG_LSPCI_TEXT && TT.numeric != 1) {
     if (!TT.ids) TT.ids = "/usr/share/misc/pci.ids";
-    if (!(TT.db = fopen(TT.ids, "r")))
+    if (!(TT.db = hwids_open(TT.ids)))
       perror_msg("could not open PCI ID db");
   }
 
   dirtree_read("/sys/bus/pci/devices", do_lspci);
+  hwids_close(TT.db);
 }
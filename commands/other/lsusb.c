@@ -10,11 +10,17 @@ config LSUSB
   help
     usage: lsusb
 
-    List USB hosts/devices.
+    List USB hosts/devices, with names from /usr/share/misc/usb.ids if
+    it's there.
 */
 
+#define FOR_lsusb
 #include "toys.h"
 
+GLOBALS(
+  struct hwids *ids;
+)
+
 static int list_device(struct dirtree *new)
 {
   FILE *file;
@@ -34,8 +40,16 @@ static int list_device(struct dirtree *new)
           || sscanf(toybuf, "DEVNUM=%u\n", &devnum)
           || sscanf(toybuf, "PRODUCT=%x/%x/", &pid, &vid)) count++;
 
-    if (count == 3)
-      printf("Bus %03d Device %03d: ID %04x:%04x\n", busnum, devnum, pid, vid);
+    if (count == 3) {
+      char *vname = 0, *dname = 0, *half = toybuf+sizeof(toybuf)/2;
+
+      if (TT.ids && (vname = hwids_name(TT.ids, pid, -1, toybuf, half-toybuf)))
+        dname = hwids_name(TT.ids, pid, vid, half, half-toybuf);
+      printf("Bus %03d Device %03d: ID %04x:%04x", busnum, devnum, pid, vid);
+      if (vname) printf(" %s", vname);
+      if (dname) printf(" %s", dname);
+      xputc('\n');
+    }
     fclose(file);
   }
   free(name);
@@ -45,5 +59,7 @@ static int list_device(struct dirtree *new)
 
 void lsusb_main(void)
 {
+  TT.ids = hwids_open("/usr/share/misc/usb.ids");
   dirtree_read("/sys/bus/usb/devices/", list_device);
+  hwids_close(TT.ids);
 }
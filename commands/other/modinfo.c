@@ -35,10 +35,61 @@ static void output_field(char *field, char *value)
   xputc((toys.optflags & FLAG_0) ? 0 : '\n');
 }
 
+// Where the data of the section with header sh is, if it's within the file.
+static int modinfo_shdata(char *sh, int big, int64_t (*get)(void *, unsigned),
+  long len, long *off, long *size)
+{
+  *off = big ? get(sh+24, 8) : get(sh+16, 4);
+  *size = big ? get(sh+32, 8) : get(sh+20, 4);
+
+  return *off>=0 && *size>=0 && *off<=len && *size<=len-*off;
+}
+
+// Find the .modinfo section through the ELF section header table, or return
+// 0 if this isn't an ELF file with one inside it.
+static char *modinfo_section(char *buf, long len, long *size)
+{
+  int64_t (*get)(void *, unsigned) = buf[5]==2 ? peek_be : peek_le;
+  long long shoff;
+  long off, sz;
+  unsigned shsize, shnum, shstr, i, name;
+  char *names;
+  int big;
+
+  if (len < 64 || memcmp(buf, "\177ELF", 4)) return 0;
+  if ((big = buf[4]==2)) {
+    shoff = get(buf+40, 8);
+    shsize = get(buf+58, 2);
+    shnum = get(buf+60, 2);
+    shstr = get(buf+62, 2);
+  } else {
+    shoff = get(buf+32, 4);
+    shsize = get(buf+46, 2);
+    shnum = get(buf+48, 2);
+    shstr = get(buf+50, 2);
+  }
+  if (shoff<0 || shsize<(big ? 40 : 24) || shstr>=shnum
+    || shoff>len || (len-shoff)/shsize<shnum) return 0;
+  if (!modinfo_shdata(buf+shoff+shstr*shsize, big, get, len, &off, &sz))
+    return 0;
+  names = buf+off;
+  for (i = 0; i<shnum; i++) {
+    name = get(buf+shoff+i*shsize, 4);
+    if (name>=sz || sz-name<9 || memcmp(names+name, ".modinfo", 9)) continue;
+    if (!modinfo_shdata(buf+shoff+i*shsize, big, get, len, &off, size))
+      return 0;
+
+    return buf+off;
+  }
+
+  return 0;
+}
+
 static void modinfo_file(char *full_name)
 {
-  int fd, len, i;
-  char *buf = 0, *pos, *modinfo_tags[] = {
+  int fd, i;
+  long len = 0, size;
+  char *buf = 0, *pos, *end, *info, *modinfo_tags[] = {
     "alias", "license", "description", "author", "firmware",
     "vermagic", "srcversion", "intree", "depends", "parm",
     "parmtype",
@@ -46,7 +97,10 @@ static void modinfo_file(char *full_name)
 
   if (-1 != (fd = open(full_name, O_RDONLY))) {
     len = fdlength(fd);
-    if (!(buf = mmap(0, len, PROT_READ, MAP_SHARED, fd, 0))) close(fd);
+    if (MAP_FAILED == (buf = mmap(0, len, PROT_READ, MAP_SHARED, fd, 0))) {
+      buf = 0;
+      close(fd);
+    }
   }
 
   if (!buf) {
@@ -56,15 +110,21 @@ static void modinfo_file(char *full_name)
 
   output_field("filename", full_name);
 
-  for (pos = buf; pos < buf+len; pos++) {
-    if (*pos) continue;
+  // The fields are "tag=value" strings in .modinfo. Something that isn't an
+  // ELF module gets searched from end to end, as before.
+  if (!(info = modinfo_section(buf, len, &size))) {
+    info = buf;
+    size = len;
+  }
+  for (pos = info; pos < info+size; pos = end+1) {
+    if (!(end = memchr(pos, 0, info+size-pos))) break;
 
     for (i = 0; i < sizeof(modinfo_tags) / sizeof(*modinfo_tags); i++) {
       char *str = modinfo_tags[i];
       int len = strlen(str);
 
-      if (!strncmp(pos+1, str, len) && pos[len+1] == '=') 
-        output_field(str, pos+len+2);
+      if (!strncmp(pos, str, len) && pos[len] == '=')
+        output_field(str, pos+len+1);
     }
   }
 
@@ -7,7 +7,7 @@
 // This little dance is because a NEWTOY with - in the name tries to do
 // things like prototype "nbd-client_main" which isn't a valid symbol. So
 // we hide the underscore name and OLDTOY the name we want.
-USE_NBD_CLIENT(NEWTOY(nbd_client, "<3>3ns", 0))
+USE_NBD_CLIENT(NEWTOY(nbd_client, "<3>3N:C#<1>16ns", 0))
 USE_NBD_CLIENT(OLDTOY(nbd-client, nbd_client, TOYFLAG_USR|TOYFLAG_BIN))
 
 config NBD_CLIENT
@@ -15,14 +15,16 @@ config NBD_CLIENT
   depends on TOYBOX_FORK
   default y
   help
-    usage: nbd-client [-ns] HOST PORT DEVICE
+    usage: nbd-client [-ns] [-C CONNS] [-N NAME] HOST PORT DEVICE
 
+    -C	Connections to open, if the server allows more than one (default 1)
+    -N	Name of the export (default the server's default export)
     -n	Do not fork into background
     -s	nbd swap support (lock server into memory)
 */
 
 /*  TODO:
-    usage: nbd-client [-sSpn] [-b BLKSZ] [-t SECS] [-N name] HOST PORT DEVICE
+    usage: nbd-client [-sSpn] [-b BLKSZ] [-t SECS] HOST PORT DEVICE
 
     -b	block size
     -t	timeout in seconds
@@ -36,34 +38,220 @@ config NBD_CLIENT
 #define FOR_nbd_client
 #include "toys.h"
 #include <linux/nbd.h>
+#include <linux/rtnetlink.h>
+#include <linux/genetlink.h>
+
+// Kernels since 4.12 can be handed all the sockets at once over netlink,
+// and keep them after we exit.
+#if defined(__has_include)
+#if __has_include(<linux/nbd-netlink.h>)
+#include <linux/nbd-netlink.h>
+#define NBD_NETLINK 1
+#endif
+#endif
+
+GLOBALS(
+  long C;
+  char *N;
+)
+
+// Connect to the server and negotiate the export, oldstyle or newstyle.
+static int nbd_connect(char *host, char *port, uint64_t *size, unsigned *flags)
+{
+  int sock = xconnect(host, port, AF_UNSPEC, SOCK_STREAM, 0, 0), temp = 1,
+    len = TT.N ? strlen(TT.N) : 0;
+  unsigned short hflags;
+  unsigned cflags;
+
+  // Requests go out as soon as the kernel queues them, and each connection
+  // has room for a few of the largest ones in flight.
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &temp, sizeof(int));
+  setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &temp, sizeof(int));
+  temp = 1<<20;
+  setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &temp, sizeof(int));
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &temp, sizeof(int));
+
+  // Read login data
+
+  xreadall(sock, toybuf, 16);
+  if (memcmp(toybuf, "NBDMAGIC", 8)) error_exit("bad login %s:%s", host, port);
+  if (!memcmp(toybuf+8, "\x00\x00\x42\x02\x81\x86\x12\x53", 8)) {
+    if (TT.N) error_exit("%s:%s has no named exports", host, port);
+    xreadall(sock, toybuf, 136);
+    *size = SWAP_BE64(*(uint64_t *)toybuf);
+    *flags = SWAP_BE32(*(unsigned *)(toybuf+8));
+  } else if (!memcmp(toybuf+8, "IHAVEOPT", 8)) {
+
+    // Newstyle: take the fixed newstyle and no zeroes flags the server
+    // offers, then ask for the export by name (empty for the default).
+    xreadall(sock, &hflags, 2);
+    hflags = SWAP_BE16(hflags)&3;
+    if (len > sizeof(toybuf)-20) error_exit("name too long");
+    cflags = SWAP_BE32(hflags);
+    memcpy(toybuf, &cflags, 4);
+    memcpy(toybuf+4, "IHAVEOPT", 8);
+    cflags = SWAP_BE32(1);
+    memcpy(toybuf+12, &cflags, 4);
+    cflags = SWAP_BE32(len);
+    memcpy(toybuf+16, &cflags, 4);
+    if (len) memcpy(toybuf+20, TT.N, len);
+    txwrite(sock, toybuf, 20+len);
+
+    // A server without the export hangs up on us here.
+    len = (hflags&2) ? 10 : 134;
+    if (readall(sock, toybuf, len) != len)
+      error_exit("no export '%s' on %s:%s", TT.N ? TT.N : "", host, port);
+    *size = SWAP_BE64(*(uint64_t *)toybuf);
+    *flags = SWAP_BE16(*(unsigned short *)(toybuf+8));
+  } else error_exit("bad login %s:%s", host, port);
+
+  return sock;
+}
+
+// Open up to -C connections into socks[], returning how many. More than one
+// only if the server says it keeps them coherent with each other.
+static int nbd_socks(char *host, char *port, int *socks, uint64_t *size,
+  unsigned *flags)
+{
+  uint64_t size2;
+  unsigned flags2;
+  int i, n = TT.C ? TT.C : 1;
+
+  *socks = nbd_connect(host, port, size, flags);
+  if (!(*flags & NBD_FLAG_CAN_MULTI_CONN)) n = 1;
+  for (i = 1; i<n; i++) {
+    socks[i] = nbd_connect(host, port, &size2, &flags2);
+    if (size2 != *size || flags2 != *flags) error_exit("export changed");
+  }
+
+  return n;
+}
+
+#ifdef NBD_NETLINK
+// Append an attribute to a netlink message. A nest (data NULL, len 0) is
+// closed by nbd_nest_end() once its contents are in.
+static struct nlattr *nbd_attr(struct nlmsghdr *nlh, int type, void *data,
+  int len)
+{
+  struct nlattr *nla = (void *)((char *)nlh+NLMSG_ALIGN(nlh->nlmsg_len));
+
+  nla->nla_type = type;
+  nla->nla_len = NLA_HDRLEN+len;
+  if (len) memcpy((char *)nla+NLA_HDRLEN, data, len);
+  nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len)+NLA_ALIGN(nla->nla_len);
+
+  return nla;
+}
+
+static void nbd_nest_end(struct nlmsghdr *nlh, struct nlattr *nla)
+{
+  nla->nla_type |= NLA_F_NESTED;
+  nla->nla_len = (char *)nlh+nlh->nlmsg_len-(char *)nla;
+}
+
+// Send the generic netlink request in toybuf and wait for its answer or
+// acknowledgement, which is left in toybuf. Returns 0 for an error.
+static int nbd_genl(int fd, int type, int cmd)
+{
+  struct nlmsghdr *nlh = (void *)toybuf;
+  struct nlmsgerr *err;
+  int len;
+
+  nlh->nlmsg_type = type;
+  nlh->nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK;
+  ((struct genlmsghdr *)NLMSG_DATA(nlh))->cmd = cmd;
+  ((struct genlmsghdr *)NLMSG_DATA(nlh))->version = 1;
+  if (send(fd, toybuf, nlh->nlmsg_len, 0) != nlh->nlmsg_len) return 0;
+  do {
+    if ((len = recv(fd, toybuf, sizeof(toybuf), 0)) < (int)sizeof(*nlh)
+      || !NLMSG_OK(nlh, len)) return 0;
+    if (nlh->nlmsg_type == NLMSG_ERROR) {
+      err = NLMSG_DATA(nlh);
+
+      return !err->error;
+    }
+  } while (nlh->nlmsg_type != type);
+
+  return 1;
+}
+
+// Hand the sockets to the kernel over netlink, it keeps them from here.
+static int nbd_netlink(int index, uint64_t size, unsigned flags, int *socks,
+  int n)
+{
+  struct nlmsghdr *nlh = (void *)toybuf;
+  struct rtattr *tb[CTRL_ATTR_MAX+1];
+  struct nlattr *list, *item;
+  uint64_t val;
+  int fd, family, i, ok = 0;
+
+  if (-1 == (fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_GENERIC)))
+    return 0;
+
+  // Look up the nbd family's id, and only ask it to connect once we know.
+  memset(toybuf, 0, NLMSG_LENGTH(GENL_HDRLEN));
+  nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  nbd_attr(nlh, CTRL_ATTR_FAMILY_NAME, "nbd", 4);
+  if (nbd_genl(fd, GENL_ID_CTRL, CTRL_CMD_GETFAMILY)) {
+    netlink_attrs(nlh, GENL_HDRLEN, tb, CTRL_ATTR_MAX);
+    if (tb[CTRL_ATTR_FAMILY_ID]) {
+      family = *(unsigned short *)RTA_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+      memset(toybuf, 0, NLMSG_LENGTH(GENL_HDRLEN));
+      nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+      nbd_attr(nlh, NBD_ATTR_INDEX, &index, 4);
+      nbd_attr(nlh, NBD_ATTR_SIZE_BYTES, &size, 8);
+      val = 4096;
+      nbd_attr(nlh, NBD_ATTR_BLOCK_SIZE_BYTES, &val, 8);
+      val = flags;
+      nbd_attr(nlh, NBD_ATTR_SERVER_FLAGS, &val, 8);
+      list = nbd_attr(nlh, NBD_ATTR_SOCKETS, 0, 0);
+      for (i = 0; i<n; i++) {
+        item = nbd_attr(nlh, NBD_SOCK_ITEM, 0, 0);
+        nbd_attr(nlh, NBD_SOCK_FD, socks+i, 4);
+        nbd_nest_end(nlh, item);
+      }
+      nbd_nest_end(nlh, list);
+      ok = nbd_genl(fd, family, NBD_CMD_CONNECT);
+    }
+  }
+  close(fd);
+
+  return ok;
+}
+#endif
 
 void nbd_client_main(void)
 {
-  int sock = -1, nbd, flags;
+  int *socks, nbd, n, i;
   unsigned long timeout = 0;
-  char *host=toys.optargs[0], *port=toys.optargs[1], *device=toys.optargs[2];
+  char *host=toys.optargs[0], *port=toys.optargs[1], *device=toys.optargs[2],
+    *s = strrchr(device, '/');
+  unsigned flags;
   uint64_t devsize;
 
+  socks = xmalloc((TT.C ? TT.C : 1)*sizeof(int));
+  n = nbd_socks(host, port, socks, &devsize, &flags);
+
+  // With netlink there's nothing left for us to do but open the device to
+  // force a reread of the partition table. This has to come before we open
+  // it ourselves, which would make the kernel set it up for ioctls.
+#ifdef NBD_NETLINK
+  if (1 == sscanf(s ? s+1 : device, "nbd%d", &i)
+    && nbd_netlink(i, devsize, flags, socks, n))
+  {
+    for (i = 0; i<n; i++) close(socks[i]);
+    close(open(device, O_RDONLY));
+
+    return;
+  }
+#endif
+
   // Repeat until spanked
 
   nbd = xopen(device, O_RDWR);
   for (;;) {
     int temp;
 
-    // Find and connect to server
-
-    sock = xconnect(host, port, AF_UNSPEC, SOCK_STREAM, 0, 0);
-    temp = 1;
-    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &temp, sizeof(int));
-
-    // Read login data
-
-    xreadall(sock, toybuf, 152);
-    if (memcmp(toybuf, "NBDMAGIC\x00\x00\x42\x02\x81\x86\x12\x53", 16))
-      error_exit("bad login %s:%s", host, port);
-    devsize = SWAP_BE64(*(uint64_t *)(toybuf+16));
-    flags = SWAP_BE32(*(int *)(toybuf+24));
-
     // Set 4k block size.  Everything uses that these days.
     ioctl(nbd, NBD_SET_BLKSIZE, 4096);
     ioctl(nbd, NBD_SET_SIZE_BLOCKS, devsize/4096);
@@ -74,15 +262,16 @@ void nbd_client_main(void)
     xioctl(nbd, BLKROSET, &temp);
 
     if (timeout && ioctl(nbd, NBD_SET_TIMEOUT, timeout)<0) break;
-    if (ioctl(nbd, NBD_SET_SOCK, sock) < 0) break;
+    if (ioctl(nbd, NBD_SET_SOCK, *socks) < 0) break;
+
+    // Kernels before 4.10 take one socket, so keep what they'll take.
+    for (i = 1; i<n; i++) if (ioctl(nbd, NBD_SET_SOCK, socks[i]) < 0) break;
+    while (n > i) close(socks[--n]);
 
     if (toys.optflags & FLAG_s) mlockall(MCL_CURRENT|MCL_FUTURE);
 
     // Open the device to force reread of the partition table.
     if ((toys.optflags & FLAG_n) || !xfork()) {
-      char *s = strrchr(device, '/');
-      int i;
-
       sprintf(toybuf, "/sys/block/%.32s/pid", s ? s+1 : device);
       // Is it up yet? (Give it 10 seconds.)
       for (i=0; i<100; i++) {
@@ -104,7 +293,8 @@ void nbd_client_main(void)
     // Process NBD requests until further notice.
 
     if (ioctl(nbd, NBD_DO_IT)>=0 || errno==EBADR) break;
-    close(sock);
+    for (i = 0; i<n; i++) close(socks[i]);
+    n = nbd_socks(host, port, socks, &devsize, &flags);
   }
 
   // Flush queue and exit.
@@ -5,14 +5,17 @@
  * TODO: udp, ipv6, genericize for telnet/microcom/tail-f
 
 USE_NETCAT(OLDTOY(nc, netcat, TOYFLAG_USR|TOYFLAG_BIN))
-USE_NETCAT(NEWTOY(netcat, USE_NETCAT_LISTEN("^tlL")"w#p#s:q#f:", TOYFLAG_BIN))
+USE_NETCAT(NEWTOY(netcat, USE_NETCAT_LISTEN("^tklL")"DI#O#w#p#s:q#f:", TOYFLAG_BIN))
 
 config NETCAT
   bool "netcat"
   default y
   help
-    usage: netcat [-u] [-wpq #] [-s addr] {IPADDR PORTNUM|-f FILENAME}
+    usage: netcat [-uD] [-wpqIO #] [-s addr] {IPADDR PORTNUM|-f FILENAME}
 
+    -D	set TCP_NODELAY (don't wait to fill packets before sending)
+    -I	SIZE of socket receive buffer
+    -O	SIZE of socket send buffer
     -f	use FILENAME (ala /dev/ttyS0) instead of network
     -p	local port number
     -q	SECONDS quit this many seconds after EOF on stdin.
@@ -28,13 +31,16 @@ config NETCAT_LISTEN
   depends on NETCAT
   depends on TOYBOX_FORK
   help
-    usage: netcat [-lL COMMAND...]
+    usage: netcat [-k] [-lL COMMAND...]
 
     -l	listen for one incoming connection.
     -L	listen for multiple incoming connections (server mode).
+    -k	keep listening after -l (same as -L)
 
     The command line after -l or -L is executed to handle each incoming
-    connection. If none, the connection is forwarded to stdin/stdout.
+    connection. If none, the connection is forwarded to stdin/stdout, and
+    with -L that's every connection at once: what each client sends goes
+    to stdout and stdin goes to all of them.
 
     For a quick-and-dirty server, try something like:
     netcat -s 127.0.0.1 -p 1234 -tL /bin/bash -l
@@ -59,8 +65,16 @@ GLOBALS(
   char *source_address;  // -s Bind to a specific source address.
   long port;             // -p Bind to a specific source port.
   long wait;             // -w Wait # seconds for a connection.
+  long sndbuf;           // -O Socket send buffer size.
+  long rcvbuf;           // -I Socket receive buffer size.
+
+  int pipefd[2];
 )
 
+// How much a relay pipe holds. It's only page references, so ask for as
+// much as an unprivileged process gets by default.
+#define NETCAT_PIPESZ (1<<20)
+
 static void timeout(int signum)
 {
   if (TT.wait) error_exit("Timeout");
@@ -77,11 +91,14 @@ static void set_alarm(int seconds)
 // Translate x.x.x.x numeric IPv4 address, or else DNS lookup an IPv4 name.
 static void lookup_name(char *name, uint32_t *result)
 {
-  struct hostent *hostbyname;
-
-  hostbyname = gethostbyname(name); // getaddrinfo
-  if (!hostbyname) error_exit("no host '%s'", name);
-  *result = *(uint32_t *)*hostbyname->h_addr_list;
+  struct addrinfo hints, *ai;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (dns_getaddrinfo(name, 0, &hints, &ai)) error_exit("no host '%s'", name);
+  *result = ((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr;
+  free(ai);
 }
 
 // Worry about a fancy lookup later.
@@ -90,14 +107,123 @@ static void lookup_port(char *str, uint16_t *port)
   *port = SWAP_BE16(atoi(str));
 }
 
+// Copy what's waiting on in to out, returning 0 at EOF or error. While
+// *ok, move it by splice()ing through TT.pipefd so the data stays in the
+// kernel. Either end refusing (EINVAL: a tty, an O_APPEND file...) clears
+// *ok and this and later copies go through toybuf.
+static int netcat_move(int in, int out, int *ok)
+{
+  long len, got = 0, done;
+
+#if TOYBOX_COPYFILE
+  if (*ok) {
+    len = syscall(SYS_splice, in, 0, TT.pipefd[1], 0, NETCAT_PIPESZ,
+      SPLICE_F_MOVE);
+    if (len<0 && errno == EINVAL) *ok = 0;
+    else if (len<1) return 0;
+    else {
+      for (done = 0; done<len; done += got)
+        if (1>(got = syscall(SYS_splice, TT.pipefd[0], 0, out, 0, len-done,
+          SPLICE_F_MOVE))) break;
+      if (done == len) return len;
+      if (got<0 && errno != EINVAL) perror_exit("splice");
+
+      // Output won't splice: write what's already in the pipe normally.
+      *ok = 0;
+      while (done<len) {
+        got = xread(TT.pipefd[0], toybuf,
+          (len-done > sizeof(toybuf)) ? sizeof(toybuf) : len-done);
+        txwrite(out, toybuf, got);
+        done += got;
+      }
+
+      return len;
+    }
+  }
+#endif
+
+  if (1>(len = read(in, toybuf, sizeof(toybuf)))) return 0;
+  txwrite(out, toybuf, len);
+
+  return len;
+}
+
+// -L (or -lk) without a command: one poll loop serving every client.
+// Whatever a client sends is copied to stdout as it arrives, and stdin is
+// sent to all of them. Once stdin hits EOF, clients get a half close.
+static void netcat_serve(int sockfd)
+{
+  struct pollfd *pfd = xzalloc(2*sizeof(*pfd));
+  int *ok = 0, count = 2, i, j, len, eof = 0, fd;
+
+  // A client going away mid-write shouldn't take the rest with it.
+  xsignal(SIGPIPE, SIG_IGN);
+  pfd[0].fd = sockfd;
+  pfd[1].fd = 0;
+  pfd[0].events = pfd[1].events = POLLIN;
+  for (;;) {
+    if (0>poll(pfd, count, -1)) {
+      if (errno == EINTR) continue;
+      perror_exit("poll");
+    }
+
+    // Copy out what clients sent, dropping the ones that hung up.
+    for (i = j = 2; i<count; i++) {
+      if (pfd[i].revents && !netcat_move(pfd[i].fd, 1, ok+i)) {
+        close(pfd[i].fd);
+        continue;
+      }
+      ok[j] = ok[i];
+      pfd[j++] = pfd[i];
+    }
+    count = j;
+
+    if (pfd[1].revents) {
+      if (1>(len = read(0, toybuf, sizeof(toybuf)))) {
+        for (i = 2; i<count; i++) shutdown(pfd[i].fd, SHUT_WR);
+        pfd[1].fd = -1;
+        eof = 1;
+      } else for (i = 2; i<count; i++)
+        if (len != writeall(pfd[i].fd, toybuf, len))
+          shutdown(pfd[i].fd, SHUT_RDWR);
+    }
+
+    if (pfd[0].revents) {
+      if (0>(fd = accept(sockfd, 0, 0))) {
+        if (errno != EINTR && errno != ECONNABORTED) perror_exit("accept");
+        continue;
+      }
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+      if (eof) shutdown(fd, SHUT_WR);
+      pfd = xrealloc(pfd, (count+1)*sizeof(*pfd));
+      ok = xrealloc(ok, (count+1)*sizeof(*ok));
+      pfd[count].fd = fd;
+      pfd[count].events = POLLIN;
+      ok[count++] = TT.pipefd[0] != -1;
+    }
+  }
+}
+
 void netcat_main(void)
 {
-  int sockfd=-1, pollcount=2;
+  int sockfd=-1, pollcount=2, ok[2];
   struct pollfd pollfds[2];
 
   memset(pollfds, 0, 2*sizeof(struct pollfd));
   pollfds[0].events = pollfds[1].events = POLLIN;
   set_alarm(TT.wait);
+  if (toys.optflags&FLAG_k) toys.optflags |= FLAG_L;
+
+  // A pipe to splice() through, as big as we're allowed.
+  TT.pipefd[0] = TT.pipefd[1] = -1;
+#if TOYBOX_COPYFILE
+  if (!pipe(TT.pipefd)) {
+    fcntl(TT.pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(TT.pipefd[1], F_SETFD, FD_CLOEXEC);
+    fcntl(TT.pipefd[0], F_SETPIPE_SZ, NETCAT_PIPESZ);
+  }
+#endif
+  ok[0] = ok[1] = TT.pipefd[0] != -1;
 
   // The argument parsing logic can't make "<2" conditional on other
   // arguments like -f and -l, so we do it by hand here.
@@ -115,6 +241,13 @@ void netcat_main(void)
     fcntl(sockfd, F_SETFD, FD_CLOEXEC);
     temp = 1;
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &temp, sizeof(temp));
+    // Accepted sockets inherit these from the listening one.
+    if (toys.optflags&FLAG_D)
+      setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &temp, sizeof(temp));
+    if ((temp = TT.sndbuf))
+      setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &temp, sizeof(temp));
+    if ((temp = TT.rcvbuf))
+      setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &temp, sizeof(temp));
     memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     if (TT.source_address || TT.port) {
@@ -146,6 +279,8 @@ void netcat_main(void)
         printf("%d\n", SWAP_BE16(address.sin_port));
         fflush(stdout);
       }
+      if ((toys.optflags&FLAG_L) && !toys.optc) netcat_serve(sockfd);
+
       // Do we need to return immediately because -l has arguments?
 
       if ((toys.optflags & FLAG_l) && toys.optc) {
@@ -207,9 +342,8 @@ void netcat_main(void)
 
     for (i=0; i<pollcount; i++) {
       if (pollfds[i].revents & POLLIN) {
-        int len = read(pollfds[i].fd, toybuf, sizeof(toybuf));
-        if (len<1) goto dohupnow;
-        txwrite(i ? pollfds[0].fd : 1, toybuf, len);
+        if (!netcat_move(pollfds[i].fd, i ? pollfds[0].fd : 1, ok+i))
+          goto dohupnow;
       } else if (pollfds[i].revents & POLLHUP) {
 dohupnow:
         // Close half-connection.  This is needed for things like
@@ -226,5 +360,9 @@ cleanup:
   if (CFG_TOYBOX_FREE) {
     close(pollfds[0].fd);
     close(sockfd);
+    if (TT.pipefd[0] != -1) {
+      close(TT.pipefd[0]);
+      close(TT.pipefd[1]);
+    }
   }
 }
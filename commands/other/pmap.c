@@ -22,19 +22,37 @@ config PMAP
 #define FOR_pmap
 #include "toys.h"
 
+// Print one mapping, adding it to the totals in tot[] (size, pss, dirty, swap).
+static void pmap_map(struct smaps *sm, void *arg)
+{
+  long long *tot = arg, size = (sm->end-sm->start)/1024;
+  char *name = *sm->name ? sm->name : "  [anon]";
+  int x = !!(toys.optflags & FLAG_x);
+
+  if (sm->perms[3] == 'p') sm->perms[3] = '-';
+  tot[0] += size;
+  printf("%0*llx % *lld%s ", (int)(2*sizeof(long)), sm->start, 6+x, size,
+    x ? "" : "K");
+  if (x) {
+    printf("% 7lld %7lld %7lld ", sm->kb[SMAPS_PSS],
+      sm->kb[SMAPS_PRIVATE_DIRTY], sm->kb[SMAPS_SWAP]);
+    tot[1] += sm->kb[SMAPS_PSS];
+    tot[2] += sm->kb[SMAPS_PRIVATE_DIRTY];
+    tot[3] += sm->kb[SMAPS_SWAP];
+    name = basename(name);
+  }
+  xprintf("%s-  %s%s\n", sm->perms, *sm->name=='[' ? "  " : "", name);
+}
+
 void pmap_main(void)
 {
   char **optargs;
 
   for (optargs = toys.optargs; *optargs; optargs++) {
     pid_t pid = atolx(*optargs);
-    FILE *fp;
-    char *line, *oldline = 0, *name = 0,
-         *k = (toys.optflags & FLAG_x) ? "" : "K";
-    size_t len;
-    long long start, end, pss, tpss = 0, dirty, tdirty = 0, swap, tswap = 0,
-              total = 0;
-    int xx = 0;
+    char *line, *k = (toys.optflags & FLAG_x) ? "" : "K";
+    long long tot[4] = {0, 0, 0, 0};
+    int fd;
 
     snprintf(toybuf, sizeof(toybuf), "/proc/%u/cmdline", pid);
     line = readfile(toybuf, 0, 0);
@@ -46,7 +64,7 @@ void pmap_main(void)
     // Only use the more verbose file in -x mode
     sprintf(toybuf, "/proc/%u/%smaps", pid,
       (toys.optflags & FLAG_x) ? "s" : "");
-    if (!(fp = fopen(toybuf, "r"))) {
+    if (-1 == (fd = open(toybuf, O_RDONLY|O_CLOEXEC))) {
       error_msg("No %ld\n", (long)pid);
       return;
     }
@@ -56,44 +74,7 @@ void pmap_main(void)
         (int)(sizeof(long)*2)-4, ' ');
 
     // Loop through mappings
-    for (;;) {
-      int off, count;
-
-      line = 0;
-      if (0 >= xgetline(&line, &len, fp)) break;
-      count = sscanf(line, "%llx-%llx %s %*s %*s %*s %n",
-        &start, &end, toybuf, &off);
-
-      if (count == 3) {
-        name = line[off] ? line+off : "  [anon]\n";
-        if (toybuf[3] == 'p') toybuf[3] = '-';
-        total += end = (end-start)/1024;
-        printf("%0*llx % *lld%s ", (int)(2*sizeof(long)), start,
-          6+!!(toys.optflags & FLAG_x), end, k);
-        if (toys.optflags & FLAG_x) {
-          oldline = line;
-          continue;
-        }
-      } else {
-        if (0<sscanf(line, "Pss: %lld", &pss)
-            || 0<sscanf(line, "Private_Dirty: %lld", &dirty)
-            || 0<sscanf(line, "Swap: %lld", &swap)) xx++;
-        free(line);
-        if (xx<3) continue;
-        line = oldline;
-        name = basename(name);
-        xx = 0;
-        printf("% 7lld %7lld %7lld ", pss, dirty, swap);
-        tpss += pss;
-        tdirty += dirty;
-        tswap += swap;
-      }
-
-      xprintf("%s-  %s%s", toybuf, line[off]=='[' ? "  " : "", name);
-
-      free(line);
-      line = 0;
-    }
+    procsnap_smaps(fd, pmap_map, tot);
 
     // Trailer
     if (!(toys.optflags & FLAG_q)) {
@@ -103,11 +84,9 @@ void pmap_main(void)
         xprintf("%.*s  ------  ------  ------  ------\n", (int)(sizeof(long)*2),
           toybuf);
       }
-      printf("total% *lld%s", 2*(int)(sizeof(long)+1)+x, total, k);
-      if (x) printf("% 8lld% 8lld% 8lld", tpss, tdirty, tswap);
+      printf("total% *lld%s", 2*(int)(sizeof(long)+1)+x, tot[0], k);
+      if (x) printf("% 8lld% 8lld% 8lld", tot[1], tot[2], tot[3]);
       xputc('\n');
     }
- 
-    fclose(fp);
   }
 }
@@ -4,34 +4,237 @@
  *
  * No standard.
 
-USE_READAHEAD(NEWTOY(readahead, NULL, TOYFLAG_BIN))
+USE_READAHEAD(NEWTOY(readahead, "ml:", TOYFLAG_BIN))
 
 config READAHEAD
   bool "readahead"
   default y
   help
-    usage: readahead FILE...
+    usage: readahead [-m] [-l LIST] [FILE...]
 
     Preload files into disk cache.
+
+    -l	Also load what LIST says, one "FILE" or "FILE OFFSET LENGTH" per line
+    -m	Show how much of each is cached instead of loading it
+
+    Everything is loaded in the order it sits on disk, so a list recorded
+    from a boot can be replayed without seeking back and forth.
 */
 
+#define FOR_readahead
 #include "toys.h"
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+GLOBALS(
+  char *l;
+
+  struct readahead_req *reqs;
+  long count;
+)
+
+struct readahead_req {
+  char *name;
+  long long off, len, block;
+  int err, order;
+};
+
+// Threads to submit reads from: fadvise waits for the request queue, so
+// more than one keeps the disk busy even on a single CPU.
+#define READAHEAD_THREADS 4
+
+static void readahead_add(char *name, long long off, long long len)
+{
+  struct readahead_req *req;
+
+  if (!(TT.count&255))
+    TT.reqs = xrealloc(TT.reqs, (TT.count+256)*sizeof(*TT.reqs));
+  req = TT.reqs+TT.count++;
+  memset(req, 0, sizeof(*req));
+  req->name = xstrdup(name);
+  req->off = off;
+  req->len = len;
+  req->order = TT.count;
+}
+
+// Is s digits all the way to end?
+static int readahead_num(char *s, char *end, long long *val)
+{
+  char *ss;
+
+  if (s == end || !isdigit(*s)) return 0;
+  *val = strtoll(s, &ss, 10);
+
+  return ss == end;
+}
+
+// Callback for loopfiles(): add the lines of a -l list. Names can have
+// spaces in them, so a range is only the last two words being numbers.
+static void readahead_list(int fd, char *name)
+{
+  struct linebuf lb;
+  long long off, len;
+  char *line, *s, *ss;
+  long ll;
+
+  linebuf_init(&lb, fd);
+  while ((line = get_linebuf(&lb, &ll, '\n', LINEBUF_CHOMP))) {
+    if (!*line) continue;
+    off = len = 0;
+    if ((s = strrchr(line, ' ')) && readahead_num(s+1, line+ll, &len)) {
+      *s = 0;
+      if ((ss = strrchr(line, ' ')) && readahead_num(ss+1, s, &off)) *ss = 0;
+      else {
+        *s = ' ';
+        off = len = 0;
+      }
+    }
+    readahead_add(line, off, len);
+  }
+  linebuf_done(&lb);
+}
+
+// Where on the disk the request starts, or -1 if the filesystem can't say.
+static long long readahead_block(struct readahead_req *req)
+{
+  struct {
+    struct fiemap fm;
+    struct fiemap_extent fe;
+  } map;
+  int fd = open(req->name, O_RDONLY);
+
+  if (fd == -1) return -1;
+  memset(&map, 0, sizeof(map));
+  map.fm.fm_start = req->off;
+  map.fm.fm_length = req->len ? req->len : ~0ULL;
+  map.fm.fm_extent_count = 1;
+  if (ioctl(fd, FS_IOC_FIEMAP, &map) || !map.fm.fm_mapped_extents)
+    map.fe.fe_physical = -1;
+  close(fd);
 
-#include <sys/syscall.h>
+  return map.fe.fe_physical;
+}
+
+// By disk position, with what the filesystem couldn't place last, and
+// otherwise in the order given.
+static int readahead_cmp(const void *a, const void *b)
+{
+  const struct readahead_req *x = a, *y = b;
+  unsigned long long xb = x->block, yb = y->block;
+
+  if (xb != yb) return (xb > yb) - (xb < yb);
+
+  return x->order-y->order;
+}
+
+static void readahead_load(struct readahead_req *req)
+{
+  int fd = open(req->name, O_RDONLY);
+
+  if (fd == -1) req->err = errno;
+  else {
+    req->err = posix_fadvise(fd, req->off, req->len, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+}
+
+// What the workers share, handed to them through the pthread arg.
+struct readahead_pool {
+  struct readahead_req *reqs;
+  long count, next;
+};
 
-static void do_readahead(int fd, char *name)
+static void *readahead_worker(void *arg)
 {
-  int rc;
+  struct readahead_pool *rp = arg;
+  long i;
 
-  // Since including fcntl.h doesn't give us the wrapper, use the syscall.
-  // 32 bits takes LO/HI offset (we don't care about endianness of 0).
-  if (sizeof(long) == 4) rc = syscall(__NR_readahead, fd, 0, 0, INT_MAX);
-  else rc = syscall(__NR_readahead, fd, 0, INT_MAX);
+  while ((i = __atomic_fetch_add(&rp->next, 1, __ATOMIC_RELAXED)) < rp->count)
+    readahead_load(rp->reqs+i);
 
-  if (rc) perror_msg("readahead: %s", name);
+  return 0;
+}
+
+// Show how many of the request's pages are in the page cache.
+static void readahead_show(struct readahead_req *req)
+{
+  long long len = req->len, pages, in = 0, i;
+  long page = sysconf(_SC_PAGESIZE);
+  int fd = open(req->name, O_RDONLY);
+  unsigned char *vec;
+  char *map;
+  off_t off = req->off&~(page-1);
+
+  if (fd == -1) {
+    perror_msg("%s", req->name);
+    return;
+  }
+  if (!len) len = fdlength(fd)-req->off;
+  if (len < 0) len = 0;
+  len += req->off-off;
+  pages = (len+page-1)/page;
+  if (pages) {
+    if (MAP_FAILED == (map = mmap(0, len, PROT_READ, MAP_SHARED, fd, off))) {
+      perror_msg("%s", req->name);
+      close(fd);
+      return;
+    }
+    vec = xmalloc(pages);
+    if (mincore(map, len, vec)) perror_msg("%s", req->name);
+    else for (i = 0; i<pages; i++) in += vec[i]&1;
+    free(vec);
+    munmap(map, len);
+  }
+  close(fd);
+  printf("%s: %lld/%lld pages (%lld%%)\n", req->name, in, pages,
+    pages ? in*100/pages : 100);
 }
 
 void readahead_main(void)
 {
-  loopfiles(toys.optargs, do_readahead);
+  struct readahead_pool rp;
+  char **arg;
+  long i;
+#if CFG_TOYBOX_THREADS
+  pthread_t tid[READAHEAD_THREADS];
+  pthread_attr_t attr;
+  int threads = 0;
+#endif
+
+  for (arg = toys.optargs; *arg; arg++) readahead_add(*arg, 0, 0);
+  if (TT.l) loopfiles((char *[]){TT.l, 0}, readahead_list);
+
+  if (toys.optflags&FLAG_m) {
+    for (i = 0; i<TT.count; i++) readahead_show(TT.reqs+i);
+
+    return;
+  }
+
+  for (i = 0; i<TT.count; i++) TT.reqs[i].block = readahead_block(TT.reqs+i);
+  qsort(TT.reqs, TT.count, sizeof(*TT.reqs), readahead_cmp);
+  rp.reqs = TT.reqs;
+  rp.count = TT.count;
+  rp.next = 0;
+
+#if CFG_TOYBOX_THREADS
+  if (TT.count > 1) {
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    while (threads < READAHEAD_THREADS-1 && threads < TT.count-1
+      && !toy_worker_create(tid+threads, &attr, readahead_worker, &rp)) threads++;
+    pthread_attr_destroy(&attr);
+  }
+#endif
+  readahead_worker(&rp);
+#if CFG_TOYBOX_THREADS
+  while (threads) pthread_join(tid[--threads], 0);
+#endif
+
+  for (i = 0; i<TT.count; i++) if ((errno = TT.reqs[i].err))
+    perror_msg("readahead: %s", TT.reqs[i].name);
+
+  if (CFG_TOYBOX_FREE) {
+    for (i = 0; i<TT.count; i++) free(TT.reqs[i].name);
+    free(TT.reqs);
+  }
 }
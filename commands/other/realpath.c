@@ -17,10 +17,22 @@ config REALPATH
 
 void realpath_main(void)
 {
-  char **s = toys.optargs;
+  char **s = toys.optargs, *path;
+  struct stat st;
 
+  // xabspath() remembers the directories it's been through, so a long list
+  // of files in the same few directories doesn't look them all up each time.
   for (s = toys.optargs; *s; s++) {
-    if (!realpath(*s, toybuf)) perror_msg("%s", *s);
-    else xputs(toybuf);
+    if (!(path = xabspath(*s, 1))) perror_msg("%s", *s);
+    else if (**s && (*s)[strlen(*s)-1] == '/'
+      && !stat(path, &st) && !S_ISDIR(st.st_mode))
+    {
+      errno = ENOTDIR;
+      perror_msg("%s", *s);
+      free(path);
+    } else {
+      xputs(path);
+      free(path);
+    }
   }
 }
@@ -18,22 +18,23 @@ config REV
 static void do_rev(int fd, char *name)
 {
   (void)name;
+  struct linebuf lb;
   char *c;
+  long len;
 
-  for (;;) {
-    int len, i;
+  linebuf_init(&lb, fd);
+  while ((c = get_linebuf(&lb, &len, '\n', LINEBUF_CHOMP))) {
+    int i;
 
-    if (!(c = get_line(fd))) break;
-    len = strlen(c) - 1;
-    for (i = 0; i <= len/2; i++) {
+    for (i = 0; i < len/2; i++) {
       char tmp = c[i];
 
-      c[i] = c[len-i];
-      c[len-i] = tmp;
+      c[i] = c[len-1-i];
+      c[len-1-i] = tmp;
     }
     xputs(c);
-    free(c);
   }
+  linebuf_done(&lb);
 }
 
 void rev_main(void)
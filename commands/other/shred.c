@@ -4,13 +4,13 @@
  *
  * No standard
 
-USE_SHRED(NEWTOY(shred, "<1zxus#<1n#<1o#<0f", TOYFLAG_USR|TOYFLAG_BIN))
+USE_SHRED(NEWTOY(shred, "<1(discard)zxus#<1n#<1o#<0f", TOYFLAG_USR|TOYFLAG_BIN))
 
 config SHRED
   bool "shred"
   default y
   help
-    usage: shred [-fuz] [-n COUNT] [-s SIZE] FILE...
+    usage: shred [-fuz] [-n COUNT] [-s SIZE] [--discard] FILE...
 
     Securely delete a file by overwriting its contents with random data.
 
@@ -21,6 +21,11 @@ config SHRED
     -u        unlink (actually delete file when done)
     -x        Use exact size (default without -s rounds up to next 4k)
     -z        zero at end
+    --discard Have a block device securely discard it after the random passes
+
+    Writes bypass the page cache where the filesystem allows, and each pass
+    is flushed to the device before the next. A block device zeroes itself
+    for -z if it can.
 
     Note: data journaling filesystems render this command useless, you must
     overwrite all free space (fill up disk) to erase old data on those.
@@ -34,22 +39,129 @@ GLOBALS(
   long iterations;
   long size;
 
-  int ufd;
+  char *buf;
+  unsigned chacha[16];
 )
 
+// Each write is this big, in a buffer aligned for O_DIRECT.
+#define SHRED_BUF (4<<20)
+
+#define rol(x, n) (((x)<<(n))|((x)>>(32-(n))))
+#define QR(a, b, c, d) \
+  a += b; d = rol(d^a, 16); c += d; b = rol(b^c, 12); \
+  a += b; d = rol(d^a, 8); c += d; b = rol(b^c, 7);
+
+// Fill len bytes (a multiple of 64) of buf with the ChaCha20 keystream. It's
+// keyed once from the kernel, so it costs no system calls per pass.
+static void shred_random(char *buf, long len)
+{
+  unsigned x[16], *c = TT.chacha, *out = (void *)buf;
+  int i;
+
+  for (; len > 0; len -= 64) {
+    memcpy(x, c, sizeof(x));
+    for (i = 0; i<10; i++) {
+      QR(x[0], x[4], x[8], x[12]) QR(x[1], x[5], x[9], x[13])
+      QR(x[2], x[6], x[10], x[14]) QR(x[3], x[7], x[11], x[15])
+      QR(x[0], x[5], x[10], x[15]) QR(x[1], x[6], x[11], x[12])
+      QR(x[2], x[7], x[8], x[13]) QR(x[3], x[4], x[9], x[14])
+    }
+    for (i = 0; i<16; i++) *out++ = x[i]+c[i];
+    if (!++c[12]) c[13]++;
+  }
+}
+
+#undef QR
+#undef rol
+
+// Key (and nonce) from getrandom(), or /dev/urandom without it.
+static void shred_seed(void)
+{
+  int fd;
+
+  memcpy(TT.chacha, "expand 32-byte k", 16);
+#ifdef SYS_getrandom
+  if (48 == syscall(SYS_getrandom, TT.chacha+4, 48, 0)) return;
+#endif
+  xreadall(fd = xopen("/dev/urandom", O_RDONLY), TT.chacha+4, 48);
+  close(fd);
+}
+
+// Direct I/O has to be block aligned, which the start or the last partial
+// block may not be, and some filesystems accept O_DIRECT at open but fail
+// the writes. Go through the page cache from then on.
+static int shred_undirect(int fd)
+{
+  int fl = fcntl(fd, F_GETFL);
+
+  if (fl == -1 || !(fl & O_DIRECT)) return 0;
+
+  return !fcntl(fd, F_SETFL, fl & ~O_DIRECT);
+}
+
+// Overwrite fd from TT.offset to len once, with random data or zeroes.
+// Returns nonzero after an error (already reported).
+static int shred_pass(int fd, char *name, off_t len, int zero, int blk)
+{
+  off_t pos = TT.offset;
+  long throw;
+
+#ifdef __linux__
+  if (zero && blk) {
+    uint64_t range[2] = {pos, len-pos};
+
+    if (!ioctl(fd, BLKZEROOUT, range)) return 0;
+  }
+#endif
+  if (pos != lseek(fd, pos, SEEK_SET)) {
+    perror_msg("%s", name);
+    return 1;
+  }
+  if (zero) memset(TT.buf, 0, SHRED_BUF);
+  if (pos & 4095) shred_undirect(fd);
+  for (; pos < len; pos += throw) {
+    throw = SHRED_BUF;
+    if (len-pos < throw)
+      throw = (toys.optflags & FLAG_x) ? len-pos : (len-pos+4095)&~4095;
+    if (!zero) shred_random(TT.buf, (throw+63)&~63);
+    if (throw & 4095) shred_undirect(fd);
+    if (throw != writeall(fd, TT.buf, throw)
+      && (errno != EINVAL || !shred_undirect(fd)
+        || pos != lseek(fd, pos, SEEK_SET)
+        || throw != writeall(fd, TT.buf, throw)))
+    {
+      perror_msg("%s", name);
+      return 1;
+    }
+  }
+
+  // Make sure this pass hit the disk before the next one replaces it.
+  if (fdatasync(fd) && errno != EINVAL) {
+    perror_msg("%s", name);
+    return 1;
+  }
+
+  return 0;
+}
+
 void shred_main(void)
 {
   char **try;
 
   if (!(toys.optflags & FLAG_n)) TT.iterations++;
-  TT.ufd = xopen("/dev/urandom", O_RDONLY);
+  shred_seed();
+  if (posix_memalign((void **)&TT.buf, 4096, SHRED_BUF)) error_exit("xmalloc");
 
   // We don't use loopfiles() here because "-" isn't stdin, and want to
   // respond to files we can't open via chmod.
 
   for (try = toys.optargs; *try; try++) {
-    off_t pos = 0, len = TT.size;
-    int fd = open(*try, O_RDWR), iter = 0, throw;
+    struct stat st;
+    off_t len = TT.size;
+    int fd = open(*try, O_RDWR|O_DIRECT), iter, blk;
+
+    // Not every filesystem does direct I/O.
+    if (fd == -1 && errno == EINVAL) fd = open(*try, O_RDWR);
 
     // do -f chmod if necessary
     if (fd == -1 && (toys.optflags & FLAG_f)) {
@@ -60,47 +172,39 @@ void shred_main(void)
       perror_msg("%s", *try);
       continue;
     }
+    blk = !fstat(fd, &st) && S_ISBLK(st.st_mode);
 
     // determine length
-    if (!len) len = fdlength(fd);
+    if (!len) {
+#ifdef BLKGETSIZE64
+      unsigned long long size;
+
+      if (blk && !ioctl(fd, BLKGETSIZE64, &size)) len = size;
+      else
+#endif
+      len = fdlength(fd);
+    }
     if (len<1) {
       error_msg("%s: needs -s", *try);
       close(fd);
       continue;
     }
 
-    // Loop through, writing to this file
-    for (;;) {
-      // Advance to next -n or -z?
-
-      if (pos >= len) {
-        pos = -1;
-        if (++iter == TT.iterations && (toys.optargs && FLAG_z)) {
-          memset(toybuf, 0, sizeof(toybuf));
-          continue;
-        }
-        if (iter >= TT.iterations) break;
-      }
-
-      if (pos < TT.offset) {
-        if (TT.offset != lseek(fd, TT.offset, SEEK_SET)) {
-          perror_msg("%s", *try);
-          break;
-        }
-        pos = TT.offset;
-      }
-
-      // Determine length, read random data if not zeroing, write.
-
-      throw = sizeof(toybuf);
-      if (toys.optflags & FLAG_x)
-        if (len-pos < throw) throw = len-pos;
-
-      if (iter != TT.iterations) xread(TT.ufd, toybuf, throw);
-      if (throw != writeall(fd, toybuf, throw)) perror_msg("%s");
-      pos += throw;
+    for (iter = 0; iter<TT.iterations; iter++)
+      if (shred_pass(fd, *try, len, 0, blk)) break;
+#ifdef __linux__
+    if (iter == TT.iterations && blk && (toys.optflags & FLAG_discard)) {
+      uint64_t range[2] = {TT.offset, len-TT.offset};
+
+      if (ioctl(fd, BLKSECDISCARD, range)) perror_msg("%s: discard", *try);
     }
+#endif
+    if (iter == TT.iterations && (toys.optflags & FLAG_z))
+      shred_pass(fd, *try, len, 1, blk);
+    close(fd);
+
     if (toys.optflags & FLAG_u)
       if (unlink(*try)) perror_msg("unlink '%s'", *try);
   }
+  if (CFG_TOYBOX_FREE) free(TT.buf);
 }
@@ -42,8 +42,8 @@ GLOBALS(
     struct stat st;
     struct statfs sf;
   } stat;
-  struct passwd *user_name;
-  struct group *group_name;
+  char *user_name;
+  char *group_name;
 )
 
 
@@ -82,7 +82,7 @@ static void print_stat(char type)
     if (!stat->st_size && filetype == S_IFREG) t = "regular empty file";
     xprintf("%s", t);
   } else if (type == 'g') xprintf("%lu", stat->st_gid);
-  else if (type == 'G') xprintf("%8s", TT.group_name->gr_name);
+  else if (type == 'G') xprintf("%8s", TT.group_name);
   else if (type == 'h') xprintf("%lu", stat->st_nlink);
   else if (type == 'i') xprintf("%llu", stat->st_ino);
   else if (type == 'N') {
@@ -93,7 +93,7 @@ static void print_stat(char type)
   } else if (type == 'o') xprintf("%lu", stat->st_blksize);
   else if (type == 's') xprintf("%llu", stat->st_size);
   else if (type == 'u') xprintf("%lu", stat->st_uid);
-  else if (type == 'U') xprintf("%8s", TT.user_name->pw_name);
+  else if (type == 'U') xprintf("%8s", TT.user_name);
   else if (type == 'x') date_stat_format((void *)&stat->st_atime);
   else if (type == 'X') xprintf("%llu", (long long)stat->st_atime);
   else if (type == 'y') date_stat_format((void *)&stat->st_mtime);
@@ -160,8 +160,8 @@ void stat_main(void)
       struct stat *stat = (struct stat*)&TT.stat;
 
       // check user and group name
-      TT.user_name = getpwuid(stat->st_uid);
-      TT.group_name = getgrgid(stat->st_gid);
+      if (!(TT.user_name = uid_name(stat->st_uid))) TT.user_name = "UNKNOWN";
+      if (!(TT.group_name = gid_name(stat->st_gid))) TT.group_name = "UNKNOWN";
     } else {
       perror_msg("'%s'", *toys.optargs);
       continue;
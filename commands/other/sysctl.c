@@ -27,6 +27,33 @@ config SYSCTL
 #include "toys.h"
 #include "xfuncs.h"
 
+GLOBALS(
+  int root, ndirs, count;
+  struct sysctl_dir *dirs[256];
+  struct sysctl_job *jobs;
+  char *file;
+  long line;
+)
+
+// Open directories under /proc/sys by their path relative to it, so a -p
+// file's thousand keys don't each walk the whole path again.
+struct sysctl_dir {
+  struct sysctl_dir *next;
+  int fd;
+  char path[];
+};
+
+// One value for -a to read, path relative to /proc/sys.
+struct sysctl_job {
+  char *path, *data;
+  int err, done;
+};
+
+// Directories to keep open at once, and values to read at once.
+#define SYSCTL_FDS 256
+#define SYSCTL_BATCH 256
+#define SYSCTL_THREADS 8
+
 // Null terminate at =, return value
 static char *split_key(char *key)
 {
@@ -42,117 +69,340 @@ static void replace_char(char *str, char old, char new)
   for (; *str; str++) if (*str == old) *str = new;
 }
 
+// Complain about key, saying which -p line it was on.
 static void key_error(char *key)
 {
-  if (errno == ENOENT) {
-    if (!(toys.optflags & FLAG_e)) error_msg("unknown key '%s'", key);
-  } else perror_msg("key '%s'", key);
+  int err = errno;
+  char *at = TT.file ? xmprintf("%s:%ld: ", TT.file, TT.line) : "";
+
+  if ((errno = err) == ENOENT) {
+    if (!(toys.optflags & FLAG_e)) error_msg("%sunknown key '%s'", at, key);
+  } else perror_msg("%skey '%s'", at, key);
+  if (TT.file) free(at);
+}
+
+static void sysctl_dirs_free(void)
+{
+  struct sysctl_dir *sd;
+  int i;
+
+  for (i = 0; i<ARRAY_LEN(TT.dirs); i++) while ((sd = TT.dirs[i])) {
+    TT.dirs[i] = sd->next;
+    close(sd->fd);
+    free(sd);
+  }
+  TT.ndirs = 0;
+}
+
+// Return an fd for directory path under /proc/sys ("" is /proc/sys), or -1.
+static int sysctl_dir(char *path)
+{
+  struct sysctl_dir *sd, **bucket;
+  unsigned hash = 0;
+  char *s;
+  int fd = TT.root;
+
+  if (!*path) return fd;
+  for (s = path; *s; s++) hash = hash*31+*s;
+  bucket = TT.dirs+(hash&(ARRAY_LEN(TT.dirs)-1));
+  for (sd = *bucket; sd; sd = sd->next) if (!strcmp(sd->path, path))
+    return sd->fd;
+
+  // Open it relative to its parent, which gets cached on the way.
+  if ((s = strrchr(path, '/'))) {
+    *s = 0;
+    fd = sysctl_dir(path);
+    *s++ = '/';
+  } else s = path;
+  if (fd == -1 || -1 == (fd = openat(fd, s, O_RDONLY|O_DIRECTORY|O_CLOEXEC)))
+    return -1;
+
+  // When they're all in use start again, the keys of a file tend to be
+  // grouped anyway.
+  if (TT.ndirs == SYSCTL_FDS) {
+    sysctl_dirs_free();
+    bucket = TT.dirs+(hash&(ARRAY_LEN(TT.dirs)-1));
+  }
+  sd = xmalloc(sizeof(*sd)+strlen(path)+1);
+  strcpy(sd->path, path);
+  sd->fd = fd;
+  sd->next = *bucket;
+  *bucket = sd;
+  TT.ndirs++;
+
+  return fd;
 }
 
-static int write_key(char *path, char *key, char *value)
+// Open a key (with . or / between its parts) relative to its cached
+// directory.
+static int sysctl_open(char *key, int flags)
 {
-  int fd = open(path, O_WRONLY);;
+  char *path = xstrdup(key), *name;
+  int fd;
 
-  if (fd < 0) {
+  replace_char(path, '.', '/');
+  if ((name = strrchr(path, '/'))) {
+    *name++ = 0;
+    fd = sysctl_dir(path);
+  } else {
+    name = path;
+    fd = TT.root;
+  }
+  if (fd != -1) fd = openat(fd, name, flags|O_CLOEXEC);
+  free(path);
+
+  return fd;
+}
+
+// Write value to key, complaining and returning 0 if we can't.
+static int write_key(char *key, char *value)
+{
+  int fd = sysctl_open(key, O_WRONLY), len = strlen(value);
+
+  if (fd < 0 || writeall(fd, value, len) != len) {
     key_error(key);
+    if (fd >= 0) close(fd);
 
     return 0;
   }
-  txwrite(fd, value, strlen(value));
-  xclose(fd);
+  close(fd);
 
   return 1;
 }
 
-// Display all keys under a path
+// Print the parts that aren't switched off by flags.
+static void show_key(char *key, char *data)
+{
+  char *s;
+
+  if (!(toys.optflags & FLAG_n)) xprintf("%s", key);
+  if (!(toys.optflags & (FLAG_N|FLAG_n))) xprintf(" = ");
+  for (s = data+strlen(data); s > data && isspace(*--s); *s = 0);
+  if (!(toys.optflags & FLAG_N)) xprintf("%s", data);
+  if ((toys.optflags & (FLAG_N|FLAG_n)) != (FLAG_N|FLAG_n)) xputc('\n');
+}
+
+// Read a value under root, in a worker thread or this one. An error_exit()
+// in a worker would leave this thread waiting for a value that never comes,
+// so this doesn't use it.
+// Files in /proc/sys don't know their length, and fit in a page.
+static void sysctl_read(int root, struct sysctl_job *job)
+{
+  int fd = openat(root, job->path, O_RDONLY|O_CLOEXEC);
+  long len;
+
+  if (fd == -1 || !(job->data = malloc(4096))) job->err = errno;
+  else if ((len = readall(fd, job->data, 4095)) < 0) {
+    job->err = errno;
+    free(job->data);
+    job->data = 0;
+  } else job->data[len] = 0;
+  if (fd != -1) close(fd);
+}
+
+#if CFG_TOYBOX_THREADS
+// As in factor, workers take values in order and this thread reads whatever
+// is next if no worker has got to it yet. Everything they need is in here.
+struct sysctl_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  struct sysctl_job *jobs;
+  int root, count, next;
+};
+
+static void *sysctl_worker(void *arg)
+{
+  struct sysctl_pool *sp = arg;
+  struct sysctl_job *job;
+  int i;
+
+  while ((i = __atomic_fetch_add(&sp->next, 1, __ATOMIC_RELAXED)) < sp->count)
+  {
+    sysctl_read(sp->root, job = sp->jobs+i);
+    pthread_mutex_lock(&sp->lock);
+    job->done = 1;
+    pthread_cond_broadcast(&sp->ready);
+    pthread_mutex_unlock(&sp->lock);
+  }
+
+  return 0;
+}
+#endif
+
+// Read and show a batch of values, several at once. (Some of them take the
+// kernel a while.)
+static void sysctl_batch(void)
+{
+  struct sysctl_job *job;
+  int i;
+#if CFG_TOYBOX_THREADS
+  struct sysctl_pool sp;
+  pthread_t tid[SYSCTL_THREADS];
+  pthread_attr_t attr;
+  int n = sysconf(_SC_NPROCESSORS_ONLN), threads = 0, j;
+
+  if (n > SYSCTL_THREADS) n = SYSCTL_THREADS;
+  if (n > TT.count) n = TT.count;
+  memset(&sp, 0, sizeof(sp));
+  sp.jobs = TT.jobs;
+  sp.root = TT.root;
+  sp.count = TT.count;
+  if (n > 1) {
+    pthread_mutex_init(&sp.lock, 0);
+    pthread_cond_init(&sp.ready, 0);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    while (threads < n-1
+      && !toy_worker_create(tid+threads, &attr, sysctl_worker, &sp)) threads++;
+    pthread_attr_destroy(&attr);
+  }
+#endif
+
+  for (i = 0; i<TT.count; i++) {
+    job = TT.jobs+i;
+#if CFG_TOYBOX_THREADS
+    if (threads) {
+      j = i;
+      if (__atomic_compare_exchange_n(&sp.next, &j, i+1, 0, __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED)) sysctl_read(TT.root, job);
+      else {
+        pthread_mutex_lock(&sp.lock);
+        while (!job->done) pthread_cond_wait(&sp.ready, &sp.lock);
+        pthread_mutex_unlock(&sp.lock);
+      }
+    } else
+#endif
+    sysctl_read(TT.root, job);
+
+    replace_char(job->path, '/', '.');
+    if (!job->data) {
+      errno = job->err;
+      key_error(job->path);
+    } else show_key(job->path, job->data);
+    free(job->data);
+    free(job->path);
+  }
+
+#if CFG_TOYBOX_THREADS
+  for (j = 0; j<threads; j++) pthread_join(tid[j], 0);
+  if (n > 1) {
+    pthread_cond_destroy(&sp.ready);
+    pthread_mutex_destroy(&sp.lock);
+  }
+#endif
+  TT.count = 0;
+}
+
+// Queue all keys under a path
 static int do_show_keys(struct dirtree *dt)
 {
-  char *path, *data, *key;
+  struct sysctl_job *job;
 
   if (!dirtree_notdotdot(dt)) return 0; // Skip . and ..
   if (S_ISDIR(dt->st.st_mode)) return DIRTREE_RECURSE;
 
-  path = dirtree_path(dt, 0);
-  data = readfile(path, 0, 0);
-  replace_char(key = path + 10, '/', '.'); // skip "/proc/sys/"
-  if (!data) key_error(key);
-  else {
-    // Print the parts that aren't switched off by flags.
-    if (!(toys.optflags & FLAG_n)) xprintf("%s", key);
-    if (!(toys.optflags & (FLAG_N|FLAG_n))) xprintf(" = ");
-    for (key = data+strlen(data); key > data && isspace(*--key); *key = 0);
-    if (!(toys.optflags & FLAG_N)) xprintf("%s", data);
-    if ((toys.optflags & (FLAG_N|FLAG_n)) != (FLAG_N|FLAG_n)) xputc('\n');
-  }
-
-  free(data);
-  free(path);
+  if (TT.count == SYSCTL_BATCH) sysctl_batch();
+  job = TT.jobs+TT.count++;
+  memset(job, 0, sizeof(*job));
+  job->path = xstrdup(dirtree_path(dt, 0)+10); // skip "/proc/sys/"
 
   return 0;
 }
 
+// Show everything under path (relative to /proc/sys).
+static void show_keys(char *path)
+{
+  char *s = xmprintf("/proc/sys%s%s", *path ? "/" : "", path);
+
+  if (!TT.jobs) TT.jobs = xmalloc(SYSCTL_BATCH*sizeof(*TT.jobs));
+  dirtree_read(s, do_show_keys);
+  sysctl_batch();
+  free(s);
+}
+
 // Read/write entries under a key. Accepts "key=value" in key if !value
 static void process_key(char *key, char *value)
 {
-  char *path;
+  struct stat st;
+  char *data;
+  int fd, len;
 
   if (!value) value = split_key(key);
   if ((toys.optflags & FLAG_w) && !value) {
-    error_msg("'%s' not key=value", key);
+    TT.file ? error_msg("%s:%ld: '%s' not key=value", TT.file, TT.line, key)
+      : error_msg("'%s' not key=value", key);
 
     return;
   }
 
-  path = xmprintf("/proc/sys/%s", key);
-  replace_char(path, '.', '/');
   // Note: failure to assign to a non-leaf node suppresses the display.
-  if (!(value && (!write_key(path, key, value) || (toys.optflags & FLAG_q)))) {
-    if (!access(path, R_OK)) dirtree_read(path, do_show_keys);
-    else key_error(key);
+  if (value && (!write_key(key, value) || (toys.optflags & FLAG_q))) return;
+  if (-1 == (fd = sysctl_open(key, O_RDONLY))) key_error(key);
+  else if (!fstat(fd, &st) && S_ISDIR(st.st_mode)) {
+    close(fd);
+    data = xstrdup(key);
+    replace_char(data, '.', '/');
+    show_keys(data);
+    free(data);
+  } else {
+    data = xmalloc(4096);
+    if (0 > (len = readall(fd, data, 4095))) key_error(key);
+    else {
+      data[len] = 0;
+      show_key(key, data);
+    }
+    close(fd);
+    free(data);
   }
-  free(path);
 }
 
 void sysctl_main()
 {
   char **args = 0;
 
+  TT.root = xopen("/proc/sys", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
   // Display all keys
-  if (toys.optflags & FLAG_a) dirtree_read("/proc/sys", do_show_keys);
+  if (toys.optflags & FLAG_a) show_keys("");
 
-  // read file
+  // read file, one key per line
   else if (toys.optflags & FLAG_p) {
-    FILE *fp = xfopen(*toys.optargs ? *toys.optargs : "/etc/sysctl.conf", "r");
-    ssize_t slen;
-    size_t len;
+    struct linebuf lb;
+    char *line, *key, *val;
+    long len;
 
-    for (;;) {
-      char *line = 0, *key, *val;
-
-      if (-1 == (slen = xgetline(&line, &len, fp))) break;
-      len = slen;
+    TT.file = *toys.optargs ? *toys.optargs : "/etc/sysctl.conf";
+    linebuf_init(&lb, xopen(TT.file, O_RDONLY));
+    while ((line = get_linebuf(&lb, &len, '\n', LINEBUF_CHOMP))) {
+      TT.line++;
       key = line;
       while (isspace(*key)) key++;
       if (*key == '#' || *key == ';' || !*key) continue;
       while (len && isspace(line[len-1])) line[--len] = 0;
-      if (!(val = split_key(line))) {
-        error_msg("'%s' not key=value", line);
+      if (!(val = split_key(key))) {
+        error_msg("%s:%ld: '%s' not key=value", TT.file, TT.line, key);
         continue;
       }
 
       // Trim whitespace around =
-      len = (val-line)-1;
-      while (len && isspace(line[len-1])) line[--len] = 0;
-      while (isspace(*val)) val++;;
+      len = (val-key)-1;
+      while (len && isspace(key[len-1])) key[--len] = 0;
+      while (isspace(*val)) val++;
 
       process_key(key, val);
-      free(line);
     }
-    fclose(fp);
+    linebuf_done(&lb);
+    close(lb.fd);
 
   // Loop through arguments, displaying or assigning as appropriate
   } else {
     if (!*toys.optargs) help_exit(0);
     for (args = toys.optargs; *args; args++) process_key(*args, 0);
   }
+
+  if (CFG_TOYBOX_FREE) {
+    sysctl_dirs_free();
+    free(TT.jobs);
+    close(TT.root);
+  }
 }
@@ -15,33 +15,77 @@ config TAC
 
 #include "toys.h"
 
-static void do_tac(int fd, char *name)
+#define TAC_BLOCK 65536
+
+// Print [start, end) of fd last line first. Blocks are read in from the end,
+// so only the line being looked at has to fit in memory.
+static void tac_back(int fd, off_t start, off_t end)
 {
-  (void)name;
-  struct arg_list *list = NULL;
-  char *c;
+  long size = TAC_BLOCK, have = 0, len;
+  char *buf = xmalloc(size), *data = buf+size, *s, *new;
 
-  // Read in lines
+  // data[0..have) is the file at end, and its last line is the next one out.
   for (;;) {
-    struct arg_list *temp;
-    long len;
-
-    if (!(c = get_rawline(fd, &len, '\n'))) break;
+    // That line starts after the newline before its own.
+    for (s = data+have-1; s > data && s[-1] != '\n'; s--);
+    if (have && (s > data || end == start)) {
+      fwrite(s, 1, data+have-s, stdout);
+      have = s-data;
+      continue;
+    }
+    if (end == start) break;
 
-    temp = xmalloc(sizeof(struct arg_list));
-    temp->next = list;
-    temp->arg = c;
-    list = temp;
+    // Read the block before data, growing the buffer if one line is more
+    // than it holds.
+    len = end-start < TAC_BLOCK ? end-start : TAC_BLOCK;
+    if (data-buf < len) {
+      if (have+len > size) {
+        new = xmalloc(size = 2*(have+len));
+        memcpy(new+size-have, data, have);
+        free(buf);
+        buf = new;
+      } else memmove(buf+size-have, data, have);
+      data = buf+size-have;
+    }
+    data -= len;
+    have += len;
+    end -= len;
+    xlseek(fd, end, SEEK_SET);
+    xreadall(fd, data, len);
   }
+  free(buf);
+  xflush();
+}
+
+// Pipes and such get copied to a deleted temp file so they can be read
+// backwards too.
+static int tac_tempfile(void)
+{
+  char *dir = getenv("TMPDIR"),
+       *name = xmprintf("%s/tacXXXXXX", dir ? dir : "/tmp");
+  int fd = mkstemp(name);
+
+  if (fd == -1) perror_exit("%s", name);
+  unlink(name);
+  free(name);
+
+  return fd;
+}
+
+static void do_tac(int fd, char *name)
+{
+  struct stat st;
+  off_t start = lseek(fd, 0, SEEK_CUR);
+  int tmp = -1;
 
-  // Play them back.
-  while (list) {
-    struct arg_list *temp = list->next;
-    xprintf("%s", list->arg);
-    free(list->arg);
-    free(list);
-    list = temp;
+  if (start < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    xsendfile(fd, tmp = tac_tempfile());
+    st.st_size = xlseek(tmp, 0, SEEK_CUR);
+    fd = tmp;
+    start = 0;
   }
+  tac_back(fd, start, st.st_size);
+  if (tmp != -1) close(tmp);
 }
 
 void tac_main(void)
@@ -26,7 +26,8 @@ void uptime_main(void)
   time_t tmptime;
   struct tm * now;
   unsigned int days, hours, minutes;
-  struct utmpx *entry;
+  struct utmpfile uf;
+  long i = -1;
   int users = 0;
 
   // Obtain the data we need.
@@ -35,9 +36,9 @@ void uptime_main(void)
   now = localtime(&tmptime);
 
   // Obtain info about logged on users
-  setutxent();
-  while ((entry = getutxent())) if (entry->ut_type == USER_PROCESS) users++;
-  endutxent();
+  utmpfile_open(&uf, 0);
+  while (utmpfile_next(&uf, &i, 0, 1<<USER_PROCESS)) users++;
+  utmpfile_close(&uf);
 
   // Time
   xprintf(" %02d:%02d:%02d up ", now->tm_hour, now->tm_min, now->tm_sec);
@@ -5,16 +5,17 @@
  * TODO: I have no idea how "system" category is calculated.
  * whatever we're doing isn't matching what other implementations are doing.
 
-USE_VMSTAT(NEWTOY(vmstat, ">2n", TOYFLAG_BIN))
+USE_VMSTAT(NEWTOY(vmstat, ">2cjn[!cj]", TOYFLAG_BIN))
 
 config VMSTAT
   bool "vmstat"
   default y
   help
-    usage: vmstat [-n] [DELAY [COUNT]]
+    usage: vmstat [-cjn] [DELAY [COUNT]]
 
     Print virtual memory statistics, repeating each DELAY seconds, COUNT times.
     (With no DELAY, prints one line. With no COUNT, repeats until killed.)
+    DELAY can be fractional, ala "0.25".
 
     Show processes running and blocked, kilobytes swapped, free, buffered, and
     cached, kilobytes swapped in and out per second, file disk blocks input and
@@ -22,6 +23,8 @@ config VMSTAT
     of CPU time spent running user code, system code, idle, and awaiting I/O.
     First line is since system started, later lines are since last line.
 
+    -c	CSV: header line once, then lines of values with time in milliseconds
+    -j	JSON: one object per line, with time in milliseconds
     -n	Display the header only once
 */
 
@@ -39,35 +42,84 @@ struct vmstat_proc {
   uint64_t swap_in, swap_out;
 };
 
+// The files are opened once and reread with pread() each sample, and each
+// key is looked for first where it was last time, which it usually still is.
+struct vmstat_file {
+  char *name, *buf;
+  int fd, size;
+};
+
+static int vmstat_read(struct vmstat_file *vf)
+{
+  int len, n;
+
+  if (!vf->buf) {
+    vf->fd = xopen(vf->name, O_RDONLY|O_CLOEXEC);
+    vf->buf = xmalloc(vf->size = 4096);
+  }
+  for (;;) {
+    for (len = 0; 0<(n = pread(vf->fd, vf->buf+len, vf->size-1-len, len));)
+      len += n;
+    if (n<0) perror_exit("%s", vf->name);
+    if (len<vf->size-1) break;
+    vf->buf = xrealloc(vf->buf, vf->size *= 2);
+  }
+  vf->buf[len] = 0;
+
+  return len;
+}
+
+// Find the value after key at the start of a line, trying the last offset
+// first.
+static char *vmstat_find(char *buf, int len, char *key, int *off)
+{
+  int klen = strlen(key);
+  char *s = buf+*off, *nl;
+
+  if (*off+klen<=len && (!*off || s[-1] == '\n') && !memcmp(s, key, klen))
+    return s+klen;
+  for (s = buf; memcmp(s, key, klen); s = nl+1)
+    if (!(nl = strchr(s, '\n'))) return 0;
+  *off = s-buf;
+
+  return s+klen;
+}
+
 // All the elements of vmstat_proc are the same size, so we can populate it as
 // a big array, then read the elements back out by name
 static void get_vmstat_proc(struct vmstat_proc *vmstat_proc)
 {
+  static struct vmstat_file files[3] = {{"/proc/stat"}, {"/proc/meminfo"},
+    {"/proc/vmstat"}};
+  static int offsets[23];
   char *vmstuff[] = { "/proc/stat", "cpu ", 0, 0, 0, 0, 0, 0,
     "intr ", "ctxt ", "procs_running ", "procs_blocked ", "/proc/meminfo",
     "MemFree: ", "Buffers: ", "Cached: ", "SwapFree: ", "SwapTotal: ",
     "/proc/vmstat", "pgpgin ", "pgpgout ", "pswpin ", "pswpout " };
   uint64_t *new = (uint64_t *)vmstat_proc;
+  struct vmstat_file *vf = files;
   char *p = p, *name = name;
-  int i, j;
+  int i, len = 0;
 
   // We use vmstuff to fill out vmstat_proc as an array of uint64_t:
   //   Strings starting with / are the file to find next entries in
   //   Any other string is a key to search for, with decimal value right after
   //   0 means parse another value on same line as last key
 
-  for (i = 0; i<(int)(sizeof(vmstuff)/sizeof(char *)); i++) {
+  for (i = 0; i<(int)ARRAY_LEN(vmstuff); i++) {
     if (!vmstuff[i]) p++;
     else if (*vmstuff[i] == '/') {
-      xreadfile(name = vmstuff[i], toybuf, sizeof(toybuf));
+      if (i) vf++;
+      name = vmstuff[i];
+      len = vmstat_read(vf);
 
       continue;
-    } else {
-      if (!(p = strstr(toybuf, vmstuff[i]))) goto error;
-      p += strlen(vmstuff[i]);
-    }
-    if (1 != sscanf(p, "%"PRIu64"%n", new++, &j)) goto error;
-    p += j;
+    } else if (!(p = vmstat_find(vf->buf, len, vmstuff[i], offsets+i)))
+      goto error;
+    while (*p == ' ') p++;
+    if (*p<'0' || *p>'9') goto error;
+    for (*new = 0; *p>='0' && *p<='9'; p++) *new = *new*10+*p-'0';
+    new++;
   }
 
   return;
@@ -76,29 +128,53 @@ error:
   error_exit("No %sin %s\n", vmstuff[i], name);
 }
 
+// Milliseconds since the epoch, for -c and -j.
+static long long vmstat_now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, 0);
+
+  return tv.tv_sec*1000LL+tv.tv_usec/1000;
+}
+
 void vmstat_main(void)
 {
   struct vmstat_proc top[2];
-  int i, loop_delay = 0, loop_max = 0;
-  unsigned loop, rows = (toys.optflags & FLAG_n) ? 0 : 25,
+  int i, loop_max = 0;
+  long loop_delay = 0, frac;
+  unsigned loop, rows = (toys.optflags & (FLAG_n|FLAG_c|FLAG_j)) ? 0 : 25,
            page_kb = sysconf(_SC_PAGESIZE)/1024;
   char *headers="r\0b\0swpd\0free\0buff\0cache\0si\0so\0bi\0bo\0in\0cs\0us\0"
-                "sy\0id\0wa", lengths[] = {2,2,6,6,6,6,4,4,5,5,4,4,2,2,2,2};
+                "sy\0id\0wa", *header, lengths[] = {2,2,6,6,6,6,4,4,5,5,4,4,2,2,2,2};
 
   memset(top, 0, sizeof(top));
-  if (toys.optc) loop_delay = atolx_range(toys.optargs[0], 0, INT_MAX);
+  if (toys.optc) {
+    loop_delay = xparsetime(toys.optargs[0], 1000, &frac);
+    if (loop_delay<0 || loop_delay>INT_MAX/1000) error_exit("bad DELAY");
+    loop_delay = loop_delay*1000+frac;
+  }
   if (toys.optc > 1) loop_max = atolx_range(toys.optargs[1], 1, INT_MAX) - 1;
 
+  if (toys.optflags & FLAG_c) {
+    xprintf("time");
+    for (header = headers, i = 0; i<(int)sizeof(lengths); i++) {
+      xprintf(",%s", header);
+      header += strlen(header)+1;
+    }
+    xputc('\n');
+  }
+
   for (loop = 0; !loop_max || loop <= (unsigned)loop_max; loop++) {
     unsigned idx = loop&1, offset = 0, expected = 0;
     uint64_t units, total_hz, *ptr = (uint64_t *)(top+idx),
-             *oldptr = (uint64_t *)(top+!idx);
+             *oldptr = (uint64_t *)(top+!idx), out[sizeof(lengths)];
 
-    if (loop && loop_delay) sleep(loop_delay);
+    if (loop && loop_delay) msleep(loop_delay);
 
     // Print headers
     if (rows>3 && !(loop % (rows-3))) {
-      char *header = headers;
+      header = headers;
 
       if (isatty(1)) terminal_size(0, &rows);
       else rows = 0;
@@ -118,7 +194,8 @@ void vmstat_main(void)
     top[idx].sys += top[idx].irq + top[idx].sirq;
     top[idx].swaptotal -= top[idx].swapfree;
 
-    // Collect unit adjustments (outside the inner loop to save time)
+    // Collect unit adjustments (outside the inner loop to save time),
+    // in milliseconds.
 
     if (!loop) {
       char *s = toybuf;
@@ -126,36 +203,57 @@ void vmstat_main(void)
       xreadfile("/proc/uptime", toybuf, sizeof(toybuf)-1);
       while (*(s++) > ' ');
       sscanf(s, "%"PRIu64, &units);
+      units *= 1000;
     } else units = loop_delay;
+    if (!units) units = 1;
 
     // add up user, sys, idle, and wait time used since last time
     // (Already appended nice to user)
     total_hz = 0;
     for (i=0; i<4; i++) total_hz += ptr[i+!!i] - oldptr[i+!!i];
+    if (!total_hz) total_hz = 1; // less than a tick since last time
 
     // Output values in order[]: running, blocked, swaptotal, memfree, buffers,
     // cache, swap_in, swap_out, io_in, io_out, sirq, ctxt, user, sys, idle,wait
 
     for (i=0; i<(int)sizeof(lengths); i++) {
       char order[] = {9, 10, 15, 11, 12, 13, 18, 19, 16, 17, 6, 8, 0, 2, 3, 4};
-      uint64_t out = ptr[(int)order[i]];
-      int len;
+
+      out[i] = ptr[(int)order[i]];
 
       // Adjust rate and units
-      if (i>5) out -= oldptr[(int)order[i]];
-      if (order[i]<7) out = ((out*100) + (total_hz/2)) / total_hz;
-      else if (order[i]>17) out = ((out * page_kb)+(units-1))/units;
-      else if (order[i]>15) out = ((out)+(units-1))/units;
-      else if (order[i]<9) out = (out+(units-1)) / units;
-
-      // If a field was too big to fit in its slot, try to compensate later
-      expected += lengths[i] + !!i;
-      len = expected - offset - !!i;
-      if (len < 0) len = 0;
-      offset += printf(" %*"PRIu64+!i, len, out);
+      if (i>5) out[i] -= oldptr[(int)order[i]];
+      if (order[i]<7) out[i] = ((out[i]*100) + (total_hz/2)) / total_hz;
+      else if (order[i]>17)
+        out[i] = ((out[i]*page_kb*1000)+(units-1))/units;
+      else if (order[i]>15 || order[i]<9)
+        out[i] = ((out[i]*1000)+(units-1))/units;
+    }
+
+    if (toys.optflags & (FLAG_c|FLAG_j)) {
+      xprintf((toys.optflags & FLAG_c) ? "%lld" : "{\"time\":%lld",
+        vmstat_now());
+      for (header = headers, i = 0; i<(int)sizeof(lengths); i++) {
+        if (toys.optflags & FLAG_c) xprintf(",%"PRIu64, out[i]);
+        else xprintf(",\"%s\":%"PRIu64, header, out[i]);
+        header += strlen(header)+1;
+      }
+      xprintf((toys.optflags & FLAG_c) ? "\n" : "}\n");
+    } else {
+      for (i=0; i<(int)sizeof(lengths); i++) {
+        int len;
+
+        // If a field was too big to fit in its slot, try to compensate later
+        expected += lengths[i] + !!i;
+        len = expected - offset - !!i;
+        if (len < 0) len = 0;
+        offset += printf(" %*"PRIu64+!i, len, out[i]);
+      }
+      xputc('\n');
     }
-    xputc('\n');
 
     if (!loop_delay) break;
+    // Each sample should reach whoever's collecting them as it's taken.
+    xflush();
   }
 }
@@ -18,17 +18,18 @@ config W
 
 void w_main(void)
 {
+  struct utmpfile uf;
   struct utmpx *x;
+  long i = -1;
 
   xprintf("USER     TTY             LOGIN@              FROM");
-  setutxent();
-  while ((x=getutxent()) != NULL) {
-    if (x->ut_type==7) {
-      time_t tt = x->ut_tv.tv_sec;
+  utmpfile_open(&uf, 0);
+  while ((x = utmpfile_next(&uf, &i, 0, 1<<USER_PROCESS))) {
+    time_t tt = x->ut_tv.tv_sec;
 
-      xprintf("\n%-9.8s%-9.8s %-4.24s (%-1.12s)", x->ut_user, x->ut_line,
-        ctime(&tt), x->ut_host);
-    }
+    xprintf("\n%-9.8s%-9.8s %-4.24s (%-1.12s)", x->ut_user, x->ut_line,
+      ctime(&tt), x->ut_host);
   }
+  utmpfile_close(&uf);
   xputc('\n');
 }
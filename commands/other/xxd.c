@@ -5,23 +5,25 @@
  * No obvious standard, output looks like:
  * 0000000: 4c69 6e75 7820 7665 7273 696f 6e20 332e  Linux version 3.
  *
- * TODO: support for reversing a hexdump back into the original data.
  * TODO: -s seek
 
-USE_XXD(NEWTOY(xxd, ">1c#<1>4096=16l#g#<1=2", TOYFLAG_USR|TOYFLAG_BIN))
+USE_XXD(NEWTOY(xxd, ">1c#<1>4096=16l#g#<1=2ipr", TOYFLAG_USR|TOYFLAG_BIN))
 
 config XXD
   bool "xxd"
   default y
   help
-    usage: xxd [-c n] [-g n] [-l n] [file]
+    usage: xxd [-ipr] [-c n] [-g n] [-l n] [file]
 
     Hexdump a file to stdout.  If no file is listed, copy from stdin.
     Filename "-" is a synonym for stdin.
 
-    -c n	Show n bytes per line (default 16).
+    -c n	Show n bytes per line (default 16, 30 with -p, 12 with -i).
     -g n	Group bytes by adding a ' ' every n bytes (default 2).
+    -i	Output a C array (with declarations if reading a file).
     -l n	Limit of n bytes before stopping (default is no limit).
+    -p	Plain hexdump: just the hex digits, no offsets or ascii.
+    -r	Reverse a (plain with -p) hexdump back into binary on stdout.
 */
 
 #define FOR_xxd
@@ -31,36 +33,158 @@ GLOBALS(
   long g;
   long l;
   long c;
+
+  char *obuf;
+  long olen;
 )
 
+// Lines are built in one buffer and written a block of input at a time.
+#define XXD_BLOCK 65536
+
 static void do_xxd(int fd, char *name)
 {
-  (void)name;
   long long pos = 0;
-  int i, len, space;
+  long block = XXD_BLOCK - XXD_BLOCK%TT.c, width = 2*TT.c+(TT.c+TT.g-1)/TT.g+1,
+    len, i, j, n;
+  char *in = xmalloc(block), *hex = xmalloc(2*block), *out, *o, *s, *var = 0;
 
-  while (0<(len = readall(fd, toybuf, (TT.l && TT.l-pos<TT.c)?TT.l-pos:TT.c))) {
-    printf("%08llx: ", pos);
-    pos += len;
-    space = 2*TT.c+TT.c/TT.g+1;
+  // A line is at most 18 characters of offset, the hex, the ascii and a
+  // newline. -i takes 6 per byte plus 4 per line.
+  out = xmalloc((block/TT.c)*(20+width+TT.c) + 6*block);
+  if ((toys.optflags & FLAG_i) && strcmp(name, "-")) {
+    var = xmprintf("%s%s", isdigit(*name) ? "__" : "", name);
+    for (s = var; *s; s++) if (!isalnum(*s)) *s = '_';
+    xprintf("unsigned char %s[] = {\n", var);
+  }
+
+  for (;;) {
+    len = (TT.l && TT.l-pos<block) ? TT.l-pos : block;
+    if (1>(len = readall(fd, in, len))) break;
+    hex_encode(hex, in, len);
+    o = out;
 
-    for (i=0; i<len;) {
-      space -= printf("%02x", toybuf[i]);
-      if (!(++i%TT.g)) {
-        putchar(' ');
-        space--;
+    for (i = 0; i<len; i += TT.c) {
+      n = (len-i<TT.c) ? len-i : TT.c;
+      if (toys.optflags & FLAG_i) {
+        for (j = 0; j<n; j++) {
+          o = stpcpy(o, !(pos+i+j) ? "  0x" : j ? ", 0x" : ",\n  0x");
+          memcpy(o, hex+2*(i+j), 2);
+          o += 2;
+        }
+        continue;
+      }
+      if (toys.optflags & FLAG_p) {
+        memcpy(o, hex+2*i, 2*n);
+        o += 2*n;
+        *o++ = '\n';
+        continue;
       }
-    }
 
-    printf("%*s", space, "");
-    for (i=0; i<len; i++)
-      putchar((toybuf[i]>=' ' && toybuf[i]<='~') ? toybuf[i] : '.');
-    putchar('\n');
+      o += sprintf(o, "%08llx: ", pos+i);
+      for (s = o, j = 0; j<n; j += TT.g) {
+        memcpy(o, hex+2*(i+j), 2*((n-j<TT.g) ? n-j : TT.g));
+        o += 2*((n-j<TT.g) ? n-j : TT.g);
+        if (j+TT.g<=n) *o++ = ' ';
+      }
+      memset(o, ' ', width-(o-s));
+      o = s+width;
+      for (j = 0; j<n; j++)
+        *o++ = (in[i+j]>=' ' && in[i+j]<='~') ? in[i+j] : '.';
+      *o++ = '\n';
+    }
+    txwrite(1, out, o-out);
+    pos += len;
   }
   if (len<0) perror_exit("read");
+
+  if (toys.optflags & FLAG_i) {
+    if (pos) xputc('\n');
+    if (var) xprintf("};\nunsigned int %s_len = %lld;\n", var, pos);
+  }
+  free(var);
+  free(out);
+  free(hex);
+  free(in);
+}
+
+// Reverse output is collected in obuf, flushed when full, before a seek,
+// and at the end.
+static void xxd_flush(void)
+{
+  if (TT.olen) txwrite(1, TT.obuf, TT.olen);
+  TT.olen = 0;
+}
+
+static void xxd_byte(char c)
+{
+  if (TT.olen == XXD_BLOCK) xxd_flush();
+  TT.obuf[TT.olen++] = c;
+}
+
+static int hexval(char c)
+{
+  if (c>='0' && c<='9') return c-'0';
+  c |= 0x20;
+  if (c>='a' && c<='f') return c-'a'+10;
+
+  return -1;
+}
+
+// -r: turn "offset: hex  ascii" lines (or with -p, hex with anything else
+// ignored) back into bytes. Offsets seek the output, or pad with NULs if
+// it can't.
+static void do_xxd_reverse(int fd, char *name)
+{
+  struct linebuf lb;
+  long long pos = 0, at;
+  long len, n;
+  char *line, *s;
+  int hi = -1, x;
+
+  if (!TT.obuf) TT.obuf = xmalloc(XXD_BLOCK);
+  linebuf_init(&lb, fd);
+  while ((line = get_linebuf(&lb, &len, '\n', LINEBUF_CHOMP))) {
+    s = line;
+    if (!(toys.optflags & FLAG_p)) {
+      for (at = 0; (x = hexval(*s))>=0; s++) at = at*16+x;
+      if (*s++ != ':') continue;
+      if (at != pos) {
+        xxd_flush();
+        if (lseek(1, at, SEEK_SET) != at) {
+          if (at<pos) error_exit("%s: can't seek back to %llx", name, at);
+          for (; pos<at; pos++) xxd_byte(0);
+        }
+        pos = at;
+      }
+    }
+    for (n = 0; s<line+len; s++) {
+      if (0>(x = hexval(*s))) {
+        if (toys.optflags & FLAG_p) continue;
+        // Two spaces (or anything but hex) ends the hex, and only -c bytes
+        // of hex so the ascii column can't be mistaken for more.
+        if (*s != ' ' || s[1] == ' ' || hi != -1) break;
+        continue;
+      }
+      if (hi == -1) hi = x;
+      else {
+        xxd_byte((hi<<4)|x);
+        hi = -1;
+        pos++;
+        if (!(toys.optflags & FLAG_p) && ++n == TT.c) break;
+      }
+    }
+    if (!(toys.optflags & FLAG_p)) hi = -1;
+  }
+  xxd_flush();
+  linebuf_done(&lb);
 }
 
 void xxd_main(void)
 {
-  loopfiles(toys.optargs, do_xxd);
+  if (!(toys.optflags & FLAG_c)) {
+    if (toys.optflags & FLAG_p) TT.c = 30;
+    if (toys.optflags & FLAG_i) TT.c = 12;
+  }
+  loopfiles(toys.optargs,
+    (toys.optflags & FLAG_r) ? do_xxd_reverse : do_xxd);
 }
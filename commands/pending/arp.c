@@ -34,6 +34,7 @@ config ARP
 #define FOR_arp
 #include "toys.h"
 #include <net/if_arp.h>
+#include <linux/rtnetlink.h>
 
 GLOBALS(
     char *hw_type;
@@ -43,6 +44,8 @@ GLOBALS(
     
     int sockfd;
     char *device;
+    char *host_ip;
+    int entries, disp;
 )
 
 struct arpreq req; //Global request structure 
@@ -211,11 +214,87 @@ static int delete_entry(void)
   return 0;
 }
 
+// Show one cache entry, from the fields of a /proc/net/arp line.
+static void show_entry(char *ip, int h_type, int flag, char *hw_addr,
+  char *mask, char *dev)
+{
+  struct sockaddr sa;
+  char *host_name = "?";
+  int i;
+
+  TT.entries++;
+  if (((toys.optflags & FLAG_H) && (get_index(hwtype, TT.hw_type) != h_type))
+   || ((toys.optflags & FLAG_i) && strcmp(TT.interface, dev))
+   || (toys.optargs[0] && strcmp(TT.host_ip, ip))) return;
+
+  resolve_host(ip, &sa);
+  if (!(toys.optflags & FLAG_n)) {
+    if (!ip_to_host(&sa, NI_NAMEREQD)) host_name = toybuf;
+  } else ip_to_host(&sa, NI_NUMERICHOST);
+
+  TT.disp++;
+  printf("%s (%s) at" , host_name, ip);
+
+  for (i = 0; hwtype[i].name; i++)
+    if (hwtype[i].val & h_type) break;
+  if (!hwtype[i].name) error_exit("unknown h/w type");
+
+  if (!(flag & ATF_COM)) {
+    if ((flag & ATF_PUBL)) printf(" *");
+    else printf(" <incomplete>");
+  } else printf(" %s [%s]", hw_addr, hwtype[i].name);
+
+  if (flag & ATF_NETMASK) printf("netmask %s ", mask);
+
+  for (i = 0; flag_type[i].name; i++)
+    if (flag_type[i].val & flag) printf(" %s", flag_type[i].name);
+
+  printf(" on %s\n", dev);
+}
+
+// RTM_GETNEIGH: rebuild what the kernel would have printed in /proc/net/arp
+// (skipping the same NOARP entries), hardware address padded to the
+// interface's address length and proxy entries as published permanent.
+static void arp_neigh(struct nlmsghdr *nlh, void *arg)
+{
+  struct ndmsg *ndm = NLMSG_DATA(nlh);
+  struct rtattr *tb[NDA_MAX+1];
+  struct netlink_link *nl = netlink_link(ndm->ndm_ifindex);
+  char ip[INET_ADDRSTRLEN], hw_addr[128], *s = hw_addr;
+  unsigned char *ha = 0;
+  int i, len = 0, flag = 0;
+
+  if (nlh->nlmsg_type != RTM_NEWNEIGH || ndm->ndm_family != AF_INET) return;
+  netlink_attrs(nlh, sizeof(*ndm), tb, NDA_MAX);
+  if (!tb[NDA_DST] || !inet_ntop(AF_INET, RTA_DATA(tb[NDA_DST]), ip, sizeof(ip)))
+    return;
+
+  if (ndm->ndm_flags & NTF_PROXY) {
+    show_entry(ip, nl ? nl->type : 0, ATF_PUBL|ATF_PERM, "00:00:00:00:00:00",
+      "*", nl ? nl->name : "*");
+
+    return;
+  }
+  if (!nl || !(ndm->ndm_state & ~NUD_NOARP)) return;
+
+  if (ndm->ndm_state & NUD_PERMANENT) flag = ATF_PERM|ATF_COM;
+  else if (ndm->ndm_state & (NUD_NOARP|NUD_REACHABLE|NUD_PROBE|NUD_STALE
+    |NUD_DELAY)) flag = ATF_COM;
+  if (tb[NDA_LLADDR]) {
+    ha = RTA_DATA(tb[NDA_LLADDR]);
+    len = RTA_PAYLOAD(tb[NDA_LLADDR]);
+  }
+  for (i = 0; i < nl->hwlen && i < 32; i++)
+    s += sprintf(s, ":%02x"+!i, i < len ? ha[i] : 0);
+  *s = 0;
+  show_entry(ip, nl->type, flag, hw_addr, "*", nl->name);
+}
+
 void arp_main(void)
 {
   struct sockaddr sa;
-  char ip[128], hw_addr[128], mask[12], dev[128], *host_ip = NULL, *buf;
-  int h_type, type, flag, i, fd, entries = 0, disp = 0;
+  struct ndmsg ndm;
+  int type, i;
 
   TT.device = "";
   memset(&sa, 0, sizeof(sa));
@@ -245,63 +324,25 @@ void arp_main(void)
   if ((toys.optflags & FLAG_d) && !delete_entry()) return; 
 
   //show arp chache
-  fd = xopen("/proc/net/arp", O_RDONLY);
-  buf = get_line(fd);
-  free(buf); //skip first line
-
   if (toys.optargs[0]) {
     resolve_host(toys.optargs[0], &sa);
     ip_to_host(&sa, NI_NUMERICHOST);
-    host_ip = xstrdup(toybuf);
+    TT.host_ip = xstrdup(toybuf);
   }
 
-  while ((buf = get_line(fd))) {
-    char *host_name = "?";
-    
-    if ((sscanf(buf, "%s 0x%x 0x%x %s %s %s\n", ip,
-        &h_type, &flag, hw_addr, mask, dev )) != 6) break;
-    entries++;
-    if (((toys.optflags & FLAG_H) && (get_index(hwtype, TT.hw_type) != h_type))
-     || ((toys.optflags & FLAG_i) && strcmp(TT.interface, dev))
-     || (toys.optargs[0] && strcmp(host_ip, ip))) {
-      free(buf);
-      continue;
-    }
-
-    resolve_host(buf, &sa);
-    if (!(toys.optflags & FLAG_n)) { 
-      if (!ip_to_host(&sa, NI_NAMEREQD)) host_name = toybuf;
-    } else ip_to_host(&sa, NI_NUMERICHOST);
-    
-    disp++;
-    printf("%s (%s) at" , host_name, ip);
-
-    for (i = 0; hwtype[i].name; i++) 
-      if (hwtype[i].val & h_type) break;
-    if (!hwtype[i].name) error_exit("unknown h/w type");
-
-    if (!(flag & ATF_COM)) {
-      if ((flag & ATF_PUBL)) printf(" *");
-      else printf(" <incomplete>");
-    } else printf(" %s [%s]", hw_addr, hwtype[i].name);
-
-    if (flag & ATF_NETMASK) printf("netmask %s ", mask);
-
-    for (i = 0; flag_type[i].name; i++) 
-      if (flag_type[i].val & flag) printf(" %s", flag_type[i].name);
-
-    printf(" on %s\n", dev);
-    free(buf);
+  // The cache, then the proxy entries, like /proc/net/arp lists them.
+  for (i = 0; i<2; i++) {
+    memset(&ndm, 0, sizeof(ndm));
+    ndm.ndm_family = AF_INET;
+    ndm.ndm_flags = i ? NTF_PROXY : 0;
+    if (!netlink_dump(RTM_GETNEIGH, &ndm, sizeof(ndm), arp_neigh, 0) && !i)
+      perror_exit("netlink");
   }
-  
+
   if (toys.optflags & FLAG_v) 
     xprintf("Entries: %d\tSkipped: %d\tFound: %d\n",
-        entries, entries - disp, disp);
-  if (!disp) xprintf("No Match found in %d entries\n", entries);
+        TT.entries, TT.entries - TT.disp, TT.disp);
+  if (!TT.disp) xprintf("No Match found in %d entries\n", TT.entries);
   
-  if (CFG_TOYBOX_FREE) {
-    free(host_ip);
-    free(buf);
-    xclose(fd);
-  }
+  if (CFG_TOYBOX_FREE) free(TT.host_ip);
 }
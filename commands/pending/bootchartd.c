@@ -22,6 +22,10 @@ config BOOTCHARTD
           (for init scripts)
 
     Under PID 1: as init, then exec $bootchart_init, /init, /sbin/init
+
+    bootchartd.conf can set SAMPLE_PERIOD=SECONDS, PROCESS_ACCOUNTING="yes",
+    and CAPTURE_MODE="memory" to keep samples in a CAPTURE_SIZE=KB buffer
+    (default 8192) and only write the logs out when it fills or logging stops.
 */
 
 #define FOR_bootchartd
@@ -34,6 +38,12 @@ GLOBALS(
   int is_login;
 
   void *head;
+  char *ring, *scratch;
+  long ring_size, used, scratch_len;
+  struct bootchart_src *src;
+  int ring_mode, nsrc, dead, *live, *pids, nlive, pidmax, stat_fd, disk_fd,
+      up_fd;
+  DIR *proc;
 )
 
 struct pid_list {
@@ -41,6 +51,15 @@ struct pid_list {
   int pid;
 };
 
+// A file capture mode keeps open, and what it read from it last time.
+// Slot 0 is /proc/stat, 1 is /proc/diskstats, the rest /proc/PID/stat.
+// A free slot's fd is the next free slot.
+struct bootchart_src {
+  char *last;
+  long len, size;
+  int fd, pid;
+};
+
 static int push_pids_in_list(pid_t pid, char *name)
 {
   struct pid_list *new = xzalloc(sizeof(struct pid_list));
@@ -126,6 +145,19 @@ static int parse_config_file(char *fname)
       TT.smpl_period_usec = smpl_val * 1000000;
       if (TT.smpl_period_usec <= 0) TT.smpl_period_usec = 1;
     }
+    if (!strncmp(ptr, "CAPTURE_MODE", strlen("CAPTURE_MODE"))) {
+      if ((ptr = strchr(ptr, '='))) ptr += 1;
+      else continue;
+      sscanf(ptr, "%s", toybuf);
+      TT.ring_mode = !strncmp(toybuf+1, "memory", strlen("memory"));
+    }
+    if (!strncmp(ptr, "CAPTURE_SIZE", strlen("CAPTURE_SIZE"))) {
+      long kb;
+
+      if ((ptr = strchr(ptr, '='))) ptr += 1;
+      else continue;
+      if (sscanf(ptr, "%ld", &kb) == 1 && kb > 0) TT.ring_size = kb*1024;
+    }
     if (!strncmp(ptr, "PROCESS_ACCOUNTING", strlen("PROCESS_ACCOUNTING"))) {
       if ((ptr = strchr(ptr, '='))) ptr += 1;
       else continue;
@@ -155,6 +187,276 @@ static char *create_tmp_dir()
   return *target;
 }
 
+// Capture mode: the files stay open and get pread() each sample, and each
+// sample goes into a buffer mapped at the start as only what changed since
+// the last one. Nothing is formatted or written until the buffer fills or
+// logging stops, so sampling every few milliseconds doesn't disturb much.
+//
+// A sample is the uptime then (slot+1, prefix, suffix, length, bytes) for
+// each file, ending with a 0: the file's text is the first prefix bytes of
+// what it was last time, these bytes, then its last suffix bytes. All the
+// numbers are stored 7 bits at a time, low first.
+
+static int ring_num(unsigned long n)
+{
+  do {
+    if (TT.used == TT.ring_size) return 0;
+    TT.ring[TT.used++] = (n&127)|(n>127 ? 128 : 0);
+  } while (n >>= 7);
+
+  return 1;
+}
+
+static unsigned long ring_get(char **p)
+{
+  unsigned long n = 0;
+  int shift = 0;
+  unsigned char c;
+
+  do {
+    c = *(*p)++;
+    n |= (unsigned long)(c&127)<<shift;
+    shift += 7;
+  } while (c&128);
+
+  return n;
+}
+
+// Read all of a proc file into TT.scratch.
+static long ring_read(int fd)
+{
+  long len;
+
+  while ((len = pread(fd, TT.scratch, TT.scratch_len, 0)) == TT.scratch_len)
+    TT.scratch = xrealloc(TT.scratch, TT.scratch_len *= 2);
+
+  return len;
+}
+
+// Store what changed in a slot's file, or return 0 if it doesn't fit.
+static int ring_add(int slot, char *new, long len)
+{
+  struct bootchart_src *s = TT.src+slot;
+  long pre = 0, suf = 0, max = len < s->len ? len : s->len, mid;
+
+  while (pre < max && new[pre] == s->last[pre]) pre++;
+  while (suf < max-pre && new[len-1-suf] == s->last[s->len-1-suf]) suf++;
+  mid = len-pre-suf;
+  if (!ring_num(slot+1) || !ring_num(pre) || !ring_num(suf) || !ring_num(mid)
+    || TT.ring_size-TT.used < mid) return 0;
+  memcpy(TT.ring+TT.used, new+pre, mid);
+  TT.used += mid;
+  if (s->size < len) s->last = xrealloc(s->last, s->size = len);
+  memcpy(s->last+pre, new+pre, mid+suf);
+  s->len = len;
+
+  return 1;
+}
+
+static int ring_slot(int pid)
+{
+  struct bootchart_src *s;
+  int slot, fd;
+
+  sprintf(toybuf, "%d/stat", pid);
+  if (-1 == (fd = openat(dirfd(TT.proc), toybuf, O_RDONLY))) return -1;
+  if ((slot = TT.dead) != -1) TT.dead = TT.src[slot].fd;
+  else {
+    if (!(TT.nsrc&63))
+      TT.src = xrealloc(TT.src, (TT.nsrc+64)*sizeof(*TT.src));
+    memset(TT.src+(slot = TT.nsrc++), 0, sizeof(*TT.src));
+  }
+  s = TT.src+slot;
+  s->fd = fd;
+  s->pid = pid;
+  s->len = 0;
+
+  return slot;
+}
+
+static void ring_drop(int slot)
+{
+  struct bootchart_src *s = TT.src+slot;
+
+  close(s->fd);
+  s->fd = TT.dead;
+  s->pid = 0;
+  TT.dead = slot;
+}
+
+// Bring the slots up to date with the processes in /proc. Both lists are in
+// pid order, so this is a merge.
+static void ring_pids(void)
+{
+  struct dirent *de;
+  int i, j, n = 0, *swap;
+
+  rewinddir(TT.proc);
+  while ((de = readdir(TT.proc))) {
+    if (!isdigit(*de->d_name)) continue;
+    if (n == TT.pidmax) {
+      TT.pidmax += 256;
+      TT.pids = xrealloc(TT.pids, TT.pidmax*sizeof(int));
+      TT.live = xrealloc(TT.live, TT.pidmax*sizeof(int));
+    }
+    TT.pids[n++] = atoi(de->d_name);
+  }
+  for (i = j = 0; i<n; i++) {
+    while (j<TT.nlive && TT.src[TT.live[j]].pid < TT.pids[i])
+      ring_drop(TT.live[j++]);
+    if (j<TT.nlive && TT.src[TT.live[j]].pid == TT.pids[i])
+      TT.pids[i] = TT.live[j++];
+    else TT.pids[i] = ring_slot(TT.pids[i]);
+  }
+  while (j<TT.nlive) ring_drop(TT.live[j++]);
+  for (i = j = 0; i<n; i++) if (TT.pids[i] != -1) TT.pids[j++] = TT.pids[i];
+  swap = TT.live;
+  TT.live = TT.pids;
+  TT.pids = swap;
+  TT.nlive = j;
+}
+
+// Returns 1 if the sample saw getty or a display manager, 0 if not, or -1
+// if it didn't fit.
+static int ring_sample(unsigned long uptime)
+{
+  long len;
+  int i, login = 0;
+  char *ptr, *tmp;
+
+  if (!ring_num(uptime)) return -1;
+  if ((len = ring_read(TT.stat_fd)) >= 0 && !ring_add(0, TT.scratch, len))
+    return -1;
+  if ((len = ring_read(TT.disk_fd)) >= 0 && !ring_add(1, TT.scratch, len))
+    return -1;
+  for (i = 0; i<TT.nlive; i++) {
+    if ((len = ring_read(TT.src[TT.live[i]].fd)) < 1) continue;
+    if (!ring_add(TT.live[i], TT.scratch, len)) return -1;
+    if (!TT.is_login || !(ptr = memchr(TT.scratch, '(', len))
+      || !(tmp = memchr(ptr, ')', len-(ptr-TT.scratch)))) continue;
+    *tmp = 0;
+    ptr++;
+    if (((ptr[0] == 'g' || ptr[0] == 'k' || ptr[0] == 'x') && ptr[1] == 'd'
+          && ptr[2] == 'm') || strstr(ptr, "getty")) login = 1;
+  }
+
+  return ring_num(0) ? login : -1;
+}
+
+// Write the buffered samples out as the text logs and empty the buffer. The
+// next sample has to be stored whole, as there's nothing to compare it with.
+static void ring_flush(FILE *stat_fp, FILE *disk_fp, FILE *ps_fp)
+{
+  char *p = TT.ring, *end = TT.ring+TT.used,
+       **text = xzalloc(TT.nsrc*sizeof(char *));
+  long *len = xzalloc(TT.nsrc*sizeof(long)), pre, suf, mid;
+  unsigned long uptime;
+  int slot;
+
+  while (p < end) {
+    uptime = ring_get(&p);
+    fprintf(ps_fp, "%lu\n", uptime);
+    while ((slot = ring_get(&p))) {
+      pre = ring_get(&p);
+      suf = ring_get(&p);
+      mid = ring_get(&p);
+      memcpy(TT.scratch, text[--slot], pre);
+      memcpy(TT.scratch+pre, p, mid);
+      memcpy(TT.scratch+pre+mid, text[slot]+len[slot]-suf, suf);
+      p += mid;
+      text[slot] = xrealloc(text[slot], len[slot] = pre+mid+suf);
+      memcpy(text[slot], TT.scratch, len[slot]);
+      if (slot < 2) {
+        FILE *fp = slot ? disk_fp : stat_fp;
+
+        fprintf(fp, "%lu\n", uptime);
+        fwrite(text[slot], 1, len[slot], fp);
+        fputc('\n', fp);
+      } else fwrite(text[slot], 1, len[slot], ps_fp);
+    }
+    fputc('\n', ps_fp);
+  }
+  for (slot = 0; slot<TT.nsrc; slot++) {
+    free(text[slot]);
+    TT.src[slot].len = 0;
+  }
+  free(text);
+  free(len);
+  TT.used = 0;
+}
+
+static void ring_logging(void)
+{
+  FILE *stat_fp = xfopen("proc_stat.log", "w"),
+       *disk_fp = xfopen("proc_diskstats.log", "w"),
+       *ps_fp = xfopen("proc_ps.log", "w");
+  long tcnt = 60 * 1000 * 1000 / TT.smpl_period_usec, start;
+  struct timespec ts;
+  unsigned long uptime;
+  int login, i;
+  char *ptr;
+
+  if (tcnt <= 0) tcnt = 1;
+  TT.ring = mmap(0, TT.ring_size, PROT_READ|PROT_WRITE,
+    MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+  if (TT.ring == MAP_FAILED) perror_exit("capture buffer");
+  TT.scratch = xmalloc(TT.scratch_len = 65536);
+  TT.dead = -1;
+  TT.nsrc = 2;
+  TT.src = xzalloc(64*sizeof(*TT.src));
+  TT.src[0].fd = TT.stat_fd = xopen("/proc/stat", O_RDONLY);
+  TT.src[1].fd = TT.disk_fd = xopen("/proc/diskstats", O_RDONLY);
+  TT.up_fd = xopen("/proc/uptime", O_RDONLY);
+  if (!(TT.proc = opendir("/proc"))) perror_exit("/proc");
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  while (--tcnt && !toys.signal) {
+    if ((i = pread(TT.up_fd, toybuf, 64, 0)) < 1) goto wait_usec;
+    toybuf[i] = 0;
+    uptime = strtoul(toybuf, &ptr, 10)*100;
+    if (*ptr == '.') uptime += strtoul(ptr+1, 0, 10);
+    ring_pids();
+    start = TT.used;
+    if (-1 == (login = ring_sample(uptime))) {
+      TT.used = start;
+      ring_flush(stat_fp, disk_fp, ps_fp);
+      if (-1 == (login = ring_sample(uptime))) {
+        TT.used = 0;
+        error_msg("sample bigger than CAPTURE_SIZE");
+        login = 0;
+        for (i = 0; i<TT.nsrc; i++) TT.src[i].len = 0;
+      }
+    }
+    // stop proc dumping in 2 secs if getty or gdm, kdm, xdm found
+    if (login && tcnt > 2 * 1000 * 1000 / TT.smpl_period_usec)
+      tcnt = 2 * 1000 * 1000 / TT.smpl_period_usec;
+wait_usec:
+    // Sleep to the next tick rather than for a period, so the time taken
+    // to sample doesn't add up.
+    ts.tv_nsec += TT.smpl_period_usec%1000000*1000;
+    ts.tv_sec += TT.smpl_period_usec/1000000 + ts.tv_nsec/1000000000;
+    ts.tv_nsec %= 1000000000;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+  }
+  ring_flush(stat_fp, disk_fp, ps_fp);
+  fclose(stat_fp);
+  fclose(disk_fp);
+  fclose(ps_fp);
+  if (CFG_TOYBOX_FREE) {
+    for (i = 0; i<TT.nlive; i++) close(TT.src[TT.live[i]].fd);
+    for (i = 0; i<TT.nsrc; i++) free(TT.src[i].last);
+    closedir(TT.proc);
+    close(TT.stat_fd);
+    close(TT.disk_fd);
+    close(TT.up_fd);
+    free(TT.src);
+    free(TT.live);
+    free(TT.pids);
+    free(TT.scratch);
+    munmap(TT.ring, TT.ring_size);
+  }
+}
+
 static void start_logging()
 {
   int proc_stat_fd = xcreate("proc_stat.log",  
@@ -165,12 +467,6 @@ static void start_logging()
   long tcnt = 60 * 1000 * 1000 / TT.smpl_period_usec;
 
   if (tcnt <= 0) tcnt = 1;
-  if (TT.proc_accounting) {
-    int kp_fd = xcreate("kernel_procs_acct", O_WRONLY | O_CREAT | O_TRUNC,0666);
-
-    xclose(kp_fd);
-    acct("kernel_procs_acct");
-  }
   memset(TT.buf, 0, sizeof(TT.buf));
   while (--tcnt && !toys.signal) {
     int i = 0, j = 0, fd = open("/proc/uptime", O_RDONLY);
@@ -257,6 +553,7 @@ void bootchartd_main()
   pid_t lgr_pid, self_pid = getpid();
   int bchartd_opt = 0; // 0=PID1, 1=start, 2=stop, 3=init
   TT.smpl_period_usec = 200 * 1000;
+  TT.ring_size = 8192 * 1024;
 
   TT.is_login = (self_pid == 1);
   if (*toys.optargs) {
@@ -292,7 +589,14 @@ void bootchartd_main()
     raise(SIGSTOP);
     if (!bchartd_opt && !getenv("PATH")) 
       putenv("PATH=/sbin:/usr/sbin:/bin:/usr/bin");
-    start_logging();
+    if (TT.proc_accounting) {
+      int kp_fd = xcreate("kernel_procs_acct", O_WRONLY|O_CREAT|O_TRUNC, 0666);
+
+      xclose(kp_fd);
+      acct("kernel_procs_acct");
+    }
+    if (TT.ring_mode) ring_logging();
+    else start_logging();
     stop_logging(tmp_dir, bchartd_opt == 1 ? toys.optargs[1] : NULL);
     return;
   } 
@@ -129,16 +129,21 @@ GLOBALS(
 
   // Compressed data buffer
   char *data;
-  unsigned pos, len;
+  unsigned pos, len, flushed;
   int infd, outfd;
 
-  // Tables only used for deflation
-  unsigned short *hashhead, *hashchain;
+  // Tables only used for deflation: fixed huffman codes (bit reversed) and
+  // their lengths for literal/length then distance symbols, and which
+  // symbol each length and distance (see deflate_dist()) uses.
+  unsigned short fixcode[288+30];
+  char fixlen[288+30], lencode[259], distcode[512];
 )
 
-// little endian bit buffer
+// little endian bit buffer. Writing goes a bit at a time through bitpos,
+// reading pulls whole bytes from buf (at pos) into a 64 bit accumulator.
 struct bitbuf {
-  int fd, bitpos, len, max;
+  int fd, bitpos, len, max, pos, count;
+  unsigned long long bits;
   char buf[];
 };
 
@@ -153,54 +158,58 @@ struct bitbuf *bitbuf_init(int fd, int size)
   return bb;
 }
 
-// Advance bitpos without the overhead of recording bits
-void bitbuf_skip(struct bitbuf *bb, int bits)
+// Top up the accumulator to at least 56 bits, 8 bytes at a time when the
+// buffer has them. Only reads more input when the buffer's empty, and
+// running out isn't an error until somebody wants bits that aren't there.
+// The bits above count are the start of buf[pos], so anything that skips
+// buf must zero them.
+static void bitbuf_fill(struct bitbuf *bb)
 {
-  int pos = bb->bitpos + bits, len = bb->len << 3;
-
-  while (pos >= len) {
-    pos -= len;
-    len = (bb->len = read(bb->fd, bb->buf, bb->max)) << 3;
-    if (bb->len < 1) perror_exit("inflate EOF");
+  unsigned long long ll;
+
+  while (bb->count < 56) {
+    if (bb->len-bb->pos >= 8) {
+      if (IS_LITTLE_ENDIAN) memcpy(&ll, bb->buf+bb->pos, 8);
+      else ll = peek_le(bb->buf+bb->pos, 8);
+      bb->bits |= ll << bb->count;
+      bb->pos += (63-bb->count)>>3;
+      bb->count |= 56;
+    } else if (bb->pos < bb->len) {
+      bb->bits |= (unsigned long long)(unsigned char)bb->buf[bb->pos++]
+        << bb->count;
+      bb->count += 8;
+    } else {
+      bb->pos = 0;
+      if (0 > (bb->len = read(bb->fd, bb->buf, bb->max))) perror_exit("read");
+      if (!bb->len) break;
+    }
   }
-  bb->bitpos = pos;
 }
 
-// Optimized single bit inlined version
-static inline int bitbuf_bit(struct bitbuf *bb)
+// Fetch the next X (up to 32) bits from the bitbuf, little endian
+unsigned bitbuf_get(struct bitbuf *bb, int bits)
 {
-  int bufpos = bb->bitpos>>3;
+  unsigned result;
 
-  if (bufpos == bb->len) {
-    bitbuf_skip(bb, 0);
-    bufpos = 0;
+  if (bb->count < bits) {
+    bitbuf_fill(bb);
+    if (bb->count < bits) error_exit("inflate EOF");
   }
+  result = bb->bits & ((1ULL<<bits)-1);
+  bb->bits >>= bits;
+  bb->count -= bits;
 
-  return (bb->buf[bufpos]>>(bb->bitpos++&7))&1;
+  return result;
 }
 
-// Fetch the next X bits from the bitbuf, little endian
-unsigned bitbuf_get(struct bitbuf *bb, int bits)
+// Advance past bits we don't care about
+void bitbuf_skip(struct bitbuf *bb, int bits)
 {
-  int result = 0, offset = 0;
-
-  while (bits) {
-    int click = bb->bitpos >> 3, blow, blen;
-
-    // Load more data if buffer empty
-    if (click == bb->len) bitbuf_skip(bb, click = 0);
-
-    // grab bits from next byte
-    blow = bb->bitpos & 7;
-    blen = 8-blow;
-    if (blen > bits) blen = bits;
-    result |= ((bb->buf[click] >> blow) & ((1<<blen)-1)) << offset;
-    offset += blen;
-    bits -= blen;
-    bb->bitpos += blen;
+  while (bits > 32) {
+    bitbuf_get(bb, 32);
+    bits -= 32;
   }
-
-  return result;
+  bitbuf_get(bb, bits);
 }
 
 void bitbuf_flush(struct bitbuf *bb)
@@ -232,72 +241,117 @@ void bitbuf_put(struct bitbuf *bb, int data, int len)
   }
 }
 
-static void output_byte(char sym)
-{
-  int pos = TT.pos++ & 32767;
+// Inflate decodes into a window this big, and when it's nearly full writes
+// out the new data and moves the last 32k (the most a back reference can
+// reach) down to the start. So most copies don't wrap and can be memcpy().
+#define INFLATE_WINDOW (256*1024)
 
-  TT.data[pos] = sym;
+static void inflate_flush(void)
+{
+  unsigned len = TT.pos-TT.flushed;
 
-  if (!pos) {
-    txwrite(TT.outfd, TT.data, 32768);
-    if (TT.crcfunc) TT.crcfunc(TT.data, 32768);
+  if (len) {
+    txwrite(TT.outfd, TT.data+TT.flushed, len);
+    if (TT.crcfunc) TT.crcfunc(TT.data+TT.flushed, len);
+  }
+  if (TT.pos > 32768) {
+    memmove(TT.data, TT.data+TT.pos-32768, 32768);
+    TT.pos = 32768;
   }
+  TT.flushed = TT.pos;
 }
 
 // Huffman coding uses bits to traverse a binary tree to a leaf node,
 // By placing frequently occurring symbols at shorter paths, frequently
 // used symbols may be represented in fewer bits than uncommon symbols.
 
+// Rather than walk the tree a bit at a time, look up the next 9 bits in a
+// table: each entry is symbol<<5 | code length. Codes longer than that
+// have their first 9 bits point to a sub-table (offset<<5 | 16 | its index
+// bits) indexed by the bits after those. Zero is an unused code.
+#define HUFF_BITS 9
+#define HUFF_SIZE 2048
+
 struct huff {
-  unsigned short length[16];
-  unsigned short symbol[288];
+  unsigned short table[HUFF_SIZE];
 };
 
-// Create simple huffman tree from array of bit lengths.
+// Create huffman lookup table from array of bit lengths.
 
 // The symbols in the huffman trees are sorted (first by bit length
 // of the code to reach them, then by symbol number). This means that given
 // the bit length of each symbol, we can construct a unique tree.
+// Codes arrive most significant bit first, but we look them up by the
+// accumulator's low bits, so entries go at the bit reversed code.
 static void len2huff(struct huff *huff, char bitlen[], int len)
 {
-  int offset[16];
-  int i;
-
-  // Count number of codes at each bit length
-  memset(huff, 0, sizeof(struct huff));
-  for (i = 0; i<len; i++) huff->length[bitlen[i]]++;
-
-  // Sort symbols by bit length. (They'll remain sorted by symbol within that.)
-  *huff->length = *offset = 0;
-  for (i = 1; i<16; i++) offset[i] = offset[i-1] + huff->length[i-1];
+  unsigned short count[16], *t = huff->table;
+  int i, j, k, code = 0, left = 1, rev, prefix = -1, base = 0, sub = 0,
+    used = 1<<HUFF_BITS, max = 0;
+
+  // Count number of codes at each bit length, and refuse oversubscribed sets
+  memset(count, 0, sizeof(count));
+  for (i = 0; i<len; i++) count[bitlen[i]]++;
+  for (i = 1; i<16; i++) {
+    if ((left = (left<<1)-count[i]) < 0) error_exit("bad tree");
+    if (count[i]) max = i;
+  }
+  memset(t, 0, sizeof(huff->table));
+
+  // Hand out canonical codes in order of length then symbol
+  for (i = 1; i<16; i++, code <<= 1) for (j = 0; j<len; j++) {
+    if (bitlen[j] != i) continue;
+    for (k = rev = 0; k<i; k++) rev |= ((code>>k)&1)<<(i-1-k);
+    code++;
+    if (i <= HUFF_BITS) {
+      for (k = rev; k < 1<<HUFF_BITS; k += 1<<i) t[k] = (j<<5)|i;
+      count[i]--;
+      continue;
+    }
 
-  for (i = 0; i<len; i++) if (bitlen[i]) huff->symbol[offset[bitlen[i]]++] = i;
+    // New sub-table? Make it just big enough for the remaining codes that
+    // will share its prefix (which come next, and are no shorter).
+    if ((rev & ((1<<HUFF_BITS)-1)) != prefix) {
+      prefix = rev & ((1<<HUFF_BITS)-1);
+      left = 1<<(sub = i-HUFF_BITS);
+      while (sub+HUFF_BITS < max) {
+        if ((left -= count[sub+HUFF_BITS]) <= 0) break;
+        sub++;
+        left <<= 1;
+      }
+      if (used+(1<<sub) > HUFF_SIZE) error_exit("bad tree");
+      t[prefix] = (used<<5)|16|sub;
+      base = used;
+      used += 1<<sub;
+    }
+    for (k = rev>>HUFF_BITS; k < 1<<sub; k += 1<<(i-HUFF_BITS))
+      t[base+k] = (j<<5)|i;
+    count[i]--;
+  }
 }
 
 // Fetch and decode next huffman coded symbol from bitbuf.
-// This takes advantage of the sorting to navigate the tree as an array:
-// each time we fetch a bit we have all the codes at that bit level in
-// order with no gaps.
 static unsigned huff_and_puff(struct bitbuf *bb, struct huff *huff)
 {
-  unsigned short *length = huff->length;
-  int start = 0, offset = 0;
-
-  // Traverse through the bit lengths until our code is in this range
-  for (;;) {
-    offset = (offset << 1) | bitbuf_bit(bb);
-    start += *++length;
-    if ((offset -= *length) < 0) break;
-    if ((length - huff->length) & 16) error_exit("bad symbol");
-  }
-
-  return huff->symbol[start + offset];
+  unsigned short *t = huff->table;
+  unsigned e;
+
+  if (bb->count < 15) bitbuf_fill(bb);
+  e = t[bb->bits & ((1<<HUFF_BITS)-1)];
+  if (e&16) e = t[(e>>5) + ((bb->bits>>HUFF_BITS) & ((1<<(e&15))-1))];
+  if (!(e&15)) error_exit("bad symbol");
+  if ((e&15) > bb->count) error_exit("inflate EOF");
+  bb->bits >>= e&15;
+  bb->count -= e&15;
+
+  return e>>5;
 }
 
 // Decompress deflated data from bitbuf to TT.outfd.
 static void inflate(struct bitbuf *bb)
 {
   TT.crc = ~0;
+  TT.pos = TT.flushed = TT.len = 0;
   // repeat until spanked
   for (;;) {
     int final, type;
@@ -312,22 +366,29 @@ static void inflate(struct bitbuf *bb)
       int len, nlen;
 
       // Align to byte, read length
-      bitbuf_skip(bb, (8-bb->bitpos)&7);
+      bitbuf_skip(bb, bb->count&7);
       len = bitbuf_get(bb, 16);
       nlen = bitbuf_get(bb, 16);
       if (len != (0xffff & ~nlen)) error_exit("bad len");
 
-      // Dump literal output data
+      // Dump literal output data: whatever's in the accumulator first, then
+      // straight from the buffer.
       while (len) {
-        int pos = bb->bitpos >> 3, bblen = bb->len - pos;
-        char *p = bb->buf+pos;
-
-        // dump bytes until done or end of current bitbuf contents
-        if (bblen > len) bblen = len;
-        pos = bblen;
-        while (pos--) output_byte(*(p++));
-        bitbuf_skip(bb, bblen << 3);
-        len -= bblen;
+        int bblen = bb->len - bb->pos;
+
+        if (TT.pos == INFLATE_WINDOW) inflate_flush();
+        if (bb->count || !bblen) {
+          TT.data[TT.pos++] = bitbuf_get(bb, 8);
+          len--;
+        } else {
+          if (bblen > len) bblen = len;
+          if (bblen > INFLATE_WINDOW-TT.pos) bblen = INFLATE_WINDOW-TT.pos;
+          bb->bits = 0;
+          memcpy(TT.data+TT.pos, bb->buf+bb->pos, bblen);
+          TT.pos += bblen;
+          bb->pos += bblen;
+          len -= bblen;
+        }
       }
 
     // Compressed block
@@ -336,7 +397,7 @@ static void inflate(struct bitbuf *bb)
 
       // Dynamic huffman codes?
       if (type == 2) {
-        struct huff *h2 = ((struct huff *)toybuf)+1;
+        struct huff *h2 = ((struct huff *)TT.fixlithuff)+2;
         int i, litlen, distlen, hufflen;
         char *hufflen_order = "\x10\x11\x12\0\x08\x07\x09\x06\x0a\x05\x0b"
                               "\x04\x0c\x03\x0d\x02\x0e\x01\x0f", *bits;
@@ -371,8 +432,8 @@ static void inflate(struct bitbuf *bb)
         }
         if (i > litlen+distlen) error_exit("bad tree");
 
-        len2huff(lithuff = h2, bits, litlen);
-        len2huff(disthuff = ((struct huff *)toybuf)+2, bits+litlen, distlen);
+        len2huff(lithuff = h2+1, bits, litlen);
+        len2huff(disthuff = h2+2, bits+litlen, distlen);
 
       // Static huffman codes
       } else {
@@ -382,22 +443,30 @@ static void inflate(struct bitbuf *bb)
 
       // Use huffman tables to decode block of compressed symbols
       for (;;) {
-        int sym = huff_and_puff(bb, lithuff);
+        int sym;
+
+        if (TT.pos > INFLATE_WINDOW-258) inflate_flush();
+        sym = huff_and_puff(bb, lithuff);
 
         // Literal?
-        if (sym < 256) output_byte(sym);
+        if (sym < 256) TT.data[TT.pos++] = sym;
 
         // Copy range?
         else if (sym > 256) {
+          char *to, *from;
           int len, dist;
 
-          sym -= 257;
+          if ((sym -= 257) > 28) error_exit("bad symbol");
           len = TT.lenbase[sym] + bitbuf_get(bb, TT.lenbits[sym]);
-          sym = huff_and_puff(bb, disthuff);
+          if ((sym = huff_and_puff(bb, disthuff)) > 29) error_exit("bad symbol");
           dist = TT.distbase[sym] + bitbuf_get(bb, TT.distbits[sym]);
-          sym = TT.pos & 32767;
+          if (dist > TT.pos) error_exit("bad distance");
 
-          while (len--) output_byte(TT.data[(TT.pos-dist) & 32767]);
+          to = TT.data+TT.pos;
+          from = to-dist;
+          TT.pos += len;
+          if (dist >= len) memcpy(to, from, len);
+          else while (len--) *to++ = *from++;
 
         // End of block
         } else break;
@@ -408,61 +477,225 @@ static void inflate(struct bitbuf *bb)
     if (final) break;
   }
 
-  if (TT.pos & 32767) {
-    txwrite(TT.outfd, TT.data, TT.pos & 32767);
-    if (TT.crcfunc) TT.crcfunc(TT.data, TT.pos & 32767);
+  inflate_flush();
+}
+
+// Deflate works on blocks this big, each with the 32k of input before it as
+// its dictionary, so a batch of them can be compressed at once (a thread
+// each, up to 8). Each block's output ends byte aligned, with an empty stored
+// block after it if it's not the last, so the output can just be written out
+// in order. Codes are the fixed huffman ones, with greedy hash chain matching.
+#define DEFLATE_BLOCK (128*1024)
+#define DEFLATE_DICT 32768
+#define DEFLATE_OUT (DEFLATE_BLOCK/8*11+64)
+#define DEFLATE_HASH 15
+#define DEFLATE_CHAIN 64
+
+struct deflate_job {
+  struct compress_data *tt;
+  char *in, *out;
+  unsigned *head, *chain, crc;
+  unsigned long long bits;
+  int dict, len, outlen, bitcount, final, started;
+#if CFG_TOYBOX_THREADS
+  pthread_t tid;
+#endif
+};
+
+static void deflate_bits(struct deflate_job *dj, unsigned data, int len)
+{
+  dj->bits |= (unsigned long long)data << dj->bitcount;
+  for (dj->bitcount += len; dj->bitcount >= 8; dj->bitcount -= 8) {
+    dj->out[dj->outlen++] = dj->bits;
+    dj->bits >>= 8;
   }
 }
 
-// Deflate from TT.infd to bitbuf
-// For deflate, TT.len = input read, TT.pos = input consumed
-static void deflate(struct bitbuf *bb)
+static void deflate_sym(struct deflate_job *dj, int sym)
 {
-  char *data = TT.data;
-  int len, final = 0;
+  deflate_bits(dj, dj->tt->fixcode[sym], dj->tt->fixlen[sym]);
+}
 
-  TT.crc = ~0;
+// Index into distcode: distances over 256 share an entry per 128.
+static int deflate_dist(int dist)
+{
+  return (dist <= 256) ? dist-1 : 256+((dist-1)>>7);
+}
 
-  while (!final) {
-    // Read next half-window of data if we haven't hit EOF yet.
-    len = readall(TT.infd, data+(TT.len&32768), 32768);
-    if (len < 0) perror_exit("read"); // todo: add filename
-    if (len != 32768) final++;
-    if (TT.crcfunc) TT.crcfunc(data+(TT.len&32768), len);
-    // TT.len += len;  crcfunc advances len
+static int deflate_hash(unsigned char *s)
+{
+  return ((s[0]<<10)^(s[1]<<5)^s[2]) & ((1<<DEFLATE_HASH)-1);
+}
+
+// Compress one block (and crc it). This runs in its own thread, so it
+// can't use TT, only dj->tt.
+static void *deflate_worker(void *arg)
+{
+  struct deflate_job *dj = arg;
+  struct compress_data *tt = dj->tt;
+  unsigned char *in = (void *)dj->in;
+  unsigned *head = dj->head, *chain = dj->chain, i;
+  int pos, end = dj->dict+dj->len, best, dist, len, max, try, h;
+
+  dj->crc = ~crc_update(~0, dj->in+dj->dict, dj->len, 1);
+  dj->outlen = dj->bitcount = dj->bits = 0;
+  memset(head, 0, sizeof(*head)<<DEFLATE_HASH);
+
+  // Block header: final flag, type 1 (fixed codes)
+  deflate_bits(dj, dj->final, 1);
+  deflate_bits(dj, 1, 2);
+
+  // Hash the dictionary, then look for the longest match within 32k back
+  // at each position of the block. Positions in the chains are +1, 0 ends.
+  for (pos = 0; pos<end;) {
+    best = dist = 0;
+    if (pos+2<end) {
+      h = deflate_hash(in+pos);
+      if (pos >= dj->dict) {
+        if ((max = end-pos) > 258) max = 258;
+        for (i = head[h], try = DEFLATE_CHAIN; i-- && pos-i <= 32768 && try--;
+          i = chain[i])
+        {
+          if (in[i+best] != in[pos+best]) continue;
+          for (len = 0; len<max && in[i+len] == in[pos+len]; len++);
+          if (len>best) {
+            dist = pos-i;
+            if ((best = len) == max) break;
+          }
+        }
+      }
+      chain[pos] = head[h];
+      head[h] = pos+1;
+    }
+    if (pos++ < dj->dict) continue;
+
+    if (best<3) deflate_sym(dj, in[pos-1]);
+    else {
+      len = tt->lencode[best];
+      deflate_sym(dj, 257+len);
+      deflate_bits(dj, best-tt->lenbase[len], tt->lenbits[len]);
+      len = tt->distcode[deflate_dist(dist)];
+      deflate_sym(dj, 288+len);
+      deflate_bits(dj, dist-tt->distbase[len], tt->distbits[len]);
+
+      // Hash the rest of the match so later matches can start in it.
+      for (best += pos-1; pos<best; pos++) if (pos+2<end) {
+        h = deflate_hash(in+pos);
+        chain[pos] = head[h];
+        head[h] = pos+1;
+      }
+    }
+  }
+  deflate_sym(dj, 256);
+
+  // Didn't compress? Store it instead, 64k-1 at most per stored block.
+  if (dj->outlen > dj->len+dj->len/64+16) {
+    dj->outlen = dj->bitcount = dj->bits = 0;
+    for (pos = 0; !pos || pos<dj->len; pos += len) {
+      if ((len = dj->len-pos) > 65535) len = 65535;
+      deflate_bits(dj, dj->final && pos+len == dj->len, 1);
+      deflate_bits(dj, 0, 7);
+      deflate_bits(dj, len, 16);
+      deflate_bits(dj, 0xffff & ~len, 16);
+      memcpy(dj->out+dj->outlen, in+dj->dict+pos, len);
+      dj->outlen += len;
+    }
+
+  // Byte align, with an empty stored block to do it if more blocks follow.
+  } else {
+    if (!dj->final) deflate_bits(dj, 0, 3);
+    deflate_bits(dj, 0, (8-dj->bitcount)&7);
+    if (!dj->final) deflate_bits(dj, 0xffff0000, 32);
+  }
 
-    // store block as literal
-    bitbuf_put(bb, final, 1);
-    bitbuf_put(bb, 0, 1);
+  return 0;
+}
 
-    bitbuf_put(bb, 0, (8-bb->bitpos)&7);
-    bitbuf_put(bb, len, 16);
-    bitbuf_put(bb, 0xffff & ~len, 16);
+// Deflate from TT.infd to bb->fd.
+static void deflate(struct bitbuf *bb)
+{
+  struct deflate_job *jobs, *dj;
+  char *data;
+  long n = 1;
+  int i, j, final = 0;
+#if CFG_TOYBOX_THREADS
+  pthread_attr_t attr;
+
+  if ((n = sysconf(_SC_NPROCESSORS_ONLN)) < 1) n = 1;
+  if (n > 8) n = 8;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+#endif
+
+  jobs = xzalloc(n*sizeof(*jobs));
+  data = xmalloc(DEFLATE_DICT+n*DEFLATE_BLOCK);
+  for (i = 0; i<n; i++) {
+    jobs[i].tt = &TT;
+    jobs[i].out = xmalloc(DEFLATE_OUT);
+    jobs[i].head = xmalloc(sizeof(*jobs->head)<<DEFLATE_HASH);
+    jobs[i].chain = xmalloc(sizeof(*jobs->chain)*(DEFLATE_DICT+DEFLATE_BLOCK));
+  }
 
-    // repeat until spanked
-    while (TT.pos != TT.len) {
-      unsigned pos = TT.pos & 65535;
+  TT.crc = ~0;
+  TT.len = 0;
+  while (!final) {
+    // Read a batch of blocks, starting each one as soon as it's read.
+    for (i = 0; i<n && !final; i++) {
+      dj = jobs+i;
+      dj->in = data+DEFLATE_DICT+i*DEFLATE_BLOCK;
+      if (0>(dj->len = readall(TT.infd, dj->in, DEFLATE_BLOCK)))
+        perror_exit("read"); // todo: add filename
+      dj->final = final = dj->len != DEFLATE_BLOCK;
+      dj->dict = (i || TT.len) ? DEFLATE_DICT : 0;
+      dj->in -= dj->dict;
+#if CFG_TOYBOX_THREADS
+      dj->started = i
+        && !toy_worker_create(&dj->tid, &attr, deflate_worker, dj);
+#endif
+    }
+    for (j = 0; j<i; j++) if (!jobs[j].started) deflate_worker(jobs+j);
+
+    // Write them out in order, adding each crc to the total.
+    for (j = 0; j<i; j++) {
+      dj = jobs+j;
+#if CFG_TOYBOX_THREADS
+      if (dj->started) pthread_join(dj->tid, 0);
+#endif
+      txwrite(bb->fd, dj->out, dj->outlen);
+      TT.crc = ~crc_combine(~TT.crc, dj->crc, dj->len);
+      TT.len += dj->len;
+    }
 
-      bitbuf_put(bb, data[pos], 8);
+    // The end of this batch is the dictionary for the start of the next.
+    memmove(data, data+n*DEFLATE_BLOCK, DEFLATE_DICT);
+  }
 
-      // need to refill buffer?
-      if (!(32767 & ++TT.pos) && !final) break;
+#if CFG_TOYBOX_THREADS
+  pthread_attr_destroy(&attr);
+#endif
+  if (CFG_TOYBOX_FREE) {
+    for (i = 0; i<n; i++) {
+      free(jobs[i].out);
+      free(jobs[i].head);
+      free(jobs[i].chain);
     }
+    free(jobs);
+    free(data);
   }
-  bitbuf_flush(bb);
 }
 
 // Allocate memory for deflate/inflate.
 static void init_deflate(int compress)
 {
-  int i, n = 1;
-
-  // compress needs 64k data and 32k each for hashhead and hashchain.
-  // decompress just needs 32k data.
-  TT.data = xmalloc(32768*(compress ? 4 : 1));
-  if (compress) {
-    TT.hashhead = (unsigned short *)(TT.data + 65536);
-    TT.hashchain = (unsigned short *)(TT.data + 65536 + 32768);
+  int i, j, n = 1;
+
+  // decompress needs a window and the huffman tables (fixed literal and
+  // distance, then dynamic code length, literal, and distance), compress
+  // allocates its own (see deflate)
+  if (!compress) {
+    TT.data = xmalloc(INFLATE_WINDOW+5*sizeof(struct huff));
+    TT.fixlithuff = TT.data+INFLATE_WINDOW;
+    TT.fixdisthuff = ((struct huff *)TT.fixlithuff)+1;
   }
 
   // Calculate lenbits, lenbase, distbits, distbase
@@ -487,10 +720,32 @@ static void init_deflate(int compress)
   }
 
   // Init fixed huffman tables
-  for (i=0; i<288; i++) toybuf[i] = 8 + (i>143) - ((i>255)<<1) + (i>279);
-  len2huff(TT.fixlithuff = ((struct huff *)toybuf)+3, toybuf, 288);
-  memset(toybuf, 5, 30);
-  len2huff(TT.fixdisthuff = ((struct huff *)toybuf)+4, toybuf, 30);
+  if (!compress) {
+    for (i=0; i<288; i++) toybuf[i] = 8 + (i>143) - ((i>255)<<1) + (i>279);
+    len2huff(TT.fixlithuff, toybuf, 288);
+    memset(toybuf, 5, 30);
+    len2huff(TT.fixdisthuff, toybuf, 30);
+
+    return;
+  }
+
+  // Fixed huffman codes (RFC 1951 section 3.2.6) go out most significant
+  // bit first, so store them backwards.
+  for (i = 0; i<288+30; i++) {
+    if (i<144) n = 0x30+i, TT.fixlen[i] = 8;
+    else if (i<256) n = 0x190+i-144, TT.fixlen[i] = 9;
+    else if (i<280) n = i-256, TT.fixlen[i] = 7;
+    else if (i<288) n = 0xc0+i-280, TT.fixlen[i] = 8;
+    else n = i-288, TT.fixlen[i] = 5;
+    for (j = TT.fixcode[i] = 0; j<TT.fixlen[i]; j++, n >>= 1)
+      TT.fixcode[i] = (TT.fixcode[i]<<1)|(n&1);
+  }
+  for (i = 0; i<29; i++)
+    for (j = TT.lenbase[i]; j<(i<28 ? TT.lenbase[i+1] : 259); j++)
+      TT.lencode[j] = i;
+  for (i = 0; i<30; i++)
+    for (j = TT.distbase[i]; j<(i<29 ? TT.distbase[i+1] : 32769); j++)
+      TT.distcode[deflate_dist(j)] = i;
 }
 
 // Return true/false whether we consumed a gzip header.
@@ -514,18 +769,13 @@ static int is_gzip(struct bitbuf *bb)
 
 void gzip_crc(char *data, int len)
 {
-  int i;
-  unsigned crc, *crc_table = (unsigned *)(toybuf+sizeof(toybuf)-1024);
-
-  crc = TT.crc;
-  for (i=0; i<len; i++) crc = crc_table[(crc^data[i])&0xff] ^ (crc>>8);
-  TT.crc = crc;
+  TT.crc = crc_update(TT.crc, data, len, 1);
   TT.len += len;
 }
 
 static void do_gzip(int fd, char *name)
 {
-  struct bitbuf *bb = bitbuf_init(1, sizeof(toybuf));
+  struct bitbuf *bb = bitbuf_init(fileno(stdout), sizeof(toybuf));
 
   // Header from RFC 1952 section 2.2:
   // 2 ID bytes (1F, 8b), gzip method byte (8=deflate), FLAG byte (none),
@@ -535,10 +785,6 @@ static void do_gzip(int fd, char *name)
   TT.infd = fd;
   txwrite(bb->fd, "\x1f\x8b\x08\0\0\0\0\0\x02\xff", 10);
 
-  // Use last 1k of toybuf for little endian crc table
-  crc_init((unsigned *)(toybuf+sizeof(toybuf)-1024), 1);
-  TT.crcfunc = gzip_crc;
-
   deflate(bb);
 
   // tail: crc32, len32
@@ -556,17 +802,15 @@ static void do_zcat(int fd, char *name)
   struct bitbuf *bb = bitbuf_init(fd, sizeof(toybuf));
 
   if (!is_gzip(bb)) error_exit("not gzip");
-  TT.outfd = 1;
+  TT.outfd = fileno(stdout);
 
-  // Use last 1k of toybuf for little endian crc table
-  crc_init((unsigned *)(toybuf+sizeof(toybuf)-1024), 1);
   TT.crcfunc = gzip_crc;
 
   inflate(bb);
 
   // tail: crc32, len32
 
-  bitbuf_skip(bb, (8-bb->bitpos)&7);
+  bitbuf_skip(bb, bb->count&7);
   if (~TT.crc != bitbuf_get(bb, 32) || TT.len != bitbuf_get(bb, 32))
     error_exit("bad crc");
   free(bb);
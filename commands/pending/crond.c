@@ -25,6 +25,10 @@ config CROND
 
 #define FOR_crond
 #include "toys.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#endif
 
 GLOBALS(
   char *crontabs_dir;
@@ -34,6 +38,8 @@ GLOBALS(
 
   time_t crontabs_dir_mtime;
   uint8_t flagd;
+  struct _job **heap, **run;
+  int heaplen, heapsize, nrun, runsize, sigpipe[2], ifd, tfd;
 )
 
 typedef struct _var {
@@ -41,13 +47,23 @@ typedef struct _var {
   char *name, *val;
 } VAR;
 
+// A job is queued in TT.heap by the next time it's due, and sits in TT.run
+// while it (or the sendmail for its output) is running.
 typedef struct _job {
   struct _job *next, *prev;
   char min[60], hour[24], dom[31], mon[12], dow[7], *cmd;
-  int isrunning, needstart, mailsize;
+  int mailsize, star;
   pid_t pid;
+  time_t due;
+  struct _cronfile *cfile;
 } JOB;
 
+// Which fields of a job started with '*'.
+#define STAR_MIN  1
+#define STAR_HOUR 2
+#define STAR_DOM  4
+#define STAR_DOW  8
+
 typedef struct _cronfile {
   struct _cronfile *next, *prev;
   struct double_list *job, *var;
@@ -262,6 +278,10 @@ static void parse_line(char *line, CRONFILE *cfile)
       // don't have any cmd to execute.
       if (!*line) return;
       j = xzalloc(sizeof(JOB));
+      if (*tokens[0] == '*') j->star |= STAR_MIN;
+      if (*tokens[1] == '*') j->star |= STAR_HOUR;
+      if (*tokens[2] == '*') j->star |= STAR_DOM;
+      if (*tokens[4] == '*') j->star |= STAR_DOW;
 
       if (parse_and_fillarray(j->min, 0, sizeof(j->min), tokens[0]))
         goto STOP_PARSING;
@@ -274,6 +294,7 @@ static void parse_line(char *line, CRONFILE *cfile)
       if (parse_and_fillarray(j->dow, 0, sizeof(j->dow), tokens[4]))
         goto STOP_PARSING;
       j->cmd = xstrdup(line);
+      j->cfile = cfile;
 
       if (TT.flagd) loginfo(LOG_LEVEL5, " command:%s", j->cmd);
       dlist_add_nomalloc((struct double_list **)&cfile->job, (struct double_list *)j);
@@ -330,9 +351,7 @@ static void remove_completed_jobs()
     list->invalid = 1;
     jstart = jlist;
     while (jlist) {
-      jlist->isrunning = 0;
       if (jlist->pid > 0) {
-        jlist->isrunning = 1;
         delete = 0;
         jlist = jlist->next;
       } else {
@@ -478,11 +497,7 @@ static void sendmail(CRONFILE *cfile, JOB *job)
   struct stat sb;
 
   job->pid = 0;
-  if (pid <=0 || job->mailsize <=0) {
-    job->isrunning = 0;
-    job->needstart = 1;
-    return;
-  }
+  if (pid <=0 || job->mailsize <=0) return;
   snprintf(toybuf, sizeof(toybuf), "/var/spool/cron/cron.%s.%d",
       cfile->username, (int)pid);
 
@@ -499,133 +514,256 @@ static void sendmail(CRONFILE *cfile, JOB *job)
   do_fork(cfile, job, mailfd, "sendmail");
 }
 
-// Count the number of jobs, which are not completed.
-static int count_running_jobs()
+// Reap finished jobs (after SIGCHLD) and send their output on.
+static void reap_jobs(void)
 {
-  CRONFILE *cfile = gclist;
-  JOB *job, *jstart;
-  int count = 0;
+  int i;
 
-  while (cfile) {
-    job = jstart = (JOB *)cfile->job;
-    while (job) {
-      int ret;
-
-      if (!job->isrunning || job->pid<=0) goto NEXT_JOB;
-      job->isrunning = 0;
-      ret = waitpid(job->pid, NULL, WNOHANG);
-      if (ret < 0 || ret == job->pid) {
-        sendmail(cfile, job);
-        if (job->pid) count += (job->isrunning=1);
-        else {
-          job->isrunning = 0;
-          job->needstart = 1;
-        }
-      }
-      else count += (job->isrunning=1);
+  for (i = 0; i < TT.nrun;) {
+    JOB *job = TT.run[i];
+    int ret = waitpid(job->pid, NULL, WNOHANG);
 
-NEXT_JOB:
-      if ((job = job->next) == jstart) break;
+    if (ret < 0 || ret == job->pid) sendmail(job->cfile, job);
+    if (job->pid > 0) i++;
+    else TT.run[i] = TT.run[--TT.nrun];
+  }
+}
+
+// Start a job and prepare for the e-mail sending.
+static void start_job(JOB *job)
+{
+  CRONFILE *cfile = job->cfile;
+  int mailfd = -1;
+
+  if (job->pid > 0) {
+    loginfo(LOG_LEVEL8, "user %s: process already running: %s",
+        cfile->username, job->cmd);
+    return;
+  }
+
+  job->mailsize = 0;
+  snprintf(toybuf, sizeof(toybuf), "/var/spool/cron/cron.%s.%d",
+      cfile->username, getpid());
+  if ((mailfd = open(toybuf, O_CREAT|O_TRUNC|O_WRONLY|O_EXCL|O_APPEND,
+          0600)) < 0) {
+    loginfo(LOG_ERROR, "can't create mail file %s for user %s, "
+        "discarding output", toybuf, cfile->username);
+  } else {
+    dprintf(mailfd, "To: %s\nSubject: cron: %s\n\n", cfile->mailto, job->cmd);
+    job->mailsize = lseek(mailfd, 0, SEEK_CUR);
+  }
+  do_fork(cfile, job, mailfd, NULL);
+  if (mailfd >= 0) {
+    if (job->pid <= 0) unlink(toybuf);
+    else {
+      char *mailfile = xmprintf("/var/spool/cron/cron.%s.%d",
+          cfile->username, (int)job->pid);
+      rename(toybuf, mailfile);
+      free(mailfile);
     }
-    if ((cfile = cfile->next) == gclist) break;
   }
-  return count;
+  loginfo(LOG_LEVEL8, "USER %s pid %3d cmd %s",
+      cfile->username, job->pid, job->cmd);
+  if (job->pid > 0) {
+    if (TT.nrun == TT.runsize)
+      TT.run = xrealloc(TT.run, (TT.runsize += 16)*sizeof(*TT.run));
+    TT.run[TT.nrun++] = job;
+  }
+}
+
+// Day of month and day of week are or'ed together, unless one is a '*'.
+static int match_day(JOB *job, struct tm *tm)
+{
+  int dom = job->dom[tm->tm_mday-1], dow = job->dow[tm->tm_wday];
+
+  if (job->star & (STAR_DOM|STAR_DOW)) return dom && dow;
+
+  return dom || dow;
+}
+
+// First minute from T on that matches JOB, looking at a field at a time so
+// a daily job takes a few dozen steps rather than a day of minutes. T is
+// either a time_t or (WALL) local time pretending to be UTC, which has no
+// DST to skip or repeat. Returns 0 if there isn't one for years (Feb 30).
+static time_t match_job(JOB *job, time_t t, int wall)
+{
+  struct tm tm;
+  int i;
+
+  for (i = 0; i < 2000; i++) {
+    if (wall) gmtime_r(&t, &tm);
+    else localtime_r(&t, &tm);
+    if (!job->mon[tm.tm_mon]) {
+      tm.tm_mon++;
+      tm.tm_mday = 1;
+    } else if (!match_day(job, &tm)) tm.tm_mday++;
+    else if (!job->hour[tm.tm_hour]) {
+      t += 60*(60-tm.tm_min);
+      continue;
+    } else if (!job->min[tm.tm_min]) {
+      t += 60;
+      continue;
+    } else return t;
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    t = wall ? timegm(&tm) : mktime(&tm);
+  }
+
+  return 0;
+}
+
+// When JOB should next run after NOW. Jobs at a fixed time of day are
+// matched on the wall clock, so they run once when DST repeats an hour and
+// an hour late (rather than not at all) when it skips one. Jobs with a '*'
+// in minute or hour just run every minute that actually happens.
+static time_t next_due(JOB *job, time_t now)
+{
+  struct tm tm;
+  time_t t, w;
+
+  if (job->star & (STAR_MIN|STAR_HOUR))
+    return match_job(job, now-now%60+60, 0);
+
+  localtime_r(&now, &tm);
+  for (w = timegm(&tm); (w = match_job(job, w-w%60+60, 1));) {
+    gmtime_r(&w, &tm);
+    tm.tm_isdst = -1;
+    if ((t = mktime(&tm)) > now) return t;
+  }
+
+  return 0;
+}
+
+static void heap_down(int i)
+{
+  JOB *job = TT.heap[i];
+
+  for (;;) {
+    int kid = 2*i+1;
+
+    if (kid >= TT.heaplen) break;
+    if (kid+1 < TT.heaplen && TT.heap[kid+1]->due < TT.heap[kid]->due) kid++;
+    if (job->due <= TT.heap[kid]->due) break;
+    TT.heap[i] = TT.heap[kid];
+    i = kid;
+  }
+  TT.heap[i] = job;
 }
 
-// Execute jobs one by one and prepare for the e-mail sending.
-static void execute_jobs(void)
+// Rebuild the heap of every job's due time from NOW, recalculating them all
+// (or with ALL=0 just the ones that run every minute or hour, which is what
+// should catch up after the clock goes back a little).
+static void queue_jobs(time_t now, int all)
 {
   CRONFILE *cfile = gclist;
   JOB *job, *jstart;
+  int i;
 
+  TT.heaplen = 0;
   while (cfile) {
+    if (cfile->invalid) goto NEXT_CRONFILE;
     job = jstart = (JOB *)cfile->job;
     while (job) {
-      if (job->needstart) {
-        job->needstart = 0;
-        if (job->pid < 0) {
-          int mailfd = -1;
-
-          job->mailsize = job->pid = 0;
-          snprintf(toybuf, sizeof(toybuf), "/var/spool/cron/cron.%s.%d",
-              cfile->username, getpid());
-          if ((mailfd = open(toybuf, O_CREAT|O_TRUNC|O_WRONLY|O_EXCL|O_APPEND,
-                  0600)) < 0) {
-            loginfo(LOG_ERROR, "can't create mail file %s for user %s, "
-                "discarding output", toybuf, cfile->username);
-          } else {
-            dprintf(mailfd, "To: %s\nSubject: cron: %s\n\n", cfile->mailto, job->cmd);
-            job->mailsize = lseek(mailfd, 0, SEEK_CUR);
-          }
-          do_fork(cfile, job, mailfd, NULL);
-          if (mailfd >= 0) {
-            if (job->pid <= 0) unlink(toybuf);
-            else {
-              char *mailfile = xmprintf("/var/spool/cron/cron.%s.%d",
-                  cfile->username, (int)job->pid);
-              rename(toybuf, mailfile);
-              free(mailfile);
-            }
-          }
-          loginfo(LOG_LEVEL8, "USER %s pid %3d cmd %s", 
-              cfile->username, job->pid, job->cmd);
-          if (job->pid < 0) job->needstart = 1;
-          else job->isrunning = 1;
-        }
+      if (all || (job->star & (STAR_MIN|STAR_HOUR)) || job->due <= now)
+        job->due = next_due(job, now);
+      if (job->due) {
+        if (TT.heaplen == TT.heapsize)
+          TT.heap = xrealloc(TT.heap, (TT.heapsize += 64)*sizeof(*TT.heap));
+        TT.heap[TT.heaplen++] = job;
       }
       if ((job = job->next) == jstart) break;
     }
+NEXT_CRONFILE:
     if ((cfile = cfile->next) == gclist) break;
   }
+  for (i = TT.heaplen/2; i--;) heap_down(i);
+  if (TT.flagd) loginfo(LOG_LEVEL5, "%d jobs queued", TT.heaplen);
 }
 
-// Identify jobs, which needs to be started at the given time interval.
-static void schedule_jobs(time_t ctime, time_t ptime)
+// Start everything due by NOW and requeue it for next time.
+static void run_due_jobs(time_t now)
 {
-  time_t tm = ptime-ptime%60;
-
-  for (; tm <= ctime; tm += 60) {
-    struct tm *lt;
-    CRONFILE *cfile = gclist;
-    JOB *job, *jstart;
-
-    if (tm <= ptime) continue;
-    lt = localtime(&tm);
-
-    while (cfile) {
-      if (TT.flagd) loginfo(LOG_LEVEL5, "file %s:", cfile->username);
-      if (cfile->invalid) goto NEXT_CRONFILE;
-      job = jstart = (JOB *)cfile->job;
-
-      while (job) {
-        if (TT.flagd) loginfo(LOG_LEVEL5, " line %s", job->cmd);
-
-        if (job->min[lt->tm_min] && job->hour[lt->tm_hour]
-            && (job->dom[lt->tm_mday] || job->dow[lt->tm_wday])
-            && job->mon[lt->tm_mon-1]) {
-          if (TT.flagd)
-            loginfo(LOG_LEVEL5, " job: %d %s\n", (int)job->pid, job->cmd);
-          if (job->pid > 0) {
-            loginfo(LOG_LEVEL8, "user %s: process already running: %s",
-                cfile->username, job->cmd);
-          } else if (!job->pid) {
-            job->pid = -1;
-            job->needstart = 1;
-            job->isrunning = 0;
-          }
-        }
-        if ((job = job->next) == jstart) break;
-      }
-NEXT_CRONFILE:
-      if ((cfile = cfile->next) == gclist) break;
+  while (TT.heaplen && TT.heap[0]->due <= now) {
+    JOB *job = TT.heap[0];
+
+    if (TT.flagd) loginfo(LOG_LEVEL5, " job: %d %s", (int)job->pid, job->cmd);
+    start_job(job);
+    if (!(job->due = next_due(job, now))) TT.heap[0] = TT.heap[--TT.heaplen];
+    if (TT.heaplen) heap_down(0);
+  }
+}
+
+// time() can lag the timerfd that just woke us by a tick, which would spin
+// until it catches up, so read the clock itself.
+static time_t crond_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return ts.tv_sec;
+}
+
+static void rescan(time_t now)
+{
+  scan_cronfiles();
+  queue_jobs(now, 1);
+}
+
+// Sleep until the next job is due, a child exits, or (Linux) a crontab
+// changes or somebody sets the clock. Elsewhere, check the directory
+// mtime once a minute like we used to.
+static void wait_for_jobs(time_t now)
+{
+  struct pollfd pfd[3];
+  long long timeout = -1;
+  int n = 0;
+
+  if (TT.heaplen) timeout = TT.heap[0]->due > now
+    ? (TT.heap[0]->due-now)*1000LL : 0;
+#ifdef __linux__
+  if (TT.tfd != -1) {
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = TT.heaplen ? TT.heap[0]->due : 0;
+    if (!timerfd_settime(TT.tfd, TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET,
+        &its, NULL)) timeout = -1;
+    pfd[n].fd = TT.tfd;
+    pfd[n++].events = POLLIN;
+  }
+  if (TT.ifd != -1) {
+    pfd[n].fd = TT.ifd;
+    pfd[n++].events = POLLIN;
+  }
+#endif
+  if ((TT.tfd == -1 || TT.ifd == -1) && (timeout < 0 || timeout > 60000))
+    timeout = 60000;
+  pfd[n].fd = TT.sigpipe[0];
+  pfd[n++].events = POLLIN;
+
+  if (poll(pfd, n, timeout) <= 0) return;
+  while (n--) {
+    if (!pfd[n].revents) continue;
+    if (pfd[n].fd == TT.sigpipe[0]) {
+      while (read(TT.sigpipe[0], toybuf, sizeof(toybuf)) > 0);
+      reap_jobs();
+    } else if (pfd[n].fd == TT.ifd) {
+      while (read(TT.ifd, toybuf, sizeof(toybuf)) > 0);
+      rescan(crond_time());
+    } else {
+      // Due, or ECANCELED because the clock was set: either way the caller
+      // looks at the time next.
+      if (read(TT.tfd, toybuf, 8) < 0 && TT.flagd)
+        loginfo(LOG_LEVEL5, "clock was set");
     }
   }
 }
 
 void crond_main(void)
 {
-  time_t ctime, ptime;
-  int sleepfor = 60;
+  time_t now, last;
+  unsigned long long mono;
   struct stat sb;
 
   TT.flagd = (toys.optflags & FLAG_d);
@@ -650,32 +788,54 @@ void crond_main(void)
   xchdir(TT.crontabs_dir);
   loginfo(LOG_LEVEL8, "crond started, log level %d", TT.loglevel);
 
+  // Children exiting, crontabs changing and the clock being set all wake
+  // the poll() up, so there's no need to check anything once a minute.
+  if (pipe(TT.sigpipe)) perror_exit("pipe");
+  fcntl(TT.sigpipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(TT.sigpipe[1], F_SETFL, O_NONBLOCK);
+  toys.signalfd = TT.sigpipe[1];
+  signal(SIGCHLD, generic_signal);
+  TT.ifd = TT.tfd = -1;
+#ifdef __linux__
+  if (-1 != (TT.ifd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC))
+      && -1 == inotify_add_watch(TT.ifd, TT.crontabs_dir, IN_CREATE|IN_DELETE
+        |IN_CLOSE_WRITE|IN_MOVED_FROM|IN_MOVED_TO|IN_ATTRIB
+        |IN_DELETE_SELF|IN_MOVE_SELF)) {
+    close(TT.ifd);
+    TT.ifd = -1;
+  }
+  TT.tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+#endif
+
   if (stat(TT.crontabs_dir, &sb)) sb.st_mtime = 0;
   TT.crontabs_dir_mtime = sb.st_mtime;
-  scan_cronfiles();
-  ctime = time(NULL);
+  rescan(last = crond_time());
+  mono = millitime();
 
-  while (1) {
+  for (;;) {
     long tdiff;
 
-    ptime = ctime;
-    sleep(sleepfor - (ptime%sleepfor) +1);
-    tdiff =(long) ((ctime = time(NULL)) - ptime);
+    wait_for_jobs(last);
+
+    // How far the clock moved apart from the time that actually passed.
+    now = crond_time();
+    tdiff = now-last-(long)((millitime()-mono)/1000);
+    last = now;
+    mono = millitime();
 
-    if (stat(TT.crontabs_dir, &sb)) sb.st_mtime = 0;
-    if (TT.crontabs_dir_mtime != sb.st_mtime) {
-      TT.crontabs_dir_mtime = sb.st_mtime;
-      scan_cronfiles();
+    if (TT.ifd == -1) {
+      if (stat(TT.crontabs_dir, &sb)) sb.st_mtime = 0;
+      if (TT.crontabs_dir_mtime != sb.st_mtime) {
+        TT.crontabs_dir_mtime = sb.st_mtime;
+        rescan(now);
+      }
     }
 
-    if (TT.flagd) loginfo(LOG_LEVEL5, "wakeup diff=%ld\n", tdiff);
-    if (tdiff < -60 * 60 || tdiff > 60 * 60)
+    if (TT.flagd) loginfo(LOG_LEVEL5, "wakeup diff=%ld", tdiff);
+    if (tdiff < -60 * 60 || tdiff > 60 * 60) {
       loginfo(LOG_LEVEL9, "time disparity of %ld minutes detected", tdiff / 60);
-    else if (tdiff > 0) {
-      schedule_jobs(ctime, ptime);
-      execute_jobs();
-      if (count_running_jobs()) sleepfor = 10;
-      else sleepfor = 60;
-    }
+      queue_jobs(now, 1);
+    } else if (tdiff < -59) queue_jobs(now, 0);
+    run_due_jobs(now);
   }
 }
@@ -11,7 +11,8 @@ config DD
   default n
     help
     usage: dd [if=FILE] [of=FILE] [ibs=N] [obs=N] [bs=N] [count=N] [skip=N]
-            [seek=N] [conv=notrunc|noerror|sync|fsync]
+            [seek=N] [conv=notrunc|noerror|sync|fsync|sparse] [iflag=direct]
+            [oflag=direct] [status=none|noxfer|progress]
 
     Options:
     if=FILE   Read from FILE instead of stdin
@@ -26,6 +27,12 @@ config DD
     conv=noerror  Continue after read errors
     conv=sync     Pad blocks with zeros
     conv=fsync    Physically write data out before finishing
+    conv=sparse   Seek over output blocks of zeros, leaving holes
+    iflag=direct  Read with O_DIRECT, bypassing the page cache
+    oflag=direct  Write with O_DIRECT, bypassing the page cache
+    status=none     Don't print the summary
+    status=noxfer   Print only the record counts
+    status=progress Show bytes copied and throughput once a second
 
     Numbers may be suffixed by c (x1), w (x2), b (x512), kD (x1000), k (x1024),
     MD (x1000000), M (x1048576), GD (x1000000000) or G (x1073741824)
@@ -50,6 +57,15 @@ GLOBALS(
 #define C_FSYNC   0x0200
 #define C_NOERROR 0x0400
 #define C_NOTRUNC 0x0800
+#define C_IFLAG   0x1000
+#define C_OFLAG   0x2000
+#define C_STATUS  0x4000
+#define C_IDIRECT 0x8000
+#define C_ODIRECT 0x10000
+#define C_NONE    0x20000
+#define C_NOXFER  0x40000
+#define C_PROGRESS 0x80000
+#define C_SPARSE  0x100000
 
 struct io {
   char *name;
@@ -57,11 +73,14 @@ struct io {
   unsigned char *buff, *bp;
   long sz, count;
   unsigned long long offset;
+  off_t pos, data, hole, size;
 };
 
 struct iostat {
   unsigned long long in_full, in_part, out_full, out_part, bytes;
   struct timeval start;
+  long shown;
+  unsigned status;
 };
 
 struct pair {
@@ -80,9 +99,24 @@ static struct pair clist[] = {
   { "fsync",    C_FSYNC },
   { "noerror",  C_NOERROR },
   { "notrunc",  C_NOTRUNC },
+  { "sparse",   C_SPARSE },
   { "sync",     C_SYNC },
 };
 
+static struct pair iflist[] = {
+  { "direct",   C_IDIRECT },
+};
+
+static struct pair oflist[] = {
+  { "direct",   C_ODIRECT },
+};
+
+static struct pair slist[] = {
+  { "none",     C_NONE },
+  { "noxfer",   C_NOXFER },
+  { "progress", C_PROGRESS },
+};
+
 static struct pair operands[] = {
   // keep the array sorted by name, bsearch() can be used.
   { "bs",    C_BS   },
@@ -90,12 +124,43 @@ static struct pair operands[] = {
   { "count", C_COUNT},
   { "ibs",   C_IBS  },
   { "if",    C_IF   },
+  { "iflag", C_IFLAG},
   { "obs",   C_OBS  },
   { "of",    C_OF   },
+  { "oflag", C_OFLAG},
   { "seek",  C_SEEK },
   { "skip",  C_SKIP },
+  { "status",C_STATUS},
+};
+
+// Output goes through two buffers: while the writer (a thread when we have
+// them) drains one, the read loop fills the other, so a slow source and a
+// slow sink each stay busy instead of taking turns. A buffer holds up to
+// DD_BATCH of output blocks so small blocks don't hand off one at a time.
+// The writer only touches its job; the main thread folds the job's counts
+// into st once it's done.
+#define DD_BATCH (1<<20)
+
+struct dd_job {
+  unsigned char *buf;
+  long len, blk, tail;
+  unsigned long long full, part, bytes;
+  int err;
 };
 
+static struct {
+  unsigned char *buf[2];
+  long size;
+  int sparse;
+  struct dd_job job;
+#if CFG_TOYBOX_THREADS
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int started, busy, done;
+#endif
+} wr;
+
 static struct io in, out;
 static struct iostat st;
 static unsigned long long c_count;
@@ -122,23 +187,46 @@ static unsigned long long strsuftoll(char* arg, int def, unsigned long long max)
   return result;
 }
 
-static void summary()
+static double elapsed(void)
 {
-  double seconds = 5.0;
   struct timeval now;
 
   gettimeofday(&now, NULL);
-  seconds = ((now.tv_sec * 1000000 + now.tv_usec) - (st.start.tv_sec * 1000000
+  return ((now.tv_sec * 1000000 + now.tv_usec) - (st.start.tv_sec * 1000000
         + st.start.tv_usec))/1000000.0;
+}
+
+static void summary()
+{
+  double seconds = elapsed();
+
+  if (st.status & C_NONE) return;
+  if (st.shown) fputc('\n', stderr);
+  st.shown = 0;
   //out to STDERR
   fprintf(stderr,"%llu+%llu records in\n%llu+%llu records out\n", st.in_full, st.in_part,
       st.out_full, st.out_part);
+  if (st.status & C_NOXFER) return;
   human_readable(toybuf, st.bytes, HR_SPACE|HR_B);
   fprintf(stderr, "%llu bytes (%s) copied, ",st.bytes, toybuf);
   human_readable(toybuf, st.bytes/seconds, HR_SPACE|HR_B);
   fprintf(stderr, "%f s, %s/s\n", seconds, toybuf);
 }
 
+// status=progress: rewrite one line on stderr about once a second.
+static void progress(void)
+{
+  double seconds = elapsed();
+
+  if (seconds < st.shown + 1) return;
+  st.shown = seconds;
+  human_readable(toybuf, st.bytes, HR_SPACE|HR_B);
+  fprintf(stderr, "\r%llu bytes (%s) copied, %ld s, ", st.bytes, toybuf,
+    st.shown);
+  human_readable(toybuf, st.bytes/seconds, HR_SPACE|HR_B);
+  fprintf(stderr, "%s/s    ", toybuf);
+}
+
 static void sig_handler(int sig)
 {
   TT.sig = sig;
@@ -154,6 +242,28 @@ static int xmove_fd(int fd)
   return newfd;
 }
 
+// O_DIRECT wants buffers aligned to the logical block size, which is never
+// bigger than a page.
+static unsigned char *dd_alloc(long size)
+{
+  void *p;
+
+  if (posix_memalign(&p, 4096, size)) error_exit("xmalloc");
+
+  return p;
+}
+
+// Direct I/O has to be block aligned, which a short read or the last
+// partial block usually isn't. Go through the page cache from then on.
+static int undirect(int fd)
+{
+  int fl = fcntl(fd, F_GETFL);
+
+  if (fl == -1 || !(fl & O_DIRECT)) return 0;
+
+  return !fcntl(fd, F_SETFL, fl & ~O_DIRECT);
+}
+
 static void setup_inout()
 {
   ssize_t n;
@@ -161,23 +271,34 @@ static void setup_inout()
   /* for C_BS, in/out is done as it is. so only in.sz is enough.
    * With Single buffer there will be overflow in a read following partial read
    */
-  in.buff = out.buff = xmalloc(in.sz + ((toys.optflags & C_BS)? 0: out.sz));
-  in.bp = out.bp = in.buff;
+  wr.size = in.sz + ((toys.optflags & C_BS)? 0: out.sz);
+  wr.sparse = toys.optflags & C_SPARSE;
+  if (wr.size < DD_BATCH) wr.size = DD_BATCH;
+  for (n = 0; n < 2; n++) wr.buf[n] = dd_alloc(wr.size);
+  in.buff = in.bp = wr.buf[0];
+  // toys is gone by the time atexit() runs
+  st.status = toys.optflags & (C_NONE|C_NOXFER);
   atexit(summary);
   //setup input
   if (!in.name) {
     in.name = "stdin";
     in.fd = STDIN_FILENO;
+    if (toys.optflags & C_IDIRECT)
+      fcntl(in.fd, F_SETFL, fcntl(in.fd, F_GETFL) | O_DIRECT);
   } else {
-    in.fd = xopen(in.name, O_RDONLY);
+    in.fd = xopen(in.name, O_RDONLY
+      | ((toys.optflags & C_IDIRECT) ? O_DIRECT : 0));
     in.fd = xmove_fd(in.fd);
   }
   //setup outout
   if (!out.name) {
     out.name = "stdout";
     out.fd = STDOUT_FILENO;
+    if (toys.optflags & C_ODIRECT)
+      fcntl(out.fd, F_SETFL, fcntl(out.fd, F_GETFL) | O_DIRECT);
   } else {
-    out.fd = xcreate(out.name, O_WRONLY | O_CREAT, 0666);
+    out.fd = xcreate(out.name, O_WRONLY | O_CREAT
+      | ((toys.optflags & C_ODIRECT) ? O_DIRECT : 0), 0666);
     out.fd = xmove_fd(out.fd);
   }
 
@@ -198,24 +319,160 @@ static void setup_inout()
   }
 
   if (out.offset) xlseek(out.fd, (off_t)(out.offset * out.sz), SEEK_CUR);
+
+  // With conv=sparse the holes in a regular input file needn't be read
+  // either: they're known to be zeros.
+  in.size = -1;
+  if (toys.optflags & C_SPARSE) {
+    struct stat sb;
+
+    if (!fstat(in.fd, &sb) && S_ISREG(sb.st_mode)
+        && -1 != (in.pos = lseek(in.fd, 0, SEEK_CUR)))
+      in.size = sb.st_size;
+    in.hole = in.pos;
+  }
+}
+
+// Read a block, or if it lies entirely in a hole in the input, seek past it
+// and make it zeros.
+static ssize_t read_block(void)
+{
+  ssize_t n;
+
+  if (in.size == -1) return read(in.fd, in.bp, in.sz);
+  if (in.pos >= in.hole)
+    in.data = lseek_data(in.fd, in.pos, in.size, &in.hole);
+  if (in.pos + in.sz <= in.data && -1 != lseek(in.fd, in.sz, SEEK_CUR)) {
+    memset(in.bp, 0, in.sz);
+    n = in.sz;
+  } else n = read(in.fd, in.bp, in.sz);
+  if (n > 0) in.pos += n;
+
+  return n;
 }
 
-static void write_out(int all)
+// Write len bytes blk at a time then tail bytes in one go, counting full
+// and partial records. With conv=sparse a block of zeros is seeked over
+// instead, if the output can seek.
+static void write_job(struct dd_job *job)
 {
+  long pos, len;
   ssize_t nw;
-  out.bp = out.buff;
-  while (out.count) {
-    nw = writeall(out.fd, out.bp, ((all)? out.count : out.sz));
-    all = 0; //further writes will be on obs
-    if (nw <= 0) perror_exit("%s: write error",out.name);
-    if (nw == out.sz) st.out_full++;
-    else st.out_part++;
-    out.count -= nw;
-    out.bp += nw;
-    st.bytes += nw;
-    if (out.count < out.sz) break;
+
+  for (pos = 0; pos < job->len + job->tail; pos += nw) {
+    len = (pos < job->len) ? job->blk : job->tail;
+    if (wr.sparse && allzero((char *)job->buf + pos, len)
+        && -1 != lseek(out.fd, len, SEEK_CUR)) nw = len;
+    else nw = writeall(out.fd, job->buf + pos, len);
+    if (nw < 0 && errno == EINVAL && undirect(out.fd))
+      nw = writeall(out.fd, job->buf + pos, len);
+    if (nw <= 0) {
+      job->err = nw ? errno : EIO;
+      break;
+    }
+    if (nw == out.sz) job->full++;
+    else job->part++;
+    job->bytes += nw;
+  }
+}
+
+#if CFG_TOYBOX_THREADS
+static void *dd_writer(void *arg)
+{
+  pthread_mutex_lock(&wr.lock);
+  for (;;) {
+    while (!wr.busy && !wr.done) pthread_cond_wait(&wr.cond, &wr.lock);
+    if (!wr.busy) break;
+    pthread_mutex_unlock(&wr.lock);
+    if (!wr.job.err) write_job(&wr.job);
+    pthread_mutex_lock(&wr.lock);
+    wr.busy = 0;
+    pthread_cond_broadcast(&wr.cond);
+  }
+  pthread_mutex_unlock(&wr.lock);
+
+  return 0;
+}
+#endif
+
+// Wait for the writer to be done with the last buffer it was given.
+static void write_wait(void)
+{
+#if CFG_TOYBOX_THREADS
+  if (wr.started) {
+    pthread_mutex_lock(&wr.lock);
+    while (wr.busy) pthread_cond_wait(&wr.cond, &wr.lock);
+    pthread_mutex_unlock(&wr.lock);
+  }
+#endif
+  st.out_full += wr.job.full;
+  st.out_part += wr.job.part;
+  st.bytes += wr.job.bytes;
+  wr.job.full = wr.job.part = wr.job.bytes = 0;
+  if (wr.job.err) {
+    errno = wr.job.err;
+    perror_exit("%s: write error", out.name);
+  }
+}
+
+// Hand the first len+tail bytes of in.buff to the writer and carry what's
+// left over to the start of the other buffer, which becomes in.buff.
+static void write_out(long len, long blk, long tail)
+{
+  unsigned char *next = wr.buf[in.buff == wr.buf[0]];
+
+  write_wait();
+  in.count -= len + tail;
+  memcpy(next, in.buff + len + tail, in.count);
+  wr.job.buf = in.buff;
+  wr.job.len = len;
+  wr.job.blk = blk;
+  wr.job.tail = tail;
+  in.buff = next;
+#if CFG_TOYBOX_THREADS
+  if (wr.started) {
+    pthread_mutex_lock(&wr.lock);
+    wr.busy = 1;
+    pthread_cond_broadcast(&wr.cond);
+    pthread_mutex_unlock(&wr.lock);
+    return;
   }
-  if (out.count) memmove(out.buff, out.bp, out.count); //move remainder to front
+#endif
+  write_job(&wr.job);
+}
+
+static void writer_start(void)
+{
+#if CFG_TOYBOX_THREADS
+  pthread_attr_t attr;
+  sigset_t all, old;
+
+  // Signals belong to the main thread, TT.sig is per thread.
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_mutex_init(&wr.lock, 0);
+  pthread_cond_init(&wr.cond, 0);
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+  wr.started = !toy_worker_create(&wr.tid, &attr, dd_writer, 0);
+  pthread_attr_destroy(&attr);
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+#endif
+}
+
+static void writer_stop(void)
+{
+  write_wait();
+#if CFG_TOYBOX_THREADS
+  if (wr.started) {
+    pthread_mutex_lock(&wr.lock);
+    wr.done = 1;
+    pthread_cond_broadcast(&wr.cond);
+    pthread_mutex_unlock(&wr.lock);
+    pthread_join(wr.tid, 0);
+    wr.started = 0;
+  }
+#endif
 }
 
 static void do_dd(void)
@@ -232,22 +489,25 @@ static void do_dd(void)
 
   if (toys.optflags & (C_OF | C_SEEK) && !(toys.optflags & C_NOTRUNC))
     ftruncate(out.fd, (off_t)out.offset * out.sz);
+  writer_start();
 
   while (!(toys.optflags & C_COUNT) || (st.in_full + st.in_part) < c_count) {
     if (TT.sig == SIGUSR1) {
       summary();
       TT.sig = 0;
     } else if (TT.sig == SIGINT) exit(TT.sig | 128);
+    if (toys.optflags & C_PROGRESS) progress();
     in.bp = in.buff + in.count;
     if (toys.optflags & C_SYNC) memset(in.bp, 0, in.sz);
-    if (!(n = read(in.fd, in.bp, in.sz))) break;
+    if (!(n = read_block())) break;
     if (n < 0) { 
-      if (errno == EINTR) continue;
+      if (errno == EINTR || (errno == EINVAL && undirect(in.fd))) continue;
       //read error case.
       perror_msg("%s: read error", in.name);
       if (!(toys.optflags & C_NOERROR)) exit(1);
       summary();
       xlseek(in.fd, in.sz, SEEK_CUR);
+      in.pos += in.sz;
       if (!(toys.optflags & C_SYNC)) continue;
       // if SYNC, then treat as full block of nuls
       n = in.sz;
@@ -261,25 +521,37 @@ static void do_dd(void)
       else in.count += n;
     }
 
-    out.count = in.count;
+    // Pass the buffer on when it's full, or after a short read since more
+    // input might take a while and what we have should go out meanwhile.
+    // bs= writes each input block as is, else whole obs= blocks.
     if (toys.optflags & C_BS) {
-      write_out(1);
-      in.count = 0;
-      continue;
-    }
-
-    if (in.count >= out.sz) {
-      write_out(0);
-      in.count = out.count;
-    }
+      if (n < in.sz) {
+        n = (toys.optflags & C_SYNC) ? in.sz : n;
+        write_out(in.count - n, in.sz, n);
+      } else if (in.count + in.sz > wr.size) write_out(in.count, in.sz, 0);
+    } else if ((n < in.sz || in.count + in.sz > wr.size) && in.count >= out.sz)
+      write_out(in.count - in.count % out.sz, out.sz, 0);
+  }
+  //write any remaining input blocks
+  if (in.count)
+    write_out(in.count - in.count % out.sz, out.sz, in.count % out.sz);
+  writer_stop();
+  // A hole at the end is only there if the file is long enough to hold it.
+  if (toys.optflags & C_SPARSE) {
+    struct stat sb;
+    off_t end = lseek(out.fd, 0, SEEK_CUR);
+
+    if (end != -1 && !fstat(out.fd, &sb) && S_ISREG(sb.st_mode)
+        && sb.st_size < end && ftruncate(out.fd, end))
+      perror_exit("%s: truncate", out.name);
   }
-  if (out.count) write_out(1); //write any remaining input blocks
   if (toys.optflags & C_FSYNC && fsync(out.fd) < 0) 
     perror_exit("%s: fsync fail", out.name);
 
   close(in.fd);
   close(out.fd);
-  if (in.buff) free(in.buff);
+  free(wr.buf[0]);
+  free(wr.buf[1]);
 }
 
 static int comp(const void *a, const void *b) //const to shut compiler up
@@ -287,18 +559,37 @@ static int comp(const void *a, const void *b) //const to shut compiler up
   return strcmp(((struct pair*)a)->name, ((struct pair*)b)->name);
 }
 
+static void set_flags(char *arg, struct pair *list, int len, char *what)
+{
+  struct pair *res, key;
+
+  while (arg) {
+    key.name = strsep(&arg, ",");
+    if (!(res = bsearch(&key, list, len, sizeof(struct pair), comp)))
+      error_exit("unknown %s %s", what, key.name);
+
+    toys.optflags |= res->val;
+  }
+}
+
 void dd_main()
 {
   struct pair *res, key;
-  char *arg;
+  char *arg, **args = toys.optargs;
   long sz;
 
+  // The shell can run us again in the same process, so start clean.
+  memset(&in, 0, sizeof(in));
+  memset(&out, 0, sizeof(out));
+  memset(&st, 0, sizeof(st));
+  memset(&wr, 0, sizeof(wr));
+  c_count = 0;
   in.sz = out.sz = 512; //default io block size
-  while (*toys.optargs) {
-    if (!(arg = strchr(*toys.optargs, '='))) error_exit("unknown arg %s", *toys.optargs);
+  while (*args) {
+    if (!(arg = strchr(*args, '='))) error_exit("unknown arg %s", *args);
     *arg++ = '\0';
     if (!*arg) help_exit(0);
-    key.name = *toys.optargs;
+    key.name = *args;
     if (!(res = bsearch(&key, operands, ARRAY_LEN(operands), sizeof(struct pair),
             comp))) error_exit("unknown arg %s", key.name);
 
@@ -331,17 +622,19 @@ void dd_main()
         in.offset = strsuftoll(arg, 0, ULLONG_MAX);
         break;
       case C_CONV:
-        while (arg) {
-          key.name = strsep(&arg, ",");
-          if (!(res = bsearch(&key, clist, ARRAY_LEN(clist), 
-                  sizeof(struct pair), comp)))
-            error_exit("unknown conversion %s", key.name);
-
-          toys.optflags |= res->val;
-        }            
+        set_flags(arg, clist, ARRAY_LEN(clist), "conversion");
+        break;
+      case C_IFLAG:
+        set_flags(arg, iflist, ARRAY_LEN(iflist), "iflag");
+        break;
+      case C_OFLAG:
+        set_flags(arg, oflist, ARRAY_LEN(oflist), "oflag");
+        break;
+      case C_STATUS:
+        set_flags(arg, slist, ARRAY_LEN(slist), "status");
         break;
     }
-    toys.optargs++;
+    args++;
   }
 
   do_dd();
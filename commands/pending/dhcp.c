@@ -4,14 +4,15 @@
  * Copyright 2013 Kyungwan Han <asura321@gmail.com>
  *
  * Not in SUSv4.
-USE_DHCP(NEWTOY(dhcp, "V:H:F:x*r:O*A#<0T#<0t#<0s:p:i:SBRCaovqnbf", TOYFLAG_SBIN|TOYFLAG_ROOTONLY))
+USE_DHCP(NEWTOY(dhcp, "(no-wait-offer)l:V:H:F:x*r:O*A#<0T#<0t#<0s:p:i:SBRCaovqnbf", TOYFLAG_SBIN|TOYFLAG_ROOTONLY))
 
 config DHCP
   bool "dhcp"
   default n
   help
    usage: dhcp [-fbnqvoCRB] [-i IFACE] [-r IP] [-s PROG] [-p PIDFILE]
-               [-H HOSTNAME] [-V VENDOR] [-x OPT:VAL] [-O OPT]
+               [-H HOSTNAME] [-V VENDOR] [-x OPT:VAL] [-O OPT] [-l FILE]
+               [--no-wait-offer]
 
         Configure network dynamicaly using DHCP.
 
@@ -38,6 +39,9 @@ config DHCP
       -V VENDOR Vendor identifier (default 'toybox VERSION')
       -C Don't send MAC as client identifier
       -v Verbose
+      -l Keep the lease in FILE, and at startup ask for it again first
+      --no-wait-offer  Ask servers to answer a discover with an ACK directly
+                       (rapid commit) rather than an offer
 
       Signals:
       USR1  Renew current lease
@@ -69,6 +73,7 @@ GLOBALS(
     char *fdn_name;
     char *hostname;
     char *vendor_cls;
+    char *lease_file;
 )
 
 #define flag_get(f,v,d) ((toys.optflags & f) ? v : d)
@@ -81,6 +86,7 @@ GLOBALS(
 #define STATE_REBINDING       4
 #define STATE_RENEW_REQUESTED 5
 #define STATE_RELEASED        6
+#define STATE_REBOOTING       7
 
 #define BOOTP_BROADCAST   0x8000
 #define DHCP_MAGIC        0x63825363
@@ -115,6 +121,7 @@ GLOBALS(
 #define DHCP_OPTION_CLIENTID    0x3D
 #define DHCP_OPTION_VENDOR      0x3C
 #define DHCP_OPTION_FQDN        0x51
+#define DHCP_OPTION_RAPID       0x50
 #define DHCP_OPTION_END         0xFF
 
 #define DHCP_NUM8           (1<<8)
@@ -1018,13 +1025,18 @@ static int dhcpc_sendmsg(int msgtype)
     if (flag_chk(FLAG_F)) pend = dhcpc_addfdnname(pend, TT.fdn_name);
     if ((!flag_chk(FLAG_o)) || flag_chk(FLAG_O)) pend = dhcpc_addreqoptions(pend);
     if (flag_chk(FLAG_x)) pend = set_xopt(pend);
+    if (flag_chk(FLAG_no_wait_offer)) {
+      *pend++ = DHCP_OPTION_RAPID;
+      *pend++ = 0;
+    }
     break;
   case DHCPREQUEST: // Send REQUEST message to the server that sent the *first* OFFER
     state->pdhcp.flags = htons(BOOTP_BROADCAST); //  Broadcast bit.
     if (state->status == STATE_RENEWING) memcpy(&state->pdhcp.ciaddr, &state->ipaddr.s_addr, 4);
     pend = dhcpc_addmaxsize(pend, htons(sizeof(dhcp_raw_t)));
+    // INIT-REBOOT asks whichever server is there for the old address.
     rqsd.s_addr = htonl(server);
-    pend = dhcpc_addserverid(&rqsd, pend);
+    if (state->status != STATE_REBOOTING) pend = dhcpc_addserverid(&rqsd, pend);
     pend = dhcpc_addreqipaddr(&state->ipaddr, pend);
     vendor = flag_get(FLAG_V, TT.vendor_cls, "toybox\0");
     pend = dhcpc_addstropt(pend, DHCP_OPTION_VENDOR, vendor, strlen(vendor));
@@ -1068,7 +1080,7 @@ static uint8_t dhcpc_parseoptions(dhcpc_result_t *presult, uint8_t *optptr)
         msgopt_list[count].len = 0;
       }
     } else {
-     msgopt_list = xmalloc(sizeof(options_list));
+     msgopt_list = xkeep(xmalloc(sizeof(options_list)));
      memcpy(msgopt_list, options_list, sizeof(options_list));
      for (count = 0; count < size; count++) {
          msgopt_list[count].len = 0;
@@ -1241,6 +1253,7 @@ static void release(void)
     temp_addr.s_addr = state->ipaddr.s_addr;
     infomsg( infomode, "Unicasting a release of %s to %s", inet_ntoa(temp_addr), buffer);
     dhcpc_sendmsg(DHCPRELEASE);
+    if (TT.lease_file) unlink(TT.lease_file);
     run_script(NULL, "deconfig");
   }
   infomsg(infomode, "Entering released state");
@@ -1250,6 +1263,43 @@ static void release(void)
   state->status = STATE_RELEASED;
 }
 
+// -l: remember the lease we were given, as "ip ADDR", "server ADDR" and
+// "expires SECONDS" lines, in a new file renamed over the old one.
+static void lease_save(dhcpc_result_t *res)
+{
+  struct in_addr addr;
+  char *tmp;
+  int fd;
+
+  if (!TT.lease_file) return;
+  tmp = xmprintf("%s.tmp", TT.lease_file);
+  if (-1 != (fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644))) {
+    addr.s_addr = htonl(res->ipaddr.s_addr);
+    dprintf(fd, "ip %s\n", inet_ntoa(addr));
+    addr.s_addr = htonl(res->serverid.s_addr);
+    dprintf(fd, "server %s\nexpires %lld\n", inet_ntoa(addr),
+      (long long)time(NULL)+res->lease_time);
+    if (fsync(fd) || close(fd) || rename(tmp, TT.lease_file))
+      perror_msg("%s", TT.lease_file);
+  } else perror_msg("%s", tmp);
+  free(tmp);
+}
+
+// Read back an unexpired lease into state->ipaddr, returns 0 if none.
+static int lease_load(void)
+{
+  char *data, *s;
+  long long expires = 0;
+
+  if (!TT.lease_file || !(data = readfile(TT.lease_file, 0, 0))) return 0;
+  if ((s = strstr(data, "expires "))) expires = atoll(s+8);
+  if (!(s = strstr(data, "ip ")) || !inet_aton(s+3, &state->ipaddr)
+    || expires <= time(NULL)) state->ipaddr.s_addr = 0;
+  free(data);
+
+  return !!state->ipaddr.s_addr;
+}
+
 static void free_option_stores(void)
 {
   int count, size = ARRAY_LEN(options_list);
@@ -1306,6 +1356,12 @@ void dhcp_main(void)
   run_script(NULL, "deconfig");
   setup_signal();
   state->status = STATE_INIT;
+
+  // With a lease left from last time, start by asking for it again.
+  if (lease_load()) {
+    state->status = STATE_REBOOTING;
+    xid = getxid();
+  }
   mode_raw();
   fcntl(state->sockfd, F_SETFD, FD_CLOEXEC);
 
@@ -1375,6 +1431,24 @@ lease_fail:
         mode_raw();
         state->status = STATE_INIT;
         goto lease_fail;
+      case STATE_REBOOTING:
+        // A server that knows us answers quickly, so wait a second for it
+        // twice, then go find one the long way.
+        if (packets < 2) {
+          infomsg(infomode, "Sending request for %s...",
+            inet_ntoa(state->ipaddr));
+          dhcpc_sendmsg(DHCPREQUEST);
+          timeout = 1;
+          waited = 0;
+          packets++;
+          continue;
+        }
+        state->status = STATE_INIT;
+        state->ipaddr.s_addr = 0;
+        timeout = 0;
+        waited = 0;
+        packets = 0;
+        continue;
       case STATE_BOUND:
         state->status = STATE_RENEWING;
         dbg("Entering renew state\n");
@@ -1456,7 +1530,11 @@ renew_requested:
       msgType = dhcpc_parsemsg(&result);
       if (msgType != DHCPNAK && result.ipaddr.s_addr == 0 ) continue;       // no ip for me ignore
       if (!msgType || !get_option_serverid(state->pdhcp.options, &result)) continue; //no server id ignore
-      if (msgType == DHCPOFFER && server == 0) server = result.serverid.s_addr; // select the server
+      // select the server: whoever offers first, or answers a reboot or a
+      // rapid commit discover.
+      if (!server && (msgType == DHCPOFFER || state->status == STATE_REBOOTING
+        || (msgType == DHCPACK && state->status == STATE_INIT
+          && flag_chk(FLAG_no_wait_offer)))) server = result.serverid.s_addr;
       if (result.serverid.s_addr != server) continue; // not from the server we requested ignore
       dhcpc_parseoptions(&result, state->pdhcp.options);
       get_option_lease(state->pdhcp.options, &result);
@@ -1469,15 +1547,25 @@ renew_requested:
           timeout = 0;
           waited = 0;
           packets = 0;
+          continue;
         }
-        continue;
+        // A rapid commit ACK is the lease, without the request.
+        if (msgType != DHCPACK || !flag_chk(FLAG_no_wait_offer)) continue;
+        state->status = STATE_REQUESTING;
+        // FALLTHROUGH
+      case STATE_REBOOTING:          // FALLTHROUGH
       case STATE_REQUESTING:         // FALLTHROUGH
       case STATE_RENEWING:           // FALLTHROUGH
       case STATE_RENEW_REQUESTED:    // FALLTHROUGH
       case STATE_REBINDING:
         if (msgType == DHCPACK) {
+          int new = state->status == STATE_REQUESTING
+            || state->status == STATE_REBOOTING;
+
+          memcpy(&state->ipaddr.s_addr, &state->pdhcp.yiaddr, 4);
           timeout = result.lease_time / 2;
-          run_script(&result, state->status == STATE_REQUESTING ? "bound" : "renew");
+          run_script(&result, new ? "bound" : "renew");
+          lease_save(&result);
           state->status = STATE_BOUND;
           infomsg(infomode, "Lease of %d.%d.%d.%d obtained, lease time %d from server %d.%d.%d.%d",
               (result.ipaddr.s_addr >> 24) & 0xff, (result.ipaddr.s_addr >> 16) & 0xff, (result.ipaddr.s_addr >> 8) & 0xff, (result.ipaddr.s_addr) & 0xff,
@@ -1498,9 +1586,12 @@ renew_requested:
         } else if (msgType == DHCPNAK) {
           dbg("NACK received.\n");
           run_script(&result, "nak");
-          if (state->status != STATE_REQUESTING) run_script(NULL, "deconfig");
+          if (TT.lease_file) unlink(TT.lease_file);
+          if (state->status != STATE_REQUESTING
+            && state->status != STATE_REBOOTING) run_script(NULL, "deconfig");
           mode_raw();
-          sleep(3);
+          // The old lease is gone, so go straight on to a discover.
+          if (state->status != STATE_REBOOTING) sleep(3);
           state->status = STATE_INIT;
           state->ipaddr.s_addr = 0;
           server = 0;
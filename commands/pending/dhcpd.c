@@ -5,7 +5,7 @@
  * Copyright 2015 Yeongdeok Suh <skyducks111@gmail.com>
  *
  * No Standard
-USE_DHCPD(NEWTOY(dhcpd, ">1P#<0>65535fi:S46[!46]", TOYFLAG_SBIN|TOYFLAG_ROOTONLY))
+USE_DHCPD(NEWTOY(dhcpd, ">1P#<0>65535fi:S46", TOYFLAG_SBIN|TOYFLAG_ROOTONLY))
 
 config DHCPD
   bool "dhcpd"
@@ -17,7 +17,7 @@ config DHCPD
     -i Interface to use
     -S    Log to syslog too
     -P N  Use port N (default ipv4 67, ipv6 547)
-    -4, -6    Run as a DHCPv4 or DHCPv6 server
+    -4, -6    Run as a DHCPv4 or DHCPv6 server (default -4, both to serve both)
 
 config DEBUG_DHCP
   bool "debugging messeges ON/OFF"
@@ -177,7 +177,7 @@ typedef struct __attribute__((packed)) dhcp6_raw_s {
 typedef struct static_lease_s {
   struct static_lease_s *next;
   uint32_t nip;
-  int mac[6];
+  uint8_t mac[6];
 } static_lease;
 
 typedef struct static_lease6_s {
@@ -206,6 +206,22 @@ typedef struct {
   uint8_t duid[20];
 } dyn_lease6;
 
+// A lease, dynamic or (is_static) from the config file, chained in the hash
+// tables by address and by client. Dynamic ones are on the list
+// write_leasefile() walks.
+struct lease {
+  struct lease *next, *prev, *ip_next, *id_next;
+  char is_static;
+  union {
+    dyn_lease v4;
+    dyn_lease6 v6;
+  } dl;
+};
+
+// Most addresses a pool can have, which sizes its bitmap
+#define POOL_MAX (1<<24)
+#define POOL_BITS (8*sizeof(long))
+
 typedef struct option_val_s {
   char *key;
   uint16_t code;
@@ -270,15 +286,45 @@ typedef struct __attribute__((__may_alias__)) server_config_s {
   struct static_lease *static_leases; // List of ip/mac pairs to assign static leases
 } server_config_t;
 
+// The leases of one address family: hashed by address and client, a bitmap
+// of the pool, and what's waiting to be appended to the lease file.
+struct lease_db {
+  struct lease *dleases, *statics, **byip, **byid;
+  unsigned hashsize, count;
+  unsigned long *pool, pool_size, pool_next;
+  int leasefd, dirty;
+  uint32_t lease_time, reclaim_time;
+  char *logbuf;
+  unsigned long loglen, logsize, logged;
+};
+
+// Packets read or sent at once, and how long a lease file write waits for
+// more changes to go with it (milliseconds)
+#define DHCP_BATCH 32
+#define LEASE_DELAY 1000
+
+// A received packet of either family
+typedef union {
+  dhcp_msg_t rcvd_pkt;
+  dhcp6_msg_t rcvd_pkt6;
+} dhcp_any_t;
+
+// A reply waiting to be sent, and the link address it goes to
+struct dhcp_reply {
+  union {
+    dhcp_raw_t v4;
+    dhcp6_raw_t v6;
+  } pkt;
+  struct sockaddr_ll sll;
+  int len;
+};
+
 typedef struct __attribute__((__may_alias__)) server_state_s {
   uint8_t client_nip6[16];
   uint32_t client_port;
   uint8_t rqcode;
   int listensock;
-  union {
-    dhcp_msg_t rcvd_pkt;
-    dhcp6_msg_t rcvd_pkt6;
-  } rcvd;
+  dhcp_any_t rcvd;
   uint8_t* rqopt;
   union {
     dhcp_msg_t send_pkt;
@@ -288,7 +334,11 @@ typedef struct __attribute__((__may_alias__)) server_state_s {
     static_lease *sleases;
     static_lease6 *sleases6;
   } leases;
-  struct arg_list *dleases;
+  struct lease_db db[2];
+  int listensock6, sendsock, families, nreplies;
+  struct dhcp_reply *replies;
+  dhcp_any_t *batch;
+  unsigned long long write_at;
 } server_state_t;
 
 static option_val_t options_list[] = {
@@ -331,6 +381,9 @@ static struct fd_pair sigfd;
 static int constone = 1;
 static sa_family_t addr_version = AF_INET;
 
+// The lease tables of the family being served
+#define LDB (gstate.db+(addr_version == AF_INET6))
+
 // calculate options size.
 static int dhcp_opt_size(uint8_t *optionptr)
 {
@@ -660,6 +713,7 @@ static int get_staticlease(const char *str, void *var)
 {
   struct static_lease_s *sltmp;
   char *tkmac, *tkip;
+  long byte;
   int count;
 
   if (!*str) return 0;
@@ -675,8 +729,8 @@ static int get_staticlease(const char *str, void *var)
   sltmp = xzalloc(sizeof(struct static_lease_s));
   for (count = 0; count < 6; count++, tkmac++) {
     errno = 0;
-    sltmp->mac[count] = strtol(tkmac, &tkmac, 16);
-    if (sltmp->mac[count]>255 || sltmp->mac[count]<0 || (*tkmac && *tkmac!=':') || errno) {
+    sltmp->mac[count] = byte = strtol(tkmac, &tkmac, 16);
+    if (byte>255 || byte<0 || (*tkmac && *tkmac!=':') || errno) {
       infomsg(infomode, "config : static lease : mac address wrong format");
       free(sltmp);
       return 0;
@@ -772,38 +826,44 @@ free_conf_continue:
   return 0;
 }
 
+// The v6 server ignores the config file's port.
+static uint32_t server_port(int v6)
+{
+  return (v6 && !TT.port) ? 547 : gconfig.port;
+}
+
 // opens UDP socket for listen ipv6 packets
 static int open_listensock6(void)
 {
   struct sockaddr_in6 addr6;
   struct ipv6_mreq mreq;
 
-  if (gstate.listensock > 0) close(gstate.listensock);
+  if (gstate.listensock6 > 0) close(gstate.listensock6);
 
-  dbg("Opening listen socket on *:%d %s\n", gconfig.port, gconfig.interface);
+  dbg("Opening listen socket on *:%d %s\n", server_port(1), gconfig.interface);
 
-  gstate.listensock = xsocket(PF_INET6, SOCK_DGRAM, 0);
-  setsockopt(gstate.listensock, SOL_SOCKET, SO_REUSEADDR, &constone, sizeof(constone));
-  setsockopt(gstate.listensock, IPPROTO_IPV6, IPV6_CHECKSUM, &constone, sizeof(constone));
+  gstate.listensock6 = xsocket(PF_INET6, SOCK_DGRAM, 0);
+  setsockopt(gstate.listensock6, SOL_SOCKET, SO_REUSEADDR, &constone, sizeof(constone));
+  setsockopt(gstate.listensock6, IPPROTO_IPV6, IPV6_CHECKSUM, &constone, sizeof(constone));
 
-  if (setsockopt(gstate.listensock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &constone,
+  if (setsockopt(gstate.listensock6, IPPROTO_IPV6, IPV6_RECVPKTINFO, &constone,
         sizeof(constone)) == -1) {
     error_msg("failed to receive ipv6 packets.\n");
-    close(gstate.listensock);
+    close(gstate.listensock6);
     return -1;
   }
 
-  setsockopt(gstate.listensock, SOL_SOCKET, SO_BINDTODEVICE, gconfig.interface, strlen(gconfig.interface)+1);
+  setsockopt(gstate.listensock6, SOL_SOCKET, SO_BINDTODEVICE, gconfig.interface, strlen(gconfig.interface)+1);
 
   memset(&addr6, 0, sizeof(addr6));
   addr6.sin6_family = AF_INET6;
-  addr6.sin6_port = htons(gconfig.port); //SERVER_PORT
+  addr6.sin6_port = htons(server_port(1)); //SERVER_PORT
   addr6.sin6_scope_id = if_nametoindex(gconfig.interface);
   //Listening for multicast packet
   inet_pton(AF_INET6, "ff02::1:2", &addr6.sin6_addr);
 
-  if (bind(gstate.listensock, (struct sockaddr *) &addr6, sizeof(addr6)) == -1) {
-    close(gstate.listensock);
+  if (bind(gstate.listensock6, (struct sockaddr *) &addr6, sizeof(addr6)) == -1) {
+    close(gstate.listensock6);
     perror_exit("bind failed");
   }
 
@@ -811,12 +871,13 @@ static int open_listensock6(void)
   mreq.ipv6mr_interface = if_nametoindex(gconfig.interface);
   memcpy(&mreq.ipv6mr_multiaddr, &addr6.sin6_addr, sizeof(addr6.sin6_addr));
 
-  if(setsockopt(gstate.listensock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) == -1) {
+  if(setsockopt(gstate.listensock6, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) == -1) {
     error_msg("failed to join a multicast group.\n");
-    close(gstate.listensock);
+    close(gstate.listensock6);
     return -1;
   }
 
+  fcntl(gstate.listensock6, F_SETFD, FD_CLOEXEC);
   dbg("OPEN : success\n");
   return 0;
 }
@@ -829,7 +890,7 @@ static int open_listensock(void)
 
   if (gstate.listensock > 0) close(gstate.listensock);
 
-  dbg("Opening listen socket on *:%d %s\n", gconfig.port, gconfig.interface);
+  dbg("Opening listen socket on *:%d %s\n", server_port(0), gconfig.interface);
   gstate.listensock = xsocket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
   setsockopt(gstate.listensock, SOL_SOCKET, SO_REUSEADDR, &constone, sizeof(constone));
   if (setsockopt(gstate.listensock, SOL_SOCKET, SO_BROADCAST, &constone, sizeof(constone)) == -1) {
@@ -843,48 +904,75 @@ static int open_listensock(void)
 
   memset(&addr, 0, sizeof(addr));
   addr.sin_family = AF_INET;
-  addr.sin_port = htons(gconfig.port); //SERVER_PORT
+  addr.sin_port = htons(server_port(0)); //SERVER_PORT
   addr.sin_addr.s_addr = INADDR_ANY ;
 
   if (bind(gstate.listensock, (struct sockaddr *) &addr, sizeof(addr))) {
     close(gstate.listensock);
     perror_exit("bind failed");
   }
+  fcntl(gstate.listensock, F_SETFD, FD_CLOEXEC);
   dbg("OPEN : success\n");
   return 0;
 }
 
+// Send the queued replies, one sendmmsg() for the lot.
+static void flush_replies(void)
+{
+  struct mmsghdr msgs[DHCP_BATCH];
+  struct iovec iov[DHCP_BATCH];
+  int i, n;
+
+  for (i = 0; i<gstate.nreplies; i++) {
+    iov[i].iov_base = &gstate.replies[i].pkt;
+    iov[i].iov_len = gstate.replies[i].len;
+    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+    msgs[i].msg_hdr.msg_name = &gstate.replies[i].sll;
+    msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+    msgs[i].msg_hdr.msg_iov = iov+i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  for (i = 0; i<gstate.nreplies; i += n) {
+    if (0>(n = sendmmsg(gstate.sendsock, msgs+i, gstate.nreplies-i, 0))) {
+      dbg("PACKET send error\n");
+      // Skip the one that failed.
+      n = errno != EINTR;
+    }
+  }
+  gstate.nreplies = 0;
+}
+
+// Queue a reply, sending the ones before it if they fill the batch.
+static struct dhcp_reply *queue_reply(uint16_t proto, uint8_t *mac)
+{
+  struct dhcp_reply *r;
+
+  if (gstate.nreplies == DHCP_BATCH) flush_replies();
+  r = gstate.replies+gstate.nreplies++;
+  memset(r, 0, sizeof(*r));
+  r->sll.sll_family = AF_PACKET;
+  r->sll.sll_protocol = htons(proto);
+  r->sll.sll_ifindex = gconfig.ifindex;
+  r->sll.sll_halen = ETH_ALEN;
+  memcpy(r->sll.sll_addr, mac, 6);
+
+  return r;
+}
+
 static int send_packet6(uint8_t relay, uint8_t *client_lla, uint16_t optlen)
 {
-  struct sockaddr_ll dest_sll;
+  struct dhcp_reply *r = queue_reply(ETH_P_IPV6, client_lla);
   dhcp6_raw_t packet;
   unsigned padding;
-  int fd, result = -1;
 
   memset(&packet, 0, sizeof(dhcp6_raw_t));
   memcpy(&packet.dhcp6, &gstate.send.send_pkt6, sizeof(dhcp6_msg_t));
   padding = sizeof(packet.dhcp6.options) - optlen;
 
-  if ((fd = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_IPV6))) < 0) {
-    dbg("SEND : ipv6 socket failed\n");
-    return -1;
-  }
-  memset(&dest_sll, 0, sizeof(dest_sll));
-  dest_sll.sll_family = AF_PACKET;
-  dest_sll.sll_protocol = htons(ETH_P_IPV6);
-  dest_sll.sll_ifindex = gconfig.ifindex;
-  dest_sll.sll_halen = ETH_ALEN;
-  memcpy(dest_sll.sll_addr, client_lla, sizeof(uint8_t)*6);
-
-  if (bind(fd, (struct sockaddr *) &dest_sll, sizeof(dest_sll)) < 0) {
-    dbg("SEND : bind failed\n");
-    close(fd);
-    return -1;
-  }
   memcpy(&packet.iph.ip6_src, &gconfig.server_nip6, sizeof(uint32_t)*4);
   memcpy(&packet.iph.ip6_dst, &gstate.client_nip6, sizeof(uint32_t)*4);
 
-  packet.udph.source = htons(gconfig.port); //SERVER_PORT
+  packet.udph.source = htons(server_port(1)); //SERVER_PORT
   packet.udph.dest = gstate.client_port; //CLIENT_PORT
   packet.udph.len = htons(sizeof(dhcp6_raw_t) - sizeof(struct ip6_hdr) - padding);
   packet.iph.ip6_ctlun.ip6_un1.ip6_un1_plen = htons(ntohs(packet.udph.len) + 0x11);
@@ -894,49 +982,28 @@ static int send_packet6(uint8_t relay, uint8_t *client_lla, uint16_t optlen)
   packet.iph.ip6_ctlun.ip6_un1.ip6_un1_nxt = IPPROTO_UDP;
   packet.iph.ip6_ctlun.ip6_un1.ip6_un1_hlim = 0x64;
 
-  result = sendto(fd, &packet, sizeof(dhcp6_raw_t)-padding,
-      0, (struct sockaddr *) &dest_sll, sizeof(dest_sll));
-
-  dbg("sendto %d\n", result);
-  close(fd);
-  if (result < 0) dbg("PACKET send error\n");
-  return result;
+  r->pkt.v6 = packet;
+  return r->len = sizeof(dhcp6_raw_t)-padding;
 }
 
-// Sends data through raw socket.
+// Queues data for the raw socket.
 static int send_packet(uint8_t broadcast)
 {
-  struct sockaddr_ll dest_sll;
+  uint8_t bmacaddr[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+  struct dhcp_reply *r = queue_reply(ETH_P_IP,
+    (broadcast)?bmacaddr:gstate.rcvd.rcvd_pkt.chaddr);
   dhcp_raw_t packet;
   unsigned padding;
-  int fd, result = -1;
-  uint8_t bmacaddr[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 
   memset(&packet, 0, sizeof(dhcp_raw_t));
   memcpy(&packet.dhcp, &gstate.send.send_pkt, sizeof(dhcp_msg_t));
 
-  if ((fd = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) < 0) {
-    dbg("SEND : socket failed\n");
-    return -1;
-  }
-  memset(&dest_sll, 0, sizeof(dest_sll));
-  dest_sll.sll_family = AF_PACKET;
-  dest_sll.sll_protocol = htons(ETH_P_IP);
-  dest_sll.sll_ifindex = gconfig.ifindex;
-  dest_sll.sll_halen = 6;
-  memcpy(dest_sll.sll_addr, (broadcast)?bmacaddr:gstate.rcvd.rcvd_pkt.chaddr , 6);
-
-  if (bind(fd, (struct sockaddr *) &dest_sll, sizeof(dest_sll)) < 0) {
-    dbg("SEND : bind failed\n");
-    close(fd);
-    return -1;
-  }
   padding = 308 - 1 - dhcp_opt_size(gstate.send.send_pkt.options);
   packet.iph.protocol = IPPROTO_UDP;
   packet.iph.saddr = gconfig.server_nip;
   packet.iph.daddr = (broadcast || (gstate.rcvd.rcvd_pkt.ciaddr == 0))?
     INADDR_BROADCAST : gstate.rcvd.rcvd_pkt.ciaddr;
-  packet.udph.source = htons(gconfig.port);//SERVER_PORT
+  packet.udph.source = htons(server_port(0));//SERVER_PORT
   packet.udph.dest = gstate.client_port; //CLIENT_PORT
   packet.udph.len = htons(sizeof(dhcp_raw_t) - sizeof(struct iphdr) - padding);
   packet.iph.tot_len = packet.udph.len;
@@ -947,30 +1014,17 @@ static int send_packet(uint8_t broadcast)
   packet.iph.ttl = IPDEFTTL;
   packet.iph.check = dhcp_checksum(&packet.iph, sizeof(packet.iph));
 
-  result = sendto(fd, &packet, sizeof(dhcp_raw_t) - padding, 0,
-      (struct sockaddr *) &dest_sll, sizeof(dest_sll));
-
-  dbg("sendto %d\n", result);
-  close(fd);
-  if (result < 0) dbg("PACKET send error\n");
-  return result;
+  r->pkt.v4 = packet;
+  return r->len = sizeof(dhcp_raw_t) - padding;
 }
 
-static int read_packet6(void)
+// Takes a packet of RET bytes from the batch.
+static int read_packet6(dhcp_any_t *pkt, int ret, struct sockaddr_in6 *c_addr)
 {
-  int ret;
-  struct sockaddr_in6 c_addr;
-  socklen_t c_addr_size = sizeof(c_addr);
-
   memset(&gstate.rcvd.rcvd_pkt6, 0, sizeof(dhcp6_msg_t));
-  ret = recvfrom(gstate.listensock, &gstate.rcvd.rcvd_pkt6, sizeof(dhcp6_msg_t),
-      0, (struct sockaddr*) &c_addr, &c_addr_size);
-  memcpy(gstate.client_nip6, &c_addr.sin6_addr, sizeof(uint32_t)*4);
-  memcpy(&gstate.client_port, &c_addr.sin6_port, sizeof(uint32_t));
-  if (ret < 0) {
-    dbg("Packet read error, ignoring. \n");
-    return ret; // returns -1
-  }
+  memcpy(&gstate.rcvd.rcvd_pkt6, pkt, ret);
+  memcpy(gstate.client_nip6, &c_addr->sin6_addr, sizeof(uint32_t)*4);
+  gstate.client_port = c_addr->sin6_port;
   if (gstate.rcvd.rcvd_pkt6.msgtype < 1) {
     dbg("Bad message type, igroning. \n");
     return -2;
@@ -980,22 +1034,12 @@ static int read_packet6(void)
   return ret;
 }
 
-// Reads from UDP socket
-static int read_packet(void)
+// Takes a packet of RET bytes read from the UDP socket.
+static int read_packet(dhcp_any_t *pkt, int ret, struct sockaddr_in *c_addr)
 {
-  int ret;
-  struct sockaddr_in c_addr;
-  socklen_t c_addr_size = sizeof(c_addr);
-
   memset(&gstate.rcvd.rcvd_pkt, 0, sizeof(dhcp_msg_t));
-  ret = recvfrom(gstate.listensock, &gstate.rcvd.rcvd_pkt, sizeof(dhcp_msg_t),
-      0, (struct sockaddr*) &c_addr, &c_addr_size);
-  memcpy(&gstate.client_port, &c_addr.sin_port, sizeof(uint32_t));
-  /*ret = read(gstate.listensock, &gstate.rcvd.rcvd_pkt, sizeof(dhcp_msg_t));*/
-  if (ret < 0) {
-    dbg("Packet read error, ignoring. \n");
-    return ret; // returns -1
-  }
+  memcpy(&gstate.rcvd.rcvd_pkt, pkt, ret);
+  gstate.client_port = c_addr->sin_port;
   if (gstate.rcvd.rcvd_pkt.cookie != htonl(DHCP_MAGIC)) {
     dbg("Packet with bad magic, ignoring. \n");
     return -2;
@@ -1194,77 +1238,317 @@ static void run_notify(char **argv)
   dbg("script complete.\n");
 }
 
-static void write_leasefile(void)
+static int ip_len(void)
 {
-  int fd;
-  uint32_t curr, tmp_time;
-  int64_t timestamp;
-  struct arg_list *listdls = gstate.dleases;
-  dyn_lease *dls;
+  return addr_version == AF_INET6 ? 16 : 4;
+}
 
-  if ((fd = open(gconfig.lease_file, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
-    perror_msg("can't open %s ", gconfig.lease_file);
-  } else {
-    curr = timestamp = time(NULL);
-    timestamp = SWAP_BE64(timestamp);
-    writeall(fd, &timestamp, sizeof(timestamp));
-
-    while (listdls) {
-      dls = (dyn_lease*)listdls->arg;
-      tmp_time = dls->expires;
-      dls->expires -= curr;
-      if ((int32_t) dls->expires < 0) goto skip;
-      dls->expires = htonl(dls->expires);
-      writeall(fd, dls, sizeof(dyn_lease));
-skip:
-      dls->expires = tmp_time;
-      listdls = listdls->next;
+static void *lease_ip(struct lease *l)
+{
+  return addr_version == AF_INET6 ? (void *)l->dl.v6.lease_nip6
+    : (void *)&l->dl.v4.lease_nip;
+}
+
+// The client's MAC, or for v6 its DUID
+static void *lease_id(struct lease *l, int *len)
+{
+  if (addr_version != AF_INET6) {
+    *len = 6;
+    return l->dl.v4.lease_mac;
+  }
+  *len = l->dl.v6.duid_len;
+
+  return l->dl.v6.duid;
+}
+
+static uint32_t *lease_exp(struct lease *l)
+{
+  return addr_version == AF_INET6 ? &l->dl.v6.expires : &l->dl.v4.expires;
+}
+
+static int lease_expired(struct lease *l, uint32_t now)
+{
+  return (int32_t)(*lease_exp(l) - now) < 0;
+}
+
+// Offset of an address in the pool bitmap, or -1 if it's not in the pool
+static long pool_off(void *ip)
+{
+  uint32_t off;
+
+  if (addr_version == AF_INET6) {
+    if (memcmp(ip, gconfig.start_ip6, 12)) return -1;
+    off = peek_be((char *)ip+12, 4)-peek_be(gconfig.start_ip6+12, 4);
+  } else off = ntohl(*(uint32_t *)ip)-gconfig.start_ip;
+
+  return off < LDB->pool_size ? off : -1;
+}
+
+// Address of pool entry off, in network order.
+static uint32_t pool_ip4(long off)
+{
+  return htonl(gconfig.start_ip+off);
+}
+
+static void pool_ip6(long off, uint8_t ip[16])
+{
+  uint32_t nip = htonl(peek_be(gconfig.start_ip6+12, 4)+off);
+
+  memcpy(ip, gconfig.start_ip6, 12);
+  memcpy(ip+12, &nip, 4);
+}
+
+static void pool_mark(long off, int used)
+{
+  unsigned long bit = 1UL<<(off%POOL_BITS);
+
+  if (used) LDB->pool[off/POOL_BITS] |= bit;
+  else LDB->pool[off/POOL_BITS] &= ~bit;
+}
+
+static unsigned lease_hash(void *key, int len)
+{
+  unsigned h = 2166136261U;
+  uint8_t *s = key;
+
+  while (len-- > 0) h = (h^*s++)*16777619;
+
+  return h&(LDB->hashsize-1);
+}
+
+// Find the dynamic or static lease on this address, or for this client.
+static struct lease *lease_by_ip(void *ip, int is_static)
+{
+  struct lease *l = 0;
+
+  if (LDB->hashsize)
+    for (l = LDB->byip[lease_hash(ip, ip_len())]; l; l = l->ip_next)
+      if (l->is_static == is_static && !memcmp(lease_ip(l), ip, ip_len()))
+        break;
+
+  return l;
+}
+
+static struct lease *lease_by_id(void *id, int len, int is_static)
+{
+  struct lease *l = 0;
+  int llen;
+
+  if (len > sizeof(l->dl.v6.duid)) len = sizeof(l->dl.v6.duid);
+  if (LDB->hashsize)
+    for (l = LDB->byid[lease_hash(id, len)]; l; l = l->id_next)
+      if (l->is_static == is_static && !memcmp(lease_id(l, &llen), id, len)
+          && llen == len) break;
+
+  return l;
+}
+
+static void lease_hashin(struct lease *l)
+{
+  unsigned h = lease_hash(lease_ip(l), ip_len());
+  void *id;
+  int len;
+
+  l->ip_next = LDB->byip[h];
+  LDB->byip[h] = l;
+  id = lease_id(l, &len);
+  h = lease_hash(id, len);
+  l->id_next = LDB->byid[h];
+  LDB->byid[h] = l;
+}
+
+// Add a lease to the hashes (doubling them to keep the chains short), to the
+// pool bitmap, and to the dynamic or static list.
+static void lease_add(struct lease *l)
+{
+  struct lease *ll, **list = l->is_static ? &LDB->statics : &LDB->dleases;
+  long off;
+  int i;
+
+  if (++LDB->count > LDB->hashsize) {
+    free(LDB->byip);
+    free(LDB->byid);
+    LDB->hashsize = LDB->hashsize ? 2*LDB->hashsize : 256;
+    LDB->byip = xzalloc(LDB->hashsize*sizeof(struct lease *));
+    LDB->byid = xzalloc(LDB->hashsize*sizeof(struct lease *));
+    for (i = 0; i<2; i++)
+      for (ll = i ? LDB->statics : LDB->dleases; ll; ll = ll->next)
+        lease_hashin(ll);
+  }
+  lease_hashin(l);
+  l->prev = 0;
+  if ((l->next = *list)) l->next->prev = l;
+  *list = l;
+  if (-1 != (off = pool_off(lease_ip(l)))) pool_mark(off, 1);
+}
+
+// Forget a dynamic lease, freeing its address unless a static lease has it.
+static void lease_del(struct lease *l)
+{
+  struct lease **ll;
+  void *ip = lease_ip(l), *id;
+  long off;
+  int len;
+
+  id = lease_id(l, &len);
+  for (ll = LDB->byip+lease_hash(ip, ip_len()); *ll != l;)
+    ll = &(*ll)->ip_next;
+  *ll = l->ip_next;
+  for (ll = LDB->byid+lease_hash(id, len); *ll != l;) ll = &(*ll)->id_next;
+  *ll = l->id_next;
+  if (l->prev) l->prev->next = l->next;
+  else LDB->dleases = l->next;
+  if (l->next) l->next->prev = l->prev;
+  LDB->count--;
+  if (-1 != (off = pool_off(ip)) && !lease_by_ip(ip, 1)) pool_mark(off, 0);
+  free(l);
+}
+
+// Find or make this client's dynamic lease on this address, replacing any
+// lease it had elsewhere and anyone else's on this address.
+static struct lease *lease_get(void *ip, void *id, int len)
+{
+  struct lease *l = lease_by_id(id, len, 0), *old = lease_by_ip(ip, 0);
+
+  if (old && old != l) lease_del(old);
+  if (l && memcmp(lease_ip(l), ip, ip_len())) {
+    lease_del(l);
+    l = 0;
+  }
+  if (!l) {
+    l = xzalloc(sizeof(struct lease));
+    if (addr_version == AF_INET6) {
+      if (len > sizeof(l->dl.v6.duid)) len = sizeof(l->dl.v6.duid);
+      memcpy(l->dl.v6.lease_nip6, ip, 16);
+      memcpy(l->dl.v6.duid, id, l->dl.v6.duid_len = len);
+    } else {
+      memcpy(&l->dl.v4.lease_nip, ip, 4);
+      memcpy(l->dl.v4.lease_mac, id, 6);
     }
-    close(fd);
-    if (gconfig.notify_file) {
-      char *argv[3];
-      argv[0] = gconfig.notify_file;
-      argv[1] = gconfig.lease_file;
-      argv[2] = NULL;
-      run_notify(argv);
+    lease_add(l);
+  }
+
+  return l;
+}
+
+// Hand out an address no lease holds, starting after the last one handed
+// out. Expired leases are only reclaimed once the rest run out.
+static long pool_alloc(void)
+{
+  unsigned long words = (LDB->pool_size+POOL_BITS-1)/POOL_BITS, i, w;
+  uint32_t now = time(NULL);
+  struct lease *l, *ll;
+  long off;
+  int try;
+
+  for (try = 0; try<2; try++) {
+    for (i = 0; i<=words; i++) {
+      w = (LDB->pool_next/POOL_BITS+i)%words;
+      if (!~LDB->pool[w]) continue;
+      off = w*POOL_BITS+__builtin_ctzl(~LDB->pool[w]);
+      LDB->pool_next = (off+1)%LDB->pool_size;
+
+      return off;
+    }
+    // Once a second at most: on a full pool that's a walk of every lease.
+    if (LDB->reclaim_time == now) break;
+    LDB->reclaim_time = now;
+    for (l = LDB->dleases; l; l = ll) {
+      ll = l->next;
+      if (lease_expired(l, now)) lease_del(l);
     }
   }
+
+  return -1;
 }
 
-static void write_lease6file(void)
+// Size the pool bitmap and add the static leases to the tables.
+static void lease_init(void)
 {
-  int fd;
-  uint32_t curr, tmp_time;
-  int64_t timestamp;
-  struct arg_list *listdls = gstate.dleases;
-  dyn_lease6 *dls6;
+  static_lease *sls;
+  struct lease *l;
+  unsigned long long size;
+  long i;
 
-  if ((fd = open(gconfig.lease6_file, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
-    perror_msg("can't open %s ", gconfig.lease6_file);
-  } else {
-    curr = timestamp = time(NULL);
-    timestamp = SWAP_BE64(timestamp);
-    writeall(fd, &timestamp, sizeof(timestamp));
-
-    while (listdls) {
-      dls6 = (dyn_lease6*)listdls->arg;
-      tmp_time = dls6->expires;
-      dls6->expires -= curr;
-      if ((int32_t) dls6->expires < 0) goto skip;
-      dls6->expires = htonl(dls6->expires);
-      writeall(fd, dls6, sizeof(dyn_lease6));
-skip:
-      dls6->expires = tmp_time;
-      listdls = listdls->next;
-    }
-    close(fd);
-    if (gconfig.notify_file) {
-      char *argv[3];
-      argv[0] = gconfig.notify_file;
-      argv[1] = gconfig.lease6_file;
-      argv[2] = NULL;
-      run_notify(argv);
+  if (addr_version == AF_INET6) {
+    size = memcmp(gconfig.start_ip6, gconfig.end_ip6, 12) ? 1ULL<<32
+      : peek_be(gconfig.end_ip6+12, 4)+1;
+    size -= peek_be(gconfig.start_ip6+12, 4);
+  } else size = gconfig.end_ip-gconfig.start_ip+1ULL;
+  if (size > POOL_MAX) {
+    error_msg("pool too big, only using the first %u addresses", POOL_MAX);
+    size = POOL_MAX;
+  }
+  LDB->pool_size = size;
+  LDB->pool = xzalloc((size+POOL_BITS)/POOL_BITS*sizeof(long));
+  // The bits past the end of the pool are never free.
+  for (i = size; i%POOL_BITS; i++) pool_mark(i, 1);
+  LDB->leasefd = -1;
+
+  if (addr_version == AF_INET6) return;
+  for (sls = gstate.leases.sleases; sls; sls = sls->next) {
+    l = xzalloc(sizeof(struct lease));
+    l->is_static = 1;
+    l->dl.v4.lease_nip = sls->nip;
+    memcpy(l->dl.v4.lease_mac, sls->mac, 6);
+    lease_add(l);
+  }
+}
+
+// Queue a lease's record to append to the lease file, expiry counted from the
+// file's timestamp. Expired leases go too, so reading the file back drops
+// them.
+static void lease_log(struct lease *l)
+{
+  int size = addr_version == AF_INET6 ? sizeof(dyn_lease6) : sizeof(dyn_lease);
+  uint32_t exp = *lease_exp(l);
+  char *rec;
+
+  if (LDB->leasefd == -1) return;
+  if (LDB->loglen+size > LDB->logsize)
+    LDB->logbuf = xrealloc(LDB->logbuf, LDB->logsize += 64*size);
+  memcpy(rec = LDB->logbuf+LDB->loglen, &l->dl, size);
+  exp = htonl((int32_t)(exp-LDB->lease_time) > 0 ? exp-LDB->lease_time : 0);
+  memcpy(rec+((char *)lease_exp(l)-(char *)&l->dl), &exp, 4);
+  LDB->loglen += size;
+  LDB->logged++;
+}
+
+// Append the leases that changed since last time to the lease file. When it
+// was never written or is mostly superseded records, write it over with
+// just the live leases instead.
+static void write_leasefile(void)
+{
+  char *name = addr_version == AF_INET6 ? gconfig.lease6_file
+    : gconfig.lease_file;
+  uint32_t now = time(NULL);
+  int64_t timestamp;
+  struct lease *l;
+
+  if (LDB->leasefd == -1 || LDB->logged > 2*LDB->count+1024) {
+    if (LDB->leasefd != -1) close(LDB->leasefd);
+    LDB->leasefd = open(name, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0600);
+    if (LDB->leasefd < 0) {
+      perror_msg("can't open %s ", name);
+      return;
     }
+    fcntl(LDB->leasefd, F_SETFD, FD_CLOEXEC);
+    LDB->lease_time = timestamp = now;
+    timestamp = SWAP_BE64(timestamp);
+    writeall(LDB->leasefd, &timestamp, sizeof(timestamp));
+    LDB->loglen = LDB->logged = 0;
+    for (l = LDB->dleases; l; l = l->next)
+      if (!lease_expired(l, now)) lease_log(l);
+  }
+  if (LDB->loglen) writeall(LDB->leasefd, LDB->logbuf, LDB->loglen);
+  LDB->loglen = LDB->dirty = 0;
+
+  if (gconfig.notify_file) {
+    char *argv[3];
+    argv[0] = gconfig.notify_file;
+    argv[1] = name;
+    argv[2] = NULL;
+    run_notify(argv);
   }
 }
 
@@ -1306,48 +1590,29 @@ static uint32_t get_lease(uint32_t req_exp)
   return req_exp;
 }
 
-static int verifyip6_in_lease(uint8_t *nip6, uint8_t *duid, uint16_t ia_type, uint32_t iaid)
+static int verifyip6_in_lease(uint8_t *nip6, uint8_t *duid, uint16_t duid_len, uint16_t ia_type, uint32_t iaid)
 {
-  static_lease6 *sls6;
-  struct arg_list *listdls;
-
-  for (listdls = gstate.dleases; listdls; listdls = listdls->next) {
-    if (!memcmp(((dyn_lease6*) listdls->arg)->lease_nip6, nip6, sizeof(uint32_t)*4))
-      return -1;
+  struct lease *l;
 
-    if (!memcmp(((dyn_lease6*) listdls->arg)->duid, duid, ((dyn_lease6*) listdls->arg)->duid_len)
-        && ((dyn_lease6*) listdls->arg)->ia_type == ia_type) 
-      return -1;
-  }
-  for (sls6 = gstate.leases.sleases6; sls6; sls6 = sls6->next)
-    if (memcmp(sls6->nip6, nip6, sizeof(uint32_t)*4)==0) return -2;
-
-  if (memcmp(nip6, gconfig.start_ip6, sizeof(uint32_t)*4) < 0 ||
-      memcmp(nip6, gconfig.end_ip6, sizeof(uint32_t)*4) > 0)
-    return -3;
+  if (lease_by_ip(nip6, 0)) return -1;
+  if ((l = lease_by_id(duid, duid_len, 0)) && l->dl.v6.ia_type == ia_type)
+    return -1;
+  if (lease_by_ip(nip6, 1)) return -2;
+  if (pool_off(nip6) < 0) return -3;
 
   return 0;
 }
 
-// Verify ip NIP in current leases ( assigned or not)
+// Verify ip NIP is free for MAC: not someone else's unexpired lease, not
+// static, and in the pool.
 static int verifyip_in_lease(uint32_t nip, uint8_t mac[6])
 {
-  static_lease *sls;
-  struct arg_list *listdls;
+  struct lease *l = lease_by_ip(&nip, 0);
 
-  for (listdls = gstate.dleases; listdls; listdls = listdls->next) {
-    if (((dyn_lease*) listdls->arg)->lease_nip == nip) {
-      if (((int32_t)(((dyn_lease*) listdls->arg)->expires) - time(NULL)) < 0)
-        return 0;
-      return -1;
-    }
-    if (!memcmp(((dyn_lease*) listdls->arg)->lease_mac, mac, 6)) return -1;
-  }
-  for (sls = gstate.leases.sleases; sls; sls = sls->next)
-    if (sls->nip == nip) return -2;
-
-  if ((ntohl(nip) < gconfig.start_ip) || (ntohl(nip) > gconfig.end_ip))
-    return -3;
+  if (l && memcmp(l->dl.v4.lease_mac, mac, 6) && !lease_expired(l, time(NULL)))
+    return -1;
+  if (lease_by_ip(&nip, 1)) return -2;
+  if (pool_off(&nip) < 0) return -3;
 
   return 0;
 }
@@ -1355,64 +1620,27 @@ static int verifyip_in_lease(uint32_t nip, uint8_t mac[6])
 // add ip assigned_nip to dynamic lease.
 static int addip_to_lease(uint32_t assigned_nip, uint8_t mac[6], uint32_t *req_exp, char *hostname, uint8_t update)
 {
-  dyn_lease *dls;
-  struct arg_list *listdls = gstate.dleases;
+  struct lease *l = lease_get(&assigned_nip, mac, 6);
   uint32_t now = time(NULL);
 
-  while (listdls) {
-    if (!memcmp(((dyn_lease*) listdls->arg)->lease_mac, mac, 6)) {
-      if (update) *req_exp = get_lease(*req_exp + ((dyn_lease*) listdls->arg)->expires);
-      ((dyn_lease*) listdls->arg)->expires = *req_exp + now;
-      return 0;
-    }
-    listdls = listdls->next;
-  }
-
-  dls = xzalloc(sizeof(dyn_lease));
-  memcpy(dls->lease_mac, mac, 6);
-  dls->lease_nip = assigned_nip;
-  if (hostname) memcpy(dls->hostname, hostname, 20);
-
+  if (hostname) memcpy(l->dl.v4.hostname, hostname, 20);
   if (update) *req_exp = get_lease(*req_exp + now);
-  dls->expires = *req_exp + now;
-
-  listdls = xzalloc(sizeof(struct arg_list));
-  listdls->next = gstate.dleases;
-  listdls->arg = (char*)dls;
-  gstate.dleases = listdls;
+  l->dl.v4.expires = *req_exp + now;
+  lease_log(l);
 
   return 0;
 }
 
 static int addip6_to_lease(uint8_t *assigned_nip, uint8_t *duid, uint16_t duid_len, uint16_t ia_type, uint32_t iaid, uint32_t *lifetime, uint8_t update)
 {
-  dyn_lease6 *dls6;
-  struct arg_list *listdls = gstate.dleases;
+  struct lease *l = lease_get(assigned_nip, duid, duid_len);
   uint32_t now = time(NULL);
 
-  while (listdls) {
-    if (!memcmp(((dyn_lease6*) listdls->arg)->duid, duid, ((dyn_lease6*) listdls->arg)->duid_len)) {
-      if (update) *lifetime = get_lease(*lifetime + ((dyn_lease6*) listdls->arg)->expires);
-      ((dyn_lease6*) listdls->arg)->expires = *lifetime + now;
-      return 0;
-    }
-    listdls = listdls->next;
-  }
-
-  dls6 = xzalloc(sizeof(dyn_lease6));
-  dls6->duid_len = duid_len; 
-  memcpy(dls6->duid, duid, duid_len);
-  dls6->ia_type = ia_type;
-  dls6->iaid = iaid;
-  memcpy(dls6->lease_nip6, assigned_nip, sizeof(uint32_t)*4);
-  
+  l->dl.v6.ia_type = ia_type;
+  l->dl.v6.iaid = iaid;
   if (update) *lifetime = get_lease(*lifetime + now);
-  dls6->expires = *lifetime + now;
-
-  listdls = xzalloc(sizeof(struct arg_list));
-  listdls->next = gstate.dleases;
-  listdls->arg = (char*)dls6;
-  gstate.dleases = listdls;
+  l->dl.v6.expires = *lifetime + now;
+  lease_log(l);
 
   return 0;
 }
@@ -1420,61 +1648,30 @@ static int addip6_to_lease(uint8_t *assigned_nip, uint8_t *duid, uint16_t duid_l
 // delete ip assigned_nip from dynamic lease.
 static int delip_from_lease(uint32_t assigned_nip, uint8_t mac[6], uint32_t del_time)
 {
-  struct arg_list *listdls = gstate.dleases;
+  struct lease *l = lease_by_id(mac, 6, 0);
 
-  while (listdls) {
-    if (!memcmp(((dyn_lease*) listdls->arg)->lease_mac, mac, 6)) {
-      ((dyn_lease*) listdls->arg)->expires = del_time + time(NULL);
-      return 0;
-    }
-    listdls = listdls->next;
-  }
-  return -1;
+  if (!l) return -1;
+  l->dl.v4.expires = del_time + time(NULL);
+  lease_log(l);
+
+  return 0;
 }
 
 // returns a IP from static, dynamic leases or free ip pool, 0 otherwise.
 static uint32_t getip_from_pool(uint32_t req_nip, uint8_t mac[6], uint32_t *req_exp, char *hostname)
 {
+  struct lease *l = lease_by_id(mac, 6, 0);
   uint32_t nip = 0;
-  static_lease *sls = gstate.leases.sleases;
-  struct arg_list *listdls = gstate.dleases, *tmp = NULL;
-
-  if (req_nip && (!verifyip_in_lease(req_nip, mac))) nip = req_nip;
+  long off;
 
+  // A client with a lease keeps its address, else gets the one it asked for.
+  if (l) {
+    if (!verifyip_in_lease(l->dl.v4.lease_nip, mac)) nip = l->dl.v4.lease_nip;
+  } else if (req_nip && !verifyip_in_lease(req_nip, mac)) nip = req_nip;
+  if (!nip && (l = lease_by_id(mac, 6, 1))) nip = l->dl.v4.lease_nip;
   if (!nip) {
-    while (listdls) {
-      if (!memcmp(((dyn_lease*)listdls->arg)->lease_mac, mac, 6)) {
-        nip = ((dyn_lease*)listdls->arg)->lease_nip;
-        if (tmp) tmp->next = listdls->next;
-        else gstate.dleases = listdls->next;
-        free(listdls->arg);
-        free(listdls);
-        if (verifyip_in_lease(nip, mac) < 0) nip = 0;
-        break;
-      }
-      tmp = listdls;
-      listdls = listdls->next;
-    }
-  }
-  if (!nip) {
-    while (sls) {
-      if (memcmp(sls->mac, mac, 6) == 0) {
-        nip = sls->nip;
-        break;
-      }
-      sls = sls->next;
-    }
-  }
-  if (!nip) {
-    for (nip = htonl(gconfig.start_ip); ntohl(nip) <= gconfig.end_ip; ) {
-      if (!verifyip_in_lease(nip, mac)) break;
-      nip = ntohl(nip);
-      nip = htonl(++nip);
-    }
-    if (ntohl(nip) > gconfig.end_ip) {
-      nip = 0;
-      infomsg(infomode, "can't find free IP in IP Pool.");
-    }
+    if (-1 != (off = pool_alloc())) nip = pool_ip4(off);
+    else infomsg(infomode, "can't find free IP in IP Pool.");
   }
   if (nip) addip_to_lease(nip, mac, req_exp, hostname, 1);
   return nip;
@@ -1482,55 +1679,23 @@ static uint32_t getip_from_pool(uint32_t req_nip, uint8_t mac[6], uint32_t *req_
 
 static uint8_t *getip6_from_pool(uint8_t *duid, uint16_t duid_len, uint16_t ia_type, uint32_t iaid, uint32_t *lifetime)
 {
-  static uint8_t nip6[16] = {0, };
-  static_lease6 *sls6 = gstate.leases.sleases6;
-  struct arg_list *listdls6 = gstate.dleases, *tmp = NULL;
+  static uint8_t nip6[16];
+  struct lease *l;
+  long off;
 
-  while(listdls6) {
-    if (!memcmp(((dyn_lease6*)listdls6->arg)->duid, duid, duid_len)) {
-      memcpy(nip6, ((dyn_lease6*)listdls6->arg)->lease_nip6, sizeof(nip6));
-      if(tmp) tmp->next = listdls6->next;
-      else gstate.dleases = listdls6->next;
-      free(listdls6->arg);
-      free(listdls6);
-
-      if(verifyip6_in_lease(nip6, duid, ia_type, iaid) < 0)
-        memset(nip6, 0, sizeof(nip6));
-      break;
-    }
-    tmp = listdls6;
-    listdls6 = listdls6->next;
+  memset(nip6, 0, sizeof(nip6));
+  if ((l = lease_by_id(duid, duid_len, 0))) {
+    if (!lease_by_ip(l->dl.v6.lease_nip6, 1) && pool_off(l->dl.v6.lease_nip6) >= 0)
+      memcpy(nip6, l->dl.v6.lease_nip6, sizeof(nip6));
   }
-
   if(!memcmp(nip6, (uint8_t[16]){0}, sizeof(uint32_t)*4)) {
-    while(sls6) {
-      if(!memcmp(sls6->duid, duid, 6)) {
-        memcpy(nip6, sls6->nip6, sizeof(nip6));
-        break;
-      }
-      sls6 = sls6->next;
-    }
+    if ((l = lease_by_id(duid, duid_len, 1)))
+      memcpy(nip6, l->dl.v6.lease_nip6, sizeof(nip6));
   }
 
   if(!memcmp(nip6, (uint8_t[16]){0}, sizeof(uint32_t)*4)) {
-    memcpy(nip6, gconfig.start_ip6, sizeof(nip6));
-    while(memcmp(nip6, gconfig.end_ip6, sizeof(nip6)) < 0) {
-      if(!verifyip6_in_lease(nip6, duid, ia_type, iaid)) break;
-      int i=sizeof(nip6);
-      while(i--) {
-        ++nip6[i];
-        if (!nip6[i]) {
-          if(i==(sizeof(nip6)-1)) ++nip6[i];
-          ++nip6[i-1];
-        } else
-          break;
-      }
-    }
-
-    if (memcmp(nip6, gconfig.end_ip6, sizeof(nip6)) > 0) {
-      memset(nip6, 0, sizeof(nip6));
-      infomsg(infomode, "can't find free IP in IPv6 Pool.");
-    }
+    if (-1 != (off = pool_alloc())) pool_ip6(off, nip6);
+    else infomsg(infomode, "can't find free IP in IPv6 Pool.");
   }
 
   if(memcmp(nip6, (uint8_t[16]){0}, sizeof(uint32_t)*4)) {
@@ -1542,80 +1707,473 @@ static uint8_t *getip6_from_pool(uint8_t *duid, uint16_t duid_len, uint16_t ia_t
   return nip6;
 }
 
+// The lease file is a timestamp and then records with expiry times counted
+// from it. Later records for a client replace earlier ones, and an expired
+// one drops the lease.
 static void read_leasefile(void)
 {
-  uint32_t passed, ip;
+  char *name = addr_version == AF_INET6 ? gconfig.lease6_file
+    : gconfig.lease_file;
+  int size = addr_version == AF_INET6 ? sizeof(dyn_lease6) : sizeof(dyn_lease),
+    len;
+  uint32_t passed, now = time(NULL);
   int32_t tmp_time;
   int64_t timestamp;
-  dyn_lease *dls;
-  int fd = open(gconfig.lease_file, O_RDONLY);
-
-  dls = xzalloc(sizeof(dyn_lease));
-
-  if (read(fd, &timestamp, sizeof(timestamp)) != sizeof(timestamp))
+  struct lease rec, *l;
+  struct stat st;
+  void *id;
+  FILE *fp = fopen(name, "r");
+
+  if (!fp) return;
+  // How long ago the file was last written says whether it's stale.
+  if (fstat(fileno(fp), &st) || (uint64_t)(now - st.st_mtime) > 12 * 60 * 60
+      || fread(&timestamp, sizeof(timestamp), 1, fp) != 1)
     goto lease_error_exit;
 
   timestamp = SWAP_BE64(timestamp);
-  passed = time(NULL) - timestamp;
-  if ((uint64_t)passed > 12 * 60 * 60) goto lease_error_exit;
-
-  while (read(fd, dls, sizeof(dyn_lease)) == sizeof(dyn_lease)) {
-    ip = ntohl(dls->lease_nip);
-    if (ip >= gconfig.start_ip && ip <= gconfig.end_ip) {
-      tmp_time = ntohl(dls->expires) - passed;
-      if (tmp_time < 0) continue;
-      addip_to_lease(dls->lease_nip, dls->lease_mac,
-          (uint32_t*)&tmp_time, dls->hostname, 0);
+  passed = now - timestamp;
+
+  while (fread(&rec.dl, size, 1, fp) == 1) {
+    if (pool_off(lease_ip(&rec)) < 0) continue;
+    id = lease_id(&rec, &len);
+    tmp_time = ntohl(*lease_exp(&rec)) - passed;
+    if (tmp_time < 0) {
+      if ((l = lease_by_id(id, len, 0))
+          && !memcmp(lease_ip(l), lease_ip(&rec), ip_len())) lease_del(l);
+      continue;
     }
+    l = lease_get(lease_ip(&rec), id, len);
+    if (addr_version == AF_INET6) {
+      l->dl.v6.ia_type = rec.dl.v6.ia_type;
+      l->dl.v6.iaid = rec.dl.v6.iaid;
+    } else memcpy(l->dl.v4.hostname, rec.dl.v4.hostname, 20);
+    *lease_exp(l) = tmp_time + now;
   }
 lease_error_exit:
-  free(dls);
-  close(fd);
+  fclose(fp);
 }
 
-static void read_lease6file(void)
+// Write the lease file soon: a burst of requests gets one write.
+static void lease_dirty(void)
 {
-  uint32_t passed;
-  uint32_t tmp_time;
-  int64_t timestamp;
-  dyn_lease6 *dls6;
-  int fd = open(gconfig.lease6_file, O_RDONLY);
+  LDB->dirty = 1;
+  if (!gstate.write_at) gstate.write_at = millitime()+LEASE_DELAY;
+}
 
-  dls6 = xzalloc(sizeof(dyn_lease6));
+// Write out the lease files that changed, or with all set every one.
+static void write_leases(int all)
+{
+  int v6;
 
-  if (read(fd, &timestamp, sizeof(timestamp)) != sizeof(timestamp))
-    goto lease6_error_exit;
+  for (v6 = 0; v6<2; v6++) {
+    if (!(gstate.families & (1<<v6))) continue;
+    addr_version = v6 ? AF_INET6 : AF_INET;
+    if (all || LDB->dirty) write_leasefile();
+  }
+  gstate.write_at = 0;
+}
 
-  timestamp = SWAP_BE64(timestamp);
-  passed = time(NULL) - timestamp;
-  if ((uint64_t)passed > 12 * 60 * 60) goto lease6_error_exit;
-
-  while (read(fd, dls6, sizeof(dyn_lease6)) == sizeof(dyn_lease6)) {
-    if (memcmp(dls6->lease_nip6, gconfig.start_ip6, sizeof(uint32_t)*4) > 0 &&
-        memcmp(dls6->lease_nip6, gconfig.end_ip6, sizeof(uint32_t)*4) < 0) {
-      tmp_time = ntohl(dls6->expires) - passed;
-      if (tmp_time < 0U) continue;
-      addip6_to_lease(dls6->lease_nip6, dls6->duid, dls6->duid_len, dls6->ia_type, dls6->iaid,
-          (uint32_t*)&tmp_time, 0);
-    }
+static void refresh_interface(void)
+{
+  int v6;
+
+  for (v6 = 0; v6<2; v6++) {
+    if (!(gstate.families & (1<<v6))) continue;
+    addr_version = v6 ? AF_INET6 : AF_INET;
+    if (get_interface(gconfig.interface, &gconfig.ifindex,
+          v6 ? (void*)gconfig.server_nip6 : (void*)&gconfig.server_nip,
+          gconfig.server_mac) < 0)
+      perror_exit("Failed to get interface %s", gconfig.interface);
+    if (!v6) gconfig.server_nip = htonl(gconfig.server_nip);
   }
+}
 
-lease6_error_exit:
-  free(dls6);
-  close(fd);
+static void serve_packet6(void)
+{
+  uint8_t *optptr, transactionid[3] = {0,};
+  uint16_t optlen = 0;
+  void *client_duid, *server_duid, *client_ia_na, *server_ia_na,
+       *client_ia_pd;
+  uint8_t client_lla[6] = {0,};
+  uint16_t client_duid_len = 0, server_duid_len = 0, server_ia_na_len = 0,
+           client_ia_na_len = 0, client_ia_pd_len = 0;
+
+  memcpy(&gstate.rqcode, &gstate.rcvd.rcvd_pkt6.msgtype, sizeof(uint8_t));
+  memcpy(&transactionid, &gstate.rcvd.rcvd_pkt6.transaction_id,
+      sizeof(transactionid));
+
+  if (!gstate.rqcode || gstate.rqcode < DHCP6SOLICIT ||
+      gstate.rqcode > DHCP6RELAYREPLY) {
+    dbg("no or bad message type option, ignoring packet.\n");
+    return;
+  }
+  if (!gstate.rcvd.rcvd_pkt6.transaction_id || 
+      memcmp(gstate.rcvd.rcvd_pkt6.transaction_id, transactionid, 3)) {
+    dbg("no or bad transaction id, ignoring packet.\n");
+    return;
+  }
+  switch (gstate.rqcode) {
+    case DHCP6SOLICIT:
+      dbg("Message Type: DHCP6SOLICIT\n");
+      optptr = prepare_send_pkt6(DHCP6ADVERTISE);
+      optlen = 0;
+
+      //TODO policy check
+      //TODO Receive: ORO check (e.g. DNS)
+
+      //Receive: Client Identifier (DUID)
+      get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
+          DHCP6_OPT_CLIENTID, &client_duid_len, &client_duid);
+
+      //Receive: Identity Association for Non-temporary Address
+      if(get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
+            DHCP6_OPT_IA_NA, &client_ia_na_len, &client_ia_na)) {
+        uint16_t ia_addr_len = sizeof(struct optval_ia_addr);
+        void *ia_addr, *status_code;
+        char *status_code_msg;
+        uint16_t status_code_len = 0;
+        server_ia_na_len = sizeof(struct optval_ia_na);
+
+        //IA Address
+        ia_addr = xzalloc(ia_addr_len);
+        struct optval_ia_addr *ia_addr_p = (struct optval_ia_addr*)ia_addr;
+        (*ia_addr_p).pref_lifetime = gconfig.pref_lifetime;
+        (*ia_addr_p).valid_lifetime = gconfig.valid_lifetime;
+        memcpy(&(*ia_addr_p).ipv6_addr,
+            getip6_from_pool(client_duid, client_duid_len,
+              DHCP6_OPT_IA_NA, (*(struct optval_ia_na*) client_ia_na).iaid,
+              &(*ia_addr_p).pref_lifetime), sizeof(uint32_t)*4);
+        server_ia_na_len += (ia_addr_len+4);
+
+        //Status Code
+        if(memcmp((*ia_addr_p).ipv6_addr, (uint8_t[16]){0}, sizeof(uint32_t)*4)) {
+          status_code_msg = xstrdup("Assigned an address.");
+          status_code_len = strlen(status_code_msg)+1;
+          status_code = xzalloc(status_code_len);
+          struct optval_status_code *status_code_p =
+            (struct optval_status_code*)status_code;
+          (*status_code_p).status_code = htons(DHCP6_STATUS_SUCCESS);
+          memcpy((*status_code_p).status_msg, status_code_msg,
+              status_code_len);
+          server_ia_na_len += (status_code_len+4);
+          free(status_code_msg);
+        } else {
+          status_code_msg = xstrdup("There's no available address.");
+          status_code_len = strlen(status_code_msg)+1;
+          status_code = xzalloc(status_code_len);
+          struct optval_status_code *status_code_p =
+            (struct optval_status_code*)status_code;
+          (*status_code_p).status_code = htons(DHCP6_STATUS_NOADDRSAVAIL);
+          memcpy((*status_code_p).status_msg, status_code_msg,
+              status_code_len);
+          server_ia_na_len += (status_code_len+4);
+          server_ia_na_len -= (ia_addr_len+4);
+          ia_addr_len = 0;
+          free(ia_addr);
+          free(status_code_msg);
+          //TODO send failed status code
+          break;
+        }
+
+        //combine options
+        server_ia_na = xzalloc(server_ia_na_len);
+        struct optval_ia_na *ia_na_p = (struct optval_ia_na*)server_ia_na;
+        (*ia_na_p).iaid = (*(struct optval_ia_na*)client_ia_na).iaid;
+        (*ia_na_p).t1 = gconfig.t1;
+        (*ia_na_p).t2 = gconfig.t2;
+
+        uint8_t* ia_na_optptr = (*ia_na_p).optval;
+        if(ia_addr_len) {
+          set_optval6(ia_na_optptr, DHCP6_OPT_IA_ADDR, ia_addr, ia_addr_len);
+          ia_na_optptr += (ia_addr_len + 4);
+          free(ia_addr);
+        }
+        if(status_code_len) {
+          set_optval6(ia_na_optptr, DHCP6_OPT_STATUS_CODE, status_code,
+              status_code_len);
+          ia_na_optptr += (status_code_len);
+          free(status_code);
+        }
+
+        //Response: Identity Association for Non-temporary Address
+        optptr = set_optval6(optptr, DHCP6_OPT_IA_NA, server_ia_na,
+            server_ia_na_len);
+        optlen += (server_ia_na_len + 4);
+        free(client_ia_na);free(server_ia_na);
+      }
+      //Receive: Identity Association for Prefix Delegation
+      else if(get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
+            DHCP6_OPT_IA_PD, &client_ia_pd_len, &client_ia_pd)) {
+
+        //TODO
+        //Response: Identity Association for Prefix Delegation
+      }
+
+      //DUID type: link-layer address plus time
+      if(ntohs((*(struct optval_duid_llt*)client_duid).type) ==
+          DHCP6_DUID_LLT) {
+        server_duid_len = 8+sizeof(gconfig.server_mac);
+        server_duid = xzalloc(server_duid_len);
+        struct optval_duid_llt *server_duid_p =
+          (struct optval_duid_llt*)server_duid;
+        (*server_duid_p).type = htons(1);
+        (*server_duid_p).hwtype = htons(1);
+        (*server_duid_p).time = htonl((uint32_t)
+            (time(NULL) - 946684800) & 0xffffffff);
+        memcpy((*server_duid_p).lladdr, gconfig.server_mac,
+            sizeof(gconfig.server_mac));
+        memcpy(&client_lla, (*(struct optval_duid_llt*)client_duid).lladdr,
+            sizeof(client_lla));
+
+        //Response: Server Identifier (DUID)
+        optptr = set_optval6(optptr, DHCP6_OPT_SERVERID, server_duid,
+            server_duid_len);
+        optlen += (server_duid_len + 4);
+        //Response: Client Identifier
+        optptr = set_optval6(optptr, DHCP6_OPT_CLIENTID, client_duid,
+            client_duid_len);
+        optlen += (client_duid_len + 4);
+        free(client_duid);free(server_duid);
+      }
+
+      send_packet6(0, client_lla, optlen);
+      lease_dirty();
+      break;
+    case DHCP6REQUEST:
+      dbg("Message Type: DHCP6REQUEST\n");
+      optptr = prepare_send_pkt6(DHCP6REPLY);
+      optlen = 0;
+
+      //Receive: Client Identifier (DUID)
+      get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
+          DHCP6_OPT_CLIENTID, &client_duid_len, &client_duid);
+      optptr = set_optval6(optptr, DHCP6_OPT_CLIENTID, client_duid,
+          client_duid_len);
+      optlen += (client_duid_len + 4);
+      memcpy(client_lla, (*(struct optval_duid_llt*)client_duid).lladdr,
+          sizeof(client_lla));
+
+      //Receive: Identity Association for Non-temporary Address
+      if(get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
+            DHCP6_OPT_IA_NA, &client_ia_na_len, &client_ia_na)) {
+        uint16_t ia_addr_len = 0, status_code_len = 0;
+        void *ia_addr, *status_code;
+        uint16_t server_ia_na_len = sizeof(struct optval_ia_na);
+        char *status_code_msg;
+
+        //Check IA Address
+        get_optval6((uint8_t*)(*(struct optval_ia_na*)client_ia_na).optval,
+            DHCP6_OPT_IA_ADDR, &ia_addr_len, &ia_addr);
+        struct optval_ia_addr *ia_addr_p = (struct optval_ia_addr*)ia_addr;
+        if(verifyip6_in_lease((*ia_addr_p).ipv6_addr, client_duid,
+              client_duid_len,
+              DHCP6_OPT_IA_NA, (*(struct optval_ia_na*)client_ia_na).iaid)
+            == -1) {
+          server_ia_na_len += (ia_addr_len + 4);
+          //Add Status Code
+          status_code_msg = xstrdup("Assigned an address.");
+          status_code_len = strlen(status_code_msg) + 1;
+          status_code = xzalloc(status_code_len);
+          struct optval_status_code *status_code_p =
+            (struct optval_status_code*)status_code;
+          (*status_code_p).status_code = htons(DHCP6_STATUS_SUCCESS);
+          memcpy((*status_code_p).status_msg, status_code_msg,
+              status_code_len);
+          server_ia_na_len += (status_code_len+4);
+        } else {
+          //TODO send failed status code
+          break;
+        }
+
+        //combine options
+        server_ia_na = xzalloc(server_ia_na_len);
+        struct optval_ia_na *ia_na_p = (struct optval_ia_na*)server_ia_na;
+        (*ia_na_p).iaid = (*(struct optval_ia_na*)client_ia_na).iaid;
+        (*ia_na_p).t1 = gconfig.t1;
+        (*ia_na_p).t2 = gconfig.t2;
+
+        uint8_t* ia_na_optptr = (*ia_na_p).optval;
+        ia_na_optptr = set_optval6(ia_na_optptr, DHCP6_OPT_IA_ADDR,
+            ia_addr, ia_addr_len);
+        free(ia_addr);
+
+        if(status_code_len) {
+          ia_na_optptr = set_optval6(ia_na_optptr, DHCP6_OPT_STATUS_CODE,
+              status_code, status_code_len);
+          free(status_code);
+        }
+
+        //Response: Identity Association for Non-temporary Address
+        //(Status Code added)
+        optptr = set_optval6(optptr, DHCP6_OPT_IA_NA,
+            server_ia_na, server_ia_na_len);
+        optlen += (server_ia_na_len + 4);
+        free(client_ia_na);free(server_ia_na);
+      }
+
+      //Receive: Server Identifier (DUID)
+      get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
+          DHCP6_OPT_SERVERID, &server_duid_len, &server_duid);
+      optptr = set_optval6(optptr, DHCP6_OPT_SERVERID,
+          server_duid, server_duid_len);
+      optlen += (server_duid_len + 4);
+
+      free(client_duid); free(server_duid);
+
+      send_packet6(0, client_lla, optlen);
+      lease_dirty();
+      break;
+    case DHCP6DECLINE:  //TODO
+    case DHCP6RENEW:    //TODO
+    case DHCP6REBIND:   //TODO
+    case DHCP6RELEASE:
+      dbg("Message Type: DHCP6RELEASE\n");
+      optptr = prepare_send_pkt6(DHCP6REPLY);
+      break;
+    default:
+      dbg("Message Type : %u\n", gstate.rqcode);
+      break;
+  }
 }
 
-void dhcpd_main(void)
+static void serve_packet(void)
 {
-  struct timeval tv;
-  int retval, i;
   uint8_t *optptr, msgtype = 0;
-  uint16_t optlen = 0;
-  uint32_t waited = 0, serverid = 0, requested_nip = 0;
-  uint8_t transactionid[3] = {0,};
-  uint32_t reqested_lease = 0, ip_pool_size = 0;
+  uint32_t serverid = 0, requested_nip = 0, reqested_lease = 0;
   char *hstname = NULL;
-  fd_set rfds;
+
+  get_optval((uint8_t*)&gstate.rcvd.rcvd_pkt.options,
+      DHCP_OPT_MESSAGE_TYPE, &gstate.rqcode);
+  if (gstate.rqcode == 0 || gstate.rqcode < DHCPDISCOVER 
+      || gstate.rqcode > DHCPINFORM) {
+    dbg("no or bad message type option, ignoring packet.\n");
+    return;
+  }
+  get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+      DHCP_OPT_SERVER_ID, &serverid);
+  if (serverid && (serverid != gconfig.server_nip)) {
+    dbg("server ID doesn't match, ignoring packet.\n");
+    return;
+  }
+  switch (gstate.rqcode) {
+    case DHCPDISCOVER:
+      msgtype = DHCPOFFER;
+      dbg("Message Type : DHCPDISCOVER\n");
+      get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+          DHCP_OPT_REQUESTED_IP, &requested_nip);
+      get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+          DHCP_OPT_HOST_NAME, &hstname);
+      reqested_lease = gconfig.offer_time;
+      get_reqparam(&gstate.rqopt);
+      optptr = prepare_send_pkt();
+      gstate.send.send_pkt.yiaddr = getip_from_pool(requested_nip,
+          gstate.rcvd.rcvd_pkt.chaddr, &reqested_lease, hstname);
+      if(!gstate.send.send_pkt.yiaddr){
+        msgtype = DHCPNAK;
+        optptr = set_optval(optptr, DHCP_OPT_MESSAGE_TYPE, &msgtype, 1);
+        send_packet(1);
+        break;
+      }
+      get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+          DHCP_OPT_LEASE_TIME, &reqested_lease);
+      reqested_lease = htonl(get_lease(reqested_lease + time(NULL)));
+      optptr = set_optval(optptr, DHCP_OPT_MESSAGE_TYPE, &msgtype, 1);
+      optptr = set_optval(optptr, DHCP_OPT_SERVER_ID, &gconfig.server_nip, 4);
+      optptr = set_optval(optptr, DHCP_OPT_LEASE_TIME, &reqested_lease, 4);
+      optptr = set_reqparam(optptr, gstate.rqopt);
+      send_packet(1);
+      break;
+    case DHCPREQUEST:
+      msgtype = DHCPACK;
+      dbg("Message Type : DHCPREQUEST\n");
+      optptr = prepare_send_pkt();
+      get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+          DHCP_OPT_REQUESTED_IP, &requested_nip);
+      get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+          DHCP_OPT_LEASE_TIME, &reqested_lease);
+      get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+          DHCP_OPT_HOST_NAME, &hstname);
+      gstate.send.send_pkt.yiaddr = getip_from_pool(requested_nip,
+          gstate.rcvd.rcvd_pkt.chaddr, &reqested_lease, hstname);
+      if (!serverid) reqested_lease = gconfig.max_lease_sec;
+      if (!gstate.send.send_pkt.yiaddr) {
+        msgtype = DHCPNAK;
+        optptr = set_optval(optptr, DHCP_OPT_MESSAGE_TYPE, &msgtype, 1);
+        send_packet(1);
+        break;
+      }
+      optptr = set_optval(optptr, DHCP_OPT_MESSAGE_TYPE, &msgtype, 1);
+      optptr = set_optval(optptr, DHCP_OPT_SERVER_ID, &gconfig.server_nip, 4);
+      reqested_lease = htonl(reqested_lease);
+      optptr = set_optval(optptr, DHCP_OPT_LEASE_TIME, &reqested_lease, 4);
+      send_packet(1);
+      lease_dirty();
+      break;
+    case DHCPDECLINE:// FALL THROUGH
+    case DHCPRELEASE:
+      dbg("Message Type : DHCPDECLINE or DHCPRELEASE \n");
+      get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+          DHCP_OPT_SERVER_ID, &serverid);
+      if (serverid != gconfig.server_nip) break;
+      get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
+          DHCP_OPT_REQUESTED_IP, &requested_nip);
+      delip_from_lease(requested_nip, gstate.rcvd.rcvd_pkt.chaddr,
+          (gstate.rqcode==DHCPRELEASE)?0:gconfig.decline_time);
+      lease_dirty();
+      break;
+    default:
+      dbg("Message Type : %u\n", gstate.rqcode);
+      break;
+  }
+}
+
+// Serve every packet waiting on a socket, a batch at a time, sending each
+// batch's replies together.
+static void serve_socket(int v6)
+{
+  struct mmsghdr msgs[DHCP_BATCH];
+  struct iovec iov[DHCP_BATCH];
+  union {
+    struct sockaddr_in v4;
+    struct sockaddr_in6 v6;
+  } from[DHCP_BATCH];
+  int fd = v6 ? gstate.listensock6 : gstate.listensock, count, i;
+
+  addr_version = v6 ? AF_INET6 : AF_INET;
+  for (i = 0; i<DHCP_BATCH; i++) {
+    iov[i].iov_base = gstate.batch+i;
+    iov[i].iov_len = v6 ? sizeof(dhcp6_msg_t) : sizeof(dhcp_msg_t);
+    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+    msgs[i].msg_hdr.msg_name = from+i;
+    msgs[i].msg_hdr.msg_iov = iov+i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  do {
+    for (i = 0; i<DHCP_BATCH; i++) msgs[i].msg_hdr.msg_namelen = sizeof(*from);
+    if (0>(count = recvmmsg(fd, msgs, DHCP_BATCH, MSG_DONTWAIT, 0))) {
+      if (errno != EAGAIN && errno != EINTR) {
+        dbg("Packet read error, reopening. \n");
+        v6 ? open_listensock6() : open_listensock();
+      }
+      break;
+    }
+    for (i = 0; i<count; i++) {
+      if (v6) {
+        if (read_packet6(gstate.batch+i, msgs[i].msg_len, &from[i].v6) >= 0)
+          serve_packet6();
+      } else if (read_packet(gstate.batch+i, msgs[i].msg_len, &from[i].v4) >= 0)
+        serve_packet();
+    }
+    flush_replies();
+  } while (count == DHCP_BATCH);
+}
+
+void dhcpd_main(void)
+{
+  struct pollfd pfd[3];
+  unsigned long long now, next, auto_at = 0;
+  uint32_t ip_pool_size = 0;
+  int i, v6;
 
   infomode = LOG_CONSOLE;
   if (!(flag_chk(FLAG_f))) {
@@ -1632,15 +2190,16 @@ void dhcpd_main(void)
   infomsg(infomode, "toybox dhcpd started");
 
   if (flag_chk(FLAG_6)){
-    addr_version = AF_INET6;
+    gstate.families |= 2;
     gconfig.t1 = ntohl(gconfig.t1);
     gconfig.t2 = ntohl(gconfig.t2);
     gconfig.pref_lifetime = ntohl(gconfig.pref_lifetime);
     gconfig.valid_lifetime = ntohl(gconfig.valid_lifetime);
-    gconfig.port = 547;
     for(i=0;i<4;i++)
       ip_pool_size += (gconfig.end_ip6[i]-gconfig.start_ip6[i])<<((3-i)*8);
-  } else {
+  }
+  if (!flag_chk(FLAG_6) || flag_chk(FLAG_4)) {
+    gstate.families |= 1;
     gconfig.start_ip = ntohl(gconfig.start_ip);
     gconfig.end_ip = ntohl(gconfig.end_ip);
     ip_pool_size = gconfig.end_ip - gconfig.start_ip + 1;
@@ -1655,59 +2214,51 @@ void dhcpd_main(void)
   set_maxlease();
   if(TT.iface) gconfig.interface = TT.iface;
   if(TT.port) gconfig.port = TT.port;
-  (addr_version==AF_INET6) ? read_lease6file() : read_leasefile();
-
-
-  if (get_interface(gconfig.interface, &gconfig.ifindex,
-        (addr_version==AF_INET6)? (void*)gconfig.server_nip6 :
-        (void*)&gconfig.server_nip, gconfig.server_mac) < 0)
-    perror_exit("Failed to get interface %s", gconfig.interface);
-  setup_signal();
-  if (addr_version==AF_INET6) {
-    open_listensock6();
-  } else {
-    gconfig.server_nip = htonl(gconfig.server_nip);
-    open_listensock();
+  for (v6 = 0; v6<2; v6++) {
+    if (!(gstate.families & (1<<v6))) continue;
+    addr_version = v6 ? AF_INET6 : AF_INET;
+    lease_init();
+    read_leasefile();
   }
 
-  fcntl(gstate.listensock, F_SETFD, FD_CLOEXEC);
+  refresh_interface();
+  setup_signal();
+  gstate.listensock = gstate.listensock6 = -1;
+  if (gstate.families & 2) open_listensock6();
+  if (gstate.families & 1) open_listensock();
+  // Protocol 0: this one only sends, the raw replies of both families.
+  gstate.sendsock = xsocket(PF_PACKET, SOCK_DGRAM, 0);
+  fcntl(gstate.sendsock, F_SETFD, FD_CLOEXEC);
+  gstate.batch = xmalloc(DHCP_BATCH*sizeof(dhcp_any_t));
+  gstate.replies = xmalloc(DHCP_BATCH*sizeof(struct dhcp_reply));
+  if (gconfig.auto_time) auto_at = millitime()+gconfig.auto_time*1000LL;
 
   for (;;) {
-    uint32_t timestmp = time(NULL);
-    FD_ZERO(&rfds);
-    FD_SET(gstate.listensock, &rfds);
-    FD_SET(sigfd.rd, &rfds);
-    tv.tv_sec = gconfig.auto_time - waited;
-    tv.tv_usec = 0;
-    retval = 0;
-    serverid = 0;
-    msgtype = 0;
-
-    int maxfd = (sigfd.rd > gstate.listensock)? sigfd.rd : gstate.listensock;
-    dbg("select waiting ....\n");
-    retval = select(maxfd + 1, &rfds, NULL, NULL, (gconfig.auto_time?&tv:NULL));
-    if (retval < 0) {
-      if (errno == EINTR) {
-        waited += (unsigned) time(NULL) - timestmp;
-        continue;
-      }
-      dbg("Error in select wait again...\n");
+    pfd[0].fd = sigfd.rd;
+    pfd[1].fd = gstate.listensock;
+    pfd[2].fd = gstate.listensock6;
+    for (i = 0; i<3; i++) pfd[i].events = POLLIN;
+
+    // Wake for the deferred lease write or the auto_time one.
+    now = millitime();
+    next = auto_at;
+    if (gstate.write_at && (!next || gstate.write_at < next))
+      next = gstate.write_at;
+    dbg("poll waiting ....\n");
+    if (poll(pfd, 3, !next ? -1 : next>now ? next-now : 0) < 0) {
+      if (errno != EINTR) dbg("Error in poll wait again...\n");
       continue;
     }
-    if (!retval) { // Timed out 
-      dbg("select wait Timed Out...\n");
-      waited = 0;
-      (addr_version == AF_INET6)? write_lease6file() : write_leasefile();
-      if (get_interface(gconfig.interface, &gconfig.ifindex,
-            (addr_version==AF_INET6)? (void*)gconfig.server_nip6 :
-            (void*)&gconfig.server_nip, gconfig.server_mac)<0)
-        perror_exit("Failed to get interface %s", gconfig.interface);
-      if(addr_version != AF_INET6) {
-        gconfig.server_nip = htonl(gconfig.server_nip);
-      }
-      continue;
+
+    now = millitime();
+    if (gstate.write_at && now >= gstate.write_at) write_leases(0);
+    if (auto_at && now >= auto_at) {
+      dbg("poll wait Timed Out...\n");
+      write_leases(1);
+      refresh_interface();
+      auto_at = now+gconfig.auto_time*1000LL;
     }
-    if (FD_ISSET(sigfd.rd, &rfds)) { // Some Activity on RDFDs : is signal 
+    if (pfd[0].revents & POLLIN) { // Some Activity on RDFDs : is signal
       unsigned char sig;
       if (read(sigfd.rd, &sig, 1) != 1) {
         dbg("signal read failed.\n");
@@ -1716,362 +2267,18 @@ void dhcpd_main(void)
       switch (sig) {
         case SIGUSR1:
           infomsg(infomode, "Received SIGUSR1");
-          (addr_version==AF_INET6)? write_lease6file() : write_leasefile();
+          write_leases(1);
           continue;
         case SIGTERM:
           infomsg(infomode, "received sigterm");
-          (addr_version==AF_INET6)? write_lease6file() : write_leasefile();
+          write_leases(1);
           unlink(gconfig.pidfile);
           exit(0);
           break;
         default: break;
       }
     }
-    if (FD_ISSET(gstate.listensock, &rfds)) { // Some Activity on RDFDs : is socket
-      dbg("select listen sock read\n");
-      if(addr_version==AF_INET6) {
-        void *client_duid, *server_duid, *client_ia_na, *server_ia_na,
-             *client_ia_pd;
-        uint8_t client_lla[6] = {0,};
-        uint16_t client_duid_len = 0, server_duid_len = 0, server_ia_na_len = 0,
-                 client_ia_na_len = 0, client_ia_pd_len = 0;
-
-        if(read_packet6() < 0) {
-          open_listensock6();
-          continue;
-        }
-        waited += time(NULL) - timestmp;
-
-        memcpy(&gstate.rqcode, &gstate.rcvd.rcvd_pkt6.msgtype, sizeof(uint8_t));
-        memcpy(&transactionid, &gstate.rcvd.rcvd_pkt6.transaction_id,
-            sizeof(transactionid));
-
-        if (!gstate.rqcode || gstate.rqcode < DHCP6SOLICIT ||
-            gstate.rqcode > DHCP6RELAYREPLY) {
-          dbg("no or bad message type option, ignoring packet.\n");
-          continue;
-        }
-        if (!gstate.rcvd.rcvd_pkt6.transaction_id || 
-            memcmp(gstate.rcvd.rcvd_pkt6.transaction_id, transactionid, 3)) {
-          dbg("no or bad transaction id, ignoring packet.\n");
-          continue;
-        }
-
-        waited += time(NULL) - timestmp;
-        switch (gstate.rqcode) {
-          case DHCP6SOLICIT:
-            dbg("Message Type: DHCP6SOLICIT\n");
-            optptr = prepare_send_pkt6(DHCP6ADVERTISE);
-            optlen = 0;
-
-            //TODO policy check
-            //TODO Receive: ORO check (e.g. DNS)
-
-            //Receive: Client Identifier (DUID)
-            get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
-                DHCP6_OPT_CLIENTID, &client_duid_len, &client_duid);
-
-            //Receive: Identity Association for Non-temporary Address
-            if(get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
-                  DHCP6_OPT_IA_NA, &client_ia_na_len, &client_ia_na)) {
-              uint16_t ia_addr_len = sizeof(struct optval_ia_addr);
-              void *ia_addr, *status_code;
-              char *status_code_msg;
-              uint16_t status_code_len = 0;
-              server_ia_na_len = sizeof(struct optval_ia_na);
-
-              //IA Address
-              ia_addr = xzalloc(ia_addr_len);
-              struct optval_ia_addr *ia_addr_p = (struct optval_ia_addr*)ia_addr;
-              (*ia_addr_p).pref_lifetime = gconfig.pref_lifetime;
-              (*ia_addr_p).valid_lifetime = gconfig.valid_lifetime;
-              memcpy(&(*ia_addr_p).ipv6_addr,
-                  getip6_from_pool(client_duid, client_duid_len,
-                    DHCP6_OPT_IA_NA, (*(struct optval_ia_na*) client_ia_na).iaid,
-                    &(*ia_addr_p).pref_lifetime), sizeof(uint32_t)*4);
-              server_ia_na_len += (ia_addr_len+4);
-
-              //Status Code
-              if(memcmp((*ia_addr_p).ipv6_addr, (uint8_t[16]){0}, sizeof(uint32_t)*4)) {
-                status_code_msg = xstrdup("Assigned an address.");
-                status_code_len = strlen(status_code_msg)+1;
-                status_code = xzalloc(status_code_len);
-                struct optval_status_code *status_code_p =
-                  (struct optval_status_code*)status_code;
-                (*status_code_p).status_code = htons(DHCP6_STATUS_SUCCESS);
-                memcpy((*status_code_p).status_msg, status_code_msg,
-                    status_code_len);
-                server_ia_na_len += (status_code_len+4);
-                free(status_code_msg);
-              } else {
-                status_code_msg = xstrdup("There's no available address.");
-                status_code_len = strlen(status_code_msg)+1;
-                status_code = xzalloc(status_code_len);
-                struct optval_status_code *status_code_p =
-                  (struct optval_status_code*)status_code;
-                (*status_code_p).status_code = htons(DHCP6_STATUS_NOADDRSAVAIL);
-                memcpy((*status_code_p).status_msg, status_code_msg,
-                    status_code_len);
-                server_ia_na_len += (status_code_len+4);
-                server_ia_na_len -= (ia_addr_len+4);
-                ia_addr_len = 0;
-                free(ia_addr);
-                free(status_code_msg);
-                //TODO send failed status code
-                break;
-              }
-
-              //combine options
-              server_ia_na = xzalloc(server_ia_na_len);
-              struct optval_ia_na *ia_na_p = (struct optval_ia_na*)server_ia_na;
-              (*ia_na_p).iaid = (*(struct optval_ia_na*)client_ia_na).iaid;
-              (*ia_na_p).t1 = gconfig.t1;
-              (*ia_na_p).t2 = gconfig.t2;
-
-              uint8_t* ia_na_optptr = (*ia_na_p).optval;
-              if(ia_addr_len) {
-                set_optval6(ia_na_optptr, DHCP6_OPT_IA_ADDR, ia_addr, ia_addr_len);
-                ia_na_optptr += (ia_addr_len + 4);
-                free(ia_addr);
-              }
-              if(status_code_len) {
-                set_optval6(ia_na_optptr, DHCP6_OPT_STATUS_CODE, status_code,
-                    status_code_len);
-                ia_na_optptr += (status_code_len);
-                free(status_code);
-              }
-
-              //Response: Identity Association for Non-temporary Address
-              optptr = set_optval6(optptr, DHCP6_OPT_IA_NA, server_ia_na,
-                  server_ia_na_len);
-              optlen += (server_ia_na_len + 4);
-              free(client_ia_na);free(server_ia_na);
-            }
-            //Receive: Identity Association for Prefix Delegation
-            else if(get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
-                  DHCP6_OPT_IA_PD, &client_ia_pd_len, &client_ia_pd)) {
-
-              //TODO
-              //Response: Identity Association for Prefix Delegation
-            }
-
-            //DUID type: link-layer address plus time
-            if(ntohs((*(struct optval_duid_llt*)client_duid).type) ==
-                DHCP6_DUID_LLT) {
-              server_duid_len = 8+sizeof(gconfig.server_mac);
-              server_duid = xzalloc(server_duid_len);
-              struct optval_duid_llt *server_duid_p =
-                (struct optval_duid_llt*)server_duid;
-              (*server_duid_p).type = htons(1);
-              (*server_duid_p).hwtype = htons(1);
-              (*server_duid_p).time = htonl((uint32_t)
-                  (time(NULL) - 946684800) & 0xffffffff);
-              memcpy((*server_duid_p).lladdr, gconfig.server_mac,
-                  sizeof(gconfig.server_mac));
-              memcpy(&client_lla, (*(struct optval_duid_llt*)client_duid).lladdr,
-                  sizeof(client_lla));
-
-              //Response: Server Identifier (DUID)
-              optptr = set_optval6(optptr, DHCP6_OPT_SERVERID, server_duid,
-                  server_duid_len);
-              optlen += (server_duid_len + 4);
-              //Response: Client Identifier
-              optptr = set_optval6(optptr, DHCP6_OPT_CLIENTID, client_duid,
-                  client_duid_len);
-              optlen += (client_duid_len + 4);
-              free(client_duid);free(server_duid);
-            }
-
-            send_packet6(0, client_lla, optlen);
-            write_lease6file();
-            break;
-          case DHCP6REQUEST:
-            dbg("Message Type: DHCP6REQUEST\n");
-            optptr = prepare_send_pkt6(DHCP6REPLY);
-            optlen = 0;
-
-            //Receive: Client Identifier (DUID)
-            get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
-                DHCP6_OPT_CLIENTID, &client_duid_len, &client_duid);
-            optptr = set_optval6(optptr, DHCP6_OPT_CLIENTID, client_duid,
-                client_duid_len);
-            optlen += (client_duid_len + 4);
-            memcpy(client_lla, (*(struct optval_duid_llt*)client_duid).lladdr,
-                sizeof(client_lla));
-
-            //Receive: Identity Association for Non-temporary Address
-            if(get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
-                  DHCP6_OPT_IA_NA, &client_ia_na_len, &client_ia_na)) {
-              uint16_t ia_addr_len = 0, status_code_len = 0;
-              void *ia_addr, *status_code;
-              uint16_t server_ia_na_len = sizeof(struct optval_ia_na);
-              char *status_code_msg;
-
-              //Check IA Address
-              get_optval6((uint8_t*)(*(struct optval_ia_na*)client_ia_na).optval,
-                  DHCP6_OPT_IA_ADDR, &ia_addr_len, &ia_addr);
-              struct optval_ia_addr *ia_addr_p = (struct optval_ia_addr*)ia_addr;
-              if(verifyip6_in_lease((*ia_addr_p).ipv6_addr, client_duid,
-                    DHCP6_OPT_IA_NA, (*(struct optval_ia_na*)client_ia_na).iaid)
-                  == -1) {
-                server_ia_na_len += (ia_addr_len + 4);
-                //Add Status Code
-                status_code_msg = xstrdup("Assigned an address.");
-                status_code_len = strlen(status_code_msg) + 1;
-                status_code = xzalloc(status_code_len);
-                struct optval_status_code *status_code_p =
-                  (struct optval_status_code*)status_code;
-                (*status_code_p).status_code = htons(DHCP6_STATUS_SUCCESS);
-                memcpy((*status_code_p).status_msg, status_code_msg,
-                    status_code_len);
-                server_ia_na_len += (status_code_len+4);
-              } else {
-                //TODO send failed status code
-                break;
-              }
-
-              //combine options
-              server_ia_na = xzalloc(server_ia_na_len);
-              struct optval_ia_na *ia_na_p = (struct optval_ia_na*)server_ia_na;
-              (*ia_na_p).iaid = (*(struct optval_ia_na*)client_ia_na).iaid;
-              (*ia_na_p).t1 = gconfig.t1;
-              (*ia_na_p).t2 = gconfig.t2;
-
-              uint8_t* ia_na_optptr = (*ia_na_p).optval;
-              ia_na_optptr = set_optval6(ia_na_optptr, DHCP6_OPT_IA_ADDR,
-                  ia_addr, ia_addr_len);
-              free(ia_addr);
-
-              if(status_code_len) {
-                ia_na_optptr = set_optval6(ia_na_optptr, DHCP6_OPT_STATUS_CODE,
-                    status_code, status_code_len);
-                free(status_code);
-              }
-
-              //Response: Identity Association for Non-temporary Address
-              //(Status Code added)
-              optptr = set_optval6(optptr, DHCP6_OPT_IA_NA,
-                  server_ia_na, server_ia_na_len);
-              optlen += (server_ia_na_len + 4);
-              free(client_ia_na);free(server_ia_na);
-            }
-
-            //Receive: Server Identifier (DUID)
-            get_optval6((uint8_t*)&gstate.rcvd.rcvd_pkt6.options,
-                DHCP6_OPT_SERVERID, &server_duid_len, &server_duid);
-            optptr = set_optval6(optptr, DHCP6_OPT_SERVERID,
-                server_duid, server_duid_len);
-            optlen += (server_duid_len + 4);
-
-            free(client_duid); free(server_duid);
-
-            send_packet6(0, client_lla, optlen);
-            write_lease6file();
-            break;
-          case DHCP6DECLINE:  //TODO
-          case DHCP6RENEW:    //TODO
-          case DHCP6REBIND:   //TODO
-          case DHCP6RELEASE:
-            dbg("Message Type: DHCP6RELEASE\n");
-            optptr = prepare_send_pkt6(DHCP6REPLY);
-            break;
-          default:
-            dbg("Message Type : %u\n", gstate.rqcode);
-            break;
-        }
-        
-      } else {
-        if(read_packet() < 0) {
-          open_listensock();
-          continue;
-        }
-        waited += time(NULL) - timestmp;
-
-        get_optval((uint8_t*)&gstate.rcvd.rcvd_pkt.options,
-            DHCP_OPT_MESSAGE_TYPE, &gstate.rqcode);
-        if (gstate.rqcode == 0 || gstate.rqcode < DHCPDISCOVER 
-            || gstate.rqcode > DHCPINFORM) {
-          dbg("no or bad message type option, ignoring packet.\n");
-          continue;
-        }
-        get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-            DHCP_OPT_SERVER_ID, &serverid);
-        if (serverid && (serverid != gconfig.server_nip)) {
-          dbg("server ID doesn't match, ignoring packet.\n");
-          continue;
-        }
-
-        waited += time(NULL) - timestmp;
-        switch (gstate.rqcode) {
-          case DHCPDISCOVER:
-            msgtype = DHCPOFFER;
-            dbg("Message Type : DHCPDISCOVER\n");
-            get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-                DHCP_OPT_REQUESTED_IP, &requested_nip);
-            get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-                DHCP_OPT_HOST_NAME, &hstname);
-            reqested_lease = gconfig.offer_time;
-            get_reqparam(&gstate.rqopt);
-            optptr = prepare_send_pkt();
-            gstate.send.send_pkt.yiaddr = getip_from_pool(requested_nip,
-                gstate.rcvd.rcvd_pkt.chaddr, &reqested_lease, hstname);
-            if(!gstate.send.send_pkt.yiaddr){
-              msgtype = DHCPNAK;
-              optptr = set_optval(optptr, DHCP_OPT_MESSAGE_TYPE, &msgtype, 1);
-              send_packet(1);
-              break;
-            }
-            get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-                DHCP_OPT_LEASE_TIME, &reqested_lease);
-            reqested_lease = htonl(get_lease(reqested_lease + time(NULL)));
-            optptr = set_optval(optptr, DHCP_OPT_MESSAGE_TYPE, &msgtype, 1);
-            optptr = set_optval(optptr, DHCP_OPT_SERVER_ID, &gconfig.server_nip, 4);
-            optptr = set_optval(optptr, DHCP_OPT_LEASE_TIME, &reqested_lease, 4);
-            optptr = set_reqparam(optptr, gstate.rqopt);
-            send_packet(1);
-            break;
-          case DHCPREQUEST:
-            msgtype = DHCPACK;
-            dbg("Message Type : DHCPREQUEST\n");
-            optptr = prepare_send_pkt();
-            get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-                DHCP_OPT_REQUESTED_IP, &requested_nip);
-            get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-                DHCP_OPT_LEASE_TIME, &reqested_lease);
-            get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-                DHCP_OPT_HOST_NAME, &hstname);
-            gstate.send.send_pkt.yiaddr = getip_from_pool(requested_nip,
-                gstate.rcvd.rcvd_pkt.chaddr, &reqested_lease, hstname);
-            if (!serverid) reqested_lease = gconfig.max_lease_sec;
-            if (!gstate.send.send_pkt.yiaddr) {
-              msgtype = DHCPNAK;
-              optptr = set_optval(optptr, DHCP_OPT_MESSAGE_TYPE, &msgtype, 1);
-              send_packet(1);
-              break;
-            }
-            optptr = set_optval(optptr, DHCP_OPT_MESSAGE_TYPE, &msgtype, 1);
-            optptr = set_optval(optptr, DHCP_OPT_SERVER_ID, &gconfig.server_nip, 4);
-            reqested_lease = htonl(reqested_lease);
-            optptr = set_optval(optptr, DHCP_OPT_LEASE_TIME, &reqested_lease, 4);
-            send_packet(1);
-            write_leasefile();
-            break;
-          case DHCPDECLINE:// FALL THROUGH
-          case DHCPRELEASE:
-            dbg("Message Type : DHCPDECLINE or DHCPRELEASE \n");
-            get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-                DHCP_OPT_SERVER_ID, &serverid);
-            if (serverid != gconfig.server_nip) break;
-            get_optval((uint8_t*) &gstate.rcvd.rcvd_pkt.options,
-                DHCP_OPT_REQUESTED_IP, &requested_nip);
-            delip_from_lease(requested_nip, gstate.rcvd.rcvd_pkt.chaddr,
-                (gstate.rqcode==DHCPRELEASE)?0:gconfig.decline_time);
-            break;
-          default:
-            dbg("Message Type : %u\n", gstate.rqcode);
-            break;
-        }
-      }
-    }
+    for (v6 = 0; v6<2; v6++)
+      if (pfd[1+v6].revents) serve_socket(v6);
   }
 }
@@ -3,7 +3,8 @@
  * Copyright 2014 Sandeep Sharma <sandeep.jack2756@gmail.com>
  * Copyright 2014 Ashwini Kumar <ak.ashwini1981@gmail.com>
  *
- * See: http://cm.bell-labs.com/cm/cs/cstr/41.pdf
+ * See: http://www.xmailserver.org/diff2.pdf (Myers, "An O(ND) Difference
+ * Algorithm and Its Variations")
 
 USE_DIFF(NEWTOY(diff, "<2>2B(ignore-blank-lines)d(minimal)b(ignore-space-change)ut(expand-tabs)w(ignore-all-space)i(ignore-case)T(initial-tab)s(report-identical-files)q(brief)a(text)L(label)*S(starting-file):N(new-file)r(recursive)U(unified)#<0=3", TOYFLAG_USR|TOYFLAG_BIN))
 
@@ -40,21 +41,13 @@ GLOBALS(
 
   int dir_num, size, is_binary, status, change, len[2];
   int *offset[2];
+  char *same;
 )
 
 #define MIN(x,y) ((x) < (y) ? (x) : (y))
 #define MAX(x,y) ((x) > (y) ? (x) : (y))
 #define IS_STDIN(s)     ((s)[0] == '-' && !(s)[1])
 
-struct v_vector {
-  unsigned serial:31;
-  unsigned last:1;
-  union {
-    unsigned hash;
-    unsigned p;
-  };
-};
-
 struct diff {
   long a, b, c, d, prev, suff;
 };
@@ -64,14 +57,13 @@ static struct dir {
   int nr_elm;
 } dir[2];
 
-struct candidate {
-  int a, b;
-  struct candidate *prev, *next;
-};
-
+// Line l (counting from 1) of a file runs from offset[l-1] to offset[l],
+// where a last line with no newline ends one past the end of the map.
 static struct file {
   FILE *fp;
   int len;
+  char *map;
+  off_t size;
 } file[2];
 
 enum {
@@ -79,295 +71,303 @@ enum {
   DIFFER,
 };
 
-enum {
-  empty = 1 << 9,
-  eol = 1 << 10,
-  eof = 1 << 11,
-  space = 1 << 12
+// Lines are compared as the string of characters left after -biw folding,
+// so walk a line a character at a time: -w drops whitespace, -b turns each
+// run of it into one space (counting the end of the line as whitespace).
+struct fold {
+  char *s, *e;
+  int sp;
 };
 
-static int comp(const void *a, const void* b)
+static int fold_next(struct fold *fo)
 {
-  int i = ((struct v_vector *)a)->hash -
-    ((struct v_vector *)b)->hash;
+  int c;
+
+  for (;;) {
+    if (fo->s == fo->e) {
+      if ((toys.optflags & (FLAG_b|FLAG_w)) == FLAG_b && !fo->sp)
+        return fo->sp = ' ';
+      return -1;
+    }
+    c = *(unsigned char *)fo->s++;
+    if (isspace(c) && (toys.optflags & (FLAG_b|FLAG_w))) {
+      if ((toys.optflags & FLAG_w) || fo->sp) continue;
+      return fo->sp = ' ';
+    }
+    fo->sp = 0;
+    if ((toys.optflags & FLAG_i) && c >= 'A' && c <= 'Z') c = tolower(c);
 
-  if (!i) i = ((struct v_vector *)a)->serial -
-    ((struct v_vector *)b)->serial;
-  return i;
+    return c;
+  }
 }
 
-static int search (struct candidate **K, int r, int k, int j)
+static void fold_line(struct fold *fo, int f, int l)
 {
-  int low = r, upper = k, mid;
+  fo->s = file[f].map + TT.offset[f][l-1];
+  fo->e = file[f].map + MIN(TT.offset[f][l], file[f].size);
+  fo->sp = 0;
+}
 
-  mid = (low + upper) / 2;
-  while (low <= mid) {
-    if (((struct candidate*)(K[mid]))->b < j &&
-        ((struct candidate*)(K[mid + 1]))->b > j)
-      return mid;
+static unsigned line_hash(int f, int l)
+{
+  struct fold fo;
+  unsigned h = 5381;
+  int c;
 
-    if (((struct candidate*)(K[mid]))->b < j) low = mid + 1;
-    else if (((struct candidate*)(K[mid]))->b > j) upper = mid - 1;
-    else return -1;
+  fold_line(&fo, f, l);
+  while ((c = fold_next(&fo)) != -1) h = h*33 + c;
 
-    mid = (low + upper) / 2;
-  }
-  return -1;
+  return h;
 }
 
-static struct candidate * new_candidate (int i, int j, struct candidate* prev)
+static int line_same(int f1, int l1, int f2, int l2)
 {
-  struct candidate *c = xzalloc(sizeof(struct candidate));
-
-  c->a = i;
-  c->b = j;
-  c->prev = prev;
-  return c;
-}
+  struct fold a, b;
+  int c;
 
+  fold_line(&a, f1, l1);
+  fold_line(&b, f2, l2);
+  while ((c = fold_next(&a)) == fold_next(&b)) if (c == -1) return 1;
 
-static void free_candidates(struct candidate *c)
-{
-  struct candidate *t = c;
-  
-  while ((t = c)) {
-    c = c->next;
-    free(t);
-  }
+  return 0;
 }
-/*
- * 1. Search K[r: k] for an element K[s] such that K[s]-> b < j and K[s + 1]->b > j
- * 2. if found do
- *  2.a. If K[s + 1]->b > j do K[r] = c; r = s+1 and c = candidate(i, j, K[s]) //we have a candidate
- *  2.b. if s = k (fence reached move it further) do K[k + 2] = K[k + 1], k++
- * 3. if E[p].last true break i.e we have reached at the end of an equiv class
- *    else p = p + 1 //keep traversing the equiv class.
- * 4. K[r] = c //Save the sucessfully filled k-candidate.
- */
-static void  do_merge(struct candidate **K, int *k, int i,
-    struct v_vector *E, int p)
+
+static void map_file(int f)
 {
-  int r = 0, s, j;
-  struct candidate *pr = 0, *c = K[0];
+  int fd = fileno(file[f].fp);
 
-  while (1) {
-    j = E[p].serial;
-    s = search(K, r, *k, j);
-    if (s >= 0 && (((struct candidate*)(K[s]))->b < j &&
-          ((struct candidate*)(K[s + 1]))->b > j)) {
-
-      if (((struct candidate*)(K[s + 1]))->b > j) {
-        pr = K[s];
-        if (r && K[r]) c->next = K[r];
-        K[r] = c;
-        r = s + 1;
-        c = new_candidate(i , j, pr);
-      }
-      if (s == *k) {
-        K[*k + 2] = K[*k + 1];
-        *k = *k + 1;
-        break;
-      }
-    }
-    if (E[p].last) break;
-    else p = p + 1;
+  file[f].size = fdlength(fd);
+  file[f].map = 0;
+  if (file[f].size) {
+    file[f].map = mmap(0, file[f].size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file[f].map == MAP_FAILED) perror_exit("mmap");
   }
-  K[r] = c;
 }
 
-static FILE* read_stdin()
+static void unmap_files(void)
 {
-  char tmp_name[] = "/tmp/diffXXXXXX";
-  int rd, wr, tmpfd = mkstemp(tmp_name);
-
-  if (tmpfd == -1) perror_exit("mkstemp");
-  unlink(tmp_name);
-
-  while (1) {
-    rd = xread(STDIN_FILENO, toybuf, sizeof(toybuf));
+  int f;
 
-    if (!rd) break;
-    if (rd < 0) perror_exit("read error");
-    wr = writeall(tmpfd, toybuf, rd);
-    if (wr < 0) perror_exit("write");
+  for (f = 0; f < 2; f++) {
+    if (file[f].map) munmap(file[f].map, file[f].size);
+    file[f].map = 0;
   }
-  return fdopen(tmpfd, "r");
 }
 
-static int read_tok(FILE *fp, off_t *off, int tok)
+// Find where the (mapped) file's lines start.
+static void index_lines(int f)
 {
-  int t = 0, is_space;
+  int size = 100;
+  char *s, *nl, *end;
+
+  TT.offset[f] = xmalloc(size*sizeof(int));
+  TT.offset[f][file[f].len = 0] = 0;
+  for (s = file[f].map, end = s + file[f].size; s < end; s = nl) {
+    if (size == ++file[f].len+1)
+      TT.offset[f] = xrealloc(TT.offset[f], (size *= 2)*sizeof(int));
+    if ((nl = memchr(s, '\n', end - s))) nl++;
+    else nl = end + 1;
+    TT.offset[f][file[f].len] = nl - file[f].map;
+  }
+}
 
-  tok |= empty;
-  while (!(tok & eol)) {
+// Myers' O(ND) diff, in linear space: find the middle snake of the
+// cheapest edit script, then recurse on either side of it. The x and y
+// arrays hold equivalence class numbers for the lines still in play, and
+// xchg/ychg end up marking which of those are deletions/insertions. fv
+// and bv hold the furthest x reached on each diagonal (x-y) going forward
+// from the start and back from the end. Past a cost of limit, settle for
+// whichever partial path got closest to its goal, which isn't minimal but
+// keeps very different files from going quadratic.
+struct myers {
+  int *x, *y, *fv, *bv, limit;
+  char *xchg, *ychg;
+};
 
-    t = fgetc(fp);
-    if (off && t != EOF) *off += 1;
-    is_space = isspace(t) || (t == EOF);
-    tok |= (t & (eof + eol)); //set tok eof+eol when t is eof
+static void myers_mid(struct myers *m, int x0, int x1, int y0, int y1,
+  int *xm, int *ym)
+{
+  int *fv = m->fv, *bv = m->bv, kmin = x0-y1, kmax = x1-y0, fk = x0-y0,
+    bk = x1-y1, odd = (fk-bk)&1, flo = fk, fhi = fk, blo = bk, bhi = bk,
+    d, k, x, y, best, bx = 0;
+
+  fv[fk] = x0;
+  bv[bk] = x1;
+  for (d = 1;; d++) {
+    // Widen each search by a diagonal at both ends where there's room,
+    // then take one more edit along each diagonal and follow the matches.
+    if (flo > kmin) fv[--flo-1] = -1;
+    else flo++;
+    if (fhi < kmax) fv[++fhi+1] = -1;
+    else fhi--;
+    for (k = fhi; k >= flo; k -= 2) {
+      x = (fv[k-1] < fv[k+1]) ? fv[k+1] : fv[k-1]+1;
+      for (y = x-k; x < x1 && y < y1 && m->x[x] == m->y[y]; x++, y++);
+      fv[k] = x;
+      if (odd && k >= blo && k <= bhi && bv[k] <= x) goto done;
+    }
 
-    if (t == '\n') tok |= eol;
-    if (toys.optflags & FLAG_i)
-      if (t >= 'A' && t <= 'Z') t = tolower(t);
+    if (blo > kmin) bv[--blo-1] = INT_MAX;
+    else blo++;
+    if (bhi < kmax) bv[++bhi+1] = INT_MAX;
+    else bhi--;
+    for (k = bhi; k >= blo; k -= 2) {
+      x = (bv[k-1] < bv[k+1]) ? bv[k-1] : bv[k+1]-1;
+      for (y = x-k; x > x0 && y > y0 && m->x[x-1] == m->y[y-1]; x--, y--);
+      bv[k] = x;
+      if (!odd && k >= flo && k <= fhi && x <= fv[k]) goto done;
+    }
 
-    if (toys.optflags & FLAG_w && is_space) continue;
+    if (d < m->limit) continue;
 
-    if (toys.optflags & FLAG_b) {
-      if (tok & space) {
-        if (is_space) continue;
-        tok &= ~space;
-      } else if (is_space) t = space + ' ';
+    // Too expensive: split where the forward search got furthest (most
+    // x+y) or the backward one did (least), whichever went further.
+    for (best = -1, k = fhi; k >= flo; k -= 2) {
+      x = MIN(fv[k], x1);
+      if ((y = x-k) > y1) x = y1+k, y = y1;
+      if (x+y > best) best = x+y, bx = x;
     }
-    tok &= ~(empty + 0xff);  //remove empty and char too.
-    tok |= t; //add most recent char
-    break;
-  }
+    *xm = bx;
+    *ym = best-bx;
+    for (best = INT_MAX, k = bhi; k >= blo; k -= 2) {
+      x = MAX(bv[k], x0);
+      if ((y = x-k) < y0) x = y0+k, y = y0;
+      if (x+y < best) best = x+y, bx = x;
+    }
+    if (x1+y1-best >= *xm+*ym-x0-y0) *xm = bx, *ym = best-bx;
 
-  return tok;
+    return;
+  }
+done:
+  *xm = x;
+  *ym = y;
 }
 
-int bcomp(const void *a, const void *b) 
+static void myers_split(struct myers *m, int x0, int x1, int y0, int y1)
 {
-  struct v_vector *l = (struct v_vector*)a,
-                  *r = (struct v_vector*)b;
-  int ret = l->hash - r->hash;
-
-  if (!ret) {
-    if ((r -1)->last) return 0;
-    else return -1;
+  int xm, ym;
+
+  // Matching lines at either end are part of the answer already.
+  while (x0 < x1 && y0 < y1 && m->x[x0] == m->y[y0]) x0++, y0++;
+  while (x0 < x1 && y0 < y1 && m->x[x1-1] == m->y[y1-1]) x1--, y1--;
+
+  if (x0 == x1) while (y0 < y1) m->ychg[y0++] = 1;
+  else if (y0 == y1) while (x0 < x1) m->xchg[x0++] = 1;
+  else {
+    myers_mid(m, x0, x1, y0, y1, &xm, &ym);
+    myers_split(m, x0, xm, y0, ym);
+    myers_split(m, xm, x1, ym, y1);
   }
-  return ret;
 }
-/*  file[0] corresponds file 1 and file[1] correspond file 2.
- * 1. calc hashes for both the files and store them in vector(v[0], v[1])
- * 2. sort file[1] with hash as primary and serial as sec. key
- * 3. Form the equivalance class of file[1] stored in e vector. It lists all the equivalence
- *    classes of lines in file[1], with e.last = true on the last element of each class.
- *    The elements are ordered by serial within classes.
- * 4. Form the p vector stored in  p_vector. p_vector[i], if non-zero, now points in e vector
- *    to the begining of the equiv class of lines in file[1] equivalent to line
- *    i in file[0].
- * 5. Form the k-candidates as discribed in do_merge.
- * 6. Create a vector J[i] = j, such that i'th line in file[0] is j'th line of
- *    file[1], i.e J comprises LCS
+
+/* Returns a vector J where J[i] = j means line i of file[0] is matched with
+ * line j in file[1] (0 for no match), with J[len0+1] = len1+1 as a fence.
+ * 1. Index both files' lines (in TT.offset) and hash each one, once.
+ * 2. Number the equivalence classes of lines, so comparing two lines from
+ *    then on is comparing two ints.
+ * 3. Lines whose class doesn't appear in the other file can't match, so
+ *    leave them out of the search, which speeds up very different files.
+ * 4. Run Myers on what's left, and pair up the unchanged lines in order.
  */
-static int * create_j_vector()
+static int *create_j_vector()
 {
-  int tok, i, j, size = 100, k;
-  off_t off;
-  long hash;
-  int *p_vector, *J;
-  struct v_vector *v[2], *e;
-  struct candidate **kcand, *pr;
-
-  for (i = 0; i < 2; i++) {
-    tok = off = 0;
-    hash = 5831;
-    v[i] = xzalloc(size * sizeof(struct v_vector));
-    TT.offset[i] = xzalloc(size * sizeof(int));
-    file[i].len = 0;
-    fseek(file[i].fp, 0, SEEK_SET);
-
-    while (1) {
-      tok  = read_tok(file[i].fp, &off, tok);
-      if (!(tok & empty)) {
-        hash = ((hash << 5) + hash) + (tok & 0xff);
-        continue;
-      }
+  unsigned *hash, h;
+  int i, j, f, n[2], mask, classes = 0, *tab, *cls[2], *idx[2], *rep, *cnt;
+  struct myers m;
+  int *J;
 
-      if (size == ++file[i].len) {
-        size = size * 11 / 10;
-        v[i] = xrealloc(v[i], size*sizeof(struct v_vector));
-        TT.offset[i] = xrealloc(TT.offset[i], size*sizeof(int));
+  for (f = 0; f < 2; f++) index_lines(f);
+  for (mask = 1; mask < 2*(file[0].len + file[1].len); mask <<= 1);
+  tab = xzalloc(mask-- * sizeof(int));
+  hash = xmalloc((file[0].len + file[1].len + 1) * sizeof(unsigned));
+  rep = xmalloc((file[0].len + file[1].len + 1) * 2 * sizeof(int));
+  cnt = xzalloc((file[0].len + file[1].len + 1) * 2 * sizeof(int));
+  for (f = 0; f < 2; f++) {
+    cls[f] = xmalloc((file[f].len + 1) * sizeof(int));
+    for (i = 1; i <= file[f].len; i++) {
+      for (j = (h = line_hash(f, i)) & mask; tab[j]; j = (j+1) & mask) {
+        int c = tab[j]-1;
+
+        if (hash[c] == h && line_same(rep[2*c], rep[2*c+1], f, i)) break;
       }
-
-      v[i][file[i].len].hash = hash & INT_MAX;
-      TT.offset[i][file[i].len] = off;
-      if ((tok & eof)) {
-        TT.offset[i][file[i].len] = ++off;
-        break;
+      if (!tab[j]) {
+        hash[classes] = h;
+        rep[2*classes] = f;
+        rep[2*classes+1] = i;
+        tab[j] = ++classes;
       }
-      hash = 5831;  //next line
-      tok = 0;
+      cnt[2*(cls[f][i] = tab[j]-1) + f]++;
     }
-    if (TT.offset[i][file[i].len] - TT.offset[i][file[i].len - 1] == 1)
-      file[i].len--;
-  }
-
-  for (i = 0; i <= file[1].len; i++) v[1][i].serial = i;
-  qsort(v[1] + 1, file[1].len, sizeof(struct v_vector), comp);
-
-  e = v[1];
-  e[0].serial = 0;
-  e[0].last = 1;
-  for ( i = 1; i <= file[1].len; i++) {
-    if ((i == file[1].len) || (v[1][i].hash != v[1][i+1].hash)) e[i].last = 1;
-    else e[i].last = 0;
-  }
-
-  p_vector = xzalloc((file[0].len + 2) * sizeof(int));
-  for (i = 1; i <= file[0].len; i++) {
-    void *r = bsearch(&v[0][i], (e + 1), file[1].len, sizeof(e[0]), bcomp);
-    if (r) p_vector[i] = (struct v_vector*)r - e;
   }
-
-  for (i = 1; i <= file[0].len; i++)
-    e[i].p = p_vector[i];
-  free(p_vector);
-
-  size = 100;
-  kcand = xzalloc(size * sizeof(struct candidate*));
-
-  kcand[0] = new_candidate(0 , 0, NULL);
-  kcand[1] = new_candidate(file[0].len+1, file[1].len+1, NULL); //the fence
-
-  k = 0;  //last successfully filled k candidate.
-  for (i = 1; i <= file[0].len; i++) {
-
-    if (!e[i].p) continue;
-    if ((size - 2) == k) {
-      size = size * 11 / 10;
-      kcand = xrealloc(kcand, (size * sizeof(struct candidate*)));
+  free(tab);
+  free(hash);
+  free(rep);
+
+  for (f = 0; f < 2; f++) {
+    idx[f] = xmalloc((file[f].len + 1) * sizeof(int));
+    for (i = 1, n[f] = 0; i <= file[f].len; i++) {
+      if (!cnt[2*cls[f][i] + !f]) continue;
+      cls[f][n[f]] = cls[f][i];
+      idx[f][n[f]++] = i;
     }
-    do_merge(kcand, &k, i, e, e[i].p);
   }
-  free(v[0]); //no need for v_vector now.
-  free(v[1]);
+  free(cnt);
+
+  m.x = cls[0];
+  m.y = cls[1];
+  m.xchg = xzalloc(n[0] + n[1] + 2);
+  m.ychg = m.xchg + n[0] + 1;
+  m.fv = xmalloc((n[0] + n[1] + 3) * 2 * sizeof(int));
+  m.bv = m.fv + n[0] + n[1] + 3;
+  m.fv += n[1] + 1;
+  m.bv += n[1] + 1;
+  if (toys.optflags & FLAG_d) m.limit = INT_MAX;
+  else {
+    for (m.limit = 1, i = n[0] + n[1]; i; i >>= 2) m.limit <<= 1;
+    m.limit = MAX(256, m.limit);
+  }
+  myers_split(&m, 0, n[0], 0, n[1]);
 
   J = xzalloc((file[0].len + 2) * sizeof(int));
+  for (i = j = 0; i < n[0]; i++) {
+    if (m.xchg[i]) continue;
+    while (m.ychg[j]) j++;
+    J[idx[0][i]] = idx[1][j++];
+  }
+  J[file[0].len + 1] = file[1].len + 1; //mark boundary
 
-  for (pr = kcand[k]; pr; pr = pr->prev)
-    J[pr->a] = pr->b;
-  J[file[0].len + 1] = file[1].len+1; //mark boundary
+  free(m.xchg);
+  free(m.fv - n[1] - 1);
+  for (f = 0; f < 2; f++) {
+    free(cls[f]);
+    free(idx[f]);
+  }
 
-  for (i = k + 1; i >= 0; i--) free_candidates(kcand[i]);
-  free(kcand);
+  return J;
+}
 
-  for (i = 1; i <= file[0].len; i++) { // jackpot?
-    if (!J[i]) continue;
+static FILE* read_stdin()
+{
+  char tmp_name[] = "/tmp/diffXXXXXX";
+  int rd, wr, tmpfd = mkstemp(tmp_name);
 
-    fseek(file[0].fp, TT.offset[0][i - 1], SEEK_SET);
-    fseek(file[1].fp, TT.offset[1][J[i] - 1], SEEK_SET);
+  if (tmpfd == -1) perror_exit("mkstemp");
+  unlink(tmp_name);
 
-    for (j = J[i]; i <= file[0].len && J[i] == j; i++, j++) {
-      int tok0 = 0, tok1 = 0;
+  while (1) {
+    rd = xread(STDIN_FILENO, toybuf, sizeof(toybuf));
 
-      do {
-        tok0 = read_tok(file[0].fp, NULL, tok0);
-        tok1 = read_tok(file[1].fp, NULL, tok1);
-        if (((tok0 ^ tok1) & empty) || ((tok0 & 0xff) != (tok1 & 0xff)))
-          J[i] = 0;
-      } while (!(tok0 & tok1 & empty));
-    }
+    if (!rd) break;
+    if (rd < 0) perror_exit("read error");
+    wr = writeall(tmpfd, toybuf, rd);
+    if (wr < 0) perror_exit("write");
   }
-  return J;
+  return fdopen(tmpfd, "r");
 }
 
 static int *diff(char **files)
 {
-  size_t i ,j;
-  int s, t;
-  char *bufi, *bufj;
+  int i;
 
   TT.is_binary = 0; //loop calls to diff
   TT.status = SAME;
@@ -383,50 +383,47 @@ static int *diff(char **files)
     }
   }
 
-  s = sizeof(toybuf)/2;
-  bufi = toybuf;
-  bufj = (toybuf + s);
-
-  fseek(file[0].fp, 0, SEEK_SET);
-  fseek(file[1].fp, 0, SEEK_SET);
-
-  if (toys.optflags & FLAG_a) return create_j_vector();
-
-  while (1) {
-    i = fread(bufi, 1, s, file[0].fp);
-    j = fread(bufj, 1, s, file[1].fp);
-
-    if (i != j) TT.status = DIFFER;
-
-    for (t = 0; t < i && !TT.is_binary; t++)
-      if (!bufi[t]) TT.is_binary = 1;
-    for (t = 0; t < j && !TT.is_binary; t++)
-      if (!bufj[t]) TT.is_binary = 1;
-
-    i = MIN(i, j);
-    for (t = 0; t < i; t++)
-      if (bufi[t] != bufj[t]) TT.status = DIFFER;
+  // Different sizes is all -q needs to know, unless folding could hide it.
+  if ((toys.optflags & FLAG_q) && !(toys.optflags & (FLAG_a|FLAG_b|FLAG_w
+      |FLAG_i|FLAG_B)) && fdlength(fileno(file[0].fp))
+      != fdlength(fileno(file[1].fp))) {
+    TT.status = DIFFER;
+    return NULL;
+  }
 
-    if (!i || !j) break;
+  for (i = 0; i < 2; i++) map_file(i);
+  if (!(toys.optflags & FLAG_a)) {
+    if (file[0].size == file[1].size && (!file[0].size
+        || !memcmp(file[0].map, file[1].map, file[0].size))) {
+      unmap_files();
+      return NULL;
+    }
+    TT.status = DIFFER;
+    for (i = 0; i < 2; i++)
+      if (memchr(file[i].map, 0, file[i].size)) TT.is_binary = 1;
+    if (TT.is_binary || ((toys.optflags & FLAG_q)
+        && !(toys.optflags & (FLAG_b|FLAG_w|FLAG_i|FLAG_B)))) {
+      unmap_files();
+      return NULL;
+    }
   }
-  if (TT.is_binary || (TT.status == SAME)) return NULL;
+
   return create_j_vector();
 }
 
-static void print_diff(int a, int b, char c, int *off_set, FILE *fp)
+static void print_diff(int a, int b, char c, int f)
 {
-  int i, j, cc, cl;
+  int i, j, cc, cl, *off_set = TT.offset[f];
 
   for (i = a; i <= b; i++) {
-    fseek(fp, off_set[i - 1], SEEK_SET);
     putchar(c);
     if (toys.optflags & FLAG_T) putchar('\t');
-    for (j = 0, cl = 0; j <  (off_set[i] - off_set[i - 1]); j++) {
-      cc = fgetc(fp);
-      if (cc == EOF) {
+    for (j = off_set[i - 1], cl = 0; j < off_set[i]; j++) {
+      if (j == file[f].size) {
         printf("\n\\ No newline at end of file\n");
         return;
       }
+      cc = file[f].map[j];
       if ((cc == '\t') && (toys.optflags & FLAG_t))
         do putchar(' '); while (++cl & 7);
       else {
@@ -616,12 +613,12 @@ calc_ct:
       printf("@@\n");
 
       for (t = ptr1; t <= ptr2; t++) {
-        if (t== ptr1) print_diff(t->suff, t->a-1, ' ', TT.offset[0], file[0].fp);
-        print_diff(t->a, t->b, '-', TT.offset[0], file[0].fp);
-        print_diff(t->c, t->d, '+', TT.offset[1], file[1].fp);
+        if (t== ptr1) print_diff(t->suff, t->a-1, ' ', 0);
+        print_diff(t->a, t->b, '-', 0);
+        print_diff(t->c, t->d, '+', 1);
         if (t == ptr2)
-          print_diff(t->b+1, (t)->prev, ' ', TT.offset[0], file[0].fp);
-        else print_diff(t->b+1, (t+1)->a-1, ' ', TT.offset[0], file[0].fp);
+          print_diff(t->b+1, (t)->prev, ' ', 0);
+        else print_diff(t->b+1, (t+1)->a-1, ' ', 0);
       }
       ptr2++;
       ptr1 = ptr2;
@@ -632,6 +629,7 @@ calc_ct:
   free(J);
   free(TT.offset[0]);
   free(TT.offset[1]);
+  unmap_files();
 }
 
 static void show_status(char **files)
@@ -691,6 +689,12 @@ static void create_empty_entry(int l , int r, int j)
     else
       printf("File %s is a %s while file %s is a"
           " %s\n", path[0], "regular file", path[1], "directory");
+  } else if (!j && TT.same && TT.same[l] && (TT.same[l] == 1
+      || ((toys.optflags & FLAG_q) && !(toys.optflags & (FLAG_a|FLAG_b
+      |FLAG_w|FLAG_i|FLAG_B))))) {
+    // Already know the answer, see find_same()
+    TT.status = (TT.same[l] == 1) ? SAME : DIFFER;
+    show_status(path);
   } else {
     do_diff(f);
     show_status(path);
@@ -704,10 +708,129 @@ static void create_empty_entry(int l , int r, int j)
   }
 }
 
+// Before walking two trees, check which pairs of regular files with the
+// same name are byte for byte identical (or obviously not: different size)
+// so only the ones that differ need reading a line at a time, doing the
+// checks across several threads to keep the disks busy. Workers only see
+// their same_job (TT is per thread), and leave a 0 in same[] for anything
+// they couldn't tell, which then goes the usual way.
+
+#define SAME_THREADS 8
+
+struct same_job {
+  char **names, *same;
+  int count, step;
+#if CFG_TOYBOX_THREADS
+  pthread_t tid;
+  int started;
+#endif
+};
+
+static int same_file(char *a, char *b, char *buf)
+{
+  struct stat st[2];
+  int fd[2], i, len, rc = 0;
+
+  fd[0] = open(a, O_RDONLY);
+  fd[1] = open(b, O_RDONLY);
+  if (fd[0] == -1 || fd[1] == -1 || fstat(fd[0], st) || fstat(fd[1], st+1)
+      || !S_ISREG(st[0].st_mode) || !S_ISREG(st[1].st_mode)) goto done;
+  rc = 2;
+  if (st[0].st_size != st[1].st_size) goto done;
+  for (;;) {
+    if ((len = readall(fd[0], buf, 65536)) < 0
+        || readall(fd[1], buf+65536, 65536) != len) {
+      rc = 0;
+      break;
+    }
+    if (memcmp(buf, buf+65536, len)) break;
+    if (len < 65536) {
+      rc = 1;
+      break;
+    }
+  }
+done:
+  for (i = 0; i < 2; i++) if (fd[i] != -1) close(fd[i]);
+
+  return rc;
+}
+
+static void *same_worker(void *arg)
+{
+  struct same_job *job = arg;
+  char *buf = malloc(2*65536);
+  int i;
+
+  if (buf) for (i = 0; i < job->count; i += job->step)
+    job->same[i] = same_file(job->names[2*i], job->names[2*i+1], buf);
+  free(buf);
+
+  return 0;
+}
+
+static void find_same(int *start)
+{
+  struct same_job jobs[SAME_THREADS];
+  char **names = xmalloc(2*MIN(dir[0].nr_elm, dir[1].nr_elm)*sizeof(char *)),
+    *same;
+  int l = start[0], r = start[1], *at, count = 0, n = 1, i, j;
+
+  // Pair up the names the way diff_dir() will.
+  at = xmalloc(MIN(dir[0].nr_elm, dir[1].nr_elm)*sizeof(int));
+  while (l < dir[0].nr_elm && r < dir[1].nr_elm) {
+    if (!(j = strcmp(dir[0].list[l] + TT.len[0], dir[1].list[r] + TT.len[1]))) {
+      names[2*count] = dir[0].list[l];
+      names[2*count+1] = dir[1].list[r];
+      at[count++] = l;
+    }
+    if (j <= 0) l++;
+    if (j >= 0) r++;
+  }
+
+  same = xzalloc(count+1);
+#if CFG_TOYBOX_THREADS
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  n = MAX(1, MIN(n, SAME_THREADS));
+  if (count < 2*n) n = 1;
+#endif
+  for (i = 0; i < n; i++) {
+    jobs[i].names = names + 2*i;
+    jobs[i].same = same + i;
+    jobs[i].count = count - i;
+    jobs[i].step = n;
+  }
+#if CFG_TOYBOX_THREADS
+  {
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    for (i = 1; i < n; i++)
+      jobs[i].started = !toy_worker_create(&jobs[i].tid, &attr, same_worker,
+        jobs+i);
+    pthread_attr_destroy(&attr);
+  }
+#endif
+  same_worker(jobs);
+#if CFG_TOYBOX_THREADS
+  for (i = 1; i < n; i++) {
+    if (jobs[i].started) pthread_join(jobs[i].tid, 0);
+    else same_worker(jobs+i);
+  }
+#endif
+
+  TT.same = xzalloc(dir[0].nr_elm);
+  for (i = 0; i < count; i++) TT.same[at[i]] = same[i];
+  free(same);
+  free(names);
+  free(at);
+}
+
 static void diff_dir(int *start)
 {
   int l, r, j = 0;
 
+  find_same(start);
   l = start[0]; //left side file start
   r = start[1]; //right side file start
   while (l < dir[0].nr_elm && r < dir[1].nr_elm) {
@@ -761,6 +884,8 @@ static void diff_dir(int *start)
   }
   free(dir[0].list[0]); //we are done, free root nodes too
   free(dir[1].list[0]);
+  free(TT.same);
+  TT.same = 0;
 }
 
 void diff_main(void)
@@ -15,25 +15,31 @@ config FSCK
 
     -A      Walk /etc/fstab and check all filesystems
     -N      Don't execute, just show what would be done
-    -P      With -A, check filesystems in parallel
+    -P      With -A, check root in parallel with the rest of its pass
     -R      With -A, skip the root filesystem
     -T      Don't show title on startup
     -V      Verbose
-    -C n    Write status information to specified filedescriptor
+    -C n    Write progress of all checkers to n, as a bar if n is 0
+    -s      Check one filesystem at a time
     -t TYPE List of filesystem types to check
 
+    With -A each fstab pass is checked in order, and within a pass
+    filesystems on different disks are checked at once. Filesystems on
+    the same disk (found through sysfs, under any md or dm layers) are
+    checked one after another. FSCK_MAX_INST limits how many run at once.
 */
 
 #define FOR_fsck
 #include "toys.h"
 #include <mntent.h>
+#include <poll.h>
 
 #define FLAG_WITHOUT_NO_PRFX 1
 #define FLAG_WITH_NO_PRFX 2
 #define FLAG_DONE 1
 
 GLOBALS(
-  int fd_num;
+  long fd_num;
   char *t_list;
 
   struct double_list *devices;
@@ -47,15 +53,21 @@ GLOBALS(
 )
 
 struct f_sys_info {
-  char *device, *mountpt, *type, *opts;
+  char *device, *mountpt, *type, *opts, *disks;
   int passno, flag;
   struct f_sys_info *next;
 };
 
 struct child_list {
   struct child_list *next;
+  struct f_sys_info *fs;
   pid_t pid;
   char *prog_name, *dev_name;
+
+  // -C progress: the read end of the checker's pipe, and what it last said
+  int fd, pass, len;
+  unsigned long long cur, max;
+  char line[80];
 };
 
 static struct f_sys_info *filesys_info = NULL; //fstab entry list
@@ -184,6 +196,152 @@ static int to_be_ignored(struct f_sys_info *finfo)
   return ((TT.negate) ? !ret : ret);
 }
 
+// Add the physical disks under the sysfs directory for a block device to
+// *disks: a partition's disk is the directory above it, and an md or dm
+// device's are under its slaves.
+static void find_disks(char *sys, char **disks)
+{
+  DIR *dir;
+  struct dirent *de;
+  char *s, *path;
+  int found = 0;
+
+  path = xmprintf("%s/partition", sys);
+  if (!access(path, F_OK) && (s = strrchr(sys, '/'))) *s = 0;
+  free(path);
+  path = xmprintf("%s/slaves", sys);
+  if ((dir = opendir(path))) {
+    while ((de = readdir(dir))) {
+      if (*de->d_name == '.') continue;
+      s = xmprintf("%s/%s", path, de->d_name);
+      free(sys);
+      sys = xabspath(s, 1);
+      free(s);
+      if (sys) {
+        find_disks(sys, disks);
+        found++;
+      }
+    }
+    closedir(dir);
+  }
+  free(path);
+  if (!found && (s = strrchr(sys, '/'))) {
+    path = *disks;
+    *disks = xmprintf("%s%s ", path ? path : " ", s+1);
+    free(path);
+  }
+  free(sys);
+}
+
+// Return the disks a filesystem lives on as " sda sdb ", or just its own
+// name if sysfs can't say.
+static char *fs_disks(struct f_sys_info *finfo)
+{
+  char *dev = finfo->device, *path = 0, *sys;
+  struct stat st;
+
+  if (finfo->disks) return finfo->disks;
+  if (!strncmp(dev, "UUID=", 5))
+    dev = path = xmprintf("/dev/disk/by-uuid/%s", dev+5);
+  else if (!strncmp(dev, "LABEL=", 6))
+    dev = path = xmprintf("/dev/disk/by-label/%s", dev+6);
+  if (!stat(dev, &st) && S_ISBLK(st.st_mode)) {
+    sprintf(toybuf, "/sys/dev/block/%u:%u", (unsigned)major(st.st_rdev),
+      (unsigned)minor(st.st_rdev));
+    if ((sys = xabspath(toybuf, 1))) find_disks(sys, &finfo->disks);
+  }
+  free(path);
+  if (!finfo->disks) finfo->disks = xmprintf(" %s ", finfo->device);
+
+  return finfo->disks;
+}
+
+// Is a checker running on any disk finfo is on?
+static int disk_busy(struct f_sys_info *finfo)
+{
+  struct child_list *child;
+  char *s, *end, *disks = fs_disks(finfo);
+
+  for (child = c_list; child; child = child->next) {
+    for (s = fs_disks(child->fs); (end = strchr(s+1, ' ')); s = end) {
+      *end = 0;
+      strcpy(toybuf, s);
+      *end = ' ';
+      strcat(toybuf, " ");
+      if (strstr(disks, toybuf)) return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Can't start another checker yet, for -s or FSCK_MAX_INST or because one
+// is already running on the same disk?
+static int must_wait(struct f_sys_info *finfo)
+{
+  return TT.nr_run && ((toys.optflags & FLAG_s)
+    || (TT.max_nr_run && TT.nr_run >= TT.max_nr_run) || disk_busy(finfo));
+}
+
+// -C: read what the checkers say ("pass current max device" lines), waiting
+// up to ms for some. A fd other than 0 gets the lines passed on whole, so
+// they don't interleave. For 0 they're drawn as one status line.
+static void read_progress(int ms)
+{
+  struct child_list *child;
+  struct pollfd *pfd;
+  char *s;
+  int n = 0, i, len, shown = 0;
+
+  for (child = c_list; child; child = child->next) n += child->fd != -1;
+  if (!n) {
+    msleep(ms);
+    return;
+  }
+  pfd = xzalloc(n*sizeof(*pfd));
+  for (i = 0, child = c_list; child; child = child->next)
+    if (child->fd != -1) {
+      pfd[i].fd = child->fd;
+      pfd[i++].events = POLLIN;
+    }
+  if (poll(pfd, n, ms) > 0) for (child = c_list; child; child = child->next) {
+    if (child->fd == -1) continue;
+    for (i = 0; i<n && pfd[i].fd != child->fd; i++);
+    if (i == n || !pfd[i].revents) continue;
+    len = read(child->fd, child->line+child->len,
+      sizeof(child->line)-1-child->len);
+    if (len < 1) {
+      close(child->fd);
+      child->fd = -1;
+      continue;
+    }
+    child->len += len;
+    child->line[child->len] = 0;
+    while ((s = strchr(child->line, '\n'))
+      || child->len == sizeof(child->line)-1)
+    {
+      if (!s) s = child->line+child->len-1;
+      *s++ = 0;
+      if (TT.fd_num) dprintf(TT.fd_num, "%s\n", child->line);
+      else sscanf(child->line, "%d %llu %llu", &child->pass, &child->cur,
+        &child->max);
+      memmove(child->line, s, child->len -= s-child->line);
+      child->line[child->len] = 0;
+    }
+  }
+  free(pfd);
+
+  if (TT.fd_num) return;
+  printf("\r");
+  for (child = c_list; child; child = child->next) if (child->max) {
+    printf("%s: pass %d %llu%%  ", child->dev_name, child->pass,
+      child->cur*100/child->max);
+    shown++;
+  }
+  if (shown) tty_esc("K");
+  fflush(stdout);
+}
+
 // find type and execute corresponding fsck.type prog.
 static void do_fsck(struct f_sys_info *finfo) 
 {
@@ -191,7 +349,7 @@ static void do_fsck(struct f_sys_info *finfo)
   char **args;
   char *type;
   pid_t pid;
-  int i = 1, j = 0;
+  int i = 1, j = 0, progress[2] = {-1, -1};
 
   if (strcmp(finfo->type, "auto")) type = finfo->type;
   else if (TT.t_list && (TT.t_list[0] != 'n' || TT.t_list[1] != 'o' || TT.t_list[0] != '!')
@@ -202,7 +360,12 @@ static void do_fsck(struct f_sys_info *finfo)
   args = xzalloc((toys.optc + 2 + 1 + 1) * sizeof(char*)); //+1, for NULL, +1 if -C
   args[0] = xmprintf("fsck.%s", type);
   
-  if(toys.optflags & FLAG_C) args[i++] = xmprintf("%s %d","-C", TT.fd_num);
+  // Each checker gets a pipe of its own for -C, which we read.
+  if ((toys.optflags & FLAG_C) && !(toys.optflags & FLAG_N)) {
+    if (pipe(progress)) perror_exit("pipe");
+    fcntl(*progress, F_SETFD, FD_CLOEXEC);
+    args[i++] = xmprintf("-C%d", progress[1]);
+  }
   while(toys.optargs[j]) {
     if(*toys.optargs[j]) args[i++] = xstrdup(toys.optargs[j]);
     j++;
@@ -230,11 +393,14 @@ static void do_fsck(struct f_sys_info *finfo)
     }
     if (!pid) xexec(args); //child, executes fsck.type
   } 
+  if (progress[1] != -1) close(progress[1]);
 
   child = xzalloc(sizeof(struct child_list)); //Parent, add to child list.
   child->dev_name = xstrdup(finfo->device);
   child->prog_name = args[0];
   child->pid = pid;
+  child->fs = finfo;
+  child->fd = *progress;
 
   if (c_list) {
     child->next = c_list;
@@ -255,7 +421,13 @@ static int wait_for(int for_all)
 
   errno = 0;
   if (!c_list) return 0;
-  while ((pid = wait(&status))) {
+  for (;;) {
+    // With -C their progress has to be read while they run.
+    if (toys.optflags & FLAG_C) {
+      read_progress(100);
+      if (TT.sig_num) kill_all();
+      if (!(pid = waitpid(-1, &status, WNOHANG))) continue;
+    } else if (!(pid = wait(&status))) break;
     temp = c_list;
     prev = temp;
     if (TT.sig_num) kill_all();
@@ -288,6 +460,12 @@ static int wait_for(int for_all)
       TT.nr_run--;
       if (prev == temp) c_list = c_list->next; //first node 
       else prev->next = temp->next;
+      if (temp->fd != -1) close(temp->fd);
+      if (!c_list && (toys.optflags & FLAG_C) && !TT.fd_num) {
+        printf("\r");
+        tty_esc("K");
+        fflush(stdout);
+      }
       free(temp->prog_name);
       free(temp->dev_name);
       free(temp);
@@ -334,20 +512,27 @@ static int scan_all(void)
   }
   passno = 1;
   while (1) {
+    int waiting;
+
     for (finfo = filesys_info; finfo; finfo = finfo->next) 
       if (!finfo->flag) break;
     if (!finfo) break;
 
-    for (finfo = filesys_info; finfo; finfo = finfo->next) {
-      if (finfo->flag) continue;
-      if (finfo->passno == passno) {
-        do_fsck(finfo);
-        finfo->flag |= FLAG_DONE;
-        if ((toys.optflags & FLAG_s) || (TT.nr_run 
-              && (TT.nr_run >= TT.max_nr_run))) ret |= wait_for(0);
+    // Start everything in this pass that isn't on a disk being checked,
+    // and each time a checker finishes look again.
+    do {
+      waiting = 0;
+      for (finfo = filesys_info; finfo; finfo = finfo->next) {
+        if (finfo->flag || finfo->passno != passno) continue;
+        if (must_wait(finfo)) waiting++;
+        else {
+          do_fsck(finfo);
+          finfo->flag |= FLAG_DONE;
+        }
       }
-    }
-    if (TT.sig_num) kill_all();
+      if (TT.sig_num) kill_all();
+      if (waiting) ret |= wait_for(0);
+    } while (waiting);
     ret |= wait_for(1);
     passno++;
   }
@@ -367,6 +552,9 @@ void fsck_main(void)
   FILE *fp;
   char *tmp, **arg = toys.optargs;
 
+  // Anything a previous run left here was freed when it exited.
+  filesys_info = 0;
+  c_list = 0;
   sigatexit(record_sig_num);
   while (*arg) {
     if ((**arg == '/') || strchr(*arg, '=')) {
@@ -405,10 +593,9 @@ void fsck_main(void)
       mt.mnt_passno = -1;
       finfo = create_db(&mt);
     }
+    while (must_wait(finfo)) toys.exitval |= wait_for(0);
     do_fsck(finfo);
     finfo->flag |= FLAG_DONE;
-    if ((toys.optflags & FLAG_s) || (TT.nr_run && (TT.nr_run >= TT.max_nr_run))) 
-      toys.exitval |= wait_for(0);
   }
   if (TT.sig_num) kill_all();
   toys.exitval |= wait_for(1);
@@ -427,6 +614,7 @@ free_all:
       free(finfo->mountpt);
       free(finfo->type);
       free(finfo->opts);
+      free(finfo->disks);
       free(finfo);
       finfo = temp;
     }
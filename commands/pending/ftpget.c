@@ -13,12 +13,12 @@ config FTPGET
   default n
   help
     usage: ftpget [-cv] [-u USER -p PASSWORD -P PORT] HOST_NAME [LOCAL_FILENAME] REMOTE_FILENAME
-    usage: ftpput [-v] [-u USER -p PASSWORD -P PORT] HOST_NAME [REMOTE_FILENAME] LOCAL_FILENAME
+    usage: ftpput [-cv] [-u USER -p PASSWORD -P PORT] HOST_NAME [REMOTE_FILENAME] LOCAL_FILENAME
 
     ftpget - Get a remote file from FTP.
     ftpput - Upload a local file on remote machine through FTP.
 
-    -c Continue previous transfer.
+    -c Continue previous transfer, and resume after the connection drops.
     -v Verbose.
     -u User name.
     -p Password.
@@ -35,6 +35,9 @@ GLOBALS(
   FILE *sockfp;
   int c;
   int isget;
+  int datafd;
+  long long size, offset, done;
+  unsigned long long start, shown;
   char buf[sizeof(struct sockaddr_storage)];
 )
 
@@ -49,6 +52,9 @@ GLOBALS(
 #define PASSWORD_REQUEST        331
 #define REQUESTED_PENDINGACTION 350
 
+#define FTP_RETRIES 5     // attempts in a row with nothing gained
+#define FTP_TIMEOUT 60    // seconds a connection can stall
+
 
 static void setport(unsigned port_num)
 {
@@ -63,6 +69,10 @@ static int connect_to_stream()
   int sockfd, af = ((struct sockaddr *)TT.buf)->sa_family;
 
   sockfd = xsocket(af, SOCK_STREAM, 0);
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO,
+    &(struct timeval){ .tv_sec = FTP_TIMEOUT }, sizeof(struct timeval));
+  setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO,
+    &(struct timeval){ .tv_sec = FTP_TIMEOUT }, sizeof(struct timeval));
   if (connect(sockfd, (struct sockaddr*)TT.buf,((af == AF_INET)? 
           sizeof(struct sockaddr_in):sizeof(struct sockaddr_in6))) < 0) {
     close(sockfd);
@@ -80,6 +90,7 @@ static void close_stream(char *msg_str)
   while ((*str >= 0x20) && (*str < 0x7f)) str++; 
   *str = '\0';
   if (TT.sockfp) fclose(TT.sockfp);
+  TT.sockfp = 0;
   error_exit("%s server response: %s", (msg_str) ? msg_str:"", toybuf);
 }
 
@@ -139,11 +150,11 @@ static void get_sockaddr(char *host)
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
 
-  status = getaddrinfo(host, port, &hints, &result); 
+  status = dns_getaddrinfo(host, port, &hints, &result);
   if (status) error_exit("bad address '%s' : %s", host, gai_strerror(status));
 
   memcpy(TT.buf, result->ai_addr, result->ai_addrlen);
-  freeaddrinfo(result);
+  free(result);
 } 
 
 // send commands to ftp fo PASV mode.
@@ -169,46 +180,77 @@ static void verify_pasv_mode(char *r_filename)
   *pch = '\0';
   portnum = portnum + (atolx_range(pch + 1, 0, 255) * 256);
   setport(htons(portnum));
-
-  if (TT.isget && get_ftp_response("SIZE", r_filename) != FTPFILE_STATUS)
-    TT.c = 0;
   return;
 
 close_stream:
   close_stream("PASV");
 }
 
-/*
- * verify the local file presence.
- * if present, get the size of the file.
- */
-static void is_localfile_present(char *l_filename)
+// Report progress on stderr with -v, at most every half second, and the
+// rate for the whole transfer at the end.
+static void show_progress(int last)
+{
+  unsigned long long now = millitime(), ms = now-TT.start;
+  char done[16], rate[16];
+
+  if (!last && now-TT.shown < 500) return;
+  TT.shown = now;
+  human_readable(done, TT.offset+TT.done, 0);
+  human_readable(rate, ms ? TT.done*1000/ms : 0, 0);
+  fprintf(stderr, "\r%s", done);
+  if (TT.size >= 0) {
+    char total[16];
+
+    human_readable(total, TT.size, 0);
+    fprintf(stderr, "/%s %3d%%", total,
+      TT.size ? (int)((TT.offset+TT.done)*100/TT.size) : 100);
+  }
+  fprintf(stderr, " %s/s%s", rate, last ? "\n" : "  ");
+}
+
+static void write_counted(int fd, char *buf, long len)
 {
-  struct stat sb;
-
-  if (stat(l_filename, &sb) < 0) perror_exit("stat");
-  //if local file present, then request for pending file action.
-  if (sb.st_size > 0) {
-    sprintf(toybuf, "REST %lu", (unsigned long) sb.st_size);
-    if (get_ftp_response(toybuf, NULL) != REQUESTED_PENDINGACTION) TT.c = 0;
-  } else TT.c = 0;
+  if (writeall(fd, buf, len) != len) perror_exit("write");
+  TT.done += len;
+  if (toys.optflags & FLAG_v) show_progress(0);
 }
 
+// Move the data a large buffer at a time, counting it, or when there's
+// no progress to show and the local end is a file the size will tell how
+// much went, let the kernel do it where it can (sendfile() for uploads).
+// Either way a stalled connection times out and errors.
 static void transfer_file(int local_fd, int remote_fd)
 {
-  int len, rfd = (TT.isget)?remote_fd:local_fd,
+  int rfd = (TT.isget)?remote_fd:local_fd,
       wfd = (TT.isget)?local_fd:remote_fd;
+  struct stat st;
 
   if (rfd < 0 || wfd < 0) error_exit("Error in file creation:");
-  while ((len = xread(rfd, toybuf, sizeof(toybuf)))) txwrite(wfd, toybuf, len);
+  TT.start = TT.shown = millitime();
+  TT.done = 0;
+  if (!(toys.optflags & FLAG_v) && !fstat(local_fd, &st)
+      && S_ISREG(st.st_mode))
+  {
+    xsendfile(rfd, wfd);
+    if (!fstat(local_fd, &st)) TT.done = st.st_size-TT.offset;
+  } else {
+    if (xcopy(rfd, wfd, write_counted)) perror_exit("read");
+    if (toys.optflags & FLAG_v) show_progress(1);
+  }
 }
 
-static void get_file(char *l_filename, char *r_filename)
+// Remote file size from the SIZE reply, or -1.
+static long long remote_size(char *r_filename)
 {
-  int local_fd = -1, remote_fd;
+  if (get_ftp_response("SIZE", r_filename) != FTPFILE_STATUS) return -1;
 
-  verify_pasv_mode(r_filename);
-  remote_fd = connect_to_stream(); //Connect to data socket.
+  return atoll(toybuf+4);
+}
+
+static void get_file(char *l_filename, char *r_filename)
+{
+  int local_fd = -1, flags = O_WRONLY|O_CREAT;
+  struct stat st;
 
   //if local file name will be '-' then local fd will be stdout.
   if ((l_filename[0] == '-') && !l_filename[1]) {
@@ -216,8 +258,23 @@ static void get_file(char *l_filename, char *r_filename)
     TT.c = 0;
   }
 
-  //if continue, check for local file existance.
-  if (TT.c) is_localfile_present(l_filename);
+  // With -c pick up after what's already here, if the server can.
+  TT.size = remote_size(r_filename);
+  TT.offset = 0;
+  if (TT.c && !stat(l_filename, &st) && st.st_size > 0) {
+    if (st.st_size == TT.size) {
+      if (toys.optflags & FLAG_v) fprintf(stderr, "Already complete\n");
+      get_ftp_response("QUIT", NULL);
+      toys.exitval = EXIT_SUCCESS;
+      return;
+    }
+    sprintf(toybuf, "REST %lld", (long long)st.st_size);
+    if (get_ftp_response(toybuf, NULL) == REQUESTED_PENDINGACTION)
+      TT.offset = st.st_size;
+  }
+
+  verify_pasv_mode(r_filename);
+  TT.datafd = connect_to_stream(); //Connect to data socket.
 
   //verify the remote file presence.
   if (get_ftp_response("RETR", r_filename) > FTPFILE_STATUSOKAY) 
@@ -225,53 +282,78 @@ static void get_file(char *l_filename, char *r_filename)
 
   //if local fd is not stdout, create a file descriptor.
   if (local_fd == -1) {
-    int flags = O_WRONLY;
-
-    flags |= (TT.c)? O_APPEND : (O_CREAT | O_TRUNC);
+    flags |= TT.offset ? O_APPEND : O_TRUNC;
     local_fd = xcreate((char *)l_filename, flags, 0666);
   }
-  transfer_file(local_fd, remote_fd);
-  xclose(remote_fd);
-  xclose(local_fd);
+  transfer_file(local_fd, TT.datafd);
+  xclose(TT.datafd);
+  TT.datafd = -1;
+  if (local_fd != 1) xclose(local_fd);
   if (get_ftp_response(NULL, NULL) != CLOSE_DATACONECTION) close_stream(NULL);
+  if (TT.size >= 0 && TT.offset+TT.done < TT.size)
+    error_exit("short transfer: %lld of %lld", TT.offset+TT.done, TT.size);
   get_ftp_response("QUIT", NULL);
   toys.exitval = EXIT_SUCCESS;
 }
 
 static void put_file(char *r_filename, char *l_filename)
 {
-  int local_fd = 0, remote_fd;
+  int local_fd = 0;
   unsigned cmd_status = 0;
-
-  verify_pasv_mode(r_filename);
-  remote_fd = connect_to_stream(); //Connect to data socket.
+  char *cmd = "STOR";
+  struct stat st;
 
   //open the local file for transfer.
   if ((l_filename[0] != '-') || l_filename[1]) 
     local_fd = xcreate((char *)l_filename, O_RDONLY, 0666);
 
+  // With -c append what the server doesn't have yet to what it does.
+  TT.offset = 0;
+  TT.size = -1;
+  if (!fstat(local_fd, &st) && S_ISREG(st.st_mode)) {
+    TT.size = st.st_size;
+    if (TT.c && (TT.offset = remote_size(r_filename)) > 0) {
+      if (TT.offset == TT.size) {
+        if (toys.optflags & FLAG_v) fprintf(stderr, "Already complete\n");
+        xclose(local_fd);
+        get_ftp_response("QUIT", NULL);
+        toys.exitval = EXIT_SUCCESS;
+        return;
+      }
+      if (TT.offset > TT.size || lseek(local_fd, TT.offset, SEEK_SET) < 0)
+        TT.offset = 0;
+      else cmd = "APPE";
+    } else TT.offset = 0;
+  }
+
+  verify_pasv_mode(r_filename);
+  TT.datafd = connect_to_stream(); //Connect to data socket.
+
   //verify for the remote file status, Ok or Open: transfer File.
-  cmd_status = get_ftp_response("STOR", r_filename);
+  cmd_status = get_ftp_response(cmd, r_filename);
   if ( (cmd_status == DATACONNECTION_OPENED) || 
       (cmd_status == FTPFILE_STATUSOKAY)) {
-    transfer_file(local_fd, remote_fd);
+    transfer_file(local_fd, TT.datafd);
+    xclose(TT.datafd);
+    TT.datafd = -1;
     if (get_ftp_response(NULL, NULL) != CLOSE_DATACONECTION) close_stream(NULL);
     get_ftp_response("QUIT", NULL);
     toys.exitval = EXIT_SUCCESS;
   } else {
     toys.exitval = EXIT_FAILURE;
-    close_stream("STOR");
+    close_stream(cmd);
   }
-  xclose(remote_fd);
-  xclose(local_fd);
+  if (local_fd) xclose(local_fd);
 }
 
 void ftpget_main(void)
 {
   char **argv = toys.optargs; //host name + file name.
+  jmp_buf rebound;
+  long long had = -1;
+  int tries = 0;
 
   TT.isget = toys.which->name[3] == 'g';
-  TT.c = 1;
   //if user name is not specified.
   if (!(toys.optflags & FLAG_u) && (toys.optflags & FLAG_p)) 
     error_exit("Missing username:");
@@ -279,15 +361,37 @@ void ftpget_main(void)
   if (!(toys.optflags & FLAG_u) && !(toys.optflags & FLAG_p))
     TT.username = TT.password ="anonymous";
 
-  //if continue is not in the command line argument.
-  if (TT.isget && !(toys.optflags & FLAG_c)) TT.c = 0;
-
   if (toys.optflags & FLAG_v) fprintf(stderr, "Connecting to %s\n", argv[0]);
   get_sockaddr(argv[0]);
 
-  TT.sockfp = xfdopen(connect_to_stream(), "r+");
-  send_requests();
-
-  if (TT.isget) get_file(argv[1], argv[2] ? argv[2] : argv[1]); 
-  else put_file(argv[1], argv[2] ? argv[2] : argv[1]);
+  // With -c a dropped connection or short transfer reconnects and resumes,
+  // for as long as each attempt gets further than the last did.
+  signal(SIGPIPE, SIG_IGN);
+  for (;;) {
+    TT.c = toys.optflags & FLAG_c;
+    TT.datafd = -1;
+    TT.offset = TT.done = 0;
+    setport(htons(TT.port));
+    if (!setjmp(rebound)) {
+      toys.rebound = &rebound;
+      TT.sockfp = xfdopen(connect_to_stream(), "r+");
+      send_requests();
+      if (TT.isget) get_file(argv[1], argv[2] ? argv[2] : argv[1]); 
+      else put_file(argv[1], argv[2] ? argv[2] : argv[1]);
+      toys.rebound = 0;
+      break;
+    }
+    toys.rebound = 0;
+    if (TT.sockfp) fclose(TT.sockfp);
+    TT.sockfp = 0;
+    if (TT.datafd != -1) close(TT.datafd);
+    if (!TT.c || TT.size < 0) xexit();
+    if (TT.offset+TT.done > had) {
+      had = TT.offset+TT.done;
+      tries = 0;
+    } else if (++tries == FTP_RETRIES) xexit();
+    if (toys.optflags & FLAG_v) fprintf(stderr, "Retrying in %ds\n", 1<<tries);
+    sleep(1<<tries);
+  }
+  toys.exitval = EXIT_SUCCESS;
 }
@@ -119,7 +119,7 @@ void host_main(void)
   if (nsname) {
     struct addrinfo ns_hints = { .ai_socktype = SOCK_DGRAM };
 
-    if ((ret = getaddrinfo(nsname, "53", &ns_hints, &ai)) < 0)
+    if ((ret = dns_getaddrinfo(nsname, "53", &ns_hints, &ai)))
       error_exit("Error looking up server name: %s", gai_strerror(ret));
     int s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
     if (s < 0 || connect(s, ai->ai_addr, ai->ai_addrlen) < 0)
@@ -11,12 +11,16 @@ config ICONV
   default n
   depends on TOYBOX_ICONV
   help
-    usage: iconv [-f FROM] [-t TO] [FILE...]
+    usage: iconv [-cs] [-f FROM] [-t TO] [FILE...]
 
     Convert character encoding of files.
 
+    -c  omit characters that can't be converted
     -f  convert from (default utf8)
+    -s  silent, don't report characters that can't be converted
     -t  convert to   (default utf8)
+
+    ASCII, latin1, UTF-8 and UTF-16LE are converted without the C library.
 */
 
 #define FOR_iconv
@@ -28,47 +32,241 @@ GLOBALS(
   char *to;
 
   void *ic;
+  char *buf;
+  int in, out;
 )
 
-static void do_iconv(int fd, char *name)
+// Input is read this much at a time, output can be up to twice as big.
+#define ICONV_BUF 65536
+
+// Encodings converted here. Anything else goes through libc's iconv().
+enum { ICONV_LIBC, ICONV_UTF8, ICONV_ASCII, ICONV_LATIN1, ICONV_UTF16LE };
+
+static int iconv_which(char *name)
 {
-  char *outstart = toybuf+2048;
-  size_t inleft = 0;
-  int len = 1;
+  struct { char *name; int enc; } names[] = {{"UTF8", ICONV_UTF8},
+    {"ASCII", ICONV_ASCII}, {"USASCII", ICONV_ASCII},
+    {"ANSIX3.41968", ICONV_ASCII}, {"LATIN1", ICONV_LATIN1},
+    {"ISO88591", ICONV_LATIN1}, {"L1", ICONV_LATIN1},
+    {"UTF16LE", ICONV_UTF16LE}};
+  char *s = toybuf;
+  int i;
 
-  do {
-    size_t outleft = 2048;
-    char *in = toybuf+inleft, *out = outstart;
+  // Ignore case, dashes and underscores: "utf-8" is "UTF8".
+  for (; *name && s-toybuf < 32; name++)
+    if (*name != '-' && *name != '_') *s++ = toupper(*name);
+  *s = 0;
+  for (i = 0; i<ARRAY_LEN(names); i++)
+    if (!strcmp(toybuf, names[i].name)) return names[i].enc;
+
+  return ICONV_LIBC;
+}
 
-    len = read(fd, in, 2048-inleft);
+// Decode the character at s (with len bytes left) into *wc, returning its
+// length, 0 if the rest of it isn't here, or -1 if it's not valid.
+static int iconv_get(unsigned char *s, long len, unsigned *wc)
+{
+  unsigned c = *s, lo;
+  int n, i;
+
+  if (TT.in == ICONV_UTF16LE) {
+    if (len < 2) return 0;
+    c |= s[1]<<8;
+    if (c-0xdc00 < 0x400) return -1;
+    if (c-0xd800 < 0x400) {
+      if (len < 4) return 0;
+      if ((lo = s[2]|(s[3]<<8))-0xdc00 >= 0x400) return -1;
+      c = 0x10000+((c-0xd800)<<10)+lo-0xdc00;
+      n = 4;
+    } else n = 2;
+    *wc = c;
+
+    return n;
+  }
+  *wc = c;
+  if (c < 0x80 || TT.in == ICONV_LATIN1) return 1;
+  if (TT.in == ICONV_ASCII || c < 0xc2 || c > 0xf4) return -1;
+
+  // UTF-8, shortest form only, and no surrogates.
+  n = c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+  c &= 0x7f>>n;
+  for (i = 1; i<n; i++) {
+    if (i == len) return 0;
+    if ((s[i]&0xc0) != 0x80) return -1;
+    c = (c<<6)|(s[i]&0x3f);
+  }
+  if ((n == 3 && c < 0x800) || (n == 4 && c < 0x10000) || c > 0x10ffff
+    || c-0xd800 < 0x800) return -1;
+  *wc = c;
 
-    if (len < 0) {
-      perror_msg("read '%s'");
-      return;
+  return n;
+}
+
+// Encode wc at out, returning its length or 0 if it doesn't fit the encoding.
+static int iconv_put(unsigned wc, unsigned char *out)
+{
+  int n, i;
+
+  if (TT.out == ICONV_UTF16LE) {
+    if (wc < 0x10000) {
+      out[0] = wc;
+      out[1] = wc>>8;
+
+      return 2;
     }
-    inleft += len;
-
-    do {
-      if (iconv(TT.ic, &in, &inleft, &out, &outleft) == -1
-          && (errno == EILSEQ || (in == toybuf+inleft-len && errno == EINVAL)))
-      {
-        if (outleft) {
-          // Skip first byte of illegal sequence to avoid endless loops
-          *(out++) = *(in++);
-          inleft--;
-        }
+    iconv_put(0xd800+((wc-0x10000)>>10), out);
+    iconv_put(0xdc00+(wc&0x3ff), out+2);
+
+    return 4;
+  }
+  if (wc < (TT.out == ICONV_LATIN1 ? 0x100 : 0x80)) {
+    *out = wc;
+
+    return 1;
+  }
+  if (TT.out != ICONV_UTF8) return 0;
+  n = wc < 0x800 ? 2 : wc < 0x10000 ? 3 : 4;
+  for (i = n; --i;) {
+    out[i] = 0x80|(wc&0x3f);
+    wc >>= 6;
+  }
+  *out = (0xf00>>n)|wc;
+
+  return n;
+}
+
+// A character at pos can't be converted. Say so (unless -s) and return
+// whether to skip it and go on (-c).
+static int iconv_bad(char *name, long long pos)
+{
+  if (!(toys.optflags & FLAG_s))
+    error_msg("%s: can't convert at byte %lld", name, pos);
+  toys.exitval = 1;
+
+  return toys.optflags & FLAG_c;
+}
+
+// Convert and write out len bytes at in, returning how many were used (the
+// rest start a character that isn't all here yet) or -1 to stop this file.
+// Runs of ASCII are checked 8 bytes at a time and copied (or widened, or
+// narrowed) in bulk, leaving only the other characters to go one at a time.
+static long iconv_fast(unsigned char *in, long len, int eof, long long pos,
+  char *name)
+{
+  unsigned char *out = (void *)TT.buf+ICONV_BUF, *o = out;
+  unsigned long long w;
+  unsigned wc;
+  long i = 0, j;
+  int n, k, wide = TT.in == ICONV_UTF16LE, unit = 1+wide;
+
+  while (i < len) {
+    for (j = i; j+8 <= len; j += 8) {
+      memcpy(&w, in+j, 8);
+      if (w & (wide ? 0xff80ff80ff80ff80ULL : 0x8080808080808080ULL)) break;
+    }
+    while (j+unit <= len && in[j] < 0x80 && (!wide || !in[j+1])) j += unit;
+    if (j > i) {
+      if (wide == (TT.out == ICONV_UTF16LE)) {
+        memcpy(o, in+i, j-i);
+        o += j-i;
       }
-      txwrite(1, outstart, out-outstart);
-      // Top off input buffer
-      memmove(in, toybuf, inleft);
-    } while (len < 1 && inleft);
-  } while (len > 0);
+      else if (wide) for (; i<j; i += 2) *o++ = in[i];
+      else for (; i<j; i++) o += iconv_put(in[i], o);
+      i = j;
+      continue;
+    }
+
+    if (!(n = iconv_get(in+i, len-i, &wc))) {
+      if (!eof) break;
+      n = -1;
+    }
+    if (n > 0 && (k = iconv_put(wc, o))) o += k;
+    else {
+      if (!iconv_bad(name, pos+i)) {
+        i = -1;
+        break;
+      }
+      if (n < 0) n = len-i < unit ? len-i : unit;
+    }
+    i += n;
+  }
+  txwrite(1, out, o-out);
+
+  return i;
+}
+
+// The same through libc iconv().
+static long iconv_libc(char *in, long len, int eof, long long pos, char *name)
+{
+  char *out = TT.buf+ICONV_BUF, *s = in, *o = out;
+  size_t left = len, oleft = 2*ICONV_BUF;
+
+  while (left) {
+    if (iconv(TT.ic, &s, &left, &o, &oleft) != -1) break;
+    if (errno == E2BIG) {
+      txwrite(1, out, o-out);
+      o = out;
+      oleft = 2*ICONV_BUF;
+    } else if (errno == EINVAL && !eof) break;
+    else if (!iconv_bad(name, pos+(s-in))) {
+      s = 0;
+      break;
+    } else {
+      s++;
+      left--;
+    }
+  }
+
+  // Return to the initial shift state at the end.
+  if (eof && s) iconv(TT.ic, 0, 0, &o, &oleft);
+  txwrite(1, out, o-out);
+
+  return s ? s-in : -1;
+}
+
+static void iconv_copy(int fd, char *name)
+{
+  xsendfile(fd, 1);
+}
+
+static void do_iconv(int fd, char *name)
+{
+  long long pos = 0;
+  long len, left = 0, used;
+
+  do {
+    if (0 > (len = read(fd, TT.buf+left, ICONV_BUF-left))) {
+      perror_msg("read '%s'", name);
+      break;
+    }
+    left += len;
+    if (TT.ic) used = iconv_libc(TT.buf, left, !len, pos, name);
+    else used = iconv_fast((void *)TT.buf, left, !len, pos, name);
+    if (used < 0) break;
+    memmove(TT.buf, TT.buf+used, left -= used);
+    pos += used;
+  } while (len);
+  if (TT.ic) iconv(TT.ic, 0, 0, 0, 0);
 }
 
 void iconv_main(void)
 {
-  TT.ic = iconv_open(TT.to ? TT.to : "utf8", TT.from ? TT.from : "utf8");
-  if (TT.ic == (iconv_t)-1) error_exit("bad encoding");
-  loopfiles(toys.optargs, do_iconv);
-  if (CFG_TOYBOX_FREE) iconv_close(TT.ic);
+  char *from = TT.from ? TT.from : "utf8", *to = TT.to ? TT.to : "utf8";
+
+  TT.in = iconv_which(from);
+  TT.out = iconv_which(to);
+  if (!TT.in || !TT.out) {
+    TT.ic = iconv_open(to, from);
+    if (TT.ic == (iconv_t)-1) error_exit("bad encoding");
+  }
+  TT.buf = xmalloc(3*ICONV_BUF);
+
+  // Latin1 to latin1 can't go wrong.
+  if (TT.in == ICONV_LATIN1 && TT.out == ICONV_LATIN1)
+    loopfiles(toys.optargs, iconv_copy);
+  else loopfiles(toys.optargs, do_iconv);
+  if (CFG_TOYBOX_FREE) {
+    if (TT.ic) iconv_close(TT.ic);
+    free(TT.buf);
+  }
 }
@@ -28,8 +28,15 @@ struct action_list_seed {
   uint8_t action;
   char *terminal_name;
   char *command;
+  unsigned long long started, due;
+  unsigned backoff;
 } *action_list_pointer = NULL;
-int caught_signal;
+int caught_signal, sigpipe[2];
+
+// A respawn entry that dies sooner than this after starting is restarted
+// after a delay doubling from 1 second up to RESPAWN_MAX.
+#define RESPAWN_FAST 10000
+#define RESPAWN_MAX  60000
 
 //INITTAB action defination
 #define SYSINIT     0x01
@@ -243,7 +250,8 @@ static pid_t final_run(struct action_list_seed *x)
     return pid;      
   } else if (pid < 0) {
     perror_msg("fork fail");
-    sleep(1);
+    sigfillset(&signal_set);
+    sigprocmask(SIG_UNBLOCK, &signal_set, NULL);
     return 0;
   }
 
@@ -285,14 +293,49 @@ static struct action_list_seed* mark_as_terminated_process(pid_t pid)
   return NULL;
 }
 
+// Decide when a respawn entry that just died (or failed to start) runs again
+static void schedule_respawn(struct action_list_seed *x)
+{
+  unsigned long long now = millitime();
+
+  if (now-x->started < RESPAWN_FAST)
+    x->backoff = x->backoff ? (2*x->backoff > RESPAWN_MAX ? RESPAWN_MAX : 2*x->backoff) : 1000;
+  else x->backoff = 0;
+  x->due = now+x->backoff;
+}
+
+static void child_exited(pid_t pid)
+{
+  struct action_list_seed *x = mark_as_terminated_process(pid);
+
+  if (x && (x->action & (RESPAWN|ASKFIRST))) schedule_respawn(x);
+}
+
+// Reap every child that has exited, without blocking
+static void reap_children(void)
+{
+  siginfo_t si;
+
+  for (;;) {
+    si.si_pid = 0;
+    if (waitid(P_ALL, 0, &si, WEXITED|WNOHANG) || !si.si_pid) break;
+    child_exited(si.si_pid);
+  }
+}
+
+// Block until pid exits, reaping whatever else exits meanwhile
 static void waitforpid(pid_t pid)
 {
-  if (pid <= 0) return;
+  siginfo_t si;
 
-  for(;;) {
-    pid_t y = wait(NULL);
-    mark_as_terminated_process(y);
-    if (kill(y, 0)) break;
+  while (pid > 0) {
+    si.si_pid = 0;
+    if (waitid(P_ALL, 0, &si, WEXITED)) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    child_exited(si.si_pid);
+    if (si.si_pid == pid) break;
   }
 }
 
@@ -308,10 +351,29 @@ static void run_action_from_list(int action)
       if (!pid) return;
       if (x->action & (SHUTDOWN|SYSINIT|CTRLALTDEL|WAIT)) waitforpid(pid);
     }
-    if (x->action & (ASKFIRST|RESPAWN))
-      if (!(x->pid)) x->pid = final_run(x);
+    if ((x->action & (ASKFIRST|RESPAWN)) && !x->pid && x->due <= millitime())
+    {
+      x->started = millitime();
+      if (!(x->pid = final_run(x))) schedule_respawn(x);
+    }
   }
- }
+}
+
+// Milliseconds until the next respawn entry is due, or -1 for none
+static int respawn_timeout(void)
+{
+  struct action_list_seed *x;
+  unsigned long long now = millitime();
+  int timeout = -1;
+
+  for (x = action_list_pointer; x; x = x->next) {
+    if (!(x->action & (ASKFIRST|RESPAWN)) || x->pid) continue;
+    if (x->due <= now) return 0;
+    if (timeout < 0 || x->due-now < timeout) timeout = x->due-now;
+  }
+
+  return timeout;
+}
 
 static void set_default(void)
 {
@@ -363,7 +425,7 @@ static void halt_poweroff_reboot_handler(int sig_no)
     _exit(EXIT_SUCCESS);
   }
 
-  while(1) sleep(1);
+  for (;;) pause();
 }
 
 static void restart_init_handler(int sig_no)
@@ -391,7 +453,7 @@ static void restart_init_handler(int sig_no)
           _exit(EXIT_SUCCESS);
         }
 
-        while(1) sleep(1);
+        for (;;) pause();
       } else {
         dup2(0, 1);
         dup2(0, 2);
@@ -408,43 +470,39 @@ static void catch_signal(int sig_no)
   error_msg("signal seen");
 }
 
+// Everything but SIGCONT is blocked in here, so children that exit while
+// we're stopped get reaped (and respawned) once we continue.
 static void pause_handler(int sig_no)
 {
   int signal_backup,errno_backup;
-  pid_t pid;
+  sigset_t mask;
 
   errno_backup = errno;
   signal_backup = caught_signal;
   xsignal(SIGCONT, catch_signal);
 
-  while(1) {
-    if (caught_signal == SIGCONT) break;
-    do pid = waitpid(-1,NULL,WNOHANG); while((pid==-1) && (errno=EINTR));
-    mark_as_terminated_process(pid);
-    sleep(1);
-  }
+  sigfillset(&mask);
+  sigdelset(&mask, SIGCONT);
+  while (caught_signal != SIGCONT) sigsuspend(&mask);
 
   signal(SIGCONT, SIG_DFL);
   errno = errno_backup;
   caught_signal = signal_backup;
 }
 
-static int check_if_pending_signals(void)
+// Act on the signals generic_signal() queued up in sigpipe
+static void check_if_pending_signals(void)
 {
-  int signal_caught = 0;
+  char sig;
 
-  while(1) {
-    int sig = caught_signal;
-    if (!sig) return signal_caught;
-    caught_signal = 0;
-    signal_caught = 1;
+  while (read(*sigpipe, &sig, 1) == 1)
     if (sig == SIGINT) run_action_from_list(CTRLALTDEL);
-  }
 }
 
 void init_main(void)
 {
   struct sigaction sig_act;
+  int i;
 
   if (getpid() != 1) error_exit("Already running"); 
   printf("Started init\n"); 
@@ -460,6 +518,12 @@ void init_main(void)
   putenv("USER=root");
 
   inittab_parsing();  
+  if (pipe(sigpipe)) perror_exit("pipe");
+  for (i = 0; i<2; i++) {
+    fcntl(sigpipe[i], F_SETFL, O_NONBLOCK);
+    fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC);
+  }
+  toys.signalfd = sigpipe[1];
   xsignal(SIGUSR1, halt_poweroff_reboot_handler);//halt
   xsignal(SIGUSR2, halt_poweroff_reboot_handler);//poweroff
   xsignal(SIGTERM, halt_poweroff_reboot_handler);//reboot
@@ -469,30 +533,22 @@ void init_main(void)
   sigdelset(&sig_act.sa_mask, SIGCONT);
   sig_act.sa_handler = pause_handler;
   sigaction(SIGTSTP, &sig_act, NULL);
-  memset(&sig_act, 0, sizeof(sig_act));
-  sig_act.sa_handler = catch_signal;
-  sigaction(SIGINT, &sig_act, NULL);  
-  sigaction(SIGHUP, &sig_act, NULL);  
+  xsignal(SIGINT, generic_signal);
+  xsignal(SIGHUP, generic_signal);
+  xsignal(SIGCHLD, generic_signal);
   run_action_from_list(SYSINIT);
   check_if_pending_signals();
   run_action_from_list(WAIT);
   check_if_pending_signals();
   run_action_from_list(ONCE);
-  while (1) {
-    int suspected_WNOHANG = check_if_pending_signals();
 
-    run_action_from_list(RESPAWN | ASKFIRST);
-    suspected_WNOHANG = suspected_WNOHANG|check_if_pending_signals();
-    sleep(1);//let cpu breath
-    suspected_WNOHANG = suspected_WNOHANG|check_if_pending_signals();
-    if (suspected_WNOHANG) suspected_WNOHANG=WNOHANG;
-
-    while(1) {
-      pid_t pid = waitpid(-1, NULL, suspected_WNOHANG);
+  // Sleep until a signal (usually SIGCHLD) or a delayed respawn is due.
+  for (;;) {
+    struct pollfd pfd = {*sigpipe, POLLIN, 0};
 
-      if (pid <= 0) break;
-      mark_as_terminated_process(pid);
-      suspected_WNOHANG = WNOHANG;
-    }
+    check_if_pending_signals();
+    reap_children();
+    run_action_from_list(RESPAWN | ASKFIRST);
+    poll(&pfd, 1, respawn_timeout());
   }
 }
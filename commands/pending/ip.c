@@ -19,11 +19,17 @@ config IP
   default n
   help
     usage: ip [ OPTIONS ] OBJECT { COMMAND }
+           ip [ OPTIONS ] -b[atch] FILE
 
     Show / manipulate routing, devices, policy routing and tunnels.
 
     where OBJECT := {address | link | route | rule | tunnel}
-    OPTIONS := { -f[amily] { inet | inet6 | link } | -o[neline] }
+    OPTIONS := { -f[amily] { inet | inet6 | link } | -o[neline] | -force }
+
+    -batch runs "OBJECT COMMAND" from each line of FILE (- for stdin) over
+    one netlink socket, sending changes without waiting for each answer.
+    A failing line is reported as "Command failed FILE:LINE" and stops the
+    batch (after the changes already sent) unless -force is given.
 */
 #define FOR_ip
 #include "toys.h"
@@ -41,6 +47,10 @@ GLOBALS(
   char stats, singleline, flush, *filter_dev, gbuf[8192];
   int sockfd, connected, from_ok, route_cmd;
   int8_t addressfamily, is_addr;
+
+  char *batch, force, failed;
+  unsigned seq, pending;
+  long lineno, *lines;
 )
 
 struct arglist {
@@ -66,6 +76,10 @@ typedef int (*cmdobj)(char **argv);
 
 #define MESG_LEN 8192
 
+// Changes -batch keeps in flight before waiting for their acks. Even error
+// acks quoting the whole request stay well inside the receive buffer.
+#define IP_WINDOW 128
+
 // For "/etc/iproute2/RPDB_tables"
 enum {
   RPDB_rtdsfield = 1,
@@ -154,6 +168,7 @@ static void send_nlmesg(int type, int flags, int family,
     buf = &req;
     blen = sizeof(req);
   }
+  ((struct nlmsghdr *)buf)->nlmsg_seq = ++TT.seq;
   if (send(TT.sockfd , (void*)buf, blen, 0) < 0)
     perror_exit("Unable to send data on socket.");
 }
@@ -213,6 +228,8 @@ static struct arglist **getlist(u_int8_t whichDB)
 {
   struct arglist **alist;
 
+  // Each table's read once, and kept for the next ip run.
+  xkeep_all(1);
   switch (whichDB) {
     case RPDB_rtdsfield:
       alist = rt_dsfield;
@@ -272,6 +289,8 @@ static struct arglist **getlist(u_int8_t whichDB)
       error_exit("wrong database");
       break; // Unreachable code.
   }
+  xkeep_all(0);
+
   return alist;
 }
 
@@ -1049,14 +1068,12 @@ static int print_addrinfo(struct nlmsghdr *h, int flag_l)
 
 static int ipaddrupdate(char **argv)
 {
-  int length, cmd = !memcmp("add", argv[-1], strlen(argv[-1]))
+  int cmd = !memcmp("add", argv[-1], strlen(argv[-1]))
     ? RTM_NEWADDR: RTM_DELADDR;
   int idx = 0,length_brd = 0, length_peer = 0,length_any = 0,length_local = 0,
       scoped = 0;
-  char *dev = NULL,*label = NULL, reply[8192];
+  char *dev = NULL,*label = NULL;
 
-  struct nlmsghdr *addr_ptr = NULL;
-  struct nlmsgerr *err = NULL;
   struct arglist cmd_objectlist[] = {{"dev",0}, {"peer", 1},
     {"remote", 2}, {"broadcast", 3}, {"brd", 4}, {"label", 5},
     {"anycast", 6},{"scope", 7}, {"local", 8}, {NULL, -1}};
@@ -1205,19 +1222,8 @@ static int ipaddrupdate(char **argv)
   req.ifadd.ifa_index = get_ifaceindex(dev, 1);
 
   send_nlmesg(RTM_NEWADDR, 0, AF_UNSPEC, (void *)&req, req.nlm.nlmsg_len);
-  length = recv(TT.sockfd, reply, sizeof(reply), 0);
-  addr_ptr = (struct nlmsghdr *) reply;
-  for (; NLMSG_OK(addr_ptr, length); addr_ptr = NLMSG_NEXT(addr_ptr, length)) {
-    if (addr_ptr->nlmsg_type == NLMSG_DONE)
-      return 1;
-    if (addr_ptr->nlmsg_type == NLMSG_ERROR)
-      err = (struct nlmsgerr*) NLMSG_DATA(addr_ptr);
-    if (err && err->error) {
-      errno = -err->error;
-      perror_exit("RTNETLINK answers:");
-    }
-  }
-  return 0;
+
+  return filter_nlmesg(NULL, NULL);
 }
 
 static int ipaddr_listflush(char **argv)
@@ -2675,10 +2681,51 @@ static int iptunnel(char **argv)
 // Common code, which is used for all ip options.
 // ===========================================================================
 
+// Read acks for -batch changes until no more than LEFT are outstanding,
+// reporting each failure against the line that sent it. The kernel answers
+// requests in order, so anything else on the socket is an echo to skip.
+static void collect_acks(unsigned left)
+{
+  while (TT.pending > left) {
+    struct nlmsghdr *mhdr;
+    int msglen = recv(TT.sockfd, TT.gbuf, MESG_LEN, 0);
+
+    if (msglen < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (msglen <= 0) perror_exit("netlink receive");
+
+    for (mhdr = (struct nlmsghdr*)TT.gbuf; NLMSG_OK(mhdr, msglen);
+        mhdr = NLMSG_NEXT(mhdr, msglen)) {
+      struct nlmsgerr *merr = (struct nlmsgerr*)NLMSG_DATA(mhdr);
+
+      if (mhdr->nlmsg_pid != getpid() || mhdr->nlmsg_type != NLMSG_ERROR)
+        continue;
+      TT.pending--;
+      if (!merr->error) continue;
+      errno = -merr->error;
+      perror_msg("RTNETLINK answers");
+      error_msg("Command failed %s:%ld", TT.batch,
+        TT.lines[mhdr->nlmsg_seq%IP_WINDOW]);
+      TT.failed = 1;
+    }
+  }
+}
+
 // Parse netlink messages and call input callback handler for action
 static int filter_nlmesg(int (*fun)(struct nlmsghdr *mhdr, char **argv),
     char **argv)
 {
+  // In -batch mode a change that only wants an ack doesn't wait for it,
+  // and anything else waits for all of those first.
+  if (TT.batch) {
+    if (!fun) {
+      collect_acks(IP_WINDOW-1);
+      TT.lines[TT.seq%IP_WINDOW] = TT.lineno;
+      TT.pending++;
+
+      return 0;
+    }
+    collect_acks(0);
+  }
   while (1) {
     struct nlmsghdr *mhdr;
     int msglen = recv(TT.sockfd, TT.gbuf, MESG_LEN, 0);
@@ -2722,6 +2769,67 @@ static int filter_nlmesg(int (*fun)(struct nlmsghdr *mhdr, char **argv),
   return 0;
 }
 
+static int ip_object(char **argv)
+{
+  struct arglist ip_objectlist[] = { {"address", 0}, {"link", 1},
+    {"route", 2}, {"rule", 3}, {"tunnel", 4}, {"tunl", 4}, {NULL, -1}};
+  cmdobj cmdobjlist[] = {ipaddr, iplink, iproute, iprule, iptunnel};
+  int idx;
+
+  if ((idx = substring_to_idx(*argv, ip_objectlist)) == -1) help_exit(0);
+
+  return cmdobjlist[idx](++argv);
+}
+
+// Run each line of the -batch file, with error_exit() and friends failing
+// just that line. Changes pile up in flight, see filter_nlmesg().
+static void ip_batch(void)
+{
+  int fd = strcmp(TT.batch, "-") ? xopen(TT.batch, O_RDONLY) : 0, one = 1,
+    rcvbuf = 1<<20;
+  char *line, *argv[64];
+  jmp_buf rebound, *outer = toys.rebound;
+
+  // A window of error acks carrying extended error text outgrows the
+  // default receive buffer, so ask for room and for acks without payload.
+  TT.lines = xzalloc(IP_WINDOW*sizeof(*TT.lines));
+  setsockopt(TT.sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+#ifdef NETLINK_CAP_ACK
+  setsockopt(TT.sockfd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+#endif
+  for (; !(TT.failed && !TT.force) && (line = get_line(fd)); free(line)) {
+    char *s = line;
+    int argc = 0;
+
+    TT.lineno++;
+    while (argc < 63) {
+      while (isspace(*s)) s++;
+      if (!*s || *s == '#') break;
+      if (*s == '"' || *s == '\'') {
+        argv[argc++] = s+1;
+        if (!(s = strchr(s+1, *s))) break;
+      } else for (argv[argc++] = s; *s && !isspace(*s); s++);
+      if (*s) *s++ = 0;
+    }
+    if (!(argv[argc] = 0, argc)) continue;
+
+    TT.flush = TT.connected = TT.from_ok = TT.route_cmd = TT.is_addr = 0;
+    TT.filter_dev = 0;
+    memset(&addrinfo, 0, sizeof(addrinfo));
+    toys.rebound = &rebound;
+    if (setjmp(rebound) || ip_object(argv)) {
+      toys.exitval = 0;
+      error_msg("Command failed %s:%ld", TT.batch, TT.lineno);
+      TT.failed = 1;
+    }
+    toys.rebound = outer;
+  }
+  collect_acks(0);
+  TT.batch = 0;
+  if (fd) close(fd);
+  toys.exitval = TT.failed;
+}
+
 void ip_main(void)
 {
   char **optargv = toys.argv;
@@ -2731,7 +2839,8 @@ void ip_main(void)
   for (++optargv; *optargv; ++optargv) {
     char *ptr = *optargv;
     struct arglist ip_options[] = {{"oneline", 0}, {"family",  1},
-      {"4", 1}, {"6", 1}, {"0", 1}, {"stats", 2}, {NULL, -1}};
+      {"4", 1}, {"6", 1}, {"0", 1}, {"stats", 2}, {"batch", 3}, {"force", 4},
+      {NULL, -1}};
 
     if (*ptr != '-') break;
     else if ((*(ptr+1) == '-') && (*(ptr+2))) ptr +=2;
@@ -2762,6 +2871,12 @@ void ip_main(void)
       case 2:
               TT.stats++;
               break;
+      case 3:
+              if (!(TT.batch = *++optargv)) help_exit(0);
+              break;
+      case 4:
+              TT.force++;
+              break;
       default: help_exit(0);
                break; // unreachable code.
     }
@@ -2769,15 +2884,12 @@ void ip_main(void)
 
   TT.sockfd = xsocket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
 
-  if (isip) {// only for ip
-    if (*optargv) {
-      struct arglist ip_objectlist[] = { {"address", 0}, {"link", 1},
-        {"route", 2}, {"rule", 3}, {"tunnel", 4}, {"tunl", 4}, {NULL, -1}};
-
-      if ((idx = substring_to_idx(*optargv, ip_objectlist)) == -1) help_exit(0);
-      ipcmd = cmdobjlist[idx];
-      toys.exitval = ipcmd(++optargv);
-    } else help_exit(0);
+  if (TT.batch) {
+    if (!isip || *optargv) help_exit(0);
+    ip_batch();
+  } else if (isip) {// only for ip
+    if (*optargv) toys.exitval = ip_object(optargv);
+    else help_exit(0);
   } else {
     struct arglist ip_objectlist[] = { {"ipaddr", 0}, {"iplink", 1},
       {"iproute", 2}, {"iprule", 3}, {"iptunnel", 4}, {NULL, -1}};
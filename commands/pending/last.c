@@ -10,6 +10,7 @@ USE_LAST(NEWTOY(last, "f:W", TOYFLAG_BIN))
 config LAST
   bool "last"
   default n
+  depends on TOYBOX_UTMPX
   help
     usage: last [-W] [-f FILE]
 
@@ -21,7 +22,6 @@ config LAST
 
 #define FOR_last
 #include "toys.h"
-#include <utmp.h>
 
 #ifndef SHUTDOWN_TIME
 #define SHUTDOWN_TIME 254
@@ -30,42 +30,59 @@ config LAST
 GLOBALS(
   char *file;
 
-  struct arg_list *list;
+  struct utmpx **seen;
+  unsigned long seen_size, seen_used;
 )
 
-static void free_list()
+#if CFG_TOYBOX_UTMPX
+// The records seen so far (so, later in time) for each tty line, hashed by
+// line name, point into the mapped file: walking it backwards, a login's
+// logout is the last record seen on its line.
+static struct utmpx **seen_slot(char *line)
 {
-  if (TT.list) {
-    llist_traverse(TT.list, llist_free_arg);
-    TT.list = NULL;
+  unsigned h = 2166136261U, len = sizeof(((struct utmpx *)0)->ut_line), i;
+
+  for (i = 0; i<len && line[i]; i++) h = (h^line[i])*16777619;
+  for (i = h&(TT.seen_size-1); TT.seen[i]; i = (i+1)&(TT.seen_size-1))
+    if (!strncmp(TT.seen[i]->ut_line, line, len)) break;
+
+  return TT.seen+i;
+}
+
+static struct utmpx *seen_find(char *line)
+{
+  return TT.seen_size ? *seen_slot(line) : 0;
+}
+
+static void seen_add(struct utmpx *ut)
+{
+  struct utmpx **slot, **old = TT.seen;
+  unsigned long i, oldsize = TT.seen_size;
+
+  if (2*(TT.seen_used+1) > TT.seen_size) {
+    TT.seen_size = oldsize ? 2*oldsize : 64;
+    TT.seen = xzalloc(TT.seen_size*sizeof(*TT.seen));
+    for (i = 0; i<oldsize; i++) if (old[i]) *seen_slot(old[i]->ut_line) = old[i];
+    free(old);
   }
+  if (!*(slot = seen_slot(ut->ut_line))) TT.seen_used++;
+  *slot = ut;
 }
 
-static void llist_add_node(struct arg_list **old, void *data)
+// Forget them all at a reboot or shutdown.
+static void seen_clear(void)
 {
-  struct arg_list *new = xmalloc(sizeof(struct arg_list));
-  
-  new->arg = (char*)data;
-  new->next = *old;
-  *old = new;
+  if (TT.seen_size) memset(TT.seen, 0, TT.seen_size*sizeof(*TT.seen));
+  TT.seen_used = 0;
 }
 
-// Find a node and dlink it from the list.
-static struct arg_list *find_and_dlink(struct arg_list **list, char *devname)
+// ctime() without glibc checking whether the timezone file changed each call
+// (a stat() per time printed, three per line of output).
+static char *last_ctime(time_t t, char *buf)
 {
-  struct arg_list *l = *list;
-  
-  while (*list) {
-    struct utmp *ut = (struct utmp *)l->arg;
+  struct tm tm;
 
-    if (!strncmp(ut->ut_line, devname, UT_LINESIZE)) {
-      *list = (*list)->next;
-      return l;
-    }
-    list = &(*list)->next;
-    l = *list;
-  }
-  return NULL;
+  return asctime_r(localtime_r(&t, &tm), buf);
 }
 
 // Compute login, logout and duration of login.
@@ -73,40 +90,39 @@ static void seize_duration(time_t tm0, time_t tm1)
 {
   unsigned days, hours, mins;
   double diff = difftime(tm1, tm0);
+  char buf[32];
   
   diff = (diff > 0) ? (tm1 - tm0) : 0;
   toybuf[0] = toybuf[18] = toybuf[28] = '\0';
-  strncpy(toybuf, ctime(&tm0), 16); // Login Time.
-  snprintf(toybuf+18, 8, "- %s", ctime(&tm1) + 11); // Logout Time.
+  strncpy(toybuf, last_ctime(tm0, buf), 16); // Login Time.
+  snprintf(toybuf+18, 8, "- %s", last_ctime(tm1, buf) + 11); // Logout Time.
   days = (mins = diff/60)/(24*60);
   hours = (mins = (mins%(24*60)))/60;
   mins = mins%60;
   sprintf(toybuf+28, "(%u+%02u:%02u)", days, hours, mins); // Duration.
 }
+#endif
 
 void last_main(void)
 {
-  struct utmp ut;
+#if CFG_TOYBOX_UTMPX
+  struct utmpfile uf;
+  struct utmpx ut, *rec;
   time_t tm[3] = {0,}; //array for time avlues, previous, current
   char *file = "/var/log/wtmp";
-  int fd, pwidth, curlog_type = EMPTY;
-  off_t loc;
+  int pwidth, curlog_type = EMPTY;
+  long i;
 
   if (toys.optflags & FLAG_f) file = TT.file;
 
   pwidth = (toys.optflags & FLAG_W) ? 46 : 16;
   *tm = time(tm+1);
-  fd = xopen(file, O_RDONLY);
-  loc = xlseek(fd, 0, SEEK_END);
+  if (utmpfile_open(&uf, file)) perror_exit("%s", file);
 
   // Loop through file structures in reverse order.
-  for (;;) {
-    loc -= sizeof(ut);
-    if(loc < 0) break;
-    xlseek(fd, loc, SEEK_SET);
-
-    // Read next structure, determine type
-    xreadall(fd, &ut, sizeof(ut));
+  for (i = uf.count; (rec = utmpfile_next(&uf, &i, 1, 0));) {
+    // Copied because the type gets worked out again below
+    memcpy(&ut, rec, sizeof(ut));
     *tm = ut.ut_tv.tv_sec;
     if (*ut.ut_line == '~') {
       if (!strcmp(ut.ut_user, "runlevel")) ut.ut_type = RUN_LVL;
@@ -127,28 +143,25 @@ void last_main(void)
         (((ut.ut_pid & 255) == '0') || ((ut.ut_pid & 255) == '6'))))
     {
       tm[1] = tm[2] = (time_t)ut.ut_tv.tv_sec;
-      free_list();
+      seen_clear();
       curlog_type = RUN_LVL;
     } else if (ut.ut_type == BOOT_TIME) {
       seize_duration(tm[0], tm[1]);
       strcpy(ut.ut_line, "system boot");
-      free_list();
+      seen_clear();
       printf("%-8.8s %-12.12s %-*.*s %-16.16s %-7.7s %s\n", ut.ut_user, 
           ut.ut_line, pwidth, pwidth, ut.ut_host, 
           toybuf, toybuf+18, toybuf+28);
       curlog_type = BOOT_TIME;
       tm[2] = (time_t)ut.ut_tv.tv_sec;
     } else if (ut.ut_type == USER_PROCESS && *ut.ut_line) {
-      struct arg_list *l = find_and_dlink(&TT.list, ut.ut_line);
+      struct utmpx *u = seen_find(ut.ut_line);
 
-      if (l) {
-        struct utmp *u = (struct utmp *)l->arg;
+      if (u) {
         seize_duration(tm[0], u->ut_tv.tv_sec);
         printf("%-8.8s %-12.12s %-*.*s %-16.16s %-7.7s %s\n", ut.ut_user, 
             ut.ut_line, pwidth, pwidth, ut.ut_host, 
             toybuf, toybuf+18, toybuf+28);
-        free(l->arg);
-        free(l);
       } else {
         int type = !tm[2] ? EMPTY : curlog_type;
         if (!tm[2]) { //check process's current status (alive or dead).
@@ -178,19 +191,15 @@ void last_main(void)
             ut.ut_line, pwidth, pwidth, ut.ut_host, 
             toybuf, toybuf+18, toybuf+28);
       }
-      llist_add_node(&TT.list, memcpy(xmalloc(sizeof(ut)), &ut, sizeof(ut)));
-    } else if (ut.ut_type == DEAD_PROCESS && *ut.ut_line)
-      llist_add_node(&TT.list, memcpy(xmalloc(sizeof(ut)), &ut, sizeof(ut)));
-
-    loc -= sizeof(ut);
-    if(loc < 0) break;
-    xlseek(fd, loc, SEEK_SET);
+      seen_add(rec);
+    } else if (ut.ut_type == DEAD_PROCESS && *ut.ut_line) seen_add(rec);
   }
 
+  xprintf("\n%s begins %-24.24s\n", basename(file), ctime(tm));
+
   if (CFG_TOYBOX_FREE) {
-    xclose(fd);
-    free_list();
+    utmpfile_close(&uf);
+    free(TT.seen);
   }
-
-  xprintf("\n%s begins %-24.24s\n", basename(file), ctime(tm));
+#endif
 }
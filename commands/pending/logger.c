@@ -4,16 +4,22 @@
  *
  * See http://pubs.opengroup.org/onlinepubs/9699919799/utilities/logger.html
 
-USE_LOGGER(NEWTOY(logger, "st:p:", TOYFLAG_USR|TOYFLAG_BIN))
+USE_LOGGER(NEWTOY(logger, "f:st:p:", TOYFLAG_USR|TOYFLAG_BIN))
 
 config LOGGER
   bool "logger"
   depends on SYSLOGD
   default n
   help
-    usage: logger [-s] [-t tag] [-p [facility.]priority] [message]
+    usage: logger [-s] [-t tag] [-p [facility.]priority] [-f FILE] [message]
 
-    Log message (or stdin) to syslog.
+    Log message to syslog, or each line of FILE (default stdin) as it
+    arrives.
+
+    -f  Log each line of FILE, - for stdin
+    -p  Priority, as facility.level or just level (default user.notice)
+    -s  Log to stderr as well
+    -t  Tag each message with tag (default user name)
 */
 
 #define FOR_logger
@@ -22,14 +28,97 @@ config LOGGER
 GLOBALS(
   char *priority_arg;
   char *ident;
+  char *file;
+
+  int fd, pri, count, len[64];
+  char *batch, stamp[16];
 )
 
+// Messages sent to /dev/log at once, and the longest one
+#define LOGGER_BATCH (sizeof(TT.len)/sizeof(*TT.len))
+#define LOGGER_MSG 1024
+
 extern int logger_lookup(int where, char *key);
 
+static void logger_connect(void)
+{
+  struct sockaddr_un sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, "/dev/log");
+  if (0>(TT.fd = socket(AF_UNIX, SOCK_DGRAM, 0))) return;
+  fcntl(TT.fd, F_SETFD, FD_CLOEXEC);
+  if (connect(TT.fd, (void *)&sa, sizeof(sa))) {
+    close(TT.fd);
+    TT.fd = -1;
+  }
+}
+
+// Send what's queued, in one sendmmsg() where there is one. If syslogd has
+// gone away (to restart, say) connect again and give it one more try.
+static void logger_flush(void)
+{
+  int sent = 0, try, n;
+#ifdef __linux__
+  struct mmsghdr msgs[LOGGER_BATCH];
+  struct iovec iov[LOGGER_BATCH];
+
+  for (n = 0; n<TT.count; n++) {
+    iov[n].iov_base = TT.batch+n*LOGGER_MSG;
+    iov[n].iov_len = TT.len[n];
+    memset(&msgs[n].msg_hdr, 0, sizeof(msgs[n].msg_hdr));
+    msgs[n].msg_hdr.msg_iov = iov+n;
+    msgs[n].msg_hdr.msg_iovlen = 1;
+  }
+#endif
+
+  for (try = 0; try<2 && sent<TT.count; try++) {
+    if (TT.fd<0) logger_connect();
+    while (TT.fd>=0 && sent<TT.count) {
+#ifdef __linux__
+      n = sendmmsg(TT.fd, msgs+sent, TT.count-sent, 0);
+#else
+      n = send(TT.fd, TT.batch+sent*LOGGER_MSG, TT.len[sent], 0) < 0 ? -1 : 1;
+#endif
+      if (n>0) sent += n;
+      else if (errno != EINTR) {
+        close(TT.fd);
+        TT.fd = -1;
+      }
+    }
+  }
+  if (sent<TT.count) {
+    perror_msg("/dev/log");
+    toys.exitval = 1;
+  }
+  TT.count = 0;
+}
+
+static void logger_queue(char *s, int len)
+{
+  char *msg = TT.batch+TT.count*LOGGER_MSG;
+  int n;
+
+  if (toys.optflags & FLAG_s) dprintf(2, "%s: %.*s\n", TT.ident, len, s);
+  n = snprintf(msg, LOGGER_MSG, "<%d>%s %s: %.*s", TT.pri, TT.stamp, TT.ident,
+    len, s);
+  TT.len[TT.count++] = n<LOGGER_MSG ? n : LOGGER_MSG-1;
+  if (TT.count == LOGGER_BATCH) logger_flush();
+}
+
+// The time in each message is the RFC 3164 kind, "Jan 18 00:11:22".
+static void logger_stamp(void)
+{
+  time_t t = time(0);
+
+  sprintf(TT.stamp, "%.15s", ctime(&t)+4);
+}
+
 void logger_main(void)
 {
-  int facility = LOG_USER, priority = LOG_NOTICE;
-  char *message = NULL;
+  int facility = LOG_USER, priority = LOG_NOTICE, fd, len, n;
+  char *s, *nl;
 
   if (toys.optflags & FLAG_p) {
     char *sep = strchr(TT.priority_arg, '.');
@@ -44,6 +133,7 @@ void logger_main(void)
     if ((priority = logger_lookup(1, TT.priority_arg)) == -1)
       error_exit("bad priority: %s", TT.priority_arg);
   }
+  TT.pri = facility|priority;
 
   if (!(toys.optflags & FLAG_t)) {
     struct passwd *pw = getpwuid(geteuid());
@@ -52,22 +142,48 @@ void logger_main(void)
     TT.ident = xstrdup(pw->pw_name);
   }
 
-  if (toys.optc) {
-    int length = 0, pos = 0;
+  TT.fd = -1;
+  TT.batch = xmalloc(LOGGER_BATCH*LOGGER_MSG);
+  logger_stamp();
 
-    for (;*toys.optargs; toys.optargs++) {
-      length += strlen(*(toys.optargs)) + 1; // plus one for the args spacing
-      message = xrealloc(message, length + 1); // another one for the null byte
+  if (toys.optc && !(toys.optflags & FLAG_f)) {
+    char *message = NULL, **arg;
+    int length = 0;
 
-      sprintf(message + pos, "%s ", *toys.optargs);
-      pos = length;
+    for (arg = toys.optargs; *arg; arg++) {
+      message = xrealloc(message, length + strlen(*arg) + 2);
+      length += sprintf(message + length, " %s"+!length, *arg);
     }
-  } else {
-    toybuf[readall(0, toybuf, 4096-1)] = '\0';
-    message = toybuf;
+    logger_queue(message, length);
+    logger_flush();
+
+    return;
   }
 
-  openlog(TT.ident, (toys.optflags & FLAG_s ? LOG_PERROR : 0) , facility);
-  syslog(priority, "%s", message);
-  closelog();
+  // Each line is a message of its own, sent with whatever else the same
+  // read() brought in, keeping the one socket open throughout.
+  fd = 0;
+  if (TT.file && strcmp(TT.file, "-")) fd = xopen(TT.file, O_RDONLY);
+  for (len = 0;;) {
+    if (1>(n = read(fd, toybuf+len, sizeof(toybuf)-len))) {
+      if (n && errno == EINTR) continue;
+      break;
+    }
+    len += n;
+    logger_stamp();
+    for (s = toybuf; (nl = memchr(s, '\n', toybuf+len-s)); s = nl+1)
+      if (nl != s) logger_queue(s, nl-s);
+    len -= s-toybuf;
+    memmove(toybuf, s, len);
+    // A line too long for the buffer goes in pieces.
+    if (len == sizeof(toybuf)) {
+      logger_queue(toybuf, len);
+      len = 0;
+    }
+    if (TT.count) logger_flush();
+  }
+  if (len) logger_queue(toybuf, len);
+  if (TT.count) logger_flush();
+  if (fd) close(fd);
+  if (TT.fd>=0) close(TT.fd);
 }
@@ -29,6 +29,8 @@ GLOBALS(
   struct double_list *files;
   int last_shown_pid;
   int shown_header;
+  struct inodeset sockets;
+  int sockets_read;
 )
 
 struct proc_info {
@@ -121,49 +123,40 @@ static void fill_flags(struct file_info *fi)
   fclose(fp);
 }
 
-static int scan_proc_net_file(char *path, int family, char type,
-    void (*fn)(char *, int, char, struct file_info *, long),
-    struct file_info *fi, long sought_inode)
+// Remember a socket's TYPE and NAME, as one string with a space between them.
+// The first file a socket's listed in wins.
+static void add_socket(unsigned long long inode, char *type, char *name)
 {
-  FILE *fp = fopen(path, "r");
-  char *line = NULL;
-  size_t line_length = 0;
-
-  if (!fp) return 0;
+  void **slot;
 
-  if (!xgetline(&line, &line_length, fp)) return 0; // Skip header.
-
-  while (xgetline(&line, &line_length, fp) > 0) {
-    fn(line, family, type, fi, sought_inode);
-    if (fi->name != 0) break;
-  }
-
-  free(line);
-  fclose(fp);
-
-  return fi->name != 0;
+  if (!inode) return;
+  slot = inodeset_slot(&TT.sockets, 0, inode);
+  if (!*slot) *slot = xmprintf("%s %s", type, name);
 }
 
-static void match_unix(char *line, int af, char type, struct file_info *fi,
-                       long sought_inode)
+static void scan_unix(void)
 {
-  long inode;
+  FILE *fp = fopen("/proc/net/unix", "r");
+  unsigned long inode;
   int path_pos;
 
-  if (sscanf(line, "%*p: %*X %*X %*X %*X %*X %lu %n", &inode, &path_pos) >= 1 &&
-        inode == sought_inode) {
-    char *name = chomp(line + path_pos);
+  if (!fp) return;
+  while (fgets(toybuf, sizeof(toybuf), fp)) {
+    char *name;
 
-    strcpy(fi->type, "unix");
-    fi->name = strdup(*name ? name : "socket");
+    if (sscanf(toybuf, "%*p: %*X %*X %*X %*X %*X %lu %n", &inode,
+        &path_pos) < 1) continue;
+    name = chomp(toybuf + path_pos);
+    add_socket(inode, "unix", *name ? name : "socket");
   }
+  fclose(fp);
 }
 
-static void match_netlink(char *line, int af, char type, struct file_info *fi,
-                          long sought_inode)
+static void scan_netlink(void)
 {
+  FILE *fp = fopen("/proc/net/netlink", "r");
   unsigned state;
-  long inode;
+  unsigned long inode;
   char *netlink_states[] = {
     "ROUTE", "UNUSED", "USERSOCK", "FIREWALL", "SOCK_DIAG", "NFLOG", "XFRM",
     "SELINUX", "ISCSI", "AUDIT", "FIB_LOOKUP", "CONNECTOR", "NETFILTER",
@@ -171,75 +164,77 @@ static void match_netlink(char *line, int af, char type, struct file_info *fi,
     "ENCRYPTFS", "RDMA", "CRYPTO"
   };
 
-  if (sscanf(line, "%*p %u %*u %*x %*u %*u %*u %*u %*u %lu",
-             &state, &inode) < 2 || inode != sought_inode) {
-    return;
+  if (!fp) return;
+  while (fgets(toybuf, sizeof(toybuf), fp)) {
+    if (sscanf(toybuf, "%*p %u %*u %*x %*u %*u %*u %*u %*u %lu",
+               &state, &inode) < 2) continue;
+    add_socket(inode, "netlink",
+      state < ARRAY_LEN(netlink_states) ? netlink_states[state] : "?");
   }
-
-  strcpy(fi->type, "netlink");
-  fi->name =
-      strdup(state < ARRAY_LEN(netlink_states) ? netlink_states[state] : "?");
+  fclose(fp);
 }
 
-static void match_ip(char *line, int af, char type, struct file_info *fi,
-                     long sought_inode)
+static void scan_ip(char *path, int af, char type)
 {
   char *tcp_states[] = {
     "UNKNOWN", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2",
     "TIME_WAIT", "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING"
   };
-  char local_ip[INET6_ADDRSTRLEN] = {0};
-  char remote_ip[INET6_ADDRSTRLEN] = {0};
-  struct in6_addr local, remote;
-  int local_port, remote_port, state;
-  long inode;
-  int ok;
+  char local_ip[INET6_ADDRSTRLEN], remote_ip[INET6_ADDRSTRLEN], *name;
+  FILE *fp = fopen(path, "r");
+  struct netsock ns;
 
-  if (af == 4) {
-    ok = sscanf(line, " %*d: %x:%x %x:%x %x %*x:%*x %*X:%*X %*X %*d %*d %ld",
-                &(local.s6_addr32[0]), &local_port,
-                &(remote.s6_addr32[0]), &remote_port,
-                &state, &inode) == 6;
-  } else {
-    ok = sscanf(line, " %*d: %8x%8x%8x%8x:%x %8x%8x%8x%8x:%x %x "
-                "%*x:%*x %*X:%*X %*X %*d %*d %ld",
-                &(local.s6_addr32[0]), &(local.s6_addr32[1]),
-                &(local.s6_addr32[2]), &(local.s6_addr32[3]),
-                &local_port,
-                &(remote.s6_addr32[0]), &(remote.s6_addr32[1]),
-                &(remote.s6_addr32[2]), &(remote.s6_addr32[3]),
-                &remote_port, &state, &inode) == 12;
-  }
-  if (!ok || inode != sought_inode) return;
-
-  strcpy(fi->type, af == 4 ? "IPv4" : "IPv6");
-  inet_ntop(af, &local, local_ip, sizeof(local_ip));
-  inet_ntop(af, &remote, remote_ip, sizeof(remote_ip));
-  if (type == 't') {
-    if (state < 0 || state > TCP_CLOSING) state = 0;
-    fi->name = xmprintf(af == 4 ?
-                        "TCP %s:%d->%s:%d (%s)" :
-                        "TCP [%s]:%d->[%s]:%d (%s)",
-                        local_ip, local_port, remote_ip, remote_port,
-                        tcp_states[state]);
-  } else {
-    fi->name = xmprintf(af == 4 ? "%s %s:%d->%s:%d" : "%s [%s]:%d->[%s]:%d",
-                        type == 'u' ? "UDP" : "RAW",
-                        local_ip, local_port, remote_ip, remote_port);
+  if (!fp) return;
+  while (fgets(toybuf, sizeof(toybuf), fp)) {
+    if (!netsock_parse(toybuf, af == 6, &ns) || !ns.inode) continue;
+    inet_ntop(af == 4 ? AF_INET : AF_INET6, ns.laddr, local_ip,
+      sizeof(local_ip));
+    inet_ntop(af == 4 ? AF_INET : AF_INET6, ns.raddr, remote_ip,
+      sizeof(remote_ip));
+    if (type == 't') {
+      if (ns.state > TCP_CLOSING) ns.state = 0;
+      name = xmprintf(af == 4 ?
+                      "TCP %s:%d->%s:%d (%s)" :
+                      "TCP [%s]:%d->[%s]:%d (%s)",
+                      local_ip, ns.lport, remote_ip, ns.rport,
+                      tcp_states[ns.state]);
+    } else {
+      name = xmprintf(af == 4 ? "%s %s:%d->%s:%d" : "%s [%s]:%d->[%s]:%d",
+                      type == 'u' ? "UDP" : "RAW",
+                      local_ip, ns.lport, remote_ip, ns.rport);
+    }
+    add_socket(ns.inode, af == 4 ? "IPv4" : "IPv6", name);
+    free(name);
   }
+  fclose(fp);
 }
 
+// Name a socket from the /proc/net tables, which are read once, the first
+// time one is asked about, instead of once per open socket.
 static int find_socket(struct file_info *fi, long inode)
 {
-  // TODO: other protocols (packet).
-  return scan_proc_net_file("/proc/net/tcp", 4, 't', match_ip, fi, inode) ||
-    scan_proc_net_file("/proc/net/tcp6", 6, 't', match_ip, fi, inode) ||
-    scan_proc_net_file("/proc/net/udp", 4, 'u', match_ip, fi, inode) ||
-    scan_proc_net_file("/proc/net/udp6", 6, 'u', match_ip, fi, inode) ||
-    scan_proc_net_file("/proc/net/raw", 4, 'r', match_ip, fi, inode) ||
-    scan_proc_net_file("/proc/net/raw6", 6, 'r', match_ip, fi, inode) ||
-    scan_proc_net_file("/proc/net/unix", 0, 0, match_unix, fi, inode) ||
-    scan_proc_net_file("/proc/net/netlink", 0, 0, match_netlink, fi, inode);
+  char *s;
+  int len;
+
+  if (!TT.sockets_read) {
+    TT.sockets_read++;
+    // TODO: other protocols (packet).
+    scan_ip("/proc/net/tcp", 4, 't');
+    scan_ip("/proc/net/tcp6", 6, 't');
+    scan_ip("/proc/net/udp", 4, 'u');
+    scan_ip("/proc/net/udp6", 6, 'u');
+    scan_ip("/proc/net/raw", 4, 'r');
+    scan_ip("/proc/net/raw6", 6, 'r');
+    scan_unix();
+    scan_netlink();
+  }
+  if (!(s = inodeset_find(&TT.sockets, 0, inode))) return 0;
+  len = strcspn(s, " ");
+  memcpy(fi->type, s, len);
+  fi->type[len] = 0;
+  fi->name = xstrdup(s+len+1);
+
+  return 1;
 }
 
 static void fill_stat(struct file_info *fi, const char* path)
@@ -379,43 +374,20 @@ static void visit_fds(struct proc_info *pi)
   closedir(dir);
 }
 
-static void lsof_pid(int pid)
+static void lsof_pid(struct procsnap *snap, long i)
 {
   struct proc_info pi;
-  FILE *fp;
-  char *line;
-  struct stat sb;
-
-  // Does this process even exist?
-  snprintf(toybuf, sizeof(toybuf), "/proc/%d/stat", pid);
-  fp = fopen(toybuf, "r");
-  if (!fp) return;
-
-  // Get COMMAND.
-  strcpy(pi.cmd, "?");
-  line = fgets(toybuf, sizeof(toybuf), fp);
-  fclose(fp);
-  if (line) {
-    char *open_paren = strchr(toybuf, '(');
-    char *close_paren = strrchr(toybuf, ')');
-
-    if (open_paren && close_paren) {
-      *close_paren = 0;
-      snprintf(pi.cmd, sizeof(pi.cmd), "%s", open_paren + 1);
-    }
-  }
 
-  // We already know PID.
-  pi.pid = pid;
-
-  // Get USER.
-  snprintf(toybuf, sizeof(toybuf), "/proc/%d", pid);
-  if (!stat(toybuf, &sb)) {
-    struct passwd *pw;
+  // COMMAND, PID and USER come from the snapshot.
+  snprintf(pi.cmd, sizeof(pi.cmd), "%s", procsnap_name(snap, i));
+  pi.pid = snap->pid[i];
+  if (toys.optflags&FLAG_l) {
+    snprintf(pi.user, sizeof(pi.user), "%u", (unsigned)snap->uid[i]);
+  } else {
+    struct passwd *pw = getpwuid(snap->uid[i]);
 
-    if (!(toys.optflags&FLAG_l) && (pw = getpwuid(sb.st_uid))) {
-      snprintf(pi.user, sizeof(pi.user), "%s", pw->pw_name);
-    } else snprintf(pi.user, sizeof(pi.user), "%u", (unsigned)sb.st_uid);
+    if (pw) snprintf(pi.user, sizeof(pi.user), "%s", pw->pw_name);
+    else snprintf(pi.user, sizeof(pi.user), "%u", (unsigned)snap->uid[i]);
   }
 
   visit_symlink(&pi, "cwd", "cwd");
@@ -425,18 +397,11 @@ static void lsof_pid(int pid)
   visit_fds(&pi);
 }
 
-static int scan_slash_proc(struct dirtree *node)
-{
-  int pid;
-
-  if (!node->parent) return DIRTREE_RECURSE;
-  if ((pid = atol(node->name))) lsof_pid(pid);
-  return 0;
-}
-
 void lsof_main(void)
 {
-  int i;
+  struct procsnap snap;
+  long n;
+  int i, *pids = 0, count = 0;
 
   // lsof will only filter on paths it can stat (because it filters by inode).
   TT.sought_files = xmalloc(toys.optc*sizeof(struct stat));
@@ -446,14 +411,30 @@ void lsof_main(void)
 
   if (toys.optflags&FLAG_p) {
     char *pid_str;
-    int length, pid;
+    int length;
 
     while ((pid_str = comma_iterate(&TT.pids, &length))) {
       pid_str[length] = 0;
-      if (!(pid = atoi(pid_str))) error_exit("bad pid '%s'", pid_str);
-      lsof_pid(pid);
+      if (!(15&count)) pids = xrealloc(pids, (count+16)*sizeof(int));
+      if (!(pids[count++] = atoi(pid_str)))
+        error_exit("bad pid '%s'", pid_str);
+    }
+  }
+
+  memset(&snap, 0, sizeof(snap));
+  procsnap_read(&snap, PROCSNAP_STAT|PROCSNAP_OWNER, 0);
+  for (n = 0; n<snap.count; n++) {
+    if (toys.optflags&FLAG_p) {
+      for (i = 0; i<count; i++) if (pids[i] == snap.pid[n]) break;
+      if (i == count) continue;
     }
-  } else dirtree_read("/proc", scan_slash_proc);
+    lsof_pid(&snap, n);
+  }
 
   llist_traverse(TT.files, print_info);
+  if (CFG_TOYBOX_FREE) {
+    procsnap_free(&snap);
+    inodeset_free(&TT.sockets, free);
+    free(pids);
+  }
 }
@@ -3,16 +3,17 @@
  * Copyright 2005, 2008 Rob Landley <rob@landley.net>
  * Copyright 2005 Frank Sorenson <frank@tuxrocks.com>
 
-USE_MDEV(NEWTOY(mdev, "s", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_UMASK))
+USE_MDEV(NEWTOY(mdev, "ms", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_UMASK))
 
 config MDEV
   bool "mdev"
   default n
   help
-    usage: mdev [-s]
+    usage: mdev [-sm]
 
     Create devices in /dev using information from /sys.
 
+    -m	With -s, also load the modules for every device in /sys/devices
     -s	Scan all entries in /sys to populate /dev.
 
 config MDEV_CONF
@@ -29,157 +30,139 @@ config MDEV_CONF
     matching devies.
 */
 
+
+#define FOR_mdev
 #include "toys.h"
 
-// mknod in /dev based on a path like "/sys/block/hda/hda1"
-static void make_device(char *path)
-{
-  char *device_name = 0, *s, *temp;
-  int major = 0, minor = 0, type, len, fd, mode = 0660;
-  uid_t uid = 0;
-  gid_t gid = 0;
+GLOBALS(
+  char *conf;
+  long conflen;
 
-  if (path) {
-    // Try to read major/minor string
+  struct mdev_dev *devs;
+  long count;
+)
 
-    temp = strrchr(path, '/');
-    fd = open(path, O_RDONLY);
-    *temp = 0;
-    len = read(fd, toybuf, 64);
-    close(fd);
-    if (len<1) return;
-    toybuf[len] = 0;
-
-    // Determine device type, major and minor
-
-    type = path[5]=='c' ? S_IFCHR : S_IFBLK;
-    sscanf(toybuf, "%u:%u", &major, &minor);
-  } else {
-    // if (!path), do hotplug
-
-    if (!(temp = getenv("MODALIAS"))) xrun((char *[]){"modprobe", temp, 0});
-    if (!(temp = getenv("SUBSYSTEM"))) return;
-    type = strcmp(temp, "block") ? S_IFCHR : S_IFBLK;
-    if (!(temp = getenv("MAJOR"))) return;
-    sscanf(temp, "%u", &major);
-    if (!(temp = getenv("MINOR"))) return;
-    sscanf(temp, "%u", &minor);
-    if (!(path = getenv("DEVPATH"))) return;
-    device_name = getenv("DEVNAME");
-  }
-  if (!device_name)
-    device_name = strrchr(path, '/') + 1;
+// A sysfs directory -s found: a /sys/class or /sys/block entry that may have
+// a device node (type S_IFCHR or S_IFBLK), or with -m a /sys/devices entry
+// (type 0) that may want a module. The uevent fills in the rest.
+struct mdev_dev {
+  char *path, *alias;
+  int type, major, minor;
+};
 
-  // as in linux/drivers/base/core.c, device_get_devnode()
-  while ((temp = strchr(device_name, '!'))) {
-    *temp = '/';
-  }
+// Aliases handed to each modprobe, well under any ARG_MAX
+#define MDEV_ARGS (64<<10)
 
-  // If we have a config file, look up permissions for this device
-
-  if (CFG_MDEV_CONF) {
-    char *conf, *pos, *end;
-
-    // mmap the config file
-    if (-1!=(fd = open("/etc/mdev.conf", O_RDONLY))) {
-      len = fdlength(fd);
-      conf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
-      if (conf) {
-        int line = 0;
-
-        // Loop through lines in mmaped file
-        for (pos = conf; pos-conf<len;) {
-          int field;
-          char *end2;
-
-          line++;
-          // find end of this line
-          for(end = pos; end-conf<len && *end!='\n'; end++);
-
-          // Three fields: regex, uid:gid, mode
-          for (field = 3; field; field--) {
-            // Skip whitespace
-            while (pos<end && isspace(*pos)) pos++;
-            if (pos==end || *pos=='#') break;
-            for (end2 = pos;
-              end2<end && !isspace(*end2) && *end2!='#'; end2++);
-            switch(field) {
-              // Regex to match this device
-              case 3:
-              {
-                char *regex = strndup(pos, end2-pos);
-                regex_t match;
-                regmatch_t off;
-                int result;
-
-                // Is this it?
-                xregcomp(&match, regex, REG_EXTENDED);
-                result=regexec(&match, device_name, 1, &off, 0);
-                regfree(&match);
-                free(regex);
-
-                // If not this device, skip rest of line
-                if (result || off.rm_so
-                  || off.rm_eo!=strlen(device_name))
-                    goto end_line;
-
-                break;
-              }
-              // uid:gid
-              case 2:
-              {
-                char *s2;
-
-                // Find :
-                for(s = pos; s<end2 && *s!=':'; s++);
-                if (s==end2) goto end_line;
-
-                // Parse UID
-                uid = strtoul(pos,&s2,10);
-                if (s!=s2) {
-                  struct passwd *pass;
-                  char *str = strndup(pos, s-pos);
-                  pass = getpwnam(str);
-                  free(str);
-                  if (!pass) goto end_line;
-                  uid = pass->pw_uid;
-                }
-                s++;
-                // parse GID
-                gid = strtoul(s,&s2,10);
-                if (end2!=s2) {
-                  struct group *grp;
-                  char *str = strndup(s, end2-s);
-                  grp = getgrnam(str);
-                  free(str);
-                  if (!grp) goto end_line;
-                  gid = grp->gr_gid;
-                }
-                break;
-              }
-              // mode
-              case 1:
-              {
-                mode = strtoul(pos, &pos, 8);
-                if (pos!=end2) goto end_line;
-                goto found_device;
-              }
-            }
-            pos=end2;
+// Look up permissions for this device in the already mapped config file
+static void mdev_perms(char *device_name, uid_t *uid, gid_t *gid, int *mode)
+{
+  char *conf = TT.conf, *pos, *end, *s;
+  long len = TT.conflen;
+  int line = 0;
+
+  // Loop through lines in mmaped file
+  for (pos = conf; pos-conf<len;) {
+    int field;
+    char *end2;
+
+    line++;
+    // find end of this line
+    for(end = pos; end-conf<len && *end!='\n'; end++);
+
+    // Three fields: regex, uid:gid, mode
+    for (field = 3; field; field--) {
+      // Skip whitespace
+      while (pos<end && isspace(*pos)) pos++;
+      if (pos==end || *pos=='#') break;
+      for (end2 = pos;
+        end2<end && !isspace(*end2) && *end2!='#'; end2++);
+      switch(field) {
+        // Regex to match this device
+        case 3:
+        {
+          char *regex = strndup(pos, end2-pos);
+          regex_t match;
+          regmatch_t off;
+          int result;
+
+          // Is this it?
+          xregcomp(&match, regex, REG_EXTENDED);
+          result=regexec(&match, device_name, 1, &off, 0);
+          regfree(&match);
+          free(regex);
+
+          // If not this device, skip rest of line
+          if (result || off.rm_so
+            || off.rm_eo!=strlen(device_name))
+              goto end_line;
+
+          break;
+        }
+        // uid:gid
+        case 2:
+        {
+          char *s2;
+
+          // Find :
+          for(s = pos; s<end2 && *s!=':'; s++);
+          if (s==end2) goto end_line;
+
+          // Parse UID
+          *uid = strtoul(pos,&s2,10);
+          if (s!=s2) {
+            struct passwd *pass;
+            char *str = strndup(pos, s-pos);
+            pass = getpwnam(str);
+            free(str);
+            if (!pass) goto end_line;
+            *uid = pass->pw_uid;
           }
-end_line:
-          // Did everything parse happily?
-          if (field && field!=3) error_exit("Bad line %d", line);
-
-          // Next line
-          pos = ++end;
+          s++;
+          // parse GID
+          *gid = strtoul(s,&s2,10);
+          if (end2!=s2) {
+            struct group *grp;
+            char *str = strndup(s, end2-s);
+            grp = getgrnam(str);
+            free(str);
+            if (!grp) goto end_line;
+            *gid = grp->gr_gid;
+          }
+          break;
+        }
+        // mode
+        case 1:
+        {
+          *mode = strtoul(pos, &pos, 8);
+          if (pos!=end2) goto end_line;
+          return;
         }
-found_device:
-        munmap(conf, len);
       }
-      close(fd);
+      pos=end2;
     }
+end_line:
+    // Did everything parse happily?
+    if (field && field!=3) error_exit("Bad line %d", line);
+
+    // Next line
+    pos = ++end;
   }
+}
+
+// mknod /dev/device_name (or with ACTION=remove, delete it)
+static void make_device(char *device_name, int type, int major, int minor)
+{
+  char *temp;
+  int mode = 0660;
+  uid_t uid = 0;
+  gid_t gid = 0;
+
+  // as in linux/drivers/base/core.c, device_get_devnode()
+  while ((temp = strchr(device_name, '!'))) {
+    *temp = '/';
+  }
+
+  if (TT.conf) mdev_perms(device_name, &uid, &gid, &mode);
 
   sprintf(toybuf, "/dev/%s", device_name);
 
@@ -199,20 +182,64 @@ found_device:
   if (CFG_MDEV_CONF) mode=chown(toybuf, uid, gid);
 }
 
+// Map the config file once for every device to look their permissions up in.
+static void mdev_conf(void)
+{
+  int fd;
+
+  if (!CFG_MDEV_CONF || -1==(fd = open("/etc/mdev.conf", O_RDONLY))) return;
+  if ((TT.conflen = fdlength(fd))) {
+    TT.conf = mmap(NULL, TT.conflen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (TT.conf == MAP_FAILED) TT.conf = 0;
+  }
+  close(fd);
+}
+
+// hotplug: the kernel runs us with the device described in the environment
+static void hotplug(void)
+{
+  char *temp, *path;
+  int major = 0, minor = 0, type;
+
+  if ((temp = getenv("MODALIAS"))) xrun((char *[]){"modprobe", temp, 0});
+  if (!(temp = getenv("SUBSYSTEM"))) return;
+  type = strcmp(temp, "block") ? S_IFCHR : S_IFBLK;
+  if (!(temp = getenv("MAJOR"))) return;
+  sscanf(temp, "%u", &major);
+  if (!(temp = getenv("MINOR"))) return;
+  sscanf(temp, "%u", &minor);
+  if (!(path = getenv("DEVPATH"))) return;
+  if (!(temp = getenv("DEVNAME"))) temp = strrchr(path, '/') + 1;
+
+  mdev_conf();
+  make_device(temp, type, major, minor);
+}
+
+static void mdev_add(char *path, int type)
+{
+  struct mdev_dev *dev;
+
+  if (!(TT.count&255))
+    TT.devs = xrealloc(TT.devs, (TT.count+256)*sizeof(struct mdev_dev));
+  dev = TT.devs+TT.count++;
+  memset(dev, 0, sizeof(*dev));
+  dev->path = path;
+  dev->type = type;
+}
+
 static int callback(struct dirtree *node)
 {
+  struct dirtree *root;
+
   // Entries in /sys/class/block aren't char devices, so skip 'em.  (We'll
   // get block devices out of /sys/block.)
   if(!strcmp(node->name, "block")) return 0;
 
-  // Does this directory have a "dev" entry in it?
+  // Anything that could have a "dev" entry gets its uevent read later.
   // This is path based because the hotplug callbacks are
   if (S_ISDIR(node->st.st_mode) || S_ISLNK(node->st.st_mode)) {
-    int len=4;
-    char *dev = dirtree_path(node, &len);
-    strcpy(dev+len, "/dev");
-    if (!access(dev, R_OK)) make_device(dev);
-    free(dev);
+    for (root = node; root->parent; root = root->parent);
+    mdev_add(dirtree_path(node, 0), root->name[5]=='c' ? S_IFCHR : S_IFBLK);
   }
 
   // Circa 2.6.25 the entries more than 2 deep are all either redundant
@@ -221,14 +248,151 @@ static int callback(struct dirtree *node)
   return (node->parent && node->parent->parent) ? 0 : DIRTREE_RECURSE;
 }
 
+// -m: every directory under /sys/devices with a uevent is a device, which
+// may name the module it needs.
+static int modalias_callback(struct dirtree *node)
+{
+  if (!dirtree_notdotdot(node)) return 0;
+  if (S_ISDIR(node->st.st_mode)) return DIRTREE_RECURSE;
+  if (S_ISREG(node->st.st_mode) && !strcmp(node->name, "uevent"))
+    mdev_add(dirtree_path(node->parent, 0), 0);
+
+  return 0;
+}
+
+// Each worker reads the uevent of every step'th device from start. This is
+// all a worker needs.
+struct mdev_job {
+  struct mdev_dev *devs;
+  long count, start, step;
+  pthread_t tid;
+  int started;
+};
+
+static void *mdev_read(void *arg)
+{
+  struct mdev_job *job = arg;
+  struct mdev_dev *dev;
+  char buf[4096], *s, *line, *next;
+  long i;
+  int fd, len;
+
+  for (i = job->start; i<job->count; i += job->step) {
+    dev = job->devs+i;
+    dev->major = dev->minor = -1;
+    snprintf(buf, sizeof(buf), "%s/uevent", dev->path);
+    if (-1 == (fd = open(buf, O_RDONLY))) continue;
+    len = readall(fd, buf, sizeof(buf)-1);
+    close(fd);
+    if (len<1) continue;
+    buf[len] = 0;
+
+    // Lines of KEY=VALUE
+    for (line = buf; *line; line = next) {
+      if ((next = strchr(s = line, '\n'))) *next++ = 0;
+      else next = line+strlen(line);
+      if (strstart(&s, "MAJOR=")) dev->major = atoi(s);
+      else if (strstart(&s, "MINOR=")) dev->minor = atoi(s);
+      else if (!dev->type && strstart(&s, "MODALIAS=")) dev->alias = strdup(s);
+    }
+  }
+
+  return 0;
+}
+
+// Read all the uevents, in parallel if we can.
+static void mdev_uevents(void)
+{
+  struct mdev_job *jobs;
+  long n = 1, i;
+#if CFG_TOYBOX_THREADS
+  pthread_attr_t attr;
+
+  if ((n = sysconf(_SC_NPROCESSORS_ONLN)) < 1) n = 1;
+  if (n > 8) n = 8;
+  if (n > TT.count/64+1) n = TT.count/64+1;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+#endif
+
+  jobs = xzalloc(n*sizeof(*jobs));
+  for (i = 0; i<n; i++) {
+    jobs[i].devs = TT.devs;
+    jobs[i].count = TT.count;
+    jobs[i].start = i;
+    jobs[i].step = n;
+#if CFG_TOYBOX_THREADS
+    jobs[i].started = i && !toy_worker_create(&jobs[i].tid, &attr, mdev_read,
+      jobs+i);
+#endif
+  }
+  for (i = 0; i<n; i++) if (!jobs[i].started) mdev_read(jobs+i);
+#if CFG_TOYBOX_THREADS
+  for (i = 0; i<n; i++) if (jobs[i].started) pthread_join(jobs[i].tid, 0);
+  pthread_attr_destroy(&attr);
+#endif
+  free(jobs);
+}
+
+// Hand every distinct alias to one modprobe -a (or a few, if there's a lot).
+static void mdev_modprobe(void)
+{
+  char **list = xmalloc((TT.count+3)*sizeof(char *)), **argv;
+  long i, n, len;
+  int j;
+
+  for (i = n = 0; i<TT.count; i++) if (TT.devs[i].alias)
+    list[n++] = TT.devs[i].alias;
+  qsort(list, n, sizeof(char *), qstrcmp);
+
+  argv = xmalloc((n+3)*sizeof(char *));
+  argv[0] = "modprobe";
+  argv[1] = "-qa";
+  for (i = 0; i<n;) {
+    for (j = 2, len = 0; i<n && len<MDEV_ARGS; i++) {
+      if (j>2 && !strcmp(list[i], argv[j-1])) continue;
+      len += strlen(argv[j++] = list[i])+1;
+    }
+    argv[j] = 0;
+    xrun(argv);
+  }
+  free(argv);
+  free(list);
+}
+
 void mdev_main(void)
 {
-  // Handle -s
+  struct mdev_dev *dev;
+  long i;
+
+  if (!(toys.optflags & FLAG_s)) {
+    hotplug();
+
+    return;
+  }
+
+  // Find the devices, read what they are, then make the nodes in one go.
+  dirtree_read_parallel("/sys/class", callback, 0);
+  dirtree_read_parallel("/sys/block", callback, 0);
+  if (toys.optflags & FLAG_m)
+    dirtree_read_parallel("/sys/devices", modalias_callback, 0);
+  mdev_uevents();
+
+  mdev_conf();
+  for (i = 0; i<TT.count; i++) {
+    dev = TT.devs+i;
+    if (dev->type && dev->major != -1 && dev->minor != -1)
+      make_device(strrchr(dev->path, '/')+1, dev->type, dev->major,
+        dev->minor);
+  }
+  if (toys.optflags & FLAG_m) mdev_modprobe();
 
-  if (toys.optflags) {
-    dirtree_read("/sys/class", callback);
-    dirtree_read("/sys/block", callback);
-  } else { // hotplug support
-    make_device(NULL);
+  if (CFG_TOYBOX_FREE) {
+    for (i = 0; i<TT.count; i++) {
+      free(TT.devs[i].path);
+      free(TT.devs[i].alias);
+    }
+    free(TT.devs);
+    if (TT.conf) munmap(TT.conf, TT.conflen);
   }
 }
@@ -2,8 +2,8 @@
  *
  * Copyright 2006, 2007 Rob Landley <rob@landley.net>
 
-// Still to go: "E:jJ:L:m:O:"
-USE_MKE2FS(NEWTOY(mke2fs, "<1>2g:Fnqm#N#i#b#", TOYFLAG_SBIN))
+// Still to go: "jJ:L:m:O:"
+USE_MKE2FS(NEWTOY(mke2fs, "<1>2g:Fnqm#N#i#b#"USE_MKE2FS_EXTENDED("E:"), TOYFLAG_SBIN))
 
 config MKE2FS
   bool "mke2fs"
@@ -58,9 +58,12 @@ config MKE2FS_EXTENDED
   default n
   depends on MKE2FS
   help
-    usage: mke2fs [-E stride=###] [-O option[,option]]
+    usage: mke2fs [-E option[,option]] [-O option[,option]]
 
-    -E stride= Set RAID stripe size (in blocks)
+    -E [opts]  Extended options
+       lazy_itable_init Don't zero inode tables, let the kernel do it once
+                        mounted (sets uninit_bg, which needs ext4 to mount)
+       nodiscard        Don't discard the device's blocks first
     -O [opts]  Specify fewer ext2 option flags (for old kernels)
                All of these are on by default (as appropriate)
        none         Clear default options (all but journaling)
@@ -76,6 +79,7 @@ config MKE2FS_EXTENDED
 
 GLOBALS(
   // Command line arguments.
+  char *extended;
   long blocksize;
   long bytes_per_inode;
   long inodes;           // Total inodes in filesystem.
@@ -98,9 +102,18 @@ GLOBALS(
   unsigned nextgroup;    // Next group we'll be allocating from
   int fsfd;              // File descriptor of filesystem (to output to).
 
+  // Output
+  char *buf;             // Writes waiting to go out, MKE2FS_BUF at most
+  unsigned buflen;
+  off_t pos, size;       // Where buf goes, and the old length of a file
+  int isblk, isreg, lazy, discard;
+
   struct ext2_superblock sb;
 )
 
+// Metadata goes out in writes this big.
+#define MKE2FS_BUF (4<<20)
+
 #define INODES_RESERVED 10
 
 static uint32_t div_round_up(uint32_t a, uint32_t b)
@@ -149,12 +162,12 @@ static uint32_t file_blocks_used(uint64_t size, uint32_t *blocklist)
 }
 
 // Use the parent pointer to iterate through the tree non-recursively.
-static struct dirtree *treenext(struct dirtree *this)
+static struct dirtree *treenext(struct dirtree *node)
 {
-  while (this && !this->next) this = this->parent;
-  if (this) this = this->next;
+  while (node && !node->next) node = node->parent;
+  if (node) node = node->next;
 
-  return this;
+  return node;
 }
 
 // Recursively calculate the number of blocks used by each inode in the tree.
@@ -370,20 +383,83 @@ static void bits_set(char *array, int start, int len)
   }
 }
 
-// Seek past len bytes (to maintain sparse file), or write zeroes if output
-// not seekable
-static void put_zeroes(int len)
+static void fs_flush(void)
+{
+  if (TT.buflen) txwrite(TT.fsfd, TT.buf, TT.buflen);
+  TT.pos += TT.buflen;
+  TT.buflen = 0;
+}
+
+static void fs_write(void *data, unsigned len)
+{
+  while (len) {
+    unsigned n = MKE2FS_BUF-TT.buflen;
+
+    if (n > len) n = len;
+    memcpy(TT.buf+TT.buflen, data, n);
+    TT.buflen += n;
+    data = n+(char *)data;
+    len -= n;
+    if (TT.buflen == MKE2FS_BUF) fs_flush();
+  }
+}
+
+// What fs_skip() leaves behind it
+#define FS_KEEP 0  // whatever was there (a boot sector)
+#define FS_FREE 1  // anything (free data blocks): discard or punch if we can
+#define FS_ZERO 2  // zeroes (inode tables)
+
+// Move past len bytes without writing them if we can: a block device can
+// zero a range itself (and was discarded up front), and a file either
+// gets a hole punched or was never that long to begin with. Failing all
+// that, or when the output doesn't seek, write zeroes.
+static void fs_skip(off_t len, int how)
 {
-  if(-1 == lseek(TT.fsfd, len, SEEK_SET)) {
-    memset(toybuf, 0, sizeof(toybuf));
+  int done = how != FS_ZERO;
+
+  fs_flush();
+  if (!len) return;
+#ifdef __linux__
+  if (TT.isblk && how == FS_ZERO) {
+    uint64_t range[2] = {TT.pos, len};
+
+    done = !ioctl(TT.fsfd, BLKZEROOUT, range);
+  } else if (how != FS_KEEP && TT.isreg) {
+    off_t end = TT.pos+len > TT.size ? TT.size : TT.pos+len;
+
+    done |= end <= TT.pos || (sizeof(long) >= sizeof(off_t)
+      && !syscall(SYS_fallocate, TT.fsfd,
+        FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, (long)TT.pos,
+        (long)(end-TT.pos)));
+  }
+#endif
+  if (done && -1 != lseek(TT.fsfd, len, SEEK_CUR)) TT.pos += len;
+  else {
+    memset(TT.buf, 0, MKE2FS_BUF);
     while (len) {
-      int out = len > sizeof(toybuf) ? sizeof(toybuf) : len;
-      txwrite(TT.fsfd, toybuf, out);
+      unsigned out = len > MKE2FS_BUF ? MKE2FS_BUF : len;
+
+      txwrite(TT.fsfd, TT.buf, out);
+      TT.pos += out;
       len -= out;
     }
   }
 }
 
+// ext4's crc16 (the reflected 0x8005 polynomial) for group descriptors.
+static uint16_t crc16(uint16_t crc, void *data, int len)
+{
+  unsigned char *p = data;
+  int i;
+
+  while (len--) {
+    crc ^= *p++;
+    for (i = 0; i<8; i++) crc = (crc>>1)^(0xA001&-(crc&1));
+  }
+
+  return crc;
+}
+
 // Fill out an inode structure from struct stat info in dirtree.
 static void fill_inode(struct ext2_inode *in, struct dirtree *that)
 {
@@ -448,8 +524,31 @@ void mke2fs_main(void)
 
   // TODO: Check if filesystem is mounted here
 
+  TT.discard = 1;
+  if (TT.extended) {
+    char *opt, *list = TT.extended;
+
+    while ((opt = strsep(&list, ","))) {
+      if (!strcmp(opt, "lazy_itable_init") || !strcmp(opt, "lazy_itable_init=1"))
+        TT.lazy = 1;
+      else if (!strcmp(opt, "lazy_itable_init=0")) TT.lazy = 0;
+      else if (!strcmp(opt, "nodiscard")) TT.discard = 0;
+      else if (!strcmp(opt, "discard")) TT.discard = 1;
+      else error_exit("bad -E %s", opt);
+    }
+  }
+
   // For mke?fs, open file.  For gene?fs, create file.
   TT.fsfd = xcreate(*toys.optargs, temp, 0777);
+  TT.buf = xmalloc(MKE2FS_BUF);
+  {
+    struct stat st;
+
+    if (!fstat(TT.fsfd, &st)) {
+      TT.isblk = S_ISBLK(st.st_mode);
+      if ((TT.isreg = S_ISREG(st.st_mode))) TT.size = st.st_size;
+    }
+  }
 
   // Determine appropriate block size and block count from file length.
   // (If no length, default to 4k.  They can override it on the cmdline.)
@@ -517,9 +616,21 @@ void mke2fs_main(void)
   // Now we know all the TT data, initialize superblock structure.
 
   init_superblock(&TT.sb);
+  if (TT.lazy)
+    TT.sb.feature_ro_compat |= SWAP_LE32(EXT4_FEATURE_RO_COMPAT_GDT_CSUM);
+
+#ifdef __linux__
+  // Tell the device everything's free, so it can skip copying old data
+  // around and (often) reads back zeroes. The boot sector's left alone.
+  if (TT.isblk && TT.discard) {
+    uint64_t range[2] = {1024, TT.blocks*(uint64_t)TT.blocksize-1024};
+
+    ioctl(TT.fsfd, BLKDISCARD, range);
+  }
+#endif
 
   // Start writing.  Skip the first 1k to avoid the boot sector (if any).
-  put_zeroes(1024);
+  fs_skip(1024, FS_KEEP);
 
   // Loop through block groups, write out each one.
   dtiblk = dtbblk = usedblocks = usedinodes = 0;
@@ -544,11 +655,11 @@ void mke2fs_main(void)
       TT.sb.block_group_nr = SWAP_LE16(i);
 
       // Write superblock and pad it up to block size
-      txwrite(TT.fsfd, &TT.sb, sizeof(struct ext2_superblock));
+      fs_write(&TT.sb, sizeof(struct ext2_superblock));
       temp = TT.blocksize - sizeof(struct ext2_superblock);
       if (!i && TT.blocksize > 1024) temp -= 1024;
       memset(toybuf, 0, TT.blocksize);
-      txwrite(TT.fsfd, toybuf, temp);
+      fs_write(toybuf, temp);
 
       // Loop through groups to write group descriptor table.
       for(j=0; j<TT.groups; j++) {
@@ -559,14 +670,14 @@ void mke2fs_main(void)
         // Find next array slot in this block (flush block if full).
         slot = j % (TT.blocksize/sizeof(struct ext2_group));
         if (!slot) {
-          if (j) txwrite(TT.fsfd, bg, TT.blocksize);
+          if (j) fs_write(bg, TT.blocksize);
           memset(bg, 0, TT.blocksize);
         }
 
         // How many free inodes in this group?
         temp = TT.inodespg;
-        if (!i) temp -= INODES_RESERVED;
-        if (temp > treeinodes) {
+        if (!j) temp -= INODES_RESERVED;
+        if (treeinodes > temp) {
           treeinodes -= temp;
           temp = 0;
         } else {
@@ -575,10 +686,17 @@ void mke2fs_main(void)
         }
         bg[slot].free_inodes_count = SWAP_LE16(temp);
 
+        // Inodes after the last one used are left for the kernel to zero.
+        if (TT.lazy) {
+          bg[slot].itable_unused = SWAP_LE16(temp);
+          if (j && temp == TT.inodespg)
+            bg[slot].flags = SWAP_LE16(EXT4_BG_INODE_UNINIT);
+        }
+
         // How many free blocks in this group?
         temp = TT.inodespg/(TT.blocksize/sizeof(struct ext2_inode)) + 2;
         temp = end-used-temp;
-        if (temp > treeblocks) {
+        if (treeblocks > temp) {
           treeblocks -= temp;
           temp = 0;
         } else {
@@ -593,8 +711,16 @@ void mke2fs_main(void)
         bg[slot].inode_bitmap = SWAP_LE32(used++);
         bg[slot].inode_table = SWAP_LE32(used);
         bg[slot].used_dirs_count = 0;  // (TODO)
+        if (TT.lazy) {
+          uint32_t group = SWAP_LE32(j);
+          uint16_t crc = crc16(~0, TT.sb.uuid, sizeof(TT.sb.uuid));
+
+          crc = crc16(crc, &group, 4);
+          bg[slot].checksum = SWAP_LE16(crc16(crc, bg+slot,
+            offsetof(struct ext2_group, checksum)));
+        }
       }
-      txwrite(TT.fsfd, bg, TT.blocksize);
+      fs_write(bg, TT.blocksize);
     }
 
     // Now write out stuff that every block group has.
@@ -610,7 +736,7 @@ void mke2fs_main(void)
       if (end-start > temp) temp = end-start;
       bits_set(toybuf, start, temp);
     }
-    txwrite(TT.fsfd, toybuf, TT.blocksize);
+    fs_write(toybuf, TT.blocksize);
 
     // Write inode bitmap
     memset(toybuf, 0, TT.blocksize);
@@ -622,13 +748,14 @@ void mke2fs_main(void)
       if (slot-j > temp) temp = slot-j;
       bits_set(toybuf, j, temp);
     }
-    txwrite(TT.fsfd, toybuf, TT.blocksize);
+    fs_write(toybuf, TT.blocksize);
 
-    // Write inode table for this group (TODO)
-    for (j = 0; j<TT.inodespg; j++) {
+    // Write inode table for this group: just the blocks with inodes in
+    // them, then the rest zeroed by the device (or left for the kernel).
+    for (j = 0; j<TT.inodespg && ((!i && j<INODES_RESERVED) || dti); j++) {
       slot = j % (TT.blocksize/sizeof(struct ext2_inode));
       if (!slot) {
-        if (j) txwrite(TT.fsfd, in, TT.blocksize);
+        if (j) fs_write(in, TT.blocksize);
         memset(in, 0, TT.blocksize);
       }
       if (!i && j<INODES_RESERVED) {
@@ -639,18 +766,20 @@ void mke2fs_main(void)
         dti = treenext(dti);
       }
     }
-    txwrite(TT.fsfd, in, TT.blocksize);
-
-    while (dtb) {
-      // TODO write index data block
-      // TODO write root directory data block
-      // TODO write directory data block
-      // TODO write file data block
-      put_zeroes(TT.blocksize);
-      start++;
-      if (start == end) break;
+    temp = 0;
+    if (j) {
+      fs_write(in, TT.blocksize);
+      temp = div_round_up(j, TT.blocksize/sizeof(struct ext2_inode));
     }
-    // Write data blocks (TODO)
-    put_zeroes((end-start) * TT.blocksize);
+    fs_skip((itable-temp)*(off_t)TT.blocksize, TT.lazy ? FS_FREE : FS_ZERO);
+
+    // Write data blocks (TODO: index, root directory, directory and file
+    // data blocks)
+    fs_skip((end-start)*(off_t)TT.blocksize, FS_FREE);
   }
+
+  // An image that grew by seeking needs its length set.
+  if (TT.isreg && TT.pos > TT.size && ftruncate(TT.fsfd, TT.pos))
+    perror_exit("ftruncate");
+  free(TT.buf);
 }
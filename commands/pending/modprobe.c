@@ -27,6 +27,7 @@ config MODPROBE
 #define FOR_modprobe
 #include "toys.h"
 #include <sys/syscall.h>
+#include <sys/mman.h>
 
 GLOBALS(
   struct arg_list *probes;
@@ -208,6 +209,23 @@ static int read_line(FILE *fl, char **li)
   return len;
 }
 
+// Record realname as a module the probed alias modent resolves to.
+static void add_alias(char *realname, void *modent)
+{
+  struct module_s *mod = modent;
+
+  llist_add(&mod->rnames, realname = path2mod(realname, NULL));
+  if (mod->flags & MOD_NDDEPS) {
+    mod->flags &= ~MOD_NDDEPS;
+    TT.nudeps--;
+  }
+  mod = get_mod(realname, 1);
+  if (!(mod->flags & MOD_NDDEPS)) {
+    mod->flags |= MOD_NDDEPS;
+    TT.nudeps++;
+  }
+}
+
 /*
  * Action to be taken on all config files in default directories
  * checks for aliases, options, install, remove and blacklist
@@ -246,24 +264,13 @@ static int config_action(struct dirtree *node)
     // process the tokens[0] contains first word of config line.
     if (!strcmp(tokens[0], "alias")) {
       struct arg_list *temp;
-      char aliase[MODNAME_LEN], *realname;
+      char aliase[MODNAME_LEN];
 
       if (!tokens[2]) continue;
       path2mod(tokens[1], aliase);
       for (temp = TT.probes; temp; temp = temp->next) {
         modent = (struct module_s *) temp->arg;
-        if (fnmatch(aliase, modent->name, 0)) continue;
-        realname = path2mod(tokens[2], NULL);
-        llist_add(&modent->rnames, realname);
-        if (modent->flags & MOD_NDDEPS) {
-          modent->flags &= ~MOD_NDDEPS;
-          TT.nudeps--;
-        }
-        modent = get_mod(realname, 1);
-        if (!(modent->flags & MOD_NDDEPS)) {
-          modent->flags |= MOD_NDDEPS;
-          TT.nudeps++;
-        }
+        if (!fnmatch(aliase, modent->name, 0)) add_alias(tokens[2], modent);
       }
     } else if (!strcmp(tokens[0], "options")) {
       if (!tokens[2]) continue;
@@ -311,38 +318,256 @@ static int depmode_read_entry(char *cmdname)
   return ret;
 }
 
-// Finds dependencies for modules from the modules.dep file.
+// Take the dependencies of mod from its modules.dep line "path: deps..."
+static void add_dep(struct module_s *mod, char *line)
+{
+  char *tmp = strchr(line, ':'), *tok;
+
+  if ((mod->flags & MOD_ALOADED) && !(toys.optflags & (FLAG_r | FLAG_D)))
+    return;
+  mod->flags |= MOD_FNDDEPMOD;
+  if (!(mod->flags & MOD_NDDEPS) || mod->dep) return;
+  TT.nudeps--;
+  llist_add(&mod->dep, xstrndup(line, tmp-line));
+  for (tmp++; (tok = strsep(&tmp, " \t"));)
+    if (*tok) llist_add_tail(&mod->dep, xstrdup(tok));
+}
+
+// depmod also writes modules.dep, modules.alias and modules.symbols as
+// kmod's binary indexes: a trie of big endian nodes, each an optional
+// prefix string, a table of children for a range of next characters and
+// a list of (priority, value) strings. Looking a name up in one costs the
+// length of the name instead of a parse of the whole text file.
+#define INDEX_MAGIC  0xB007F457
+#define INDEX_PREFIX 0x80000000
+#define INDEX_VALUES 0x40000000
+#define INDEX_CHILDS 0x20000000
+#define INDEX_MASK   0x0FFFFFFF
+#define INDEX_KEYLEN 4096
+
+struct modidx {
+  unsigned char *map;
+  unsigned len;
+};
+
+struct idx_node {
+  char *prefix;
+  unsigned first, last, kids, values, nvalues;
+};
+
+static unsigned idx_u32(struct modidx *idx, unsigned off)
+{
+  return (off+4 > idx->len || off+4 < off) ? 0 : peek_be(idx->map+off, 4);
+}
+
+// Map name, returning 0 if it isn't there or isn't a version 2 index.
+static int idx_open(struct modidx *idx, char *name)
+{
+  int fd = open(name, O_RDONLY);
+  off_t len;
+
+  idx->map = 0;
+  if (fd == -1) return 0;
+  len = fdlength(fd);
+  if (len>=12 && len<INDEX_MASK) {
+    idx->map = mmap(0, idx->len = len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (idx->map == MAP_FAILED) idx->map = 0;
+    else if (idx_u32(idx, 0) != INDEX_MAGIC || (idx_u32(idx, 4)>>16) != 2) {
+      munmap(idx->map, idx->len);
+      idx->map = 0;
+    }
+  }
+  close(fd);
+
+  return !!idx->map;
+}
+
+static void idx_close(struct modidx *idx)
+{
+  if (idx->map) munmap(idx->map, idx->len);
+}
+
+// Decode the node ref points to, returning 0 if there isn't a valid one.
+static int idx_node(struct modidx *idx, unsigned ref, struct idx_node *n)
+{
+  unsigned off = ref & INDEX_MASK, len;
+
+  if (!off || off >= idx->len) return 0;
+  n->prefix = "";
+  if (ref & INDEX_PREFIX) {
+    n->prefix = (char *)idx->map+off;
+    if ((len = strnlen(n->prefix, idx->len-off)) == idx->len-off) return 0;
+    off += len+1;
+  }
+  n->first = 1;
+  n->last = n->nvalues = 0;
+  if (ref & INDEX_CHILDS) {
+    if (off+2 > idx->len) return 0;
+    n->first = idx->map[off];
+    n->last = idx->map[off+1];
+    n->kids = off+2;
+    off += 2+4*(n->last-n->first+1);
+  }
+  if (ref & INDEX_VALUES) {
+    n->nvalues = idx_u32(idx, off);
+    n->values = off+4;
+  }
+
+  return 1;
+}
+
+static unsigned idx_child(struct modidx *idx, struct idx_node *n, int ch)
+{
+  if (ch<n->first || ch>n->last) return 0;
+
+  return idx_u32(idx, n->kids+4*(ch-n->first));
+}
+
+static void idx_values(struct modidx *idx, struct idx_node *n,
+  void (*each)(char *value, void *arg), void *arg)
+{
+  unsigned off = n->values, i, len;
+
+  for (i = 0; i<n->nvalues; i++) {
+    if ((off += 4) >= idx->len) break;
+    if ((len = strnlen((char *)idx->map+off, idx->len-off)) == idx->len-off)
+      break;
+    each((char *)idx->map+off, arg);
+    off += len+1;
+  }
+}
+
+// Exact lookup, returning the first value stored for key.
+static char *idx_find(struct modidx *idx, char *key)
+{
+  struct idx_node n;
+  unsigned ref = idx_u32(idx, 8);
+  int i;
+
+  while (idx_node(idx, ref, &n)) {
+    for (i = 0; n.prefix[i]; i++) if (n.prefix[i] != key[i]) return 0;
+    key += i;
+    if (!*key) {
+      if (n.nvalues && n.values+4 < idx->len
+        && strnlen((char *)idx->map+n.values+4, idx->len-n.values-4)
+          < idx->len-n.values-4) return (char *)idx->map+n.values+4;
+      return 0;
+    }
+    ref = idx_child(idx, &n, *(unsigned char *)key++);
+  }
+
+  return 0;
+}
+
+// Below a wildcard in an alias index, collect the rest of each pattern
+// after the first wildcard in buf and fnmatch() it against the rest of key.
+static void idx_wild_all(struct modidx *idx, struct idx_node *n, int i,
+  char *buf, int len, char *key, void (*each)(char *, void *), void *arg)
+{
+  struct idx_node kid;
+  int ch;
+
+  while (n->prefix[i] && len<INDEX_KEYLEN-2) buf[len++] = n->prefix[i++];
+  for (ch = n->first; ch<=n->last; ch++) {
+    if (len>=INDEX_KEYLEN-2 || !idx_node(idx, idx_child(idx, n, ch), &kid))
+      continue;
+    buf[len] = ch;
+    idx_wild_all(idx, &kid, 0, buf, len+1, key, each, arg);
+  }
+  if (n->nvalues) {
+    buf[len] = 0;
+    if (!fnmatch(buf, key, 0)) idx_values(idx, n, each, arg);
+  }
+}
+
+// Call each() with the value of every pattern in the index matching key.
+static void idx_wild(struct modidx *idx, char *key,
+  void (*each)(char *value, void *arg), void *arg)
+{
+  struct idx_node n, kid;
+  char buf[INDEX_KEYLEN], *wild = "*?[";
+  unsigned ref = idx_u32(idx, 8);
+  int i;
+
+  while (idx_node(idx, ref, &n)) {
+    for (i = 0; n.prefix[i]; i++) {
+      if (strchr(wild, n.prefix[i])) {
+        idx_wild_all(idx, &n, i, buf, 0, key+i, each, arg);
+        return;
+      }
+      if (n.prefix[i] != key[i]) return;
+    }
+    key += i;
+    for (i = 0; wild[i]; i++) {
+      if (!idx_node(idx, idx_child(idx, &n, wild[i]), &kid)) continue;
+      *buf = wild[i];
+      idx_wild_all(idx, &kid, 0, buf, 1, key, each, arg);
+    }
+    if (!*key) {
+      idx_values(idx, &n, each, arg);
+      return;
+    }
+    ref = idx_child(idx, &n, *(unsigned char *)key++);
+  }
+}
+
+// Resolve the probes through the alias index name, returning 0 if there's
+// no such index and the text file needs reading instead.
+static int find_bin_alias(char *name)
+{
+  struct modidx idx;
+  struct arg_list *temp;
+  char key[MODNAME_LEN], *s;
+  int i;
+
+  if (!idx_open(&idx, name)) return 0;
+  for (temp = TT.probes; temp; temp = temp->next) {
+    struct module_s *mod = (struct module_s *) temp->arg;
+
+    // Keys are stored with - turned into _ as path2mod() does.
+    for (s = mod->cmdname, i = 0; s[i] && i<MODNAME_LEN-1; i++)
+      key[i] = (s[i] == '-') ? '_' : s[i];
+    key[i] = 0;
+    idx_wild(&idx, key, add_alias, mod);
+  }
+  idx_close(&idx);
+
+  return 1;
+}
+
+// Finds dependencies for modules from modules.dep.bin, or modules.dep.
 static void find_dep(void)
 {
-  char *line = NULL;
+  struct modidx idx;
+  struct arg_list *temp;
+  char *line = NULL, *tmp;
   struct module_s *mod;
-  FILE *fe = xfopen("modules.dep", "r");
-
-  for (; read_line(fe, &line) > 0; free(line)) {
-    char *tmp = strchr(line, ':');
+  FILE *fe;
+  int i;
 
-    if (tmp) {
-      *tmp = '\0';
-      mod = get_mod(line, 0);
-      if (!mod) continue;
-      if ((mod->flags & MOD_ALOADED) &&
-          !(toys.optflags & (FLAG_r | FLAG_D))) continue;
-      
-      mod->flags |= MOD_FNDDEPMOD;
-      if ((mod->flags & MOD_NDDEPS) && (!mod->dep)) {
-        TT.nudeps--;
-        llist_add(&mod->dep, xstrdup(line));
-        tmp++;
-        if (*tmp) {
-          char *tok;
-
-          while ((tok = strsep(&tmp, " \t"))) {
-            if (!*tok) continue;
-            llist_add_tail(&mod->dep, xstrdup(tok));
-          }
-        }
+  // With an index look up just the modules that need it.
+  if (idx_open(&idx, "modules.dep.bin")) {
+    for (i = 0; i<DBASE_SIZE; i++) {
+      for (temp = TT.dbase[i]; temp; temp = temp->next) {
+        mod = (struct module_s *) temp->arg;
+        if (!(mod->flags & MOD_NDDEPS) || mod->dep) continue;
+        if (!(tmp = idx_find(&idx, mod->name)) || !strchr(tmp, ':')) continue;
+        add_dep(mod, line = xstrdup(tmp));
+        free(line);
       }
     }
+    idx_close(&idx);
+
+    return;
+  }
+
+  fe = xfopen("modules.dep", "r");
+  for (; read_line(fe, &line) > 0; free(line)) {
+    if (!(tmp = strchr(line, ':'))) continue;
+    *tmp = 0;
+    mod = get_mod(line, 0);
+    *tmp = ':';
+    if (mod) add_dep(mod, line);
   }
   fclose(fe);
 }
@@ -365,21 +590,14 @@ static int rm_mod(char *modules, uint32_t flags)
 // Insert module same as insmod implementation.
 static int ins_mod(char *modules, char *flags)
 {
-  char *buf = NULL;
-  int len, res;
-  int fd = xopen(modules, O_RDONLY);
-
-  len = fdlength(fd);
-  buf = xmalloc(len);
-  xreadall(fd, buf, len);
-  xclose(fd);
+  int res, fd = xopen(modules, O_RDONLY);
 
   while (flags && strlen(toybuf) + strlen(flags) + 2 < sizeof(toybuf)) {
     strcat(toybuf, flags);
     strcat(toybuf, " ");
   }
-  res = syscall(__NR_init_module, buf, len, toybuf);
-  if (CFG_TOYBOX_FREE && buf != toybuf) free(buf);
+  res = load_module(fd, modules, toybuf);
+  xclose(fd);
   return res;
 }
 
@@ -537,8 +755,10 @@ void modprobe_main(void)
   }
   dirtree_read("/etc/modprobe.conf", config_action);
   dirtree_read("/etc/modprobe.d", config_action);
-  if (TT.symreq) dirtree_read("modules.symbols", config_action);
-  if (TT.nudeps) dirtree_read("modules.alias", config_action);
+  if (TT.symreq && !find_bin_alias("modules.symbols.bin"))
+    dirtree_read("modules.symbols", config_action);
+  if (TT.nudeps && !find_bin_alias("modules.alias.bin"))
+    dirtree_read("modules.alias", config_action);
   find_dep();
   while ((module = llist_popme(&TT.probes))) {
     if (!module->rnames) {
@@ -37,21 +37,6 @@ GLOBALS(
   int some_process_unidentified;
 );
 
-typedef union _iaddr {
-  unsigned u;
-  unsigned char b[4];
-} iaddr;
-
-typedef union _iaddr6 {
-  struct {
-    unsigned a;
-    unsigned b;
-    unsigned c;
-    unsigned d;
-  } u;
-  unsigned char b[16];
-} iaddr6;
-
 #define ADDR_LEN (INET6_ADDRSTRLEN + 1 + 5 + 1) //IPv6 addr len + : + port + '\0'
 
 //For unix states
@@ -63,12 +48,14 @@ enum {
 
 #define SOCK_NOT_CONNECTED 1
 
-typedef struct _pidlist {
-  struct _pidlist *next;
-  long inode;
-  char name[21];
-} PID_LIST;
-PID_LIST *pid_list = NULL;
+// Socket inode -> "pid/name" of a process that has it open, for -p.
+static struct inodeset pid_inodes;
+
+// What show_netsock() is showing.
+struct netsock_how {
+  int af;
+  char *label;
+};
 
 /*
  * locate character in string.
@@ -113,10 +100,9 @@ static unsigned get_strtou(char *str, char **endp, int base)
  */
 static const char *get_pid_name(unsigned long inode)
 {
-  PID_LIST *tmp;
-  for (tmp = pid_list; tmp; tmp = tmp->next)
-    if (tmp->inode == inode) return tmp->name;
-  return "-";
+  char *name = inodeset_find(&pid_inodes, 0, inode);
+
+  return name ? name : "-";
 }
 /*
  * For TCP/UDP/RAW display data.
@@ -149,22 +135,19 @@ static void display_data(unsigned rport, char *label,
   xprintf("%3s   %6d %6d ", label, rxq, txq);
   xprintf((toys.optflags & FLAG_W) ? "%-51.51s %-51.51s " : "%-23.23s %-23.23s ", lip, rip);
   xprintf("%-11s ", ss_state);
-  if ((toys.optflags & FLAG_e)) xprintf("%-10s %-11d ", user, inode);
+  if ((toys.optflags & FLAG_e)) xprintf("%-10s %-11lu ", user, inode);
   if ((toys.optflags & FLAG_p)) xprintf("%s", get_pid_name(inode));
   xputc('\n');
 }
 /*
- * For TCP/UDP/RAW show data.
+ * For TCP/UDP/RAW, is this one to show?
  */
-static void show_data(unsigned rport, char *label, unsigned rxq, unsigned txq,
-                      char *lip, char *rip, unsigned state, unsigned uid,
-                      unsigned long inode)
+static int show_data(unsigned rport, unsigned state)
 {
-  if (toys.optflags & FLAG_l) {
-    if (!rport && (state & 0xA)) display_data(rport, label, rxq, txq, lip, rip, state, uid, inode);
-  } else if (toys.optflags & FLAG_a) display_data(rport, label, rxq, txq, lip, rip, state, uid, inode);
+  if (toys.optflags & FLAG_l) return !rport && (state & 0xA);
+  if (toys.optflags & FLAG_a) return 1;
   //rport && (TCP | UDP | RAW)
-  else if (rport & (0x10 | 0x20 | 0x40)) display_data(rport, label, rxq, txq, lip, rip, state, uid, inode);
+  return !!(rport & (0x10 | 0x20 | 0x40));
 }
 /*
  * used to get service name.
@@ -229,57 +212,37 @@ static void addr2str(int af, void *addr, unsigned port, char *buf, char *label)
   memcpy(buf, ip, ADDR_LEN);
 }
 /*
- * display ipv4 info for TCP/UDP/RAW.
+ * display one TCP/UDP/RAW socket, filtered before the names are looked up.
  */
-static void show_ipv4(char *fname, char *label)
+static void show_netsock(struct netsock *ns, void *arg)
 {
-  FILE *fp = fopen((char *)fname, "r");
-  if (!fp) {
-     perror_msg("'%s'", fname);
-     return;
-  }
-  fgets(toybuf, sizeof(toybuf), fp); //skip header.
-  while (fgets(toybuf, sizeof(toybuf), fp)) {
-    char lip[ADDR_LEN] = {0,}, rip[ADDR_LEN] = {0,};
-    iaddr laddr, raddr;
-    unsigned lport, rport, state, txq, rxq, num, uid;
-    unsigned long inode;
-
-    int nitems = sscanf(toybuf, " %d: %x:%x %x:%x %x %x:%x %*X:%*X %*X %d %*d %ld",
-        &num, &laddr.u, &lport, &raddr.u, &rport, &state, &txq, &rxq, &uid, &inode);
-    if (nitems == 10) {
-      addr2str(AF_INET, &laddr, lport, lip, label);
-      addr2str(AF_INET, &raddr, rport, rip, label);
-      show_data(rport, label, rxq, txq, lip, rip, state, uid, inode);
-    }
-  }//End of While
-  fclose(fp);
+  struct netsock_how *how = arg;
+  char lip[ADDR_LEN] = {0,}, rip[ADDR_LEN] = {0,};
+
+  if (!show_data(ns->rport, ns->state)) return;
+  addr2str(how->af, ns->laddr, ns->lport, lip, how->label);
+  addr2str(how->af, ns->raddr, ns->rport, rip, how->label);
+  display_data(ns->rport, how->label, ns->rxq, ns->txq, lip, rip, ns->state,
+    ns->uid, ns->inode);
 }
 /*
- * display ipv6 info for TCP/UDP/RAW.
+ * display TCP/UDP/RAW sockets of one family, from sock_diag if the kernel
+ * has it for this protocol, else from the /proc/net file.
  */
-static void show_ipv6(char *fname, char *label)
+static void show_inet(int af, int protocol, char *fname, char *label)
 {
-  FILE *fp = fopen((char *)fname, "r");
-  if (!fp) {
+  struct netsock_how how = {af, label};
+  struct netsock ns;
+  FILE *fp;
+
+  if (protocol && netsock_diag(af, protocol, show_netsock, &how)) return;
+  if (!(fp = fopen(fname, "r"))) {
     perror_msg("'%s'", fname);
     return;
   }
-  fgets(toybuf, sizeof(toybuf), fp); //skip header.
-  while (fgets(toybuf, sizeof(toybuf), fp)) {
-    char lip[ADDR_LEN] = {0,}, rip[ADDR_LEN] = {0,};
-    iaddr6 laddr6, raddr6;
-    unsigned lport, rport, state, txq, rxq, num, uid;
-    unsigned long inode;
-    int nitems = sscanf(toybuf, " %d: %8x%8x%8x%8x:%x %8x%8x%8x%8x:%x %x %x:%x %*X:%*X %*X %d %*d %ld",
-        &num, &laddr6.u.a, &laddr6.u.b, &laddr6.u.c, &laddr6.u.d, &lport, &raddr6.u.a, &raddr6.u.b,
-        &raddr6.u.c, &raddr6.u.d, &rport, &state, &txq, &rxq, &uid, &inode);
-    if (nitems == 16) {
-      addr2str(AF_INET6, &laddr6, lport, lip, label);
-      addr2str(AF_INET6, &raddr6, rport, rip, label);
-      show_data(rport, label, rxq, txq, lip, rip, state, uid, inode);
-    }
-  }//End of While
+  // The header doesn't parse, so that skips it too.
+  while (fgets(toybuf, sizeof(toybuf), fp))
+    if (netsock_parse(toybuf, af == AF_INET6, &ns)) show_netsock(&ns, &how);
   fclose(fp);
 }
 /*
@@ -364,66 +327,61 @@ static long ss_inode(char *link)
  */
 static void add2list(long inode)
 {
-  PID_LIST *node = pid_list;
-  for(; node; node = node->next) {
-    if(node->inode == inode)
-      return;
-  }
-  PID_LIST *new = (PID_LIST *)xzalloc(sizeof(PID_LIST));
-  new->inode = inode;
-  xstrncpy(new->name, TT.current_name, sizeof(new->name));
-  new->next = pid_list;
-  pid_list = new;
+  void **slot = inodeset_slot(&pid_inodes, 0, inode);
+
+  if (!*slot) *slot = xstrdup(TT.current_name);
 }
 
 static void scan_pid_inodes(char *path)
 {
-  DIR *dp;
-  struct dirent *entry;
+  struct dirbuf *dir;
+  struct dirbuf_ent *ent;
+  char link_name[64], link[64];
+  long inode;
+  int fd, len;
 
-  if (!(dp = opendir(path))) {
+  // dirbuf_open() can only fail for lack of memory once the open worked.
+  if (-1 == (fd = open(path, O_RDONLY|O_CLOEXEC)) || !(dir = dirbuf_open(fd, 0)))
+  {
     if (errno == EACCES) {
       TT.some_process_unidentified = 1;
       return;
     } else perror_exit("%s", path);
   }
-  while ((entry = readdir(dp))) {
-    char link_name[64], *link;
-    long inode;
-
-    if (!isdigit(entry->d_name[0])) continue;
-    snprintf(link_name, sizeof(link_name), "%s/%s", path, entry->d_name);
-    link = xreadlink(link_name);
+  while ((ent = dirbuf_read(dir))) {
+    if (!isdigit(ent->name[0])) continue;
+    snprintf(link_name, sizeof(link_name), "%s/%s", path, ent->name);
+    // closed, or not ours
+    if (0>(len = readlink(link_name, link, sizeof(link)-1))) continue;
+    link[len] = 0;
     if ((inode = ss_inode(link)) != -1) add2list(inode);
-    free(link);
   }
-  closedir(dp);
+  dirbuf_close(dir);
 }
 
-static void scan_pid(int pid)
+static void scan_pid(int pid, char *cmd)
 {
-  char *line, *p, *fd_dir;
-
-  snprintf(toybuf, sizeof(toybuf), "/proc/%d/cmdline", pid);
-  line = xreadfile(toybuf, 0, 0);
+  char *p, *fd_dir;
 
-  if ((p = strchr(line, ' '))) *p = 0; // "/bin/netstat -ntp" -> "/bin/netstat"
+  if ((p = strchr(cmd, ' '))) *p = 0; // "/bin/netstat -ntp" -> "/bin/netstat"
   snprintf(TT.current_name, sizeof(TT.current_name), "%d/%s",
-           pid, basename_r(line)); // "584/netstat"
-  free(line);
+           pid, basename_r(cmd)); // "584/netstat"
 
   fd_dir = xmprintf("/proc/%d/fd", pid);
   scan_pid_inodes(fd_dir);
   free(fd_dir);
 }
 
-static int scan_pids(struct dirtree *node)
+// Note which process has each socket open.
+static void scan_pids(void)
 {
-  int pid;
+  struct procsnap snap;
+  long i;
 
-  if (!node->parent) return DIRTREE_RECURSE;
-  if ((pid = atol(node->name))) scan_pid(pid);
-  return 0;
+  memset(&snap, 0, sizeof(snap));
+  procsnap_read(&snap, PROCSNAP_CMDLINE, 0);
+  for (i = 0; i<snap.count; i++) scan_pid(snap.pid[i], procsnap_cmd(&snap, i));
+  procsnap_free(&snap);
 }
 
 /*
@@ -431,12 +389,7 @@ static int scan_pids(struct dirtree *node)
  */
 static void clean_pid_list(void)
 {
-  PID_LIST *tmp;
-  while (pid_list) {
-    tmp = pid_list->next;
-    free(pid_list);
-    pid_list = tmp;
-  }
+  inodeset_free(&pid_inodes, free);
 }
 /*
  * For TCP/UDP/RAW show the header.
@@ -571,7 +524,7 @@ void netstat_main(void)
   }
 
   if (toys.optflags & FLAG_p) {
-    dirtree_read("/proc", scan_pids);
+    scan_pids();
     // TODO: we probably shouldn't warn if all the processes we're going to
     // list were identified.
     if (TT.some_process_unidentified)
@@ -590,16 +543,16 @@ void netstat_main(void)
 
     show_header();
     if (toys.optflags & FLAG_t) {//For TCP
-      show_ipv4("/proc/net/tcp",  "tcp");
-      show_ipv6("/proc/net/tcp6", "tcp");
+      show_inet(AF_INET, IPPROTO_TCP, "/proc/net/tcp",  "tcp");
+      show_inet(AF_INET6, IPPROTO_TCP, "/proc/net/tcp6", "tcp");
     }
     if (toys.optflags & FLAG_u) {//For UDP
-      show_ipv4("/proc/net/udp",  "udp");
-      show_ipv6("/proc/net/udp6", "udp");
+      show_inet(AF_INET, IPPROTO_UDP, "/proc/net/udp",  "udp");
+      show_inet(AF_INET6, IPPROTO_UDP, "/proc/net/udp6", "udp");
     }
     if (toys.optflags & FLAG_w) {//For raw
-      show_ipv4("/proc/net/raw",  "raw");
-      show_ipv6("/proc/net/raw6", "raw");
+      show_inet(AF_INET, 0, "/proc/net/raw",  "raw");
+      show_inet(AF_INET6, 0, "/proc/net/raw6", "raw");
     }
   }
   if (toys.optflags & FLAG_x) {//For UNIX.
@@ -3,25 +3,28 @@
  * Copyright 2014 Rob Landley <rob@landley.net>
  *
  * Not in SUSv4.
- 
-USE_PING(NEWTOY(ping, "<1>1t#<0>255c#<0s#<0>65535I:W#<0w#<0q46[-46]", TOYFLAG_ROOTONLY|TOYFLAG_USR|TOYFLAG_BIN))
- 
+
+USE_PING(NEWTOY(ping, "<1i#<0=1000t#<0>255c#<0s#<0>65535I:W#<0=10w#<0q46[-46]", TOYFLAG_ROOTONLY|TOYFLAG_USR|TOYFLAG_BIN))
+
 config PING
   bool "ping"
   default n
   help
-    usage: ping [OPTIONS] HOST
+    usage: ping [OPTIONS] HOST...
 
     Check network connectivity by sending packets to a host and reporting
     its response.
 
     Send ICMP ECHO_REQUEST packets to ipv4 or ipv6 addresses and prints each
-    echo it receives back, with round trip time.
+    echo it receives back, with round trip time. With more than one HOST
+    they're all pinged at once from one socket, and a line of statistics per
+    HOST is printed at the end. Exit status is 1 if any HOST never answered.
 
     Options:
     -4, -6      Force IPv4 or IPv6
-    -c CNT      Send CNT many packets
+    -c CNT      Send CNT many packets (default 1 with several HOSTs)
     -I IFACE/IP Source interface or address
+    -i MS       Milliseconds between packets to each HOST (default 1000)
     -q          Quiet, only displays output at start and when finished
     -s SIZE     Packet SIZE in bytes (default 56)
     -t TTL      Set Time (number of hops) To Live
@@ -29,10 +32,12 @@ config PING
     -w SEC      Exit after this many seconds
 */
 
-#define FOR_ping 
+#define FOR_ping
 #include "toys.h"
 
 #include <ifaddrs.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
 
 GLOBALS(
   long wait_exit;
@@ -41,54 +46,162 @@ GLOBALS(
   long size;
   long count;
   long ttl;
+  long interval;
 
-  int sock;
+  int sock, family, ident, hashsize, ntargets;
+  struct ping_target *targets, **hash;
+  char *packet, *rpkt;
 )
 
-void ping_main(void)
-{
-  int family, protocol;
+// Send times remembered per HOST, enough to time replies that arrive -W SEC
+// late at the default interval. Older replies still count, just untimed.
+#define PING_RING 32
+
+// One HOST being pinged. They're hashed on their binary address so a
+// reply from any of hundreds of targets finds its stats in one lookup.
+struct ping_target {
+  struct ping_target *next;
+  char *name;
   union {
-    struct in_addr in;
-    struct in6_addr in6;
-  } src_addr;
-  char *host = 0;
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+  } sa;
+  unsigned sent, recv, dup, timed;
+  unsigned long long min, max, sum, stamp[PING_RING];
+};
+
+static void *ping_addr(struct ping_target *t)
+{
+  return TT.family == AF_INET ? (void *)&t->sa.in.sin_addr
+    : (void *)&t->sa.in6.sin6_addr;
+}
+
+static unsigned ping_hash(void *key)
+{
+  unsigned h = 2166136261U;
+  unsigned char *s = key;
+  int len = TT.family == AF_INET ? 4 : 16;
+
+  while (len-- > 0) h = (h^*s++)*16777619;
+
+  return h&(TT.hashsize-1);
+}
+
+static struct ping_target *ping_find(void *addr)
+{
+  struct ping_target *t;
+
+  for (t = TT.hash[ping_hash(addr)]; t; t = t->next)
+    if (!memcmp(ping_addr(t), addr, TT.family == AF_INET ? 4 : 16)) break;
+
+  return t;
+}
+
+static unsigned short ping_cksum(unsigned short *p, int len)
+{
+  unsigned sum = 0;
+
+  for (; len > 1; len -= 2) sum += *p++;
+  if (len) sum += *(unsigned char *)p;
+  sum = (sum>>16)+(sum&0xffff);
+  sum += sum>>16;
+
+  return ~sum;
+}
+
+// Resolve every HOST up front. The first one picks the family unless -4 or
+// -6 did, and the socket only speaks that one. Names that don't resolve
+// (or repeat an address already listed) are reported and skipped.
+static void ping_targets(void)
+{
+  struct addrinfo hint, *ai;
+  struct ping_target *t;
+  char **arg;
+  int i;
 
-  // Determine IPv4 vs IPv6 type
+  TT.targets = xzalloc(toys.optc*sizeof(*TT.targets));
+  for (TT.hashsize = 16; TT.hashsize < 2*toys.optc; TT.hashsize *= 2);
+  TT.hash = xzalloc(TT.hashsize*sizeof(*TT.hash));
+  if (toys.optflags & FLAG_6) TT.family = AF_INET6;
+  else if (toys.optflags & FLAG_4) TT.family = AF_INET;
 
-  if(!(toys.optflags & (FLAG_4|FLAG_6))) {
-// todo getaddrinfo instead?
-    if (inet_pton(AF_INET6, toys.optargs[0], (void*)&src_addr))
-      toys.optflags |= FLAG_6;
+  for (arg = toys.optargs; *arg; arg++) {
+    memset(&hint, 0, sizeof(hint));
+    hint.ai_family = TT.family;
+    hint.ai_socktype = SOCK_DGRAM;
+    if ((i = dns_getaddrinfo(*arg, 0, &hint, &ai))) {
+      error_msg("%s: %s", *arg, gai_strerror(i));
+      continue;
+    }
+    t = TT.targets+TT.ntargets;
+    TT.family = ai->ai_family;
+    memcpy(&t->sa, ai->ai_addr, ai->ai_addrlen);
+    free(ai);
+    if (ping_find(ping_addr(t))) {
+      memset(t, 0, sizeof(*t));
+      continue;
+    }
+    t->name = *arg;
+    t->min = ~0ULL;
+    i = ping_hash(ping_addr(t));
+    t->next = TT.hash[i];
+    TT.hash[i] = t;
+    TT.ntargets++;
   }
+  if (!TT.ntargets) xexit();
+}
 
-  if (toys.optflags & FLAG_6) {
-    family = AF_INET6;
-    protocol = IPPROTO_ICMPV6;
-  } else {
-    family = AF_INET;
-    protocol = IPPROTO_ICMP;
+// Open the raw socket and apply -I, -t and a receive buffer big enough for
+// a whole round of replies to land at once.
+static void ping_socket(void)
+{
+  int set = 1, protocol = TT.family == AF_INET ? IPPROTO_ICMP : IPPROTO_ICMPV6;
+
+  TT.sock = xsocket(TT.family, SOCK_RAW, protocol);
+  if (TT.family == AF_INET6) {
+    struct icmp6_filter filter;
+
+    ICMP6_FILTER_SETBLOCKALL(&filter);
+    ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+    setsockopt(TT.sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+    setsockopt(TT.sock, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &set, sizeof(set));
   }
+  set = TT.ntargets*(TT.size+128);
+  if (set > (1<<16))
+    setsockopt(TT.sock, SOL_SOCKET, SO_RCVBUF, &set, sizeof(set));
 
-  if (!(toys.optflags & FLAG_s)) TT.size = 56; // 64-PHDR_LEN
+  if (toys.optflags & FLAG_t) {
+    set = TT.ttl;
+    if (TT.family == AF_INET)
+      setsockopt(TT.sock, IPPROTO_IP, IP_TTL, &set, sizeof(set));
+    else setsockopt(TT.sock, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &set,
+      sizeof(set));
+  }
 
   if (TT.iface) {
-    memset(&src_addr, 0, sizeof(src_addr));
+    union {
+      struct sockaddr_in in;
+      struct sockaddr_in6 in6;
+    } src;
+    void *addr = TT.family == AF_INET ? (void *)&src.in.sin_addr
+      : (void *)&src.in6.sin6_addr;
+
+    memset(&src, 0, sizeof(src));
+    src.in.sin_family = TT.family;
 
     // IP address?
-    if (!inet_pton(family, TT.iface, &src_addr)) {
+    if (!inet_pton(TT.family, TT.iface, addr)) {
       struct ifaddrs *ifsave, *ifa = 0;
 
       // Interface name?
       if (!getifaddrs(&ifsave)) {
         for (ifa = ifsave; ifa; ifa = ifa->ifa_next) {
-          if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family) continue;
+          if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != TT.family) continue;
           if (!strcmp(ifa->ifa_name, TT.iface)) {
-            if (family == AF_INET)
-              memcpy(&src_addr,
-                &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr,
+            if (TT.family == AF_INET)
+              memcpy(addr, &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr,
                 sizeof(struct in_addr));
-            else memcpy(&src_addr,
+            else memcpy(addr,
                 &((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr,
                 sizeof(struct in6_addr));
             break;
@@ -97,14 +210,189 @@ void ping_main(void)
         freeifaddrs(ifsave);
       }
       if (!ifa)
-        error_exit("no v%d addr for -I %s", 4+2*(family==AF_INET6), TT.iface);
+        error_exit("no v%d addr for -I %s", 4+2*(TT.family==AF_INET6),
+          TT.iface);
     }
-    inet_ntop(family, &src_addr, toybuf, sizeof(toybuf));
-    host = xstrdup(toybuf);
+    if (bind(TT.sock, (void *)&src, TT.family == AF_INET
+      ? sizeof(src.in) : sizeof(src.in6))) perror_exit("bind %s", TT.iface);
   }
+}
+
+static void ping_send(struct ping_target *t)
+{
+  struct icmphdr *icmp = (void *)TT.packet;
+  int len = sizeof(*icmp)+TT.size;
 
-printf("host=%s\n", host);
+  // Same header layout for both: the kernel checksums ICMPv6 for us.
+  icmp->type = TT.family == AF_INET ? ICMP_ECHO : ICMP6_ECHO_REQUEST;
+  icmp->code = 0;
+  icmp->un.echo.id = TT.ident;
+  icmp->un.echo.sequence = htons(++t->sent);
+  icmp->checksum = 0;
+  if (TT.family == AF_INET) icmp->checksum = ping_cksum((void *)icmp, len);
 
-  // Open raw socket
-  TT.sock = xsocket(family, SOCK_RAW, protocol);
+  t->stamp[t->sent%PING_RING] = microtime();
+  if (sendto(TT.sock, icmp, len, 0, (void *)&t->sa, TT.family == AF_INET
+      ? sizeof(t->sa.in) : sizeof(t->sa.in6)) != len
+    && !(toys.optflags & FLAG_q)) perror_msg("%s", t->name);
+}
+
+// Match one reply to its target and sequence number. Returns 1 if it
+// answered something we were still waiting for, 0 if it wasn't ours, and -1
+// once the socket is drained.
+static int ping_recv(void)
+{
+  union {
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+  } from;
+  struct iovec iov = {TT.rpkt, TT.size+128};
+  char ctl[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg = {&from, sizeof(from), &iov, 1, ctl, sizeof(ctl), 0};
+  struct cmsghdr *cm;
+  struct icmphdr *icmp = (void *)TT.rpkt;
+  struct ping_target *t;
+  unsigned long long now, *stamp, rtt = 0;
+  unsigned short seq;
+  int len, ttl = -1, timed = 0;
+
+  if ((len = recvmsg(TT.sock, &msg, MSG_DONTWAIT)) < 0) return -1;
+  now = microtime();
+
+  if (TT.family == AF_INET) {
+    struct iphdr *ip = (void *)TT.rpkt;
+
+    if (len < sizeof(*ip) || len < ip->ihl*4+sizeof(*icmp)) return 0;
+    ttl = ip->ttl;
+    len -= ip->ihl*4;
+    icmp = (void *)(TT.rpkt+ip->ihl*4);
+    if (icmp->type != ICMP_ECHOREPLY) return 0;
+    t = ping_find(&from.in.sin_addr);
+  } else {
+    if (len < sizeof(*icmp) || icmp->type != ICMP6_ECHO_REPLY) return 0;
+    for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+      if (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_HOPLIMIT)
+        memcpy(&ttl, CMSG_DATA(cm), sizeof(ttl));
+    t = ping_find(&from.in6.sin6_addr);
+  }
+  if (!t || icmp->un.echo.id != TT.ident) return 0;
+
+  // Anything older than the ring is still a reply, but it can't be timed
+  // or told apart from a duplicate.
+  seq = ntohs(icmp->un.echo.sequence);
+  if ((unsigned short)(t->sent-seq) >= t->sent) return 0;
+  stamp = t->stamp+seq%PING_RING;
+  if ((unsigned short)(t->sent-seq) >= PING_RING);
+  else if (!*stamp) {
+    t->dup++;
+    if (!(toys.optflags & FLAG_q))
+      xprintf("%d bytes from %s: icmp_seq=%u DUP!\n", len,
+        inet_ntop(TT.family, ping_addr(t), toybuf, sizeof(toybuf)), seq);
+    return 0;
+  } else {
+    rtt = now-*stamp;
+    *stamp = 0;
+    if (rtt < t->min) t->min = rtt;
+    if (rtt > t->max) t->max = rtt;
+    t->sum += rtt;
+    t->timed++;
+    timed++;
+  }
+  t->recv++;
+
+  if (!(toys.optflags & FLAG_q)) {
+    xprintf("%d bytes from %s: icmp_seq=%u", len,
+      inet_ntop(TT.family, ping_addr(t), toybuf, sizeof(toybuf)), seq);
+    if (ttl != -1) xprintf(" ttl=%d", ttl);
+    if (timed) xprintf(" time=%llu.%03llu ms", rtt/1000, rtt%1000);
+    xputc('\n');
+  }
+
+  return 1;
+}
+
+static void ping_stats(struct ping_target *t)
+{
+  unsigned loss = 0;
+  unsigned long long avg = t->timed ? t->sum/t->timed : 0;
+
+  if (t->sent > t->recv) loss = 100-t->recv*100ULL/t->sent;
+  if (TT.ntargets == 1) {
+    xprintf("\n--- %s ping statistics ---\n"
+      "%u packets transmitted, %u received, ", t->name, t->sent, t->recv);
+    if (t->dup) xprintf("+%u duplicates, ", t->dup);
+    xprintf("%u%% packet loss\n", loss);
+    if (t->timed) xprintf("round-trip min/avg/max = ");
+  } else {
+    xprintf("%s : xmt/rcv/%%loss = %u/%u/%u%%", t->name, t->sent, t->recv,
+      loss);
+    if (t->timed) xprintf(", min/avg/max = ");
+  }
+  if (t->timed)
+    xprintf("%llu.%03llu/%llu.%03llu/%llu.%03llu%s", t->min/1000, t->min%1000,
+      avg/1000, avg%1000, t->max/1000, t->max%1000,
+      TT.ntargets == 1 ? " ms" : "");
+  xputc('\n');
+}
+
+void ping_main(void)
+{
+  struct pollfd pfd;
+  unsigned long long now, due, gap, end = 0, quit = 0;
+  long i, next = 0, left, waiting = 0;
+
+  ping_targets();
+
+  // Several targets default to a single probe each: is it up or not.
+  if (!(toys.optflags & FLAG_c) && TT.ntargets > 1) TT.count = 1;
+  if (!(toys.optflags & FLAG_s)) TT.size = 56; // 64-PHDR_LEN
+  TT.packet = xzalloc(sizeof(struct icmphdr)+TT.size);
+  for (i = 0; i < TT.size; i++)
+    TT.packet[sizeof(struct icmphdr)+i] = i;
+  TT.rpkt = xmalloc(TT.size+128);
+  TT.ident = htons(getpid()^(long)&TT);
+  ping_socket();
+
+  if (TT.ntargets == 1)
+    xprintf("PING %s (%s): %ld data bytes\n", TT.targets->name,
+      inet_ntop(TT.family, ping_addr(TT.targets), toybuf, sizeof(toybuf)),
+      TT.size);
+
+  // Spread the sends for a round evenly over -i, so a few hundred targets
+  // each see one packet a second without bunching up on the wire.
+  gap = TT.interval*1000/TT.ntargets;
+  left = TT.count*TT.ntargets;
+  due = now = microtime();
+  if (TT.wait_exit) quit = now+TT.wait_exit*1000000ULL;
+  signal(SIGINT, generic_signal);
+  pfd.fd = TT.sock;
+  pfd.events = POLLIN;
+
+  for (;;) {
+    long long timeout;
+
+    toy_cancelpoint();
+    if (toys.signal || (quit && now >= quit)) break;
+    while ((!TT.count || left) && now >= due) {
+      ping_send(TT.targets+next);
+      if (++next == TT.ntargets) next = 0;
+      left--;
+      waiting++;
+      due += gap;
+      if (TT.count && !left) end = now+TT.wait_resp*1000000ULL;
+    }
+    if (TT.count && !left && (!waiting || now >= end)) break;
+
+    if (TT.count && !left) timeout = end-now;
+    else timeout = due-now;
+    if (quit && quit-now < timeout) timeout = quit-now;
+    if (poll(&pfd, 1, (timeout+999)/1000) > 0)
+      while ((i = ping_recv()) != -1) waiting -= i;
+    now = microtime();
+  }
+
+  for (i = 0; i < TT.ntargets; i++) {
+    if (!TT.targets[i].recv) toys.exitval = 1;
+    ping_stats(TT.targets+i);
+  }
 }
@@ -23,6 +23,7 @@ config ROUTE
 #include "toys.h"
 #include <net/route.h>
 #include <sys/param.h>
+#include <linux/rtnetlink.h>
 
 GLOBALS(
   char *family;
@@ -101,47 +102,91 @@ static void get_flag_value(char *str, int flags)
     if (flags & flagarray[i++]) ++str;
 }
 
-// extract inet4 route info from /proc/net/route file and display it.
-static void display_routes(void)
+// Print one main table route from an RTM_GETROUTE dump, the way the kernel
+// would have formatted it into /proc/net/route.
+static void show_route(struct nlmsghdr *nlh, void *arg)
 {
-  unsigned long dest, gate, mask;
-  int flags, ref, use, metric, mss, win, irtt, items;
-  char iface[64] = {0,}, flag_val[10]; //there are 9 flags "UGHRDMDAC" for route.
-
-  FILE *fp = xfopen("/proc/net/route", "r");
-
-  xprintf("Kernel IP routing table\n"
-      "Destination     Gateway         Genmask         Flags %s Iface\n",
-      (toys.optflags & FLAG_e)? "  MSS Window  irtt" : "Metric Ref    Use");
-
-  if (fscanf(fp, "%*[^\n]\n") < 0) perror_exit("fscanf"); //skip 1st line
-  while ((items = fscanf(fp, "%63s%lx%lx%X%d%d%d%lx%d%d%d\n", iface, &dest, 
-          &gate, &flags, &ref, &use, &metric, &mask, &mss, &win, &irtt)) == 11) {
-
-    char *destip = toybuf, *gateip = toybuf+32, *maskip = toybuf+64; //ip string 16
-    memset(flag_val, 0, 10);
+  struct rtmsg *rtm = NLMSG_DATA(nlh);
+  struct rtattr *tb[RTA_MAX+1];
+  struct netlink_link *nl;
+  unsigned dest = 0, gate = 0, mask, metrics[RTAX_MAX+1];
+  int flags = RTF_UP, metric = 0, oif = 0, table;
+  char *destip = toybuf, *gateip = toybuf+32, *maskip = toybuf+64; //ip string 16
+  char flag_val[10]; //there are 9 flags "UGHRDMDAC" for route.
+
+  if (nlh->nlmsg_type != RTM_NEWROUTE || rtm->rtm_family != AF_INET) return;
+  netlink_attrs(nlh, sizeof(*rtm), tb, RTA_MAX);
+  table = tb[RTA_TABLE] ? *(unsigned *)RTA_DATA(tb[RTA_TABLE]) : rtm->rtm_table;
+  if (table != RT_TABLE_MAIN || rtm->rtm_type == RTN_BROADCAST
+    || rtm->rtm_type == RTN_MULTICAST) return;
+
+  if (tb[RTA_DST]) memcpy(&dest, RTA_DATA(tb[RTA_DST]), 4);
+  mask = rtm->rtm_dst_len ? htonl(~0U<<(32-rtm->rtm_dst_len)) : 0;
+  if (tb[RTA_GATEWAY]) memcpy(&gate, RTA_DATA(tb[RTA_GATEWAY]), 4);
+  if (tb[RTA_OIF]) oif = *(int *)RTA_DATA(tb[RTA_OIF]);
+  if (tb[RTA_PRIORITY]) metric = *(int *)RTA_DATA(tb[RTA_PRIORITY]);
+
+  // Multipath routes show their first hop.
+  if (tb[RTA_MULTIPATH]) {
+    struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
+    struct rtattr *rta = RTNH_DATA(nh);
+    int len = nh->rtnh_len-sizeof(*nh);
+
+    oif = nh->rtnh_ifindex;
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+      if (rta->rta_type == RTA_GATEWAY) memcpy(&gate, RTA_DATA(rta), 4);
+  }
 
-    if (!(flags & RTF_UP)) continue; //skip down interfaces.
+  memset(metrics, 0, sizeof(metrics));
+  if (tb[RTA_METRICS]) {
+    struct rtattr *rta = RTA_DATA(tb[RTA_METRICS]);
+    int len = RTA_PAYLOAD(tb[RTA_METRICS]);
 
-    if (!dest && !(toys.optflags & FLAG_n)) strcpy( destip, "default");
-    else if (!inet_ntop(AF_INET, &dest, destip, 32)) perror_exit("inet");
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+      if (rta->rta_type <= RTAX_MAX)
+        metrics[rta->rta_type] = *(unsigned *)RTA_DATA(rta);
+  }
 
-    if (!gate && !(toys.optflags & FLAG_n)) strcpy( gateip, "*");
-    else if (!inet_ntop(AF_INET, &gate, gateip, 32)) perror_exit("inet");
+  if (rtm->rtm_type == RTN_UNREACHABLE || rtm->rtm_type == RTN_PROHIBIT)
+    flags |= RTF_REJECT;
+  if (gate) flags |= RTF_GATEWAY;
+  if (mask == 0xffffffff) flags |= RTF_HOST;
+
+  if (!dest && !(toys.optflags & FLAG_n)) strcpy( destip, "default");
+  else if (!inet_ntop(AF_INET, &dest, destip, 32)) perror_exit("inet");
+
+  if (!gate && !(toys.optflags & FLAG_n)) strcpy( gateip, "*");
+  else if (!inet_ntop(AF_INET, &gate, gateip, 32)) perror_exit("inet");
+
+  if (!inet_ntop(AF_INET, &mask, maskip, 32)) perror_exit("inet");
+
+  //Get flag Values
+  memset(flag_val, 0, 10);
+  get_flag_value(flag_val, (flags & (RTF_GATEWAY|RTF_HOST|RTF_REINSTATE
+          |RTF_DYNAMIC|RTF_MODIFIED)));
+  if (flags & RTF_REJECT) flag_val[0] = '!';
+  xprintf("%-15.15s %-15.15s %-16s%-6s", destip, gateip, maskip, flag_val);
+  nl = oif ? netlink_link(oif) : 0;
+  if (toys.optflags & FLAG_e)
+    xprintf("%5d %-5d %6d %s\n", metrics[RTAX_ADVMSS] ?
+      metrics[RTAX_ADVMSS]+40 : 0, metrics[RTAX_WINDOW], metrics[RTAX_RTT]>>3,
+      nl ? nl->name : "*");
+  else xprintf("%-6d %-2d %7d %s\n", metric, 0, 0, nl ? nl->name : "*");
+}
 
-    if (!inet_ntop(AF_INET, &mask, maskip, 32)) perror_exit("inet");
+// Display the inet4 main routing table, in /proc/net/route's format.
+static void display_routes(void)
+{
+  struct rtmsg rtm;
 
-    //Get flag Values
-    get_flag_value(flag_val, (flags & (RTF_GATEWAY|RTF_HOST|RTF_REINSTATE
-            |RTF_DYNAMIC|RTF_MODIFIED)));
-    if (flags & RTF_REJECT) flag_val[0] = '!';
-    xprintf("%-15.15s %-15.15s %-16s%-6s", destip, gateip, maskip, flag_val);
-    if (toys.optflags & FLAG_e) xprintf("%5d %-5d %6d %s\n", mss, win, irtt, iface);
-    else xprintf("%-6d %-2d %7d %s\n", metric, ref, use, iface);
-  }
+  xprintf("Kernel IP routing table\n"
+      "Destination     Gateway         Genmask         Flags %s Iface\n",
+      (toys.optflags & FLAG_e)? "  MSS Window  irtt" : "Metric Ref    Use");
 
-  if (items > 0 && feof(fp)) perror_exit("fscanf %d", items);
-  fclose(fp);
+  memset(&rtm, 0, sizeof(rtm));
+  rtm.rtm_family = AF_INET;
+  if (!netlink_dump(RTM_GETROUTE, &rtm, sizeof(rtm), show_route, 0))
+    perror_exit("netlink");
 }
 
 
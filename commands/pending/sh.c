@@ -288,24 +288,8 @@ static void run_pipeline(struct pipeline *line)
 
   tl = toy_find(cmd->argv[0]);
   // Is this command a builtin that should run in this process?
-  if (tl && (tl->flags & TOYFLAG_NOFORK)) {
-    struct toy_context temp;
-    jmp_buf rebound;
-
-    // This fakes lots of what toybox_main() does.
-    memcpy(&temp, &toys, sizeof(struct toy_context));
-    memset(&toys, 0, sizeof(struct toy_context));
-
-    if (!setjmp(rebound)) {
-      toys.rebound = &rebound;
-      toy_init(tl, cmd->argv);
-      tl->toy_main();
-    }
-    cmd->pid = toys.exitval;
-    if (toys.optargs != toys.argv+1) free(toys.optargs);
-    if (toys.old_umask) umask(toys.old_umask);
-    memcpy(&toys, &temp, sizeof(struct toy_context));
-  } else {
+  if (tl && (tl->flags & TOYFLAG_NOFORK)) cmd->pid = toy_run(tl, cmd->argv);
+  else {
     int status;
 
     cmd->pid = xvfork();
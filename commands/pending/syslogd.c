@@ -5,14 +5,15 @@
  *
  * No Standard
 
-USE_SYSLOGD(NEWTOY(syslogd,">0l#<1>8=8R:b#<0>99=1s#<0=200m#<0>71582787=20O:p:f:a:nSKLD", TOYFLAG_SBIN|TOYFLAG_STAYROOT))
+USE_SYSLOGD(NEWTOY(syslogd,">0WB#<1=256t#<0l#<1>8=8R:b#<0>99=1s#<0=200m#<0>71582787=20O:p:f:a:nSKLD", TOYFLAG_SBIN|TOYFLAG_STAYROOT))
 
 config SYSLOGD
   bool "syslogd"
   default n
   help
   usage: syslogd  [-a socket] [-O logfile] [-f config file] [-m interval]
-                  [-p socket] [-s SIZE] [-b N] [-R HOST] [-l N] [-nSLKD]
+                  [-p socket] [-s SIZE] [-b N] [-R HOST] [-l N] [-t MS]
+                  [-B KB] [-nSLKDW]
 
   System logging utility
 
@@ -23,18 +24,24 @@ config SYSLOGD
   -n      Avoid auto-backgrounding.
   -S      Smaller output
   -m MARK interval <DEFAULT: 20 minutes> (RANGE: 0 to 71582787)
-  -R HOST Log to IP or hostname on PORT (default PORT=514/UDP)"
+  -R HOST Log to IP or hostname on PORT (default PORT=514/UDP, @HOST for TCP)"
   -L      Log locally and via network (default is network only if -R)"
+  -B KB   Queue up to KB of messages for each remote host (default 256)
+  -W      Wait for room in a full remote queue (default: drop the oldest)
   -s SIZE Max size (KB) before rotation (default:200KB, 0=off)
   -b N    rotated logs to keep (default:1, max=99, 0=purge)
   -K      Log to kernel printk buffer (use dmesg to read it)
   -l N    Log only messages more urgent than prio(default:8 max:8 min:1)
   -D      Drop duplicates
+  (SIGUSR1 logs how many messages and bytes each destination got or dropped)
+  -t MS   Hold log file writes for up to MS milliseconds (default 0: write
+          after each batch of messages)
 */
 
 #define FOR_syslogd
 #define SYSLOG_NAMES
 #include "toys.h"
+#include <sys/uio.h>
 
 // UNIX Sockets for listening
 struct unsocks {
@@ -44,16 +51,56 @@ struct unsocks {
   int sd;
 };
 
+// Messages a forwarder sends at once, and the buffer it copies them into
+#define FORWARD_BATCH 64
+#define FORWARD_BUF (64*1024)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * Queue for a remote destination: logmsg() appends {length, message} records
+ * at head and the forwarder takes them from tail, without locks. Only the
+ * producer moves head, and tail moves by compare and swap so a full queue
+ * can drop its oldest record out from under the consumer. The consumer
+ * copies records out before claiming them, and starts over if tail moved
+ * meanwhile, since what it copied may have been overwritten.
+ */
+struct forward {
+  char *ring, *buf;
+  unsigned long long head, tail, retry;
+  unsigned long size;
+  long long lost;
+  struct sockaddr_in addr;
+  int tcp, fd, block, sleeping, quit, started, backoff, wake[2];
+  int count, used, sent, len[FORWARD_BATCH];
+#if CFG_TOYBOX_THREADS
+  pthread_t tid;
+#endif
+};
+
 // Log file entry to log into.
 struct logfile {
   struct logfile *next;
   char *filename;
   uint32_t facility[8];
   uint8_t level[LOG_NFACILITIES];
-  int logfd;
-  struct sockaddr_in saddr;
+  int logfd, isreg, iovcnt;
+  struct forward *fwd;
+  off_t size;
+  long pending;
+  struct iovec *iov;
+  long long msgs, bytes, drops;
 };
 
+// Datagrams read from a socket at once, and the most kept of each
+#define SYSLOG_BATCH 64
+#define SYSLOG_MSG 1024
+// Formatted lines waiting in the arena to be written, and lines per writev()
+#define SYSLOG_ARENA (64*1024)
+#define SYSLOG_IOV 256
+
 GLOBALS(
   char *socket;
   char *config_file;
@@ -64,10 +111,17 @@ GLOBALS(
   long rot_count;
   char *remote_log;
   long log_prio;
+  long flush_ms;
+  long queue_kb;
 
   struct unsocks *lsocks;  // list of listen sockets
   struct logfile *lfiles;  // list of write logfiles
   int sigfd[2];
+  char *hostname, *arena, *batch, stamp[26];
+  long arena_len;
+  time_t stamp_time;
+  struct logfile **routes;
+  unsigned *route;
 )
 
 // Lookup numerical code from name
@@ -233,6 +287,299 @@ static int parse_config_file(void)
   return 0;
 }
 
+static void ring_put(struct forward *fw, unsigned long long pos, void *data,
+  unsigned len)
+{
+  unsigned long off = pos%fw->size, n = fw->size-off;
+
+  if (n > len) n = len;
+  memcpy(fw->ring+off, data, n);
+  memcpy(fw->ring, (char *)data+n, len-n);
+}
+
+static void ring_get(struct forward *fw, unsigned long long pos, void *data,
+  unsigned len)
+{
+  unsigned long off = pos%fw->size, n = fw->size-off;
+
+  if (n > len) n = len;
+  memcpy(data, fw->ring+off, n);
+  memcpy((char *)data+n, fw->ring, len-n);
+}
+
+// Copy up to FORWARD_BATCH records from the queue into fw->buf and claim
+// them. Returns how many.
+static int forward_take(struct forward *fw)
+{
+  unsigned long long tail, head, pos;
+  unsigned len;
+  int count, used;
+
+  do {
+    tail = __atomic_load_n(&fw->tail, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&fw->head, __ATOMIC_ACQUIRE);
+    for (pos = tail, count = used = 0; count<FORWARD_BATCH && pos<head;) {
+      ring_get(fw, pos, &len, 4);
+      // A nonsense length was overwritten as we read it: the swap will fail.
+      if (len > head-pos-4 || used+len > FORWARD_BUF) break;
+      ring_get(fw, pos+4, fw->buf+used, len);
+      fw->len[count++] = len;
+      used += len;
+      pos += 4+len;
+    }
+  } while (!__atomic_compare_exchange_n(&fw->tail, &tail, pos, 0,
+    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  fw->count = count;
+  fw->used = used;
+  fw->sent = 0;
+
+  return count;
+}
+
+// Open the socket, or if that fails say when to try again, backing off from
+// one second to a minute.
+static int forward_connect(struct forward *fw)
+{
+  unsigned long long now = millitime();
+  struct timeval tv = {5, 0};
+  int fd;
+
+  if (now < fw->retry) return 0;
+  if (-1 != (fd = socket(AF_INET, fw->tcp ? SOCK_STREAM : SOCK_DGRAM, 0))) {
+    // A stalled receiver fails the connect or send instead of hanging us.
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (!connect(fd, (struct sockaddr *)&fw->addr, sizeof(fw->addr))) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+      fw->fd = fd;
+      fw->backoff = 0;
+
+      return 1;
+    }
+    close(fd);
+  }
+  fw->backoff = !fw->backoff ? 1000 : fw->backoff<30000 ? 2*fw->backoff : 60000;
+  fw->retry = now+fw->backoff;
+
+  return 0;
+}
+
+// Send the claimed batch, returning 0 if the connection failed. Without
+// wait, a TCP batch the socket can't take yet stays for next time.
+static int forward_send(struct forward *fw, int wait)
+{
+  int flags = MSG_NOSIGNAL|(wait ? 0 : MSG_DONTWAIT), i, len;
+  char *s = fw->buf;
+
+  if (fw->tcp) {
+    while (fw->sent < fw->used) {
+      if (0>(len = send(fw->fd, fw->buf+fw->sent, fw->used-fw->sent, flags))) {
+        if (errno == EINTR) continue;
+
+        return !wait && errno == EAGAIN;
+      }
+      fw->sent += len;
+    }
+  } else {
+    // Each message is a datagram, and one that can't go is lost.
+#ifdef __linux__
+    struct mmsghdr msgs[FORWARD_BATCH];
+    struct iovec iov[FORWARD_BATCH];
+
+    for (i = 0; i<fw->count; s += fw->len[i++]) {
+      iov[i].iov_base = s;
+      iov[i].iov_len = fw->len[i];
+      memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+      msgs[i].msg_hdr.msg_iov = iov+i;
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (i = 0; i<fw->count; i += len) {
+      if (0>(len = sendmmsg(fw->fd, msgs+i, fw->count-i, flags))) {
+        if (errno == EINTR) len = 0;
+        else {
+          __atomic_add_fetch(&fw->lost, 1, __ATOMIC_RELAXED);
+          len = 1;
+        }
+      }
+    }
+#else
+    for (i = 0; i<fw->count; s += fw->len[i++])
+      if (0>send(fw->fd, s, fw->len[i], flags))
+        __atomic_add_fetch(&fw->lost, 1, __ATOMIC_RELAXED);
+#endif
+  }
+  fw->count = fw->used = fw->sent = 0;
+
+  return 1;
+}
+
+// Wait up to ms milliseconds, or with -1 until logmsg() queues something,
+// either way waking early for forward_stop().
+static void forward_sleep(struct forward *fw, long ms)
+{
+  struct pollfd pfd = {fw->wake[0], POLLIN, 0};
+  char buf[64];
+
+  // Say we're asleep before the last look, so logmsg() can't miss us.
+  if (ms < 0) {
+    __atomic_store_n(&fw->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&fw->head, __ATOMIC_SEQ_CST)
+      != __atomic_load_n(&fw->tail, __ATOMIC_SEQ_CST)) ms = 0;
+  }
+  if (!__atomic_load_n(&fw->quit, __ATOMIC_ACQUIRE) && 0<poll(&pfd, 1, ms))
+    while (0<read(fw->wake[0], buf, sizeof(buf)));
+  __atomic_store_n(&fw->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+static void forward_wake(struct forward *fw)
+{
+  if (__atomic_exchange_n(&fw->sleeping, 0, __ATOMIC_SEQ_CST))
+    write(fw->wake[1], "", 1);
+}
+
+// Send what's queued for a remote destination. The forwarding thread waits
+// in here until forward_stop(), otherwise the main loop calls it after each
+// pass to send what it can without blocking.
+static void forward_pump(struct forward *fw, int wait)
+{
+  long long ms;
+  int quit, i, start;
+
+  for (;;) {
+    quit = __atomic_load_n(&fw->quit, __ATOMIC_ACQUIRE);
+    if (fw->fd == -1 && !forward_connect(fw)) {
+      if (!wait || quit) return;
+      ms = fw->retry-millitime();
+      forward_sleep(fw, ms<0 ? 0 : ms);
+    } else if (!fw->count && !forward_take(fw)) {
+      if (!wait || quit) return;
+      forward_sleep(fw, -1);
+    } else if (forward_send(fw, wait)) {
+      if (fw->count) return;
+    } else {
+      close(fw->fd);
+      fw->fd = -1;
+
+      // Resend from the first message the receiver didn't get whole.
+      for (i = start = 0; start+fw->len[i] <= fw->sent; start += fw->len[i++]);
+      memmove(fw->buf, fw->buf+start, fw->used -= start);
+      memmove(fw->len, fw->len+i, (fw->count -= i)*sizeof(*fw->len));
+      fw->sent = 0;
+    }
+  }
+}
+
+#if CFG_TOYBOX_THREADS
+static void *forward_thread(void *arg)
+{
+  forward_pump(arg, 1);
+
+  return 0;
+}
+#endif
+
+// Queue a message for a remote destination. When it's full, drop the oldest
+// messages to make room, or with -W wait for the forwarder to send them.
+static void forward_queue(struct logfile *tf, char *msg, unsigned len)
+{
+  struct forward *fw = tf->fwd;
+  unsigned long long head = fw->head, tail;
+  unsigned rec, flen = 0, old;
+  char frame[12];
+
+  // TCP gets RFC 6587 octet counting: "LEN MSG"
+  if (fw->tcp) flen = sprintf(frame, "%u ", len);
+  if (4+(rec = flen+len) > fw->size) {
+    tf->drops++;
+    return;
+  }
+  for (;;) {
+    tail = __atomic_load_n(&fw->tail, __ATOMIC_ACQUIRE);
+    if (head+4+rec-tail <= fw->size) break;
+    if (fw->block) {
+      forward_wake(fw);
+      if (!fw->started) forward_pump(fw, 0);
+      msleep(1);
+    } else {
+      ring_get(fw, tail, &old, 4);
+      if (__atomic_compare_exchange_n(&fw->tail, &tail, tail+4+old, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) tf->drops++;
+    }
+  }
+  ring_put(fw, head, &rec, 4);
+  ring_put(fw, head+4, frame, flen);
+  ring_put(fw, head+4+flen, msg, len);
+  __atomic_store_n(&fw->head, head+4+rec, __ATOMIC_SEQ_CST);
+  forward_wake(fw);
+  tf->msgs++;
+  tf->bytes += len;
+}
+
+// Set up a remote destination's queue, and its thread if we can.
+static struct forward *forward_start(struct sockaddr_in *addr, int tcp)
+{
+  struct forward *fw = xzalloc(sizeof(struct forward));
+  int i;
+#if CFG_TOYBOX_THREADS
+  pthread_attr_t attr;
+  sigset_t all, old;
+#endif
+
+  fw->addr = *addr;
+  fw->tcp = tcp;
+  fw->fd = -1;
+  fw->block = !!(toys.optflags & FLAG_W);
+  fw->size = TT.queue_kb*1024;
+  fw->ring = xmalloc(fw->size);
+  fw->buf = xmalloc(FORWARD_BUF);
+  if (pipe(fw->wake) < 0) perror_exit("pipe");
+  for (i = 0; i<2; i++) {
+    fcntl(fw->wake[i], F_SETFD, FD_CLOEXEC);
+    fcntl(fw->wake[i], F_SETFL, fcntl(fw->wake[i], F_GETFL) | O_NONBLOCK);
+  }
+
+#if CFG_TOYBOX_THREADS
+  // Signals are for the main loop, so the thread starts with them blocked.
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  fw->started = !toy_worker_create(&fw->tid, &attr, forward_thread, fw);
+  pthread_sigmask(SIG_SETMASK, &old, 0);
+  pthread_attr_destroy(&attr);
+#endif
+
+  return fw;
+}
+
+// Send what's left unless the remote end is down, and free the queue.
+static void forward_stop(struct forward *fw)
+{
+  __atomic_store_n(&fw->quit, 1, __ATOMIC_RELEASE);
+#if CFG_TOYBOX_THREADS
+  if (fw->started) {
+    write(fw->wake[1], "", 1);
+    pthread_join(fw->tid, 0);
+  } else
+#endif
+  forward_pump(fw, 1);
+  if (fw->fd != -1) close(fw->fd);
+  close(fw->wake[0]);
+  close(fw->wake[1]);
+  free(fw->ring);
+  free(fw->buf);
+  free(fw);
+}
+
+static void stop_forwarding(void)
+{
+  struct logfile *tf;
+
+  for (tf = TT.lfiles; tf; tf = tf->next) {
+    if (tf->fwd) forward_stop(tf->fwd);
+    tf->fwd = 0;
+  }
+}
+
 // open every log file in list.
 static void open_logfiles(void)
 {
@@ -241,11 +588,13 @@ static void open_logfiles(void)
   for (tfd = TT.lfiles; tfd; tfd = tfd->next) {
     char *p, *tmpfile;
     long port = 514;
+    struct stat st;
 
-    if (*tfd->filename == '@') { // network
+    if (*tfd->filename == '@') { // network, "@@" for TCP
       struct addrinfo *info, rp;
+      int tcp = tfd->filename[1] == '@';
 
-      tmpfile = xstrdup(tfd->filename + 1);
+      tmpfile = xstrdup(tfd->filename + 1 + tcp);
       if ((p = strchr(tmpfile, ':'))) {
         char *endptr;
 
@@ -256,35 +605,84 @@ static void open_logfiles(void)
       }
       memset(&rp, 0, sizeof(rp));
       rp.ai_family = AF_INET;
-      rp.ai_socktype = SOCK_DGRAM;
-      rp.ai_protocol = IPPROTO_UDP;
+      rp.ai_socktype = tcp ? SOCK_STREAM : SOCK_DGRAM;
+      rp.ai_protocol = tcp ? IPPROTO_TCP : IPPROTO_UDP;
 
       if (getaddrinfo(tmpfile, NULL, &rp, &info) || !info) 
         perror_exit("BAD ADDRESS: can't find : %s ", tmpfile);
       ((struct sockaddr_in*)info->ai_addr)->sin_port = htons(port);
-      memcpy(&tfd->saddr, info->ai_addr, info->ai_addrlen);
+      tfd->fwd = forward_start((struct sockaddr_in *)info->ai_addr, tcp);
       freeaddrinfo(info);
-
-      tfd->logfd = xsocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
       free(tmpfile);
+      tfd->logfd = -1;
+      continue;
     } else tfd->logfd = open(tfd->filename, O_CREAT | O_WRONLY | O_APPEND, 0666);
     if (tfd->logfd < 0) {
       tfd->filename = "/dev/console";
       tfd->logfd = open(tfd->filename, O_APPEND);
     }
+
+    // Regular files get buffered, and their size tracked for rotation.
+    if (!fstat(tfd->logfd, &st) && S_ISREG(st.st_mode)) {
+      tfd->isreg = 1;
+      tfd->size = st.st_size;
+    }
   }
 }
 
-//write to file with rotation
-static int write_rotate(struct logfile *tf, int len)
+// Write out the lines waiting for this file.
+static void logfile_flush(struct logfile *tf)
+{
+  ssize_t len;
+
+  if (!tf->iovcnt) return;
+  len = writev(tf->logfd, tf->iov, tf->iovcnt);
+  if (len < 0) perror_msg("write failed file : %s ", tf->filename);
+  else tf->size += len;
+  tf->iovcnt = tf->pending = 0;
+}
+
+// Write out every file, which frees up the whole arena.
+static void flush_logfiles(void)
+{
+  struct logfile *tf;
+
+  for (tf = TT.lfiles; tf; tf = tf->next) logfile_flush(tf);
+  TT.arena_len = 0;
+}
+
+/*
+ * Compile the per file facility and level masks into a table: for each
+ * facility and level, the offset in TT.routes of a NULL terminated list of
+ * the logfiles that get it.
+ */
+static void build_routes(void)
 {
-  int size, isreg;
-  struct stat statf;
-  isreg = (!fstat(tf->logfd, &statf) && S_ISREG(statf.st_mode));
-  size = statf.st_size;
+  struct logfile *tf;
+  int fac, lvl, n = 0, count = 1;
 
+  for (tf = TT.lfiles; tf; tf = tf->next) count++;
+  free(TT.routes);
+  TT.routes = xmalloc(LOG_NFACILITIES*8*count*sizeof(struct logfile *));
+  if (!TT.route) TT.route = xmalloc(LOG_NFACILITIES*8*sizeof(unsigned));
+  for (fac = 0; fac < LOG_NFACILITIES; fac++) {
+    for (lvl = 0; lvl < 8; lvl++) {
+      TT.route[fac*8+lvl] = n;
+      for (tf = TT.lfiles; tf; tf = tf->next)
+        if (!((tf->facility[lvl] & (1 << fac)) || (tf->level[fac] & (1<<lvl))))
+          TT.routes[n++] = tf;
+      TT.routes[n++] = 0;
+    }
+  }
+}
+
+//write to file with rotation
+static int write_rotate(struct logfile *tf, char *line, int len)
+{
   if ((toys.optflags & FLAG_s) || (toys.optflags & FLAG_b)) {
-    if (TT.rot_size && isreg && (size + len) > (TT.rot_size*1024)) {
+    if (TT.rot_size && tf->isreg
+        && (tf->size + tf->pending + len) > (TT.rot_size*1024)) {
+      logfile_flush(tf);
       if (TT.rot_count) { /* always 0..99 */
         int i = strlen(tf->filename) + 3 + 1;
         char old_file[i];
@@ -306,19 +704,42 @@ static int write_rotate(struct logfile *tf, int len)
         }
       }
       ftruncate(tf->logfd, 0);
+      tf->size = 0;
     }
   }
-  return write(tf->logfd, toybuf, len);
+
+  // Anything else (/dev/kmsg, consoles) takes each line as its own write.
+  if (!tf->isreg) return write(tf->logfd, line, len);
+
+  if (!tf->iov) tf->iov = xmalloc(SYSLOG_IOV*sizeof(struct iovec));
+  if (tf->iovcnt == SYSLOG_IOV) logfile_flush(tf);
+  tf->iov[tf->iovcnt].iov_base = line;
+  tf->iov[tf->iovcnt++].iov_len = len;
+  tf->pending += len;
+
+  return len;
+}
+
+// ctime() without the day of the week, redone only when the second changes
+static char *syslog_stamp(void)
+{
+  time_t now = time(0);
+
+  if (now != TT.stamp_time) {
+    ctime_r(&now, TT.stamp);
+    TT.stamp[19] = 0;
+    TT.stamp_time = now;
+  }
+
+  return TT.stamp+4;
 }
 
 //Parse messege and write to file.
 static void logmsg(char *msg, int len)
 {
-  time_t now;
-  char *p, *ts, *lvlstr, *facstr;
-  struct utsname uts;
+  char *p, *ts, *lvlstr, *facstr, *line;
   int pri = 0;
-  struct logfile *tf = TT.lfiles;
+  struct logfile *tf, **dest;
 
   char *omsg = msg;
   int olen = len, fac, lvl;
@@ -327,55 +748,118 @@ static void logmsg(char *msg, int len)
     pri = (int) strtoul(msg + 1, &p, 10);
     if (*p == '>') msg = p + 1;
   }
+  fac = LOG_FAC(pri);
+  lvl = LOG_PRI(pri);
+  if (lvl >= TT.log_prio || !TT.routes) return;
+  if (fac >= LOG_NFACILITIES) return; // no config can select these
+
   /* Jan 18 00:11:22 msg...
    * 01234567890123456
    */
   if (len < 16 || msg[3] != ' ' || msg[6] != ' ' || msg[9] != ':'
       || msg[12] != ':' || msg[15] != ' ') {
-    time(&now);
-    ts = ctime(&now) + 4; /* skip day of week */
+    ts = syslog_stamp();
   } else {
-    now = 0;
     ts = msg;
     msg += 16;
+    ts[15] = '\0';
   }
-  ts[15] = '\0';
-  fac = LOG_FAC(pri);
-  lvl = LOG_PRI(pri);
 
-  if (toys.optflags & FLAG_K) len = sprintf(toybuf, "<%d> %s\n", pri, msg);
+  // The line goes in the arena, for the files to writev() from.
+  if (TT.arena_len + SYSLOG_MSG + 256 > SYSLOG_ARENA) flush_logfiles();
+  line = TT.arena + TT.arena_len;
+  if (toys.optflags & FLAG_K) len = sprintf(line, "<%d> %s\n", pri, msg);
   else {
     char facbuf[12], pribuf[12];
 
     facstr = dec(pri & LOG_FACMASK, facilitynames, facbuf);
     lvlstr = dec(LOG_PRI(pri), prioritynames, pribuf);
 
-    p = "local";
-    if (!uname(&uts)) p = uts.nodename;
-    if (toys.optflags & FLAG_S) len = sprintf(toybuf, "%s %s\n", ts, msg);
-    else len = sprintf(toybuf, "%s %s %s.%s %s\n", ts, p, facstr, lvlstr, msg);
+    if (toys.optflags & FLAG_S) len = sprintf(line, "%s %s\n", ts, msg);
+    else len = sprintf(line, "%s %s %s.%s %s\n", ts, TT.hostname, facstr,
+      lvlstr, msg);
   }
-  if (lvl >= TT.log_prio) return;
-
-  for (; tf; tf = tf->next) {
-    if (tf->logfd > 0) {
-      if (!((tf->facility[lvl] & (1 << fac)) || (tf->level[fac] & (1<<lvl)))) {
-        int wlen, isNetwork = *tf->filename == '@';
-        if (isNetwork)
-          wlen = sendto(tf->logfd, omsg, olen, 0, (struct sockaddr*)&tf->saddr, sizeof(tf->saddr));
-        else wlen = write_rotate(tf, len);
-        if (wlen < 0) perror_msg("write failed file : %s ", tf->filename + isNetwork);
+  TT.arena_len += len;
+
+  for (dest = TT.routes + TT.route[fac*8+lvl]; (tf = *dest); dest++) {
+    if (tf->fwd) forward_queue(tf, omsg, olen);
+    else if (tf->logfd > 0) {
+      int wlen = write_rotate(tf, line, len);
+
+      if (wlen < 0) {
+        perror_msg("write failed file : %s ", tf->filename);
+        tf->drops++;
+      } else {
+        tf->msgs++;
+        tf->bytes += wlen;
       }
-    }
+    } else tf->drops++;
+  }
+}
+
+// SIGUSR1: log what each destination has been sent so far
+static void log_stats(void)
+{
+  struct logfile *tf;
+  char *msg;
+
+  for (tf = TT.lfiles; tf; tf = tf->next) {
+    msg = xmprintf("<46>syslogd: %s: %lld messages, %lld bytes, %lld dropped",
+      tf->filename, tf->msgs, tf->bytes, tf->drops
+      + (tf->fwd ? __atomic_load_n(&tf->fwd->lost, __ATOMIC_RELAXED) : 0));
+    logmsg(msg, strlen(msg));
+    free(msg);
   }
 }
 
+// Log every datagram waiting on sd, reading them SYSLOG_BATCH at a time.
+static void read_socket(int sd, char *last_buf, int *last_len)
+{
+  char *buffer;
+  int lens[SYSLOG_BATCH], count, i, len;
+#ifdef __linux__
+  struct mmsghdr msgs[SYSLOG_BATCH];
+  struct iovec iov[SYSLOG_BATCH];
+
+  for (i = 0; i<SYSLOG_BATCH; i++) {
+    iov[i].iov_base = TT.batch+i*SYSLOG_MSG;
+    iov[i].iov_len = SYSLOG_MSG-1; // 1 for NUL
+    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+    msgs[i].msg_hdr.msg_iov = iov+i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+#endif
+
+  do {
+#ifdef __linux__
+    if (0<(count = recvmmsg(sd, msgs, SYSLOG_BATCH, MSG_DONTWAIT, 0)))
+      for (i = 0; i<count; i++) lens[i] = msgs[i].msg_len;
+#else
+    for (count = 0; count<SYSLOG_BATCH; count++)
+      if (1>(lens[count] = recv(sd, TT.batch+count*SYSLOG_MSG, SYSLOG_MSG-1,
+        MSG_DONTWAIT))) break;
+#endif
+    for (i = 0; i<count; i++) {
+      if (1>(len = lens[i])) continue;
+      buffer = TT.batch+i*SYSLOG_MSG;
+      buffer[len] = '\0';
+      if((toys.optflags & FLAG_D) && (len == *last_len))
+        if (!memcmp(last_buf, buffer, len)) continue;
+
+      memcpy(last_buf, buffer, len);
+      *last_len = len;
+      logmsg(buffer, len);
+    }
+  } while (count == SYSLOG_BATCH);
+}
+
 /*
  * closes all read and write fds
  * and frees all nodes and lists
  */
 static void cleanup(void)
 {
+  stop_forwarding();
   while (TT.lsocks) {
     struct unsocks *fnode = TT.lsocks;
 
@@ -391,10 +875,13 @@ static void cleanup(void)
     struct logfile *fnode = TT.lfiles;
 
     free(fnode->filename);
+    free(fnode->iov);
     if (fnode->logfd >= 0) close(fnode->logfd);
     TT.lfiles = fnode->next;
     free(fnode);
   }
+  free(TT.routes);
+  TT.routes = 0;
 }
 
 static void signal_handler(int sig)
@@ -406,17 +893,26 @@ static void signal_handler(int sig)
 void syslogd_main(void)
 {
   struct unsocks *tsd;
+  struct logfile *tf;
+  struct utsname uts;
   int nfds, retval, last_len=0;
   struct timeval tv;
   fd_set rfds;        // fds for reading
-  char *temp, *buffer = (toybuf +2048), *last_buf = (toybuf + 3072); //these two buffs are of 1K each
+  char *temp, *last_buf = (toybuf + 3072); //1K
+  unsigned long long flush_at = 0, now;
 
   if ((toys.optflags & FLAG_p) && (strlen(TT.unix_socket) > 108))
     error_exit("Socket path should not be more than 108");
 
   TT.config_file = (toys.optflags & FLAG_f) ?
                    TT.config_file : "/etc/syslog.conf"; //DEFCONFFILE
+  if (!TT.arena) {
+    TT.arena = xmalloc(SYSLOG_ARENA);
+    TT.batch = xmalloc(SYSLOG_BATCH*SYSLOG_MSG);
+  }
 init_jumpin:
+  free(TT.hostname);
+  TT.hostname = xstrdup(uname(&uts) ? "local" : uts.nodename);
   tsd = xzalloc(sizeof(struct unsocks));
 
   tsd->path = (toys.optflags & FLAG_p) ? TT.unix_socket : "/dev/log"; // DEFLOGSOCK
@@ -470,9 +966,12 @@ init_jumpin:
   signal(SIGTERM, signal_handler);
   signal(SIGINT, signal_handler);
   signal(SIGQUIT, signal_handler);
+  signal(SIGUSR1, signal_handler);
+  signal(SIGPIPE, SIG_IGN);
 
   if (parse_config_file() == -1) goto clean_and_exit;
   open_logfiles();
+  build_routes();
   if (!(toys.optflags & FLAG_n)) {
     daemon(0, 0);
     //don't daemonize again if SIGHUP received.
@@ -481,6 +980,7 @@ init_jumpin:
   xpidfile("syslogd");
 
   logmsg("<46>Toybox: syslogd started", 27); //27 : the length of message
+  flush_logfiles();
   for (;;) {
     // Add opened socks to rfds for select()
     FD_ZERO(&rfds);
@@ -489,11 +989,22 @@ init_jumpin:
     tv.tv_usec = 0;
     tv.tv_sec = TT.interval*60;
 
-    retval = select(TT.sigfd[0] + 1, &rfds, NULL, NULL, (TT.interval)?&tv:NULL);
+    // With lines waiting, wake up in time to write them.
+    if (flush_at) {
+      now = millitime();
+      now = (flush_at > now) ? flush_at - now : 0;
+      tv.tv_sec = now/1000;
+      tv.tv_usec = (now%1000)*1000;
+    }
+
+    retval = select(TT.sigfd[0] + 1, &rfds, NULL, NULL,
+      (TT.interval || flush_at) ? &tv : NULL);
     if (retval < 0) {
       if (errno != EINTR) perror_msg("Error in select ");
     }
-    else if (!retval) logmsg("<46>-- MARK --", 14);
+    else if (!retval) {
+      if (!flush_at) logmsg("<46>-- MARK --", 14);
+    }
     else if (FD_ISSET(TT.sigfd[0], &rfds)) { /* May be a signal */
       unsigned char sig;
 
@@ -506,6 +1017,8 @@ init_jumpin:
         case SIGINT:     /* FALLTHROUGH */
         case SIGQUIT:
           logmsg("<46>syslogd exiting", 19);
+          flush_logfiles();
+          stop_forwarding();
           if (CFG_TOYBOX_FREE ) cleanup();
           signal(sig, SIG_DFL);
           sigset_t ss;
@@ -515,32 +1028,39 @@ init_jumpin:
           raise(sig);
           _exit(1);  /* Should not reach it */
           break;
+        case SIGUSR1:
+          log_stats();
+          break;
         case SIGHUP:
           logmsg("<46>syslogd exiting", 19);
+          flush_logfiles();
+          flush_at = 0;
           cleanup(); //cleanup is done, as we restart syslog.
           goto init_jumpin;
         default: break;
       }
     } else { /* Some activity on listen sockets. */
-      for (tsd = TT.lsocks; tsd; tsd = tsd->next) {
-        int sd = tsd->sd;
-        if (FD_ISSET(sd, &rfds)) {
-          int len = read(sd, buffer, 1023); //buffer is of 1K, hence readingonly 1023 bytes, 1 for NUL
-          if (len > 0) {
-            buffer[len] = '\0';
-            if((toys.optflags & FLAG_D) && (len == last_len))
-              if (!memcmp(last_buf, buffer, len)) break;
-
-            memcpy(last_buf, buffer, len);
-            last_len = len;
-            logmsg(buffer, len);
-          }
-          break;
-        }
+      for (tsd = TT.lsocks; tsd; tsd = tsd->next)
+        if (FD_ISSET(tsd->sd, &rfds)) read_socket(tsd->sd, last_buf, &last_len);
+    }
+
+    // Write what this pass logged now, or once -t has passed.
+    if (TT.arena_len) {
+      now = millitime();
+      if (!flush_at) flush_at = now + TT.flush_ms;
+      if (now >= flush_at) {
+        flush_logfiles();
+        flush_at = 0;
       }
     }
+
+    // Without a thread of their own, remote hosts get sent to between passes.
+    for (tf = TT.lfiles; tf; tf = tf->next)
+      if (tf->fwd && !tf->fwd->started) forward_pump(tf->fwd, 0);
   }
 clean_and_exit:
   logmsg("<46>syslogd exiting", 19);
+  flush_logfiles();
+  stop_forwarding();
   if (CFG_TOYBOX_FREE ) cleanup();
 }
@@ -7,17 +7,19 @@
  * For writing to external program
  * http://www.gnu.org/software/tar/manual/html_node/Writing-to-an-External-Program.html
 
-USE_TAR(NEWTOY(tar, "&(no-recursion)(numeric-owner)(no-same-permissions)(overwrite)(exclude)*(to-command):o(no-same-owner)p(same-permissions)k(keep-old)c(create)|h(dereference)x(extract)|t(list)|v(verbose)z(gzip)O(to-stdout)m(touch)X(exclude-from)*T(files-from)*C(directory):f(file):[!txc]", TOYFLAG_USR|TOYFLAG_BIN))
+USE_TAR(NEWTOY(tar, "&(index):(jobs)#<1>64(no-recursion)(numeric-owner)(no-same-permissions)(overwrite)(exclude)*(to-command):S(sparse)J(xz)j(bzip2)o(no-same-owner)p(same-permissions)k(keep-old)c(create)|h(dereference)x(extract)|t(list)|v(verbose)z(gzip)O(to-stdout)m(touch)X(exclude-from)*T(files-from)*C(directory):f(file):b#<1>2048=20[!txc]", TOYFLAG_USR|TOYFLAG_BIN))
 
 config TAR
   bool "tar"
   default n
   help
-    usage: tar -[cxtzhmvO] [-X FILE] [-T FILE] [-f TARFILE] [-C DIR]
+    usage: tar -[cxtzjJhmvOS] [-X FILE] [-T FILE] [-f TARFILE] [-C DIR] [-b N] [--jobs N]
+                [--index FILE]
 
     Create, extract, or list files from a tar file
 
     Operation:
+    b Blocking factor, read/write N 512 byte records at a time (default 20)
     c Create
     f Name of TARFILE ('-' for stdin/out)
     h Follow symlinks
@@ -26,26 +28,39 @@ config TAR
     v Verbose
     x Extract
     z (De)compress using gzip
+    j (De)compress using bzip2
+    J (De)compress using xz
+    S Store holes in sparse files as holes (extract always does)
     C Change to DIR before operation
     O Extract to stdout
     exclude=FILE File to exclude
     X File with names to exclude
     T File with names to include
+    jobs=N Extract with N threads writing files
+    index=FILE Offset of each member, written by c or first full t/x read,
+               then used to seek straight to members
 */
 
 #define FOR_tar
 #include "toys.h"
 
 GLOBALS(
+  long blocks;
   char *fname;
   char *dir;
   struct arg_list *inc_file;
   struct arg_list *exc_file;
   char *tocmd;
   struct arg_list *exc;
+  long jobs;
+  char *index;
 
   struct arg_list *inc, *pass;
-  void *inodes, *handle;
+  struct inodeset inodes;
+  struct double_list *idx;
+  void *handle, *pool, *dirs, *codec;
+  char *zargv[3];
+  pid_t codec_pid;
 )
 
 struct tar_hdr {
@@ -62,33 +77,171 @@ struct file_header {
   mode_t mode;
   time_t mtime;
   dev_t device;
+  off_t realsize, *sparse;
+  int nsparse;
 };
 
+// Archive data goes through buf a record (TT.blocks*512 bytes) at a time:
+// when reading, pos..len is what's left of the last read(), when writing
+// len is how much is waiting to go out.
 struct archive_handler {
   int src_fd;
   struct file_header file_hdr;
   off_t offset;
   void (*extract_handler)(struct archive_handler*);
+  char *buf;
+  int bufsize, pos, len, seekable, index;
 };
 
-struct inode_list {
-  struct inode_list *next;
-  char *arg;
-  ino_t ino;
-  dev_t dev;
-};
+// Refill the record buffer, returning how much was read.
+static int tar_fill(struct archive_handler *tar)
+{
+  int len = read(tar->src_fd, tar->buf, tar->bufsize);
+
+  if (len < 0) perror_exit("read");
+  tar->pos = 0;
+
+  return tar->len = len;
+}
+
+// Read up to len bytes of archive into data, returning how many there were.
+static int tar_read(struct archive_handler *tar, void *data, int len)
+{
+  int n, done = 0;
+
+  while (done < len) {
+    if (tar->pos == tar->len && !tar_fill(tar)) break;
+    if ((n = tar->len - tar->pos) > len - done) n = len - done;
+    memcpy((char *)data + done, tar->buf + tar->pos, n);
+    tar->pos += n;
+    done += n;
+  }
+  tar->offset += done;
+
+  return done;
+}
+
+// Write out whatever's waiting in the record buffer.
+static void tar_flush(struct archive_handler *tar)
+{
+  if (tar->len) txwrite(tar->src_fd, tar->buf, tar->len);
+  tar->len = 0;
+}
+
+// Append len bytes of data (or zeroes if data is NULL) to the archive.
+static void tar_write(struct archive_handler *tar, void *data, off_t len)
+{
+  while (len) {
+    int n = tar->bufsize - tar->len;
+
+    if (n > len) n = len;
+    if (data) {
+      memcpy(tar->buf + tar->len, data, n);
+      data = (char *)data + n;
+    } else memset(tar->buf + tar->len, 0, n);
+    tar->len += n;
+    tar->offset += n;
+    len -= n;
+    if (tar->len == tar->bufsize) tar_flush(tar);
+  }
+}
+
+// Zero fill the archive out to the next 512 byte boundary.
+static void tar_pad(struct archive_handler *tar)
+{
+  tar_write(tar, 0, -tar->offset & 511);
+}
 
-static void copy_in_out(int src, int dst, off_t size)
+// Append size bytes of file to the archive, read straight into the buffer.
+static void tar_write_file(struct archive_handler *tar, int fd, char *name,
+  off_t size)
 {
-  int i, rd, rem = size%512, cnt;
-  
-  cnt = size/512 + (rem?1:0);
+  while (size) {
+    int n = tar->bufsize - tar->len, rd;
+
+    if (n > size) n = size;
+    if ((rd = readall(fd, tar->buf + tar->len, n)) < 0) rd = 0;
+    tar->len += rd;
+    tar->offset += rd;
+    size -= rd;
+    if (tar->len == tar->bufsize) tar_flush(tar);
+    if (rd < n) {
+      // Header already promised this much, so keep the archive readable.
+      error_msg("'%s' shrank, padding %lld", name, (long long)size);
+      tar_write(tar, 0, size);
+      break;
+    }
+  }
+}
+
+// Copy size bytes of archive to dst (or discard them if dst is -1). Once
+// the buffer's drained a seekable archive can have the kernel move the
+// rest, going from the fd's own position which is right there.
+static void copy_in_out(struct archive_handler *tar, int dst, off_t size)
+{
+  while (size) {
+    int n;
+
+    if (tar->pos == tar->len) {
+#if TOYBOX_COPYFILE
+      if (tar->seekable && dst != -1 && size > tar->bufsize) {
+        long len;
+
+        while (size > tar->bufsize) {
+          len = syscall(SYS_copy_file_range, tar->src_fd, 0, dst, 0, size, 0);
+          if (len < 1) len = sendfile(dst, tar->src_fd, 0, size);
+          if (len < 1) break;
+          size -= len;
+          tar->offset += len;
+        }
+        // Didn't manage a byte? Don't try again for every file.
+        if (len < 0) tar->seekable = 0;
+        if (size <= tar->bufsize) continue;
+      }
+#endif
+      if (!tar_fill(tar)) error_exit("short read");
+    }
+    if ((n = tar->len - tar->pos) > size) n = size;
+    if (dst != -1) writeall(dst, tar->buf + tar->pos, n);
+    tar->pos += n;
+    tar->offset += n;
+    size -= n;
+  }
+}
 
-  for (i = 0; i < cnt; i++) {
-    rd = (i == cnt-1 && rem) ? rem : 512;
-    xreadall(src, toybuf, rd);
-    writeall(dst, toybuf, rd);
+// Copy a sparse member's data to dst, putting the holes back in by seeking
+// if seek is set, else as zeroes.
+static void copy_sparse(struct archive_handler *tar, int dst, int seek)
+{
+  struct file_header *file_hdr = &tar->file_hdr;
+  off_t pos = 0, left = file_hdr->size, off, len;
+  int i, n;
+
+  for (i = 0; i <= file_hdr->nsparse; i++) {
+    off = (i < file_hdr->nsparse) ? file_hdr->sparse[2*i] : file_hdr->realsize;
+    if (dst != -1 && off > pos) {
+      if (seek) lseek(dst, off, SEEK_SET);
+      else {
+        memset(toybuf, 0, sizeof(toybuf));
+        for (len = off-pos; len > 0; len -= n) {
+          n = (len > sizeof(toybuf)) ? sizeof(toybuf) : len;
+          if (writeall(dst, toybuf, n) != n) {
+            dst = -1;
+            break;
+          }
+        }
+      }
+    }
+    if (i == file_hdr->nsparse) break;
+    if ((len = file_hdr->sparse[2*i+1]) > left) len = left;
+    copy_in_out(tar, dst, len);
+    left -= len;
+    pos = off+len;
   }
+  // A bad map mustn't leave us in the middle of the member.
+  copy_in_out(tar, -1, left);
+  if (seek && dst != -1 && ftruncate(dst, file_hdr->realsize))
+    perror_msg("truncate '%s'", file_hdr->name);
 }
 
 //convert to octal
@@ -102,32 +255,63 @@ static void itoo(char *str, int len, off_t val)
   memcpy(str, t, len);
 }
 
-static struct inode_list *seen_inode(void **list, struct stat *st, char *name)
+// Return the name this inode was first archived under, or NULL (remembering
+// name for it) if it's new.
+static char *seen_inode(struct inodeset *set, struct stat *st, char *name)
 {
-  if (!st) llist_traverse(*list, llist_free_arg);
-  else if (!S_ISDIR(st->st_mode) && st->st_nlink > 1) {
-    struct inode_list *new;
-
-    for (new = *list; new; new = new->next)
-      if(new->ino == st->st_ino && new->dev == st->st_dev)
-        return new;
+  if (!S_ISDIR(st->st_mode) && st->st_nlink > 1) {
+    void **slot = inodeset_slot(set, st->st_dev, st->st_ino);
 
-    new = xzalloc(sizeof(*new));
-    new->ino = st->st_ino;
-    new->dev = st->st_dev;
-    new->arg = xstrdup(name);
-    new->next = *list;
-    *list = new;
+    if (*slot) return *slot;
+    *slot = xstrdup(name);
   }
   return 0;
 }
 
+// The --index file is a "#tarindex ARCHIVESIZE" line and then one
+// "OFFSET SIZE MTIME NAME" line per member, OFFSET being where its first
+// header (long name or pax header included) starts. Backslash and newline
+// in NAME are escaped.
+static void tar_index_add(off_t offset, off_t size, time_t mtime, char *name)
+{
+  char *line = xmalloc(3*24 + 2*strlen(name) + 2), *s;
+
+  s = line + sprintf(line, "%lld %lld %lld ", (long long)offset,
+    (long long)size, (long long)mtime);
+  for (; *name; name++) {
+    if (*name == '\\' || *name == '\n') *s++ = '\\';
+    *s++ = (*name == '\n') ? 'n' : *name;
+  }
+  strcpy(s, "\n");
+  dlist_add(&TT.idx, line);
+}
+
+static void tar_index_write(struct archive_handler *tar)
+{
+  struct double_list *dl;
+  struct stat st;
+  FILE *fp;
+
+  if (fstat(tar->src_fd, &st) || !S_ISREG(st.st_mode)) {
+    error_msg("can't --index a stream");
+    return;
+  }
+  fp = xfdopen(xcreate(TT.index, O_WRONLY|O_CREAT|O_TRUNC, 0666), "w");
+  fprintf(fp, "#tarindex %lld\n", (long long)st.st_size);
+  while (TT.idx) {
+    dl = dlist_pop(&TT.idx);
+    fputs(dl->data, fp);
+    free(dl->data);
+    free(dl);
+  }
+  if (fclose(fp)) perror_msg("%s", TT.index);
+}
+
 static void write_longname(struct archive_handler *tar, char *name, char type)
 {
   struct tar_hdr tmp;
   unsigned int sum = 0;
   int i, sz = strlen(name) +1;
-  char buf[512] = {0,};
 
   memset(&tmp, 0, sizeof(tmp));
   strcpy(tmp.name, "././@LongLink");
@@ -143,10 +327,10 @@ static void write_longname(struct archive_handler *tar, char *name, char type)
   for (i= 0; i < 512; i++) sum += (unsigned int)((char*)&tmp)[i];
   itoo(tmp.chksum, sizeof(tmp.chksum)-1, sum);
 
-  writeall(tar->src_fd, (void*) &tmp, sizeof(tmp));
+  tar_write(tar, &tmp, sizeof(tmp));
   //write name to archive
-  writeall(tar->src_fd, name, sz);
-  if (sz%512) writeall(tar->src_fd, buf, (512-(sz%512)));
+  tar_write(tar, name, sz);
+  tar_pad(tar);
 }
 
 static int filter(struct arg_list *lst, char *name)
@@ -158,16 +342,57 @@ static int filter(struct arg_list *lst, char *name)
   return 0;
 }
 
+// Old GNU sparse members ('S') store just the data, with a map of where it
+// goes: offset and length pairs, 4 in the header (where ustar would have its
+// name prefix) and 21 in each extension block after it, the last pair of
+// a file that ends in a hole being (realsize, 0).
+#define SPARSE_MAP 41
+#define SPARSE_EXT 137
+#define SPARSE_SIZE 138
+
+// Map fd's data, returning the pairs and setting *count and *stored.
+static off_t *sparse_scan(int fd, off_t size, int *count, off_t *stored)
+{
+  off_t *map = 0, pos = 0, data, end;
+  int n = 0;
+
+  for (*stored = 0; pos < size; pos = end) {
+    data = lseek_data(fd, pos, size, &end);
+    if (!(n&15)) map = xrealloc(map, (n+16)*2*sizeof(off_t));
+    map[2*n] = data;
+    *stored += map[2*n+1] = end-data;
+    n++;
+  }
+  *count = n;
+
+  return map;
+}
+
+// Write the map pairs after the first 4 as extension blocks.
+static void sparse_write_ext(struct archive_handler *tar, off_t *map, int n)
+{
+  char blk[512];
+  int i;
+
+  for (map += 8, n -= 4; n > 0; map += 42, n -= 21) {
+    memset(blk, 0, sizeof(blk));
+    for (i = 0; i < 21 && i < n; i++) {
+      itoo(blk+24*i, 12, map[2*i]);
+      itoo(blk+24*i+12, 12, map[2*i+1]);
+    }
+    blk[504] = (n > 21) ? '1' : 0;
+    tar_write(tar, blk, 512);
+  }
+}
+
 static void add_file(struct archive_handler *tar, char **nam, struct stat *st)
 {
   struct tar_hdr hdr;
-  struct passwd *pw;
-  struct group *gr;
-  struct inode_list *node;
-  int i, fd =-1;
-  char *c, *p, *name = *nam, *lnk, *hname, buf[512] = {0,};
+  int i, fd =-1, nmap = 0;
+  char *c, *p, *name = *nam, *lnk, *hname, *first;
   unsigned int sum = 0;
   static int warn = 1;
+  off_t start = tar->offset, size = st->st_size, *map = 0;
 
   for (p = name; *p; p++)
     if ((p == name || p[-1] == '/') && *p != '/'
@@ -198,12 +423,12 @@ static void add_file(struct archive_handler *tar, char **nam, struct stat *st)
   itoo(hdr.mtime, sizeof(hdr.mtime), st->st_mtime);
   for (i=0; i<sizeof(hdr.chksum); i++) hdr.chksum[i] = ' ';
 
-  if ((node = seen_inode(&TT.inodes, st, hname))) {
+  if ((first = seen_inode(&TT.inodes, st, hname))) {
     //this is a hard link
     hdr.type = '1';
-    if (strlen(node->arg) > sizeof(hdr.link))
+    if (strlen(first) > sizeof(hdr.link))
       write_longname(tar, hname, 'K'); //write longname LINK
-    xstrncpy(hdr.link, node->arg, sizeof(hdr.link));
+    xstrncpy(hdr.link, first, sizeof(hdr.link));
   } else if (S_ISREG(st->st_mode)) {
     hdr.type = '0';
     if (st->st_size <= (off_t)0777777777777LL)
@@ -213,6 +438,18 @@ static void add_file(struct archive_handler *tar, char **nam, struct stat *st)
                 hname, (unsigned long long)st->st_size);
       return;
     }
+    if ((toys.optflags & FLAG_S) && st->st_blocks*512 < st->st_size
+        && (fd = open(name, O_RDONLY)) != -1) {
+      map = sparse_scan(fd, st->st_size, &nmap, &size);
+      hdr.type = 'S';
+      itoo(hdr.size, sizeof(hdr.size), size);
+      for (i = 0; i < 4 && i < nmap; i++) {
+        itoo(hdr.prefix+SPARSE_MAP+24*i, 12, map[2*i]);
+        itoo(hdr.prefix+SPARSE_MAP+24*i+12, 12, map[2*i+1]);
+      }
+      if (nmap > 4) hdr.prefix[SPARSE_EXT] = '1';
+      itoo(hdr.prefix+SPARSE_SIZE, 12, st->st_size);
+    }
   } else if (S_ISLNK(st->st_mode)) {
     hdr.type = '2'; //'K' long link
     if (!(lnk = xreadlink(name))) {
@@ -237,28 +474,43 @@ static void add_file(struct archive_handler *tar, char **nam, struct stat *st)
   if (strlen(hname) > sizeof(hdr.name))
           write_longname(tar, hname, 'L'); //write longname NAME
   strcpy(hdr.magic, "ustar  ");
-  if ((pw = getpwuid(st->st_uid)))
-    snprintf(hdr.uname, sizeof(hdr.uname), "%s", pw->pw_name);
+  if ((p = uid_name(st->st_uid)))
+    snprintf(hdr.uname, sizeof(hdr.uname), "%s", p);
   else snprintf(hdr.uname, sizeof(hdr.uname), "%d", st->st_uid);
 
-  if ((gr = getgrgid(st->st_gid)))
-    snprintf(hdr.gname, sizeof(hdr.gname), "%s", gr->gr_name);
+  if ((p = gid_name(st->st_gid)))
+    snprintf(hdr.gname, sizeof(hdr.gname), "%s", p);
   else snprintf(hdr.gname, sizeof(hdr.gname), "%d", st->st_gid);
 
   //calculate chksum.
   for (i= 0; i < 512; i++) sum += (unsigned int)((char*)&hdr)[i];
   itoo(hdr.chksum, sizeof(hdr.chksum)-1, sum);
   if (toys.optflags & FLAG_v) printf("%s\n",hname);
-  writeall(tar->src_fd, (void*)&hdr, 512);
+  tar_write(tar, &hdr, 512);
+  if (TT.index) tar_index_add(start, (hdr.type == '0' || map) ? size : 0,
+    st->st_mtime, hname);
 
   //write actual data to archive
+  if (map) {
+    sparse_write_ext(tar, map, nmap);
+    for (i = 0; i < nmap; i++) {
+      if (map[2*i+1] && -1 == lseek(fd, map[2*i], SEEK_SET)) {
+        perror_msg("seek '%s'", name);
+        tar_write(tar, 0, map[2*i+1]);
+      } else tar_write_file(tar, fd, name, map[2*i+1]);
+    }
+    tar_pad(tar);
+    close(fd);
+    free(map);
+    return;
+  }
   if (hdr.type != '0') return; //nothing to write
   if ((fd = open(name, O_RDONLY)) < 0) {
     perror_msg("can't open '%s'", name);
     return;
   }
-  copy_in_out(fd, tar->src_fd, st->st_size);
-  if (st->st_size%512) writeall(tar->src_fd, buf, (512-(st->st_size%512)));
+  tar_write_file(tar, fd, name, st->st_size);
+  tar_pad(tar);
   close(fd);
 }
 
@@ -282,26 +534,67 @@ static int add_to_tar(struct dirtree *node)
   return ((DIRTREE_RECURSE | ((toys.optflags & FLAG_h)?DIRTREE_SYMFOLLOW:0)));
 }
 
-static void compress_stream(struct archive_handler *tar_hdl)
+// -z, -j and -J put a compressor (or decompressor) between us and the
+// archive, connected by a pipe: it gets the archive's fd and we keep the
+// other end of the pipe as src_fd. When it's a toy and there's a thread to
+// run it in (gzip then deflates on threads of its own too) nothing gets
+// exec()ed, otherwise it's a child process as usual.
+static void tar_codec(struct archive_handler *tar_hdl)
 {
-  int pipefd[2];
-  pid_t cpid;
+  int pipefd[2], create = toys.optflags & FLAG_c, in, out;
+#if CFG_TOYBOX_THREADS
+  struct toy_list *toy;
+#endif
+
+  if (toys.optflags & FLAG_j) *TT.zargv = create ? "bzip2" : "bzcat";
+  else if (toys.optflags & FLAG_J) *TT.zargv = create ? "xz" : "xzcat";
+  else *TT.zargv = create ? "gzip" : "zcat";
+  TT.zargv[1] = create ? "-c" : 0;
+
+  if (pipe(pipefd)) perror_exit("pipe");
+  in = create ? pipefd[0] : tar_hdl->src_fd;
+  out = create ? tar_hdl->src_fd : pipefd[1];
+  signal(SIGPIPE, SIG_IGN);
+  tar_hdl->src_fd = pipefd[!!create];
+  tar_hdl->seekable = 0;
 
-  if (pipe(pipefd) == -1) error_exit("pipe");
+#if CFG_TOYBOX_THREADS
+  // The thread owns in and out from here on.
+  if ((toy = toy_find(*TT.zargv))
+      && (TT.codec = toy_thread_start(toy, TT.zargv, in, out))) return;
+#endif
 
-  signal(SIGPIPE, SIG_IGN);
-  cpid = xfork();
-  if (cpid == -1) perror_exit("fork");
+  if (!(TT.codec_pid = xfork())) {
+    close(tar_hdl->src_fd);
+    dup2(in, 0);
+    dup2(out, 1);
+    xexec(TT.zargv);
+  }
+  close(in);
+  close(out);
+}
 
-  if (!cpid) {    /* Child reads from pipe */
-    char *argv[] = {"gzip", "-f", NULL};
-    xclose(pipefd[1]); /* Close unused write*/
-    dup2(pipefd[0], 0);
-    dup2(tar_hdl->src_fd, 1); //write to tar fd
-    xexec(argv);
-  } else {
-    xclose(pipefd[0]);          /* Close unused read end */
-    dup2(pipefd[1], tar_hdl->src_fd); //write to pipe
+// Let the (de)compressor see the end of its input, and wait for it. If we
+// stopped reading at the end of the archive there may still be padding on
+// the way, which it mustn't die of SIGPIPE trying to write.
+static void tar_codec_done(struct archive_handler *tar)
+{
+  int rc = 0;
+
+  if (!TT.codec && !TT.codec_pid) return;
+  if (!(toys.optflags & FLAG_c)) while (tar_fill(tar));
+  close(tar->src_fd);
+  tar->src_fd = -1;
+#if CFG_TOYBOX_THREADS
+  if (TT.codec) rc = toy_thread_join(TT.codec);
+  else
+#endif
+  rc = xwaitpid(TT.codec_pid);
+  TT.codec = 0;
+  TT.codec_pid = 0;
+  if (rc) {
+    error_msg("%s failed", *TT.zargv);
+    if (!toys.exitval) toys.exitval = rc;
   }
 }
 
@@ -309,8 +602,9 @@ static void extract_to_stdout(struct archive_handler *tar)
 {
   struct file_header *file_hdr = &tar->file_hdr;
 
-  copy_in_out(tar->src_fd, 0, file_hdr->size);
-  tar->offset += file_hdr->size;
+  xflush();
+  if (file_hdr->sparse) copy_sparse(tar, 1, 0);
+  else copy_in_out(tar, 1, file_hdr->size);
 }
 
 static void extract_to_command(struct archive_handler *tar)
@@ -331,7 +625,8 @@ static void extract_to_command(struct archive_handler *tar)
     setenv("TAR_FILETYPE", "f", 1);
     sprintf(buf, "%0o", file_hdr->mode);
     setenv("TAR_MODE", buf, 1);
-    sprintf(buf, "%ld", (long)file_hdr->size);
+    sprintf(buf, "%ld",
+      (long)(file_hdr->sparse ? file_hdr->realsize : file_hdr->size));
     setenv("TAR_SIZE", buf, 1);
     setenv("TAR_FILENAME", file_hdr->name, 1);
     setenv("TAR_UNAME", file_hdr->uname, 1);
@@ -349,8 +644,8 @@ static void extract_to_command(struct archive_handler *tar)
     xexec(argv);
   } else {
     xclose(pipefd[0]);  // Close unused read end
-    copy_in_out(tar->src_fd, pipefd[1], file_hdr->size);
-    tar->offset += file_hdr->size;
+    if (file_hdr->sparse) copy_sparse(tar, pipefd[1], 0);
+    else copy_in_out(tar, pipefd[1], file_hdr->size);
     xclose(pipefd[1]);
     waitpid(cpid, &status, 0);
     if (WIFSIGNALED(status))
@@ -358,6 +653,226 @@ static void extract_to_command(struct archive_handler *tar)
   }
 }
 
+// Directories get their permissions and mtime once everything that's going
+// into them has been extracted, or creating the contents would undo it.
+struct tar_dir {
+  struct tar_dir *next;
+  char *name;
+  mode_t mode;
+  time_t mtime;
+};
+
+static void tar_owner(struct file_header *file_hdr, uid_t *u, gid_t *g)
+{
+  //--no-same-owner, --numeric-owner
+  *u = file_hdr->uid;
+  *g = file_hdr->gid;
+
+  if (!(toys.optflags & FLAG_numeric_owner)) {
+    struct group *gr = getgrnam(file_hdr->gname);
+    struct passwd *pw = getpwnam(file_hdr->uname);
+    if (pw) *u = pw->pw_uid;
+    if (gr) *g = gr->gr_gid;
+  }
+}
+
+static void tar_dirs_done(void)
+{
+  struct tar_dir *dir;
+
+  // Newest first, so children are done before their parents lose write bit.
+  while ((dir = TT.dirs)) {
+    TT.dirs = dir->next;
+    if (toys.optflags & FLAG_p) chmod(dir->name, dir->mode);
+    if (!(toys.optflags & FLAG_m)) {
+      struct timeval times[2] = {{dir->mtime, 0},{dir->mtime, 0}};
+      utimes(dir->name, times);
+    }
+    free(dir->name);
+    free(dir);
+  }
+}
+
+#if CFG_TOYBOX_THREADS
+// With --jobs the archive is still read in order, but regular files up to
+// TAR_JOB_MAX bytes get read into memory and handed to a pool of writer
+// threads along with their already open fd, to write and then set owner,
+// mode and mtime on. TAR_QUEUE_MAX caps how much can be waiting at once.
+// Writers run in a copy of this command's context, so they only use their
+// tar_job, and leave any error in it for the main thread to report.
+
+#define TAR_QUEUE_MAX (64<<20)
+#define TAR_JOB_MAX (TAR_QUEUE_MAX/8)
+
+struct tar_job {
+  struct tar_job *next;
+  char *name, *op, *data;
+  long size, cost;
+  int fd, err, own, perm, times;
+  uid_t uid;
+  gid_t gid;
+  mode_t mode;
+  time_t mtime;
+};
+
+struct tar_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t work, room;
+  struct tar_job *todo, **tail, *done;
+  long queued;
+  int quit, threads;
+  pthread_t tid[];
+};
+
+static void tar_job_fail(struct tar_job *job, char *op)
+{
+  if (!job->op) {
+    job->op = op;
+    job->err = errno;
+  }
+}
+
+static void *tar_writer(void *arg)
+{
+  struct tar_pool *pool = arg;
+  struct tar_job *job;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->todo && !pool->quit)
+      pthread_cond_wait(&pool->work, &pool->lock);
+    if ((job = pool->todo) && !(pool->todo = job->next))
+      pool->tail = &pool->todo;
+    pthread_mutex_unlock(&pool->lock);
+    if (!job) return 0;
+
+    if (writeall(job->fd, job->data, job->size) != job->size)
+      tar_job_fail(job, "write");
+    if (job->own && fchown(job->fd, job->uid, job->gid))
+      tar_job_fail(job, "chown");
+    if (job->perm && fchmod(job->fd, job->mode)) tar_job_fail(job, "chmod");
+    if (job->times) {
+      struct timespec ts[2] = {{job->mtime, 0}, {job->mtime, 0}};
+
+      if (futimens(job->fd, ts)) tar_job_fail(job, "utime");
+    }
+    if (close(job->fd)) tar_job_fail(job, "close");
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued -= job->cost;
+    job->next = pool->done;
+    pool->done = job;
+    pthread_cond_signal(&pool->room);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+// Report and free the jobs the writers have finished.
+static void tar_reap(struct tar_pool *pool)
+{
+  struct tar_job *job, *next;
+
+  pthread_mutex_lock(&pool->lock);
+  job = pool->done;
+  pool->done = 0;
+  pthread_mutex_unlock(&pool->lock);
+
+  for (; job; job = next) {
+    next = job->next;
+    if (job->op) {
+      errno = job->err;
+      perror_msg("%s '%s'", job->op, job->name);
+    }
+    free(job->name);
+    free(job);
+  }
+}
+
+// Read this file's data and queue it for a writer, taking over fd.
+// Returns 0 if it's not one for the pool.
+static int tar_queue(struct archive_handler *tar, int fd)
+{
+  struct tar_pool *pool = TT.pool;
+  struct file_header *file_hdr = &tar->file_hdr;
+  struct tar_job *job;
+
+  if (!pool || file_hdr->size > TAR_JOB_MAX) return 0;
+
+  job = xzalloc(sizeof(struct tar_job) + file_hdr->size);
+  job->data = (char *)(job+1);
+  job->size = file_hdr->size;
+  job->cost = sizeof(struct tar_job) + job->size;
+  if (tar_read(tar, job->data, job->size) != job->size)
+    error_exit("short read");
+  job->name = xstrdup(file_hdr->name);
+  job->fd = fd;
+  if ((job->own = !(toys.optflags & FLAG_o)))
+    tar_owner(file_hdr, &job->uid, &job->gid);
+  job->perm = toys.optflags & FLAG_p;
+  job->mode = file_hdr->mode & 07777;
+  job->times = !(toys.optflags & FLAG_m);
+  job->mtime = file_hdr->mtime;
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->queued && pool->queued + job->cost > TAR_QUEUE_MAX)
+    pthread_cond_wait(&pool->room, &pool->lock);
+  *pool->tail = job;
+  pool->tail = &job->next;
+  pool->queued += job->cost;
+  pthread_cond_signal(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  tar_reap(pool);
+
+  return 1;
+}
+
+static void tar_pool_start(int threads)
+{
+  struct tar_pool *pool;
+  pthread_attr_t attr;
+
+  pool = xzalloc(sizeof(struct tar_pool) + threads*sizeof(pthread_t));
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->work, 0);
+  pthread_cond_init(&pool->room, 0);
+  pool->tail = &pool->todo;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+  while (pool->threads < threads
+    && !toy_worker_create(pool->tid + pool->threads, &attr, tar_writer, pool))
+      pool->threads++;
+  pthread_attr_destroy(&attr);
+
+  if (pool->threads) TT.pool = pool;
+  else free(pool);
+}
+
+// Let the writers finish what's queued, then shut the pool down.
+static void tar_pool_stop(void)
+{
+  struct tar_pool *pool = TT.pool;
+  int i;
+
+  if (!pool) return;
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->threads; i++) pthread_join(pool->tid[i], 0);
+  tar_reap(pool);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->room);
+  free(pool);
+  TT.pool = 0;
+}
+#else
+static int tar_queue(struct archive_handler *tar, int fd) { return 0; }
+static void tar_pool_start(int threads) {}
+static void tar_pool_stop(void) {}
+#endif
+
 static void extract_to_disk(struct archive_handler *tar)
 {
   int flags, dst_fd = -1;
@@ -417,27 +932,35 @@ static void extract_to_disk(struct archive_handler *tar)
   }
 
   //copy file....
+  if (dst_fd != -1 && !file_hdr->sparse && tar_queue(tar, dst_fd)) return;
 COPY:
-  copy_in_out(tar->src_fd, dst_fd, file_hdr->size);
-  tar->offset += file_hdr->size;
-  close(dst_fd);
+  if (file_hdr->sparse) copy_sparse(tar, dst_fd, 1);
+  else copy_in_out(tar, dst_fd, file_hdr->size);
+  if (dst_fd != -1) close(dst_fd);
 
   if (S_ISLNK(file_hdr->mode)) return;
   if (!(toys.optflags & FLAG_o)) {
-    //set ownership..., --no-same-owner, --numeric-owner
-    uid_t u = file_hdr->uid;
-    gid_t g = file_hdr->gid;
+    //set ownership...
+    uid_t u;
+    gid_t g;
 
-    if (!(toys.optflags & FLAG_numeric_owner)) {
-      struct group *gr = getgrnam(file_hdr->gname);
-      struct passwd *pw = getpwnam(file_hdr->uname);
-      if (pw) u = pw->pw_uid;
-      if (gr) g = gr->gr_gid;
-    }
+    tar_owner(file_hdr, &u, &g);
     if (chown(file_hdr->name, u, g))
       perror_msg("chown %d:%d '%s'", u, g, file_hdr->name);;
   }
 
+  if (S_ISDIR(file_hdr->mode)) {
+    struct tar_dir *dir = xmalloc(sizeof(struct tar_dir));
+
+    dir->name = xstrdup(file_hdr->name);
+    dir->mode = file_hdr->mode;
+    dir->mtime = file_hdr->mtime;
+    dir->next = TT.dirs;
+    TT.dirs = dir;
+
+    return;
+  }
+
   if (toys.optflags & FLAG_p) // || !(toys.optflags & FLAG_no_same_permissions))
     chmod(file_hdr->name, file_hdr->mode);
 
@@ -485,37 +1008,41 @@ static struct archive_handler *init_handler()
 }
 
 //convert octal to int
-static int otoi(char *str, int len)
+static off_t otoi(char *str, int len)
 {
-  long val;
+  long long val;
   char *endp, inp[len+1]; //1 for NUL termination
 
   memcpy(inp, str, len);
   inp[len] = '\0'; //nul-termination made sure
-  val = strtol(inp, &endp, 8);
+  val = strtoll(inp, &endp, 8);
   if (*endp && *endp != ' ') error_exit("invalid param");
-  return (int)val;
+  return val;
 }
 
-static void extract_stream(struct archive_handler *tar_hdl)
+// Read an 'S' member's map out of its header and any extension blocks.
+static void sparse_read(struct archive_handler *tar, struct tar_hdr *hdr)
 {
-  int pipefd[2];              
-  pid_t cpid;                 
-
-  if (pipe(pipefd) == -1) error_exit("pipe");
-
-  cpid = xfork();
-  if (cpid == -1) perror_exit("fork");
-
-  if (!cpid) {    /* Child reads from pipe */
-    char *argv[] = {"gunzip", "-cf", "-", NULL};
-    xclose(pipefd[0]); /* Close unused read*/
-    dup2(tar_hdl->src_fd, 0);
-    dup2(pipefd[1], 1); //write to pipe
-    xexec(argv);
-  } else {
-    xclose(pipefd[1]);          /* Close unused read end */
-    dup2(pipefd[0], tar_hdl->src_fd); //read from pipe
+  struct file_header *file_hdr = &tar->file_hdr;
+  char *map = hdr->prefix+SPARSE_MAP, ext = hdr->prefix[SPARSE_EXT], blk[512];
+  int i, n = 4;
+  off_t *pair;
+
+  file_hdr->realsize = otoi(hdr->prefix+SPARSE_SIZE, 12);
+  for (;;) {
+    for (i = 0; i < n && map[24*i]; i++) {
+      if (!(file_hdr->nsparse&15))
+        file_hdr->sparse = xrealloc(file_hdr->sparse,
+          (file_hdr->nsparse+16)*2*sizeof(off_t));
+      pair = file_hdr->sparse + 2*file_hdr->nsparse++;
+      pair[0] = otoi(map+24*i, 12);
+      pair[1] = otoi(map+24*i+12, 12);
+    }
+    if (!ext) break;
+    if (tar_read(tar, blk, 512) != 512) error_exit("short read");
+    map = blk;
+    ext = blk[504];
+    n = 21;
   }
 }
 
@@ -523,9 +1050,8 @@ static char *process_extended_hdr(struct archive_handler *tar, int size)
 {
   char *value = NULL, *p, *buf = xzalloc(size+1);
 
-  if (readall(tar->src_fd, buf, size) != size) error_exit("short read");
+  if (tar_read(tar, buf, size) != size) error_exit("short read");
   buf[size] = 0;
-  tar->offset += size;
   p = buf;
 
   while (size) {
@@ -554,18 +1080,19 @@ static char *process_extended_hdr(struct archive_handler *tar, int size)
   return value;
 }
 
-static void tar_skip(struct archive_handler *tar, int sz)
+static void tar_skip(struct archive_handler *tar, off_t sz)
 {
-  int x;
+  int n = tar->len - tar->pos;
 
-  while ((x = lskip(tar->src_fd, sz))) {
-    tar->offset += sz - x;
-    sz = x;
-  }
-  tar->offset += sz;
+  // Use up what's buffered, then seek (or read) past the rest.
+  if (n > sz) n = sz;
+  tar->pos += n;
+  tar->offset += n;
+  if ((sz -= n)) tar->offset += sz - lskip(tar->src_fd, sz);
 }
 
-static void unpack_tar(struct archive_handler *tar_hdl)
+// Unpack members until the end of the archive, or just the next one.
+static void unpack_tar(struct archive_handler *tar_hdl, int one)
 {
   struct tar_hdr tar;
   struct file_header *file_hdr;
@@ -573,6 +1100,7 @@ static void unpack_tar(struct archive_handler *tar_hdl)
   unsigned int cksum;
   unsigned char *gzMagic;
   char *longname = NULL, *longlink = NULL;
+  off_t start = -1;
 
   while (1) {
     cksum = 0;
@@ -580,8 +1108,8 @@ static void unpack_tar(struct archive_handler *tar_hdl)
       sz = 512 - tar_hdl->offset % 512;
       tar_skip(tar_hdl, sz);
     }
-    i = readall(tar_hdl->src_fd, &tar, 512);
-    tar_hdl->offset += i;
+    if (start == -1) start = tar_hdl->offset;
+    i = tar_read(tar_hdl, &tar, 512);
     if (i != 512) {
       if (i >= 2) goto CHECK_MAGIC; //may be a small (<512 byte)zipped file
       error_exit("read error");
@@ -590,16 +1118,24 @@ static void unpack_tar(struct archive_handler *tar_hdl)
     if (!tar.name[0]) {
       if (e) return; //end of tar 2 empty blocks
       e = 1;//empty jump to next block
+      start = -1;
       continue;
     }
     if (strncmp(tar.magic, "ustar", 5)) {
       //try detecting by reading magic
 CHECK_MAGIC:
       gzMagic = (unsigned char*)&tar;
-      if ((gzMagic[0] == 0x1f) && (gzMagic[1] == 0x8b) 
-          && !lseek(tar_hdl->src_fd, -i, SEEK_CUR)) {
+      if (((gzMagic[0] == 0x1f && gzMagic[1] == 0x8b)
+           || (i >= 3 && !memcmp(gzMagic, "BZh", 3))
+           || (i >= 6 && !memcmp(gzMagic, "\xfd" "7zXZ", 6)))
+          && !TT.codec && !TT.codec_pid
+          && !lseek(tar_hdl->src_fd, tar_hdl->pos-tar_hdl->len-i, SEEK_CUR)) {
         tar_hdl->offset -= i;
-        extract_stream(tar_hdl);
+        tar_hdl->pos = tar_hdl->len = 0;
+        if (*gzMagic == 'B') toys.optflags |= FLAG_j;
+        else if (*gzMagic == 0xfd) toys.optflags |= FLAG_J;
+        tar_codec(tar_hdl);
+        start = -1;
         continue;
       }
       error_exit("invalid tar format");
@@ -625,7 +1161,7 @@ CHECK_MAGIC:
     min = otoi(tar.minor, sizeof(tar.minor));
     file_hdr->device = makedev(maj, min);
 
-    if (tar.type <= '7') {
+    if (tar.type <= '7' || tar.type == 'S') {
       if (tar.link[0]) {
         sz = sizeof(tar.link);
         file_hdr->link_target = xmalloc(sz + 1);
@@ -634,7 +1170,7 @@ CHECK_MAGIC:
       }
 
       file_hdr->name = xzalloc(256);// pathname supported size
-      if (tar.prefix[0]) {
+      if (tar.type != 'S' && tar.prefix[0]) {
         memcpy(file_hdr->name, tar.prefix, sizeof(tar.prefix));
         sz = strlen(file_hdr->name);
         if (file_hdr->name[sz-1] != '/') file_hdr->name[sz] = '/';
@@ -666,24 +1202,28 @@ CHECK_MAGIC:
       case '6':
         file_hdr->mode |= S_IFIFO;
         break;
+      case 'S':
+        file_hdr->mode |= S_IFREG;
+        sparse_read(tar_hdl, &tar);
+        break;
       case 'K':
         longlink = xzalloc(file_hdr->size +1);
-        xread(tar_hdl->src_fd, longlink, file_hdr->size);
-        tar_hdl->offset += file_hdr->size;
+        if (tar_read(tar_hdl, longlink, file_hdr->size) != file_hdr->size)
+          error_exit("short read");
         continue;
       case 'L':
         free(longname);
         longname = xzalloc(file_hdr->size +1);           
-        xread(tar_hdl->src_fd, longname, file_hdr->size);
-        tar_hdl->offset += file_hdr->size;
+        if (tar_read(tar_hdl, longname, file_hdr->size) != file_hdr->size)
+          error_exit("short read");
         continue;
       case 'D':
       case 'M':
       case 'N':
-      case 'S':
       case 'V':
       case 'g':  // pax global header
         tar_skip(tar_hdl, file_hdr->size);
+        start = -1;
         continue;
       case 'x':  // pax extended header
         free(longname);
@@ -714,6 +1254,10 @@ CHECK_MAGIC:
         || S_ISLNK(file_hdr->mode) || S_ISDIR(file_hdr->mode))
       file_hdr->size = 0;
 
+    if (tar_hdl->index)
+      tar_index_add(start, file_hdr->size, file_hdr->mtime, file_hdr->name);
+    start = -1;
+
     if (filter(TT.exc, file_hdr->name) ||
         (TT.inc && !filter(TT.inc, file_hdr->name))) goto SKIP;
     add_to_list(&TT.pass, xstrdup(file_hdr->name));
@@ -725,7 +1269,9 @@ CHECK_MAGIC:
 
         mode_to_string(file_hdr->mode, perm);
         printf("%s %s/%s %9ld %d-%02d-%02d %02d:%02d:%02d ",perm,file_hdr->uname,
-            file_hdr->gname, (long)file_hdr->size, 1900+lc->tm_year,
+            file_hdr->gname,
+            (long)(file_hdr->sparse ? file_hdr->realsize : file_hdr->size),
+            1900+lc->tm_year,
             1+lc->tm_mon, lc->tm_mday, lc->tm_hour, lc->tm_min, lc->tm_sec);
       }
       printf("%s",file_hdr->name);
@@ -741,14 +1287,59 @@ SKIP:
     free(file_hdr->link_target);
     free(file_hdr->uname);
     free(file_hdr->gname);
+    free(file_hdr->sparse);
+    if (one) return;
   }
 }
 
+// Go through the members listed in the index, seeking to each wanted one
+// and unpacking just it. Returns 0 if there's no usable index.
+static int tar_index_read(struct archive_handler *tar)
+{
+  struct stat st;
+  long long off, size, mtime, len = 0;
+  char *line = 0, *s, *d;
+  size_t alloc = 0;
+  int fd = open(TT.index, O_RDONLY), n;
+  FILE *fp;
+
+  if (fd == -1) return 0;
+  fp = xfdopen(fd, "r");
+  if (fstat(tar->src_fd, &st) || getline(&line, &alloc, fp) < 1
+      || sscanf(line, "#tarindex %lld", &len) != 1 || len != st.st_size) {
+    free(line);
+    fclose(fp);
+
+    return 0;
+  }
+
+  while (getline(&line, &alloc, fp) > 0) {
+    if (sscanf(line, "%lld %lld %lld %n", &off, &size, &mtime, &n) != 3) {
+      error_msg("bad index line '%s'", line);
+      continue;
+    }
+    for (s = d = line+n; *s && *s != '\n'; s++)
+      *d++ = (*s == '\\' && s[1]) ? unescape(*++s) : *s;
+    *d = 0;
+    if (!filter(TT.exc, line+n) && (!TT.inc || filter(TT.inc, line+n))) {
+      xlseek(tar->src_fd, off, SEEK_SET);
+      tar->pos = tar->len = 0;
+      tar->offset = off;
+      unpack_tar(tar, 1);
+    }
+  }
+  free(line);
+  fclose(fp);
+
+  return 1;
+}
+
 void tar_main(void)
 {
   struct archive_handler *tar_hdl;
   int fd = 0;
   struct arg_list *tmp;
+  struct stat st;
   char **args = toys.optargs;
 
   if (!geteuid()) toys.optflags |= FLAG_p;
@@ -766,10 +1357,14 @@ void tar_main(void)
   }
   if ((toys.optflags & FLAG_f) && strcmp(TT.fname, "-")) 
     fd = xcreate(TT.fname, fd*(O_WRONLY|O_CREAT|O_TRUNC), 0666);
+  if (TT.index) TT.index = xabspath(TT.index, 0);
   if (toys.optflags & FLAG_C) xchdir(TT.dir);
 
   tar_hdl = init_handler();
   tar_hdl->src_fd = fd;
+  tar_hdl->buf = xmalloc(tar_hdl->bufsize = TT.blocks*512);
+  if (!fstat(fd, &st) && S_ISREG(st.st_mode))
+    tar_hdl->seekable = 1;
 
   if ((toys.optflags & FLAG_x) || (toys.optflags & FLAG_t)) {
     if (toys.optflags & FLAG_O) tar_hdl->extract_handler = extract_to_stdout;
@@ -777,27 +1372,41 @@ void tar_main(void)
       signal(SIGPIPE, SIG_IGN); //will be using pipe between child & parent
       tar_hdl->extract_handler = extract_to_command;
     }
-    if (toys.optflags & FLAG_z) extract_stream(tar_hdl);
-    unpack_tar(tar_hdl);
+    if (toys.optflags & (FLAG_z|FLAG_j|FLAG_J)) tar_codec(tar_hdl);
+    if (TT.jobs > 1 && tar_hdl->extract_handler == extract_to_disk
+        && !(toys.optflags & FLAG_t)) tar_pool_start(TT.jobs);
+    if (!TT.index || !tar_hdl->seekable || !tar_index_read(tar_hdl)) {
+      tar_hdl->index = TT.index && tar_hdl->seekable;
+      unpack_tar(tar_hdl, 0);
+      if (tar_hdl->index && tar_hdl->seekable) tar_index_write(tar_hdl);
+    }
+    tar_codec_done(tar_hdl);
+    tar_pool_stop();
+    tar_dirs_done();
     for (tmp = TT.inc; tmp; tmp = tmp->next)
       if (!filter(TT.exc, tmp->arg) && !filter(TT.pass, tmp->arg))
         error_msg("'%s' not in archive", tmp->arg);
   } else if (toys.optflags & FLAG_c) {
     //create the tar here.
-    if (toys.optflags & FLAG_z) compress_stream(tar_hdl);
+    if (toys.optflags & (FLAG_z|FLAG_j|FLAG_J)) tar_codec(tar_hdl);
     for (tmp = TT.inc; tmp; tmp = tmp->next) {
       TT.handle = tar_hdl;
       //recurse thru dir and add files to archive
       dirtree_handle_callback(dirtree_start(tmp->arg, toys.optflags & FLAG_h),
         add_to_tar);
     }
-    memset(toybuf, 0, 1024);
-    writeall(tar_hdl->src_fd, toybuf, 1024);
-    seen_inode(&TT.inodes, 0, 0);
+    // Two empty headers end the archive, then pad out the last record.
+    tar_write(tar_hdl, 0, 1024);
+    tar_write(tar_hdl, 0, (tar_hdl->bufsize - tar_hdl->len) % tar_hdl->bufsize);
+    tar_flush(tar_hdl);
+    if (TT.index && tar_hdl->seekable) tar_index_write(tar_hdl);
+    tar_codec_done(tar_hdl);
+    inodeset_free(&TT.inodes, free);
   }
 
   if (CFG_TOYBOX_FREE) {
     close(tar_hdl->src_fd);
+    free(tar_hdl->buf);
     free(tar_hdl);
     llist_traverse(TT.exc, llist_free_arg);
     llist_traverse(TT.inc, llist_free_arg);
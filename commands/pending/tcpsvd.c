@@ -30,7 +30,8 @@ config TCPSVD
                   New connections from this IP address are closed
                   immediately. MSG is written to the peer before close
     -h            Look up peer's hostname
-    -E            Don't set up environment variables
+    -E            Don't set up environment variables (so a toybox PROG can
+                  run in a thread, without a fork and exec per connection)
     -v            Verbose
 */
 
@@ -47,28 +48,30 @@ GLOBALS(
   int maxc;
   int count_all;
   int udp;
+  int hashsize;
+  int seq;
+  int notify[2];
+  struct tcpsvd_peer **peers, *free_peers;
+  struct tcpsvd_conn **conns, *free_conns;
 )
 
-struct list_pid {
-  struct list_pid *next;
-  char *ip;  
-  int pid;
-};
-
-struct list {
-  struct list* next;
-  char *d;
-  int count;
+// A client address and how many connections it has open, hashed on its
+// 4 (IPv4) or 16 (IPv6) binary bytes.
+struct tcpsvd_peer {
+  struct tcpsvd_peer *next;
+  unsigned char addr[16];
+  int len, count;
 };
 
-struct hashed {
-  struct list *head;
+// A running connection: a child process, or a toy command running in a
+// thread of ours (id is its struct toy_thread). pid is what -v shows.
+struct tcpsvd_conn {
+  struct tcpsvd_conn *next;
+  struct tcpsvd_peer *peer;
+  long id;
+  int pid;
 };
 
-#define HASH_NR 256
-struct hashed h[HASH_NR];
-struct list_pid *pids = NULL;
-
 // convert IP address to string.
 static char *sock_to_address(struct sockaddr *sock, int flags)
 {
@@ -85,106 +88,140 @@ static char *sock_to_address(struct sockaddr *sock, int flags)
   error_exit("getnameinfo: %s", gai_strerror(status));
 }
 
-// Insert pid, ip and fd in the list.
-static void insert(struct list_pid **l, int pid, char *addr)
+static unsigned tcpsvd_hash(void *key, int len)
 {
-  struct list_pid *newnode = xmalloc(sizeof(struct list_pid));
-  newnode->pid = pid;
-  newnode->ip = addr;
-  newnode->next = NULL;
-  if (!*l) *l = newnode;
-  else {
-    newnode->next = (*l);
-   *l = newnode;
-  }
+  unsigned h = 2166136261U;
+  unsigned char *s = key;
+
+  while (len-- > 0) h = (h^*s++)*16777619;
+
+  return h&(TT.hashsize-1);
 }
 
-// Hashing of IP address.
-static int haship( char *addr)
+// The binary address in a sockaddr, and its length.
+static unsigned char *peer_addr(char *sa, int *len)
 {
-  uint32_t ip[8] = {0,};
-  int count = 0, i = 0;
-
-  if (!addr) error_exit("NULL ip");
-  while (i < strlen(addr)) {
-    while (addr[i] && (addr[i] != ':') && (addr[i] != '.')) {
-      ip[count] = ip[count]*10 + (addr[i]-'0');
-      i++;
-    }
-    if (i >= strlen(addr)) break;
-    count++;
-    i++;
+  if (((struct sockaddr *)sa)->sa_family == AF_INET6) {
+    *len = 16;
+    return (void *)(sa + offsetof(struct sockaddr_in6, sin6_addr));
   }
-  return (ip[0]^ip[1]^ip[2]^ip[3]^ip[4]^ip[5]^ip[6]^ip[7])%HASH_NR;
+  *len = 4;
+
+  return (void *)(sa + offsetof(struct sockaddr_in, sin_addr));
 }
 
-// Remove a node from the list.
-static char *delete(struct list_pid **pids, int pid)
+static struct tcpsvd_peer *peer_find(char *sa)
 {
-  struct list_pid *prev, *free_node, *head = *pids; 
-  char *ip = NULL;
- 
-  if (!head) return NULL;
-  prev = free_node = NULL;
-  while (head) {
-    if (head->pid == pid) {
-      ip = head->ip;
-      free_node = head;
-      if (!prev) *pids = head->next;
-      else prev->next = head->next;
-      free(free_node);
-      return ip;
-    }
-    prev = head;
-    head = head->next;
-  }
-  return NULL;
+  struct tcpsvd_peer *p;
+  unsigned char *addr;
+  int len;
+
+  addr = peer_addr(sa, &len);
+  for (p = TT.peers[tcpsvd_hash(addr, len)]; p; p = p->next)
+    if (p->len == len && !memcmp(p->addr, addr, len)) break;
+
+  return p;
 }
 
-// decrement the ref count fora connection, if count reches ZERO then remove the node
-static void remove_connection(char *ip)
+// Count a connection from sa, adding its address if it's new. Finished
+// connections and addresses are kept on free lists for the next ones.
+static struct tcpsvd_peer *peer_get(char *sa)
 {
-  struct list *head, *prev = NULL, *free_node = NULL;
-  int hash = haship(ip);
-
-  head = h[hash].head;
-  while (head) {
-    if (!strcmp(ip, head->d)) {
-      head->count--;
-      free_node = head;
-      if (!head->count) {
-        if (!prev) h[hash].head = head->next;
-        else prev->next = head->next;
-        free(free_node);
-      }
-      break;
-    }
-    prev = head;
-    head = head->next;
+  struct tcpsvd_peer *p = peer_find(sa), **pp;
+  unsigned char *addr;
+
+  if (!p) {
+    if ((p = TT.free_peers)) TT.free_peers = p->next;
+    else p = xmalloc(sizeof(*p));
+    addr = peer_addr(sa, &p->len);
+    memcpy(p->addr, addr, p->len);
+    p->count = 0;
+    pp = TT.peers + tcpsvd_hash(addr, p->len);
+    p->next = *pp;
+    *pp = p;
   }
-  free(ip);
+  p->count++;
+
+  return p;
 }
 
-// Handler function.
-static void handle_exit(int sig)
+static void peer_put(struct tcpsvd_peer *p)
+{
+  struct tcpsvd_peer **pp;
+
+  if (--p->count) return;
+  for (pp = TT.peers+tcpsvd_hash(p->addr, p->len); *pp != p; pp = &(*pp)->next);
+  *pp = p->next;
+  p->next = TT.free_peers;
+  TT.free_peers = p;
+}
+
+static void conn_add(long id, int pid, struct tcpsvd_peer *peer)
 {
-  int status;
-  pid_t pid_n = wait(&status);
+  struct tcpsvd_conn *c, **cc = TT.conns + tcpsvd_hash(&id, sizeof(id));
+
+  if ((c = TT.free_conns)) TT.free_conns = c->next;
+  else c = xmalloc(sizeof(*c));
+  c->id = id;
+  c->pid = pid;
+  c->peer = peer;
+  c->next = *cc;
+  *cc = c;
+}
 
-  if (pid_n <= 0) return;
-  char *ip = delete(&pids, pid_n);
-  if (!ip) return;
-  remove_connection(ip);
+// A connection finished: drop it from the tables and the counts.
+static void conn_end(long id, int status)
+{
+  struct tcpsvd_conn *c, **cc = TT.conns + tcpsvd_hash(&id, sizeof(id));
+
+  for (; (c = *cc); cc = &c->next) if (c->id == id) break;
+  if (!c) return;
+  *cc = c->next;
+  if (c->peer) peer_put(c->peer);
+  c->next = TT.free_conns;
+  TT.free_conns = c;
   TT.count_all--;
   if (toys.optflags & FLAG_v) {
     if (WIFEXITED(status))
-      xprintf("%s: end %d exit %d\n",toys.which->name, pid_n, WEXITSTATUS(status));
+      xprintf("%s: end %d exit %d\n",toys.which->name, c->pid, WEXITSTATUS(status));
     else if (WIFSIGNALED(status))
-      xprintf("%s: end %d signaled %d\n",toys.which->name, pid_n, WTERMSIG(status));
+      xprintf("%s: end %d signaled %d\n",toys.which->name, c->pid, WTERMSIG(status));
     if (TT.cn > 1) xprintf("%s: status %d/%d\n",toys.which->name, TT.count_all, TT.cn);
   }
 }
 
+// Children exiting are reaped from the main loop: tell it through the same
+// pipe in-process commands report on, with a NULL.
+static void handle_exit(int sig)
+{
+  void *none = 0;
+  int err = errno;
+
+  write(TT.notify[1], &none, sizeof(none));
+  errno = err;
+}
+
+// Collect every connection that has finished.
+static void reap(void)
+{
+  void *done[64];
+  pid_t pid;
+  int len, i, status;
+
+  while (0 < (len = read(TT.notify[0], done, sizeof(done)))) {
+    for (i = 0; i < len/sizeof(*done); i++) {
+      if (!done[i]) {
+        while (0 < (pid = waitpid(-1, &status, WNOHANG))) conn_end(pid, status);
+#if CFG_TOYBOX_THREADS
+      } else {
+        status = toy_thread_join(done[i]);
+        conn_end((long)done[i], (status&255)<<8);
+#endif
+      }
+    }
+  }
+}
+
 // Grab uid and gid 
 static void get_uidgid(uid_t *uid, gid_t *gid, char *ug)
 {
@@ -266,14 +303,20 @@ void tcpsvd_main(void)
   gid_t gid = 0;
   pid_t pid;
   char haddr[sizeof(struct sockaddr_in6)];
-  struct list *head, *newnode;
-  int hash, fd, newfd, j;
-  char *ptr = NULL, *addr, *server, buf[sizeof(struct sockaddr_in6)];
-  socklen_t len = sizeof(buf);
+  struct tcpsvd_peer *peer;
+  struct pollfd pfd[2];
+  int fd, newfd;
+  char *ptr = NULL, *server, buf[sizeof(struct sockaddr_in6)];
+  socklen_t len;
+#if CFG_TOYBOX_THREADS
+  struct toy_list *toy = 0;
+  struct toy_thread *tt;
+  int out;
+#endif
 
   TT.udp = (*toys.which->name == 'u');
   if (TT.udp) toys.optflags &= ~FLAG_C;
-  memset(buf, 0, len);
+  memset(buf, 0, sizeof(buf));
   if (toys.optflags & FLAG_C) {
     if ((ptr = strchr(TT.nmsg, ':'))) {
       *ptr = '\0';
@@ -281,7 +324,7 @@ void tcpsvd_main(void)
     }
     TT.maxc = atolx_range(TT.nmsg, 1, INT_MAX);
   }
-  
+
   fd = create_bind_sock(toys.optargs[0], (struct sockaddr*)&haddr);
   if(toys.optflags & FLAG_u) {
     get_uidgid(&uid, &gid, TT.user);
@@ -298,58 +341,95 @@ void tcpsvd_main(void)
     else 
       xprintf("%s: listening on %s, starting\n", toys.which->name, server);
   }
-  for (j = 0; j < HASH_NR; j++) h[j].head = NULL;
+
+  // There are never more than -c connections (or addresses) to look up,
+  // so size the hashes for that up front: a chain is rarely longer than 1.
+  for (TT.hashsize = 16; TT.hashsize < 2*TT.cn && TT.hashsize < (1<<24);)
+    TT.hashsize *= 2;
+  TT.peers = xzalloc(TT.hashsize*sizeof(*TT.peers));
+  TT.conns = xzalloc(TT.hashsize*sizeof(*TT.conns));
+
+  // Finished connections are reported down this pipe, see reap().
+  if (pipe(TT.notify)) perror_exit("pipe");
+  for (newfd = 0; newfd < 2; newfd++) {
+    fcntl(TT.notify[newfd], F_SETFD, FD_CLOEXEC);
+    fcntl(TT.notify[newfd], F_SETFL, O_NONBLOCK);
+  }
   sigatexit(handle_signal);  
   signal(SIGCHLD, handle_exit);
 
+  // A toy command with no environment to set up can run in one of our
+  // threads, rather than costing a fork and exec per connection. That needs
+  // it to have stdio of its own, see toy_thread_start().
+#if CFG_TOYBOX_THREADS
+  if (TOYBOX_TASK_STDIO && (toys.optflags & FLAG_E))
+    toy = toy_find(toys.optargs[2]);
+#endif
+
   while (1) {
-    if (TT.count_all  < TT.cn) {
-      if (TT.udp) {
-        if(recvfrom(fd, NULL, 0, MSG_PEEK, (struct sockaddr *)buf, &len) < 0)
-          perror_exit("recvfrom");
-        newfd = fd;
-      } else {
-        newfd = accept(fd, (struct sockaddr *)buf, &len);
-        if (newfd < 0) perror_exit("Error on accept");
-      }
+    // Stop accepting while there are -c connections, they can queue up.
+    pfd[0].fd = TT.notify[0];
+    pfd[1].fd = fd;
+    pfd[0].events = pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    if (0 > poll(pfd, 1+(TT.count_all < TT.cn), -1)) {
+      if (errno == EINTR) continue;
+      perror_exit("poll");
+    }
+    if (pfd[0].revents) reap();
+    if (!pfd[1].revents || TT.count_all >= TT.cn) continue;
+
+    len = sizeof(buf);
+    if (TT.udp) {
+      if(recvfrom(fd, NULL, 0, MSG_PEEK, (struct sockaddr *)buf, &len) < 0)
+        perror_exit("recvfrom");
+      newfd = fd;
     } else {
-      sigset_t ss;
-      sigemptyset(&ss);
-      sigsuspend(&ss);
-      continue;
+      newfd = accept(fd, (struct sockaddr *)buf, &len);
+      if (newfd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        perror_exit("Error on accept");
+      }
     }
-    TT.count_all++;
-    addr = sock_to_address((struct sockaddr*)buf, NI_NUMERICHOST);
 
-    hash = haship(addr);
+    peer = 0;
     if (toys.optflags & FLAG_C) {
-      for (head = h[hash].head; head; head = head->next)
-        if (!strcmp(head->d, addr)) break;
-
-      if (head && head->count >= TT.maxc) {
+      if ((peer = peer_find(buf)) && peer->count >= TT.maxc) {
         if (ptr) write(newfd, ptr, strlen(ptr)+1);
         close(newfd);
-        TT.count_all--;
         continue;
       }
+      peer = peer_get(buf);
     }
+    TT.count_all++;
 
-    newnode = (struct list*)xzalloc(sizeof(struct list));
-    newnode->d = addr;
-    for (head = h[hash].head; head; head = head->next) {
-      if (!strcmp(addr, head->d)) {
-        head->count++;
-        free(newnode);
-        break;
+#if CFG_TOYBOX_THREADS
+    if (toy && (!TT.udp || !connect(newfd, (struct sockaddr *)buf, len))) {
+      tt = 0;
+      if (-1 != (out = dup(newfd))
+          && (tt = toy_thread_start(toy, toys.optargs+2, newfd, out))) {
+        fcntl(out, F_SETFD, FD_CLOEXEC);
+        conn_add((long)tt, pid = -++TT.seq, peer);
+        if (toys.optflags & FLAG_v) {
+          char *client = sock_to_address((struct sockaddr*)buf,
+            NI_NUMERICHOST | NI_NUMERICSERV);
+
+          xprintf("%s: start %d %s-%s\n",toys.which->name, pid, server, client);
+          if (TT.cn > 1)
+            xprintf("%s: status %d/%d\n",toys.which->name, TT.count_all, TT.cn);
+          free(client);
+        }
+        toy_thread_notify(tt, TT.notify[1]);
+        if (TT.udp) fd = create_bind_sock(toys.optargs[0],
+            (struct sockaddr*)&haddr);
+        continue;
       }
+      if (out != -1) close(out);
     }
+#endif
 
-    if (!head) {
-      newnode->next = h[hash].head;
-      h[hash].head = newnode;
-      h[hash].head->count++;
-    }
-
+    // Don't leave buffered -v output for the child to send down the socket.
+    xflush();
     if (!(pid = xfork())) {
       char *serv = NULL, *clie = NULL;
       char *client = sock_to_address((struct sockaddr*)buf, NI_NUMERICHOST | NI_NUMERICSERV);
@@ -388,13 +468,18 @@ void tcpsvd_main(void)
       if (TT.udp && (connect(newfd, (struct sockaddr *)buf, sizeof(buf)) < 0))
           perror_exit("connect");
 
+      xflush();
       close(0);
       close(1);
       dup2(newfd, 0);
       dup2(newfd, 1);
       xexec(toys.optargs+2); //skip IP PORT
+
+      // A toy command ran here instead of exec()ing: don't go on to serve.
+      fflush(0);
+      _exit(toys.exitval);
     } else {
-      insert(&pids, pid, addr);
+      conn_add(pid, pid, peer);
       xclose(newfd); //close and reopen for next client.
       if (TT.udp) fd = create_bind_sock(toys.optargs[0],
           (struct sockaddr*)&haddr);
@@ -25,6 +25,7 @@ config TELNETD
 #define FOR_telnetd
 #include "toys.h"
 #include <utmp.h>
+#include <sys/uio.h>
 GLOBALS(
     char *login_path;
     char *issue_path;
@@ -32,8 +33,9 @@ GLOBALS(
     char *host_addr;
     long w_sec;
 
-    int gmax_fd;
     pid_t fork_pid;
+    int sessions, pfdsize, sigpipe[2];
+    struct pollfd *pfd;
 )
 
 
@@ -50,15 +52,26 @@ GLOBALS(
 # define TELOPT_TTYPE 24  /* terminal type */
 # define TELOPT_NAWS  31  /* window size */
 
-#define BUFSIZE 4*1024
+// Each direction of a session is a ring buffer: pty output with IACs
+// doubled waiting for the socket, and client input with the telnet
+// commands taken out waiting for the pty.
+#define BUFSIZE (4*1024)
+struct ring {
+  unsigned head, len;
+  char buf[BUFSIZE];
+};
+
+// Where the client input parser is, kept across reads so a command can
+// be split between packets.
+enum {TS_DATA, TS_CR, TS_IAC, TS_OPT, TS_SB, TS_SBIAC};
+
 struct term_session {
+  struct term_session *next;
   int new_fd, pty_fd;
   pid_t child_pid;
-  int buff1_avail, buff2_avail;
-  int buff1_written, buff2_written;
-  int rem;  //unprocessed data from socket
-  char buff1[BUFSIZE], buff2[BUFSIZE];
-  struct term_session *next;
+  unsigned char state, sblen;
+  unsigned char sb[8];
+  struct ring to_net, to_pty;
 };
 
 struct term_session *session_list = NULL;
@@ -149,7 +162,7 @@ static int listen_socket(void)
     perror_exit("bind");
   }
 
-  if (listen(s, 1) < 0) perror_exit("listen");
+  if (listen(s, 32) < 0) perror_exit("listen");
   return s;
 }
 
@@ -206,108 +219,164 @@ static int new_session(int sockfd)
   exit(EXIT_FAILURE);
 }
 
-static int handle_iacs(struct term_session *tm, int c, int fd)
+static void ring_put(struct ring *r, char *s, unsigned len)
 {
-  char *curr ,*start,*end;
-  int i = 0;
-
-  curr = start = tm->buff2+tm->buff2_avail; 
-  end = tm->buff2 + c -1;
-  tm->rem = 0;
-  while (curr <= end) {
-    if (*curr != IAC){
-
-      if (*curr != '\r') {
-        toybuf[i++] = *curr++;
-        continue;
-      } else {
-        toybuf[i++] = *curr++;
-        curr++;
-        if (curr < end && (*curr == '\n' || *curr == '\0')) 
-          curr++;
-        continue;
-      }
-    }
+  unsigned tail = (r->head + r->len) % BUFSIZE, n = BUFSIZE - tail;
 
-    if ((curr + 1) > end) {
-      tm->rem = 1;
-      break; 
-    }
-    if (*(curr+1) == IAC) { //IAC as data --> IAC IAC
-      toybuf[i++] = *(curr+1);
-      curr += 2; //IAC IAC --> 2 bytes
-      continue;
-    }
-    if (*(curr + 1) == NOP || *(curr + 1) == SE) {
-      curr += 2;
+  if (n > len) n = len;
+  memcpy(r->buf + tail, s, n);
+  memcpy(r->buf, s + n, len - n);
+  r->len += len;
+}
+
+// Write out as much of the ring as fd takes, returns <0 on error.
+static int ring_write(int fd, struct ring *r)
+{
+  struct iovec iov[2];
+  unsigned n = BUFSIZE - r->head;
+  int w;
+
+  if (n > r->len) n = r->len;
+  iov[0].iov_base = r->buf + r->head;
+  iov[0].iov_len = n;
+  iov[1].iov_base = r->buf;
+  iov[1].iov_len = r->len - n;
+  if ((w = writev(fd, iov, 1 + !!iov[1].iov_len)) < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+  r->head = (r->head + w) % BUFSIZE;
+  if (!(r->len -= w)) r->head = 0;
+
+  return w;
+}
+
+// Pass client input on to the pty, acting on and dropping telnet commands.
+// Plain data is copied a run at a time, up to the next IAC or CR.
+static void handle_iacs(struct term_session *tm, char *s, int len)
+{
+  struct winsize ws;
+  char *iac, *cr;
+  int c, n;
+
+  while (len) {
+    if (tm->state == TS_DATA) {
+      cr = memchr(s, '\r', (iac = memchr(s, IAC, len)) ? iac - s : len);
+      n = cr ? cr + 1 - s : iac ? iac - s : len;
+      ring_put(&tm->to_pty, s, n);
+      if (cr) tm->state = TS_CR;
+      else if (iac) tm->state = TS_IAC, n++;
+      s += n;
+      len -= n;
       continue;
     }
 
-    if (*(curr + 1) == SB ) {
-      if (*(curr+2) == TELOPT_NAWS) {
-        struct winsize ws;
-        if ((curr+8) >= end) {  //ensure we have data to process.
-          tm->rem = end - curr; 
-          break;  
+    c = *(unsigned char *)s++;
+    len--;
+    switch (tm->state) {
+    // CR LF and CR NUL are both just CR, the pty's icrnl does the rest.
+    case TS_CR:
+      tm->state = TS_DATA;
+      if (c && c != '\n') s--, len++;
+      break;
+    case TS_IAC:
+      tm->state = TS_DATA;
+      if (c == IAC) ring_put(&tm->to_pty, s - 1, 1);
+      else if (c == SB) tm->state = TS_SB, tm->sblen = 0;
+      else if (c >= WILL && c <= DONT) tm->state = TS_OPT;
+      break;
+    case TS_OPT:
+      tm->state = TS_DATA;
+      break;
+    case TS_SB:
+      if (c == IAC) tm->state = TS_SBIAC;
+      else if (tm->sblen < sizeof(tm->sb)) tm->sb[tm->sblen++] = c;
+      break;
+    case TS_SBIAC:
+      tm->state = TS_SB;
+      if (c == IAC) {
+        if (tm->sblen < sizeof(tm->sb)) tm->sb[tm->sblen++] = c;
+      } else if (c == SE) {
+        tm->state = TS_DATA;
+        if (*tm->sb == TELOPT_NAWS && tm->sblen >= 5) {
+          memset(&ws, 0, sizeof(ws));
+          ws.ws_col = (tm->sb[1] << 8) | tm->sb[2];
+          ws.ws_row = (tm->sb[3] << 8) | tm->sb[4];
+          ioctl(tm->pty_fd, TIOCSWINSZ, &ws);
         }
-        ws.ws_col = (curr[3] << 8) | curr[4];
-        ws.ws_row = (curr[5] << 8) | curr[6];
-        ioctl(fd, TIOCSWINSZ, (char *)&ws);
-        curr += 9;
-        continue;
-      } else { //eat non-supported sub neg. options.
-        curr++, tm->rem++;
-        while (*curr != IAC && curr <= end) {
-          curr++;
-          tm->rem++;
-        } 
-        if (*curr == IAC) {
-          tm->rem = 0;
-          continue;
-        } else break;
       }
+      break;
     }
-    curr += 3; //skip non-supported 3 bytes.
   }
-  memcpy(start, toybuf, i);
-  memcpy(start + i, end - tm->rem, tm->rem); //put remaining if we break;
-  return i;
 }
 
-static int dup_iacs(char *start, int fd, int len)
+// Queue pty output for the client, with any IAC in it sent as IAC IAC.
+static void dup_iacs(struct term_session *tm, char *s, int len)
 {
-  char arr[] = {IAC, IAC};
-  char *needle = NULL;
-  int ret = 0, c, count = 0;
+  char *iac;
+  int n;
 
   while (len) {
-    if (*start == IAC) {
-      count = writeall(fd, arr, sizeof(arr));
-      if (count != 2) break; //short write
-      start++;
-      ret++;
-      len--;
-      continue;
-    }
-    needle = memchr(start, IAC, len);
-    if (needle) c = needle - start;
-    else c = len;
-    count = writeall(fd, start, c);
-    if (count < 0) break; 
-    len -= count;
-    ret += count;
-    start += count;
+    n = (iac = memchr(s, IAC, len)) ? iac + 1 - s : len;
+    ring_put(&tm->to_net, s, n);
+    if (iac) ring_put(&tm->to_net, iac, 1);
+    s += n;
+    len -= n;
   }
-  return ret;
+}
+
+// Move what can be moved each way, returns 0 once either end has gone.
+static int pump_session(struct term_session *tm, struct pollfd *pfd)
+{
+  int out = tm->new_fd + !!(toys.optflags & FLAG_i), c;
+
+  if (pfd[0].revents & POLLIN) {
+    // Doubling every IAC could at worst need twice what was read.
+    c = (BUFSIZE - tm->to_net.len)/2;
+    if ((c = read(tm->pty_fd, toybuf, c)) <= 0) {
+      if (!c || (errno != EAGAIN && errno != EINTR)) return 0;
+    } else dup_iacs(tm, toybuf, c);
+  } else if (pfd[0].revents & (POLLHUP|POLLERR)) return 0;
+  if (pfd[1].revents & POLLIN) {
+    c = BUFSIZE - tm->to_pty.len;
+    if ((c = read(tm->new_fd, toybuf, c)) <= 0) {
+      if (!c || (errno != EAGAIN && errno != EINTR)) return 0;
+    } else handle_iacs(tm, toybuf, c);
+  } else if (pfd[1].revents & (POLLHUP|POLLERR)) return 0;
+
+  // Try the writes straight away rather than waiting to be told they'd fit.
+  if (tm->to_pty.len && ring_write(tm->pty_fd, &tm->to_pty) < 0) return 0;
+  if (tm->to_net.len && ring_write(out, &tm->to_net) < 0) return 0;
+
+  return 1;
+}
+
+static void add_session(int new_fd, int pty_fd)
+{
+  struct term_session *tm = xzalloc(sizeof(struct term_session));
+
+  tm->child_pid = TT.fork_pid;
+  tm->new_fd = new_fd;
+  tm->pty_fd = pty_fd;
+  tm->next = session_list;
+  session_list = tm;
+  TT.sessions++;
+}
+
+// A session's descriptors close when either end goes away, its entry
+// goes when the login child is reaped.
+static void end_session(struct term_session *tm)
+{
+  if (tm->pty_fd < 0) return;
+  close(tm->pty_fd);
+  close(tm->new_fd);
+  tm->pty_fd = tm->new_fd = -1;
 }
 
 void telnetd_main(void)
 {
   errno = 0;
-  fd_set rd, wr;
-  struct term_session *tm = NULL;
-  struct timeval tv, *tv_ptr = NULL;
-  int pty_fd, new_fd, c = 0, w, master_fd = 0;
+  struct term_session *tm, **tt;
+  struct pollfd *pfd;
+  int pty_fd, new_fd, n, polled, master_fd = 0, timeout = -1;
   int inetd_m = toys.optflags & FLAG_i;
 
   if (!(toys.optflags & FLAG_l)) TT.login_path = "/bin/login";
@@ -316,131 +385,88 @@ void telnetd_main(void)
   if (!inetd_m) {
     master_fd = listen_socket();
     fcntl(master_fd, F_SETFD, FD_CLOEXEC);
-    if (master_fd > TT.gmax_fd) TT.gmax_fd = master_fd;
-    if (!(toys.optflags & FLAG_F)) daemon(0, 0); 
+    fcntl(master_fd, F_SETFL, O_NONBLOCK);
+    if (!(toys.optflags & FLAG_F)) daemon(0, 0);
   } else {
     pty_fd = new_session(master_fd); //master_fd = 0
-    if (pty_fd > TT.gmax_fd) TT.gmax_fd = pty_fd;
-    tm = xzalloc(sizeof(struct term_session));
-    tm->child_pid = TT.fork_pid;
-    tm->new_fd = 0;    
-    tm->pty_fd = pty_fd;    
-    if (session_list) {     
-      tm->next = session_list;
-      session_list = tm;    
-    } else session_list = tm;
+    add_session(0, pty_fd);
   }
 
-  if ((toys.optflags & FLAG_w) && !session_list) {
-    tv.tv_sec = TT.w_sec;
-    tv.tv_usec = 0;
-    tv_ptr = &tv;
-  }                
+  if ((toys.optflags & FLAG_w) && !session_list) timeout = TT.w_sec*1000;
+
+  // Children exiting wake the poll up through this pipe.
+  if (pipe(TT.sigpipe)) perror_exit("pipe");
+  fcntl(TT.sigpipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(TT.sigpipe[1], F_SETFL, O_NONBLOCK);
+  toys.signalfd = TT.sigpipe[1];
   signal(SIGCHLD, generic_signal);
 
   for (;;) {
-    FD_ZERO(&rd);
-    FD_ZERO(&wr);
-    if (!inetd_m) FD_SET(master_fd, &rd);
-
-    tm = session_list;
-    while (tm) {
-
-      if (tm->pty_fd > 0 && tm->buff1_avail < BUFSIZE) FD_SET(tm->pty_fd, &rd);
-      if (tm->new_fd >= 0 && tm->buff2_avail < BUFSIZE) FD_SET(tm->new_fd, &rd);
-      if (tm->pty_fd > 0 && (tm->buff2_avail - tm->buff2_written) > 0)  
-        FD_SET(tm->pty_fd, &wr);
-      if (tm->new_fd >= 0 && (tm->buff1_avail - tm->buff1_written) > 0)  
-        FD_SET(tm->new_fd, &wr);
-      tm = tm->next;
+    // Each session gets its pty, the socket, and (if it differs) the
+    // socket's write side, after the signal pipe and listener.
+    if (TT.pfdsize < 3*TT.sessions + 2) {
+      TT.pfdsize = 3*TT.sessions + 34;
+      TT.pfd = xrealloc(TT.pfd, TT.pfdsize * sizeof(*TT.pfd));
     }
-
-
-    int r = select(TT.gmax_fd + 1, &rd, &wr, NULL, tv_ptr);
-    if (!r) return; //timeout
-    if (r < -1) continue;
-
-    if (!inetd_m && FD_ISSET(master_fd, &rd)) { //accept new connection
-      new_fd = accept(master_fd, NULL, NULL);
-      if (new_fd < 0) continue;
-      tv_ptr = NULL;
-      fcntl(new_fd, F_SETFD, FD_CLOEXEC);
-      if (new_fd > TT.gmax_fd) TT.gmax_fd = new_fd;
-      pty_fd = new_session(new_fd);
-      if (pty_fd > TT.gmax_fd) TT.gmax_fd = pty_fd;
-
-      tm = xzalloc(sizeof(struct term_session));
-      tm->child_pid = TT.fork_pid;
-      tm->new_fd = new_fd;
-      tm->pty_fd = pty_fd;
-      if (session_list) {
-        tm->next = session_list;
-        session_list = tm;
-      } else session_list = tm;
+    pfd = TT.pfd;
+    pfd[0].fd = TT.sigpipe[0];
+    pfd[0].events = POLLIN;
+    pfd[1].fd = inetd_m ? -1 : master_fd;
+    pfd[1].events = POLLIN;
+    for (n = 2, tm = session_list; tm; tm = tm->next, n += 3) {
+      pfd[n].fd = tm->pty_fd;
+      pfd[n].events = 0;
+      pfd[n+1].fd = tm->new_fd;
+      pfd[n+1].events = 0;
+      pfd[n+2].fd = -1;
+      pfd[n+2].events = POLLOUT;
+      if (tm->pty_fd < 0) continue;
+      if (tm->to_net.len <= BUFSIZE - 2) pfd[n].events |= POLLIN;
+      if (tm->to_pty.len < BUFSIZE) pfd[n+1].events |= POLLIN;
+      if (tm->to_pty.len) pfd[n].events |= POLLOUT;
+      if (tm->to_net.len) {
+        if (inetd_m) pfd[n+2].fd = 1;
+        else pfd[n+1].events |= POLLOUT;
+      }
     }
 
-    tm = session_list;
-    for (;tm;tm=tm->next) {
-      if (FD_ISSET(tm->pty_fd, &rd)) {
-        if ((c = read(tm->pty_fd, tm->buff1 + tm->buff1_avail,
-                BUFSIZE-tm->buff1_avail)) <= 0) break;
-        tm->buff1_avail += c;
-        if ((w = dup_iacs(tm->buff1 + tm->buff1_written, tm->new_fd + inetd_m,
-                tm->buff1_avail - tm->buff1_written)) < 0) break;
-        tm->buff1_written += w;
-      }
-      if (FD_ISSET(tm->new_fd, &rd)) {
-        if ((c = read(tm->new_fd, tm->buff2+tm->buff2_avail,
-                BUFSIZE-tm->buff2_avail)) <= 0) break;
-        c = handle_iacs(tm, c, tm->pty_fd);
-        tm->buff2_avail += c;
-        if ((w = write(tm->pty_fd, tm->buff2+ tm->buff2_written, 
-                tm->buff2_avail - tm->buff2_written)) < 0) break;
-        tm->buff2_written += w;
-      }
-      if (FD_ISSET(tm->pty_fd, &wr)) {
-        if ((w = write(tm->pty_fd,  tm->buff2 + tm->buff2_written, 
-                tm->buff2_avail - tm->buff2_written)) < 0) break;
-        tm->buff2_written += w;
-      }
-      if (FD_ISSET(tm->new_fd, &wr)) {
-        if ((w = dup_iacs(tm->buff1 + tm->buff1_written, tm->new_fd + inetd_m,
-                tm->buff1_avail - tm->buff1_written)) < 0) break;
-        tm->buff1_written += w;
+    if (!xpoll(pfd, n, timeout)) return; //timeout
+    polled = TT.sessions;
+
+    // Accept every waiting connection.
+    if (pfd[1].revents & POLLIN) {
+      while ((new_fd = accept(master_fd, NULL, NULL)) >= 0) {
+        timeout = -1;
+        fcntl(new_fd, F_SETFD, FD_CLOEXEC);
+        pty_fd = new_session(new_fd);
+        add_session(new_fd, pty_fd);
       }
-      if (tm->buff1_written == tm->buff1_avail)
-        tm->buff1_written = tm->buff1_avail = 0;
-      if (tm->buff2_written == tm->buff2_avail)
-        tm->buff2_written = tm->buff2_avail = 0;
-      fflush(NULL);
     }
 
-    // Loop to handle (unknown number of) SIGCHLD notifications
-    while (toys.signal) {
-      int status;
-      struct term_session *prev = NULL;
-      pid_t pid;
+    // New sessions went on the front of the list and weren't polled.
+    for (tm = session_list, n = TT.sessions; n > polled; n--) tm = tm->next;
+    for (n = 2; tm; tm = tm->next, n += 3)
+      if (tm->pty_fd >= 0 && !pump_session(tm, pfd+n)) end_session(tm);
 
-      // funny little dance to avoid race conditions.
-      toys.signal = 0;
-      pid = waitpid(-1, &status, WNOHANG);
-      if (pid < 0) break;
-      toys.signal++;
+    if (!(pfd[0].revents & POLLIN)) continue;
+    while (read(TT.sigpipe[0], toybuf, sizeof(toybuf)) > 0);
 
+    // Reap every child that's exited, closing and freeing its session.
+    for (;;) {
+      int status;
+      pid_t pid = waitpid(-1, &status, WNOHANG);
 
-      for (tm = session_list; tm; tm = tm->next) {
+      if (pid <= 0) break;
+      for (tt = &session_list; (tm = *tt); tt = &tm->next)
         if (tm->child_pid == pid) break;
-        prev = tm;
-      }
-      if (!tm) return; // reparented child we don't care about
+      if (!tm) continue; // reparented child we don't care about
 
       if (toys.optflags & FLAG_i) exit(EXIT_SUCCESS);
-      if (!prev) session_list = session_list->next;
-      else prev->next = tm->next;
+      *tt = tm->next;
       utmp_entry();
-      xclose(tm->pty_fd);
-      xclose(tm->new_fd);
+      end_session(tm);
       free(tm);
+      TT.sessions--;
     }
   }
 }
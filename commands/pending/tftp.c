@@ -5,7 +5,7 @@
  *
  * No Standard.
 
-USE_TFTP(NEWTOY(tftp, "<1b#<8>65464r:l:g|p|[!gp]", TOYFLAG_USR|TOYFLAG_BIN))
+USE_TFTP(NEWTOY(tftp, "<1w#<1>65535=1b#<8>65464=512r:l:g|p|[!gp]", TOYFLAG_USR|TOYFLAG_BIN))
 
 config TFTP
   bool "tftp"
@@ -20,6 +20,7 @@ config TFTP
     -g    Get file
     -p    Put file
     -b SIZE Transfer blocks of SIZE octets(8 <= SIZE <= 65464)
+    -w NUM  Send NUM blocks per ACK (1 <= NUM <= 65535)
 */
 #define FOR_tftp
 #include "toys.h"
@@ -28,18 +29,18 @@ GLOBALS(
   char *local_file;
   char *remote_file;
   long block_size;
+  long window_size;
 
   struct sockaddr_storage inaddr;
   int af;
 )
 
 #define TFTP_BLKSIZE    512
-#define TFTP_RETRIES    3
+#define TFTP_RETRIES    5
+#define TFTP_TIMEOUT    1000  // ms before the first resend, doubled each retry
 #define TFTP_DATAHEADERSIZE 4
-#define TFTP_MAXPACKETSIZE  (TFTP_DATAHEADERSIZE + TFTP_BLKSIZE)
-#define TFTP_PACKETSIZE    TFTP_MAXPACKETSIZE
-#define TFTP_DATASIZE    (TFTP_PACKETSIZE-TFTP_DATAHEADERSIZE)
-#define TFTP_IOBUFSIZE    (TFTP_PACKETSIZE+8)
+// A sent window stays buffered until it's acked, so cap its size in bytes.
+#define TFTP_WINDOWBYTES  (1<<23)
 
 #define TFTP_OP_RRQ      1  /* Read Request      RFC 1350, RFC 2090 */
 #define TFTP_OP_WRQ      2  /* Write Request     RFC 1350 */
@@ -48,8 +49,9 @@ GLOBALS(
 #define TFTP_OP_ERR      5  /* Error Message     RFC 1350 */
 #define TFTP_OP_OACK    6  /* Option acknowledgment RFC 2347 */
 
+#define TFTP_ER_FULL    3  /* Disk full or allocation exceeded */
 #define TFTP_ER_ILLEGALOP  4  /* Illegal TFTP operation */
-#define TFTP_ER_UNKID    5  /* Unknown transfer ID */
+#define TFTP_ER_NEGOTIATE  8  /* Terminate transfer due to option negotiation */
 
 #define TFTP_ES_NOSUCHFILE  "File not found"
 #define TFTP_ES_ACCESS    "Access violation"
@@ -63,12 +65,9 @@ GLOBALS(
 // Initializes SERVER with ADDR and returns socket.
 static int init_tftp(struct sockaddr_storage *server)
 {
-  struct timeval to = { .tv_sec = 10, //Time out
-                        .tv_usec = 0 };
   const int set = 1;
   int port = 69, sd = xsocket(TT.af, SOCK_DGRAM, IPPROTO_UDP);
 
-  xsetsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, (void *)&to, sizeof(struct timeval));
   xsetsockopt(sd, SOL_SOCKET, SO_REUSEADDR, (void *)&set, sizeof(set));
 
   if(toys.optc == 2) port = atolx_range(toys.optargs[1], 1, 65535);
@@ -89,23 +88,33 @@ static int init_tftp(struct sockaddr_storage *server)
 }
 
 /*
- * Makes a request packet in BUFFER with OPCODE and file PATH of MODE
- * and returns length of packet.
+ * Makes a request packet in BUFFER with OPCODE for the remote file, asking
+ * for the -b and -w sizes when they aren't the RFC 1350 ones, and TSIZE
+ * (which for a get is 0 asking the server for the size) when it's >= 0.
+ * Returns length of packet.
  */
-static int mkpkt_request(uint8_t *buffer, int opcode, char *path, int mode)
+static int mkpkt_request(char *buffer, int opcode, long long tsize)
 {
+  char *s = buffer + 2;
+
   buffer[0] = opcode >> 8;
   buffer[1] = opcode & 0xff;
-  if(strlen(path) > TFTP_BLKSIZE) error_exit("path too long");
-  return sprintf((char*) &buffer[2], "%s%c%s", path, 0, 
-    (mode ? "octet" : "netascii")) + 3;
+  if(strlen(TT.remote_file) > TFTP_BLKSIZE) error_exit("path too long");
+  s += sprintf(s, "%s%coctet", TT.remote_file, 0) + 1;
+  if (TT.block_size != TFTP_BLKSIZE)
+    s += sprintf(s, "blksize%c%ld", 0, TT.block_size) + 1;
+  if (TT.window_size != 1)
+    s += sprintf(s, "windowsize%c%ld", 0, TT.window_size) + 1;
+  if (tsize >= 0) s += sprintf(s, "tsize%c%lld", 0, tsize) + 1;
+
+  return s - buffer;
 }
 
 /*
  * Makes an acknowledgement packet in BUFFER of BLOCNO
  * and returns packet length.
  */
-static int mkpkt_ack(uint8_t *buffer, uint16_t blockno)
+static int mkpkt_ack(char *buffer, uint16_t blockno)
 {
   buffer[0] = TFTP_OP_ACK >> 8;
   buffer[1] = TFTP_OP_ACK & 0xff;
@@ -118,41 +127,72 @@ static int mkpkt_ack(uint8_t *buffer, uint16_t blockno)
  * Makes an error packet in BUFFER with ERRORCODE and ERRORMSG.
  * and returns packet length.
  */
-static int mkpkt_err(uint8_t *buffer, uint16_t errorcode, char *errormsg)
+static int mkpkt_err(char *buffer, uint16_t errorcode, char *errormsg)
 {
   buffer[0] = TFTP_OP_ERR >> 8;
   buffer[1] = TFTP_OP_ERR & 0xff;
   buffer[2] = errorcode >> 8;
   buffer[3] = errorcode & 0xff;
-  strcpy((char*) &buffer[4], errormsg);
+  strcpy(buffer + 4, errormsg);
   return strlen(errormsg) + 5;
 }
 
+// Report an ERROR packet from the server.
+static void show_err(char *packet)
+{
+  char *message = "DATA Check failure.";
+  char *arr[] = {TFTP_ES_NOSUCHFILE, TFTP_ES_ACCESS, TFTP_ES_FULL,
+    TFTP_ES_ILLEGALOP, TFTP_ES_UNKID, TFTP_ES_EXISTS, TFTP_ES_UNKUSER,
+    TFTP_ES_NEGOTIATE};
+  int code = peek_be(packet + 2, 2);
+
+  if (code && code < 9) message = arr[code - 1];
+  error_msg(message);
+}
+
 /*
- * Recieves data from server in BUFF with socket SD and updates FROM
- * and returns read length.
+ * Waits up to TIMEOUT milliseconds for a packet from the server into BUF
+ * and returns its length, 0 if none came, or -1 on error. The server
+ * answers from a new port (its transfer ID), so until it has, pass SERVER:
+ * packets from other hosts are dropped, and the first one that isn't
+ * records the port and connects the socket to it so the kernel filters the
+ * rest of the transfer.
  */
-static ssize_t read_server(int sd, void *buf, size_t len,
-  struct sockaddr_storage *from)
+static int read_server(int sd, void *buf, size_t len, int timeout,
+  struct sockaddr_storage *server)
 {
+  struct sockaddr_storage from;
+  struct pollfd pfd;
   socklen_t alen;
-  ssize_t nb;
-  
+  int nb;
+
+  pfd.fd = sd;
+  pfd.events = POLLIN;
   for (;;) {
-    memset(buf, 0, len);
-    alen = sizeof(struct sockaddr_storage);
-    nb = recvfrom(sd, buf, len, 0, (struct sockaddr *) from, &alen);
+    if (!(nb = poll(&pfd, 1, timeout))) return 0;
+    if (nb > 0) {
+      alen = sizeof(from);
+      nb = recvfrom(sd, buf, len, 0, (struct sockaddr *)&from, &alen);
+    }
     if (nb < 0) {
-      if (errno == EAGAIN) {
-        perror_msg("server read timed out");
-        return nb;
-      }else if (errno != EINTR) {
-        perror_msg("server read failed");
-        return nb;
-      }
-    }else return nb;
+      if (errno == EINTR) continue;
+      perror_msg("server read failed");
+      return nb;
+    }
+    if (!server) return nb;
+    if ((TT.af == AF_INET6) ? memcmp(&((struct sockaddr_in6 *)server)->sin6_addr,
+          &((struct sockaddr_in6 *)&from)->sin6_addr, sizeof(struct in6_addr))
+        : ((struct sockaddr_in *)server)->sin_addr.s_addr
+          != ((struct sockaddr_in *)&from)->sin_addr.s_addr) {
+      error_msg("Invalid address in DATA.");
+      continue;
+    }
+    memcpy(server, &from, alen);
+    if (connect(sd, (struct sockaddr *)&from, alen))
+      perror_exit("can't connect to remote host");
+
+    return nb;
   }
-  return nb;
 }
 
 /*
@@ -163,7 +203,7 @@ static ssize_t write_server(int sd, void *buf, size_t len,
   struct sockaddr_storage *to)
 {
   ssize_t nb;
-  
+
   for (;;) {
     nb = sendto(sd, buf, len, 0, (struct sockaddr *)to,
             sizeof(struct sockaddr_storage));
@@ -177,247 +217,287 @@ static ssize_t write_server(int sd, void *buf, size_t len,
   return nb;
 }
 
-// checks packet for data and updates block no
-static inline int check_data( uint8_t *packet, uint16_t *opcode, 
-  uint16_t *blockno)
+/*
+ * Applies the server's OACK in PACKET of LEN bytes. It may lower the sizes
+ * we asked for but not raise them or add options we didn't send, which
+ * sends the server an error and returns -1.
+ */
+static int read_oack(int sd, char *packet, int len, long long *tsize,
+  struct sockaddr_storage *server)
 {
-  *opcode = (uint16_t) packet[0] << 8 | (uint16_t) packet[1];
-  if (*opcode == TFTP_OP_DATA) {
-    *blockno = (uint16_t) packet[2] << 8 | (uint16_t) packet[3];
-    return 0;
+  char *s = packet + 2, *val, *end;
+  long blksize = TFTP_BLKSIZE, window = 1;
+  long long n;
+
+  if (packet[len - 1]) len = 0;
+  for (; len && s < packet + len; s = val + strlen(val) + 1) {
+    if ((val = s + strlen(s) + 1) >= packet + len) break;
+    n = strtoll(val, &end, 10);
+    if (*end || !isdigit(*val)) break;
+    if (!strcasecmp(s, "blksize") && n >= 8 && n <= TT.block_size)
+      blksize = n;
+    else if (!strcasecmp(s, "windowsize") && n >= 1 && n <= TT.window_size)
+      window = n;
+    else if (!strcasecmp(s, "tsize") && *tsize >= 0) *tsize = n;
+    else break;
   }
-  return -1;
-}
+  if (!len || s < packet + len) {
+    error_msg("Bad OACK.");
+    len = mkpkt_err(packet, TFTP_ER_NEGOTIATE, TFTP_ES_NEGOTIATE);
+    write_server(sd, packet, len, server);
 
-// Makes data packet through FD from file OFFSET in buffer PACKET of BLOCKNO
-static int mkpkt_data(int fd, off_t offset, uint8_t *packet, uint16_t blockno)
-{
-  off_t tmp;
-  int nbytesread;
-
-  packet[0] = TFTP_OP_DATA >> 8;
-  packet[1] = TFTP_OP_DATA & 0xff;
-  packet[2] = blockno >> 8;
-  packet[3] = blockno & 0xff;
-  tmp = lseek(fd, offset, SEEK_SET);
-  if (tmp == (off_t) -1) {
-    perror_msg("lseek failed");
     return -1;
   }
-  nbytesread = readall(fd, &packet[TFTP_DATAHEADERSIZE], TFTP_DATASIZE);
-  if (nbytesread < 0) return -1;
-  return nbytesread + TFTP_DATAHEADERSIZE;
-}
+  TT.block_size = blksize;
+  TT.window_size = window;
 
-// Receives ACK responses from server and updates blockno
-static int read_ack(int sd, uint8_t *packet, struct sockaddr_storage *server,
-  uint16_t *port, uint16_t *blockno)
-{
-  struct sockaddr_storage from;
-  ssize_t nbytes;
-  uint16_t opcode, rblockno;
-  int packetlen, retry;
-
-  for (retry = 0; retry < TFTP_RETRIES; retry++) {
-    for (;;) {
-      nbytes = read_server(sd, packet, TFTP_IOBUFSIZE, &from);
-      if (nbytes < 4) { // Ack headersize = 4
-        if (nbytes == 0) error_msg("Connection lost.");
-        else if (nbytes > 0) error_msg("Short packet: %d bytes", nbytes);
-        else error_msg("Server read ACK failure.");
-        break;
-      } else {
-        if (!*port) {
-          *port = ((struct sockaddr_in *)&from)->sin_port;
-          ((struct sockaddr_in *)server)->sin_port =
-                  ((struct sockaddr_in *)&from)->sin_port;
-        }
-        if (((struct sockaddr_in *)server)->sin_addr.s_addr !=
-                ((struct sockaddr_in *)&from)->sin_addr.s_addr) {
-          error_msg("Invalid address in DATA.");
-          continue;
-        }
-        if (*port != ((struct sockaddr_in *)server)->sin_port) {
-          error_msg("Invalid port in DATA.");
-          packetlen = mkpkt_err(packet, TFTP_ER_UNKID, TFTP_ES_UNKID);
-          (void) write_server(sd, packet, packetlen, server);
-          continue;
-        }
-        opcode = (uint16_t) packet[0] << 8 | (uint16_t) packet[1];
-        rblockno = (uint16_t) packet[2] << 8 | (uint16_t) packet[3];
-
-        if (opcode != TFTP_OP_ACK) {
-          error_msg("Bad opcode.");
-          if (opcode > 5) {
-            packetlen = mkpkt_err(packet, TFTP_ER_ILLEGALOP, TFTP_ES_ILLEGALOP);
-            (void) write_server(sd, packet, packetlen, server);
-          }
-          break;
-        }
-        if (blockno) *blockno = rblockno;
-        return 0;
-      }
-    }
-  }
-  error_msg("Timeout, Waiting for ACK.");
-  return -1;
+  return 0;
 }
 
 // receives file from server.
 static int file_get(void)
 {
-  struct sockaddr_storage server, from;
-  uint8_t *packet;
-  uint16_t blockno = 0, opcode, rblockno = 0;
-  int len, sd, fd, retry, nbytesrecvd = 0, ndatabytes, ret, result = -1;
+  struct sockaddr_storage server, *peer = &server;
+  char *packet;
+  long long tsize = 0, got = 0, blockno = 0;
+  int len, sd, fd, n, retry = 0, timeout = TFTP_TIMEOUT, count = 0,
+    nacked = 0, done = 0, result = -1, size, rcvbuf;
+  socklen_t alen;
 
   sd = init_tftp(&server);
 
-  packet = (uint8_t*) xzalloc(TFTP_IOBUFSIZE);
+  // Big enough for an OACK or error however small the blocks, and one byte
+  // more than a block to spot oversized ones.
+  size = ((TT.block_size > TFTP_BLKSIZE) ? TT.block_size : TFTP_BLKSIZE)
+    + TFTP_DATAHEADERSIZE + 1;
+  packet = xmalloc(size);
   fd = xcreate(TT.local_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
 
-  len = mkpkt_request(packet, TFTP_OP_RRQ, TT.remote_file, 1);
-  ret = write_server(sd, packet, len, &server);
-  if (ret != len){
-    unlink(TT.local_file);
-    goto errout_with_sd;
-  }
-  if (TT.af == AF_INET6) ((struct sockaddr_in6 *)&server)->sin6_port = 0;
-  else ((struct sockaddr_in *)&server)->sin_port = 0;
-
-  do {
-    blockno++;
-    for (retry = 0 ; retry < TFTP_RETRIES; retry++) {
-      nbytesrecvd = read_server(sd, packet, TFTP_IOBUFSIZE, &from);
-      if (nbytesrecvd > 0) {
-        if ( ((TT.af == AF_INET) &&
-                memcmp(&((struct sockaddr_in *)&server)->sin_addr,
-                &((struct sockaddr_in *)&from)->sin_addr,
-                sizeof(struct in_addr))) ||
-             ((TT.af == AF_INET6) &&
-                memcmp(&((struct sockaddr_in6 *)&server)->sin6_addr,
-                &((struct sockaddr_in6 *)&from)->sin6_addr,
-                sizeof(struct in6_addr)))) {
-          error_msg("Invalid address in DATA.");
-          retry--;
-          continue;
-        }
-        if ( ((TT.af == AF_INET) && ((struct sockaddr_in *)&server)->sin_port
-                && (((struct sockaddr_in *)&server)->sin_port !=
-                ((struct sockaddr_in *)&from)->sin_port)) ||
-             ((TT.af == AF_INET6) && ((struct sockaddr_in6 *)&server)->sin6_port
-                && (((struct sockaddr_in6 *)&server)->sin6_port !=
-                ((struct sockaddr_in6 *)&from)->sin6_port))) {
-          error_msg("Invalid port in DATA.");
-          len = mkpkt_err(packet, TFTP_ER_UNKID, TFTP_ES_UNKID);
-          ret = write_server(sd, packet, len, &from);
-          retry--;
-          continue;
-        }
-        if (nbytesrecvd < TFTP_DATAHEADERSIZE) {
-          error_msg("Tiny data packet ignored.");
-          continue;
+  // Resend the request (in toybuf) until the server answers, then the ACK.
+  len = mkpkt_request(toybuf, TFTP_OP_RRQ, tsize);
+  for (;;) {
+    if (write_server(sd, toybuf, len, &server) != len) goto errout_with_sd;
+    if (done) break;
+
+    for (;;) {
+      n = read_server(sd, packet, size, timeout, peer);
+      if (n < 0) goto errout_with_sd;
+      if (!n) {
+        if (++retry > TFTP_RETRIES) {
+          error_msg("Retry limit exceeded.");
+          goto errout_with_sd;
         }
-        if (check_data(packet, &opcode, &rblockno) != 0
-            || blockno != rblockno) {
-
-        if (opcode == TFTP_OP_ERR) {
-          char *message = "DATA Check failure.";
-            char *arr[] = {TFTP_ES_NOSUCHFILE, TFTP_ES_ACCESS,
-              TFTP_ES_FULL, TFTP_ES_ILLEGALOP,
-              TFTP_ES_UNKID, TFTP_ES_EXISTS,
-              TFTP_ES_UNKUSER, TFTP_ES_NEGOTIATE};
-            if (rblockno && (rblockno < 9)) message = arr[rblockno - 1];
-            error_msg(message);
+        timeout *= 2;
+        count = 0;
+        break;
+      }
+      if (n < TFTP_DATAHEADERSIZE) {
+        error_msg("Tiny data packet ignored.");
+        continue;
+      }
+      if (peek_be(packet, 2) == TFTP_OP_ERR) {
+        show_err(packet);
+        goto errout_with_sd;
+      }
+
+      // The first answer is an OACK, or data if the server ignored options
+      if (peer) {
+        peer = 0;
+        if (peek_be(packet, 2) == TFTP_OP_OACK) {
+          if (read_oack(sd, packet, n, &tsize, &server)) goto errout_with_sd;
+
+          // Room for a whole window in the socket while we write, as far as
+          // the kernel allows. Never shrink it below the default.
+          n = TT.window_size * (TT.block_size + TFTP_DATAHEADERSIZE);
+          alen = sizeof(rcvbuf);
+          if (getsockopt(sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &alen)
+              || rcvbuf < n) setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+          retry = 0;
+          timeout = TFTP_TIMEOUT;
+          len = mkpkt_ack(toybuf, 0);
+          break;
         }
-        if (opcode > 5) {
-          len = mkpkt_err(packet, TFTP_ER_ILLEGALOP, TFTP_ES_ILLEGALOP);
-          ret = write_server(sd, packet, len, &from);
+        TT.block_size = TFTP_BLKSIZE;
+        TT.window_size = 1;
+        tsize = -1;
+        len = mkpkt_ack(toybuf, 0);
+      }
+      if (peek_be(packet, 2) != TFTP_OP_DATA) {
+        if (peek_be(packet, 2) > 6) {
+          n = mkpkt_err(packet, TFTP_ER_ILLEGALOP, TFTP_ES_ILLEGALOP);
+          write_server(sd, packet, n, &server);
         }
         continue;
-        }
-        if ((TT.af == AF_INET6) && !((struct sockaddr_in6 *)&server)->sin6_port)
-          ((struct sockaddr_in6 *)&server)->sin6_port =
-            ((struct sockaddr_in6 *)&from)->sin6_port;
-        else if ((TT.af == AF_INET) && !((struct sockaddr_in *)&server)->sin_port)
-          ((struct sockaddr_in *)&server)->sin_port =
-            ((struct sockaddr_in *)&from)->sin_port;
+      }
+
+      // Ack the last block we have when one goes missing, so the server
+      // restarts its window there (RFC 7440). Once is enough per gap.
+      if (peek_be(packet + 2, 2) != (uint16_t)(blockno + 1)
+          || (n -= TFTP_DATAHEADERSIZE) > TT.block_size) {
+        if (nacked) continue;
+        nacked = 1;
+        count = 0;
+        break;
+      }
+      if (writeall(fd, packet + TFTP_DATAHEADERSIZE, n) != n) {
+        perror_msg("write");
+        n = mkpkt_err(packet, TFTP_ER_FULL, TFTP_ES_FULL);
+        write_server(sd, packet, n, &server);
+        goto errout_with_sd;
+      }
+      got += n;
+      len = mkpkt_ack(toybuf, ++blockno);
+      retry = nacked = 0;
+      timeout = TFTP_TIMEOUT;
+      if ((done = n < TT.block_size) || ++count == TT.window_size) {
+        count = 0;
         break;
       }
     }
-    if (retry == TFTP_RETRIES) {
-      error_msg("Retry limit exceeded.");
-      unlink(TT.local_file);
-      goto errout_with_sd;
-    }
-    ndatabytes = nbytesrecvd - TFTP_DATAHEADERSIZE;
-    if (writeall(fd, packet + TFTP_DATAHEADERSIZE, ndatabytes) < 0){
-      unlink(TT.local_file);
-      goto errout_with_sd;
-    }
-    len = mkpkt_ack(packet, blockno);
-    ret = write_server(sd, packet, len, &server);
-    if (ret != len){
-      unlink(TT.local_file);
-      goto errout_with_sd;
-    }
-  } while (ndatabytes >= TFTP_DATASIZE);
+  }
+  if (tsize > 0 && got != tsize) {
+    error_msg("got %lld of %lld bytes", got, tsize);
+    goto errout_with_sd;
+  }
 
   result = 0;
 
 errout_with_sd: xclose(sd);
+  if (result) unlink(TT.local_file);
+  close(fd);
   free(packet);
   return result;
 }
 
-// Sends file to server.
-int file_put(void)
+// Sends file to server, a window of blocks per ACK.
+static int file_put(void)
 {
-  struct sockaddr_storage server;
-  uint8_t *packet;
-  off_t offset = 0;
-  uint16_t blockno = 1, rblockno, port = 0;
-  int packetlen, sd, fd, retry = 0, ret, result = -1;
+  struct sockaddr_storage server, *peer = &server;
+  struct mmsghdr *msgs = 0;
+  struct iovec *iov = 0;
+  struct stat st;
+  char *packet = toybuf, *data = 0;
+  long long tsize = -1, base = 1, next = 1, last = LLONG_MAX, b;
+  unsigned long long sent = 0;
+  int len, sd, fd, n, retry = 0, timeout = TFTP_TIMEOUT, srtt = -1, count,
+    result = -1;
+  unsigned delta;
 
   sd = init_tftp(&server);
-  packet = (uint8_t*)xzalloc(TFTP_IOBUFSIZE);
   fd = xopen(TT.local_file, O_RDONLY);
+  if (!fstat(fd, &st) && S_ISREG(st.st_mode)) tsize = st.st_size;
 
-  for (;;) {  //first loop for request send and confirmation from server.
-    packetlen = mkpkt_request(packet, TFTP_OP_WRQ, TT.remote_file, 1);
-    ret = write_server(sd, packet, packetlen, &server);
-    if (ret != packetlen) goto errout_with_sd;
-    if (read_ack(sd, packet, &server, &port, NULL) == 0) break;
-    if (++retry > TFTP_RETRIES) {
-      error_msg("Retry count exceeded.");
+  // Resend the request until the server answers with an OACK or ACK 0.
+  len = mkpkt_request(packet, TFTP_OP_WRQ, tsize);
+  while (peer) {
+    if (write_server(sd, packet, len, &server) != len) goto errout_with_sd;
+    if (0 > (len = read_server(sd, packet, TFTP_BLKSIZE, timeout, peer)))
       goto errout_with_sd;
+    if (!len) {
+      if (++retry > TFTP_RETRIES) {
+        error_msg("Retry count exceeded.");
+        goto errout_with_sd;
+      }
+      timeout *= 2;
+      len = mkpkt_request(packet, TFTP_OP_WRQ, tsize);
+      continue;
     }
+    peer = 0;
+    if (len >= 4 && peek_be(packet, 2) == TFTP_OP_ERR) show_err(packet);
+    else if (len >= 2 && peek_be(packet, 2) == TFTP_OP_OACK) {
+      if (!read_oack(sd, packet, len, &tsize, &server)) break;
+    } else if (len >= 4 && peek_be(packet, 2) == TFTP_OP_ACK
+        && !peek_be(packet + 2, 2)) {
+      TT.block_size = TFTP_BLKSIZE;
+      TT.window_size = 1;
+      break;
+    } else error_msg("Bad opcode.");
+    goto errout_with_sd;
   }
-  for (;;) {  // loop for data sending and receving ack from server.
-    packetlen = mkpkt_data(fd, offset, packet, blockno);
-    if (packetlen < 0) goto errout_with_sd;
-
-    ret = write_server(sd, packet, packetlen, &server);
-    if (ret != packetlen) goto errout_with_sd;
-
-    if (read_ack(sd, packet, &server, &port, &rblockno) == 0) {
-      if (rblockno == blockno) {
-        if (packetlen < TFTP_PACKETSIZE) break;
-        blockno++;
-        offset += TFTP_DATASIZE;
-        retry = 0;
-        continue;
+  retry = 0;
+  timeout = TFTP_TIMEOUT;
+
+  msgs = xzalloc(TT.window_size * sizeof(*msgs));
+  iov = xzalloc(TT.window_size * sizeof(*iov));
+  data = xmalloc(TT.window_size * (TT.block_size + TFTP_DATAHEADERSIZE));
+  for (;;) {
+    // Queue the window from the first unacked block, reading new ones.
+    for (count = 0, b = base; count < TT.window_size && b <= last; b++) {
+      struct iovec *v = iov + b % TT.window_size;
+
+      if (b == next) {
+        char *ptr = data + (b % TT.window_size)
+          * (TT.block_size + TFTP_DATAHEADERSIZE);
+
+        next++;
+        ptr[0] = TFTP_OP_DATA >> 8;
+        ptr[1] = TFTP_OP_DATA & 0xff;
+        ptr[2] = b >> 8;
+        ptr[3] = b & 0xff;
+        len = readall(fd, ptr + TFTP_DATAHEADERSIZE, TT.block_size);
+        if (len < 0) {
+          perror_msg("read");
+          goto errout_with_sd;
+        }
+        if (len < TT.block_size) last = b;
+        v->iov_base = ptr;
+        v->iov_len = len + TFTP_DATAHEADERSIZE;
       }
+      msgs[count].msg_hdr.msg_iov = v;
+      msgs[count++].msg_hdr.msg_iovlen = 1;
     }
-    if (++retry > TFTP_RETRIES) {
-      error_msg("Retry count exceeded.");
-      goto errout_with_sd;
+    for (len = 0; len < count; len += n) {
+      if (0 > (n = sendmmsg(sd, msgs + len, count - len, 0))) {
+        if (errno == EINTR) n = 0;
+        else {
+          perror_msg("server write failed");
+          goto errout_with_sd;
+        }
+      }
     }
+    sent = millitime();
+
+    // Wait for an ACK of something in this window, or time out and resend.
+    for (;;) {
+      if (0 > (len = read_server(sd, packet, TFTP_BLKSIZE, timeout, 0)))
+        goto errout_with_sd;
+      if (!len) {
+        if (++retry > TFTP_RETRIES) {
+          error_msg("Timeout, Waiting for ACK.");
+          goto errout_with_sd;
+        }
+        timeout *= 2;
+        break;
+      }
+      if (len < 4) continue;
+      if (peek_be(packet, 2) == TFTP_OP_ERR) {
+        show_err(packet);
+        goto errout_with_sd;
+      }
+      if (peek_be(packet, 2) != TFTP_OP_ACK) continue;
+      delta = (uint16_t)(peek_be(packet + 2, 2) - (base - 1));
+      if (delta > count) continue;
+      base += delta;
+
+      // Time out after twice the smoothed round trip. A resent window can't
+      // be timed (which copy got acked?) so keep the backed off timeout.
+      if (!retry) {
+        len = millitime() - sent;
+        srtt = (srtt < 0) ? len : (7 * srtt + len) / 8;
+        timeout = 2 * srtt + 50;
+      }
+      retry = 0;
+      break;
+    }
+    if (base > last) break;
   }
   result = 0;
 
 errout_with_sd: close(sd);
-  free(packet);
+  close(fd);
+  free(msgs);
+  free(iov);
+  free(data);
   return result;
 }
 
@@ -434,6 +514,11 @@ void tftp_main(void)
   } else if (toys.optflags & FLAG_l) TT.remote_file = TT.local_file;
   else error_exit("Please provide some files.");
 
+  // The whole window is kept for resends, so don't ask for more than we'd
+  // buffer. The server can lower it further.
+  if (TT.window_size > TFTP_WINDOWBYTES/(TT.block_size + TFTP_DATAHEADERSIZE))
+    TT.window_size = TFTP_WINDOWBYTES/(TT.block_size + TFTP_DATAHEADERSIZE);
+
   memset(&rp, 0, sizeof(rp));
   rp.ai_family = AF_UNSPEC;
   rp.ai_socktype = SOCK_STREAM;
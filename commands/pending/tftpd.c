@@ -5,13 +5,13 @@
  *
  * No Standard.
 
-USE_TFTPD(NEWTOY(tftpd, "rcu:l", TOYFLAG_BIN))
+USE_TFTPD(NEWTOY(tftpd, "rcDFm#<1=256p#<1>65535=69u:l", TOYFLAG_BIN))
 
 config TFTPD
   bool "tftpd"
   default n
   help
-    usage: tftpd [-cr] [-u USER] [DIR]
+    usage: tftpd [-crDF] [-u USER] [-p PORT] [-m MAX] [DIR]
 
     Transfer file from/to tftp server.
 
@@ -19,6 +19,10 @@ config TFTPD
     -c	Allow file creation via upload
     -u	run as USER
     -l	Log to syslog (inetd mode requires this)
+    -D	Standalone daemon, not run from inetd
+    -F	Run in foreground (with -D)
+    -p	Port to listen on (default 69)
+    -m	Serve at most MAX transfers at once (default 256)
 */
 
 #define FOR_tftpd
@@ -26,12 +30,22 @@ config TFTPD
 
 GLOBALS(
   char *user;
+  long port;
+  long max;
 
-  long sfd;
   struct passwd *pw;
+  struct tftpd_xfer *xfers;
+  struct tftpd_map *maps;
+  char *rpkt;
+  int count;
 )
 
 #define TFTPD_BLKSIZE 512  // as per RFC 1350.
+#define TFTPD_MAXBLKSIZE 65464  // RFC 2348
+#define TFTPD_RETRIES 5
+#define TFTPD_TIMEOUT 1000  // ms before the first resend, doubled each retry
+// Cap the bytes a window puts in flight, and the per-block bookkeeping.
+#define TFTPD_WINDOWBYTES (1<<23)
 
 // opcodes
 #define TFTPD_OP_RRQ  1  // Read Request          RFC 1350, RFC 2090
@@ -69,241 +83,583 @@ GLOBALS(
  *         ----------------------------------------
  *  ERROR | 05    |  ErrorCode |   ErrMsg   |   0  |
  *         ----------------------------------------
+ *         2 bytes   string  1 byte  string  1 byte
+ *         ---------------------------------------
+ *  OACK  | 06    |  Option  |   0  |  Value |  0  | ...
+ *         ---------------------------------------
+ *
+ * RRQ/WRQ carry the same option/value pairs after the mode. We understand
+ * blksize (RFC 2348), tsize (RFC 2349) and windowsize (RFC 7440), where the
+ * sender sends windowsize blocks before waiting for an ACK of the last one.
  */
 
-static char *g_errpkt = toybuf + TFTPD_BLKSIZE;
+// A download's file, mapped once for every client fetching it. Blocks go
+// out straight from the page cache, 200 clients booting the same image cost
+// one copy of it.
+struct tftpd_map {
+  struct tftpd_map *next;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  char *data;
+  int refs;
+};
+
+// One transfer. Downloads send WINDOW blocks from BASE then wait for an ACK,
+// PENDING counting how many of the QUEUED have gone out so far. Uploads
+// have written up to BLOCK, COUNT of them since the last ACK, and REPLY is
+// the ACK (or OACK) to resend when the client goes quiet.
+struct tftpd_xfer {
+  struct tftpd_xfer *next;
+  struct tftpd_map *map;
+  struct sockaddr_storage peer;
+  socklen_t peerlen;
+  struct mmsghdr *msgs;
+  struct iovec *iov;
+  char *hdr, reply[TFTPD_BLKSIZE];
+  long long base, last, block;
+  unsigned long long sent, deadline;
+  int sfd, fd, opcode, blksize, window, rlen, retry, timeout, srtt, count,
+    queued, pending, nacked, done;
+};
+
+// toybuf belongs to the running command, so this can't be a static pointer.
+#define g_errpkt (toybuf + TFTPD_BLKSIZE)
 
 // Create and send error packet.
-static void send_errpkt(struct sockaddr *dstaddr,
-    socklen_t socklen, char *errmsg)
+static void send_errpkt(int sfd, int code, char *errmsg)
 {
   error_msg(errmsg);
+  memset(g_errpkt, 0, 4);
   g_errpkt[1] = TFTPD_OP_ERR;
+  g_errpkt[3] = code;
   strcpy(g_errpkt + 4, errmsg);
-  if (sendto(TT.sfd, g_errpkt, strlen(errmsg)+5, 0, dstaddr, socklen) < 0)
-    perror_exit("sendto failed");
+  if (send(sfd, g_errpkt, strlen(errmsg)+5, MSG_DONTWAIT) < 0)
+    perror_msg("sendto failed");
 }
 
-// Used to send / receive packets.
-static void do_action(struct sockaddr *srcaddr, struct sockaddr *dstaddr,
-    socklen_t socklen, char *file, int opcode, int tsize, int blksize)
+// Report an ERROR packet from the client.
+static void recv_errpkt(char *rpkt)
 {
-  int fd, done = 0, retry_count = 12, timeout = 100, len;
-  uint16_t blockno = 1, pktopcode, rblockno;
-  char *ptr, *spkt, *rpkt;
-  struct pollfd pollfds[1];
-
-  spkt = xzalloc(blksize + 4);
-  rpkt = xzalloc(blksize + 4);
-  ptr = spkt+2; //point after opcode.
-
-  pollfds[0].fd = TT.sfd;
-  // initialize groups, setgid and setuid
-  if (TT.pw) xsetuser(TT.pw);
+  char *message = "DATA Check failure.";
+  char *arr[] = {"File not found", "Access violation",
+    "Disk full or allocation exceeded", "Illegal TFTP operation",
+    "Unknown transfer ID", "File already exists",
+    "No such user", "Terminate transfer due to option negotiation"};
+  int code = peek_be(rpkt+2, 2);
+
+  if (code && code < 9) message = arr[code - 1];
+  error_msg(message);
+}
 
-  if (opcode == TFTPD_OP_RRQ) fd = open(file, O_RDONLY, 0666);
-  else fd = open(file, ((toys.optflags & FLAG_c) ?
-        (O_WRONLY|O_TRUNC|O_CREAT) : (O_WRONLY|O_TRUNC)) , 0666);
-  if (fd < 0) {
-    g_errpkt[3] = TFTPD_ER_NOSUCHFILE;
-    send_errpkt(dstaddr, socklen, "can't open file");
-    goto CLEAN_APP;
-  }
-  // For download -> blockno will be 1.
-  // 1st ACK will be from dst,which will have blockno-=1
-  // Create and send ACK packet.
-  if (blksize != TFTPD_BLKSIZE || tsize) {
-    pktopcode = TFTPD_OP_OACK;
-    // add "blksize\000blksize_val\000" in send buffer.
-    if (blksize != TFTPD_BLKSIZE) {
-      strcpy(ptr, "blksize");
-      ptr += strlen("blksize") + 1;
-      ptr += snprintf(ptr, 6, "%d", blksize) + 1;
-    }
-    if (tsize) {// add "tsize\000tsize_val\000" in send buffer.
-      struct stat sb;
-
-      sb.st_size = 0;
-      fstat(fd, &sb);
-      strcpy(ptr, "tsize");
-      ptr += strlen("tsize") + 1;
-      ptr += sprintf(ptr, "%lu", (unsigned long)sb.st_size)+1;
-    }
-    goto SEND_PKT;
-  }
-  // upload ->  ACK 1st packet with filename, as it has blockno 0.
-  if (opcode == TFTPD_OP_WRQ) blockno = 0;
-
-  // Prepare DATA and/or ACK pkt and send it.
-  for (;;) {
-    int poll_ret;
-
-    retry_count = 12, timeout = 100, pktopcode = TFTPD_OP_ACK;
-    ptr = spkt+2;
-    *((uint16_t*)ptr) = htons(blockno);
-    blockno++;
-    ptr += 2;
-    if (opcode == TFTPD_OP_RRQ) {
-      pktopcode = TFTPD_OP_DATA;
-      len = readall(fd, ptr, blksize);
-      if (len < 0) {
-        send_errpkt(dstaddr, socklen, "read-error");
-        break;
+// Share a mapping of FD's file with whoever else is reading it. Anything
+// about the file changing gets a new mapping, old ones last until unused.
+static struct tftpd_map *map_get(int fd)
+{
+  struct tftpd_map *map;
+  struct stat st;
+
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode)) return 0;
+  for (map = TT.maps; map; map = map->next)
+    if (map->dev == st.st_dev && map->ino == st.st_ino
+        && map->size == st.st_size && map->mtime == st.st_mtime) break;
+  if (!map) {
+    map = xzalloc(sizeof(*map));
+    map->dev = st.st_dev;
+    map->ino = st.st_ino;
+    map->size = st.st_size;
+    map->mtime = st.st_mtime;
+    if (map->size) {
+      map->data = mmap(0, map->size, PROT_READ, MAP_SHARED, fd, 0);
+      if (map->data == MAP_FAILED) {
+        free(map);
+
+        return 0;
       }
-      if (len != blksize) done = 1; //last pkt.
-      ptr += len;
+      madvise(map->data, map->size, MADV_SEQUENTIAL);
     }
-SEND_PKT:
-    // 1st ACK will be from dst, which will have blockno-=1
-    *((uint16_t*)spkt) = htons(pktopcode); //append send pkt's opcode.
-RETRY_SEND:
-    if (sendto(TT.sfd, spkt, (ptr - spkt), 0, dstaddr, socklen) <0)
-      perror_exit("sendto failed");
-    // if "block size < 512", send ACK and exit.
-    if ((pktopcode == TFTPD_OP_ACK) && done) break;
-
-POLL_INPUT:
-    pollfds[0].events = POLLIN;
-    pollfds[0].fd = TT.sfd;
-    poll_ret = poll(pollfds, 1, timeout);
-    if (poll_ret < 0 && (errno == EINTR || errno == ENOMEM)) goto POLL_INPUT;
-    if (!poll_ret) {
-      if (!--retry_count) {
-        error_msg("timeout");
-        break;
-      }
-      timeout += 150;
-      goto RETRY_SEND;
-    } else if (poll_ret == 1) {
-      len = read(pollfds[0].fd, rpkt, blksize + 4);
-      if (len < 0) {
-        send_errpkt(dstaddr, socklen, "read-error");
-        break;
+    map->next = TT.maps;
+    TT.maps = map;
+  }
+  map->refs++;
+
+  return map;
+}
+
+static void map_put(struct tftpd_map *map)
+{
+  struct tftpd_map **mm;
+
+  if (--map->refs) return;
+  for (mm = &TT.maps; *mm != map; mm = &(*mm)->next);
+  *mm = map->next;
+  if (map->size) munmap(map->data, map->size);
+  free(map);
+}
+
+// Send what's left of the queued window, stopping when the socket buffer
+// fills up. The loop polls for POLLOUT to finish it, and the timer only
+// starts once it has all gone.
+static void xfer_send(struct tftpd_xfer *x)
+{
+  int n;
+
+  while (x->pending < x->queued) {
+    n = sendmmsg(x->sfd, x->msgs + x->pending, x->queued - x->pending,
+      MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) {
+        perror_msg("sendto failed");
+        x->done = 1;
       }
-      if (len < 4) goto POLL_INPUT;
-    } else {
-      perror_msg("poll");
-      break;
-    }
-    // Validate receive packet.
-    pktopcode = ntohs(((uint16_t*)rpkt)[0]);
-    rblockno = ntohs(((uint16_t*)rpkt)[1]);
-    if (pktopcode == TFTPD_OP_ERR) {
-      char *message = "DATA Check failure.";
-      char *arr[] = {"File not found", "Access violation",
-        "Disk full or allocation exceeded", "Illegal TFTP operation",
-        "Unknown transfer ID", "File already exists",
-        "No such user", "Terminate transfer due to option negotiation"};
-
-      if (rblockno && (rblockno < 9)) message = arr[rblockno - 1];
-      error_msg(message);
-      break; // Break the for loop.
+      return;
     }
+    x->pending += n;
+  }
+  x->sent = millitime();
+  x->deadline = x->sent + x->timeout;
+}
 
-    // if download requested by client,
-    // server will send data pkt and will receive ACK pkt from client.
-    if ((opcode == TFTPD_OP_RRQ) && (pktopcode == TFTPD_OP_ACK)) {
-      if (rblockno == (uint16_t) (blockno - 1)) {
-        if (!done) continue; // Send next chunk of data.
-        break;
-      }
+// Queue the window from BASE: each block is a 4 byte header and a pointer
+// into the mapping, nothing gets copied. If there is an OACK it goes out
+// alone as block 0, and ACK 0 starts the data.
+static void xfer_window(struct tftpd_xfer *x)
+{
+  long long b = x->base;
+  off_t off;
+  int i = 0;
+
+  if (!b) {
+    x->iov->iov_base = x->reply;
+    x->iov->iov_len = x->rlen;
+    x->msgs->msg_hdr.msg_iov = x->iov;
+    x->msgs->msg_hdr.msg_iovlen = 1;
+    i++;
+  } else for (; i < x->window && b <= x->last; i++, b++) {
+    struct iovec *v = x->iov + 2*i;
+    char *h = x->hdr + 4*i;
+
+    h[0] = 0;
+    h[1] = TFTPD_OP_DATA;
+    h[2] = b >> 8;
+    h[3] = b;
+    v->iov_base = h;
+    v->iov_len = 4;
+    off = (b - 1) * x->blksize;
+    v[1].iov_base = x->map->data + off;
+    v[1].iov_len = (x->map->size - off < x->blksize)
+      ? x->map->size - off : x->blksize;
+    x->msgs[i].msg_hdr.msg_iov = v;
+    x->msgs[i].msg_hdr.msg_iovlen = 2;
+  }
+  x->queued = i;
+  x->pending = 0;
+  xfer_send(x);
+}
+
+// (Re)send an upload's last ACK or OACK.
+static void xfer_reply(struct tftpd_xfer *x)
+{
+  if (send(x->sfd, x->reply, x->rlen, MSG_DONTWAIT) < 0) {
+    perror_msg("sendto failed");
+    x->done = 1;
+  }
+  x->deadline = millitime() + x->timeout;
+}
+
+// Download: an ACK for the window's last block moves it on, an ACK short of
+// that restarts it from the first block the client is missing.
+static void xfer_ack(struct tftpd_xfer *x, char *rpkt)
+{
+  unsigned delta;
+  int len;
+
+  if (rpkt[1] != TFTPD_OP_ACK) return;
+  delta = (uint16_t)(peek_be(rpkt + 2, 2) - (x->base - 1));
+  if (delta > x->pending) return;
+  x->base += delta;
+
+  // Time out after twice the smoothed round trip. A resent window can't
+  // be timed (which copy got acked?) so keep the backed off timeout.
+  if (!x->retry && x->pending == x->queued) {
+    len = millitime() - x->sent;
+    x->srtt = (x->srtt < 0) ? len : (7 * x->srtt + len) / 8;
+    x->timeout = 2 * x->srtt + 50;
+  }
+  x->retry = 0;
+  if (x->base > x->last) x->done = 1;
+  else xfer_window(x);
+}
+
+// Upload: write what the client sends. ACK every WINDOW blocks, the final
+// short one, and when a block turns up out of order, the last one we have
+// so the client restarts from there.
+static void xfer_data(struct tftpd_xfer *x, char *rpkt, int len)
+{
+  if (rpkt[1] != TFTPD_OP_DATA || (len -= 4) > x->blksize) return;
+  if (peek_be(rpkt + 2, 2) != (uint16_t)(x->block + 1)) {
+    // Don't nack block 0, the client needs our OACK resent, not an ACK.
+    if (!x->nacked && x->block) {
+      x->nacked = 1;
+      x->count = 0;
+      xfer_reply(x);
     }
-    
-    // server will receive DATA pkt and write the data.
-    if ((opcode == TFTPD_OP_WRQ) && (pktopcode == TFTPD_OP_DATA)) {
-      if (rblockno == blockno) {
-        int nw = writeall(fd, &rpkt[4], len-4);
-        if (nw != len-4) {
-          g_errpkt[3] = TFTPD_ER_FULL;
-          send_errpkt(dstaddr, socklen, "write error");
-          break;
-        }
-      
-        if (nw != blksize) done = 1;
+    return;
+  }
+  if (writeall(x->fd, rpkt + 4, len) != len) {
+    send_errpkt(x->sfd, TFTPD_ER_FULL, "write error");
+    x->done = 1;
+    return;
+  }
+  x->block++;
+  x->retry = x->nacked = 0;
+  x->timeout = TFTPD_TIMEOUT;
+  x->reply[0] = 0;
+  x->reply[1] = TFTPD_OP_ACK;
+  x->reply[2] = x->block >> 8;
+  x->reply[3] = x->block;
+  x->rlen = 4;
+  if (len != x->blksize || ++x->count == x->window) {
+    x->count = 0;
+    xfer_reply(x);
+    if (len != x->blksize) x->done = 1;
+  } else x->deadline = millitime() + x->timeout;
+}
+
+// Handle everything queued on a transfer's socket.
+static void xfer_read(struct tftpd_xfer *x)
+{
+  int len;
+
+  while (!x->done) {
+    len = recv(x->sfd, TT.rpkt, TFTPD_MAXBLKSIZE + 5, MSG_DONTWAIT);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) {
+        perror_msg("read");
+        x->done = 1;
       }
-      continue;
+      break;
     }
-    goto POLL_INPUT;
-  } // end of loop
-
-CLEAN_APP:
-  if (CFG_TOYBOX_FREE) {
-    free(spkt);
-    free(rpkt);
-    close(fd);
+    if (len < 4 || TT.rpkt[0]) continue;
+    if (TT.rpkt[1] == TFTPD_OP_ERR) {
+      recv_errpkt(TT.rpkt);
+      x->done = 1;
+    } else if (x->opcode == TFTPD_OP_RRQ) xfer_ack(x, TT.rpkt);
+    else xfer_data(x, TT.rpkt, len);
   }
 }
 
-void tftpd_main(void)
+// The client went quiet: resend the window or the last ACK.
+static void xfer_timeout(struct tftpd_xfer *x)
 {
-  int fd = 0, recvmsg_len, rbuflen, opcode, blksize = TFTPD_BLKSIZE, tsize = 0, set =1;
-  struct sockaddr_storage srcaddr, dstaddr;
-  socklen_t socklen = sizeof(struct sockaddr_storage);
-  char *buf = toybuf;
-
-  memset(&srcaddr, 0, sizeof(srcaddr));
-  if (getsockname(0, (struct sockaddr *)&srcaddr, &socklen)) help_exit(0);
+  if (++x->retry > TFTPD_RETRIES) {
+    error_msg("timeout");
+    x->done = 1;
+    return;
+  }
+  x->timeout *= 2;
+  if (x->opcode == TFTPD_OP_RRQ) xfer_window(x);
+  else {
+    x->count = 0;
+    xfer_reply(x);
+  }
+}
 
-  if (TT.user) TT.pw = xgetpwnam(TT.user);
-  if (*toys.optargs) xchroot(*toys.optargs);
+static void xfer_free(struct tftpd_xfer *x)
+{
+  close(x->sfd);
+  if (x->fd >= 0) close(x->fd);
+  if (x->map) map_put(x->map);
+  free(x->msgs);
+  free(x->iov);
+  free(x->hdr);
+  free(x);
+  TT.count--;
+}
 
-  recvmsg_len = recvfrom(fd, toybuf, blksize, 0, (void *)&dstaddr, &socklen);
+// Start a transfer for the LEN byte request in TT.rpkt, answering on SFD
+// (connected to the client). Bad requests get an ERROR and SFD closed.
+static void xfer_start(int sfd, int len, struct sockaddr_storage *peer,
+  socklen_t peerlen)
+{
+  struct tftpd_xfer *x;
+  char *buf = TT.rpkt, *end, *s, *ptr;
+  int opcode, fd, blksize = 0, window = 0, n, rcvbuf;
+  long long tsize = -1, val;
+  socklen_t sl = sizeof(rcvbuf);
 
-  TT.sfd = xsocket(dstaddr.ss_family, SOCK_DGRAM, 0);
-  if (setsockopt(TT.sfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&set,
-        sizeof(set)) < 0) perror_exit("setsockopt failed");
-  if (bind(TT.sfd, (void *)&srcaddr, socklen)) perror_exit("bind");
-  if (connect(TT.sfd, (void *)&dstaddr, socklen) < 0)
-    perror_exit("can't connect to remote host");
   // Error condition.
-  if (recvmsg_len<4 || recvmsg_len>TFTPD_BLKSIZE || toybuf[recvmsg_len-1]) {
-    send_errpkt((struct sockaddr*)&dstaddr, socklen, "packet format error");
-    return;
+  if (len<4 || len>TFTPD_BLKSIZE || buf[len-1]) {
+    send_errpkt(sfd, 0, "packet format error");
+    goto error;
   }
 
   // request is either upload or Download.
   opcode = buf[1];
-  if (((opcode != TFTPD_OP_RRQ) && (opcode != TFTPD_OP_WRQ))
+  if (buf[0] || ((opcode != TFTPD_OP_RRQ) && (opcode != TFTPD_OP_WRQ))
       || ((opcode == TFTPD_OP_WRQ) && (toys.optflags & FLAG_r))) {
-    send_errpkt((struct sockaddr*)&dstaddr, socklen,
-    	(opcode == TFTPD_OP_WRQ) ? "write error" : "packet format error");
-    return;
+    send_errpkt(sfd, 0,
+      (opcode == TFTPD_OP_WRQ) ? "write error" : "packet format error");
+    goto error;
   }
 
   buf += 2;
   if (*buf == '.' || strstr(buf, "/.")) {
-    send_errpkt((struct sockaddr*)&dstaddr, socklen, "dot in filename");
-    return;
+    send_errpkt(sfd, 0, "dot in filename");
+    goto error;
   }
 
   buf += strlen(buf) + 1; //1 '\0'.
   // As per RFC 1350, mode is case in-sensitive.
-  if (buf >= toybuf+recvmsg_len || strcasecmp(buf, "octet")) {
-    send_errpkt((struct sockaddr*)&dstaddr, socklen, "packet format error");
-    return;
+  if (buf >= TT.rpkt+len || strcasecmp(buf, "octet")) {
+    send_errpkt(sfd, 0, "packet format error");
+    goto error;
+  }
+
+  // RFC 2347: "opt1\0val1\0...optN\0valN\0". Unknown or malformed options
+  // are left out of the OACK, and sizes we can't do are lowered to ones we
+  // can, which the client must accept or abort.
+  for (buf += strlen(buf) + 1; buf < TT.rpkt+len; buf = s+strlen(s)+1) {
+    s = buf + strlen(buf) + 1;
+    if (s >= TT.rpkt+len) break;
+    val = strtoll(s, &end, 10);
+    if (*end || !isdigit(*s)) continue;
+    if (!strcasecmp(buf, "blksize") && val >= 8)
+      blksize = (val > TFTPD_MAXBLKSIZE) ? TFTPD_MAXBLKSIZE : val;
+    else if (!strcasecmp(buf, "windowsize") && val >= 1)
+      window = (val > 65535) ? 65535 : val;
+    else if (!strcasecmp(buf, "tsize")) tsize = val;
+  }
+  if (window && opcode == TFTPD_OP_RRQ) {
+    val = TFTPD_WINDOWBYTES / ((blksize ? blksize : TFTPD_BLKSIZE) + 4);
+    if (window > val) window = val ? val : 1;
+  }
+
+  if (opcode == TFTPD_OP_RRQ) fd = open(TT.rpkt + 2, O_RDONLY, 0666);
+  else fd = open(TT.rpkt + 2, ((toys.optflags & FLAG_c) ?
+        (O_WRONLY|O_TRUNC|O_CREAT) : (O_WRONLY|O_TRUNC)) , 0666);
+  if (fd < 0) {
+    send_errpkt(sfd, TFTPD_ER_NOSUCHFILE, "can't open file");
+    goto error;
+  }
+
+  x = xzalloc(sizeof(*x));
+  x->sfd = sfd;
+  x->fd = fd;
+  x->opcode = opcode;
+  memcpy(&x->peer, peer, x->peerlen = peerlen);
+  x->timeout = TFTPD_TIMEOUT;
+  x->srtt = -1;
+  x->next = TT.xfers;
+  TT.xfers = x;
+  TT.count++;
+
+  // Only regular files can be mapped, so only those can be downloaded.
+  if (opcode == TFTPD_OP_RRQ) {
+    x->map = map_get(fd);
+    close(fd);
+    x->fd = -1;
+    if (!x->map) {
+      send_errpkt(sfd, TFTPD_ER_NOSUCHFILE, "can't open file");
+      x->done = 1;
+      return;
+    }
+  }
+
+  // Acknowledge the options we accept. For a download the OACK stands in
+  // front of block 1, for an upload it takes the place of ACK 0.
+  ptr = x->reply + 2;
+  if (blksize || window || tsize >= 0) {
+    if (blksize) ptr += sprintf(ptr, "blksize%c%d", 0, blksize) + 1;
+    if (window) ptr += sprintf(ptr, "windowsize%c%d", 0, window) + 1;
+    // The client tells us an upload's size, we tell it a download's.
+    if (tsize >= 0) ptr += sprintf(ptr, "tsize%c%lld", 0,
+      (opcode == TFTPD_OP_RRQ) ? (long long)x->map->size : tsize) + 1;
+    x->reply[1] = TFTPD_OP_OACK;
+    x->rlen = ptr - x->reply;
+  }
+  x->blksize = blksize ? blksize : TFTPD_BLKSIZE;
+  x->window = window ? window : 1;
+
+  if (opcode == TFTPD_OP_RRQ) {
+    x->msgs = xzalloc(x->window * sizeof(*x->msgs));
+    x->iov = xzalloc(2 * x->window * sizeof(*x->iov));
+    x->hdr = xmalloc(4 * x->window);
+    x->base = !x->rlen;
+    x->last = x->map->size / x->blksize + 1;
+    xfer_window(x);
+  } else {
+    // Let a whole window queue up in the socket while we write. The kernel
+    // caps this at its configured maximum, and we don't go below its default.
+    n = (x->window > TFTPD_WINDOWBYTES/(x->blksize + 4)) ? TFTPD_WINDOWBYTES
+      : x->window * (x->blksize + 4);
+    if (getsockopt(sfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &sl) || rcvbuf < n)
+      setsockopt(sfd, SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+
+    // upload ->  ACK 1st packet with filename, as it has blockno 0.
+    if (!x->rlen) {
+      x->reply[1] = TFTPD_OP_ACK;
+      x->rlen = 4;
+    }
+    xfer_reply(x);
+  }
+
+  return;
+
+error:
+  close(sfd);
+}
+
+// Take queued requests from the listening socket, up to the transfer limit.
+// Each transfer answers from its own new port (the server's transfer ID in
+// RFC 1350), so all the listener ever sees is requests.
+static void tftpd_accept(int lfd)
+{
+  struct sockaddr_storage from;
+  struct tftpd_xfer *x;
+  socklen_t fromlen;
+  int len, sfd;
+
+  while (TT.count < TT.max) {
+    memset(&from, 0, sizeof(from));
+    fromlen = sizeof(from);
+    len = recvfrom(lfd, TT.rpkt, TFTPD_BLKSIZE, MSG_DONTWAIT, (void *)&from,
+      &fromlen);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) perror_msg("recvfrom");
+      break;
+    }
+
+    // A client resending its request isn't asking for a second transfer.
+    for (x = TT.xfers; x; x = x->next)
+      if (x->peerlen == fromlen && !memcmp(&x->peer, &from, fromlen)) break;
+    if (x) continue;
+
+    if (0 > (sfd = socket(from.ss_family, SOCK_DGRAM, 0))) {
+      perror_msg("socket");
+      break;
+    }
+    if (connect(sfd, (void *)&from, fromlen)) {
+      perror_msg("can't connect to remote host");
+      close(sfd);
+      continue;
+    }
+    xfer_start(sfd, len, &from, fromlen);
   }
+}
 
-  //RFC2348. e.g. of size type: "ttype1\0ttype1_val\0...ttypeN\0ttypeN_val\0"
-  buf += strlen(buf) + 1;
-  rbuflen = toybuf + recvmsg_len - buf;
-  if (rbuflen) {
-    int jump = 0, bflag = 0;
-
-    for (; rbuflen; rbuflen -= jump, buf += jump) {
-      if (!bflag && !strcasecmp(buf, "blksize")) { //get blksize
-        errno = 0;
-        blksize = strtoul(buf, NULL, 10);
-        if (errno || blksize > 65564 || blksize < 8) blksize = TFTPD_BLKSIZE;
-        bflag ^= 1;
-      } else if (!tsize && !strcasecmp(buf, "tsize")) tsize ^= 1;
-      
-      jump += strlen(buf) + 1;
+// Bind the -D socket, IPv6 taking IPv4 clients too where the kernel allows.
+static int tftpd_listen(void)
+{
+  struct sockaddr_in6 sa6;
+  struct sockaddr_in sa;
+  int fd, set = 1, off = 0;
+
+  memset(&sa6, 0, sizeof(sa6));
+  sa6.sin6_family = AF_INET6;
+  sa6.sin6_port = htons(TT.port);
+  if (0 <= (fd = socket(AF_INET6, SOCK_DGRAM, 0))) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &set, sizeof(set));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    if (!bind(fd, (void *)&sa6, sizeof(sa6))) return fd;
+    close(fd);
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(TT.port);
+  fd = xsocket(AF_INET, SOCK_DGRAM, 0);
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &set, sizeof(set));
+  if (bind(fd, (void *)&sa, sizeof(sa))) perror_exit("bind");
+
+  return fd;
+}
+
+// One loop runs every transfer: poll their sockets (and the listener while
+// there's room for more), then feed each transfer its packets, its socket
+// becoming writable, or its timer running out. inetd mode is the same loop
+// with one transfer and no listener.
+static void tftpd_loop(int lfd)
+{
+  struct pollfd *pfd = xmalloc((TT.max + 1) * sizeof(*pfd));
+  struct tftpd_xfer *x, **xx;
+  unsigned long long now;
+  long long wait;
+  int n, lpoll;
+
+  while (lfd >= 0 || TT.xfers) {
+    now = millitime();
+    wait = -1;
+    n = 0;
+    if ((lpoll = lfd >= 0 && TT.count < TT.max)) {
+      pfd->fd = lfd;
+      pfd[n++].events = POLLIN;
     }
-    tsize &= (opcode == TFTPD_OP_RRQ);
+    for (x = TT.xfers; x; x = x->next) {
+      pfd[n].fd = x->sfd;
+      pfd[n++].events = POLLIN | ((x->pending < x->queued) ? POLLOUT : 0);
+      if (x->pending < x->queued) continue;
+      if (x->deadline <= now) wait = 0;
+      else if (wait < 0 || x->deadline - now < wait) wait = x->deadline - now;
+    }
+    xpoll(pfd, n, wait);
+
+    now = millitime();
+    for (xx = &TT.xfers, n = lpoll; (x = *xx); n++) {
+      if (pfd[n].revents & POLLOUT) xfer_send(x);
+      if (pfd[n].revents & ~POLLOUT) xfer_read(x);
+      if (!x->done && x->pending >= x->queued && x->deadline <= now)
+        xfer_timeout(x);
+      if (x->done) {
+        *xx = x->next;
+        xfer_free(x);
+      } else xx = &x->next;
+    }
+    if (lpoll && (pfd->revents & POLLIN)) tftpd_accept(lfd);
   }
+  if (CFG_TOYBOX_FREE) free(pfd);
+}
+
+void tftpd_main(void)
+{
+  struct sockaddr_storage srcaddr, dstaddr;
+  socklen_t socklen = sizeof(struct sockaddr_storage);
+  int lfd = -1, sfd = -1, len = 0, set = 1;
 
-  //do send / receive file.
-  do_action((struct sockaddr*)&srcaddr, (struct sockaddr*)&dstaddr,
-      socklen, toybuf + 2, opcode, tsize, blksize);
-  if (CFG_TOYBOX_FREE) close(STDIN_FILENO);
+  TT.rpkt = xmalloc(TFTPD_MAXBLKSIZE + 5);
+  if (TT.user) TT.pw = xgetpwnam(TT.user);
+
+  if (toys.optflags & FLAG_D) {
+    lfd = tftpd_listen();
+    if (*toys.optargs) xchroot(*toys.optargs);
+    if (!(toys.optflags & FLAG_F)) daemon(0, 0);
+  } else {
+    memset(&srcaddr, 0, sizeof(srcaddr));
+    if (getsockname(0, (struct sockaddr *)&srcaddr, &socklen)) help_exit(0);
+    if (*toys.optargs) xchroot(*toys.optargs);
+
+    len = recvfrom(0, TT.rpkt, TFTPD_BLKSIZE, 0, (void *)&dstaddr, &socklen);
+
+    sfd = xsocket(dstaddr.ss_family, SOCK_DGRAM, 0);
+    if (setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&set,
+          sizeof(set)) < 0) perror_exit("setsockopt failed");
+    if (bind(sfd, (void *)&srcaddr, socklen)) perror_exit("bind");
+    if (connect(sfd, (void *)&dstaddr, socklen) < 0)
+      perror_exit("can't connect to remote host");
+  }
+
+  // initialize groups, setgid and setuid, now the sockets are bound.
+  if (TT.pw) xsetuser(TT.pw);
+
+  if (sfd >= 0) {
+    TT.max = 1;
+    xfer_start(sfd, len, &dstaddr, socklen);
+    if (CFG_TOYBOX_FREE) close(STDIN_FILENO);
+  }
+  tftpd_loop(lfd);
+  if (CFG_TOYBOX_FREE) free(TT.rpkt);
 }
@@ -65,10 +65,15 @@ struct keycode_map_s {
   int code;
 };
 
+// Processes are kept from one refresh to the next, found by pid in proc_hash,
+// with their stat file left open (up to proc_fdmax of them) so a refresh is
+// one pread() each. Status and cmdline are only read for new pids, or when
+// the name in stat changes because the process exec()ed.
 struct proc_info {
   struct proc_info *next;
-  pid_t pid, ppid;
+  pid_t pid, ppid, tgid;
   uid_t uid;
+  int fd, seen;
   char name[PROC_NAME_LEN];
   char tname[PROC_NAME_LEN];
   char state[4];
@@ -77,49 +82,76 @@ struct proc_info {
   unsigned long vss, vssrw, rss, rss_shr, drt, drt_shr, stack;
 };
 
-static struct proc_info *free_procs, **old_procs, **new_procs;
+#define PROC_HASH 1024
+
+static struct proc_info *free_procs, **new_procs, *proc_hash[PROC_HASH];
+static int proc_room, proc_seen, proc_fds, proc_fdmax;
 static struct cpu_info old_cpu[10], new_cpu[10]; //1 total, 8 cores, 1 null
 static int (*proc_cmp)(const void *a, const void *b);
 
-static struct proc_info *find_old_proc(pid_t pid) 
+static struct proc_info **find_proc(pid_t pid)
 {
-  int i;
+  struct proc_info **pp = proc_hash+(pid&(PROC_HASH-1));
 
-  for (i = 0; old_procs && old_procs[i]; i++)
-    if (old_procs[i]->pid == pid) return old_procs[i];
+  while (*pp && (*pp)->pid != pid) pp = &(*pp)->next;
 
-  return NULL;
+  return pp;
 }
 
-static void read_stat(char *filename, struct proc_info *proc) 
+// Reread proc's stat through its fd (opening path if it hasn't got one),
+// updating the cpu time deltas. Returns 0 if it's gone, 2 if its name
+// changed, else 1.
+static int read_stat(char *path, struct proc_info *proc)
 {
-  int nice;
-  FILE *file;
-  char *open_paren, *close_paren;
-
-  if (!(file = fopen(filename, "r"))) return;
-  fgets(toybuf, sizeof(toybuf), file);
-  fclose(file);
-
-  // Split at first '(' and last ')' to get process name.
-  open_paren = strchr(toybuf, '(');
-  close_paren = strrchr(toybuf, ')');
-  if (!open_paren || !close_paren) return;
-
-  *open_paren = *close_paren = '\0';
-  snprintf(proc->tname, PROC_NAME_LEN, "[%s]",open_paren + 1);
+  long long slot[PROCSNAP_SLOTS];
+  char *name, state;
+  int fd = proc->fd, len, ret = 1;
+
+  if (fd == -1) {
+    if (-1 == (fd = open(path, O_RDONLY|O_CLOEXEC))) return 0;
+    if (proc_fds < proc_fdmax) {
+      proc->fd = fd;
+      proc_fds++;
+    }
+  }
+  len = pread(fd, toybuf, sizeof(toybuf)-1, 0);
+  if (fd != proc->fd) close(fd);
+  else if (len<1) {
+    // A kept fd stays with the process it was opened for, even if the pid's
+    // been reused since, so a new process there shows up next refresh.
+    close(fd);
+    proc->fd = -1;
+    proc_fds--;
+  }
+  if (len<1) return 0;
+  toybuf[len] = 0;
+  if (0>(len = procsnap_parse_stat(toybuf, len, slot, &name, &state)))
+    return 0;
 
-  // Scan rest of string.
-  sscanf(close_paren + 1, " %c %d %*d %*d %*d %*d %*d %*d %*d %*d %*d "
-      "%lu %lu %*d %*d %*d %d %*d %*d %*d %lu %ld "
-      "%*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %d",
-      &proc->state[0], &proc->ppid, &proc->utime, &proc->stime, &nice, 
-      &proc->vss, &proc->rss, &proc->prs);
+  name[len] = 0;
+  if (strncmp(proc->tname+1, name, len) || proc->tname[len+1] != ']') {
+    snprintf(proc->tname, PROC_NAME_LEN, "[%s]", name);
+    ret = 2;
+  }
+  proc->state[0] = state;
+  proc->ppid = slot[1];
+  if (proc->seen) {
+    proc->delta_utime = slot[11] - proc->utime;
+    proc->delta_stime = slot[12] - proc->stime;
+  }
+  proc->delta_time = proc->delta_utime + proc->delta_stime;
+  proc->utime = slot[11];
+  proc->stime = slot[12];
+  proc->vss = slot[20];
+  proc->rss = slot[21];
+  proc->prs = slot[36];
   if (!proc->vss && proc->state[0] != 'Z') proc->state[1] = 'W';
   else proc->state[1] = ' ';
-  if (nice < 0 ) proc->state[2] = '<';
-  else if (nice) proc->state[2] = 'N';
+  if (slot[16] < 0) proc->state[2] = '<';
+  else if (slot[16]) proc->state[2] = 'N';
   else proc->state[2] = ' ';
+
+  return ret;
 }
 
 static void read_status(char *filename, struct proc_info *proc) 
@@ -139,7 +171,7 @@ static void read_cmdline(char *filename, struct proc_info *proc)
   char *ch, *base, tname[PROC_NAME_LEN];
 
   if ((fd = open(filename, O_RDONLY)) == -1) return;
-  rbytes = readall(fd, toybuf, sizeof(toybuf));
+  rbytes = readall(fd, toybuf, sizeof(toybuf)-1);
   close(fd);
   if (rbytes <= 0) {
     strcpy(proc->name, proc->tname);
@@ -168,21 +200,18 @@ static void read_cmdline(char *filename, struct proc_info *proc)
     snprintf(toybuf, sizeof(toybuf), "{%s}", tname);
     toybuf[len-1] = ' ';
   } 
-  snprintf(proc->name, PROC_NAME_LEN, "%s", toybuf);
+  snprintf(proc->name, PROC_NAME_LEN, "%.*s", PROC_NAME_LEN-1, toybuf);
 }
 
-static void add_proc(int proc_num, struct proc_info *proc) 
+// Append to new_procs, which keeps last refresh's order so a sort that
+// didn't change anything is one pass.
+static void add_proc(struct proc_info *proc) 
 {
-  int i;
-
-  if (proc_num >= TT.num_new_procs-1) {
-    new_procs = xrealloc(new_procs, (INIT_PROCS + TT.num_new_procs) 
-        * sizeof(struct proc_info *));
-    for (i = TT.num_new_procs; i < (INIT_PROCS +  TT.num_new_procs); i++)
-      new_procs[i] = NULL;
-    TT.num_new_procs += INIT_PROCS;
+  if (TT.num_new_procs == proc_room) {
+    proc_room += INIT_PROCS;
+    new_procs = xrealloc(new_procs, proc_room*sizeof(struct proc_info *));
   }
-  new_procs[proc_num] = proc;
+  new_procs[TT.num_new_procs++] = proc;
 }
 
 void signal_handler(int sig)
@@ -298,6 +327,7 @@ static struct proc_info *alloc_proc(void)
     free_procs = free_procs->next;
     memset(proc, 0, sizeof(*proc));
   } else proc = xzalloc(sizeof(*proc));
+  proc->fd = -1;
 
   return proc;
 }
@@ -315,128 +345,172 @@ static void free_proc_list(struct proc_info *procs)
 // Free allocated Processes in order to avoid memory leaks
 static void free_proc(struct proc_info *proc) 
 {
+  if (proc->fd != -1) {
+    close(proc->fd);
+    proc_fds--;
+  }
   proc->next = free_procs;
   free_procs = proc;
 }
 
-static struct proc_info *add_new_proc(pid_t pid, pid_t tid)
+// Sizes of mappings, from their maps (or smaps) header.
+static void smaps_size(struct smaps *sm, void *arg)
 {
-  char filename[64];
-  struct proc_info *proc = alloc_proc();
-
-  proc->pid = (tid)? tid : pid;
-  if (!tid) {
-    sprintf(filename, "/proc/%d/stat", pid);
-    read_stat(filename, proc);
-    sprintf(filename, "/proc/%d/cmdline", pid);
-    read_cmdline(filename, proc);
-    sprintf(filename, "/proc/%d/status", pid);
-    read_status(filename, proc);
-  } else{
-    sprintf(filename, "/proc/%d/task/%d/stat", pid,tid);
-    read_stat(filename, proc);
-    sprintf(filename, "/proc/%d/task/%d/cmdline", pid, tid);
-    read_cmdline(filename, proc);
+  struct proc_info *p = arg;
+  unsigned long len = sm->end-sm->start;
+
+  if (strncmp(sm->name, "/dev/", 5) || !strcmp(sm->name, "/dev/zero")) {
+    p->vss += len;
+    if (sm->perms[1] == 'w') p->vssrw += len;
   }
-  return proc;
+  if (!strncmp(sm->name, "[stack]", 7)) p->stack += len;
 }
 
-static void read_smaps(pid_t pid, struct proc_info *p)
+static void smaps_count(struct smaps *sm, void *arg)
 {
-  FILE *fp;
-  char *line;
-  size_t len;
-  long long start, end, val, prvcl, prvdr, shrdr, shrcl;
-  int count;
+  long long *kb = arg;
+  int k;
+
+  for (k = 0; k<SMAPS_KEYS; k++) kb[k] += sm->kb[k];
+}
 
-  p->vss = p->rss = 0;
-  start = end = val = prvcl = prvdr = shrdr = shrcl = 0;
-  sprintf(toybuf, "/proc/%u/smaps", pid);
-  if (!(fp = fopen(toybuf, "r"))) {
+static void smaps_both(struct smaps *sm, void *arg)
+{
+  smaps_size(sm, ((void **)arg)[0]);
+  smaps_count(sm, ((void **)arg)[1]);
+}
+
+// The sizes only need the maps headers, and the kernel adds the counters up
+// in smaps_rollup (since 4.14) without us parsing a dozen lines per mapping.
+// Older kernels get the lot from smaps.
+static void read_smaps(pid_t pid, struct proc_info *p)
+{
+  static int no_rollup;
+  long long kb[SMAPS_KEYS];
+  void *both[] = {p, kb};
+  int fd, rfd;
+
+  p->vss = p->vssrw = p->rss = p->stack = 0;
+  memset(kb, 0, sizeof(kb));
+  if (!no_rollup) {
+    sprintf(toybuf, "/proc/%u/maps", pid);
+    if (-1 != (fd = open(toybuf, O_RDONLY|O_CLOEXEC))) {
+      procsnap_smaps(fd, smaps_size, p);
+      // It was there a moment ago, so no smaps_rollup is an old kernel.
+      // (Kernel threads have no memory to sum, so other errors are fine.)
+      sprintf(toybuf, "/proc/%u/smaps_rollup", pid);
+      if (-1 != (rfd = open(toybuf, O_RDONLY|O_CLOEXEC)))
+        procsnap_smaps(rfd, smaps_count, kb);
+      else if (errno == ENOENT) {
+        no_rollup++;
+        p->vss = p->vssrw = p->stack = 0;
+      }
+    }
+  }
+  if (no_rollup) {
+    sprintf(toybuf, "/proc/%u/smaps", pid);
+    if (-1 != (fd = open(toybuf, O_RDONLY|O_CLOEXEC)))
+      procsnap_smaps(fd, smaps_both, both);
+  }
+  if (fd == -1) {
     error_msg("No %ld\n", (long)pid);
     return;
   }
-  for (;;) {
-    int off;
 
-    line = 0;
-    if (0 >= xgetline(&line, &len, fp)) break;
-    count = sscanf(line, "%llx-%llx %s %*s %*s %*s %n",
-        &start, &end, toybuf, &off);
-
-    if (count == 3) {
-      end = end - start;
-      if (strncmp(line+off, "/dev/", 5) || !strcmp(line+off, "/dev/zero\n")) {
-        p->vss += end;
-        if (toybuf[1] == 'w') p->vssrw += end;
-      }
-      if (line[off] && !strncmp(line+off, "[stack]",7)) p->stack += end;
-    } else {
-      if (0<sscanf(line, "Private_Clean: %lld", &val)) prvcl += val;
-      if (0<sscanf(line, "Private_Dirty: %lld", &val)) prvdr += val;
-      if (0<sscanf(line, "Shared_Dirty: %lld", &val)) shrdr += val;
-      if (0<sscanf(line, "Shared_Clean: %lld", &val)) shrcl += val;
+  p->rss_shr = kb[SMAPS_SHARED_DIRTY] + kb[SMAPS_SHARED_CLEAN];
+  p->drt = kb[SMAPS_PRIVATE_DIRTY] + kb[SMAPS_SHARED_DIRTY];
+  p->drt_shr = kb[SMAPS_SHARED_DIRTY];
+  p->rss = p->rss_shr + kb[SMAPS_PRIVATE_DIRTY] + kb[SMAPS_PRIVATE_CLEAN];
+}
+
+// Add pid (a thread of tgid if they differ) to this refresh, or refresh it if
+// it was there last time. Returns NULL if it's gone or not shown.
+static struct proc_info *update_proc(pid_t pid, pid_t tgid,
+  struct proc_info *parent)
+{
+  struct proc_info **pp = find_proc(pid), *proc = *pp;
+  char path[64];
+  int len, rc;
+
+  if (pid == tgid) len = sprintf(path, "/proc/%d/", pid);
+  else len = sprintf(path, "/proc/%d/task/%d/", tgid, pid);
+  if (!proc) {
+    proc = alloc_proc();
+    proc->pid = pid;
+    proc->tgid = tgid;
+  }
+
+  strcpy(path+len, "stat");
+  if (!(rc = read_stat(path, proc))) goto gone;
+  if (rc == 2) {
+    // Threads have the same uid as their process.
+    if (parent) proc->uid = parent->uid;
+    else {
+      strcpy(path+len, "status");
+      read_status(path, proc);
     }
-    free(line);
+    strcpy(path+len, "cmdline");
+    read_cmdline(path, proc);
   }
-  free(line); //incase it broke out.
-  p->rss_shr = shrdr + shrcl;
-  p->drt = prvdr + shrdr;
-  p->drt_shr = shrdr;
-  p->rss = p->rss_shr + prvdr + prvcl;
-  fclose(fp);
+  if (TT.m_flag && !parent) {
+    read_smaps(pid, proc);
+    if (!proc->vss) goto gone;
+  }
+
+  if (!proc->seen) {
+    *pp = proc;
+    add_proc(proc);
+  }
+  proc->seen = proc_seen;
+
+  return proc;
+
+gone:
+  // Known processes that weren't seen this time get freed by read_procs().
+  if (!proc->seen) free_proc(proc);
+
+  return 0;
 }
 
 static void read_procs(void) // Read Processes
 {
-  DIR *proc_dir, *thr_dir;
-  struct dirent *pid_dir, *t_dir;
+  struct dirbuf *dir, *task;
+  struct dirbuf_ent *entry;
   struct proc_info *proc;
+  char path[64];
   pid_t pid, tid;
-  int proc_num = 0;
-
-  proc_dir = opendir("/proc");
-  if (!proc_dir) perror_exit("Could not open /proc");
+  int fd, i, j;
 
-  new_procs = xzalloc(INIT_PROCS * sizeof(struct proc_info *));
-  TT.num_new_procs = INIT_PROCS;
+  proc_seen++;
+  if (-1 == (fd = open("/proc", O_RDONLY|O_CLOEXEC))
+      || !(dir = dirbuf_open(fd, 0))) perror_exit("Could not open /proc");
 
-  while ((pid_dir = readdir(proc_dir))) {
-    if (!isdigit(pid_dir->d_name[0])) continue;
+  while ((entry = dirbuf_read(dir))) {
+    if (!(pid = atoi(entry->name))) continue;
+    if (!(proc = update_proc(pid, pid, 0)) || !TT.threads) continue;
 
-    pid = atoi(pid_dir->d_name);
-    proc = add_new_proc(pid, 0);
-    if (TT.m_flag) {
-      read_smaps(pid, proc);
-      if (!proc->vss) {
-        free(proc);
-        continue;
-      }
-    }
-    add_proc(proc_num++, proc);
-
-    if (TT.threads) {
-      char filename[64];
-      uid_t uid = proc->uid;
-
-      sprintf(filename,"/proc/%d/task",pid);
-      if ((thr_dir = opendir(filename))) {
-        while ((t_dir = readdir(thr_dir))) {
-          if (!isdigit(t_dir->d_name[0])) continue;   
-
-          tid = atoi(t_dir->d_name);
-          if (pid == tid) continue;
-          proc = add_new_proc(pid, tid);
-          proc->uid = uid; //child will have same uid as parent.
-          add_proc(proc_num++, proc);
-        }
-        closedir(thr_dir);
-      }
+    sprintf(path, "/proc/%d/task", pid);
+    if (-1 == (fd = open(path, O_RDONLY|O_CLOEXEC))) continue;
+    if (!(task = dirbuf_open(fd, 4096))) {
+      close(fd);
+      continue;
     }
+    while ((entry = dirbuf_read(task)))
+      if ((tid = atoi(entry->name)) && tid != pid) update_proc(tid, pid, proc);
+    dirbuf_close(task);
   }
+  dirbuf_close(dir);
 
-  closedir(proc_dir);
-  TT.num_new_procs = proc_num;
+  // Forget the ones that went away, keeping the rest in last refresh's order.
+  for (i = j = 0; i < TT.num_new_procs; i++) {
+    proc = new_procs[i];
+    if (proc->seen == proc_seen) new_procs[j++] = proc;
+    else {
+      *find_proc(proc->pid) = proc->next;
+      free_proc(proc);
+    }
+  }
+  TT.num_new_procs = j;
 }
 
 //calculate percentage.
@@ -545,9 +619,8 @@ static int print_header(struct sysinfo *info, unsigned int cols)
 static void print_procs(void) 
 {
   int i, j = 0;
-  struct proc_info *old_proc, *proc;
+  struct proc_info *proc;
   long unsigned total_delta_time;
-  struct passwd *user;
   char *user_str, user_buf[20];
   struct sysinfo info;
   unsigned int cols=0, rows =0;
@@ -560,25 +633,14 @@ static void print_procs(void)
   if (toys.optflags & FLAG_b) rows = INT_MAX;
   TT.rows = rows;
 
-  for (i = 0; i < TT.num_new_procs; i++) {
-    if (new_procs[i]) {
-      old_proc = find_old_proc(new_procs[i]->pid);
-      if (old_proc) {
-        new_procs[i]->delta_utime = new_procs[i]->utime - old_proc->utime;
-        new_procs[i]->delta_stime = new_procs[i]->stime - old_proc->stime;
-      } else {
-        new_procs[i]->delta_utime = 0;
-        new_procs[i]->delta_stime = 0;
-      }
-      new_procs[i]->delta_time = new_procs[i]->delta_utime 
-        + new_procs[i]->delta_stime;
-    }
-  }
-
   total_delta_time = new_cpu[0].total - old_cpu[0].total;
   if (!total_delta_time) total_delta_time = 1;
 
-  qsort(new_procs, TT.num_new_procs, sizeof(struct proc_info *), proc_cmp);
+  // Most refreshes don't change the order much, and often not at all.
+  for (i = 1; i < TT.num_new_procs; i++)
+    if (proc_cmp(new_procs+i-1, new_procs+i) > 0) break;
+  if (i < TT.num_new_procs)
+    qsort(new_procs, TT.num_new_procs, sizeof(struct proc_info *), proc_cmp);
 
   //Memory details
   sysinfo(&info);
@@ -602,10 +664,7 @@ static void print_procs(void)
     j = 0;
     proc = new_procs[i];
 
-    user  = getpwuid(proc->uid);
-    if (user && user->pw_name) {
-      user_str = user->pw_name;
-    } else {
+    if (!(user_str = uid_name(proc->uid))) {
       snprintf(user_buf, 20, "%d", proc->uid);
       user_str = user_buf;
     }
@@ -661,19 +720,6 @@ static void print_procs(void)
   }
 }
 
-/* 
- * Free old processes(displayed in old iteration) in order to 
- * avoid memory leaks
- */
-static void free_procs_arr(struct proc_info **procs) 
-{
-  int i;
-  for (i = 0; procs && procs[i]; i++)
-      free_proc(procs[i]);
-
-  free(procs);
-}
-
 static int numcmp(long long a, long long b) 
 {
   if (a < b) return (TT.reverse)?-1 : 1;
@@ -761,6 +807,11 @@ void top_main(void )
 {
   int get_key;
 
+  // The last run's processes went with its heap when it exited.
+  free_procs = 0;
+  new_procs = 0;
+  proc_room = proc_fds = 0;
+  memset(proc_hash, 0, sizeof(proc_hash));
   proc_cmp = &proc_cpu_cmp;
   if ( TT.delay < 0)  TT.delay = 3;
   if (toys.optflags & FLAG_m) {
@@ -768,17 +819,18 @@ void top_main(void )
     TT.m_flag = 1;
   }
 
+  // Leave room for everything else that wants a filehandle.
+  proc_fdmax = sysconf(_SC_OPEN_MAX)/2;
+
   sigatexit(signal_handler);
   read_cpu_stat();
   get_key = read_input(0);
 
   while (!(toys.optflags & FLAG_n) || TT.iterations--) {
-    old_procs = new_procs;
     memcpy(old_cpu, new_cpu, sizeof(old_cpu));
     read_procs();
     read_cpu_stat();
     print_procs();
-    free_procs_arr(old_procs);
     if ((toys.optflags & FLAG_n) && !TT.iterations) break;
 
     get_key = read_input(TT.delay);
@@ -840,9 +892,10 @@ void top_main(void )
   }
   xputc('\n');
   if (CFG_TOYBOX_FREE) {
-    free_proc_list(free_procs);
-    free_procs = NULL;
-    free_procs_arr(new_procs);
+    int i;
+
+    for (i = 0; i < TT.num_new_procs; i++) free_proc(new_procs[i]);
+    free(new_procs);
     free_proc_list(free_procs);
   }
 }
@@ -23,7 +23,9 @@ config TR
 #include "toys.h"
 
 GLOBALS(
-  short map[256]; //map of chars
+  // low byte is what a char translates to, 0x100 deletes it, 0x200 means
+  // runs of this char get squeezed when it's output
+  short map[256];
   int len1, len2;
 )
 
@@ -33,23 +35,22 @@ enum {
   class_punct,class_cntrl,class_xdigit,class_invalid
 };
 
-static void map_translation(char *set1 , char *set2)
+static void map_translation(unsigned char *set1, unsigned char *set2)
 {
   int i = TT.len1, k = 0;
 
   if (toys.optflags & FLAG_d)
     for (; i; i--, k++) TT.map[set1[k]] = set1[k]|0x100; //set delete bit
 
+  // Squeeze what comes out: SET2 when there is one, else SET1.
   if (toys.optflags & FLAG_s) {
-    for (i = TT.len1, k = 0; i; i--, k++)
-      TT.map[set1[k]] = TT.map[set1[k]]|0x200;
-    for (i = TT.len2, k = 0; i; i--, k++)
-      TT.map[set2[k]] = TT.map[set2[k]]|0x200;
+    if (set2) for (k = 0; k < TT.len2; k++) TT.map[set2[k]] |= 0x200;
+    else for (k = 0; k < TT.len1; k++) TT.map[set1[k]] |= 0x200;
   }
   i = k = 0;
   while (!(toys.optflags & FLAG_d) && set2 && TT.len1--) { //ignore set2 if -d present
     TT.map[set1[i]] = ((TT.map[set1[i]] & 0xFF00) | set2[k]);
-    if (set2[k + 1]) k++;
+    if (k + 1 < TT.len2) k++;
     i++;
   }
 }
@@ -131,7 +132,8 @@ static char *expand_set(char *arg, int *len)
 
   while (*arg) {
 
-    if (i >= size) {
+    // a range or class adds up to 256 at once
+    if (i + 256 >= size) {
       size += 256;
       set = xrealloc(set, size);
     }
@@ -208,29 +210,39 @@ save:
   return set;
 }
 
-static void print_map(char *set1, char *set2)
+// Work a 64k block at a time. Plain translation goes through a byte table
+// (or is just a copy if nothing changes), deleting and squeezing compact the
+// block in place, and each block is one write.
+static void print_map(void)
 {
-  int r = 0, i, prev_char = -1;
+  unsigned char *buf, xlat[256];
+  int i, len, out, c, prev = -1;
 
-  while (1)
-  {
-    i = 0;
-    r = read(STDIN_FILENO, (toybuf), sizeof(toybuf));
-    if (!r) break;
-    for (;r > i;i++) {
+  for (i = 0; i < 256; i++) xlat[i] = TT.map[i];
+  if (!(toys.optflags & (FLAG_d|FLAG_s))) {
+    for (i = 0; i < 256; i++) if (xlat[i] != i) break;
+    if (i == 256) {
+      xsendfile(0, 1);
+      return;
+    }
+  }
 
-      if ((toys.optflags & FLAG_d) && (TT.map[(int)toybuf[i]] & 0x100)) continue;
-      if (toys.optflags & FLAG_s) {
-        if ((TT.map[(int)toybuf[i]] & 0x200) &&
-            (prev_char == TT.map[(int)toybuf[i]])) {
-          continue;
-        }
+  buf = xmalloc(65536);
+  while ((len = xread(0, buf, 65536))) {
+    if (!(toys.optflags & (FLAG_d|FLAG_s)))
+      for (i = 0; i < len; i++) buf[i] = xlat[buf[i]];
+    else {
+      for (i = out = 0; i < len; i++) {
+        if ((c = TT.map[buf[i]]) & 0x100) continue;
+        c &= 0xff;
+        if (c == prev && (TT.map[c] & 0x200)) continue;
+        buf[out++] = prev = c;
       }
-      xputc(TT.map[(int)toybuf[i]] & 0xFF);
-      prev_char = TT.map[(int)toybuf[i]];
-      fflush(stdout);
+      len = out;
     }
+    txwrite(1, buf, len);
   }
+  free(buf);
 }
 
 static void do_complement(char **set)
@@ -260,9 +272,9 @@ void tr_main(void)
     if (toys.optargs[1][0] == '\0') error_exit("set2 can't be empty string");
     set2 = expand_set(toys.optargs[1], &TT.len2);
   }
-  map_translation(set1, set2);
+  map_translation((void *)set1, (void *)set2);
 
-  print_map(set1, set2);
+  print_map();
   free(set1);
   free(set2);
 }
@@ -7,17 +7,17 @@
  *
  * No Standard
 
-USE_TRACEROUTE(NEWTOY(traceroute, "<1>2i:f#<1>255=1z#<0>86400=0g*w#<0>86400=5t#<0>255=0s:q#<1>255=3p#<1>65535=33434m#<1>255=30rvndlIUF64", TOYFLAG_STAYROOT|TOYFLAG_USR|TOYFLAG_BIN))
+USE_TRACEROUTE(NEWTOY(traceroute, "<1>2N#<1=16i:f#<1>255=1z#<0>86400=0g*w#<0>86400=5t#<0>255=0s:q#<1>255=3p#<1>65535=33434m#<1>255=30rvndlIUF64", TOYFLAG_STAYROOT|TOYFLAG_USR|TOYFLAG_BIN))
 USE_TRACEROUTE(OLDTOY(traceroute6,traceroute, TOYFLAG_STAYROOT|TOYFLAG_USR|TOYFLAG_BIN))
 config TRACEROUTE
   bool "traceroute"
   default n
   help
-    usage: traceroute [-46FUIldnvr] [-f 1ST_TTL] [-m MAXTTL] [-p PORT] [-q PROBES]
+    usage: traceroute [-46FUIldnvr] [-f 1ST_TTL] [-m MAXTTL] [-N PROBES] [-p PORT] [-q PROBES]
     [-s SRC_IP] [-t TOS] [-w WAIT_SEC] [-g GATEWAY] [-i IFACE] [-z PAUSE_MSEC] HOST [BYTES]
     
-    traceroute6 [-dnrv] [-m MAXTTL] [-p PORT] [-q PROBES][-s SRC_IP] [-t TOS] [-w WAIT_SEC] 
-      [-i IFACE] HOST [BYTES]
+    traceroute6 [-dnrv] [-m MAXTTL] [-N PROBES] [-p PORT] [-q PROBES][-s SRC_IP] [-t TOS]
+      [-w WAIT_SEC] [-i IFACE] HOST [BYTES]
 
     Trace the route to HOST
 
@@ -31,6 +31,7 @@ config TRACEROUTE
     -v    verbose
     -r    Bypass routing tables, send directly to HOST
     -m    Max time-to-live (max number of hops)(RANGE 1 to 255)
+    -N    Probes in flight at once across all hops (default 16, 1 = hop by hop)
     -p    Base UDP port number used in probes(default 33434)(RANGE 1 to 65535)
     -q    Number of probes per TTL (default 3)(RANGE 1 to 255)
     -s    IP address to use as the source address
@@ -59,6 +60,7 @@ GLOBALS(
   long pause_time;
   long first_ttl;
   char *iface;
+  long squeries;
 
   uint32_t gw_list[9];
   int recv_sock;
@@ -81,6 +83,14 @@ struct payload_s {
   uint32_t ident;
 };
 
+// What came back for one probe: len is 0 if nothing did.
+struct probe_s {
+  struct sockaddr_storage from;
+  unsigned long long sent;
+  unsigned delta;
+  int done, len, res, pmtu, ttl, type, code;
+};
+
 char addr_str[INET6_ADDRSTRLEN];
 struct sockaddr_storage dest;
 
@@ -194,285 +204,322 @@ static void resolve_addr(char *host, int family, int type, int proto, void *sock
   freeaddrinfo(info);
 }
 
+// Work out whether the packet in toybuf answers one of our probes. Returns
+// its sequence number (0 if it isn't ours) and fills in REPLY.
+static int match_reply(int rcv_len, struct probe_s *reply)
+{
+  int seq = 0;
+
+  reply->len = rcv_len;
+  if (!TT.istraceroute6) {
+    struct ip *rcv_pkt = (struct ip*) toybuf, *hip;
+    struct icmp *ricmp, *hicmp;
+    struct udphdr *hudp;
+    int left = rcv_len - (rcv_pkt->ip_hl << 2);
+
+    ricmp = (struct icmp *) ((void*)rcv_pkt + (rcv_pkt->ip_hl << 2));
+    reply->ttl = rcv_pkt->ip_ttl;
+    reply->type = ricmp->icmp_type;
+    reply->code = ricmp->icmp_code;
+    if (ricmp->icmp_code == ICMP_UNREACH_NEEDFRAG)
+      reply->pmtu = ntohs(ricmp->icmp_nextmtu);
+
+    if (!((ricmp->icmp_type == ICMP_TIMXCEED
+          && ricmp->icmp_code == ICMP_TIMXCEED_INTRANS)
+        || ricmp->icmp_type == ICMP_UNREACH
+        || ricmp->icmp_type == ICMP_ECHOREPLY)) return 0;
+    reply->res = ricmp->icmp_type == ICMP_TIMXCEED ? -1 : ricmp->icmp_code;
+
+    hip = &ricmp->icmp_ip;
+    if (toys.optflags & FLAG_U) {
+      hudp = (struct udphdr*) ((char*)hip + (hip->ip_hl << 2));
+      if ((hip->ip_hl << 2) + 12 <= left && hip->ip_p == IPPROTO_UDP)
+        seq = (uint16_t)(hudp->dest - TT.port);
+    } else if (ricmp->icmp_type == ICMP_ECHOREPLY) {
+      if (ricmp->icmp_id == htons(TT.ident)) {
+        seq = ntohs(ricmp->icmp_seq);
+        reply->res = ICMP_UNREACH_PORT;
+      }
+    } else {
+      hicmp = (struct icmp *) ((void*)hip + (hip->ip_hl << 2));
+      if ((hip->ip_hl << 2) + ICMP_HD_SIZE4 <= left
+          && hip->ip_p == IPPROTO_ICMP && hicmp->icmp_id == htons(TT.ident))
+        seq = ntohs(hicmp->icmp_seq);
+    }
+  } else {
+    struct icmp6_hdr *ricmp  = (struct icmp6_hdr *) toybuf;
+    struct ip6_hdr *hip;
+    struct udphdr *hudp;
+    int hdr_next;
+
+    if (!((ricmp->icmp6_type == ICMP6_TIME_EXCEEDED
+          && ricmp->icmp6_code == ICMP6_TIME_EXCEED_TRANSIT)
+        || ricmp->icmp6_type == ICMP6_DST_UNREACH
+        || ricmp->icmp6_type == ICMP6_ECHO_REPLY)) return 0;
+    reply->res = ricmp->icmp6_type == ICMP6_TIME_EXCEEDED ? -1
+      : ricmp->icmp6_code;
+
+    hip = (struct ip6_hdr *)(ricmp + 1);
+    hudp = (struct udphdr*) (hip + 1);
+    hdr_next = hip->ip6_nxt;
+    if (hdr_next == IPPROTO_FRAGMENT) {
+      hdr_next = *(unsigned char*)hudp;
+      hudp++;
+    }
+
+    if (hdr_next == IPPROTO_UDP) {
+      struct payload_s *pkt = (struct payload_s*)(hudp + 1);
+      if (pkt->ident == TT.ident) seq = pkt->seq;
+    }
+  }
+
+  return seq;
+}
+
+// Add one probe's answer (or lack of one) to its hop's line. LAST is the
+// address already shown on this line, and REACH and FEXIT record whether
+// this hop ends the trace.
+static void print_probe(struct probe_s *p, int first,
+  struct sockaddr_storage *last, int *reach, int *fexit)
+{
+  struct sockaddr_storage *from = &p->from;
+
+  if (!p->len) {
+    xprintf("  *");
+    return;
+  }
+
+  if (!TT.istraceroute6) {
+    if (memcmp(&((struct sockaddr_in *)last)->sin_addr,
+          &((struct sockaddr_in *)from)->sin_addr, sizeof(struct in_addr))) {
+      if (!(toys.optflags & FLAG_n)) {
+        char host[NI_MAXHOST];
+        if (!getnameinfo((struct sockaddr *) from,
+              sizeof(struct sockaddr_in), host, NI_MAXHOST, NULL, 0, 0))
+          xprintf("  %s (", host);
+        else xprintf(" %s (", inet_ntoa(
+                ((struct sockaddr_in *)from)->sin_addr));
+      }
+      xprintf(" %s", inet_ntoa(((struct sockaddr_in *)from)->sin_addr));
+      if (!(toys.optflags & FLAG_n)) xprintf(")");
+      memcpy(last, from, sizeof(*from));
+    }
+    xprintf("  %u.%03u ms", p->delta / 1000, p->delta % 1000);
+    if (toys.optflags & FLAG_l) xprintf(" (%d)", p->ttl);
+    if (toys.optflags & FLAG_v) {
+      xprintf(" %d bytes from %s : icmp type %d code %d\t",
+          p->len, inet_ntoa(((struct sockaddr_in *)from)->sin_addr),
+          p->type, p->code);
+    }
+
+    switch (p->res) {
+      case ICMP_UNREACH_PORT:
+        if (p->ttl <= 1) xprintf(" !");
+        *reach = 1;
+        break;
+      case ICMP_UNREACH_NET:
+        xprintf(" !N");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_HOST:
+        xprintf(" !H");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_PROTOCOL:
+        xprintf(" !P");
+        *reach = 1;
+        break;
+      case ICMP_UNREACH_NEEDFRAG:
+        xprintf(" !F-%d", p->pmtu);
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_SRCFAIL:
+        xprintf(" !S");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_FILTER_PROHIB:
+      case ICMP_UNREACH_NET_PROHIB:
+        xprintf(" !A");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_HOST_PROHIB:
+        xprintf(" !C");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_HOST_PRECEDENCE:
+        xprintf(" !V");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_PRECEDENCE_CUTOFF:
+        xprintf(" !C");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_NET_UNKNOWN:
+      case ICMP_UNREACH_HOST_UNKNOWN:
+        xprintf(" !U");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_ISOLATED:
+        xprintf(" !I");
+        ++*fexit;
+        break;
+      case ICMP_UNREACH_TOSNET:
+      case ICMP_UNREACH_TOSHOST:
+        xprintf(" !T");
+        ++*fexit;
+        break;
+      default:
+        break;
+    }
+  } else {
+    if (memcmp(&((struct sockaddr_in6 *)last)->sin6_addr,
+          &((struct sockaddr_in6 *)from)->sin6_addr,
+          sizeof(struct in6_addr))) {
+      if (!(toys.optflags & FLAG_n)) {
+        char host[NI_MAXHOST];
+        if (!getnameinfo((struct sockaddr *) from,
+              sizeof(*from), host, sizeof(host), NULL, 0, 0))
+          xprintf("  %s (", host);
+      }
+      memset(addr_str, '\0', INET6_ADDRSTRLEN);
+      inet_ntop(AF_INET6, &((struct sockaddr_in6 *)from)->sin6_addr,
+          addr_str, INET6_ADDRSTRLEN);
+      xprintf(" %s", addr_str);
+
+      if (!(toys.optflags & FLAG_n)) xprintf(")");
+      memcpy(last, from, sizeof(*from));
+    }
+
+    if ((toys.optflags & FLAG_v) && first) {
+      memset(addr_str, '\0', INET6_ADDRSTRLEN);
+      inet_ntop(AF_INET6, &((struct sockaddr_in6 *)from)->sin6_addr,
+          addr_str, INET6_ADDRSTRLEN);
+      xprintf(" %d bytes to %s ", p->len - (int)sizeof(struct ip6_hdr),
+          addr_str);
+    }
+    xprintf("  %u.%03u ms", p->delta / 1000, p->delta % 1000);
+
+    switch (p->res) {
+      case ICMP6_DST_UNREACH_NOPORT:
+        ++*fexit;
+        *reach = 1;
+        break;
+      case ICMP6_DST_UNREACH_NOROUTE:
+        xprintf(" !N");
+        ++*fexit;
+        break;
+      case ICMP6_DST_UNREACH_ADDR:
+        xprintf(" !H");
+        ++*fexit;
+        break;
+      case ICMP6_DST_UNREACH_ADMIN:
+        xprintf(" !S");
+        ++*fexit;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Keep up to -N probes in flight across all the TTLs at once, each with its
+// own sequence number so replies can come back in any order, and print the
+// hops in order as each one's probes are answered or time out. Probes stop
+// going out past the first hop known to end the trace.
 static void do_trace()
 {
-  int seq, fexit, ttl, tv = TT.wait_time * 1000;
+  int hops = TT.max_ttl - TT.first_ttl + 1, total = hops * TT.ttl_probes,
+      sent = 0, busy = 0, hop = 0, i;
+  unsigned long long now, next = 0, tv = TT.wait_time * USEC;
+  struct probe_s *probes = xzalloc(total * sizeof(*probes)), *p, reply;
   struct pollfd pfd[1];
-  struct sockaddr_storage from;
 
-  memset(&from, 0, sizeof(from));
   pfd[0].fd = TT.recv_sock;
   pfd[0].events = POLLIN;
 
-  for (ttl = TT.first_ttl; ttl <= TT.max_ttl; ++ttl) {
-    int probe, dest_reach = 0, print_verbose = 1;
-    struct timeval t1, t2;
-    struct sockaddr_storage last_addr;
-
-    memset(&last_addr, 0, sizeof(last_addr));
-    fexit = 0;
-    xprintf("%2d", ttl);
-
-    for (probe = 0, seq = 0; probe < TT.ttl_probes; ++probe) {
-      int res = 0, tleft;
-
-      fflush(NULL);
-      if (!TT.istraceroute6)
-        if (probe && (toys.optflags & FLAG_z)) usleep(TT.pause_time * 1000);
-
-      if (!TT.istraceroute6) send_probe4(++seq, ttl);
-      else send_probe6(++seq, ttl);
-      gettimeofday(&t1, NULL);
-      t2 = t1;
-
-      while ((tleft = (int)(tv - ((unsigned long long)(t2.tv_sec * 1000ULL 
-                  + t2.tv_usec/1000) - (unsigned long long)(t1.tv_sec * 1000ULL
-                    + t1.tv_usec/1000)))) >= 0) {
-        unsigned delta = 0;
-        if (!(res = poll(pfd, 1, tleft))) { 
-          xprintf("  *"); 
-          break;
-        }
-        gettimeofday(&t2, NULL);
-        if (res < 0) {
-          if (errno != EINTR) perror_exit("poll");
-          continue;
-        }
-        delta = (t2.tv_sec * USEC + t2.tv_usec)
-          - (t1.tv_sec * USEC + t1.tv_usec);
-
-        if (pfd[0].revents) {
-          unsigned addrlen = sizeof(struct sockaddr_storage);
-          int rcv_len, icmp_res = 0;
-
-          rcv_len = recvfrom(TT.recv_sock, toybuf, sizeof(toybuf),
-              MSG_DONTWAIT, (struct sockaddr *) &from, &addrlen);
-          if (rcv_len <= 0) continue;
-
-          if (!TT.istraceroute6) {
-            int pmtu = 0;
-            struct ip *rcv_pkt = (struct ip*) toybuf;
-            struct icmp *ricmp;
-
-            ricmp = (struct icmp *) ((void*)rcv_pkt + (rcv_pkt->ip_hl << 2));
-            if (ricmp->icmp_code == ICMP_UNREACH_NEEDFRAG)
-              pmtu = ntohs(ricmp->icmp_nextmtu);
-
-            if ((ricmp->icmp_type == ICMP_TIMXCEED
-                  && ricmp->icmp_code == ICMP_TIMXCEED_INTRANS)
-                || ricmp->icmp_type == ICMP_UNREACH
-                || ricmp->icmp_type == ICMP_ECHOREPLY) {
-
-              struct udphdr *hudp;
-              struct icmp *hicmp;
-              struct ip *hip = &ricmp->icmp_ip;
-
-              if (toys.optflags & FLAG_U) {
-                hudp = (struct udphdr*) ((char*)hip + (hip->ip_hl << 2));
-                if ((hip->ip_hl << 2) + 12 <=(rcv_len - (rcv_pkt->ip_hl << 2))
-                    && hip->ip_p == IPPROTO_UDP
-                    && hudp->dest == (TT.port + seq))
-                  icmp_res = (ricmp->icmp_type == ICMP_TIMXCEED ? -1 :
-                      ricmp->icmp_code);
-              } else {
-                hicmp = (struct icmp *) ((void*)hip + (hip->ip_hl << 2));
-                if (ricmp->icmp_type == ICMP_ECHOREPLY 
-                    && ricmp->icmp_id == ntohs(TT.ident)
-                    && ricmp->icmp_seq == ntohs(seq))
-                  icmp_res = ICMP_UNREACH_PORT;
-                else if ((hip->ip_hl << 2) + ICMP_HD_SIZE4 
-                    <= (rcv_len - (rcv_pkt->ip_hl << 2))
-                    && hip->ip_p == IPPROTO_ICMP
-                    && hicmp->icmp_id == htons(TT.ident)
-                    && hicmp->icmp_seq == htons(seq))
-                  icmp_res = (ricmp->icmp_type == ICMP_TIMXCEED ? -1 : 
-                      ricmp->icmp_code);
-              }
-            }
-            if (!icmp_res) continue;
-
-            if (addrlen > 0) {
-              if (memcmp(&((struct sockaddr_in *)&last_addr)->sin_addr, 
-                    &((struct sockaddr_in *)&from)->sin_addr, 
-                    sizeof(struct in_addr))) {
-                if (!(toys.optflags & FLAG_n)) {
-                  char host[NI_MAXHOST];
-                  if (!getnameinfo((struct sockaddr *) &from, 
-                        sizeof(struct sockaddr_in), host, NI_MAXHOST, NULL, 0, 0))
-                    xprintf("  %s (", host);
-                  else xprintf(" %s (", inet_ntoa(
-                          ((struct sockaddr_in *)&from)->sin_addr));
-                }
-                xprintf(" %s", inet_ntoa(
-                      ((struct sockaddr_in *)&from)->sin_addr));
-                if (!(toys.optflags & FLAG_n)) xprintf(")");
-                memcpy(&last_addr, &from, sizeof(from));
-              }
-              xprintf("  %u.%03u ms", delta / 1000, delta % 1000);
-              if (toys.optflags & FLAG_l) xprintf(" (%d)", rcv_pkt->ip_ttl);
-              if (toys.optflags & FLAG_v) {
-                xprintf(" %d bytes from %s : icmp type %d code %d\t",
-                    rcv_len, inet_ntoa(((struct sockaddr_in *)&from)->sin_addr),
-                    ricmp->icmp_type, ricmp->icmp_code);
-              }
-            } else xprintf("\t!H");
-
-            switch (icmp_res) {
-              case ICMP_UNREACH_PORT:
-                if (rcv_pkt->ip_ttl <= 1) xprintf(" !");
-                dest_reach = 1;
-                break;
-              case ICMP_UNREACH_NET:
-                xprintf(" !N");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_HOST:
-                xprintf(" !H");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_PROTOCOL:
-                xprintf(" !P");
-                dest_reach = 1;
-                break;
-              case ICMP_UNREACH_NEEDFRAG:
-                xprintf(" !F-%d", pmtu);
-                ++fexit;
-                break;
-              case ICMP_UNREACH_SRCFAIL:
-                xprintf(" !S");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_FILTER_PROHIB:
-              case ICMP_UNREACH_NET_PROHIB:
-                xprintf(" !A");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_HOST_PROHIB:
-                xprintf(" !C");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_HOST_PRECEDENCE:
-                xprintf(" !V");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_PRECEDENCE_CUTOFF:
-                xprintf(" !C");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_NET_UNKNOWN:  
-              case ICMP_UNREACH_HOST_UNKNOWN:
-                xprintf(" !U");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_ISOLATED:
-                xprintf(" !I");
-                ++fexit;
-                break;
-              case ICMP_UNREACH_TOSNET:
-              case ICMP_UNREACH_TOSHOST:
-                xprintf(" !T");
-                ++fexit;
-                break;
-              default:
-                break;
-            }
-            break;
-          } else {
-            struct icmp6_hdr *ricmp  = (struct icmp6_hdr *) toybuf;
-
-            if ((ricmp->icmp6_type == ICMP6_TIME_EXCEEDED
-                  && ricmp->icmp6_code == ICMP6_TIME_EXCEED_TRANSIT)
-                || ricmp->icmp6_type == ICMP6_DST_UNREACH
-                || ricmp->icmp6_type == ICMP6_ECHO_REPLY) {
-
-              struct ip6_hdr *hip;
-              struct udphdr *hudp;
-              int hdr_next;
-
-              hip = (struct ip6_hdr *)(ricmp + 1);
-              hudp = (struct udphdr*) (hip + 1);
-              hdr_next = hip->ip6_nxt;
-              if (hdr_next == IPPROTO_FRAGMENT) {
-                hdr_next = *(unsigned char*)hudp;
-                hudp++;
-              }
-
-              if (hdr_next == IPPROTO_UDP) {
-                struct payload_s *pkt = (struct payload_s*)(hudp + 1);
-                if ((pkt->ident == TT.ident) && (pkt->seq == seq))
-                  icmp_res = (ricmp->icmp6_type == ICMP6_TIME_EXCEEDED) ? -1 :
-                    ricmp->icmp6_code;
-              }
-            }
-
-            if (!icmp_res) continue;
-            if (addrlen > 0) {
-              if (memcmp(&((struct sockaddr_in6 *)&last_addr)->sin6_addr, 
-                    &((struct sockaddr_in6 *)&from)->sin6_addr, 
-                    sizeof(struct in6_addr))) {
-                if (!(toys.optflags & FLAG_n)) {
-                  char host[NI_MAXHOST];
-                  if (!getnameinfo((struct sockaddr *) &from,
-                        sizeof(from), host, sizeof(host), NULL, 0, 0))
-                    xprintf("  %s (", host);
-                }
-                memset(addr_str, '\0', INET6_ADDRSTRLEN);
-                inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&from)->sin6_addr,
-                    addr_str, INET6_ADDRSTRLEN);
-                xprintf(" %s", addr_str);
-
-                if (!(toys.optflags & FLAG_n)) xprintf(")");
-                memcpy(&last_addr,&from,sizeof(from));
-              }
-
-              if (toys.optflags & FLAG_v) {
-                if(print_verbose){
-                  memset(addr_str, '\0', INET6_ADDRSTRLEN);
-                  inet_ntop(AF_INET6, &((struct sockaddr_in6 *)
-                        &from)->sin6_addr, addr_str, INET6_ADDRSTRLEN);
-                  rcv_len -= sizeof(struct ip6_hdr);
-                  xprintf(" %d bytes to %s ", rcv_len, addr_str);
-                }
-              }
-              xprintf("  %u.%03u ms", delta / 1000, delta % 1000);
-              delta = 0;
-
-            } else xprintf("\t!H");
-
-            switch (icmp_res) {
-              case ICMP6_DST_UNREACH_NOPORT:
-                ++fexit;
-                dest_reach = 1;
-                break;
-              case ICMP6_DST_UNREACH_NOROUTE:
-                xprintf(" !N");
-                ++fexit;
-                break;
-              case ICMP6_DST_UNREACH_ADDR:
-                xprintf(" !H");
-                ++fexit;
-                break;
-              case ICMP6_DST_UNREACH_ADMIN:
-                xprintf(" !S");
-                ++fexit;
-                break;
-              default:
-                break;
-            }
-            break;
-          }
-        } //revents
+  for (;;) {
+    long long tleft = -1;
+
+    now = microtime();
+    while (sent < total && busy < TT.squeries && now >= next) {
+      int ttl = TT.first_ttl + sent / TT.ttl_probes;
+
+      if (!TT.istraceroute6) send_probe4(sent + 1, ttl);
+      else send_probe6(sent + 1, ttl);
+      probes[sent++].sent = now;
+      busy++;
+      if (!TT.istraceroute6 && (toys.optflags & FLAG_z)) {
+        next = now + TT.pause_time * 1000;
+        break;
       }
-      print_verbose = 0;
     }
-    xputc('\n');
-    if(!TT.istraceroute6) {
-      if (!memcmp(&((struct sockaddr_in *)&from)->sin_addr, 
-            &((struct sockaddr_in *)&dest)->sin_addr, sizeof(struct in_addr))
-          || dest_reach || (fexit && fexit >= TT.ttl_probes -1))
-        break;
-    } else if (dest_reach || (fexit > 0 && fexit >= TT.ttl_probes -1)) break;
+
+    for (i = hop * TT.ttl_probes; i < sent; i++) {
+      p = probes + i;
+      if (p->done) continue;
+      if (now - p->sent >= tv) {
+        p->done = 1;
+        busy--;
+      } else if (tleft < 0 || p->sent + tv - now < tleft)
+        tleft = p->sent + tv - now;
+    }
+
+    // Print every hop whose probes have all either answered or timed out.
+    while (hop < hops) {
+      struct sockaddr_storage last_addr, *from = 0;
+      int dest_reach = 0, fexit = 0, probe;
+
+      p = probes + hop * TT.ttl_probes;
+      for (probe = 0; probe < TT.ttl_probes; probe++)
+        if (hop * TT.ttl_probes + probe >= sent || !p[probe].done) break;
+      if (probe < TT.ttl_probes) break;
+
+      memset(&last_addr, 0, sizeof(last_addr));
+      xprintf("%2d", TT.first_ttl + hop);
+      for (probe = 0; probe < TT.ttl_probes; probe++) {
+        print_probe(p + probe, !probe, &last_addr, &dest_reach, &fexit);
+        if (p[probe].len) from = &p[probe].from;
+      }
+      xputc('\n');
+      xflush();
+      hop++;
+
+      if (dest_reach || (fexit && fexit >= TT.ttl_probes - 1)
+          || (!TT.istraceroute6 && from
+            && !memcmp(&((struct sockaddr_in *)from)->sin_addr,
+              &((struct sockaddr_in *)&dest)->sin_addr,
+              sizeof(struct in_addr)))) hops = hop;
+    }
+    if (hop >= hops) break;
+
+    if (sent < total && busy < TT.squeries
+        && (tleft < 0 || next - now < tleft)) tleft = next > now ? next - now : 0;
+    if (poll(pfd, 1, (tleft + 999) / 1000) < 0) {
+      if (errno != EINTR) perror_exit("poll");
+      continue;
+    }
+    if (!pfd[0].revents) continue;
+
+    for (;;) {
+      socklen_t addrlen = sizeof(struct sockaddr_storage);
+      int rcv_len, seq;
+
+      memset(&reply, 0, sizeof(reply));
+      rcv_len = recvfrom(TT.recv_sock, toybuf, sizeof(toybuf), MSG_DONTWAIT,
+          (struct sockaddr *) &reply.from, &addrlen);
+      if (rcv_len <= 0) break;
+      if (!(seq = match_reply(rcv_len, &reply)) || seq > sent) continue;
+
+      p = probes + seq - 1;
+      if (p->done) continue;
+      reply.sent = p->sent;
+      reply.delta = microtime() - p->sent;
+      reply.done = 1;
+      *p = reply;
+      busy--;
+    }
   }
+  free(probes);
 }
 
 void traceroute_main(void)
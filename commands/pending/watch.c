@@ -3,7 +3,7 @@
  * Copyright 2013 Sandeep Sharma <sandeep.jack2756@gmail.com>
  * Copyright 2013 Kyungwan Han <asura321@gmail.com>
  *
-USE_WATCH(NEWTOY(watch, "^<1n#<0=2te", TOYFLAG_USR|TOYFLAG_BIN))
+USE_WATCH(NEWTOY(watch, "^<1n:te", TOYFLAG_USR|TOYFLAG_BIN))
 
 config WATCH
   bool "watch"
@@ -13,7 +13,7 @@ config WATCH
 
     Run PROG periodically
 
-    -n  Loop period in seconds (default 2)
+    -n  Loop period in seconds (default 2, fractions allowed)
     -t  Don't print header
     -e  Freeze updates on command error, and exit after enter.
 */
@@ -21,50 +21,176 @@ config WATCH
 #include "toys.h"
 
 GLOBALS(
-  int interval;
+  char *interval;
+
+  char **screen;
+  unsigned rows, cols;
 )
 
+// Bytes of a UTF-8 sequence after the first don't take up a column.
+#define CONT(c) (((c)&0xc0) == 0x80)
+
+// One line of output as it will appear: tabs expanded, other control
+// characters shown as ?, cut off at the screen width.
+static char *watch_line(char *s, int len)
+{
+  char *line = xmalloc(8*TT.cols+1);
+  int i, col = 0, out = 0;
+
+  for (i = 0; i < len && col < TT.cols; i++) {
+    unsigned char c = s[i];
+
+    if (c == '\t') {
+      do line[out++] = ' '; while (++col < TT.cols && col&7);
+      continue;
+    }
+    if (c < ' ' || c == 127) c = '?';
+    line[out++] = c;
+    if (!CONT(c)) col++;
+    // Let the last character that fits keep its tail.
+    while (col == TT.cols && i+1 < len && CONT(s[i+1])) line[out++] = s[++i];
+  }
+  line[out] = 0;
+
+  return line;
+}
+
+static int watch_cells(char *s)
+{
+  int n = 0;
+
+  for (; *s; s++) if (!CONT(*s)) n++;
+
+  return n;
+}
+
+// Bring screen row y up to date with new contents, writing only the span
+// of characters that changed.
+static void watch_row(int y, char *new)
+{
+  char *old = TT.screen[y] ? TT.screen[y] : "";
+  int i, j, n, col, len = strlen(new), cells = watch_cells(new);
+
+  for (i = 0; old[i] && old[i] == new[i]; i++);
+  if (old[i] || new[i]) {
+    while (i && CONT(new[i])) i--;
+    for (col = 1, n = 0; n < i; n++) if (!CONT(new[n])) col++;
+
+    // With the rest of the row where it was, the end that matches can stay.
+    j = len;
+    if (len == strlen(old) && cells == watch_cells(old)) {
+      while (j > i && old[j-1] == new[j-1]) j--;
+      while (j < len && CONT(new[j])) j++;
+    }
+    xprintf("\033[%d;%dH%.*s", y+1, col, j-i, new+i);
+    if (watch_cells(old) > cells) xprintf("\033[K");
+  }
+  free(TT.screen[y]);
+  TT.screen[y] = new;
+}
+
+// Run the command with its output on a pipe, without a new process if
+// it's a toy, and return how it exited with its output in *out.
+static int watch_run(char **argv, char **out, int *len)
+{
+  int fd, pid, size = 4096, n;
+
+  *out = xmalloc(size);
+  *len = 0;
+  pid = xpopen(argv, &fd, 1);
+  while ((n = read(fd, *out + *len, size - *len)) > 0)
+    if ((*len += n) == size) *out = xrealloc(*out, size *= 2);
+
+  return xpclose(pid, fd);
+}
+
 void watch_main(void)
 {
-  int i = 0, hlen;
+  char *shell[] = {"sh", "-c", 0, 0}, **argv = toys.optargs, *cmd, *out, *s;
+  unsigned width, height, y;
+  unsigned long long next;
+  long period, frac;
+  int i, len, retval;
   time_t t;
-  unsigned width = 80, len = sizeof("Www Mmm dd hh:mm:ss yyyy") - 1 ;
-  char *header, *cmd = *toys.optargs;
-  int retval;
-
-  while(toys.optargs[++i])
-  {
-    char * oldcmd = cmd;
-    cmd = xmprintf("%s %s", oldcmd, toys.optargs[i]);
-    if (CFG_TOYBOX_FREE) free(oldcmd);
+
+  period = 2000;
+  if (TT.interval) {
+    period = xparsetime(TT.interval, 1000, &frac)*1000 + frac;
+    if (period < 10) period = 10;
   }
-  header = xmprintf("Every %us: %s", TT.interval, cmd);
-  hlen = strlen(header);
-
-  while(1) {
-    xprintf("\033[H\033[J");
-    if(!(toys.optflags & FLAG_t)) {
-      terminal_size(&width, NULL);
-      if (!width) width = 80; //on serial it may return 0.
+
+  // One argument with shell syntax in it goes to sh, otherwise run it as is.
+  cmd = *toys.optargs;
+  for (i = 1; toys.optargs[i]; i++) {
+    s = cmd;
+    cmd = xmprintf("%s %s", s, toys.optargs[i]);
+    if (s != *toys.optargs) free(s);
+  }
+  if (i == 1 && strpbrk(cmd, " \t\n;&|<>()$`\\\"'*?[#~=%")) {
+    shell[2] = cmd;
+    argv = shell;
+  }
+
+  for (next = millitime();; next += period) {
+    width = 80;
+    height = 25;
+    terminal_size(&width, &height);
+    if (!width) width = 80; //on serial it may return 0.
+    if (!height) height = 25;
+
+    // Start over from a clear screen when its size changes.
+    if (width != TT.cols || height != TT.rows) {
+      for (y = 0; y < TT.rows; y++) free(TT.screen[y]);
+      TT.screen = xrealloc(TT.screen, height*sizeof(char *));
+      memset(TT.screen, 0, height*sizeof(char *));
+      TT.cols = width;
+      TT.rows = height;
+      xprintf("\033[H\033[J");
+    }
+
+    retval = watch_run(argv, &out, &len);
+
+    y = 0;
+    if (!(toys.optflags & FLAG_t)) {
+      char *head = xmprintf("Every %gs: %s", period/1000.0, cmd), *date;
+      int hlen = strlen(head), dlen;
+
       time(&t);
-      if (width > (hlen + len)) xprintf("%s", header);
-      if(width >= len)
-        xprintf("%*s\n",width + ((width > (hlen + len))?-hlen:0) + 1, ctime(&t));
-      else
-        xprintf("\n\n");
+      date = ctime(&t);
+      dlen = strlen(date) - 1;
+      if (width > hlen + dlen) s = xmprintf("%s%*.*s", head, width-hlen, dlen, date);
+      else if (width >= dlen) s = xmprintf("%*.*s", width, dlen, date);
+      else s = xstrdup("");
+      watch_row(y++, watch_line(s, strlen(s)));
+      free(s);
+      free(head);
+      watch_row(y++, xstrdup(""));
+    }
+
+    // Each line of output goes on its own row, blank ones below the last.
+    for (s = out; y < height; y++) {
+      char *nl = memchr(s, '\n', out + len - s);
+      int n = nl ? nl - s : out + len - s;
+
+      watch_row(y, watch_line(s, n));
+      s += n + !!nl;
     }
-    fflush(NULL); //making sure the screen is clear
-    retval = system(cmd);
-    if ((toys.optflags & FLAG_e) && retval){
-      xprintf("command exit with non-zero status, press enter to exit\n");
+    xprintf("\033[%u;1H", height);
+    free(out);
+    xflush();
+
+    if ((toys.optflags & FLAG_e) && retval) {
+      xprintf("\ncommand exit with non-zero status, press enter to exit\n");
+      xflush();
       getchar();
       break;
     }
-    sleep(TT.interval);
-  }
 
-  if (CFG_TOYBOX_FREE){
-    free(header);
-    if (cmd != *toys.optargs) free(cmd);
+    // Keep to the period even when the command takes a while, but don't try
+    // to catch up after one that took longer than that.
+    if (next + period > millitime()) msleep(next + period - millitime());
+    else next = millitime() - period;
   }
+
+  if (CFG_TOYBOX_FREE && cmd != *toys.optargs) free(cmd);
 }
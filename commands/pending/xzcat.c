@@ -6,20 +6,32 @@
  * This file has been put into the public domain.
  * You can do whatever you want with this file.
  * Modified for toybox by Isaac Dunham
-USE_XZCAT(NEWTOY(xzcat, NULL, TOYFLAG_USR|TOYFLAG_BIN))
+USE_XZCAT(NEWTOY(xzcat, "(offset)#<0(length)#<0", TOYFLAG_USR|TOYFLAG_BIN))
 
 config XZCAT
   bool "xzcat"
   default n
   help
-    usage: xzcat [filename...]
+    usage: xzcat [--offset N] [--length N] [filename...]
     
     Decompress listed files to stdout. Use stdin if no files listed.
+    Files with more than one block are decompressed a block per thread.
+
+    --offset	Skip this many bytes of output (only decompressing the
+    		blocks needed, if the file has an index)
+    --length	Stop after this many bytes of output
 
 */
 #define FOR_xzcat
 #include "toys.h"
 
+GLOBALS(
+  long length;
+  long offset;
+
+  long long pos, end;
+)
+
 // BEGIN xz.h
 
 /**
@@ -166,23 +178,28 @@ void xz_dec_reset(struct xz_dec *s);
  */
 void xz_dec_end(struct xz_dec *s);
 
+/**
+ * xz_dec_block() - Decode one Block of a Stream on its own
+ * @s:          Decoder state allocated using xz_dec_init()
+ * @b:          Input buffer holding exactly the Block (Header through
+ *              Check), output buffer with room for all of its data
+ * @check:      Check ID from the Stream Flags
+ *
+ * Blocks don't depend on each other, so given an Index saying where they
+ * are they can be decoded in any order (or at once, with a decoder each).
+ * Returns XZ_STREAM_END once the whole Block has been decoded and its
+ * Check verified.
+ */
+enum xz_ret xz_dec_block(struct xz_dec *s, struct xz_buf *b, int check);
+
 /*
  * Update CRC32 value using the polynomial from IEEE-802.3. To start a new
  * calculation, the third argument must be zero. To continue the calculation,
  * the previously returned value is passed as the third argument.
  */
-static uint32_t xz_crc32_table[256];
-
 uint32_t xz_crc32(const uint8_t *buf, size_t size, uint32_t crc)
 {
-  crc = ~crc;
-
-  while (size != 0) {
-    crc = xz_crc32_table[*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
-    --size;
-  }
-
-  return ~crc;
+  return ~crc_update(~crc, (void *)buf, size, 1);
 }
 
 static uint64_t xz_crc64_table[256];
@@ -190,118 +207,6 @@ static uint64_t xz_crc64_table[256];
 
 // END xz.h
 
-static uint8_t in[BUFSIZ];
-static uint8_t out[BUFSIZ];
-
-void do_xzcat(int fd, char *name)
-{
-  struct xz_buf b;
-  struct xz_dec *s;
-  enum xz_ret ret;
-  const char *msg;
-
-  crc_init(xz_crc32_table, 1);
-  const uint64_t poly = 0xC96C5795D7870F42ULL;
-  uint32_t i;
-  uint32_t j;
-  uint64_t r;
-
-  /* initialize CRC64 table*/
-  for (i = 0; i < 256; ++i) {
-    r = i;
-    for (j = 0; j < 8; ++j)
-      r = (r >> 1) ^ (poly & ~((r & 1) - 1));
-
-    xz_crc64_table[i] = r;
-  }
-
-  /*
-   * Support up to 64 MiB dictionary. The actually needed memory
-   * is allocated once the headers have been parsed.
-   */
-  s = xz_dec_init(1 << 26);
-  if (s == NULL) {
-    msg = "Memory allocation failed\n";
-    goto error;
-  }
-
-  b.in = in;
-  b.in_pos = 0;
-  b.in_size = 0;
-  b.out = out;
-  b.out_pos = 0;
-  b.out_size = BUFSIZ;
-
-  for (;;) {
-    if (b.in_pos == b.in_size) {
-      b.in_size = read(fd, in, sizeof(in));
-      b.in_pos = 0;
-    }
-
-    ret = xz_dec_run(s, &b);
-
-    if (b.out_pos == sizeof(out)) {
-      if (fwrite(out, 1, b.out_pos, stdout) != b.out_pos) {
-        msg = "Write error\n";
-        goto error;
-      }
-
-      b.out_pos = 0;
-    }
-
-    if (ret == XZ_OK)
-      continue;
-
-    if (ret == XZ_UNSUPPORTED_CHECK)
-      continue;
-
-    if (fwrite(out, 1, b.out_pos, stdout) != b.out_pos) {
-      msg = "Write error\n";
-      goto error;
-    }
-
-    switch (ret) {
-    case XZ_STREAM_END:
-      xz_dec_end(s);
-      return;
-
-    case XZ_MEM_ERROR:
-      msg = "Memory allocation failed\n";
-      goto error;
-
-    case XZ_MEMLIMIT_ERROR:
-      msg = "Memory usage limit reached\n";
-      goto error;
-
-    case XZ_FORMAT_ERROR:
-      msg = "Not a .xz file\n";
-      goto error;
-
-    case XZ_OPTIONS_ERROR:
-      msg = "Unsupported options in the .xz headers\n";
-      goto error;
-
-    case XZ_DATA_ERROR:
-    case XZ_BUF_ERROR:
-      msg = "File is corrupt\n";
-      goto error;
-
-    default:
-      msg = "Bug!\n";
-      goto error;
-    }
-  }
-
-error:
-  xz_dec_end(s);
-  error_exit("%s", msg);
-}
-
-void xzcat_main(void)
-{
-  loopfiles(toys.optargs, do_xzcat);
-}
-
 // BEGIN xz_private.h
 
 
@@ -2282,6 +2187,7 @@ enum xz_ret xz_dec_lzma2_reset(struct xz_dec_lzma2 *s, uint8_t props)
       s->dict.allocated = 0;
       return XZ_MEM_ERROR;
     }
+    s->dict.allocated = s->dict.size;
   }
 
   s->lzma.len = 0;
@@ -2578,15 +2484,17 @@ static enum xz_ret dec_block(struct xz_dec *s, struct xz_buf *b)
   if (s->check_type == XZ_CHECK_CRC32)
     s->crc = xz_crc32(b->out + s->out_start,
         b->out_pos - s->out_start, s->crc);
-  else if (s->check_type == XZ_CHECK_CRC64)
-    s->crc = ~(s->crc);
+  else if (s->check_type == XZ_CHECK_CRC64) {
     size_t size = b->out_pos - s->out_start;
     uint8_t *buf = b->out + s->out_start;
+
+    s->crc = ~(s->crc);
     while (size) {
       s->crc = xz_crc64_table[*buf++ ^ (s->crc & 0xFF)] ^ (s->crc >> 8);
       --size;
     }
     s->crc=~(s->crc);
+  }
 
   if (ret == XZ_STREAM_END) {
     if (s->block_header.compressed != VLI_UNKNOWN
@@ -3089,6 +2997,26 @@ enum xz_ret xz_dec_run(struct xz_dec *s, struct xz_buf *b)
   return ret;
 }
 
+enum xz_ret xz_dec_block(struct xz_dec *s, struct xz_buf *b, int check)
+{
+  enum xz_ret ret;
+
+  xz_dec_reset(s);
+  s->check_type = check;
+  s->sequence = SEQ_BLOCK_START;
+
+  /*
+   * dec_main() wants more input once it's back at the start of a Block,
+   * having checked the one we gave it.
+   */
+  ret = dec_main(s, b);
+  if (ret == XZ_OK)
+    ret = (s->sequence == SEQ_BLOCK_START && s->block.count == 1)
+        ? XZ_STREAM_END : XZ_DATA_ERROR;
+
+  return ret;
+}
+
 struct xz_dec *xz_dec_init(uint32_t dict_max)
 {
   struct xz_dec *s = malloc(sizeof(*s));
@@ -3141,3 +3069,326 @@ void xz_dec_end(struct xz_dec *s)
     free(s);
   }
 }
+
+// The command itself, which needs the stream format above to find blocks.
+
+static uint8_t in[BUFSIZ];
+static uint8_t out[BUFSIZ];
+
+// Blocks bigger than this get decoded as a stream rather than in parallel,
+// which would need all of one in memory (per thread, up to XZ_THREADS).
+#define XZ_BLOCK_MAX (64<<20)
+#define XZ_THREADS 4
+
+// Support up to 64 MiB dictionary. The actually needed memory
+// is allocated once the headers have been parsed.
+#define XZ_DICT_MAX (1<<26)
+
+// Where each block is in the file (including padding) and in the output.
+struct xz_block {
+  long long pos, size, start, len;
+};
+
+// One block being decoded by a worker thread, which has its own decoder
+// (and thus dictionary).
+struct xz_job {
+  struct xz_dec *s;
+  struct xz_block *blk;
+  uint8_t *in, *out;
+  size_t inmax, outmax;
+  int fd, check;
+  enum xz_ret ret;
+#if CFG_TOYBOX_THREADS
+  pthread_t tid;
+  int started;
+#endif
+};
+
+static char *xz_msg(enum xz_ret ret)
+{
+  switch (ret) {
+  case XZ_MEM_ERROR:
+    return "Memory allocation failed";
+  case XZ_MEMLIMIT_ERROR:
+    return "Memory usage limit reached";
+  case XZ_FORMAT_ERROR:
+    return "Not a .xz file";
+  case XZ_OPTIONS_ERROR:
+    return "Unsupported options in the .xz headers";
+  case XZ_DATA_ERROR:
+  case XZ_BUF_ERROR:
+    return "File is corrupt";
+  default:
+    return "Bug!";
+  }
+}
+
+// Write the part of len bytes of output (starting at TT.pos in the
+// uncompressed data) that's inside --offset and --length. Returns true once
+// there's nothing more to write.
+static int xz_write(uint8_t *buf, size_t len)
+{
+  long long start = TT.pos, skip = TT.offset-start;
+
+  TT.pos += len;
+  if (TT.pos > TT.end) len = TT.end-start;
+  if (skip < 0) skip = 0;
+  if ((long long)len > skip) txwrite(fileno(stdout), buf+skip, len-skip);
+
+  return TT.pos >= TT.end;
+}
+
+// Read a variable length integer out of the index at *pos.
+static int xz_vli(uint8_t *buf, long long len, long long *pos, long long *val)
+{
+  int shift;
+
+  for (*val = shift = 0; *pos < len && shift < 63; shift += 7) {
+    *val |= (long long)(buf[*pos]&0x7f)<<shift;
+    if (!(buf[(*pos)++]&0x80)) return 1;
+  }
+
+  return 0;
+}
+
+// Read the index of a seekable single stream .xz file into *list, and its
+// stream header into head. Returns number of blocks, or -1 if there isn't a
+// usable index (so decode it as a stream instead).
+static long long xz_index(int fd, uint8_t *head, struct xz_block **list)
+{
+  uint8_t foot[STREAM_HEADER_SIZE], *idx = 0;
+  struct xz_block *blk = 0;
+  long long size, len, pos, count = -1, i, unpadded, start = 0, where;
+
+  // Only seekable files we're at the start of.
+  *list = 0;
+  if (lseek(fd, 0, SEEK_CUR)
+    || (size = lseek(fd, 0, SEEK_END)) < 2*STREAM_HEADER_SIZE
+    || pread(fd, foot, STREAM_HEADER_SIZE, size-STREAM_HEADER_SIZE)
+      != STREAM_HEADER_SIZE
+    || pread(fd, head, STREAM_HEADER_SIZE, 0) != STREAM_HEADER_SIZE)
+    goto done;
+
+  // Stream footer and header must be sane and agree on the stream flags.
+  // (Stream padding or a second stream would show up as a bad footer or
+  // an index that doesn't describe the whole file.)
+  if (memcmp(foot+10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE)
+    || xz_crc32(foot+4, 6, 0) != get_le32(foot)
+    || memcmp(head, HEADER_MAGIC, HEADER_MAGIC_SIZE)
+    || xz_crc32(head+6, 2, 0) != get_le32(head+8)
+    || memcmp(head+6, foot+8, 2) || head[6] || head[7] > XZ_CHECK_MAX)
+    goto done;
+  len = (get_le32(foot+4)+1LL)*4;
+  where = size-STREAM_HEADER_SIZE-len;
+  if (where < STREAM_HEADER_SIZE) goto done;
+  idx = xmalloc(len);
+  if (pread(fd, idx, len, where) != len || *idx
+    || xz_crc32(idx, len-4, 0) != get_le32(idx+len-4)) goto done;
+
+  // Index: 0, number of records, then unpadded and uncompressed size of
+  // each block, which are laid out one after another after the header.
+  pos = 1;
+  if (!xz_vli(idx, len-4, &pos, &i) || i > (len-pos)/2) goto done;
+  blk = xmalloc((i+1)*sizeof(*blk));
+  for (count = 0, where = STREAM_HEADER_SIZE; count < i; count++) {
+    if (!xz_vli(idx, len-4, &pos, &unpadded)
+      || !xz_vli(idx, len-4, &pos, &blk[count].len)
+      || unpadded < 5 || unpadded > size)
+      break;
+    blk[count].pos = where;
+    where += blk[count].size = (unpadded+3)&~3LL;
+    blk[count].start = start;
+    start += blk[count].len;
+  }
+  if (count == i && where == size-STREAM_HEADER_SIZE-len) *list = blk;
+  else count = -1;
+
+done:
+  free(idx);
+  if (!*list) free(blk);
+
+  return *list ? count : -1;
+}
+
+static void *xz_worker(void *arg)
+{
+  struct xz_job *xj = arg;
+  struct xz_buf b;
+
+  b.in = xj->in;
+  b.in_pos = 0;
+  b.in_size = xj->blk->size;
+  b.out = xj->out;
+  b.out_pos = 0;
+  b.out_size = xj->blk->len;
+
+  if (pread(xj->fd, xj->in, b.in_size, xj->blk->pos) != b.in_size)
+    xj->ret = XZ_DATA_ERROR;
+  else {
+    xj->ret = xz_dec_block(xj->s, &b, xj->check);
+    if (xj->ret == XZ_STREAM_END
+      && (b.in_pos != b.in_size || b.out_pos != b.out_size))
+        xj->ret = XZ_DATA_ERROR;
+  }
+
+  return 0;
+}
+
+// Decode the blocks of the file covering --offset and --length using its
+// index, a batch of them at a time in parallel, writing them out in order.
+// Returns false if it's better streamed (no index, one block, big blocks...)
+static int xz_parallel(int fd)
+{
+  uint8_t head[STREAM_HEADER_SIZE];
+  struct xz_block *blk;
+  struct xz_job *jobs;
+  long long count = xz_index(fd, head, &blk), first, last, i;
+  int j, n = 1;
+#if CFG_TOYBOX_THREADS
+  pthread_attr_t attr;
+#endif
+
+  // Which blocks overlap the range we want?
+  for (first = 0; first < count; first++)
+    if (blk[first].start+blk[first].len > TT.offset) break;
+  for (last = first; last < count && blk[last].start < TT.end; last++)
+    if (blk[last].len > XZ_BLOCK_MAX) count = -1;
+  if (count < 0 || (count == 1 && first == 0 && last == 1
+    && !(toys.optflags&(FLAG_offset|FLAG_length))))
+  {
+    free(blk);
+    lseek(fd, 0, SEEK_SET);
+
+    return 0;
+  }
+
+#if CFG_TOYBOX_THREADS
+  if ((n = sysconf(_SC_NPROCESSORS_ONLN)) < 1) n = 1;
+  if (n > XZ_THREADS) n = XZ_THREADS;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+#endif
+  if (n > last-first) n = last-first;
+  jobs = xzalloc(n*sizeof(*jobs));
+  for (j = 0; j<n; j++) {
+    jobs[j].fd = fd;
+    jobs[j].check = head[7];
+    if (!(jobs[j].s = xz_dec_init(XZ_DICT_MAX)))
+      error_exit("%s", xz_msg(XZ_MEM_ERROR));
+  }
+
+  for (i = first; i < last; i += n) {
+    struct xz_job *xj;
+
+    // Start a batch, with the first block on this thread
+    for (j = 0; j<n && i+j<last; j++) {
+      xj = jobs+j;
+      xj->blk = blk+i+j;
+      if (xj->inmax < xj->blk->size)
+        xj->in = xrealloc(xj->in, xj->inmax = xj->blk->size);
+      if (xj->outmax < xj->blk->len)
+        xj->out = xrealloc(xj->out, xj->outmax = xj->blk->len);
+#if CFG_TOYBOX_THREADS
+      xj->started = j && !toy_worker_create(&xj->tid, &attr, xz_worker, xj);
+#endif
+    }
+    while (j--) {
+#if CFG_TOYBOX_THREADS
+      if (jobs[j].started) continue;
+#endif
+      xz_worker(jobs+j);
+    }
+
+    // Write them out in order
+    for (j = 0; j<n && i+j<last; j++) {
+      xj = jobs+j;
+#if CFG_TOYBOX_THREADS
+      if (xj->started) pthread_join(xj->tid, 0);
+#endif
+      if (xj->ret != XZ_STREAM_END) error_exit("%s", xz_msg(xj->ret));
+      TT.pos = xj->blk->start;
+      xz_write(xj->out, xj->blk->len);
+    }
+  }
+
+#if CFG_TOYBOX_THREADS
+  pthread_attr_destroy(&attr);
+#endif
+  for (j = 0; j<n; j++) {
+    xz_dec_end(jobs[j].s);
+    free(jobs[j].in);
+    free(jobs[j].out);
+  }
+  free(jobs);
+  free(blk);
+
+  return 1;
+}
+
+void do_xzcat(int fd, char *name)
+{
+  struct xz_buf b;
+  struct xz_dec *s;
+  enum xz_ret ret;
+
+  const uint64_t poly = 0xC96C5795D7870F42ULL;
+  uint32_t i;
+  uint32_t j;
+  uint64_t r;
+
+  /* initialize CRC64 table*/
+  for (i = 0; i < 256; ++i) {
+    r = i;
+    for (j = 0; j < 8; ++j)
+      r = (r >> 1) ^ (poly & ~((r & 1) - 1));
+
+    xz_crc64_table[i] = r;
+  }
+
+  TT.pos = 0;
+  TT.end = (toys.optflags&FLAG_length) ? TT.offset+TT.length : LLONG_MAX;
+  if (TT.end <= TT.offset || xz_parallel(fd)) return;
+
+  s = xz_dec_init(XZ_DICT_MAX);
+  if (s == NULL) error_exit("%s", xz_msg(XZ_MEM_ERROR));
+
+  b.in = in;
+  b.in_pos = 0;
+  b.in_size = 0;
+  b.out = out;
+  b.out_pos = 0;
+  b.out_size = BUFSIZ;
+
+  for (;;) {
+    if (b.in_pos == b.in_size) {
+      b.in_size = read(fd, in, sizeof(in));
+      b.in_pos = 0;
+    }
+
+    ret = xz_dec_run(s, &b);
+
+    if (b.out_pos == sizeof(out)) {
+      if (xz_write(out, b.out_pos)) break;
+      b.out_pos = 0;
+    }
+
+    if (ret == XZ_OK)
+      continue;
+
+    if (ret == XZ_UNSUPPORTED_CHECK)
+      continue;
+
+    xz_write(out, b.out_pos);
+    if (ret == XZ_STREAM_END) break;
+
+    xz_dec_end(s);
+    error_exit("%s", xz_msg(ret));
+  }
+
+  xz_dec_end(s);
+}
+
+void xzcat_main(void)
+{
+  loopfiles(toys.optargs, do_xzcat);
+}
@@ -19,7 +19,7 @@ config CAT
     Copy (concatenate) files to stdout.  If no files listed, copy from stdin.
     Filename "-" is a synonym for stdin.
 
-    -u	Copy one byte at a time (slow).
+    -u	Don't buffer output (the default, data is written as it arrives).
 
 config CAT_V
   bool "cat -etv"
@@ -51,45 +51,50 @@ config CATV
 #define FORCE_FLAGS
 #include "toys.h"
 
-static void do_cat(int fd, char *name)
+// Escape a block a byte at a time, 1k of input per toybuf of output (no
+// character takes more than 4 bytes: M-^?).
+static void cat_v(int out, char *buf, long len)
 {
-  int i, len, size=(toys.optflags & FLAG_u) ? 1 : sizeof(toybuf);
+  char *o;
+  long i = 0, end;
 
-  for(;;) {
-    len = read(fd, toybuf, size);
-    if (len < 0) {
-      toys.exitval = EXIT_FAILURE;
-      perror_msg("%s", name);
-    }
-    if (len < 1) break;
-    if ((CFG_CAT_V || CFG_CATV) && (toys.optflags&~FLAG_u)) {
-      for (i=0; i<len; i++) {
-        char c=toybuf[i];
-
-        if (c > 126 && (toys.optflags & FLAG_v)) {
-          if ((unsigned char)c > 127) {
-            printf("M-");
-            c -= 128;
-          }
-          if (c == 127) {
-            printf("^?");
-            continue;
-          }
-        }
-        if (c < 32) {
-          if (c == 10) {
-            if (toys.optflags & FLAG_e) xputc('$');
-          } else if (toys.optflags & (c==9 ? FLAG_t : FLAG_v)) {
-            printf("^%c", c+'@');
-            continue;
-          }
+  while (i<len) {
+    for (o = toybuf, end = (len-i > 1024) ? i+1024 : len; i<end; i++) {
+      unsigned char c = buf[i];
+
+      // High control characters are always M-^x, even tab and newline.
+      if (c > 127 && (toys.optflags & FLAG_v)) {
+        o = stpcpy(o, "M-");
+        if ((c -= 128) < 32) {
+          *o++ = '^';
+          *o++ = c+'@';
+          continue;
         }
-        xputc(c);
       }
-    } else txwrite(1, toybuf, len);
+      if (c == 127 && (toys.optflags & FLAG_v)) {
+        o = stpcpy(o, "^?");
+        continue;
+      }
+      if (c == 10) {
+        if (toys.optflags & FLAG_e) *o++ = '$';
+      } else if (c < 32 && (toys.optflags & (c==9 ? FLAG_t : FLAG_v))) {
+        *o++ = '^';
+        *o++ = c+'@';
+        continue;
+      }
+      *o++ = c;
+    }
+    txwrite(out, toybuf, o-toybuf);
   }
 }
 
+static void do_cat(int fd, char *name)
+{
+  int v = (CFG_CAT_V || CFG_CATV) && (toys.optflags&~FLAG_u);
+
+  if (xcopy(fd, fileno(stdout), v ? cat_v : 0)) perror_msg("%s", name);
+}
+
 void cat_main(void)
 {
   loopfiles(toys.optargs, do_cat);
@@ -26,13 +26,40 @@ GLOBALS(
   char *name;
 )
 
-// This handles opening the file and
+#define CMP_BLOCK 65536
+
+// Count the newlines in len bytes of buf.
+static long lines(void *buf, int len)
+{
+  char *s = buf, *end = s + len;
+  long n = 0;
+
+  while ((s = memchr(s, '\n', end - s))) s++, n++;
+
+  return n;
+}
+
+// Files that can't differ: the same regular file at the same offset. Or for
+// -s, regular files with different sizes can't be the same.
+static int cmp_stat(int fd)
+{
+  struct stat st1, st2;
+
+  if (fstat(TT.fd, &st1) || fstat(fd, &st2)
+      || !S_ISREG(st1.st_mode) || !S_ISREG(st2.st_mode)) return 0;
+  if (st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino
+      && lseek(TT.fd, 0, SEEK_CUR) == lseek(fd, 0, SEEK_CUR)) return 1;
+  if ((toys.optflags & FLAG_s) && lseek(TT.fd, 0, SEEK_CUR)
+      - st1.st_size != lseek(fd, 0, SEEK_CUR) - st2.st_size) return 2;
+
+  return 0;
+}
 
 static void do_cmp(int fd, char *name)
 {
-  int i, len1, len2, min_len, size = sizeof(toybuf)/2;
+  int i, len1, len2, min_len;
   long byte_no = 1, line_no = 1;
-  char *buf2 = toybuf+size;
+  unsigned char *buf1, *buf2;
 
   // First time through, cache the data and return.
   if (!TT.fd) {
@@ -43,28 +70,37 @@ static void do_cmp(int fd, char *name)
     return;
   }
 
+  if ((i = cmp_stat(fd))) {
+    toys.exitval = i - 1;
+    goto out;
+  }
+
+  // Without -l compare a block at a time and only walk it byte by byte to
+  // find where it differs.
+  buf1 = xmalloc(2*CMP_BLOCK);
+  buf2 = buf1 + CMP_BLOCK;
   for (;;) {
-    len1 = readall(TT.fd, toybuf, size);
-    len2 = readall(fd, buf2, size);
+    len1 = readall(TT.fd, buf1, CMP_BLOCK);
+    len2 = readall(fd, buf2, CMP_BLOCK);
 
     min_len = len1 < len2 ? len1 : len2;
-    for (i=0; i<min_len; i++) {
-      if (toybuf[i] != buf2[i]) {
-        toys.exitval = 1;
-        if (toys.optflags & FLAG_l)
-          printf("%ld %o %o\n", byte_no, toybuf[i], buf2[i]);
-        else {
-          if (!(toys.optflags & FLAG_s)) {
-            printf("%s %s differ: char %ld, line %ld\n",
-              TT.name, name, byte_no, line_no);
-            toys.exitval++;
-          }
-          goto out;
-        }
+    if (!(toys.optflags & FLAG_l) && (min_len < 1
+        || !memcmp(buf1, buf2, min_len))) i = min_len;
+    else for (i = 0; i<min_len; i++) {
+      if (buf1[i] == buf2[i]) continue;
+      toys.exitval = 1;
+      if (toys.optflags & FLAG_l)
+        printf("%ld %o %o\n", byte_no + i, buf1[i], buf2[i]);
+      else {
+        if (!(toys.optflags & FLAG_s))
+          printf("%s %s differ: char %ld, line %ld\n",
+            TT.name, name, byte_no + i, line_no + lines(buf1, i));
+        goto done;
       }
-      byte_no++;
-      if (toybuf[i] == '\n') line_no++;
     }
+    byte_no += min_len;
+    if (!(toys.optflags & (FLAG_l|FLAG_s)))
+      line_no += lines(buf1, min_len);
     if (len1 != len2) {
       if (!(toys.optflags & FLAG_s))
         fprintf(stderr, "cmp: EOF on %s\n", len1 < len2 ? TT.name : name);
@@ -73,6 +109,8 @@ static void do_cmp(int fd, char *name)
     }
     if (len1 < 1) break;
   }
+done:
+  free(buf1);
 out:
   if (CFG_TOYBOX_FREE) close(TT.fd);
 }
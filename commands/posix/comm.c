@@ -39,8 +39,11 @@ static void writeline(const char *line, int col)
   puts(line);
 }
 
+// Each file gets its own linebuf, so the current line from one stays put
+// in its buffer while the other side reads ahead.
 void comm_main(void)
 {
+  struct linebuf lb[2];
   int file[2];
   char *line[2];
   int i;
@@ -50,7 +53,8 @@ void comm_main(void)
   for (i = 0; i < 2; i++) {
     file[i] = strcmp("-", toys.optargs[i])
       ? xopen(toys.optargs[i], O_RDONLY) : 0;
-    line[i] = get_line(file[i]);
+    linebuf_init(lb+i, file[i]);
+    line[i] = get_linebuf(lb+i, 0, '\n', LINEBUF_CHOMP);
   }
 
   while (line[0] && line[1]) {
@@ -58,24 +62,21 @@ void comm_main(void)
 
     if (order == 0) {
       writeline(line[0], 2);
-      for (i = 0; i < 2; i++) {
-        free(line[i]);
-        line[i] = get_line(file[i]);
-      }
+      for (i = 0; i < 2; i++)
+        line[i] = get_linebuf(lb+i, 0, '\n', LINEBUF_CHOMP);
     } else {
       i = order < 0 ? 0 : 1;
       writeline(line[i], i);
-      free(line[i]);
-      line[i] = get_line(file[i]);
+      line[i] = get_linebuf(lb+i, 0, '\n', LINEBUF_CHOMP);
     }
   }
 
   /* print rest of the longer file */
   for (i = line[0] ? 0 : 1; line[i];) {
     writeline(line[i], i);
-    free(line[i]);
-    line[i] = get_line(file[i]);
+    line[i] = get_linebuf(lb+i, 0, '\n', LINEBUF_CHOMP);
   }
 
+  for (i = 0; i < 2; i++) linebuf_done(lb+i);
   if (CFG_TOYBOX_FREE) for (i = 0; i < 2; i++) xclose(file[i]);
 }
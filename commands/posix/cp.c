@@ -9,7 +9,7 @@
 // options shared between mv/cp must be in same order (right to left)
 // for FLAG macros to work out right in shared infrastructure.
 
-USE_CP(NEWTOY(cp, "<2"USE_CP_PRESERVE("(preserve):;")"RHLPp"USE_CP_MORE("rdaslvnF(remove-destination)")"fi[-HLP"USE_CP_MORE("d")"]"USE_CP_MORE("[-ni]"), TOYFLAG_BIN))
+USE_CP(NEWTOY(cp, "<2"USE_CP_PRESERVE("(preserve):;")USE_CP_MORE("(sparse):j#<1")"RHLPp"USE_CP_MORE("rdaslvnF(remove-destination)")"fi[-HLP"USE_CP_MORE("d")"]"USE_CP_MORE("[-ni]"), TOYFLAG_BIN))
 USE_MV(NEWTOY(mv, "<2"USE_CP_MORE("vnF")"fi"USE_CP_MORE("[-ni]"), TOYFLAG_BIN))
 USE_INSTALL(NEWTOY(install, "<1cdDpsvm:o:g:", TOYFLAG_USR|TOYFLAG_BIN))
 
@@ -36,16 +36,20 @@ config CP_MORE
   default y
   depends on CP
   help
-    usage: cp [-adlnrsv]
+    usage: cp [-adlnrsv] [-j N] [--sparse=WHEN]
 
     -a	same as -dpr
     -d	don't dereference symlinks
+    -j	copy the contents of up to N files at once
     -l	hard link instead of copy
     -n	no clobber (don't overwrite DEST)
     -r	synonym for -R
     -s	symlink instead of copy
     -v	verbose
 
+    --sparse: auto (default) keeps holes in SOURCE as holes, always turns
+    blocks of zeroes into holes too, never writes everything out.
+
 config CP_PRESERVE
   bool "cp --preserve support"
   default y
@@ -114,6 +118,8 @@ GLOBALS(
       char *mode;
     } i;
     struct {
+      long jobs;
+      char *sparse;
       char *preserve;
     } c;
   };
@@ -123,9 +129,192 @@ GLOBALS(
   int (*callback)(struct dirtree *try);
   uid_t uid;
   gid_t gid;
-  int pflags;
+  int pflags, holes;
+  struct inodeset links;
+  void *pool;
 )
 
+// Copy the contents of fdin (described by st) into the new file fdout.
+// On a copy-on-write filesystem the copy can just share fdin's extents,
+// otherwise reserve the space up front (unless fdin's sparse, where that
+// would fill in the holes) so the kernel can lay it out in one piece. A
+// sparse fdin is copied extent by extent so its holes stay holes.
+
+static int cp_contents(int fdin, int fdout, struct stat *st, char *buf,
+  size_t size)
+{
+#if TOYBOX_COPYFILE
+  if (st->st_size && !ioctl(fdout, FICLONE, fdin)) return 0;
+#endif
+  if (TT.holes != 1 && (TT.holes || st->st_blocks*512 < st->st_size))
+    return copyfd_sparse(fdin, fdout, buf, size, TT.holes == 2);
+#if TOYBOX_COPYFILE
+  if (sizeof(long) >= sizeof(off_t) && st->st_size >= 65536
+      && st->st_blocks*512 >= st->st_size)
+    syscall(SYS_fallocate, fdout, FALLOC_FL_KEEP_SIZE, 0L, (long)st->st_size);
+#endif
+
+  return copyfd(fdin, fdout, buf, size);
+}
+
+// Set fd's preserved attributes from st, mode last because the others can
+// strip the suid bit. Returns nonzero if chown failed.
+static int cp_fdattrs(int fd, struct stat *st)
+{
+  int rc = 0;
+
+  if (TT.pflags & 2) rc = fchown(fd, st->st_uid, st->st_gid);
+  if (TT.pflags & 4) {
+    struct timespec times[] = {st->st_atim, st->st_mtim};
+
+    xfutimens(fd, times);
+  }
+  if (TT.pflags & 1) fchmod(fd, st->st_mode);
+
+  return rc;
+}
+
+#if CFG_TOYBOX_THREADS
+// cp -j: the walk creates each file and hands its two filehandles to a
+// worker thread, which copies the contents, sets the attributes and closes
+// them. A bounded queue keeps the walk from running out of filehandles.
+
+struct cp_job {
+  struct cp_job *next;
+  struct stat st;
+  char *path;
+  int fdin, fdout;
+};
+
+struct cp_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t todo, room;
+  struct cp_job *head, **tail;
+  pthread_t *tid;
+  int threads, queued, quit;
+};
+
+#define CP_BUFSIZE 65536
+
+// Copy one file's contents and attributes. A failure, even an error_exit()
+// from a library function, lands back here and only fails this file.
+static void cp_job(struct cp_job *job, char *buf)
+{
+  struct cp_pool *pool = TT.pool;
+  jmp_buf rebound, *outer = toys.rebound;
+  char *err = 0;
+
+  toys.rebound = &rebound;
+  if (!setjmp(rebound)) {
+    if (cp_contents(job->fdin, job->fdout, &job->st, buf, CP_BUFSIZE))
+      err = "%s";
+    else if (cp_fdattrs(job->fdout, &job->st)) err = "chown '%s'";
+    if (err) {
+      pthread_mutex_lock(&pool->lock);
+      perror_msg(err, job->path);
+      pthread_mutex_unlock(&pool->lock);
+    }
+  }
+  toys.rebound = outer;
+  close(job->fdin);
+  close(job->fdout);
+  free(job->path);
+  free(job);
+}
+
+// Runs in a context of its own, see toy_worker_create().
+static void *cp_worker(void *arg)
+{
+  struct cp_pool *pool = arg;
+  struct cp_job *job;
+  char *buf = xmalloc(CP_BUFSIZE);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (!(job = pool->head) && !pool->quit)
+      pthread_cond_wait(&pool->todo, &pool->lock);
+    if (job) {
+      if (!(pool->head = job->next)) pool->tail = &pool->head;
+      pool->queued--;
+      pthread_cond_signal(&pool->room);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!job) break;
+    cp_job(job, buf);
+  }
+  free(buf);
+
+  return 0;
+}
+
+static void cp_queue(struct cp_pool *pool, int fdin, int fdout,
+  struct dirtree *try)
+{
+  struct cp_job *job = xzalloc(sizeof(struct cp_job));
+
+  job->st = try->st;
+  job->path = dirtree_path(try, 0);
+  job->fdin = fdin;
+  job->fdout = fdout;
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->queued >= 4*pool->threads)
+    pthread_cond_wait(&pool->room, &pool->lock);
+  *pool->tail = job;
+  pool->tail = &job->next;
+  pool->queued++;
+  pthread_cond_signal(&pool->todo);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Start up to jobs workers. Leaves TT.pool NULL when there aren't any.
+static void cp_pool_start(int jobs)
+{
+  struct cp_pool *pool = TT.pool = xzalloc(sizeof(struct cp_pool));
+  pthread_attr_t attr;
+
+  pool->tail = &pool->head;
+  pool->tid = xmalloc(jobs*sizeof(pthread_t));
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->todo, 0);
+  pthread_cond_init(&pool->room, 0);
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+  while (pool->threads < jobs
+    && !toy_worker_create(pool->tid+pool->threads, &attr, cp_worker, pool))
+      pool->threads++;
+  pthread_attr_destroy(&attr);
+  if (pool->threads) return;
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->todo);
+  pthread_cond_destroy(&pool->room);
+  free(pool->tid);
+  free(pool);
+  TT.pool = 0;
+}
+
+// Let the workers finish what's queued, then collect them. A worker's
+// failures land in toys.exitval as it exits.
+static void cp_pool_stop(void)
+{
+  struct cp_pool *pool = TT.pool;
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->todo);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i<pool->threads; i++) pthread_join(pool->tid[i], 0);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->todo);
+  pthread_cond_destroy(&pool->room);
+  free(pool->tid);
+  free(pool);
+  TT.pool = 0;
+}
+#endif
+
 // Callback from dirtree_read() for each file/directory under a source dir.
 
 int cp_node(struct dirtree *try)
@@ -135,6 +324,7 @@ int cp_node(struct dirtree *try)
   unsigned flags = toys.optflags;
   char *catch = try->parent ? try->name : TT.destname, *err = "%s";
   struct stat cst;
+  void **hlink = 0;
 
   if (!dirtree_notdotdot(try)) return 0;
 
@@ -221,6 +411,14 @@ int cp_node(struct dirtree *try)
       } else if (flags & FLAG_l) {
         if (!xlinkat(tfd, try->name, cfd, catch, 0)) err = 0;
 
+      // -a keeps hardlinks within the copy: later names link to the first.
+
+      } else if ((flags & FLAG_a) && try->st.st_nlink > 1 && *(hlink
+        = inodeset_slot(&TT.links, try->st.st_dev, try->st.st_ino)))
+      {
+        if (!xlinkat(AT_FDCWD, *hlink, cfd, catch, 0)) err = 0;
+        hlink = 0;
+
       // Copy tree as symlinks. For non-absolute paths this involves
       // appending the right number of .. entries as you go down the tree.
 
@@ -275,12 +473,28 @@ int cp_node(struct dirtree *try)
         }
         fdout = xopenat(cfd, catch, O_RDWR|O_CREAT|O_TRUNC, try->st.st_mode);
         if (fdout >= 0) {
-          xsendfile(fdin, fdout);
           err = 0;
+#if CFG_TOYBOX_THREADS
+          if (TT.pool) {
+            cp_queue(TT.pool, fdin, fdout, try);
+            fdout = fdin = -1;
+          } else
+#endif
+          if (cp_contents(fdin, fdout, &try->st, libbuf, sizeof(libbuf)))
+            perror_msg("%s", catch);
         }
-        close(fdin);
+        if (fdin != -1) close(fdin);
       }
     } while (err && (flags & (FLAG_f|FLAG_n)) && !xunlinkat(cfd, catch, 0));
+
+    // Remember where the first copy of a hardlinked file went.
+    if (hlink && !err) {
+      struct dirtree *top = try;
+      char *s = dirtree_curpath(try);
+
+      while (top->parent) top = top->parent;
+      *hlink = xmprintf("%s%s", TT.destname, s+strlen(top->name));
+    }
   }
 
   // Did we make a thing?
@@ -289,36 +503,25 @@ int cp_node(struct dirtree *try)
 
     // Inability to set --preserve isn't fatal, some require root access.
 
-    // ownership
-    if (TT.pflags & 2) {
-
-      // permission bits already correct for mknod and don't apply to symlink
-      // If we can't get a filehandle to the actual object, use racy functions
-      if (fdout == AT_FDCWD)
-        rc = xfchownat(cfd, catch, try->st.st_uid, try->st.st_gid,
-                      AT_SYMLINK_NOFOLLOW);
-      else rc = fchown(fdout, try->st.st_uid, try->st.st_gid);
-      if (rc) {
-        char *pp;
+    // permission bits already correct for mknod and don't apply to symlink
+    // If we can't get a filehandle to the actual object, use racy functions
+    if (fdout != AT_FDCWD) rc = cp_fdattrs(fdout, &try->st);
+    else {
+      rc = (TT.pflags & 2) && xfchownat(cfd, catch, try->st.st_uid,
+        try->st.st_gid, AT_SYMLINK_NOFOLLOW);
+      if (TT.pflags & 4) {
+        struct timespec times[] = {try->st.st_atim, try->st.st_mtim};
 
-        perror_msg("chown '%s'", pp = dirtree_path(try, 0));
-        free(pp);
+        xutimensat(cfd, catch, times, AT_SYMLINK_NOFOLLOW);
       }
     }
+    if (rc) {
+      char *pp;
 
-    // timestamp
-    if (TT.pflags & 4) {
-      struct timespec times[] = {try->st.st_atim, try->st.st_mtim};
-
-      if (fdout == AT_FDCWD) xutimensat(cfd, catch, times, AT_SYMLINK_NOFOLLOW);
-      else xfutimens(fdout, times);
-    }
-
-    // mode comes last because other syscalls can strip suid bit
-    if (fdout != AT_FDCWD) {
-      if (TT.pflags & 1) fchmod(fdout, try->st.st_mode);
-      xclose(fdout);
+      perror_msg("chown '%s'", pp = dirtree_path(try, 0));
+      free(pp);
     }
+    if (fdout != AT_FDCWD) xclose(fdout);
 
     if (CFG_MV && toys.which->name[0] == 'm')
       if (xunlinkat(tfd, try->name, S_ISDIR(try->st.st_mode) ? AT_REMOVEDIR :0))
@@ -363,7 +566,19 @@ void cp_main(void)
     }
     free(pre);
   }
+  if (CFG_CP_MORE && (toys.optflags & FLAG_sparse)) {
+    char *when[] = {"auto", "never", "always"};
+
+    for (i = 0; i<(int)ARRAY_LEN(when); i++)
+      if (!strcmp(TT.c.sparse, when[i])) break;
+    if (i == ARRAY_LEN(when)) error_exit("bad --sparse=%s", TT.c.sparse);
+    TT.holes = i;
+  }
   if (!TT.callback) TT.callback = cp_node;
+#if CFG_TOYBOX_THREADS
+  if (CFG_CP_MORE && (toys.optflags & FLAG_j) && TT.c.jobs > 1)
+    cp_pool_start(TT.c.jobs);
+#endif
 
   // Loop through sources
   for (i=0; i<toys.optc; i++) {
@@ -402,6 +617,10 @@ void cp_main(void)
     }
     if (destdir) free(TT.destname);
   }
+#if CFG_TOYBOX_THREADS
+  if (TT.pool) cp_pool_stop();
+#endif
+  if (CFG_TOYBOX_FREE) inodeset_free(&TT.links, free);
 }
 
 void mv_main(void)
@@ -39,19 +39,90 @@ GLOBALS(
   char *archive;
   char *pass;
   char *fmt;
+
+  struct inodeset links;
+  char *buf;
+  long pos, len;
+  int afd, eof;
+  struct cpio_file *ahead;
+  struct cpio_link *pending, **tail;
 )
 
+// The archive moves through one buffer this big, in whichever direction.
+#define CPIO_BUF 65536
+
+// How many of the names on stdin -o opens before it gets to them, so the
+// kernel can read them in while earlier ones go out.
+#define CPIO_AHEAD 16
+
+struct cpio_file {
+  char *name;
+  struct stat st;
+  int fd, err;
+};
+
+// -o holds back names of a hardlinked file until it gets to the last one,
+// which carries the data as newc wants.
+struct cpio_link {
+  struct cpio_link *next;
+  struct double_list *names;
+  unsigned left;
+};
+
+// Return the next len (at most CPIO_BUF) bytes of the archive, which stay
+// put until the next call.
+static char *cpio_get(unsigned len)
+{
+  char *s;
+
+  if (TT.len-TT.pos < len) {
+    memmove(TT.buf, TT.buf+TT.pos, TT.len -= TT.pos);
+    for (TT.pos = 0; TT.len < len; TT.len += TT.pos) {
+      if (0 > (TT.pos = read(TT.afd, TT.buf+TT.len, CPIO_BUF-TT.len)))
+        perror_exit("read");
+      if (!TT.pos) error_exit("short archive");
+    }
+    TT.pos = 0;
+  }
+  s = TT.buf+TT.pos;
+  TT.pos += len;
+
+  return s;
+}
+
+// Copy len bytes of the archive to buf.
+static void cpio_take(char *buf, unsigned len)
+{
+  unsigned n;
+
+  for (; len; len -= n, buf += n) {
+    n = len > CPIO_BUF ? CPIO_BUF : len;
+    memcpy(buf, cpio_get(n), n);
+  }
+}
+
+// Skip len bytes of the archive, seeking over them if it can.
+static void cpio_skip(unsigned len)
+{
+  unsigned n = TT.len-TT.pos;
+
+  if (n > len) n = len;
+  TT.pos += n;
+  if (!(len -= n) || -1 != lseek(TT.afd, len, SEEK_CUR)) return;
+  for (; len; len -= n) cpio_get(n = len > CPIO_BUF ? CPIO_BUF : len);
+}
+
 // Read strings, tail padded to 4 byte alignment. Argument "align" is amount
 // by which start of string isn't aligned (usually 0, but header is 110 bytes
 // which is 2 bytes off because the first field wasn't expanded from 6 to 8).
-static char *strpad(int fd, unsigned len, unsigned align)
+static char *strpad(unsigned len, unsigned align)
 {
-  char *str;
+  char *str = xmalloc(len+1);
 
+  cpio_take(str, len);
+  str[len] = 0;
   align = (align + len) & 3;
-  if (align) len += (4-align);
-  xreadall(fd, str = xmalloc(len+1), len);
-  str[len]=0; // redundant, in case archive is bad
+  if (align) cpio_get(4-align);
 
   return str;
 }
@@ -74,6 +145,193 @@ unsigned x8u(char *hex)
   return val;
 }
 
+static void cpio_flush(void)
+{
+  if (TT.len) txwrite(TT.afd, TT.buf, TT.len);
+  TT.len = 0;
+}
+
+// Add len bytes of data (or zeroes if it's NULL) to the archive.
+static void cpio_put(char *data, long len)
+{
+  long n;
+
+  for (; len; len -= n) {
+    if (TT.len == CPIO_BUF) cpio_flush();
+    if ((n = CPIO_BUF-TT.len) > len) n = len;
+    if (data) memcpy(TT.buf+TT.len, data, n), data += n;
+    else memset(TT.buf+TT.len, 0, n);
+    TT.len += n;
+  }
+}
+
+// NUL pad up to a multiple of 4 bytes, len being how much went out unpadded.
+static void cpio_pad(long long len)
+{
+  if (len & 3) cpio_put(0, 4-(len&3));
+}
+
+static void cpio_header(char *name, struct stat *st, unsigned size)
+{
+  unsigned nlen = strlen(name)+1;
+  char hdr[111];
+
+  sprintf(hdr, "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+    (int)st->st_ino, st->st_mode, st->st_uid, st->st_gid, (int)st->st_nlink,
+    (int)st->st_mtime, size, major(st->st_dev), minor(st->st_dev),
+    major(st->st_rdev), minor(st->st_rdev), nlen, 0);
+  cpio_put(hdr, 110);
+  cpio_put(name, nlen);
+  cpio_pad(110+nlen);
+}
+
+// Write out size bytes of fd. Big runs of data go straight from the file to
+// the archive (so the kernel can copy it without us seeing it), the rest
+// through the buffer. Holes in sparse files are zeroes we needn't read.
+static void cpio_body(int fd, char *name, struct stat *st)
+{
+  off_t pos = 0, data = 0, end = st->st_size, size = st->st_size;
+  long long len;
+  int sparse = st->st_blocks*512 < size;
+
+  while (pos < size) {
+    if (sparse) {
+      data = lseek_data(fd, pos, size, &end);
+      if (data > pos && -1 != lseek(fd, data, SEEK_SET)) cpio_put(0, data-pos);
+      else data = pos;
+    }
+    for (pos = data, len = 1; pos < end && len > 0; pos += len) {
+      if (end-pos >= CPIO_BUF) {
+        cpio_flush();
+        len = copyfd_len(fd, 0, TT.afd, end-pos);
+      } else {
+        if (TT.len == CPIO_BUF) cpio_flush();
+        if ((len = CPIO_BUF-TT.len) > end-pos) len = end-pos;
+        if (0 < (len = readall(fd, TT.buf+TT.len, len))) TT.len += len;
+      }
+    }
+    // If read fails, write anyway (already wrote size in header)
+    if (pos < end) {
+      perror_msg("bad read from file '%s'", name);
+      cpio_put(0, size-pos);
+      break;
+    }
+  }
+  cpio_pad(size);
+}
+
+// Stat and open f->name, so the kernel starts reading the file in.
+static void cpio_stat(struct cpio_file *f)
+{
+  f->fd = -1;
+  f->err = 0;
+  if (lstat(f->name, &f->st)) f->err = errno;
+  else if (S_ISREG(f->st.st_mode) && f->st.st_size) {
+    if (0 > (f->fd = open(f->name, O_RDONLY))) f->err = errno;
+#ifdef POSIX_FADV_WILLNEED
+    else posix_fadvise(f->fd, 0, 1<<20, POSIX_FADV_WILLNEED);
+#endif
+  }
+}
+
+// Look up the next name on stdin. Leaves name NULL at the end of the list.
+static void cpio_next(struct cpio_file *f)
+{
+  size_t size = 0;
+  long len;
+
+  f->name = 0;
+  if (TT.eof || 1 > (len = xgetline(&f->name, &size, stdin))) {
+    TT.eof = 1;
+    free(f->name);
+    f->name = 0;
+
+    return;
+  }
+  if (f->name[len-1] == '\n') f->name[--len] = 0;
+  cpio_stat(f);
+}
+
+// Add a file to the archive. A hardlinked one waits for the rest of its
+// names unless last is set, then they all go out with it.
+static void cpio_file(struct cpio_file *f, int last)
+{
+  struct stat *st = &f->st;
+  struct double_list *dl;
+
+  if (f->err) {
+    errno = f->err;
+    perror_msg("%s", f->name);
+
+    return;
+  }
+  if (!S_ISREG(st->st_mode) && !S_ISLNK(st->st_mode)) st->st_size = 0;
+  if (st->st_size >> 32) {
+    perror_msg("skipping >2G file '%s'", f->name);
+
+    return;
+  }
+
+  if (S_ISREG(st->st_mode) && st->st_nlink > 1 && !last) {
+    void **slot = inodeset_slot(&TT.links, st->st_dev, st->st_ino);
+    struct cpio_link *cl = *slot;
+
+    if (!cl) {
+      *slot = cl = xzalloc(sizeof(struct cpio_link));
+      *TT.tail = cl;
+      TT.tail = &cl->next;
+    }
+    if (!cl->left) cl->left = st->st_nlink;
+    if (--cl->left) {
+      dlist_add(&cl->names, xstrdup(f->name));
+
+      return;
+    }
+    while (cl->names) {
+      dl = dlist_pop(&cl->names);
+      cpio_header(dl->data, st, 0);
+      free(dl->data);
+      free(dl);
+    }
+  }
+
+  cpio_header(f->name, st, st->st_size);
+  if (S_ISLNK(st->st_mode)) {
+    if (readlink(f->name, toybuf, sizeof(toybuf)-1) == st->st_size) {
+      cpio_put(toybuf, st->st_size);
+      cpio_pad(st->st_size);
+    } else {
+      perror_msg("readlink '%s'", f->name);
+      cpio_put(0, (st->st_size+3)&~3);
+    }
+  } else if (f->fd != -1) cpio_body(f->fd, f->name, st);
+}
+
+// Names of hardlinked files whose other names never showed up go out at the
+// end, the data with the last one.
+static void cpio_links(void)
+{
+  struct cpio_link *cl;
+  struct cpio_file f;
+  struct double_list *dl;
+
+  for (cl = TT.pending; cl; cl = cl->next) if (cl->names) {
+    f.name = cl->names->prev->data;
+    cpio_stat(&f);
+    while (cl->names->next != cl->names) {
+      dl = dlist_pop(&cl->names);
+      if (!f.err) cpio_header(dl->data, &f.st, 0);
+      free(dl->data);
+      free(dl);
+    }
+    cpio_file(&f, 1);
+    if (f.fd != -1) close(f.fd);
+    free(f.name);
+    free(cl->names);
+    cl->names = 0;
+  }
+}
+
 void cpio_main(void)
 {
   // Subtle bit: FLAG_o is 1 so we can just use it to select stdin/stdout.
@@ -100,17 +358,19 @@ void cpio_main(void)
 
     afd = xcreate(TT.archive, perm, 0644);
   }
+  TT.afd = afd;
+  TT.buf = xmalloc(CPIO_BUF);
 
   // read cpio archive
 
   if (toys.optflags & (FLAG_i|FLAG_t)) for (;;) {
     char *name, *tofree, *data;
-    unsigned size, mode, uid, gid, timestamp;
+    unsigned size, mode, uid, gid, nlink, timestamp;
     int test = toys.optflags & FLAG_t, err = 0;
 
     // Read header and name.
-    xreadall(afd, toybuf, 110);
-    tofree = name = strpad(afd, x8u(toybuf+94), 110);
+    cpio_take(toybuf, 110);
+    tofree = name = strpad(x8u(toybuf+94), 110);
     if (!strcmp("TRAILER!!!", name)) {
       if (CFG_TOYBOX_FREE) free(tofree);
       break;
@@ -122,8 +382,9 @@ void cpio_main(void)
 
     size = x8u(toybuf+54);
     mode = x8u(toybuf+14);
-    uid = x8u(toybuf+30);
-    gid = x8u(toybuf+38);
+    uid = x8u(toybuf+22);
+    gid = x8u(toybuf+30);
+    nlink = x8u(toybuf+38);
     timestamp = x8u(toybuf+46); // unsigned 32 bit, so year 2100 problem
 
     if (toys.optflags & (FLAG_t|FLAG_v)) puts(name);
@@ -139,13 +400,27 @@ void cpio_main(void)
     if (S_ISDIR(mode)) {
       if (!test) err = mkdir(name, mode);
     } else if (S_ISLNK(mode)) {
-      data = strpad(afd, size, 0);
+      data = strpad(size, 0);
       if (!test) err = symlink(data, name);
       free(data);
       // Can't get a filehandle to a symlink, so do special chown
       if (!err && !getpid()) err = lchown(name, uid, gid);
     } else if (S_ISREG(mode)) {
-      int fd = test ? 0 : open(name, O_CREAT|O_WRONLY|O_TRUNC|O_NOFOLLOW, mode);
+      unsigned len;
+      int fd = -1, holes;
+
+      // Later names for a hardlinked file become links to the first one,
+      // with any data they carry (newc puts it on the last) written through.
+      if (!test && nlink > 1) {
+        void **slot = inodeset_slot(&TT.links,
+          makedev(x8u(toybuf+62), x8u(toybuf+70)), x8u(toybuf+6));
+
+        if (*slot && !link(*slot, name))
+          fd = open(name, O_WRONLY|O_NOFOLLOW|(size ? O_TRUNC : 0));
+        else if (!*slot) *slot = xstrdup(name);
+      }
+      if (fd == -1)
+        fd = test ? 0 : open(name, O_CREAT|O_WRONLY|O_TRUNC|O_NOFOLLOW, mode);
 
       // If write fails, we still need to read/discard data to continue with
       // archive. Since doing so overwrites errno, report error now
@@ -154,17 +429,20 @@ void cpio_main(void)
         test++;
       }
 
-      data = toybuf;
-      while (size) {
-        if (size < sizeof(toybuf)) data = strpad(afd, size, 0);
-        else xreadall(afd, toybuf, sizeof(toybuf));
-        if (!test) txwrite(fd, data, data == toybuf ? sizeof(toybuf) : size);
-        if (data != toybuf) {
-          free(data);
-          break;
-        }
-        size -= sizeof(toybuf);
+      // Runs of zeroes become holes, filled out to length by ftruncate().
+      len = size;
+      holes = 0;
+      if (test) cpio_skip(size);
+      else while (size) {
+        unsigned chunk = size > CPIO_BUF ? CPIO_BUF : size;
+
+        data = cpio_get(chunk);
+        if (allzero(data, chunk) && -1 != lseek(fd, chunk, SEEK_CUR)) holes++;
+        else txwrite(fd, data, chunk);
+        size -= chunk;
       }
+      cpio_skip((4-(len&3))&3);
+      if (!test && holes && ftruncate(fd, len)) perror_msg("'%s'", name);
 
       if (!test) {
         // set owner, restore dropped suid bit
@@ -175,7 +453,7 @@ void cpio_main(void)
         close(fd);
       }
     } else if (!test)
-      err = mknod(name, mode, makedev(x8u(toybuf+62), x8u(toybuf+70)));
+      err = mknod(name, mode, makedev(x8u(toybuf+78), x8u(toybuf+86)));
 
     // Set ownership and timestamp.
     if (!test && !err) {
@@ -210,66 +488,27 @@ void cpio_main(void)
   // Output cpio archive
 
   } else {
-    char *name = 0;
-    size_t size = 0;
-
-    for (;;) {
-      struct stat st;
-      unsigned nlen, error = 0, zero = 0;
-      int len, fd = -1;
-      ssize_t llen;
-
-      len = xgetline(&name, &size, stdin);
-      if (len<1) break;
-      if (name[len-1] == '\n') name[--len] = 0;
-      nlen = len+1;
-      if (lstat(name, &st) || (S_ISREG(st.st_mode) 
-          && st.st_size && (fd = open(name, O_RDONLY))<0))
-      {
-        perror_msg("%s", name);
-        continue;
-      }
-
-      if (!S_ISREG(st.st_mode) && !S_ISLNK(st.st_mode)) st.st_size = 0;
-      if (st.st_size >> 32) perror_msg("skipping >2G file '%s'", name);
-      else {
-        llen = sprintf(toybuf,
-          "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
-          (int)st.st_ino, st.st_mode, st.st_uid, st.st_gid, (int)st.st_nlink,
-          (int)st.st_mtime, (int)st.st_size, major(st.st_dev),
-          minor(st.st_dev), major(st.st_rdev), minor(st.st_rdev), nlen, 0);
-        txwrite(afd, toybuf, llen);
-        txwrite(afd, name, nlen);
-
-        // NUL Pad header up to 4 multiple bytes.
-        llen = (llen + nlen) & 3;
-        if (llen) txwrite(afd, &zero, 4-llen); 
-
-        // Write out body for symlink or regular file
-        llen = st.st_size;
-        if (S_ISLNK(st.st_mode)) {
-          if (readlink(name, toybuf, sizeof(toybuf)-1) == llen)
-            txwrite(afd, toybuf, llen);
-          else perror_msg("readlink '%s'", name);
-        } else while (llen) {
-          nlen = llen > (ssize_t)sizeof(toybuf) ? sizeof(toybuf) : (unsigned)llen;
-          llen -= nlen;
-          // If read fails, write anyway (already wrote size in header)
-          if (nlen != readall(fd, toybuf, nlen))
-            if (!error++) perror_msg("bad read from file '%s'", name);
-          txwrite(afd, toybuf, nlen);
-        }
-        llen = st.st_size & 3;
-        if (llen) txwrite(afd, &zero, 4-llen);
-      }
-      close(fd);
+    int i;
+
+    TT.tail = &TT.pending;
+    TT.ahead = xmalloc(CPIO_AHEAD*sizeof(struct cpio_file));
+    for (i = 0; i<CPIO_AHEAD; i++) cpio_next(TT.ahead+i);
+    for (i = 0; TT.ahead[i].name; i = (i+1)%CPIO_AHEAD) {
+      cpio_file(TT.ahead+i, 0);
+      if (TT.ahead[i].fd != -1) close(TT.ahead[i].fd);
+      free(TT.ahead[i].name);
+      cpio_next(TT.ahead+i);
     }
-    free(name);
+    cpio_links();
+    if (CFG_TOYBOX_FREE) free(TT.ahead);
 
     memset(toybuf, 0, sizeof(toybuf));
-    txwrite(afd, toybuf,
+    cpio_put(toybuf,
       sprintf(toybuf, "070701%040X%056X%08XTRAILER!!!", 1, 0x0b, 0)+4);
+    cpio_flush();
   }
+  if (CFG_TOYBOX_FREE) inodeset_free(&TT.links, free);
+  if (CFG_TOYBOX_FREE) free(TT.buf);
   if (TT.archive) xclose(afd);
 
   if (TT.pass) toys.exitval |= xpclose(pid, pipe);
@@ -35,7 +35,9 @@ GLOBALS(
 
   void *slist_head;
   unsigned nelem;
-  void (*do_cut)(int fd);
+  int *ranges, nranges, tty;
+  char *obuf;
+  long olen;
 )
 
 struct slist {
@@ -98,6 +100,96 @@ static void parse_list(char *list)
   if (!TT.nelem) error_exit("missing positions list");
 }
 
+// Merge the sorted list into ranges of positions without overlaps or gaps
+// between neighbours, as start/end pairs in TT.ranges. Position lists then
+// come out as spans of the input, a field range with its own delimiters.
+static void merge_list(void)
+{
+  struct slist *sl;
+  int start, end, *r;
+
+  r = TT.ranges = xmalloc(2*TT.nelem*sizeof(int));
+  for (sl = TT.slist_head; sl; sl = sl->next) {
+    start = sl->start;
+    if ((end = sl->end) >= INT_MAX-1) end = INT_MAX;
+    else if (end < start) end = start;
+    if (r != TT.ranges && start <= r[-1]+(r[-1] < INT_MAX)) {
+      if (end > r[-1]) r[-1] = end;
+    } else {
+      *r++ = start;
+      *r++ = end;
+    }
+  }
+  TT.nranges = (r-TT.ranges)/2;
+}
+
+static void cut_flush(void)
+{
+  if (TT.olen && writeall(1, TT.obuf, TT.olen) != TT.olen)
+    perror_exit("write");
+  TT.olen = 0;
+}
+
+static void cut_write(char *s, long len)
+{
+  if (TT.olen+len > 65536) cut_flush();
+  if (len > 65536) {
+    if (writeall(1, s, len) != len) perror_exit("write");
+  } else {
+    memcpy(TT.obuf+TT.olen, s, len);
+    TT.olen += len;
+  }
+}
+
+// Cut each line of fd, writing the wanted parts straight out of the read
+// buffer. Fields are found a memchr() at a time, stopping after the last
+// one wanted.
+static void do_cut(int fd)
+{
+  struct linebuf lb;
+  char *s, *e, *p, *q, d = TT.delim ? *TT.delim : 0;
+  long len;
+  int i, field, out;
+
+  linebuf_init(&lb, fd);
+  lb.buf = xmalloc(lb.size = 65536);
+  while ((s = get_linebuf(&lb, &len, '\n', LINEBUF_CHOMP))) {
+    e = s+len;
+    if (!(toys.optflags & FLAG_f)) {
+      for (i = 0; i < TT.nranges && TT.ranges[2*i] < len; i++) {
+        p = s+TT.ranges[2*i];
+        q = (TT.ranges[2*i+1] < len) ? s+TT.ranges[2*i+1]+1 : e;
+        cut_write(p, q-p);
+      }
+    } else if (!memchr(s, d, len)) {
+      // No delimiter: print whole line unless -s
+      if (toys.optflags & FLAG_s) continue;
+      cut_write(s, len);
+    } else for (i = field = out = 0, p = s; i < TT.nranges; i++) {
+      // Skip to the range's first field (if the line has that many)
+      for (; field < TT.ranges[2*i]; field++) {
+        if (!(q = memchr(p, d, e-p))) break;
+        p = q+1;
+      }
+      if (field < TT.ranges[2*i]) break;
+
+      // Find the end of its last field, and write the lot
+      for (q = p; (q = memchr(q, d, e-q)) && field < TT.ranges[2*i+1]; q++)
+        field++;
+      if (!q) q = e;
+      if (out++) cut_write(&d, 1);
+      cut_write(p, q-p);
+      if (q == e) break;
+      p = q+1;
+      field++;
+    }
+    cut_write("\n", 1);
+    if (TT.tty) cut_flush();
+  }
+  linebuf_done(&lb);
+  cut_flush();
+}
+
 /*
  * retrive data from the file/s.
  */
@@ -106,126 +198,23 @@ static void get_data(void)
   char **argv = toys.optargs; //file name.
   toys.exitval = EXIT_SUCCESS;
 
-  if(!*argv) TT.do_cut(0); //for stdin
+  if(!*argv) do_cut(0); //for stdin
   else {
     for(; *argv; ++argv) {
-      if(strcmp(*argv, "-") == 0) TT.do_cut(0); //for stdin
+      if(strcmp(*argv, "-") == 0) do_cut(0); //for stdin
       else {
         int fd = open(*argv, O_RDONLY, 0);
         if(fd < 0) {//if file not present then continue with other files.
           perror_msg("%s", *argv);
           continue;
         }
-        TT.do_cut(fd);
+        do_cut(fd);
         xclose(fd);
       }
     }
   }
 }
 
-// perform cut operation on the given delimiter.
-static void do_fcut(int fd)
-{
-  char *buff, *pfield = 0, *delimiter = TT.delim;
-
-  for (;;) {
-    unsigned cpos = 0;
-    int start, ndelimiters = -1;
-    int  nprinted_fields = 0;
-    struct slist *temp_node = TT.slist_head;
-
-    free(pfield);
-    pfield = 0;
-
-    if (!(buff = get_line(fd))) break;
-
-    //does line have any delimiter?.
-    if (strrchr(buff, (int)delimiter[0]) == NULL) {
-      //if not then print whole line and move to next line.
-      if (!(toys.optflags & FLAG_s)) xputs(buff);
-      continue;
-    }
-
-    pfield = xzalloc(strlen(buff) + 1);
-
-    if (temp_node) {
-      //process list on each line.
-      while (cpos < TT.nelem && buff) {
-        if (!temp_node) break;
-        start = temp_node->start;
-        do {
-          char *field = 0;
-
-          //count number of delimeters per line.
-          while (buff) {
-            if (ndelimiters < start) {
-              ndelimiters++;
-              field = strsep(&buff, delimiter);
-            } else break;
-          }
-          //print field (if not yet printed).
-          if (!pfield[ndelimiters]) {
-            if (ndelimiters == start) {
-              //put delimiter.
-              if (nprinted_fields++ > 0) xputc(delimiter[0]);
-              if (field) fputs(field, stdout);
-              //make sure this field won't print again.
-              pfield[ndelimiters] = (char) 0x23; //put some char at this position.
-            }
-          }
-          start++;
-          if ((temp_node->end < 0) || !buff) break;          
-        } while(start <= temp_node->end);
-        temp_node = temp_node->next;
-        cpos++;
-      }
-    }
-    xputc('\n');
-  }
-}
-
-// perform cut operation char or byte.
-static void do_bccut(int fd)
-{
-  char *buff;
-
-  while ((buff = get_line(fd)) != NULL) {
-    unsigned cpos = 0;
-    int buffln = strlen(buff);
-    char *pfield = xzalloc(buffln + 1);
-    struct slist *temp_node = TT.slist_head;
-
-    if (temp_node != NULL) {
-      while (cpos < TT.nelem) {
-        int start;
-
-        if (!temp_node) break;
-        start = temp_node->start;
-        while (start < buffln) {
-          //to avoid duplicate field printing.
-          if (pfield[start]) {
-              if (++start <= temp_node->end) continue;
-              temp_node = temp_node->next;
-              break;
-          } else {
-            //make sure this field won't print again.
-            pfield[start] = (char) 0x23; //put some char at this position.
-            xputc(buff[start]);
-          }
-          if (++start > temp_node->end) {
-            temp_node = temp_node->next;
-            break;
-          }
-        }
-        cpos++;
-      }
-      xputc('\n');
-    }
-    free(pfield);
-    pfield = NULL;
-  }
-}
-
 void cut_main(void)
 {
   char delimiter = '\t'; //default delimiter.
@@ -234,17 +223,10 @@ void cut_main(void)
   TT.nelem = 0;
   TT.slist_head = NULL;
 
-  //Get list and assign the function.
-  if (toys.optflags & FLAG_f) {
-    list = TT.flist;
-    TT.do_cut = do_fcut;
-  } else if (toys.optflags & FLAG_c) {
-    list = TT.clist;
-    TT.do_cut = do_bccut;
-  } else {
-    list = TT.blist;
-    TT.do_cut = do_bccut;
-  }
+  //Get list.
+  if (toys.optflags & FLAG_f) list = TT.flist;
+  else if (toys.optflags & FLAG_c) list = TT.clist;
+  else list = TT.blist;
 
   if (toys.optflags & FLAG_d) {
     //delimiter must be 1 char.
@@ -267,10 +249,17 @@ void cut_main(void)
   }
 
   parse_list(list);
+  merge_list();
+  TT.obuf = xmalloc(65536);
+  TT.tty = isatty(1);
   get_data();
   if (!(toys.optflags & FLAG_d) && (toys.optflags & FLAG_f)) {
     free(TT.delim);
     TT.delim = NULL;
   }
   llist_traverse(TT.slist_head, free);
+  if (CFG_TOYBOX_FREE) {
+    free(TT.ranges);
+    free(TT.obuf);
+  }
 }
@@ -39,9 +39,9 @@ config DU
 GLOBALS(
   long maxdepth;
 
-  long depth, total;
+  long total;
   dev_t st_dev;
-  void *inodes;
+  struct inodeset inodes;
 )
 
 typedef struct node_size {
@@ -52,9 +52,12 @@ typedef struct node_size {
 // Print the size and name, given size in bytes
 static void print(long long size, struct dirtree *node)
 {
+  struct dirtree *try;
   char *name = "total";
+  long depth = 0;
 
-  if (TT.maxdepth && TT.depth > TT.maxdepth) return;
+  for (try = node; try && try->parent; try = try->parent) depth++;
+  if (TT.maxdepth && depth > TT.maxdepth) return;
 
   if (toys.optflags & FLAG_h) {
     human_readable(toybuf, size, 0);
@@ -67,37 +70,23 @@ static void print(long long size, struct dirtree *node)
 
     printf("%llu", (size>>bits)+!!(size&((1<<bits)-1)));
   }
-  if (node) name = dirtree_path(node, NULL);
+  if (node) name = dirtree_curpath(node);
   xprintf("\t%s\n", name);
-  if (node) free(name);
 }
 
-// Return whether or not we've seen this inode+dev, adding it to the list if
+// Return whether or not we've seen this inode+dev, adding it to the set if
 // we haven't.
-static int seen_inode(void **list, struct stat *st)
+static int seen_inode(struct inodeset *set, struct stat *st)
 {
-  if (!st) llist_traverse(st, free);
-
   // Skipping dir nodes isn't _quite_ right. They're not hardlinked, but could
   // be bind mounted. Still, it's more efficient and the archivers can't use
   // hardlinked directory info anyway. (Note that we don't catch bind mounted
   // _files_ because it doesn't change st_nlink.)
-  else if (!S_ISDIR(st->st_mode) && st->st_nlink > 1) {
-    struct inode_list {
-      struct inode_list *next;
-      ino_t ino;
-      dev_t dev;
-    } *new;
-
-    for (new = *list; new; new = new->next)
-      if(new->ino == st->st_ino && new->dev == st->st_dev)
-        return 1;
-
-    new = xzalloc(sizeof(*new));
-    new->ino = st->st_ino;
-    new->dev = st->st_dev;
-    new->next = *list;
-    *list = new;
+  if (!S_ISDIR(st->st_mode) && st->st_nlink > 1) {
+    void **slot = inodeset_slot(set, st->st_dev, st->st_ino);
+
+    if (*slot) return 1;
+    *slot = set;
   }
 
   return 0;
@@ -127,12 +116,8 @@ static int do_du(struct dirtree *node)
     if (seen_inode(&TT.inodes, &node->st)) return 0;
 
   // Collect child info before printing directory size
-  if (S_ISDIR(node->st.st_mode)) {
-    if (!node->again) {
-      TT.depth++;
-      return DIRTREE_COMEAGAIN|(DIRTREE_SYMFOLLOW*!!(toys.optflags&FLAG_L));
-    } else TT.depth--;
-  }
+  if (S_ISDIR(node->st.st_mode) && !node->again)
+    return DIRTREE_COMEAGAIN|(DIRTREE_SYMFOLLOW*!!(toys.optflags&FLAG_L));
 
   node->extra += node->st.st_blocks;
   if (node->parent) node->parent->extra += node->extra;
@@ -151,11 +136,17 @@ void du_main(void)
 {
   char *noargs[] = {".", 0}, **args;
 
-  // Loop over command line arguments, recursing through children
-  for (args = toys.optc ? toys.optargs : noargs; *args; args++)
-    dirtree_handle_callback(dirtree_start(*args, toys.optflags&(FLAG_H|FLAG_L)),
-      do_du);
+  // Loop over command line arguments, recursing through children. When all
+  // that's printed is the total the order of the walk doesn't matter, so
+  // let it have as many stat()s outstanding as the filesystem will take.
+  for (args = toys.optc ? toys.optargs : noargs; *args; args++) {
+    struct dirtree *dt = dirtree_start(*args, toys.optflags&(FLAG_H|FLAG_L));
+
+    if ((toys.optflags&(FLAG_s|FLAG_a)) == FLAG_s)
+      dirtree_handle_parallel(dt, do_du, 0);
+    else dirtree_handle_callback(dt, do_du);
+  }
   if (toys.optflags & FLAG_c) print(TT.total*512, 0);
 
-  if (CFG_TOYBOX_FREE) seen_inode(TT.inodes, 0);
+  if (CFG_TOYBOX_FREE) inodeset_free(&TT.inodes, 0);
 }
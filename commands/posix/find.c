@@ -55,49 +55,108 @@ config FIND
 GLOBALS(
   char **filter;
   struct double_list *argdata;
-  int topdir, xdev, depth, envsize;
+  int topdir, xdev, depth, envsize, print;
   time_t now;
+  void *expr;
 )
 
 // None of this can go in TT because you can have more than one -exec
 struct exec_range {
   char *next, *prev;
 
-  int dir, plus, arglen, argsize, curly, namecount, namesize;
+  int dir, plus, ok, arglen, argsize, curly, namecount, namesize;
   char **argstart;
   struct double_list *names;
 };
 
-// Perform pending -exec (if any)
-static int flush_exec(struct dirtree *new, struct exec_range *aa)
+// The filter is parsed once into a tree of these, which do_find() evaluates
+// for each file. AND and OR have a list of kids, NOT is a flag on the node.
+
+enum {FIND_AND, FIND_OR, FIND_TRUE, FIND_PRINT, FIND_PRUNE, FIND_NAME,
+  FIND_PATH, FIND_TYPE, FIND_PERM, FIND_ATIME, FIND_CTIME, FIND_MTIME,
+  FIND_SIZE, FIND_LINKS, FIND_INUM, FIND_MINDEPTH, FIND_MAXDEPTH, FIND_USER,
+  FIND_GROUP, FIND_NEWER, FIND_NOUSER, FIND_NOGROUP, FIND_EXEC};
+
+// What a test costs: nothing, the name and type readdir() gave us, the
+// path, or a stat(). Tests with no side effects (pure) in a row of ANDs get
+// sorted cheapest first, so they can rule a file out before it's stat()ed.
+#define FIND_COST_PATH 2
+#define FIND_COST_STAT 3
+
+// How to match a -name/-path pattern: fnmatch(), strcmp(), or for "*.c"
+// compare the end of the name.
+enum {FIND_GLOB, FIND_LITERAL, FIND_SUFFIX};
+
+struct find_expr {
+  struct find_expr *next, *kids;
+  char type, not, pure, cost, icase, match;
+  char *str;
+  long long num;
+  char sign;
+  union {
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+    struct timespec tm;
+    struct exec_range *aa;
+  } u;
+};
+
+static struct find_test {
+  char *name, type, cost, pure, arg;
+} find_tests[] = {
+  {"xdev", FIND_TRUE, 0, 1}, {"depth", FIND_TRUE, 0, 1},
+  {"print", FIND_PRINT}, {"print0", FIND_PRINT}, {"prune", FIND_PRUNE, 1},
+  {"nouser", FIND_NOUSER, FIND_COST_STAT, 1},
+  {"nogroup", FIND_NOGROUP, FIND_COST_STAT, 1},
+  {"name", FIND_NAME, 1, 1, 1}, {"iname", FIND_NAME, 1, 1, 1},
+  {"path", FIND_PATH, FIND_COST_PATH, 1, 1},
+  {"ipath", FIND_PATH, FIND_COST_PATH, 1, 1},
+  {"perm", FIND_PERM, FIND_COST_STAT, 1, 1}, {"type", FIND_TYPE, 1, 1, 1},
+  {"atime", FIND_ATIME, FIND_COST_STAT, 1, 1},
+  {"ctime", FIND_CTIME, FIND_COST_STAT, 1, 1},
+  {"mtime", FIND_MTIME, FIND_COST_STAT, 1, 1},
+  {"size", FIND_SIZE, FIND_COST_STAT, 1, 1},
+  {"links", FIND_LINKS, FIND_COST_STAT, 1, 1},
+  {"inum", FIND_INUM, FIND_COST_STAT, 1, 1},
+  {"mindepth", FIND_MINDEPTH, 0, 0, 1}, {"maxdepth", FIND_MAXDEPTH, 0, 0, 1},
+  {"user", FIND_USER, FIND_COST_STAT, 1, 1},
+  {"group", FIND_GROUP, FIND_COST_STAT, 1, 1},
+  {"newer", FIND_NEWER, FIND_COST_STAT, 1, 1},
+  {"exec", FIND_EXEC}, {"ok", FIND_EXEC}, {"execdir", FIND_EXEC},
+  {"okdir", FIND_EXEC}
+};
+
+// Perform pending -exec (if any). For -execdir the names are collected in
+// the directory they're in (dir), which is NULL for the command line ones.
+static int flush_exec(struct dirtree *dir, struct exec_range *aa)
 {
-  struct double_list **dl;
+  struct double_list **dl, *dl2;
   char **newargs;
-  int rc = 0;
-
-  if (!aa->namecount) return 0;
+  int rc = 0, count = 0;
 
-  if (aa->dir && new->parent) dl = (void *)&new->parent->extra;
+  if (aa->dir && dir) dl = (void *)&dir->extra;
   else dl = &aa->names;
+  if (!*dl) return 0;
   dlist_terminate(*dl);
+  for (dl2 = *dl; dl2; dl2 = dl2->next) count++;
 
   // switch to directory for -execdir, or back to top if we have an -execdir
   // _and_ a normal -exec, or are at top of tree in -execdir
-  if (aa->dir && new->parent) rc = fchdir(new->parent->data);
+  if (aa->dir && dir) rc = fchdir(dir->data);
   else if (TT.topdir != -1) rc = fchdir(TT.topdir);
   if (rc) {
-    perror_msg("%s", new->name);
+    perror_msg("%s", dir ? dir->name : ".");
 
     return rc;
   }
 
   // execdir: accumulated execs in this directory's children.
-  newargs = xmalloc(sizeof(char *)*(aa->arglen+aa->namecount+1));
+  newargs = xmalloc(sizeof(char *)*(aa->arglen+count+1));
   if (aa->curly < 0) {
     memcpy(newargs, aa->argstart, sizeof(char *)*aa->arglen);
     newargs[aa->arglen] = 0;
   } else {
-    struct double_list *dl2 = *dl;
     int pos = aa->curly, rest = aa->arglen - aa->curly;
 
     // Collate argument list
@@ -109,379 +168,466 @@ static int flush_exec(struct dirtree *new, struct exec_range *aa)
   }
 
   rc = xrun(newargs);
+  free(newargs);
 
   llist_traverse(*dl, llist_free_double);
   *dl = 0;
-  aa->namecount = 0;
+  if (!(aa->namecount -= count)) aa->namesize = 0;
 
   return rc;
 }
 
-// Return numeric value with explicit sign
-static int compare_numsign(long val, long units, char *str)
+// Parse [+-]N, with units applied unless it ends with a suffix letter
+static void parse_numsign(struct find_expr *e, long units, char *str)
 {
-  char sign = 0;
-  long myval;
-
-  if (*str == '+' || *str == '-') sign = *(str++);
+  if (*str == '+' || *str == '-') e->sign = *(str++);
   else if (!isdigit(*str)) error_exit("%s not [+-]N", str);
-  myval = atolx(str);
-  if (units && isdigit(str[strlen(str)-1])) myval *= units;
+  e->num = atolx(str);
+  if (units && isdigit(str[strlen(str)-1])) e->num *= units;
+}
 
-  if (sign == '+') return val > myval;
-  if (sign == '-') return val < myval;
-  return val == myval;
+// Compare val against a parsed [+-]N
+static int compare_numsign(struct find_expr *e, long long val)
+{
+  if (e->sign == '+') return val > e->num;
+  if (e->sign == '-') return val < e->num;
+  return val == e->num;
 }
 
 static void do_print(struct dirtree *new, char c)
 {
-  char *s=dirtree_path(new, 0);
+  xprintf("%s%c", dirtree_curpath(new), c);
+}
 
-  xprintf("%s%c", s, c);
-  free(s);
+// Set up -exec's argument range, consuming it from ss.
+static struct exec_range *parse_exec(char ***sss, char *s)
+{
+  struct exec_range *aa;
+  char **ss = *sss;
+  int len;
+
+  // catch "-exec" with no args and "-exec \;"
+  if (!ss[1] || !strcmp(ss[1], ";")) error_exit("'%s' needs 1 arg", s);
+
+  dlist_add_nomalloc(&TT.argdata, (void *)(aa = xzalloc(sizeof(*aa))));
+  aa->argstart = ++ss;
+  aa->curly = -1;
+
+  // Record command line arguments to -exec
+  for (len = 0; ss[len]; len++) {
+    if (!strcmp(ss[len], ";")) break;
+    else if (!strcmp(ss[len], "{}")) {
+      aa->curly = len;
+      if (ss[len+1] && !strcmp(ss[len+1], "+")) {
+
+        // Measure environment space
+        if (!TT.envsize) {
+          char **env;
+
+          for (env = environ; *env; env++)
+            TT.envsize += sizeof(char *) + strlen(*env) + 1;
+          TT.envsize += sizeof(char *);
+        }
+        aa->plus++;
+        len++;
+        break;
+      }
+    } else aa->argsize += sizeof(char *) + strlen(ss[len]) + 1;
+  }
+  if (!ss[len]) error_exit("-exec without \\;");
+  *sss = ss+len;
+  aa->arglen = len;
+  aa->dir = !!strchr(s, 'd');
+  aa->ok = *s == 'o';
+  if (aa->dir && TT.topdir == -1) TT.topdir = xopen(".", 0);
+
+  return aa;
 }
 
-// Call this with 0 for first pass argument parsing and syntax checking (which
-// populates argdata). Later commands traverse argdata (in order) when they
-// need "do once" results.
-static int do_find(struct dirtree *new)
+// Parse one test or action, with any ! in front of it, and its argument.
+static struct find_expr *parse_test(char ***sss, int not)
 {
-  int pcount = 0, print = 0, not = 0, active = !!new, test = active, recurse;
-  struct double_list *argdata = TT.argdata;
-  char *s, **ss;
+  struct find_expr *e;
+  struct find_test *ft;
+  char **ss = *sss, *s = *ss, *arg = ss[1];
+
+  if (*s != '-') error_exit("bad arg '%s'", s);
+  for (ft = find_tests; ft<find_tests+ARRAY_LEN(find_tests); ft++)
+    if (!strcmp(s+1, ft->name)) break;
+  if (ft == find_tests+ARRAY_LEN(find_tests)) error_exit("bad arg '%s'", s);
+  if (ft->arg && !arg) error_exit("'%s' needs 1 arg", s);
+
+  e = xzalloc(sizeof(struct find_expr));
+  e->type = ft->type;
+  e->cost = ft->cost;
+  e->pure = ft->pure;
+  e->not = not;
+  s++;
+
+  if (!strcmp(s, "xdev")) TT.xdev = 1;
+  else if (!strcmp(s, "depth")) TT.depth = 1;
+  else if (e->type == FIND_PRINT) {
+    TT.print++;
+    e->sign = s[5] ? 0 : '\n';
+  } else if (e->type == FIND_NAME || e->type == FIND_PATH) {
+    e->icase = *s == 'i';
+    e->str = e->icase ? strlower(arg) : arg;
+    if (!strpbrk(e->str, "*?[\\")) e->match = FIND_LITERAL;
+    else if (e->type == FIND_NAME && *e->str == '*'
+             && !strpbrk(e->str+1, "*?[\\"))
+    {
+      e->match = FIND_SUFFIX;
+      e->num = strlen(++e->str);
+    }
+  } else if (e->type == FIND_PERM) {
+    e->sign = *arg == '-';
+    e->u.mode = string_to_mode(arg+e->sign, 0);
+  } else if (e->type == FIND_TYPE) {
+    unsigned types[] = {S_IFBLK, S_IFCHR, S_IFDIR, S_IFLNK, S_IFIFO, S_IFREG,
+                        S_IFSOCK};
+    int i = stridx("bcdlpfs", *arg);
+
+    if (i<0) error_exit("bad -type '%c'", *arg);
+    e->u.mode = types[i];
+  } else if (e->type>=FIND_ATIME && e->type<=FIND_MTIME)
+    parse_numsign(e, 86400, arg);
+  else if (e->type == FIND_SIZE) parse_numsign(e, 512, arg);
+  else if (e->type == FIND_LINKS || e->type == FIND_INUM)
+    parse_numsign(e, 0, arg);
+  else if (e->type == FIND_MINDEPTH || e->type == FIND_MAXDEPTH)
+    e->num = atolx(arg);
+  else if (e->type == FIND_USER) e->u.uid = xgetpwnamid(arg)->pw_uid;
+  else if (e->type == FIND_GROUP) e->u.gid = xgetgrnamid(arg)->gr_gid;
+  else if (e->type == FIND_NEWER) {
+    struct stat st;
+
+    xstat(arg, &st);
+    e->u.tm = st.st_mtim;
+  } else if (e->type == FIND_EXEC) {
+    TT.print++;
+    e->u.aa = parse_exec(&ss, s);
+  }
+  *sss = ss+1+ft->arg;
 
-  recurse = DIRTREE_COMEAGAIN|(DIRTREE_SYMFOLLOW*!!(toys.optflags&FLAG_L));
+  return e;
+}
 
-  // skip . and .. below topdir, handle -xdev and -depth
-  if (new) {
-    if (new->parent) {
-      if (!dirtree_notdotdot(new)) return 0;
-      if (TT.xdev && new->st.st_dev != new->parent->st.st_dev) recurse = 0;
+// Does this token end an AND list?
+static int end_and(char *s)
+{
+  return !s || !strcmp(s, "-o") || !strcmp(s, "-or") || !strcmp(s, ")");
+}
+
+static struct find_expr *parse_or(char ***sss, int depth);
+
+// Parse "!"s and then a test or parenthesized expression.
+static struct find_expr *parse_unary(char ***sss, int depth)
+{
+  struct find_expr *e;
+  char **ss = *sss;
+  int not = 0;
+
+  for (; *ss && (!strcmp(*ss, "!") || !strcmp(*ss, "-not")); ss++) not = !not;
+  if (!*ss) error_exit("bad arg '%s'", ss[-1]);
+  if (strcmp(*ss, "(")) e = parse_test(&ss, not);
+  else {
+    if (depth == 4096) error_exit("bad arg '%s'", *ss);
+    ss++;
+    if (end_and(*ss)) error_exit("bad arg '%s'", *ss ? *ss : ss[-1]);
+    e = parse_or(&ss, depth+1);
+    if (!*ss || strcmp(*ss, ")")) error_exit("bad arg '%s'", ss[-1]);
+    ss++;
+
+    // Keep the group so its ! doesn't land on a -maxdepth inside it
+    if (not) {
+      struct find_expr *group = xzalloc(sizeof(struct find_expr));
+
+      group->kids = e;
+      group->pure = e->pure;
+      group->cost = e->cost;
+      group->not = 1;
+      e = group;
     }
-    if (S_ISDIR(new->st.st_mode)) {
-      if (!new->again) {
-        struct dirtree *n;
-
-        if (TT.depth) return recurse;
-        for (n = new->parent; n; n = n->parent) {
-          if (n->st.st_ino==new->st.st_ino && n->st.st_dev==new->st.st_dev) {
-            error_msg("'%s': loop detected", s = dirtree_path(new, 0));
-            free(s);
-
-            return 0;
-          }
-        }
-      } else {
-        struct double_list *dl;
+  }
+  *sss = ss;
 
-        if (TT.topdir != -1)
-          for (dl = TT.argdata; dl; dl = dl->next)
-            if (dl->prev == (void *)1 || !new->parent)
-              toys.exitval |= flush_exec(new, (void *)dl);
+  return e;
+}
 
-        return 0;
-      }
+// Make a list of kids into an AND or OR node (unless there's just one).
+// The pure tests in each run in an AND list get sorted, cheapest first.
+static struct find_expr *parse_group(struct find_expr **kids, int count,
+  int type)
+{
+  struct find_expr *e, *t;
+  int i, j;
+
+  if (count == 1) return *kids;
+  if (type == FIND_AND) {
+    for (i = 1; i<count; i++) {
+      if (!kids[i]->pure) continue;
+      for (t = kids[i], j = i; j && kids[j-1]->pure && kids[j-1]->cost>t->cost;
+           j--) kids[j] = kids[j-1];
+      kids[j] = t;
     }
   }
+  e = xzalloc(sizeof(struct find_expr));
+  e->type = type;
+  e->pure = 1;
+  for (i = count; i--;) {
+    kids[i]->next = e->kids;
+    e->kids = kids[i];
+    if (!kids[i]->pure) e->pure = 0;
+    if (kids[i]->cost > e->cost) e->cost = kids[i]->cost;
+  }
+
+  return e;
+}
 
-  // pcount: parentheses stack depth (using toybuf bytes, 4096 max depth)
-  // test: result of most recent test
-  // active: if 0 don't perform tests
-  // not: a pending ! applies to this test (only set if performing tests)
-  // print: saw one of print/ok/exec, no need for default -print
-
-  if (TT.filter) for (ss = TT.filter; *ss; ss++) {
-    int check = active && test;
-
-    s = *ss;
-
-    // handle ! ( ) using toybuf as a stack
-    if (*s != '-') {
-      if (s[1]) goto error;
-
-      if (*s == '!') {
-        // Don't invert if we're not making a decision
-        if (check) not = !not;
-
-      // Save old "not" and "active" on toybuf stack.
-      // Deactivate this parenthetical if !test
-      // Note: test value should never change while !active
-      } else if (*s == '(') {
-        if (pcount == sizeof(toybuf)) goto error;
-        toybuf[pcount++] = not+(active<<1);
-        if (!check) active = 0;
-        not = 0;
-
-      // Pop status, apply deferred not to test
-      } else if (*s == ')') {
-        if (--pcount < 0) goto error;
-        // Pop active state, apply deferred not (which was only set if checking)
-        active = (toybuf[pcount]>>1)&1;
-        if (active && (toybuf[pcount]&1)) test = !test;
-        not = 0;
-      } else goto error;
-
-      continue;
-    } else s++;
-
-    if (!strcmp(s, "xdev")) TT.xdev = 1;
-    else if (!strcmp(s, "depth")) TT.depth = 1;
-    else if (!strcmp(s, "o") || !strcmp(s, "or")) {
-      if (not) goto error;
-      if (active) {
-        if (!test) test = 1;
-        else active = 0;     // decision has been made until next ")"
+// Parse tests and actions joined by -a (or nothing) and then -o.
+static struct find_expr *parse_or(char ***sss, int depth)
+{
+  struct find_expr **ors = 0, **ands = 0, *e;
+  char **ss = *sss;
+  int nors = 0, nands;
+
+  for (;;) {
+    for (nands = 0;;) {
+      e = parse_unary(&ss, depth);
+      if (!(nands&15)) ands = xrealloc(ands, sizeof(*ands)*(nands+16));
+      ands[nands++] = e;
+      if (end_and(*ss)) break;
+      if (!strcmp(*ss, "-a") || !strcmp(*ss, "-and")) {
+        if (end_and(*++ss)) error_exit("bad arg '%s'", ss[-1]);
       }
-    } else if (!strcmp(s, "not")) {
-      if (check) not = !not;
-      continue;
-    // Mostly ignore NOP argument
-    } else if (!strcmp(s, "a") || !strcmp(s, "and")) {
-      if (not) goto error;
-
-    } else if (!strcmp(s, "print") || !strcmp("print0", s)) {
-      print++;
-      if (check) do_print(new, s[5] ? 0 : '\n');
-
-    } else if (!strcmp(s, "nouser")) {
-      if (check) if (getpwuid(new->st.st_uid)) test = 0;
-    } else if (!strcmp(s, "nogroup")) {
-      if (check) if (getgrgid(new->st.st_gid)) test = 0;
-    } else if (!strcmp(s, "prune")) {
-      if (check && S_ISDIR(new->st.st_dev) && !TT.depth) recurse = 0;
-
-    // Remaining filters take an argument
+    }
+    if (!(nors&15)) ors = xrealloc(ors, sizeof(*ors)*(nors+16));
+    ors[nors++] = parse_group(ands, nands, FIND_AND);
+    if (!*ss || **ss == ')') break;
+    if (end_and(*++ss)) error_exit("bad arg '%s'", ss[-1]);
+  }
+  e = parse_group(ors, nors, FIND_OR);
+  free(ands);
+  free(ors);
+  *sss = ss;
+
+  return e;
+}
+
+// Match a -name or -path pattern.
+static int find_match(struct find_expr *e, char *name, int flags)
+{
+  long len;
+
+  if (e->match == FIND_LITERAL) return !strcmp(e->str, name);
+  if (e->match == FIND_SUFFIX)
+    return (len = strlen(name)) >= e->num && !strcmp(name+len-e->num, e->str);
+
+  return !fnmatch(e->str, name, flags);
+}
+
+// Evaluate expression e for new (stat()ing it first if e needs that),
+// clearing *recurse if it says not to descend.
+static int find_eval(struct find_expr *e, struct dirtree *new, int *recurse)
+{
+  struct stat *st = &new->st;
+  struct find_expr *k;
+  int test = 1;
+
+  if (e->cost == FIND_COST_STAT && e->type > FIND_OR && !dirtree_stat(new))
+    return 0;
+
+  switch (e->type) {
+  case FIND_AND:
+    for (k = e->kids; k && test; k = k->next) test = find_eval(k, new, recurse);
+    break;
+  case FIND_OR:
+    for (k = e->kids, test = 0; k && !test; k = k->next)
+      test = find_eval(k, new, recurse);
+    break;
+  case FIND_PRINT:
+    do_print(new, e->sign);
+    break;
+  case FIND_PRUNE:
+    if (S_ISDIR(st->st_mode) && !TT.depth) *recurse = 0;
+    break;
+  case FIND_NAME:
+  case FIND_PATH: {
+    char *name = e->type == FIND_PATH ? dirtree_curpath(new) : new->name;
+
+    // Case flattening
+    if (e->icase) name = strlower(name);
+    test = find_match(e, name, FNM_PATHNAME*(e->type == FIND_PATH));
+    if (e->icase) free(name);
+    break;
+  }
+  case FIND_PERM: {
+    mode_t m2 = st->st_mode & 07777;
+
+    if (e->sign) m2 &= e->u.mode;
+    test = e->u.mode == m2;
+    break;
+  }
+  case FIND_TYPE:
+    test = (st->st_mode & S_IFMT) == e->u.mode;
+    break;
+  case FIND_ATIME:
+    test = compare_numsign(e, TT.now - st->st_atime);
+    break;
+  case FIND_CTIME:
+    test = compare_numsign(e, TT.now - st->st_ctime);
+    break;
+  case FIND_MTIME:
+    test = compare_numsign(e, TT.now - st->st_mtime);
+    break;
+  case FIND_SIZE:
+    test = compare_numsign(e, st->st_size);
+    break;
+  case FIND_LINKS:
+    test = compare_numsign(e, st->st_nlink);
+    break;
+  case FIND_INUM:
+    test = compare_numsign(e, st->st_ino);
+    break;
+  case FIND_MINDEPTH:
+  case FIND_MAXDEPTH: {
+    struct dirtree *dt = new;
+    long long i = 0;
+
+    while ((dt = dt->parent)) i++;
+    if (e->type == FIND_MINDEPTH) {
+      test = i >= e->num;
+      if (i == e->num && e->not) *recurse = 0;
     } else {
-      if (!strcmp(s, "name") || !strcmp(s, "iname")
-        || !strcmp(s, "path") || !strcmp(s, "ipath"))
-      {
-        int i = (*s == 'i');
-        char *arg = ss[1], *path = 0, *name = new->name;
-
-        // Handle path expansion and case flattening
-        if (new && s[i] == 'p') name = path = dirtree_path(new, 0);
-        if (i) {
-          if (check || !new) {
-            name = strlower(new ? name : arg);
-            if (!new) {
-              dlist_add(&TT.argdata, name);
-              free(path);
-            } else arg = ((struct double_list *)llist_pop(&argdata))->data;
-          }
-        }
+      test = i <= e->num;
+      if (i == e->num && !e->not) *recurse = 0;
+    }
+    break;
+  }
+  case FIND_USER:
+    test = st->st_uid == e->u.uid;
+    break;
+  case FIND_GROUP:
+    test = st->st_gid == e->u.gid;
+    break;
+  case FIND_NEWER:
+    test = st->st_mtim.tv_sec > e->u.tm.tv_sec;
+    if (st->st_mtim.tv_sec == e->u.tm.tv_sec)
+      test = st->st_mtim.tv_nsec > e->u.tm.tv_nsec;
+    break;
+  case FIND_NOUSER:
+    test = !uid_name(st->st_uid);
+    break;
+  case FIND_NOGROUP:
+    test = !gid_name(st->st_gid);
+    break;
+  case FIND_EXEC: {
+    struct exec_range *aa = e->u.aa;
+    struct double_list **ddl;
+    // name is always a new malloc, so we can always free it.
+    char *name = aa->dir ? xstrdup(new->name) : dirtree_path(new, 0);
+
+    // Mark entry so COMEAGAIN can call flush_exec() in parent.
+    // This is never a valid pointer value for prev to have otherwise
+    if (aa->dir) aa->prev = (void *)1;
+
+    if (aa->ok) {
+      fprintf(stderr, "[%s] %s", *aa->argstart, name);
+      if (!(test = yesno(0))) {
+        free(name);
+        break;
+      }
+    }
 
-        if (check) {
-          test = !fnmatch(arg, name, FNM_PATHNAME*(s[i] == 'p'));
-          free(path);
-          if (i) free(name);
-        }
-      } else if (!strcmp(s, "perm")) {
-        if (check) {
-          char *m = ss[1];
-          mode_t m1 = string_to_mode(m+(*m == '-'), 0),
-                 m2 = new->st.st_dev & 07777;
-
-          if (*m != '-') m2 &= m1;
-          test = m1 == m2;
-        }
-      } else if (!strcmp(s, "type")) {
-        if (check) {
-          unsigned int types[] = {S_IFBLK, S_IFCHR, S_IFDIR, S_IFLNK, S_IFIFO,
-                         S_IFREG, S_IFSOCK};
-          int i = stridx("bcdlpfs", *ss[1]);
-
-          if (i<0) error_exit("bad -type '%c'", *ss[1]);
-          if ((new->st.st_mode & S_IFMT) != types[i]) test = 0;
-        }
+    // Add next name to list (global list without -dir, local with)
+    if (aa->dir && new->parent)
+      ddl = (struct double_list **)&new->parent->extra;
+    else ddl = &aa->names;
 
-      } else if (!strcmp(s, "atime")) {
-        if (check)
-          test = compare_numsign(TT.now - new->st.st_atime, 86400, ss[1]);
-      } else if (!strcmp(s, "ctime")) {
-        if (check)
-          test = compare_numsign(TT.now - new->st.st_ctime, 86400, ss[1]);
-      } else if (!strcmp(s, "mtime")) {
-        if (check)
-          test = compare_numsign(TT.now - new->st.st_mtime, 86400, ss[1]);
-      } else if (!strcmp(s, "size")) {
-        if (check)
-          test = compare_numsign(new->st.st_size, 512, ss[1]);
-      } else if (!strcmp(s, "links")) {
-        if (check) test = compare_numsign(new->st.st_nlink, 0, ss[1]);
-      } else if (!strcmp(s, "inum")) {
-        if (check)
-          test = compare_numsign(new->st.st_ino, 0, ss[1]);
-      } else if (!strcmp(s, "mindepth") || !strcmp(s, "maxdepth")) {
-        if (check) {
-          struct dirtree *dt = new;
-          int i = 0, d = atolx(ss[1]);
-
-          while ((dt = dt->parent)) i++;
-          if (s[1] == 'i') {
-            test = i >= d;
-            if (i == d && not) recurse = 0;
-          } else {
-            test = i <= d;
-            if (i == d && !not) recurse = 0;
-          }
-        }
-      } else if (!strcmp(s, "user") || !strcmp(s, "group")
-              || !strcmp(s, "newer"))
-      {
-        struct {
-          void *next, *prev;
-          union {
-            uid_t uid;
-            gid_t gid;
-            struct timespec tm;
-          } u;
-        } *udl;
-
-        if (!new) {
-          if (ss[1]) {
-            udl = xmalloc(sizeof(*udl));
-            dlist_add_nomalloc(&TT.argdata, (void *)udl);
-
-            if (*s == 'u') udl->u.uid = xgetpwnamid(ss[1])->pw_uid;
-            else if (*s == 'g') udl->u.gid = xgetgrnamid(ss[1])->gr_gid;
-            else {
-              struct stat st;
-
-              xstat(ss[1], &st);
-              udl->u.tm = st.st_mtim;
-            }
-          }
-        } else {
-          udl = (void *)llist_pop(&argdata);
-          if (check) {
-            if (*s == 'u') test = new->st.st_uid == udl->u.uid;
-            else if (*s == 'g') test = new->st.st_gid == udl->u.gid;
-            else {
-              test = new->st.st_mtim.tv_sec > udl->u.tm.tv_sec;
-              if (new->st.st_mtim.tv_sec == udl->u.tm.tv_sec)
-                test = new->st.st_mtim.tv_nsec > udl->u.tm.tv_nsec;
-            }
-          }
-        }
-      } else if (!strcmp(s, "exec") || !strcmp("ok", s)
-              || !strcmp(s, "execdir") || !strcmp(s, "okdir"))
-      {
-        struct exec_range *aa;
-
-        print++;
-
-        // Initial argument parsing pass
-        if (!new) {
-          int len;
-
-          // catch "-exec" with no args and "-exec \;"
-          if (!ss[1] || !strcmp(ss[1], ";")) error_exit("'%s' needs 1 arg", s);
-
-          dlist_add_nomalloc(&TT.argdata, (void *)(aa = xzalloc(sizeof(*aa))));
-          aa->argstart = ++ss;
-          aa->curly = -1;
-
-          // Record command line arguments to -exec
-          for (len = 0; ss[len]; len++) {
-            if (!strcmp(ss[len], ";")) break;
-            else if (!strcmp(ss[len], "{}")) {
-              aa->curly = len;
-              if (!strcmp(ss[len+1], "+")) {
-
-                // Measure environment space
-                if (!TT.envsize) {
-                  char **env;
-
-                  for (env = environ; *env; env++)
-                    TT.envsize += sizeof(char *) + strlen(*env) + 1;
-                  TT.envsize += sizeof(char *);
-                }
-                aa->plus++;
-                len++;
-                break;
-              }
-            } else aa->argsize += sizeof(char *) + strlen(ss[len]) + 1;
-          }
-          if (!ss[len]) error_exit("-exec without \\;");
-          ss += len;
-          aa->arglen = len;
-          aa->dir = !!strchr(s, 'd');
-          if (aa->dir && TT.topdir == -1) TT.topdir = xopen(".", 0);
-
-        // collect names and execute commands
-        } else {
-          char *name, *ss1 = ss[1];
-          struct double_list **ddl;
-
-          // Grab command line exec argument list
-          aa = (void *)llist_pop(&argdata);
-          ss += aa->arglen + 1;
-
-          if (!check) goto cont;
-          // name is always a new malloc, so we can always free it.
-          name = aa->dir ? xstrdup(new->name) : dirtree_path(new, 0);
-
-          // Mark entry so COMEAGAIN can call flush_exec() in parent.
-          // This is never a valid pointer value for prev to have otherwise
-          if (aa->dir) aa->prev = (void *)1;
-
-          if (*s == 'o') {
-            fprintf(stderr, "[%s] %s", ss1, name);
-            if (!(test = yesno(0))) {
-              free(name);
-              goto cont;
-            }
-          }
-
-          // Add next name to list (global list without -dir, local with)
-          if (aa->dir && new->parent)
-            ddl = (struct double_list **)&new->parent->extra;
-          else ddl = &aa->names;
-
-          // Is this + mode?
-          if (aa->plus) {
-            int size = sizeof(char *)+strlen(name)+1;
-
-            // Linux caps environment space (env vars + args) at 32 4k pages.
-            // todo: is there a way to probe this instead of constant here?
-
-            if (TT.envsize+aa->argsize+aa->namesize+size >= 131072)
-              toys.exitval |= flush_exec(new, aa);
-            aa->namesize += size;
-          }
-          dlist_add(ddl, name);
-          aa->namecount++;
-          if (!aa->plus) test = flush_exec(new, aa);
+    // Is this + mode?
+    if (aa->plus) {
+      int size = sizeof(char *)+strlen(name)+1;
+
+      // Linux caps environment space (env vars + args) at 32 4k pages.
+      // todo: is there a way to probe this instead of constant here?
+
+      if (TT.envsize+aa->argsize+aa->namesize+size >= 131072)
+        toys.exitval |= flush_exec(new->parent, aa);
+      aa->namesize += size;
+    }
+    dlist_add(ddl, name);
+    aa->namecount++;
+    if (!aa->plus) test = !flush_exec(new->parent, aa);
+    break;
+  }
+  }
+
+  return test ^ e->not;
+}
+
+static int do_find(struct dirtree *new)
+{
+  int recurse, test;
+  char *s;
+
+  recurse = DIRTREE_COMEAGAIN|DIRTREE_LAZYSTAT
+    |(DIRTREE_SYMFOLLOW*!!(toys.optflags&FLAG_L));
+
+  // skip . and .. below topdir, handle -xdev and -depth
+  if (new->parent) {
+    if (!dirtree_notdotdot(new)) return 0;
+    if (S_ISDIR(new->st.st_mode) && !dirtree_stat(new)) return 0;
+    if (TT.xdev && new->st.st_dev != new->parent->st.st_dev) recurse = 0;
+  }
+  if (S_ISDIR(new->st.st_mode)) {
+    if (!new->again) {
+      struct dirtree *n;
+
+      for (n = new->parent; n; n = n->parent) {
+        if (n->st.st_ino==new->st.st_ino && n->st.st_dev==new->st.st_dev) {
+          error_msg("'%s': loop detected", s = dirtree_path(new, 0));
+          free(s);
+
+          return 0;
         }
+      }
+      if (TT.depth) return recurse;
+    } else {
+      struct double_list *dl;
 
-        // Argument consumed, skip the check.
-        goto cont;
-      } else goto error;
+      for (dl = TT.argdata; dl; dl = dl->next)
+        if (dl->prev == (void *)1 || !new->parent)
+          toys.exitval |= flush_exec(new, (void *)dl);
 
-      // This test can go at the end because we do a syntax checking
-      // pass first. Putting it here gets the error message (-unknown
-      // vs -known noarg) right.
-      if (!*++ss) error_exit("'%s' needs 1 arg", --s);
+      // With -depth, the directory's own turn comes after its contents.
+      if (!TT.depth) return 0;
+      recurse = 0;
     }
-cont:
-    // Apply pending "!" to result
-    if (active && not) test = !test;
-    not = 0;
   }
 
-  if (new) {
-    // If there was no action, print
-    if (!print && test) do_print(new, '\n');
-  } else dlist_terminate(TT.argdata);
+  test = !TT.expr || find_eval(TT.expr, new, &recurse);
+
+  // If there was no action, print
+  if (!TT.print && test) do_print(new, '\n');
 
   return recurse;
+}
+
+static void free_expr(struct find_expr *e)
+{
+  struct find_expr *k;
 
-error:
-  error_exit("bad arg '%s'", *ss);
+  while ((k = e->kids)) {
+    e->kids = k->next;
+    free_expr(k);
+  }
+  if (e->icase) free(e->str);
+  free(e);
 }
 
 void find_main(void)
 {
+  struct double_list *dl;
   int i, len;
   char **ss = toys.optargs;
 
@@ -498,17 +644,28 @@ void find_main(void)
     len = 1;
   }
 
-  // first pass argument parsing, verify args match up, handle "evaluate once"
+  // Parse the filter once, resolving things like -user and -newer up front
   TT.now = time(0);
-  do_find(0);
+  if (*TT.filter) {
+    char **f = TT.filter;
+
+    TT.expr = parse_or(&f, 0);
+    if (*f) error_exit("bad arg '%s'", *f);
+  }
+  dlist_terminate(TT.argdata);
 
   // Loop through paths
   for (i = 0; i < len; i++)
     dirtree_handle_callback(dirtree_start(ss[i], toys.optflags&(FLAG_H|FLAG_L)),
       do_find);
 
+  // Anything still pending was named on the command line
+  for (dl = TT.argdata; dl; dl = dl->next)
+    toys.exitval |= flush_exec(0, (void *)dl);
+
   if (CFG_TOYBOX_FREE) {
     close(TT.topdir);
     llist_traverse(TT.argdata, free);
+    if (TT.expr) free_expr(TT.expr);
   }
 }
@@ -6,7 +6,7 @@
  *
  * TODO: -ABC
 
-USE_GREP(NEWTOY(grep, "ZzEFHabhinorsvwclqe*f*m#x[!wx][!EFw]", TOYFLAG_BIN))
+USE_GREP(NEWTOY(grep, "(unordered)ZzEFHabhinorsvwclqe*f*m#x[!wx][!EF]", TOYFLAG_BIN))
 USE_EGREP(OLDTOY(egrep, grep, TOYFLAG_BIN))
 USE_FGREP(OLDTOY(fgrep, grep, TOYFLAG_BIN))
 
@@ -14,12 +14,16 @@ config GREP
   bool "grep"
   default y
   help
-    usage: grep [-EFivwcloqsHbhn] [-m MAX] [-e REGEX]... [-f REGFILE] [FILE]...
+    usage: grep [-EFivwcloqsHbhna] [-m MAX] [-e REGEX]... [-f REGFILE] [FILE]...
 
     Show lines matching regular expressions. If no -e, first argument is
     regular expression to match. With no files (or "-" filename) read stdin.
     Returns 0 if matched, 1 if no match found.
 
+    A file with a NUL byte in its first block is binary: rather than its
+    matching lines, say it matches. -r searches several files at once, each
+    file's output coming out in the order they were found.
+
     -e  Regex to match. (May be repeated.)
     -f  File containing regular expressions to match.
 
@@ -28,7 +32,7 @@ config GREP
     -i  case insensitive         -m  stop after this many lines matched
     -r  recursive (on dir)       -v  invert match
     -w  whole word (implies -E)  -x  whole line
-    -z  input NUL terminated
+    -z  input NUL terminated     -a  binary files are text
 
     display modes: (default: matched line)
     -c  count of matching lines  -l  show matching filenames
@@ -39,6 +43,8 @@ config GREP
     -H  force filename           -b  byte offset of match
     -h  hide filename            -n  line number of match
 
+    --unordered  with -r, show each file's output when it's done
+
 config EGREP
   bool
   default y
@@ -59,156 +65,488 @@ GLOBALS(
   long m;
   struct arg_list *f;
   struct arg_list *e;
+
+  struct fixed *fixed;
+  char *regex;
+  FILE *out, *sink;
+  char *buf;
+  long size;
+  int binary, *stop;
+  struct grep_pool *pool;
+  struct grep_job *job;
 )
 
-// Show matches in one file
-static void do_grep(int fd, char *name)
+// A file queued for a grep -r worker, see grep_start(). next is walk order,
+// todo the ones no worker has taken yet.
+struct grep_job {
+  struct grep_job *next, *todo;
+  char *name, *data;
+  size_t len;
+  FILE *out;
+  unsigned flags;
+  int fd, err, matched, done, head, direct;
+};
+
+// Fixed string matching (-F), compiled once by parse_regex():
+// Boyer-Moore-Horspool for a single pattern, Aho-Corasick for several.
+// Both find the leftmost match, and the longest one starting there, which
+// is what regexec() would say for the same strings.
+
+struct fixed {
+  unsigned char fold[256];  // -i folds case, otherwise identity
+
+  // Boyer-Moore-Horspool: pattern and how far to skip on each last byte.
+  char *pat;
+  long len, skip[256];
+
+  // Aho-Corasick: a DFA over an alphabet of just the bytes that appear in
+  // patterns (class 0 is everything else), and for each state the length of
+  // the longest pattern ending there, or -1.
+  unsigned char class[256];
+  int count, nclass, nstates, maxlen, *outlen;
+  unsigned *next;
+};
+
+static struct fixed *fixed_compile(struct arg_list *list)
 {
-  FILE *file = fdopen(fd, "r");
-  long offset = 0;
-  int lcount = 0, mcount = 0;
-  char indelim = '\n' * !(toys.optflags&FLAG_z),
-       outdelim = '\n' * !(toys.optflags&FLAG_Z);
+  struct fixed *fx = xzalloc(sizeof(struct fixed));
+  struct arg_list *al;
+  unsigned *fail, *queue, s, t;
+  int i, c, l, head, tail, total = 0;
+
+  for (i = 0; i<256; i++)
+    fx->fold[i] = (toys.optflags&FLAG_i) ? tolower(i) : i;
+  for (al = list; al; al = al->next) {
+    fx->count++;
+    total += (l = strlen(al->arg));
+    if (l>fx->maxlen) fx->maxlen = l;
+  }
 
-  if (!fd) name = "(standard input)";
+  if (fx->count == 1) {
+    fx->len = strlen(fx->pat = xstrdup(list->arg));
+    for (i = 0; i<fx->len; i++) fx->pat[i] = fx->fold[(unsigned char)fx->pat[i]];
+    for (i = 0; i<256; i++) fx->skip[i] = fx->len;
+    for (i = 0; i+1<fx->len; i++)
+      fx->skip[(unsigned char)fx->pat[i]] = fx->len-1-i;
+    if (toys.optflags&FLAG_i) for (i = 0; i<256; i++)
+      fx->skip[i] = fx->skip[fx->fold[i]];
 
-  if (!file) {
-    perror_msg("%s", name);
-    return;
+    return fx;
   }
 
-  // Loop through lines of input
-  for (;;) {
-    char *line = 0, *start;
-    regmatch_t matches;
-    size_t unused;
-    long len;
-    int mmatch = 0;
-
-    lcount++;
-    if (0 > (len = xgetdelim(&line, &unused, indelim, file))) break;
-    if (line[len-1] == indelim) line[len-1] = 0;
+  // Number the (folded) bytes patterns use
+  for (al = list; al; al = al->next)
+    for (i = 0; al->arg[i]; i++)
+      fx->class[fx->fold[(unsigned char)al->arg[i]]] = 1;
+  for (i = 0, fx->nclass = 1; i<256; i++)
+    if (fx->class[i]) fx->class[i] = fx->nclass++;
+  for (i = 0; i<256; i++) fx->class[i] = fx->class[fx->fold[i]];
+
+  // Build the trie. State 0 is the root, so no trie edge ever points at 0
+  // and 0 can mean "no edge yet".
+  fx->next = xzalloc(sizeof(unsigned)*(total+1)*fx->nclass);
+  fx->outlen = xmalloc(sizeof(int)*(total+1));
+  fx->outlen[0] = -1;
+  fx->nstates = 1;
+  for (al = list; al; al = al->next) {
+    for (s = i = 0; al->arg[i]; i++) {
+      c = fx->class[(unsigned char)al->arg[i]];
+      if (!(t = fx->next[s*fx->nclass+c])) {
+        t = fx->next[s*fx->nclass+c] = fx->nstates++;
+        fx->outlen[t] = -1;
+      }
+      s = t;
+    }
+    if (i>fx->outlen[s]) fx->outlen[s] = i;
+  }
 
-    start = line;
+  // Breadth first, point each state's missing edges where its failure link
+  // goes, and inherit the failure state's output.
+  fail = xzalloc(sizeof(unsigned)*fx->nstates);
+  queue = xmalloc(sizeof(unsigned)*fx->nstates);
+  for (head = tail = 0, s = 0;; s = queue[head++]) {
+    for (c = 0; c<fx->nclass; c++) {
+      if ((t = fx->next[s*fx->nclass+c])) {
+        fail[t] = s ? fx->next[fail[s]*fx->nclass+c] : 0;
+        if (fx->outlen[fail[t]]>fx->outlen[t])
+          fx->outlen[t] = fx->outlen[fail[t]];
+        queue[tail++] = t;
+      } else if (s) fx->next[s*fx->nclass+c] = fx->next[fail[s]*fx->nclass+c];
+    }
+    if (head == tail) break;
+  }
+  free(fail);
+  free(queue);
 
-    // Loop through matches in this line
-    do {
-      int rc = 0, skip = 0;
-
-      // Handle non-regex matches
-      if (toys.optflags & FLAG_F) {
-        struct arg_list *seek, fseek;
-        char *s = 0;
-
-        for (seek = TT.e; seek; seek = seek->next) {
-          if (toys.optflags & FLAG_x) {
-            int i = (toys.optflags & FLAG_i);
-
-            if ((i ? strcasecmp : strcmp)(seek->arg, line)) s = line;
-          } else if (!*seek->arg) {
-            seek = &fseek;
-            fseek.arg = s = line;
-            break;
-          }
-          if (toys.optflags & FLAG_i) {
-            long ll = strlen(seek->arg);;
-
-            // Alas, posix hasn't got strcasestr()
-            for (s = line; *s; s++) if (!strncasecmp(s, seek->arg, ll)) break;
-            if (!*s) s = 0;
-          } else s = strstr(line, seek->arg);
-          if (s) break;
-        }
+  return fx;
+}
 
-        if (s) {
-          matches.rm_so = (s-line);
-          skip = matches.rm_eo = (s-line)+strlen(seek->arg);
-        } else rc = 1;
-      } else {
-        rc = regexec((regex_t *)toybuf, start, 1, &matches,
-                     start==line ? 0 : REG_NOTBOL);
-        skip = matches.rm_eo;
+// Find the leftmost(-longest) match in len bytes at s, setting *so and *eo.
+static int fixed_find(struct fixed *fx, char *s, long len, long *so, long *eo)
+{
+  unsigned char *str = (void *)s, *fold = fx->fold;
+  long i, j, start = -1, end = 0;
+  unsigned state = 0;
+  int l;
+
+  if (fx->count == 1) {
+    for (i = 0; i+fx->len<=len; i += fx->skip[str[i+fx->len-1]]) {
+      for (j = fx->len; j && fold[str[i+j-1]] == (unsigned char)fx->pat[j-1];)
+        j--;
+      if (!j) {
+        *so = i;
+        *eo = i+fx->len;
+
+        return 1;
       }
+    }
+
+    return 0;
+  }
 
-      if (toys.optflags & FLAG_x)
-        if (matches.rm_so || line[matches.rm_eo]) rc = 1;
+  // An empty pattern matches right away, but keep going for a longer one.
+  if (!fx->outlen[0]) start = 0;
+  for (i = 0; i<len; i++) {
+    state = fx->next[state*fx->nclass+fx->class[str[i]]];
+    if ((l = fx->outlen[state])>=0 && (start<0 || i+1-l<=start)) {
+      start = i+1-l;
+      end = i+1;
+    }
 
-      if (!rc && (toys.optflags & FLAG_w)) {
-        char c = 0;
+    // Nothing that ends later can start further left than this.
+    if (start>=0 && i+1-start>=fx->maxlen) break;
+  }
+  if (start<0) return 0;
+  *so = start;
+  *eo = end;
 
-        if ((start+matches.rm_so)!=line) {
-          c = start[matches.rm_so-1];
-          if (!isalnum(c) && c != '_') c = 0;
-        }
-        if (!c) {
-          c = start[matches.rm_eo];
-          if (!isalnum(c) && c != '_') c = 0;
+  return 1;
+}
+
+// Find the longest run of literal bytes every match of this regex contains,
+// for do_grep() to search for before bothering regexec(). Only top level
+// runs count: anything inside a group might be optional, a quantifier makes
+// the byte before it optional, and alternation means there's no one string.
+// Non-ASCII bytes end runs since a quantifier applies to the whole character.
+// Sets *all when the regex is nothing but that literal.
+static char *regex_literal(char *re, int *all)
+{
+  int ere = toys.optflags & FLAG_E, depth = 0, other = 0;
+  char *run = xmalloc(strlen(re)+1), *best = 0;
+  long rlen = 0, blen = 0;
+
+  for (;;) {
+    int c = (unsigned char)*re++, lit = 0, quant = 0;
+
+    if (c == '\\') {
+      if (!(c = (unsigned char)*re++)) goto none;
+      if (!ere && (c == '(' || c == ')')) quant = -1;
+      else if (!ere && c == '|') quant = 2;
+      else if (!ere && (c == '+' || c == '?')) quant = 1;
+      else if (!ere && c == '{') {
+        if (!(re = strstr(re, "\\}"))) goto none;
+        re += 2;
+        quant = 1;
+      } else if (!isalnum(c) && !strchr("<>`'", c) && c<128) lit = 1;
+    } else if (c == '[') {
+      if (*re == '^') re++;
+      if (*re == ']') re++;
+      while (*re && *re != ']') {
+        if (*re == '[' && re[1] && strchr(":=.", re[1])) {
+          char *end = strchr(re+2, re[1]);
+
+          while (end && end[1] != ']') end = strchr(end+1, re[1]);
+          if (!end) goto none;
+          re = end+1;
         }
-        if (c) {
-          start += matches.rm_so+1;
+        re++;
+      }
+      if (*re) re++;
+    } else if (c == '*') quant = 1;
+    else if (ere && (c == '+' || c == '?')) quant = 1;
+    else if (ere && c == '{') {
+      if (!(re = strchr(re, '}'))) goto none;
+      re++;
+      quant = 1;
+    } else if (ere && (c == '(' || c == ')')) quant = -1;
+    else if (ere && c == '|') quant = 2;
+    else if (c && !strchr(".^$", c) && c<128) lit = 1;
+
+    if (!c) depth = 0;
+    if (quant == -1) {
+      if (c == '(') depth++;
+      else if (depth) depth--;
+      else quant = 0;
+    }
+    if (depth) continue;
+    if (quant == 2) goto none;
+    if (lit) {
+      run[rlen++] = c;
+      continue;
+    }
+    if (c) other++;
+    if (quant == 1 && rlen) rlen--;
+    if (rlen>blen) {
+      free(best);
+      best = xstrndup(run, blen = rlen);
+    }
+    rlen = 0;
+    if (!c) break;
+  }
+  free(run);
+  *all = !other;
+
+  return best;
+
+none:
+  free(run);
+  free(best);
 
+  return 0;
+}
+
+// Output goes to TT.out: stdout, or for a file being searched by a worker
+// thread that file's own buffer until it's the next to go out.
+static void grep_printf(char *fmt, ...)
+{
+  va_list va;
+
+  va_start(va, fmt);
+  vfprintf(TT.out, fmt, va);
+  va_end(va);
+  if (!TT.job) xflushtty();
+}
+
+// Show matches in one line, which starts offset bytes into the file and is
+// null terminated at llen. Returns whether it matched, or -1 when that's
+// all this file needs (-l, -q, or a binary file).
+static int grep_line(char *name, char *line, long llen, long offset,
+  int lcount, char outdelim)
+{
+  char *start = line;
+  regmatch_t matches;
+  int mmatch = 0;
+
+  // Loop through matches in this line
+  do {
+    int rc = 0, skip = 0;
+
+    // Handle non-regex matches
+    if (toys.optflags & FLAG_F) {
+      long so, eo;
+
+      if (fixed_find(TT.fixed, start, llen-(start-line), &so, &eo)) {
+        matches.rm_so = so;
+        skip = matches.rm_eo = eo;
+      } else rc = 1;
+    } else {
+      rc = regexec((regex_t *)toybuf, start, 1, &matches,
+                   start==line ? 0 : REG_NOTBOL);
+      skip = matches.rm_eo;
+    }
+
+    if (toys.optflags & FLAG_x)
+      if (matches.rm_so || line[matches.rm_eo]) rc = 1;
+
+    if (!rc && (toys.optflags & FLAG_w)) {
+      char c = 0;
+
+      if ((start+matches.rm_so)!=line) {
+        c = start[matches.rm_so-1];
+        if (!isalnum(c) && c != '_') c = 0;
+      }
+      if (!c) {
+        c = start[matches.rm_eo];
+        if (!isalnum(c) && c != '_') c = 0;
+      }
+      if (c) {
+        start += matches.rm_so+1;
+
+        continue;
+      }
+    }
+
+    if (toys.optflags & FLAG_v) {
+      if (toys.optflags & FLAG_o) {
+        if (rc) skip = matches.rm_eo = strlen(start);
+        else if (!matches.rm_so) {
+          start += skip;
           continue;
-        }
+        } else matches.rm_eo = matches.rm_so;
+      } else {
+        if (!rc) break;
+        matches.rm_eo = strlen(start);
       }
+      matches.rm_so = 0;
+    } else if (rc) break;
 
-      if (toys.optflags & FLAG_v) {
-        if (toys.optflags & FLAG_o) {
-          if (rc) skip = matches.rm_eo = strlen(start);
-          else if (!matches.rm_so) {
-            start += skip;
-            continue;
-          } else matches.rm_eo = matches.rm_so;
-        } else {
-          if (!rc) break;
-          matches.rm_eo = strlen(start);
-        }
-        matches.rm_so = 0;
-      } else if (rc) break;
-
-      mmatch++;
-      toys.exitval = 0;
-      if (toys.optflags & FLAG_q) xexit();
-      if (toys.optflags & FLAG_l) {
-        printf("%s%c", name, outdelim);
-        free(line);
-        fclose(file);
-        return;
+    mmatch++;
+    toys.exitval = 0;
+    if (toys.optflags & FLAG_q) {
+      // With workers running, they have to be stopped first.
+      if (!TT.stop) xexit();
+      __atomic_store_n(TT.stop, 1, __ATOMIC_RELAXED);
+
+      return -1;
+    }
+    if (toys.optflags & FLAG_l) {
+      grep_printf("%s%c", name, outdelim);
+
+      return -1;
+    }
+    if (TT.binary && !(toys.optflags & FLAG_c)) {
+      grep_printf("Binary file %s matches\n", name);
+
+      return -1;
+    }
+    if (toys.optflags & FLAG_o)
+      if (matches.rm_eo == matches.rm_so)
+        break;
+
+    if (!(toys.optflags & FLAG_c)) {
+      if (toys.optflags & FLAG_H) grep_printf("%s:", name);
+      if (toys.optflags & FLAG_n) grep_printf("%d:", lcount);
+      if (toys.optflags & FLAG_b)
+        grep_printf("%ld:", offset + (start-line) +
+            ((toys.optflags & FLAG_o) ? matches.rm_so : 0));
+      if (!(toys.optflags & FLAG_o)) grep_printf("%s%c", line, outdelim);
+      else {
+        grep_printf("%.*s%c", matches.rm_eo - matches.rm_so,
+                start + matches.rm_so, outdelim);
       }
-      if (toys.optflags & FLAG_o)
-        if (matches.rm_eo == matches.rm_so)
-          break;
+    }
+
+    start += skip;
+    if (!(toys.optflags & FLAG_o)) break;
+  } while (*start);
+
+  return !!mmatch;
+}
+
+// Count delimiters in len bytes at s
+static int count_lines(char *s, long len, char delim)
+{
+  char *end = s+len;
+  int n = 0;
+
+  while ((s = memchr(s, delim, end-s))) {
+    n++;
+    s++;
+  }
+
+  return n;
+}
+
+// Complain about name, or have a worker's file complain once its output's
+// gone out.
+static void grep_fail(char *name)
+{
+  if (TT.job) TT.job->err = errno;
+  else perror_msg("%s", name);
+}
+
+static int grep_block(void);
+
+// Show matches in one file
+//
+// Input is read in big blocks rather than a line at a time. When TT.fixed
+// holds a string every match has to contain (or is the -F matcher itself),
+// the block is searched for that first and only the lines it turns up go
+// through the real matcher. Without -v, lines in between can't match.
+// Only the first block is looked at to see if the file's binary.
+static void do_grep(int fd, char *name)
+{
+  char *buf, *line, *s;
+  long len = 0, lim, pos, next, llen, so, eo, base = 0;
+  int lcount = 0, mcount = 0, eof = 0, rc;
+  char indelim = '\n' * !(toys.optflags&FLAG_z),
+       outdelim = '\n' * !(toys.optflags&FLAG_Z);
+
+  if (!fd) name = "(standard input)";
+
+  if (fd<0) {
+    grep_fail(name);
+    return;
+  }
+
+  // One spare byte to null terminate an unterminated last line. The block
+  // is kept for the next file.
+  if (!TT.buf) TT.buf = xmalloc((TT.size = 1<<17)+1);
+  buf = TT.buf;
+  TT.binary = -1;
+  for (;;) {
+    // Top up the block, growing it when a single line fills all of it
+    if (len == TT.size) buf = TT.buf = xrealloc(buf, (TT.size *= 2)+1);
+    if (0>(rc = read(fd, buf+len, TT.size-len))) {
+      grep_fail(name);
+      break;
+    }
+    if (!rc) eof = 1;
+    len += rc;
+    if (TT.binary<0)
+      TT.binary = !(toys.optflags&(FLAG_a|FLAG_z)) && memchr(buf, 0, len);
+
+    // Only complete lines this pass, the partial one waits for more data
+    if (eof) lim = len;
+    else {
+      for (lim = len; lim && buf[lim-1] != indelim; lim--);
+      if (!lim) continue;
+    }
 
-      if (!(toys.optflags & FLAG_c)) {
-        if (toys.optflags & FLAG_H) printf("%s:", name);
-        if (toys.optflags & FLAG_n) printf("%d:", lcount);
-        if (toys.optflags & FLAG_b)
-          printf("%ld:", offset + (start-line) +
-              ((toys.optflags & FLAG_o) ? matches.rm_so : 0));
-        if (!(toys.optflags & FLAG_o)) xprintf("%s%c", line, outdelim);
-        else {
-          xprintf("%.*s%c", matches.rm_eo - matches.rm_so,
-                  start + matches.rm_so, outdelim);
+    for (pos = 0; pos<lim; pos = next) {
+      line = buf+pos;
+
+      if (TT.fixed && !(toys.optflags & FLAG_v)) {
+        if (!fixed_find(TT.fixed, line, lim-pos, &so, &eo)) {
+          if (toys.optflags & FLAG_n) lcount += count_lines(line, lim-pos, indelim);
+          break;
         }
+        for (s = line+so; s>line && s[-1] != indelim; s--);
+        if (toys.optflags & FLAG_n) lcount += count_lines(line, s-line, indelim);
+        line = s;
       }
 
-      start += skip;
-      if (!(toys.optflags & FLAG_o)) break;
-    } while (*start);
-    offset += len;
+      s = memchr(line, indelim, buf+lim-line);
+      llen = s ? s-line : buf+lim-line;
+      next = line-buf+llen+!!s;
+      line[llen] = 0;
 
-    free(line);
+      rc = grep_line(name, line, llen, base+(line-buf), ++lcount, outdelim);
+      if (rc<0) goto done;
+      if (rc) mcount++;
+      if ((toys.optflags & FLAG_m) && mcount >= TT.m) goto out;
+    }
+    if (eof || grep_block()) break;
 
-    if (mmatch) mcount++;
-    if ((toys.optflags & FLAG_m) && mcount >= TT.m) break;
+    memmove(buf, buf+lim, len -= lim);
+    base += lim;
   }
 
+out:
   if (toys.optflags & FLAG_c) {
-    if (toys.optflags & FLAG_H) printf("%s:", name);
-    xprintf("%d%c", mcount, outdelim);
+    if (toys.optflags & FLAG_H) grep_printf("%s:", name);
+    grep_printf("%d%c", mcount, outdelim);
   }
 
-  // loopfiles will also close the fd, but this frees an (opaque) struct.
-  fclose(file);
+done:
+  TT.binary = 0;
+  // loopfiles_rw() without O_CLOEXEC leaves closing the file to us.
+  if (fd) close(fd);
+}
+
+// Compile TT.regex into toybuf. With -r each worker thread has a copy of
+// its own, so they aren't all waiting on the lock regexec() takes.
+static void grep_regcomp(void)
+{
+  int i = regcomp((regex_t *)toybuf, TT.regex,
+                  ((toys.optflags & FLAG_E) ? REG_EXTENDED : 0) |
+                  ((toys.optflags & FLAG_i) ? REG_ICASE    : 0));
+
+  if (i) {
+    regerror(i, (regex_t *)toybuf, toybuf+sizeof(regex_t),
+             sizeof(toybuf)-sizeof(regex_t));
+    error_exit("bad REGEX: %s", toybuf);
+  }
 }
 
 static void parse_regex(void)
@@ -244,47 +582,285 @@ static void parse_regex(void)
   }
   TT.e = list;
 
-  if (!(toys.optflags & FLAG_F)) {
-    char *regstr;
+  if (toys.optflags & FLAG_F) TT.fixed = fixed_compile(TT.e);
+  else {
     int i;
 
+    // One regex can have a literal to look for first, several can't. When
+    // that's all there is to it, skip regexec() entirely.
+    if (!TT.e->next && (s = regex_literal(TT.e->arg, &i))) {
+      struct arg_list lit = {0, s};
+
+      TT.fixed = fixed_compile(&lit);
+      if (i) {
+        toys.optflags |= FLAG_F;
+
+        return;
+      }
+    }
+
     // Convert strings to one big regex
     for (al = TT.e; al; al = al->next)
       len += strlen(al->arg)+1+!(toys.optflags & FLAG_E);
 
-    regstr = s = xmalloc(len);
+    TT.regex = s = xmalloc(len);
     for (al = TT.e; al; al = al->next) {
       s = stpcpy(s, al->arg);
       if (!(toys.optflags & FLAG_E)) *(s++) = '\\';
       *(s++) = '|';
     }
     *(s-=(1+!(toys.optflags & FLAG_E))) = 0;
+    grep_regcomp();
+  }
+}
+
+#if CFG_TOYBOX_THREADS
+// grep -r in threads: the walk (in this thread) opens each file it finds and
+// queues it, and a pool of workers search one file each at a time, with a
+// toy_context copy apiece for their flags, block and regex. What a file
+// shows is collected in a buffer of its own, and goes out from here in the
+// order the walk found them, except that the file up next streams straight
+// out. With --unordered files go out in whatever order they finish.
+
+// Workers at most, and files each may have waiting
+#define GREP_THREADS 8
+#define GREP_QUEUE 4
+
+struct grep_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t work, ready;
+  struct grep_job *first, **last, *todo, **todo_last;
+  pthread_t tid[GREP_THREADS];
+  struct toy_io io;
+  int threads, queued, stop, quit;
+};
+
+// Between blocks of a worker's file: give up if -q found a match anywhere,
+// and once this file's output is next to go out, send it straight there.
+static int grep_block(void)
+{
+  struct grep_job *job = TT.job;
+
+  if (!job) return 0;
+  if (__atomic_load_n(TT.stop, __ATOMIC_RELAXED)) return 1;
+  if (!job->direct && __atomic_load_n(&job->head, __ATOMIC_ACQUIRE)) {
+    fclose(job->out);
+    fwrite(job->data, 1, job->len, TT.sink);
+    free(job->data);
+    job->data = 0;
+    job->len = 0;
+    job->out = 0;
+    TT.out = TT.sink;
+    job->direct = 1;
+  }
+
+  return 0;
+}
+
+// Search one file in a worker: toy_current is the worker's context.
+static void grep_job(struct grep_job *job)
+{
+  TT.job = job;
+  toys.optflags = job->flags;
+  toys.exitval = 1;
+  if (__atomic_load_n(TT.stop, __ATOMIC_RELAXED)) close(job->fd);
+  else if (!(job->out = open_memstream(&job->data, &job->len))) {
+    job->err = errno;
+    close(job->fd);
+  } else {
+    TT.out = job->out;
+    grep_block();
+    do_grep(job->fd, job->name);
+    if (!job->direct) fclose(job->out);
+    job->out = 0;
+    job->matched = !toys.exitval;
+  }
+  TT.job = 0;
+}
+
+// Runs in a context of its own, see toy_worker_create().
+static void *grep_worker(void *arg)
+{
+  struct grep_pool *pool = arg;
+  struct grep_job *job;
+
+  TT.buf = 0;
+  if (!(toys.optflags & FLAG_F)) grep_regcomp();
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!(job = pool->todo) && !pool->quit)
+      pthread_cond_wait(&pool->work, &pool->lock);
+    if (!job) break;
+    if (!(pool->todo = job->todo)) pool->todo_last = &pool->todo;
+    pthread_mutex_unlock(&pool->lock);
+    grep_job(job);
+    pthread_mutex_lock(&pool->lock);
+    job->done = 1;
+    pthread_cond_broadcast(&pool->ready);
+  }
+
+  // What this thread read counts toward the grep that started it.
+  pool->io.rbytes += toy_io.rbytes;
+  pool->io.reads += toy_io.reads;
+  pthread_mutex_unlock(&pool->lock);
+  if (!(toys.optflags & FLAG_F)) regfree((regex_t *)toybuf);
+  free(TT.buf);
 
-    i = regcomp((regex_t *)toybuf, regstr,
-                ((toys.optflags & FLAG_E) ? REG_EXTENDED : 0) |
-                ((toys.optflags & FLAG_i) ? REG_ICASE    : 0));
+  // Whether each file matched went back in its job.
+  toys.exitval = 0;
 
-    if (i) {
-      regerror(i, (regex_t *)toybuf, toybuf+sizeof(regex_t),
-               sizeof(toybuf)-sizeof(regex_t));
-      error_exit("bad REGEX: %s", toybuf);
+  return 0;
+}
+
+// Send out a finished file, in this thread.
+static void grep_done(struct grep_job *job)
+{
+  if (job->len) fwrite(job->data, 1, job->len, stdout);
+  free(job->data);
+  if (job->matched) toys.exitval = 0;
+  if (job->err) {
+    errno = job->err;
+    perror_msg("%s", job->name);
+  }
+  free(job->name);
+  free(job);
+}
+
+// Send out what's finished, in walk order unless --unordered. With wait,
+// don't return before something's gone out (or there's nothing left).
+static void grep_flush(struct grep_pool *pool, int wait)
+{
+  struct grep_job *job, **jj;
+  int unordered = toys.optflags & FLAG_unordered;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    // Only this thread changes the list, so it can be walked unlocked.
+    for (jj = &pool->first; (job = *jj);) {
+      if (!job->done) {
+        if (!unordered) break;
+        jj = &job->next;
+        continue;
+      }
+      if (!(*jj = job->next)) pool->last = jj;
+      pool->queued--;
+      wait = 0;
+      pthread_mutex_unlock(&pool->lock);
+      grep_done(job);
+      pthread_mutex_lock(&pool->lock);
     }
+    if (!unordered && pool->first)
+      __atomic_store_n(&pool->first->head, 1, __ATOMIC_RELEASE);
+    if (!wait || !pool->first) break;
+    pthread_cond_wait(&pool->ready, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Queue file name, already opened as fd, waiting if too many are.
+static void grep_queue(char *name, int fd)
+{
+  struct grep_pool *pool = TT.pool;
+  struct grep_job *job = xzalloc(sizeof(struct grep_job));
+
+  job->name = xstrdup(name);
+  job->flags = toys.optflags;
+  if ((job->fd = fd)<0) {
+    job->err = errno;
+    job->done = 1;
+  }
+  pthread_mutex_lock(&pool->lock);
+  *pool->last = job;
+  pool->last = &job->next;
+  if (!job->done) {
+    *pool->todo_last = job;
+    pool->todo_last = &job->todo;
+    pthread_cond_signal(&pool->work);
+  }
+  pool->queued++;
+  pthread_mutex_unlock(&pool->lock);
+  grep_flush(pool, pool->queued >= GREP_QUEUE*pool->threads);
+}
+
+// Start up to n workers. Leaves TT.pool NULL when there aren't any.
+static void grep_start(int n)
+{
+  struct grep_pool *pool = TT.pool = xzalloc(sizeof(struct grep_pool));
+  pthread_attr_t attr;
+
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->work, 0);
+  pthread_cond_init(&pool->ready, 0);
+  pool->last = &pool->first;
+  pool->todo_last = &pool->todo;
+  TT.sink = stdout;
+  TT.stop = &pool->stop;
+
+  // regexec() wants more stack than most.
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 256*1024);
+  while (pool->threads<n
+    && !toy_worker_create(pool->tid+pool->threads, &attr, grep_worker, pool))
+      pool->threads++;
+  pthread_attr_destroy(&attr);
+  if (!pool->threads) {
+    free(pool);
+    TT.pool = 0;
+    TT.stop = 0;
   }
 }
 
+// Wait for everything to go out, and the workers to finish.
+static void grep_finish(void)
+{
+  struct grep_pool *pool = TT.pool;
+  int i;
+
+  if (!pool) return;
+  while (pool->first) grep_flush(pool, 1);
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i<pool->threads; i++) pthread_join(pool->tid[i], 0);
+  toy_io.rbytes += pool->io.rbytes;
+  toy_io.reads += pool->io.reads;
+  if (pool->stop) toys.exitval = 0;
+  pthread_cond_destroy(&pool->ready);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+  TT.pool = 0;
+  TT.stop = 0;
+}
+#else
+static int grep_block(void)
+{
+  return 0;
+}
+#endif
+
 static int do_grep_r(struct dirtree *new)
 {
   char *name;
+  int fd;
 
   if (new->parent && !dirtree_notdotdot(new)) return 0;
-  if (S_ISDIR(new->st.st_mode)) return DIRTREE_RECURSE;
+  if (S_ISDIR(new->st.st_mode)) return DIRTREE_RECURSE|DIRTREE_LAZYSTAT;
 
   // "grep -r onefile" doesn't show filenames, but "grep -r onedir" should.
   if (new->parent && !(toys.optflags & FLAG_h)) toys.optflags |= FLAG_H;
 
-  name = dirtree_path(new, 0);
-  do_grep(xopenat(dirtree_parentfd(new), new->name, 0), name);
-  free(name);
+  name = dirtree_curpath(new);
+  fd = xopenat(dirtree_parentfd(new), new->name, 0);
+#if CFG_TOYBOX_THREADS
+  if (TT.pool) {
+    grep_queue(name, fd);
+
+    return __atomic_load_n(TT.stop, __ATOMIC_RELAXED) ? DIRTREE_ABORT : 0;
+  }
+#endif
+  do_grep(fd, name);
 
   return 0;
 }
@@ -313,12 +889,30 @@ void grep_main(void)
     close(2);
     xopen("/dev/null", O_RDWR);
   }
+  TT.out = stdout;
 
   if (toys.optflags & FLAG_r) {
+#if CFG_TOYBOX_THREADS
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n > GREP_THREADS) n = GREP_THREADS;
+    if (n > 1) grep_start(n);
+#endif
+
     // Iterate through -r arguments. Use "." as default if none provided.
     for (ss = *ss ? ss : (char *[]){".", 0}; *ss; ss++) {
-      if (!strcmp(*ss, "-")) do_grep(0, *ss);
-      else dirtree_read(*ss, do_grep_r);
+      if (!strcmp(*ss, "-")) {
+        // Stdin's searched here, once everything before it has gone out.
+#if CFG_TOYBOX_THREADS
+        if (TT.pool) while (TT.pool->first) grep_flush(TT.pool, 1);
+#endif
+        do_grep(0, *ss);
+      } else dirtree_read_parallel(*ss, do_grep_r,
+        !(toys.optflags & FLAG_unordered));
+      if (TT.stop && *TT.stop) break;
     }
+#if CFG_TOYBOX_THREADS
+    grep_finish();
+#endif
   } else loopfiles_rw(ss, O_RDONLY, 0, 1, do_grep);
 }
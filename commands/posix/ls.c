@@ -5,13 +5,13 @@
  *
  * See http://opengroup.org/onlinepubs/9699919799/utilities/ls.html
 
-USE_LS(NEWTOY(ls, USE_LS_COLOR("(color):;")"ZgoACFHLRSacdfhiklmnpqrstux1[-Cxm1][-Cxml][-Cxmo][-Cxmg][-cu][-ftS][-HL]", TOYFLAG_BIN|TOYFLAG_LOCALE))
+USE_LS(NEWTOY(ls, USE_LS_COLOR("(color):;")"ZgoACFHLRSUacdfhiklmnpqrstux1[-Cxm1][-Cxml][-Cxmo][-Cxmg][-cu][-ftSU][-HL]", TOYFLAG_BIN|TOYFLAG_LOCALE))
 
 config LS
   bool "ls"
   default y
   help
-    usage: ls [-ACFHLRSZacdfhiklmnpqrstux1] [directory...]
+    usage: ls [-ACFHLRSUZacdfhiklmnpqrstux1] [directory...]
     list files
 
     what to show:
@@ -32,7 +32,8 @@ config LS
     -x	columns (horizontal sort)
 
     sorting (default is alphabetical):
-    -f	unsorted	-r  reverse	-t  timestamp	-S  size
+    -f	unsorted, all	-r  reverse	-t  timestamp	-S  size
+    -U	unsorted (unsorted -1 and -l print entries as they're read)
 
 config LS_COLOR
   bool "ls --color"
@@ -60,7 +61,7 @@ GLOBALS(
   struct dirtree *files, *singledir;
 
   unsigned screen_width;
-  int nl_title;
+  int nl_title, stream;
   char uid_buf[12], gid_buf[12];
 )
 
@@ -104,18 +105,20 @@ static char endtype(struct stat *st)
 
 static char *getusername(uid_t uid)
 {
-  struct passwd *pw = getpwuid(uid);
+  char *name = uid_name(uid);
 
+  if (name) return name;
   sprintf(TT.uid_buf, "%u", (unsigned)uid);
-  return pw ? pw->pw_name : TT.uid_buf;
+  return TT.uid_buf;
 }
 
 static char *getgroupname(gid_t gid)
 {
-  struct group *gr = getgrgid(gid);
+  char *name = gid_name(gid);
 
+  if (name) return name;
   sprintf(TT.gid_buf, "%u", (unsigned)gid);
-  return gr ? gr->gr_name : TT.gid_buf;
+  return TT.gid_buf;
 }
 
 static int numlen(long long ll)
@@ -155,75 +158,25 @@ static void entrylen(struct dirtree *dt, unsigned *len)
   len[7] = (flags & FLAG_Z) ? strwidth((char *)dt->extra) : 0;
 }
 
+// What qsort() shuffles: the sort key and name copied out of each node, so
+// comparisons don't chase pointers into a few hundred thousand struct stats.
+struct sortent {
+  long long key;
+  char *name;
+  struct dirtree *dt;
+};
+
 static int compare(void *a, void *b)
 {
-  struct dirtree *dta = *(struct dirtree **)a;
-  struct dirtree *dtb = *(struct dirtree **)b;
+  struct sortent *sa = a, *sb = b;
   int ret = 0, reverse = (toys.optflags & FLAG_r) ? -1 : 1;
 
-  if (toys.optflags & FLAG_S) {
-    if (dta->st.st_size > dtb->st.st_size) ret = -1;
-    else if (dta->st.st_size < dtb->st.st_size) ret = 1;
-  }
-  if (toys.optflags & FLAG_t) {
-    if (dta->st.st_mtime > dtb->st.st_mtime) ret = -1;
-    else if (dta->st.st_mtime < dtb->st.st_mtime) ret = 1;
-  }
-  if (!ret) ret = strcmp(dta->name, dtb->name);
+  if (sa->key > sb->key) ret = -1;
+  else if (sa->key < sb->key) ret = 1;
+  if (!ret) ret = strcmp(sa->name, sb->name);
   return ret * reverse;
 }
 
-// callback from dirtree_recurse() determining how to handle this entry.
-
-static int filter(struct dirtree *new)
-{
-  int flags = toys.optflags;
-
-  // Special case to handle enormous dirs without running out of memory.
-  if (flags == (FLAG_1|FLAG_f)) {
-    xprintf("%s\n", new->name);
-    return 0;
-  }
-
-  if (flags & FLAG_Z) {
-    if (!CFG_TOYBOX_LSM_NONE) {
-
-      // (Wouldn't it be nice if the lsm functions worked like openat(),
-      // fchmodat(), mknodat(), readlinkat() so we could do this without
-      // even O_PATH? But no, this is 1990's tech.)
-      int fd = xopenat(dirtree_parentfd(new), new->name,
-        O_PATH|(O_NOFOLLOW*!!(toys.optflags&FLAG_L)));
-
-      if (fd != -1) {
-        if (-1 == lsm_fget_context(fd, (char **)&new->extra) && errno == EBADF)
-        {
-          char hack[32];
-
-          // Work around kernel bug that won't let us read this "metadata" from
-          // the filehandle unless we have permission to read the data. (We can
-          // query the same data in by path, but can't do it through an O_PATH
-          // filehandle, because reasons. But for some reason, THIS is ok? If
-          // they ever fix the kernel, this should stop triggering.)
-
-          sprintf(hack, "/proc/self/fd/%d", fd);
-          lsm_lget_context(hack, (char **)&new->extra);
-        }
-        close(fd);
-      }
-    }
-    if (CFG_TOYBOX_LSM_NONE || !new->extra) new->extra = (long)xstrdup("?");
-  }
-
-  if (flags & FLAG_u) new->st.st_mtime = new->st.st_atime;
-  if (flags & FLAG_c) new->st.st_mtime = new->st.st_ctime;
-  if (flags & FLAG_k) new->st.st_blocks = (new->st.st_blocks + 1) / 2;
-
-  if (flags & (FLAG_a|FLAG_f)) return DIRTREE_SAVE;
-  if (!(flags & FLAG_A) && new->name[0]=='.') return 0;
-
-  return dirtree_notdotdot(new) & DIRTREE_SAVE;
-}
-
 // For column view, calculate horizontal position (for padding) and return
 // index of next entry to display.
 
@@ -280,12 +233,159 @@ int color_from_mode(mode_t mode)
   return color;
 }
 
+// Print one entry (not counting the padding and separators around it), with
+// fields padded to the widths in totals.
+
+static void print_entry(int dirfd, struct dirtree *dt, unsigned *totals)
+{
+  struct stat *st = &(dt->st);
+  mode_t mode = st->st_mode;
+  unsigned flags = toys.optflags, color = 0;
+  char tmp[64], et = endtype(st);
+
+  if (flags & FLAG_i)
+    xprintf("%*lu ", totals[1], (unsigned long)st->st_ino);
+  if (flags & FLAG_s)
+    xprintf("%*lu ", totals[6], (unsigned long)st->st_blocks);
+
+  if (flags & (FLAG_l|FLAG_o|FLAG_n|FLAG_g)) {
+    struct tm *tm;
+    char *ss;
+
+    // (long) is to coerce the st types into something we know we can print.
+    mode_to_string(mode, tmp);
+    printf("%s% *ld", tmp, totals[2]+1, (long)st->st_nlink);
+
+    // print user
+    if (!(flags&FLAG_g)) {
+      if (flags&FLAG_n) sprintf(ss = tmp, "%u", (unsigned)st->st_uid);
+      else strwidth(ss = getusername(st->st_uid));
+      printf(" %-*s", (int)totals[3], ss);
+    }
+
+    // print group
+    if (!(flags&FLAG_o)) {
+      if (flags&FLAG_n) sprintf(ss = tmp, "%u", (unsigned)st->st_gid);
+      else strwidth(ss = getgroupname(st->st_gid));
+      printf(" %-*s", (int)totals[4], ss);
+    }
+
+    if (flags & FLAG_Z)
+      printf(" %-*s", -(int)totals[7], (char *)dt->extra);
+
+    // print major/minor, or size
+    if (S_ISCHR(st->st_mode) || S_ISBLK(st->st_mode))
+      printf("% *d,% 4d", totals[5]-4, major(st->st_rdev),minor(st->st_rdev));
+    else if (flags&FLAG_h) {
+      human_readable(tmp, st->st_size, 0);
+      xprintf("%*s", totals[5]+1, tmp);
+    } else printf("% *lld", totals[5]+1, (long long)st->st_size);
+
+    // print time, always in --time-style=long-iso
+    tm = localtime(&(st->st_mtime));
+    strftime(tmp, sizeof(tmp), "%F %H:%M", tm);
+    xprintf(" %s ", tmp);
+  } else if (flags & FLAG_Z)
+    printf("%-*s ", (int)totals[7], (char *)dt->extra);
+
+  if (flags & FLAG_color) {
+    color = color_from_mode(st->st_mode);
+    if (color) printf("\033[%d;%dm", color>>8, color&255);
+  }
+
+  if (flags & FLAG_q) {
+    char *p;
+    for (p=dt->name; *p; p++) fputc(isprint(*p) ? *p : '?', stdout);
+  } else xprintf("%s", dt->name);
+  if (color) xprintf("\033[0m");
+
+  if ((flags & (FLAG_l|FLAG_o|FLAG_n|FLAG_g)) && S_ISLNK(mode)) {
+    printf(" -> ");
+    if (flags & FLAG_color) {
+      struct stat st2;
+
+      if (xfstatat(dirfd, dt->symlink, &st2, 0)) color = 256+31;
+      else color = color_from_mode(st2.st_mode);
+
+      if (color) printf("\033[%d;%dm", color>>8, color&255);
+    }
+
+    printf("%s", dt->symlink);
+    if (color) printf("\033[0m");
+  }
+
+  if (et) xputc(et);
+}
+
+// callback from dirtree_recurse() determining how to handle this entry.
+
+static int filter(struct dirtree *new)
+{
+  int flags = toys.optflags;
+
+  if (flags & FLAG_Z) {
+    if (!CFG_TOYBOX_LSM_NONE) {
+
+      // (Wouldn't it be nice if the lsm functions worked like openat(),
+      // fchmodat(), mknodat(), readlinkat() so we could do this without
+      // even O_PATH? But no, this is 1990's tech.)
+      int fd = xopenat(dirtree_parentfd(new), new->name,
+        O_PATH|(O_NOFOLLOW*!!(toys.optflags&FLAG_L)));
+
+      if (fd != -1) {
+        if (-1 == lsm_fget_context(fd, (char **)&new->extra) && errno == EBADF)
+        {
+          char hack[32];
+
+          // Work around kernel bug that won't let us read this "metadata" from
+          // the filehandle unless we have permission to read the data. (We can
+          // query the same data in by path, but can't do it through an O_PATH
+          // filehandle, because reasons. But for some reason, THIS is ok? If
+          // they ever fix the kernel, this should stop triggering.)
+
+          sprintf(hack, "/proc/self/fd/%d", fd);
+          lsm_lget_context(hack, (char **)&new->extra);
+        }
+        close(fd);
+      }
+    }
+    if (CFG_TOYBOX_LSM_NONE || !new->extra) new->extra = (long)xstrdup("?");
+  }
+
+  if (flags & FLAG_u) new->st.st_mtime = new->st.st_atime;
+  if (flags & FLAG_c) new->st.st_mtime = new->st.st_ctime;
+  if (flags & FLAG_k) new->st.st_blocks = (new->st.st_blocks + 1) / 2;
+
+  if (!(flags & (FLAG_a|FLAG_f))
+      && ((!(flags & FLAG_A) && new->name[0]=='.') || !dirtree_notdotdot(new)))
+    return 0;
+
+  // Unsorted one-per-line output needn't wait for the rest of the directory,
+  // which could be enormous. Fields get fixed widths since we can't measure
+  // what's coming, and only directories -R will visit are kept.
+  if (TT.stream && new->parent != TT.files) {
+    unsigned totals[] = {0, 7, 2, 8, 8, 8, 5, 0};
+
+    print_entry(dirtree_parentfd(new), new, totals);
+    xputc('\n');
+    TT.nl_title = 1;
+    if ((flags & FLAG_R) && S_ISDIR(new->st.st_mode) && dirtree_notdotdot(new))
+      return DIRTREE_SAVE;
+    free((void *)new->extra);
+
+    return 0;
+  }
+
+  return DIRTREE_SAVE;
+}
+
 // Display a list of dirtree entries, according to current format
 // Output types -1, -l, -C, or stream
 
 static void listfiles(int dirfd, struct dirtree *indir)
 {
-  struct dirtree *dt, **sort;
+  struct dirtree *dt;
+  struct sortent *sort;
   unsigned long dtlen, ul = 0;
   unsigned width, flags = toys.optflags, totals[8], len[8], totpad = 0,
     *colsizes = (unsigned *)(toybuf+260), columns = (sizeof(toybuf)-260)/4;
@@ -314,43 +414,49 @@ static void listfiles(int dirfd, struct dirtree *indir)
 
     // Do preprocessing (Dirtree didn't populate, so callback wasn't called.)
     for (;dt; dt = dt->next) filter(dt);
-    if (flags == (FLAG_1|FLAG_f)) return;
   } else {
+    // Label directory if not top of tree, or if -R. This comes first because
+    // in stream mode filter() prints entries as dirtree_recurse() reads them.
+    if (TT.singledir!=indir || (flags&FLAG_R)) {
+      char *path = dirtree_path(indir, 0);
+
+      if (TT.nl_title++) xputc('\n');
+      xprintf("%s:\n", path);
+      free(path);
+    }
+
     // Read directory contents. We dup() the fd because this will close it.
-    // This reads/saves contents to display later, except for in "ls -1f" mode.
+    // This reads/saves contents to display later, except in stream mode.
     indir->data = dup(dirfd);
     dirtree_recurse(indir, filter, DIRTREE_SYMFOLLOW*!!(flags&FLAG_L));
   }
 
   // Copy linked list to array and sort it. Directories go in array because
   // we visit them in sorted order too. (The nested loops let us measure and
-  // fill with the same inner loop.)
-  for (sort = 0;;sort = xmalloc(dtlen*sizeof(void *))) {
-    for (dtlen = 0, dt = indir->child; dt; dt = dt->next, dtlen++)
-      if (sort) sort[dtlen] = dt;
+  // fill with the same inner loop.) Sorting moves (key, name, node) records
+  // around instead of chasing each node's stat for every comparison.
+  for (sort = 0;;sort = xmalloc(dtlen*sizeof(*sort))) {
+    for (dtlen = 0, dt = indir->child; dt; dt = dt->next, dtlen++) {
+      if (!sort) continue;
+      sort[dtlen].dt = dt;
+      sort[dtlen].name = dt->name;
+      if (flags & FLAG_S) sort[dtlen].key = dt->st.st_size;
+      else if (flags & FLAG_t) sort[dtlen].key = dt->st.st_mtime;
+      else sort[dtlen].key = 0;
+    }
     if (sort || !dtlen) break;
   }
 
-  // Label directory if not top of tree, or if -R
-  if (indir->parent && (TT.singledir!=indir || (flags&FLAG_R)))
-  {
-    char *path = dirtree_path(indir, 0);
-
-    if (TT.nl_title++) xputc('\n');
-    xprintf("%s:\n", path);
-    free(path);
-  }
-
   // Measure each entry to work out whitespace padding and total blocks
-  if (!(flags & FLAG_f)) {
+  if (!(flags & (FLAG_f|FLAG_U))) {
     unsigned long long blocks = 0;
 
-    qsort(sort, dtlen, sizeof(void *), (void *)compare);
+    qsort(sort, dtlen, sizeof(*sort), (void *)compare);
     for (ul = 0; ul<dtlen; ul++) {
-      entrylen(sort[ul], len);
+      entrylen(sort[ul].dt, len);
       for (width = 0; width<8; width++)
         if (len[width]>totals[width]) totals[width] = len[width];
-      blocks += sort[ul]->st.st_blocks;
+      blocks += sort[ul].dt->st.st_blocks;
     }
     totpad = totals[1]+!!totals[1]+totals[6]+!!totals[6]+totals[7]+!!totals[7];
     if ((flags&(FLAG_h|FLAG_l|FLAG_o|FLAG_n|FLAG_g|FLAG_s)) && indir->parent) {
@@ -375,7 +481,7 @@ static void listfiles(int dirfd, struct dirtree *indir)
 
       memset(colsizes, 0, columns*sizeof(unsigned));
       for (ul=0; ul<dtlen; ul++) {
-        entrylen(sort[next_column(ul, dtlen, columns, &c)], len);
+        entrylen(sort[next_column(ul, dtlen, columns, &c)].dt, len);
         *len += totpad;
         if (c == columns) break;
         // Expand this column if necessary, break if that puts us over budget
@@ -393,19 +499,17 @@ static void listfiles(int dirfd, struct dirtree *indir)
   // Loop through again to produce output.
   memset(toybuf, ' ', 256);
   width = 0;
-  for (ul = 0; ul<dtlen; ul++) {
-    unsigned curcol, color = 0;
+  if (!TT.stream || !indir->parent) for (ul = 0; ul<dtlen; ul++) {
+    unsigned curcol;
     unsigned long next = next_column(ul, dtlen, columns, &curcol);
-    struct stat *st = &(sort[next]->st);
-    mode_t mode = st->st_mode;
-    char et = endtype(st);
 
     // Skip directories at the top of the tree when -d isn't set
-    if (S_ISDIR(mode) && !indir->parent && !(flags & FLAG_d)) continue;
+    if (S_ISDIR(sort[next].dt->st.st_mode) && !indir->parent
+        && !(flags & FLAG_d)) continue;
     TT.nl_title=1;
 
     // Handle padding and wrapping for display purposes
-    entrylen(sort[next], len);
+    entrylen(sort[next].dt, len);
     if (ul) {
       if (flags & FLAG_m) xputc(',');
       if (flags & (FLAG_C|FLAG_x)) {
@@ -420,78 +524,7 @@ static void listfiles(int dirfd, struct dirtree *indir)
     }
     width += *len;
 
-    if (flags & FLAG_i)
-      xprintf("%*lu ", totals[1], (unsigned long)st->st_ino);
-    if (flags & FLAG_s)
-      xprintf("%*lu ", totals[6], (unsigned long)st->st_blocks);
-
-    if (flags & (FLAG_l|FLAG_o|FLAG_n|FLAG_g)) {
-      struct tm *tm;
-      char *ss;
-
-      // (long) is to coerce the st types into something we know we can print.
-      mode_to_string(mode, tmp);
-      printf("%s% *ld", tmp, totals[2]+1, (long)st->st_nlink);
-
-      // print user
-      if (!(flags&FLAG_g)) {
-        if (flags&FLAG_n) sprintf(ss = tmp, "%u", (unsigned)st->st_uid);
-        else strwidth(ss = getusername(st->st_uid));
-        printf(" %-*s", (int)totals[3], ss);
-      }
-
-      // print group
-      if (!(flags&FLAG_o)) {
-        if (flags&FLAG_n) sprintf(ss = tmp, "%u", (unsigned)st->st_gid);
-        else strwidth(ss = getgroupname(st->st_gid));
-        printf(" %-*s", (int)totals[4], ss);
-      }
-
-      if (flags & FLAG_Z)
-        printf(" %-*s", -(int)totals[7], (char *)sort[next]->extra);
-
-      // print major/minor, or size
-      if (S_ISCHR(st->st_mode) || S_ISBLK(st->st_mode))
-        printf("% *d,% 4d", totals[5]-4, major(st->st_rdev),minor(st->st_rdev));
-      else if (flags&FLAG_h) {
-        human_readable(tmp, st->st_size, 0);
-        xprintf("%*s", totals[5]+1, tmp);
-      } else printf("% *lld", totals[5]+1, (long long)st->st_size);
-
-      // print time, always in --time-style=long-iso
-      tm = localtime(&(st->st_mtime));
-      strftime(tmp, sizeof(tmp), "%F %H:%M", tm);
-      xprintf(" %s ", tmp);
-    } else if (flags & FLAG_Z)
-      printf("%-*s ", (int)totals[7], (char *)sort[next]->extra);
-
-    if (flags & FLAG_color) {
-      color = color_from_mode(st->st_mode);
-      if (color) printf("\033[%d;%dm", color>>8, color&255);
-    }
-
-    if (flags & FLAG_q) {
-      char *p;
-      for (p=sort[next]->name; *p; p++) fputc(isprint(*p) ? *p : '?', stdout);
-    } else xprintf("%s", sort[next]->name);
-    if (color) xprintf("\033[0m");
-
-    if ((flags & (FLAG_l|FLAG_o|FLAG_n|FLAG_g)) && S_ISLNK(mode)) {
-      printf(" -> ");
-      if (flags & FLAG_color) {
-        struct stat st2;
-
-        if (xfstatat(dirfd, sort[next]->symlink, &st2, 0)) color = 256+31;
-        else color = color_from_mode(st2.st_mode);
-
-        if (color) printf("\033[%d;%dm", color>>8, color&255);
-      }
-
-      printf("%s", sort[next]->symlink);
-      if (color) printf("\033[0m");
-    }
-
-    if (et) xputc(et);
+    print_entry(dirfd, sort[next].dt, totals);
 
     // Pad columns
     if (flags & (FLAG_C|FLAG_x)) {
@@ -504,13 +537,14 @@ static void listfiles(int dirfd, struct dirtree *indir)
 
   // Free directory entries, recursing first if necessary.
 
-  for (ul = 0; ul<dtlen; free(sort[ul++])) {
-    if ((flags & FLAG_d) || !S_ISDIR(sort[ul]->st.st_mode)) continue;
+  for (ul = 0; ul<dtlen; free(sort[ul++].dt)) {
+    dt = sort[ul].dt;
+    if ((flags & FLAG_d) || !S_ISDIR(dt->st.st_mode)) continue;
 
     // Recurse into dirs if at top of the tree or given -R
-    if (!indir->parent || ((flags&FLAG_R) && dirtree_notdotdot(sort[ul])))
-      listfiles(xopenat(dirfd, sort[ul]->name, 0), sort[ul]);
-    free((void *)sort[ul]->extra);
+    if (!indir->parent || ((flags&FLAG_R) && dirtree_notdotdot(dt)))
+      listfiles(xopenat(dirfd, dt->name, 0), dt);
+    free((void *)dt->extra);
   }
   free(sort);
   if (dirfd != AT_FDCWD) close(dirfd);
@@ -536,6 +570,8 @@ void ls_main(void)
   // but currently it has "switch off when this is set", so "-dR" and "-Rd"
   // behave differently
   if (toys.optflags & FLAG_d) toys.optflags &= ~FLAG_R;
+  TT.stream = (toys.optflags&(FLAG_f|FLAG_U))
+    && !(toys.optflags&(FLAG_C|FLAG_x|FLAG_m));
 
   // Iterate through command line arguments, collecting directories and files.
   // Non-absolute paths are relative to current directory.
@@ -39,19 +39,39 @@ GLOBALS(
 
   // Count of consecutive blank lines for -l has to persist between files
   long lcount;
+  struct ascii_count count;
+  char clip;
 )
 
+static void nl_pad(char c, long n)
+{
+  for (; n>0; n--) putchar(c);
+}
+
+// Print the next line number padded to -w (the way printf would), then -s.
+static void nl_number(void)
+{
+  long pad = TT.w-TT.count.len;
+
+  if (TT.clip != '-') nl_pad(TT.clip ? TT.clip : ' ', pad);
+  fwrite(ascii_count_str(&TT.count), 1, TT.count.len, stdout);
+  if (TT.clip == '-') nl_pad(' ', pad);
+  fputs(TT.s, stdout);
+  ascii_count_next(&TT.count);
+}
+
 static void do_nl(int fd, char *name)
 {
   FILE *f = xfdopen(fd, "r");
-  int w = TT.w, slen = strlen(TT.s);
+  int slen = strlen(TT.s);
 
   for (;;) {
     char *line = 0;
     size_t temp;
+    long len;
     int match = *TT.b != 'n';
 
-    if (xgetline(&line, &temp, f) < 1) {
+    if ((len = xgetline(&line, &temp, f)) < 1) {
       if (ferror(f)) perror_msg("%s", name);
       break;
     }
@@ -61,9 +81,9 @@ static void do_nl(int fd, char *name)
       if (*line == '\n') match = TT.l && ++TT.lcount >= TT.l;
     if (match) {
       TT.lcount = 0;
-      printf(toybuf, w, TT.v++, TT.s);
-    } else printf("%*c", (int)w+slen, ' ');
-    xprintf("%s", line);
+      nl_number();
+    } else nl_pad(' ', TT.w+slen);
+    fwrite(line, 1, len, stdout);
 
     free(line);
   }
@@ -73,16 +93,14 @@ static void do_nl(int fd, char *name)
 
 void nl_main(void)
 {
-  char *clip = "";
-
   if (!TT.s) TT.s = "\t";
 
   if (!TT.n || !strcmp(TT.n, "rn")); // default
-  else if (!strcmp(TT.n, "ln")) clip = "-";
-  else if (!strcmp(TT.n, "rz")) clip = "0";
+  else if (!strcmp(TT.n, "ln")) TT.clip = '-';
+  else if (!strcmp(TT.n, "rz")) TT.clip = '0';
   else error_exit("bad -n '%s'", TT.n);
 
-  sprintf(toybuf, "%%%s%s", clip, "*ld%s");
+  ascii_count_init(&TT.count, TT.v, 1);
 
   if (!TT.b) TT.b = "t";
   if (*TT.b == 'p' && TT.b[1])
@@ -53,7 +53,7 @@ static int od_out_t(struct odtype *t, char *buf, int *offset)
 
   // Handle ascii
   if (t->type < 2) {
-    char c = TT.buf[(*offset)++];
+    unsigned char c = TT.buf[(*offset)++];
     pad += 4;
 
     if (!t->type) {
@@ -78,16 +78,23 @@ static int od_out_t(struct odtype *t, char *buf, int *offset)
     *offset += t->size;
     if (sizeof(float) == t->size) {
       ld = fdl.f;
-      pad += (throw = 8)+7;
+      pad += (throw = 8)+8;
     } else if (sizeof(double) == t->size) {
       ld = fdl.d;
-      pad += (throw = 17)+8;
+      pad += (throw = 17)+9;
     } else if (sizeof(long double) == t->size) {
       ld = fdl.ld;
-      pad += (throw = 21)+9;
+      pad += (throw = 21)+10;
     } else error_exit("bad -tf '%d'", t->size);
 
     sprintf(buf, "%.*Le", throw, ld);
+  // Hex is digit pairs in big endian order, straight from a table.
+  } else if (t->type == 5) {
+    for (k=0; k < (unsigned)t->size; k++)
+      hex_encode(buf+2*k, TT.buf+*offset+(IS_BIG_ENDIAN ? k : t->size-k-1), 1);
+    buf[2*k] = 0;
+    *offset += t->size;
+    pad += 2*t->size+1;
   // Integer types
   } else {
     unsigned long long ll = 0, or;
@@ -103,7 +110,7 @@ static int od_out_t(struct odtype *t, char *buf, int *offset)
 
     // Accumulate integer based on size argument
     for (k=0; k < (unsigned)t->size; k++) {
-      or = TT.buf[(*offset)++];
+      or = (unsigned char)TT.buf[(*offset)++];
       ll |= or << (8*(IS_BIG_ENDIAN ? t->size-k-1 : k));
     }
 
@@ -125,9 +132,10 @@ static int od_out_t(struct odtype *t, char *buf, int *offset)
 static void od_outline(void)
 {
   unsigned flags = toys.optflags;
-  char buf[128], *abases[] = {"", "%07lld", "%07llo", "%06llx"};
+  char buf[128], line[16*128+16], *o, *abases[] = {"", "%07lld", "%07llo",
+    "%06llx"};
   struct odtype *types = (struct odtype *)toybuf;
-  int i, j, len, pad;
+  int i, j, k, len, pad;
 
   if (TT.leftover<16) memset(TT.buf+TT.leftover, 0, 16-TT.leftover);
 
@@ -156,29 +164,35 @@ static void od_outline(void)
   TT.leftover = 0;
   if (TT.star) return;
 
-  // Find largest "pad" of the output types.
+  // Find the widest line (per 16 bytes) of the output types, so each can
+  // be spread out to the same width.
   for (i = pad = 0; i<(int)TT.types; i++) {
     int bytes = 0;
 
-    // If more than one byte of input consumed, average rounding up.
     j = od_out_t(types+i, buf, &bytes);
-    j = (j+bytes-1)/bytes;
-   
+    j = (16*j+bytes-1)/bytes;
+
     if (j > pad) pad = j;
   }
 
-  // For each output type, print one line
+  // For each output type, assemble one line and print it
 
   for (i=0; i<(int)TT.types; i++) {
-    for (j = 0; j<len;) {
+    for (o = line, j = 0; j<len;) {
       int bytes = j;
 
       // pad for as many bytes as were consumed, and indent non-numbered lines
       od_out_t(types+i, buf, &bytes);
-      xprintf("%*s", pad*(bytes-j) + 7*(!!i)*!j, buf);
+      k = pad*bytes/16 - pad*j/16 + 7*(!!i)*!j - strlen(buf);
+      if (k > 0) {
+        memset(o, ' ', k);
+        o += k;
+      }
+      o = stpcpy(o, buf);
       j = bytes;
     }
-    xputc('\n');
+    strcpy(o, "\n");
+    xprintf("%s", line);
   }
 
   // buffer toggle for "same as last time" check.
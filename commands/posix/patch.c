@@ -53,9 +53,70 @@ GLOBALS(
   long oldline, oldlen, newline, newlen;
   long linenum;
   int context, state, filein, fileout, filepatch, hunknum;
-  char *tempname;
+  char *tempname, *obuf;
+  long olen;
+  struct linebuf lb;
 )
 
+// Lines of the patch and of the file being patched are kept with a hash of
+// what a comparison looks at: the line past its first character for the
+// patch, ignoring whitespace with -l. Lines whose hashes differ can't match,
+// which is most of them, so only the rest need comparing.
+
+struct patch_line {
+  unsigned hash;
+  char data[];
+};
+
+#define LINE_HASH(s) \
+  (((struct patch_line *)((s)-offsetof(struct patch_line, data)))->hash)
+
+// Copy len bytes of s into a new line, hashed from skip bytes in. Every
+// line read gets hashed, so without -l that's done 8 bytes at a time.
+static char *patch_keep(char *s, long len, int skip)
+{
+  struct patch_line *pl = xmalloc(sizeof(struct patch_line)+len+1);
+  unsigned char *c = memcpy(pl->data, s, len), *end = c+len;
+  unsigned long long h = 0xcbf29ce484222325ULL, w;
+
+  pl->data[len] = 0;
+  c += skip;
+  if (toys.optflags & FLAG_l) {
+    for (; c<end; c++) if (!isspace(*c)) h = (h^*c)*0x100000001b3ULL;
+  } else {
+    for (; end-c >= 8; c += 8) {
+      memcpy(&w, c, 8);
+      h = (h^w)*0x100000001b3ULL;
+      h ^= h>>32;
+    }
+    for (; c<end; c++) h = (h^*c)*0x100000001b3ULL;
+  }
+  pl->hash = h^(h>>32);
+
+  return pl->data;
+}
+
+static void patch_free(char *s)
+{
+  free(s-offsetof(struct patch_line, data));
+}
+
+// Write to the new file a big chunk at a time. NULL flushes.
+static void patch_write(char *s, long len)
+{
+  if (TT.olen && (!s || TT.olen+len > 65536)) {
+    txwrite(TT.fileout, TT.obuf, TT.olen);
+    TT.olen = 0;
+  }
+  if (!s) return;
+  if (len >= 65536) txwrite(TT.fileout, s, len);
+  else {
+    if (!TT.obuf) TT.obuf = xmalloc(65536);
+    memcpy(TT.obuf+TT.olen, s, len);
+    TT.olen += len;
+  }
+}
+
 // Dispose of a line of input, either by writing it out or discarding it.
 
 // state < 2: just free
@@ -69,22 +130,32 @@ static void do_line(void *data)
 
   if (TT.state>1 && *dlist->data != TT.state) {
     char *s = dlist->data+(TT.state>3 ? 1 : 0);
-    int i = TT.state == 2 ? 2 : TT.fileout;
 
-    txwrite(i, s, strlen(s));
-    txwrite(i, "\n", 1);
+    if (TT.state == 2) {
+      txwrite(2, s, strlen(s));
+      txwrite(2, "\n", 1);
+    } else {
+      patch_write(s, strlen(s));
+      patch_write("\n", 1);
+    }
   }
 
   if (toys.optflags & FLAG_x)
     fprintf(stderr, "DO %d: %s\n", TT.state, dlist->data);
 
-  free(dlist->data);
+  patch_free(dlist->data);
   free(data);
 }
 
+// The rest of the old file goes straight across after what's buffered
 static void finish_oldfile(void)
 {
-  if (TT.tempname) replace_tempfile(TT.filein, TT.fileout, &TT.tempname);
+  if (TT.tempname) {
+    patch_write(0, 0);
+    linebuf_done(&TT.lb);
+    replace_tempfile(TT.filein, TT.fileout, &TT.tempname);
+  }
+  linebuf_init(&TT.lb, -1);
   TT.fileout = TT.filein = -1;
 }
 
@@ -102,6 +173,9 @@ static void fail_hunk(void)
   TT.state = 2;
   llist_traverse(TT.current_hunk, do_line);
   TT.current_hunk = NULL;
+  TT.olen = 0;
+  linebuf_done(&TT.lb);
+  linebuf_init(&TT.lb, -1);
   delete_tempfile(TT.filein, TT.fileout, &TT.tempname);
   TT.state = 0;
 }
@@ -132,8 +206,11 @@ static int apply_one_hunk(void)
   struct double_list *plist, *buf = NULL, *check;
   int matcheof, trailing = 0, reverse = toys.optflags & FLAG_R, backwarn = 0;
   int (*lcmp)(char *aa, char *bb);
+  long len;
 
   lcmp = (toys.optflags & FLAG_l) ? (void *)loosecmp : (void *)strcmp;
+#define HUNKCMP(line, pl) \
+  (LINE_HASH(line) != LINE_HASH((pl)->data) || lcmp(line, (pl)->data+1))
   dlist_terminate(TT.current_hunk);
 
   // Match EOF if there aren't as many ending context lines as beginning
@@ -154,13 +231,15 @@ static int apply_one_hunk(void)
   buf = NULL;
 
   for (;;) {
-    char *data = get_line(TT.filein);
+    char *data = get_linebuf(&TT.lb, &len, '\n', LINEBUF_CHOMP);
+
+    if (data) data = patch_keep(data, len, 0);
 
     TT.linenum++;
     // Figure out which line of hunk to compare with next.  (Skip lines
     // of the hunk we'd be adding.)
     while (plist && *plist->data == "+-"[reverse]) {
-      if (data && !lcmp(data, plist->data+1)) {
+      if (data && !HUNKCMP(data, plist)) {
         if (!backwarn) backwarn = TT.linenum;
       }
       plist = plist->next;
@@ -193,7 +272,7 @@ static int apply_one_hunk(void)
     // out of buffer.
 
     for (;;) {
-      if (!plist || lcmp(check->data, plist->data+1)) {
+      if (!plist || HUNKCMP(check->data, plist)) {
         // Match failed.  Write out first line of buffered data and
         // recheck remaining buffered data for a new match.
 
@@ -243,6 +322,7 @@ done:
     dlist_terminate(buf);
     llist_traverse(buf, do_line);
   }
+#undef HUNKCMP
 
   return TT.state;
 }
@@ -260,36 +340,38 @@ void patch_main(void)
   int reverse = toys.optflags&FLAG_R, state = 0, patchlinenum = 0,
     strip = 0;
   char *oldname = NULL, *newname = NULL;
+  struct linebuf plb;
+  long len;
 
   if (TT.infile) TT.filepatch = xopen(TT.infile, O_RDONLY);
   TT.filein = TT.fileout = -1;
+  linebuf_init(&plb, TT.filepatch);
 
   // Loop through the lines in the patch
   for (;;) {
     char *patchline;
 
-    patchline = get_line(TT.filepatch);
+    patchline = get_linebuf(&plb, &len, '\n', LINEBUF_CHOMP);
     if (!patchline) break;
 
     // Other versions of patch accept damaged patches,
     // so we need to also.
     if (strip || !patchlinenum++) {
-      int len = strlen(patchline);
-      if (patchline[len-1] == '\r') {
+      if (len && patchline[len-1] == '\r') {
         if (!strip) fprintf(stderr, "Removing DOS newlines\n");
         strip = 1;
-        patchline[len-1]=0;
+        patchline[--len]=0;
       }
     }
     if (!*patchline) {
-      free(patchline);
-      patchline = xstrdup(" ");
+      patchline = " ";
+      len = 1;
     }
 
     // Are we assembling a hunk?
     if (state >= 2) {
       if (*patchline==' ' || *patchline=='+' || *patchline=='-') {
-        dlist_add(&TT.current_hunk, patchline);
+        dlist_add(&TT.current_hunk, patch_keep(patchline, len, 1));
 
         if (*patchline != '+') TT.oldlen--;
         if (*patchline != '-') TT.newlen--;
@@ -399,21 +481,18 @@ void patch_main(void)
             TT.filein = xopen(name, O_RDONLY);
           }
           TT.fileout = copy_tempfile(TT.filein, name, &TT.tempname);
+          linebuf_init(&TT.lb, TT.filein);
           TT.linenum = 0;
           TT.hunknum = 0;
         }
       }
 
       TT.hunknum++;
-
-      continue;
     }
-
-    // If we didn't continue above, discard this line.
-    free(patchline);
   }
 
   finish_oldfile();
+  linebuf_done(&plb);
 
   if (CFG_TOYBOX_FREE) {
     close(TT.filepatch);
@@ -28,19 +28,19 @@
  *       switch -fl to -y, use "string" instead of constants to set, remove C
  * TODO: --sort -Z
  * TODO: way too many hardwired constants here, how can I generate them?
- * TODO: thread support /proc/$d/task/%d/stat (and -o stat has "l")
+ * TODO: -o stat has "l" for multithreaded
  *
  * Design issue: the -o fields are an ordered array, and the order is
  * significant. The array index is used in strawberry->which (consumed
  * in do_ps()) and in the bitmasks enabling default fields in ps_main().
 
-USE_PS(NEWTOY(ps, "P(ppid)*aAdeflo*p(pid)*s*t*u*U*g*G*wZ[!ol][+Ae]", TOYFLAG_USR|TOYFLAG_BIN))
+USE_PS(NEWTOY(ps, "P(ppid)*aAdeflo*p(pid)*s*t*u*U*g*G*wTZ[!ol][+Ae]", TOYFLAG_USR|TOYFLAG_BIN))
 
 config PS
   bool "ps"
   default y
   help
-    usage: ps [-AadeflwZ] [-gG GROUP] [-o FIELD] [-p PID] [-t TTY] [-uU USER]
+    usage: ps [-AadeflTwZ] [-gG GROUP] [-o FIELD] [-p PID] [-t TTY] [-uU USER]
 
     List processes.
 
@@ -56,11 +56,12 @@ config PS
     -P	Parent PIDs (--ppid)
     -s	In session IDs
     -t	Attached to selected TTYs
+    -T	Show threads too
     -u	Owned by USERs
     -U	Owned by real USERs (before suid)
     -w	Wide output (don't truncate at terminal width)
 
-    Which FIELDs to show. (Default = -o PID,TTY,TIME,CMD)
+    Which FIELDs to show. (Default = -o PID,TTY,TIME,CMD, with TID for -T)
 
     -f	Full listing (-o USER:8=UID,PID,PPID,C,STIME,TTY,TIME,CMD)
     -l	Long listing (-o F,S,UID,PID,PPID,C,PRI,NI,ADDR,SZ,WCHAN,TTY,TIME,CMD)
@@ -70,8 +71,11 @@ config PS
     Available -o FIELDs:
 
       ADDR   Instruction pointer
+      BLKIO  Seconds spent waiting for block I/O
       CMD    Command line (including args)
       COMM   Command name (no args)
+      DREAD  Data read from storage
+      DWRITE Data written to storage
       ETIME  Elapsed time since process start
       F      Process flags (PF_*) from linux source file include/sched.h
              (in octal rather than hex because posix)
@@ -87,6 +91,7 @@ config PS
       PPID   Parent Process ID
       PRI    Priority
       RGID   Real (before sgid) group ID
+      READ   Data read (including cache)
       RGROUP Real (before sgid) group name
       RSS    Resident Set Size (memory currently used)
       RUID   Real (before suid) user ID
@@ -99,17 +104,18 @@ config PS
              s session leader         + foreground   l multithreaded
       STIME  Start time of process in hh:mm (size :19 shows yyyy-mm-dd hh:mm:ss)
       SZ     Memory Size (4k pages needed to completely swap out process)
+      TID    Thread ID (same as PID for a process)
       TIME   CPU time consumed
       TTY    Controlling terminal
       UID    User id
       USER   User name
       VSZ    Virtual memory size (1k units)
       WCHAN  Waiting in kernel for
+      WRITE  Data written (including cache)
 */
 
 #define FOR_ps
 #include "toys.h"
-#include "xfuncs.h"
 
 GLOBALS(
   struct arg_list *G;
@@ -126,7 +132,7 @@ GLOBALS(
   unsigned width;
   dev_t tty;
   void *fields;
-  long bits;
+  long long bits;
   long long ticks;
   size_t header_len;
 )
@@ -180,59 +186,42 @@ static int match_process(long long *slot)
   return 1;
 }
 
-// dirtree callback.
-// toybuf used as: 1024 /proc/$PID/stat, 1024 slot[], 2048 /proc/$PID/cmdline
-static int do_ps(struct dirtree *new)
+// Copy process n's stat numbers into slot[], then save uid, ruid, gid and
+// rgid into slots 31-34 (we don't use sigcatch or numeric wchan, and the
+// remaining two are always zero) and vmlck into slot[18] (it_real_value,
+// also always zero). A thread's slot[0] is its process's pid.
+static void ps_slots(struct procsnap *snap, long n, long long *slot)
 {
-  struct strawberry *field;
-  long long *slot = (void *)(toybuf+1024), ll;
-  char *name, *s, state;
-  int nlen, i, fd, len, width = TT.width;
-
-  if (!new->parent) return DIRTREE_RECURSE|DIRTREE_SHUTUP;
-  if (!(*slot = atol(new->name))) return 0;
-
-  // name field limited to 256 bytes by VFS, plus 40 fields * max 20 chars:
-  // 1000-ish total, but some forced zero so actually there's headroom.
-  sprintf(toybuf, "%lld/stat", *slot);
-  if (!readfileat(dirtree_parentfd(new), toybuf, toybuf, 1024)) return 0;
-
-  // parse oddball fields (name and state)
-  if (!(s = strchr(toybuf, '('))) return 0;
-  for (name = ++s; *s != ')'; s++) if (!*s) return 0;
-  nlen = s++-name;
-  if (1>sscanf(++s, " %c%n", &state, &i)) return 0;
-
-  // parse numeric fields (PID = 0, skip 2, then 4th field goes in slot[1])
-  for (len = 1; len<100; len++)
-    if (1>sscanf(s += i, " %lld%n", slot+len, &i)) break;
-
-  // save uid, ruid, gid, gid, and rgid int slots 31-34 (we don't use sigcatch
-  // or numeric wchan, and the remaining two are always zero).
-  slot[31] = new->st.st_uid;
-  slot[33] = new->st.st_gid;
-
-  // If RGROUP RUSER STAT RUID RGID
-  // Save ruid in slot[34] and rgid in slot[35], which are otherwise zero,
-  // and vmlck into slot[18] (it_real_value, also always zero).
-  if ((TT.bits & 0x38300000) || TT.GG.len || TT.UU.len) {
-    char *out = toybuf+2048;
-
-    sprintf(out, "%lld/status", *slot);
-    if (!readfileat(dirtree_parentfd(new), out, out, 2048)) *out = 0;
-    s = strstr(out, "\nUid:");
-    slot[32] = s ? atol(s+5) : new->st.st_uid;
-    s = strstr(out, "\nGid:");
-    slot[34] = s ? atol(s+5) : new->st.st_gid;
-    s = strstr(out, "\nVmLck:");
-    if (s) slot[18] = atoll(s+5);
-  }
+  memcpy(slot, procsnap_stat(snap, n), PROCSNAP_SLOTS*sizeof(long long));
+  *slot = snap->tgid[n];
+  slot[31] = snap->uid[n];
+  slot[32] = snap->ruid[n];
+  slot[33] = snap->gid[n];
+  slot[34] = snap->rgid[n];
+  slot[18] = snap->vmlck[n];
+}
 
-  // skip processes we don't care about.
-  if (!match_process(slot)) return 0;
+// procsnap_read() callback: skip processes we don't care about before their
+// command line is read.
+static int ps_keep(struct procsnap *snap, long n)
+{
+  long long slot[PROCSNAP_SLOTS];
+
+  ps_slots(snap, n, slot);
 
-  // At this point 512 bytes at toybuf+512 are free (already parsed).
-  // Start of toybuf still has name in it.
+  return match_process(slot);
+}
+
+// Show process n of the snapshot.
+// toybuf used as: 512 scratch, 2048 output
+static void do_ps(struct procsnap *snap, long n)
+{
+  struct strawberry *field;
+  long long slot[PROCSNAP_SLOTS], ll;
+  char *name = procsnap_name(snap, n), *s, state = snap->state[n];
+  int nlen = strlen(name), i, len, width = TT.width;
+
+  ps_slots(snap, n, slot);
 
   // Loop through fields
   for (field = TT.fields; field; field = field->next) {
@@ -261,15 +250,9 @@ static int do_ps(struct dirtree *new)
       // Even entries are numbers, odd are names
       sprintf(out, "%d", id);
       if (i&1) {
-        if (i>3) {
-          struct group *gr = getgrgid(id);
-
-          if (gr) out = gr->gr_name;
-        } else {
-          struct passwd *pw = getpwuid(id);
+        char *name = i>3 ? gid_name(id) : uid_name(id);
 
-          if (pw) out = pw->pw_name;
-        }
+        if (name) out = name;
       }
  
     // F (also assignment of i used by later tests)
@@ -291,13 +274,13 @@ static int do_ps(struct dirtree *new)
       } 
     // WCHAN
     } else if (i==10) {
-      sprintf(scratch, "%lld/wchan", *slot);
-      readfileat(dirtree_parentfd(new), scratch, out, 2047);
+      sprintf(scratch, "/proc/%lld/wchan", *slot);
+      readfile(scratch, out, 2047);
 
     // LABEL
     } else if (i==31) {
-      sprintf(scratch, "%lld/attr/current", *slot);
-      readfileat(dirtree_parentfd(new), scratch, out, 2047);
+      sprintf(scratch, "/proc/%lld/attr/current", *slot);
+      readfile(scratch, out, 2047);
       chomp(out);
 
     // STIME
@@ -319,11 +302,10 @@ static int do_ps(struct dirtree *new)
       for (i=0; i<3; i++) {
         struct stat st;
 
-        sprintf(scratch, "%lld/fd/%i", *slot, i);
-        fd = dirtree_parentfd(new);
-        if (!xfstatat(fd, scratch, &st, 0) && S_ISCHR(st.st_mode)
+        sprintf(scratch, "/proc/%lld/fd/%i", *slot, i);
+        if (!stat(scratch, &st) && S_ISCHR(st.st_mode)
           && st.st_rdev == (unsigned long)slot[4]
-          && 0<(len = xreadlinkat(fd, scratch, out, 2047)))
+          && 0<(len = readlink(scratch, out, 2047)))
         {
           out[len] = 0;
           if (!strncmp(out, "/dev/", 5)) out += 5;
@@ -360,19 +342,12 @@ static int do_ps(struct dirtree *new)
     // it'd almost never get used, querying length of a proc file is awkward,
     // fixed buffer is nommu friendly... Wait for somebody to complain. :)
     } else if (i==14) {
-      int fd;
-
-      len = 0;
-      sprintf(out, "%lld/cmdline", *slot);
-      fd = xopenat(dirtree_parentfd(new), out, O_RDONLY);
- 
-      if (fd != -1) {
-        if (0<(len = read(fd, out, 2047))) {
-          if (!out[len-1]) len--;
-          else out[len] = 0;
-          for (i = 0; i<len; i++) if (out[i] < ' ') out[i] = ' ';
-        }
-        close(fd);
+      if ((len = snap->cmdlen[n]) > 2047) len = 2047;
+      memcpy(out, procsnap_cmd(snap, n), len);
+      if (len) {
+        if (!out[len-1]) len--;
+        else out[len] = 0;
+        for (i = 0; i<len; i++) if (out[i] < ' ') out[i] = ' ';
       }
 
       if (len<1) sprintf(out, "[%.*s]", nlen, name);
@@ -386,7 +361,18 @@ static int do_ps(struct dirtree *new)
       ll = (get_uptime()*sysconf(_SC_CLK_TCK)-slot[19]);
       len = ((slot[11]+slot[12])*1000)/ll;
       sprintf(out, "%d.%d", len/10, len%10);
-    }
+
+    // READ WRITE DREAD DWRITE
+    } else if (i>=32 && i<36) {
+      human_readable(out, procsnap_io(snap, n)[i-32], 0);
+
+    // BLKIO
+    } else if (i==36) {
+      ll = procsnap_io(snap, n)[PROCSNAP_BLKIO]/10000000;
+      sprintf(out, "%lld.%02lld", ll/100, ll%100);
+
+    // TID
+    } else if (i==37) sprintf(out, "%d", snap->pid[n]);
 
     // Output the field, appropriately padded
     len = width - (field != TT.fields);
@@ -401,8 +387,6 @@ static int do_ps(struct dirtree *new)
     if (!width) break;
   }
   xputc('\n');
-
-  return 0;
 }
 
 // Traverse arg_list of csv, calling callback on each value
@@ -430,13 +414,15 @@ static char *parse_o(char *type, int length)
          "F", "S", "UID", "PID", "PPID", "C", "PRI", "NI", "ADDR", "SZ",
          "WCHAN", "STIME", "TTY", "TIME", "CMD", "COMMAND", "ELAPSED", "GROUP",
          "%CPU", "PGID", "RGROUP", "RUSER", "USER", "VSZ", "RSS", "MAJFL",
-         "GID", "STAT", "RUID", "RGID", "MINFL", "LABEL"
+         "GID", "STAT", "RUID", "RGID", "MINFL", "LABEL", "READ", "WRITE",
+         "DREAD", "DWRITE", "BLKIO", "TID"
   };
   // TODO: Android uses -30 for LABEL, but ideally it would auto-size.
   signed char widths[] = {1,-1,5,5,5,2,3,3,4+sizeof(long),5,
                           -6,5,-8,8,-27,-27,11,-8,
                           4,5,-8,-8,-8,6,5,6,
-                          8,-5,4,4,6,-30};
+                          8,-5,4,4,6,-30,6,6,
+                          6,6,6,5};
   int i, j, k;
 
   // Get title, length of title, type, end of type, and display width
@@ -492,7 +478,7 @@ static char *parse_o(char *type, int length)
   TT.header_len +=
     snprintf(toybuf + TT.header_len, sizeof(toybuf) - TT.header_len,
              " %*s" + (field == TT.fields), field->len, field->title);
-  TT.bits |= (i = 1<<field->which);
+  TT.bits |= 1LL<<field->which;
 
   return 0;
 }
@@ -578,6 +564,8 @@ static char *parse_rest(char *str, int len)
 
 void ps_main(void)
 {
+  struct procsnap snap;
+  long n;
   int i;
 
   TT.width = 99999;
@@ -628,6 +616,7 @@ void ps_main(void)
       al.arg = "USER:8=UID,PID,PPID,C,STIME,TTY,TIME,CMD";
     else if (toys.optflags&FLAG_l)
       al.arg = "F,S,UID,PID,PPID,C,PRI,NI,ADDR,SZ,WCHAN,TTY,TIME,CMD";
+    else if (toys.optflags&FLAG_T) al.arg = "PID,TID,TTY,TIME,CMD";
     else al.arg = "PID,TTY,TIME,CMD";
 
     comma_args(&al, 0, parse_o);
@@ -635,7 +624,16 @@ void ps_main(void)
   dlist_terminate(TT.fields);
   printf("%s\n", toybuf);
 
-  dirtree_read("/proc", do_ps);
+  // Only read what the selections and fields need: status for RGROUP RUSER
+  // STAT RUID RGID and -G -U, command lines for CMD, io for READ WRITE DREAD
+  // DWRITE BLKIO, and threads for -T.
+  memset(&snap, 0, sizeof(snap));
+  procsnap_read(&snap, PROCSNAP_STAT|PROCSNAP_OWNER
+    | (((TT.bits & 0x38300000) || TT.GG.len || TT.UU.len) ? PROCSNAP_STATUS : 0)
+    | ((TT.bits & (1<<14)) ? PROCSNAP_CMDLINE : 0)
+    | ((TT.bits & (31LL<<32)) ? PROCSNAP_IO : 0)
+    | ((toys.optflags&FLAG_T) ? PROCSNAP_THREADS : 0), ps_keep);
+  for (n = 0; n<snap.count; n++) do_ps(&snap, n);
 
   if (CFG_TOYBOX_FREE) {
     free(TT.gg.ptr);
@@ -647,5 +645,6 @@ void ps_main(void)
     free(TT.uu.ptr);
     free(TT.UU.ptr);
     llist_traverse(TT.fields, free);
+    procsnap_free(&snap);
   }
 }
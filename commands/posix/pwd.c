@@ -23,7 +23,7 @@ config PWD
 
 void pwd_main(void)
 {
-  char *s, *pwd = getcwd(0, 0), *PWD;
+  char *s, *pwd = cachedcwd(), *PWD;
 
   // Only use $PWD if it's an absolute path alias for cwd with no "." or ".."
   if (!(toys.optflags & FLAG_P) && (s = PWD = getenv("PWD"))) {
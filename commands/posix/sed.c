@@ -173,15 +173,15 @@ GLOBALS(
   // processed pattern list
   struct double_list *pattern;
 
-  char *nextline, *remember;
+  char *nextline, *remember, *spare[2], *obuf;
   void *restart, *lastregex;
-  long nextlen, rememberlen, count;
-  int fdout, noeol;
+  long nextlen, rememberlen, count, sparesize[2], olen;
+  int fdout, noeol, ofd;
   unsigned xx;
 )
 
 struct step {
-  struct step *next, *prev;
+  struct step *next, *prev, *jump; // jump: b/t/T label, or { to its }
 
   // Begin and end of each match
   long lmatch[2];
@@ -190,34 +190,118 @@ struct step {
   char c; // action
 };
 
+// A compiled regex, and the pattern itself if it's just a string of
+// ordinary characters, which memmem() finds without the regex engine.
+struct sedregex {
+  regex_t reg;
+  char *lit;
+  int litlen;
+};
+
+// Write out whatever output has piled up in obuf
+static int sed_flush(void)
+{
+  long len = TT.olen;
+
+  TT.olen = 0;
+  if (len && writeall(TT.ofd, TT.obuf, len) != len) {
+    perror_msg("short write");
+
+    return 1;
+  }
+
+  return 0;
+}
+
+// Output to the main output file (stdout or -i's tempfile) collects in obuf
+// so a line isn't a write() each, anything else (w files) goes right out.
+static int sed_write(char *s, long len)
+{
+  if (TT.fdout == TT.ofd) {
+    if (TT.olen+len > 65536 && sed_flush()) return 1;
+    if (len < 65536) {
+      if (!TT.obuf) TT.obuf = xmalloc(65536);
+      memcpy(TT.obuf+TT.olen, s, len);
+      TT.olen += len;
+
+      return 0;
+    }
+  }
+  if (writeall(TT.fdout, s, len) != len) {
+    perror_msg("short write");
+
+    return 1;
+  }
+
+  return 0;
+}
+
 // Write out line with potential embedded NUL, handling eol/noeol
 static int emit(char *line, long len, int eol)
 {
   int l, old = line[len];
 
-  if (TT.noeol && !writeall(TT.fdout, "\n", 1)) return 1;
+  if (TT.noeol && sed_write("\n", 1)) return 1;
   if (eol) line[len++] = '\n';
   if (!len) return 0;
   TT.noeol = len && !eol;
-  l = writeall(TT.fdout, line, len);
+  l = sed_write(line, len);
   if (eol) line[len-1] = old;
-  if (l != len) {
-    perror_msg("short write");
 
-    return 1;
+  return l;
+}
+
+// Lines get handed back here instead of freed, and the input and s/// take
+// them again, so going through a file doesn't malloc() and free() per line.
+// size is how much of the allocation we know about, at least len+1.
+static void line_recycle(char *line, long size)
+{
+  int i = TT.sparesize[0] > TT.sparesize[1];
+
+  if (!line) return;
+  if (size > TT.sparesize[i]) {
+    free(TT.spare[i]);
+    TT.spare[i] = line;
+    TT.sparesize[i] = size;
+  } else free(line);
+}
+
+// Grow line (of *size bytes) to hold at least len bytes. A NULL line
+// gets a recycled one if there is one.
+static char *line_grow(char *line, long *size, long len)
+{
+  if (!line) {
+    int i = TT.sparesize[0] < TT.sparesize[1];
+
+    line = TT.spare[i];
+    *size = TT.sparesize[i];
+    TT.spare[i] = 0;
+    TT.sparesize[i] = 0;
   }
+  if (len > *size) line = xrealloc(line, *size = len+(len>>1)+64);
 
-  return 0;
+  return line;
 }
 
 // Do regex matching handling embedded NUL bytes in string. Note that
 // neither the pattern nor the match can currently include NUL bytes
 // (even with wildcards) and string must be null terminated.
-static int ghostwheel(regex_t *preg, char *string, long len, int nmatch,
+static int ghostwheel(struct sedregex *rx, char *string, long len, int nmatch,
   regmatch_t pmatch[], int eflags)
 {
   char *s = string;
 
+  // No NUL in the pattern, so memmem() finds the same first match
+  if (rx->lit) {
+    if (!(s = memmem(string, len, rx->lit, rx->litlen))) return REG_NOMATCH;
+    while (nmatch--) {
+      pmatch[nmatch].rm_so = nmatch ? -1 : s-string;
+      pmatch[nmatch].rm_eo = nmatch ? -1 : s-string+rx->litlen;
+    }
+
+    return 0;
+  }
+
   for (;;) {
     long ll = 0;
     int rc;
@@ -228,7 +312,7 @@ static int ghostwheel(regex_t *preg, char *string, long len, int nmatch,
     }
     while (s[ll] && ll<len) ll++;
 
-    rc = regexec(preg, s, nmatch, pmatch, eflags);
+    rc = regexec(&rx->reg, s, nmatch, pmatch, eflags);
     if (!rc) {
       for (rc = 0; rc<nmatch && pmatch[rc].rm_so!=-1; rc++) {
         pmatch[rc].rm_so += s-string;
@@ -260,10 +344,24 @@ static char *extend_string(char **old, char *new, int oldlen, int newlen)
   return s+oldlen+newlen+1;
 }
 
+static void sed_regcomp(struct sedregex *rx, char *s, int flags)
+{
+  char *c;
+
+  xregcomp(&rx->reg, s, flags);
+  rx->lit = 0;
+  if (flags & REG_ICASE) return;
+  for (c = s; *c; c++)
+    if ((MB_CUR_MAX > 1 && *c < 0) || strchr("\\.[]*^$", *c)
+        || ((flags & REG_EXTENDED) && strchr("+?(){}|", *c))) return;
+  rx->litlen = strlen(rx->lit = xstrdup(s));
+}
+
 // An empty regex repeats the previous one
 static void *get_regex(void *trump, int offset)
 {
   if (!offset) {
+    sed_flush();
     if (!TT.lastregex) error_exit("no previous regex");
     return TT.lastregex;
   }
@@ -343,15 +441,7 @@ static void walk_pattern(char **pline, long plen)
 
       if (lm) {
         // Handle skipping curly bracket command group
-        if (c == '{') {
-          int curly = 1;
-
-          while (curly) {
-            logrus = logrus->next;
-            if (logrus->c == '{') curly++;
-            if (logrus->c == '}') curly--;
-          }
-        }
+        if (c == '{') logrus = logrus->jump;
         logrus = logrus->next;
         continue;
       }
@@ -376,20 +466,16 @@ static void walk_pattern(char **pline, long plen)
       if (c != 'b') tea = 0;
       if (c=='b' || t^(c=='T')) {
         if (!logrus->arg1) break;
-        str = logrus->arg1+(char *)logrus;
-        for (logrus = (void *)TT.pattern; logrus; logrus = logrus->next)
-          if (logrus->c == ':' && !strcmp(logrus->arg1+(char *)logrus, str))
-            break;
-        if (!logrus) error_exit("no :%s", str);
+        logrus = logrus->jump;
       }
     } else if (c=='c') {
       str = logrus->arg1+(char *)logrus;
       if (!logrus->hit) emit(str, strlen(str), 1);
-      free(line);
+      line_recycle(line, len+1);
       line = 0;
       continue;
     } else if (c=='d') {
-      free(line);
+      line_recycle(line, len+1);
       line = 0;
       continue;
     } else if (c=='D') {
@@ -402,7 +488,7 @@ static void walk_pattern(char **pline, long plen)
       // if "delete" blanks line, disable further processing
       // otherwise trim and restart script
       if (!len) {
-        free(line);
+        line_recycle(line, len+1);
         line = 0;
       } else {
         line[len] = 0;
@@ -410,18 +496,16 @@ static void walk_pattern(char **pline, long plen)
       }
       continue;
     } else if (c=='g') {
-      free(line);
-      line = xstrdup(TT.remember);
-      len = TT.rememberlen;
+      line = xrealloc(line, TT.rememberlen+1);
+      memcpy(line, TT.remember, (len = TT.rememberlen)+1);
     } else if (c=='G') {
       line = xrealloc(line, len+TT.rememberlen+2);
       line[len++] = '\n';
       memcpy(line+len, TT.remember, TT.rememberlen);
       line[len += TT.rememberlen] = 0;
     } else if (c=='h') {
-      free(TT.remember);
-      TT.remember = xstrdup(line);
-      TT.rememberlen = len;
+      TT.remember = xrealloc(TT.remember, len+1);
+      memcpy(TT.remember, line, (TT.rememberlen = len)+1);
     } else if (c=='H') {
       TT.remember = xrealloc(TT.remember, TT.rememberlen+len+2);
       TT.remember[TT.rememberlen++] = '\n';
@@ -465,7 +549,7 @@ static void walk_pattern(char **pline, long plen)
       if (pline) {
         TT.restart = logrus->next+1;
         extend_string(&line, TT.nextline, len, -TT.nextlen);
-        free(TT.nextline);
+        line_recycle(TT.nextline, TT.nextlen+1);
         TT.nextline = line;
         TT.nextlen += len + 1;
         line = 0;
@@ -485,10 +569,12 @@ static void walk_pattern(char **pline, long plen)
 
       break;
     } else if (c=='s') {
-      char *rline = line, *new = logrus->arg2 + (char *)logrus, *swap, *rswap;
+      char *rline = line, *new = logrus->arg2 + (char *)logrus, *swap = 0,
+        *rswap;
       regmatch_t *match = (void *)toybuf;
-      regex_t *reg = get_regex(logrus, logrus->arg1);
+      struct sedregex *reg = get_regex(logrus, logrus->arg1);
       int mflags = 0, count = 0, zmatch = 1, rlen = len, mlen, off, newlen;
+      long done = 0, slen = 0, ssize = 0;
 
       // Find match in remaining line (up to remaining len)
       while (!ghostwheel(reg, rline, rlen, 10, match, mflags)) {
@@ -528,13 +614,15 @@ static void walk_pattern(char **pline, long plen)
           newlen += match[cc].rm_eo-match[cc].rm_so;
         }
 
-        // Allocate new size, copy start/end around match. (Can't extend in
-        // place because backrefs may refer to text after it's overwritten.)
-        len += newlen-mlen;
-        swap = xmalloc(len+1);
-        rswap = swap+(rline-line)+match[0].rm_so;
-        memcpy(swap, line, (rline-line)+match[0].rm_so);
-        memcpy(rswap+newlen, rline+match[0].rm_eo, (rlen -= match[0].rm_eo)+1);
+        // Build the new line in swap as we go, copying what's between the
+        // last match and this one then the replacement. (Backrefs refer to
+        // the old line, which stays put until we're done.)
+        off = (rline-line)+match[0].rm_so-done;
+        swap = line_grow(swap, &ssize, slen+off+newlen+1);
+        memcpy(swap+slen, line+done, off);
+        rswap = swap+(slen += off);
+        slen += newlen;
+        done = (rline-line)+match[0].rm_eo;
 
         // copy in new replacement text
         for (off = mlen = 0; new[off]; off++) {
@@ -547,7 +635,10 @@ static void walk_pattern(char **pline, long plen)
                 rswap[mlen-1] = new[off];
 
               continue;
-            } else if (match[cc].rm_so == -1) error_exit("no s//\\%d/", cc);
+            } else if (match[cc].rm_so == -1) {
+              sed_flush();
+              error_exit("no s//\\%d/", cc);
+            }
           } else if (new[off] != '&') {
             rswap[mlen++] = new[off];
 
@@ -559,14 +650,22 @@ static void walk_pattern(char **pline, long plen)
           mlen += ll;
         }
 
-        rline = rswap+newlen;
-        free(line);
-        line = swap;
+        rline += match[0].rm_eo;
+        rlen -= match[0].rm_eo;
 
         // Stop after first substitution unless we have flag g
         if (!(logrus->sflags & 2)) break;
       }
 
+      // Copy the rest of the line after the last match and switch over
+      if (swap) {
+        swap = line_grow(swap, &ssize, slen+len-done+1);
+        memcpy(swap+slen, line+done, len-done+1);
+        line_recycle(line, len+1);
+        line = swap;
+        len = slen+len-done;
+      }
+
       if (mflags) {
         // flag p
         if (logrus->sflags & 4) emit(line, len, eol);
@@ -579,7 +678,8 @@ static void walk_pattern(char **pline, long plen)
       char *name;
 
 writenow:
-      // Swap out emit() context
+      // Swap out emit() context, keeping output in order for w /dev/stdout
+      sed_flush();
       fd = TT.fdout;
       noeol = TT.noeol;
 
@@ -625,7 +725,7 @@ writenow:
   if (line && !(toys.optflags & FLAG_n)) emit(line, len, eol);
 
 done:
-  free(line);
+  line_recycle(line, len+1);
 
   if (dlist_terminate(append)) while (append) {
     struct append *a = append->next;
@@ -635,6 +735,7 @@ done:
 
       // Force newline if noeol pending
       if (fd != -1) {
+        sed_flush();
         if (TT.noeol) txwrite(TT.fdout, "\n", 1);
         TT.noeol = 0;
         xsendfile(fd, TT.fdout);
@@ -650,25 +751,30 @@ done:
 
 // Iterate over lines in file, calling function. Function can write 0 to
 // the line pointer if they want to keep it, or 1 to terminate processing,
-// otherwise line is freed. Passed file descriptor is closed at the end.
+// otherwise line is recycled. Passed file descriptor is closed at the end.
 static void do_lines(int fd, char *name, void (*call)(char **pline, long len))
 {
-  (void)name;
-  FILE *fp = fd ? xfdopen(fd, "r") : stdin;
+  struct linebuf lb;
+  struct stat st;
+  char *line, *s;
+  long len, size;
+  int slow = fstat(fd, &st) || !S_ISREG(st.st_mode);
 
+  (void)name;
+  linebuf_init(&lb, fd);
   for (;;) {
-    char *line = 0;
-    ssize_t len;
-
-    len = xgetline(&line, (void *)&len, fp);
-    if (len > 0) {
-      call(&line, len);
-      if (line == (void *)1) break;
-      free(line);
-    } else break;
+    // Don't sit on output while waiting for more input from a pipe or tty
+    if (slow && TT.olen && (lb.end == lb.start
+        || !memchr(lb.buf+lb.start, '\n', lb.end-lb.start))) sed_flush();
+    if (!(s = get_linebuf(&lb, &len, '\n', 0))) break;
+    line = line_grow(0, &size, len+1);
+    memcpy(line, s, len+1);
+    call(&line, len);
+    if (line == (void *)1) break;
+    line_recycle(line, size);
   }
-
-  if (fd) fclose(fp);
+  linebuf_done(&lb);
+  if (fd) close(fd);
 }
 
 // Callback called on each input file
@@ -689,11 +795,13 @@ static void do_sed(int fd, char *name)
     for (primal = (void *)TT.pattern; primal; primal = primal->next)
       primal->hit = 0;
   }
+  TT.ofd = TT.fdout;
   do_lines(fd, name, walk_pattern);
   if (i) {
     walk_pattern(0, 0);
+    sed_flush();
     replace_tempfile(-1, TT.fdout, &tmp);
-    TT.fdout = 1;
+    TT.ofd = TT.fdout = 1;
     TT.nextline = 0;
     TT.nextlen = TT.noeol = 0;
   }
@@ -808,9 +916,9 @@ static void jewel_of_judgement(char **pline, long len)
         if (!(s = unescape_delimited_string(&line, 0, 1))) goto brand;
         if (!*s) corwin->rmatch[i] = 0;
         else {
-          xregcomp((void *)reg, s, (toys.optflags & FLAG_r)*REG_EXTENDED);
+          sed_regcomp((void *)reg, s, (toys.optflags & FLAG_r)*REG_EXTENDED);
           corwin->rmatch[i] = reg-toybuf;
-          reg += sizeof(regex_t);
+          reg += sizeof(struct sedregex);
         }
         free(s);
       } else break;
@@ -851,7 +959,7 @@ static void jewel_of_judgement(char **pline, long len)
       if (!(TT.remember = unescape_delimited_string(&line, &delim, 1)))
         goto brand;
 
-      reg += sizeof(regex_t);
+      reg += sizeof(struct sedregex);
       corwin->arg1 = reg-(char *)corwin;
       corwin->hit = delim;
 resume_s:
@@ -901,7 +1009,7 @@ resume_s:
       // We deferred actually parsing the regex until we had the s///i flag
       // allocating the space was done by extend_string() above
       if (!*TT.remember) corwin->arg1 = 0;
-      else xregcomp((void *)(corwin->arg1 + (char *)corwin), TT.remember,
+      else sed_regcomp((void *)(corwin->arg1 + (char *)corwin), TT.remember,
         ((toys.optflags & FLAG_r)*REG_EXTENDED)|((corwin->sflags&1)*REG_ICASE));
       free(TT.remember);
       TT.remember = 0;
@@ -1010,6 +1118,30 @@ brand:
   error_exit("bad pattern '%s'@%ld (%c)", errstart, line-errstart+1L, *line);
 }
 
+// Point branches at their labels and each { at its }, so running the
+// script doesn't have to go looking for them every time.
+static void resolve_jumps(void)
+{
+  struct step *step, *curly = 0, *label;
+  char *str;
+
+  for (step = (void *)TT.pattern; step; step = step->next) {
+    if (step->c == '{') {
+      step->jump = curly;
+      curly = step;
+    } else if (step->c == '}') {
+      label = curly;
+      curly = curly->jump;
+      label->jump = step;
+    } else if (strchr("btT", step->c) && step->arg1) {
+      str = step->arg1+(char *)step;
+      for (label = (void *)TT.pattern; label; label = label->next)
+        if (label->c == ':' && !strcmp(label->arg1+(char *)label, str)) break;
+      if (!(step->jump = label)) error_exit("no :%s", str);
+    }
+  }
+}
+
 void sed_main(void)
 {
   struct arg_list *dworkin;
@@ -1039,14 +1171,16 @@ void sed_main(void)
   jewel_of_judgement(0, 0);
   dlist_terminate(TT.pattern);
   if (TT.nextlen) error_exit("no }");  
+  resolve_jumps();
 
-  TT.fdout = 1;
+  TT.ofd = TT.fdout = 1;
   TT.remember = xstrdup("");
 
   // Inflict pattern upon input files
   loopfiles_rw(args, O_RDONLY, 0, 0, do_sed);
 
   if (!(toys.optflags & FLAG_i)) walk_pattern(0, 0);
+  if (sed_flush()) toys.exitval = 1;
 
   // todo: need to close fd when done for TOYBOX_FREE?
 }
@@ -32,5 +32,24 @@ void sleep_main(void)
   struct timespec tv;
 
   tv.tv_sec = xparsetime(*toys.optargs, 1000000000, &tv.tv_nsec);
+
+  // In a thread, wake up now and then to see if kill wants us gone.
+  if (CFG_TOYBOX_THREADS && toy_cancel) {
+    struct timespec slice = {0, 100000000};
+
+    while (tv.tv_sec || tv.tv_nsec > slice.tv_nsec) {
+      toy_cancelpoint();
+      if (nanosleep(&slice, NULL)) {
+        toys.exitval = 1;
+        return;
+      }
+      if (tv.tv_nsec >= slice.tv_nsec) tv.tv_nsec -= slice.tv_nsec;
+      else {
+        tv.tv_sec--;
+        tv.tv_nsec += 1000000000-slice.tv_nsec;
+      }
+    }
+    toy_cancelpoint();
+  }
   toys.exitval = !!nanosleep(&tv, NULL);
 }
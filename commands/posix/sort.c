@@ -4,7 +4,7 @@
  *
  * See http://opengroup.org/onlinepubs/007904975/utilities/sort.html
 
-USE_SORT(NEWTOY(sort, USE_SORT_FLOAT("g")USE_SORT_BIG("S:T:m" "o:k*t:xbMcszdfi") "run", TOYFLAG_USR|TOYFLAG_BIN))
+USE_SORT(NEWTOY(sort, USE_SORT_BIG("(unique-unordered)(parallel)#<1")USE_SORT_FLOAT("g")USE_SORT_BIG("S:T:m" "o:k*t:xbMcszdfi") "run", TOYFLAG_USR|TOYFLAG_BIN))
 
 config SORT
   bool "sort"
@@ -23,7 +23,7 @@ config SORT_BIG
   default y
   depends on SORT
   help
-    usage: sort [-bcdfiMsz] [-k#[,#[x]] [-t X]] [-o FILE]
+    usage: sort [-bcdfiMmsz] [-k#[,#[x]] [-t X]] [-o FILE] [-S SIZE] [-T DIR]
 
     -b	ignore leading blanks (or trailing blanks in second part of key)
     -c	check whether input is sorted
@@ -37,6 +37,12 @@ config SORT_BIG
     -k	sort by "key" (see below)
     -t	use a key separator other than whitespace
     -o	output to FILE instead of stdout
+    -m	merge already sorted files
+    -S	memory to sort in before spilling to temp files (default 1/4 of RAM)
+    -T	directory for temp files (default $TMPDIR or /tmp)
+    --parallel=N	sort with N threads
+    --unique-unordered	don't sort, output the first of each set of lines
+    			-u would call duplicates, in input order
 
     Sorting by key looks at a subset of the words on each line.  -k2
     uses the second word to the end of the line, -k2,2 looks at only
@@ -62,11 +68,14 @@ GLOBALS(
   char *key_separator;
   struct arg_list *raw_keys;
   char *outfile;
-  char *ignore1, ignore2;   // GNU compatability NOPs for -S and -T.
-
-  void *key_list;
-  int linecount;
-  char **lines;
+  char *tmpdir, *bufsize;
+  long parallel;
+
+  void *key_list, **lines, *last, **hash;
+  int nkeys, linecount, linemax, outfd, nruns, levelfd[16];
+  struct sort_run *runs;
+  long size, used, outlen, hashmask, hashcount;
+  char end;
 )
 
 // The sort types are n, g, and M.
@@ -83,20 +92,38 @@ struct sort_key
   int flags;
 };
 
-// Copy of the part of this string corresponding to a key/flags.
+// One key of one line, found (and for the numeric types, parsed) once when
+// the line is read instead of on every comparison. The text points into the
+// line unless -dfi had to edit a copy.
+struct key_data {
+  char *str;
+  long len;
+  union {
+    double d;
+    long long l;
+  } val;
+  char copy, bad;
+};
 
-static char *get_key_data(char *str, struct sort_key *key, int flags)
-{
-  int start=0, end, len, i, j;
+// A line and its keys, allocated together.
+struct sort_line {
+  char *str;
+  long len;
+  struct key_data key[];
+};
 
-  // Special case whole string, so we don't have to make a copy
+// Work out which part of this string corresponds to a key/flags.
 
-  if(key->range[0]==1 && !key->range[1] && !key->range[2] && !key->range[3]
-    && !(flags&(FLAG_b&FLAG_d&FLAG_f&FLAG_i&FLAG_bb))) return str;
+static void get_key_data(struct key_data *kd, char *str, long len,
+  struct sort_key *key, int flags)
+{
+  int start=0, end, i, j, ff = flags & (FLAG_n|FLAG_g|FLAG_M|FLAG_x);
+  char c, *s;
+
+  kd->copy = kd->bad = 0;
 
   // Find start of key on first pass, end on second pass
 
-  len = strlen(str);
   for (j=0; j<2; j++) {
     if (!key->range[2*j]) end=len;
 
@@ -109,7 +136,8 @@ static char *get_key_data(char *str, struct sort_key *key, int flags)
         if (str[end] && !TT.key_separator)
           while (isspace(str[end])) end++;
 
-        // Skip body of key
+        // Skip body of key (and the separator before it, if not the first)
+        if (TT.key_separator && i>1 && str[end]==*TT.key_separator) end++;
         for (; str[end]; end++) {
           if (TT.key_separator) {
             if (str[end]==*TT.key_separator) break;
@@ -136,29 +164,51 @@ static char *get_key_data(char *str, struct sort_key *key, int flags)
     start += key->range[1]-1;
     if (start>len) start=len;
   }
-
-  // Make the copy
   if (end<start) end=start;
-  str = xstrndup(str+start, end-start);
+  kd->str = str+start;
+  kd->len = end-start;
+
+  // Only -dfi need their own copy to edit
+  if (flags&(FLAG_d|FLAG_i|FLAG_f)) {
+    s = kd->str = xstrndup(kd->str, kd->len);
+    kd->copy++;
+
+    // Handle -d
+    if (flags&FLAG_d) {
+      for (start = end = 0; s[end]; end++)
+        if (isspace(s[end]) || isalnum(s[end])) s[start++] = s[end];
+      s[start] = 0;
+    }
 
-  // Handle -d
-  if (flags&FLAG_d) {
-    for (start = end = 0; str[end]; end++)
-      if (isspace(str[end]) || isalnum(str[end])) str[start++] = str[end];
-    str[start] = 0;
-  }
+    // Handle -i
+    if (flags&FLAG_i) {
+      for (start = end = 0; s[end]; end++)
+        if (isprint(s[end])) s[start++] = s[end];
+      s[start] = 0;
+    }
 
-  // Handle -i
-  if (flags&FLAG_i) {
-    for (start = end = 0; str[end]; end++)
-      if (isprint(str[end])) str[start++] = str[end];
-    str[start] = 0;
+    // Handle -f
+    if (flags&FLAG_f) for(i=0; s[i]; i++) s[i] = toupper(s[i]);
+    kd->len = strlen(s);
   }
+  if (!ff) return;
 
-  // Handle -f
-  if (flags*FLAG_f) for(i=0; str[i]; i++) str[i] = toupper(str[i]);
+  // Parse the value with the key temporarily null terminated, so the number
+  // can't run on into the next field.
+  c = kd->str[kd->len];
+  kd->str[kd->len] = 0;
+  if (CFG_SORT_FLOAT && ff == FLAG_g) {
+    kd->val.d = strtod(kd->str, &s);
+    kd->bad = (s == kd->str);
+  } else if (CFG_SORT_BIG && ff == FLAG_M) {
+    struct tm thyme;
 
-  return str;
+    kd->bad = !strptime(kd->str, "%b", &thyme);
+    kd->val.l = thyme.tm_mon;
+  } else if (CFG_SORT_BIG && ff == FLAG_x) kd->val.l = strtol(kd->str, 0, 16);
+  else if (CFG_SORT_FLOAT) kd->val.d = atof(kd->str);
+  else kd->val.l = atoi(kd->str);
+  kd->str[kd->len] = c;
 }
 
 // append a sort_key to key_list.
@@ -168,27 +218,72 @@ static struct sort_key *add_key(void)
   void **stupid_compiler = &TT.key_list;
   struct sort_key **pkey = (struct sort_key **)stupid_compiler;
 
+  TT.nkeys++;
   while (*pkey) pkey = &((*pkey)->next_key);
   return *pkey = xzalloc(sizeof(struct sort_key));
 }
 
+// Make a sort_line out of len bytes of str, extracting all its keys.
+static struct sort_line *new_line(char *str, long len)
+{
+  struct sort_line *sl;
+  struct sort_key *key;
+  int i;
+
+  // Lines end at the first NUL, same as they always did
+  len = strnlen(str, len);
+  sl = xmalloc(sizeof(struct sort_line)+TT.nkeys*sizeof(struct key_data)
+    +len+1);
+  sl->str = (char *)(sl->key+TT.nkeys);
+  memcpy(sl->str, str, len);
+  sl->str[sl->len = len] = 0;
+  for (key = TT.key_list, i = 0; key; key = key->next_key, i++)
+    get_key_data(sl->key+i, sl->str, len, key,
+      key->flags ? key->flags : (int)toys.optflags);
+
+  return sl;
+}
+
+// Memory a line in TT.lines costs: the pointer and malloc overhead count
+// too, it adds up for short lines.
+static long line_size(struct sort_line *sl)
+{
+  return sizeof(*sl)+TT.nkeys*sizeof(struct key_data)+sl->len+1
+    +3*sizeof(void *);
+}
+
+static void free_line(struct sort_line *sl)
+{
+  int i;
+
+  for (i = 0; i<TT.nkeys; i++) if (sl->key[i].copy) free(sl->key[i].str);
+  free(sl);
+}
+
+// Byte order, like strcmp() but with the lengths we already know.
+static int compare_bytes(char *x, long xlen, char *y, long ylen)
+{
+  int rc = memcmp(x, y, xlen<ylen ? xlen : ylen);
+
+  return rc ? rc : (xlen>ylen)-(xlen<ylen);
+}
+
 // Perform actual comparison
-static int compare_values(int flags, char *x, char *y)
+static int compare_values(int flags, struct key_data *x, struct key_data *y)
 {
   int ff = flags & (FLAG_n|FLAG_g|FLAG_M|FLAG_x);
 
   // Ascii sort
-  if (!ff) return strcmp(x, y);
+  if (!ff) return compare_bytes(x->str, x->len, y->str, y->len);
 
   if (CFG_SORT_FLOAT && ff == FLAG_g) {
-    char *xx,*yy;
-    double dx = strtod(x,&xx), dy = strtod(y,&yy);
+    double dx = x->val.d, dy = y->val.d;
     int xinf, yinf;
 
     // not numbers < NaN < -infinity < numbers < +infinity
 
-    if (x==xx) return y==yy ? 0 : -1;
-    if (y==yy) return 1;
+    if (x->bad) return y->bad ? 0 : -1;
+    if (y->bad) return 1;
 
     // Check for isnan
     if (dx!=dx) return (dy!=dy) ? 0 : -1;
@@ -205,104 +300,628 @@ static int compare_values(int flags, char *x, char *y)
 
     return dx>dy ? 1 : (dx<dy ? -1 : 0);
   } else if (CFG_SORT_BIG && ff == FLAG_M) {
-    struct tm thyme;
-    int dx;
-    char *xx,*yy;
-
-    xx = strptime(x,"%b",&thyme);
-    dx = thyme.tm_mon;
-    yy = strptime(y,"%b",&thyme);
-    if (!xx) return !yy ? 0 : -1;
-    else if (!yy) return 1;
-    else return dx==thyme.tm_mon ? 0 : dx-thyme.tm_mon;
-
-  } else if (CFG_SORT_BIG && ff == FLAG_x) {
-    return strtol(x, NULL, 16)-strtol(y, NULL, 16);
-  // This has to be ff == FLAG_n
-  } else {
+    if (x->bad) return y->bad ? 0 : -1;
+    else if (y->bad) return 1;
+  } else if (CFG_SORT_FLOAT && !(CFG_SORT_BIG && ff == FLAG_x)) {
     // Full floating point version of -n
-    if (CFG_SORT_FLOAT) {
-      double dx = atof(x), dy = atof(y);
+    double dx = x->val.d, dy = y->val.d;
 
-      return dx>dy ? 1 : (dx<dy ? -1 : 0);
-    // Integer version of -n for tiny systems
-    } else return atoi(x)-atoi(y);
+    return dx>dy ? 1 : (dx<dy ? -1 : 0);
   }
+
+  // Month, hex, and integer version of -n for tiny systems
+  return (x->val.l>y->val.l)-(x->val.l<y->val.l);
 }
 
-// Callback from qsort(): Iterate through key_list and perform comparisons.
-static int compare_keys(const void *xarg, const void *yarg)
+// Iterate through key_list and perform comparisons.
+static int compare_lines(struct sort_line *x, struct sort_line *y)
 {
-  int flags = toys.optflags, retval = 0;
-  char *x, *y, *xx = *(char **)xarg, *yy = *(char **)yarg;
+  int flags = toys.optflags, retval = 0, i;
   struct sort_key *key;
 
-  if (CFG_SORT_BIG) {
-    for (key=(struct sort_key *)TT.key_list; !retval && key;
-       key = key->next_key)
-    {
-      flags = key->flags ? key->flags : (int)toys.optflags;
+  for (key = TT.key_list, i = 0; key; key = key->next_key, i++) {
+    flags = key->flags ? key->flags : (int)toys.optflags;
+    if ((retval = compare_values(flags, x->key+i, y->key+i))) break;
+  }
+
+  // Perform fallback sort if necessary
+  if (!retval && !(CFG_SORT_BIG && (toys.optflags&FLAG_s))) {
+    retval = compare_bytes(x->str, x->len, y->str, y->len);
+    flags = toys.optflags;
+  }
+
+  return retval * ((flags&FLAG_r) ? -1 : 1);
+}
 
-      // Chop out and modify key chunks, handling -dfib
+// Callback from qsort()
+static int compare_keys(const void *xarg, const void *yarg)
+{
+  return compare_lines(*(struct sort_line **)xarg, *(struct sort_line **)yarg);
+}
 
-      x = get_key_data(xx, key, flags);
-      y = get_key_data(yy, key, flags);
+// Sorting the whole line in byte order (no -k, no flags but -ruz) doesn't
+// need compare_lines() at all: MSD radix sort on the line's bytes. Groups
+// left to sort go on a heap allocated stack so long shared prefixes can't
+// run us out of (thread) stack.
+static int radix_ok(void)
+{
+  struct sort_key *key = TT.key_list;
 
-      retval = compare_values(flags, x, y);
+  return !key->next_key && key->range[0]==1 && !key->range[1]
+    && !key->range[2] && !key->range[3]
+    && !((key->flags|toys.optflags)
+         & ~(FLAG_r|FLAG_u|FLAG_z|FLAG_s|FLAG_t|FLAG_o|FLAG_S|FLAG_T|FLAG_m
+            |FLAG_parallel));
+}
 
-      // Free the copies get_key_data() made.
+static void sort_radix(struct sort_line **lines, long count)
+{
+  struct sort_line **tmp = xmalloc(sizeof(*tmp)*count), *t;
+  struct { long start, count, depth; } *todo = 0;
+  long i, j, c, start, depth, bucket[257], pos[257], ntodo = 0, maxtodo = 0;
 
-      if (x != xx) free(x);
-      if (y != yy) free(y);
+  for (;;) {
+    if (!count) {
+      if (!ntodo) break;
+      ntodo--;
+      start = todo[ntodo].start;
+      count = todo[ntodo].count;
+      depth = todo[ntodo].depth;
+    } else start = depth = 0;
+
+    // Insertion sort small groups on the rest of the string
+    if (count<32) {
+      for (i = start+1; i<start+count; i++) {
+        for (t = lines[i], j = i; j>start; j--) {
+          if (0>=strcmp(lines[j-1]->str+depth, t->str+depth)) break;
+          lines[j] = lines[j-1];
+        }
+        lines[j] = t;
+      }
+      count = 0;
+      continue;
+    }
 
-      if (retval) break;
+    // Count lines by byte at depth (0 for lines that ended), then distribute
+    memset(bucket, 0, sizeof(bucket));
+    for (i = start; i<start+count; i++)
+      bucket[(unsigned char)lines[i]->str[depth]]++;
+    for (c = 0, j = 0; c<256; c++) pos[c] = j, j += bucket[c];
+    for (i = start; i<start+count; i++)
+      tmp[pos[(unsigned char)lines[i]->str[depth]]++] = lines[i];
+    memcpy(lines+start, tmp, sizeof(*tmp)*count);
+
+    // Lines that ended are done (and identical), the rest go on the pile
+    for (j = start+bucket[0], c = 1; c<256; j += bucket[c++]) {
+      if (bucket[c]<2) continue;
+      if (ntodo == maxtodo)
+        todo = xrealloc(todo, sizeof(*todo)*(maxtodo = maxtodo*2+64));
+      todo[ntodo].start = j;
+      todo[ntodo].count = bucket[c];
+      todo[ntodo++].depth = depth+1;
     }
-  } else retval = compare_values(flags, xx, yy);
+    count = 0;
+  }
+  free(todo);
+  free(tmp);
+}
 
-  // Perform fallback sort if necessary
-  if (!retval && !(CFG_SORT_BIG && (toys.optflags&FLAG_s))) {
-    retval = strcmp(xx, yy);
-    flags = toys.optflags;
+// Bytes of output buffered in toybuf. Flush when s is NULL.
+static void sort_out(char *s, long len)
+{
+  if (!s || TT.outlen+len+1 > (long)sizeof(toybuf)) {
+    txwrite(TT.outfd, toybuf, TT.outlen);
+    TT.outlen = 0;
+  }
+  if (!s) return;
+  if (len+1 > (long)sizeof(toybuf)) {
+    txwrite(TT.outfd, s, len);
+    txwrite(TT.outfd, &TT.end, 1);
+  } else {
+    memcpy(toybuf+TT.outlen, s, len);
+    toybuf[TT.outlen+len] = TT.end;
+    TT.outlen += len+1;
   }
+}
 
-  return retval * ((flags&FLAG_r) ? -1 : 1);
+// Output a line unless -u and it matches the previous one. Frees the line
+// (or keeps it as the one to match next).
+static void sort_emit(struct sort_line *sl)
+{
+  if (toys.optflags&FLAG_u) {
+    if (TT.last && !compare_lines(TT.last, sl)) {
+      free_line(sl);
+      return;
+    }
+    if (TT.last) free_line(TT.last);
+    TT.last = sl;
+  }
+  sort_out(sl->str, sl->len);
+  if (sl != TT.last) free_line(sl);
+}
+
+// Start (or finish) writing sorted output to fd.
+static void sort_output(int fd)
+{
+  if (TT.outlen) sort_out(0, 0);
+  if (TT.last) free_line(TT.last);
+  TT.last = 0;
+  TT.outfd = fd;
+}
+
+static int sort_tempfile(void)
+{
+  char *dir = TT.tmpdir ? TT.tmpdir : getenv("TMPDIR"),
+       *name = xmprintf("%s/sortXXXXXX", dir ? dir : "/tmp");
+  int fd = mkstemp(name);
+
+  if (fd == -1) perror_exit("%s", name);
+  unlink(name);
+  free(name);
+
+  return fd;
+}
+
+// A sorted run to merge: all of fd (len -1, for -m), or len bytes of it from
+// off. Spilled runs of each level share one temp file, see sort_spilled().
+struct sort_run {
+  long long off, len;
+  int fd, level;
+};
+
+// Add a run after the rest (ties go to the earlier run), starting at fd's
+// current offset.
+static struct sort_run *sort_addrun(int fd, int level)
+{
+  struct sort_run *run;
+
+  if (!(TT.nruns&15))
+    TT.runs = xrealloc(TT.runs, sizeof(struct sort_run)*(TT.nruns+16));
+  run = TT.runs+TT.nruns++;
+  run->fd = fd;
+  run->level = level;
+  run->off = level<0 ? 0 : lseek(fd, 0, SEEK_CUR);
+  run->len = -1;
+
+  return run;
+}
+
+// Start writing a new run at the end of the temp file for level, opening
+// it on first use (TT.levelfd holds fd+1 so 0 is unopened).
+static struct sort_run *sort_startrun(int level)
+{
+  struct sort_run *run;
+
+  if (level >= ARRAY_LEN(TT.levelfd)) error_exit("too many runs");
+  if (!TT.levelfd[level]) TT.levelfd[level] = sort_tempfile()+1;
+  sort_output((run = sort_addrun(TT.levelfd[level]-1, level))->fd);
+
+  return run;
+}
+
+static void sort_endrun(struct sort_run *run)
+{
+  sort_output(-1);
+  run->len = lseek(run->fd, 0, SEEK_CUR)-run->off;
+}
+
+// Merge sorted a[0..na) and a[na..na+nb) into out. Ties go to the left.
+static void sort_merge2(struct sort_line **a, long na, long nb,
+  struct sort_line **out)
+{
+  struct sort_line **b = a+na;
+  long i = 0, j = 0;
+
+  while (i<na && j<nb) *out++ = compare_lines(b[j], a[i])<0 ? b[j++] : a[i++];
+  memcpy(out, a+i, sizeof(*a)*(na-i));
+  memcpy(out+na-i, b+j, sizeof(*b)*(nb-j));
+}
+
+// Merge sort (qsort() isn't stable, and -s should be).
+static void sort_stable(struct sort_line **lines, struct sort_line **tmp,
+  long count)
+{
+  long half = count/2, i, j;
+  struct sort_line *t;
+
+  if (count<16) {
+    for (i = 1; i<count; i++) {
+      for (t = lines[i], j = i; j && compare_lines(lines[j-1], t)>0; j--)
+        lines[j] = lines[j-1];
+      lines[j] = t;
+    }
+    return;
+  }
+  sort_stable(lines, tmp, half);
+  sort_stable(lines+half, tmp, count-half);
+  sort_merge2(lines, half, count-half, tmp);
+  memcpy(lines, tmp, sizeof(*lines)*count);
+}
+
+// Sort one chunk of lines.
+static void sort_chunk(struct sort_line **lines, long count)
+{
+  struct sort_line **tmp, *t;
+  long idx;
+
+  if (radix_ok()) {
+    sort_radix(lines, count);
+    if (toys.optflags&FLAG_r) for (idx = 0; idx<count/2; idx++) {
+      t = lines[idx];
+      lines[idx] = lines[count-1-idx];
+      lines[count-1-idx] = t;
+    }
+  } else if (CFG_SORT_BIG && (toys.optflags&FLAG_s)) {
+    tmp = xmalloc(sizeof(*tmp)*count);
+    sort_stable(lines, tmp, count);
+    free(tmp);
+  } else qsort(lines, count, sizeof(*lines), compare_keys);
+}
+
+#if CFG_TOYBOX_THREADS
+// --parallel: sort N chunks at once, then merge neighbouring pairs at once
+// until there's one left. Workers run in a copy of this command's context
+// (see toy_worker_create()) so compare_lines() sees the same keys and
+// flags, but an error_exit() in one only ends that thread, and the caller
+// exits once they're all back.
+
+struct sort_job {
+  pthread_t tid;
+  struct sort_line **lines, **out;
+  long count, count2;
+  int started;
+};
+
+static void sort_job(struct sort_job *job)
+{
+  if (!job->out) sort_chunk(job->lines, job->count);
+  else sort_merge2(job->lines, job->count, job->count2, job->out);
+}
+
+static void *sort_worker(void *arg)
+{
+  sort_job(arg);
+
+  return 0;
+}
+
+// Run jobs, all but the first in their own threads.
+static void sort_jobs(struct sort_job *jobs, int n)
+{
+  pthread_attr_t attr;
+  jmp_buf rebound, *old = toys.rebound;
+  int i, exitval = toys.exitval;
+
+  toys.exitval = 0;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+  for (i = 1; i<n; i++)
+    jobs[i].started = !toy_worker_create(&jobs[i].tid, &attr, sort_worker,
+      jobs+i);
+  pthread_attr_destroy(&attr);
+
+  // Whatever didn't get a thread (including job 0) runs here, and waits for
+  // the rest even if it fails.
+  toys.rebound = &rebound;
+  if (!setjmp(rebound))
+    for (i = 0; i<n; i++) if (!jobs[i].started) sort_job(jobs+i);
+  toys.rebound = old;
+  for (i = 1; i<n; i++) if (jobs[i].started) pthread_join(jobs[i].tid, 0);
+  if (toys.exitval) xexit();
+  toys.exitval = exitval;
+}
+
+static void sort_parallel(struct sort_line **lines, long count, int n)
+{
+  struct sort_job *jobs = xzalloc(sizeof(struct sort_job)*n);
+  struct sort_line **orig = lines, **buf = xmalloc(sizeof(*buf)*count),
+    **tmp = buf, **swap;
+  long *start = xmalloc(sizeof(long)*(n+1));
+  int i, j;
+
+  for (i = 0; i<=n; i++) start[i] = count*i/n;
+  for (i = 0; i<n; i++) {
+    jobs[i].lines = lines+start[i];
+    jobs[i].count = start[i+1]-start[i];
+  }
+  sort_jobs(jobs, n);
+
+  // Merge pairs of neighbouring chunks until there's one, ping-ponging
+  // between lines and tmp. An odd chunk out is copied across as is.
+  while (n>1) {
+    memset(jobs, 0, sizeof(struct sort_job)*n);
+    for (i = j = 0; i<n; i += 2, j++) {
+      jobs[j].lines = lines+start[i];
+      jobs[j].out = tmp+start[i];
+      jobs[j].count = start[i+1]-start[i];
+      jobs[j].count2 = (i+1<n) ? start[i+2]-start[i+1] : 0;
+      start[j] = start[i];
+    }
+    start[j] = count;
+    sort_jobs(jobs, n = j);
+    swap = lines;
+    lines = tmp;
+    tmp = swap;
+  }
+  if (lines != orig) memcpy(orig, lines, sizeof(*lines)*count);
+  free(buf);
+  free(jobs);
+  free(start);
+}
+#endif
+
+static void sort_spilled(void);
+
+// Sort the lines in memory, and if spill write them out as another run.
+static void sort_lines(int spill)
+{
+  struct sort_line **lines = (void *)TT.lines;
+  struct sort_run *run;
+  long idx;
+
+#if CFG_TOYBOX_THREADS
+  // Not worth a thread for fewer than a few thousand lines each
+  idx = TT.parallel<TT.linecount/4096 ? TT.parallel : TT.linecount/4096;
+  if (idx>1) sort_parallel(lines, TT.linecount, idx);
+  else
+#endif
+  sort_chunk(lines, TT.linecount);
+
+  // With -u only the first of each set of equal lines matters, and if
+  // getting rid of the rest freed enough there's no need to spill yet.
+  if (toys.optflags&FLAG_u) {
+    long i;
+
+    for (idx = i = 0; i<TT.linecount; i++) {
+      if (idx && !compare_lines(lines[idx-1], lines[i])) {
+        TT.used -= line_size(lines[i]);
+        free_line(lines[i]);
+      } else lines[idx++] = lines[i];
+    }
+    TT.linecount = idx;
+    if (spill && TT.used<=TT.size/2) return;
+  }
+  if (!spill) return;
+
+  run = sort_startrun(0);
+  for (idx = 0; idx<TT.linecount; idx++) sort_emit(lines[idx]);
+  sort_endrun(run);
+  TT.linecount = TT.used = 0;
+  sort_spilled();
+}
+
+// One input to a merge: a sorted run, or the sorted lines still in memory
+// (fd -1). Order breaks ties so equal lines come out in input order.
+struct sort_src {
+  struct linebuf lb;
+  struct sort_line *line;
+  long idx;
+  int order;
+};
+
+static struct sort_line *sort_next(struct sort_src *src)
+{
+  struct sort_line **lines = (void *)TT.lines;
+  char *s;
+  long len;
+
+  if (src->lb.fd == -1)
+    return src->line = src->idx<TT.linecount ? lines[src->idx++] : 0;
+  if (!(s = get_linebuf(&src->lb, &len, TT.end, LINEBUF_CHOMP)))
+    return src->line = 0;
+
+  return src->line = new_line(s, len);
+}
+
+static int sort_less(struct sort_src *a, struct sort_src *b)
+{
+  int rc = compare_lines(a->line, b->line);
+
+  return rc ? rc<0 : a->order<b->order;
+}
+
+// Move heap[i] down to where it belongs in a heap of n entries.
+static void sort_sift(struct sort_src **heap, int n, int i)
+{
+  struct sort_src *t = heap[i];
+  int j;
+
+  while ((j = 2*i+1)<n) {
+    if (j+1<n && sort_less(heap[j+1], heap[j])) j++;
+    if (!sort_less(heap[j], t)) break;
+    heap[i] = heap[j];
+    i = j;
+  }
+  heap[i] = t;
+}
+
+// Merge count sorted runs (plus the lines in memory if mem) to TT.outfd,
+// with a binary heap keyed on each source's current line. Closes the fds
+// of whole file runs.
+static void sort_merge(struct sort_run *runs, int count, int mem)
+{
+  struct sort_src *src = xzalloc(sizeof(struct sort_src)*(count+1)),
+    **heap = xmalloc(sizeof(struct sort_src *)*(count+1));
+  int i, n = 0;
+
+  for (i = 0; i<count+mem; i++) {
+    if (i>=count) src[i].lb.fd = -1;
+    else if (runs[i].len<0) linebuf_init(&src[i].lb, runs[i].fd);
+    else linebuf_range(&src[i].lb, runs[i].fd, runs[i].off, runs[i].len);
+    src[i].order = i;
+    if (sort_next(src+i)) heap[n++] = src+i;
+  }
+  for (i = n/2; i--;) sort_sift(heap, n, i);
+
+  while (n) {
+    sort_emit(heap[0]->line);
+    if (!sort_next(heap[0])) heap[0] = heap[--n];
+    if (n) sort_sift(heap, n, 0);
+  }
+  if (mem) TT.linecount = 0;
+
+  for (i = 0; i<count; i++) {
+    linebuf_done(&src[i].lb);
+    if (runs[i].len<0 && runs[i].fd != fileno(stdin)) close(runs[i].fd);
+  }
+  free(src);
+  free(heap);
+}
+
+// Spilled runs are merged SORT_FANIN at a time, and only runs next to each
+// other so -u and ties stay in input order.
+#define SORT_FANIN 16
+
+// After each spill, once there are SORT_FANIN runs of one level merge them
+// into a run a level up, like carrying a digit. They were all the runs in
+// that level's temp file, so it starts over empty. This keeps one fd open
+// per level, and each line is merged once a level.
+static void sort_spilled(void)
+{
+  struct sort_run merging[SORT_FANIN], *run;
+  int level, fd;
+
+  while (TT.nruns >= SORT_FANIN) {
+    run = TT.runs+TT.nruns-SORT_FANIN;
+    if ((level = run->level)<0 || run[SORT_FANIN-1].level != level) break;
+    memcpy(merging, run, sizeof(merging));
+    TT.nruns -= SORT_FANIN;
+    run = sort_startrun(level+1);
+    sort_merge(merging, SORT_FANIN, 0);
+    sort_endrun(run);
+    if (ftruncate(fd = TT.levelfd[level]-1, 0)) perror_exit("ftruncate");
+    lseek(fd, 0, SEEK_SET);
+  }
+}
+
+// --unique-unordered keeps the first of each set of lines compare_lines()
+// calls equal in a hash table, so the hash covers what it looks at.
+static unsigned hash_bytes(unsigned h, void *p, long len)
+{
+  unsigned char *s = p;
+
+  while (len--) h = h*33+*s++;
+
+  return h;
+}
+
+static unsigned hash_line(struct sort_line *sl)
+{
+  struct sort_key *key;
+  struct key_data *kd;
+  unsigned h = 5381;
+  double d;
+  int i, ff;
+
+  for (key = TT.key_list, i = 0; key; key = key->next_key, i++) {
+    kd = sl->key+i;
+    ff = (key->flags ? key->flags : (int)toys.optflags)
+      & (FLAG_n|FLAG_g|FLAG_M|FLAG_x);
+    if (!ff) h = hash_bytes(h, kd->str, kd->len);
+    else if (kd->bad) h = h*33+1;
+    else if (CFG_SORT_FLOAT && ff != FLAG_M && ff != FLAG_x) {
+      // All NaNs compare equal, and so do 0 and -0
+      d = kd->val.d;
+      if (d != d) h = h*33+2;
+      else {
+        if (!d) d = 0;
+        h = hash_bytes(h, &d, sizeof(d));
+      }
+    } else h = hash_bytes(h, &kd->val.l, sizeof(kd->val.l));
+  }
+  if (!(CFG_SORT_BIG && (toys.optflags&FLAG_s)))
+    h = hash_bytes(h, sl->str, sl->len);
+
+  return h;
+}
+
+// Add the line to the table unless there's already one equal to it.
+// Returns 1 if it went in.
+static int hash_add(struct sort_line *sl)
+{
+  struct sort_line **hash = (void *)TT.hash, **old = hash;
+  long i, j;
+
+  // Keep it at most 3/4 full
+  if (TT.hashcount*4 >= TT.hashmask*3) {
+    j = TT.hashmask;
+    TT.hashmask = j ? j*2+1 : 1023;
+    TT.hash = (void *)(hash = xzalloc(sizeof(*hash)*(TT.hashmask+1)));
+    if (j) for (j++; j--;) if (old[j]) {
+      for (i = hash_line(old[j])&TT.hashmask; hash[i]; i = (i+1)&TT.hashmask);
+      hash[i] = old[j];
+    }
+    free(old);
+  }
+  for (i = hash_line(sl)&TT.hashmask; hash[i]; i = (i+1)&TT.hashmask)
+    if (!compare_lines(hash[i], sl)) return 0;
+  hash[i] = sl;
+  TT.hashcount++;
+
+  return 1;
 }
 
 // Callback from loopfiles to handle input files.
 static void sort_read(int fd, char *name)
 {
-  // Read each line from file, appending to a big array.
+  struct linebuf lb;
+  struct sort_line *sl;
+  char *line;
+  long len;
 
-  for (;;) {
-    char * line = (CFG_SORT_BIG && (toys.optflags&FLAG_z))
-             ? get_rawline(fd, NULL, 0) : get_line(fd);
+  // Read each line from file, appending to a big array.
 
-    if (!line) break;
+  linebuf_init(&lb, fd);
+  while ((line = get_linebuf(&lb, &len, TT.end, LINEBUF_CHOMP))) {
+    sl = new_line(line, len);
 
     // handle -c here so we don't allocate more memory than necessary.
     if (CFG_SORT_BIG && (toys.optflags&FLAG_c)) {
       int j = (toys.optflags&FLAG_u) ? -1 : 0;
 
-      if (TT.lines && compare_keys((void *)&TT.lines, &line)>j)
+      if (TT.last && compare_lines(TT.last, sl)>j)
         error_exit("%s: Check line %d\n", name, TT.linecount);
-      free(TT.lines);
-      TT.lines = (char **)line;
+      if (TT.last) free_line(TT.last);
+      TT.last = sl;
+      TT.linecount++;
+
+    // --unique-unordered writes each new line out as soon as it's seen,
+    // or with -o (which may be one of the inputs) saves them for later.
+    } else if (CFG_SORT_BIG && (toys.optflags&FLAG_unique_unordered)) {
+      if (!hash_add(sl)) free_line(sl);
+      else if (!TT.outfile) sort_out(sl->str, sl->len);
+      else {
+        if (TT.linecount == TT.linemax)
+          TT.lines = xrealloc(TT.lines,
+            sizeof(void *)*(TT.linemax = TT.linemax*2+64));
+        TT.lines[TT.linecount++] = sl;
+      }
     } else {
-      if (!(TT.linecount&63))
-        TT.lines = xrealloc(TT.lines, sizeof(char *)*(TT.linecount+64));
-      TT.lines[TT.linecount] = line;
+      if (TT.linecount == TT.linemax)
+        TT.lines = xrealloc(TT.lines,
+          sizeof(void *)*(TT.linemax = TT.linemax*2+64));
+      TT.lines[TT.linecount++] = sl;
+      TT.used += line_size(sl);
+      if (TT.size && TT.used>TT.size) sort_lines(1);
     }
-    TT.linecount++;
   }
+  linebuf_done(&lb);
 }
 
 void sort_main(void)
 {
-  int idx, fd = 1;
+  int idx, fd = fileno(stdout);
 
-  // Open output file if necessary.
-  if (CFG_SORT_BIG && TT.outfile)
-    fd = xcreate(TT.outfile, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+  TT.end = (CFG_SORT_BIG && (toys.optflags&FLAG_z)) ? 0 : '\n';
+  if (CFG_SORT_BIG && TT.bufsize)
+    TT.size = atolx_range(TT.bufsize, 1, LONG_MAX);
+#ifdef _SC_PHYS_PAGES
+  else if (CFG_SORT_BIG) {
+    long pages = sysconf(_SC_PHYS_PAGES), pagesize = sysconf(_SC_PAGESIZE);
+
+    if (pages>0 && pagesize>0) TT.size = pages/4*pagesize;
+  }
+#endif
 
   // Parse -k sort keys.
   if (CFG_SORT_BIG && TT.raw_keys) {
@@ -323,7 +942,7 @@ void sort_main(void)
 
         // Handle flags appended to a key type.
         for (;*temp;temp++) {
-          char *temp2, *optlist;
+          char *keyflags = "bdfgiMnr", *temp2;
 
           // Note that a second comma becomes an "Unknown key" error.
 
@@ -332,16 +951,12 @@ void sort_main(void)
             break;
           }
 
-          // Which flag is this?
-
-          optlist = toys.which->options;
-          temp2 = strchr(optlist, *temp);
-          flag = (1<<(optlist-temp2+strlen(optlist)-1));
+          // Is it a flag that can apply to a key? Not looked up in the
+          // option string, whose long names have letters too.
 
-          // Was it a flag that can apply to a key?
-
-          if (!temp2 || flag>FLAG_b
-            || (flag&(FLAG_u|FLAG_c|FLAG_s|FLAG_z)))
+          if (!(temp2 = strchr(keyflags, *temp))
+            || !(flag = (int []){FLAG_b, FLAG_d, FLAG_f, FLAG_g, FLAG_i,
+              FLAG_M, FLAG_n, FLAG_r}[temp2-keyflags]))
           {
             error_exit("Unknown key option.");
           }
@@ -357,43 +972,72 @@ void sort_main(void)
   if (toys.optflags&FLAG_b) toys.optflags |= FLAG_bb;
 
   // If no keys, perform alphabetic sort over the whole line.
-  if (CFG_SORT_BIG && !TT.key_list) add_key()->range[0] = 1;
-
-  // Open input files and read data, populating TT.lines[TT.linecount]
-  loopfiles(toys.optargs, sort_read);
+  if (!TT.key_list) add_key()->range[0] = 1;
+
+  // With -m the inputs are already sorted runs, otherwise read them into
+  // TT.lines[TT.linecount], spilling sorted runs to temp files as it fills.
+  TT.outfd = fd;
+  if (CFG_SORT_BIG && (toys.optflags&FLAG_m)
+    && !(toys.optflags&(FLAG_c|FLAG_unique_unordered)))
+  {
+    char *dash[] = {"-", 0}, **arg = *toys.optargs ? toys.optargs : dash;
+    struct stat st, ost;
+    int out = TT.outfile && !stat(TT.outfile, &ost), tmp;
+
+    for (; *arg; arg++) {
+      if (!strcmp(*arg, "-")) fd = fileno(stdin);
+      else if (-1 == (fd = open(*arg, O_RDONLY|O_CLOEXEC))) {
+        perror_msg("%s", *arg);
+        continue;
+      }
+      // An input that is also the -o file gets truncated before it's read,
+      // so merge a copy of it instead.
+      if (out && !fstat(fd, &st) && st.st_dev==ost.st_dev
+        && st.st_ino==ost.st_ino)
+      {
+        xsendfile(fd, tmp = sort_tempfile());
+        if (fd != fileno(stdin)) close(fd);
+        xlseek(fd = tmp, 0, SEEK_SET);
+      }
+      sort_addrun(fd, -1);
+    }
+  } else loopfiles(toys.optargs, sort_read);
 
   // The compare (-c) logic was handled in sort_read(),
   // so if we got here, we're done.
   if (CFG_SORT_BIG && (toys.optflags&FLAG_c)) goto exit_now;
 
-  // Perform the actual sort
-  qsort(TT.lines, TT.linecount, sizeof(char *), compare_keys);
-
-  // handle unique (-u)
-  if (toys.optflags&FLAG_u) {
-    int jdx;
+  // Open output file now the input's all read, so sort -o can overwrite
+  // one of its inputs.
+  fd = fileno(stdout);
+  if (CFG_SORT_BIG && TT.outfile)
+    fd = xcreate(TT.outfile, O_CREAT|O_TRUNC|O_WRONLY, 0666);
 
-    for (jdx=0, idx=1; idx<TT.linecount; idx++) {
-      if (!compare_keys(&TT.lines[jdx], &TT.lines[idx]))
-        free(TT.lines[idx]);
-      else TT.lines[++jdx] = TT.lines[idx];
-    }
-    if (TT.linecount) TT.linecount = jdx+1;
+  // The first of each line, in input order, is all --unique-unordered wants.
+  if (CFG_SORT_BIG && (toys.optflags&FLAG_unique_unordered)) {
+    sort_output(fd);
+    for (idx = 0; idx<TT.linecount; idx++)
+      sort_out(((struct sort_line *)TT.lines[idx])->str,
+        ((struct sort_line *)TT.lines[idx])->len);
+    sort_output(-1);
+    goto exit_now;
   }
 
-  // Output result
-  for (idx = 0; idx<TT.linecount; idx++) {
-    char *s = TT.lines[idx];
-    unsigned i = strlen(s);
-
-    if (!(toys.optflags&FLAG_z)) s[i] = '\n';
-    txwrite(fd, s, i+1);
-    if (CFG_TOYBOX_FREE) free(s);
-  }
+  // Sort what's left in memory and merge it with any runs on the way out.
+  // That's under SORT_FANIN runs a level, or -m's already open inputs.
+  sort_lines(0);
+  sort_output(fd);
+  sort_merge(TT.runs, TT.nruns, !(toys.optflags&FLAG_m));
+  sort_output(-1);
 
 exit_now:
   if (CFG_TOYBOX_FREE) {
-    if (fd != 1) close(fd);
+    if (TT.last) free_line(TT.last);
+    if (fd != fileno(stdout)) close(fd);
     free(TT.lines);
+    for (idx = 0; idx<ARRAY_LEN(TT.levelfd); idx++)
+      if (TT.levelfd[idx]) close(TT.levelfd[idx]-1);
+    free(TT.runs);
+    free(TT.hash);
   }
 }
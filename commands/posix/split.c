@@ -7,14 +7,15 @@
  * Standard does not cover:
  * - should splitting an empty file produce an empty outfile? (Went with "no".)
  * - permissions on output file
+ * - -n and --parallel aren't in posix
 
-USE_SPLIT(NEWTOY(split, ">2a#<1=2>9b#<1l#<1", TOYFLAG_USR|TOYFLAG_BIN))
+USE_SPLIT(NEWTOY(split, ">2(parallel)a#<1=2>9b#<1l#<1n#<1", TOYFLAG_USR|TOYFLAG_BIN))
 
 config SPLIT
   bool "split"
   default y
   help
-    usage: split [-a SUFFIX_LEN] [-b BYTES] [-l LINES] [INPUT [OUTPUT]]
+    usage: split [-a SUFFIX_LEN] [-b BYTES] [-l LINES] [-n N [--parallel]] [INPUT [OUTPUT]]
 
     Copy INPUT (or stdin) data to a series of OUTPUT (or "x") files with
     alphabetically increasing suffix (aa, ab, ac... az, ba, bb...).
@@ -22,12 +23,15 @@ config SPLIT
     -a	Suffix length (default 2)
     -b	BYTES/file (10, 10k, 10m, 10g...)
     -l	LINES/file (default 1000)
+    -n	N files of equal size (INPUT must be a regular file)
+    --parallel	Write the -n files at the same time
 */
 
 #define FOR_split
 #include "toys.h"
 
 GLOBALS(
+  long number;
   long lines;
   long bytes;
   long suflen;
@@ -35,70 +39,191 @@ GLOBALS(
   char *outfile;
 )
 
+#define SPLIT_BLOCK 65536
+#define SPLIT_THREADS 8
+#define MIN(x,y) ((x) < (y) ? (x) : (y))
+
+// Fill in the suffix for output file number filenum.
+static void split_name(unsigned long filenum)
+{
+  char *s = TT.outfile + strlen(TT.outfile);
+  int i;
+
+  for (i = 0; i<TT.suflen; i++) {
+    *(--s) = 'a'+(filenum%26);
+    filenum /= 26;
+  }
+  if (filenum) error_exit("bad suffix");
+}
+
+// One -n piece: everything a worker needs is in here.
+struct split_job {
+  char *name;
+  off_t off;
+  long long len;
+  int in, mode, err, count, step;
+#if CFG_TOYBOX_THREADS
+  pthread_t tid;
+  int started;
+#endif
+};
+
+// Copy every step'th piece, recording the first errno.
+static void *split_worker(void *arg)
+{
+  struct split_job *job = arg;
+  int i, fd;
+
+  for (i = 0; i<job->count; i += job->step) {
+    if (-1 == (fd = open(job[i].name, O_RDWR|O_CREAT|O_TRUNC, job->mode))
+      || copyfd_len(job->in, &job[i].off, fd, job[i].len)<0)
+      job[i].err = errno ? errno : EIO;
+    if (fd != -1 && close(fd) && !job[i].err) job[i].err = errno;
+  }
+
+  return 0;
+}
+
+// -n: cut a file of known size into TT.number pieces, the last one taking
+// any remainder. Each is at its own offset, so --parallel can do several
+// at once with no shared file position.
+static void split_number(int infd, char *in, struct stat *st)
+{
+  struct split_job *jobs = xzalloc(TT.number*sizeof(*jobs));
+  off_t pos = lseek(infd, 0, SEEK_CUR);
+  long long size, chunk;
+  long i, n = 1;
+
+  if (!S_ISREG(st->st_mode) || pos<0) error_exit("%s: can't get size", in);
+  size = (st->st_size > pos) ? st->st_size-pos : 0;
+  if (!(chunk = size/TT.number)) chunk = 1;
+  for (i = 0; i<TT.number; i++) {
+    split_name(i);
+    jobs[i].name = xstrdup(TT.outfile);
+    jobs[i].off = pos + MIN(size, i*chunk);
+    jobs[i].len = (i == TT.number-1) ? pos+size-jobs[i].off
+      : MIN(chunk, pos+size-jobs[i].off);
+  }
+
+#if CFG_TOYBOX_THREADS
+  if (toys.optflags & FLAG_parallel) n = MIN(TT.number, SPLIT_THREADS);
+#endif
+  for (i = 0; i<n; i++) {
+    jobs[i].in = infd;
+    jobs[i].mode = st->st_mode & 0777;
+    jobs[i].count = TT.number-i;
+    jobs[i].step = n;
+  }
+#if CFG_TOYBOX_THREADS
+  {
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    for (i = 1; i<n; i++)
+      jobs[i].started = !toy_worker_create(&jobs[i].tid, &attr, split_worker,
+        jobs+i);
+    pthread_attr_destroy(&attr);
+  }
+#endif
+  split_worker(jobs);
+#if CFG_TOYBOX_THREADS
+  for (i = 1; i<n; i++) {
+    if (jobs[i].started) pthread_join(jobs[i].tid, 0);
+    else split_worker(jobs+i);
+  }
+#endif
+
+  for (i = 0; i<TT.number; i++) {
+    if (jobs[i].err) {
+      errno = jobs[i].err;
+      perror_exit("%s", jobs[i].name);
+    }
+    if (CFG_TOYBOX_FREE) free(jobs[i].name);
+  }
+  if (CFG_TOYBOX_FREE) free(jobs);
+}
+
 static void do_split(int infd, char *in)
 {
-  (void)in;
-  unsigned long bytesleft, linesleft, filenum, len, pos;
+  unsigned long bytesleft, linesleft, filenum, len, pos, end;
+  long long left, got;
   int outfd = -1;
   struct stat st;
+  char *buf = 0, *s;
 
   // posix doesn't cover permissions on output file, so copy input (or 0777)
   st.st_mode = 0777;
   fstat(infd, &st);
 
+  if (TT.number) {
+    split_number(infd, in, &st);
+    goto done;
+  }
+
+  // Byte splits of a regular file don't need to see the data: let the
+  // kernel copy each piece. Stop at the size we started with.
+  if (!TT.lines && S_ISREG(st.st_mode)
+      && (left = lseek(infd, 0, SEEK_CUR)) >= 0)
+  {
+    for (left = st.st_size-left, filenum = 0; left>0; left -= got) {
+      split_name(filenum++);
+      outfd = xcreate(TT.outfile, O_RDWR|O_CREAT|O_TRUNC, st.st_mode & 0777);
+      got = xsendfile_len(infd, outfd, MIN(left, TT.bytes));
+      xclose(outfd);
+      if (got < MIN(left, TT.bytes)) break;
+    }
+    outfd = -1;
+    goto done;
+  }
+
+  buf = xmalloc(SPLIT_BLOCK);
   len = pos = filenum = bytesleft = linesleft = 0;
   for (;;) {
-    int i, j;
-
-    // Refill toybuf?
+    // Refill buffer?
     if (len == pos) {
-      if (!(len = xread(infd, toybuf, sizeof(toybuf)))) break;
+      if (!(len = xread(infd, buf, SPLIT_BLOCK))) break;
       pos = 0;
     }
 
     // Start new output file?
     if ((TT.bytes && !bytesleft) || (TT.lines && !linesleft)) {
-      char *s = TT.outfile + strlen(TT.outfile);
-
-      j = filenum++;
-      for (i = 0; i<TT.suflen; i++) {
-        *(--s) = 'a'+(j%26);
-        j /= 26;
-      }
-      if (j) error_exit("bad suffix");
+      split_name(filenum++);
       bytesleft = TT.bytes;
       linesleft = TT.lines;
       if (outfd != -1) close(outfd);
       outfd = xcreate(TT.outfile, O_RDWR|O_CREAT|O_TRUNC, st.st_mode & 0777);
     }
 
-    // Write next chunk of output.
+    // Write next chunk of output, up to the byte limit (if any) or the
+    // newline that ends this file's last line.
+    end = len;
+    if (TT.bytes && end-pos > bytesleft) end = pos+bytesleft;
     if (TT.lines) {
-      for (i = pos; (unsigned long)i < len; ) {
-        if (toybuf[i++] == '\n' && !--linesleft) break;
-        if (!--bytesleft) break;
-      }
-      j = i - pos;
-    } else {
-      j = len - pos;
-      if ((unsigned long)j > bytesleft) j = bytesleft;
-      bytesleft -= j;
+      for (s = buf+pos; s<buf+end; s++)
+        if (!(s = memchr(s, '\n', buf+end-s)) || !--linesleft) break;
+      if (s && s<buf+end) end = s-buf+1;
     }
-    txwrite(outfd, toybuf+pos, j);
-    pos += j;
+    bytesleft -= end-pos;
+    txwrite(outfd, buf+pos, end-pos);
+    pos = end;
   }
 
+done:
   if (CFG_TOYBOX_FREE) {
     if (outfd != -1) close(outfd);
     if (infd) close(infd);
     free(TT.outfile);
+    free(buf);
   }
   xexit();
 }
 
 void split_main(void)
 {
-  if (!TT.bytes && !TT.lines) TT.lines = 1000;
+  if (!TT.bytes && !TT.lines && !TT.number) TT.lines = 1000;
+  if (!TT.number && (toys.optflags & FLAG_parallel))
+    error_exit("--parallel needs -n");
 
   // Allocate template for output filenames
   TT.outfile = xmprintf("%s%*c", (toys.optc == 2) ? toys.optargs[1] : "x",
@@ -7,19 +7,20 @@
  * TODO: utf8 strings
  * TODO: posix -t
 
-USE_STRINGS(NEWTOY(strings, "an#=4<1fo", TOYFLAG_USR|TOYFLAG_BIN))
+USE_STRINGS(NEWTOY(strings, "t:an#=4<1fo", TOYFLAG_USR|TOYFLAG_BIN))
 
 config STRINGS
   bool "strings"
   default y
   help
-    usage: strings [-fo] [-n LEN] [FILE...]
+    usage: strings [-fo] [-n LEN] [-t d|o|x] [FILE...]
 
     Display printable strings in a binary file
 
     -f	Precede strings with filenames
     -n	At least LEN characters form a string (default 4)
     -o	Precede strings with decimal offsets
+    -t	Precede strings with offsets in (d)ecimal, (o)ctal, or he(x)
 */
 
 #define FOR_strings
@@ -27,41 +28,199 @@ config STRINGS
 
 GLOBALS(
   long num;
+  char *t;
+
+  char *fmt;
 )
 
-static void do_strings(int fd, char *filename)
+#define STRINGS_READ 65536
+#define STRINGS_OUT 65536
+
+// One file's scan, with all it needs so a worker thread can run it. Output
+// goes to fd a buffer at a time, or with fd -1 collects in memory until the
+// caller prints it. Running out of memory for that fails just this file.
+struct strings_job {
+  char *file, *name, *fmt, *buf, *string, *out;
+  long num, len, size;
+  int fd, err, werr;
+#if CFG_TOYBOX_THREADS
+  pthread_t tid;
+  int started;
+#endif
+};
+
+static void strings_add(struct strings_job *job, char *s, long len)
 {
-  int nread, i, wlen = TT.num, count = 0;
-  off_t offset = 0;
-  char *string = xzalloc(wlen + 1);
-
-  for (;;) {
-    nread = read(fd, toybuf, sizeof(toybuf));
-    if (nread < 0) perror_msg("%s", filename);
-    if (nread < 1) break;
-    for (i = 0; i < nread; i++, offset++) {
-      if (((toybuf[i] >= 32) && (toybuf[i] <= 126)) || (toybuf[i] == '\t')) {
-        if (count == wlen) fputc(toybuf[i], stdout);
-        else {
-          string[count++] = toybuf[i];
-          if (count == wlen) {
-            if (toys.optflags & FLAG_f) printf("%s: ", filename);
-            if (toys.optflags & FLAG_o)
-              printf("%7lld ",(long long)(offset - wlen));
-            printf("%s", string);
+  if (job->werr) return;
+  if (job->len+len > job->size) {
+    if (job->fd != -1) {
+      if (job->len != writeall(job->fd, job->out, job->len)) job->werr = errno;
+      job->len = 0;
+      if (len >= job->size) {
+        if (len != writeall(job->fd, s, len)) job->werr = errno;
+
+        return;
+      }
+    } else {
+      long size = (2*job->size > job->len+len) ? 2*job->size : job->len+len;
+      char *new = realloc(job->out, size);
+
+      if (!new) {
+        job->werr = ENOMEM;
+
+        return;
+      }
+      job->out = new;
+      job->size = size;
+    }
+  }
+  memcpy(job->out+job->len, s, len);
+  job->len += len;
+}
+
+// Find runs of at least num printable characters a block at a time,
+// holding on to a run's start until it's long enough to print.
+static void strings_fd(struct strings_job *job, int fd)
+{
+  long long offset = 0;
+  long n, i, j, count = 0;
+  char *buf = job->buf, num[32];
+
+  while (0<(n = read(fd, buf, STRINGS_READ))) {
+    for (i = 0;;) {
+      if ((j = span_printable(buf+i, n-i, 1))) {
+        if (count == job->num) strings_add(job, buf+i, j);
+        else if (count+j < job->num) {
+          memcpy(job->string+count, buf+i, j);
+          count += j;
+        } else {
+          if (job->name) {
+            strings_add(job, job->name, strlen(job->name));
+            strings_add(job, ": ", 2);
           }
+          if (job->fmt)
+            strings_add(job, num, sprintf(num, job->fmt, offset+i-count));
+          strings_add(job, job->string, count);
+          strings_add(job, buf+i, j);
+          count = job->num;
         }
-      } else {
-        if (count == wlen) xputc('\n');
-        count = 0;
+        i += j;
       }
+      if (i == n) break;
+      if (count == job->num) strings_add(job, "\n", 1);
+      count = 0;
+      i++;
+      if ((i += span_printable(buf+i, n-i, 0)) == n) break;
+    }
+    offset += n;
+  }
+  if (count == job->num) strings_add(job, "\n", 1);
+  if (n<0) job->err = errno;
+}
+
+static void strings_init(struct strings_job *job, int fd)
+{
+  memset(job, 0, sizeof(*job));
+  job->fmt = TT.fmt;
+  job->num = TT.num;
+  job->fd = fd;
+  job->buf = xmalloc(STRINGS_READ);
+  job->string = xmalloc(TT.num);
+  job->size = STRINGS_OUT;
+  job->out = xmalloc(job->size);
+}
+
+static void strings_free(struct strings_job *job)
+{
+  free(job->buf);
+  free(job->string);
+  free(job->out);
+}
+
+static void do_strings(int fd, char *filename)
+{
+  struct strings_job job;
+
+  strings_init(&job, 1);
+  if (toys.optflags & FLAG_f) job.name = filename;
+  strings_fd(&job, fd);
+  if (!job.werr && job.len != writeall(1, job.out, job.len)) job.werr = errno;
+  if ((errno = job.err)) perror_msg("%s", filename);
+  if ((errno = job.werr)) perror_exit("write");
+  strings_free(&job);
+}
+
+#if CFG_TOYBOX_THREADS
+// Scan several files at once, a thread each, printing each batch in order
+// once it's done. Gets the same output (and errors) as loopfiles() would.
+
+static void *strings_worker(void *arg)
+{
+  struct strings_job *job = arg;
+  int fd = strcmp(job->file, "-") ? open(job->file, O_RDONLY|O_CLOEXEC) : 0;
+
+  if (fd == -1) job->err = errno;
+  else {
+    strings_fd(job, fd);
+    if (fd) close(fd);
+  }
+
+  return 0;
+}
+
+static void strings_parallel(int n)
+{
+  struct strings_job *jobs = xmalloc(n*sizeof(struct strings_job));
+  pthread_attr_t attr;
+  char **arg = toys.optargs;
+  int i, j;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+  while (*arg) {
+    for (i = 0; i<n && *arg; i++) {
+      strings_init(jobs+i, -1);
+      jobs[i].file = *(arg++);
+      if (toys.optflags & FLAG_f) jobs[i].name = jobs[i].file;
+      jobs[i].started = i
+        && !toy_worker_create(&jobs[i].tid, &attr, strings_worker, jobs+i);
+    }
+    for (j = 0; j<i; j++) if (!jobs[j].started) strings_worker(jobs+j);
+    for (j = 0; j<i; j++) {
+      if (jobs[j].started) pthread_join(jobs[j].tid, 0);
+      txwrite(1, jobs[j].out, jobs[j].len);
+      if ((errno = jobs[j].err)) perror_msg("%s", jobs[j].file);
+      if ((errno = jobs[j].werr)) perror_msg("%s", jobs[j].file);
+      strings_free(jobs+j);
     }
   }
-  xclose(fd);
-  free(string);
+  pthread_attr_destroy(&attr);
+  if (CFG_TOYBOX_FREE) free(jobs);
 }
+#endif
 
 void strings_main(void)
 {
+  long n = 1;
+
+  if (toys.optflags & FLAG_o) TT.fmt = "%7lld ";
+  if (toys.optflags & FLAG_t) {
+    if (strlen(TT.t) != 1 || -1 == (n = stridx("dox", *TT.t)))
+      error_exit("bad -t %s", TT.t);
+    TT.fmt = (char *[]){"%7lld ", "%7llo ", "%7llx "}[n];
+    n = 1;
+  }
+
+#if CFG_TOYBOX_THREADS
+  if (toys.optc > 1) n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n > toys.optc) n = toys.optc;
+  if (n > 8) n = 8;
+  if (n > 1) {
+    strings_parallel(n);
+
+    return;
+  }
+#endif
+
   loopfiles(toys.optargs, do_strings);
 }
@@ -4,20 +4,21 @@
  *
  * See http://opengroup.org/onlinepubs/9699919799/utilities/tail.html
 
-USE_TAIL(NEWTOY(tail, "?fc-n-[-cn]", TOYFLAG_USR|TOYFLAG_BIN))
+USE_TAIL(NEWTOY(tail, "?Ffc-n-[-cn]", TOYFLAG_USR|TOYFLAG_BIN))
 
 config TAIL
   bool "tail"
   default y
   help
-    usage: tail [-n|c NUMBER] [-f] [FILE...]
+    usage: tail [-n|c NUMBER] [-fF] [FILE...]
 
     Copy last lines from files to stdout. If no files listed, copy from
     stdin. Filename "-" is a synonym for stdin.
 
     -n	output the last NUMBER lines (default 10), +X counts from start.
     -c	output the last NUMBER bytes, +NUMBER counts from start
-    #-f	follow FILE(s), waiting for more data to be appended [TODO]
+    -f	follow FILE(s), waiting for more data to be appended
+    -F	follow FILE names, reopening them when they're rotated or appear
 
 config TAIL_SEEK
   bool "tail seek support"
@@ -29,14 +30,30 @@ config TAIL_SEEK
 
 #define FOR_tail
 #include "toys.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 GLOBALS(
   long lines;
   long bytes;
 
-  int file_no;
+  int file_no, ffd, nfiles, last;
+  struct tail_file *files;
+  char *buf;
 )
 
+#define TAIL_READ (64*1024)
+
+// A file being followed by -f
+struct tail_file {
+  char *name;
+  int fd, wd, ready, gone;
+  dev_t dev;
+  ino_t ino;
+  off_t pos;
+};
+
 struct line_list {
   struct line_list *next, *prev;
   char *data;
@@ -63,7 +80,7 @@ static void dump_chunk(void *ptr)
 {
   struct line_list *list = ptr;
 
-  txwrite(1, list->data, list->len);
+  txwrite(fileno(stdout), list->data, list->len);
   free(list);
 }
 
@@ -73,7 +90,7 @@ static void dump_chunk(void *ptr)
 static int try_lseek(int fd, long bytes, long lines)
 {
   struct line_list *list = 0, *temp;
-  int flag = 0, chunk = sizeof(toybuf);
+  int flag = 0, chunk = TAIL_READ;
   ssize_t pos = lseek(fd, 0, SEEK_END);
 
   // If lseek() doesn't work on this stream, return now.
@@ -82,7 +99,8 @@ static int try_lseek(int fd, long bytes, long lines)
   // Seek to the right spot, output data from there.
   if (bytes) {
     if (lseek(fd, bytes, SEEK_END)<0) lseek(fd, 0, SEEK_SET);
-    xsendfile(fd, 1);
+    xflush();
+    xsendfile(fd, fileno(stdout));
     return 1;
   }
 
@@ -90,7 +108,8 @@ static int try_lseek(int fd, long bytes, long lines)
 
   bytes = pos;
   while (lines && pos) {
-    int offset;
+    char *s, *end;
+    long count = 0;
 
     // Read in next chunk from end of file
     if (chunk>pos) chunk = pos;
@@ -103,21 +122,23 @@ static int try_lseek(int fd, long bytes, long lines)
     temp->next = list;
     list = temp;
 
-    // Count newlines in this chunk.
-    offset = list->len;
-    while (offset--) {
-      // If the last line ends with a newline, that one doesn't count.
-      if (!flag) flag++;
-
-      // Start outputting data right after newline
-      else if (list->data[offset] == '\n' && !++lines) {
-        offset++;
-        list->data += offset;
-        list->len -= offset;
+    // Count newlines in this chunk. If the last line ends with a newline,
+    // that one doesn't count.
+    end = list->data+list->len-!flag++;
+    for (s = list->data; (s = memchr(s, '\n', end-s)); s++) count++;
+    if (count < -lines) {
+      lines += count;
+      continue;
+    }
 
-        break;
-      }
+    // Start outputting data right after the newline that makes enough.
+    for (count += lines, s = list->data;; s++) {
+      s = memchr(s, '\n', end-s);
+      if (!count--) break;
     }
+    list->len -= ++s-list->data;
+    list->data = s;
+    break;
   }
 
   // Output stored data
@@ -205,30 +226,177 @@ static void do_tail(int fd, char *name)
       if (toybuf[offset++] == '\n') lines--;
       if (offset >= len) break;
     }
-    if (offset<len) txwrite(1, toybuf+offset, len-offset);
+    if (offset<len) txwrite(fileno(stdout), toybuf+offset, len-offset);
+  }
+
+}
+
+// Print whatever's been added to a followed file since last time.
+static void tail_read(struct tail_file *tf)
+{
+  struct stat st;
+  int len;
+
+  if (tf->fd == -1) return;
+  if (!fstat(tf->fd, &st) && S_ISREG(st.st_mode) && st.st_size < tf->pos) {
+    error_msg("%s: file truncated", tf->name);
+    tf->pos = lseek(tf->fd, 0, SEEK_SET);
+  }
+  while (0<(len = read(tf->fd, TT.buf, TAIL_READ))) {
+    if (toys.optc>1 && TT.last != tf-TT.files) {
+      xprintf("\n==> %s <==\n", tf->name);
+      TT.last = tf-TT.files;
+    }
+    txwrite(fileno(stdout), TT.buf, len);
+    tf->pos += len;
+  }
+}
+
+// Watch one file for writes, and with -F for being renamed or deleted.
+static void tail_watch(struct tail_file *tf)
+{
+  tf->wd = -1;
+#ifdef __linux__
+  if (TT.ffd != -1 && tf->fd != -1 && strcmp(tf->name, "-"))
+    tf->wd = inotify_add_watch(TT.ffd, tf->name, IN_MODIFY|IN_ATTRIB
+      |IN_DELETE_SELF|IN_MOVE_SELF);
+#endif
+}
+
+// With -F, start reading whatever has the file's name now if that's changed,
+// after finishing off the old one (which may still be getting written to
+// until whoever rotated it tells the writer).
+static void tail_reopen(struct tail_file *tf)
+{
+  struct stat st;
+  int fd;
+
+  if (stat(tf->name, &st)) {
+    if (!tf->gone++) error_msg("'%s' has become inaccessible", tf->name);
+
+    return;
+  }
+  if (tf->fd != -1 && st.st_dev == tf->dev && st.st_ino == tf->ino) return;
+  if (-1 == (fd = open(tf->name, O_RDONLY|O_CLOEXEC))) return;
+  if (tf->fd != -1) {
+    tail_read(tf);
+    close(tf->fd);
+#ifdef __linux__
+    if (tf->wd != -1) inotify_rm_watch(TT.ffd, tf->wd);
+#endif
+    error_msg("'%s' has been replaced; following new file", tf->name);
+  } else error_msg("'%s' has appeared; following new file", tf->name);
+  tf->gone = 0;
+  tf->fd = fd;
+  tf->dev = st.st_dev;
+  tf->ino = st.st_ino;
+  tf->pos = 0;
+  tail_watch(tf);
+  tf->ready = 1;
+}
+
+// Show the end of the file, and remember it for -f.
+static void do_follow(int fd, char *name)
+{
+  struct tail_file *tf;
+  struct stat st;
+
+  if (fd == -1) {
+    perror_msg("%s", name);
+    if (toys.optc > 1) TT.file_no++;
+  } else {
+    do_tail(fd, name);
+    if (fstat(fd, &st) || S_ISFIFO(st.st_mode)) {
+      if (fd) close(fd);
+
+      return;
+    }
+  }
+
+  if (!(TT.nfiles&15))
+    TT.files = xrealloc(TT.files, (TT.nfiles+16)*sizeof(*TT.files));
+  tf = TT.files+TT.nfiles;
+  memset(tf, 0, sizeof(*tf));
+  tf->name = name;
+  tf->gone = fd == -1;
+  if (-1 != (tf->fd = fd)) {
+    tf->dev = st.st_dev;
+    tf->ino = st.st_ino;
+    tf->pos = lseek(fd, 0, SEEK_CUR);
   }
+  TT.last = TT.nfiles++;
+}
+
+// Wait for followed files to grow. That's inotify where there is such a
+// thing, which can't see stdin or files that don't exist (yet), so those
+// have to be checked every second.
+static void tail_follow(void)
+{
+  struct tail_file *tf;
+  struct pollfd pfd;
+  int i, len, timeout;
+
+  TT.buf = xmalloc(TAIL_READ);
+  TT.ffd = -1;
+#ifdef __linux__
+  TT.ffd = inotify_init();
+#endif
+  for (i = 0; i<TT.nfiles; i++) tail_watch(TT.files+i);
+
+  for (;;) {
+    for (timeout = i = 0; i<TT.nfiles; i++) {
+      tf = TT.files+i;
+      if (toys.optflags&FLAG_F) tail_reopen(tf);
+      if (tf->wd == -1) timeout = 1000;
+      if (tf->ready || tf->wd == -1) tail_read(tf);
+      tf->ready = 0;
+    }
 
-  // -f support: cache name/descriptor
+    if (TT.ffd == -1) {
+      sleep(1);
+      continue;
+    }
+    pfd.fd = TT.ffd;
+    pfd.events = POLLIN;
+    if (!xpoll(&pfd, 1, timeout ? timeout : -1)) continue;
+
+#ifdef __linux__
+    // Which files had something happen to them?
+    if (0<(len = read(TT.ffd, TT.buf, TAIL_READ))) {
+      struct inotify_event *ev;
+      char *s;
+
+      for (s = TT.buf; s<TT.buf+len; s += sizeof(*ev)+ev->len) {
+        ev = (void *)s;
+        for (i = 0; i<TT.nfiles; i++) {
+          if (TT.files[i].wd != ev->wd) continue;
+          TT.files[i].ready = 1;
+          if (ev->mask & IN_IGNORED) TT.files[i].wd = -1;
+        }
+      }
+    }
+#endif
+  }
 }
 
 void tail_main(void)
 {
   char **args = toys.optargs;
 
+  if (toys.optflags&FLAG_F) toys.optflags |= FLAG_f;
   if (!(toys.optflags&(FLAG_n|FLAG_c))) {
     char *arg = *args;
 
-    // handle old "-42" style arguments
+    // handle old "-42" style arguments, else default -n to -10
     if (arg && *arg == '-' && arg[1]) {
       TT.lines = atolx(*(args++));
       toys.optc--;
-    }
-
-    // if nothing specified, default -n to -10
-    TT.lines = -10;
+    } else TT.lines = -10;
   }
 
-  loopfiles(args, do_tail);
-
-  // do -f stuff
+  if (!(toys.optflags&FLAG_f)) loopfiles(args, do_tail);
+  else {
+    loopfiles_rw(args, O_RDONLY, 0, toys.optflags&FLAG_F, do_follow);
+    if (TT.nfiles) tail_follow();
+  }
 }
@@ -28,45 +28,167 @@ GLOBALS(
 
 struct fd_list {
   struct fd_list *next;
-  int fd;
+  int fd, how;
 };
 
+#define TEE_BUF 65536
+
+// How each output gets its data: tee() it from the input pipe, splice()
+// it from a private copy of the input, or plain write() from a buffer.
+#define TEE_PIPE 1
+#define TEE_SPLICE 2
+
 // Open each output file, saving filehandles to a linked list.
 
 static void do_tee_open(int fd, char *name)
 {
   (void)name;
   struct fd_list *temp;
+  struct stat st;
 
   temp = xmalloc(sizeof(struct fd_list));
   temp->next = TT.outputs;
   temp->fd = fd;
+  temp->how = (!fstat(fd, &st) && S_ISFIFO(st.st_mode)) ? TEE_PIPE
+    : TEE_SPLICE;
   TT.outputs = temp;
 }
 
+#if TOYBOX_COPYFILE
+// splice() up to len bytes out of pipe from, returning how many moved or
+// -1 if none did.
+static long tee_move(int from, int to, long len)
+{
+  long done = 0, got;
+
+  while (done<len) {
+    got = syscall(SYS_splice, from, 0, to, 0, len-done, SPLICE_F_MOVE);
+    if (got<1) return done ? done : -1;
+    done += got;
+  }
+
+  return done;
+}
+
+// Discard len bytes waiting in pipe fd.
+static void tee_drop(int fd, int null, char *buf, long len)
+{
+  long got = tee_move(fd, null, len);
+
+  if (got<0) got = 0;
+  while (got<len) {
+    long n = xread(fd, buf, (len-got > TEE_BUF) ? TEE_BUF : len-got);
+
+    if (!n) error_exit("short pipe");
+    got += n;
+  }
+}
+
+// When stdin is a pipe, let the kernel hand its pages to each output
+// without copying them through userspace: tee() duplicates them into other
+// pipes, and a private spool pipe holds a copy to splice() into anything
+// else. Outputs that won't take either get written from a buffer read out
+// of the spool. Each round leaves the data in stdin until every output
+// has it, then throws it away. Returns 0 if stdin can't do this.
+
+static int tee_splice(char *buf)
+{
+  struct fd_list *fdl;
+  struct stat st;
+  int spool[2], null = -1, full, inbuf;
+  long len = 0, got;
+
+  if (fstat(0, &st) || !S_ISFIFO(st.st_mode) || pipe(spool)) return 0;
+  if (-1 == (null = open("/dev/null", O_WRONLY))) goto out;
+
+  for (;;) {
+    // The first copy sets how much this round handles.
+    if (1>(len = syscall(SYS_tee, 0, spool[1], TEE_BUF, 0))) {
+      if (len && errno != EINVAL) perror_exit("tee");
+      break;
+    }
+    full = 1;
+    inbuf = 0;
+
+    for (fdl = TT.outputs; fdl; fdl = fdl->next) {
+      got = 0;
+      if (fdl->how == TEE_PIPE) {
+        if (len == (got = syscall(SYS_tee, 0, fdl->fd, len, 0))) continue;
+        if (got<0) {
+          if (errno != EINVAL) {
+            toys.exitval = 1;
+            continue;
+          }
+          fdl->how = got = 0;
+        }
+      } else if (fdl->how == TEE_SPLICE) {
+        if (!full && len != syscall(SYS_tee, 0, spool[1], len, 0))
+          perror_exit("tee");
+        full = 0;
+        if (len == (got = tee_move(spool[0], fdl->fd, len))) continue;
+        if (got>0 || errno != EINVAL) {
+          tee_drop(spool[0], null, buf, len-(got>0 ? got : 0));
+          toys.exitval = 1;
+          continue;
+        }
+        full = 1;
+        fdl->how = got = 0;
+      }
+
+      // Anything tee() or splice() didn't finish gets written normally.
+      if (!inbuf) {
+        if (!full && len != syscall(SYS_tee, 0, spool[1], len, 0))
+          perror_exit("tee");
+        if (len != readall(spool[0], buf, len)) perror_exit("read");
+        full = 0;
+        inbuf = 1;
+      }
+      if (len-got != writeall(fdl->fd, buf+got, len-got)) toys.exitval = 1;
+    }
+
+    if (full) tee_drop(spool[0], null, buf, len);
+    tee_drop(0, null, buf, len);
+  }
+
+out:
+  close(spool[0]);
+  close(spool[1]);
+  if (null != -1) close(null);
+
+  return null != -1 && len>=0;
+}
+#endif
+
+// Write data to each output file, plus stdout.
+static void tee_write(int out, char *buf, long len)
+{
+  struct fd_list *fdl;
+
+  for (fdl = TT.outputs; fdl; fdl = fdl->next)
+    if (len != writeall(fdl->fd, buf, len)) toys.exitval = 1;
+}
+
 void tee_main(void)
 {
   if (toys.optflags & FLAG_i) xsignal(SIGINT, SIG_IGN);
 
+  // Stdout is written last, so it goes on the list first.
+  do_tee_open(fileno(stdout), 0);
+
   // Open output files
   loopfiles_rw(toys.optargs,
     O_RDWR|O_CREAT|((toys.optflags & FLAG_a)?O_APPEND:O_TRUNC),
     0666, 0, do_tee_open);
 
-  for (;;) {
-    struct fd_list *fdl;
-    int len;
-
-    // Read data from stdin
-    len = xread(0, toybuf, sizeof(toybuf));
-    if (len<1) break;
-
-    // Write data to each output file, plus stdout.
-    fdl = TT.outputs;
-    for (;;) {
-      if(len != writeall(fdl ? fdl->fd : 1, toybuf, len)) toys.exitval=1;
-      if (!fdl) break;
-      fdl = fdl->next;
-    }
+#if TOYBOX_COPYFILE
+  {
+    char *buf = xmalloc(TEE_BUF);
+    int done = tee_splice(buf);
+
+    free(buf);
+    if (done) return;
   }
+#endif
+
+  if (xcopy(fileno(stdin), -1, tee_write)) perror_exit("read");
 }
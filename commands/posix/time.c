@@ -4,46 +4,92 @@
  *
  * See http://pubs.opengroup.org/onlinepubs/9699919799/utilities/time.html
 
-USE_TIME(NEWTOY(time, "<1^p", TOYFLAG_USR|TOYFLAG_BIN))
+USE_TIME(NEWTOY(time, "<1^mvp", TOYFLAG_USR|TOYFLAG_BIN))
 
 config TIME
   bool "time"
   default y
   depends on TOYBOX_FLOAT
   help
-    usage: time [-p] COMMAND [ARGS...]
+    usage: time [-mpv] COMMAND [ARGS...]
 
     Run command line and report real, user, and system time elapsed in seconds.
     (real = clock on the wall, user = cpu used by command's code,
     system = cpu used by OS on behalf of command.)
 
+    A built in command runs in this thread, timed by its CPU clock, and -v
+    also shows the most heap it had at once and what it read, wrote and
+    opened through the library. For a program -v shows its peak memory,
+    page faults and context switches.
+
+    -m	machine readable key=value lines, with everything -v shows
     -p	posix mode (ignored)
+    -v	verbose
 */
 
+#define FOR_time
 #include "toys.h"
 
+static void time_show(char *name, char *fmt, unsigned long long val)
+{
+  if (toys.optflags&FLAG_m) fprintf(stderr, "%s=%llu\n", name, val);
+  else fprintf(stderr, fmt, val);
+}
+
 void time_main(void)
 {
+  struct toy_list *which = toy_find(*toys.optargs);
+  struct timespec ts, ts2;
+  struct rusage ru;
+  float r, u, s;
+  int mflag = toys.optflags&FLAG_m, verbose = toys.optflags&(FLAG_v|FLAG_m);
   pid_t pid;
-  struct timeval tv, tv2;
 
-  gettimeofday(&tv, NULL);
+  if (which) {
+    struct toy_usage use;
+
+    toys.exitval = toy_run(which, toys.optargs);
+    use = toy_last;
+    r = use.wall/1e9;
+    u = use.user/1e9;
+    s = use.sys/1e9;
+    if (mflag) fprintf(stderr, "real_usec=%llu\nuser_usec=%llu\n"
+      "sys_usec=%llu\n", use.wall/1000, use.user/1000, use.sys/1000);
+    else fprintf(stderr, "real %f\nuser %f\nsys %f\n", r, u, s);
+    if (!verbose) return;
+    time_show("heap_peak", "heap peak %llu\n", use.heap);
+    time_show("read_bytes", "read %llu bytes", use.io.rbytes);
+    time_show("read_calls", " in %llu calls\n", use.io.reads);
+    time_show("write_bytes", "wrote %llu bytes", use.io.wbytes);
+    time_show("write_calls", " in %llu calls\n", use.io.writes);
+    time_show("opens", "opened %llu files\n", use.io.opens);
+
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
   if (!(pid = XVFORK())) xexec(toys.optargs);
   else {
     int stat;
-    struct rusage ru;
-    float r, u, s;
 
     wait4(pid, &stat, 0, &ru);
-    gettimeofday(&tv2, NULL);
-    if (tv.tv_usec > tv2.tv_usec) {
-      tv2.tv_usec += 1000000;
-      tv2.tv_sec--;
-    }
-    r = (tv2.tv_sec-tv.tv_sec)+((tv2.tv_usec-tv.tv_usec)/1000000.0);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    r = (ts2.tv_sec-ts.tv_sec)+((ts2.tv_nsec-ts.tv_nsec)/1e9);
     u = ru.ru_utime.tv_sec+(ru.ru_utime.tv_usec/1000000.0);
     s = ru.ru_stime.tv_sec+(ru.ru_stime.tv_usec/1000000.0);
-    fprintf(stderr, "real %f\nuser %f\nsys %f\n", r, u, s);
+    if (mflag) fprintf(stderr, "real_usec=%llu\nuser_usec=%llu\n"
+      "sys_usec=%llu\n", (unsigned long long)(r*1e6),
+      ru.ru_utime.tv_sec*1000000ULL+ru.ru_utime.tv_usec,
+      ru.ru_stime.tv_sec*1000000ULL+ru.ru_stime.tv_usec);
+    else fprintf(stderr, "real %f\nuser %f\nsys %f\n", r, u, s);
+    if (verbose) {
+      time_show("maxrss_kb", "max rss %llu kB\n", ru.ru_maxrss);
+      time_show("major_faults", "page faults %llu major", ru.ru_majflt);
+      time_show("minor_faults", " %llu minor\n", ru.ru_minflt);
+      time_show("voluntary_switches", "context switches %llu voluntary",
+        ru.ru_nvcsw);
+      time_show("involuntary_switches", " %llu involuntary\n", ru.ru_nivcsw);
+    }
     toys.exitval = WIFEXITED(stat) ? WEXITSTATUS(stat) : WTERMSIG(stat);
   }
 }
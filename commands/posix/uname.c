@@ -66,7 +66,7 @@ void uname_main(void)
         *(--c)=' ';
         len++;
       }
-      txwrite(1, c, len);
+      txwrite(fileno(stdout), c, len);
     }
   }
   putchar('\n');
@@ -4,13 +4,13 @@
  *
  * See http://opengroup.org/onlinepubs/9699919799/utilities/uniq.html
 
-USE_UNIQ(NEWTOY(uniq, "f#s#w#zicdu", TOYFLAG_USR|TOYFLAG_BIN))
+USE_UNIQ(NEWTOY(uniq, "(unsorted)f#s#w#zicdu", TOYFLAG_USR|TOYFLAG_BIN))
 
 config UNIQ
   bool "uniq"
   default y
   help
-    usage: uniq [-cduiz] [-w maxchars] [-f fields] [-s char] [input_file [output_file]]
+    usage: uniq [-cduiz] [-w maxchars] [-f fields] [-s char] [--unsorted] [input_file [output_file]]
 
     Report or filter out repeated lines in a file
 
@@ -22,101 +22,159 @@ config UNIQ
     -w	compare maximum X chars per line
     -f	ignore first X fields
     -s	ignore first X chars
+    --unsorted	repeats needn't be adjacent: count each line wherever it
+    		occurs and output it once, in order of first appearance
 */
 
 #define FOR_uniq
 #include "toys.h"
-#include "xfuncs.h"
 
 GLOBALS(
   long maxchars;
   long nchars;
   long nfields;
   long repeats;
+
+  void *seen;
+  unsigned *slot;
+  long nseen, size;
 )
 
-static char *skip(char *str)
+// --unsorted keeps each different line in seen[], in the order they first
+// turned up, with a hash table of indexes (plus one) into it in slot[].
+struct uniq_seen {
+  char *line;
+  long len, key, klen, count;
+  unsigned hash;
+};
+
+// Find the part of the line between -f/-s and -w (*len is the length
+// before its end of line character, and what's left after).
+static char *skip(char *str, long *len)
 {
-  long nchars = TT.nchars, nfields;
+  char *end = str+*len;
+  long nfields;
 
   // Skip fields first
-  for (nfields = TT.nfields; nfields; str++) {
-    while (*str && isspace(*str)) str++;
-    while (*str && !isspace(*str)) str++;
-    nfields--;
+  for (nfields = TT.nfields; nfields; nfields--) {
+    while (str<end && isspace(*str)) str++;
+    while (str<end && !isspace(*str)) str++;
   }
   // Skip chars
-  while (*str && nchars--) str++;
+  str += (TT.nchars < end-str) ? TT.nchars : end-str;
+  *len = end-str;
+  if (TT.maxchars && *len > TT.maxchars) *len = TT.maxchars;
 
   return str;
 }
 
-static void print_line(FILE *f, char *line)
+static int same(char *a, char *b, long len)
+{
+  if (!(toys.optflags & FLAG_i)) return !memcmp(a, b, len);
+  while (len--)
+    if (tolower((unsigned char)*a++) != tolower((unsigned char)*b++)) return 0;
+
+  return 1;
+}
+
+static void print_line(FILE *f, char *line, long len, char eol)
 {
   if (toys.optflags & (TT.repeats ? FLAG_u : FLAG_d)) return;
   if (toys.optflags & FLAG_c) fprintf(f, "%7lu ", TT.repeats + 1);
-  fputs(line, f);
-  if (toys.optflags & FLAG_z) fputc(0, f);
+  fwrite(line, 1, len, f);
+  if (!len || line[len-1] != eol) fputc(eol, f);
 }
 
-void uniq_main(void)
+// Look the key up in (or add it to) the table of lines seen before
+static void count_line(char *line, long len, char *key, long klen)
 {
-  FILE *infile = stdin, *outfile = stdout;
-  char *thisline = NULL, *prevline = NULL, *tmpline, eol = '\n';
-  size_t thissize, prevsize = 0, tmpsize;
-
-  if (toys.optc >= 1) infile = xfopen(toys.optargs[0], "r");
-  if (toys.optc >= 2) outfile = xfopen(toys.optargs[1], "w");
+  struct uniq_seen *us;
+  unsigned hash = 2166136261U, i, j;
+  long l;
 
-  if (toys.optflags & FLAG_z) eol = 0;
+  for (l = 0; l < klen; l++) {
+    j = (unsigned char)key[l];
+    hash = (hash ^ ((toys.optflags & FLAG_i) ? tolower(j) : j))*16777619;
+  }
 
-  // If first line can't be read
-  if (xgetdelim(&prevline, &prevsize, eol, infile) < 0)
-    return;
-
-  while (xgetdelim(&thisline, &thissize, eol, infile) > 0) {
-    int diff;
-    char *t1, *t2;
-
-    // If requested get the chosen fields + character offsets.
-    if (TT.nfields || TT.nchars) {
-      t1 = skip(thisline);
-      t2 = skip(prevline);
-    } else {
-      t1 = thisline;
-      t2 = prevline;
+  if (2*(TT.nseen+1) > TT.size) {
+    TT.size = TT.size ? 2*TT.size : 1024;
+    free(TT.slot);
+    TT.slot = xzalloc(TT.size*sizeof(unsigned));
+    TT.seen = xrealloc(TT.seen, (TT.size/2)*sizeof(struct uniq_seen));
+    for (j = 0, us = TT.seen; j < TT.nseen; j++) {
+      for (i = us[j].hash&(TT.size-1); TT.slot[i]; i = (i+1)&(TT.size-1));
+      TT.slot[i] = j+1;
     }
+  }
+  for (i = hash&(TT.size-1); TT.slot[i]; i = (i+1)&(TT.size-1)) {
+    us = (struct uniq_seen *)TT.seen+TT.slot[i]-1;
+    if (us->hash == hash && us->klen == klen
+        && same(us->line+us->key, key, klen)) {
+      us->count++;
 
-    if (TT.maxchars == 0) {
-      diff = !(toys.optflags & FLAG_i) ? strcmp(t1, t2) : strcasecmp(t1, t2);
-    } else {
-      diff = !(toys.optflags & FLAG_i) ? strncmp(t1, t2, TT.maxchars)
-              : strncasecmp(t1, t2, TT.maxchars);
+      return;
     }
+  }
+  us = (struct uniq_seen *)TT.seen+TT.nseen;
+  TT.slot[i] = ++TT.nseen;
+  us->line = xmalloc(len+1);
+  memcpy(us->line, line, len+1);
+  us->len = len;
+  us->key = key-line;
+  us->klen = klen;
+  us->count = 0;
+  us->hash = hash;
+}
 
-    if (diff == 0) { // same
-      TT.repeats++;
-    } else {
-      print_line(outfile, prevline);
-
-      TT.repeats = 0;
+void uniq_main(void)
+{
+  FILE *outfile = stdout;
+  struct linebuf lb;
+  struct uniq_seen *us;
+  char *line, *key, *prev = 0, *pkey = 0, eol = '\n';
+  long len, klen, plen = 0, pklen = 0, psize = 0, i;
+  int fd = 0;
+
+  if (toys.optc >= 1 && strcmp(toys.optargs[0], "-"))
+    fd = xopen(toys.optargs[0], O_RDONLY);
+  if (toys.optc >= 2) outfile = xfopen(toys.optargs[1], "w");
 
-      tmpline = prevline;
-      prevline = thisline;
-      thisline = tmpline;
+  if (toys.optflags & FLAG_z) eol = 0;
 
-      tmpsize = prevsize;
-      prevsize = thissize;
-      thissize = tmpsize;
+  // Lines are compared where they sit in the linebuf, and only copied out
+  // when a different one comes along to be the previous line.
+  linebuf_init(&lb, fd);
+  while ((line = get_linebuf(&lb, &len, eol, 0))) {
+    klen = len - (line[len-1] == eol);
+    key = skip(line, &klen);
+
+    if (toys.optflags & FLAG_unsorted) count_line(line, len, key, klen);
+    else if (prev && klen == pklen && same(key, pkey, klen)) TT.repeats++;
+    else {
+      if (prev) print_line(outfile, prev, plen, eol);
+      TT.repeats = 0;
+      if (len+1 > psize) prev = xrealloc(prev, psize = len+1);
+      memcpy(prev, line, len+1);
+      plen = len;
+      pkey = prev+(key-line);
+      pklen = klen;
     }
   }
+  linebuf_done(&lb);
 
-  print_line(outfile, prevline);
+  if (prev) print_line(outfile, prev, plen, eol);
+  for (i = 0, us = TT.seen; i < TT.nseen; i++) {
+    TT.repeats = us[i].count;
+    print_line(outfile, us[i].line, us[i].len, eol);
+  }
 
   if (CFG_TOYBOX_FREE) {
     if (outfile != stdout) fclose(outfile);
-    if (infile != stdin) fclose(infile);
-    free(prevline);
-    free(thisline);
+    if (fd) close(fd);
+    free(prev);
+    for (i = 0; i < TT.nseen; i++) free(us[i].line);
+    free(TT.seen);
+    free(TT.slot);
   }
 }
@@ -26,7 +26,7 @@ GLOBALS(
 
 void uudecode_main(void)
 {
-  int ifd = 0, ofd, idx = 0, m = m;
+  int ifd = 0, ofd, idx = 0, m = m, state = 0;
   char *line = 0, mode[16],
        *class[] = {"begin%*[ ]%15s%*[ ]%n", "begin-base64%*[ ]%15s%*[ ]%n"};
 
@@ -55,35 +55,28 @@ void uudecode_main(void)
       continue;
     }
 
-    olen = 0;
+    // Groups of 4 can span lines. Padding ends a group, so start over after.
+    if (m) {
+      if (state == -1) state = 0;
+      if (*line)
+        txwrite(ofd, line, base64_decode(line, line, strlen(line), &state, 1));
+
+      continue;
+    }
+
     in = out = line;
-    if (!m) olen = (*(in++) - 32) & 0x3f;
+    olen = (*(in++) - 32) & 0x3f;
 
     for (;;) {
       int i = 0, x = 0, len = 4;
       char c = 0;
 
-      if (!m) {
-        if (olen < 1) break;
-        if (olen < 3) len = olen + 1;
-      }
+      if (olen < 1) break;
+      if (olen < 3) len = olen + 1;
 
       while (i < len) {
         if (!(c = *(in++))) goto line_done;
-
-        if (m) {
-          if (c == '=') {
-            len--;
-            continue;
-          } else if (len != 4) break;
-
-          if (c >= 'A' && c <= 'Z') c -= 'A';
-          else if (c >= 'a' && c <= 'z') c += 26 - 'a';
-          else if (c >= '0' && c <= '9') c += 52 - '0';
-          else if (c == '+') c = 62;
-          else if (c == '/') c = 63;
-          else continue;
-        } else c = (c - 32) & 0x3f;
+        c = (c - 32) & 0x3f;
 
         x |= c << (6*(3-i));
 
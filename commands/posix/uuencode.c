@@ -28,15 +28,22 @@ void uuencode_main(void)
 
   if (toys.optc > 1) fd = xopen(toys.optargs[0], O_RDONLY);
 
-  base64_init(toybuf);
-
   xprintf("begin%s 744 %s\n", m ? "-base64" : "", name);
   for (;;) {
     char *in;
 
-    if (!(i = xread(fd, buf, m ? sizeof(buf) : 45))) break;
+    // Only the last line can be short, or base64 would pad in the middle.
+    if (0>(i = readall(fd, buf, m ? sizeof(buf) : 45))) perror_exit(0);
+    if (!i) break;
+
+    if (m) {
+      toybuf[base64_encode(toybuf, buf, i)] = 0;
+      xputs(toybuf);
+
+      continue;
+    }
 
-    if (!m) xputc(i+32);
+    xputc(i+32);
     in = buf;
 
     for (in = buf; in-buf < i; ) {
@@ -49,7 +56,7 @@ void uuencode_main(void)
 
         if (j < bytes) x |= (*(in++) & 0x0ff) << (8*(2-j));
         out = (x>>((3-j)*6)) & 0x3f;
-        xputc(m ? (j > bytes ? '=' : toybuf[out]) : (out ? out + 0x20 : 0x60));
+        xputc(out ? out + 0x20 : 0x60);
       } 
     }
     xputc('\n');
@@ -29,8 +29,11 @@ config WC
 
 GLOBALS(
   unsigned long totals[3];
+  char *buf;
 )
 
+#define WC_READ (64*1024)
+
 static void show_lengths(unsigned long *lengths, char *name)
 {
   int i, nospace = 1;
@@ -45,30 +48,95 @@ static void show_lengths(unsigned long *lengths, char *name)
   xputc('\n');
 }
 
+// Test 8 bytes at once: each byte of the result has its high bit set if
+// that byte of x is zero, or ascii whitespace (what isspace() means in the
+// C locale), and the rest clear.
+
+#define WC_ONES 0x0101010101010101ULL
+#define WC_HIGH (WC_ONES*0x80)
+#define WC_COUNT(x) ((((x)>>7)*WC_ONES)>>56)
+
+static unsigned long long wc_zero(unsigned long long x)
+{
+  return ~(((x&~WC_HIGH)+~WC_HIGH)|x|~WC_HIGH);
+}
+
+static unsigned long long wc_space(unsigned long long x)
+{
+  return wc_zero(x^(WC_ONES*' ')) | (((x|WC_HIGH)-WC_ONES*9)
+    & ~(((x|WC_HIGH)-WC_ONES*14)|x) & WC_HIGH);
+}
+
+// Count lines (and words if asked) in bytes that aren't multibyte
+// characters, 8 at a time. Words start at a non-space after a space, and
+// *space says whether the byte before this buffer was one.
+
+static void wc_count(char *s, int len, unsigned long *lengths, int *space,
+  int words)
+{
+  unsigned long long x, sp;
+  int i;
+
+  for (; len>=8; len -= 8, s += 8) {
+    memcpy(&x, s, 8);
+    x = SWAP_LE64(x);
+    lengths[0] += WC_COUNT(wc_zero(x^(WC_ONES*'\n')));
+    if (words) {
+      sp = wc_space(x);
+      lengths[1] += WC_COUNT(~sp & ((sp<<8)|(*space<<7)) & WC_HIGH);
+      *space = sp>>63;
+    }
+  }
+  for (; len; len--, s++) {
+    lengths[0] += *s=='\n';
+    i = *s==' ' || (unsigned char)(*s-9)<5;
+    lengths[1] += words && *space && !i;
+    *space = i;
+  }
+}
+
 static void do_wc(int fd, char *name)
 {
-  int i, len, clen=1, space;
+  int i, len, clen=1, space = 1, lines, words;
   unsigned long word=0, lengths[]={0,0,0};
+  struct stat st;
+  off_t pos, end;
+
+  lines = !toys.optflags || (toys.optflags&FLAG_l);
+  words = !toys.optflags || (toys.optflags&FLAG_w);
+
+  // Just bytes of a regular file doesn't need to read it, but stop short
+  // and read the last block since /proc and /sys files lie about their size.
+  if (!lines && !words && !(toys.optflags&FLAG_m) && !fstat(fd, &st)
+      && S_ISREG(st.st_mode) && (pos = lseek(fd, 0, SEEK_CUR)) != -1)
+  {
+    end = st.st_size - st.st_size%(st.st_blksize+1);
+    if (pos<end && lseek(fd, end, SEEK_SET)==end) lengths[2] = end-pos;
+  }
 
   for (;;) {
-    len = read(fd, toybuf, sizeof(toybuf));
+    len = read(fd, TT.buf, WC_READ);
     if (len<0) perror_msg("%s", name);
     if (len<1) break;
+    if (!CFG_TOYBOX_I18N || !(toys.optflags&FLAG_m)) {
+      lengths[2] += len;
+      if (lines || words) wc_count(TT.buf, len, lengths, &space, words);
+
+      continue;
+    }
     for (i=0; i<len; i+=clen) {
       wchar_t wchar;
 
-      if (CFG_TOYBOX_I18N && (toys.optflags&FLAG_m)) {
-        clen = mbrtowc(&wchar, toybuf+i, len-i, 0);
-        if (clen == -1) {
-          clen = 1;
-          continue;
-        }
-        if (clen == -2) break;
-        if (clen == 0) clen=1;
-        space = iswspace(wchar);
-      } else space = isspace(toybuf[i]);
-
-      if (toybuf[i]==10) lengths[0]++;
+      clen = mbrtowc(&wchar, TT.buf+i, len-i, 0);
+      if (clen == -1) {
+        clen = 1;
+        continue;
+      }
+      if (clen == -2) break;
+      if (clen == 0) clen=1;
+      space = iswspace(wchar);
+
+      if (TT.buf[i]==10) lengths[0]++;
       if (space) word=0;
       else {
         if (!word) lengths[1]++;
@@ -84,6 +152,8 @@ static void do_wc(int fd, char *name)
 void wc_main(void)
 {
   toys.optflags |= (toys.optflags&8)>>1;
+  TT.buf = xmalloc(WC_READ);
   loopfiles(toys.optargs, do_wc);
   if (toys.optc>1) show_lengths(TT.totals, "total");
+  if (CFG_TOYBOX_FREE) free(TT.buf);
 }
@@ -27,24 +27,22 @@ config WHO
 void who_main(void)
 {
 #if CFG_TOYBOX_UTMPX
+  struct utmpfile uf;
   struct utmpx *entry;
-
-  setutxent();
-
-  while ((entry = getutxent())) {
-    if ((toys.optflags & FLAG_a) || entry->ut_type == USER_PROCESS) {
-      time_t time;
-      int time_size;
-      char *times;
-
-      time = entry->ut_tv.tv_sec;
-      times = ctime(&time);
-      time_size = strlen(times) - 2;
-      printf("%s\t%s\t%*.*s\t(%s)\n", entry->ut_user, entry->ut_line,
-        time_size, time_size, ctime(&time), entry->ut_host);
-    }
+  long i = -1;
+
+  utmpfile_open(&uf, 0);
+  while ((entry = utmpfile_next(&uf, &i, 0,
+      (toys.optflags & FLAG_a) ? 0 : 1<<USER_PROCESS)))
+  {
+    time_t time = entry->ut_tv.tv_sec;
+    char *times = ctime(&time);
+    int time_size = strlen(times) - 2;
+
+    printf("%s\t%s\t%*.*s\t(%s)\n", entry->ut_user, entry->ut_line,
+      time_size, time_size, times, entry->ut_host);
   }
 
-  endutxent();
+  utmpfile_close(&uf);
 #endif
 }
@@ -6,13 +6,13 @@
  *
  * TODO: Rich's whitespace objection, env size isn't fixed anymore.
 
-USE_XARGS(NEWTOY(xargs, "^I:E:L#ptxrn#<1s#0", TOYFLAG_USR|TOYFLAG_BIN))
+USE_XARGS(NEWTOY(xargs, "^P#<0I:E:L#ptxrn#<1s#0", TOYFLAG_USR|TOYFLAG_BIN))
 
 config XARGS
   bool "xargs"
   default y
   help
-    usage: xargs [-ptxr0] [-s NUM] [-n NUM] [-L NUM] [-E STR] COMMAND...
+    usage: xargs [-ptxr0] [-s NUM] [-n NUM] [-L NUM] [-E STR] [-P NUM] COMMAND...
 
     Run command line one or more times, appending arguments from stdin.
 
@@ -20,6 +20,8 @@ config XARGS
 
     -s	Size in bytes per command line
     -n	Max number of arguments per command
+    -P	Run up to NUM commands at once (0 = one per CPU), each one's output
+    	printed together when it exits
     -0	Each argument is NULL terminated, no whitespace or quote processing
     #-p	Prompt for y/n from tty before running each command
     #-t	Trace, print command line to stderr
@@ -47,9 +49,12 @@ GLOBALS(
   long L;
   char *eofstr;
   char *I;
+  long P;
 
   long entries, bytes;
   char delim;
+  int stop;
+  void *jobs, *pfd;
 )
 
 // If out==NULL count TT.bytes and TT.entries, stopping at max.
@@ -107,14 +112,161 @@ static char *handle_entries(char *data, char **entry)
   return NULL;
 }
 
+// Fold a command's exit status into ours the way GNU does: any failure
+// makes it 123, and exiting 255, dying to a signal, or not being runnable
+// at all stops us launching more and says so (124, 125, 126/127).
+static void xargs_status(int status)
+{
+  if (!status) return;
+  if (status == 255) status = 124;
+  else if (status > 127) status = 125;
+  else if (status < 126) {
+    toys.exitval = 123;
+    return;
+  }
+  if (!TT.stop) TT.stop = status;
+}
+
+// One batch of arguments, run while the next ones are read.
+struct xargs_job {
+  struct double_list *dlist;
+  char **out, *buf;
+  struct toy_thread *tt;
+  pid_t pid;
+  int fd, len, done;
+};
+
+// Start a batch going, in a thread if it's a toy and otherwise in a child
+// process, with its output going to a pipe we collect it from. A toy can
+// only write somewhere other than our stdout if this libc gives each
+// command its own stdio, otherwise it just shares ours.
+static void xargs_start(struct xargs_job *job)
+{
+  int pipes[2] = {-1, -1};
+
+#if CFG_TOYBOX_THREADS
+  struct toy_list *toy = toy_find(*job->out);
+
+  if (toy && toys.stacktop && !CFG_TOYBOX_NORECURSE) {
+    int fd = -1;
+
+    if (TOYBOX_TASK_STDIO) {
+      if (pipe(pipes)) perror_exit("pipe");
+      fd = xopen("/dev/null", O_RDONLY);
+    }
+    if ((job->tt = toy_thread_start(toy, job->out, fd, pipes[1]))) {
+      job->fd = pipes[0];
+      return;
+    }
+    if (fd != -1) {
+      close(fd);
+      close(pipes[0]);
+      close(pipes[1]);
+    }
+  }
+#endif
+
+  if (pipe(pipes)) perror_exit("pipe");
+  if (!(job->pid = XVFORK())) {
+    xclose(0);
+    open("/dev/null", O_RDONLY);
+    dup2(pipes[1], 1);
+    close(pipes[0]);
+    close(pipes[1]);
+    xexec(job->out);
+  }
+  close(pipes[1]);
+  job->fd = pipes[0];
+}
+
+// Whether job has exited (waiting for it if block), collecting its status.
+static int xargs_done(struct xargs_job *job, int block)
+{
+  int status;
+
+  if (job->done) return 1;
+#if CFG_TOYBOX_THREADS
+  if (job->tt) {
+    if (!block && !toy_thread_done(job->tt)) return 0;
+    xargs_status(toy_thread_join(job->tt));
+
+    return job->done = 1;
+  }
+#endif
+  if (waitpid(job->pid, &status, block ? 0 : WNOHANG) != job->pid) return 0;
+  xargs_status(WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status)+127);
+
+  return job->done = 1;
+}
+
+// Collect output from running batches until at least one of them is done,
+// then print all the output of each finished batch at once and free it.
+static void xargs_reap(void)
+{
+  struct xargs_job *job, *jobs = TT.jobs;
+  struct pollfd *pfd = TT.pfd;
+  int i, n, finished = 0, len;
+
+  for (;;) {
+    for (i = n = 0; i < TT.P; i++) {
+      job = jobs+i;
+      if (!job->out) continue;
+      if (job->fd != -1) {
+        pfd[n].fd = job->fd;
+        pfd[n++].events = POLLIN;
+      } else if (xargs_done(job, 0)) {
+        fflush(stdout);
+        if (job->len) txwrite(1, job->buf, job->len);
+        free(job->buf);
+        free(job->out);
+        llist_traverse(job->dlist, llist_free_double);
+        memset(job, 0, sizeof(*job));
+        finished++;
+      }
+    }
+    if (finished) return;
+
+    // Nothing left to read (a thread sharing our stdout, or a child that
+    // closed its own) so wait for one to exit.
+    if (!n) {
+      for (job = jobs; !job->out; job++);
+      xargs_done(job, 1);
+      continue;
+    }
+
+    if (poll(pfd, n, -1) < 0) {
+      if (errno == EINTR) continue;
+      perror_exit("poll");
+    }
+    for (i = n = 0; i < TT.P; i++) {
+      job = jobs+i;
+      if (!job->out || job->fd == -1 || !pfd[n++].revents) continue;
+      if (0 < (len = read(job->fd, libbuf, sizeof(libbuf)))) {
+        job->buf = xrealloc(job->buf, job->len+len);
+        memcpy(job->buf+job->len, libbuf, len);
+        job->len += len;
+      } else {
+        close(job->fd);
+        job->fd = -1;
+      }
+    }
+  }
+}
+
 void xargs_main(void)
 {
   struct double_list *dlist = NULL, *dtemp;
-  int entries, bytes, done = 0, status;
+  struct xargs_job *job;
+  int entries, bytes, done = 0, status, fd, ran = 0;
   char *data = NULL, **out;
   pid_t pid;
 
   if (!(toys.optflags & FLAG_0)) TT.delim = '\n';
+  if ((toys.optflags & FLAG_P) && !TT.P) TT.P = sysconf(_SC_NPROCESSORS_ONLN);
+  if (TT.P > 1) {
+    TT.jobs = xzalloc(TT.P*sizeof(struct xargs_job));
+    TT.pfd = xmalloc(TT.P*sizeof(struct pollfd));
+  }
 
   // If no optargs, call echo.
   if (!toys.optc) {
@@ -127,7 +279,7 @@ void xargs_main(void)
     bytes += strlen(toys.optargs[entries]);
 
   // Loop through exec chunks.
-  while (data || !done) {
+  while ((data || !done) && !TT.stop) {
     TT.entries = 0;
     TT.bytes = bytes;
 
@@ -160,6 +312,10 @@ void xargs_main(void)
     // Accumulate cally thing
 
     if (data && !TT.entries) error_exit("argument too long");
+
+    // Only run with no arguments from stdin if there weren't any at all
+    if (!TT.entries && ran) break;
+    ran++;
     out = xzalloc((entries+TT.entries+1)*sizeof(char *));
 
     // Fill out command line to exec
@@ -170,13 +326,38 @@ void xargs_main(void)
     for (dtemp = dlist; dtemp; dtemp = dtemp->next)
       handle_entries(dtemp->data, out+entries);
 
-    if (!(pid = XVFORK())) {
-      xclose(0);
-      open("/dev/null", O_RDONLY);
-      xexec(out);
+    // With -P hand it to a free slot, waiting for one if need be.
+    if (TT.jobs) {
+      for (;;) {
+        for (job = TT.jobs; job < (struct xargs_job *)TT.jobs+TT.P; job++)
+          if (!job->out) break;
+        if (job < (struct xargs_job *)TT.jobs+TT.P) break;
+        xargs_reap();
+      }
+      if (!TT.stop) {
+        job->out = out;
+        job->dlist = dlist;
+        xargs_start(job);
+        out = 0;
+        dlist = 0;
+      }
+
+    // Run toys in this process. Their stdin can only be pointed elsewhere
+    // when this libc gives each command its own stdio, otherwise it's ours.
+    } else {
+      fd = TOYBOX_TASK_STDIO ? open("/dev/null", O_RDONLY) : -1;
+      if (-1 == (status = xrun_toy(out, fd, -1))) {
+        if (fd != -1) close(fd);
+        if (!(pid = XVFORK())) {
+          xclose(0);
+          open("/dev/null", O_RDONLY);
+          xexec(out);
+        }
+        waitpid(pid, &status, 0);
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status)+127;
+      }
+      xargs_status(status);
     }
-    waitpid(pid, &status, 0);
-    status = WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status)+127;
 
     // Abritrary number of execs, can't just leak memory each time...
     while (dlist) {
@@ -188,4 +369,19 @@ void xargs_main(void)
     }
     free(out);
   }
+
+  // Wait for the last batches
+  if (TT.jobs) {
+    for (;;) {
+      for (job = TT.jobs; job < (struct xargs_job *)TT.jobs+TT.P; job++)
+        if (job->out) break;
+      if (job == (struct xargs_job *)TT.jobs+TT.P) break;
+      xargs_reap();
+    }
+    if (CFG_TOYBOX_FREE) {
+      free(TT.jobs);
+      free(TT.pfd);
+    }
+  }
+  if (TT.stop) toys.exitval = TT.stop;
 }
@@ -89,6 +89,61 @@ struct toy_list *toy_find(char *name);
 void toy_init(struct toy_list *which, char *argv[]);
 int toy_run(struct toy_list *cmd, char *argv[]);
 //void toy_exec(char *argv[]);
+struct toy_thread;
+struct toy_thread *toy_thread_start(struct toy_list *which, char *argv[],
+  int in, int out);
+int toy_thread_join(struct toy_thread *tt);
+int toy_thread_done(struct toy_thread *tt);
+void toy_thread_queue(struct toy_thread *tt);
+void toy_thread_notify(struct toy_thread *tt, int fd);
+struct toy_thread *toy_thread_reap(int block);
+int toy_thread_ready(void);
+struct toy_thread *toy_thread_next(struct toy_thread *tt);
+#if CFG_TOYBOX_THREADS
+extern void (*toy_thread_exited)(pthread_t owner);
+int toy_worker_create(pthread_t *tid, pthread_attr_t *attr,
+  void *(*func)(void *), void *arg);
+#endif
+void toy_thread_cancel(struct toy_thread *tt, int sig);
+void toy_cancelled(void) noreturn;
+extern int toy_thread_keep;
+extern TOYTLS volatile int *toy_cancel;
+
+// What the commands run in this thread moved through lib's read and write
+// calls, and the files they opened. Only ever goes up.
+struct toy_io {
+  unsigned long long rbytes, wbytes;
+  unsigned long reads, writes, opens;
+};
+extern TOYTLS struct toy_io toy_io;
+
+// Count a read() or write() that returned len (which is evaluated twice).
+#define TOY_IO_READ(len) (toy_io.reads++, toy_io.rbytes += (len)>0 ? (len) : 0)
+#define TOY_IO_WRITE(len) \
+  (toy_io.writes++, toy_io.wbytes += (len)>0 ? (len) : 0)
+
+// What toy_run() calls used: the last one in this thread (toy_last), and all
+// of them added up by command (toy_total, indexed like toy_list). The times
+// are nanoseconds of this thread's clocks, and include commands run from
+// inside the command. heap is the most its x*alloc() blocks came to at once,
+// the largest of any run in toy_total.
+struct toy_usage {
+  unsigned long long wall, user, sys;
+  struct toy_io io;
+  unsigned long runs, heap;
+};
+extern TOYTLS struct toy_usage toy_last;
+extern struct toy_usage toy_total[];
+
+// Commands running in a thread can't be sent a signal, so kill asks them to
+// stop and long running loops check here.
+#if CFG_TOYBOX_THREADS
+#define toy_cancelpoint() do { \
+  if (toy_cancel && *toy_cancel) toy_cancelled(); \
+} while (0)
+#else
+#define toy_cancelpoint() do {} while (0)
+#endif
 
 // Flags describing command behavior.
 
@@ -120,10 +175,13 @@ extern struct toy_list {
   char *options;
   int flags;
 } toy_list[];
+extern const int toy_count;
 
-// Global context shared by all commands.
+// Everything one invocation of a command owns. toy_run() gives each call
+// its own, so a command run from inside another (xargs, find -exec) or in
+// another thread doesn't stomp on anybody else's flags, GLOBALS or buffers.
 
-extern struct toy_context {
+struct toy_context {
   struct toy_list *which;  // Which entry in toy_list is this one?
   char **argv;             // Original command line arguments
   char **optargs;          // Arguments left over from get_optflags()
@@ -134,15 +192,29 @@ extern struct toy_context {
   int toycount;            // Total number of commands in this build
   int signal;              // generic_signal() records what signal it saw here
   int signalfd;            // and writes signal to this fd, if set
+  int ttyout;              // stdout is a tty (1), isn't (-1), not checked (0)
+  void *abscache;          // directories xabspath() has resolved, see xfile.c
 
   // This is at the end so toy_init() doesn't zero it.
   jmp_buf *rebound;        // longjmp here instead of exit when do_rebound set
   void *stacktop;          // nested toy_exec() call count, or -1 if vforked
-} toys;
+  struct toy_heap heap;    // x*alloc() blocks to free when command exits
+  int keep;                // xkeep_all() depth: don't add to heap
+
+  union global_union global;  // this.command's GLOBALS()
+
+  // Two big temporary buffers: one for use by commands, one for library
+  // functions. Left uninitialized, nothing may assume they start zeroed.
+  char scratch[4096], libscratch[4096];
+};
 
-// Two big temporary buffers: one for use by commands, one for library functions
+// The context of whatever command this thread is running.
+extern TOYTLS struct toy_context *toy_current;
 
-extern char toybuf[4096], libbuf[4096];
+#define toys (*toy_current)
+#define this (toy_current->global)
+#define toybuf (toy_current->scratch)
+#define libbuf (toy_current->libscratch)
 
 extern char **environ;
 
@@ -109,6 +109,10 @@ ct_encode_string(const Char *s, ct_buffer_t *conv)
 		}
 		if (!*s)
 			break;
+		if ((unsigned long)*s < 0x80) {	/* ASCII is itself */
+			*dst++ = (char)*s++;
+			continue;
+		}
 		used = ct_encode_char(dst, (size_t)5, *s);
 		if (used == -1) /* failed to encode, need more buffer space */
 			abort();
@@ -127,6 +131,23 @@ ct_decode_string(const char *s, ct_buffer_t *conv)
 	if (!s)
 		return NULL;
 
+	/*
+	 * Prompts are decoded on every refresh, and are almost always
+	 * ASCII, which needs no mbstowcs() to widen.
+	 */
+	for (len = 0; s[len] && !(s[len] & 0x80); len++)
+		continue;
+	if (!s[len]) {
+		if (conv->wsize < len + 1)
+			if (ct_conv_wbuff_resize(conv, len + 1 + CT_BUFSIZ)
+			    == -1)
+				return NULL;
+		conv->wbuff[len] = 0;
+		while (len--)
+			conv->wbuff[len] = (unsigned char)s[len];
+		return conv->wbuff;
+	}
+
 	len = ct_mbstowcs(NULL, s, (size_t)0);
 	if (len == (size_t)-1)
 		return NULL;
@@ -202,6 +223,10 @@ ct_encode_char(char *dst, size_t len, Char c)
 	ssize_t l = 0;
 	if (len < ct_enc_width(c))
 		return -1;
+	if ((unsigned long)c < 0x80) {	/* skip wctomb() for ASCII */
+		*dst = (char)c;
+		return 1;
+	}
 	l = ct_wctomb(dst, c);
 
 	if (l < 0) {
@@ -275,7 +300,7 @@ ct_visual_width(Char c)
 		return 0; /* Should this be 1 instead? */
 #ifdef WIDECHAR
 	case CHTYPE_PRINT:
-		return wcwidth(c);
+		return c < 0x80 ? 1 : wcwidth(c);
 	case CHTYPE_NONPRINT:
 		if (c > 0xffff) /* prefer standard 4-byte display over 5-byte */
 			return 8; /* \U+12345 */
@@ -351,6 +376,9 @@ ct_visual_char(Char *dst, size_t len, Char c)
 protected int
 ct_chr_class(Char c)
 {
+	/* ASCII without asking the locale, it's most of what's classified */
+	if (c >= 0x20 && c < 0x7f)
+		return CHTYPE_PRINT;
 	if (c == '\t')
 		return CHTYPE_TAB;
 	else if (c == '\n')
@@ -46,6 +46,7 @@ __RCSID("$NetBSD: filecomplete.c,v 1.34 2014/10/18 15:07:02 riz Exp $");
 #include <unistd.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
 #include <fcntl.h>
 #include <vis.h>
 
@@ -134,6 +135,187 @@ fn_tilde_expand(const char *txt)
 }
 
 
+/*
+ * The directories completion has read lately.  Each is kept as a sorted
+ * array of its names, so the ones starting with a prefix are found with
+ * a binary search, and is read again only once its mtime has changed.
+ * What readdir() said each name is goes in a byte before it: 'd' for a
+ * directory, 'f' for anything else, and '?' when it didn't say or for a
+ * symbolic link, which might be to a directory; those are left to stat().
+ */
+#define FN_NDIRS	4
+
+struct fn_dir {
+	char	 *path;
+	dev_t	  dev;
+	ino_t	  ino;
+	time_t	  mtime;
+	char	**names;
+	size_t	  count;
+};
+
+static struct fn_dir fn_dirs[FN_NDIRS];
+static size_t fn_nextdir;
+static struct fn_dir *fn_lastdir;	/* what the last completion read */
+
+static void
+fn_dirfree(struct fn_dir *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->count; i++)
+		el_free(d->names[i]);
+	el_free(d->names);
+	el_free(d->path);
+	d->names = NULL;
+	d->path = NULL;
+	d->count = 0;
+}
+
+static int
+fn_dircmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a + 1, *(char * const *)b + 1);
+}
+
+static char
+fn_dtype(const struct dirent *entry)
+{
+#ifdef DT_DIR
+	switch (entry->d_type) {
+	case DT_DIR:
+		return 'd';
+	case DT_UNKNOWN:
+	case DT_LNK:
+		return '?';
+	default:
+		return 'f';
+	}
+#else
+	return '?';
+#endif
+}
+
+/*
+ * Return the names in the directory path, from the cache if they are
+ * still current.
+ */
+static struct fn_dir *
+fn_dirload(const char *path)
+{
+	struct fn_dir *d;
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+	char **names;
+	size_t i, len, size;
+
+	if (stat(path, &st) == -1)
+		return NULL;
+	for (i = 0; i < FN_NDIRS; i++)
+		if (fn_dirs[i].path && strcmp(fn_dirs[i].path, path) == 0)
+			break;
+	if (i < FN_NDIRS) {
+		d = &fn_dirs[i];
+		if (d->dev == st.st_dev && d->ino == st.st_ino &&
+		    d->mtime == st.st_mtime)
+			return d;
+	} else {
+		d = &fn_dirs[fn_nextdir];
+		fn_nextdir = (fn_nextdir + 1) % FN_NDIRS;
+	}
+	fn_dirfree(d);
+
+	if ((dir = opendir(path)) == NULL)
+		return NULL;
+	size = 0;
+	while ((entry = readdir(dir)) != NULL) {
+		/* skip . and .. */
+		if (entry->d_name[0] == '.' && (!entry->d_name[1]
+		    || (entry->d_name[1] == '.' && !entry->d_name[2])))
+			continue;
+		if (d->count == size) {
+			size = size ? size * 2 : 64;
+			names = el_realloc(d->names, size * sizeof(*names));
+			if (names == NULL)
+				goto bad;
+			d->names = names;
+		}
+       /* Some dirents have d_namlen, but it is not portable. */
+		len = strlen(entry->d_name);
+		if ((d->names[d->count] = el_malloc(len + 2)) == NULL)
+			goto bad;
+		d->names[d->count][0] = fn_dtype(entry);
+		(void)memcpy(d->names[d->count] + 1, entry->d_name, len + 1);
+		d->count++;
+	}
+	(void)closedir(dir);
+	if ((d->path = strdup(path)) == NULL) {
+		fn_dirfree(d);
+		return NULL;
+	}
+	qsort(d->names, d->count, sizeof(*d->names), fn_dircmp);
+	d->dev = st.st_dev;
+	d->ino = st.st_ino;
+	/*
+	 * Something added later in the same second wouldn't change the
+	 * mtime, so what was read in that second is read again next time.
+	 */
+	d->mtime = st.st_mtime < time(NULL) ? st.st_mtime : (time_t)-1;
+	return d;
+bad:
+	(void)closedir(dir);
+	fn_dirfree(d);
+	return NULL;
+}
+
+/*
+ * Index of the first name in d not less than prefix: the first of those
+ * starting with it, if there are any.
+ */
+static size_t
+fn_dirfind(const struct fn_dir *d, const char *prefix)
+{
+	size_t lo = 0, hi = d->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(d->names[mid] + 1, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * What the last completion's directory says path is, 0 if it doesn't
+ * know.
+ */
+static char
+fn_dirtype(const char *path)
+{
+	const char *base = strrchr(path, '/');
+	size_t len, i;
+
+	if (fn_lastdir == NULL)
+		return 0;
+	if (base) {
+		len = (size_t)(++base - path);
+		if (strlen(fn_lastdir->path) != len ||
+		    strncmp(fn_lastdir->path, path, len) != 0)
+			return 0;
+	} else {
+		base = path;
+		if (strcmp(fn_lastdir->path, "./") != 0)
+			return 0;
+	}
+	i = fn_dirfind(fn_lastdir, base);
+	if (i < fn_lastdir->count && strcmp(fn_lastdir->names[i] + 1, base) == 0)
+		return fn_lastdir->names[i][0];
+	return 0;
+}
+
 /*
  * return first found file name starting by the ``text'' or NULL if no
  * such file can be found
@@ -144,11 +326,10 @@ fn_tilde_expand(const char *txt)
 char *
 fn_filename_completion_function(const char *text, int state)
 {
-	static DIR *dir = NULL;
+	static struct fn_dir *dir = NULL;
 	static char *filename = NULL, *dirname = NULL, *dirpath = NULL;
-	static size_t filename_len = 0;
-	struct dirent *entry;
-	char *temp;
+	static size_t filename_len = 0, next = 0;
+	char *temp, *entry;
 	size_t len;
 
 	if (state == 0 || dir == NULL) {
@@ -190,11 +371,6 @@ fn_filename_completion_function(const char *text, int state)
 			dirname = NULL;
 		}
 
-		if (dir != NULL) {
-			(void)closedir(dir);
-			dir = NULL;
-		}
-
 		/* support for ``~user'' syntax */
 
 		el_free(dirpath);
@@ -211,44 +387,25 @@ fn_filename_completion_function(const char *text, int state)
 		if (dirpath == NULL)
 			return NULL;
 
-		dir = opendir(dirpath);
+		dir = fn_lastdir = fn_dirload(dirpath);
 		if (!dir)
 			return NULL;	/* cannot open the directory */
 
 		/* will be used in cycle */
 		filename_len = filename ? strlen(filename) : 0;
+		next = fn_dirfind(dir, filename ? filename : "");
 	}
 
-	/* find the match */
-	while ((entry = readdir(dir)) != NULL) {
-		/* skip . and .. */
-		if (entry->d_name[0] == '.' && (!entry->d_name[1]
-		    || (entry->d_name[1] == '.' && !entry->d_name[2])))
-			continue;
-		if (filename_len == 0)
-			break;
-		/* otherwise, get first entry where first */
-		/* filename_len characters are equal	  */
-		if (entry->d_name[0] == filename[0]
-          /* Some dirents have d_namlen, but it is not portable. */
-		    && strlen(entry->d_name) >= filename_len
-		    && strncmp(entry->d_name, filename,
-			filename_len) == 0)
-			break;
-	}
-
-	if (entry) {		/* match found */
-
-       /* Some dirents have d_namlen, but it is not portable. */
-		len = strlen(entry->d_name);
-
-		len = strlen(dirname) + len + 1;
+	/* the matches, if any, are next in order */
+	if (next < dir->count && (filename_len == 0 ||
+	    strncmp(dir->names[next] + 1, filename, filename_len) == 0)) {
+		entry = dir->names[next++] + 1;
+		len = strlen(dirname) + strlen(entry) + 1;
 		temp = el_malloc(len * sizeof(*temp));
 		if (temp == NULL)
 			return NULL;
-		(void)snprintf(temp, len, "%s%s", dirname, entry->d_name);
+		(void)snprintf(temp, len, "%s%s", dirname, entry);
 	} else {
-		(void)closedir(dir);
 		dir = NULL;
 		temp = NULL;
 	}
@@ -264,6 +421,14 @@ append_char_function(const char *name)
 	char *expname = *name == '~' ? fn_tilde_expand(name) : NULL;
 	const char *rs = " ";
 
+	/* completion has just read the directory, which may say */
+	switch (fn_dirtype(expname ? expname : name)) {
+	case 'd':
+		rs = "/";
+		/* FALLTHROUGH */
+	case 'f':
+		goto out;
+	}
 	if (stat(expname ? expname : name, &stbuf) == -1)
 		goto out;
 	if (S_ISDIR(stbuf.st_mode))
@@ -277,7 +442,6 @@ out:
  * returns list of completions for text given
  * non-static for readline.
  */
-char ** completion_matches(const char *, char *(*)(const char *, int));
 char **
 completion_matches(const char *text, char *(*genfunc)(const char *, int))
 {
@@ -428,6 +592,7 @@ fn_complete(EditLine *el,
 	if (completion_type != NULL)
 		*completion_type = what_to_do;
 
+	fn_lastdir = NULL;
 	if (!complet_func)
 		complet_func = fn_filename_completion_function;
 	if (!app_func)
@@ -575,3 +740,20 @@ _el_fn_complete(EditLine *el, int ch __attribute__((__unused__)))
 	    break_chars, NULL, NULL, (size_t)100,
 	    NULL, NULL, NULL, NULL);
 }
+
+/*
+ * As above, but with attempted tried first on each word, so that an
+ * application can complete some words itself: it is passed the word and
+ * where it starts and ends in the line, and returns NULL to leave the word
+ * to filename completion.
+ */
+unsigned char
+_el_fn_complete_app(EditLine *el,
+	char **(*attempted)(const char *, int, int))
+{
+	int over = 0;
+
+	return (unsigned char)fn_complete(el, NULL, attempted,
+	    break_chars, NULL, NULL, (size_t)100,
+	    NULL, &over, NULL, NULL);
+}
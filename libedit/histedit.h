@@ -113,6 +113,10 @@ int		 el_parse(EditLine *, int, const char **);
 int		 el_set(EditLine *, int, ...);
 int		 el_get(EditLine *, int, ...);
 unsigned char	_el_fn_complete(EditLine *, int);
+unsigned char	_el_fn_complete_app(EditLine *,
+		    char **(*)(const char *, int, int));
+char		**completion_matches(const char *,
+		    char *(*)(const char *, int));
 
 /*
  * el_set/el_get parameters
@@ -226,6 +230,7 @@ int		history(History *, HistEvent *, int, ...);
 #define	H_DELDATA	24	/* , int, histdata_t *);*/
 #define	H_REPLACE	25	/* , const char *, histdata_t);	*/
 #define	H_SAVE_FP	26	/* , FILE *);		*/
+#define	H_SAVE_APPEND	27	/* , const char *);	*/
 
 
 
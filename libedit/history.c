@@ -51,6 +51,8 @@ __RCSID("$NetBSD: history.c,v 1.47 2014/05/11 01:05:17 christos Exp $");
 #include <stdlib.h>
 #include <stdarg.h>
 #include <vis.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 static const char hist_cookie[] = "_HiStOrY_V2_\n";
@@ -109,6 +111,7 @@ private int history_set_fun(TYPE(History) *, TYPE(History) *);
 private int history_load(TYPE(History) *, const char *);
 private int history_save(TYPE(History) *, const char *);
 private int history_save_fp(TYPE(History) *, FILE *);
+private int history_save_append(TYPE(History) *, const char *);
 private int history_prev_event(TYPE(History) *, TYPE(HistEvent) *, int);
 private int history_next_event(TYPE(History) *, TYPE(HistEvent) *, int);
 private int history_next_string(TYPE(History) *, TYPE(HistEvent) *, const Char *);
@@ -728,42 +731,73 @@ history_set_fun(TYPE(History) *h, TYPE(History) *nh)
 
 
 /* history_load():
- *	TYPE(History) load function
+ *	TYPE(History) load function.  The file is read in one go, and
+ *	only as many of its last lines as the history can hold are
+ *	entered, since a file that's appended to grows past that.
+ *	Returns the number of lines in the file.
  */
 private int
 history_load(TYPE(History) *h, const char *fname)
 {
-	FILE *fp;
-	char *line;
-	size_t sz, max_size;
+	struct stat st;
+	char *buf, *line, *end, *nl;
+	size_t sz, max_size, skip;
 	char *ptr;
-	int i = -1;
+	ssize_t n;
+	int fd, i = -1;
 	TYPE(HistEvent) ev;
 #ifdef WIDECHAR
 	static ct_buffer_t conv;
 #endif
 
-	if ((fp = fopen(fname, "r")) == NULL)
+	if ((fd = open(fname, O_RDONLY)) == -1)
 		return i;
+	if (fstat(fd, &st) == -1 || (buf = h_malloc((size_t)st.st_size + 1))
+	    == NULL) {
+		(void) close(fd);
+		return i;
+	}
+	for (sz = 0; sz < (size_t)st.st_size; sz += (size_t)n)
+		if ((n = read(fd, buf + sz, (size_t)st.st_size - sz)) <= 0)
+			break;
+	(void) close(fd);
+	end = buf + sz;
+	*end = '\0';
 
-	if ((line = fgetln(fp, &sz)) == NULL)
+	if (sz < sizeof(hist_cookie) - 1 ||
+	    strncmp(buf, hist_cookie, sizeof(hist_cookie) - 1) != 0)
 		goto done;
+	line = buf + sizeof(hist_cookie) - 1;
 
-	if (strncmp(line, hist_cookie, sz) != 0)
-		goto done;
+	/* Count the lines, and find the first one worth entering. */
+	skip = 0;
+	for (i = 0, nl = line; nl < end; i++)
+		if ((nl = memchr(nl, '\n', (size_t)(end - nl))) == NULL)
+			nl = end;
+		else
+			nl++;
+	if (h->h_next == history_def_next &&
+	    i > ((history_t *)h->h_ref)->max) {
+		/* Number the events as if the skipped ones were entered. */
+		skip = (size_t)(i - ((history_t *)h->h_ref)->max);
+		((history_t *)h->h_ref)->eventid += (int)skip;
+	}
 
 	ptr = h_malloc((max_size = 1024) * sizeof(*ptr));
-	if (ptr == NULL)
+	if (ptr == NULL) {
+		i = -1;
 		goto done;
-	for (i = 0; (line = fgetln(fp, &sz)) != NULL; i++) {
-		char c = line[sz];
-
-		if (sz != 0 && line[sz - 1] == '\n')
-			line[--sz] = '\0';
-		else
-			line[sz] = '\0';
-
-		if (max_size < sz) {
+	}
+	for (; line < end; line = nl) {
+		if ((nl = memchr(line, '\n', (size_t)(end - line))) == NULL)
+			nl = end;
+		*nl++ = '\0';
+		if (skip) {
+			skip--;
+			continue;
+		}
+		sz = strlen(line);
+		if (max_size < sz + 1) {
 			char *nptr;
 			max_size = (sz + 1024) & (size_t)~1023;
 			nptr = h_realloc(ptr, max_size * sizeof(*ptr));
@@ -774,7 +808,6 @@ history_load(TYPE(History) *h, const char *fname)
 			ptr = nptr;
 		}
 		(void) strunvis(ptr, line);
-		line[sz] = c;
 		if (HENTER(h, &ev, ct_decode_string(ptr, &conv)) == -1) {
 			i = -1;
 			goto oomem;
@@ -783,7 +816,7 @@ history_load(TYPE(History) *h, const char *fname)
 oomem:
 	h_free(ptr);
 done:
-	(void) fclose(fp);
+	h_free(buf);
 	return i;
 }
 
@@ -854,6 +887,48 @@ history_save(TYPE(History) *h, const char *fname)
 }
 
 
+/* history_save_append():
+ *	Add the newest event to the end of a history file, starting the
+ *	file if there isn't one.  One write(), so that shells sharing a
+ *	file don't tear each other's lines.
+ */
+private int
+history_save_append(TYPE(History) *h, const char *fname)
+{
+	TYPE(HistEvent) ev;
+	struct stat st;
+	const char *str;
+	char *ptr;
+	size_t len;
+	int fd, i = -1;
+#ifdef WIDECHAR
+	static ct_buffer_t conv;
+#endif
+
+	if (HFIRST(h, &ev) == -1)
+		return i;
+	if ((fd = open(fname, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR|S_IWUSR))
+	    == -1)
+		return i;
+	str = ct_encode_string(ev.str, &conv);
+	len = sizeof(hist_cookie) + strlen(str) * 4 + 1;
+	if (fstat(fd, &st) == 0 && (ptr = h_malloc(len)) != NULL) {
+		len = 0;
+		if (st.st_size == 0) {
+			(void) strcpy(ptr, hist_cookie);
+			len = sizeof(hist_cookie) - 1;
+		}
+		len += (size_t)strvis(ptr + len, str, VIS_WHITE);
+		ptr[len++] = '\n';
+		if (write(fd, ptr, len) == (ssize_t)len)
+			i = 1;
+		h_free(ptr);
+	}
+	(void) close(fd);
+	return i;
+}
+
+
 /* history_prev_event():
  *	Find the previous event, with number given
  */
@@ -1040,6 +1115,12 @@ FUNW(history)(TYPE(History) *h, TYPE(HistEvent) *ev, int fun, ...)
 		    he_seterrev(ev, _HE_HIST_WRITE);
 		break;
 
+	case H_SAVE_APPEND:
+		retval = history_save_append(h, va_arg(va, const char *));
+		if (retval == -1)
+		    he_seterrev(ev, _HE_HIST_WRITE);
+		break;
+
 	case H_PREV_EVENT:
 		retval = history_prev_event(h, ev, va_arg(va, int));
 		break;
@@ -108,6 +108,10 @@ keymacro_init(EditLine *el)
 	    sizeof(*el->el_keymacro.buf));
 	if (el->el_keymacro.buf == NULL)
 		return -1;
+	el->el_keymacro.first = el_malloc(N_KEYS *
+	    sizeof(*el->el_keymacro.first));
+	if (el->el_keymacro.first == NULL)
+		return -1;
 	el->el_keymacro.map = NULL;
 	keymacro_reset(el);
 	return 0;
@@ -122,6 +126,8 @@ keymacro_end(EditLine *el)
 
 	el_free(el->el_keymacro.buf);
 	el->el_keymacro.buf = NULL;
+	el_free(el->el_keymacro.first);
+	el->el_keymacro.first = NULL;
 	node__free(el->el_keymacro.map);
 }
 
@@ -161,6 +167,7 @@ keymacro_reset(EditLine *el)
 
 	node__put(el, el->el_keymacro.map);
 	el->el_keymacro.map = NULL;
+	el->el_keymacro.firstok = 0;
 	return;
 }
 
@@ -176,8 +183,32 @@ keymacro_reset(EditLine *el)
 protected int
 keymacro_get(EditLine *el, Char *ch, keymacro_value_t *val)
 {
-
-	return node_trav(el, el->el_keymacro.map, ch, val);
+	keymacro_node_t *ptr;
+	int i;
+
+	/*
+	 * Every key bound to a sequence starts at the top of the map,
+	 * so index its first characters rather than walk them each time.
+	 */
+	if (!el->el_keymacro.firstok) {
+		for (i = 0; i < N_KEYS; i++)
+			el->el_keymacro.first[i] = NULL;
+		for (ptr = el->el_keymacro.map; ptr; ptr = ptr->sibling)
+			if ((unsigned long)ptr->ch < N_KEYS &&
+			    !el->el_keymacro.first[ptr->ch])
+				el->el_keymacro.first[ptr->ch] = ptr;
+		el->el_keymacro.firstok = 1;
+	}
+	if ((unsigned long)*ch < N_KEYS) {
+		if ((ptr = el->el_keymacro.first[*ch]) == NULL) {
+			val->str = NULL;
+			return XK_STR;
+		}
+	} else if ((ptr = el->el_keymacro.map) == NULL) {
+		val->str = NULL;
+		return XK_STR;
+	}
+	return node_trav(el, ptr, ch, val);
 }
 
 
@@ -208,6 +239,7 @@ keymacro_add(EditLine *el, const Char *key, keymacro_value_t *val, int ntype)
 
 	/* Now recurse through el->el_keymacro.map */
 	(void) node__try(el, el->el_keymacro.map, key, val, ntype);
+	el->el_keymacro.firstok = 0;
 	return;
 }
 
@@ -248,6 +280,7 @@ keymacro_delete(EditLine *el, const Char *key)
 		return 0;
 
 	(void) node__delete(el, &el->el_keymacro.map, key);
+	el->el_keymacro.firstok = 0;
 	return 0;
 }
 
@@ -50,6 +50,8 @@ typedef struct keymacro_node_t keymacro_node_t;
 typedef struct el_keymacromacro_t {
 	Char		*buf;	/* Key print buffer		*/
 	keymacro_node_t	*map;	/* Key map			*/
+	keymacro_node_t	**first; /* Top node in map for each byte	*/
+	int		 firstok; /* first[] matches map		*/
 	keymacro_value_t val;	/* Local conversion buffer	*/
 } el_keymacro_t;
 
@@ -349,7 +349,9 @@ read_char(EditLine *el, Char *cp)
 	}
 
 #ifdef WIDECHAR
-	if (el->el_flags & CHARSET_IS_UTF8) {
+	/* An ASCII byte that doesn't end a sequence is just itself. */
+	if ((el->el_flags & CHARSET_IS_UTF8) &&
+	    (cbp || !isascii((unsigned char)cbuf[0]))) {
 		if (!utf8_islead((unsigned char)cbuf[0]))
 			goto again; /* discard the byte we read and try again */
 		++cbp;
@@ -105,7 +105,10 @@ regerror(const char *msg)
 
 
 /* el_match():
- *	Return if string matches pattern
+ *	Return if string matches pattern.  Searching the history calls
+ *	this with the same pattern for every line, so the pattern is only
+ *	compiled when it changes, and one that is just ".*text.*" needs
+ *	no regular expression at all.
  */
 protected int
 el_match(const Char *str, const Char *pat)
@@ -114,8 +117,10 @@ el_match(const Char *str, const Char *pat)
 	static ct_buffer_t conv;
 #endif
 #if defined (REGEX)
-	regex_t re;
-	int rv;
+	static regex_t re;
+	static char *lastpat;
+	static int lastrv;
+	const char *p;
 #elif defined (REGEXP)
 	regexp *rp;
 	int rv;
@@ -123,19 +128,40 @@ el_match(const Char *str, const Char *pat)
 	extern char	*re_comp(const char *);
 	extern int	 re_exec(const char *);
 #endif
+	const Char *cp;
+	size_t len;
 
 	if (Strstr(str, pat) != 0)
 		return 1;
 
+	len = Strlen(pat);
+	if (len >= 4 && pat[0] == '.' && pat[1] == '*' &&
+	    pat[len - 2] == '.' && pat[len - 1] == '*') {
+		for (cp = pat + 2; cp < pat + len - 2; cp++)
+			if (Strchr(STR(".[]*\\^$"), *cp))
+				break;
+		if (cp == pat + len - 2) {
+			for (len -= 4; Strncmp(str, pat + 2, len) != 0; str++)
+				if (*str == '\0')
+					return 0;
+			return 1;
+		}
+	}
+
 #if defined(REGEX)
-	if (regcomp(&re, ct_encode_string(pat, &conv), 0) == 0) {
-		rv = regexec(&re, ct_encode_string(str, &conv), (size_t)0, NULL,
-		    0) == 0;
-		regfree(&re);
-	} else {
-		rv = 0;
+	p = ct_encode_string(pat, &conv);
+	if (lastpat == NULL || strcmp(p, lastpat) != 0) {
+		if (lastpat != NULL && lastrv == 0)
+			regfree(&re);
+		el_free(lastpat);
+		if ((lastpat = strdup(p)) == NULL)
+			return 0;
+		lastrv = regcomp(&re, lastpat, 0);
 	}
-	return rv;
+	if (lastrv != 0)
+		return 0;
+	return regexec(&re, ct_encode_string(str, &conv), (size_t)0, NULL,
+	    0) == 0;
 #elif defined(REGEXP)
 	if ((re = regcomp(ct_encode_string(pat, &conv))) != NULL) {
 		rv = regexec(re, ct_encode_string(str, &conv));
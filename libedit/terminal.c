@@ -46,6 +46,7 @@ __RCSID("$NetBSD: terminal.c,v 1.14 2012/05/30 18:21:14 christos Exp $");
  *	       We have to declare a static variable here, since the
  *	       termcap putchar routine does not take an argument!
  */
+#include <errno.h>
 #include <stdio.h>
 #include <signal.h>
 #include <string.h>
@@ -83,6 +84,7 @@ __RCSID("$NetBSD: terminal.c,v 1.14 2012/05/30 18:21:14 christos Exp $");
  */
 
 #define	TC_BUFSIZE	((size_t)2048)
+#define	TC_FRAMESIZE	((size_t)4096)	/* output held until a flush */
 
 #define	GoodStr(a)	(el->el_terminal.t_str[a] != NULL && \
 			    el->el_terminal.t_str[a][0] != '\0')
@@ -210,11 +212,13 @@ private void	terminal_init_arrow(EditLine *);
 private void	terminal_reset_arrow(EditLine *);
 private int	terminal_putc(int);
 private void	terminal_tputs(EditLine *, const char *, int);
+private int	terminal_frame(EditLine *, const char *, size_t);
+private void	terminal_frame_write(EditLine *);
 
 #ifdef _REENTRANT
 private pthread_mutex_t terminal_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
-private FILE *terminal_outfile = NULL;
+private EditLine *terminal_el = NULL;
 
 
 /* terminal_setflags():
@@ -294,6 +298,10 @@ terminal_init(EditLine *el)
 		return -1;
 	(void) memset(el->el_terminal.t_val, 0, T_val *
 	    sizeof(*el->el_terminal.t_val));
+	el->el_terminal.t_frame = el_malloc(TC_FRAMESIZE);
+	if (el->el_terminal.t_frame == NULL)
+		return -1;
+	el->el_terminal.t_flen = 0;
 	(void) terminal_set(el, NULL);
 	terminal_init_arrow(el);
 	return 0;
@@ -306,6 +314,9 @@ protected void
 terminal_end(EditLine *el)
 {
 
+	terminal__flush(el);
+	el_free(el->el_terminal.t_frame);
+	el->el_terminal.t_frame = NULL;
 	el_free(el->el_terminal.t_buf);
 	el->el_terminal.t_buf = NULL;
 	el_free(el->el_terminal.t_cap);
@@ -1211,15 +1222,62 @@ terminal_bind_arrow(EditLine *el)
 	}
 }
 
+/* terminal_frame_write():
+ *	Write out what has been put in the frame so far
+ */
+private void
+terminal_frame_write(EditLine *el)
+{
+	char *p = el->el_terminal.t_frame;
+	size_t len = el->el_terminal.t_flen;
+	ssize_t n;
+	int fd;
+
+	el->el_terminal.t_flen = 0;
+	if ((fd = fileno(el->el_outfile)) == -1) {
+		(void) fwrite(p, 1, len, el->el_outfile);
+		(void) fflush(el->el_outfile);
+		return;
+	}
+	while (len > 0) {
+		if ((n = write(fd, p, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+}
+
+/* terminal_frame():
+ *	Add output to the frame, which goes out in one write() when
+ *	the refresh that made it is done with it, however the stdio
+ *	stream underneath happens to be buffered.
+ */
+private int
+terminal_frame(EditLine *el, const char *s, size_t len)
+{
+	if (el->el_terminal.t_frame == NULL)
+		return fwrite(s, 1, len, el->el_outfile) == len ? 0 : -1;
+	if (el->el_terminal.t_flen + len > TC_FRAMESIZE)
+		terminal_frame_write(el);
+	(void) memcpy(el->el_terminal.t_frame + el->el_terminal.t_flen, s, len);
+	el->el_terminal.t_flen += len;
+	return 0;
+}
+
 /* terminal_putc():
  *	Add a character
  */
 private int
 terminal_putc(int c)
 {
-	if (terminal_outfile == NULL)
+	char ch = (char)c;
+
+	if (terminal_el == NULL)
 		return -1;
-	return fputc(c, terminal_outfile);
+	return terminal_frame(terminal_el, &ch, 1) == 0 ? c : -1;
 }
 
 private void
@@ -1228,7 +1286,7 @@ terminal_tputs(EditLine *el, const char *cap, int affcnt)
 #ifdef _REENTRANT
 	pthread_mutex_lock(&terminal_mutex);
 #endif
-	terminal_outfile = el->el_outfile;
+	terminal_el = el;
 	(void)tputs(cap, affcnt, terminal_putc);
 #ifdef _REENTRANT
 	pthread_mutex_unlock(&terminal_mutex);
@@ -1248,18 +1306,20 @@ terminal__putc(EditLine *el, Int c)
 	i = ct_encode_char(buf, (size_t)MB_LEN_MAX, c);
 	if (i <= 0)
 		return (int)i;
-	buf[i] = '\0';
-	return fputs(buf, el->el_outfile);
+	return terminal_frame(el, buf, (size_t)i);
 }
 
 /* terminal__flush():
- *	Flush output
+ *	Flush output: anything written to the stream directly goes
+ *	first, then the frame, all of it in one write()
  */
 protected void
 terminal__flush(EditLine *el)
 {
 
 	(void) fflush(el->el_outfile);
+	if (el->el_terminal.t_flen > 0)
+		terminal_frame_write(el);
 }
 
 /* terminal_writec():
@@ -68,6 +68,8 @@ typedef struct {
 	int	 *t_val;		/* termcap values	*/
 	char	 *t_cap;		/* Termcap buffer	*/
 	funckey_t	 *t_fkey;		/* Array of keys	*/
+	char	 *t_frame;		/* Output not yet written	*/
+	size_t	  t_flen;		/* # bytes in it	*/
 } el_terminal_t;
 
 /*
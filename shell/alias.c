@@ -40,25 +40,45 @@
 #include "memalloc.h"
 #include "mystring.h"
 #include "alias.h"
+#include "eval.h"
 #include "options.h"	/* XXX for argptr (should remove?) */
 
-#define ATABSIZE 39
+#define ATABSIZE 16		/* initial size, must be a power of 2 */
 
-struct alias *atab[ATABSIZE];
+STATIC SHTLS struct alias **atab;
+STATIC SHTLS unsigned int atabsize;	/* number of chains, a power of 2 */
+STATIC SHTLS struct alias *noalias;	/* what an empty atab finds */
+SHTLS int naliases;			/* number of aliases in atab */
 
-STATIC void setalias(const char *, const char *);
+/*
+ * A copy of the aliases a subshell run in this process started with,
+ * taken the first time it changes any.
+ */
+struct aliassave {
+	struct aliassave *next;
+	int nest;			/* the subshell */
+	struct alias *list;		/* in atab order */
+};
+
+STATIC SHTLS struct aliassave *aliassaved;
+
+STATIC void savealiases(void);
 STATIC struct alias *freealias(struct alias *);
 STATIC struct alias **__lookupalias(const char *);
+STATIC unsigned int hashalias(const char *);
+STATIC void growatab(void);
 
-STATIC
 void
 setalias(const char *name, const char *val)
 {
 	struct alias *ap, **app;
 
+	INTOFF;
+	/* grow first, so app stays valid */
+	if ((unsigned int)naliases >= atabsize)
+		growatab();
 	app = __lookupalias(name);
 	ap = *app;
-	INTOFF;
 	if (ap) {
 		if (!(ap->flag & ALIASINUSE)) {
 			ckfree(ap->val);
@@ -70,9 +90,11 @@ setalias(const char *name, const char *val)
 		ap = ckmalloc(sizeof (struct alias));
 		ap->name = savestr(name);
 		ap->val = savestr(val);
+		ap->hashval = hashalias(name);
 		ap->flag = 0;
 		ap->next = 0;
 		*app = ap;
+		naliases++;
 	}
 	INTON;
 }
@@ -98,10 +120,10 @@ void
 rmaliases(void)
 {
 	struct alias *ap, **app;
-	int i;
+	unsigned int i;
 
 	INTOFF;
-	for (i = 0; i < ATABSIZE; i++) {
+	for (i = 0; i < atabsize; i++) {
 		app = &atab[i];
 		for (ap = *app; ap; ap = *app) {
 			*app = freealias(*app);
@@ -113,6 +135,22 @@ rmaliases(void)
 	INTON;
 }
 
+/*
+ * Call fn with each alias, for the shimage builtin.
+ */
+
+void
+walkaliases(void (*fn)(struct alias *, void *), void *arg)
+{
+	struct alias *ap;
+	unsigned int i;
+
+	for (i = 0; i < atabsize; i++)
+		for (ap = atab[i]; ap; ap = ap->next)
+			if (!(ap->flag & ALIASDEAD))
+				fn(ap, arg);
+}
+
 struct alias *
 lookupalias(const char *name, int check)
 {
@@ -134,9 +172,9 @@ aliascmd(int argc, char **argv)
 	struct alias *ap;
 
 	if (argc == 1) {
-		int i;
+		unsigned int i;
 
-		for (i = 0; i < ATABSIZE; i++)
+		for (i = 0; i < atabsize; i++)
 			for (ap = atab[i]; ap; ap = ap->next) {
 				printalias(ap);
 			}
@@ -151,6 +189,7 @@ aliascmd(int argc, char **argv)
 				printalias(ap);
 		} else {
 			*v++ = '\0';
+			savealiases();
 			setalias(n, v);
 		}
 	}
@@ -165,6 +204,7 @@ unaliascmd(int argc, char **argv)
     (void)argv;
 	int i;
 
+	savealiases();
 	while ((i = nextopt("a")) != '\0') {
 		if (i == 'a') {
 			rmaliases();
@@ -191,39 +231,128 @@ freealias(struct alias *ap) {
 	}
 
 	next = ap->next;
+	naliases--;
 	ckfree(ap->name);
 	ckfree(ap->val);
 	ckfree(ap);
 	return next;
 }
 
+/*
+ * Copy the aliases for the innermost subshell, unless it has already.
+ */
+STATIC void
+savealiases(void)
+{
+	struct aliassave *sp;
+	struct alias *ap, *copy, **lastp;
+	unsigned int i;
+
+	if (!subshell || (aliassaved && aliassaved->nest == subshell))
+		return;
+	INTOFF;
+	sp = ckmalloc(sizeof (struct aliassave));
+	sp->next = aliassaved;
+	sp->nest = subshell;
+	lastp = &sp->list;
+	for (i = 0; i < atabsize; i++)
+		for (ap = atab[i]; ap; ap = ap->next) {
+			if (ap->flag & ALIASDEAD)
+				continue;
+			copy = ckmalloc(sizeof (struct alias));
+			copy->name = savestr(ap->name);
+			copy->val = savestr(ap->val);
+			*lastp = copy;
+			lastp = &copy->next;
+		}
+	*lastp = NULL;
+	aliassaved = sp;
+	INTON;
+}
+
+/*
+ * Put back the aliases the innermost subshell started with.
+ */
+void
+popsubaliases(void)
+{
+	struct aliassave *sp;
+	struct alias *ap, *next;
+
+	sp = aliassaved;
+	if (!sp || sp->nest != subshell)
+		return;
+	INTOFF;
+	aliassaved = sp->next;
+	rmaliases();
+	for (ap = sp->list; ap; ap = next) {
+		next = ap->next;
+		setalias(ap->name, ap->val);
+		ckfree(ap->name);
+		ckfree(ap->val);
+		ckfree(ap);
+	}
+	ckfree(sp);
+	INTON;
+}
+
 void
 printalias(const struct alias *ap) {
 	out1fmt("%s=%s\n", ap->name, single_quote(ap->val));
 }
 
+STATIC unsigned int
+hashalias(const char *name)
+{
+	unsigned int hashval;
+
+	hashval = 5381;
+	while (*name)
+		hashval = hashval * 33 + (unsigned char)*name++;
+	return hashval;
+}
+
 STATIC struct alias **
 __lookupalias(const char *name) {
 	unsigned int hashval;
 	struct alias **app;
-	const char *p;
-	unsigned int ch;
 
-	p = name;
-
-	ch = (unsigned char)*p;
-	hashval = ch << 4;
-	while (ch) {
-		hashval += ch;
-		ch = (unsigned char)*++p;
-	}
-	app = &atab[hashval % ATABSIZE];
+	if (!atabsize)
+		return &noalias;
+	hashval = hashalias(name);
+	app = &atab[hashval & (atabsize - 1)];
 
 	for (; *app; app = &(*app)->next) {
-		if (equal(name, (*app)->name)) {
+		if ((*app)->hashval == hashval && equal(name, (*app)->name)) {
 			break;
 		}
 	}
 
 	return app;
 }
+
+/*
+ * Double the number of hash chains, keeping at most one alias per chain
+ * on average.  Interrupts must be off.
+ */
+STATIC void
+growatab(void)
+{
+	struct alias **newtab;
+	struct alias *ap, *next;
+	unsigned int newsize, i;
+
+	newsize = atabsize ? atabsize * 2 : ATABSIZE;
+	newtab = ckmalloc(newsize * sizeof(*newtab));
+	memset(newtab, 0, newsize * sizeof(*newtab));
+	for (i = 0; i < atabsize; i++)
+		for (ap = atab[i]; ap; ap = next) {
+			next = ap->next;
+			ap->next = newtab[ap->hashval & (newsize - 1)];
+			newtab[ap->hashval & (newsize - 1)] = ap;
+		}
+	if (atab)
+		ckfree(atab);
+	atab = newtab;
+	atabsize = newsize;
+}
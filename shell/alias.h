@@ -41,12 +41,18 @@ struct alias {
 	struct alias *next;
 	char *name;
 	char *val;
+	unsigned int hashval;
 	int flag;
 };
 
+extern SHTLS int naliases;
+
 struct alias *lookupalias(const char *, int);
+void setalias(const char *, const char *);
+void walkaliases(void (*)(struct alias *, void *), void *);
 int aliascmd(int, char **);
 int unaliascmd(int, char **);
 void rmaliases(void);
 int unalias(const char *);
 void printalias(const struct alias *);
+void popsubaliases(void);
@@ -33,11 +33,16 @@
  */
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+#include "shell.h"
 #include "arith_yacc.h"
 #include "expand.h"
-#include "shell.h"
 #include "error.h"
+#include "machdep.h"
+#include "memalloc.h"
+#include "mystring.h"
 #include "output.h"
 #include "var.h"
 
@@ -45,12 +50,42 @@
 #error Arithmetic tokens are out of order.
 #endif
 
-static const char *arith_startbuf;
+static SHTLS const char *arith_startbuf;
+
+SHTLS const char *arith_buf;
+SHTLS union yystype yylval;
+
+static SHTLS int last_token;
+
+/*
+ * Expressions are lexed once into a list of tokens, which is kept for
+ * when the same text comes round again, as it does for a counter in a
+ * loop.  Names in it remember which variable they found.
+ */
+
+struct arithtok {
+	int type;
+	union yystype val;
+};
+
+struct arithvar {
+	struct var *vp;		/* the variable, if it existed */
+	unsigned int gen;	/* varsfreed when vp was looked up */
+	char name[1];
+};
+
+struct arithcode {
+	char *text;		/* the expression */
+	struct arithtok tok[1];	/* ending with EOF or ARITH_BAD */
+};
+
+#define ARITHCACHE 16		/* number of expressions kept */
 
-const char *arith_buf;
-union yystype yylval;
+static SHTLS struct arithcode *arithcache[ARITHCACHE];
+static SHTLS int arithnext;		/* slot to reuse next */
+static SHTLS struct arithtok *arith_tok;
 
-static int last_token;
+static struct arithcode *arithcompile(const char *);
 
 #define ARITH_PRECEDENCE(op, prec) [op - ARITH_BINOP_MIN] = prec
 
@@ -82,6 +117,26 @@ static void yyerror(const char *s)
 	/* NOTREACHED */
 }
 
+static int nexttok(void)
+{
+	struct arithtok *t = arith_tok;
+
+	/* Like the lexer, keep returning the last token. */
+	if (t->type && t->type != ARITH_BAD)
+		arith_tok++;
+	yylval = t->val;
+	return t->type;
+}
+
+static intmax_t arithvarint(struct arithvar *av)
+{
+	if (!av->vp || av->gen != varsfreed) {
+		av->vp = lookupvp(av->name);
+		av->gen = varsfreed;
+	}
+	return atomax(vpvalue(av->vp) ?: nullstr, 0);
+}
+
 static inline int arith_prec(int op)
 {
 	return prec[op - ARITH_BINOP_MIN];
@@ -144,28 +199,28 @@ again:
 		result = assignment(op, noeval);
 		if (last_token != ARITH_RPAREN)
 			yyerror("expecting ')'");
-		last_token = yylex();
+		last_token = nexttok();
 		return result;
 	case ARITH_NUM:
 		last_token = op;
 		return val->val;
 	case ARITH_VAR:
 		last_token = op;
-		return noeval ? val->val : lookupvarint(val->name);
+		return noeval ? val->val : arithvarint(val->var);
 	case ARITH_ADD:
 		token = op;
 		*val = yylval;
-		op = yylex();
+		op = nexttok();
 		goto again;
 	case ARITH_SUB:
 		*val = yylval;
-		return -primary(op, val, yylex(), noeval);
+		return -primary(op, val, nexttok(), noeval);
 	case ARITH_NOT:
 		*val = yylval;
-		return !primary(op, val, yylex(), noeval);
+		return !primary(op, val, nexttok(), noeval);
 	case ARITH_BNOT:
 		*val = yylval;
-		return ~primary(op, val, yylex(), noeval);
+		return ~primary(op, val, nexttok(), noeval);
 	default:
 		yyerror("expecting primary");
 	}
@@ -179,10 +234,10 @@ static intmax_t binop2(intmax_t a, int op, int prec, int noeval)
 		int op2;
 		int token;
 
-		token = yylex();
+		token = nexttok();
 		val = yylval;
 
-		b = primary(token, &val, yylex(), noeval);
+		b = primary(token, &val, nexttok(), noeval);
 
 		op2 = last_token;
 		if (op2 >= ARITH_BINOP_MIN && op2 < ARITH_BINOP_MAX &&
@@ -221,10 +276,10 @@ static intmax_t and(int token, union yystype *val, int op, int noeval)
 	if (op != ARITH_AND)
 		return a;
 
-	token = yylex();
+	token = nexttok();
 	*val = yylval;
 
-	b = and(token, val, yylex(), noeval | !a);
+	b = and(token, val, nexttok(), noeval | !a);
 
 	return a && b;
 }
@@ -238,10 +293,10 @@ static intmax_t or(int token, union yystype *val, int op, int noeval)
 	if (op != ARITH_OR)
 		return a;
 
-	token = yylex();
+	token = nexttok();
 	*val = yylval;
 
-	b = or(token, val, yylex(), noeval | !!a);
+	b = or(token, val, nexttok(), noeval | !!a);
 
 	return a || b;
 }
@@ -255,15 +310,15 @@ static intmax_t cond(int token, union yystype *val, int op, int noeval)
 	if (last_token != ARITH_QMARK)
 		return a;
 
-	b = assignment(yylex(), noeval | !a);
+	b = assignment(nexttok(), noeval | !a);
 
 	if (last_token != ARITH_COLON)
 		yyerror("expecting ':'");
 
-	token = yylex();
+	token = nexttok();
 	*val = yylval;
 
-	c = cond(token, val, yylex(), noeval | !!a);
+	c = cond(token, val, nexttok(), noeval | !!a);
 
 	return a ? b : c;
 }
@@ -271,7 +326,7 @@ static intmax_t cond(int token, union yystype *val, int op, int noeval)
 static intmax_t assignment(int var, int noeval)
 {
 	union yystype val = yylval;
-	int op = yylex();
+	int op = nexttok();
 	intmax_t result;
 
 	if (var != ARITH_VAR)
@@ -280,22 +335,82 @@ static intmax_t assignment(int var, int noeval)
 	if (op != ARITH_ASS && (op < ARITH_ASS_MIN || op >= ARITH_ASS_MAX))
 		return cond(var, &val, op, noeval);
 
-	result = assignment(yylex(), noeval);
+	result = assignment(nexttok(), noeval);
 	if (noeval)
 		return result;
 
-	return setvarint(val.name,
+	return setvarint(val.var->name,
 			 op == ARITH_ASS ? result :
-			 do_binop(op - 11, lookupvarint(val.name), result), 0);
+			 do_binop(op - 11, arithvarint(val.var), result), 0);
+}
+
+/*
+ * Find the tokens for s in arithcache, or lex it and put them there.
+ * The lexer is run twice, first to size the block and then to fill it.
+ */
+static struct arithcode *arithcompile(const char *s)
+{
+	struct arithcode *ac;
+	struct arithtok *tp;
+	char *p;
+	size_t ntok, names, len;
+	int token;
+	int i;
+
+	for (i = 0; i < ARITHCACHE; i++) {
+		ac = arithcache[i];
+		if (ac && !strcmp(ac->text, s))
+			return ac;
+	}
+
+	ntok = names = 0;
+	arith_buf = s;
+	do {
+		token = yylex();
+		if (token == ARITH_VAR)
+			names += SHELL_ALIGN(offsetof(struct arithvar, name) +
+					     strlen(yylval.name) + 1);
+		ntok++;
+	} while (token && token != ARITH_BAD);
+
+	len = SHELL_ALIGN(offsetof(struct arithcode, tok) +
+			  ntok * sizeof(struct arithtok));
+	ac = ckmalloc(len + names + strlen(s) + 1);
+	p = (char *)ac + len;
+	tp = ac->tok;
+	arith_buf = s;
+	do {
+		token = yylex();
+		tp->type = token;
+		tp->val = yylval;
+		if (token == ARITH_VAR) {
+			struct arithvar *av = (struct arithvar *)p;
+
+			av->vp = NULL;
+			len = strlen(yylval.name) + 1;
+			memcpy(av->name, yylval.name, len);
+			p += SHELL_ALIGN(offsetof(struct arithvar, name) + len);
+			tp->val.var = av;
+		}
+		tp++;
+	} while (token && token != ARITH_BAD);
+	ac->text = strcpy(p, s);
+
+	if (arithcache[arithnext])
+		ckfree(arithcache[arithnext]);
+	arithcache[arithnext] = ac;
+	arithnext = (arithnext + 1) % ARITHCACHE;
+	return ac;
 }
 
 intmax_t arith(const char *s)
 {
 	intmax_t result;
 
-	arith_buf = arith_startbuf = s;
+	arith_startbuf = s;
+	arith_tok = arithcompile(s)->tok;
 
-	result = assignment(yylex(), 0);
+	result = assignment(nexttok(), 0);
 
 	if (last_token)
 		yyerror("expecting EOF");
@@ -79,11 +79,14 @@
 #define ARITH_QMARK 37
 #define ARITH_COLON 38
 
+struct arithvar;
+
 union yystype {
 	intmax_t val;
 	char *name;
+	struct arithvar *var;
 };
 
-extern union yystype yylval;
+extern SHTLS union yystype yylval;
 
 int yylex(void);
@@ -35,10 +35,10 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include "shell.h"
 #include "arith_yacc.h"
 #include "expand.h"
 #include "error.h"
-#include "shell.h"
 #include "memalloc.h"
 #include "syntax.h"
 #include "system.h"
@@ -47,7 +47,7 @@
 #error Arithmetic tokens are out of order.
 #endif
 
-extern const char *arith_buf;
+extern SHTLS const char *arith_buf;
 
 int
 yylex()
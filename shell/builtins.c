@@ -5,11 +5,13 @@
 #include "shell.h"
 #include "builtins.h"
 
+int basenamecmd(int, char **);
 int bgcmd(int, char **);
 int fgcmd(int, char **);
 int breakcmd(int, char **);
 int cdcmd(int, char **);
 int commandcmd(int, char **);
+int dirnamecmd(int, char **);
 int dotcmd(int, char **);
 int echocmd(int, char **);
 int evalcmd(int, char **);
@@ -21,13 +23,19 @@ int getoptscmd(int, char **);
 int hashcmd(int, char **);
 int jobscmd(int, char **);
 int localcmd(int, char **);
+int mapfilecmd(int, char **);
 int printfcmd(int, char **);
 int pwdcmd(int, char **);
 int readcmd(int, char **);
 int returncmd(int, char **);
+int runpartscmd(int, char **);
 int setcmd(int, char **);
+int shellstatcmd(int, char **);
 int shiftcmd(int, char **);
+int shimagecmd(int, char **);
+int shlogcmd(int, char **);
 int timescmd(int, char **);
+int tracecmd(int, char **);
 int trapcmd(int, char **);
 int truecmd(int, char **);
 int typecmd(int, char **);
@@ -47,12 +55,14 @@ const struct builtincmd builtincmd[] = {
 	{ ":", truecmd, 3 },
 	{ "[", testcmd, 0 },
 	{ "alias", aliascmd, 6 },
+	{ "basename", basenamecmd, 0 },
 	{ "bg", bgcmd, 2 },
 	{ "break", breakcmd, 3 },
 	{ "cd", cdcmd, 2 },
 	{ "chdir", cdcmd, 0 },
 	{ "command", commandcmd, 2 },
 	{ "continue", breakcmd, 3 },
+	{ "dirname", dirnamecmd, 0 },
 	{ "echo", echocmd, 0 },
 	{ "eval", NULL, 3 },
 	{ "exec", execcmd, 3 },
@@ -65,15 +75,21 @@ const struct builtincmd builtincmd[] = {
 	{ "jobs", jobscmd, 2 },
 	{ "kill", killcmd, 2 },
 	{ "local", localcmd, 7 },
+	{ "mapfile", mapfilecmd, 2 },
 	{ "printf", printfcmd, 0 },
 	{ "pwd", pwdcmd, 0 },
 	{ "read", readcmd, 2 },
 	{ "readonly", exportcmd, 7 },
 	{ "return", returncmd, 3 },
+	{ "runparts", runpartscmd, 0 },
 	{ "set", setcmd, 3 },
+	{ "shellstat", shellstatcmd, 0 },
 	{ "shift", shiftcmd, 3 },
+	{ "shimage", shimagecmd, 0 },
+	{ "shlog", shlogcmd, 0 },
 	{ "test", testcmd, 0 },
 	{ "times", timescmd, 3 },
+	{ "trace", tracecmd, 0 },
 	{ "trap", trapcmd, 3 },
 	{ "true", truecmd, 2 },
 	{ "type", typecmd, 0 },
@@ -85,3 +101,5 @@ const struct builtincmd builtincmd[] = {
 	{ "unset", unsetcmd, 3 },
 	{ "wait", waitcmd, 2 },
 };
+
+const int numbuiltins = sizeof(builtincmd) / sizeof(builtincmd[0]);
@@ -3,41 +3,49 @@
  */
 
 #define ALIASCMD (builtincmd + 3)
-#define BGCMD (builtincmd + 4)
-#define BREAKCMD (builtincmd + 5)
-#define CDCMD (builtincmd + 6)
-#define COMMANDCMD (builtincmd + 8)
+#define BASENAMECMD (builtincmd + 4)
+#define BGCMD (builtincmd + 5)
+#define BREAKCMD (builtincmd + 6)
+#define CDCMD (builtincmd + 7)
+#define COMMANDCMD (builtincmd + 9)
+#define DIRNAMECMD (builtincmd + 11)
 #define DOTCMD (builtincmd + 0)
-#define ECHOCMD (builtincmd + 10)
-#define EVALCMD (builtincmd + 11)
-#define EXECCMD (builtincmd + 12)
-#define EXITCMD (builtincmd + 13)
-#define EXPORTCMD (builtincmd + 14)
-#define FALSECMD (builtincmd + 15)
-#define FGCMD (builtincmd + 16)
-#define GETOPTSCMD (builtincmd + 17)
-#define HASHCMD (builtincmd + 18)
-#define JOBSCMD (builtincmd + 19)
-#define KILLCMD (builtincmd + 20)
-#define LOCALCMD (builtincmd + 21)
-#define PRINTFCMD (builtincmd + 22)
-#define PWDCMD (builtincmd + 23)
-#define READCMD (builtincmd + 24)
-#define RETURNCMD (builtincmd + 26)
-#define SETCMD (builtincmd + 27)
-#define SHIFTCMD (builtincmd + 28)
+#define ECHOCMD (builtincmd + 12)
+#define EVALCMD (builtincmd + 13)
+#define EXECCMD (builtincmd + 14)
+#define EXITCMD (builtincmd + 15)
+#define EXPORTCMD (builtincmd + 16)
+#define FALSECMD (builtincmd + 17)
+#define FGCMD (builtincmd + 18)
+#define GETOPTSCMD (builtincmd + 19)
+#define HASHCMD (builtincmd + 20)
+#define JOBSCMD (builtincmd + 21)
+#define KILLCMD (builtincmd + 22)
+#define LOCALCMD (builtincmd + 23)
+#define MAPFILECMD (builtincmd + 24)
+#define PRINTFCMD (builtincmd + 25)
+#define PWDCMD (builtincmd + 26)
+#define READCMD (builtincmd + 27)
+#define RETURNCMD (builtincmd + 29)
+#define RUNPARTSCMD (builtincmd + 30)
+#define SETCMD (builtincmd + 31)
+#define SHELLSTATCMD (builtincmd + 32)
+#define SHIFTCMD (builtincmd + 33)
+#define SHIMAGECMD (builtincmd + 34)
+#define SHLOGCMD (builtincmd + 35)
 #define TESTCMD (builtincmd + 2)
-#define TIMESCMD (builtincmd + 30)
-#define TRAPCMD (builtincmd + 31)
+#define TIMESCMD (builtincmd + 37)
+#define TRACECMD (builtincmd + 38)
+#define TRAPCMD (builtincmd + 39)
 #define TRUECMD (builtincmd + 1)
-#define TYPECMD (builtincmd + 33)
-#define ULIMITCMD (builtincmd + 34)
-#define UMASKCMD (builtincmd + 35)
-#define UNALIASCMD (builtincmd + 36)
-#define UNSETCMD (builtincmd + 37)
-#define WAITCMD (builtincmd + 38)
+#define TYPECMD (builtincmd + 41)
+#define ULIMITCMD (builtincmd + 42)
+#define UMASKCMD (builtincmd + 43)
+#define UNALIASCMD (builtincmd + 44)
+#define UNSETCMD (builtincmd + 45)
+#define WAITCMD (builtincmd + 46)
 
-#define NUMBUILTINS 39
+#define NUMBUILTINS numbuiltins
 
 #define BUILTIN_SPECIAL 0x1
 #define BUILTIN_REGULAR 0x2
@@ -50,3 +58,4 @@ struct builtincmd {
 };
 
 extern const struct builtincmd builtincmd[];
+extern const int numbuiltins;
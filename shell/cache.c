@@ -0,0 +1,387 @@
+/*-
+ * Copyright (c) 1991, 1993
+ *	The Regents of the University of California.  All rights reserved.
+ * Copyright (c) 1997-2005
+ *	Herbert Xu <herbert@gondor.apana.org.au>.  All rights reserved.
+ *
+ * This code is derived from software contributed to Berkeley by
+ * Kenneth Almquist.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compiled script cache.  When SHCACHE names a directory, a script read
+ * from a regular file is parsed from start to end before any of it runs
+ * and parsecmd hands out the trees one at a time.  The trees are also
+ * written to $SHCACHE under the file's device and inode numbers, along
+ * with its size and modification time, so that the next shell to run
+ * the same unchanged script reads them back instead of parsing it.
+ *
+ * Aliases are expanded by the parser, so nothing is cached while any
+ * are defined, and a script that defines one goes back to being parsed
+ * the ordinary way from the next command on.  The same goes for set -v,
+ * which has to echo the input as it is read.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shell.h"
+#include "nodes.h"
+#include "parser.h"
+#include "eval.h"
+#include "input.h"
+#include "options.h"
+#include "output.h"
+#include "var.h"
+#include "alias.h"
+#include "memalloc.h"
+#include "error.h"
+#include "cache.h"
+
+
+#define CACHEMAGIC	0x73686333	/* "shc3" */
+
+struct cachehdr {
+	unsigned int magic;
+	unsigned int nodesize;		/* sizeof(union node) of the writer */
+	dev_t dev;			/* the script it was made from */
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	int count;			/* number of commands */
+	size_t blocksize;		/* size of the block of trees */
+	void *base;			/* where the block was when written */
+};
+
+struct cacheline {
+	off_t end;			/* offset just past the command */
+	int linno;			/* plinno after reading it */
+};
+
+struct scache {
+	int fd;				/* the script */
+	int next;			/* next command to hand out */
+	int count;
+	struct cacheline *line;
+	union node **trees;		/* block made by copytrees */
+};
+
+
+SHTLS int cachequiet;			/* don't print syntax errors */
+
+STATIC struct scache *cacheload(const char *, struct stat *, int);
+STATIC struct scache *cachecompile(int, size_t *);
+STATIC void cachesave(const char *, struct stat *, struct scache *, size_t);
+STATIC int readall(int, void *, size_t);
+
+
+
+/*
+ * Called by setinputfile with the newly opened script.  Returns the
+ * commands in it if they can be had from the cache or by parsing it
+ * now, otherwise NULL and the file is read as usual.
+ */
+
+struct scache *
+cacheopen(int fd)
+{
+	const char *dir;
+	char name[PATH_MAX];
+	struct stat st;
+	struct scache *sc;
+	size_t blocksize;
+
+	if ((dir = lookupvar("SHCACHE")) == NULL || *dir == '\0' ||
+	    iflag || vflag || naliases ||
+	    fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return NULL;
+	if (fmtstr(name, sizeof(name), "%s/%lx.%lx", dir,
+		   (unsigned long) st.st_dev, (unsigned long) st.st_ino) >=
+	    (int) sizeof(name))
+		return NULL;
+	if ((sc = cacheload(name, &st, fd)) == NULL &&
+	    (sc = cachecompile(fd, &blocksize)) != NULL)
+		cachesave(name, &st, sc, blocksize);
+	return sc;
+}
+
+
+
+/*
+ * Return the next command from the cache in *np, or NEOF at the end.
+ * Returns zero if the current input isn't cached, and parsecmd should
+ * read the command itself.
+ */
+
+int
+cachenext(union node **np)
+{
+	struct scache *sc = parsecache;
+	struct cacheline *lp;
+
+	if (sc == NULL)
+		return 0;
+	if (naliases || vflag) {
+		INTOFF;
+		lp = sc->next ? &sc->line[sc->next - 1] : NULL;
+		lseek(sc->fd, lp ? lp->end : 0, SEEK_SET);
+		parselleft = parsenleft = 0;
+		plinno = lp ? lp->linno : 1;
+		parsecache = NULL;
+		cachefree(sc);
+		INTON;
+		return 0;
+	}
+	if (sc->next >= sc->count) {
+		*np = NEOF;
+		return 1;
+	}
+	plinno = sc->line[sc->next].linno;
+	*np = sc->trees[sc->next++];
+	return 1;
+}
+
+
+
+void
+cachefree(struct scache *sc)
+{
+	if (sc == NULL)
+		return;
+	ckfree(sc->line);
+	ckfree(sc->trees);
+	ckfree(sc);
+}
+
+
+
+/*
+ * Read the cache file for a script, if there is one that is ours and
+ * the script hasn't changed since it was written.
+ */
+
+STATIC struct scache *
+cacheload(const char *name, struct stat *st, int fd)
+{
+	struct cachehdr h;
+	struct stat cst;
+	struct scache *sc = NULL;
+	size_t linesize;
+	int cfd, i;
+
+	if ((cfd = open(name, O_RDONLY)) < 0)
+		return NULL;
+	INTOFF;
+	if (fstat(cfd, &cst) < 0 || cst.st_uid != geteuid() ||
+	    readall(cfd, &h, sizeof(h)) ||
+	    h.magic != CACHEMAGIC || h.nodesize != sizeof(union node) ||
+	    h.dev != st->st_dev || h.ino != st->st_ino ||
+	    h.size != st->st_size || h.mtime != st->st_mtime ||
+	    h.count < 0 || (size_t) h.count > SSIZE_MAX / sizeof(struct cacheline))
+		goto out;
+	linesize = h.count * sizeof(struct cacheline);
+	if (h.blocksize > (size_t) cst.st_size ||
+	    (size_t) cst.st_size != sizeof(h) + linesize + h.blocksize)
+		goto out;
+	sc = ckmalloc(sizeof(*sc));
+	sc->fd = fd;
+	sc->next = 0;
+	sc->count = h.count;
+	sc->line = linesize ? ckmalloc(linesize) : NULL;
+	sc->trees = ckmalloc(h.blocksize);
+	if (readall(cfd, sc->line, linesize) ||
+	    readall(cfd, sc->trees, h.blocksize) ||
+	    reloctrees(sc->trees, h.count, h.blocksize, h.base))
+		goto bad;
+	for (i = 0; i < h.count; i++) {
+		if (sc->line[i].end < (i ? sc->line[i - 1].end : 0) ||
+		    sc->line[i].end > h.size)
+			goto bad;
+	}
+	goto out;
+bad:
+	cachefree(sc);
+	sc = NULL;
+out:
+	close(cfd);
+	INTON;
+	return sc;
+}
+
+
+
+/*
+ * Parse the whole of a script.  A syntax error anywhere in it means it
+ * can't be cached, since the commands before the error have to run
+ * before the error is reported; the file is rewound and NULL returned.
+ */
+
+STATIC struct scache *
+cachecompile(int fd, size_t *blocksizep)
+{
+	struct jmploc jmploc;
+	struct jmploc *volatile savehandler;
+	struct parsefile *volatile pf;
+	struct stackmark smark;
+	union node **volatile trees;
+	struct cacheline *volatile line;
+	volatile int count;
+	int size, saveexit, e;
+	struct scache *sc;
+	union node *n;
+	off_t end;
+
+	trees = NULL;
+	line = NULL;
+	count = size = 0;
+	pf = parsefile;
+	saveexit = exitstatus;
+	savehandler = handler;
+	setstackmark(&smark);
+	if (setjmp(jmploc.loc)) {
+		e = exception;
+		handler = savehandler;
+		cachequiet = 0;
+		INTOFF;
+		while (parsefile != pf)
+			popfile();
+		popstackmark(&smark);
+		ckfree(trees);
+		ckfree(line);
+		exitstatus = saveexit;
+		lseek(fd, 0, SEEK_SET);
+		parselleft = parsenleft = 0;
+		plinno = 1;
+		INTON;
+		if (e != EXERROR)
+			longjmp(handler->loc, 1);
+		return NULL;
+	}
+	handler = &jmploc;
+	cachequiet = 1;
+	while ((n = parsecmd(0)) != NEOF) {
+		if (count >= size) {
+			size = size ? size * 2 : 64;
+			INTOFF;
+			trees = ckrealloc(trees, size * sizeof(*trees));
+			line = ckrealloc(line, size * sizeof(*line));
+			INTON;
+		}
+		end = lseek(fd, 0, SEEK_CUR);
+		if (parsenleft > 0)
+			end -= parsenleft;
+		if (parselleft > 0)
+			end -= parselleft;
+		trees[count] = n;
+		line[count].end = end;
+		line[count].linno = plinno;
+		count++;
+	}
+	cachequiet = 0;
+	handler = savehandler;
+	INTOFF;
+	sc = ckmalloc(sizeof(*sc));
+	sc->fd = fd;
+	sc->next = 0;
+	sc->count = count;
+	sc->line = line;
+	sc->trees = copytrees(trees, count, blocksizep);
+	popstackmark(&smark);
+	ckfree(trees);
+	INTON;
+	return sc;
+}
+
+
+
+/*
+ * Write out the trees for a script.  This is only an optimisation, so
+ * anything going wrong just leaves the cache without it.  A script that
+ * was modified within the last second isn't saved, as another change in
+ * the same second would leave its modification time the same.
+ */
+
+STATIC void
+cachesave(const char *name, struct stat *st, struct scache *sc,
+	  size_t blocksize)
+{
+	struct cachehdr h;
+	char tmp[PATH_MAX];
+	int cfd, err;
+
+	if (st->st_mtime >= time(NULL) - 1 ||
+	    fmtstr(tmp, sizeof(tmp), "%s.%d", name, (int) getpid()) >=
+	    (int) sizeof(tmp))
+		return;
+	INTOFF;
+	if ((cfd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0)
+		goto out;
+	memset(&h, 0, sizeof(h));
+	h.magic = CACHEMAGIC;
+	h.nodesize = sizeof(union node);
+	h.dev = st->st_dev;
+	h.ino = st->st_ino;
+	h.size = st->st_size;
+	h.mtime = st->st_mtime;
+	h.count = sc->count;
+	h.blocksize = blocksize;
+	h.base = sc->trees;
+	err = dxwrite(cfd, &h, sizeof(h)) ||
+	      dxwrite(cfd, sc->line, sc->count * sizeof(struct cacheline)) ||
+	      dxwrite(cfd, sc->trees, blocksize);
+	if (close(cfd) < 0 || err || rename(tmp, name) < 0)
+		unlink(tmp);
+out:
+	INTON;
+}
+
+
+
+STATIC int
+readall(int fd, void *p, size_t n)
+{
+	char *buf = p;
+	ssize_t i;
+
+	while (n) {
+		do {
+			i = read(fd, buf, n);
+		} while (i < 0 && errno == EINTR);
+		if (i <= 0)
+			return -1;
+		buf += i;
+		n -= i;
+	}
+	return 0;
+}
@@ -34,6 +34,8 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -51,12 +53,14 @@
 #include "output.h"
 #include "memalloc.h"
 #include "error.h"
+#include "eval.h"
 #include "exec.h"
 #include "redir.h"
 #include "main.h"
 #include "mystring.h"
 #include "show.h"
 #include "cd.h"
+#include "toys.h"
 
 #define CD_PHYSICAL 1
 #define CD_PRINT 2
@@ -65,9 +69,23 @@ STATIC int docd(const char *, int);
 STATIC const char *updatepwd(const char *);
 STATIC char *getpwd(void);
 STATIC int cdopt(void);
+STATIC void savecwd(void);
 
-STATIC char *curdir = nullstr;		/* current working directory */
-STATIC char *physdir = nullstr;		/* physical working directory */
+STATIC SHTLS char *curdir = nullstr;		/* current working directory */
+STATIC SHTLS char *physdir = nullstr;		/* physical working directory */
+
+/*
+ * Where a subshell run in this process was before its first cd.
+ */
+struct cwdsave {
+	struct cwdsave *next;
+	int nest;			/* the subshell */
+	int fd;				/* open on the directory, or -1 */
+	char *curdir;
+	char *physdir;
+};
+
+STATIC SHTLS struct cwdsave *cwdsaved;
 
 STATIC int
 cdopt()
@@ -167,6 +185,8 @@ docd(const char *dest, int flags)
 	TRACE(("docd(\"%s\", %d) called\n", dest, flags));
 
 	INTOFF;
+	if (subshell && (!cwdsaved || cwdsaved->nest != subshell))
+		savecwd();
 	if (!(flags & CD_PHYSICAL)) {
 		dir = updatepwd(dest);
 		if (dir)
@@ -183,6 +203,69 @@ out:
 }
 
 
+/*
+ * Remember the current directory for popsubcwd.
+ * Called with interrupts off.
+ */
+
+STATIC void
+savecwd(void)
+{
+	struct cwdsave *cp;
+	int fd;
+
+	fd = open(".", O_RDONLY | O_DIRECTORY);
+	if (fd >= 0)
+		fd = savefd(fd, fd);
+	cp = ckmalloc(sizeof(*cp));
+	cp->next = cwdsaved;
+	cp->nest = subshell;
+	cp->fd = fd;
+	cp->curdir = curdir == nullstr ? nullstr : savestr(curdir);
+	cp->physdir = physdir == curdir ? cp->curdir :
+		      physdir == nullstr ? nullstr : savestr(physdir);
+	cwdsaved = cp;
+}
+
+
+/*
+ * Go back to where the innermost subshell was before its first cd.
+ * PWD and OLDPWD are put back with the rest of its variables.
+ */
+
+void
+popsubcwd(void)
+{
+	struct cwdsave *cp;
+	int err;
+
+	cp = cwdsaved;
+	if (!cp || cp->nest != subshell)
+		return;
+	INTOFF;
+	cwdsaved = cp->next;
+	if (cp->fd >= 0) {
+		err = fchdir(cp->fd);
+		close(cp->fd);
+		if (!err && cp->physdir != nullstr)
+			cachecwd(cp->physdir);
+	} else
+		err = chdir(cp->physdir != nullstr ? cp->physdir : cp->curdir);
+	if (err)
+		sh_warnx("cannot return to %s: %s", cp->curdir,
+			 strerror(errno));
+	if (physdir != nullstr && physdir != curdir)
+		free(physdir);
+	if (curdir != nullstr)
+		free(curdir);
+	curdir = cp->curdir;
+	physdir = cp->physdir;
+	ckfree(cp);
+	hashcd();
+	INTON;
+}
+
+
 /*
  * Update curdir (the name of the current directory) in response to a
  * cd command.
@@ -247,24 +330,18 @@ updatepwd(const char *dir)
 
 
 /*
- * Find out what the current directory is. If we already know the current
- * directory, this routine returns immediately.
+ * Find out what the current directory is.  A path the toybox library
+ * already worked out, and can see is still right, saves getcwd() walking
+ * back up to the root; the in-process commands get the same answer.
  */
 inline
 STATIC char *
 getpwd()
 {
-#ifdef __GLIBC__
-	char *dir = getcwd(0, 0);
+	char *dir = cachedcwd();
 
 	if (dir)
 		return dir;
-#else
-	char buf[PATH_MAX];
-
-	if (getcwd(buf, sizeof(buf)))
-		return savestr(buf);
-#endif
 
 	sh_warnx("getcwd() failed: %s", strerror(errno));
 	return nullstr;
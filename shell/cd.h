@@ -33,3 +33,4 @@
 int	cdcmd(int, char **);
 int	pwdcmd(int, char **);
 void	setpwd(const char *, int);
+void	popsubcwd(void);
@@ -58,11 +58,11 @@
  * Code to handle exceptions in C.
  */
 
-struct jmploc *handler;
-int exception;
-int suppressint;
-volatile sig_atomic_t intpending;
-int errlinno;
+SHTLS struct jmploc *handler;
+SHTLS int exception;
+SHTLS int suppressint;
+SHTLS volatile sig_atomic_t intpending;
+SHTLS int errlinno;
 
 
 static void exverror(int, const char *, va_list)
@@ -60,8 +60,8 @@ struct jmploc {
 	jmp_buf loc;
 };
 
-extern struct jmploc *handler;
-extern int exception;
+extern SHTLS struct jmploc *handler;
+extern SHTLS int exception;
 
 /* exceptions */
 #define EXINT 0		/* SIGINT received */
@@ -76,8 +76,8 @@ extern int exception;
  * more fun than worrying about efficiency and portability. :-))
  */
 
-extern int suppressint;
-extern volatile sig_atomic_t intpending;
+extern SHTLS int suppressint;
+extern SHTLS volatile sig_atomic_t intpending;
 
 #define barrier() ({ __asm__ __volatile__ ("": : :"memory"); })
 #define INTOFF \
@@ -120,7 +120,7 @@ void onint(void) __attribute__((__noreturn__));
 #else
 void onint(void);
 #endif
-extern int errlinno;
+extern SHTLS int errlinno;
 void sh_error(const char *, ...) __attribute__((__noreturn__));
 void exerror(int, const char *, ...) __attribute__((__noreturn__));
 const char *errmsg(int, int);
@@ -32,7 +32,12 @@
  * SUCH DAMAGE.
  */
 
+#include <fcntl.h>
+#ifdef HAVE_PATHS_H
+#include <paths.h>
+#endif
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -42,6 +47,8 @@
  */
 
 #include "shell.h"
+#include "alias.h"
+#include "cd.h"
 #include "nodes.h"
 #include "syntax.h"
 #include "expand.h"
@@ -51,9 +58,12 @@
 #include "builtins.h"
 #include "options.h"
 #include "exec.h"
+#include "miscbltin.h"
 #include "redir.h"
 #include "input.h"
 #include "output.h"
+#include "profile.h"
+#include "stats.h"
 #include "trap.h"
 #include "var.h"
 #include "memalloc.h"
@@ -66,15 +76,16 @@
 #endif
 
 
-int evalskip;			/* set if we are skipping commands */
-STATIC int skipcount;		/* number of levels to skip */
-MKINIT int loopnest;		/* current loop nesting level */
-static int funcline;		/* starting line number of current function, or 0 if not in a function */
+SHTLS int evalskip;			/* set if we are skipping commands */
+STATIC SHTLS int skipcount;		/* number of levels to skip */
+MKINIT SHTLS int loopnest;		/* current loop nesting level */
+static SHTLS int funcline;		/* starting line number of current function, or 0 if not in a function */
+SHTLS int subshell;			/* depth of subshells run in this process */
 
 
-char *commandname;
-int exitstatus;			/* exit status of last command */
-int back_exitstatus;		/* exit status of backquoted command */
+SHTLS char *commandname;
+SHTLS int exitstatus;			/* exit status of last command */
+SHTLS int back_exitstatus;		/* exit status of backquoted command */
 
 
 #if !defined(__alpha__) || (defined(__GNUC__) && __GNUC__ >= 3)
@@ -85,8 +96,13 @@ STATIC void evalloop(union node *, int);
 STATIC void evalfor(union node *, int);
 STATIC void evalcase(union node *, int);
 STATIC void evalsubshell(union node *, int);
+STATIC void evalsubshellhere(union node *, int);
 STATIC void expredir(union node *);
 STATIC void evalpipe(union node *, int);
+#if CFG_TOYBOX_THREADS
+STATIC int evaltoypipe(union node *, struct nodelist *, int, int);
+STATIC char **heapargv(char **);
+#endif
 #ifdef notyet
 STATIC void evalcommand(union node *, int, struct backcmd *);
 #else
@@ -95,8 +111,18 @@ STATIC void evalcommand(union node *, int);
 STATIC int evalbltin(const struct builtincmd *, int, char **, int);
 STATIC int evaltoycmd(const struct toy_list *, int, char **, int);
 STATIC int evalfun(struct funcnode *, int, char **, int);
+STATIC int backcmdsafe(union node *, int);
+STATIC int wordsafe(union node *);
+STATIC int evalbackfile(union node *, struct backcmd *);
+#ifndef USE_GLIBC_STDIO
+STATIC int evalbackbltin(union node *, struct backcmd *);
+#endif
+#if TOYBOX_TASK_STDIO
+STATIC int evalbacktoy(union node *, struct backcmd *);
+#endif
 STATIC void prehash(union node *);
 STATIC int eprintlist(struct output *, struct strlist *, int);
+STATIC int eprintargv(struct output *, char **, int);
 STATIC int bltincmd(int, char **);
 
 
@@ -460,6 +486,20 @@ evalsubshell(union node *n, int flags)
 	if (funcline)
 		lineno -= funcline - 1;
 
+	if (!backgnd && (!(flags & EV_EXIT) || have_traps())) {
+		evalsubshellhere(n, flags);
+		return;
+	}
+#if CFG_TOYBOX_THREADS
+	if (backgnd && !n->nredir.redirect) {
+		struct nodelist cmdlist;
+
+		cmdlist.next = NULL;
+		cmdlist.n = n->nredir.n;
+		if (evaltoypipe(n, &cmdlist, 1, 1))
+			return;
+	}
+#endif
 	expredir(n->nredir.redirect);
 	if (!backgnd && flags & EV_EXIT && !have_traps())
 		goto nofork;
@@ -484,6 +524,95 @@ nofork:
 
 
 
+/*
+ * Run a subshell without forking.  The variables, working directory,
+ * traps, functions and redirections each save themselves the first
+ * time the subshell changes them and are put back here; the options
+ * and positional parameters are copied as evalfun does.  So unless the
+ * subshell changes a lot, this costs about what a function call does.
+ */
+
+STATIC void
+evalsubshellhere(union node *n, int flags)
+{
+	struct jmploc jmploc;
+	struct jmploc *volatile savehandler;
+	volatile struct shparam saveparam;
+	int localvar_stop;
+	struct redirtab *redir_stop;
+	struct stackmark smark;
+	char saveopts[NOPTS];
+	volatile int saveint;
+	volatile int status;
+	int saveloopnest;
+	int e;
+
+	setstackmark(&smark);
+	expredir(n->nredir.redirect);
+	SAVEINT(saveint);
+	INTOFF;
+	savehandler = handler;
+	saveparam = shellparam;
+	shellparam.malloc = 0;
+	if (shellparam.nparam) {
+		/* shift moves them down in place */
+		size_t len = (shellparam.nparam + 1) * sizeof(char *);
+
+		shellparam.p = memcpy(stalloc(len), shellparam.p, len);
+	}
+	memcpy(saveopts, optlist, NOPTS);
+	saveloopnest = loopnest;
+	localvar_stop = pushsubvars();
+	redir_stop = pushsubredir();
+	subshell++;
+	pushsubtraps();
+	if (!(e = setjmp(jmploc.loc))) {
+		handler = &jmploc;
+		INTON;
+		redirect(n->nredir.redirect, REDIR_PUSH);
+		evaltree(n->nredir.n, flags & EV_TESTED);
+	}
+	/* only the low 8 bits would get out of a forked subshell */
+	status = exitstatus & 0xff;
+	if (!e || exception != EXINT) {
+		e = 0;
+		if (!setjmp(jmploc.loc)) {
+			handler = &jmploc;
+			subexittrap();
+		} else if (exception == EXEXIT)
+			status = exitstatus & 0xff;
+		else if (exception == EXINT)
+			e = 1;
+	}
+
+	INTOFF;
+	handler = savehandler;
+	evalskip = 0;
+	loopnest = saveloopnest;
+	unwindlocalvars(localvar_stop);
+	unwindredir(redir_stop);
+	popsubtraps();
+	popsubcwd();
+	popsubumask();
+	popsubaliases();
+	popsubfuncs();
+	popsubvars();
+	subshell--;
+	freeparam(&shellparam);
+	shellparam = saveparam;
+	if (memcmp(saveopts, optlist, NOPTS)) {
+		memcpy(optlist, saveopts, NOPTS);
+		optschanged();
+	}
+	popstackmark(&smark);
+	RESTOREINT(saveint);
+	if (e)
+		exraise(EXINT);
+	exitstatus = status;
+}
+
+
+
 /*
  * Compute the names of the files in a redirection list.
  */
@@ -538,6 +667,10 @@ evalpipe(union node *n, int flags)
 	pipelen = 0;
 	for (lp = n->npipe.cmdlist ; lp ; lp = lp->next)
 		pipelen++;
+#if CFG_TOYBOX_THREADS
+	if (evaltoypipe(n, n->npipe.cmdlist, pipelen, n->npipe.backgnd))
+		return;
+#endif
 	flags |= EV_EXIT;
 	INTOFF;
 	jp = makejob(n, pipelen);
@@ -581,6 +714,189 @@ evalpipe(union node *n, int flags)
 
 
 
+#if CFG_TOYBOX_THREADS
+/*
+ * Run a pipeline made up entirely of compiled-in commands without
+ * forking: each stage gets a thread of its own, joined to its neighbours
+ * by pipes, and the exit statuses are gathered into a job just as if the
+ * stages had been processes.  In the background the job is left running
+ * and dowait collects the threads as they finish; a single command run
+ * in the background comes here as a pipeline of one.  Returns 0 without
+ * doing anything if some stage is not a plain toy command, in which
+ * case the caller forks.
+ */
+
+STATIC int
+evaltoypipe(union node *n, struct nodelist *cmdlist, int pipelen, int backgnd)
+{
+	struct job *jp;
+	struct nodelist *lp;
+	struct cmdentry entry;
+	struct stackmark smark;
+	struct toy_list **cmds;
+	struct toy_thread **tt;
+	char ***argvs;
+	int prevfd;
+	int pip[2];
+	int i;
+
+	/* Without stdio of their own, threads can't be given pipes */
+	if (!TOYBOX_TASK_STDIO && cmdlist->next)
+		return 0;
+	for (lp = cmdlist ; lp ; lp = lp->next) {
+		union node *cmd = lp->n;
+
+		if (cmd->type != NCMD || cmd->ncmd.assign ||
+		    cmd->ncmd.redirect || !cmd->ncmd.args ||
+		    !goodname(cmd->ncmd.args->narg.text))
+			return 0;
+		find_command(cmd->ncmd.args->narg.text, &entry, 0, pathval());
+		if (entry.cmdtype != CMDTOYCMD)
+			return 0;
+	}
+
+	setstackmark(&smark);
+	cmds = stalloc(pipelen * sizeof(*cmds));
+	tt = stalloc(pipelen * sizeof(*tt));
+	argvs = stalloc(pipelen * sizeof(*argvs));
+
+	/* Expand everything first, expansion errors can't leave threads behind */
+	for (i = 0, lp = cmdlist ; lp ; lp = lp->next, i++) {
+		struct arglist arglist;
+		struct strlist *sp;
+		union node *argp;
+		char **argv;
+		int argc;
+
+		errlinno = lineno = lp->n->ncmd.linno;
+		if (funcline)
+			lineno -= funcline - 1;
+		arglist.lastp = &arglist.list;
+		argc = 0;
+		for (argp = lp->n->ncmd.args; argp; argp = argp->narg.next)
+			expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
+		*arglist.lastp = NULL;
+		for (sp = arglist.list ; sp ; sp = sp->next)
+			argc++;
+		if (!argc) {
+			popstackmark(&smark);
+			return 0;
+		}
+		argv = argvs[i] = stalloc(sizeof (char *) * (argc + 1));
+		for (sp = arglist.list ; sp ; sp = sp->next)
+			*argv++ = sp->text;
+		*argv = NULL;
+
+		find_command(argvs[i][0], &entry, 0, pathval());
+		if (entry.cmdtype != CMDTOYCMD) {
+			popstackmark(&smark);
+			return 0;
+		}
+		cmds[i] = (struct toy_list *)entry.u.toycmd;
+
+		if (xflag) {
+			struct output *out = &preverrout;
+
+			preverrout.fd = 2;
+			outstr(expandstr(ps4val()), out);
+			eprintlist(out, arglist.list, 0);
+			outcslow('\n', out);
+#ifdef FLUSHERR
+			flushout(out);
+#endif
+		}
+	}
+
+	flushall();
+	INTOFF;
+	environ = environment();
+	jp = makejob(n, pipelen);
+	prevfd = -1;
+#if TOYBOX_TASK_STDIO
+	/* as forkchild does, a background job doesn't read our input */
+	if (backgnd && !jobctl)
+		prevfd = open(_PATH_DEVNULL, O_RDONLY);
+#endif
+	for (i = 0, lp = cmdlist ; lp ; lp = lp->next, i++) {
+		pip[0] = pip[1] = -1;
+		if (lp->next && pipe(pip) < 0)
+			break;
+		if (backgnd)
+			argvs[i] = heapargv(argvs[i]);
+		toy_trace(pipe_stage, argvs[i][0], i);
+		tt[i] = toy_thread_start(cmds[i], argvs[i], prevfd, pip[1]);
+		if (!tt[i]) {
+			if (pip[1] >= 0) {
+				close(pip[0]);
+				close(pip[1]);
+			}
+			if (backgnd)
+				ckfree(argvs[i]);
+			break;
+		}
+		if (backgnd)
+			bgthreadjob(jp, lp->n, tt[i], argvs[i]);
+		prevfd = pip[0];
+	}
+	pipelen = i;
+	if (prevfd >= 0)
+		close(prevfd);
+
+	/* Stages started before a failure still have to be reaped */
+	if (!backgnd)
+		for (i = 0, lp = cmdlist ; i < pipelen ; lp = lp->next, i++)
+			threadjob(jp, lp->n,
+				  (toy_thread_join(tt[i]) & 0xff) << 8);
+	if (lp) {
+		threadjob(jp, lp->n, 2 << 8);
+		if (!backgnd)
+			waitforjob(jp);
+		INTON;
+		popstackmark(&smark);
+		sh_error("Cannot start thread");
+	}
+	if (backgnd)
+		exitstatus = 0;
+	else
+		exitstatus = waitforjob(jp);
+	TRACE(("evaltoypipe:  job done exit status %d\n", exitstatus));
+	INTON;
+	popstackmark(&smark);
+
+	return 1;
+}
+
+
+/*
+ * Copy argv to one block from ckmalloc, for a thread that outlives the
+ * stack it was expanded on.
+ */
+
+STATIC char **
+heapargv(char **argv)
+{
+	char **ap, **nargv;
+	size_t len;
+	char *p;
+	int argc;
+
+	len = 0;
+	for (ap = argv ; *ap ; ap++)
+		len += strlen(*ap) + 1;
+	argc = ap - argv;
+	nargv = ckmalloc((argc + 1) * sizeof(char *) + len);
+	p = (char *)(nargv + argc + 1);
+	for (ap = nargv ; *argv ; argv++) {
+		*ap++ = p;
+		p = stpcpy(p, *argv) + 1;
+	}
+	*ap = NULL;
+	return nargv;
+}
+#endif
+
+
+
 /*
  * Execute a command inside back quotes.  If it's a builtin command, we
  * want to save its output in a block obtained from malloc.  Otherwise
@@ -598,9 +914,21 @@ evalbackcmd(union node *n, struct backcmd *result)
 	result->buf = NULL;
 	result->nleft = 0;
 	result->jp = NULL;
+	result->tt = NULL;
+	result->argv = NULL;
 	if (n == NULL) {
 		goto out;
 	}
+	if (evalbackfile(n, result))
+		goto out;
+#ifndef USE_GLIBC_STDIO
+	if (evalbackbltin(n, result))
+		goto out;
+#endif
+#if TOYBOX_TASK_STDIO
+	if (evalbacktoy(n, result))
+		goto out;
+#endif
 
 	if (pipe(pip) < 0)
 		sh_error("Pipe call failed");
@@ -625,6 +953,285 @@ out:
 		result->fd, result->buf, result->nleft, result->jp));
 }
 
+
+/*
+ * Called once everything has been read from result->fd, to close it and
+ * wait for the command writing to it.  Returns its exit status.  Should
+ * be called with interrupts off.
+ */
+
+int
+waitbackcmd(struct backcmd *result)
+{
+	int status;
+
+	close(result->fd);
+#if TOYBOX_TASK_STDIO
+	if (result->tt) {
+		status = toy_thread_join(result->tt) & 0xff;
+		ckfree(result->argv);
+		return status;
+	}
+#endif
+	status = waitforjob(result->jp);
+	return status;
+}
+
+
+int basenamecmd(int, char **);
+int dirnamecmd(int, char **);
+int echocmd(int, char **);
+int printfcmd(int, char **);
+int pwdcmd(int, char **);
+int testcmd(int, char **);
+int testfast(int, int, char **);
+int truecmd(int, char **);
+int falsecmd(int, char **);
+
+/*
+ * Check whether a command substitution can run without a subshell.  It
+ * has to be a single simple command of the given type, with nothing but
+ * arguments, and expanding those must not be able to change anything or
+ * raise an error: so no ${var=...}, ${var?...}, arithmetic or set -u.
+ * Builtins are limited to the few that don't touch the shell's state.
+ */
+
+STATIC int
+backcmdsafe(union node *n, int type)
+{
+	struct cmdentry entry;
+	union node *argp;
+
+	if (n->type != NCMD || n->ncmd.assign || n->ncmd.redirect ||
+	    !n->ncmd.args || !goodname(n->ncmd.args->narg.text) || uflag)
+		return 0;
+	find_command(n->ncmd.args->narg.text, &entry, 0, pathval());
+	if (entry.cmdtype != type)
+		return 0;
+	if (type == CMDBUILTIN) {
+		int (*fn)(int, char **) = entry.u.cmd->builtin;
+
+		if (fn != echocmd && fn != printfcmd && fn != pwdcmd &&
+		    fn != testcmd && fn != truecmd && fn != falsecmd &&
+		    fn != basenamecmd && fn != dirnamecmd)
+			return 0;
+	}
+	for (argp = n->ncmd.args; argp; argp = argp->narg.next)
+		if (!wordsafe(argp))
+			return 0;
+	return 1;
+}
+
+
+/*
+ * Check that expanding a word can't change anything or raise an error.
+ */
+
+STATIC int
+wordsafe(union node *argp)
+{
+	const char *p;
+
+	for (p = argp->narg.text; *p; p++) {
+		switch ((signed char)*p) {
+		case CTLESC:
+			p++;
+			break;
+		case CTLVAR:
+			switch (p[1] & VSTYPE) {
+			case VSASSIGN:
+			case VSQUESTION:
+				return 0;
+			}
+			break;
+		case CTLARI:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * $(<file) is the file's contents: the command has nothing but the one
+ * redirection, which a subshell would apply and then print nothing.  So
+ * read the file straight into result->buf instead, in one read if it's
+ * a plain file, and expbackq takes the trailing newlines off as usual.
+ * A file that won't open is an error in the subshell, so it's just a
+ * message and an exit status of 2 here.  Returns 0 for any other
+ * command.
+ */
+
+STATIC int
+evalbackfile(union node *n, struct backcmd *result)
+{
+	struct arglist fn;
+	struct stackmark smark;
+	union node *redir;
+	int f;
+
+	if (n->type != NCMD || n->ncmd.args || n->ncmd.assign ||
+	    !(redir = n->ncmd.redirect) || redir->nfile.next ||
+	    redir->type != NFROM || redir->nfile.fd != 0 ||
+	    !wordsafe(redir->nfile.fname) || uflag)
+		return 0;
+	setstackmark(&smark);
+	errlinno = lineno = n->ncmd.linno;
+	if (funcline)
+		lineno -= funcline - 1;
+	fn.lastp = &fn.list;
+	expandarg(redir->nfile.fname, &fn, EXP_TILDE | EXP_REDIR);
+	*fn.lastp = NULL;
+
+	if (xflag) {
+		struct output *out = &preverrout;
+
+		preverrout.fd = 2;
+		outstr(expandstr(ps4val()), out);
+		outcslow('\n', out);
+#ifdef FLUSHERR
+		flushout(out);
+#endif
+	}
+
+	if ((f = open64(fn.list->text, O_RDONLY)) < 0) {
+		sh_warnx("cannot open %s: %s", fn.list->text,
+			 errmsg(errno, E_OPEN));
+		back_exitstatus = 2;
+	} else {
+		result->buf = readfdall(f, &result->nleft);
+		close(f);
+		back_exitstatus = 0;
+	}
+	popstackmark(&smark);
+	return 1;
+}
+
+
+#ifndef USE_GLIBC_STDIO
+/*
+ * Run a command substitution that backcmdsafe passes as a builtin in the
+ * shell itself, with out1 pointed at memout, instead of forking.  Its
+ * output is handed back in result->buf.  Returns 0 if the command has
+ * to go to a subshell after all.
+ */
+
+STATIC int
+evalbackbltin(union node *n, struct backcmd *result)
+{
+	struct jmploc jmploc;
+	struct jmploc *volatile savehandler;
+	struct output *volatile saveout;
+	volatile int saveint;
+	int savestatus;
+	int e;
+
+	if (!backcmdsafe(n, CMDBUILTIN))
+		return 0;
+	savestatus = exitstatus;
+	saveout = out1;
+	savehandler = handler;
+	SAVEINT(saveint);
+	if ((e = setjmp(jmploc.loc)) == 0) {
+		handler = &jmploc;
+		out1 = &memout;
+		evalcommand(n, EV_BACKCMD);
+	}
+	handler = savehandler;
+	out1 = saveout;
+	RESTOREINT(saveint);
+	if (e) {
+		ckfree(grabmemout(NULL));
+		longjmp(handler->loc, 1);
+	}
+	result->buf = grabmemout(&result->nleft);
+	back_exitstatus = exitstatus;
+	exitstatus = savestatus;
+	return 1;
+}
+#endif
+
+
+#if TOYBOX_TASK_STDIO
+/*
+ * Run a command substitution that is a single toy command in a thread
+ * of its own, writing down a pipe that expbackq reads, as evaltoypipe
+ * runs a pipeline stage.  Its arguments are copied to the heap because
+ * the stack they were expanded on is popped before the command is done.
+ * Returns 0 if the command has to go to a subshell after all.
+ */
+
+STATIC int
+evalbacktoy(union node *n, struct backcmd *result)
+{
+	struct cmdentry entry;
+	struct stackmark smark;
+	char **args;
+	char **argv;
+	char *p;
+	size_t len;
+	int argc;
+	int i;
+	int pip[2];
+
+	if (!backcmdsafe(n, CMDTOYCMD))
+		return 0;
+	setstackmark(&smark);
+	errlinno = lineno = n->ncmd.linno;
+	if (funcline)
+		lineno -= funcline - 1;
+	argc = expandargv(n->ncmd.args, &args, EXP_FULL | EXP_TILDE);
+	len = 0;
+	for (i = 0 ; i < argc ; i++)
+		len += strlen(args[i]) + 1;
+	if (argc)
+		find_command(args[0], &entry, 0, pathval());
+	if (!argc || entry.cmdtype != CMDTOYCMD) {
+		popstackmark(&smark);
+		return 0;
+	}
+
+	if (xflag) {
+		struct output *out = &preverrout;
+
+		preverrout.fd = 2;
+		outstr(expandstr(ps4val()), out);
+		eprintargv(out, args, 0);
+		outcslow('\n', out);
+#ifdef FLUSHERR
+		flushout(out);
+#endif
+	}
+
+	argv = ckmalloc((argc + 1) * sizeof(char *) + len);
+	p = (char *)(argv + argc + 1);
+	for (i = 0 ; i < argc ; i++) {
+		argv[i] = p;
+		p = stpcpy(p, args[i]) + 1;
+	}
+	argv[argc] = NULL;
+	popstackmark(&smark);
+
+	flushall();
+	if (pipe(pip) < 0) {
+		ckfree(argv);
+		sh_error("Pipe call failed");
+	}
+	environ = environment();
+	result->tt = toy_thread_start((struct toy_list *)entry.u.toycmd,
+				      argv, -1, pip[1]);
+	if (!result->tt) {
+		close(pip[0]);
+		close(pip[1]);
+		ckfree(argv);
+		sh_error("Cannot start thread");
+	}
+	result->fd = pip[0];
+	result->argv = argv;
+	return 1;
+}
+#endif
+
 static char **
 parse_command_args(char **argv, const char **path)
 {
@@ -670,15 +1277,13 @@ evalcommand(union node *cmd, int flags, struct backcmd *backcmd)
 evalcommand(union node *cmd, int flags)
 #endif
 {
-	struct localvar_list *localvar_stop;
+	int localvar_stop;
 	struct redirtab *redir_stop;
 	struct stackmark smark;
 	union node *argp;
-	struct arglist arglist;
 	struct arglist varlist;
 	char **argv;
 	int argc;
-	struct strlist *sp;
 #ifdef notyet
 	int pip[2];
 #endif
@@ -690,6 +1295,7 @@ evalcommand(union node *cmd, int flags)
 	int execcmd;
 	int status;
 	char **nargv;
+	int profframe;
 
 	errlinno = lineno = cmd->ncmd.linno;
 	if (funcline)
@@ -698,6 +1304,7 @@ evalcommand(union node *cmd, int flags)
 	/* First expand the arguments. */
 	TRACE(("evalcommand(0x%lx, %d) called\n", (long)cmd, flags));
 	setstackmark(&smark);
+	profframe = Pflag ? profstart(cmd->ncmd.linno) : -1;
 	localvar_stop = pushlocalvars();
 	back_exitstatus = 0;
 
@@ -705,31 +1312,16 @@ evalcommand(union node *cmd, int flags)
 	cmdentry.u.cmd = &bltin;
 	varlist.lastp = &varlist.list;
 	*varlist.lastp = NULL;
-	arglist.lastp = &arglist.list;
-	*arglist.lastp = NULL;
 
-	argc = 0;
-	for (argp = cmd->ncmd.args; argp; argp = argp->narg.next) {
-		struct strlist **spp;
-
-		spp = arglist.lastp;
-		expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
-		for (sp = *spp; sp; sp = sp->next)
-			argc++;
-	}
-
-	/* Reserve one extra spot at the front for shellexec. */
-	nargv = stalloc(sizeof (char *) * (argc + 2));
-	argv = ++nargv;
-	for (sp = arglist.list ; sp ; sp = sp->next) {
-		TRACE(("evalcommand arg: %s\n", sp->text));
-		*nargv++ = sp->text;
-	}
-	*nargv = NULL;
+	argc = expandargv(cmd->ncmd.args, &argv, EXP_FULL | EXP_TILDE);
+#ifdef DEBUG
+	for (nargv = argv ; *nargv ; nargv++)
+		TRACE(("evalcommand arg: %s\n", *nargv));
+#endif
 
 	lastarg = NULL;
-	if (iflag && funcline == 0 && argc > 0)
-		lastarg = nargv[-1];
+	if (iflag && funcline == 0 && argc > 0 && !(flags & EV_BACKCMD))
+		lastarg = argv[argc - 1];
 
 	preverrout.fd = 2;
 	expredir(cmd->ncmd.redirect);
@@ -764,7 +1356,7 @@ evalcommand(union node *cmd, int flags)
 		outstr(expandstr(ps4val()), out);
 		sep = 0;
 		sep = eprintlist(out, varlist.list, sep);
-		eprintlist(out, arglist.list, sep);
+		eprintargv(out, argv, sep);
 		outcslow('\n', out);
 #ifdef FLUSHERR
 		flushout(out);
@@ -782,7 +1374,12 @@ evalcommand(union node *cmd, int flags)
 		path += 5;
 		oldpath = path;
 		for (;;) {
-			find_command(argv[0], &cmdentry, cmd_flag, path);
+			if (cmd_flag == DO_ERR && path == pathval() &&
+			    cmd->ncmd.args->narg.lit > 0)
+				find_nodecmd(cmd, argv[0], &cmdentry);
+			else
+				find_command(argv[0], &cmdentry, cmd_flag,
+					     path);
 			if (cmdentry.cmdtype == CMDUNKNOWN) {
 				status = 127;
 #ifdef FLUSHERR
@@ -814,8 +1411,12 @@ evalcommand(union node *cmd, int flags)
                 }
 	}
 
-	if (status) {
 bail:
+	if (profframe >= 0)
+		profcommand(profframe, cmdentry.cmdtype,
+			    argc ? argv[0] : "(assignment)");
+
+	if (status) {
 		exitstatus = status;
 
 		/* We have a redirection error. */
@@ -828,6 +1429,7 @@ bail:
 	/* Execute the command. */
 	switch (cmdentry.cmdtype) {
 	default:
+		hashchanged();
 		/* Fork off a child process if necessary. */
 		if (!(flags & EV_EXIT) || have_traps()) {
 			INTOFF;
@@ -849,6 +1451,11 @@ bail:
 			if (execcmd && argc > 1)
 				listsetvar(varlist.list, VEXPORT);
 		}
+		if (cmd->ncmd.testop && cmdentry.u.cmd->builtin == testcmd &&
+		    (status = testfast(cmd->ncmd.testop, argc, argv)) >= 0) {
+			exitstatus = status;
+			break;
+		}
 		if (evalbltin(cmdentry.u.cmd, argc, argv, flags)) {
 			int status;
 			int i;
@@ -873,7 +1480,10 @@ raise:
 			poplocalvars(1);
 			if (execcmd && argc > 1)
 				listsetvar(varlist.list, VEXPORT);
-		}
+		} else
+			/* the toy reads them from environ, like a program */
+			listsetvar(varlist.list, VEXPORT|VSTACK);
+		hashchanged();
 		if (evaltoycmd(cmdentry.u.toycmd, argc, argv, flags)) {
 			int status;
 			int i;
@@ -911,6 +1521,8 @@ out:
 		 * However I implemented that within libedit itself.
 		 */
 		setvar("_", lastarg, 0);
+	if (profframe >= 0)
+		profend(profframe);
 	popstackmark(&smark);
 }
 
@@ -931,15 +1543,20 @@ evalbltin(const struct builtincmd *cmd, int argc, char **argv, int flags)
 	commandname = argv[0];
 	argptr = argv + 1;
 	optptr = NULL;			/* initialize nextopt */
+	toy_trace(builtin_enter, argv[0], argc);
 	if (cmd == EVALCMD)
 		status = evalcmd(argc, argv, flags);
 	else
 		status = (*cmd->builtin)(argc, argv);
-	flushall();
+	flushtty();
 	status |= outerr(out1);
 	exitstatus = status;
 cmddone:
-	freestdout();
+	toy_trace(builtin_exit, argv[0], exitstatus);
+	if (i)
+		/* what earlier commands wrote may still be in it */
+		flushout(&output);
+	output.flags &= ~OUTPUT_ERR;
 	commandname = savecmdname;
 	handler = savehandler;
 
@@ -949,34 +1566,36 @@ cmddone:
 STATIC int
 evaltoycmd(const struct toy_list *cmd, int argc, char **argv, int flags)
 {
+    (void)argc;
     (void)flags;
 	char *volatile savecmdname;
 	struct jmploc *volatile savehandler;
 	struct jmploc jmploc;
+	uint64_t start;
 	int status;
 	int i;
-	char *toy_argv = calloc(argc+1, sizeof(char *));
-
-	printf("evaluating toy command\n");
-	memcpy(toy_argv, argv, argc * sizeof(char *));
 
 	savecmdname = commandname;
 	savehandler = handler;
+	start = statclock();
 	if ((i = setjmp(jmploc.loc)))
 		goto tcmddone;
 	handler = &jmploc;
 	commandname = argv[0];
 	argptr = argv + 1;
 	optptr = NULL;			/* initialize nextopt */
-	status = toy_run((struct toy_list *)cmd, argv);
 	flushall();
+	environ = environment();
+	status = toy_run((struct toy_list *)cmd, argv);
 	status |= outerr(out1);
 	exitstatus = status;
 tcmddone:
-	freestdout();
+	toystat(cmd, start);
+	if (i)
+		freestdout();
+	output.flags &= ~OUTPUT_ERR;
 	commandname = savecmdname;
 	handler = savehandler;
-	free(toy_argv);
 
 	return i;
 }
@@ -1132,6 +1751,20 @@ execcmd(int argc, char **argv)
 {
     (void)argc;
     (void)argv;
+	if (argc > 1 && subshell) {
+		struct job *jp;
+
+		/* Only the subshell is replaced, so run it and leave. */
+		INTOFF;
+		jp = makejob(NULL, 1);
+		if (forkshell(jp, NULL, FORK_FG) == 0) {
+			FORCEINTON;
+			shellexec(argv + 1, pathval(), 0);
+		}
+		exitstatus = waitforjob(jp);
+		INTON;
+		exraise(EXEXIT);
+	}
 	if (argc > 1) {
 		iflag = 0;		/* exit on error */
 		mflag = 0;
@@ -1156,3 +1789,15 @@ eprintlist(struct output *out, struct strlist *sp, int sep)
 
 	return sep;
 }
+
+
+STATIC int
+eprintargv(struct output *out, char **argv, int sep)
+{
+	for (; *argv; argv++) {
+		outfmt(out, " %s" + (1 - sep), *argv);
+		sep |= 1;
+	}
+
+	return sep;
+}
@@ -34,9 +34,9 @@
  *	@(#)eval.h	8.2 (Berkeley) 5/4/95
  */
 
-extern char *commandname;	/* currently executing command */
-extern int exitstatus;		/* exit status of last command */
-extern int back_exitstatus;	/* exit status of backquoted command */
+extern SHTLS char *commandname;	/* currently executing command */
+extern SHTLS int exitstatus;		/* exit status of last command */
+extern SHTLS int back_exitstatus;	/* exit status of backquoted command */
 
 
 struct backcmd {		/* result of evalbackcmd */
@@ -44,18 +44,23 @@ struct backcmd {		/* result of evalbackcmd */
 	char *buf;		/* buffer */
 	int nleft;		/* number of chars in buffer */
 	struct job *jp;		/* job structure for command */
+	struct toy_thread *tt;	/* or the thread running it */
+	char **argv;		/* and its arguments */
 };
 
 /* flags in argument to evaltree */
 #define EV_EXIT 01		/* exit after evaluating tree */
 #define EV_TESTED 02		/* exit status is checked; ignore -e flag */
+#define EV_BACKCMD 04		/* command executing within back quotes */
 
 int evalstring(char *, int);
 union node;	/* BLETCH for ansi C */
 void evaltree(union node *, int);
 void evalbackcmd(union node *, struct backcmd *);
+int waitbackcmd(struct backcmd *);
 
-extern int evalskip;
+extern SHTLS int evalskip;
+extern SHTLS int subshell;		/* depth of subshells run in this process */
 
 /* reasons for skipping commands (see comment on breakcmd routine) */
 #define SKIPBREAK	(1 << 0)
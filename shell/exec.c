@@ -69,10 +69,12 @@
 #include "show.h"
 #include "jobs.h"
 #include "alias.h"
+#include "stats.h"
 #include "system.h"
+#include "toys.h"
 
 
-#define CMDTABLESIZE 31		/* should be prime */
+#define CMDTABLESIZE 64		/* initial size, must be a power of 2 */
 #define ARB 1			/* actual size determined at run time */
 
 
@@ -80,14 +82,46 @@
 struct tblentry {
 	struct tblentry *next;	/* next entry in hash chain */
 	union param param;	/* definition of builtin function */
+	unsigned int hashval;	/* hash of cmdname */
 	short cmdtype;		/* index identifying command */
 	char rehash;		/* if set, cd done since entry created */
 	char cmdname[ARB];	/* name of command */
 };
 
 
-STATIC struct tblentry *cmdtable[CMDTABLESIZE];
-STATIC int builtinloc = -1;		/* index in path of %builtin, or -1 */
+STATIC SHTLS struct tblentry **cmdtable;
+STATIC SHTLS unsigned int cmdtablesize;	/* number of chains, a power of 2 */
+STATIC SHTLS unsigned int cmdcount;		/* number of entries */
+STATIC SHTLS int builtinloc = -1;		/* index in path of %builtin, or -1 */
+
+/*
+ * A CMDUNKNOWN entry remembers a failed PATH search, so running a
+ * missing command again doesn't stat every directory again.  Its
+ * param.index is the value missgen had then; anything that could have
+ * put the command in PATH bumps missgen (see hashchanged).
+ */
+STATIC SHTLS int missgen;
+
+/*
+ * Bumped whenever an entry is added, changed or removed, so a simple
+ * command that remembers the entry its name found (see find_nodecmd)
+ * knows when it has to look again.
+ */
+STATIC SHTLS unsigned int cmdgen = 1;
+
+/*
+ * The functions a subshell run in this process defines or unsets, with
+ * what each was before it did, or NULL.  The old definition is held
+ * with a reference of its own until popsubfuncs puts it back.
+ */
+struct funcsave {
+	struct funcsave *next;
+	int nest;			/* the subshell */
+	struct funcnode *func;
+	char name[ARB];
+};
+
+STATIC SHTLS struct funcsave *funcsaved;
 
 
 STATIC void tryexec(char *, char **, char **);
@@ -95,8 +129,10 @@ STATIC void printentry(struct tblentry *);
 STATIC void clearcmdentry(int);
 STATIC struct tblentry *cmdlookup(const char *, int);
 STATIC void delete_cmd_entry(void);
+STATIC void growcmdtable(void);
 STATIC void addcmdentry(char *, struct cmdentry *);
 STATIC int describe_command(struct output *, char *, const char *, int);
+STATIC void savefunc(const char *);
 
 
 /*
@@ -112,6 +148,7 @@ shellexec(char **argv, const char *path, int idx)
 	char **envp;
 	int exerrno;
 
+	flushall();
 	envp = environment();
 	if (strchr(argv[0], '/') != NULL) {
 		tryexec(argv[0], argv, envp);
@@ -180,7 +217,7 @@ repeat:
  * NULL.
  */
 
-const char *pathopt;
+SHTLS const char *pathopt;
 
 char *
 padvance(const char **path, const char *name)
@@ -237,7 +274,7 @@ hashcmd(int argc, char **argv)
 		return 0;
 	}
 	if (*argptr == NULL) {
-		for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
+		for (pp = cmdtable ; pp < &cmdtable[cmdtablesize] ; pp++) {
 			for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
 				if (cmdp->cmdtype == CMDNORMAL)
 					printentry(cmdp);
@@ -248,7 +285,7 @@ hashcmd(int argc, char **argv)
 	c = 0;
 	while ((name = *argptr) != NULL) {
 		if ((cmdp = cmdlookup(name, 0)) != NULL
-		 && (cmdp->cmdtype == CMDNORMAL
+		 && (cmdp->cmdtype == CMDNORMAL || cmdp->cmdtype == CMDUNKNOWN
 		     || (cmdp->cmdtype == CMDBUILTIN && builtinloc >= 0)))
 			delete_cmd_entry();
 		find_command(name, &entry, DO_ERR, pathval());
@@ -278,6 +315,62 @@ printentry(struct tblentry *cmdp)
 }
 
 
+#ifndef SMALL
+STATIC int
+cmdnamecmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * The command names starting with prefix, for completion: builtins,
+ * functions and whatever is in the hash table, then the toys.  Nothing
+ * is looked for along the path.  The list is sorted, each name in it
+ * once, and malloc()ed, like the names, for the caller to free.
+ */
+
+int
+cmdnames(const char *prefix, char ***list)
+{
+	struct tblentry **pp;
+	struct tblentry *cmdp;
+	const char **names;
+	char **out;
+	size_t len;
+	int i, n, count;
+
+	len = strlen(prefix);
+	n = NUMBUILTINS + cmdcount + toy_count;
+	if ((names = malloc(n * sizeof(*names))) == NULL)
+		return 0;
+	n = 0;
+	for (i = 0 ; i < NUMBUILTINS ; i++)
+		if (!strncmp(builtincmd[i].name, prefix, len))
+			names[n++] = builtincmd[i].name;
+	for (pp = cmdtable ; pp < &cmdtable[cmdtablesize] ; pp++)
+		for (cmdp = *pp ; cmdp ; cmdp = cmdp->next)
+			if (cmdp->cmdtype != CMDUNKNOWN &&
+			    !strncmp(cmdp->cmdname, prefix, len))
+				names[n++] = cmdp->cmdname;
+	for (i = 0 ; i < toy_count ; i++)
+		if (!strncmp(toy_list[i].name, prefix, len))
+			names[n++] = toy_list[i].name;
+	qsort(names, n, sizeof(*names), cmdnamecmp);
+
+	out = (char **)names;
+	for (i = count = 0 ; i < n ; i++) {
+		if (count && !strcmp(names[i], out[count - 1]))
+			continue;
+		if ((out[count] = strdup(names[i])) == NULL)
+			break;
+		count++;
+	}
+	*list = out;
+	return count;
+}
+#endif
+
+
 
 /*
  * Resolve a command name.  If you change this routine, you may have to
@@ -295,6 +388,7 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	int e;
 	int updatetbl;
 	struct builtincmd *bcmd;
+	struct toy_list *toycmd;
 
 	/* If name contains a slash, don't use PATH or hash table */
 	if (strchr(name, '/') != NULL) {
@@ -329,6 +423,13 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 #if DEBUG
 			abort();
 #endif
+		case CMDUNKNOWN:
+			if (!(act & DO_ALTPATH) && cmdp->rehash == 0 &&
+			    cmdp->param.index == missgen) {
+				e = ENOENT;
+				goto fail;
+			}
+			/* FALLTHROUGH */
 		case CMDNORMAL:
 			bit = DO_ALTPATH;
 			break;
@@ -336,13 +437,14 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 			bit = DO_NOFUNC;
 			break;
 		case CMDBUILTIN:
+		case CMDTOYCMD:
 			bit = DO_ALTBLTIN;
 			break;
 		}
 		if (act & bit) {
 			updatetbl = 0;
 			cmdp = NULL;
-		} else if (cmdp->rehash == 0)
+		} else if (cmdp->rehash == 0 && cmdp->cmdtype != CMDUNKNOWN)
 			/* if not invalidated by cd, we're done */
 			goto success;
 	}
@@ -354,9 +456,25 @@ find_command(char *name, struct cmdentry *entry, int act, const char *path)
 	)))
 		goto builtin_success;
 
+	/* Then the compiled-in commands, which need no PATH at all */
+	if ((toycmd = toy_find(name)) != NULL) {
+		if (!updatetbl) {
+			entry->cmdtype = CMDTOYCMD;
+			entry->u.toycmd = toycmd;
+			return;
+		}
+		INTOFF;
+		cmdp = cmdlookup(name, 1);
+		cmdp->cmdtype = CMDTOYCMD;
+		cmdp->param.toycmd = toycmd;
+		INTON;
+		goto success;
+	}
+
 	/* We have to search path. */
 	prev = -1;		/* where to start */
-	if (cmdp && cmdp->rehash) {	/* doing a rehash */
+	if (cmdp && cmdp->rehash && cmdp->cmdtype != CMDUNKNOWN) {
+		/* doing a rehash */
 		if (cmdp->cmdtype == CMDBUILTIN)
 			prev = builtinloc;
 		else
@@ -439,9 +557,20 @@ loop:
 		goto success;
 	}
 
-	/* We failed.  If there was an entry for this command, delete it */
-	if (cmdp && updatetbl)
+	/*
+	 * We failed.  Remember that the command isn't there, or if the
+	 * failure might be something else, delete any entry we had.
+	 */
+	if (updatetbl && e == ENOENT) {
+		INTOFF;
+		cmdp = cmdlookup(name, 1);
+		cmdp->cmdtype = CMDUNKNOWN;
+		cmdp->param.index = missgen;
+		cmdp->rehash = 0;
+		INTON;
+	} else if (cmdp && updatetbl)
 		delete_cmd_entry();
+fail:
 	if (act & DO_ERR)
 		sh_warnx("%s: %s", name, errmsg(e, E_EXEC));
 	entry->cmdtype = CMDUNKNOWN;
@@ -495,9 +624,10 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
+	for (pp = cmdtable ; pp < &cmdtable[cmdtablesize] ; pp++) {
 		for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
-			if (cmdp->cmdtype == CMDNORMAL || (
+			if (cmdp->cmdtype == CMDNORMAL ||
+			    cmdp->cmdtype == CMDUNKNOWN || (
 				cmdp->cmdtype == CMDBUILTIN &&
 				!(cmdp->param.cmd->flags & BUILTIN_REGULAR) &&
 				builtinloc > 0
@@ -505,6 +635,7 @@ hashcd(void)
 				cmdp->rehash = 1;
 		}
 	}
+	cmdgen++;
 }
 
 
@@ -568,15 +699,18 @@ clearcmdentry(int firstchange)
 	struct tblentry *cmdp;
 
 	INTOFF;
-	for (tblp = cmdtable ; tblp < &cmdtable[CMDTABLESIZE] ; tblp++) {
+	cmdgen++;
+	for (tblp = cmdtable ; tblp < &cmdtable[cmdtablesize] ; tblp++) {
 		pp = tblp;
 		while ((cmdp = *pp) != NULL) {
 			if ((cmdp->cmdtype == CMDNORMAL &&
 			     cmdp->param.index >= firstchange)
 			 || (cmdp->cmdtype == CMDBUILTIN &&
-			     builtinloc >= firstchange)) {
+			     builtinloc >= firstchange)
+			 || cmdp->cmdtype == CMDUNKNOWN) {
 				*pp = cmdp->next;
 				ckfree(cmdp);
+				cmdcount--;
 			} else {
 				pp = &cmdp->next;
 			}
@@ -597,7 +731,7 @@ clearcmdentry(int firstchange)
  * Interrupts must be off if called with add != 0.
  */
 
-struct tblentry **lastcmdentry;
+SHTLS struct tblentry **lastcmdentry;
 
 
 STATIC struct tblentry *
@@ -609,27 +743,74 @@ cmdlookup(const char *name, int add)
 	struct tblentry **pp;
 
 	p = name;
-	hashval = (unsigned char)*p << 4;
+	hashval = 5381;
 	while (*p)
-		hashval += (unsigned char)*p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
+		hashval = hashval * 33 + (unsigned char)*p++;
+	/* grow first, so lastcmdentry stays valid */
+	if (add) {
+		cmdgen++;
+		if (cmdcount >= cmdtablesize)
+			growcmdtable();
+	}
+	if (!cmdtablesize) {
+		lastcmdentry = NULL;
+		return NULL;
+	}
+	pp = &cmdtable[hashval & (cmdtablesize - 1)];
 	for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
-		if (equal(cmdp->cmdname, name))
+		if (cmdp->hashval == hashval && equal(cmdp->cmdname, name))
 			break;
 		pp = &cmdp->next;
 	}
+	if (cmdp)
+		shstat.cmdhits++;
+	else
+		shstat.cmdmisses++;
 	if (add && cmdp == NULL) {
 		cmdp = *pp = ckmalloc(sizeof (struct tblentry) - ARB
 					+ strlen(name) + 1);
 		cmdp->next = NULL;
+		cmdp->hashval = hashval;
 		cmdp->cmdtype = CMDUNKNOWN;
+		cmdp->param.index = -1;
+		cmdp->rehash = 0;
 		strcpy(cmdp->cmdname, name);
+		cmdcount++;
 	}
 	lastcmdentry = pp;
 	return cmdp;
 }
 
+
+/*
+ * Double the number of hash chains, keeping the table at most one entry
+ * per chain on average.  Entries keep their hash, so nothing is rehashed.
+ * Interrupts must be off.
+ */
+
+STATIC void
+growcmdtable(void)
+{
+	struct tblentry **newtbl;
+	struct tblentry *cmdp, *next;
+	unsigned int newsize, i;
+
+	newsize = cmdtablesize ? cmdtablesize * 2 : CMDTABLESIZE;
+	newtbl = ckmalloc(newsize * sizeof(*newtbl));
+	memset(newtbl, 0, newsize * sizeof(*newtbl));
+	for (i = 0 ; i < cmdtablesize ; i++) {
+		for (cmdp = cmdtable[i] ; cmdp ; cmdp = next) {
+			next = cmdp->next;
+			cmdp->next = newtbl[cmdp->hashval & (newsize - 1)];
+			newtbl[cmdp->hashval & (newsize - 1)] = cmdp;
+		}
+	}
+	if (cmdtable)
+		ckfree(cmdtable);
+	cmdtable = newtbl;
+	cmdtablesize = newsize;
+}
+
 /*
  * Delete the command entry returned on the last lookup.
  */
@@ -640,15 +821,59 @@ delete_cmd_entry(void)
 	struct tblentry *cmdp;
 
 	INTOFF;
+	cmdgen++;
 	cmdp = *lastcmdentry;
 	*lastcmdentry = cmdp->next;
 	if (cmdp->cmdtype == CMDFUNCTION)
 		freefunc(cmdp->param.func);
 	ckfree(cmdp);
+	cmdcount--;
 	INTON;
 }
 
 
+/*
+ * Called when a command has run that could have changed what is in
+ * PATH, so cached misses have to be looked up again.
+ */
+
+void
+hashchanged(void)
+{
+	missgen++;
+}
+
+
+/*
+ * Look up the command name of a simple command, written out plainly in
+ * the script, as find_command(name, entry, DO_ERR, pathval()) would.
+ * The node keeps the table entry that answered, which holds until
+ * cmdgen moves, so a command run over and over in a loop is only
+ * looked up the first time.
+ */
+
+void
+find_nodecmd(union node *n, char *name, struct cmdentry *entry)
+{
+	struct tblentry *cmdp;
+
+	if (n->ncmd.cmdgen == cmdgen) {
+		cmdp = n->ncmd.cmdp;
+		entry->cmdtype = cmdp->cmdtype;
+		entry->u = cmdp->param;
+		return;
+	}
+	find_command(name, entry, DO_ERR, pathval());
+	if (entry->cmdtype == CMDUNKNOWN || strchr(name, '/') != NULL)
+		return;
+	cmdp = *lastcmdentry;
+	if (cmdp && !cmdp->rehash && equal(cmdp->cmdname, name)) {
+		n->ncmd.cmdp = cmdp;
+		n->ncmd.cmdgen = cmdgen;
+	}
+}
+
+
 
 #ifdef notdef
 void
@@ -688,22 +913,76 @@ addcmdentry(char *name, struct cmdentry *entry)
 
 
 /*
- * Define a shell function.
+ * Define a shell function.  A definition run again unchanged, as when a
+ * library is sourced twice, leaves the function alone: the body is the
+ * shared one it already has, and the entry isn't touched, so commands
+ * that remember it don't have to look it up again.
  */
 
 void
 defun(union node *func)
 {
 	struct cmdentry entry;
+	struct tblentry *cmdp;
 
 	INTOFF;
 	entry.cmdtype = CMDFUNCTION;
-	entry.u.func = copyfunc(func);
+	entry.u.func = sharefunc(func);
+	if ((cmdp = cmdlookup(func->ndefun.text, 0)) != NULL &&
+	    cmdp->cmdtype == CMDFUNCTION && cmdp->param.func == entry.u.func) {
+		entry.u.func->count--;
+		INTON;
+		return;
+	}
+	if (subshell)
+		savefunc(func->ndefun.text);
 	addcmdentry(func->ndefun.text, &entry);
 	INTON;
 }
 
 
+/*
+ * Call fn with each function and each program found in PATH, for the
+ * shimage builtin.
+ */
+
+void
+walkcmds(void (*fn)(const char *, struct cmdentry *, void *), void *arg)
+{
+	struct tblentry **pp;
+	struct tblentry *cmdp;
+	struct cmdentry entry;
+
+	for (pp = cmdtable ; pp < cmdtable + cmdtablesize ; pp++) {
+		for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
+			if (cmdp->cmdtype != CMDFUNCTION &&
+			    cmdp->cmdtype != CMDNORMAL)
+				continue;
+			entry.cmdtype = cmdp->cmdtype;
+			entry.u = cmdp->param;
+			fn(cmdp->cmdname, &entry, arg);
+		}
+	}
+}
+
+
+/*
+ * Enter a function or program from a shell image.  A program is marked
+ * as if there had been a cd since it was found, as a relative directory
+ * in PATH may be another one now.
+ */
+
+void
+restorecmd(const char *name, struct cmdentry *entry)
+{
+	INTOFF;
+	addcmdentry((char *) name, entry);
+	if (entry->cmdtype == CMDNORMAL)
+		(*lastcmdentry)->rehash = 1;
+	INTON;
+}
+
+
 /*
  * Delete a function if it exists.
  */
@@ -714,8 +993,71 @@ unsetfunc(const char *name)
 	struct tblentry *cmdp;
 
 	if ((cmdp = cmdlookup(name, 0)) != NULL &&
-	    cmdp->cmdtype == CMDFUNCTION)
+	    cmdp->cmdtype == CMDFUNCTION) {
+		INTOFF;
+		if (subshell) {
+			savefunc(name);
+			cmdlookup(name, 0);
+		}
 		delete_cmd_entry();
+		INTON;
+	}
+}
+
+
+/*
+ * Save the definition of name for the innermost subshell, unless it
+ * has already.
+ * Called with interrupts off.
+ */
+
+STATIC void
+savefunc(const char *name)
+{
+	struct funcsave *fp;
+	struct tblentry *cmdp;
+
+	for (fp = funcsaved ; fp && fp->nest == subshell ; fp = fp->next)
+		if (equal(fp->name, name))
+			return;
+	fp = ckmalloc(sizeof (struct funcsave) - ARB + strlen(name) + 1);
+	fp->next = funcsaved;
+	fp->nest = subshell;
+	fp->func = NULL;
+	if ((cmdp = cmdlookup(name, 0)) != NULL &&
+	    cmdp->cmdtype == CMDFUNCTION) {
+		fp->func = cmdp->param.func;
+		fp->func->count++;
+	}
+	strcpy(fp->name, name);
+	funcsaved = fp;
+}
+
+
+/*
+ * Put back the functions the innermost subshell changed.
+ */
+
+void
+popsubfuncs(void)
+{
+	struct funcsave *fp;
+	struct cmdentry entry;
+	struct tblentry *cmdp;
+
+	INTOFF;
+	while ((fp = funcsaved) && fp->nest == subshell) {
+		funcsaved = fp->next;
+		if (fp->func) {
+			entry.cmdtype = CMDFUNCTION;
+			entry.u.func = fp->func;
+			addcmdentry(fp->name, &entry);
+		} else if ((cmdp = cmdlookup(fp->name, 0)) != NULL &&
+			   cmdp->cmdtype == CMDFUNCTION)
+			delete_cmd_entry();
+		ckfree(fp);
+	}
+	INTON;
 }
 
 /*
@@ -770,7 +1112,8 @@ describe_command(out, command, path, verbose)
 	}
 
 	/* Then check if it is a tracked alias */
-	if ((cmdp = cmdlookup(command, 0)) != NULL) {
+	if ((cmdp = cmdlookup(command, 0)) != NULL &&
+	    cmdp->cmdtype != CMDUNKNOWN) {
 		entry.cmdtype = cmdp->cmdtype;
 		entry.u = cmdp->param;
 	} else {
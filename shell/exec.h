@@ -60,20 +60,26 @@ struct cmdentry {
 #define DO_ALTPATH	0x08	/* using alternate path */
 #define DO_ALTBLTIN	0x20	/* %builtin in alt. path */
 
-extern const char *pathopt;	/* set by padvance */
+extern SHTLS const char *pathopt;	/* set by padvance */
 
 void shellexec(char **, const char *, int)
     __attribute__((__noreturn__));
 char *padvance(const char **, const char *);
 int hashcmd(int, char **);
+int cmdnames(const char *, char ***);
 void find_command(char *, struct cmdentry *, int, const char *);
+void find_nodecmd(union node *, char *, struct cmdentry *);
 struct builtincmd *find_builtin(const char *);
 void hashcd(void);
+void hashchanged(void);
 void changepath(const char *);
 #ifdef notdef
 void getcmdentry(char *, struct cmdentry *);
 #endif
 void defun(union node *);
 void unsetfunc(const char *);
+void walkcmds(void (*)(const char *, struct cmdentry *, void *), void *);
+void restorecmd(const char *, struct cmdentry *);
+void popsubfuncs(void);
 int typecmd(int, char **);
 int commandcmd(int, char **);
@@ -45,6 +45,7 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
 #include <fnmatch.h>
 #ifdef HAVE_GLOB
 #include <glob.h>
@@ -72,6 +73,7 @@
 #include "mystring.h"
 #include "show.h"
 #include "system.h"
+#include "toys.h"
 
 /*
  * _rmescape() flags
@@ -92,23 +94,40 @@
  */
 
 struct ifsregion {
-	struct ifsregion *next;	/* next region in list */
 	int begoff;		/* offset of start of region */
 	int endoff;		/* offset of end of region */
 	int nulonly;		/* search for nul bytes only */
 };
 
+/* what ifsmap says about a character */
+#define IFSSEP	1		/* splits fields */
+#define IFSSPC	2		/* is IFS white space, if it splits */
+#define IFSESC	4		/* CTLESC, look at the next one */
+
 /* output of current string */
-static char *expdest;
+static SHTLS char *expdest;
 /* list of back quote expressions */
-static struct nodelist *argbackq;
-/* first struct in list of ifs regions */
-static struct ifsregion ifsfirst;
-/* last struct in list */
-static struct ifsregion *ifslastp;
+static SHTLS struct nodelist *argbackq;
+/*
+ * The regions of the word being expanded, in order, from ifsbase to
+ * ifsnregion; a command substitution expands its own words above them.
+ */
+static SHTLS struct ifsregion *ifsregion;
+static SHTLS int ifsbase;
+static SHTLS int ifsnregion;
+static SHTLS int ifsmaxregion;
+/* IFS and nul-only character classes, ifsmap[0] good if ifsmapok */
+static SHTLS char ifsmap[2][256];
+static SHTLS int ifsmapok;
+/* no character ifsmap[0] stops at is a printable ASCII one */
+static SHTLS int ifsmapctl;
 /* holds expanded arg list */
-static struct arglist exparg;
+static SHTLS struct arglist exparg;
 
+STATIC int litword(const char *);
+STATIC inline char *litarg(union node *);
+STATIC void expandfields(union node *, int);
+STATIC char **argvgrow(char **, int *);
 STATIC void argstr(char *, int);
 STATIC char *exptilde(char *, char *, int);
 STATIC void expbackq(union node *, int);
@@ -136,6 +155,7 @@ STATIC int cvtnum(intmax_t);
 STATIC size_t esclen(const char *, const char *);
 STATIC char *scanleft(char *, char *, char *, char *, int, int);
 STATIC char *scanright(char *, char *, char *, char *, int, int);
+STATIC int scanfast(char *, const char *, size_t, int, size_t *);
 STATIC void varunset(const char *, const char *, const char *, int)
 	__attribute__((__noreturn__));
 
@@ -188,15 +208,124 @@ expandarg(union node *arg, struct arglist *arglist, int flag)
 	struct strlist *sp;
 	char *p;
 
+	if (arglist == NULL) {
+		/* here document expanded */
+		argbackq = arg->narg.backquote;
+		STARTSTACKSTR(expdest);
+		argstr(arg->narg.text, flag);
+		p = _STPUTC('\0', expdest);
+		expdest = p - 1;
+	} else if ((p = litarg(arg))) {
+		sp = (struct strlist *)stalloc(sizeof (struct strlist));
+		sp->text = p;
+		sp->next = NULL;
+		*arglist->lastp = sp;
+		arglist->lastp = &sp->next;
+		return;
+	} else {
+		expandfields(arg, flag);
+		if (exparg.list) {
+			*arglist->lastp = exparg.list;
+			arglist->lastp = exparg.lastp;
+		}
+	}
+	ifsfree();
+}
+
+
+/*
+ * Expand the words of a simple command, as expandarg() would, straight
+ * into the argument vector it runs with.  The vector has room for a
+ * field per word to begin with and is moved to one twice the size when
+ * splitting or globbing fills it; the old one stays on the stack until
+ * the command is done with.  There is a spare slot in front for
+ * shellexec.  Returns the number of fields.
+ */
+
+int
+expandargv(union node *arg, char ***argvp, int flag)
+{
+	struct strlist *sp;
+	union node *n;
+	char **argv;
+	char *p;
+	int argc;
+	int max;
+
+	for (max = 0, n = arg ; n ; n = n->narg.next)
+		max++;
+	argv = (char **)stalloc(sizeof (char *) * (max + 2)) + 1;
+	argc = 0;
+
+	for (; arg; arg = arg->narg.next) {
+		if ((p = litarg(arg))) {
+			if (argc == max)
+				argv = argvgrow(argv, &max);
+			argv[argc++] = p;
+			continue;
+		}
+		expandfields(arg, flag);
+		for (sp = exparg.list ; sp ; sp = sp->next) {
+			if (argc == max)
+				argv = argvgrow(argv, &max);
+			argv[argc++] = sp->text;
+		}
+		ifsfree();
+	}
+	argv[argc] = NULL;
+
+	*argvp = argv;
+	return argc;
+}
+
+
+STATIC char **
+argvgrow(char **argv, int *max)
+{
+	char **nargv;
+
+	nargv = (char **)stalloc(sizeof (char *) * (*max * 2 + 2)) + 1;
+	memcpy(nargv, argv, sizeof (char *) * *max);
+	*max *= 2;
+	return nargv;
+}
+
+
+/*
+ * Most words in a script are plain text that expands to itself.  The
+ * first expansion of a word looks, and the node remembers in narg.lit:
+ * 0 not looked at yet, -1 something to expand, or the length of the
+ * text plus one.  Returns a copy of the text to use as the field, or
+ * NULL if the word has to be expanded.
+ */
+
+STATIC inline char *
+litarg(union node *arg)
+{
+	if (!arg->narg.lit)
+		arg->narg.lit = litword(arg->narg.text);
+	if (arg->narg.lit < 0)
+		return NULL;
+	return memcpy(stalloc(arg->narg.lit), arg->narg.text, arg->narg.lit);
+}
+
+
+/*
+ * Expand a word into the list exparg, splitting it into fields and
+ * expanding file names if EXP_FULL is set.
+ */
+
+STATIC void
+expandfields(union node *arg, int flag)
+{
+	struct strlist *sp;
+	char *p;
+
 	argbackq = arg->narg.backquote;
 	STARTSTACKSTR(expdest);
 	argstr(arg->narg.text, flag);
 	p = _STPUTC('\0', expdest);
 	expdest = p - 1;
-	if (arglist == NULL) {
-		/* here document expanded */
-		goto out;
-	}
 	p = grabstackstr(p);
 	exparg.lastp = &exparg.list;
 	/*
@@ -214,13 +343,30 @@ expandarg(union node *arg, struct arglist *arglist, int flag)
 		exparg.lastp = &sp->next;
 	}
 	*exparg.lastp = NULL;
-	if (exparg.list) {
-		*arglist->lastp = exparg.list;
-		arglist->lastp = exparg.lastp;
-	}
+}
 
-out:
-	ifsfree();
+
+/*
+ * Is this word one field that is its own text?  A quote, escape or
+ * expansion leaves a control character, and a tilde or a glob
+ * character has to go through argstr and expandmeta.  Returns the
+ * length of the text plus one, or -1.
+ */
+
+STATIC int
+litword(const char *text)
+{
+	const char *p;
+	int c;
+
+	for (p = text ; (c = (signed char)*p) ; p++) {
+		if ((c >= CTL_FIRST && c <= CTL_LAST) ||
+		    c == '*' || c == '?' || c == '[' || c == '~')
+			return -1;
+	}
+	if (p == text)
+		return -1;
+	return p - text + 1;
 }
 
 
@@ -406,40 +552,24 @@ lose:
 void 
 removerecordregions(int endoff)
 {
-	if (ifslastp == NULL)
+	int i;
+
+	if (ifsnregion == ifsbase)
 		return;
 
-	if (ifsfirst.endoff > endoff) {
-		while (ifsfirst.next != NULL) {
-			struct ifsregion *ifsp;
-			INTOFF;
-			ifsp = ifsfirst.next->next;
-			ckfree(ifsfirst.next);
-			ifsfirst.next = ifsp;
-			INTON;
-		}
-		if (ifsfirst.begoff > endoff)
-			ifslastp = NULL;
-		else {
-			ifslastp = &ifsfirst;
-			ifsfirst.endoff = endoff;
-		}
+	if (ifsregion[ifsbase].endoff > endoff) {
+		ifsnregion = ifsbase;
+		if (ifsregion[ifsbase].begoff <= endoff)
+			ifsregion[ifsnregion++].endoff = endoff;
 		return;
 	}
-	
-	ifslastp = &ifsfirst;
-	while (ifslastp->next && ifslastp->next->begoff < endoff)
-		ifslastp=ifslastp->next;
-	while (ifslastp->next != NULL) {
-		struct ifsregion *ifsp;
-		INTOFF;
-		ifsp = ifslastp->next->next;
-		ckfree(ifslastp->next);
-		ifslastp->next = ifsp;
-		INTON;
-	}
-	if (ifslastp->endoff > endoff)
-		ifslastp->endoff = endoff;
+
+	i = ifsbase;
+	while (i + 1 < ifsnregion && ifsregion[i + 1].begoff < endoff)
+		i++;
+	ifsnregion = i + 1;
+	if (ifsregion[i].endoff > endoff)
+		ifsregion[i].endoff = endoff;
 }
 
 
@@ -522,12 +652,27 @@ expbackq(union node *cmd, int flag)
 	int startloc;
 	char const *syntax = flag & EXP_QUOTED ? DQSYNTAX : BASESYNTAX;
 	struct stackmark smark;
+	struct nodelist *saveargbackq;
+	int saveifsbase;
+	int saveifsnregion;
 
 	INTOFF;
 	startloc = expdest - (char *)stackblock();
 	pushstackmark(&smark, startloc);
+	/*
+	 * The command may be run without a subshell, expanding its own
+	 * arguments, so keep this word's state out of its way.
+	 */
+	saveargbackq = argbackq;
+	saveifsbase = ifsbase;
+	saveifsnregion = ifsnregion;
+	ifsbase = ifsnregion;
 	evalbackcmd(cmd, (struct backcmd *) &in);
+	argbackq = saveargbackq;
+	ifsbase = saveifsbase;
+	ifsnregion = saveifsnregion;
 	popstackmark(&smark);
+	expdest = (char *)stackblock() + startloc;
 
 	p = in.buf;
 	i = in.nleft;
@@ -549,10 +694,8 @@ read:
 
 	if (in.buf)
 		ckfree(in.buf);
-	if (in.fd >= 0) {
-		close(in.fd);
-		back_exitstatus = waitforjob(in.jp);
-	}
+	if (in.fd >= 0)
+		back_exitstatus = waitbackcmd(&in);
 	INTON;
 
 	/* Eat all trailing newlines */
@@ -638,6 +781,82 @@ scanright(
 	return 0;
 }
 
+/*
+ * Patterns for ${var%pat} and friends are very often a plain string,
+ * maybe with a * at one end, and then where they match can be found
+ * directly instead of trying pmatch on every prefix or suffix.  Returns
+ * 1 with the length of the prefix removed or kept in *kp, 0 for no
+ * match, or -1 to leave it to scanleft or scanright.
+ */
+
+STATIC int
+scanfast(char *pat, const char *s, size_t n, int subtype, size_t *kp)
+{
+	char *p, *q;
+	int lead, trail;
+	size_t m;
+	const char *hit;
+
+	lead = *pat == '*';
+	trail = 0;
+	for (p = pat + lead; *p; p++) {
+		if (*p == '\\' && p[1])
+			p++;
+		else if (*p == '*' && !p[1] && !lead)
+			trail = 1;
+		else if (*p == '*' || *p == '?' || *p == '[')
+			return -1;
+	}
+
+	/* Now take the literal part out, without its backslashes. */
+	q = pat;
+	for (p = pat + lead; *p && !(trail && !p[1]); p++) {
+		if (*p == '\\' && p[1])
+			p++;
+		*q++ = *p;
+	}
+	*q = '\0';
+	m = q - pat;
+
+	/* lead: the pattern ends with the literal, trail: starts with it */
+	hit = NULL;
+	if ((subtype >= 2 && lead) || (subtype < 2 && trail)) {
+		if (subtype == 2 || subtype == 1) {
+			hit = strstr(s, pat);
+		} else if (n >= m) {
+			hit = s + n - m;
+			while (memcmp(hit, pat, m))
+				if (hit-- == s) {
+					hit = NULL;
+					break;
+				}
+		}
+		if (!hit)
+			return 0;
+	}
+
+	switch (subtype) {
+	case 2:		/* # */
+	case 3:		/* ## */
+		if (lead)
+			*kp = hit - s + m;
+		else if (strncmp(s, pat, m))
+			return 0;
+		else
+			*kp = trail && subtype == 3 ? n : m;
+		break;
+	default:	/* % and %% */
+		if (trail)
+			*kp = hit - s;
+		else if (n < m || memcmp(s + n - m, pat, m))
+			return 0;
+		else
+			*kp = lead && subtype == 1 ? 0 : n - m;
+		break;
+	}
+	return 1;
+}
+
 STATIC const char *
 subevalvar(char *p, char *str, int strloc, int subtype, int startloc, int varflags, int flag)
 {
@@ -648,6 +867,7 @@ subevalvar(char *p, char *str, int strloc, int subtype, int startloc, int varfla
 	int amount;
 	char *rmesc, *rmescend;
 	int zero;
+	size_t k;
 	char *(*scan)(char *, char *, char *, char *, int , int);
 
 	argstr(p, EXP_TILDE | (subtype != VSASSIGN && subtype != VSQUESTION ?
@@ -693,7 +913,25 @@ subevalvar(char *p, char *str, int strloc, int subtype, int startloc, int varfla
 	/* VSTRIMLEFT/VSTRIMRIGHTMAX -> scanleft */
 	scan = (subtype & 1) ^ zero ? scanleft : scanright;
 
-	loc = scan(startp, rmesc, rmescend, str, quotes, zero);
+	switch (scanfast(str, rmesc, rmescend - rmesc, subtype, &k)) {
+	case -1:
+		loc = scan(startp, rmesc, rmescend, str, quotes, zero);
+		break;
+	case 0:
+		loc = NULL;
+		break;
+	default:
+		loc = startp;
+		if (!quotes)
+			loc += k;
+		else
+			while (k--) {
+				if (*loc == (char)CTLESC)
+					loc++;
+				loc++;
+			}
+		break;
+	}
 	if (loc) {
 		if (zero) {
 			memmove(startp, loc, str - loc);
@@ -846,30 +1084,51 @@ end:
 
 
 /*
- * Put a string on the stack.
+ * Put a string on the stack.  Runs of characters that go as they are
+ * are copied in one piece, there being room for the worst case.
  */
 
 STATIC void
 memtodest(const char *p, size_t len, const char *syntax, int quotes) {
+	const char *end = p + len;
+	const char *s;
+	int bsesc;
 	char *q;
+	int c;
 
 	if (unlikely(!len))
 		return;
 
-	q = makestrspace(len * 2, expdest);
+	if (!(quotes & QUOTES_ESC)) {
+		q = makestrspace(len, expdest);
+		if (!(quotes & QUOTES_KEEPNUL)) {
+			while ((s = memchr(p, 0, end - p))) {
+				q = mempcpy(q, p, s - p);
+				p = s + 1;
+			}
+		}
+		expdest = mempcpy(q, p, end - p);
+		return;
+	}
 
-	do {
-		int c = (signed char)*p++;
-		if (c) {
-			if ((quotes & QUOTES_ESC) &&
-			    ((syntax[c] == CCTL) ||
-			     (((quotes & EXP_FULL) || syntax != BASESYNTAX) &&
-			      syntax[c] == CBACK)))
-				USTPUTC(CTLESC, q);
-		} else if (!(quotes & QUOTES_KEEPNUL))
+	q = makestrspace(len * 2, expdest);
+	bsesc = (quotes & EXP_FULL) || syntax != BASESYNTAX;
+	for (;;) {
+		for (s = p; p < end; p++) {
+			c = (signed char)*p;
+			if (!c || syntax[c] == CCTL ||
+			    (bsesc && syntax[c] == CBACK))
+				break;
+		}
+		q = mempcpy(q, s, p - s);
+		if (p == end)
+			break;
+		if ((c = (signed char)*p++))
+			USTPUTC(CTLESC, q);
+		else if (!(quotes & QUOTES_KEEPNUL))
 			continue;
 		USTPUTC(c, q);
-	} while (--len);
+	}
 
 	expdest = q;
 }
@@ -999,19 +1258,86 @@ recordregion(int start, int end, int nulonly)
 {
 	struct ifsregion *ifsp;
 
-	if (ifslastp == NULL) {
-		ifsp = &ifsfirst;
-	} else {
+	if (ifsnregion == ifsmaxregion) {
 		INTOFF;
-		ifsp = (struct ifsregion *)ckmalloc(sizeof (struct ifsregion));
-		ifsp->next = NULL;
-		ifslastp->next = ifsp;
+		ifsmaxregion = ifsmaxregion ? ifsmaxregion * 2 : 8;
+		ifsregion = ckrealloc(ifsregion,
+				      ifsmaxregion * sizeof (struct ifsregion));
 		INTON;
 	}
-	ifslastp = ifsp;
-	ifslastp->begoff = start;
-	ifslastp->endoff = end;
-	ifslastp->nulonly = nulonly;
+	ifsp = &ifsregion[ifsnregion++];
+	ifsp->begoff = start;
+	ifsp->endoff = end;
+	ifsp->nulonly = nulonly;
+}
+
+
+
+/*
+ * IFS is about to change, so ifsmap[0] has to be made again.
+ */
+
+void
+changeifs(const char *val)
+{
+    (void)val;
+	ifsmapok = 0;
+}
+
+
+/*
+ * Sort the bytes into the classes ifsbreakup looks for: the ones in
+ * IFS, and for a region that splits at nul bytes only, nul.  A nul
+ * always matches and counts as white space, as it did when this was
+ * strchr(ifs, c) and strchr(defifs, c).
+ */
+
+STATIC void
+mkifsmap(void)
+{
+	const char *p;
+	int c;
+
+	memset(ifsmap, 0, sizeof(ifsmap));
+	ifsmapctl = 1;
+	for (p = ifsset() ? ifsval() : defifs ; (c = (unsigned char)*p) ; p++) {
+		ifsmap[0][c] = IFSSEP;
+		if (c > ' ' && c < 0x80)
+			ifsmapctl = 0;
+	}
+	for (p = defifs ; *p ; p++)
+		if (ifsmap[0][(unsigned char)*p])
+			ifsmap[0][(unsigned char)*p] |= IFSSPC;
+	ifsmap[0][0] = ifsmap[1][0] = IFSSEP | IFSSPC;
+	ifsmap[0][(unsigned char)CTLESC] |= IFSESC;
+	ifsmap[1][(unsigned char)CTLESC] |= IFSESC;
+	ifsmapok = 1;
+}
+
+
+/*
+ * Skip the characters that don't split a field, from p up to end.
+ * When every one that can is white space, a control character or not
+ * ASCII, a long value is gone through a word at a time first.
+ */
+
+STATIC char *
+ifsskip(char *p, char *end, const char *map)
+{
+	unsigned long w;
+	const unsigned long ones = ~0UL / 255;
+
+	if (map == ifsmap[0] && ifsmapctl) {
+		while (end - p >= (long)sizeof(w)) {
+			memcpy(&w, p, sizeof(w));
+			if (((w - ones * 0x21) | w) & ones * 0x80)
+				break;
+			p += sizeof(w);
+		}
+	}
+	while (p < end && !map[(unsigned char)*p])
+		p++;
+	return p;
 }
 
 
@@ -1029,29 +1355,34 @@ ifsbreakup(char *string, struct arglist *arglist)
 	char *start;
 	char *p;
 	char *q;
-	const char *ifs, *realifs;
+	char *end;
+	const char *map;
 	int ifsspc;
 	int nulonly;
+	int i;
 
 
 	start = string;
-	if (ifslastp != NULL) {
+	if (ifsnregion > ifsbase) {
 		ifsspc = 0;
 		nulonly = 0;
-		realifs = ifsset() ? ifsval() : defifs;
-		ifsp = &ifsfirst;
-		do {
+		if (!ifsmapok)
+			mkifsmap();
+		for (i = ifsbase ; i < ifsnregion ; i++) {
+			ifsp = &ifsregion[i];
 			p = string + ifsp->begoff;
+			end = string + ifsp->endoff;
 			nulonly = ifsp->nulonly;
-			ifs = nulonly ? nullstr : realifs;
+			map = ifsmap[nulonly != 0];
 			ifsspc = 0;
-			while (p < string + ifsp->endoff) {
+			while ((p = ifsskip(p, end, map)) < end) {
 				q = p;
 				if (*p == (char)CTLESC)
 					p++;
-				if (strchr(ifs, *p)) {
+				if (map[(unsigned char)*p] & IFSSEP) {
 					if (!nulonly)
-						ifsspc = (strchr(defifs, *p) != NULL);
+						ifsspc = map[(unsigned char)*p] &
+							 IFSSPC;
 					/* Ignore IFS whitespace at start */
 					if (q == start && ifsspc) {
 						p++;
@@ -1066,16 +1397,18 @@ ifsbreakup(char *string, struct arglist *arglist)
 					p++;
 					if (!nulonly) {
 						for (;;) {
-							if (p >= string + ifsp->endoff) {
+							if (p >= end) {
 								break;
 							}
 							q = p;
 							if (*p == (char)CTLESC)
 								p++;
-							if (strchr(ifs, *p) == NULL ) {
+							if (!(map[(unsigned char)*p] &
+							      IFSSEP)) {
 								p = q;
 								break;
-							} else if (strchr(defifs, *p) == NULL) {
+							} else if (!(map[(unsigned char)*p] &
+								     IFSSPC)) {
 								if (ifsspc) {
 									p++;
 									ifsspc = 0;
@@ -1091,7 +1424,7 @@ ifsbreakup(char *string, struct arglist *arglist)
 				} else
 					p++;
 			}
-		} while ((ifsp = ifsp->next) != NULL);
+		}
 		if (nulonly)
 			goto add;
 	}
@@ -1106,25 +1439,20 @@ add:
 	arglist->lastp = &sp->next;
 }
 
+/*
+ * Done with the regions of this word.  The array stays for the next
+ * one, unless a long list of fields made it big.
+ */
 void ifsfree(void)
 {
-	struct ifsregion *p = ifsfirst.next;
-
-	if (!p)
-		goto out;
-
-	INTOFF;
-	do {
-		struct ifsregion *ifsp;
-		ifsp = p->next;
-		ckfree(p);
-		p = ifsp;
-	} while (p);
-	ifsfirst.next = NULL;
-	INTON;
-
-out:
-	ifslastp = NULL;
+	ifsnregion = ifsbase;
+	if (!ifsbase && ifsmaxregion > 256) {
+		INTOFF;
+		ckfree(ifsregion);
+		ifsregion = NULL;
+		ifsmaxregion = 0;
+		INTON;
+	}
 }
 
 
@@ -1196,7 +1524,39 @@ addglob(pglob)
 
 
 #else	/* HAVE_GLOB */
-STATIC char *expdir;
+STATIC SHTLS char *expdir;
+
+
+/*
+ * A directory listing for expmeta.  Each name is preceded by a byte
+ * holding its d_type, so that names which can't be directories are
+ * passed over without a stat.  Big listings of directories that have
+ * stopped changing are kept, sorted, and used again for as long as the
+ * directory's mtime says they are still right.
+ */
+
+struct globdir {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	int busy;		/* number of expmeta calls using it */
+	int kept;		/* it is in globdirs */
+	int count;		/* number of names */
+	char **names;
+};
+
+#define GLOBDIRS 4		/* listings to keep */
+#define GLOBDIRMIN 256		/* fewest names worth keeping */
+
+/* dirbuf gives DT_UNKNOWN where the system has no d_type */
+#define notdir(t)	((t) != DT_DIR && (t) != DT_LNK && (t) != DT_UNKNOWN)
+
+STATIC SHTLS struct globdir *globdirs[GLOBDIRS];
+STATIC SHTLS int globnext;		/* slot to try first when keeping one */
+
+STATIC struct globdir *openglobdir(const char *);
+STATIC void closeglobdir(struct globdir *);
+STATIC int globcmp(const void *, const void *);
 
 
 STATIC void
@@ -1264,8 +1624,9 @@ expmeta(char *enddir, char *name)
 	char *endname;
 	int metaflag;
 	struct stat64 statb;
-	DIR *dirp;
-	struct dirent *dp;
+	struct globdir *gd;
+	char **np, **npend;
+	size_t plen;
 	int atend;
 	int matchdot;
 	int esc;
@@ -1329,7 +1690,7 @@ expmeta(char *enddir, char *name)
 		cp = expdir;
 		enddir[-1] = '\0';
 	}
-	if ((dirp = opendir(cp)) == NULL)
+	if ((gd = openglobdir(cp)) == NULL)
 		return;
 	if (enddir != expdir)
 		enddir[-1] = '/';
@@ -1346,15 +1707,43 @@ expmeta(char *enddir, char *name)
 		p++;
 	if (*p == '.')
 		matchdot++;
-	while (! int_pending() && (dp = readdir(dirp)) != NULL) {
-		if (dp->d_name[0] == '.' && ! matchdot)
+	/*
+	 * Only names starting with the pattern's literal prefix can match,
+	 * and in a sorted listing those are all together.
+	 */
+	plen = strcspn(start, "*?[\\");
+	np = gd->names;
+	npend = np + gd->count;
+	if (plen && gd->kept) {
+		char **lo = np, **hi = npend, **mid;
+
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (strncmp(*mid + 1, start, plen) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		np = lo;
+	}
+	for (; np < npend && ! int_pending() ; np++) {
+		const char *dname = *np + 1;
+
+		if (plen && strncmp(dname, start, plen)) {
+			if (gd->kept)
+				break;
+			continue;
+		}
+		if (dname[0] == '.' && ! matchdot)
+			continue;
+		if (!atend && notdir((unsigned char)**np))
 			continue;
-		if (pmatch(start, dp->d_name)) {
+		if (pmatch(start, dname)) {
 			if (atend) {
-				scopy(dp->d_name, enddir);
+				scopy(dname, enddir);
 				addfname(expdir);
 			} else {
-				for (p = enddir, cp = dp->d_name;
+				for (p = enddir, cp = dname;
 				     (*p++ = *cp++) != '\0';)
 					continue;
 				p[-1] = '/';
@@ -1362,10 +1751,122 @@ expmeta(char *enddir, char *name)
 			}
 		}
 	}
-	closedir(dirp);
+	closeglobdir(gd);
 	if (! atend)
 		endname[-esc - 1] = esc ? '\\' : '/';
 }
+
+
+/*
+ * Get the listing of a directory for expmeta, from globdirs if it has
+ * a good one.  Returns NULL if the directory can't be read.
+ */
+
+STATIC struct globdir *
+openglobdir(const char *name)
+{
+	struct stat64 st;
+	struct globdir *gd;
+	struct dirbuf_ent *dp;
+	struct dirbuf *dirp;
+	char *buf, *p;
+	size_t len, size, n;
+	int count;
+	int fd;
+	int i;
+
+	if (stat64(name, &st) < 0)
+		return NULL;
+	for (i = 0 ; i < GLOBDIRS ; i++) {
+		gd = globdirs[i];
+		if (gd && gd->ino == st.st_ino && gd->dev == st.st_dev &&
+		    gd->mtime == st.st_mtime) {
+			gd->busy++;
+			return gd;
+		}
+	}
+	/*
+	 * dirbuf reads the whole directory a large buffer at a time
+	 * (getdents64 on Linux) rather than an entry or two a syscall.
+	 */
+	if ((fd = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return NULL;
+	if ((dirp = dirbuf_open(fd, 0)) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	buf = NULL;
+	len = size = 0;
+	count = 0;
+	while (! int_pending() && (dp = dirbuf_read(dirp)) != NULL) {
+		n = strlen(dp->name) + 2;
+		if (len + n > size) {
+			do
+				size = size ? size * 2 : 1024;
+			while (len + n > size);
+			buf = ckrealloc(buf, size);
+		}
+		buf[len] = dp->type;
+		memcpy(buf + len + 1, dp->name, n - 1);
+		len += n;
+		count++;
+	}
+	dirbuf_close(dirp);
+
+	gd = ckmalloc(sizeof(*gd) + count * sizeof(char *) + len);
+	gd->names = (char **)(gd + 1);
+	p = (char *)(gd->names + count);
+	if (len)
+		memcpy(p, buf, len);
+	ckfree(buf);
+	for (i = 0 ; i < count ; i++) {
+		gd->names[i] = p;
+		p += strlen(p + 1) + 2;
+	}
+	gd->dev = st.st_dev;
+	gd->ino = st.st_ino;
+	gd->mtime = st.st_mtime;
+	gd->busy = 1;
+	gd->kept = 0;
+	gd->count = count;
+
+	/*
+	 * A directory changed in the last second could change again
+	 * without its mtime showing it, so only keep ones older than that.
+	 */
+	if (count < GLOBDIRMIN || int_pending() ||
+	    st.st_mtime >= time(NULL) - 1)
+		return gd;
+	for (i = 0 ; i < GLOBDIRS ; i++) {
+		struct globdir **gp = &globdirs[(globnext + i) % GLOBDIRS];
+
+		if (*gp && (*gp)->busy)
+			continue;
+		if (*gp)
+			ckfree(*gp);
+		qsort(gd->names, count, sizeof(char *), globcmp);
+		gd->kept = 1;
+		*gp = gd;
+		globnext = (gp - globdirs + 1) % GLOBDIRS;
+		break;
+	}
+	return gd;
+}
+
+
+STATIC void
+closeglobdir(struct globdir *gd)
+{
+	if (--gd->busy == 0 && !gd->kept)
+		ckfree(gd);
+}
+
+
+STATIC int
+globcmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a + 1, *(char *const *)b + 1);
+}
 #endif	/* HAVE_GLOB */
 
 
@@ -1396,11 +1897,19 @@ STATIC struct strlist *
 expsort(struct strlist *str)
 {
 	int len;
+	int sorted;
 	struct strlist *sp;
 
 	len = 0;
-	for (sp = str ; sp ; sp = sp->next)
+	sorted = 1;
+	for (sp = str ; sp ; sp = sp->next) {
 		len++;
+		if (sp->next && strcmp(sp->text, sp->next->text) > 0)
+			sorted = 0;
+	}
+	/* Matches from a kept listing are in order already. */
+	if (sorted)
+		return str;
 	return msort(str, len);
 }
 
@@ -1725,6 +2234,7 @@ varunset(const char *end, const char *var, const char *umsg, int varflags)
 INCLUDE "expand.h"
 
 RESET {
+	ifsbase = 0;
 	ifsfree();
 }
 
@@ -63,6 +63,7 @@ struct arglist {
 
 union node;
 void expandarg(union node *, struct arglist *, int);
+int expandargv(union node *, char ***, int);
 void expari(int);
 #define rmescapes(p) _rmescapes((p), 0)
 char *_rmescapes(char *, int);
@@ -71,6 +72,7 @@ void recordregion(int, int, int);
 void removerecordregions(int); 
 void ifsbreakup(char *, struct arglist *);
 void ifsfree(void);
+void changeifs(const char *);
 
 /* From arith.y */
 intmax_t arith(const char *);
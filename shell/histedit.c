@@ -53,17 +53,21 @@
 #ifndef SMALL
 #include "myhistedit.h"
 #include "eval.h"
+#include "exec.h"
 #include "memalloc.h"
 
 #define MAXHISTLOOPS	4	/* max recursions through fc */
 #define DEFEDITOR	"ed"	/* default editor *should* be $EDITOR */
 
-History *hist;	/* history cookie */
-EditLine *el;	/* editline cookie */
-int displayhist;
-static FILE *el_in, *el_out;
+SHTLS History *hist;	/* history cookie */
+SHTLS EditLine *el;	/* editline cookie */
+SHTLS int displayhist;
+static SHTLS FILE *el_in, *el_out;
 
 STATIC const char *fc_replace(const char *, char *, char *);
+STATIC char *sh_cmdname(const char *, int);
+STATIC char **sh_matches(const char *, int, int);
+STATIC unsigned char sh_complete(EditLine *, int);
 
 #ifdef DEBUG
 extern FILE *tracefile;
@@ -115,6 +119,10 @@ histedit(void)
 				if (hist)
 					el_set(el, EL_HIST, history, hist);
 				el_set(el, EL_PROMPT, getprompt);
+				el_set(el, EL_ADDFN, "sh-complete",
+				    "Complete a command or file name",
+				    sh_complete);
+				el_set(el, EL_BIND, "^I", "sh-complete", NULL);
 			} else {
 bad:
 				out2str("sh: can't initialize editing\n");
@@ -162,6 +170,129 @@ sethistsize(const char *hs)
 	}
 }
 
+
+/*
+ * The history file is only ever appended to, a line per command as it's
+ * entered (so sessions sharing a file see each other's), and loading it
+ * reads only as many lines from its end as the history keeps.  Once the
+ * file is over twice that it's rewritten with just those.  It's loaded
+ * at the next prompt after HISTFILE is set, by when HISTSIZE will be
+ * too, wherever it is in the profile.
+ */
+
+STATIC SHTLS int histpending;		/* HISTFILE set since it was read */
+STATIC SHTLS int histsaved;		/* newest event already in the file */
+
+void
+sethistfile(const char *hf)
+{
+	histpending = *hf != '\0';
+}
+
+
+void
+histload(void)
+{
+	HistEvent he;
+	const char *hf;
+	char *tmp;
+	int lines, size;
+
+	if (hist == NULL || !histpending)
+		return;
+	histpending = 0;
+	hf = histfileval();
+	INTOFF;
+	lines = history(hist, &he, H_LOAD, hf);
+	size = atoi(histsizeval());
+	if (*histsizeval() == '\0' || size < 0)
+		size = 100;
+	if (lines > 2 * size) {
+		tmp = ckmalloc(strlen(hf) + 5);
+		strcpy(tmp, hf);
+		strcat(tmp, ".new");
+		if (history(hist, &he, H_SAVE, tmp) != -1)
+			rename(tmp, hf);
+		else
+			unlink(tmp);
+		ckfree(tmp);
+	}
+	if (history(hist, &he, H_FIRST) != -1)
+		histsaved = he.num;
+	INTON;
+}
+
+
+void
+histsave(void)
+{
+	HistEvent he;
+
+	if (hist == NULL || *histfileval() == '\0')
+		return;
+	INTOFF;
+	if (history(hist, &he, H_FIRST) != -1 && he.num != histsaved) {
+		histsaved = he.num;
+		history(hist, &he, H_SAVE_APPEND, histfileval());
+	}
+	INTON;
+}
+
+/*
+ * Tab completion: the first word of a command is completed from the
+ * commands the shell knows of without searching the path, anything else
+ * (or a command name no command starts with) as a file name.
+ */
+
+STATIC char *
+sh_cmdname(const char *text, int state)
+{
+	static char **names;
+	static int count, next;
+
+	if (state == 0) {
+		while (next < count)
+			free(names[next++]);
+		free(names);
+		names = NULL;
+		count = cmdnames(text, &names);
+		next = 0;
+	}
+	if (next < count)
+		return names[next++];
+	return NULL;
+}
+
+
+STATIC char **
+sh_matches(const char *text, int start, int end)
+{
+	const LineInfo *li;
+	const char *p;
+
+	(void)end;
+	if (strchr(text, '/'))
+		return NULL;
+	li = el_line(el);
+	if (start > li->lastchar - li->buffer)
+		return NULL;
+	for (p = li->buffer + start ; p > li->buffer ; p--)
+		if (p[-1] != ' ' && p[-1] != '\t')
+			break;
+	if (p > li->buffer && !strchr(";&|(`", p[-1]))
+		return NULL;
+	return completion_matches(text, sh_cmdname);
+}
+
+
+STATIC unsigned char
+sh_complete(EditLine *e, int ch)
+{
+	(void)ch;
+	return _el_fn_complete_app(e, sh_matches);
+}
+
+
 void
 setterm(const char *term)
 {
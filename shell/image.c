@@ -0,0 +1,387 @@
+/*-
+ * Copyright (c) 1991, 1993
+ *	The Regents of the University of California.  All rights reserved.
+ * Copyright (c) 1997-2005
+ *	Herbert Xu <herbert@gondor.apana.org.au>.  All rights reserved.
+ *
+ * This code is derived from software contributed to Berkeley by
+ * Kenneth Almquist.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shell images.  A shell that sources a big library of functions every
+ * time it starts parses the library and copies each function out of the
+ * tree again each time.  "shimage file" writes out what the shell has
+ * defined instead: its functions, as one block of trees laid out by
+ * copyfuncs, its variables, its aliases and the programs it has found
+ * in PATH.  A shell started with SHIMAGE naming such a file maps it,
+ * fixes up the pointers in the trees and uses the functions and the
+ * variables' text where they lie, before any profile is read.
+ *
+ * It is an image of what was defined, not of the environment.  A
+ * variable that is already set when the shell starts, from the
+ * environment or as one of the shell's own, keeps its value, and the
+ * shell's special variables aren't saved at all.  The programs are
+ * only used if PATH is the same as it was.  Nothing checks whether the
+ * scripts the image was made from have changed since.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shell.h"
+#include "nodes.h"
+#include "exec.h"
+#include "options.h"
+#include "parser.h"
+#include "alias.h"
+#include "var.h"
+#include "machdep.h"
+#include "memalloc.h"
+#include "mystring.h"
+#include "output.h"
+#include "error.h"
+#include "image.h"
+
+
+#define IMAGEMAGIC	0x73686932	/* "shi2" */
+
+/*
+ * The header is followed by the variables' flags and the programs'
+ * places in PATH, then, aligned, the block of trees, then the strings:
+ * the function names, the variables as name=value, each alias's name
+ * and value, PATH and the program names.
+ */
+struct imagehdr {
+	unsigned int magic;
+	unsigned int nodesize;		/* sizeof(union node) of the writer */
+	int nfunc;
+	int nvar;
+	int nalias;
+	int nprog;
+	size_t blocksize;		/* size of the block of trees */
+	size_t strsize;			/* size of the strings */
+	void *base;			/* where the block was when written */
+};
+
+struct imagecmd {
+	const char *name;
+	struct cmdentry entry;
+};
+
+struct imagecmds {
+	int count;
+	int size;
+	struct imagecmd *cmd;
+};
+
+struct imagestr {
+	char *p;			/* end of the strings so far */
+	int count;
+};
+
+
+STATIC SHTLS char *imagemap;			/* the image this shell started with */
+STATIC SHTLS size_t imagesize;
+
+
+STATIC void imageaddcmd(const char *, struct cmdentry *, void *);
+STATIC void imageaddalias(struct alias *, void *);
+STATIC char *imageputs(const char *, char *);
+STATIC char *imageskip(char *, char *, int);
+
+
+
+STATIC void
+imageaddcmd(const char *name, struct cmdentry *entry, void *arg)
+{
+	struct imagecmds *cp = arg;
+
+	if (cp->count >= cp->size) {
+		cp->size = cp->size ? cp->size * 2 : 64;
+		cp->cmd = ckrealloc(cp->cmd, cp->size * sizeof(*cp->cmd));
+	}
+	cp->cmd[cp->count].name = name;
+	cp->cmd[cp->count++].entry = *entry;
+}
+
+
+STATIC void
+imageaddalias(struct alias *ap, void *arg)
+{
+	struct imagestr *sp = arg;
+
+	sp->p = imageputs(ap->name, sp->p);
+	sp->p = imageputs(ap->val, sp->p);
+	sp->count++;
+}
+
+
+STATIC char *
+imageputs(const char *s, char *p)
+{
+	return stnputs(s, strlen(s) + 1, p);
+}
+
+
+
+/*
+ * The shimage builtin.  Like the script cache, the file is written
+ * under another name and renamed, so a shell starting meanwhile sees
+ * either the old image or the new one.
+ */
+
+int
+shimagecmd(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+	struct imagehdr h;
+	struct imagecmds cmds;
+	struct imagestr str;
+	union node **trees, **block;
+	char **vars, **vend, **vp;
+	char *name, *start;
+	char tmp[PATH_MAX];
+	int *flags;
+	size_t blocksize, intsize;
+	int i, n, fd, err, e;
+
+	nextopt(nullstr);
+	if (!(name = *argptr) || argptr[1])
+		sh_error("usage: shimage file");
+	if (fmtstr(tmp, sizeof(tmp), "%s.%d", name, (int) getpid()) >=
+	    (int) sizeof(tmp))
+		sh_error("%s: name too long", name);
+
+	memset(&h, 0, sizeof(h));
+	h.magic = IMAGEMAGIC;
+	h.nodesize = sizeof(union node);
+	/*
+	 * Text that is fixed and not in our own image is the environment's
+	 * (or PPID, which is the shell's own).
+	 */
+	vars = listvars(0, VUNSET | VSTRFIXED | VSTACK, NULL);
+	for (vp = vend = vars ; *vp ; vp++)
+		if (!(lookupvp(*vp)->flags & VTEXTFIXED) ||
+		    (*vp >= imagemap && *vp < imagemap + imagesize))
+			*vend++ = *vp;
+	h.nvar = vend - vars;
+
+	INTOFF;
+	cmds.count = cmds.size = 0;
+	cmds.cmd = NULL;
+	walkcmds(imageaddcmd, &cmds);
+	for (i = 0 ; i < cmds.count ; i++)
+		if (cmds.cmd[i].entry.cmdtype == CMDFUNCTION)
+			h.nfunc++;
+		else
+			h.nprog++;
+
+	intsize = SHELL_ALIGN((h.nvar + h.nprog) * sizeof(int));
+	flags = stalloc(intsize);
+	for (i = 0 ; i < h.nvar ; i++)
+		flags[i] = lookupvp(vars[i])->flags & (VEXPORT | VREADONLY);
+	trees = stalloc((h.nfunc + 1) * sizeof(*trees));
+	for (i = n = 0 ; i < cmds.count ; i++)
+		if (cmds.cmd[i].entry.cmdtype == CMDFUNCTION)
+			trees[n++] = &cmds.cmd[i].entry.u.func->n;
+		else
+			flags[h.nvar + i - n] = cmds.cmd[i].entry.u.index;
+	block = copyfuncs(trees, h.nfunc, &blocksize);
+	h.blocksize = blocksize;
+	h.base = block;
+
+	STARTSTACKSTR(str.p);
+	for (i = 0 ; i < cmds.count ; i++)
+		if (cmds.cmd[i].entry.cmdtype == CMDFUNCTION)
+			str.p = imageputs(cmds.cmd[i].name, str.p);
+	for (vp = vars ; vp < vend ; vp++)
+		str.p = imageputs(*vp, str.p);
+	str.count = 0;
+	walkaliases(imageaddalias, &str);
+	h.nalias = str.count;
+	str.p = imageputs(pathval(), str.p);
+	for (i = 0 ; i < cmds.count ; i++)
+		if (cmds.cmd[i].entry.cmdtype == CMDNORMAL)
+			str.p = imageputs(cmds.cmd[i].name, str.p);
+	start = stackblock();
+	h.strsize = str.p - start;
+
+	err = (fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0;
+	if (!err) {
+		err = dxwrite(fd, &h, sizeof(h)) ||
+		      dxwrite(fd, flags, intsize) ||
+		      dxwrite(fd, block, blocksize) ||
+		      dxwrite(fd, start, h.strsize);
+		err = close(fd) < 0 || err || rename(tmp, name) < 0;
+		e = errno;
+		if (err)
+			unlink(tmp);
+	} else
+		e = errno;
+	ckfree(block);
+	ckfree(cmds.cmd);
+	INTON;
+	if (err)
+		sh_error("cannot create %s: %s", name, errmsg(e, E_CREAT));
+	return 0;
+}
+
+
+
+/*
+ * Step over count strings from p, returning where the next would start
+ * or NULL if they run past end.
+ */
+
+STATIC char *
+imageskip(char *p, char *end, int count)
+{
+	while (count-- > 0) {
+		if ((p = memchr(p, '\0', end - p)) == NULL)
+			return NULL;
+		p++;
+	}
+	return p;
+}
+
+
+
+/*
+ * Called from main with the value of SHIMAGE.  An image that can't be
+ * used is only a warning, and the shell carries on without it.  The
+ * mapping is never undone: the functions live in it, each with a
+ * reference count that freefunc can't take below zero, and so does the
+ * text of the variables.
+ */
+
+void
+imageload(const char *name)
+{
+	struct imagehdr h;
+	struct stat st;
+	struct cmdentry entry;
+	struct var *vp;
+	struct funcnode *f;
+	union node **block;
+	char *map, *p, *end, *val, *fname, *path;
+	int *flags;
+	size_t size, off;
+	int fd, i;
+
+	if ((fd = open(name, O_RDONLY)) < 0) {
+		sh_warnx("cannot open %s: %s", name, errmsg(errno, E_OPEN));
+		return;
+	}
+	INTOFF;
+	map = MAP_FAILED;
+	if (fstat(fd, &st) < 0 || st.st_uid != geteuid() ||
+	    (size_t) st.st_size < sizeof(h) || st.st_size > SSIZE_MAX)
+		goto bad;
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto bad;
+	memcpy(&h, map, sizeof(h));
+	if (h.magic != IMAGEMAGIC || h.nodesize != sizeof(union node) ||
+	    h.nfunc < 0 || h.nvar < 0 || h.nalias < 0 || h.nprog < 0 ||
+	    (size_t) h.nvar + h.nprog > size / sizeof(int))
+		goto bad;
+	off = sizeof(h) + SHELL_ALIGN((h.nvar + h.nprog) * sizeof(int));
+	if (off > size || h.blocksize > size - off ||
+	    h.strsize != size - off - h.blocksize)
+		goto bad;
+	flags = (int *) (map + sizeof(h));
+	block = (union node **) (map + off);
+	p = map + off + h.blocksize;
+	end = p + h.strsize;
+	if (relocfuncs(block, h.nfunc, h.blocksize, h.base) ||
+	    imageskip(p, end, h.nfunc + h.nvar + 2 * h.nalias + 1 + h.nprog)
+	    == NULL)
+		goto bad;
+	for (i = 0 ; i < h.nfunc ; i++)
+		if (block[i] == NULL)
+			goto bad;
+	for (fname = p, val = imageskip(p, end, h.nfunc), i = 0 ;
+	     i < h.nvar ; i++, val = imageskip(val, end, 1))
+		if (*endofname(val) != '=' || endofname(val) == val)
+			goto bad;
+
+	entry.cmdtype = CMDFUNCTION;
+	for (i = 0 ; i < h.nfunc ; i++, fname = imageskip(fname, end, 1)) {
+		f = (struct funcnode *)
+		    ((char *) block[i] - offsetof(struct funcnode, n));
+		f->count = INT_MAX / 2;
+		enterfunc(f);
+		entry.u.func = f;
+		restorecmd(fname, &entry);
+	}
+	for (i = 0 ; i < h.nvar ; i++, fname = imageskip(fname, end, 1)) {
+		vp = lookupvp(fname);
+		if (vp && (!(vp->flags & VUNSET) || vp->flags & VREADONLY))
+			continue;
+		setvareq(fname, (flags[i] & (VEXPORT | VREADONLY)) |
+			 VTEXTFIXED);
+	}
+	for (i = 0 ; i < h.nalias ; i++) {
+		val = imageskip(fname, end, 1);
+		setalias(fname, val);
+		fname = imageskip(val, end, 1);
+	}
+	path = fname;
+	fname = imageskip(fname, end, 1);
+	if (equal(path, pathval())) {
+		entry.cmdtype = CMDNORMAL;
+		for (i = 0 ; i < h.nprog ; i++,
+		     fname = imageskip(fname, end, 1)) {
+			if ((entry.u.index = flags[h.nvar + i]) < 0)
+				continue;
+			restorecmd(fname, &entry);
+		}
+	}
+	imagemap = map;
+	imagesize = size;
+	close(fd);
+	INTON;
+	return;
+
+bad:
+	if (map != MAP_FAILED)
+		munmap(map, size);
+	close(fd);
+	INTON;
+	sh_warnx("%s: not a usable shell image", name);
+}
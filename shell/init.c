@@ -5,11 +5,13 @@
 #include "shell.h"
 #include "mystring.h"
 #include "init.h"
+#include "machdep.h"
+#include "memalloc.h"
 #include <stdio.h>
 #include "input.h"
 #include "error.h"
+#include <stdlib.h>
 #include "output.h"
-#include "memalloc.h"
 #include "trap.h"
 #include "parser.h"
 #include <unistd.h>
@@ -20,14 +22,26 @@
 
 
 
+#undef  MINSIZE
+#define MINSIZE SHELL_ALIGN(504)
+#undef  MAXNEWSIZE
+#define MAXNEWSIZE SHELL_ALIGN(16384)
+#undef  MAXFREE
+#define MAXFREE 65536
 #undef  EOF_NLEFT
 #define EOF_NLEFT -99		/* value of parsenleft when EOF pushed back */
 #undef  IBUFSIZ
 #define IBUFSIZ (BUFSIZ + 1)
+#undef  MAXIBUFSIZ
+#define MAXIBUFSIZ (1024 * 1024 + 1)	/* for whole script files */
 #undef  OUTBUFSIZ
 #define OUTBUFSIZ BUFSIZ
+#undef  OUTBUFMAX
+#define OUTBUFMAX (16 * 1024)	/* largest buffer for a file or pipe */
 #undef  MEM_OUT
 #define MEM_OUT -3		/* output to dynamically allocated memory */
+#undef  MEMOUTSIZ
+#define MEMOUTSIZ 128		/* first allocation for memout */
 #undef  S_DFL
 #define S_DFL 1			/* default signal handling (SIG_DFL) */
 #undef  S_CATCH
@@ -39,9 +53,18 @@
 #undef  S_RESET
 #define S_RESET 5		/* temporary - to reset a hard ignored sig */
 #undef  VTABSIZE
-#define VTABSIZE 39
+#define VTABSIZE 64		/* initial size, must be a power of 2 */
+
 
 
+struct stack_block {
+	struct stack_block *prev;
+	size_t size;
+	char space[MINSIZE];
+};
+
+extern SHTLS struct stack_block stackbase;
+extern SHTLS struct stack_block *stackp;	/* set by init() */
 
 struct strpush {
 	struct strpush *prev;	/* preceding string on stack */
@@ -59,15 +82,17 @@ struct parsefile {
 	int lleft;		/* number of chars left in this buffer */
 	char *nextc;		/* next char in buffer */
 	char *buf;		/* input buffer */
+	int bufsize;		/* its size, one more than is read into it */
 	struct strpush *strpush; /* for pushing strings at this level */
 	struct strpush basestrpush; /* so pushing one is fast */
+	struct scache *cache;	/* commands compiled from the file */
 };
 
-extern int parselleft;		/* copy of parsefile->lleft */
-extern struct parsefile basepf;	/* top level input file */
-extern char basebuf[IBUFSIZ];	/* buffer for top level input file */
+extern SHTLS int parselleft;		/* copy of parsefile->lleft */
+extern SHTLS struct parsefile basepf;	/* top level input file */
+extern SHTLS char *basebuf;		/* buffer for top level input file */
 
-extern struct localvar_list *localvar_stack;
+extern SHTLS struct localvar_list *localvar_stack;
 extern char **environ;
 
 
@@ -79,13 +104,26 @@ extern char **environ;
 void
 init() {
 
+      /* from memalloc.c: */
+      {
+	      stackp = &stackbase;
+	      stacknxt = stackbase.space;
+	      stacknleft = MINSIZE;
+	      sstrend = stackbase.space + MINSIZE;
+      }
+
       /* from input.c: */
       {
+	      parsefile = &basepf;
+	      basebuf = ckmalloc(IBUFSIZ);
 	      basepf.nextc = basepf.buf = basebuf;
+	      basepf.bufsize = IBUFSIZ;
       }
 
       /* from output.c: */
       {
+	      out1 = &output;
+	      out2 = &errout;
 #ifdef USE_GLIBC_STDIO
 	      initstreams();
 #endif
@@ -100,7 +138,7 @@ init() {
       /* from var.c: */
       {
 	      char **envp;
-	      static char ppid[32] = "PPID=";
+	      static SHTLS char ppid[32] = "PPID=";
 	      const char *p;
 	      struct stat st1, st2;
 
@@ -144,13 +182,13 @@ reset() {
 
       /* from output.c: */
       {
-#ifdef notyet
 	      out1 = &output;
 	      out2 = &errout;
-#ifdef USE_GLIBC_STDIO
+#ifndef USE_GLIBC_STDIO
+	      ckfree(grabmemout(NULL));
+#elif defined(notyet)
 	      if (memout.stream != NULL)
 		      __closememout();
-#endif
 	      if (memout.buf != NULL) {
 		      ckfree(memout.buf);
 		      memout.buf = NULL;
@@ -32,6 +32,7 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/stat.h>
 #include <stdio.h>	/* defines BUFSIZ */
 #include <fcntl.h>
 #include <unistd.h>
@@ -42,8 +43,8 @@
  * This file implements the input routines used by the parser.
  */
 
-#include "eval.h"
 #include "shell.h"
+#include "eval.h"
 #include "redir.h"
 #include "syntax.h"
 #include "input.h"
@@ -54,6 +55,8 @@
 #include "alias.h"
 #include "parser.h"
 #include "main.h"
+#include "cache.h"
+#include "stats.h"
 #ifndef SMALL
 #include "myhistedit.h"
 #endif
@@ -64,6 +67,7 @@
 
 #define EOF_NLEFT -99		/* value of parsenleft when EOF pushed back */
 #define IBUFSIZ (BUFSIZ + 1)
+#define MAXIBUFSIZ (1024 * 1024 + 1)	/* for whole script files */
 
 MKINIT
 struct strpush {
@@ -88,22 +92,25 @@ struct parsefile {
 	int lleft;		/* number of chars left in this buffer */
 	char *nextc;		/* next char in buffer */
 	char *buf;		/* input buffer */
+	int bufsize;		/* its size, one more than is read into it */
 	struct strpush *strpush; /* for pushing strings at this level */
 	struct strpush basestrpush; /* so pushing one is fast */
+	struct scache *cache;	/* commands compiled from the file */
 };
 
 
-int plinno = 1;			/* input line number */
-int parsenleft;			/* copy of parsefile->nleft */
-MKINIT int parselleft;		/* copy of parsefile->lleft */
-char *parsenextc;		/* copy of parsefile->nextc */
-MKINIT struct parsefile basepf;	/* top level input file */
-MKINIT char basebuf[IBUFSIZ];	/* buffer for top level input file */
-struct parsefile *parsefile = &basepf;	/* current input file */
-int whichprompt;		/* 1 == PS1, 2 == PS2 */
+SHTLS int plinno = 1;			/* input line number */
+SHTLS int parsenleft;			/* copy of parsefile->nleft */
+MKINIT SHTLS int parselleft;		/* copy of parsefile->lleft */
+SHTLS char *parsenextc;		/* copy of parsefile->nextc */
+SHTLS struct scache *parsecache;	/* copy of parsefile->cache */
+MKINIT SHTLS struct parsefile basepf;	/* top level input file */
+MKINIT SHTLS char *basebuf;		/* buffer for top level input file */
+SHTLS struct parsefile *parsefile;	/* current input file */
+SHTLS int whichprompt;		/* 1 == PS1, 2 == PS2 */
 
 #ifndef SMALL
-EditLine *el;			/* cookie for editline package */
+SHTLS EditLine *el;			/* cookie for editline package */
 #endif
 
 STATIC void pushfile(void);
@@ -116,7 +123,10 @@ INCLUDE "input.h"
 INCLUDE "error.h"
 
 INIT {
+	parsefile = &basepf;
+	basebuf = ckmalloc(IBUFSIZ);
 	basepf.nextc = basepf.buf = basebuf;
+	basepf.bufsize = IBUFSIZ;
 }
 
 RESET {
@@ -161,6 +171,7 @@ preadfd(void)
 	parsenextc = buf;
 
 retry:
+	shstat.inreads++;
 #ifndef SMALL
 	if (parsefile->fd == 0 && el) {
 		static const char *rl_cp;
@@ -172,8 +183,8 @@ retry:
 			nr = 0;
 		else {
 			nr = el_len;
-			if (nr > IBUFSIZ - 1)
-				nr = IBUFSIZ - 1;
+			if (nr > parsefile->bufsize - 1)
+				nr = parsefile->bufsize - 1;
 			memcpy(buf, rl_cp, nr);
 			if (nr != el_len) {
 				el_len -= nr;
@@ -189,7 +200,7 @@ retry:
 		nr = hetio_read_input(parsefile->fd);
 		if (nr == -255)
 #endif
-		nr = read(parsefile->fd, buf, IBUFSIZ - 1);
+		nr = read(parsefile->fd, buf, parsefile->bufsize - 1);
 
 
 	if (nr < 0) {
@@ -224,9 +235,6 @@ preadbuffer(void)
 {
 	char *q;
 	int more;
-#ifndef SMALL
-	int something;
-#endif
 	char savec;
 
 	while (unlikely(parsefile->strpush)) {
@@ -258,44 +266,25 @@ again:
 
 	q = parsenextc;
 
-	/* delete nul characters */
-#ifndef SMALL
-	something = 0;
-#endif
+	/* find the end of the line, deleting nul characters */
 	for (;;) {
-		int c;
-
-		more--;
-		c = *q;
-
-		if (!c)
-			memmove(q, q + 1, more);
-		else {
-			q++;
-
-			if (c == '\n') {
-				parsenleft = q - parsenextc - 1;
-				break;
-			}
-
-#ifndef SMALL
-			switch (c) {
-			default:
-				something = 1;
-				/* fall through */
-			case '\t':
-			case ' ':
-				break;
-			}
-#endif
-		}
-
-		if (more <= 0) {
-			parsenleft = q - parsenextc - 1;
-			if (parsenleft < 0)
-				goto again;
-			break;
+		char *nl, *z;
+		int len;
+
+		nl = memchr(q, '\n', more);
+		len = nl ? nl - q + 1 : more;
+		if ((z = memchr(q, '\0', len))) {
+			more -= z - q + 1;
+			memmove(z, z + 1, more);
+			q = z;
+			continue;
 		}
+		q += len;
+		more -= len;
+		parsenleft = q - parsenextc - 1;
+		if (!nl && parsenleft < 0)
+			goto again;
+		break;
 	}
 	parselleft = more;
 
@@ -303,7 +292,8 @@ again:
 	*q = '\0';
 
 #ifndef SMALL
-	if (parsefile->fd == 0 && hist && something) {
+	if (parsefile->fd == 0 && hist &&
+	    parsenextc[strspn(parsenextc, " \t\n")]) {
 		HistEvent he;
 		INTOFF;
 		history(hist, &he, whichprompt == 1? H_ENTER : H_APPEND,
@@ -414,6 +404,9 @@ setinputfile(const char *fname, int flags)
 	if (fd < 10)
 		fd = savefd(fd, fd);
 	setinputfd(fd, flags & INPUT_PUSH_FILE);
+	INTON;
+	parsecache = cacheopen(fd);
+	return fd;
 out:
 	INTON;
 	return fd;
@@ -428,13 +421,28 @@ out:
 static void
 setinputfd(int fd, int push)
 {
+	struct stat st;
+	int size;
+
 	if (push) {
 		pushfile();
 		parsefile->buf = 0;
 	}
 	parsefile->fd = fd;
-	if (parsefile->buf == NULL)
-		parsefile->buf = ckmalloc(IBUFSIZ);
+	cachefree(parsecache);
+	parsecache = NULL;
+	size = IBUFSIZ;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size >= IBUFSIZ)
+		size = st.st_size < MAXIBUFSIZ ? st.st_size + 1 : MAXIBUFSIZ;
+	if (parsefile->buf && parsefile->bufsize < size) {
+		if (parsefile->buf != basebuf)
+			ckfree(parsefile->buf);
+		parsefile->buf = NULL;
+	}
+	if (parsefile->buf == NULL) {
+		parsefile->buf = ckmalloc(size);
+		parsefile->bufsize = size;
+	}
 	parselleft = parsenleft = 0;
 	plinno = 1;
 }
@@ -472,6 +480,8 @@ pushfile(void)
 	parsefile->lleft = parselleft;
 	parsefile->nextc = parsenextc;
 	parsefile->linno = plinno;
+	parsefile->cache = parsecache;
+	parsecache = NULL;
 	pf = (struct parsefile *)ckmalloc(sizeof (struct parsefile));
 	pf->prev = parsefile;
 	pf->fd = -1;
@@ -493,12 +503,14 @@ popfile(void)
 		ckfree(pf->buf);
 	while (pf->strpush)
 		popstring();
+	cachefree(parsecache);
 	parsefile = pf->prev;
 	ckfree(pf);
 	parsenleft = parsefile->nleft;
 	parselleft = parsefile->lleft;
 	parsenextc = parsefile->nextc;
 	plinno = parsefile->linno;
+	parsecache = parsefile->cache;
 	INTON;
 }
 
@@ -530,3 +542,21 @@ closescript(void)
 		parsefile->fd = 0;
 	}
 }
+
+
+#if CFG_TOYBOX_THREADS
+/*
+ * Give back the top level input buffer, when the shell running in this
+ * thread exits.  See shellsession().
+ */
+
+void
+freeinput(void)
+{
+	closescript();
+	if (basepf.buf != basebuf)
+		ckfree(basepf.buf);
+	ckfree(basebuf);
+	basepf.buf = basebuf = NULL;
+}
+#endif
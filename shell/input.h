@@ -46,9 +46,12 @@ enum {
  * and restores it when files are pushed and popped.  The user of this
  * package must set its value.
  */
-extern int plinno;
-extern int parsenleft;		/* number of characters left in input buffer */
-extern char *parsenextc;	/* next character in input buffer */
+extern SHTLS int plinno;
+extern SHTLS int parsenleft;		/* number of characters left in input buffer */
+extern SHTLS int parselleft;		/* number of characters left after that */
+extern SHTLS char *parsenextc;	/* next character in input buffer */
+extern SHTLS struct parsefile *parsefile;	/* current input file */
+extern SHTLS struct scache *parsecache;	/* its commands, if compiled */
 
 int pgetc(void);
 int pgetc2(void);
@@ -61,6 +64,7 @@ void setinputstring(char *);
 void popfile(void);
 void popallfiles(void);
 void closescript(void);
+void freeinput(void);
 
 #define pgetc_macro() \
 	(--parsenleft >= 0 ? (signed char)*parsenextc++ : preadbuffer())
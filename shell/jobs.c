@@ -68,7 +68,7 @@
 #include "error.h"
 #include "mystring.h"
 #include "system.h"
-#include "portability.h"
+#include "toys.h"
 
 /* mode flags for set_curjob */
 #define CUR_DELETE 2
@@ -81,23 +81,32 @@
 #define DOWAIT_WAITCMD 2
 
 /* array of jobs */
-static struct job *jobtab;
+static SHTLS struct job *jobtab;
 /* size of array */
-static unsigned njobs;
+static SHTLS unsigned njobs;
 /* pid of last background process */
-pid_t backgndpid;
+SHTLS pid_t backgndpid;
 
 #if JOBS
 /* pgrp of shell on invocation */
-static int initialpgrp;
+static SHTLS int initialpgrp;
 /* control terminal */
-static int ttyfd = -1;
+static SHTLS int ttyfd = -1;
 #endif
 
 /* current job */
-static struct job *curjob;
+static SHTLS struct job *curjob;
 /* number of presumed living untracked jobs */
-static int jobless;
+static SHTLS int jobless;
+/* background threads not yet reaped */
+SHTLS int threadsrunning;
+#if CFG_TOYBOX_THREADS
+/* made up pid for the next one */
+static SHTLS pid_t nextthreadpid = THREADPID;
+#define threadsdone() (threadsrunning && toy_thread_ready())
+#else
+#define threadsdone() 0
+#endif
 
 STATIC void set_curjob(struct job *, unsigned);
 STATIC int jobno(const struct job *);
@@ -112,6 +121,11 @@ STATIC int dowait(int, struct job *);
 STATIC int onsigchild(void);
 #endif
 STATIC int waitproc(int, int *);
+#if CFG_TOYBOX_THREADS
+STATIC int reapthreads(int);
+STATIC void threadexited(pthread_t);
+STATIC int killthread(struct job *, pid_t, int);
+#endif
 STATIC char *commandtext(union node *);
 STATIC void cmdtxt(union node *);
 STATIC void cmdlist(union node *, int);
@@ -181,7 +195,7 @@ set_curjob(struct job *jp, unsigned mode)
  * Called with interrupts off.
  */
 
-int jobctl;
+SHTLS int jobctl;
 
 void
 setjobctl(int on)
@@ -322,9 +336,30 @@ usage:
 		if (**argv == '%') {
 			jp = getjob(*argv, 0);
 			pid = -jp->ps[0].pid;
+#if CFG_TOYBOX_THREADS
+			if (isthread(jp->ps)) {
+				if (killthread(jp, 0, signo)) {
+					sh_warnx("%s: job has finished", *argv);
+					i = 1;
+				}
+				continue;
+			}
+#endif
 		} else
 			pid = **argv == '-' ?
 				-number(*argv + 1) : number(*argv);
+#if CFG_TOYBOX_THREADS
+		if (pid >= THREADPID) {
+			for (jp = curjob; jp; jp = jp->prev_job)
+				if (!killthread(jp, pid, signo))
+					break;
+			if (!jp) {
+				sh_warnx("%s\n", strerror(ESRCH));
+				i = 1;
+			}
+			continue;
+		}
+#endif
 		if (kill(pid, signo) != 0) {
 			sh_warnx("%s\n", strerror(errno));
 			i = 1;
@@ -387,7 +422,8 @@ restartjob(struct job *jp, int mode)
 	pid_t pgid;
 
 	INTOFF;
-	if (jp->state == JOBDONE)
+	/* threads never stop, so there is nothing to continue */
+	if (jp->state == JOBDONE || isthread(jp->ps))
 		goto out;
 	jp->state = JOBRUNNING;
 	pgid = jp->ps->pid;
@@ -859,6 +895,7 @@ forkchild(struct job *jp, union node *n, int mode)
 	shlvl++;
 
 	closescript();
+	forgetstdsave();
 	clear_traps();
 #if JOBS
 	/* do job control only in root shell */
@@ -927,6 +964,7 @@ forkparent(struct job *jp, union node *n, int mode, pid_t pid)
 		ps->pid = pid;
 		ps->status = -1;
 		ps->cmd = nullstr;
+		ps->tt = NULL;
 		if (jobctl && n)
 			ps->cmd = commandtext(n);
 	}
@@ -938,6 +976,7 @@ forkshell(struct job *jp, union node *n, int mode)
 	int pid;
 
 	TRACE(("forkshell(%%%d, %p, %d) called\n", jobno(jp), n, mode));
+	flushall();
 	pid = xfork();
 	if (pid < 0) {
 		TRACE(("Fork failed, errno=%d", errno));
@@ -947,11 +986,196 @@ forkshell(struct job *jp, union node *n, int mode)
 	}
 	if (pid == 0)
 		forkchild(jp, n, mode);
-	else
+	else {
+		toy_trace(forkshell, NULL, pid);
 		forkparent(jp, n, mode, pid);
+	}
 	return pid;
 }
 
+/*
+ * Record the exit status of a pipeline stage that ran as a thread of
+ * this shell rather than a child process.  There is no process to wait
+ * for, so the job is done once the last stage has been recorded and
+ * waitforjob() returns straight away.  Status is in wait() format.
+ * Called with interrupts off.
+ */
+
+void
+threadjob(struct job *jp, union node *n, int status)
+{
+	struct procstat *ps = &jp->ps[jp->nprocs++];
+	int i;
+
+	ps->pid = 0;
+	ps->status = status;
+	ps->cmd = nullstr;
+	ps->tt = NULL;
+	if (jobctl && n)
+		ps->cmd = commandtext(n);
+	jp->state = JOBDONE;
+	for (i = 0 ; i < jp->nprocs ; i++)
+		if (jp->ps[i].status == -1)
+			jp->state = JOBRUNNING;
+}
+
+
+#if CFG_TOYBOX_THREADS
+/*
+ * Add a pipeline stage running in the background as thread tt, with
+ * arguments argv to be freed once it is reaped.  There is no process
+ * to stop or give the terminal to, so fg and bg only wait or say it is
+ * running, but it gets a pid for $! and kill.  Called with interrupts off.
+ */
+
+void
+bgthreadjob(struct job *jp, union node *n, struct toy_thread *tt, char **argv)
+{
+	struct procstat *ps = &jp->ps[jp->nprocs++];
+
+	ps->pid = nextthreadpid;
+	if (++nextthreadpid <= 0)
+		nextthreadpid = THREADPID;
+	ps->status = -1;
+	ps->cmd = nullstr;
+	if (jobctl && n)
+		ps->cmd = commandtext(n);
+	ps->tt = tt;
+	ps->argv = argv;
+	backgndpid = ps->pid;
+	set_curjob(jp, CUR_RUNNING);
+	threadsrunning++;
+	toy_thread_exited = threadexited;
+	toy_thread_queue(tt);
+}
+
+
+/*
+ * Collect every background thread that has finished, waiting for one
+ * first if block is set, and return how many there were.  However many
+ * are done they cost one wakeup.  Called with interrupts off.
+ */
+
+STATIC int
+reapthreads(int block)
+{
+	struct toy_thread *tt, *next;
+	struct procstat *sp, *spend;
+	struct job *jp;
+	int status;
+	int n;
+
+	n = 0;
+	for (tt = toy_thread_reap(block) ; tt ; tt = next) {
+		next = toy_thread_next(tt);
+		status = (toy_thread_join(tt) & 0xff) << 8;
+		threadsrunning--;
+		n++;
+		for (jp = curjob; jp; jp = jp->prev_job) {
+			spend = jp->ps + jp->nprocs;
+			for (sp = jp->ps ; sp < spend ; sp++)
+				if (sp->tt == tt)
+					goto found;
+		}
+		continue;
+found:
+		TRACE(("Job %d: thread done, status 0x%x\n", jobno(jp), status));
+		sp->status = status;
+		sp->tt = NULL;
+		ckfree(sp->argv);
+		for (sp = jp->ps ; sp < spend ; sp++)
+			if (sp->status == -1)
+				break;
+		if (sp == spend) {
+			jp->state = JOBDONE;
+			jp->changed = 1;
+		}
+	}
+	return n;
+}
+
+
+/*
+ * Runs in the thread that finished, so all it can do is make sure the
+ * shell notices: a SIGCHLD wakes waitproc as a child exiting would.  It
+ * goes to the thread running the shell that started it, not to whichever
+ * thread of the process the kernel picks.
+ */
+
+STATIC void
+threadexited(pthread_t owner)
+{
+	pthread_kill(owner, SIGCHLD);
+}
+
+
+/*
+ * Send signo to the stages of job jp still running as threads, or just
+ * to the one with pid pid if that is nonzero.  A thread can't take a
+ * signal, so this asks it to exit as though killed by signo when it next
+ * reads or writes; signal 0 only asks whether it is there.  Returns 0 if
+ * any were found, else -1.
+ */
+
+STATIC int
+killthread(struct job *jp, pid_t pid, int signo)
+{
+	struct procstat *ps, *psend;
+	int rc;
+
+	rc = -1;
+	psend = jp->ps + jp->nprocs;
+	for (ps = jp->ps ; ps < psend ; ps++) {
+		if (!ps->tt || (pid && ps->pid != pid))
+			continue;
+		if (signo)
+			toy_thread_cancel(ps->tt, signo);
+		rc = 0;
+	}
+	return rc;
+}
+
+
+/*
+ * A shell that is only one of the threads of the process takes its
+ * background threads with it when it exits, as exiting the process
+ * would: ask each to stop as though hung up, and wait until they have.
+ */
+
+void
+endthreads(void)
+{
+	struct job *jp;
+
+	INTOFF;
+	for (jp = curjob; jp; jp = jp->prev_job)
+		killthread(jp, 0, SIGHUP);
+	while (threadsrunning)
+		reapthreads(1);
+	INTON;
+}
+#endif
+
+
+/*
+ * Called when TOYWORKERS is set: how many idle threads to keep around
+ * for running commands, so the next one doesn't have to start its own.
+ */
+
+void
+settoyworkers(const char *val)
+{
+#if CFG_TOYBOX_THREADS
+	int n;
+
+	if (val == NULL || *val == '\0' || (n = atoi(val)) < 0)
+		n = 4;
+	toy_thread_keep = n;
+#else
+	(void)val;
+#endif
+}
+
 /*
  * Wait for job to finish.
  *
@@ -1020,8 +1244,31 @@ dowait(int block, struct job *job)
 
 	INTOFF;
 	TRACE(("dowait(%d) called\n", block));
+#if CFG_TOYBOX_THREADS
+	if (threadsrunning) {
+		struct procstat *sp;
+		int wait = 0;
+
+		/* a job of threads alone can be waited for on its own */
+		if (block == DOWAIT_BLOCK && job) {
+			wait = 1;
+			for (sp = job->ps ; sp < job->ps + job->nprocs ; sp++)
+				if (sp->status == -1 && !isthread(sp))
+					wait = 0;
+		}
+		if ((pid = reapthreads(wait)) > 0)
+			goto out;
+	}
+#endif
 	pid = waitproc(block, &status);
 	TRACE(("wait returns pid %d, status=%d\n", pid, status));
+#if CFG_TOYBOX_THREADS
+	/* or it was a thread that woke us */
+	if (pid <= 0 && threadsrunning && (state = reapthreads(0)) > 0) {
+		pid = state;
+		goto out;
+	}
+#endif
 	if (pid <= 0)
 		goto out;
 
@@ -1144,6 +1391,11 @@ waitproc(int block, int *status)
 	do {
 		gotsigchld = 0;
 		err = waitpid(-1, status, flags);
+#if CFG_TOYBOX_THREADS
+		/* with no children, wait for a thread to say it's done */
+		if (err < 0 && errno == ECHILD && threadsrunning && block)
+			err = 0;
+#endif
 		if (err || !block)
 			break;
 
@@ -1152,7 +1404,7 @@ waitproc(int block, int *status)
 		sigfillset(&mask);
 		sigprocmask(SIG_SETMASK, &mask, &oldmask);
 
-		while (!gotsigchld && !pendingsigs)
+		while (!gotsigchld && !pendingsigs && !threadsdone())
 			sigsuspend(&oldmask);
 
 		sigclearmask();
@@ -1164,7 +1416,7 @@ waitproc(int block, int *status)
 /*
  * return 1 if there are stopped jobs, otherwise 0
  */
-int job_warning;
+SHTLS int job_warning;
 int
 stoppedjobs(void)
 {
@@ -1190,7 +1442,7 @@ out:
  * jobs command).
  */
 
-STATIC char *cmdnextc;
+STATIC SHTLS char *cmdnextc;
 
 STATIC char *
 commandtext(union node *n)
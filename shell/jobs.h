@@ -55,10 +55,22 @@
  * array of pids.
  */
 
+struct toy_thread;
+
+/*
+ * Background threads get made up process ids from THREADPID up, well
+ * clear of any the kernel hands out, so that $!, wait and kill can name
+ * them.  Threads run in the foreground have pid 0.
+ */
+#define THREADPID	0x40000000
+#define isthread(ps)	((ps)->pid == 0 || (ps)->pid >= THREADPID)
+
 struct procstat {
-	pid_t	pid;		/* process id */
+	pid_t	pid;		/* process id, 0 or THREADPID up for a thread */
  	int	status;		/* last process status from wait() */
  	char	*cmd;		/* text of command being run */
+	struct toy_thread *tt;	/* background thread not yet reaped */
+	char	**argv;		/* its arguments, from ckmalloc */
 };
 
 struct job {
@@ -83,10 +95,11 @@ struct job {
 	struct job *prev_job;	/* previous job */
 };
 
-extern pid_t backgndpid;	/* pid of last background process */
-extern int job_warning;		/* user was warned about stopped jobs */
+extern SHTLS pid_t backgndpid;	/* pid of last background process */
+extern SHTLS int job_warning;		/* user was warned about stopped jobs */
+extern SHTLS int threadsrunning;	/* background toy threads not yet reaped */
 #if JOBS
-extern int jobctl;		/* true if doing job control */
+extern SHTLS int jobctl;		/* true if doing job control */
 #else
 #define jobctl 0
 #endif
@@ -102,6 +115,10 @@ int waitcmd(int, char **);
 struct job *makejob(union node *, int);
 int forkshell(struct job *, union node *, int);
 int waitforjob(struct job *);
+void threadjob(struct job *, union node *, int);
+void bgthreadjob(struct job *, union node *, struct toy_thread *, char **);
+void endthreads(void);
+void settoyworkers(const char *);
 int stoppedjobs(void);
 
 #if ! JOBS
@@ -37,6 +37,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <setjmp.h>
+#ifdef __rtems__
+#include <rtems/libio.h>
+#endif
 
 
 #include "shell.h"
@@ -59,6 +63,11 @@
 #include "mystring.h"
 #include "exec.h"
 #include "cd.h"
+#include "profile.h"
+#include "image.h"
+#ifndef SMALL
+#include "myhistedit.h"
+#endif
 
 #ifdef HETIO
 #include "hetio.h"
@@ -66,10 +75,14 @@
 
 #define PROFILE 0
 
-int rootpid;
-int shlvl;
+SHTLS int rootpid;
+SHTLS int shlvl;
 #ifdef __GLIBC__
-int *dash_errno;
+SHTLS int *dash_errno;
+#endif
+#if CFG_TOYBOX_THREADS
+SHTLS jmp_buf *sessionexit;
+SHTLS int sessionstatus;
 #endif
 #if PROFILE
 short profile_buf[16384];
@@ -111,6 +124,8 @@ main(int argc, char **argv)
 		int s;
 
 		reset();
+		/* commands the exception cut short */
+		profend(0);
 
 		e = exception;
 
@@ -148,6 +163,8 @@ main(int argc, char **argv)
 	init();
 	setstackmark(&smark);
 	login = procargs(argc, argv);
+	if ((shinit = lookupvar("SHIMAGE")) != NULL && *shinit != '\0')
+		imageload(shinit);
 	if (login) {
 		state = 1;
 		read_profile("/etc/profile");
@@ -191,6 +208,40 @@ state4:	/* XXX ??? - why isn't this before the "if" statement */
 }
 
 
+#if CFG_TOYBOX_THREADS
+/*
+ * Run a shell in this thread with arguments argv, as main would in a
+ * process of its own, and return its exit status once it exits.  Every
+ * thread has its own copy of what the interpreter changes (see SHTLS in
+ * shell.h), so any number can run at once.  None of it is put back as it
+ * was afterwards, so a thread that has already run a shell gets -1.  The
+ * environment and the signal dispositions are still the process's, as is
+ * the current directory except on RTEMS, which gives each its own.
+ */
+
+int
+shellsession(int argc, char **argv)
+{
+	jmp_buf loc;
+
+	if (rootpid)
+		return -1;
+	if (setjmp(loc)) {
+		handler = NULL;
+		sessionexit = NULL;
+		freeinput();
+		freestack();
+		return sessionstatus;
+	}
+	sessionexit = &loc;
+#ifdef __rtems__
+	rtems_libio_set_private_env();
+#endif
+	return main(argc, argv);
+}
+#endif
+
+
 /*
  * Read and execute commands.  "Top" is nonzero for the top level command
  * loop; it turns on prompting if the shell is interactive.
@@ -220,8 +271,15 @@ cmdloop(int top)
 		if (iflag && top) {
 			inter++;
 			chkmail();
+#ifndef SMALL
+			histload();
+#endif
 		}
 		n = parsecmd(inter);
+#ifndef SMALL
+		if (inter)
+			histsave();
+#endif
 		/* showtree(n); DEBUG */
 		if (n == NEOF) {
 			if (!top || numeof >= 50)
@@ -237,6 +295,9 @@ cmdloop(int top)
 			numeof = 0;
 			evaltree(n, 0);
 			status = exitstatus;
+#ifdef STACKSTATS
+			stackstats();
+#endif
 		}
 		popstackmark(&smark);
 
@@ -35,16 +35,23 @@
  */
 
 #include <errno.h>
+#include <setjmp.h>
 
 /* pid of main shell */
-extern int rootpid;
+extern SHTLS int rootpid;
 /* shell level: 0 for the main shell, 1 for its children, and so on */
-extern int shlvl;
+extern SHTLS int shlvl;
 #define rootshell (!shlvl)
 
+#if CFG_TOYBOX_THREADS
+/* where exitshell() goes back to, for a shell in a thread of its own */
+extern SHTLS jmp_buf *sessionexit;
+extern SHTLS int sessionstatus;
+#endif
+
 #ifdef __GLIBC__
 /* glibc sucks */
-extern int *dash_errno;
+extern SHTLS int *dash_errno;
 #undef errno
 #define errno (*dash_errno)
 #endif
@@ -52,3 +59,6 @@ extern int *dash_errno;
 void readcmdfile(char *);
 int dotcmd(int, char **);
 int exitcmd(int, char **);
+#if CFG_TOYBOX_THREADS
+int shellsession(int, char **);
+#endif
@@ -41,7 +41,9 @@
 #include "error.h"
 #include "machdep.h"
 #include "mystring.h"
+#include "stats.h"
 #include "system.h"
+#include "toylib/trace.h"
 
 /*
  * Like malloc, but returns an error when out of space.
@@ -94,21 +96,68 @@ savestr(const char *s)
  *
  * The size 504 was chosen because the Ultrix malloc handles that size
  * well.
+ *
+ * A command that runs off the end of one block is likely to run off the
+ * end of the next, so each new block is twice the size of the last, up
+ * to MAXNEWSIZE, until the stack is back down to the base block.  Blocks
+ * released by popstackmark are kept on a free list, up to MAXFREE bytes
+ * of them, since the next command will most likely want them again.
  */
 
 /* minimum size of a block */
 #define MINSIZE SHELL_ALIGN(504)
+/* largest size a new block is rounded up to */
+#define MAXNEWSIZE SHELL_ALIGN(16384)
+/* most space kept on the free list */
+#define MAXFREE 65536
 
+MKINIT
 struct stack_block {
 	struct stack_block *prev;
+	size_t size;
 	char space[MINSIZE];
 };
 
-struct stack_block stackbase;
-struct stack_block *stackp = &stackbase;
-char *stacknxt = stackbase.space;
-size_t stacknleft = MINSIZE;
-char *sstrend = stackbase.space + MINSIZE;
+MKINIT SHTLS struct stack_block stackbase = { NULL, MINSIZE };
+MKINIT SHTLS struct stack_block *stackp;	/* set by init() */
+SHTLS char *stacknxt;
+SHTLS size_t stacknleft;
+SHTLS char *sstrend;
+
+STATIC SHTLS struct stack_block *stackfree;	/* released blocks */
+STATIC SHTLS size_t stackfreesize;		/* total size of them */
+STATIC SHTLS size_t stacknewsize = MINSIZE;	/* size of the next new block */
+
+#ifdef STACKSTATS
+STATIC SHTLS size_t stackbytes = MINSIZE;	/* size of the live blocks */
+STATIC SHTLS size_t stackpeak = MINSIZE;	/* most there have been */
+STATIC SHTLS unsigned stacknblocks;		/* blocks malloced */
+STATIC SHTLS unsigned stacknreused;		/* blocks taken from the free list */
+STATIC SHTLS unsigned stackngrows;		/* calls to growstackblock */
+
+#define STACKSTAT(x) (x)
+#define STACKCOUNT(n) \
+	((stackbytes += (n)) > stackpeak ? stackpeak = stackbytes : 0)
+#else
+#define STACKSTAT(x)
+#define STACKCOUNT(n)
+#endif
+
+STATIC struct stack_block *newstackblock(size_t);
+STATIC void freestackblock(struct stack_block *);
+
+#ifdef mkinit
+INCLUDE "machdep.h"
+INCLUDE "memalloc.h"
+
+INIT {
+	stackp = &stackbase;
+	stacknxt = stackbase.space;
+	stacknleft = MINSIZE;
+	sstrend = stackbase.space + MINSIZE;
+}
+#endif
+
 
 pointer
 stalloc(size_t nbytes)
@@ -117,23 +166,17 @@ stalloc(size_t nbytes)
 	size_t aligned;
 
 	aligned = SHELL_ALIGN(nbytes);
+	shstat.stallocs++;
+	shstat.stbytes += aligned;
 	if (aligned > stacknleft) {
-		size_t len;
-		size_t blocksize;
 		struct stack_block *sp;
 
-		blocksize = aligned;
-		if (blocksize < MINSIZE)
-			blocksize = MINSIZE;
-		len = sizeof(struct stack_block) - MINSIZE + blocksize;
-		if (len < blocksize)
-			sh_error("Out of space");
 		INTOFF;
-		sp = ckmalloc(len);
+		sp = newstackblock(aligned);
 		sp->prev = stackp;
 		stacknxt = sp->space;
-		stacknleft = blocksize;
-		sstrend = stacknxt + blocksize;
+		stacknleft = sp->size;
+		sstrend = stacknxt + sp->size;
 		stackp = sp;
 		INTON;
 	}
@@ -144,6 +187,63 @@ stalloc(size_t nbytes)
 }
 
 
+/*
+ * Get a block with room for at least nbytes, from the free list if there
+ * is one big enough.  Call with interrupts off.
+ */
+
+STATIC struct stack_block *
+newstackblock(size_t nbytes)
+{
+	struct stack_block *sp, **spp;
+	size_t blocksize;
+	size_t len;
+
+	for (spp = &stackfree; (sp = *spp) != NULL; spp = &sp->prev) {
+		if (sp->size >= nbytes) {
+			*spp = sp->prev;
+			stackfreesize -= sp->size;
+			STACKSTAT(stacknreused++);
+			STACKCOUNT(sp->size);
+			return sp;
+		}
+	}
+	blocksize = nbytes;
+	if (blocksize < stacknewsize)
+		blocksize = stacknewsize;
+	len = sizeof(struct stack_block) - MINSIZE + blocksize;
+	if (len < blocksize)
+		sh_error("Out of space");
+	sp = ckmalloc(len);
+	sp->size = blocksize;
+	if (stacknewsize < MAXNEWSIZE)
+		stacknewsize *= 2;
+	shstat.stblocks++;
+	STACKSTAT(stacknblocks++);
+	STACKCOUNT(blocksize);
+	return sp;
+}
+
+
+/*
+ * Put a block that is no longer in use on the free list, or back to
+ * malloc if the list is full.  Call with interrupts off.
+ */
+
+STATIC void
+freestackblock(struct stack_block *sp)
+{
+	STACKCOUNT(-sp->size);
+	if (stackfreesize + sp->size > MAXFREE) {
+		ckfree(sp);
+		return;
+	}
+	sp->prev = stackfree;
+	stackfree = sp;
+	stackfreesize += sp->size;
+}
+
+
 void
 stunalloc(pointer p)
 {
@@ -182,8 +282,10 @@ popstackmark(struct stackmark *mark)
 	while (stackp != mark->stackp) {
 		sp = stackp;
 		stackp = sp->prev;
-		ckfree(sp);
+		freestackblock(sp);
 	}
+	if (stackp == &stackbase)
+		stacknewsize = MINSIZE;
 	stacknxt = mark->stacknxt;
 	stacknleft = mark->stacknleft;
 	sstrend = mark->stacknxt + mark->stacknleft;
@@ -191,6 +293,52 @@ popstackmark(struct stackmark *mark)
 }
 
 
+#if CFG_TOYBOX_THREADS
+/*
+ * Give every stack block back to malloc, when the shell running in this
+ * thread exits.  See shellsession().
+ */
+
+void
+freestack(void)
+{
+	struct stack_block *sp;
+
+	while ((sp = stackp) != &stackbase) {
+		stackp = sp->prev;
+		ckfree(sp);
+	}
+	while ((sp = stackfree) != NULL) {
+		stackfree = sp->prev;
+		ckfree(sp);
+	}
+	stackfreesize = 0;
+	stacknxt = stackbase.space;
+	stacknleft = MINSIZE;
+	sstrend = stackbase.space + MINSIZE;
+}
+#endif
+
+
+#ifdef STACKSTATS
+/*
+ * Report how much stack the last command used, and start counting
+ * again for the next one.  Called from cmdloop.
+ */
+
+void
+stackstats(void)
+{
+	outfmt(out2,
+	    "stack: peak %lu bytes, %u new blocks, %u reused, %u grows\n",
+	    (unsigned long) stackpeak, stacknblocks, stacknreused,
+	    stackngrows);
+	stackpeak = stackbytes;
+	stacknblocks = stacknreused = stackngrows = 0;
+}
+#endif
+
+
 /*
  * When the parser reads in a string, it wants to stick the string on the
  * stack and only adjust the stack pointer when it knows how big the
@@ -211,6 +359,9 @@ growstackblock(void)
 		sh_error("Out of space");
 	if (newlen < 128)
 		newlen += 128;
+	shstat.stgrows++;
+	STACKSTAT(stackngrows++);
+	toy_trace(stack_grow, NULL, newlen);
 
 	if (stacknxt == stackp->space && stackp != &stackbase) {
 		struct stack_block *sp;
@@ -221,8 +372,10 @@ growstackblock(void)
 		sp = stackp;
 		prevstackp = sp->prev;
 		grosslen = newlen + sizeof(struct stack_block) - MINSIZE;
+		STACKCOUNT(newlen - sp->size);
 		sp = ckrealloc((pointer)sp, grosslen);
 		sp->prev = prevstackp;
+		sp->size = newlen;
 		stackp = sp;
 		stacknxt = sp->space;
 		stacknleft = newlen;
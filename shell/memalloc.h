@@ -43,9 +43,9 @@ struct stackmark {
 };
 
 
-extern char *stacknxt;
-extern size_t stacknleft;
-extern char *sstrend;
+extern SHTLS char *stacknxt;
+extern SHTLS size_t stacknleft;
+extern SHTLS char *sstrend;
 
 pointer ckmalloc(size_t);
 pointer ckrealloc(pointer, size_t);
@@ -60,6 +60,10 @@ void *growstackstr(void);
 char *makestrspace(size_t, char *);
 char *stnputs(const char *, size_t, char *);
 char *stputs(const char *, char *);
+void freestack(void);
+#ifdef STACKSTATS
+void stackstats(void);
+#endif
 
 
 static inline void grabstackblock(size_t len)
@@ -45,6 +45,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include "shell.h"
 #include "options.h"
@@ -52,6 +53,7 @@
 #include "output.h"
 #include "memalloc.h"
 #include "error.h"
+#include "eval.h"
 #include "miscbltin.h"
 #include "mystring.h"
 #include "main.h"
@@ -61,6 +63,8 @@
 
 #undef rflag
 
+#define READBUFSIZ 512		/* read ahead this much from a file */
+
 
 /** handle one line of the read command.
  *  more fields than variables -> remainder shall be part of last variable.
@@ -129,9 +133,13 @@ readcmd_handle_line(char *s, char **ap)
 /*
  * The read builtin.  The -e option causes backslashes to escape the
  * following character. The -p option followed by an argument prompts
- * with the argument.
+ * with the argument.  The -d option ends the line at its argument's
+ * first character instead of a newline, and -n stops after that many
+ * characters.
  *
- * This uses unbuffered input, which may be avoidable in some cases.
+ * We mustn't take input past the end of the line away from whoever
+ * reads next, so a pipe or terminal is read a byte at a time.  A plain
+ * file is read in chunks, seeking back over what wasn't used.
  */
 
 int
@@ -148,14 +156,33 @@ readcmd(int argc, char **argv)
 	int newloc;
 	int status;
 	int i;
+	char delim;
+	int nchars;
+	struct stat st;
+	char buf[READBUFSIZ];
+	char *bp, *bend;
+	size_t bufsize;
+	ssize_t n;
 
 	rflag = 0;
 	prompt = NULL;
-	while ((i = nextopt("p:r")) != '\0') {
-		if (i == 'p')
+	delim = '\n';
+	nchars = -1;
+	while ((i = nextopt("p:rd:n:")) != '\0') {
+		switch (i) {
+		case 'p':
 			prompt = optionarg;
-		else
+			break;
+		case 'd':
+			delim = *optionarg;
+			break;
+		case 'n':
+			nchars = number(optionarg);
+			break;
+		default:
 			rflag = 1;
+			break;
+		}
 	}
 	if (prompt && isatty(0)) {
 		out2str(prompt);
@@ -166,24 +193,31 @@ readcmd(int argc, char **argv)
 	if (*(ap = argptr) == NULL)
 		sh_error("arg count");
 
+	bufsize = 1;
+	if (!fstat(0, &st) && S_ISREG(st.st_mode))
+		bufsize = sizeof(buf);
+	bp = bend = buf;
+
 	status = 0;
 	STARTSTACKSTR(p);
 
 	goto start;
 
 	for (;;) {
-		switch (read(0, &c, 1)) {
-		case 1:
+		if (nchars >= 0 && !nchars--)
 			break;
-		default:
-			if (errno == EINTR && !pendingsigs)
-				continue;
-				/* fall through */
-		case 0:
-			status = 1;
-			goto out;
+		while (bp == bend) {
+			n = read(0, buf, bufsize);
+			if (n > 0) {
+				bp = buf;
+				bend = buf + n;
+			} else if (n == 0 || errno != EINTR || pendingsigs) {
+				status = 1;
+				goto out;
+			}
 		}
-		if (c == '\0')
+		c = *bp++;
+		if (c == '\0' && delim != '\0')
 			continue;
 		if (newloc >= startloc) {
 			if (c == '\n')
@@ -194,7 +228,7 @@ readcmd(int argc, char **argv)
 			newloc = p - (char *)stackblock();
 			continue;
 		}
-		if (c == '\n')
+		if (c == delim)
 			break;
 put:
 		CHECKSTRSPACE(2, p);
@@ -211,6 +245,8 @@ start:
 		}
 	}
 out:
+	if (bp != bend)
+		lseek(0, bp - bend, SEEK_CUR);
 	recordregion(startloc, p - (char *)stackblock(), 0);
 	STACKSTRNUL(p);
 	readcmd_handle_line(p + 1, ap);
@@ -219,6 +255,169 @@ out:
 
 
 
+/*
+ * Read everything left on fd into a block from ckmalloc and return it,
+ * with its length in *lenp.  A plain file is read in one go into a
+ * block sized from fstat, anything else in growing chunks.  An error
+ * ends the data as end of file would, and so does an interrupt once
+ * there is a signal waiting to be handled.
+ */
+
+char *
+readfdall(int fd, int *lenp)
+{
+	struct stat st;
+	off_t off;
+	size_t size, len;
+	ssize_t n;
+	char *buf;
+
+	size = READBUFSIZ;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) &&
+	    (off = lseek(fd, 0, SEEK_CUR)) >= 0 && st.st_size > off &&
+	    st.st_size - off < INT_MAX)
+		/* one more, to see end of file without growing */
+		size = st.st_size - off + 1;
+	buf = ckmalloc(size);
+	len = 0;
+	for (;;) {
+		if (len == size) {
+			if (size > INT_MAX / 2)
+				break;
+			buf = ckrealloc(buf, size *= 2);
+		}
+		n = read(fd, buf + len, size - len);
+		if (n > 0)
+			len += n;
+		else if (n == 0 || errno != EINTR || pendingsigs || intpending)
+			break;
+	}
+	*lenp = len;
+	return buf;
+}
+
+
+/*
+ * The mapfile builtin reads lines into the positional parameters, or
+ * with a name into name1, name2 and on, setting name to how many there
+ * are.  Unlike a read loop it takes the whole input in one read where
+ * it can.  With -n it must not take more than the lines it uses, which
+ * means a byte at a time unless the input is a plain file it can seek
+ * back in.
+ */
+
+int
+mapfilecmd(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+	struct stat st;
+	char buf[READBUFSIZ];
+	char **lines, **ap;
+	char *data, *p, *end, *nl, *name;
+	const char *old;
+	int count, skip, fd;
+	int len, nlines, i, n;
+	size_t bufsize;
+	ssize_t rd;
+
+	count = -1;
+	skip = 0;
+	fd = 0;
+	while ((i = nextopt("n:s:u:")) != '\0') {
+		switch (i) {
+		case 'n':
+			count = number(optionarg);
+			break;
+		case 's':
+			skip = number(optionarg);
+			break;
+		default:
+			fd = number(optionarg);
+			if (fstat(fd, &st) < 0)
+				sh_error("%d: bad file descriptor", fd);
+			break;
+		}
+	}
+	name = *argptr;
+	if (name && (argptr[1] || !goodname(name)))
+		sh_error(argptr[1] ? "arg count" : "%s: bad variable name",
+			 name);
+
+	if (count < 0) {
+		/* onto the stack, so a readonly name can't leak it */
+		p = readfdall(fd, &len);
+		data = stalloc(len + 1);
+		memcpy(data, p, len);
+		ckfree(p);
+	} else {
+		bufsize = 1;
+		if (!fstat(fd, &st) && S_ISREG(st.st_mode))
+			bufsize = sizeof(buf);
+		/* gather lines on the stack until there are enough */
+		STARTSTACKSTR(p);
+		n = skip + count;
+		rd = 0;
+		i = 0;
+		while (n && (rd = read(fd, buf, bufsize)) != 0) {
+			if (rd < 0) {
+				if (errno != EINTR || pendingsigs)
+					break;
+				continue;
+			}
+			for (i = 0; i < rd; i++)
+				if (buf[i] == '\n' && !--n) {
+					i++;
+					break;
+				}
+			p = stnputs(buf, i, p);
+		}
+		if (rd > i)
+			lseek(fd, i - rd, SEEK_CUR);
+		len = p - (char *)stackblock();
+		data = grabstackstr(p);
+	}
+
+	nlines = 0;
+	for (p = data, end = data + len; p < end; p++)
+		if (*p == '\n')
+			nlines++;
+	if (len && end[-1] != '\n')
+		nlines++;
+	ap = lines = stalloc((nlines + 1) * sizeof(*lines));
+	for (p = data; p < end; p = nl + 1) {
+		if (!(nl = memchr(p, '\n', end - p)))
+			nl = end;
+		*nl = '\0';
+		if (skip)
+			skip--;
+		else if (count < 0 || count-- > 0)
+			*ap++ = p;
+	}
+	*ap = NULL;
+	nlines = ap - lines;
+
+	if (!name)
+		setparam(lines);
+	else {
+		/* drop what an earlier mapfile into name left past the end */
+		n = (old = lookupvar(name)) && is_number(old) ? number(old) : 0;
+		setvarint(name, nlines, 0);
+		len = strlen(name) + 12;
+		p = stalloc(len);
+		for (i = 0; i < nlines || i < n; i++) {
+			fmtstr(p, len, "%s%d", name, i + 1);
+			if (i < nlines)
+				setvar(p, lines[i], 0);
+			else
+				unsetvar(p);
+		}
+	}
+	return 0;
+}
+
+
+
 /*
  * umask builtin
  *
@@ -228,6 +427,18 @@ out:
  * Public domain.
  */
 
+/*
+ * The umask a subshell run in this process started with, saved the
+ * first time it sets one.
+ */
+struct umasksave {
+	struct umasksave *next;
+	int nest;			/* the subshell */
+	mode_t mask;
+};
+
+STATIC SHTLS struct umasksave *umasksaved;
+
 int
 umaskcmd(int argc, char **argv)
 {
@@ -339,11 +550,40 @@ umaskcmd(int argc, char **argv)
 			}
 			new_mask = ~new_mask;
 		}
+		INTOFF;
+		if (subshell && (!umasksaved || umasksaved->nest != subshell)) {
+			struct umasksave *up;
+
+			up = ckmalloc(sizeof(*up));
+			up->next = umasksaved;
+			up->nest = subshell;
+			up->mask = mask;
+			umasksaved = up;
+		}
 		umask(new_mask);
+		INTON;
 	}
 	return 0;
 }
 
+
+/*
+ * Put back the umask the innermost subshell started with.
+ */
+
+void
+popsubumask(void)
+{
+	struct umasksave *up;
+
+	up = umasksaved;
+	if (!up || up->nest != subshell)
+		return;
+	umasksaved = up->next;
+	umask(up->mask);
+	ckfree(up);
+}
+
 #ifdef HAVE_GETRLIMIT
 /*
  * ulimit builtin
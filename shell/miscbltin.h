@@ -27,5 +27,8 @@
  */
 
 int readcmd(int, char **);
+char *readfdall(int, int *);
+int mapfilecmd(int, char **);
 int umaskcmd(int, char **);
+void popsubumask(void);
 int ulimitcmd(int, char **);
@@ -52,7 +52,7 @@
 #define T_STRING 3
 #define T_INT 4			/* int field */
 #define T_OTHER 5		/* other */
-#define T_TEMP 6		/* don't copy this field */
+#define T_TEMP 6		/* don't copy this field, clear it */
 
 
 struct field {			/* a structure field */
@@ -86,6 +86,9 @@ static void parsefield(void);
 static void output(char *);
 static void outsizes(FILE *);
 static void outfunc(FILE *, int);
+static void outreloc(FILE *);
+static void outhash(FILE *);
+static void outequal(FILE *);
 static void indent(int, FILE *);
 static int nextfield(char *);
 static void skipbl(void);
@@ -244,11 +247,19 @@ output(char *file)
 	fputs("\tunion node *n;\n", hfile);
 	fputs("};\n\n\n", hfile);
 	fputs("struct funcnode {\n", hfile);
+	fputs("\tstruct funcnode *next;\n", hfile);
+	fputs("\tunsigned int hashval;\n", hfile);
 	fputs("\tint count;\n", hfile);
 	fputs("\tunion node n;\n", hfile);
 	fputs("};\n\n\n", hfile);
 	fputs("struct funcnode *copyfunc(union node *);\n", hfile);
+	fputs("struct funcnode *sharefunc(union node *);\n", hfile);
+	fputs("void enterfunc(struct funcnode *);\n", hfile);
 	fputs("void freefunc(struct funcnode *);\n", hfile);
+	fputs("union node **copytrees(union node **, int, size_t *);\n", hfile);
+	fputs("int reloctrees(union node **, int, size_t, void *);\n", hfile);
+	fputs("union node **copyfuncs(union node **, int, size_t *);\n", hfile);
+	fputs("int relocfuncs(union node **, int, size_t, void *);\n", hfile);
 
 	fputs(writer, cfile);
 	while (fgets(line, sizeof line, patfile) != NULL) {
@@ -259,6 +270,12 @@ output(char *file)
 			outfunc(cfile, 1);
 		else if (strcmp(p, "%COPY\n") == 0)
 			outfunc(cfile, 0);
+		else if (strcmp(p, "%RELOC\n") == 0)
+			outreloc(cfile);
+		else if (strcmp(p, "%HASH\n") == 0)
+			outhash(cfile);
+		else if (strcmp(p, "%EQUAL\n") == 0)
+			outequal(cfile);
 		else
 			fputs(line, cfile);
 	}
@@ -348,6 +365,13 @@ outfunc(FILE *cfile, int calcsize)
 						sp->tag, fp->name, sp->tag, fp->name);
 				}
 				break;
+			case T_TEMP:
+				if (! calcsize) {
+					indent(12, cfile);
+					fprintf(cfile, "new->%s.%s = 0;\n",
+						sp->tag, fp->name);
+				}
+				break;
 			}
 		}
 		indent(12, cfile);
@@ -359,6 +383,178 @@ outfunc(FILE *cfile, int calcsize)
 }
 
 
+/*
+ * Walk a tree made by copynode that has been moved in memory, fixing
+ * up each pointer in place.
+ */
+
+static void
+outreloc(FILE *cfile)
+{
+	struct str *sp;
+	struct field *fp;
+	int i;
+
+	fputs("      if (n == NULL || (n = relocnodeptr(n)) == NULL)\n", cfile);
+	fputs("	    return NULL;\n", cfile);
+	fputs("      switch (n->type) {\n", cfile);
+	for (sp = str ; sp < &str[nstr] ; sp++) {
+		for (i = 0 ; i < ntypes ; i++) {
+			if (nodestr[i] == sp)
+				fprintf(cfile, "      case %s:\n", nodename[i]);
+		}
+		for (i = sp->nfields ; --i >= 1 ; ) {
+			fp = &sp->field[i];
+			switch (fp->type) {
+			case T_NODE:
+				indent(12, cfile);
+				fprintf(cfile, "n->%s.%s = relocnode(n->%s.%s);\n",
+					sp->tag, fp->name, sp->tag, fp->name);
+				break;
+			case T_NODELIST:
+				indent(12, cfile);
+				fprintf(cfile, "n->%s.%s = relocnodelist(n->%s.%s);\n",
+					sp->tag, fp->name, sp->tag, fp->name);
+				break;
+			case T_STRING:
+				indent(12, cfile);
+				fprintf(cfile, "n->%s.%s = relocstr(n->%s.%s);\n",
+					sp->tag, fp->name, sp->tag, fp->name);
+				break;
+			case T_TEMP:
+				indent(12, cfile);
+				fprintf(cfile, "n->%s.%s = 0;\n",
+					sp->tag, fp->name);
+				break;
+			}
+		}
+		indent(12, cfile);
+		fputs("break;\n", cfile);
+	}
+	fputs("      };\n", cfile);
+}
+
+
+/*
+ * Hash the nodes, strings and ints copynode would copy, so that trees
+ * that copy the same hash the same.  "other" fields are left to the
+ * comparison.
+ */
+
+static void
+outhash(FILE *cfile)
+{
+	struct str *sp;
+	struct field *fp;
+	int i;
+
+	fputs("      if (n == NULL) {\n", cfile);
+	fputs("\t    hashint(-1);\n", cfile);
+	fputs("\t    return;\n", cfile);
+	fputs("      }\n", cfile);
+	fputs("      hashint(n->type);\n", cfile);
+	fputs("      switch (n->type) {\n", cfile);
+	for (sp = str ; sp < &str[nstr] ; sp++) {
+		for (i = 0 ; i < ntypes ; i++) {
+			if (nodestr[i] == sp)
+				fprintf(cfile, "      case %s:\n", nodename[i]);
+		}
+		for (i = sp->nfields ; --i >= 1 ; ) {
+			fp = &sp->field[i];
+			switch (fp->type) {
+			case T_NODE:
+				indent(12, cfile);
+				fprintf(cfile, "hashnode(n->%s.%s);\n",
+					sp->tag, fp->name);
+				break;
+			case T_NODELIST:
+				indent(12, cfile);
+				fprintf(cfile, "hashnodelist(n->%s.%s);\n",
+					sp->tag, fp->name);
+				break;
+			case T_STRING:
+				indent(12, cfile);
+				fprintf(cfile, "hashstr(n->%s.%s);\n",
+					sp->tag, fp->name);
+				break;
+			case T_INT:
+				indent(12, cfile);
+				fprintf(cfile, "hashint(n->%s.%s);\n",
+					sp->tag, fp->name);
+				break;
+			}
+		}
+		indent(12, cfile);
+		fputs("break;\n", cfile);
+	}
+	fputs("      };\n", cfile);
+}
+
+
+/*
+ * Compare two trees the same way, field by field.
+ */
+
+static void
+outequal(FILE *cfile)
+{
+	struct str *sp;
+	struct field *fp;
+	int i;
+
+	fputs("      if (a == b)\n", cfile);
+	fputs("\t    return 1;\n", cfile);
+	fputs("      if (a == NULL || b == NULL || a->type != b->type)\n", cfile);
+	fputs("\t    return 0;\n", cfile);
+	fputs("      switch (a->type) {\n", cfile);
+	for (sp = str ; sp < &str[nstr] ; sp++) {
+		for (i = 0 ; i < ntypes ; i++) {
+			if (nodestr[i] == sp)
+				fprintf(cfile, "      case %s:\n", nodename[i]);
+		}
+		for (i = sp->nfields ; --i >= 1 ; ) {
+			fp = &sp->field[i];
+			switch (fp->type) {
+			case T_NODE:
+				indent(12, cfile);
+				fprintf(cfile, "if (!equalnode(a->%s.%s, b->%s.%s))\n",
+					sp->tag, fp->name, sp->tag, fp->name);
+				break;
+			case T_NODELIST:
+				indent(12, cfile);
+				fprintf(cfile, "if (!equalnodelist(a->%s.%s, b->%s.%s))\n",
+					sp->tag, fp->name, sp->tag, fp->name);
+				break;
+			case T_STRING:
+				indent(12, cfile);
+				fprintf(cfile, "if (strcmp(a->%s.%s, b->%s.%s))\n",
+					sp->tag, fp->name, sp->tag, fp->name);
+				break;
+			case T_INT:
+				indent(12, cfile);
+				fprintf(cfile, "if (a->%s.%s != b->%s.%s)\n",
+					sp->tag, fp->name, sp->tag, fp->name);
+				break;
+			case T_OTHER:
+				indent(12, cfile);
+				fprintf(cfile, "if (memcmp(&a->%s.%s, &b->%s.%s, sizeof(a->%s.%s)))\n",
+					sp->tag, fp->name, sp->tag, fp->name,
+					sp->tag, fp->name);
+				break;
+			default:
+				continue;
+			}
+			indent(16, cfile);
+			fputs("return 0;\n", cfile);
+		}
+		indent(12, cfile);
+		fputs("break;\n", cfile);
+	}
+	fputs("      };\n", cfile);
+	fputs("      return 1;\n", cfile);
+}
+
+
 static void
 indent(int amount, FILE *fp)
 {
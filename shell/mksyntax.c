@@ -40,6 +40,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+/* A host tool: none of parser.h's variables are used, just its CTL values. */
+#define SHTLS
 #include "parser.h"
 
 
@@ -33,12 +33,15 @@
 
 #include <histedit.h>
 
-extern History *hist;
-extern EditLine *el;
-extern int displayhist;
+extern SHTLS History *hist;
+extern SHTLS EditLine *el;
+extern SHTLS int displayhist;
 
 void histedit(void);
 void sethistsize(const char *);
+void sethistfile(const char *);
+void histload(void);
+void histsave(void);
 void setterm(const char *);
 int histcmd(int, char **);
 int not_fcnumber(char *);
@@ -38,6 +38,7 @@
  *	@(#)nodes.c.pat	8.2 (Berkeley) 5/4/95
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 /*
  * Routine for dealing with parsed shell commands.
@@ -51,10 +52,10 @@
 #include "system.h"
 
 
-int     funcblocksize;		/* size of structures in function */
-int     funcstringsize;		/* size of strings in node */
-pointer funcblock;		/* block to allocate function from */
-char   *funcstring;		/* block to allocate strings from */
+SHTLS int     funcblocksize;		/* size of structures in function */
+SHTLS int     funcstringsize;		/* size of strings in node */
+SHTLS pointer funcblock;		/* block to allocate function from */
+SHTLS char   *funcstring;		/* block to allocate strings from */
 
 static const short nodesize[26] = {
       SHELL_ALIGN(sizeof (struct ncmd)),
@@ -85,12 +86,47 @@ static const short nodesize[26] = {
       SHELL_ALIGN(sizeof (struct nnot)),
 };
 
+#define FUNCTABSIZE 64		/* initial size, must be a power of 2 */
 
+
+STATIC union node **copyblock(union node **, int, size_t, size_t *);
+STATIC int relocblock(union node **, int, size_t, size_t, void *);
 STATIC void calcsize(union node *);
 STATIC void sizenodelist(struct nodelist *);
 STATIC union node *copynode(union node *);
 STATIC struct nodelist *copynodelist(struct nodelist *);
 STATIC char *nodesavestr(char *);
+STATIC union node *relocnode(union node *);
+STATIC struct nodelist *relocnodelist(struct nodelist *);
+STATIC char *relocstr(char *);
+STATIC void *relocptr(void *, size_t);
+STATIC union node *relocnodeptr(union node *);
+STATIC void hashnode(union node *);
+STATIC void hashnodelist(struct nodelist *);
+STATIC void hashstr(const char *);
+STATIC void hashint(int);
+STATIC int equalnode(union node *, union node *);
+STATIC int equalnodelist(struct nodelist *, struct nodelist *);
+STATIC struct funcnode *funclookup(union node *, unsigned int);
+STATIC void addfunc(struct funcnode *);
+STATIC void growfunctab(void);
+
+STATIC SHTLS char *relocbase;		/* block being relocated */
+STATIC SHTLS char *relocnext;		/* where the next node should be */
+STATIC SHTLS char *relocend;		/* end of that block */
+STATIC SHTLS ptrdiff_t relocdelta;	/* where it is less where it was */
+STATIC SHTLS int relocbad;		/* it pointed outside itself */
+
+STATIC SHTLS unsigned int funchash;	/* hash of the tree being walked */
+
+/*
+ * The function bodies that sharefunc has handed out, by the hash of
+ * their tree, so that defining the same function again takes another
+ * reference instead of another copy.
+ */
+STATIC SHTLS struct funcnode **functab;
+STATIC SHTLS unsigned int functabsize;	/* number of chains, a power of 2 */
+STATIC SHTLS unsigned int funccount;		/* number of bodies in it */
 
 
 
@@ -112,12 +148,232 @@ copyfunc(union node *n)
 	funcblock = (char *) f + offsetof(struct funcnode, n);
 	funcstring = (char *) f + blocksize;
 	copynode(n);
+	f->next = NULL;
+	f->hashval = 0;
 	f->count = 0;
 	return f;
 }
 
 
 
+/*
+ * Like copyfunc, but if an identical tree has been copied already and
+ * is still in use, take another reference to it instead.  Trees are the
+ * same if every node and string copynode would copy is, line numbers
+ * included, so sharing one can't change what the function does.
+ * Interrupts must be off.
+ */
+
+struct funcnode *
+sharefunc(union node *n)
+{
+	struct funcnode *f;
+	unsigned int hashval;
+
+	funchash = 5381;
+	hashnode(n);
+	hashval = funchash;
+	if ((f = funclookup(n, hashval)) != NULL) {
+		f->count++;
+		return f;
+	}
+	f = copyfunc(n);
+	f->hashval = hashval;
+	addfunc(f);
+	return f;
+}
+
+
+
+/*
+ * Offer a body that didn't come from sharefunc, and is never freed, for
+ * sharefunc to hand out.  A shell image uses this, so that sourcing the
+ * library an image was made from shares the bodies in the image.
+ */
+
+void
+enterfunc(struct funcnode *f)
+{
+	funchash = 5381;
+	hashnode(&f->n);
+	f->hashval = funchash;
+	addfunc(f);
+}
+
+
+
+/*
+ * Find a body in the table the same as n.
+ */
+
+STATIC struct funcnode *
+funclookup(union node *n, unsigned int hashval)
+{
+	struct funcnode *f;
+
+	if (!functabsize)
+		return NULL;
+	for (f = functab[hashval & (functabsize - 1)] ; f ; f = f->next)
+		if (f->hashval == hashval && equalnode(&f->n, n))
+			break;
+	return f;
+}
+
+
+
+STATIC void
+addfunc(struct funcnode *f)
+{
+	struct funcnode **fp;
+
+	if (funccount >= functabsize)
+		growfunctab();
+	fp = &functab[f->hashval & (functabsize - 1)];
+	f->next = *fp;
+	*fp = f;
+	funccount++;
+}
+
+
+
+/*
+ * Double the number of hash chains.  A body keeps its hash, so nothing
+ * is walked again.
+ */
+
+STATIC void
+growfunctab(void)
+{
+	struct funcnode **newtab;
+	struct funcnode *f, *next;
+	unsigned int newsize, i;
+
+	newsize = functabsize ? functabsize * 2 : FUNCTABSIZE;
+	newtab = ckmalloc(newsize * sizeof(*newtab));
+	memset(newtab, 0, newsize * sizeof(*newtab));
+	for (i = 0 ; i < functabsize ; i++) {
+		for (f = functab[i] ; f ; f = next) {
+			next = f->next;
+			f->next = newtab[f->hashval & (newsize - 1)];
+			newtab[f->hashval & (newsize - 1)] = f;
+		}
+	}
+	if (functab)
+		ckfree(functab);
+	functab = newtab;
+	functabsize = newsize;
+}
+
+
+
+/*
+ * Copy a list of parse trees into one block, headed by the array of
+ * pointers to them, so that it can be written out and read back.
+ */
+
+union node **
+copytrees(union node **trees, int count, size_t *sizep)
+{
+	return copyblock(trees, count, 0, sizep);
+}
+
+
+
+/*
+ * The same for function bodies: each tree is laid out at the end of a
+ * struct funcnode, so the block can be used where it is read in.
+ */
+
+union node **
+copyfuncs(union node **trees, int count, size_t *sizep)
+{
+	return copyblock(trees, count, offsetof(struct funcnode, n), sizep);
+}
+
+
+
+/*
+ * Fix up a block from copytrees that was at oldbase and has been
+ * read into memory at block.  Returns nonzero if the block is not
+ * one copytrees could have made, in which case it must not be used.
+ */
+
+int
+reloctrees(union node **block, int count, size_t size, void *oldbase)
+{
+	return relocblock(block, count, 0, size, oldbase);
+}
+
+
+
+/* And one from copyfuncs. */
+
+int
+relocfuncs(union node **block, int count, size_t size, void *oldbase)
+{
+	return relocblock(block, count, offsetof(struct funcnode, n), size,
+			  oldbase);
+}
+
+
+
+/*
+ * The work of both, with skip bytes left free before each tree.
+ */
+
+STATIC union node **
+copyblock(union node **trees, int count, size_t skip, size_t *sizep)
+{
+	union node **block;
+	size_t blocksize;
+	int i;
+
+	funcblocksize = SHELL_ALIGN(count * sizeof(union node *));
+	funcstringsize = 1;
+	for (i = 0 ; i < count ; i++) {
+		funcblocksize += skip;
+		calcsize(trees[i]);
+	}
+	blocksize = funcblocksize;
+	block = ckmalloc(blocksize + funcstringsize);
+	funcblock = (char *) block + SHELL_ALIGN(count * sizeof(union node *));
+	funcstring = (char *) block + blocksize;
+	for (i = 0 ; i < count ; i++) {
+		funcblock = (char *) funcblock + skip;
+		block[i] = copynode(trees[i]);
+	}
+	*funcstring = '\0';
+	*sizep = blocksize + funcstringsize;
+	return block;
+}
+
+
+
+STATIC int
+relocblock(union node **block, int count, size_t skip, size_t size,
+	   void *oldbase)
+{
+	int i;
+
+	relocbase = (char *) block;
+	relocend = relocbase + size;
+	relocdelta = (char *) block - (char *) oldbase;
+	relocbad = 0;
+	if (count < 0 || size < SHELL_ALIGN(count * sizeof(union node *)) + 1 ||
+	    relocend[-1] != '\0')
+		return 1;
+	relocnext = relocbase + SHELL_ALIGN(count * sizeof(union node *));
+	for (i = 0 ; i < count && !relocbad ; i++) {
+		if (skip > (size_t)(relocend - relocnext))
+			return 1;
+		relocnext += skip;
+		block[i] = relocnode(block[i]);
+	}
+	return relocbad;
+}
+
+
+
 STATIC void
 calcsize(n)
 	union node *n;
@@ -227,6 +483,9 @@ copynode(n)
       funcblock = (char *) funcblock + nodesize[n->type];
       switch (n->type) {
       case NCMD:
+	    new->ncmd.cmdp = 0;
+	    new->ncmd.cmdgen = 0;
+	    new->ncmd.testop = n->ncmd.testop;
 	    new->ncmd.redirect = copynode(n->ncmd.redirect);
 	    new->ncmd.args = copynode(n->ncmd.args);
 	    new->ncmd.assign = copynode(n->ncmd.assign);
@@ -278,6 +537,7 @@ copynode(n)
 	    new->ndefun.linno = n->ndefun.linno;
 	    break;
       case NARG:
+	    new->narg.lit = n->narg.lit;
 	    new->narg.backquote = copynodelist(n->narg.backquote);
 	    new->narg.text = nodesavestr(n->narg.text);
 	    new->narg.next = copynode(n->narg.next);
@@ -287,6 +547,7 @@ copynode(n)
       case NFROM:
       case NFROMTO:
       case NAPPEND:
+	    new->nfile.expfname = 0;
 	    new->nfile.fname = copynode(n->nfile.fname);
 	    new->nfile.fd = n->nfile.fd;
 	    new->nfile.next = copynode(n->nfile.next);
@@ -347,13 +608,469 @@ nodesavestr(s)
 
 
 
+STATIC union node *
+relocnode(n)
+	union node *n;
+{
+      if (n == NULL || (n = relocnodeptr(n)) == NULL)
+	    return NULL;
+      switch (n->type) {
+      case NCMD:
+	    n->ncmd.cmdp = 0;
+	    n->ncmd.cmdgen = 0;
+	    n->ncmd.redirect = relocnode(n->ncmd.redirect);
+	    n->ncmd.args = relocnode(n->ncmd.args);
+	    n->ncmd.assign = relocnode(n->ncmd.assign);
+	    break;
+      case NPIPE:
+	    n->npipe.cmdlist = relocnodelist(n->npipe.cmdlist);
+	    break;
+      case NREDIR:
+      case NBACKGND:
+      case NSUBSHELL:
+	    n->nredir.redirect = relocnode(n->nredir.redirect);
+	    n->nredir.n = relocnode(n->nredir.n);
+	    break;
+      case NAND:
+      case NOR:
+      case NSEMI:
+      case NWHILE:
+      case NUNTIL:
+	    n->nbinary.ch2 = relocnode(n->nbinary.ch2);
+	    n->nbinary.ch1 = relocnode(n->nbinary.ch1);
+	    break;
+      case NIF:
+	    n->nif.elsepart = relocnode(n->nif.elsepart);
+	    n->nif.ifpart = relocnode(n->nif.ifpart);
+	    n->nif.test = relocnode(n->nif.test);
+	    break;
+      case NFOR:
+	    n->nfor.var = relocstr(n->nfor.var);
+	    n->nfor.body = relocnode(n->nfor.body);
+	    n->nfor.args = relocnode(n->nfor.args);
+	    break;
+      case NCASE:
+	    n->ncase.cases = relocnode(n->ncase.cases);
+	    n->ncase.expr = relocnode(n->ncase.expr);
+	    break;
+      case NCLIST:
+	    n->nclist.body = relocnode(n->nclist.body);
+	    n->nclist.pattern = relocnode(n->nclist.pattern);
+	    n->nclist.next = relocnode(n->nclist.next);
+	    break;
+      case NDEFUN:
+	    n->ndefun.body = relocnode(n->ndefun.body);
+	    n->ndefun.text = relocstr(n->ndefun.text);
+	    break;
+      case NARG:
+	    n->narg.backquote = relocnodelist(n->narg.backquote);
+	    n->narg.text = relocstr(n->narg.text);
+	    n->narg.next = relocnode(n->narg.next);
+	    break;
+      case NTO:
+      case NCLOBBER:
+      case NFROM:
+      case NFROMTO:
+      case NAPPEND:
+	    n->nfile.expfname = 0;
+	    n->nfile.fname = relocnode(n->nfile.fname);
+	    n->nfile.next = relocnode(n->nfile.next);
+	    break;
+      case NTOFD:
+      case NFROMFD:
+	    n->ndup.vname = relocnode(n->ndup.vname);
+	    n->ndup.next = relocnode(n->ndup.next);
+	    break;
+      case NHERE:
+      case NXHERE:
+	    n->nhere.doc = relocnode(n->nhere.doc);
+	    n->nhere.next = relocnode(n->nhere.next);
+	    break;
+      case NNOT:
+	    n->nnot.com = relocnode(n->nnot.com);
+	    break;
+      };
+	return n;
+}
+
+
+
+STATIC struct nodelist *
+relocnodelist(lp)
+	struct nodelist *lp;
+{
+	struct nodelist *start;
+
+	start = lp = relocptr(lp, SHELL_ALIGN(sizeof(struct nodelist)));
+	while (lp) {
+		lp->n = relocnode(lp->n);
+		lp = lp->next = relocptr(lp->next,
+		    SHELL_ALIGN(sizeof(struct nodelist)));
+	}
+	return start;
+}
+
+
+
+STATIC char *
+relocstr(s)
+	char   *s;
+{
+	char *q;
+
+	if (relocbad)
+		return NULL;
+	q = (char *) ((uintptr_t) s + relocdelta);
+	if (q < relocnext || q >= relocend) {
+		relocbad = 1;
+		return NULL;
+	}
+	return q;
+}
+
+
+
 /*
- * Free a parse tree.
+ * Move a pointer into the block by relocdelta.  The walk visits nodes
+ * in the order copynode laid them out, so each one has to start just
+ * where the last one ended; anything else marks the whole block bad and
+ * comes back NULL, which stops the walk from following it.
+ */
+
+STATIC void *
+relocptr(void *p, size_t size)
+{
+	char *q;
+
+	if (p == NULL || relocbad)
+		return NULL;
+	q = (char *) ((uintptr_t) p + relocdelta);
+	if (q != relocnext || size > (size_t)(relocend - q)) {
+		relocbad = 1;
+		return NULL;
+	}
+	relocnext += size;
+	return q;
+}
+
+
+
+STATIC union node *
+relocnodeptr(n)
+	union node *n;
+{
+	char *q;
+
+	q = (char *) ((uintptr_t) n + relocdelta);
+	if (relocbad || q != relocnext || relocend - q < (ptrdiff_t)sizeof(int) ||
+	    (unsigned) *(int *) q >= sizeof(nodesize) / sizeof(nodesize[0])) {
+		relocbad = 1;
+		return NULL;
+	}
+	return relocptr(n, nodesize[*(int *) q]);
+}
+
+
+
+STATIC void
+hashnode(n)
+	union node *n;
+{
+      if (n == NULL) {
+	    hashint(-1);
+	    return;
+      }
+      hashint(n->type);
+      switch (n->type) {
+      case NCMD:
+	    hashint(n->ncmd.testop);
+	    hashnode(n->ncmd.redirect);
+	    hashnode(n->ncmd.args);
+	    hashnode(n->ncmd.assign);
+	    hashint(n->ncmd.linno);
+	    break;
+      case NPIPE:
+	    hashnodelist(n->npipe.cmdlist);
+	    hashint(n->npipe.backgnd);
+	    break;
+      case NREDIR:
+      case NBACKGND:
+      case NSUBSHELL:
+	    hashnode(n->nredir.redirect);
+	    hashnode(n->nredir.n);
+	    hashint(n->nredir.linno);
+	    break;
+      case NAND:
+      case NOR:
+      case NSEMI:
+      case NWHILE:
+      case NUNTIL:
+	    hashnode(n->nbinary.ch2);
+	    hashnode(n->nbinary.ch1);
+	    break;
+      case NIF:
+	    hashnode(n->nif.elsepart);
+	    hashnode(n->nif.ifpart);
+	    hashnode(n->nif.test);
+	    break;
+      case NFOR:
+	    hashstr(n->nfor.var);
+	    hashnode(n->nfor.body);
+	    hashnode(n->nfor.args);
+	    hashint(n->nfor.linno);
+	    break;
+      case NCASE:
+	    hashnode(n->ncase.cases);
+	    hashnode(n->ncase.expr);
+	    hashint(n->ncase.linno);
+	    break;
+      case NCLIST:
+	    hashnode(n->nclist.body);
+	    hashnode(n->nclist.pattern);
+	    hashnode(n->nclist.next);
+	    break;
+      case NDEFUN:
+	    hashnode(n->ndefun.body);
+	    hashstr(n->ndefun.text);
+	    hashint(n->ndefun.linno);
+	    break;
+      case NARG:
+	    hashint(n->narg.lit);
+	    hashnodelist(n->narg.backquote);
+	    hashstr(n->narg.text);
+	    hashnode(n->narg.next);
+	    break;
+      case NTO:
+      case NCLOBBER:
+      case NFROM:
+      case NFROMTO:
+      case NAPPEND:
+	    hashnode(n->nfile.fname);
+	    hashint(n->nfile.fd);
+	    hashnode(n->nfile.next);
+	    break;
+      case NTOFD:
+      case NFROMFD:
+	    hashnode(n->ndup.vname);
+	    hashint(n->ndup.dupfd);
+	    hashint(n->ndup.fd);
+	    hashnode(n->ndup.next);
+	    break;
+      case NHERE:
+      case NXHERE:
+	    hashnode(n->nhere.doc);
+	    hashint(n->nhere.fd);
+	    hashnode(n->nhere.next);
+	    break;
+      case NNOT:
+	    hashnode(n->nnot.com);
+	    break;
+      };
+}
+
+
+
+STATIC void
+hashnodelist(lp)
+	struct nodelist *lp;
+{
+	for (; lp ; lp = lp->next)
+		hashnode(lp->n);
+	hashint(-1);
+}
+
+
+
+STATIC void
+hashstr(const char *s)
+{
+	while (*s)
+		funchash = funchash * 33 + (unsigned char)*s++;
+	funchash = funchash * 33;
+}
+
+
+
+STATIC void
+hashint(int i)
+{
+	funchash = funchash * 33 + (unsigned int)i;
+}
+
+
+
+STATIC int
+equalnode(a, b)
+	union node *a, *b;
+{
+      if (a == b)
+	    return 1;
+      if (a == NULL || b == NULL || a->type != b->type)
+	    return 0;
+      switch (a->type) {
+      case NCMD:
+	    if (a->ncmd.testop != b->ncmd.testop)
+		return 0;
+	    if (!equalnode(a->ncmd.redirect, b->ncmd.redirect))
+		return 0;
+	    if (!equalnode(a->ncmd.args, b->ncmd.args))
+		return 0;
+	    if (!equalnode(a->ncmd.assign, b->ncmd.assign))
+		return 0;
+	    if (a->ncmd.linno != b->ncmd.linno)
+		return 0;
+	    break;
+      case NPIPE:
+	    if (!equalnodelist(a->npipe.cmdlist, b->npipe.cmdlist))
+		return 0;
+	    if (a->npipe.backgnd != b->npipe.backgnd)
+		return 0;
+	    break;
+      case NREDIR:
+      case NBACKGND:
+      case NSUBSHELL:
+	    if (!equalnode(a->nredir.redirect, b->nredir.redirect))
+		return 0;
+	    if (!equalnode(a->nredir.n, b->nredir.n))
+		return 0;
+	    if (a->nredir.linno != b->nredir.linno)
+		return 0;
+	    break;
+      case NAND:
+      case NOR:
+      case NSEMI:
+      case NWHILE:
+      case NUNTIL:
+	    if (!equalnode(a->nbinary.ch2, b->nbinary.ch2))
+		return 0;
+	    if (!equalnode(a->nbinary.ch1, b->nbinary.ch1))
+		return 0;
+	    break;
+      case NIF:
+	    if (!equalnode(a->nif.elsepart, b->nif.elsepart))
+		return 0;
+	    if (!equalnode(a->nif.ifpart, b->nif.ifpart))
+		return 0;
+	    if (!equalnode(a->nif.test, b->nif.test))
+		return 0;
+	    break;
+      case NFOR:
+	    if (strcmp(a->nfor.var, b->nfor.var))
+		return 0;
+	    if (!equalnode(a->nfor.body, b->nfor.body))
+		return 0;
+	    if (!equalnode(a->nfor.args, b->nfor.args))
+		return 0;
+	    if (a->nfor.linno != b->nfor.linno)
+		return 0;
+	    break;
+      case NCASE:
+	    if (!equalnode(a->ncase.cases, b->ncase.cases))
+		return 0;
+	    if (!equalnode(a->ncase.expr, b->ncase.expr))
+		return 0;
+	    if (a->ncase.linno != b->ncase.linno)
+		return 0;
+	    break;
+      case NCLIST:
+	    if (!equalnode(a->nclist.body, b->nclist.body))
+		return 0;
+	    if (!equalnode(a->nclist.pattern, b->nclist.pattern))
+		return 0;
+	    if (!equalnode(a->nclist.next, b->nclist.next))
+		return 0;
+	    break;
+      case NDEFUN:
+	    if (!equalnode(a->ndefun.body, b->ndefun.body))
+		return 0;
+	    if (strcmp(a->ndefun.text, b->ndefun.text))
+		return 0;
+	    if (a->ndefun.linno != b->ndefun.linno)
+		return 0;
+	    break;
+      case NARG:
+	    if (a->narg.lit != b->narg.lit)
+		return 0;
+	    if (!equalnodelist(a->narg.backquote, b->narg.backquote))
+		return 0;
+	    if (strcmp(a->narg.text, b->narg.text))
+		return 0;
+	    if (!equalnode(a->narg.next, b->narg.next))
+		return 0;
+	    break;
+      case NTO:
+      case NCLOBBER:
+      case NFROM:
+      case NFROMTO:
+      case NAPPEND:
+	    if (!equalnode(a->nfile.fname, b->nfile.fname))
+		return 0;
+	    if (a->nfile.fd != b->nfile.fd)
+		return 0;
+	    if (!equalnode(a->nfile.next, b->nfile.next))
+		return 0;
+	    break;
+      case NTOFD:
+      case NFROMFD:
+	    if (!equalnode(a->ndup.vname, b->ndup.vname))
+		return 0;
+	    if (a->ndup.dupfd != b->ndup.dupfd)
+		return 0;
+	    if (a->ndup.fd != b->ndup.fd)
+		return 0;
+	    if (!equalnode(a->ndup.next, b->ndup.next))
+		return 0;
+	    break;
+      case NHERE:
+      case NXHERE:
+	    if (!equalnode(a->nhere.doc, b->nhere.doc))
+		return 0;
+	    if (a->nhere.fd != b->nhere.fd)
+		return 0;
+	    if (!equalnode(a->nhere.next, b->nhere.next))
+		return 0;
+	    break;
+      case NNOT:
+	    if (!equalnode(a->nnot.com, b->nnot.com))
+		return 0;
+	    break;
+      };
+      return 1;
+}
+
+
+
+STATIC int
+equalnodelist(a, b)
+	struct nodelist *a, *b;
+{
+	for (; a && b ; a = a->next, b = b->next)
+		if (!equalnode(a->n, b->n))
+			return 0;
+	return a == b;
+}
+
+
+
+/*
+ * Free a parse tree, taking it out of the table if sharefunc made it.
  */
 
 void
 freefunc(struct funcnode *f)
 {
-	if (f && --f->count < 0)
+	struct funcnode **fp;
+
+	if (f && --f->count < 0) {
+		if (functabsize) {
+			fp = &functab[f->hashval & (functabsize - 1)];
+			for (; *fp ; fp = &(*fp)->next)
+				if (*fp == f) {
+					*fp = f->next;
+					funccount--;
+					break;
+				}
+		}
 		ckfree(f);
+	}
 }
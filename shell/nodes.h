@@ -37,6 +37,9 @@ struct ncmd {
       union node *assign;
       union node *args;
       union node *redirect;
+      int testop;
+      unsigned int cmdgen;
+      void *cmdp;
 };
 
 
@@ -108,6 +111,7 @@ struct narg {
       union node *next;
       char *text;
       struct nodelist *backquote;
+      int lit;
 };
 
 
@@ -169,10 +173,18 @@ struct nodelist {
 
 
 struct funcnode {
+	struct funcnode *next;
+	unsigned int hashval;
 	int count;
 	union node n;
 };
 
 
 struct funcnode *copyfunc(union node *);
+struct funcnode *sharefunc(union node *);
+void enterfunc(struct funcnode *);
 void freefunc(struct funcnode *);
+union node **copytrees(union node **, int, size_t *);
+int reloctrees(union node **, int, size_t, void *);
+union node **copyfuncs(union node **, int, size_t *);
+int relocfuncs(union node **, int, size_t, void *);
@@ -55,13 +55,13 @@
 #endif
 #include "show.h"
 
-char *arg0;			/* value of $0 */
-struct shparam shellparam;	/* current positional parameters */
-char **argptr;			/* argument list for builtin commands */
-char *optionarg;		/* set by nextopt (like getopt) */
-char *optptr;			/* used by nextopt */
+SHTLS char *arg0;			/* value of $0 */
+SHTLS struct shparam shellparam;	/* current positional parameters */
+SHTLS char **argptr;			/* argument list for builtin commands */
+SHTLS char *optionarg;		/* set by nextopt (like getopt) */
+SHTLS char *optptr;			/* used by nextopt */
 
-char *minusc;			/* argument to -c option */
+SHTLS char *minusc;			/* argument to -c option */
 
 static const char *const optnames[NOPTS] = {
 	"errexit",
@@ -81,6 +81,7 @@ static const char *const optnames[NOPTS] = {
 	"nounset",
 	"nolog",
 	"debug",
+	"profile",
 };
 
 const char optletters[NOPTS] = {
@@ -101,9 +102,10 @@ const char optletters[NOPTS] = {
 	'u',
 	0,
 	0,
+	'P',
 };
 
-char optlist[NOPTS];
+SHTLS char optlist[NOPTS];
 
 
 static int options(int);
@@ -61,19 +61,20 @@ struct shparam {
 #define	uflag optlist[14]
 #define	nolog optlist[15]
 #define	debug optlist[16]
+#define	Pflag optlist[17]
 
-#define NOPTS	17
+#define NOPTS	18
 
 extern const char optletters[NOPTS];
-extern char optlist[NOPTS];
+extern SHTLS char optlist[NOPTS];
 
 
-extern char *minusc;		/* argument to -c option */
-extern char *arg0;		/* $0 */
-extern struct shparam shellparam;  /* $@ */
-extern char **argptr;		/* argument list for builtin commands */
-extern char *optionarg;		/* set by nextopt */
-extern char *optptr;		/* used by nextopt */
+extern SHTLS char *minusc;		/* argument to -c option */
+extern SHTLS char *arg0;		/* $0 */
+extern SHTLS struct shparam shellparam;  /* $@ */
+extern SHTLS char **argptr;		/* argument list for builtin commands */
+extern SHTLS char *optionarg;		/* set by nextopt */
+extern SHTLS char *optptr;		/* used by nextopt */
 
 int procargs(int, char **);
 void optschanged(void);
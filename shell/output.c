@@ -46,6 +46,7 @@
 #include <sys/types.h>		/* quad_t */
 #include <sys/param.h>		/* BSD4_4 */
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include <stdio.h>	/* defines BUFSIZ */
 #include <string.h>
@@ -62,68 +63,73 @@
 #include "memalloc.h"
 #include "error.h"
 #include "main.h"
+#include "stats.h"
 #include "system.h"
 
 
 #define OUTBUFSIZ BUFSIZ
+#define OUTBUFMAX (16 * 1024)	/* largest buffer for a file or pipe */
 #define MEM_OUT -3		/* output to dynamically allocated memory */
+#define MEMOUTSIZ 128		/* first allocation for memout */
 
 
 #ifdef USE_GLIBC_STDIO
-struct output output = {
+SHTLS struct output output = {
 	stream: 0, nextc: 0, end: 0, buf: 0, bufsize: 0, fd: 1, flags: 0
 };
-struct output errout = {
+SHTLS struct output errout = {
 	stream: 0, nextc: 0, end: 0, buf: 0, bufsize: 0, fd: 2, flags: 0
 }
 #ifdef notyet
-struct output memout = {
+SHTLS struct output memout = {
 	stream: 0, nextc: 0, end: 0, buf: 0, bufsize: 0, fd: MEM_OUT, flags: 0
 };
 #endif
 #else
-struct output output = {
+SHTLS struct output output = {
 	nextc: 0, end: 0, buf: 0, bufsize: OUTBUFSIZ, fd: 1, flags: 0
 };
-struct output errout = {
+SHTLS struct output errout = {
 	nextc: 0, end: 0, buf: 0, bufsize: 0, fd: 2, flags: 0
 };
-struct output preverrout;
-#ifdef notyet
-struct output memout = {
-	nextc: 0, end: 0, buf: 0, bufsize: 0, fd: MEM_OUT, flags: 0
+SHTLS struct output preverrout;
+SHTLS struct output memout = {
+	nextc: 0, end: 0, buf: 0, bufsize: MEMOUTSIZ, fd: MEM_OUT, flags: 0
 };
 #endif
-#endif
-struct output *out1 = &output;
-struct output *out2 = &errout;
+SHTLS struct output *out1;		/* &output, set by init() */
+SHTLS struct output *out2;		/* &errout */
 
 
 #ifndef USE_GLIBC_STDIO
 static void __outstr(const char *, size_t, struct output *);
+static int outwritev(struct output *, const char *, size_t);
 #endif
 static int xvsnprintf(char *, size_t, const char *, va_list);
 
 
 #ifdef mkinit
 
+INCLUDE <stdlib.h>
 INCLUDE "output.h"
 INCLUDE "memalloc.h"
 
 INIT {
+	out1 = &output;
+	out2 = &errout;
 #ifdef USE_GLIBC_STDIO
 	initstreams();
 #endif
 }
 
 RESET {
-#ifdef notyet
 	out1 = &output;
 	out2 = &errout;
-#ifdef USE_GLIBC_STDIO
+#ifndef USE_GLIBC_STDIO
+	ckfree(grabmemout(NULL));
+#elif defined(notyet)
 	if (memout.stream != NULL)
 		__closememout();
-#endif
 	if (memout.buf != NULL) {
 		ckfree(memout.buf);
 		memout.buf = NULL;
@@ -151,15 +157,33 @@ buffered:
 
 	bufsize = dest->bufsize;
 	if (!bufsize) {
-		;
+		/*
+		 * Unbuffered output is error messages, which often go to
+		 * the same place as standard output, so keep them in order.
+		 */
+		flushout(&output);
 	} else if (dest->buf == NULL) {
 		if (dest->fd == MEM_OUT && len > bufsize) {
 			bufsize = len;
 		}
 		offset = 0;
 		goto alloc;
-	} else if (dest->fd == MEM_OUT) {
-		offset = bufsize;
+	} else if (dest->fd != MEM_OUT) {
+		/*
+		 * Nobody is watching a file or pipe as it fills, so let
+		 * the buffer grow and save on system calls.
+		 */
+		if (bufsize < OUTBUFMAX &&
+		    (dest->flags & (OUTPUT_CHECKED | OUTPUT_TTY)) ==
+		    OUTPUT_CHECKED) {
+			offset = dest->nextc - dest->buf;
+			bufsize <<= 1;
+			if (bufsize > OUTBUFMAX)
+				bufsize = OUTBUFMAX;
+			goto alloc;
+		}
+	} else {
+		offset = dest->nextc - dest->buf;
 		if (bufsize >= len) {
 			bufsize <<= 1;
 		} else {
@@ -174,19 +198,62 @@ alloc:
 		dest->end = dest->buf + bufsize;
 		dest->nextc = dest->buf + offset;
 		INTON;
-	} else {
-		flushout(dest);
 	}
 
 	nleft = dest->end - dest->nextc;
-	if (nleft > len)
+	if (nleft >= len)
 		goto buffered;
 
-	if ((dxwrite(dest->fd, p, len))) {
+	if (outwritev(dest, p, len)) {
 err:
 		dest->flags |= OUTPUT_ERR;
 	}
 }
+
+
+/*
+ * Write out the buffer followed by len bytes at p, with the one system
+ * call if the kernel will take it all.
+ */
+
+static int
+outwritev(struct output *dest, const char *p, size_t len)
+{
+	struct iovec iov[2];
+	struct iovec *v;
+	int n;
+	ssize_t i;
+
+	iov[0].iov_base = dest->buf;
+	iov[0].iov_len = dest->nextc - dest->buf;
+	iov[1].iov_base = (char *)p;
+	iov[1].iov_len = len;
+	dest->nextc = dest->buf;
+	v = iov;
+	n = 2;
+	for (;;) {
+		while (n && v->iov_len == 0) {
+			v++;
+			n--;
+		}
+		if (!n)
+			return 0;
+		do {
+			i = writev(dest->fd, v, n);
+		} while (i < 0 && errno == EINTR);
+		if (i < 0)
+			return -1;
+		while ((size_t)i >= v->iov_len) {
+			i -= v->iov_len;
+			v->iov_len = 0;
+			if (--n == 0)
+				return 0;
+			v++;
+		}
+		v->iov_base = (char *)v->iov_base + i;
+		v->iov_len -= i;
+	}
+}
 #endif
 
 
@@ -206,6 +273,23 @@ outstr(const char *p, struct output *file)
 }
 
 
+/*
+ * Output len bytes, which may include NULs.
+ */
+
+void
+outmem(const char *p, size_t len, struct output *file)
+{
+#ifdef USE_GLIBC_STDIO
+	INTOFF;
+	fwrite(p, 1, len, file->stream);
+	INTON;
+#else
+	__outstr(p, len, file);
+#endif
+}
+
+
 #ifndef USE_GLIBC_STDIO
 
 
@@ -218,12 +302,68 @@ outcslow(int c, struct output *dest)
 #endif
 
 
+#ifndef USE_GLIBC_STDIO
+/*
+ * Take what has been written to memout, leaving it empty.  The caller
+ * frees the buffer with ckfree.  Returns NULL if nothing was written.
+ */
+
+char *
+grabmemout(int *lenp)
+{
+	char *buf = memout.buf;
+
+	if (lenp)
+		*lenp = memout.nextc - memout.buf;
+	memout.buf = memout.nextc = memout.end = NULL;
+	memout.bufsize = MEMOUTSIZ;
+	memout.flags = 0;
+	return buf;
+}
+#endif
+
+
+/*
+ * Flush everything.  This is done whenever standard output might be
+ * about to change hands, so check what it is again next time.
+ */
+
 void
 flushall(void)
 {
 	flushout(&output);
 #ifdef FLUSHERR
 	flushout(&errout);
+#endif
+	output.flags &= ~OUTPUT_CHECKED;
+}
+
+
+/*
+ * Called after each builtin.  Someone may be watching a terminal, but
+ * output to a file or pipe can wait until the buffer fills or flushall
+ * is called.
+ */
+
+void
+flushtty(void)
+{
+#ifndef USE_GLIBC_STDIO
+	if (output.nextc == output.buf)
+		return;
+	if (!(output.flags & OUTPUT_CHECKED)) {
+		output.flags |= OUTPUT_CHECKED;
+		if (isatty(output.fd))
+			output.flags |= OUTPUT_TTY;
+		else
+			output.flags &= ~OUTPUT_TTY;
+	}
+	if (!(output.flags & OUTPUT_TTY))
+		return;
+#endif
+	flushout(&output);
+#ifdef FLUSHERR
+	flushout(&errout);
 #endif
 }
 
@@ -242,6 +382,7 @@ flushout(struct output *dest)
 	if (!len || dest->fd < 0)
 		return;
 	dest->nextc = dest->buf;
+	shstat.outflushes++;
 	if ((dxwrite(dest->fd, dest->buf, len)))
 		dest->flags |= OUTPUT_ERR;
 #endif
@@ -54,20 +54,23 @@ struct output {
 	int flags;
 };
 
-extern struct output output;
-extern struct output errout;
-extern struct output preverrout;
-#ifdef notyet
-extern struct output memout;
+extern SHTLS struct output output;
+extern SHTLS struct output errout;
+extern SHTLS struct output preverrout;
+#ifndef USE_GLIBC_STDIO
+extern SHTLS struct output memout;
 #endif
-extern struct output *out1;
-extern struct output *out2;
+extern SHTLS struct output *out1;
+extern SHTLS struct output *out2;
 
 void outstr(const char *, struct output *);
+void outmem(const char *, size_t, struct output *);
 #ifndef USE_GLIBC_STDIO
 void outcslow(int, struct output *);
+char *grabmemout(int *);
 #endif
 void flushall(void);
+void flushtty(void);
 void flushout(struct output *);
 void outfmt(struct output *, const char *, ...)
     __attribute__((__format__(__printf__,2,3)));
@@ -95,6 +98,8 @@ freestdout()
 }
 
 #define OUTPUT_ERR 01		/* error occurred on output */
+#define OUTPUT_CHECKED 02	/* we know whether fd is a terminal */
+#define OUTPUT_TTY 04		/* fd is a terminal */
 
 #ifdef USE_GLIBC_STDIO
 static inline void outc(int ch, struct output *file)
@@ -117,7 +122,7 @@ static inline void outc(int ch, struct output *file)
 #define out2c(c)	outcslow((c), out2)
 #define out1str(s)	outstr((s), out1)
 #define out2str(s)	outstr((s), out2)
-#define outerr(f)	(f)->flags
+#define outerr(f)	((f)->flags & OUTPUT_ERR)
 
 #define OUTPUT_INCL
 #endif
@@ -54,6 +54,7 @@
 #include "alias.h"
 #include "show.h"
 #include "builtins.h"
+#include "cache.h"
 #include "system.h"
 #ifndef SMALL
 #include "myhistedit.h"
@@ -82,17 +83,17 @@ struct heredoc {
 
 
 
-struct heredoc *heredoclist;	/* list of here documents to read */
-int doprompt;			/* if set, prompt the user */
-int needprompt;			/* true if interactive and at start of line */
-int lasttoken;			/* last token read */
-int tokpushback;		/* last token pushed back */
-char *wordtext;			/* text of last word returned by readtoken */
-int checkkwd;
-struct nodelist *backquotelist;
-union node *redirnode;
-struct heredoc *heredoc;
-int quoteflag;			/* set if (part of) last token was quoted */
+SHTLS struct heredoc *heredoclist;	/* list of here documents to read */
+SHTLS int doprompt;			/* if set, prompt the user */
+SHTLS int needprompt;			/* true if interactive and at start of line */
+SHTLS int lasttoken;			/* last token read */
+SHTLS int tokpushback;		/* last token pushed back */
+SHTLS char *wordtext;			/* text of last word returned by readtoken */
+SHTLS int checkkwd;
+SHTLS struct nodelist *backquotelist;
+SHTLS union node *redirnode;
+SHTLS struct heredoc *heredoc;
+SHTLS int quoteflag;			/* set if (part of) last token was quoted */
 
 
 STATIC union node *list(int);
@@ -100,6 +101,7 @@ STATIC union node *andor(void);
 STATIC union node *pipeline(void);
 STATIC union node *command(void);
 STATIC union node *simplecmd(void);
+STATIC int testshape(union node *);
 STATIC union node *makename(void);
 STATIC void parsefname(void);
 STATIC void parseheredoc(void);
@@ -135,9 +137,13 @@ static inline int realeofmark(const char *eofmark)
 union node *
 parsecmd(int interact)
 {
+	union node *n;
 	int t;
 
+	if (cachenext(&n))
+		return n;
 	tokpushback = 0;
+	heredoclist = NULL;
 	doprompt = interact;
 	if (doprompt)
 		setprompt(doprompt);
@@ -369,6 +375,7 @@ TRACE(("expecting DO got %s %s\n", tokname[got], got == TWORD ? wordtext : ""));
 				n2->type = NARG;
 				n2->narg.text = wordtext;
 				n2->narg.backquote = backquotelist;
+				n2->narg.lit = 0;
 				*app = n2;
 				app = &n2->narg.next;
 			}
@@ -381,6 +388,7 @@ TRACE(("expecting DO got %s %s\n", tokname[got], got == TWORD ? wordtext : ""));
 			n2->type = NARG;
 			n2->narg.text = (char *)dolatstr;
 			n2->narg.backquote = NULL;
+			n2->narg.lit = 0;
 			n2->narg.next = NULL;
 			n1->nfor.args = n2;
 			/*
@@ -406,6 +414,7 @@ TRACE(("expecting DO got %s %s\n", tokname[got], got == TWORD ? wordtext : ""));
 		n2->type = NARG;
 		n2->narg.text = wordtext;
 		n2->narg.backquote = backquotelist;
+		n2->narg.lit = 0;
 		n2->narg.next = NULL;
 		checkkwd = CHKNL | CHKKWD | CHKALIAS;
 		if (readtoken() != TIN)
@@ -425,6 +434,7 @@ next_case:
 				ap->type = NARG;
 				ap->narg.text = wordtext;
 				ap->narg.backquote = backquotelist;
+				ap->narg.lit = 0;
 				if (readtoken() != TPIPE)
 					break;
 				app = &ap->narg.next;
@@ -520,6 +530,7 @@ simplecmd(void) {
 			n->type = NARG;
 			n->narg.text = wordtext;
 			n->narg.backquote = backquotelist;
+			n->narg.lit = 0;
 			if (savecheckkwd && isassignment(wordtext)) {
 				*vpp = n;
 				vpp = &n->narg.next;
@@ -576,9 +587,38 @@ out:
 	n->ncmd.args = args;
 	n->ncmd.assign = vars;
 	n->ncmd.redirect = redir;
+	n->ncmd.testop = testshape(args);
+	n->ncmd.cmdgen = 0;
+	n->ncmd.cmdp = NULL;
 	return n;
 }
 
+
+int testbinop(const char *);
+
+/*
+ * Spot "[ a op b ]" and "test a op b", with the command name and the
+ * binary operator written out plainly, and return what testbinop makes
+ * of the operator.  evalcommand can then check the expanded arguments
+ * still have that shape and skip running the builtin.
+ */
+
+STATIC int
+testshape(union node *args)
+{
+	union node *ap[5];
+	int n;
+
+	for (n = 0 ; args && n < 5 ; args = args->narg.next)
+		ap[n++] = args;
+	if (args || n < 4)
+		return 0;
+	if (ap[0]->narg.backquote ||
+	    strcmp(ap[0]->narg.text, n == 5 ? "[" : "test"))
+		return 0;
+	return testbinop(ap[2]->narg.text);
+}
+
 STATIC union node *
 makename(void)
 {
@@ -589,6 +629,7 @@ makename(void)
 	n->narg.next = NULL;
 	n->narg.text = wordtext;
 	n->narg.backquote = backquotelist;
+	n->narg.lit = 0;
 	return n;
 }
 
@@ -669,6 +710,7 @@ parseheredoc(void)
 		n->narg.next = NULL;
 		n->narg.text = wordtext;
 		n->narg.backquote = backquotelist;
+		n->narg.lit = 0;
 		here->here->nhere.doc = n;
 		here = here->next;
 	}
@@ -1481,6 +1523,8 @@ STATIC void
 synerror(const char *msg)
 {
 	errlinno = plinno;
+	if (cachequiet)
+		exraise(EXERROR);
 	sh_error("Syntax error: %s", msg);
 	/* NOTREACHED */
 }
@@ -1528,6 +1572,7 @@ expandstr(const char *ps)
 	n.narg.next = NULL;
 	n.narg.text = wordtext;
 	n.narg.backquote = backquotelist;
+	n.narg.lit = 0;
 
 	expandarg(&n, NULL, EXP_QUOTED);
 	return stackblock();
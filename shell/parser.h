@@ -75,11 +75,11 @@
  * must be distinct from NULL, so we use the address of a variable that
  * happens to be handy.
  */
-extern int lasttoken;
-extern int tokpushback;
+extern SHTLS int lasttoken;
+extern SHTLS int tokpushback;
 #define NEOF ((union node *)&tokpushback)
-extern int whichprompt;		/* 1 == PS1, 2 == PS2 */
-extern int checkkwd;
+extern SHTLS int whichprompt;		/* 1 == PS1, 2 == PS2 */
+extern SHTLS int checkkwd;
 
 
 union node *parsecmd(int);
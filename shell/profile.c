@@ -0,0 +1,409 @@
+/*-
+ * Copyright (c) 1991, 1993
+ *	The Regents of the University of California.  All rights reserved.
+ * Copyright (c) 1997-2005
+ *	Herbert Xu <herbert@gondor.apana.org.au>.  All rights reserved.
+ *
+ * This code is derived from software contributed to Berkeley by
+ * Kenneth Almquist.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Profiling, for set -P (set -o profile).  Each simple command is timed
+ * from the expansion of its words to its end, and the wall and CPU time
+ * are added up by command name and by source line.  Both include what
+ * the command ran, so a function's line and name carry its whole body.
+ * When the shell exits the totals go to $SHPROF, or to standard error,
+ * as tables sorted by wall time.  If $SHPROF_STACKS is set, collapsed
+ * stacks with each command's own wall time in microseconds are written
+ * there too, for flame graph tools.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shell.h"
+#include "nodes.h"
+#include "exec.h"
+#include "main.h"
+#include "memalloc.h"
+#include "mystring.h"
+#include "output.h"
+#include "error.h"
+#include "var.h"
+#include "profile.h"
+
+
+#define PROFHASH	1024
+
+#define PROF_LINE	0	/* name is the function the line is in */
+#define PROF_STACK	1	/* name is the stack, outermost first */
+#define PROF_CMD	3	/* plus the cmdtype */
+
+struct profent {
+	struct profent *next;	/* next entry in hash chain */
+	unsigned long count;
+	uint64_t wall;		/* nanoseconds */
+	uint64_t cpu;
+	int kind;
+	int line;
+	char name[1];
+};
+
+struct profframe {
+	struct profent *cmd;	/* NULL until profcommand */
+	struct profent *line;
+	uint64_t wall;		/* when it started */
+	uint64_t cpu;
+	uint64_t child;		/* wall time of the commands it ran */
+};
+
+STATIC SHTLS struct profent **proftab;	/* PROFHASH chains, when used */
+STATIC SHTLS unsigned int profents;
+STATIC SHTLS struct profframe *profstack;
+STATIC SHTLS int profdepth;		/* frames in use */
+STATIC SHTLS int profsize;		/* frames allocated */
+STATIC SHTLS char *stackname;		/* for building PROF_STACK names */
+STATIC SHTLS size_t stacknamesize;
+
+STATIC uint64_t profclock(void);
+STATIC uint64_t profcpu(void);
+STATIC struct profent *proflookup(int, int, const char *);
+STATIC const char *profname(struct profframe *);
+STATIC void profstackent(int, uint64_t);
+STATIC int profcmp(const void *, const void *);
+STATIC void proftable(struct output *, struct profent **, int, int);
+STATIC int profopen(const char *, int);
+
+
+STATIC uint64_t
+profclock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * CPU time of the shell and of the children it has waited for, so that
+ * an external command is charged for what it used.
+ */
+
+STATIC uint64_t
+profcpu(void)
+{
+	struct rusage self, kids;
+	uint64_t usec;
+
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &kids);
+	usec = (uint64_t)(self.ru_utime.tv_sec + self.ru_stime.tv_sec +
+			  kids.ru_utime.tv_sec + kids.ru_stime.tv_sec) * 1000000;
+	usec += self.ru_utime.tv_usec + self.ru_stime.tv_usec +
+		kids.ru_utime.tv_usec + kids.ru_stime.tv_usec;
+	return usec * 1000;
+}
+
+
+STATIC struct profent *
+proflookup(int kind, int line, const char *name)
+{
+	struct profent **pp;
+	struct profent *ep;
+	unsigned int hashval;
+	const char *p;
+
+	if (proftab == NULL) {
+		proftab = ckmalloc(PROFHASH * sizeof (struct profent *));
+		memset(proftab, 0, PROFHASH * sizeof (struct profent *));
+	}
+	hashval = kind * 31 + line;
+	for (p = name ; *p ; p++)
+		hashval = hashval * 33 + (unsigned char)*p;
+	pp = &proftab[hashval & (PROFHASH - 1)];
+	for (ep = *pp ; ep ; ep = ep->next)
+		if (ep->kind == kind && ep->line == line &&
+		    equal(ep->name, name))
+			return ep;
+	ep = ckmalloc(sizeof (struct profent) + strlen(name));
+	ep->next = *pp;
+	ep->count = 0;
+	ep->wall = ep->cpu = 0;
+	ep->kind = kind;
+	ep->line = line;
+	strcpy(ep->name, name);
+	*pp = ep;
+	profents++;
+	return ep;
+}
+
+
+/*
+ * Start timing a command at line, before its words are expanded.
+ * Returns its frame, which goes to profcommand and profend.
+ */
+
+int
+profstart(int line)
+{
+	struct profframe *fp;
+	const char *func;
+	int i;
+
+	INTOFF;
+	if (profdepth == profsize) {
+		profsize = profsize * 2 + 16;
+		profstack = ckrealloc(profstack,
+				      profsize * sizeof (struct profframe));
+	}
+	func = "main";
+	for (i = profdepth ; --i >= 0 ; ) {
+		struct profent *ep = profstack[i].cmd;
+
+		if (ep && ep->kind == PROF_CMD + CMDFUNCTION) {
+			func = ep->name;
+			break;
+		}
+	}
+	fp = &profstack[profdepth];
+	fp->cmd = NULL;
+	fp->line = proflookup(PROF_LINE, line, func);
+	fp->child = 0;
+	fp->wall = profclock();
+	fp->cpu = profcpu();
+	INTON;
+	return profdepth++;
+}
+
+
+/*
+ * Say what the command in frame turned out to be.
+ */
+
+void
+profcommand(int frame, int cmdtype, const char *name)
+{
+	INTOFF;
+	profstack[frame].cmd = proflookup(PROF_CMD + cmdtype, 0, name);
+	INTON;
+}
+
+
+/*
+ * Stop timing frame, and any frames above it that an exception left
+ * behind.
+ */
+
+void
+profend(int frame)
+{
+	struct profframe *fp;
+	uint64_t wall, cpu;
+
+	if (profdepth <= frame)
+		return;
+	cpu = profcpu();
+	wall = profclock();
+	INTOFF;
+	while (profdepth > frame) {
+		uint64_t w, c;
+
+		fp = &profstack[--profdepth];
+		w = wall - fp->wall;
+		c = cpu - fp->cpu;
+		if (!fp->cmd)
+			fp->cmd = proflookup(PROF_CMD + CMDBUILTIN, 0,
+					     "(no command)");
+		fp->cmd->count++;
+		fp->cmd->wall += w;
+		fp->cmd->cpu += c;
+		fp->line->count++;
+		fp->line->wall += w;
+		fp->line->cpu += c;
+		profstackent(profdepth, w - fp->child);
+		if (profdepth)
+			fp[-1].child += w;
+	}
+	INTON;
+}
+
+
+/*
+ * A frame with no command yet is still expanding its words, and what
+ * is above it is a command substitution.
+ */
+
+STATIC const char *
+profname(struct profframe *fp)
+{
+	return fp->cmd ? fp->cmd->name : "(expansion)";
+}
+
+
+/*
+ * Add self nanoseconds to the collapsed stack ending in frame.
+ */
+
+STATIC void
+profstackent(int frame, uint64_t self)
+{
+	struct profent *ep;
+	size_t len;
+	char *p;
+	int i;
+
+	len = sizeof("main");
+	for (i = 0 ; i <= frame ; i++)
+		len += strlen(profname(&profstack[i])) + 1;
+	if (len > stacknamesize) {
+		stacknamesize = len + 64;
+		stackname = ckrealloc(stackname, stacknamesize);
+	}
+	p = stpcpy(stackname, "main");
+	for (i = 0 ; i <= frame ; i++) {
+		*p++ = ';';
+		p = stpcpy(p, profname(&profstack[i]));
+	}
+	ep = proflookup(PROF_STACK, 0, stackname);
+	ep->count++;
+	ep->wall += self;
+}
+
+
+STATIC int
+profcmp(const void *a, const void *b)
+{
+	const struct profent *x = *(struct profent *const *)a;
+	const struct profent *y = *(struct profent *const *)b;
+
+	if (x->wall != y->wall)
+		return x->wall < y->wall ? 1 : -1;
+	return strcmp(x->name, y->name);
+}
+
+
+STATIC void
+proftable(struct output *out, struct profent **list, int n, int cmds)
+{
+	static const char *const types[] = {
+		"missing", "external", "function", "builtin", "toy",
+	};
+	struct profent *ep;
+	int i;
+
+	outfmt(out, "%8s %12s %12s  %s\n", "calls", "wall ms", "cpu ms",
+	       cmds ? "type     command" : "line");
+	for (i = 0 ; i < n ; i++) {
+		ep = list[i];
+		if (cmds ? ep->kind < PROF_CMD - 1 : ep->kind != PROF_LINE)
+			continue;
+		outfmt(out, "%8lu %8llu.%03u %8llu.%03u  ", ep->count,
+		       (unsigned long long)(ep->wall / 1000000),
+		       (unsigned)(ep->wall / 1000 % 1000),
+		       (unsigned long long)(ep->cpu / 1000000),
+		       (unsigned)(ep->cpu / 1000 % 1000));
+		if (cmds)
+			outfmt(out, "%-8s %s\n",
+			       types[ep->kind - (PROF_CMD - 1)], ep->name);
+		else
+			outfmt(out, "%s:%d\n", ep->name, ep->line);
+	}
+}
+
+
+STATIC int
+profopen(const char *name, int fd)
+{
+	const char *p;
+
+	p = lookupvar(name);
+	if (!p || !*p)
+		return fd;
+	fd = open(p, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		sh_warnx("%s: cannot create %s", name, p);
+	return fd;
+}
+
+
+/*
+ * Write out the report, from the shell that started profiling only.
+ */
+
+void
+profdump(void)
+{
+	struct output out;
+	struct profent **list;
+	struct profent *ep;
+	int i, n;
+
+	if (!profents || getpid() != rootpid)
+		return;
+	profend(0);
+	INTOFF;
+	list = ckmalloc(profents * sizeof (struct profent *));
+	n = 0;
+	for (i = 0 ; i < PROFHASH ; i++)
+		for (ep = proftab[i] ; ep ; ep = ep->next)
+			list[n++] = ep;
+	qsort(list, n, sizeof (struct profent *), profcmp);
+
+	out.nextc = out.end = out.buf = NULL;
+	out.bufsize = BUFSIZ;
+	out.flags = 0;
+	if ((out.fd = profopen("SHPROF", 2)) >= 0) {
+		proftable(&out, list, n, 1);
+		outcslow('\n', &out);
+		proftable(&out, list, n, 0);
+		flushout(&out);
+		if (out.fd != 2)
+			close(out.fd);
+	}
+	if ((out.fd = profopen("SHPROF_STACKS", -1)) >= 0) {
+		for (i = 0 ; i < n ; i++)
+			if (list[i]->kind == PROF_STACK)
+				outfmt(&out, "%s %llu\n", list[i]->name,
+				       (unsigned long long)(list[i]->wall /
+							    1000));
+		flushout(&out);
+		close(out.fd);
+	}
+	if (out.buf)
+		ckfree(out.buf);
+	ckfree(list);
+	INTON;
+}
@@ -40,13 +40,17 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 /*
  * Code for dealing with input/output redirection.
  */
 
-#include "main.h"
 #include "shell.h"
+#include "main.h"
 #include "nodes.h"
 #include "jobs.h"
 #include "options.h"
@@ -55,6 +59,9 @@
 #include "output.h"
 #include "memalloc.h"
 #include "error.h"
+#include "toylib/trace.h"
+#include "eval.h"
+#include "var.h"
 
 
 #define REALLY_CLOSED -3	/* fd that was closed and still is */
@@ -72,10 +79,21 @@ MKINIT
 struct redirtab {
 	struct redirtab *next;
 	int renamed[10];
+	int subshell;		/* keeps what exec does, see popredir */
 };
 
 
-MKINIT struct redirtab *redirlist;
+MKINIT SHTLS struct redirtab *redirlist;
+
+/*
+ * A copy of each of the shell's own standard descriptors at 10 or
+ * above, made the first time a redirection saves it and kept, so the
+ * next one needn't copy it again and undoing it is a dup2.  A copy
+ * only stands for the descriptor while no frame has it saved: one
+ * that something changes for good (exec, or a child setting up its
+ * pipes) throws the copy away.
+ */
+STATIC SHTLS int stdsave[3] = { -1, -1, -1 };
 
 STATIC int openredirect(union node *);
 #ifdef notyet
@@ -84,6 +102,8 @@ STATIC void dupredirect(union node *, int, char[10]);
 STATIC void dupredirect(union node *, int);
 #endif
 STATIC int openhere(union node *);
+STATIC int savestdfd(int);
+STATIC void dropstdsave(int);
 
 
 /*
@@ -112,6 +132,7 @@ redirect(union node *redir, int flags)
 #endif
 	if (!redir)
 		return;
+	flushall();
 	sv = NULL;
 	INTOFF;
 	if (likely(flags & REDIR_PUSH))
@@ -123,6 +144,8 @@ redirect(union node *redir, int flags)
 			continue;
 
 		fd = n->nfile.fd;
+		toy_trace(redirect, n->nfile.type <= NAPPEND ?
+			  n->nfile.expfname : NULL, fd);
 
 		if (sv) {
 			p = &sv->renamed[fd];
@@ -130,7 +153,11 @@ redirect(union node *redir, int flags)
 
 			if (likely(i == EMPTY)) {
 				i = CLOSED;
-				if (fd != newfd) {
+				if (fd == newfd)
+					;
+				else if (fd < 3)
+					i = savestdfd(fd);
+				else {
 					i = savefd(fd, fd);
 					fd = -1;
 				}
@@ -141,7 +168,8 @@ redirect(union node *redir, int flags)
 				i = REALLY_CLOSED;
 
 			*p = i;
-		}
+		} else if (fd < 3)
+			dropstdsave(fd);
 
 		if (fd == newfd)
 			continue;
@@ -287,9 +315,44 @@ err:
 
 
 /*
- * Handle here documents.  Normally we fork off a process to write the
- * data to a pipe.  If the document is short, we can stuff the data in
- * the pipe without forking.
+ * Put a here document that won't fit in a pipe into a file with no
+ * name, a memfd where there are such things and otherwise one unlinked
+ * from $TMPDIR, and return it open at the start.  Returns -1 if the
+ * file can't be made.
+ */
+
+STATIC int
+openherefile(const char *p, size_t len)
+{
+	char name[PATH_MAX];
+	const char *dir;
+	int fd;
+
+#ifdef SYS_memfd_create
+	fd = syscall(SYS_memfd_create, "sh-here", 0);
+	if (fd < 0)
+#endif
+	{
+		if ((dir = lookupvar("TMPDIR")) == NULL || *dir == '\0')
+			dir = "/tmp";
+		if (fmtstr(name, sizeof(name), "%s/sh-hereXXXXXX", dir) >=
+		    (int) sizeof(name) || (fd = mkstemp(name)) < 0)
+			return -1;
+		unlink(name);
+	}
+	if (dxwrite(fd, p, len) || lseek(fd, 0, SEEK_SET) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/*
+ * Handle here documents.  If the document is short, we can stuff the
+ * data in a pipe.  Longer ones go in a file made by openherefile, and
+ * only if that fails do we fork off a process to write them to a pipe,
+ * since forking isn't possible everywhere.
  */
 
 STATIC int
@@ -298,9 +361,7 @@ openhere(union node *redir)
 	char *p;
 	int pip[2];
 	size_t len = 0;
-
-	if (pipe(pip) < 0)
-		sh_error("Pipe call failed");
+	int fd;
 
 	p = redir->nhere.doc->narg.text;
 	if (redir->type == NXHERE) {
@@ -309,6 +370,11 @@ openhere(union node *redir)
 	}
 
 	len = strlen(p);
+	if (len > PIPESIZE && (fd = openherefile(p, len)) >= 0)
+		return fd;
+
+	if (pipe(pip) < 0)
+		sh_error("Pipe call failed");
 	if (len <= PIPESIZE) {
 		dxwrite(pip[1], p, len);
 		goto out;
@@ -334,18 +400,32 @@ out:
 
 
 /*
- * Undo the effects of the last redirection.
+ * Undo the effects of the last redirection.  With drop, as for exec,
+ * they are kept instead, but only until the end of a subshell run in
+ * this process: a saved descriptor that nothing between here and the
+ * subshell's frame has saved already moves down to that frame.
  */
 
 void
 popredir(int drop)
 {
 	struct redirtab *rp;
+	struct redirtab *q;
 	int i;
 
+	flushall();
 	INTOFF;
 	rp = redirlist;
 	for (i = 0 ; i < 10 ; i++) {
+		if (drop && subshell && rp->renamed[i] != EMPTY) {
+			q = rp->next;
+			while (!q->subshell && q->renamed[i] == EMPTY)
+				q = q->next;
+			if (q->subshell && q->renamed[i] == EMPTY) {
+				q->renamed[i] = rp->renamed[i];
+				continue;
+			}
+		}
 		switch (rp->renamed[i]) {
 		case CLOSED:
 			if (!drop)
@@ -357,6 +437,11 @@ popredir(int drop)
 		default:
 			if (!drop)
 				dup2(rp->renamed[i], i);
+			if (i < 3 && rp->renamed[i] == stdsave[i]) {
+				if (!drop)
+					break;
+				stdsave[i] = -1;
+			}
 			close(rp->renamed[i]);
 			break;
 		}
@@ -396,20 +481,82 @@ savefd(int from, int ofd)
 	int newfd;
 	int err;
 
+#ifdef F_DUPFD_CLOEXEC
+	newfd = fcntl(from, F_DUPFD_CLOEXEC, 10);
+#else
 	newfd = fcntl(from, F_DUPFD, 10);
+#endif
 	err = newfd < 0 ? errno : 0;
 	if (err != EBADF) {
-		close(ofd);
+		if (ofd >= 0)
+			close(ofd);
 		if (err)
 			sh_error("%d: %s", from, strerror(err));
-		else
-			fcntl(newfd, F_SETFD, FD_CLOEXEC);
+#ifndef F_DUPFD_CLOEXEC
+		fcntl(newfd, F_SETFD, FD_CLOEXEC);
+#endif
 	}
 
 	return newfd;
 }
 
 
+/*
+ * Save standard descriptor fd for a redirection, with the copy in
+ * stdsave if nothing has fd redirected already.  fd is left open for
+ * dupredirect to replace with dup2 or close.
+ */
+
+STATIC int
+savestdfd(int fd)
+{
+	struct redirtab *rp;
+
+	for (rp = redirlist->next ; rp ; rp = rp->next)
+		if (rp->renamed[fd] != EMPTY)
+			return savefd(fd, -1);
+	if (stdsave[fd] < 0)
+		stdsave[fd] = savefd(fd, -1);
+	return stdsave[fd];
+}
+
+
+/*
+ * Forget the copy of fd, which no longer says what it should be.  A
+ * frame that has it saved still puts it back, and closes it then.
+ */
+
+STATIC void
+dropstdsave(int fd)
+{
+	struct redirtab *rp;
+
+	if (stdsave[fd] < 0)
+		return;
+	for (rp = redirlist ; rp ; rp = rp->next)
+		if (rp->renamed[fd] == stdsave[fd])
+			break;
+	if (!rp)
+		close(stdsave[fd]);
+	stdsave[fd] = -1;
+}
+
+
+/*
+ * Called in a child, which is about to point its standard descriptors
+ * at pipes and such.
+ */
+
+void
+forgetstdsave(void)
+{
+	int i;
+
+	for (i = 0 ; i < 3 ; i++)
+		dropstdsave(i);
+}
+
+
 int
 redirectsafe(union node *redir, int flags)
 {
@@ -451,9 +598,31 @@ struct redirtab *pushredir(union node *redir)
 	sv = ckmalloc(sizeof (struct redirtab));
 	sv->next = q;
 	redirlist = sv;
+	sv->subshell = 0;
 	for (i = 0; i < 10; i++)
 		sv->renamed[i] = EMPTY;
 
 out:
 	return q;
 }
+
+
+/*
+ * Push a frame for a subshell run in this process, which it redirects
+ * into and which exec inside it can't get past.
+ */
+struct redirtab *pushsubredir(void)
+{
+	struct redirtab *sv;
+	struct redirtab *q;
+	int i;
+
+	q = redirlist;
+	sv = ckmalloc(sizeof (struct redirtab));
+	sv->next = q;
+	redirlist = sv;
+	sv->subshell = 1;
+	for (i = 0; i < 10; i++)
+		sv->renamed[i] = EMPTY;
+	return q;
+}
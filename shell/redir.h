@@ -47,7 +47,9 @@ void redirect(union node *, int);
 void popredir(int);
 void clearredir(void);
 int savefd(int, int);
+void forgetstdsave(void);
 int redirectsafe(union node *, int);
 void unwindredir(struct redirtab *stop);
 struct redirtab *pushredir(union node *redir);
+struct redirtab *pushsubredir(void);
 
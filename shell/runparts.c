@@ -0,0 +1,348 @@
+/*-
+ * Copyright (c) 1991, 1993
+ *	The Regents of the University of California.  All rights reserved.
+ * Copyright (c) 1997-2005
+ *	Herbert Xu <herbert@gondor.apana.org.au>.  All rights reserved.
+ *
+ * This code is derived from software contributed to Berkeley by
+ * Kenneth Almquist.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The runparts builtin: run the scripts in a directory, such as the rc
+ * scripts of a boot, in the order their headers ask for.  Each script
+ * is sourced in a subshell of this shell, so a boot costs no forks, and
+ * one that fails only stops the scripts that need it.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shell.h"
+#include "eval.h"
+#include "options.h"
+#include "output.h"
+#include "memalloc.h"
+#include "mystring.h"
+#include "error.h"
+#include "stats.h"
+
+
+#define RUNHEAD		4096	/* bytes of each script searched for headers */
+
+#define PWAIT		0
+#define PDONE		1
+#define PFAILED		2	/* or skipped */
+
+struct part {
+	char *name;
+	char *path;
+	char *requires;		/* words, space separated */
+	char *provides;		/* the same, with name first */
+	int state;
+};
+
+STATIC char *headerwords(char *, const char *);
+STATIC int haveword(const char *, const char *, size_t);
+STATIC char *quoterun(char *, char **);
+
+
+/*
+ * If line is "# key: words...", return the words.
+ */
+
+STATIC char *
+headerwords(char *line, const char *key)
+{
+	char *p;
+
+	for (p = line + 1 ; *p == ' ' || *p == '\t' ; p++)
+		;
+	if (strncasecmp(p, key, strlen(key)))
+		return NULL;
+	return p + strlen(key);
+}
+
+
+STATIC int
+haveword(const char *list, const char *word, size_t len)
+{
+	size_t n;
+
+	for (; *list ; list += n + !!list[n]) {
+		n = strcspn(list, " ");
+		if (n == len && !strncmp(list, word, len))
+			return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Read the comment block a script starts with, for a part with its
+ * requires: and provides: words in a normal form.  The script's own
+ * name is always one of the things it provides.
+ */
+
+STATIC void
+readheaders(struct part *pp)
+{
+	char buf[RUNHEAD + 1];
+	char *line, *next, *words, *p;
+	char *req, *prov;
+	ssize_t len;
+	int fd;
+
+	len = 0;
+	if ((fd = open(pp->path, O_RDONLY)) >= 0) {
+		len = read(fd, buf, RUNHEAD);
+		close(fd);
+	}
+	buf[len > 0 ? len : 0] = '\0';
+	req = stalloc(len + 2);
+	prov = stalloc(strlen(pp->name) + len + 2);
+	*req = '\0';
+	strcpy(prov, pp->name);
+	for (line = buf ; *line == '#' ; line = next) {
+		if ((next = strchr(line, '\n')))
+			*next++ = '\0';
+		else
+			next = "";
+		if ((words = headerwords(line, "requires:")))
+			p = req;
+		else if ((words = headerwords(line, "provides:")))
+			p = prov;
+		else
+			continue;
+		for (;;) {
+			size_t n;
+
+			words += strspn(words, " \t,");
+			if (!(n = strcspn(words, " \t,")))
+				break;
+			if (*p)
+				strcat(p, " ");
+			strncat(p, words, n);
+			words += n;
+		}
+	}
+	pp->requires = req;
+	pp->provides = prov;
+}
+
+
+/*
+ * The command sourcing path in a subshell with positional parameters
+ * args, quoted.  Built on the stack.
+ */
+
+STATIC char *
+quoterun(char *path, char **args)
+{
+	char *p, *s;
+	char **ap;
+
+	STARTSTACKSTR(p);
+	p = stputs("( set --", p);
+	for (ap = args ; ; ap++) {
+		s = *ap ? *ap : path;
+		p = stputs(*ap ? " '" : "; . '", p);
+		for (; *s ; s++) {
+			if (*s == '\'')
+				p = stputs("'\\''", p);
+			else
+				STPUTC(*s, p);
+		}
+		STPUTC('\'', p);
+		if (!*ap)
+			break;
+	}
+	p = stputs(" )", p);
+	STPUTC('\0', p);
+	return grabstackstr(p);
+}
+
+
+/*
+ * runparts [-q] dir [arg ...]
+ *
+ * Run the executable files in dir, not counting dotfiles and backups~,
+ * in name order except that each waits for the scripts providing what
+ * its "# requires:" header line names.  A script that exits non-zero,
+ * or needs one that did, leaves its dependents unrun.  Prints how long
+ * each script took, unless -q, and returns 1 if any failed.
+ */
+
+int
+runpartscmd(int argc, char **argv)
+{
+	struct part *parts, *pp, *dp;
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	char **names, **args;
+	char *dirname, *word, *cmd;
+	uint64_t start;
+	int qflag, nparts, nalloc, waiting, progress, failed;
+	int i, j, c;
+	size_t len;
+
+	qflag = 0;
+	while ((c = nextopt("q")) != '\0')
+		qflag = 1;
+	if (!(dirname = *argptr++))
+		sh_error("usage: runparts [-q] dir [arg ...]");
+	args = argptr;
+
+	INTOFF;
+	if (!(dir = opendir(dirname))) {
+		INTON;
+		sh_error("can't open %s", dirname);
+	}
+	nparts = 0;
+	nalloc = 64;
+	names = ckmalloc(nalloc * sizeof(*names));
+	while ((de = readdir(dir))) {
+		len = strlen(de->d_name);
+		if (*de->d_name == '.' || de->d_name[len - 1] == '~')
+			continue;
+		if (nparts == nalloc)
+			names = ckrealloc(names, (nalloc *= 2) * sizeof(*names));
+		names[nparts++] = savestr(de->d_name);
+	}
+	closedir(dir);
+	qsort(names, nparts, sizeof(*names), pstrcmp);
+
+	parts = stalloc((nparts + 1) * sizeof(*parts));
+	for (i = j = 0 ; i < nparts ; i++) {
+		pp = parts + j;
+		pp->name = sstrdup(names[i]);
+		pp->path = stalloc(strlen(dirname) + strlen(names[i]) + 2);
+		strcat(strcat(strcpy(pp->path, dirname), "/"), names[i]);
+		ckfree(names[i]);
+		if (stat(pp->path, &st) || !S_ISREG(st.st_mode) ||
+		    !(st.st_mode & 0111))
+			continue;
+		pp->state = PWAIT;
+		readheaders(pp);
+		j++;
+	}
+	ckfree(names);
+	nparts = j;
+	INTON;
+
+	/* Anything nobody provides can't be waited for; say so once. */
+	for (pp = parts ; pp < parts + nparts ; pp++) {
+		for (word = pp->requires ; *word ; word += len + !!word[len]) {
+			len = strcspn(word, " ");
+			for (dp = parts ; dp < parts + nparts ; dp++)
+				if (haveword(dp->provides, word, len))
+					break;
+			if (dp == parts + nparts)
+				outfmt(out2, "runparts: %s: nothing provides "
+					"%.*s\n", pp->name, (int)len, word);
+		}
+	}
+
+	/*
+	 * Run the first script (by name) whose requirements are all met,
+	 * or skip the first with one that failed, and look again.
+	 */
+	failed = 0;
+	do {
+		waiting = progress = 0;
+		for (pp = parts ; pp < parts + nparts ; pp++) {
+			char *broken;
+			size_t brokenlen;
+			int blocked;
+
+			if (pp->state != PWAIT)
+				continue;
+			waiting++;
+			blocked = 0;
+			broken = NULL;
+			brokenlen = 0;
+			for (word = pp->requires ; *word && !blocked ;
+			     word += len + !!word[len]) {
+				len = strcspn(word, " ");
+				for (dp = parts ; dp < parts + nparts ; dp++) {
+					if (dp == pp ||
+					    !haveword(dp->provides, word, len))
+						continue;
+					if (dp->state == PWAIT)
+						blocked = 1;
+					else if (dp->state == PFAILED &&
+						 !broken) {
+						broken = word;
+						brokenlen = len;
+					}
+				}
+			}
+			if (blocked)
+				continue;
+			progress = 1;
+			if (broken) {
+				outfmt(out2, "runparts: %s: skipped, needs %.*s\n",
+					pp->name, (int)brokenlen, broken);
+				pp->state = PFAILED;
+				failed = 1;
+				break;
+			}
+			cmd = quoterun(pp->path, args);
+			start = statclock();
+			evalstring(cmd, 0);
+			start = (statclock() - start) / 1000000;
+			pp->state = exitstatus ? PFAILED : PDONE;
+			if (exitstatus) {
+				failed = 1;
+				outfmt(out2, "runparts: %s: %u.%03us, exit %d\n",
+					pp->name, (unsigned)(start / 1000),
+					(unsigned)(start % 1000), exitstatus);
+			} else if (!qflag)
+				outfmt(out2, "runparts: %s: %u.%03us\n",
+					pp->name, (unsigned)(start / 1000),
+					(unsigned)(start % 1000));
+			break;
+		}
+	} while (progress);
+
+	/* All that's left are waiting on each other. */
+	if (waiting) {
+		for (pp = parts ; pp < parts + nparts ; pp++)
+			if (pp->state == PWAIT)
+				outfmt(out2, "runparts: %s: skipped, "
+					"dependency loop\n", pp->name);
+		failed = 1;
+	}
+	return failed;
+}
@@ -71,6 +71,20 @@ typedef void *pointer;
 #define STATIC static
 #define MKINIT	/* empty */
 
+#include "geninc/config.h"
+
+/*
+ * Everything the interpreter changes as it runs is declared SHTLS, so
+ * with threads each one can be running a shell of its own at once (see
+ * shellsession() in main.c).  What no shell writes, syntax.c, the
+ * builtin and keyword tables, toy_list[], is shared.
+ */
+#if CFG_TOYBOX_THREADS
+#define SHTLS __thread
+#else
+#define SHTLS
+#endif
+
 extern char nullstr[1];		/* null string */
 
 
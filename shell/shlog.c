@@ -0,0 +1,171 @@
+/*-
+ * Copyright (c) 1991, 1993
+ *	The Regents of the University of California.  All rights reserved.
+ * Copyright (c) 1997-2005
+ *	Herbert Xu <herbert@gondor.apana.org.au>.  All rights reserved.
+ *
+ * This code is derived from software contributed to Berkeley by
+ * Kenneth Almquist.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The shlog builtin: send a message to syslogd, as logger does, over a
+ * socket the shell keeps open from one call to the next, so a script
+ * can log every time round a loop without starting anything.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#define SYSLOG_NAMES
+#include <syslog.h>
+
+#include "shell.h"
+#include "options.h"
+#include "memalloc.h"
+#include "mystring.h"
+#include "error.h"
+
+
+#ifndef _PATH_LOG
+#define _PATH_LOG	"/dev/log"
+#endif
+
+#define LOGMSG		1024	/* longest message sent */
+
+STATIC SHTLS int logfd = -1;
+
+STATIC int logname(CODE *, const char *);
+STATIC int logsend(const char *, size_t);
+
+
+STATIC int
+logname(CODE *names, const char *name)
+{
+	for (; names->c_name ; names++)
+		if (!strcasecmp(name, names->c_name))
+			return names->c_val;
+	return -1;
+}
+
+
+/*
+ * Send one datagram, connecting first if need be.  If syslogd has gone
+ * away since the last message, connect again and try once more.
+ */
+
+STATIC int
+logsend(const char *msg, size_t len)
+{
+	struct sockaddr_un sun;
+	int try;
+
+	for (try = 0 ; try < 2 ; try++) {
+		if (logfd < 0) {
+			memset(&sun, 0, sizeof(sun));
+			sun.sun_family = AF_UNIX;
+			strcpy(sun.sun_path, _PATH_LOG);
+			if ((logfd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+				return -1;
+			fcntl(logfd, F_SETFD, FD_CLOEXEC);
+			if (connect(logfd, (struct sockaddr *)&sun,
+				    sizeof(sun)) < 0) {
+				close(logfd);
+				logfd = -1;
+				return -1;
+			}
+		}
+		while (send(logfd, msg, len, 0) < 0)
+			if (errno != EINTR)
+				goto again;
+		return 0;
+again:
+		close(logfd);
+		logfd = -1;
+	}
+	return -1;
+}
+
+
+/*
+ * shlog [-p [facility.]level] [-t tag] message ...
+ *
+ * The tag defaults to the name of the script.
+ */
+
+int
+shlogcmd(int argc, char **argv)
+{
+	char msg[LOGMSG];
+	char *tag, *pri, *p;
+	int facility, level, c, len;
+	time_t t;
+
+	facility = LOG_USER;
+	level = LOG_NOTICE;
+	tag = NULL;
+	while ((c = nextopt("p:t:")) != '\0') {
+		if (c == 't') {
+			tag = optionarg;
+			continue;
+		}
+		pri = optionarg;
+		if ((p = strchr(pri, '.'))) {
+			*p = '\0';
+			if ((facility = logname(facilitynames, pri)) < 0)
+				sh_error("bad facility: %s", pri);
+			pri = p + 1;
+		}
+		if ((level = logname(prioritynames, pri)) < 0)
+			sh_error("bad priority: %s", pri);
+	}
+	if (!tag) {
+		tag = arg0;
+		if ((p = strrchr(tag, '/')))
+			tag = p + 1;
+	}
+
+	time(&t);
+	len = snprintf(msg, sizeof(msg), "<%d>%.15s %s:", facility | level,
+		       ctime(&t) + 4, tag);
+	for (argv = argptr ; *argv && len < sizeof(msg) ; argv++)
+		len += snprintf(msg + len, sizeof(msg) - len, " %s", *argv);
+	if (len >= sizeof(msg))
+		len = sizeof(msg) - 1;
+
+	if (logsend(msg, len) < 0) {
+		sh_warnx("%s: %s", _PATH_LOG, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,349 @@
+/*-
+ * Copyright (c) 1991, 1993
+ *	The Regents of the University of California.  All rights reserved.
+ * Copyright (c) 1997-2005
+ *	Herbert Xu <herbert@gondor.apana.org.au>.  All rights reserved.
+ *
+ * This code is derived from software contributed to Berkeley by
+ * Kenneth Almquist.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hot path counters, for watching a long running shell.  The counters
+ * themselves are bumped where things happen; this file keeps the time
+ * spent in each toy command and has the builtin that reports it all,
+ * and the one that prints the event rings of toylib/trace.c.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shell.h"
+#include "options.h"
+#include "output.h"
+#include "memalloc.h"
+#include "mystring.h"
+#include "error.h"
+#include "var.h"
+#include "stats.h"
+#include "toys.h"
+
+
+#define TOYSTATHASH	64
+
+struct toystat {
+	struct toystat *next;
+	const struct toy_list *cmd;
+	unsigned long runs;
+	uint64_t time;		/* nanoseconds */
+};
+
+SHTLS struct shstat shstat;
+
+STATIC SHTLS struct toystat *toystats[TOYSTATHASH];
+
+STATIC void statreset(void);
+
+
+uint64_t
+statclock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * Count a run of cmd that started at statclock() time start.
+ */
+
+void
+toystat(const struct toy_list *cmd, uint64_t start)
+{
+	struct toystat **pp;
+	struct toystat *tp;
+	uint64_t now;
+
+	now = statclock();
+	INTOFF;
+	pp = &toystats[((uintptr_t)cmd / sizeof(*cmd)) % TOYSTATHASH];
+	for (tp = *pp ; tp ; tp = tp->next)
+		if (tp->cmd == cmd)
+			break;
+	if (!tp) {
+		tp = ckmalloc(sizeof(*tp));
+		tp->next = *pp;
+		tp->cmd = cmd;
+		tp->runs = 0;
+		tp->time = 0;
+		*pp = tp;
+	}
+	tp->runs++;
+	tp->time += now - start;
+	INTON;
+}
+
+
+/*
+ * For times -v and -m: what each toy run inside this shell used, times
+ * in its own thread's clocks, with toylib's counts of its I/O and the
+ * most heap one run had.
+ */
+
+void
+toytimes(int keys)
+{
+	struct toy_usage *tu;
+	const char *name;
+	int i;
+
+	for (i = 0 ; i < toy_count ; i++) {
+		tu = &toy_total[i];
+		if (!tu->runs)
+			continue;
+		name = toy_list[i].name;
+		if (keys)
+			out1fmt("toy_%s_runs=%lu\ntoy_%s_real_usec=%llu\n"
+				"toy_%s_user_usec=%llu\ntoy_%s_sys_usec=%llu\n"
+				"toy_%s_heap_peak=%lu\n"
+				"toy_%s_read_bytes=%llu\ntoy_%s_read_calls=%lu\n"
+				"toy_%s_write_bytes=%llu\n"
+				"toy_%s_write_calls=%lu\ntoy_%s_opens=%lu\n",
+				name, tu->runs, name, tu->wall / 1000,
+				name, tu->user / 1000, name, tu->sys / 1000,
+				name, tu->heap,
+				name, tu->io.rbytes, name, tu->io.reads,
+				name, tu->io.wbytes,
+				name, tu->io.writes, name, tu->io.opens);
+		else
+			out1fmt("%s: %lu runs, %fs real %fs user %fs sys, "
+				"heap peak %lu, read %llu bytes in %lu calls, "
+				"wrote %llu in %lu, opened %lu\n",
+				name, tu->runs, tu->wall / 1e9,
+				tu->user / 1e9, tu->sys / 1e9, tu->heap,
+				tu->io.rbytes, tu->io.reads,
+				tu->io.wbytes, tu->io.writes, tu->io.opens);
+	}
+}
+
+
+STATIC void
+statreset(void)
+{
+	struct toystat *tp, *next;
+	int i;
+
+	INTOFF;
+	memset(&shstat, 0, sizeof(shstat));
+	for (i = 0 ; i < TOYSTATHASH ; i++) {
+		for (tp = toystats[i] ; tp ; tp = next) {
+			next = tp->next;
+			ckfree(tp);
+		}
+		toystats[i] = NULL;
+	}
+	INTON;
+}
+
+
+/*
+ * shellstat [-m] [-r] [-t]
+ *
+ * Print the counters, as key=value lines with -m, and with -r start
+ * them again from zero once they have been printed.  With -t print
+ * only the time on the clock the toys are timed by, in microseconds,
+ * for a script to time itself with.
+ */
+
+int
+shellstatcmd(int argc, char **argv)
+{
+	struct toystat *tp;
+	unsigned int nvars, size, longest, used;
+	int keys, reset;
+	int i, c;
+
+	keys = reset = 0;
+	while ((c = nextopt("mrt")) != '\0') {
+		if (c == 'm')
+			keys = 1;
+		else if (c == 'r')
+			reset = 1;
+		else {
+			out1fmt("%llu\n",
+				(unsigned long long)(statclock() / 1000));
+			return 0;
+		}
+	}
+	varchains(&nvars, &size, &longest, &used);
+
+	if (keys) {
+		out1fmt(
+			"stalloc_bytes=%lu\nstalloc_calls=%lu\n"
+			"stack_grows=%lu\nstack_blocks=%lu\n"
+			"cmdlookup_hits=%lu\ncmdlookup_misses=%lu\n"
+			"var_lookups=%lu\nvar_probes=%lu\n"
+			"var_count=%u\nvar_chains=%u\n"
+			"var_chains_used=%u\nvar_chain_max=%u\n"
+			"output_flushes=%lu\ninput_reads=%lu\n",
+			shstat.stbytes, shstat.stallocs,
+			shstat.stgrows, shstat.stblocks,
+			shstat.cmdhits, shstat.cmdmisses,
+			shstat.varlookups, shstat.varprobes,
+			nvars, size, used, longest,
+			shstat.outflushes, shstat.inreads);
+	} else {
+		out1fmt(
+			"stack     %lu bytes in %lu stallocs, %lu grows, "
+			"%lu new blocks\n"
+			"commands  %lu lookups found, %lu not\n"
+			"variables %lu lookups, %lu chain entries looked at\n"
+			"          %u in %u chains, %u used, longest %u\n"
+			"output    %lu flushes\n"
+			"input     %lu reads\n",
+			shstat.stbytes, shstat.stallocs, shstat.stgrows,
+			shstat.stblocks,
+			shstat.cmdhits, shstat.cmdmisses,
+			shstat.varlookups, shstat.varprobes,
+			nvars, size, used, longest,
+			shstat.outflushes, shstat.inreads);
+	}
+	for (i = 0 ; i < TOYSTATHASH ; i++) {
+		for (tp = toystats[i] ; tp ; tp = tp->next) {
+			if (keys)
+				out1fmt("toy_%s_runs=%lu\ntoy_%s_usec=%llu\n",
+					tp->cmd->name, tp->runs,
+					tp->cmd->name,
+					(unsigned long long)(tp->time / 1000));
+			else
+				out1fmt("toy       %lu runs of %s, %llu usec\n",
+					tp->runs, tp->cmd->name,
+					(unsigned long long)(tp->time / 1000));
+		}
+	}
+	if (reset)
+		statreset();
+	return 0;
+}
+
+
+#if CFG_TOYBOX_TRACE
+/*
+ * The events named in a comma separated list, as a bit mask.  A name
+ * picks the event of that name, or the events it is the first part
+ * of, so "toy" is toy_start and toy_end.
+ */
+
+STATIC int
+tracemask(const char *list)
+{
+	const char *p;
+	size_t len;
+	int mask, i, m;
+
+	mask = 0;
+	for (p = list ; *p ; p += len + (p[len] == ',')) {
+		len = strchrnul(p, ',') - p;
+		m = 0;
+		for (i = 0 ; i < TRACE_COUNT ; i++)
+			if (!strncmp(trace_names[i], p, len) &&
+			    (trace_names[i][len] == '\0' ||
+			     trace_names[i][len] == '_'))
+				m |= 1 << i;
+		if (!len || !m)
+			sh_error("%.*s: no such event", (int)len, p);
+		mask |= m;
+	}
+	return mask;
+}
+#endif
+
+
+/*
+ * trace [-c] [-e event[,event...]] [-n count]
+ *
+ * Print what is in the trace rings, oldest first, one event a line:
+ * the time in seconds, the ring (one a thread), the event, its string
+ * and its number.  -e prints only the events named, -n only the last
+ * count of them, and -c empties the rings instead.
+ */
+
+int
+tracecmd(int argc, char **argv)
+{
+#if CFG_TOYBOX_TRACE
+	struct trace_event *ev;
+	const char *events;
+	int mask, count, skip, cflag;
+	int n, i, c;
+
+	events = NULL;
+	count = -1;
+	cflag = 0;
+	while ((c = nextopt("ce:n:")) != '\0') {
+		if (c == 'c')
+			cflag = 1;
+		else if (c == 'e')
+			events = optionarg;
+		else
+			count = number(optionarg);
+	}
+	if (cflag) {
+		trace_clear();
+		return 0;
+	}
+	mask = events ? tracemask(events) : ~0;
+
+	INTOFF;
+	ev = trace_snapshot(&n);
+	skip = 0;
+	for (i = 0 ; i < n ; i++)
+		if (mask & 1 << ev[i].type)
+			skip++;
+	skip = count < 0 || skip < count ? 0 : skip - count;
+	for (i = 0 ; i < n ; i++) {
+		if (!(mask & 1 << ev[i].type) || skip-- > 0)
+			continue;
+		out1fmt("%llu.%06llu %u %s %s %lld\n",
+			ev[i].ns / 1000000000,
+			ev[i].ns / 1000 % 1000000,
+			ev[i].ring, trace_names[ev[i].type],
+			*ev[i].str ? ev[i].str : "-", ev[i].num);
+	}
+	free(ev);
+	INTON;
+	return 0;
+#else
+	sh_error("not compiled in");
+	/* NOTREACHED */
+	return 2;
+#endif
+}
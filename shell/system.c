@@ -57,6 +57,7 @@
 #include <signal.h>
 #include <string.h>
 
+#include "shell.h"
 #include "error.h"
 #include "output.h"
 #include "system.h"
@@ -50,6 +50,7 @@
 #include "error.h"
 #include "trap.h"
 #include "mystring.h"
+#include "profile.h"
 
 #ifdef HETIO
 #include "hetio.h"
@@ -69,20 +70,35 @@
 
 
 /* trap handler commands */
-static char *trap[NSIG];
+static SHTLS char *trap[NSIG];
 /* number of non-null traps */
-int trapcnt;
+SHTLS int trapcnt;
 /* current value of signal */
-char sigmode[NSIG - 1];
+SHTLS char sigmode[NSIG - 1];
 /* indicates specified signal received */
-static char gotsig[NSIG - 1];
+static SHTLS char gotsig[NSIG - 1];
 /* last pending signal */
-volatile sig_atomic_t pendingsigs;
+SHTLS volatile sig_atomic_t pendingsigs;
 /* received SIGCHLD */
-int gotsigchld;
+SHTLS int gotsigchld;
 
 extern char *signal_names[];
 
+/*
+ * The traps a subshell run in this process started with, saved when it
+ * cleared them or first ran trap.
+ */
+struct trapsave {
+	struct trapsave *next;
+	int nest;		/* the subshell */
+	int cnt;		/* its trapcnt */
+	char *trap[NSIG];
+};
+
+static SHTLS struct trapsave *trapsaved;
+
+static void savetraps(void);
+
 #ifdef mkinit
 INCLUDE "trap.h"
 INIT {
@@ -122,6 +138,11 @@ trapcmd(int argc, char **argv)
 		action = NULL;
 	else
 		action = *ap++;
+	if (subshell && (!trapsaved || trapsaved->nest != subshell)) {
+		INTOFF;
+		savetraps();
+		INTON;
+	}
 	while (*ap) {
 		if ((signo = decode_signal(*ap, 0)) < 0) {
 			outfmt(out2, "trap: %s: bad trap\n", *ap);
@@ -177,6 +198,99 @@ clear_traps(void)
 
 
 
+/*
+ * Save the traps for the innermost subshell.  The copies left in trap[]
+ * are its own, to change or free.
+ * Called with interrupts off.
+ */
+
+static void
+savetraps(void)
+{
+	struct trapsave *tp;
+	int i;
+
+	tp = ckmalloc(sizeof(*tp));
+	tp->next = trapsaved;
+	tp->nest = subshell;
+	tp->cnt = trapcnt;
+	for (i = 0 ; i < NSIG ; i++) {
+		tp->trap[i] = trap[i];
+		if (trap[i])
+			trap[i] = savestr(trap[i]);
+	}
+	trapsaved = tp;
+}
+
+
+
+/*
+ * Clear traps for a subshell run in this process, as a fork would.
+ */
+
+void
+pushsubtraps(void)
+{
+	if (!trapcnt)
+		return;
+	INTOFF;
+	savetraps();
+	clear_traps();
+	INTON;
+}
+
+
+
+/*
+ * Put back the traps the innermost subshell started with.
+ */
+
+void
+popsubtraps(void)
+{
+	struct trapsave *tp;
+	char *t;
+	int i;
+
+	tp = trapsaved;
+	if (!tp || tp->nest != subshell)
+		return;
+	INTOFF;
+	trapsaved = tp->next;
+	for (i = 0 ; i < NSIG ; i++) {
+		t = trap[i];
+		trap[i] = tp->trap[i];
+		if (t)
+			ckfree(t);
+		if (i && (t || trap[i]))
+			setsignal(i);
+	}
+	trapcnt = tp->cnt;
+	ckfree(tp);
+	INTON;
+}
+
+
+
+/*
+ * Run the EXIT trap the innermost subshell set, if it set one.
+ */
+
+void
+subexittrap(void)
+{
+	char *p;
+
+	if (!trapsaved || trapsaved->nest != subshell || !(p = trap[0]))
+		return;
+	trap[0] = NULL;
+	evalskip = 0;
+	evalstring(p, 0);
+	ckfree(p);
+}
+
+
+
 /*
  * Set the signal handler for the specified signal.  The routine figures
  * out what it should be set to.
@@ -347,7 +461,7 @@ void dotrap(void)
 void
 setinteractive(int on)
 {
-	static int is_interactive;
+	static SHTLS int is_interactive;
 
 	if (++on == is_interactive)
 		return;
@@ -394,6 +508,17 @@ out:
 	if (likely(!setjmp(loc.loc)))
 		setjobctl(0);
 	flushall();
+	if (likely(!setjmp(loc.loc)))
+		profdump();
+#if CFG_TOYBOX_THREADS
+	/* Not in a child forked from the shell. */
+	if (sessionexit && getpid() == rootpid) {
+		if (likely(!setjmp(loc.loc)))
+			endthreads();
+		sessionstatus = status;
+		longjmp(*sessionexit, 1);
+	}
+#endif
 	_exit(status);
 	/* NOTREACHED */
 }
@@ -36,13 +36,16 @@
 
 #include <signal.h>
 
-extern int trapcnt;
-extern char sigmode[];
-extern volatile sig_atomic_t pendingsigs;
-extern int gotsigchld;
+extern SHTLS int trapcnt;
+extern SHTLS char sigmode[];
+extern SHTLS volatile sig_atomic_t pendingsigs;
+extern SHTLS int gotsigchld;
 
 int trapcmd(int, char **);
 void clear_traps(void);
+void pushsubtraps(void);
+void popsubtraps(void);
+void subexittrap(void);
 void setsignal(int);
 void ignoresig(int);
 void onsig(int);
@@ -45,9 +45,11 @@
 
 #include "shell.h"
 #include "output.h"
+#include "eval.h"
 #include "expand.h"
 #include "nodes.h"	/* for other headers */
 #include "exec.h"
+#include "jobs.h"
 #include "syntax.h"
 #include "options.h"
 #include "mail.h"
@@ -57,21 +59,29 @@
 #include "mystring.h"
 #include "parser.h"
 #include "show.h"
+#include "stats.h"
 #ifndef SMALL
 #include "myhistedit.h"
 #endif
 #include "system.h"
 
 
-#define VTABSIZE 39
+#define VTABSIZE 64		/* initial size, must be a power of 2 */
 
 
 struct localvar_list {
 	struct localvar_list *next;
 	struct localvar *lv;
+	int depth;		/* the localvar_depth it is for */
 };
 
-MKINIT struct localvar_list *localvar_stack;
+/*
+ * Every simple command and function call pushes a scope, but few of
+ * them make anything local, so a scope is only a count until then.
+ */
+MKINIT SHTLS struct localvar_list *localvar_stack;
+STATIC SHTLS int localvar_depth;
+STATIC SHTLS struct localvar_list *subvar_stack;
 
 const char defpathvar[] =
 	"PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
@@ -81,18 +91,18 @@ const char defifsvar[] = "IFS= \t\n";
 const char defifs[] = " \t\n";
 #endif
 
-int lineno;
-char linenovar[sizeof("LINENO=")+sizeof(int)*CHAR_BIT/3+1] = "LINENO=";
+SHTLS int lineno;
+SHTLS char linenovar[sizeof("LINENO=")+sizeof(int)*CHAR_BIT/3+1] = "LINENO=";
 
 /* Some macros in var.h depend on the order, add new variables to the end. */
-struct var varinit[] = {
+SHTLS struct var varinit[] = {
 #if ATTY
 	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"ATTY\0",	0 },
 #endif
 #ifdef IFS_BROKEN
-	{ 0,	VSTRFIXED|VTEXTFIXED,		defifsvar,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		defifsvar,	changeifs },
 #else
-	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"IFS\0",	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"IFS\0",	changeifs },
 #endif
 	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"MAIL\0",	changemail },
 	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"MAILPATH\0",	changemail },
@@ -102,25 +112,55 @@ struct var varinit[] = {
 	{ 0,	VSTRFIXED|VTEXTFIXED,		"PS4=+ ",	0 },
 	{ 0,	VSTRFIXED|VTEXTFIXED,		"OPTIND=1",	getoptsreset },
 #ifdef WITH_LINENO
-	{ 0,	VSTRFIXED|VTEXTFIXED,		linenovar,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		0,		0 },	/* linenovar */
 #endif
 #ifndef SMALL
 	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"TERM\0",	0 },
 	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"HISTSIZE\0",	sethistsize },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"HISTFILE\0",	sethistfile },
 #endif
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"TOYWORKERS\0",	settoyworkers },
 };
 
-STATIC struct var *vartab[VTABSIZE];
+STATIC SHTLS struct var **vartab;
+STATIC SHTLS unsigned int vtabsize;		/* number of chains, a power of 2 */
+STATIC SHTLS unsigned int nvars;		/* number of variables */
+SHTLS unsigned int varsfreed;			/* bumped when a struct var is freed */
+SHTLS unsigned int envgen;			/* bumped when an export changes */
+
+/*
+ * The environment made for the last exec or toy, still good while
+ * envgen hasn't moved.  See environment().
+ */
+STATIC SHTLS char **envcache;
+STATIC SHTLS unsigned int envcachegen;
+STATIC SHTLS size_t envcount;
+STATIC SHTLS char **envretired;
+
+/*
+ * Spare structures for local variable scopes, which come and go with
+ * every function call, so making a variable local doesn't go back to
+ * malloc each time.
+ */
+STATIC SHTLS struct localvar *lvspare;
+STATIC SHTLS struct localvar_list *llspare;
 
-STATIC struct var **hashvar(const char *);
+STATIC unsigned int hashvar(const char *, unsigned int *);
 STATIC int vpcmp(const void *, const void *);
-STATIC struct var **findvar(struct var **, const char *);
+STATIC struct var **findvar(const char *);
+STATIC struct var *setvareqat(struct var **, char *, int);
+STATIC void dropvar(struct var *);
+STATIC struct localvar *newlocalvar(void);
+STATIC struct localvar_list *newlocallist(void);
+STATIC void growvartab(void);
+STATIC void savesubvar(struct var *, int);
 
 /*
  * Initialize the varable symbol tables and import the environment
  */
 
 #ifdef mkinit
+INCLUDE "parser.h"
 INCLUDE <unistd.h>
 INCLUDE <sys/types.h>
 INCLUDE <sys/stat.h>
@@ -130,7 +170,7 @@ INCLUDE "var.h"
 MKINIT char **environ;
 INIT {
 	char **envp;
-	static char ppid[32] = "PPID=";
+	static SHTLS char ppid[32] = "PPID=";
 	const char *p;
 	struct stat st1, st2;
 
@@ -173,12 +213,18 @@ initvar(void)
 	struct var *end;
 	struct var **vpp;
 
+#ifdef WITH_LINENO
+	vlineno.text = linenovar;
+#endif
 	vp = varinit;
 	end = vp + sizeof(varinit) / sizeof(varinit[0]);
+	growvartab();
 	do {
-		vpp = hashvar(vp->text);
+		vp->hashval = hashvar(vp->text, &vp->namelen);
+		vpp = &vartab[vp->hashval & (vtabsize - 1)];
 		vp->next = *vpp;
 		*vpp = vp;
+		nvars++;
 	} while (++vp < end);
 	/*
 	 * PS1 depends on uid
@@ -251,11 +297,21 @@ intmax_t setvarint(const char *name, intmax_t val, int flags)
 
 struct var *setvareq(char *s, int flags)
 {
-	struct var *vp, **vpp;
+	return setvareqat(findvar(s), s, flags);
+}
+
+
+/*
+ * The rest of setvareq, for a caller that has already looked s up and
+ * found where it goes in vartab.
+ */
+
+STATIC struct var *
+setvareqat(struct var **vpp, char *s, int flags)
+{
+	struct var *vp;
 
-	vpp = hashvar(s);
 	flags |= (VEXPORT & (((unsigned) (1 - aflag)) - 1));
-	vpp = findvar(vpp, s);
 	vp = *vpp;
 	if (vp) {
 		if (vp->flags & VREADONLY) {
@@ -271,9 +327,14 @@ struct var *setvareq(char *s, int flags)
 		if (flags & VNOSET)
 			goto out;
 
+		if (vp->nest != subshell)
+			savesubvar(vp, 0);
+
 		if (vp->func && (flags & VNOFUNC) == 0)
 			(*vp->func)(strchrnul(s, '=') + 1);
 
+		if ((vp->flags | flags) & VEXPORT)
+			envgen++;
 		if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
 			ckfree(vp->text);
 
@@ -281,6 +342,8 @@ struct var *setvareq(char *s, int flags)
 		     (vp->flags & VSTRFIXED)) == VUNSET) {
 			*vpp = vp->next;
 			ckfree(vp);
+			nvars--;
+			varsfreed++;
 out_free:
 			if ((flags & (VTEXTFIXED|VSTACK|VNOSAVE)) == VNOSAVE)
 				ckfree(s);
@@ -295,12 +358,23 @@ out_free:
 			goto out_free;
 		/* not found */
 		vp = ckmalloc(sizeof (*vp));
+		vp->hashval = hashvar(s, &vp->namelen);
+		if (++nvars > vtabsize)
+			growvartab();
+		vpp = &vartab[vp->hashval & (vtabsize - 1)];
 		vp->next = *vpp;
 		vp->func = NULL;
+		vp->nest = 0;
 		*vpp = vp;
+		if (subshell) {
+			savesubvar(vp, 1);
+			flags |= VSTRFIXED;
+		}
 	}
 	if (!(flags & (VTEXTFIXED|VSTACK|VNOSAVE)))
 		s = savestr(s);
+	if (flags & VEXPORT)
+		envgen++;
 	vp->text = s;
 	vp->flags = flags;
 
@@ -337,9 +411,30 @@ listsetvar(struct strlist *list, int flags)
 char *
 lookupvar(const char *name)
 {
-	struct var *v;
+	return vpvalue(*findvar(name));
+}
+
+
+/*
+ * Find a variable's entry, set or not, for someone who wants to keep
+ * it.  It stays good until varsfreed changes.
+ */
+
+struct var *
+lookupvp(const char *name)
+{
+	return *findvar(name);
+}
+
 
-	if ((v = *findvar(hashvar(name), name)) && !(v->flags & VUNSET)) {
+/*
+ * The value of the variable with entry v, or NULL if it isn't set.
+ */
+
+char *
+vpvalue(struct var *v)
+{
+	if (v && !(v->flags & VUNSET)) {
 #ifdef WITH_LINENO
 		if (v == &vlineno && v->text == linenovar) {
 			fmtstr(linenovar+7, sizeof(linenovar)-7, "%d", lineno);
@@ -379,7 +474,7 @@ listvars(int on, int off, char ***end)
 					ep = growstackstr();
 				*ep++ = (char *) vp->text;
 			}
-	} while (++vpp < vartab + VTABSIZE);
+	} while (++vpp < vartab + vtabsize);
 	if (ep == stackstrend())
 		ep = growstackstr();
 	if (end)
@@ -390,6 +485,71 @@ listvars(int on, int off, char ***end)
 
 
 
+/*
+ * The exported variables, as an environment for exec or for a toy,
+ * which finds it in environ.  Making it walks the whole table, so it's
+ * kept until an export changes.  The strings are copied into the same
+ * block since the variables' own can be freed while a background toy is
+ * still reading its environment, and such a toy keeps the block it
+ * started with: one replaced while any are running is only freed once
+ * they have all been reaped.  A toy may setenv() or unsetenv(), which
+ * changes the array in place, so a spare copy of it puts that right
+ * before it's handed out again.
+ */
+
+char **
+environment(void)
+{
+	char **list, **ep, **epend, **new, **np;
+	size_t len;
+	char *p;
+
+	INTOFF;
+	if (!threadsrunning)
+		while ((np = envretired)) {
+			envretired = (char **)*np;
+			ckfree(np);
+		}
+	if (envcache && envcachegen == envgen) {
+		len = (envcount + 1) * sizeof(char *);
+		if (memcmp(envcache, envcache + envcount + 1, len))
+			memcpy(envcache, envcache + envcount + 1, len);
+		INTON;
+		return envcache;
+	}
+
+	list = listvars(VEXPORT, VUNSET, &epend);
+	len = 0;
+	for (ep = list ; ep < epend ; ep++)
+		len += strlen(*ep) + 1;
+	envcount = epend - list;
+	/* the link to the next retired block, the array, its spare copy */
+	new = ckmalloc((2 * envcount + 3) * sizeof(char *) + len);
+	p = (char *)(new + 2 * envcount + 3);
+	for (np = new + 1, ep = list ; ep < epend ; ep++) {
+		*np++ = p;
+		p = stpcpy(p, *ep) + 1;
+	}
+	*np = NULL;
+	memcpy(np + 1, new + 1, (envcount + 1) * sizeof(char *));
+	stunalloc(list);
+
+	if (envcache) {
+		np = envcache - 1;
+		if (threadsrunning) {
+			*np = (char *)envretired;
+			envretired = np;
+		} else
+			ckfree(np);
+	}
+	envcache = new + 1;
+	envcachegen = envgen;
+	INTON;
+	return envcache;
+}
+
+
+
 /*
  * POSIX requires that 'set' (but not export or readonly) output the
  * variables in lexicographic order - by the locale's collating order (sigh).
@@ -448,7 +608,11 @@ exportcmd(int argc, char **argv)
 			if ((p = strchr(name, '=')) != NULL) {
 				p++;
 			} else {
-				if ((vp = *findvar(hashvar(name), name))) {
+				if ((vp = *findvar(name))) {
+					if (vp->nest != subshell)
+						savesubvar(vp, 0);
+					if (flag == VEXPORT)
+						envgen++;
 					vp->flags |= flag;
 					continue;
 				}
@@ -472,7 +636,7 @@ localcmd(int argc, char **argv)
     (void)argc;
 	char *name;
 
-	if (!localvar_stack)
+	if (!localvar_depth)
 		sh_error("not in a function");
 
 	argv = argptr;
@@ -483,6 +647,32 @@ localcmd(int argc, char **argv)
 }
 
 
+STATIC struct localvar *
+newlocalvar(void)
+{
+	struct localvar *lvp;
+
+	if ((lvp = lvspare))
+		lvspare = lvp->next;
+	else
+		lvp = ckmalloc(sizeof(*lvp));
+	return lvp;
+}
+
+
+STATIC struct localvar_list *
+newlocallist(void)
+{
+	struct localvar_list *ll;
+
+	if ((ll = llspare))
+		llspare = ll->next;
+	else
+		ll = ckmalloc(sizeof(*ll));
+	return ll;
+}
+
+
 /*
  * Make a variable a local variable.  When a variable is made local, it's
  * value and flags are saved in a localvar structure.  The saved values
@@ -492,12 +682,20 @@ localcmd(int argc, char **argv)
 
 void mklocal(char *name)
 {
+	struct localvar_list *ll;
 	struct localvar *lvp;
-	struct var **vpp;
-	struct var *vp;
+	struct var *vp, **vpp;
 
 	INTOFF;
-	lvp = ckmalloc(sizeof (struct localvar));
+	ll = localvar_stack;
+	if (!ll || ll->depth != localvar_depth) {
+		ll = newlocallist();
+		ll->lv = NULL;
+		ll->depth = localvar_depth;
+		ll->next = localvar_stack;
+		localvar_stack = ll;
+	}
+	lvp = newlocalvar();
 	if (name[0] == '-' && name[1] == '\0') {
 		char *p;
 		p = ckmalloc(sizeof(optlist));
@@ -506,26 +704,28 @@ void mklocal(char *name)
 	} else {
 		char *eq;
 
-		vpp = hashvar(name);
-		vp = *findvar(vpp, name);
+		vpp = findvar(name);
+		vp = *vpp;
 		eq = strchr(name, '=');
 		if (vp == NULL) {
 			if (eq)
-				vp = setvareq(name, VSTRFIXED);
+				vp = setvareqat(vpp, name, VSTRFIXED);
 			else
 				vp = setvar(name, NULL, VSTRFIXED);
 			lvp->flags = VUNSET;
 		} else {
+			if (vp->nest != subshell)
+				savesubvar(vp, 0);
 			lvp->text = vp->text;
 			lvp->flags = vp->flags;
 			vp->flags |= VSTRFIXED|VTEXTFIXED;
 			if (eq)
-				setvareq(name, 0);
+				setvareqat(vpp, name, 0);
 		}
 	}
 	lvp->vp = vp;
-	lvp->next = localvar_stack->lv;
-	localvar_stack->lv = lvp;
+	lvp->next = ll->lv;
+	ll->lv = lvp;
 	INTON;
 }
 
@@ -542,12 +742,18 @@ poplocalvars(int keep)
 	struct localvar *lvp, *next;
 	struct var *vp;
 
-	INTOFF;
 	ll = localvar_stack;
+	if (!ll || ll->depth != localvar_depth) {
+		localvar_depth--;
+		return;
+	}
+	INTOFF;
+	localvar_depth--;
 	localvar_stack = ll->next;
 
 	next = ll->lv;
-	ckfree(ll);
+	ll->next = llspare;
+	llspare = ll;
 
 	while ((lvp = next) != NULL) {
 		next = lvp->next;
@@ -574,44 +780,136 @@ poplocalvars(int keep)
 			ckfree(lvp->text);
 			optschanged();
 		} else if (lvp->flags == VUNSET) {
-			vp->flags &= ~(VSTRFIXED|VREADONLY);
-			unsetvar(vp->text);
+			vp->flags &= ~VREADONLY;
+			if (!vp->nest)		/* else a subshell still has it */
+				vp->flags &= ~VSTRFIXED;
+			/* unsetvar would free it, so skip looking it up */
+			if (!vp->nest && !subshell && !vp->func && !aflag) {
+				if (vp->flags & VEXPORT)
+					envgen++;
+				dropvar(vp);
+			} else
+				unsetvar(vp->text);
 		} else {
 			if (vp->func)
 				(*vp->func)(strchrnul(lvp->text, '=') + 1);
+			if ((vp->flags | lvp->flags) & VEXPORT)
+				envgen++;
 			if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
 				ckfree(vp->text);
 			vp->flags = lvp->flags;
 			vp->text = lvp->text;
 		}
-		ckfree(lvp);
+		lvp->next = lvspare;
+		lvspare = lvp;
 	}
 	INTON;
 }
 
 
 /*
- * Create a new localvar environment.
+ * Create a new localvar environment.  Returns the depth to unwind to.
+ */
+int pushlocalvars(void)
+{
+	return localvar_depth++;
+}
+
+
+void unwindlocalvars(int stop)
+{
+	while (localvar_depth > stop)
+		poplocalvars(0);
+}
+
+
+/*
+ * A subshell run in this process saves each variable the first time it
+ * changes it, the way mklocal does, and popsubvars puts them all back.
+ * vp->nest is the subshell that has saved it, so later changes are
+ * free.  Returns the local variables to unwind to when it is done.
  */
-struct localvar_list *pushlocalvars(void)
+int pushsubvars(void)
 {
 	struct localvar_list *ll;
 
 	INTOFF;
-	ll = ckmalloc(sizeof(*ll));
+	ll = newlocallist();
 	ll->lv = NULL;
-	ll->next = localvar_stack;
-	localvar_stack = ll;
+	ll->next = subvar_stack;
+	subvar_stack = ll;
 	INTON;
 
-	return ll->next;
+	return localvar_depth;
 }
 
 
-void unwindlocalvars(struct localvar_list *stop)
+/*
+ * Save vp for the innermost subshell.  A variable the subshell is just
+ * making is saved as VUNSET, so popsubvars knows to take it away again.
+ * Called with interrupts off.
+ */
+STATIC void
+savesubvar(struct var *vp, int new)
 {
-	while (localvar_stack != stop)
-		poplocalvars(0);
+	struct localvar *lvp;
+
+	lvp = newlocalvar();
+	if (new) {
+		lvp->flags = VUNSET;
+		lvp->text = NULL;
+	} else {
+		lvp->flags = vp->flags;
+		lvp->text = vp->text;
+		vp->flags |= VSTRFIXED|VTEXTFIXED;
+	}
+	lvp->nest = vp->nest;
+	vp->nest = subshell;
+	lvp->vp = vp;
+	lvp->next = subvar_stack->lv;
+	subvar_stack->lv = lvp;
+}
+
+
+/*
+ * Put back the variables the innermost subshell changed.  This doesn't
+ * go through setvareq, which would only save them again.
+ */
+void
+popsubvars(void)
+{
+	struct localvar_list *ll;
+	struct localvar *lvp, *next;
+	struct var *vp;
+
+	INTOFF;
+	ll = subvar_stack;
+	subvar_stack = ll->next;
+
+	next = ll->lv;
+	ll->next = llspare;
+	llspare = ll;
+
+	while ((lvp = next) != NULL) {
+		next = lvp->next;
+		vp = lvp->vp;
+		if ((vp->flags | lvp->flags) & VEXPORT)
+			envgen++;
+		if (lvp->flags == VUNSET)
+			dropvar(vp);
+		else {
+			if (vp->func && vp->text != lvp->text)
+				(*vp->func)(strchrnul(lvp->text, '=') + 1);
+			if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
+				ckfree(vp->text);
+			vp->flags = lvp->flags;
+			vp->text = lvp->text;
+			vp->nest = lvp->nest;
+		}
+		lvp->next = lvspare;
+		lvspare = lvp;
+	}
+	INTON;
 }
 
 
@@ -658,18 +956,78 @@ void unsetvar(const char *s)
 
 
 /*
- * Find the appropriate entry in the hash table from the name.
+ * Hash a variable name, which ends at the first = or '\0', and store
+ * its length in *lenp.
  */
 
-STATIC struct var **
-hashvar(const char *p)
+STATIC unsigned int
+hashvar(const char *p, unsigned int *lenp)
 {
+	const char *name = p;
 	unsigned int hashval;
 
-	hashval = ((unsigned char) *p) << 4;
+	hashval = 5381;
 	while (*p && *p != '=')
-		hashval += (unsigned char) *p++;
-	return &vartab[hashval % VTABSIZE];
+		hashval = hashval * 33 + (unsigned char) *p++;
+	*lenp = p - name;
+	return hashval;
+}
+
+
+
+/*
+ * Double the number of hash chains.  Variables keep their hash, so
+ * they only need relinking.  Interrupts must be off.
+ */
+
+STATIC void
+growvartab(void)
+{
+	struct var **newtab;
+	struct var *vp, *next;
+	unsigned int newsize, i;
+
+	newsize = vtabsize ? vtabsize * 2 : VTABSIZE;
+	newtab = ckmalloc(newsize * sizeof(*newtab));
+	memset(newtab, 0, newsize * sizeof(*newtab));
+	for (i = 0 ; i < vtabsize ; i++) {
+		for (vp = vartab[i] ; vp ; vp = next) {
+			next = vp->next;
+			vp->next = newtab[vp->hashval & (newsize - 1)];
+			newtab[vp->hashval & (newsize - 1)] = vp;
+		}
+	}
+	if (vartab)
+		ckfree(vartab);
+	vartab = newtab;
+	vtabsize = newsize;
+}
+
+
+
+/*
+ * Report the shape of the variable table, for shellstat.
+ */
+
+void
+varchains(unsigned int *count, unsigned int *size, unsigned int *longest,
+	  unsigned int *used)
+{
+	struct var *vp;
+	unsigned int i, n;
+
+	*count = nvars;
+	*size = vtabsize;
+	*longest = *used = 0;
+	for (i = 0 ; i < vtabsize ; i++) {
+		n = 0;
+		for (vp = vartab[i] ; vp ; vp = vp->next)
+			n++;
+		if (n)
+			++*used;
+		if (n > *longest)
+			*longest = n;
+	}
 }
 
 
@@ -705,13 +1063,49 @@ vpcmp(const void *a, const void *b)
 	return varcmp(*(const char **)a, *(const char **)b);
 }
 
+/*
+ * Find the link to the named variable in its hash chain, or the null
+ * link at the end of the chain if it isn't there.
+ */
+
 STATIC struct var **
-findvar(struct var **vpp, const char *name)
+findvar(const char *name)
 {
+	struct var **vpp;
+	unsigned int hashval, len;
+
+	hashval = hashvar(name, &len);
+	vpp = &vartab[hashval & (vtabsize - 1)];
+	shstat.varlookups++;
 	for (; *vpp; vpp = &(*vpp)->next) {
-		if (varequal((*vpp)->text, name)) {
+		shstat.varprobes++;
+		if ((*vpp)->hashval == hashval && (*vpp)->namelen == len &&
+		    !memcmp((*vpp)->text, name, len)) {
 			break;
 		}
 	}
 	return vpp;
 }
+
+
+
+/*
+ * Take vp out of vartab and free it.  Its chain is known from the hash,
+ * so finding the link to it needs no name comparisons.
+ */
+
+STATIC void
+dropvar(struct var *vp)
+{
+	struct var **vpp;
+
+	vpp = &vartab[vp->hashval & (vtabsize - 1)];
+	while (*vpp != vp)
+		vpp = &(*vpp)->next;
+	*vpp = vp->next;
+	if ((vp->flags & (VTEXTFIXED|VSTACK)) == 0)
+		ckfree(vp->text);
+	ckfree(vp);
+	nvars--;
+	varsfreed++;
+}
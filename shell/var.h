@@ -59,6 +59,9 @@ struct var {
 	void (*func)(const char *);
 					/* function to be called when  */
 					/* the variable gets set/unset */
+	unsigned int hashval;		/* hash of the name */
+	unsigned int namelen;		/* length of the name */
+	int nest;			/* subshell that has saved it */
 };
 
 
@@ -67,13 +70,14 @@ struct localvar {
 	struct var *vp;			/* the variable that was made local */
 	int flags;			/* saved flags */
 	const char *text;		/* saved text */
+	int nest;			/* saved nest */
 };
 
 struct localvar_list;
 
 
 extern struct localvar *localvars;
-extern struct var varinit[];
+extern SHTLS struct var varinit[];
 
 #if ATTY
 #define vatty varinit[0]
@@ -98,6 +102,7 @@ extern struct var varinit[];
 #define vterm (&voptind)[1]
 #endif
 #define vhistsize (&vterm)[1]
+#define vhistfile (&vhistsize)[1]
 #endif
 
 #ifdef IFS_BROKEN
@@ -109,8 +114,10 @@ extern const char defifs[];
 extern const char defpathvar[];
 #define defpath (defpathvar + 36)
 
-extern int lineno;
-extern char linenovar[];
+extern SHTLS int lineno;
+extern SHTLS char linenovar[];
+extern SHTLS unsigned int varsfreed;
+extern SHTLS unsigned int envgen;
 
 /*
  * The following macros access the values of the above variables.
@@ -130,6 +137,7 @@ extern char linenovar[];
 #define linenoval()	(vlineno.text + 7)
 #ifndef SMALL
 #define histsizeval()	(vhistsize.text + 9)
+#define histfileval()	(vhistfile.text + 9)
 #define termval()	(vterm.text + 5)
 #endif
 
@@ -146,17 +154,23 @@ struct strlist;
 void listsetvar(struct strlist *, int);
 char *lookupvar(const char *);
 intmax_t lookupvarint(const char *);
+struct var *lookupvp(const char *);
+char *vpvalue(struct var *);
 char **listvars(int, int, char ***);
-#define environment() listvars(VEXPORT, VUNSET, 0)
+char **environment(void);
 int showvars(const char *, int, int);
 int exportcmd(int, char **);
 int localcmd(int, char **);
 void mklocal(char *);
-struct localvar_list *pushlocalvars(void);
+int pushlocalvars(void);
 void poplocalvars(int);
-void unwindlocalvars(struct localvar_list *stop);
+void unwindlocalvars(int stop);
+int pushsubvars(void);
+void popsubvars(void);
 int unsetcmd(int, char **);
 void unsetvar(const char *);
+void varchains(unsigned int *, unsigned int *, unsigned int *,
+    unsigned int *);
 int varcmp(const char *, const char *);
 
 static inline int varequal(const char *a, const char *b) {
@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Run toy tests with the shellbox being tested, on the host or copied
+# onto a target, the same way as in toybox: each .test file is a list of
+#
+#	testing "name" "command" "result" "infile" "stdin"
+#
+# where infile is written to ./input in an empty directory before
+# command is run there, with stdin on its standard input, and what it
+# writes to standard output must be result.  Exits 1 if any failed.
+#
+#	sh runtest.sh [file.test ...]
+
+SH=${SH:-../shellbox}
+dir=${TEST_DIR:-/tmp}/shellbox-test.$$
+case $0 in
+*/*)	here=${0%/*};;
+*)	here=.;;
+esac
+pass=0
+fail=0
+
+mkdir -p "$dir" || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+testing() {
+	rm -rf "$dir" && mkdir "$dir" || exit 1
+	printf '%b' "$4" >"$dir/input"
+	printf '%b' "$5" >"$dir/stdin"
+	printf '%b' "$3" >"$dir/expected"
+	(cd "$dir" && "$SH" -c "$2" <stdin >actual 2>/dev/null)
+	if cmp -s "$dir/expected" "$dir/actual"; then
+		pass=$((pass + 1))
+	else
+		fail=$((fail + 1))
+		echo "FAIL: $1"
+		echo "  $2"
+	fi
+}
+
+[ $# -gt 0 ] || set -- "$here"/*.test
+for t; do
+	case $t in
+	*/*)	;;
+	*)	t=./$t;;
+	esac
+	. "$t"
+done
+echo "$pass passed, $fail failed"
+[ $fail -eq 0 ]
@@ -30,6 +30,9 @@
  * You don't have to free the option strings, which point into the environment
  * space. List objects should be freed by main() when command_main() returns.
  *
+ * Each command's option string is parsed the first time it runs and the
+ * result kept, so running it again only has to look at argv.
+ *
  * Example:
  *   Calling get_optflags() when toys.which->options="ab:c:d" and
  *   argv = ["command", "-b", "fruit", "-d", "walrus"] results in:
@@ -92,10 +95,10 @@
 //   -abcd means -a -b -c -d (but if -b takes an argument, then it's -a -b cd)
 
 // Linked list of all known options (option string parsed into this).
-// Hangs off getoptflagstate, freed at end of option parsing.
+// Hangs off getoptflagstate, and isn't changed once parsed.
 struct opts {
   struct opts *next;
-  long *arg;         // Pointer into union "this" to store arguments at.
+  int arg;           // Index into union "this" to store arguments at.
   int c;             // Argument character to match
   int flags;         // |=1, ^=2
   unsigned dex[3];   // which bits to disable/enable/exclude in toys.optflags
@@ -106,8 +109,7 @@ struct opts {
   } val[3];          // low, high, default - range of allowed values
 };
 
-// linked list of long options. (Hangs off getoptflagstate, free at end of
-// option parsing, details about flag to set and global slot to fill out
+// linked list of long options. (Hangs off getoptflagstate, details about flag to set and global slot to fill out
 // stored in related short option struct, but if opt->c = -1 the long option
 // is "bare" (has no corresponding short option).
 struct longopts {
@@ -128,6 +130,24 @@ struct getoptflagstate
   unsigned excludes, requires;
 };
 
+// Where in union "this" an option's argument goes
+#define OPTARG(opt) ((long *)&this+(opt)->arg)
+
+// Parsed option strings, by toy_list[] index. Only the parts of each
+// getoptflagstate that come from the option string are filled in.
+static struct getoptflagstate **optcache;
+#if CFG_TOYBOX_THREADS
+static pthread_mutex_t optcache_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void optcache_lock_set(int lock)
+{
+#if CFG_TOYBOX_THREADS
+  if (lock) pthread_mutex_lock(&optcache_lock);
+  else pthread_mutex_unlock(&optcache_lock);
+#endif
+}
+
 // Use getoptflagstate to parse parse one command line option from argv
 static int gotflag(struct getoptflagstate *gof, struct opts *opt)
 {
@@ -146,7 +166,7 @@ static int gotflag(struct getoptflagstate *gof, struct opts *opt)
 
     // Forget saved argument for flag we switch back off
     for (clr=gof->opts, i=1; clr; clr = clr->next, i<<=1)
-      if (clr->arg && (i & toys.optflags & opt->dex[0])) *clr->arg = 0;
+      if (clr->type && (i & toys.optflags & opt->dex[0])) *OPTARG(clr) = 0;
     toys.optflags &= ~opt->dex[0];
   }
 
@@ -173,7 +193,7 @@ static int gotflag(struct getoptflagstate *gof, struct opts *opt)
   } else gof->arg++;
   type = opt->type;
 
-  if (type == '@') ++*(opt->arg);
+  if (type == '@') ++*OPTARG(opt);
   else if (type) {
     char *arg = gof->arg;
 
@@ -193,11 +213,11 @@ static int gotflag(struct getoptflagstate *gof, struct opts *opt)
       help_exit("%s--%.*s", s, lo->len, lo->str);
     }
 
-    if (type == ':') *(opt->arg) = (long)arg;
+    if (type == ':') *OPTARG(opt) = (long)arg;
     else if (type == '*') {
       struct arg_list **list;
 
-      list = (struct arg_list **)opt->arg;
+      list = (struct arg_list **)OPTARG(opt);
       while (*list) list=&((*list)->next);
       *list = xzalloc(sizeof(struct arg_list));
       (*list)->arg = arg;
@@ -207,9 +227,9 @@ static int gotflag(struct getoptflagstate *gof, struct opts *opt)
       if (l < opt->val[0].l) help_exit("-%c < %ld", opt->c, opt->val[0].l);
       if (l > opt->val[1].l) help_exit("-%c > %ld", opt->c, opt->val[1].l);
 
-      *(opt->arg) = l;
+      *OPTARG(opt) = l;
     } else if (CFG_TOYBOX_FLOAT && type == '.') {
-      FLOAT *f = (FLOAT *)(opt->arg);
+      FLOAT *f = (FLOAT *)OPTARG(opt);
 
       *f = strtod(arg, &arg);
       if (opt->val[0].l != LONG_MIN && *f < opt->val[0].f)
@@ -229,8 +249,8 @@ static int gotflag(struct getoptflagstate *gof, struct opts *opt)
 void parse_optflaglist(struct getoptflagstate *gof)
 {
   char *options = toys.which->options;
-  long *nextarg = (long *)&this;
   struct opts *new = 0;
+  int nextarg = 0;
   int idx;
 
   // Parse option format string
@@ -331,10 +351,7 @@ void parse_optflaglist(struct getoptflagstate *gof)
     if (new->c == 1) new->c = 0;
     new->dex[1] = u;
     if (new->flags & 1) gof->requires |= u;
-    if (new->type) {
-      new->arg = (void *)nextarg;
-      *(nextarg++) = new->val[2].l;
-    }
+    if (new->type) new->arg = nextarg++;
   }
 
   // Parse trailing group indicators
@@ -376,10 +393,11 @@ void parse_optflaglist(struct getoptflagstate *gof)
 
 void get_optflags(void)
 {
-  struct getoptflagstate gof;
+  struct getoptflagstate gof, *parsed = 0;
   struct opts *catch;
   long saveflags;
   char *letters[]={"s",""};
+  int which = toys.which-toy_list;
 
   // Option parsing is a two stage process: parse the option string into
   // a struct opts list, then use that list to process argv[];
@@ -389,7 +407,36 @@ void get_optflags(void)
   while (toys.argv[saveflags++]);
   toys.optargs = xzalloc(sizeof(char *)*saveflags);
 
-  parse_optflaglist(&gof);
+  // The option string only needs parsing the first time a command runs,
+  // unless it's somehow not one from toy_list[].
+  if (which<0 || which>=toy_count) which = -1;
+  else {
+    optcache_lock_set(1);
+    if (optcache) parsed = optcache[which];
+    optcache_lock_set(0);
+  }
+  if (parsed) gof = *parsed;
+  else {
+    // What goes in the cache outlives this command.
+    if (which != -1) xkeep_all(1);
+    parse_optflaglist(&gof);
+    if (which != -1) {
+      parsed = xmalloc(sizeof(gof));
+      *parsed = gof;
+      optcache_lock_set(1);
+      if (!optcache) optcache = xzalloc(toy_count*sizeof(*optcache));
+      if (!optcache[which]) optcache[which] = parsed;
+      else which = -1;
+      optcache_lock_set(0);
+      // Another thread got there first, so this copy is ours to free.
+      if (which == -1) free(parsed);
+      xkeep_all(0);
+    }
+  }
+
+  // Defaults for options taking arguments
+  for (catch = gof.opts; catch; catch = catch->next)
+    if (catch->type) *OPTARG(catch) = catch->val[2].l;
 
   // Iterate through command line arguments, skipping argv[0]
   for (gof.argc=1; toys.argv[gof.argc]; gof.argc++) {
@@ -489,7 +536,7 @@ notflag:
     help_exit("Needs %s-%s", s[1] ? "one of " : "", needs);
   }
 
-  if (CFG_TOYBOX_FREE) {
+  if (which == -1) {
     llist_traverse(gof.opts, free);
     llist_traverse(gof.longopts, free);
   }
@@ -16,40 +16,58 @@
 struct toy_list toy_list[] = {
 #include "geninc/newtoys.h"
 };
+const int toy_count = ARRAY_LEN(toy_list);
 
-// global context for this command.
+// Context of the command each thread is running. Library code called when
+// no command is running still needs somewhere to put things, so it starts
+// out pointing at a dummy. A finished context is kept for the next toy_run()
+// so running commands in a loop doesn't keep going back to malloc().
 
-struct toy_context toys;
-union global_union this;
-char toybuf[4096], libbuf[4096];
+static struct toy_context toy_outside;
+TOYTLS struct toy_context *toy_current = &toy_outside;
+static TOYTLS struct toy_context *toy_spare;
+
+// What commands used, see toys.h. The totals are shared by all threads.
+TOYTLS struct toy_io toy_io;
+TOYTLS struct toy_usage toy_last;
+struct toy_usage toy_total[ARRAY_LEN(toy_list)];
+#if CFG_TOYBOX_THREADS
+static pthread_mutex_t toy_total_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// Perfect hash built from newtoys.h: the first hash picks a bucket, whose
+// displacement perturbs it into a slot no other command name lands in. So
+// lookup is two hashes and one strcmp() to reject names that aren't there.
+
+#include "geninc/toyhash.h"
+
+// If newtoys.h gained or lost a command, regenerate toyhash.h to match.
+typedef char toyhash_stale[ARRAY_LEN(toy_list) == TOYHASH_COUNT ? 1 : -1];
 
 struct toy_list *toy_find(char *name)
 {
-  int top, bottom, middle;
+  unsigned char *s = (void *)name;
+  unsigned h = 2166136261U;
+  int i;
 
   if (!CFG_TOYBOX) return 0;
 
-  // If the name starts with "toybox" accept that as a match.  Otherwise
-  // skip the first entry, which is out of order.
+  // If the name starts with "toybox" accept that as a match.  The first
+  // entry, which is out of order, isn't in the hash.
 
   if (!strncmp(name,"toybox",6)) return toy_list;
-  bottom = 1;
 
-  // Binary search to find this command.
+  // FNV-1a, then a murmur3 style finish of it plus the bucket's displacement
+  while (*s) h = (h^*s++)*16777619U;
+  h += toyhash_disp[h%TOYHASH_BUCKETS]*0x9e3779b1U;
+  h = (h^(h>>16))*0x7feb352dU;
+  h = (h^(h>>15))*0x846ca68bU;
+  h ^= h>>16;
 
-  top = ARRAY_LEN(toy_list)-1;
-  for (;;) {
-    int result;
-
-    middle = (top+bottom)/2;
-    if (middle<bottom || middle>top) return NULL;
-    result = strcmp(name,toy_list[middle].name);
-    if (!result) return toy_list+middle;
-    if (result<0) top=--middle;
-    else bottom = ++middle;
-  }
-  
-  return NULL;
+  if (!(i = toyhash_slot[h&(TOYHASH_SLOTS-1)])) return 0;
+  i--;
+
+  return strcmp(name, toy_list[i].name) ? 0 : toy_list+i;
 }
 
 // Figure out whether or not anything is using the option parsing logic,
@@ -112,26 +130,462 @@ void toy_init(struct toy_list *which, char *argv[])
 
   // Free old toys contents (to be reentrant), but leave rebound if any
   // don't blank old optargs if our new argc lives in the old optargs.
+  // A context that hasn't run anything yet came from toy_run() pre-zeroed.
   if (argv<toys.optargs || argv>toys.optargs+toys.optc) free(toys.optargs);
-  memset(&toys, 0, offsetof(struct toy_context, rebound));
   if (toys.which) memset(&this, 0, sizeof(this));
+  memset(&toys, 0, offsetof(struct toy_context, rebound));
 
   // Continue to portion of init needed by standalone commands
   toy_singleinit(which, argv);
 }
 
-// Runs an internal toybox command. Returns the exit value.
+// This thread's CPU time so far, in nanoseconds.
+static void toy_cputime(unsigned long long *user, unsigned long long *sys)
+{
+#ifdef RUSAGE_THREAD
+  struct rusage ru;
+
+  getrusage(RUSAGE_THREAD, &ru);
+  *user = ru.ru_utime.tv_sec*1000000000ULL+ru.ru_utime.tv_usec*1000ULL;
+  *sys = ru.ru_stime.tv_sec*1000000000ULL+ru.ru_stime.tv_usec*1000ULL;
+#else
+  struct timespec ts;
+
+  // Without per-thread rusage (RTEMS) there's one clock for both.
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  *user = ts.tv_sec*1000000000ULL+ts.tv_nsec;
+  *sys = 0;
+#endif
+}
+
+static unsigned long long toy_wallclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+// Add a run of cmd to its totals.
+static void toy_account(struct toy_list *cmd, struct toy_usage *use)
+{
+  struct toy_usage *tu;
+
+  if (cmd<toy_list || cmd>=toy_list+ARRAY_LEN(toy_list)) return;
+  tu = toy_total+(cmd-toy_list);
+#if CFG_TOYBOX_THREADS
+  pthread_mutex_lock(&toy_total_lock);
+#endif
+  tu->runs++;
+  tu->wall += use->wall;
+  tu->user += use->user;
+  tu->sys += use->sys;
+  tu->io.rbytes += use->io.rbytes;
+  tu->io.wbytes += use->io.wbytes;
+  tu->io.reads += use->io.reads;
+  tu->io.writes += use->io.writes;
+  tu->io.opens += use->io.opens;
+  if (use->heap > tu->heap) tu->heap = use->heap;
+#if CFG_TOYBOX_THREADS
+  pthread_mutex_unlock(&toy_total_lock);
+#endif
+}
+
+// Runs an internal toybox command in a context of its own, so it doesn't
+// disturb whatever called it. Returns the exit value. Instead of exiting,
+// error_exit() and friends unwind back to here, and whatever the command
+// allocated and didn't free is freed here (see xmem.c).
 int toy_run(struct toy_list *cmd, char *argv[])
 {
-    // Return if stack depth getting noticeable (proxy for leaked heap, etc).
-    if (toys.stacktop && labs((char *)toys.stacktop-(char *)&cmd)>6000) {
-      error_msg("stack full");
-      return 1;
-    }
+  struct toy_context *outer = toy_current, *tc;
+  struct toy_heap heap = {0};
+  struct toy_io io = toy_io;
+  struct toy_usage use;
+  jmp_buf rebound;
+  int rc;
+
+  // Return if stack depth getting noticeable (proxy for leaked heap, etc).
+  if (outer->stacktop && labs((char *)outer->stacktop-(char *)&cmd)>6000) {
+    error_msg("stack full");
+    return 1;
+  }
 
+  if ((tc = toy_spare)) {
+    toy_spare = 0;
+    heap = tc->heap;
+  } else if (!(tc = malloc(sizeof(*tc)))) {
+    fprintf(stderr, "%s: out of memory\n", *argv);
+    return 1;
+  }
+  memset(tc, 0, offsetof(struct toy_context, scratch));
+  tc->heap.slot = heap.slot;
+  tc->heap.mask = heap.mask;
+  toy_heap_start(&tc->heap, &outer->heap);
+  tc->stacktop = outer->stacktop ? outer->stacktop : (void *)&outer;
+  tc->rebound = &rebound;
+  toy_current = tc;
+
+  toy_trace(toy_start, *argv, 0);
+  use.wall = toy_wallclock();
+  toy_cputime(&use.user, &use.sys);
+  if (!setjmp(rebound)) {
     toy_init(cmd, argv);
-    if (toys.which)
-        toys.which->toy_main();
+    if (toys.which) toys.which->toy_main();
+  }
+  if (fflush(stdout) && !toys.exitval) toys.exitval = 1;
+  rc = toys.exitval;
+  toy_trace(toy_end, *argv, rc);
+  if (toys.optargs != toys.argv+1) free(toys.optargs);
+  if (toys.old_umask) umask(toys.old_umask);
+  toy_heap_end(&tc->heap);
+
+  toy_last.wall = toy_wallclock()-use.wall;
+  toy_cputime(&toy_last.user, &toy_last.sys);
+  toy_last.user -= use.user;
+  toy_last.sys -= use.sys;
+  toy_last.io.rbytes = toy_io.rbytes-io.rbytes;
+  toy_last.io.wbytes = toy_io.wbytes-io.wbytes;
+  toy_last.io.reads = toy_io.reads-io.reads;
+  toy_last.io.writes = toy_io.writes-io.writes;
+  toy_last.io.opens = toy_io.opens-io.opens;
+  toy_last.runs = 1;
+  toy_last.heap = tc->heap.peak;
+  toy_account(cmd, &toy_last);
+
+  toy_current = outer;
+  if (toy_spare) {
+    free(tc->heap.slot);
+    free(tc);
+  } else toy_spare = tc;
+
+  return rc;
+}
+
+#if CFG_TOYBOX_THREADS
+
+// A thread a command starts to help it runs in a copy of the command's
+// context, so it can read toys and GLOBALS() but has toybuf and libbuf to
+// itself. What it frees is looked for in the command's heap (see
+// toy_heap_child()), and error_exit() ends just the thread, with its
+// exitval handed back to the command. A detached thread may outlive the
+// command, so it's given none of that: only a context to put things in.
+
+struct toy_worker {
+  struct toy_context tc;
+  struct toy_context *up;
+  void *(*func)(void *);
+  void *arg;
+};
+
+static void *toy_worker_main(void *arg)
+{
+  struct toy_worker *tw = arg;
+  jmp_buf rebound;
+  void *ret;
+
+  toy_current = &tw->tc;
+  toys.rebound = &rebound;
+  if (setjmp(rebound)) ret = 0;
+  else ret = tw->func(tw->arg);
+  if (tw->up && toys.exitval)
+    __atomic_store_n(&tw->up->exitval, toys.exitval, __ATOMIC_RELAXED);
+  toy_current = &toy_outside;
+  free(tw);
+
+  return ret;
+}
+
+// Start func(arg) in a thread of the running command, as pthread_create().
+int toy_worker_create(pthread_t *tid, pthread_attr_t *attr,
+  void *(*func)(void *), void *arg)
+{
+  struct toy_worker *tw;
+  int detach = PTHREAD_CREATE_JOINABLE, rc;
+
+  if (attr) pthread_attr_getdetachstate(attr, &detach);
+  if (!(tw = malloc(sizeof(*tw)))) return EAGAIN;
+  memcpy(&tw->tc, toy_current, offsetof(struct toy_context, scratch));
+  tw->up = detach == PTHREAD_CREATE_DETACHED ? 0 : toy_current;
+  toy_heap_child(&tw->tc.heap, tw->up ? &toys.heap : 0);
+  tw->tc.exitval = 0;
+  tw->tc.abscache = 0;
+  tw->tc.rebound = 0;
+  tw->tc.stacktop = 0;
+  tw->tc.keep = 0;
+  tw->func = func;
+  tw->arg = arg;
+  if ((rc = pthread_create(tid, attr, toy_worker_main, tw))) free(tw);
+
+  return rc;
+}
+
+// Commands mostly live in toybuf/libbuf and the heap, so they don't need
+// much stack, but regex and qsort can recurse a fair way.
+#define TOY_THREAD_STACK (64*1024)
+
+struct toy_thread {
+  struct toy_thread *next;
+  struct toy_list *which;
+  char **argv;
+  struct toy_reaper *reaper;
+  int fd[2], exitval, done, notify;
+  volatile int cancel;
+};
+
+// Commands are run by a pool of worker threads, so starting one doesn't
+// have to create a thread (or an RTEMS task, with its stack). A worker that
+// finishes a command takes the next one waiting, or waits for one while
+// fewer than toy_thread_keep others are idle, or exits. When they're all
+// busy another starts: a command that never ends, like a daemon, mustn't
+// hold up the rest.
+
+static pthread_mutex_t toy_done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t toy_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t toy_work_cond = PTHREAD_COND_INITIALIZER;
+static struct toy_thread *toy_work, **toy_work_tail = &toy_work;
+static int toy_waiting, toy_idle;
+int toy_thread_keep = 4;
+
+// Threads handed to toy_thread_queue() go on the list of the thread that
+// queued them as they finish, so whoever is waiting for a batch of them
+// wakes up once for all that are done rather than once per thread. Each
+// thread running a shell of its own reaps only its own commands.
+
+struct toy_reaper {
+  struct toy_thread *done, **tail;
+  pthread_t owner;
+};
+
+static TOYTLS struct toy_reaper toy_reaper;
+void (*toy_thread_exited)(pthread_t owner);
+
+// Where the command this thread is running looks to see if it's been
+// cancelled, or NULL if it can't be.
+TOYTLS volatile int *toy_cancel;
+
+static void toy_thread_run(struct toy_thread *tt)
+{
+  struct toy_reaper *r;
+#if TOYBOX_TASK_STDIO
+  FILE *in = stdin, *out = stdout;
+
+  if (tt->fd[0] != -1) stdin = fdopen(tt->fd[0], "r");
+  if (tt->fd[1] != -1) stdout = fdopen(tt->fd[1], "w");
+#endif
+
+  toy_cancel = &tt->cancel;
+  tt->exitval = toy_run(tt->which, tt->argv);
+  toy_cancel = 0;
+
+#if TOYBOX_TASK_STDIO
+  if (tt->fd[0] != -1) fclose(stdin);
+  if (tt->fd[1] != -1) fclose(stdout);
+  stdin = in;
+  stdout = out;
+#endif
+
+  // Once it's marked done tt belongs to whoever's waiting. The owner can't
+  // reap it, and maybe go away, until the lock is dropped, so tell them first.
+  pthread_mutex_lock(&toy_done_lock);
+  tt->done = 1;
+  if (tt->notify) write(tt->notify-1, &tt, sizeof(tt));
+  if ((r = tt->reaper)) {
+    *r->tail = tt;
+    r->tail = &tt->next;
+    if (toy_thread_exited) toy_thread_exited(r->owner);
+  }
+  pthread_cond_broadcast(&toy_done_cond);
+  pthread_mutex_unlock(&toy_done_lock);
+}
+
+static void *toy_thread_main(void *arg)
+{
+  struct toy_thread *tt;
+  sigset_t set;
+
+  // A reader that exits early shows up as EPIPE instead of a signal
+  // that would take the whole shell down with it.
+  // SIGCHLD is left to the thread that waits for children.
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  sigaddset(&set, SIGCHLD);
+  pthread_sigmask(SIG_BLOCK, &set, 0);
+
+  pthread_mutex_lock(&toy_done_lock);
+  for (;;) {
+    while (!(tt = toy_work)) {
+      if (toy_idle >= toy_thread_keep) goto out;
+      toy_idle++;
+      pthread_cond_wait(&toy_work_cond, &toy_done_lock);
+      toy_idle--;
+    }
+    if (!(toy_work = tt->next)) toy_work_tail = &toy_work;
+    tt->next = 0;
+    toy_waiting--;
+    pthread_mutex_unlock(&toy_done_lock);
+    toy_thread_run(tt);
+    pthread_mutex_lock(&toy_done_lock);
+  }
+out:
+  pthread_mutex_unlock(&toy_done_lock);
+  if (toy_spare) free(toy_spare->heap.slot);
+  free(toy_spare);
+  toy_spare = 0;
+
+  return 0;
+}
+
+// Run a command in a thread of its own, with stdin and stdout on the given
+// file descriptors (-1 to share the caller's). The thread owns both fds and
+// closes them when the command exits. Returns NULL if no thread was started,
+// in which case the fds are still the caller's.
+struct toy_thread *toy_thread_start(struct toy_list *which, char *argv[],
+  int in, int out)
+{
+  struct toy_thread *tt;
+  pthread_attr_t attr;
+  pthread_t tid;
+  int rc = 0;
+
+  if (!TOYBOX_TASK_STDIO && (in != -1 || out != -1)) return 0;
+  if (!(tt = calloc(1, sizeof(*tt)))) return 0;
+  tt->which = which;
+  tt->argv = argv;
+  tt->fd[0] = in;
+  tt->fd[1] = out;
+
+  pthread_mutex_lock(&toy_done_lock);
+  *toy_work_tail = tt;
+  toy_work_tail = &tt->next;
+  if (++toy_waiting > toy_idle) {
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, TOY_THREAD_STACK);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&tid, &attr, toy_thread_main, 0);
+    pthread_attr_destroy(&attr);
+  } else pthread_cond_signal(&toy_work_cond);
+
+  // Nobody to run it, so take it back off the list
+  if (rc) {
+    struct toy_thread **ttt = &toy_work;
+
+    while (*ttt != tt) ttt = &(*ttt)->next;
+    if (!(*ttt = tt->next)) toy_work_tail = ttt;
+    toy_waiting--;
+    free(tt);
+    tt = 0;
+  }
+  pthread_mutex_unlock(&toy_done_lock);
+
+  return tt;
+}
+
+// Ask the command in tt to stop, as if it got signal sig. It notices the
+// next time it reads or writes, or at whatever other point it checks
+// toy_cancelled(), and exits with 128+sig.
+void toy_thread_cancel(struct toy_thread *tt, int sig)
+{
+  tt->cancel = sig;
+}
+
+// Called by toy_cancelpoint() when this thread's command has been cancelled.
+void toy_cancelled(void)
+{
+  toys.exitval = 128+*toy_cancel;
+  xexit();
+}
+
+// Instead of being joined directly, tt goes on this thread's finished list
+// once it exits, where toy_thread_reap() called from this thread can collect
+// it.
+void toy_thread_queue(struct toy_thread *tt)
+{
+  struct toy_reaper *r = &toy_reaper;
+
+  pthread_mutex_lock(&toy_done_lock);
+  if (!r->tail) r->tail = &r->done;
+  r->owner = pthread_self();
+  tt->reaper = r;
+  if (tt->done) {
+    *r->tail = tt;
+    r->tail = &tt->next;
+    pthread_cond_broadcast(&toy_done_cond);
+  }
+  pthread_mutex_unlock(&toy_done_lock);
+}
+
+// When tt's command exits (now, if it already has) write tt's address to fd,
+// a non-blocking pipe. This lets a poll() loop juggling its own commands hear
+// about them without going through toy_thread_queue()'s list, which belongs
+// to the shell that queued them.
+void toy_thread_notify(struct toy_thread *tt, int fd)
+{
+  pthread_mutex_lock(&toy_done_lock);
+  if (tt->done) write(fd, &tt, sizeof(tt));
+  else tt->notify = fd+1;
+  pthread_mutex_unlock(&toy_done_lock);
+}
+
+// Take every thread this one queued that has finished, linked through
+// toy_thread_next() and still to be passed to toy_thread_join(). If block is
+// set and none have finished yet, wait for one.
+struct toy_thread *toy_thread_reap(int block)
+{
+  struct toy_reaper *r = &toy_reaper;
+  struct toy_thread *tt;
+
+  pthread_mutex_lock(&toy_done_lock);
+  while (block && !r->done)
+    pthread_cond_wait(&toy_done_cond, &toy_done_lock);
+  tt = r->done;
+  r->done = 0;
+  r->tail = &r->done;
+  pthread_mutex_unlock(&toy_done_lock);
+
+  return tt;
+}
+
+// Whether toy_thread_reap() has anything to collect for this thread.
+int toy_thread_ready(void)
+{
+  int rc;
+
+  pthread_mutex_lock(&toy_done_lock);
+  rc = !!toy_reaper.done;
+  pthread_mutex_unlock(&toy_done_lock);
+
+  return rc;
+}
+
+// Whether the command in tt has exited, so toy_thread_join() won't block.
+int toy_thread_done(struct toy_thread *tt)
+{
+  int rc;
+
+  pthread_mutex_lock(&toy_done_lock);
+  rc = tt->done;
+  pthread_mutex_unlock(&toy_done_lock);
+
+  return rc;
+}
+
+struct toy_thread *toy_thread_next(struct toy_thread *tt)
+{
+  return tt->next;
+}
+
+// Wait for a command started by toy_thread_start() and return its exit value.
+int toy_thread_join(struct toy_thread *tt)
+{
+  int rc;
+
+  pthread_mutex_lock(&toy_done_lock);
+  while (!tt->done) pthread_cond_wait(&toy_done_cond, &toy_done_lock);
+  pthread_mutex_unlock(&toy_done_lock);
+  rc = tt->exitval;
+  free(tt);
 
-    return toys.exitval;
+  return rc;
 }
+#endif
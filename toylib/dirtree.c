@@ -13,6 +13,126 @@ static int notdotdot(char *name)
   return 1;
 }
 
+// Scratch space for the nodes dirtree_recurse() hands to callbacks, so a walk
+// doesn't malloc() and free() every entry. Each directory being read has one,
+// reused for each entry in turn (the last one's been dealt with by the time
+// the next is read), and nodes the callback keeps get copied out to the heap.
+struct dirslab {
+  struct dirslab *next;
+  char *buf;
+  size_t size, used;
+};
+
+// The walk this thread's doing: spare slabs, and the path of the node it's
+// handling, kept up to date entry by entry so dirtree_curpath() doesn't have
+// to assemble it. node is only set while that node's callbacks run, so it
+// never points at something already freed. A walk can outlast the command
+// that started it (find -exec running one of its own), so what hangs off
+// this is xkeep()ed.
+static TOYTLS struct {
+  struct dirslab *slabs;
+  struct dirtree *node;
+  char *path;
+  int len, size, busy, gen;
+} dirwalk;
+
+static struct dirslab *dirslab_get(void)
+{
+  struct dirslab *slab = dirwalk.slabs;
+
+  if (slab) dirwalk.slabs = slab->next;
+  else slab = xkeep(xzalloc(sizeof(struct dirslab)));
+  dirwalk.busy++;
+
+  return slab;
+}
+
+static void dirslab_put(struct dirslab *slab)
+{
+  slab->next = dirwalk.slabs;
+  dirwalk.slabs = slab;
+
+  // Last one back means the walk's over, so don't hang on to anything.
+  if (!--dirwalk.busy) {
+    while ((slab = dirwalk.slabs)) {
+      dirwalk.slabs = slab->next;
+      free(slab->buf);
+      free(slab);
+    }
+    free(dirwalk.path);
+    dirwalk.path = 0;
+    dirwalk.node = 0;
+    dirwalk.len = dirwalk.size = 0;
+    dirwalk.gen++;
+  }
+}
+
+// Zeroed space for a node, from slab if it's not NULL.
+static struct dirtree *dirslab_node(struct dirslab *slab, size_t len)
+{
+  struct dirtree *dt;
+
+  if (!slab) return xzalloc(len);
+  if (len > slab->size) {
+    free(slab->buf);
+    slab->buf = xkeep(xmalloc(slab->size = len+512));
+  }
+  dt = memset(slab->buf, 0, slab->used = len);
+  dt->slab = 1;
+
+  return dt;
+}
+
+// Move a node the callback wants to keep out of its slab.
+static struct dirtree *dirslab_keep(struct dirslab *slab, struct dirtree *dt)
+{
+  struct dirtree *new = xmalloc(slab->used), *kid;
+  char *start = (char *)dt;
+
+  memcpy(new, dt, slab->used);
+  new->slab = 0;
+  if (dt->symlink >= start && dt->symlink < start+slab->used)
+    new->symlink += (char *)new-start;
+  for (kid = new->child; kid; kid = kid->next) kid->parent = new;
+
+  return new;
+}
+
+// Write node's path into dirwalk.path, returning its length.
+static int dirpath_fill(struct dirtree *node)
+{
+  int len = node->parent ? dirpath_fill(node->parent) : 0,
+      nlen = strlen(node->name);
+
+  if (len+nlen+2 > dirwalk.size)
+    dirwalk.path = xkeep(xrealloc(dirwalk.path, dirwalk.size = len+nlen+256));
+  if (len && dirwalk.path[len-1] != '/') dirwalk.path[len++] = '/';
+  strcpy(dirwalk.path+len, node->name);
+
+  return len+nlen;
+}
+
+// Make node, whose parent's path is the first len bytes of dirwalk.path
+// (as of generation gen), the node being handled.
+static void dirpath_enter(struct dirtree *node, int len, int gen)
+{
+  // Somebody else wrote into the buffer since, so start over
+  if (gen != dirwalk.gen) {
+    dirwalk.len = dirpath_fill(node);
+    dirwalk.gen++;
+  } else {
+    int nlen = strlen(node->name);
+
+    if (len+nlen+2 > dirwalk.size)
+      dirwalk.path =
+        xkeep(xrealloc(dirwalk.path, dirwalk.size = len+nlen+256));
+    if (len && dirwalk.path[len-1] != '/') dirwalk.path[len++] = '/';
+    strcpy(dirwalk.path+len, node->name);
+    dirwalk.len = len+nlen;
+  }
+  dirwalk.node = node;
+}
+
 // Default callback, filters out "." and "..".
 
 int dirtree_notdotdot(struct dirtree *catch)
@@ -25,7 +145,8 @@ int dirtree_notdotdot(struct dirtree *catch)
 // (This doesn't open directory filehandles yet so as not to exhaust the
 // filehandle space on large trees, dirtree_handle_callback() does that.)
 
-struct dirtree *dirtree_add_node(struct dirtree *parent, char *name, int flags)
+static struct dirtree *dirtree_node(struct dirtree *parent, char *name,
+  int flags, struct dirslab *slab)
 {
   struct dirtree *dt = NULL;
   struct stat st;
@@ -43,7 +164,7 @@ struct dirtree *dirtree_add_node(struct dirtree *parent, char *name, int flags)
     }
     len = strlen(name);
   }
-  dt = xzalloc((len = sizeof(struct dirtree)+len+1)+linklen);
+  dt = dirslab_node(slab, (len = sizeof(struct dirtree)+len+1)+linklen);
   dt->parent = parent;
   if (name) {
     memcpy(&(dt->st), &st, sizeof(struct stat));
@@ -65,10 +186,63 @@ error:
     if (parent) free(path);
   }
   if (parent) parent->symlink = (char *)1;
-  free(dt);
   return 0;
 }
 
+struct dirtree *dirtree_add_node(struct dirtree *parent, char *name, int flags)
+{
+  return dirtree_node(parent, name, flags, 0);
+}
+
+// Create a DIRTREE_LAZYSTAT node from what the directory read said about it, or
+// return NULL if that wasn't enough. Symlinks aren't lazy because their
+// node has the link contents.
+
+static struct dirtree *dirtree_lazy_node(struct dirtree *parent,
+  struct dirbuf_ent *entry, struct dirslab *slab)
+{
+  struct dirtree *dt;
+
+  if (entry->type == DT_UNKNOWN || entry->type == DT_LNK) return 0;
+  dt = dirslab_node(slab, sizeof(struct dirtree)+strlen(entry->name)+1);
+  dt->parent = parent;
+  strcpy(dt->name, entry->name);
+  // The DT_ values are the S_IFMT ones shifted down
+  dt->st.st_mode = entry->type<<12;
+  dt->st.st_ino = entry->ino;
+  dt->lazy = 1;
+
+  return dt;
+}
+
+// Return node's stat info, filling the rest of it in first for a node
+// DIRTREE_LAZYSTAT left half done. Returns NULL (having complained) if
+// it's gone away since.
+
+struct stat *dirtree_stat(struct dirtree *node)
+{
+  int fd = dirtree_parentfd(node);
+  char *path = 0;
+
+  if (!node->lazy) return &node->st;
+
+  // After its filehandle's closed, go by path.
+  if (fd == -1) path = dirtree_path(node, 0);
+  if (xfstatat(path ? AT_FDCWD : fd, path ? path : node->name, &node->st,
+    AT_SYMLINK_NOFOLLOW))
+  {
+    if (!path) path = dirtree_path(node, 0);
+    perror_msg("%s", path);
+    free(path);
+
+    return 0;
+  }
+  free(path);
+  node->lazy = 0;
+
+  return &node->st;
+}
+
 // Return path to this node, assembled recursively.
 
 // Initial call can pass in NULL to plen, or point to an int initialized to 0
@@ -95,6 +269,21 @@ char *dirtree_path(struct dirtree *node, int *plen)
   return path;
 }
 
+// Return path to this node without allocating anything. It's already there
+// for the node a dirtree_read() callback was handed, otherwise it's built in
+// the same buffer. Good until the next call, or the callback returning.
+
+char *dirtree_curpath(struct dirtree *node)
+{
+  if (node != dirwalk.node) {
+    dirwalk.len = dirpath_fill(node);
+    dirwalk.node = 0;
+    dirwalk.gen++;
+  }
+
+  return dirwalk.path;
+}
+
 int dirtree_parentfd(struct dirtree *node)
 {
   return node->parent ? node->parent->data : AT_FDCWD;
@@ -124,9 +313,12 @@ struct dirtree *dirtree_handle_callback(struct dirtree *new,
     }
   }
 
+  if (dirwalk.node == new) dirwalk.node = 0;
+
   // If this had children, it was callback's job to free them already.
+  // Nodes in dirtree_recurse()'s slab are its to deal with.
   if (!(flags & DIRTREE_SAVE)) {
-    free(new);
+    if (!new->slab) free(new);
     new = NULL;
   }
 
@@ -140,10 +332,12 @@ int dirtree_recurse(struct dirtree *node,
           int (*callback)(struct dirtree *node), int flags)
 {
   struct dirtree *new, **ddt = &(node->child);
-  struct dirent *entry;
-  DIR *dir;
+  struct dirbuf_ent *entry;
+  struct dirbuf *dir;
+  struct dirslab *slab;
+  int len, gen;
 
-  if (node->data == -1 || !(dir = fdopendir(node->data))) {
+  if (!(dir = dirbuf_open(node->data, 0))) {
     if (!(flags & DIRTREE_SHUTUP)) {
       char *path = dirtree_path(node, 0);
       perror_msg("No %s", path);
@@ -154,28 +348,50 @@ int dirtree_recurse(struct dirtree *node,
     return flags;
   }
 
-  // according to the fddir() man page, the filehandle in the DIR * can still
-  // be externally used by things that don't lseek() it.
+  toy_trace(dirtree_enter, node->name, node->data);
+
+  // The filehandle can still be used by things that don't lseek() it, which
+  // is how the callbacks get at node->data.
+
+  slab = dirslab_get();
+  if (dirwalk.node != node) {
+    dirwalk.len = dirpath_fill(node);
+    dirwalk.node = node;
+    dirwalk.gen++;
+  }
+  len = dirwalk.len;
+  gen = dirwalk.gen;
 
   // The extra parentheses are to shut the stupid compiler up.
-  while ((entry = readdir(dir))) {
-    if (!(new = dirtree_add_node(node, entry->d_name, flags))) continue;
+  while ((entry = dirbuf_read(dir))) {
+    if (!(flags & DIRTREE_LAZYSTAT)
+        || !(new = dirtree_lazy_node(node, entry, slab)))
+      if (!(new = dirtree_node(node, entry->name, flags, slab))) continue;
+    dirpath_enter(new, len, gen);
+    gen = dirwalk.gen;
     new = dirtree_handle_callback(new, callback);
     if (new == DIRTREE_ABORTVAL) break;
     if (new) {
+      if (new->slab) new = dirslab_keep(slab, new);
       *ddt = new;
       ddt = &((*ddt)->next);
     }
   }
 
   if (flags & DIRTREE_COMEAGAIN) {
+    if (gen == dirwalk.gen) {
+      dirwalk.path[dirwalk.len = len] = 0;
+      dirwalk.node = node;
+    }
     node->again++;
     flags = callback(node);
   }
+  if (dirwalk.node != node) dirwalk.node = 0;
 
   // This closes filehandle as well, so note it
-  closedir(dir);
+  dirbuf_close(dir);
   node->data = -1;
+  dirslab_put(slab);
 
   return flags;
 }
@@ -196,3 +412,572 @@ struct dirtree *dirtree_read(char *path, int (*callback)(struct dirtree *node))
 
   return root ? dirtree_handle_callback(root, callback) : DIRTREE_ABORTVAL;
 }
+
+#if CFG_TOYBOX_THREADS
+
+// dirtree_handle_parallel(): worker threads read directories and stat what's
+// in them while the calling thread runs every callback, so callbacks see the
+// same one-thing-at-a-time world dirtree_read() gives them and only the
+// waiting on the filesystem overlaps. The workers use absolute paths, because
+// the *at() fallbacks in xat.c fchdir() behind everybody's back.
+
+// Directories being read at once
+#define DIRTREE_THREADS 16
+// Read directories whose filehandle waits around for the callbacks
+#define DIRTREE_FDS 32
+
+// One directory to read: on the stack (next/prev) until a worker takes it,
+// then on the done list for an unordered walk. up is the directory it's in
+// there, sib the next subdirectory of the same parent for an ordered walk.
+struct dirlist {
+  struct dirlist *next, **prev, *up, *sib;
+  struct dirtree *dir, *kids;
+  char *path;
+  struct dirbuf *handle;
+  int err, follow, lazy, flags, pending, done, dropped;
+};
+
+struct dirpool {
+  pthread_mutex_t lock;
+  pthread_cond_t work, ready;
+  struct dirlist *todo, *done, **done_tail;
+  pthread_t tid[DIRTREE_THREADS];
+  int threads, idle, fds, ordered, quit;
+  char *buf;
+  size_t size;
+};
+
+// Read dl->path into a list of stat()ed nodes, leaving the directory open
+// in dl->handle. Entries that can't be stat()ed get st_mode 0 and errno in
+// data so the caller can complain. No toy context is touched here.
+static void dirtree_list(struct dirlist *dl, char **buf, size_t *size)
+{
+  struct dirtree *dt, **ddt = &dl->kids;
+  struct dirbuf_ent *entry;
+  struct stat st;
+  char link[4096];
+  size_t len = strlen(dl->path), nlen;
+  int fd, linklen, err, lazy;
+
+  if ((fd = open(dl->path, O_RDONLY|O_CLOEXEC)) == -1
+      || !(dl->handle = dirbuf_open(fd, 0)))
+  {
+    dl->err = errno;
+    if (fd != -1) close(fd);
+
+    return;
+  }
+
+  while ((entry = dirbuf_read(dl->handle))) {
+    nlen = strlen(entry->name);
+    if (len+nlen+2 > *size) {
+      free(*buf);
+      if (!(*buf = malloc(*size = len+nlen+256))) {
+        *size = 0;
+        dl->err = ENOMEM;
+        break;
+      }
+    }
+    sprintf(*buf, "%s/%s", dl->path, entry->name);
+
+    linklen = err = lazy = 0;
+    if (dl->lazy && entry->type != DT_UNKNOWN && entry->type != DT_LNK) {
+      lazy++;
+      memset(&st, 0, sizeof(st));
+      st.st_mode = entry->type<<12;
+      st.st_ino = entry->ino;
+    } else
+    if ((dl->follow ? stat : lstat)(*buf, &st)) err = errno;
+    else if (S_ISLNK(st.st_mode)) {
+      if (0>(linklen = readlink(*buf, link, sizeof(link)-1))) {
+        err = errno;
+        linklen = 0;
+      } else link[linklen++] = 0;
+    }
+    if (!(dt = calloc(1, sizeof(struct dirtree)+nlen+1+linklen))) {
+      dl->err = ENOMEM;
+      break;
+    }
+    dt->parent = dl->dir;
+    dt->lazy = lazy;
+    strcpy(dt->name, entry->name);
+    if (err) dt->data = err;
+    else {
+      memcpy(&dt->st, &st, sizeof(st));
+      if (linklen) {
+        dt->symlink = memcpy(sizeof(struct dirtree)+nlen+1+(char *)dt, link,
+          linklen);
+        dt->data = --linklen;
+      }
+    }
+    *ddt = dt;
+    ddt = &dt->next;
+  }
+}
+
+static void dirlist_free(struct dirpool *dp, struct dirlist *dl)
+{
+  struct dirtree *dt;
+
+  if (dl->handle) {
+    pthread_mutex_lock(&dp->lock);
+    dp->fds--;
+    pthread_mutex_unlock(&dp->lock);
+    dirbuf_close(dl->handle);
+  }
+  while ((dt = dl->kids)) {
+    dl->kids = dt->next;
+    free(dt);
+  }
+  free(dl->path);
+  free(dl);
+}
+
+// Read dl and hand it over. Called with the lock held, which is dropped
+// while reading.
+static void dirpool_read(struct dirpool *dp, struct dirlist *dl,
+  char **buf, size_t *size)
+{
+  if (!dl->dropped) {
+    pthread_mutex_unlock(&dp->lock);
+    dirtree_list(dl, buf, size);
+    pthread_mutex_lock(&dp->lock);
+
+    // Past the budget, whoever wants the filehandle can open it again.
+    if (dl->handle && dp->fds >= DIRTREE_FDS) {
+      dirbuf_close(dl->handle);
+      dl->handle = 0;
+    } else if (dl->handle) dp->fds++;
+  }
+  dl->done = 1;
+  if (dl->dropped) {
+    pthread_mutex_unlock(&dp->lock);
+    dirlist_free(dp, dl);
+    pthread_mutex_lock(&dp->lock);
+  } else {
+    if (!dp->ordered) {
+      *dp->done_tail = dl;
+      dp->done_tail = &dl->next;
+    }
+    // Only the thread running the callbacks waits for this
+    pthread_cond_signal(&dp->ready);
+  }
+}
+
+// Put the chain of dirlists from first to last on top of the stack, or
+// take dl off it. Called with the lock held.
+static void dirpool_push(struct dirpool *dp, struct dirlist *first,
+  struct dirlist *last)
+{
+  if ((last->next = dp->todo)) dp->todo->prev = &last->next;
+  first->prev = &dp->todo;
+  dp->todo = first;
+}
+
+static void dirpool_unlink(struct dirlist *dl)
+{
+  if ((*dl->prev = dl->next)) dl->next->prev = dl->prev;
+  dl->next = 0;
+  dl->prev = 0;
+}
+
+static struct dirlist *dirpool_pop(struct dirpool *dp)
+{
+  struct dirlist *dl;
+
+  if ((dl = dp->todo)) dirpool_unlink(dl);
+
+  return dl;
+}
+
+static void *dirtree_worker(void *arg)
+{
+  struct dirpool *dp = arg;
+  struct dirlist *dl;
+  char *buf = 0;
+  size_t size = 0;
+
+  pthread_mutex_lock(&dp->lock);
+  for (;;) {
+    while (!(dl = dirpool_pop(dp)) && !dp->quit) {
+      dp->idle++;
+      pthread_cond_wait(&dp->work, &dp->lock);
+      dp->idle--;
+    }
+    if (!dl) break;
+    dirpool_read(dp, dl, &buf, &size);
+  }
+  pthread_mutex_unlock(&dp->lock);
+  free(buf);
+
+  return 0;
+}
+
+// Wake workers for count newly queued directories, starting more if there
+// aren't enough idle. Called with the lock held.
+static void dirpool_grow(struct dirpool *dp, int count)
+{
+  pthread_attr_t attr;
+  int i;
+
+  for (i = dp->idle < count ? dp->idle : count; i>0; i--, count--)
+    pthread_cond_signal(&dp->work);
+  if (count && dp->threads < DIRTREE_THREADS) {
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    while (count-- && dp->threads < DIRTREE_THREADS)
+      if (toy_worker_create(dp->tid+dp->threads, &attr, dirtree_worker, dp)) break;
+      else dp->threads++;
+    pthread_attr_destroy(&attr);
+  }
+}
+
+// Wait until dl (or with dl NULL, anything in an unordered walk) has been
+// read. Rather than sit idle, read it here if no worker's got to it yet, or
+// in an unordered walk read whatever's next.
+static void dirpool_wait(struct dirpool *dp, struct dirlist *dl)
+{
+  struct dirlist *next;
+
+  pthread_mutex_lock(&dp->lock);
+  while (dl ? !dl->done : !dp->done) {
+    next = 0;
+    if (!dl) next = dirpool_pop(dp);
+    else if (dl->prev) dirpool_unlink(next = dl);
+    if (next) dirpool_read(dp, next, &dp->buf, &dp->size);
+    else pthread_cond_wait(&dp->ready, &dp->lock);
+  }
+  pthread_mutex_unlock(&dp->lock);
+}
+
+static struct dirlist *dirlist_new(struct dirlist *up, struct dirtree *dt,
+  char *path, int flags)
+{
+  struct dirlist *dl = xzalloc(sizeof(struct dirlist));
+
+  dl->up = up;
+  dl->dir = dt;
+  dl->path = path;
+  dl->flags = flags;
+  dl->follow = !!(flags & DIRTREE_SYMFOLLOW);
+  dl->lazy = !!(flags & DIRTREE_LAZYSTAT);
+  dl->pending = 1;
+
+  return dl;
+}
+
+// Queue the directory dt, whose absolute path is path, to be read.
+static struct dirlist *dirlist_push(struct dirpool *dp, struct dirlist *up,
+  struct dirtree *dt, char *path, int flags)
+{
+  struct dirlist *dl = dirlist_new(up, dt, path, flags);
+
+  pthread_mutex_lock(&dp->lock);
+  dirpool_push(dp, dl, dl);
+  dirpool_grow(dp, 1);
+  pthread_mutex_unlock(&dp->lock);
+
+  return dl;
+}
+
+// Forget a dirlist nobody's going to look at: free it unless it's being
+// read, in which case leave that to the worker reading it.
+static void dirlist_drop(struct dirpool *dp, struct dirlist *dl)
+{
+  int mine;
+
+  if (!dl) return;
+  pthread_mutex_lock(&dp->lock);
+  if ((mine = !!dl->prev)) dirpool_unlink(dl);
+  else if (!(mine = dl->done)) dl->dropped = 1;
+  pthread_mutex_unlock(&dp->lock);
+  if (mine) dirlist_free(dp, dl);
+}
+
+// Give dl's directory node a filehandle for its children's callbacks, or
+// complain it couldn't be read. Returns 0 if there's nothing to look at.
+static int dirlist_open(struct dirlist *dl)
+{
+  struct dirtree *dt = dl->dir;
+
+  if (dl->handle) dt->data = dirbuf_fd(dl->handle);
+  else if (!dl->err) dt->data = open(dl->path, O_RDONLY|O_CLOEXEC);
+  if (dl->err || dt->data == -1) {
+    if (!(dl->flags & DIRTREE_SHUTUP)) {
+      char *path = dirtree_path(dt, 0);
+
+      if (dl->err) errno = dl->err;
+      perror_msg("No %s", path);
+      free(path);
+    }
+    dt->data = -1;
+
+    return 0;
+  }
+
+  return 1;
+}
+
+// Close dl's directory once its children have been seen to.
+static void dirlist_close(struct dirpool *dp, struct dirlist *dl)
+{
+  if (dl->handle) {
+    pthread_mutex_lock(&dp->lock);
+    dp->fds--;
+    pthread_mutex_unlock(&dp->lock);
+    dirbuf_close(dl->handle);
+    dl->handle = 0;
+  } else if (dl->dir->data != -1) close(dl->dir->data);
+  dl->dir->data = -1;
+}
+
+// Like dirtree_add_node()'s error path, for an entry a worker couldn't stat.
+static void dirlist_badkid(struct dirlist *dl, struct dirtree *dt)
+{
+  if (!(dl->flags&DIRTREE_SHUTUP) && notdotdot(dt->name)) {
+    char *path = dirtree_path(dl->dir, 0);
+
+    errno = dt->data;
+    perror_msg("%s/%s", path, dt->name);
+    free(path);
+  }
+  dl->dir->symlink = (char *)1;
+  free(dt);
+}
+
+// Callbacks in the order dirtree_recurse() would make them. Every
+// subdirectory is queued as soon as its parent's been read, first one on
+// top, so by the time the walk gets to it it's usually been read already.
+// Returns flags as dirtree_recurse() does.
+static int dirtree_ordered(struct dirpool *dp, struct dirlist *dl,
+  int (*callback)(struct dirtree *node))
+{
+  struct dirtree *dt = dl->dir, *kid, *next, **ddt = &dt->child;
+  struct dirlist *pre = 0, *kdl, *last = 0;
+  int flags = dl->flags, kflags, count = 0, abort = 0;
+
+  dirpool_wait(dp, dl);
+  if (!dirlist_open(dl)) return flags;
+
+  // Queue the subdirectories, in order, on top of the stack.
+  for (kid = dl->kids; kid; kid = kid->next) {
+    if (!S_ISDIR(kid->st.st_mode)) continue;
+    kdl = dirlist_new(0, kid, xmprintf("%s/%s", dl->path, kid->name), flags);
+    if (last) {
+      last->sib = last->next = kdl;
+      kdl->prev = &last->next;
+    } else pre = kdl;
+    last = kdl;
+    count++;
+  }
+  if (pre) {
+    pthread_mutex_lock(&dp->lock);
+    dirpool_push(dp, pre, last);
+    dirpool_grow(dp, count);
+    pthread_mutex_unlock(&dp->lock);
+  }
+
+  for (kid = dl->kids, dl->kids = 0; kid; kid = next) {
+    next = kid->next;
+    kid->next = 0;
+    kdl = 0;
+    if (S_ISDIR(kid->st.st_mode)) {
+      kdl = pre;
+      pre = pre->sib;
+    }
+    if (abort) {
+      dirlist_drop(dp, kdl);
+      free(kid);
+      continue;
+    }
+    if (!kid->st.st_mode) {
+      dirlist_badkid(dl, kid);
+      continue;
+    }
+
+    kflags = callback(kid);
+    if (kdl && (kflags & (DIRTREE_RECURSE|DIRTREE_COMEAGAIN))) {
+      // Read with the wrong idea about symlinks or stat? Read it again.
+      if (kdl->follow != !!(kflags & DIRTREE_SYMFOLLOW)
+          || (kdl->lazy && !(kflags & DIRTREE_LAZYSTAT)))
+      {
+        char *path = xstrdup(kdl->path);
+
+        dirlist_drop(dp, kdl);
+        kdl = dirlist_push(dp, 0, kid, path, kflags);
+      }
+      kdl->flags = kflags;
+      kflags = dirtree_ordered(dp, kdl, callback);
+      dirlist_free(dp, kdl);
+    } else dirlist_drop(dp, kdl);
+
+    if (!(kflags & DIRTREE_SAVE)) free(kid);
+    else {
+      *ddt = kid;
+      ddt = &kid->next;
+    }
+    if ((kflags & DIRTREE_ABORT)==DIRTREE_ABORT) abort++;
+  }
+
+  if (flags & DIRTREE_COMEAGAIN) {
+    dt->again++;
+    flags = callback(dt);
+  }
+  dirlist_close(dp, dl);
+
+  return flags;
+}
+
+// Callbacks as directories finish being read, whichever that is. Each
+// directory's children are called back together with its filehandle open,
+// but a directory asking to come again does so after everything under it,
+// with its (and its parent's) filehandle closed. Saved nodes go on their
+// parent's child list in no particular order. Returns the top directory's
+// flags as dirtree_recurse() does.
+static int dirtree_unordered(struct dirpool *dp, struct dirlist *dl,
+  int (*callback)(struct dirtree *node))
+{
+  struct dirtree *kid, *next;
+  struct dirlist *up;
+  int outstanding = 1, kflags, abort, flags = 0;
+
+  while (outstanding--) {
+    dirpool_wait(dp, 0);
+    pthread_mutex_lock(&dp->lock);
+    dl = dp->done;
+    if (!(dp->done = dl->next)) dp->done_tail = &dp->done;
+    dl->next = 0;
+    pthread_mutex_unlock(&dp->lock);
+
+    abort = 0;
+    if (dirlist_open(dl)) {
+      for (kid = dl->kids, dl->kids = 0; kid; kid = next) {
+        next = kid->next;
+        kid->next = 0;
+        if (abort) {
+          free(kid);
+          continue;
+        }
+        if (!kid->st.st_mode) {
+          dirlist_badkid(dl, kid);
+          continue;
+        }
+        kflags = callback(kid);
+        if (S_ISDIR(kid->st.st_mode)
+            && (kflags & (DIRTREE_RECURSE|DIRTREE_COMEAGAIN)))
+        {
+          dl->pending++;
+          outstanding++;
+          dirlist_push(dp, dl, kid, xmprintf("%s/%s", dl->path, kid->name),
+            kflags);
+        } else if (!(kflags & DIRTREE_SAVE)) free(kid);
+        else {
+          kid->next = dl->dir->child;
+          dl->dir->child = kid;
+        }
+        if ((kflags & DIRTREE_ABORT)==DIRTREE_ABORT) abort++;
+      }
+      dirlist_close(dp, dl);
+    }
+
+    // Finishing a directory may finish the one it's in, and so on up.
+    while (dl && !--dl->pending) {
+      kflags = dl->flags;
+      if (kflags & DIRTREE_COMEAGAIN) {
+        dl->dir->again++;
+        kflags = callback(dl->dir);
+      }
+      if (!(up = dl->up)) flags = kflags;
+      else if (!(kflags & DIRTREE_SAVE)) free(dl->dir);
+      else {
+        dl->dir->next = up->dir->child;
+        up->dir->child = dl->dir;
+      }
+      dirlist_free(dp, dl);
+      dl = up;
+    }
+  }
+
+  return flags;
+}
+
+#endif
+
+// Like dirtree_handle_callback(), but directories are read and their
+// contents stat()ed by a pool of threads, so a walk that spends its time
+// waiting on a slow (network) filesystem has many requests outstanding at
+// once. Callbacks still all happen in this thread. With ordered they happen
+// in the same order dirtree_handle_callback() would make them; without, as
+// directories finish being read, which keeps more going at once but means
+// each directory's callbacks come in a burst and the "again" callback comes
+// with no filehandles open. Without thread support this is just
+// dirtree_handle_callback().
+
+struct dirtree *dirtree_handle_parallel(struct dirtree *new,
+          int (*callback)(struct dirtree *node), int ordered)
+{
+#if CFG_TOYBOX_THREADS
+  struct dirpool dp;
+  struct dirlist *dl;
+  char *path;
+  int flags, i;
+
+  if (!new) return 0;
+  if (!callback) callback = dirtree_notdotdot;
+  flags = callback(new);
+
+  if (S_ISDIR(new->st.st_mode) && (flags&(DIRTREE_RECURSE|DIRTREE_COMEAGAIN))) {
+    memset(&dp, 0, sizeof(dp));
+    pthread_mutex_init(&dp.lock, 0);
+    pthread_cond_init(&dp.work, 0);
+    pthread_cond_init(&dp.ready, 0);
+    dp.done_tail = &dp.done;
+    dp.ordered = ordered;
+
+    if (*new->name == '/') path = xstrdup(new->name);
+    else {
+      char *cwd = xgetcwd();
+
+      path = xmprintf("%s/%s", cwd, new->name);
+      free(cwd);
+    }
+    dl = dirlist_push(&dp, 0, new, path, flags);
+    if (ordered) {
+      flags = dirtree_ordered(&dp, dl, callback);
+      dirlist_free(&dp, dl);
+    } else flags = dirtree_unordered(&dp, dl, callback);
+
+    pthread_mutex_lock(&dp.lock);
+    dp.quit = 1;
+    pthread_cond_broadcast(&dp.work);
+    pthread_mutex_unlock(&dp.lock);
+    for (i = 0; i<dp.threads; i++) pthread_join(dp.tid[i], 0);
+    free(dp.buf);
+    pthread_cond_destroy(&dp.ready);
+    pthread_cond_destroy(&dp.work);
+    pthread_mutex_destroy(&dp.lock);
+  }
+
+  if (!(flags & DIRTREE_SAVE)) {
+    free(new);
+    new = NULL;
+  }
+
+  return (flags & DIRTREE_ABORT)==DIRTREE_ABORT ? DIRTREE_ABORTVAL : new;
+#else
+  (void)ordered;
+
+  return dirtree_handle_callback(new, callback);
+#endif
+}
+
+// dirtree_read() with dirtree_handle_parallel()
+
+struct dirtree *dirtree_read_parallel(char *path,
+          int (*callback)(struct dirtree *node), int ordered)
+{
+  struct dirtree *root = dirtree_start(path, 0);
+
+  return root ? dirtree_handle_parallel(root, callback, ordered)
+    : DIRTREE_ABORTVAL;
+}
@@ -65,17 +65,50 @@ int mountlist_istype(struct mtab_list *ml, char *typelist)
   return !skip;
 }
 
-// Get list of mounted filesystems, including stat and statvfs info.
-// Returns a reversed list, which is good for finding overmounts and such.
+// The mount table as last read, kept until /proc/self/mounts polls with
+// POLLPRI|POLLERR (which it does after anything is mounted or unmounted),
+// so a df every few seconds on a box with hundreds of mounts doesn't parse
+// and deslash it all each time. Only the parsed text is kept, not the stat
+// information, which can change without the table changing.
+static struct {
+#if CFG_TOYBOX_THREADS
+  pthread_mutex_t lock;
+#endif
+  struct mtab_list *list;
+  int fd;
+} mtcache = {
+#if CFG_TOYBOX_THREADS
+  PTHREAD_MUTEX_INITIALIZER,
+#endif
+  0, -1};
 
-struct mtab_list *xgetmountlist(char *path)
+static int mtab_size(struct mtab_list *mt)
+{
+  return sizeof(struct mtab_list) + strlen(mt->type) + strlen(mt->dir) +
+    strlen(mt->device) + strlen(mt->opts) + 4;
+}
+
+static struct mtab_list *mtab_copy(struct mtab_list *old)
+{
+  struct mtab_list *mt = xmalloc(mtab_size(old));
+
+  memcpy(mt, old, mtab_size(old));
+  mt->dir = mt->type+(old->dir-old->type);
+  mt->device = mt->type+(old->device-old->type);
+  mt->opts = mt->type+(old->opts-old->type);
+  memset(&mt->stat, 0, sizeof(mt->stat));
+  memset(&mt->statvfs, 0, sizeof(mt->statvfs));
+
+  return mt;
+}
+
+static struct mtab_list *mtab_read(char *path)
 {
   struct mtab_list *mtlist = 0, *mt;
   struct mntent *me;
   FILE *fp;
-  char *p = path ? path : "/proc/mounts";
 
-  if (!(fp = setmntent(p, "r"))) perror_exit("bad %s", p);
+  if (!(fp = setmntent(path, "r"))) perror_exit("bad %s", path);
 
   // The "test" part of the loop is done before the first time through and
   // again after each "increment", so putting the actual load there avoids
@@ -86,13 +119,6 @@ struct mtab_list *xgetmountlist(char *path)
       strlen(me->mnt_dir) + strlen(me->mnt_type) + strlen(me->mnt_opts) + 4);
     dlist_add_nomalloc((void *)&mtlist, (void *)mt);
 
-    // Collect details about mounted filesystem
-    // Don't report errors, just leave data zeroed
-    if (!path) {
-      stat(me->mnt_dir, &(mt->stat));
-      statvfs(me->mnt_dir, &(mt->statvfs));
-    }
-
     // Remember information from /proc/mounts
     mt->dir = stpcpy(mt->type, me->mnt_type)+1;
     mt->device = stpcpy(mt->dir, me->mnt_dir)+1;
@@ -107,4 +133,216 @@ struct mtab_list *xgetmountlist(char *path)
   return mtlist;
 }
 
+static void mtab_free(struct mtab_list *mtlist)
+{
+  struct mtab_list *mt;
+
+  if (mtlist) mtlist->prev->next = 0;
+  while ((mt = mtlist)) {
+    mtlist = mt->next;
+    free(mt);
+  }
+}
+
+// A private copy of the kernel's mount table, reading it again only if it
+// changed since last time.
+static struct mtab_list *mtab_current(void)
+{
+  struct mtab_list *mtlist = 0, *mt;
+  struct pollfd pfd;
+  int cached;
+
+#if CFG_TOYBOX_THREADS
+  pthread_mutex_lock(&mtcache.lock);
+#endif
+  if (mtcache.fd == -1)
+    mtcache.fd = open("/proc/self/mounts", O_RDONLY|O_CLOEXEC);
+  if ((cached = mtcache.fd != -1)) {
+    // The event is cleared by polling, before the read it asks for, so a
+    // mount that happens during the read is seen next time.
+    pfd.fd = mtcache.fd;
+    pfd.events = POLLPRI;
+    if (poll(&pfd, 1, 0) && (pfd.revents & (POLLPRI|POLLERR))) {
+      mtab_free(mtcache.list);
+      mtcache.list = 0;
+    }
+    if (!mtcache.list) {
+      xkeep_all(1);
+      mtcache.list = mtab_read("/proc/mounts");
+      xkeep_all(0);
+    }
+    if ((mt = mtcache.list)) do {
+      dlist_add_nomalloc((void *)&mtlist, (void *)mtab_copy(mt));
+    } while ((mt = mt->next) != mtcache.list);
+  }
+#if CFG_TOYBOX_THREADS
+  pthread_mutex_unlock(&mtcache.lock);
+#endif
+
+  return cached ? mtlist : mtab_read("/proc/mounts");
+}
+
+#if CFG_TOYBOX_THREADS
+// stat() and statvfs() each mount point from a few threads at once, so one
+// that hangs (a dead NFS server, say) holds up only itself. Whatever hasn't
+// answered once nothing has for MOUNT_TIMEOUT seconds is reported and left
+// zeroed, which df skips. A thread stuck in the kernel stays stuck, so the
+// batch belongs to whoever is last to let go of it.
+#define MOUNT_THREADS 8
+#define MOUNT_TIMEOUT 5
+
+struct mount_stats {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int count, next, done, refs;
+  char **dirs, *finished;
+  struct stat *st;
+  struct statvfs *vfs;
+};
+
+static int mount_stats_put(struct mount_stats *ms)
+{
+  int last = !--ms->refs;
+
+  pthread_mutex_unlock(&ms->lock);
+  if (last) {
+    pthread_cond_destroy(&ms->cond);
+    pthread_mutex_destroy(&ms->lock);
+    free(ms);
+  }
+
+  return last;
+}
+
+static void *mount_stats_thread(void *arg)
+{
+  struct mount_stats *ms = arg;
+  struct statvfs vfs;
+  struct stat st;
+  int i;
+
+  pthread_mutex_lock(&ms->lock);
+  while ((i = ms->next) < ms->count) {
+    ms->next++;
+    pthread_mutex_unlock(&ms->lock);
+
+    // Don't report errors, just leave data zeroed
+    memset(&st, 0, sizeof(st));
+    memset(&vfs, 0, sizeof(vfs));
+    stat(ms->dirs[i], &st);
+    statvfs(ms->dirs[i], &vfs);
+
+    pthread_mutex_lock(&ms->lock);
+    ms->st[i] = st;
+    ms->vfs[i] = vfs;
+    ms->finished[i] = 1;
+    ms->done++;
+    pthread_cond_signal(&ms->cond);
+  }
+  mount_stats_put(ms);
+
+  return 0;
+}
+
+static void mount_stats(struct mtab_list *mtlist)
+{
+  struct mount_stats *ms;
+  struct mtab_list *mt, **mts;
+  struct timespec ts;
+  pthread_attr_t attr;
+  pthread_t tid;
+  int i, count = 0, threads = 0, done;
+  long len = 0;
+  char *s;
+
+  if (!(mt = mtlist)) return;
+  do {
+    count++;
+    len += strlen(mt->dir)+1;
+  } while ((mt = mt->next) != mtlist);
+
+  // One allocation holds the lot, even the names, since it may outlive us.
+  ms = xkeep(xzalloc(sizeof(*ms) + count*(sizeof(char *)+sizeof(struct stat)
+    +sizeof(struct statvfs)+1) + len));
+  ms->st = (void *)(ms+1);
+  ms->vfs = (void *)(ms->st+count);
+  ms->dirs = (void *)(ms->vfs+count);
+  ms->finished = (void *)(ms->dirs+count);
+  s = ms->finished+count;
+  mts = xmalloc(count*sizeof(*mts));
+  for (i = 0, mt = mtlist; i<count; i++, mt = mt->next) {
+    mts[i] = mt;
+    ms->dirs[i] = s;
+    s = stpcpy(s, mt->dir)+1;
+  }
+  ms->count = count;
+  ms->refs = 1;
+  pthread_mutex_init(&ms->lock, 0);
+  pthread_cond_init(&ms->cond, 0);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64*1024);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_mutex_lock(&ms->lock);
+  while (threads<MOUNT_THREADS && threads<count) {
+    ms->refs++;
+    if (toy_worker_create(&tid, &attr, mount_stats_thread, ms)) {
+      ms->refs--;
+      break;
+    }
+    threads++;
+  }
+  pthread_attr_destroy(&attr);
+
+  // No threads to be had, so do it here and wait for whatever hangs.
+  if (!threads) {
+    ms->refs++;
+    pthread_mutex_unlock(&ms->lock);
+    mount_stats_thread(ms);
+    pthread_mutex_lock(&ms->lock);
+  }
+
+  while ((done = ms->done) < count) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += MOUNT_TIMEOUT;
+    while (ms->done == done)
+      if (pthread_cond_timedwait(&ms->cond, &ms->lock, &ts)) break;
+    if (ms->done == done) break;
+  }
+
+  for (i = 0; i<count; i++) {
+    if (ms->finished[i]) {
+      mts[i]->stat = ms->st[i];
+      mts[i]->statvfs = ms->vfs[i];
+    } else error_msg("%s: no answer", mts[i]->dir);
+  }
+  free(mts);
+  mount_stats_put(ms);
+}
+#else
+// Without threads, just stat() and statvfs() each mount point in turn.
+static void mount_stats(struct mtab_list *mtlist)
+{
+  struct mtab_list *mt;
+
+  if ((mt = mtlist)) do {
+    stat(mt->dir, &mt->stat);
+    statvfs(mt->dir, &mt->statvfs);
+  } while ((mt = mt->next) != mtlist);
+}
+#endif
+
+// Get list of mounted filesystems, including stat and statvfs info.
+// Returns a reversed list, which is good for finding overmounts and such.
+
+struct mtab_list *xgetmountlist(char *path)
+{
+  struct mtab_list *mtlist;
+
+  if (path) return mtab_read(path);
+  mount_stats(mtlist = mtab_current());
+
+  return mtlist;
+}
+
 #endif
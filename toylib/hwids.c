@@ -0,0 +1,220 @@
+/* hwids.c - Look up vendor and device names in pci.ids or usb.ids.
+ *
+ * Both files are plain text: a vendor is "vvvv  Name" at the start of a
+ * line and its devices follow as "\tdddd  Name". Reading one to name each
+ * device means scanning a megabyte of text per device, so the first look
+ * writes FILE.idx beside it: the text's size and mtime, then the vendor and
+ * device ids sorted, each with the offset of its name in the text. Later
+ * runs mmap both and binary search. An index that doesn't match the text
+ * is rebuilt, and if it can't be written the one built in memory does.
+ *
+ * See https://pci-ids.ucw.cz and http://www.linux-usb.org/usb.ids
+ */
+
+#include "toys.h"
+
+struct hwids_head {
+  char magic[8];
+  uint64_t size;
+  int64_t sec;
+  uint32_t nsec, vcount, dcount, pad;
+};
+
+#define HWIDS_MAGIC "hwids1\n"
+
+// A vendor or device: id is vendor<<16|device for devices, off is where
+// its name starts in the text.
+struct hwid {
+  uint32_t id, off;
+};
+
+struct hwids {
+  char *text, *map;
+  long textlen, maplen;
+  struct hwid *vendors, *devices;
+  unsigned vcount, dcount;
+};
+
+static int hwid_cmp(const void *a, const void *b)
+{
+  const struct hwid *aa = a, *bb = b;
+
+  if (aa->id != bb->id) return aa->id < bb->id ? -1 : 1;
+
+  return (aa->off > bb->off)-(aa->off < bb->off);
+}
+
+// Parse 4 hex digits and the whitespace after them, or return -1.
+static int hwid_hex(char *s, char *end, char **name)
+{
+  int i, id = 0;
+
+  for (i = 0; i<4; i++) {
+    if (s+i == end || !isxdigit(s[i])) return -1;
+    id = (id<<4)+(isdigit(s[i]) ? s[i]-'0' : (s[i]|32)-'a'+10);
+  }
+  s += 4;
+  if (s == end || (*s != ' ' && *s != '\t')) return -1;
+  while (s<end && (*s == ' ' || *s == '\t')) s++;
+  *name = s;
+
+  return id;
+}
+
+// Scan the text into a head and two sorted tables in one allocation.
+static char *hwids_build(struct hwids *ids, struct stat *st, long *len)
+{
+  struct hwids_head *head;
+  struct hwid *v = 0, *d = 0;
+  unsigned vc = 0, dc = 0, vsize = 0, dsize = 0;
+  char *s = ids->text, *end = s+ids->textlen, *nl, *name, *map;
+  int vendor = -1, id;
+
+  // A line that isn't a comment, a vendor or one of its devices (the
+  // "C 00  Unclassified device" class list, say) ends the vendor before it.
+  for (; s<end; s = nl+1) {
+    if (!(nl = memchr(s, '\n', end-s))) nl = end;
+    if (*s == '#' || s == nl) continue;
+    if (*s == '\t') {
+      if (vendor == -1 || s[1] == '\t') continue;
+      if (-1 == (id = hwid_hex(s+1, nl, &name))) continue;
+      if (dc == dsize) d = xrealloc(d, (dsize += 4096)*sizeof(*d));
+      d[dc].id = (vendor<<16)|id;
+      d[dc++].off = name-ids->text;
+    } else if (-1 != (vendor = hwid_hex(s, nl, &name))) {
+      if (vc == vsize) v = xrealloc(v, (vsize += 1024)*sizeof(*v));
+      v[vc].id = vendor;
+      v[vc++].off = name-ids->text;
+    }
+  }
+  if (vc) qsort(v, vc, sizeof(*v), hwid_cmp);
+  if (dc) qsort(d, dc, sizeof(*d), hwid_cmp);
+
+  *len = sizeof(*head)+(vc+dc)*sizeof(*v);
+  head = (void *)(map = xzalloc(*len));
+  memcpy(head->magic, HWIDS_MAGIC, sizeof(head->magic));
+  head->size = st->st_size;
+  head->sec = st->st_mtim.tv_sec;
+  head->nsec = st->st_mtim.tv_nsec;
+  head->vcount = vc;
+  head->dcount = dc;
+  if (vc) memcpy(head+1, v, vc*sizeof(*v));
+  if (dc) memcpy((struct hwid *)(head+1)+vc, d, dc*sizeof(*d));
+  free(v);
+  free(d);
+
+  return map;
+}
+
+// Is this index the index of this text?
+static int hwids_valid(char *map, long len, struct stat *st)
+{
+  struct hwids_head *head = (void *)map;
+
+  return len >= sizeof(*head) && !memcmp(head->magic, HWIDS_MAGIC, 8)
+    && head->size == st->st_size && head->sec == st->st_mtim.tv_sec
+    && head->nsec == st->st_mtim.tv_nsec
+    && len == sizeof(*head)+((long)head->vcount+head->dcount)*sizeof(struct hwid);
+}
+
+// Write the index beside the text, atomically, if we're allowed to.
+static void hwids_save(char *path, char *map, long len)
+{
+  char *idx = xmprintf("%s.idx", path), *tmp = xmprintf("%s.XXXXXX", idx);
+  int fd;
+
+  if (-1 != (fd = mkstemp(tmp))) {
+    fchmod(fd, 0644);
+    if (writeall(fd, map, len) != len || close(fd) || rename(tmp, idx))
+      unlink(tmp);
+  }
+  free(tmp);
+  free(idx);
+}
+
+struct hwids *hwids_open(char *path)
+{
+  struct hwids *ids;
+  struct stat st, ist;
+  char *idx;
+  int fd, ifd;
+
+  if (-1 == (fd = open(path, O_RDONLY|O_CLOEXEC))) return 0;
+  if (fstat(fd, &st) || !st.st_size) {
+    close(fd);
+    return 0;
+  }
+  ids = xzalloc(sizeof(*ids));
+  ids->textlen = st.st_size;
+  ids->text = mmap(0, ids->textlen, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ids->text == MAP_FAILED) {
+    free(ids);
+    return 0;
+  }
+
+  idx = xmprintf("%s.idx", path);
+  if (-1 != (ifd = open(idx, O_RDONLY|O_CLOEXEC))) {
+    if (!fstat(ifd, &ist) && ist.st_size) {
+      ids->maplen = ist.st_size;
+      ids->map = mmap(0, ids->maplen, PROT_READ, MAP_SHARED, ifd, 0);
+      if (ids->map == MAP_FAILED) ids->map = 0;
+      else if (!hwids_valid(ids->map, ids->maplen, &st)) {
+        munmap(ids->map, ids->maplen);
+        ids->map = 0;
+      }
+    }
+    close(ifd);
+  }
+  free(idx);
+
+  // Negative maplen means map came from malloc rather than mmap.
+  if (!ids->map) {
+    ids->map = hwids_build(ids, &st, &ids->maplen);
+    hwids_save(path, ids->map, ids->maplen);
+    ids->maplen = -ids->maplen;
+  }
+  ids->vcount = ((struct hwids_head *)ids->map)->vcount;
+  ids->dcount = ((struct hwids_head *)ids->map)->dcount;
+  ids->vendors = (void *)(ids->map+sizeof(struct hwids_head));
+  ids->devices = ids->vendors+ids->vcount;
+
+  return ids;
+}
+
+void hwids_close(struct hwids *ids)
+{
+  if (!ids) return;
+  if (ids->maplen<0) free(ids->map);
+  else munmap(ids->map, ids->maplen);
+  munmap(ids->text, ids->textlen);
+  free(ids);
+}
+
+// Copy the name of vendor (or with device not -1, of vendor's device) into
+// buf, returning buf or 0 if the database doesn't know it.
+char *hwids_name(struct hwids *ids, int vendor, int device, char *buf, int size)
+{
+  struct hwid *list = device == -1 ? ids->vendors : ids->devices;
+  unsigned lo = 0, hi = device == -1 ? ids->vcount : ids->dcount, mid,
+    id = device == -1 ? vendor : (vendor<<16)|device;
+  char *s, *e;
+
+  // leftmost match, which is the first in the text
+  while (lo<hi) {
+    mid = lo+(hi-lo)/2;
+    if (list[mid].id<id) lo = mid+1;
+    else hi = mid;
+  }
+  if (lo == (device == -1 ? ids->vcount : ids->dcount) || list[lo].id != id
+      || list[lo].off >= ids->textlen || size<1) return 0;
+
+  s = ids->text+list[lo].off;
+  if (!(e = memchr(s, '\n', ids->textlen-list[lo].off)))
+    e = ids->text+ids->textlen;
+  if (e-s >= size) e = s+size-1;
+  memcpy(buf, s, e-s);
+  buf[e-s] = 0;
+
+  return buf;
+}
@@ -10,6 +10,8 @@ void verror_msg(char *msg, int err, va_list va)
 {
   char *s = ": %s";
 
+  // stdout may be buffered, keep it in order with this when they're the same
+  fflush(stdout);
   fprintf(stderr, "%s: ", toys.which->name);
   if (msg) vfprintf(stderr, msg, va);
   else s+=2;
@@ -84,7 +86,11 @@ ssize_t readall(int fd, void *buf, size_t len)
   size_t count = 0;
 
   while (count<len) {
-    int i = read(fd, (char *)buf+count, len-count);
+    int i;
+
+    toy_cancelpoint();
+    i = read(fd, (char *)buf+count, len-count);
+    TOY_IO_READ(i);
     if (!i) break;
     if (i<0) return i;
     count += i;
@@ -98,7 +104,11 @@ ssize_t writeall(int fd, void *buf, size_t len)
 {
   size_t count = 0;
   while (count<len) {
-    int i = write(fd, count+(char *)buf, len-count);
+    int i;
+
+    toy_cancelpoint();
+    i = write(fd, count+(char *)buf, len-count);
+    TOY_IO_WRITE(i);
     if (i<1) return i;
     count += i;
   }
@@ -297,6 +307,40 @@ long atolx_range(char *numstr, long low, long high)
   return val;
 }
 
+// Digits go right aligned before the NUL at the end of digits[], step's
+// likewise, so adding them is a carry from the last digit forward.
+
+static int ascii_digits(char *buf, int size, unsigned long long n)
+{
+  char *s = buf+size-1;
+
+  *s = 0;
+  do *--s = '0'+n%10; while (n /= 10);
+
+  return buf+size-1-s;
+}
+
+void ascii_count_init(struct ascii_count *ac, unsigned long long start,
+  unsigned long long step)
+{
+  ac->len = ascii_digits(ac->digits, sizeof(ac->digits), start);
+  ac->steplen = ascii_digits(ac->step, sizeof(ac->step), step);
+}
+
+void ascii_count_next(struct ascii_count *ac)
+{
+  char *s = ac->digits+sizeof(ac->digits)-1, *t = ac->step+sizeof(ac->step)-1;
+  int i, d, carry = 0;
+
+  for (i = 0; i<ac->steplen || carry; i++) {
+    d = carry + (i<ac->len ? s[-1-i]-'0' : 0)
+      + (i<ac->steplen ? t[-1-i]-'0' : 0);
+    if ((carry = d>9)) d -= 10;
+    s[-1-i] = '0'+d;
+  }
+  if (i>ac->len) ac->len = i;
+}
+
 int stridx(char *haystack, char needle)
 {
   char *off;
@@ -376,18 +420,20 @@ off_t fdlength(int fd)
   struct stat st;
   off_t base = 0, range = 1, expand = 1, old;
 
-  if (!fstat(fd, &st) && S_ISREG(st.st_mode)) return st.st_size;
+  if (fstat(fd, &st)) st.st_mode = 0;
+  else if (S_ISREG(st.st_mode)) return st.st_size;
 
   // If the ioctl works for this, return it.
-  // TODO: is blocksize still always 512, or do we stat for it?
-  // unsigned int size;
-  // if (ioctl(fd, BLKGETSIZE, &size) >= 0) return size*512L;
+#ifdef BLKGETSIZE64
+  if (S_ISBLK(st.st_mode)) {
+    unsigned long long size;
 
-  // If not, do a binary search for the last location we can read.  (Some
-  // block devices don't do BLKGETSIZE right.)  This should probably have
-  // a CONFIG option...
+    if (!ioctl(fd, BLKGETSIZE64, &size)) return size;
+  }
+#endif
 
-  // If not, do a binary search for the last location we can read.
+  // If not, do a binary search for the last location we can read.  (Some
+  // block devices don't do BLKGETSIZE right.)
 
   old = lseek(fd, 0, SEEK_CUR);
   do {
@@ -452,6 +498,26 @@ void msleep(long miliseconds)
   nanosleep(&ts, &ts);
 }
 
+// Milliseconds from an arbitrary start, for measuring intervals
+unsigned long long millitime(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec*1000ULL+ts.tv_nsec/1000000;
+}
+
+// Microseconds, same clock, for timing round trips.
+unsigned long long microtime(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec*1000000ULL+ts.tv_nsec/1000;
+}
+
 // Inefficient, but deals with unaligned access
 int64_t peek_le(void *ptr, unsigned size)
 {
@@ -459,7 +525,7 @@ int64_t peek_le(void *ptr, unsigned size)
   char *c = ptr;
   unsigned i;
 
-  for (i=0; i<size; i++) ret |= ((int64_t)c[i])<<i;
+  for (i=0; i<size; i++) ret |= ((int64_t)(unsigned char)c[i])<<(i*8);
 
   return ret;
 }
@@ -469,7 +535,7 @@ int64_t peek_be(void *ptr, unsigned size)
   int64_t ret = 0;
   char *c = ptr;
 
-  while (size--) ret = (ret<<8)|c[size];
+  while (size--) ret = (ret<<8)|(unsigned char)*c++;
 
   return ret;
 }
@@ -509,17 +575,18 @@ void loopfiles_rw(char **argv, int flags, int permissions, int failok,
   int fd;
 
   // If no arguments, read from stdin.
-  if (!*argv) function((flags & O_ACCMODE) != O_RDONLY ? 1 : 0, "-");
+  if (!*argv)
+    function(fileno((flags & O_ACCMODE) != O_RDONLY ? stdout : stdin), "-");
   else do {
     // Filename "-" means read from stdin.
     // Inability to open a file prints a warning, but doesn't exit.
 
-    if (!strcmp(*argv, "-")) fd=0;
+    if (!strcmp(*argv, "-")) fd = fileno(stdin);
     else if (0>(fd = open(*argv, flags, permissions)) && !failok) {
       perror_msg("%s", *argv);
       toys.exitval = 1;
       continue;
-    }
+    } else if (fd>=0) toy_io.opens++;
     function(fd, *argv);
     if (flags & O_CLOEXEC) close(fd);
   } while (*++argv);
@@ -531,15 +598,40 @@ void loopfiles(char **argv, void (*function)(int fd, char *name))
   loopfiles_rw(argv, O_RDONLY|O_CLOEXEC, 0, 0, function);
 }
 
-// Slow, but small.
+// Read one line, leaving fd positioned right after it so callers can mix
+// this with other reads. That means a byte at a time from pipes, and a
+// read plus an lseek() per line for files. Use a linebuf for bulk reading.
 
 char *get_rawline(int fd, long *plen, char end)
 {
-  char c, *buf = NULL;
-  long len = 0;
-
-  for (;;) {
-    if (1>read(fd, &c, 1)) break;
+  char c, *buf = NULL, *s;
+  long len = 0, size = 0, got;
+  struct stat st;
+  off_t pos;
+
+  if (!fstat(fd, &st) && S_ISREG(st.st_mode)
+      && -1 != (pos = lseek(fd, 0, SEEK_CUR)))
+  {
+    for (;;) {
+      if (len == size) buf = xrealloc(buf, (size = size ? size*2 : 128)+1);
+      got = read(fd, buf+len, size-len);
+      TOY_IO_READ(got);
+      if (1>got) break;
+      if ((s = memchr(buf+len, end, got))) {
+        len = s+1-buf;
+        lseek(fd, pos+len, SEEK_SET);
+        break;
+      }
+      len += got;
+    }
+    if (!len) {
+      free(buf);
+      buf = NULL;
+    }
+  } else for (;;) {
+    got = read(fd, &c, 1);
+    TOY_IO_READ(got);
+    if (1>got) break;
     if (!(len & 63)) buf=xrealloc(buf, len+65);
     if ((buf[len++]=c) == end) break;
   }
@@ -559,6 +651,226 @@ char *get_line(int fd)
   return buf;
 }
 
+// Buffered line reading. This reads ahead, so once an fd is handed to a
+// linebuf don't read from it any other way until linebuf_done(), which
+// gives unread data back to seekable files.
+
+void linebuf_init(struct linebuf *lb, int fd)
+{
+  memset(lb, 0, sizeof(struct linebuf));
+  lb->fd = fd;
+}
+
+// Like linebuf_init() but only read len bytes starting at off, with pread()
+// so several linebufs can share one fd without disturbing its offset.
+
+void linebuf_range(struct linebuf *lb, int fd, long long off, long long len)
+{
+  linebuf_init(lb, fd);
+  lb->off = off;
+  lb->left = len;
+  lb->ranged = 1;
+}
+
+// Return the next line (with its end character unless LINEBUF_CHOMP) and
+// set *plen to its length, or return NULL at EOF. The line is null
+// terminated but lives in the linebuf, and is only good until the next call:
+// xstrndup() it to keep it.
+
+char *get_linebuf(struct linebuf *lb, long *plen, char end, int flags)
+{
+  char *s = 0, *line;
+  long len, seen;
+
+  // Put back the byte the last line's null terminator was sitting on
+  if (lb->held) lb->buf[lb->start] = lb->save;
+  lb->held = 0;
+
+  for (seen = lb->start;;) {
+    if (lb->end > seen && (s = memchr(lb->buf+seen, end, lb->end-seen)))
+      break;
+    if (lb->eof) {
+      if (lb->start == lb->end) return 0;
+      break;
+    }
+
+    // Slide the partial line to the front, growing the buffer if it's full
+    // (keeping one spare byte for the null terminator).
+    if (lb->start) {
+      memmove(lb->buf, lb->buf+lb->start, lb->end -= lb->start);
+      lb->start = 0;
+    }
+    if (lb->end+1 >= lb->size)
+      lb->buf = xrealloc(lb->buf, lb->size = lb->size ? lb->size*2 : 4096);
+    seen = lb->end;
+    len = lb->size-lb->end-1;
+    if (!lb->ranged) len = read(lb->fd, lb->buf+lb->end, len);
+    else if ((len = len<lb->left ? len : lb->left))
+      if (0<(len = pread(lb->fd, lb->buf+lb->end, len, lb->off)))
+        lb->off += len, lb->left -= len;
+    TOY_IO_READ(len);
+    if (1>len) lb->eof++;
+    else lb->end += len;
+  }
+
+  line = lb->buf+lb->start;
+  lb->start += (len = s ? s+1-line : lb->end-lb->start);
+  if (s && (flags&LINEBUF_CHOMP)) *s = 0, len--;
+  else {
+    if (lb->start < lb->end) lb->save = lb->buf[lb->start], lb->held++;
+    lb->buf[lb->start] = 0;
+  }
+  if (plen) *plen = len;
+
+  return line;
+}
+
+void linebuf_done(struct linebuf *lb)
+{
+  if (lb->held) lb->buf[lb->start] = lb->save;
+  if (!lb->ranged && lb->end > lb->start)
+    lseek(lb->fd, lb->start-lb->end, SEEK_CUR);
+  free(lb->buf);
+  lb->buf = 0;
+}
+
+// Open addressing with linear probing, grown to keep it under half full, so
+// checking a file against a million hardlinks seen before is a probe or two
+// rather than a walk down a list.
+
+static unsigned long inodeset_hash(struct inodeset *set, dev_t dev, ino_t ino)
+{
+  unsigned long long h = ((unsigned long long)dev<<32)^ino;
+
+  h *= 0x9e3779b97f4a7c15ULL;
+
+  return (h^(h>>29)) & (set->size-1);
+}
+
+// Return the data pointer for (dev, ino), adding the pair with NULL data if
+// it's not there yet. Store something non-NULL in it to remember the pair,
+// an entry left NULL counts as not there.
+
+void **inodeset_slot(struct inodeset *set, dev_t dev, ino_t ino)
+{
+  struct inodeset_ent *ent;
+  unsigned long i;
+
+  if (2*(set->used+1) > set->size) {
+    struct inodeset_ent *old = set->ent;
+    unsigned long oldsize = set->size;
+
+    set->size = oldsize ? 2*oldsize : 256;
+    set->ent = xzalloc(set->size*sizeof(*set->ent));
+    for (set->used = i = 0; i<oldsize; i++) if (old[i].data) {
+      ent = set->ent+inodeset_hash(set, old[i].dev, old[i].ino);
+      while (ent->data) if (++ent == set->ent+set->size) ent = set->ent;
+      *ent = old[i];
+      set->used++;
+    }
+    free(old);
+  }
+
+  ent = set->ent+inodeset_hash(set, dev, ino);
+  while (ent->data && (ent->dev != dev || ent->ino != ino))
+    if (++ent == set->ent+set->size) ent = set->ent;
+  if (!ent->data) {
+    ent->dev = dev;
+    ent->ino = ino;
+    set->used++;
+  }
+
+  return &ent->data;
+}
+
+// Return the data for (dev, ino) without adding it, or NULL if it's not there.
+
+void *inodeset_find(struct inodeset *set, dev_t dev, ino_t ino)
+{
+  struct inodeset_ent *ent;
+
+  if (!set->size) return 0;
+  ent = set->ent+inodeset_hash(set, dev, ino);
+  while (ent->data && (ent->dev != dev || ent->ino != ino))
+    if (++ent == set->ent+set->size) ent = set->ent;
+
+  return ent->data;
+}
+
+// Free the table, calling using() (if not NULL) on each entry's data first.
+
+void inodeset_free(struct inodeset *set, void (*using)(void *data))
+{
+  unsigned long i;
+
+  if (using) for (i = 0; i<set->size; i++)
+    if (set->ent[i].data) using(set->ent[i].data);
+  free(set->ent);
+  memset(set, 0, sizeof(struct inodeset));
+}
+
+// Names of uids and gids. Small libcs reread /etc/passwd or /etc/group for
+// every getpwuid() or getgrgid(), so remember what they said, including that
+// there's no such user. Entries are never freed, so callers can keep the
+// names. (Asking libc as needed rather than parsing the files up front means
+// anything nsswitch.conf adds still works.)
+
+static struct idname {
+  struct idname *next;
+  char *name;
+  unsigned id;
+  char group;
+} *idnames[64];
+#if CFG_TOYBOX_THREADS
+static pthread_mutex_t idname_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static char *id_name(unsigned id, int group)
+{
+  struct idname *in, **bucket = idnames+((2*id+group)&63);
+  char *name = 0;
+
+#if CFG_TOYBOX_THREADS
+  pthread_mutex_lock(&idname_lock);
+#endif
+  for (in = *bucket; in; in = in->next)
+    if (in->id == id && in->group == group) break;
+  if (!in) {
+    if (group) {
+      struct group *gr = getgrgid(id);
+
+      if (gr) name = gr->gr_name;
+    } else {
+      struct passwd *pw = getpwuid(id);
+
+      if (pw) name = pw->pw_name;
+    }
+    in = xkeep(xmalloc(sizeof(struct idname)+(name ? strlen(name)+1 : 0)));
+    in->name = name ? strcpy((char *)(in+1), name) : 0;
+    in->id = id;
+    in->group = group;
+    in->next = *bucket;
+    *bucket = in;
+  }
+#if CFG_TOYBOX_THREADS
+  pthread_mutex_unlock(&idname_lock);
+#endif
+
+  return in->name;
+}
+
+// Return the name of uid, or NULL if there's no such user.
+char *uid_name(uid_t uid)
+{
+  return id_name(uid, 0);
+}
+
+// Return the name of gid, or NULL if there's no such group.
+char *gid_name(gid_t gid)
+{
+  return id_name(gid, 1);
+}
+
 int wfchmodat(int fd, char *name, mode_t mode)
 {
   int rc = xfchmodat(fd, name, mode, 0);
@@ -578,21 +890,35 @@ static void tempfile_handler(int i)
   _exit(1);
 }
 
-// Open a temporary file to copy an existing file into.
+// Open a temporary file to copy an existing file into. It's next to the
+// original so replace_tempfile() can rename() it over the top, starts out
+// with the original's owner and mode, and has the original's size reserved
+// where the filesystem can so the rewrite is laid out in one piece.
 int copy_tempfile(int fdin, char *name, char **tempname)
 {
-  struct stat statbuf;
+  struct stat statbuf, st;
   int fd;
 
-  *tempname = xmprintf("%s%s", name, "XXXXXX");
+  // tempfile2zap may outlive the command, so it's kept.
+  *tempname = xkeep(xmprintf("%s%s", name, "XXXXXX"));
   if(-1 == (fd = mkstemp(*tempname))) error_exit("no temp file");
   if (!tempfile2zap) sigatexit(tempfile_handler);
   tempfile2zap = *tempname;
 
-  // Set permissions of output file
-
-  fstat(fdin, &statbuf);
-  fchmod(fd, statbuf.st_mode);
+  // Set owner and permissions of output file (mode last, chown clears suid)
+
+  if (!fstat(fdin, &statbuf)) {
+    if (!fstat(fd, &st)
+        && (st.st_uid != statbuf.st_uid || st.st_gid != statbuf.st_gid))
+      fchown(fd, statbuf.st_uid, statbuf.st_gid);
+    fchmod(fd, statbuf.st_mode);
+#if TOYBOX_COPYFILE
+    if (sizeof(long) >= sizeof(off_t) && S_ISREG(statbuf.st_mode)
+        && statbuf.st_size)
+      syscall(SYS_fallocate, fd, FALLOC_FL_KEEP_SIZE, 0L,
+        (long)statbuf.st_size);
+#endif
+  }
 
   return fd;
 }
@@ -608,18 +934,40 @@ void delete_tempfile(int fdin, int fdout, char **tempname)
   *tempname = NULL;
 }
 
-// Copy the rest of the data and replace the original with the copy.
+// Copy the rest of the data and replace the original with the copy. With
+// TOYBOX_FSYNC the new contents and the rename are on disk before we return,
+// so a crash leaves either the old file or the new one.
 void replace_tempfile(int fdin, int fdout, char **tempname)
 {
-  char *temp = xstrdup(*tempname);
+  char *temp = xstrdup(*tempname), *s;
+  struct stat st;
+  int fd;
 
   temp[strlen(temp)-6]=0;
   if (fdin != -1) {
     xsendfile(fdin, fdout);
     xclose(fdin);
   }
+
+  // Give back whatever copy_tempfile() reserved past the end
+  if (TOYBOX_COPYFILE && !fstat(fdout, &st) && S_ISREG(st.st_mode))
+    ftruncate(fdout, st.st_size);
+  if (CFG_TOYBOX_FSYNC && fsync(fdout)) {
+    unlink(*tempname);
+    perror_exit("fsync %s", temp);
+  }
   xclose(fdout);
-  rename(*tempname, temp);
+  if (rename(*tempname, temp)) {
+    unlink(*tempname);
+    perror_exit("rename %s", temp);
+  }
+  if (CFG_TOYBOX_FSYNC) {
+    if ((s = strrchr(temp, '/'))) *s = 0;
+    if (-1 != (fd = open(s ? (s == temp ? "/" : temp) : ".", O_RDONLY))) {
+      fsync(fd);
+      close(fd);
+    }
+  }
   tempfile2zap = (char *)1;
   free(*tempname);
   free(temp);
@@ -642,6 +990,209 @@ void crc_init(unsigned int *crc_table, int little_endian)
   }
 }
 
+// CRC32 a buffer at a time, continuing from crc (callers do their own
+// inversion at the start and end). It's the same polynomial either way
+// around: little endian is the bit reflected one gzip, zip and xz use, big
+// endian is what cksum and bzip2 do.
+//
+// The portable version looks up 8 bytes at once in 8 tables (slicing by 8,
+// 8k per bit order, built the first time that order's used). Processors with
+// carryless multiply (x86 pclmul) or crc instructions (armv8) do little
+// endian several times faster, and crc_update() switches over to those when
+// the processor it's running on has them and they get the right answer.
+
+static unsigned *crc_slice[2];
+
+static unsigned *crc_tables(int le)
+{
+  unsigned *t = crc_slice[le], i;
+
+  if (t) return t;
+  t = xkeep(xmalloc(8*256*sizeof(*t)));
+  crc_init(t, le);
+  for (i = 256; i<8*256; i++)
+    t[i] = le ? (t[i-256]>>8)^t[t[i-256]&255] : (t[i-256]<<8)^t[t[i-256]>>24];
+  // Another thread can get here first, but it builds the same tables.
+  __sync_synchronize();
+
+  return crc_slice[le] = t;
+}
+
+static unsigned crc_sliced(unsigned crc, unsigned char *s, size_t len, int le)
+{
+  unsigned *t = crc_tables(le), w[2], a, b;
+
+  if (le) {
+    for (; len>=8; len -= 8, s += 8) {
+      memcpy(w, s, 8);
+      a = crc^SWAP_LE32(w[0]);
+      b = SWAP_LE32(w[1]);
+      crc = t[7*256+(a&255)]^t[6*256+((a>>8)&255)]^t[5*256+((a>>16)&255)]
+        ^t[4*256+(a>>24)]^t[3*256+(b&255)]^t[2*256+((b>>8)&255)]
+        ^t[256+((b>>16)&255)]^t[b>>24];
+    }
+    while (len--) crc = t[(crc^*s++)&255]^(crc>>8);
+  } else {
+    for (; len>=8; len -= 8, s += 8) {
+      memcpy(w, s, 8);
+      a = crc^SWAP_BE32(w[0]);
+      b = SWAP_BE32(w[1]);
+      crc = t[7*256+(a>>24)]^t[6*256+((a>>16)&255)]^t[5*256+((a>>8)&255)]
+        ^t[4*256+(a&255)]^t[3*256+(b>>24)]^t[2*256+((b>>16)&255)]
+        ^t[256+((b>>8)&255)]^t[b&255];
+    }
+    while (len--) crc = t[(crc>>24)^*s++]^(crc<<8);
+  }
+
+  return crc;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define CRC_PCLMUL 1
+
+// Fold 64 bytes at a time into four 128 bit accumulators, then those into
+// one, then Barrett reduce that to 32 bits ("Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ", Intel 2009, constants for the reflected
+// polynomial). Only does whole 16 byte chunks, at least 64 bytes of them.
+
+#define CRC_FOLD(x, k, y) \
+  _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), \
+    _mm_clmulepi64_si128(x, k, 0x00)), y)
+
+__attribute__((target("pclmul,sse4.1")))
+static unsigned crc_pclmul(unsigned crc, char *s, size_t len)
+{
+  __m128i x[4], k, y, mask = _mm_setr_epi32(~0, 0, ~0, 0);
+  int i;
+
+  for (i = 0; i<4; i++) x[i] = _mm_loadu_si128((void *)(s+16*i));
+  x[0] = _mm_xor_si128(x[0], _mm_cvtsi32_si128(crc));
+  k = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);
+  for (s += 64, len -= 64; len>=64; s += 64, len -= 64)
+    for (i = 0; i<4; i++)
+      x[i] = CRC_FOLD(x[i], k, _mm_loadu_si128((void *)(s+16*i)));
+
+  k = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);
+  for (i = 1; i<4; i++) *x = CRC_FOLD(*x, k, x[i]);
+  for (; len>=16; s += 16, len -= 16)
+    *x = CRC_FOLD(*x, k, _mm_loadu_si128((void *)s));
+
+  // 128 bits to 64, then Barrett reduction to 32.
+  *x = _mm_xor_si128(_mm_srli_si128(*x, 8), _mm_clmulepi64_si128(*x, k, 0x10));
+  y = _mm_srli_si128(*x, 4);
+  *x = _mm_xor_si128(y, _mm_clmulepi64_si128(_mm_and_si128(*x, mask),
+    _mm_set_epi64x(0, 0x163cd6124), 0x00));
+  k = _mm_set_epi64x(0x1f7011641, 0x1db710641);
+  y = _mm_and_si128(_mm_clmulepi64_si128(_mm_and_si128(*x, mask), k, 0x10),
+    mask);
+  *x = _mm_xor_si128(*x, _mm_clmulepi64_si128(y, k, 0x00));
+
+  return _mm_extract_epi32(*x, 1);
+}
+
+static unsigned crc_fast(unsigned crc, unsigned char *s, size_t len)
+{
+  size_t fold = len&~(size_t)15;
+
+  if (fold<64) return crc_sliced(crc, s, len, 1);
+  crc = crc_pclmul(crc, (void *)s, fold);
+
+  return crc_sliced(crc, s+fold, len-fold, 1);
+}
+
+static int crc_hardware(void)
+{
+  unsigned a, b, c, d;
+
+  return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_PCLMUL)
+    && (c & bit_SSE4_1);
+}
+
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#define CRC_ARMV8 1
+
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1<<7)
+#endif
+
+__attribute__((target("+crc")))
+static unsigned crc_fast(unsigned crc, unsigned char *s, size_t len)
+{
+  unsigned long long w;
+
+  for (; len && ((long)s&7); len--) crc = __crc32b(crc, *s++);
+  for (; len>=8; len -= 8, s += 8) {
+    memcpy(&w, s, 8);
+    crc = __crc32d(crc, SWAP_LE64(w));
+  }
+  while (len--) crc = __crc32b(crc, *s++);
+
+  return crc;
+}
+
+static int crc_hardware(void)
+{
+  return !!(getauxval(AT_HWCAP) & HWCAP_CRC32);
+}
+#endif
+
+unsigned crc_update(unsigned crc, void *data, size_t len, int little_endian)
+{
+#if CRC_PCLMUL || CRC_ARMV8
+  // 0 = not checked yet, 1 = use it, 2 = don't.
+  static char fast;
+
+  if (little_endian && !fast) {
+    unsigned char test[256];
+    int i;
+
+    for (i = 0; i<sizeof(test); i++) test[i] = i*7;
+    fast = 2;
+    if (crc_hardware() && crc_fast(~0, test, 255) == crc_sliced(~0, test, 255, 1))
+      fast = 1;
+  }
+  if (little_endian && fast == 1) return crc_fast(crc, data, len);
+#endif
+
+  return crc_sliced(crc, data, len, little_endian);
+}
+
+// Multiply a vector by a 32x32 bit matrix over GF(2), for crc_combine().
+static unsigned crc_gf2(unsigned *mat, unsigned vec)
+{
+  unsigned sum = 0;
+
+  for (; vec; vec >>= 1, mat++) if (vec&1) sum ^= *mat;
+
+  return sum;
+}
+
+// Given finished (inverted) little endian crcs of two pieces of data, return
+// the crc of both together, where len2 is the second one's length. That's
+// the first crc advanced by len2 zero bytes (squaring a matrix that does one
+// zero bit, once per bit of len2) then xored with the second one.
+unsigned crc_combine(unsigned crc1, unsigned crc2, long long len2)
+{
+  unsigned m[2][32], i, row = 1;
+
+  if (len2<1) return crc1;
+  for (*m[1] = 0xEDB88320, i = 1; i<32; i++, row <<= 1) m[1][i] = row;
+  for (i = 0; i<32; i++) m[0][i] = crc_gf2(m[1], m[1][i]);
+  for (i = 0; i<32; i++) m[1][i] = crc_gf2(m[0], m[0][i]);
+  for (i = 0; len2; i ^= 1, len2 >>= 1) {
+    unsigned *in = m[!i], *out = m[i], j;
+
+    for (j = 0; j<32; j++) out[j] = crc_gf2(in, in[j]);
+    if (len2&1) crc1 = crc_gf2(out, crc1);
+  }
+
+  return crc1^crc2;
+}
+
 // Init base64 table
 
 void base64_init(char *p)
@@ -657,6 +1208,382 @@ void base64_init(char *p)
   *(p++) = '/';
 }
 
+// Base64 and hex a block at a time (and finding runs of printable text).
+// These use their own tables so they don't need a toybuf, and the vector
+// versions do 16 characters per loop: x86 with ssse3 (checked at runtime),
+// and arm64 (which always has neon).
+
+static char base64_chars[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+  hex_digits[] = "0123456789abcdef";
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define LIB_SSSE3 1
+
+// Spread 12 bytes into 16 6-bit indexes with shuffle and multiply, then
+// turn indexes into ascii by adding an offset looked up per range.
+__attribute__((target("ssse3")))
+static int base64_enc_fast(char *out, unsigned char *in, int len)
+{
+  __m128i x, y, shift = _mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52,
+    '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+  int done = 0;
+
+  for (; len-done>=16; done += 12, out += 16) {
+    x = _mm_shuffle_epi8(_mm_loadu_si128((void *)(in+done)),
+      _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    x = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(x,
+      _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040)),
+      _mm_mullo_epi16(_mm_and_si128(x, _mm_set1_epi32(0x003f03f0)),
+        _mm_set1_epi32(0x01000010)));
+    y = _mm_or_si128(_mm_subs_epu8(x, _mm_set1_epi8(51)),
+      _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), x), _mm_set1_epi8(13)));
+    _mm_storeu_si128((void *)out, _mm_add_epi8(x, _mm_shuffle_epi8(shift, y)));
+  }
+
+  return done;
+}
+
+// Classify each character by its high and low nibble (a zero AND means
+// it's in the alphabet), bail out on anything else, then add an offset per
+// range to get 6-bit values and multiply/shuffle them back together.
+__attribute__((target("ssse3")))
+static int base64_dec_fast(char *out, unsigned char *in, int len)
+{
+  __m128i x, hi, lo, nib = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128(),
+    lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a),
+    lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10),
+    roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0,
+      0, 0);
+  char buf[16];
+  int done = 0;
+
+  for (; len-done>=16; done += 16, out += 12) {
+    x = _mm_loadu_si128((void *)(in+done));
+    hi = _mm_and_si128(_mm_srli_epi32(x, 4), nib);
+    lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(x, nib));
+    if (0xffff != _mm_movemask_epi8(_mm_cmpeq_epi8(zero,
+      _mm_and_si128(lo, _mm_shuffle_epi8(lut_hi, hi))))) break;
+    x = _mm_add_epi8(x, _mm_shuffle_epi8(roll,
+      _mm_add_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('/')), hi)));
+    x = _mm_madd_epi16(_mm_maddubs_epi16(x, _mm_set1_epi32(0x01400140)),
+      _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128((void *)buf, _mm_shuffle_epi8(x, _mm_setr_epi8(2, 1, 0,
+      6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)));
+    memcpy(out, buf, 12);
+  }
+
+  return done;
+}
+
+// Look up each nibble in the 16 digits and interleave high and low.
+__attribute__((target("ssse3")))
+static int hex_enc_fast(char *out, unsigned char *in, int len)
+{
+  __m128i x, hi, lo, nib = _mm_set1_epi8(0x0f),
+    dig = _mm_loadu_si128((void *)hex_digits);
+  int done = 0;
+
+  for (; len-done>=16; done += 16, out += 32) {
+    x = _mm_loadu_si128((void *)(in+done));
+    hi = _mm_shuffle_epi8(dig, _mm_and_si128(_mm_srli_epi16(x, 4), nib));
+    lo = _mm_shuffle_epi8(dig, _mm_and_si128(x, nib));
+    _mm_storeu_si128((void *)out, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((void *)(out+16), _mm_unpackhi_epi8(hi, lo));
+  }
+
+  return done;
+}
+
+// Signed compares put 128-255 below ' ', so two compares and a tab check
+// classify 16 bytes, and the mask's first set bit is where the span stops.
+__attribute__((target("ssse3")))
+static int printable_fast(unsigned char *in, int len, int want)
+{
+  __m128i x, lo = _mm_set1_epi8(' '-1), hi = _mm_set1_epi8(127),
+    tab = _mm_set1_epi8('\t');
+  int done = 0, m;
+
+  for (; len-done>=16; done += 16) {
+    x = _mm_loadu_si128((void *)(in+done));
+    m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, tab),
+      _mm_and_si128(_mm_cmpgt_epi8(x, lo), _mm_cmplt_epi8(x, hi))));
+    if (want) m = ~m & 0xffff;
+    if (m) return done+__builtin_ctz(m);
+  }
+
+  return done;
+}
+
+static int vector_hardware(void)
+{
+  unsigned a, b, c, d;
+
+  return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3);
+}
+
+#elif defined(__GNUC__) && defined(__aarch64__)
+#include <arm_neon.h>
+#define LIB_NEON 1
+
+// 48 bytes at a time: split 3 ways, shift into 4 sets of indexes, and look
+// those up in all 64 characters at once.
+static int base64_enc_fast(char *out, unsigned char *in, int len)
+{
+  uint8x16_t m = vdupq_n_u8(0x3f);
+  uint8x16x4_t tbl, x;
+  uint8x16x3_t y;
+  int done = 0, i;
+
+  for (i = 0; i<4; i++) tbl.val[i] = vld1q_u8((void *)(base64_chars+16*i));
+  for (; len-done>=48; done += 48, out += 64) {
+    y = vld3q_u8(in+done);
+    x.val[0] = vshrq_n_u8(y.val[0], 2);
+    x.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(y.val[1], 4),
+      vshlq_n_u8(y.val[0], 4)), m);
+    x.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(y.val[2], 6),
+      vshlq_n_u8(y.val[1], 2)), m);
+    x.val[3] = vandq_u8(y.val[2], m);
+    for (i = 0; i<4; i++) x.val[i] = vqtbl4q_u8(tbl, x.val[i]);
+    vst4q_u8((void *)out, x);
+  }
+
+  return done;
+}
+
+static int hex_enc_fast(char *out, unsigned char *in, int len)
+{
+  uint8x16_t dig = vld1q_u8((void *)hex_digits), m = vdupq_n_u8(0x0f), x;
+  uint8x16x2_t y;
+  int done = 0;
+
+  for (; len-done>=16; done += 16, out += 32) {
+    x = vld1q_u8(in+done);
+    y.val[0] = vqtbl1q_u8(dig, vshrq_n_u8(x, 4));
+    y.val[1] = vqtbl1q_u8(dig, vandq_u8(x, m));
+    vst2q_u8((void *)out, y);
+  }
+
+  return done;
+}
+
+// No movemask on neon: narrowing shift the compare result down to 4 bits
+// per byte instead.
+static int printable_fast(unsigned char *in, int len, int want)
+{
+  uint8x16_t x, m;
+  uint64_t bits;
+  int done = 0;
+
+  for (; len-done>=16; done += 16) {
+    x = vld1q_u8(in+done);
+    m = vorrq_u8(vceqq_u8(x, vdupq_n_u8('\t')),
+      vandq_u8(vcgtq_u8(x, vdupq_n_u8(' '-1)), vcltq_u8(x, vdupq_n_u8(127))));
+    if (want) m = vmvnq_u8(m);
+    bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(
+      vreinterpretq_u16_u8(m), 4)), 0);
+    if (bits) return done+(__builtin_ctzll(bits)>>2);
+  }
+
+  return done;
+}
+
+static int vector_hardware(void)
+{
+  return 1;
+}
+#endif
+
+// Characters' values plus one, so zero means not in the alphabet.
+static unsigned char *base64_values(void)
+{
+  static unsigned char val[256];
+  int i;
+
+  if (!val['/']) {
+    for (i = 0; i<63; i++) val[(unsigned char)base64_chars[i]] = i+1;
+    // Another thread can get here first, but it fills in the same values.
+    __sync_synchronize();
+    val['/'] = 64;
+  }
+
+  return val;
+}
+
+#if LIB_SSSE3 || LIB_NEON
+// 0 = not checked yet, 1 = use vector code, 2 = don't.
+static char vector_fast;
+
+static int use_vector(void)
+{
+  if (!vector_fast) vector_fast = 2-vector_hardware();
+
+  return vector_fast == 1;
+}
+#endif
+
+// Encode len bytes as base64, into out with room for 4 bytes per 3 of input
+// (rounded up). Pads with = if len isn't a multiple of 3, so for a stream
+// of blocks only the last one should be. Returns bytes written.
+int base64_encode(char *out, void *data, int len)
+{
+  unsigned char *in = data;
+  char *o = out, *c = base64_chars;
+  unsigned x;
+  int i;
+
+#if LIB_SSSE3 || LIB_NEON
+  if (use_vector()) {
+    i = base64_enc_fast(o, in, len);
+    o += i/3*4;
+    in += i;
+    len -= i;
+  }
+#endif
+  for (; len>=3; len -= 3, in += 3) {
+    x = (in[0]<<16)|(in[1]<<8)|in[2];
+    *o++ = c[x>>18];
+    *o++ = c[(x>>12)&63];
+    *o++ = c[(x>>6)&63];
+    *o++ = c[x&63];
+  }
+  if (len) {
+    x = (in[0]<<16)|((len>1) ? in[1]<<8 : 0);
+    *o++ = c[x>>18];
+    *o++ = c[(x>>12)&63];
+    *o++ = (len>1) ? c[(x>>6)&63] : '=';
+    *o++ = '=';
+  }
+
+  return o-out;
+}
+
+// Decode base64 into out, which needs 3 bytes per 4 of input and can be the
+// same buffer. Partial groups carry over between calls in *state, which
+// starts at 0, and a call with len 0 at the end of input flushes what's left.
+// Newlines are skipped, as is anything outside the alphabet if ignore is
+// set, otherwise that returns -1. An = ends the data: it sets *state to -1,
+// after which this does nothing. Returns bytes written.
+int base64_decode(char *out, char *data, int len, int *state, int ignore)
+{
+  unsigned char *in = (void *)data, *val = base64_values(), a, b, c, d;
+  unsigned x = *state>>2, y;
+  int n = *state&3, i, end = !len;
+  char *o = out;
+
+  if (*state == -1) return 0;
+  while (len) {
+    // Whole groups at a time, while everything's in the alphabet.
+    if (!n) {
+#if LIB_SSSE3
+      if (len>=16 && use_vector()) {
+        i = base64_dec_fast(o, in, len);
+        o += i/4*3;
+        in += i;
+        len -= i;
+      }
+#endif
+      for (; len>=4; len -= 4, in += 4) {
+        if (!((a = val[in[0]]) && (b = val[in[1]]) && (c = val[in[2]])
+          && (d = val[in[3]]))) break;
+        y = ((a-1)<<18)|((b-1)<<12)|((c-1)<<6)|(d-1);
+        *o++ = y>>16;
+        *o++ = y>>8;
+        *o++ = y;
+      }
+      if (!len) break;
+    }
+
+    // Then a character at a time to the next group boundary.
+    len--;
+    if (*in == '=') {
+      end = 1;
+      break;
+    }
+    if (!(a = val[*in++])) {
+      if (in[-1] == '\n' || ignore) continue;
+
+      return -1;
+    }
+    x = (x<<6)|(a-1);
+    if (++n == 4) {
+      *o++ = x>>16;
+      *o++ = x>>8;
+      *o++ = x;
+      x = n = 0;
+    }
+  }
+
+  // At = or the end of input, flush a partial group.
+  if (end) {
+    if (n == 2) *o++ = x>>4;
+    else if (n == 3) {
+      *o++ = x>>10;
+      *o++ = x>>2;
+    }
+    *state = -1;
+  } else *state = (x<<2)|n;
+
+  return o-out;
+}
+
+// Two lowercase hex digits for each byte value, at 2*byte.
+static char *hex_pairs(void)
+{
+  static char pairs[512];
+  int i;
+
+  if (!pairs[511]) {
+    for (i = 0; i<511; i++) pairs[i] = hex_digits[(i&1) ? (i/2)&15 : i/32];
+    __sync_synchronize();
+    pairs[511] = 'f';
+  }
+
+  return pairs;
+}
+
+// Write len bytes as hex to out, two lowercase digits per byte and no NUL
+// terminator. Returns bytes written (2*len).
+int hex_encode(char *out, void *data, int len)
+{
+  unsigned char *in = data;
+  char *o = out, *pairs = hex_pairs();
+
+#if LIB_SSSE3 || LIB_NEON
+  if (len>=16 && use_vector()) {
+    int i = hex_enc_fast(o, in, len);
+
+    o += 2*i;
+    in += i;
+    len -= i;
+  }
+#endif
+  for (; len; len--, o += 2) memcpy(o, pairs+2*(*in++), 2);
+
+  return o-out;
+}
+
+// Return how many bytes at the start of data are printable ascii or tab,
+// or with want 0, how many aren't.
+int span_printable(void *data, int len, int want)
+{
+  unsigned char *in = data;
+  int i = 0;
+
+  want = !!want;
+#if LIB_SSSE3 || LIB_NEON
+  if (len>=16 && use_vector()) i = printable_fast(in, len, want);
+#endif
+  for (; i<len; i++)
+    if (want != ((in[i]>=' ' && in[i]<127) || in[i]=='\t')) break;
+
+  return i;
+}
+
 int yesno(int def)
 {
   char buf;
@@ -870,29 +1797,60 @@ char *basename_r(char *name)
   return name;
 }
 
-// Execute a callback for each PID that matches a process name from a list.
-void names_to_pid(char **names, int (*callback)(pid_t pid, char *name))
+static unsigned name_hash(char *s, int slash)
 {
-  DIR *dp;
-  struct dirent *entry;
+  unsigned h = 2166136261U;
 
-  if (!(dp = opendir("/proc"))) perror_exit("opendir");
+  while (*s) h = (h^(unsigned char)*s++)*16777619;
 
-  while ((entry = readdir(dp))) {
-    unsigned u;
-    char *cmd, **curname;
+  return 2*h+slash;
+}
 
-    if (!(u = atoi(entry->d_name))) continue;
-    sprintf(libbuf, "/proc/%u/cmdline", u);
-    if (!(cmd = readfile(libbuf, libbuf, sizeof(libbuf)))) continue;
+// Execute a callback for each PID that matches a process name from a list.
+// Names starting with / match the whole of argv[0], others its basename.
+// The names go in a hash table chained in argument order, so each process
+// is one lookup for each of the two ways it can match, not a compare
+// against every name.
+void names_to_pid(char **names, int (*callback)(pid_t pid, char *name))
+{
+  struct procsnap snap;
+  char *cmd, *base;
+  long i;
+  int count, size, j, a, b, *first, *next;
+
+  for (count = 0; names[count]; count++);
+  for (size = 16; size < 2*count; size *= 2);
+  first = xmalloc((size+count)*sizeof(int));
+  next = first+size;
+  for (j = 0; j<size; j++) first[j] = -1;
+  for (j = count; j--;) {
+    a = (*names[j] == '/') ? name_hash(names[j], 1)
+      : name_hash(basename_r(names[j]), 0);
+    next[j] = first[a &= size-1];
+    first[a] = j;
+  }
 
-    for (curname = names; *curname; curname++)
-      if (**curname == '/' ? !strcmp(cmd, *curname)
-          : !strcmp(basename_r(cmd), basename_r(*curname)))
-        if (callback(u, *curname)) break;
-    if (*curname) break;
+  memset(&snap, 0, sizeof(snap));
+  procsnap_read(&snap, PROCSNAP_CMDLINE, 0);
+  for (i = 0; i<snap.count; i++) {
+    base = basename_r(cmd = procsnap_cmd(&snap, i));
+    a = name_hash(base, 0)&(size-1);
+    b = name_hash(cmd, 1)&(size-1);
+    b = (a == b) ? -1 : first[b];
+    a = first[a];
+
+    // Merge the two chains, so callbacks still happen in argument order.
+    while (a != -1 || b != -1) {
+      if (b == -1 || (a != -1 && a<b)) a = next[j = a];
+      else b = next[j = b];
+      if (*names[j] == '/' ? !strcmp(cmd, names[j])
+          : !strcmp(base, basename_r(names[j])))
+        if (callback(snap.pid[i], names[j])) goto done;
+    }
   }
-  closedir(dp);
+done:
+  procsnap_free(&snap);
+  free(first);
 }
 
 // display first few digits of number with power of two units
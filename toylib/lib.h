@@ -32,6 +32,32 @@ struct ptr_len {
   long len;
 };
 
+// Read ahead buffer for get_linebuf(), see lib.c
+struct linebuf {
+  char *buf, save;
+  long size, start, end;
+  long long off, left;
+  int fd, held, eof, ranged;
+};
+
+// Decimal number stepped in ascii, so printing a run of them doesn't need
+// a division per number, see lib.c
+struct ascii_count {
+  char digits[24], step[24];
+  int len, steplen;
+};
+
+// Hash table of (dev, ino) pairs for hardlink detection, see lib.c. Start it
+// zeroed.
+struct inodeset {
+  struct inodeset_ent {
+    dev_t dev;
+    ino_t ino;
+    void *data;
+  } *ent;
+  unsigned long size, used;
+};
+
 void llist_free_arg(void *node);
 void llist_free_double(void *node);
 void llist_traverse(void *list, void (*using)(void *node));
@@ -60,6 +86,9 @@ void get_optflags(void);
 #define DIRTREE_SYMFOLLOW    8
 // Don't warn about failure to stat
 #define DIRTREE_SHUTUP      16
+// Only fill in file type and inode of children from readdir(), leaving the
+// rest of st for dirtree_stat() to fill in if anyone asks
+#define DIRTREE_LAZYSTAT    32
 // Don't look at any more files in this directory.
 #define DIRTREE_ABORT      256
 
@@ -72,12 +101,16 @@ struct dirtree {
   char *symlink;
   int data;  // dirfd for directory, linklen for symlink
   char again;
+  char lazy; // st is just file type and inode until dirtree_stat()
+  char slab; // dirtree_recurse() scratch space, copied out if DIRTREE_SAVEd
   char name[];
 };
 
 struct dirtree *dirtree_start(char *name, int symfollow);
 struct dirtree *dirtree_add_node(struct dirtree *p, char *name, int flags);
+struct stat *dirtree_stat(struct dirtree *node);
 char *dirtree_path(struct dirtree *node, int *plen);
+char *dirtree_curpath(struct dirtree *node);
 int dirtree_notdotdot(struct dirtree *catch);
 int dirtree_parentfd(struct dirtree *node);
 struct dirtree *dirtree_handle_callback(struct dirtree *new,
@@ -85,11 +118,113 @@ struct dirtree *dirtree_handle_callback(struct dirtree *new,
 int dirtree_recurse(struct dirtree *node, int (*callback)(struct dirtree *node),
   int symfollow);
 struct dirtree *dirtree_read(char *path, int (*callback)(struct dirtree *node));
+struct dirtree *dirtree_handle_parallel(struct dirtree *new,
+  int (*callback)(struct dirtree *node), int ordered);
+struct dirtree *dirtree_read_parallel(char *path,
+  int (*callback)(struct dirtree *node), int ordered);
+
+// procsnap.c
+
+// What procsnap_read() fetches for each process
+#define PROCSNAP_STAT    1  // name, state and numbers from /proc/$PID/stat
+#define PROCSNAP_OWNER   2  // uid and gid owning the /proc/$PID directory
+#define PROCSNAP_STATUS  4  // real uid, real gid and VmLck from status
+#define PROCSNAP_CMDLINE 8  // command line, NUL separated, up to 4095 bytes
+#define PROCSNAP_THREADS 16 // each thread in /proc/$PID/task as well
+#define PROCSNAP_IO      32 // io counters, from taskstats or /proc/$PID/io
+
+// stat numbers kept per process, numbered as ps does: slot 0 is the pid and
+// the field after the state is slot 1.
+#define PROCSNAP_SLOTS 50
+
+// io counters kept per process: bytes through read() and write(), bytes
+// to and from storage, and nanoseconds waited for block io.
+enum {PROCSNAP_RCHAR, PROCSNAP_WCHAR, PROCSNAP_RBYTES, PROCSNAP_WBYTES,
+  PROCSNAP_BLKIO, PROCSNAP_IOS};
+
+// Snapshot of the process table, a column per field. Names and command
+// lines live in pool (at the offsets in name and cmd) so the columns stay
+// small and a reread reuses all the memory.
+struct procsnap {
+  long count, size;
+  pid_t *pid, *tgid;
+  uid_t *uid, *ruid;
+  gid_t *gid, *rgid;
+  long long *vmlck, *stat, *io;
+  unsigned *name, *cmd;
+  int *cmdlen;
+  char *state, *pool;
+  unsigned long used, room;
+  int flags, (*keep)(struct procsnap *snap, long i);
+  int tsfd;
+  unsigned short tsfamily;
+};
+
+#define procsnap_stat(snap, i) ((snap)->stat+(i)*PROCSNAP_SLOTS)
+#define procsnap_io(snap, i) ((snap)->io+(i)*PROCSNAP_IOS)
+#define procsnap_name(snap, i) ((snap)->pool+(snap)->name[i])
+#define procsnap_cmd(snap, i) ((snap)->pool+(snap)->cmd[i])
+
+void procsnap_read(struct procsnap *snap, int flags,
+  int (*keep)(struct procsnap *snap, long i));
+int procsnap_parse_stat(char *buf, int len, long long *slot, char **name,
+  char *state);
+void procsnap_free(struct procsnap *snap);
+
+// One mapping out of /proc/$PID/smaps (or maps, or smaps_rollup), counts in kB
+enum {SMAPS_RSS, SMAPS_PSS, SMAPS_SHARED_CLEAN, SMAPS_SHARED_DIRTY,
+  SMAPS_PRIVATE_CLEAN, SMAPS_PRIVATE_DIRTY, SMAPS_SWAP, SMAPS_KEYS};
+struct smaps {
+  unsigned long long start, end;
+  long long kb[SMAPS_KEYS];
+  char perms[5], name[PATH_MAX];
+};
+void procsnap_smaps(int fd, void (*each)(struct smaps *sm, void *arg),
+  void *arg);
+
+// utmp.c
+#ifdef _PATH_UTMPX
+#define UTMPFILE_DEFAULT _PATH_UTMPX
+#else
+#define UTMPFILE_DEFAULT "/var/run/utmp"
+#endif
+struct utmpfile {
+  struct utmpx *ut;
+  long count;
+  size_t len;
+};
+int utmpfile_open(struct utmpfile *uf, char *path);
+struct utmpx *utmpfile_next(struct utmpfile *uf, long *i, int backward,
+  unsigned types);
+void utmpfile_close(struct utmpfile *uf);
 
 // help.c
 
 void show_help(FILE *out);
 
+// xmem.c
+struct toy_heap {
+  struct toy_heap *up;
+  void **slot;
+  unsigned mask, used, gone;
+  unsigned long bytes, peak;
+  int live, shared;
+#if CFG_TOYBOX_THREADS
+  pthread_mutex_t lock;
+#endif
+};
+void toy_heap_start(struct toy_heap *heap, struct toy_heap *up);
+void toy_heap_child(struct toy_heap *heap, struct toy_heap *up);
+void toy_heap_end(struct toy_heap *heap);
+void toy_free(void *ptr);
+void *toy_realloc(void *ptr, size_t size);
+void *xkeep(void *ptr);
+void xkeep_all(int keep);
+
+// So a block a command frees isn't freed again when it exits.
+#define free toy_free
+#define realloc toy_realloc
+
 // xwrap.c
 void xstrncpy(char *dest, char *src, size_t size);
 void xstrncat(char *dest, char *src, size_t size);
@@ -104,6 +239,7 @@ void xprintf(char *format, ...) printf_format;
 void xputs(char *s);
 void xputc(char c);
 void xflush(void);
+void xflushtty(void);
 void xexec(char **argv);
 int xexecl(const char *path, const char *arg, ...);
 int xexeclp(const char *file, const char *arg, ...);
@@ -115,6 +251,7 @@ int xpclose_both(pid_t pid, int *pipes);
 pid_t xpopen(char **argv, int *pipe, int stdout_);
 pid_t xpclose(pid_t pid, int pipe);
 int xrun(char **argv);
+int xrun_toy(char **argv, int in, int out);
 int xpspawn(char **argv, int*pipes);
 void xaccess(char *path, int flags);
 void xunlink(char *path);
@@ -131,6 +268,8 @@ off_t xlseek(int fd, off_t offset, int whence);
 char *xreadfile(char *name, char *buf, off_t len);
 int xioctl(int fd, int request, void *data);
 char *xgetcwd(void);
+void cachecwd(char *path);
+char *cachedcwd(void);
 void xstat(char *path, struct stat *st);
 char *xabspath(char *path, int exact);
 void xchdir(char *path);
@@ -164,6 +303,8 @@ struct string_list **splitpath(char *path, struct string_list **list);
 char *readfileat(int dirfd, char *name, char *buf, off_t len);
 char *readfile(char *name, char *buf, off_t len);
 void msleep(long miliseconds);
+unsigned long long millitime(void);
+unsigned long long microtime(void);
 int64_t peek_le(void *ptr, unsigned size);
 int64_t peek_be(void *ptr, unsigned size);
 int64_t peek(void *ptr, unsigned size);
@@ -173,6 +314,10 @@ long estrtol(char *str, char **end, int base);
 long xstrtol(char *str, char **end, int base);
 long atolx(char *c);
 long atolx_range(char *numstr, long low, long high);
+void ascii_count_init(struct ascii_count *ac, unsigned long long start,
+  unsigned long long step);
+void ascii_count_next(struct ascii_count *ac);
+#define ascii_count_str(ac) ((ac)->digits+sizeof((ac)->digits)-1-(ac)->len)
 int stridx(char *haystack, char needle);
 char *strlower(char *s);
 char *chomp(char *s);
@@ -184,19 +329,44 @@ void loopfiles_rw(char **argv, int flags, int permissions, int failok,
 void loopfiles(char **argv, void (*function)(int fd, char *name));
 char *get_rawline(int fd, long *plen, char end);
 char *get_line(int fd);
+void linebuf_init(struct linebuf *lb, int fd);
+void linebuf_range(struct linebuf *lb, int fd, long long off, long long len);
+char *get_linebuf(struct linebuf *lb, long *plen, char end, int flags);
+void linebuf_done(struct linebuf *lb);
+void **inodeset_slot(struct inodeset *set, dev_t dev, ino_t ino);
+void *inodeset_find(struct inodeset *set, dev_t dev, ino_t ino);
+void inodeset_free(struct inodeset *set, void (*using)(void *data));
+char *uid_name(uid_t uid);
+char *gid_name(gid_t gid);
+#define XCOPY_BUF (128*1024)
+int copyfd(int in, int out, char *buf, size_t size);
+int xcopy(int in, int out, void (*each)(int out, char *buf, long len));
 void xsendfile(int in, int out);
+long long copyfd_len(int in, off_t *off, int out, long long len);
+int allzero(char *buf, long len);
+off_t lseek_data(int fd, off_t pos, off_t size, off_t *end);
+int copyfd_sparse(int in, int out, char *buf, size_t size, int zeroes);
+long long xsendfile_len(int in, int out, long long len);
 int wfchmodat(int rc, char *name, mode_t mode);
 int copy_tempfile(int fdin, char *name, char **tempname);
 void delete_tempfile(int fdin, int fdout, char **tempname);
 void replace_tempfile(int fdin, int fdout, char **tempname);
 void crc_init(unsigned int *crc_table, int little_endian);
+unsigned crc_update(unsigned crc, void *data, size_t len, int little_endian);
+unsigned crc_combine(unsigned crc1, unsigned crc2, long long len2);
 void base64_init(char *p);
+int base64_encode(char *out, void *data, int len);
+int base64_decode(char *out, char *data, int len, int *state, int ignore);
+int hex_encode(char *out, void *data, int len);
+int span_printable(void *data, int len, int want);
 int yesno(int def);
 int qstrcmp(const void *a, const void *b);
 #ifndef __rtems__
 int xpoll(struct pollfd *fds, int nfds, int timeout);
 #endif
 
+#define LINEBUF_CHOMP 1 // Drop the end character from returned lines
+
 #define HR_SPACE 1 // Space between number and units
 #define HR_B     2 // Use "B" for single byte units
 #define HR_1000  4 // Use decimal instead of binary units
@@ -226,12 +396,42 @@ void tty_sigreset(int i);
 // net.c
 int xsocket(int domain, int type, int protocol);
 void xsetsockopt(int fd, int level, int opt, void *val, socklen_t len);
+int dns_getaddrinfo(char *host, char *port, struct addrinfo *hints,
+  struct addrinfo **res);
 int xconnect(char *host, char *port, int family, int socktype, int protocol,
   int flags);
+int xconnect_timeout(char *host, char *port, int family, int socktype,
+  int protocol, int flags, long ms);
+
+// One line of /proc/net/{tcp,udp,raw}[6] or one sock_diag record.
+struct netsock {
+  unsigned laddr[4], raddr[4], lport, rport, state, txq, rxq, uid;
+  unsigned long long inode;
+};
+int netsock_parse(char *line, int v6, struct netsock *ns);
+int netsock_diag(int family, int protocol,
+  void (*each)(struct netsock *ns, void *arg), void *arg);
+struct nlmsghdr;
+struct rtattr;
+int netlink_dump(int type, void *req, int len,
+  void (*each)(struct nlmsghdr *nlh, void *arg), void *arg);
+void netlink_attrs(struct nlmsghdr *nlh, int hdrlen, struct rtattr **tb,
+  int max);
+struct netlink_link {
+  struct netlink_link *next;
+  int index, type, hwlen;
+  char name[16];
+};
+struct netlink_link *netlink_link(int index);
 
 // password.c
 int get_salt(char *salt, char * algo);
 
+// hwids.c
+struct hwids *hwids_open(char *path);
+void hwids_close(struct hwids *ids);
+char *hwids_name(struct hwids *ids, int vendor, int device, char *buf, int size);
+
 // getmountlist.c
 struct mtab_list {
   struct mtab_list *next, *prev;
@@ -265,6 +465,9 @@ void names_to_pid(char **names, int (*callback)(pid_t pid, char *name));
 pid_t xvforkwrap(pid_t pid);
 #define XVFORK() xvforkwrap(vfork())
 
+// trace.c
+#include "toylib/trace.h"
+
 // Functions in need of further review/cleanup
 #include "toylib/pending.h"
 
@@ -1,5 +1,12 @@
 #include "toys.h"
 
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/rtnetlink.h>
+#endif
+
 int xsocket(int domain, int type, int protocol)
 {
   int fd = socket(domain, type, protocol);
@@ -13,34 +20,730 @@ void xsetsockopt(int fd, int level, int opt, void *val, socklen_t len)
   if (-1 == setsockopt(fd, level, opt, val, len)) perror_exit("setsockopt");
 }
 
+// Copy a getaddrinfo() list into one allocation, so whichever way
+// dns_getaddrinfo() got its answer the caller can just free() it.
+static struct addrinfo *dns_copy(struct addrinfo *ai)
+{
+  struct addrinfo *a, *new, **nn;
+  char *s;
+  int len = 0;
+
+  for (a = ai; a; a = a->ai_next)
+    len += sizeof(*a) + a->ai_addrlen + (a->ai_canonname ? strlen(a->ai_canonname)+1 : 0);
+  s = xmalloc(len);
+  for (a = ai, nn = &new; a; a = a->ai_next) {
+    *nn = (void *)s;
+    **nn = *a;
+    s += sizeof(*a);
+    (*nn)->ai_addr = memcpy(s, a->ai_addr, a->ai_addrlen);
+    s += a->ai_addrlen;
+    if (a->ai_canonname) {
+      (*nn)->ai_canonname = strcpy(s, a->ai_canonname);
+      s += strlen(s)+1;
+    }
+    nn = &(*nn)->ai_next;
+  }
+  *nn = 0;
+  freeaddrinfo(ai);
+
+  return new;
+}
+
 #ifndef __rtems__
-int xconnect(char *host, char *port, int family, int socktype, int protocol,
-             int flags)
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+// Answers from DNS are kept for their TTL in a per-user file on tmpfs, so
+// the next command (or the same script's next run of one) looking up the
+// same name doesn't go out to the network for it again. A and AAAA are
+// kept separately, each with how long it's good for, and "none of those"
+// is kept too (for the SOA's negative TTL) so a v4 only name doesn't ask
+// for AAAA every time.
+
+#define DNS_CACHE "/dev/shm/toybox-dns-%u"
+#define DNS_SLOTS 64
+#define DNS_ADDRS 8
+#define DNS_MAXTTL 86400
+
+struct dns_cached {
+  char name[256];
+  long long expires[2];
+  unsigned char count[2], nx[2], addr4[DNS_ADDRS][4], addr6[DNS_ADDRS][16];
+};
+
+static int dns_lock(int fd, int type)
+{
+  struct flock lock;
+
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+
+  return fcntl(fd, F_SETLKW, &lock);
+}
+
+// Open the cache file, if it's ours.
+static int dns_open(void)
 {
-  struct addrinfo info, *ai, *ai2;
+  char name[64];
+  struct stat st;
   int fd;
 
+  sprintf(name, DNS_CACHE, (unsigned)geteuid());
+  if (-1 == (fd = open(name, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0600)))
+    return -1;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+      || (st.st_mode & 077)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Find name's slot in the cache (read into dc), or -1.
+static int dns_find(struct dns_cached *dc, char *name)
+{
+  int i;
+
+  for (i = 0; i<DNS_SLOTS; i++) if (!strcasecmp(dc[i].name, name)) return i;
+
+  return -1;
+}
+
+// Merge what we learned into the cache, in name's slot or else in an empty
+// one or else in the one closest to expiring.
+static void dns_store(int fd, struct dns_cached *new, int want)
+{
+  struct dns_cached *dc = xzalloc(DNS_SLOTS*sizeof(*dc));
+  long long t, oldest = LLONG_MAX;
+  int i, slot;
+
+  if (dns_lock(fd, F_WRLCK)) goto done;
+  pread(fd, dc, DNS_SLOTS*sizeof(*dc), 0);
+  if (-1 == (slot = dns_find(dc, new->name))) {
+    for (slot = i = 0; i<DNS_SLOTS; i++) {
+      if ((t = dc[i].expires[0]) < dc[i].expires[1]) t = dc[i].expires[1];
+      if (t < oldest) oldest = t, slot = i;
+    }
+    memset(dc+slot, 0, sizeof(*dc));
+  }
+  strcpy(dc[slot].name, new->name);
+  for (i = 0; i<2; i++) {
+    if (!(want&(1<<i))) continue;
+    dc[slot].expires[i] = new->expires[i];
+    dc[slot].count[i] = new->count[i];
+    dc[slot].nx[i] = new->nx[i];
+  }
+  if (want&1) memcpy(dc[slot].addr4, new->addr4, sizeof(new->addr4));
+  if (want&2) memcpy(dc[slot].addr6, new->addr6, sizeof(new->addr6));
+  pwrite(fd, dc+slot, sizeof(*dc), slot*sizeof(*dc));
+  dns_lock(fd, F_UNLCK);
+done:
+  free(dc);
+}
+
+static unsigned dns_short(unsigned char *p)
+{
+  return (p[0]<<8)|p[1];
+}
+
+static unsigned dns_long(unsigned char *p)
+{
+  return (dns_short(p)<<16)|dns_short(p+2);
+}
+
+// Collect the addresses of type (A or AAAA, which=0 or 1) from a reply,
+// with the shortest TTL of those or of the SOA saying there aren't any.
+// Returns 0 if it isn't a usable answer.
+static int dns_answer(unsigned char *a, int len, int which, struct dns_cached *dc)
+{
+  unsigned char *p = a+12, *end = a+len;
+  unsigned type = which ? 28 : 1, rtype, rlen, ttl = DNS_MAXTTL, t;
+  int i, n, count[3];
+
+  // Truncated or failed, try elsewhere (or let getaddrinfo() retry over TCP)
+  if ((a[2]&2) || ((a[3]&15) && (a[3]&15) != 3)) return 0;
+  dc->nx[which] = (a[3]&15) == 3;
+  for (i = 0; i<3; i++) count[i] = dns_short(a+6+2*i);
+  for (n = dns_short(a+4); n--; p += i+4)
+    if ((i = dn_skipname(p, end)) < 0 || p+i+4 > end) return 0;
+  for (i = 0; i<2; i++) {
+    while (count[i]--) {
+      if ((n = dn_skipname(p, end)) < 0 || p+n+10 > end) return 0;
+      p += n;
+      rtype = dns_short(p);
+      t = dns_long(p+4);
+      rlen = dns_short(p+8);
+      if ((p += 10)+rlen > end) return 0;
+      if (!i && rtype == type && rlen == (which ? 16 : 4)) {
+        if (dc->count[which] < DNS_ADDRS)
+          memcpy(which ? dc->addr6[dc->count[which]] : dc->addr4[dc->count[which]],
+            p, rlen);
+        dc->count[which]++;
+        if (t < ttl) ttl = t;
+      } else if (i && rtype == 6 && rlen >= 20 && !dc->count[which]) {
+        if (t < ttl) ttl = t;
+        if (dns_long(p+rlen-4) < ttl) ttl = dns_long(p+rlen-4);
+      }
+      p += rlen;
+    }
+    // Only look at the authority section if there weren't any answers.
+    if (dc->count[which]) break;
+  }
+  if (dc->count[which] > DNS_ADDRS) dc->count[which] = DNS_ADDRS;
+  dc->expires[which] = time(0)+ttl;
+
+  return 1;
+}
+
+// Ask the nameservers in resolv.conf for A and/or AAAA (bits 1 and 2 of
+// want) at once, both queries on one socket. Returns which got answers.
+static int dns_query(char *name, int want, struct dns_cached *dc)
+{
+  unsigned char query[2][300], reply[512];
+  struct pollfd pfd;
+  int qlen[2], got = 0, try, ns, i, fd, len;
+  long long deadline;
+
+  if (!(_res.options & RES_INIT) && res_init()) return 0;
+  for (i = 0; i<2; i++) {
+    if (!(want&(1<<i))) continue;
+    if ((qlen[i] = res_mkquery(QUERY, name, C_IN, i ? 28 : 1, 0, 0, 0,
+      query[i], sizeof(query[i]))) < 0) return 0;
+    dc->count[i] = dc->nx[i] = 0;
+  }
+
+  for (try = 0; try < _res.retry; try++) {
+    for (ns = 0; ns < _res.nscount; ns++) {
+      struct sockaddr_in *sin = _res.nsaddr_list+ns;
+
+      if (sin->sin_family != AF_INET) continue;
+      if (-1 == (fd = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0))) return got;
+      if (connect(fd, (void *)sin, sizeof(*sin))) {
+        close(fd);
+        continue;
+      }
+      for (i = 0; i<2; i++)
+        if ((want&~got)&(1<<i)) send(fd, query[i], qlen[i], 0);
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      deadline = millitime()+1000*_res.retrans;
+      while ((want&~got) && (len = deadline-millitime()) > 0
+             && poll(&pfd, 1, len) > 0) {
+        if ((len = recv(fd, reply, sizeof(reply), 0)) < 12 || !(reply[2]&128))
+          continue;
+        for (i = 0; i<2; i++)
+          if (((want&~got)&(1<<i)) && !memcmp(reply, query[i], 2)
+              && dns_answer(reply, len, i, dc)) got |= 1<<i;
+      }
+      close(fd);
+      if (!(want&~got)) return got;
+    }
+  }
+
+  return got;
+}
+
+// Is name in /etc/hosts? Anything there is left to getaddrinfo().
+static int dns_hosts(char *name)
+{
+  FILE *fp = fopen("/etc/hosts", "re");
+  char *line = 0, *s, *word;
+  size_t size = 0;
+  int found = 0;
+
+  if (!fp) return 0;
+  while (!found && getline(&line, &size, fp) > 0) {
+    if ((s = strchr(line, '#'))) *s = 0;
+    for (s = line; !found && (word = strtok(s, " \t\n")); s = 0)
+      if (s != line) found = !strcasecmp(word, name);
+  }
+  free(line);
+  fclose(fp);
+
+  return found;
+}
+
+// getaddrinfo() that answers from the cache when it can, and otherwise
+// asks DNS for A and AAAA in parallel and caches what comes back. Names
+// without a dot (which the resolver's search list applies to), numeric
+// addresses, /etc/hosts entries and requests without a socket type go to
+// getaddrinfo() as before. The result is one allocation: free() it.
+int dns_getaddrinfo(char *host, char *port, struct addrinfo *hints,
+  struct addrinfo **res)
+{
+  struct dns_cached *cache = 0, new, *dc = &new;
+  struct addrinfo *ai, **aa;
+  unsigned char buf[16];
+  int fd = -1, want, have = 0, i, j, len, portnum = 0, rc = EAI_NONAME;
+  long long now = time(0);
+
+  want = hints->ai_family == AF_INET ? 1 : hints->ai_family == AF_INET6 ? 2 : 3;
+  if (!host || !hints->ai_socktype || strlen(host) > 253 || !strchr(host, '.')
+      || inet_pton(AF_INET, host, buf) > 0 || inet_pton(AF_INET6, host, buf) > 0
+      || (hints->ai_flags & (AI_NUMERICHOST|AI_CANONNAME)) || dns_hosts(host))
+    goto fallback;
+  if (port) {
+    char *end;
+    struct servent *se;
+
+    portnum = strtoul(port, &end, 10);
+    if (*end || end == port || portnum > 65535) {
+      if (!(se = getservbyname(port,
+                  hints->ai_socktype == SOCK_DGRAM ? "udp" : "tcp")))
+        goto fallback;
+      portnum = ntohs(se->s_port);
+    }
+  }
+
+  memset(&new, 0, sizeof(new));
+  strcpy(new.name, host);
+  if (-1 != (fd = dns_open())) {
+    cache = xzalloc(DNS_SLOTS*sizeof(*cache));
+    if (!dns_lock(fd, F_RDLCK)) {
+      pread(fd, cache, DNS_SLOTS*sizeof(*cache), 0);
+      dns_lock(fd, F_UNLCK);
+    }
+    if (-1 != (i = dns_find(cache, host))) {
+      new = cache[i];
+      for (j = 0; j<2; j++) if (new.expires[j] > now) have |= 1<<j;
+    }
+  }
+
+  // Fetch what isn't cached and store it, keeping the cached rest.
+  if (want&~have) {
+    if ((i = dns_query(host, want&~have, dc)) && fd != -1) dns_store(fd, dc, i);
+    have |= i;
+  }
+  if ((want&have) != want) goto fallback;
+
+  // Build the list: IPv4 first, as ping and friends take the first entry.
+  if (!(len = ((want&1) ? dc->count[0] : 0) + ((want&2) ? dc->count[1] : 0))) {
+    if ((want&1) ? !dc->nx[0] : !dc->nx[1]) rc = EAI_NODATA;
+    goto done;
+  }
+  ai = xzalloc(len*(sizeof(*ai)+sizeof(struct sockaddr_in6)));
+  *res = ai;
+  for (aa = res, i = 0; i<2; i++) {
+    if (!(want&(1<<i))) continue;
+    for (j = 0; j<dc->count[i]; j++) {
+      struct sockaddr_in *sin = (void *)((struct sockaddr_in6 *)(*res+len)
+        +(ai-*res));
+
+      *ai = *hints;
+      ai->ai_flags = 0;
+      ai->ai_addr = (void *)sin;
+      if (!i) {
+        ai->ai_family = sin->sin_family = AF_INET;
+        sin->sin_port = htons(portnum);
+        memcpy(&sin->sin_addr, dc->addr4[j], 4);
+        ai->ai_addrlen = sizeof(struct sockaddr_in);
+      } else {
+        struct sockaddr_in6 *sin6 = (void *)sin;
+
+        ai->ai_family = sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(portnum);
+        memcpy(&sin6->sin6_addr, dc->addr6[j], 16);
+        ai->ai_addrlen = sizeof(struct sockaddr_in6);
+      }
+      *aa = ai;
+      aa = &(ai++)->ai_next;
+    }
+  }
+  *aa = 0;
+  rc = 0;
+  goto done;
+
+fallback:
+  if (!(rc = getaddrinfo(host, port, hints, &ai))) *res = dns_copy(ai);
+done:
+  if (fd != -1) close(fd);
+  free(cache);
+
+  return rc;
+}
+#else
+int dns_getaddrinfo(char *host, char *port, struct addrinfo *hints,
+  struct addrinfo **res)
+{
+  struct addrinfo *ai;
+  int rc = getaddrinfo(host, port, hints, &ai);
+
+  if (!rc) *res = dns_copy(ai);
+
+  return rc;
+}
+#endif
+
+#ifndef __rtems__
+// How long to give each stream address to connect before also trying the
+// next one (RFC 8305 says 250ms), and how many to have going at once.
+#define CONNECT_STAGGER 250
+#define CONNECT_MAX 16
+
+// Start a non-blocking connect to ai. Returns the socket, or -1 with errno.
+static int connect_start(struct addrinfo *ai, int *done)
+{
+  int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+  *done = 0;
+  if (fd == -1) return -1;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+  if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) *done = 1;
+  else if (errno != EINPROGRESS) {
+    int err = errno;
+
+    close(fd);
+    errno = err;
+    fd = -1;
+  }
+
+  return fd;
+}
+
+// Connect to the first address that answers. Stream connections are raced
+// (RFC 8305): a new attempt starts every CONNECT_STAGGER ms while earlier
+// ones are still waiting, alternating address families so a dead IPv6 route
+// doesn't hold up IPv4, and the first through wins. If ms isn't 0, give up
+// after that many milliseconds.
+int xconnect_timeout(char *host, char *port, int family, int socktype,
+  int protocol, int flags, long ms)
+{
+  struct addrinfo info, *ai, *ai2, *list[CONNECT_MAX];
+  struct pollfd pfd[CONNECT_MAX];
+  unsigned long long now, start = millitime(), next = start;
+  int fd = -1, n, i, j, k, waiting = 0, err = ECONNREFUSED, done, len;
+
   memset(&info, 0, sizeof(struct addrinfo));
   info.ai_family = family;
   info.ai_socktype = socktype;
   info.ai_protocol = protocol;
   info.ai_flags = flags;
 
-  fd = getaddrinfo(host, port, &info, &ai);
+  fd = dns_getaddrinfo(host, port, &info, &ai);
   if (fd || !ai)
     error_exit("Connect '%s%s%s': %s", host, port ? ":" : "", port ? port : "",
       fd ? gai_strerror(fd) : "not found");
+  ai2 = ai;
+  fd = -1;
 
-  // Try all the returned addresses. Report errors if last entry can't connect.
-  for (ai2 = ai; ai; ai = ai->ai_next) {
-    fd = (ai->ai_next ? socket : xsocket)(ai->ai_family, ai->ai_socktype,
-      ai->ai_protocol);
-    if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) break;
-    else if (!ai2->ai_next) perror_exit("connect");
-    close(fd);
+  // Anything but a stream connects (or doesn't) right away, so just take the
+  // first that works.
+  if (ai->ai_socktype != SOCK_STREAM) {
+    for (; ai; ai = ai->ai_next) {
+      fd = (ai->ai_next ? socket : xsocket)(ai->ai_family, ai->ai_socktype,
+        ai->ai_protocol);
+      if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) break;
+      else if (!ai->ai_next) perror_exit("connect");
+      close(fd);
+    }
+    free(ai2);
+
+    return fd;
+  }
+
+  // Take the addresses in resolver order but alternating families, starting
+  // with the one the resolver likes best.
+  for (n = 0, i = ai->ai_family; ai && n<CONNECT_MAX; ) {
+    struct addrinfo **aa, *a;
+
+    for (aa = &ai; *aa && (*aa)->ai_family != i; aa = &(*aa)->ai_next);
+    if (!*aa) aa = &ai;
+    list[n++] = a = *aa;
+    *aa = a->ai_next;
+    i = a->ai_family == AF_INET6 ? AF_INET : AF_INET6;
+  }
+
+  for (i = 0; fd == -1; ) {
+    now = millitime();
+    if (ms && now-start >= ms) {
+      err = ETIMEDOUT;
+      break;
+    }
+
+    // Time for the next attempt? Also start it early when nothing's pending.
+    if (i<n && (now >= next || !waiting)) {
+      if (-1 == (k = connect_start(list[i], &done))) err = errno;
+      else if (done) fd = k;
+      else {
+        pfd[waiting].fd = k;
+        pfd[waiting++].events = POLLOUT;
+      }
+      i++;
+      next = now+CONNECT_STAGGER;
+      continue;
+    }
+    if (!waiting) break;
+
+    // Wait for one to finish, the next attempt, or the deadline.
+    len = -1;
+    if (i<n) len = next-now;
+    if (ms && (len == -1 || start+ms-now < len)) len = start+ms-now;
+    if (poll(pfd, waiting, len) < 1) continue;
+    for (j = 0; j<waiting; j++) {
+      socklen_t sl = sizeof(k);
+
+      if (!pfd[j].revents) continue;
+      if (getsockopt(pfd[j].fd, SOL_SOCKET, SO_ERROR, &k, &sl)) k = errno;
+      if (!k && fd == -1) fd = pfd[j].fd;
+      else {
+        close(pfd[j].fd);
+        if (k) err = k;
+      }
+      pfd[j--] = pfd[--waiting];
+    }
+  }
+  while (waiting) close(pfd[--waiting].fd);
+  free(ai2);
+  if (fd == -1) {
+    errno = err;
+    perror_exit("connect");
   }
-  freeaddrinfo(ai2);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)&~O_NONBLOCK);
 
   return fd;
 }
+
+int xconnect(char *host, char *port, int family, int socktype, int protocol,
+             int flags)
+{
+  return xconnect_timeout(host, port, family, socktype, protocol, flags, 0);
+}
 #endif
+
+// Read a number of at most max digits in base 10 or 16, after any spaces.
+// Returns where it stopped, or NULL if there weren't any digits.
+static char *netsock_num(char *s, int base, int max, unsigned long long *val)
+{
+  unsigned long long n = 0;
+  char *start;
+  int d;
+
+  while (*s == ' ') s++;
+  for (start = s; max--; s++) {
+    if (*s>='0' && *s<='9') d = *s-'0';
+    else if (base == 16 && (*s|32)>='a' && (*s|32)<='f') d = (*s|32)-'a'+10;
+    else break;
+    n = n*base+d;
+  }
+  *val = n;
+
+  return s == start ? 0 : s;
+}
+
+// Parse one line of /proc/net/{tcp,udp,raw}[6], which the kernel prints as
+// fixed columns of hex and decimal:
+//   sl: laddr:lport raddr:rport st txq:rxq tr:when retrnsmt uid timeout inode
+// Addresses are 1 (or with v6, 4) 32 bit words in host byte order, so they
+// land in laddr/raddr as the bytes inet_ntop() wants. Returns 0 for the
+// header or anything else that isn't a socket line.
+int netsock_parse(char *line, int v6, struct netsock *ns)
+{
+  unsigned long long val;
+  unsigned *addr;
+  char *s = line;
+  int i, j;
+
+  if (!(s = netsock_num(s, 10, 20, &val)) || *s++ != ':') return 0;
+  for (i = 0; i<2; i++) {
+    addr = i ? ns->raddr : ns->laddr;
+    memset(addr, 0, 4*sizeof(*addr));
+    for (j = 0; j<(v6 ? 4 : 1); j++) {
+      if (!(s = netsock_num(s, 16, 8, &val))) return 0;
+      addr[j] = val;
+    }
+    if (*s++ != ':' || !(s = netsock_num(s, 16, 8, &val))) return 0;
+    *(i ? &ns->rport : &ns->lport) = val;
+  }
+  if (!(s = netsock_num(s, 16, 2, &val))) return 0;
+  ns->state = val;
+  if (!(s = netsock_num(s, 16, 8, &val)) || *s++ != ':') return 0;
+  ns->txq = val;
+  if (!(s = netsock_num(s, 16, 8, &val))) return 0;
+  ns->rxq = val;
+
+  // tr:when retrnsmt, then uid, timeout and inode in decimal.
+  for (i = 0; i<6; i++) {
+    if (!(s = netsock_num(s, i<3 ? 16 : 10, 20, &val))) return 0;
+    if (i == 0 && *s++ != ':') return 0;
+    if (i == 3) ns->uid = val;
+  }
+  ns->inode = val;
+
+  return 1;
+}
+
+// Dump family's sockets of protocol (IPPROTO_TCP or IPPROTO_UDP) through
+// NETLINK_SOCK_DIAG, calling each() on every one. That's one fixed size
+// binary record per socket instead of a line of text to format and parse.
+// Returns 0 if the kernel can't do it (old kernel, module not loaded, not
+// linux), so the caller can fall back to /proc/net.
+int netsock_diag(int family, int protocol,
+  void (*each)(struct netsock *ns, void *arg), void *arg)
+{
+#if defined(__linux__) && defined(SOCK_DIAG_BY_FAMILY)
+  struct {
+    struct nlmsghdr nlh;
+    struct inet_diag_req_v2 req;
+  } msg;
+  struct sockaddr_nl sa;
+  struct nlmsghdr *nlh;
+  struct inet_diag_msg *dm;
+  struct netsock ns;
+  char *buf;
+  int fd, len, seen = 0, done = 0;
+
+  if (-1 == (fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC,
+    NETLINK_SOCK_DIAG))) return 0;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.nlh.nlmsg_len = sizeof(msg);
+  msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  msg.nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+  msg.req.sdiag_family = family;
+  msg.req.sdiag_protocol = protocol;
+  msg.req.idiag_states = ~0U;
+  memset(&sa, 0, sizeof(sa));
+  sa.nl_family = AF_NETLINK;
+  if (sizeof(msg) != sendto(fd, &msg, sizeof(msg), 0, (void *)&sa, sizeof(sa)))
+  {
+    close(fd);
+    return 0;
+  }
+
+  buf = xmalloc(32768);
+  while (!done && 0<(len = recv(fd, buf, 32768, 0))) {
+    for (nlh = (void *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+        done = 1;
+        break;
+      }
+      dm = NLMSG_DATA(nlh);
+      memcpy(ns.laddr, dm->id.idiag_src, sizeof(ns.laddr));
+      memcpy(ns.raddr, dm->id.idiag_dst, sizeof(ns.raddr));
+      ns.lport = ntohs(dm->id.idiag_sport);
+      ns.rport = ntohs(dm->id.idiag_dport);
+      ns.state = dm->idiag_state;
+      ns.rxq = dm->idiag_rqueue;
+      // For listening sockets that's the backlog limit, /proc/net says 0.
+      ns.txq = (protocol == IPPROTO_TCP && ns.state == TCP_LISTEN)
+        ? 0 : dm->idiag_wqueue;
+      ns.uid = dm->idiag_uid;
+      ns.inode = dm->idiag_inode;
+      each(&ns, arg);
+      seen++;
+    }
+  }
+  free(buf);
+  close(fd);
+
+  // An error before any sockets is the kernel not knowing the protocol.
+  return seen || (done && nlh->nlmsg_type == NLMSG_DONE);
+#else
+  return 0;
+#endif
+}
+
+// Dump a NETLINK_ROUTE table (RTM_GETLINK, RTM_GETADDR, RTM_GETROUTE or
+// RTM_GETNEIGH), sending req (the table's ifinfomsg, ifaddrmsg, rtmsg or
+// ndmsg selecting family and such) and calling each() on every reply.
+// Returns 0 if the kernel can't do it, so the caller can fall back.
+int netlink_dump(int type, void *req, int len,
+  void (*each)(struct nlmsghdr *nlh, void *arg), void *arg)
+{
+#ifdef __linux__
+  struct nlmsghdr *nlh;
+  struct sockaddr_nl sa;
+  char *buf;
+  int fd, rcvbuf = 1<<20, done = 0, ok = 0;
+
+  if (-1 == (fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE)))
+    return 0;
+  // The kernel fills the socket as fast as we drain it, so give it room.
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  buf = xzalloc(65536);
+  nlh = (void *)buf;
+  nlh->nlmsg_len = NLMSG_LENGTH(len);
+  nlh->nlmsg_type = type;
+  nlh->nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+  memcpy(NLMSG_DATA(nlh), req, len);
+  memset(&sa, 0, sizeof(sa));
+  sa.nl_family = AF_NETLINK;
+  if (nlh->nlmsg_len != sendto(fd, buf, nlh->nlmsg_len, 0, (void *)&sa,
+    sizeof(sa))) done++;
+
+  while (!done && 0<(len = recv(fd, buf, 65536, 0))) {
+    for (nlh = (void *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_type == NLMSG_ERROR) done++;
+      else if (nlh->nlmsg_type == NLMSG_DONE) done = ok = 1;
+      else each(nlh, arg);
+      if (done) break;
+    }
+  }
+  free(buf);
+  close(fd);
+
+  return ok;
+#else
+  return 0;
+#endif
+}
+
+// Index the attributes after nlh's hdrlen byte header into tb[0..max].
+void netlink_attrs(struct nlmsghdr *nlh, int hdrlen, struct rtattr **tb,
+  int max)
+{
+#ifdef __linux__
+  struct rtattr *rta = (void *)((char *)NLMSG_DATA(nlh)+NLMSG_ALIGN(hdrlen));
+  int len = nlh->nlmsg_len-NLMSG_LENGTH(hdrlen);
+
+  memset(tb, 0, (max+1)*sizeof(*tb));
+  for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    if (rta->rta_type <= max && !tb[rta->rta_type]) tb[rta->rta_type] = rta;
+#endif
+}
+
+#ifdef __linux__
+static void netlink_link_each(struct nlmsghdr *nlh, void *arg)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+  struct netlink_link **list = arg, *nl;
+  struct rtattr *tb[IFLA_MAX+1];
+
+  if (nlh->nlmsg_type != RTM_NEWLINK) return;
+  netlink_attrs(nlh, sizeof(*ifi), tb, IFLA_MAX);
+  if (!tb[IFLA_IFNAME]) return;
+  nl = xzalloc(sizeof(*nl));
+  nl->index = ifi->ifi_index;
+  nl->type = ifi->ifi_type;
+  if (tb[IFLA_ADDRESS]) nl->hwlen = RTA_PAYLOAD(tb[IFLA_ADDRESS]);
+  xstrncpy(nl->name, RTA_DATA(tb[IFLA_IFNAME]), sizeof(nl->name));
+  nl->next = *list;
+  *list = nl;
+}
+#endif
+
+// Look up an interface by index, from one RTM_GETLINK dump made on first
+// use. So listing a table costs one dump instead of an ioctl per entry.
+struct netlink_link *netlink_link(int index)
+{
+  static struct netlink_link *list;
+  static int dumped;
+  struct netlink_link *nl;
+
+#ifdef __linux__
+  struct ifinfomsg ifi;
+
+  if (!dumped++) {
+    memset(&ifi, 0, sizeof(ifi));
+    xkeep_all(1);
+    netlink_dump(RTM_GETLINK, &ifi, sizeof(ifi), netlink_link_each, &list);
+    xkeep_all(0);
+  }
+#endif
+  for (nl = list; nl; nl = nl->next) if (nl->index == index) break;
+
+  return nl;
+}
@@ -8,6 +8,10 @@
 
 #include "toys.h"
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 // We can't fork() on nommu systems, and vfork() requires an exec() or exit()
 // before resuming the parent (because they share a heap until then). And no,
 // we can't implement our own clone() call that does the equivalent of fork()
@@ -33,52 +37,73 @@ pid_t xfork(void)
 }
 #endif
 
+// Where we know how to find stdio's read buffer, search it with memchr()
+// and copy out a whole run at a time rather than a getc() per byte. Other
+// libcs report an empty buffer and get the getc() loop.
+#if defined(__GLIBC__)
+#define FBUF_PTR(f) ((f)->_IO_read_ptr)
+#define FBUF_LEN(f) ((f)->_IO_read_end-(f)->_IO_read_ptr)
+#define FBUF_SKIP(f, n) ((f)->_IO_read_ptr += (n))
+#elif defined(__NEWLIB__)
+#define FBUF_PTR(f) ((char *)(f)->_p)
+#define FBUF_LEN(f) ((f)->_r)
+#define FBUF_SKIP(f, n) ((f)->_p += (n), (f)->_r -= (n))
+#else
+#define FBUF_PTR(f) ((char *)0)
+#define FBUF_LEN(f) 0
+#define FBUF_SKIP(f, n) ((void)(n))
+#endif
+
+// getdelim(): returns length read including delim, -1 at EOF or error.
 ssize_t xgetdelim(char **linep, size_t *np, int delim, FILE *stream)
 {
+  size_t len = 0, size;
+  ssize_t avail;
+  char c, *s, *end, *line;
   int ch;
-  size_t new_len;
-  ssize_t i = 0;
-  char *line, *new_line;
 
-  // Invalid input
   if (!linep || !np) {
     errno = EINVAL;
     return -1;
   }
-
-  if (*linep == NULL || *np == 0) {
-    *np = 1024;
-    *linep = calloc(1, *np);
-    if (*linep == NULL) return -1;
-  }
-  line = *linep;
-
-  while ((ch = getc(stream)) != EOF) {
-    if (i > (ssize_t)*np) {
-      // Need more space
-      new_len = *np + 1024;
-      new_line = realloc(*linep, new_len);
-      if (!new_line) return -1;
-      *np = new_len;
-      line = *linep = new_line;
+  if (!*linep) *np = 0;
+
+  flockfile(stream);
+  for (;;) {
+    if (0 < (avail = FBUF_LEN(stream))) {
+      s = FBUF_PTR(stream);
+      if ((end = memchr(s, delim, avail))) avail = end+1-s;
+    } else {
+      // Buffer's empty, getc() refills it (or tells us there's no more).
+      if (EOF == (ch = getc_unlocked(stream))) break;
+      c = ch;
+      s = &c;
+      avail = 1;
+      end = (ch == delim) ? s : 0;
     }
 
-    line[i] = ch;
-    if (ch == delim) break;
-    i += 1;
+    // Grow geometrically, always leaving room for the null terminator.
+    if (len+avail >= *np) {
+      for (size = *np ? *np : 128; size <= len+avail; size *= 2);
+      if (!(line = realloc(*linep, size))) {
+        funlockfile(stream);
+        errno = ENOMEM;
+        return -1;
+      }
+      *linep = line;
+      *np = size;
+    }
+    memcpy(*linep+len, s, avail);
+    len += avail;
+    if (s != &c) FBUF_SKIP(stream, avail);
+    if (end) break;
   }
+  funlockfile(stream);
 
-  if (i > (ssize_t)*np) {
-    // Need more space
-    new_len  = i + 2;
-    new_line = realloc(*linep, new_len);
-    if (!new_line) return -1;
-    *np = new_len;
-    line = *linep = new_line;
-  }
-  line[i + 1] = '\0';
+  if (!len) return -1;
+  (*linep)[len] = 0;
 
-  return i > 0 ? i : -1;
+  return len;
 }
 
 ssize_t xgetline(char **linep, size_t *np, FILE *stream)
@@ -95,3 +120,125 @@ int clearenv(void)
   return 0;
 }
 #endif
+
+// Start reading the directory open on fd, with a buffer of size bytes (0 for
+// DIRBUF_SIZE). Takes over fd, which dirbuf_close() closes. Returns NULL
+// with errno set on failure, closing nothing. This doesn't die on failure
+// because the shell's globbing uses it too.
+struct dirbuf *dirbuf_open(int fd, int size)
+{
+  struct dirbuf *db;
+
+  if (fd == -1) {
+    errno = EBADF;
+    return 0;
+  }
+  if (!(db = calloc(1, sizeof(struct dirbuf)))) return 0;
+  db->fd = fd;
+  db->size = size ? size : DIRBUF_SIZE;
+#if !defined(__linux__) || !defined(SYS_getdents64)
+  if (!(db->dir = fdopendir(fd))) {
+    free(db);
+    return 0;
+  }
+#endif
+
+  return db;
+}
+
+#if defined(__linux__) && defined(SYS_getdents64)
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+// Return the next entry, or NULL at the end of the directory (or on error,
+// with errno set). Once the end is reached the buffer is freed, so a
+// finished dirbuf kept around for its fd doesn't hold on to it.
+struct dirbuf_ent *dirbuf_read(struct dirbuf *db)
+{
+#if defined(__linux__) && defined(SYS_getdents64)
+  struct linux_dirent64 *de;
+
+  while (db->pos >= db->len) {
+    if (!db->buf && (db->len == -1 || !(db->buf = malloc(db->size))))
+      return 0;
+    db->pos = 0;
+    db->len = syscall(SYS_getdents64, db->fd, db->buf, db->size);
+    if (db->len < 1) {
+      free(db->buf);
+      db->buf = 0;
+      db->len = -1;
+
+      return 0;
+    }
+  }
+  de = (void *)(db->buf+db->pos);
+  db->pos += de->d_reclen;
+  db->ent.ino = de->d_ino;
+  db->ent.type = de->d_type;
+  db->ent.name = de->d_name;
+#else
+  struct dirent *de;
+
+  if (!(de = readdir(db->dir))) return 0;
+  db->ent.ino = de->d_ino;
+  db->ent.type = DIRENT_TYPE(de);
+  db->ent.name = de->d_name;
+#endif
+
+  return &db->ent;
+}
+
+void dirbuf_close(struct dirbuf *db)
+{
+  if (!db) return;
+  if (db->dir) closedir(db->dir);
+  else close(db->fd);
+  free(db->buf);
+  free(db);
+}
+
+// Hand the kernel a module with these options, returning 0 or -1 with errno
+// set. Where finit_module() exists the kernel reads the file straight from
+// fd, and decompresses one whose name says it's compressed. Older kernels
+// get the file mapped (not copied) and passed to init_module().
+int load_module(int fd, char *name, char *opts)
+{
+#if defined(__linux__)
+  char *map;
+  off_t len;
+  int rc, err;
+
+#ifdef SYS_finit_module
+  char *s = strrchr(name, '.');
+  int flags = 0;
+
+  if (s && (!strcmp(s, ".gz") || !strcmp(s, ".xz") || !strcmp(s, ".zst")))
+    flags = MODULE_INIT_COMPRESSED_FILE;
+  if (!(rc = syscall(SYS_finit_module, fd, opts, flags)) || errno != ENOSYS)
+    return rc;
+#endif
+  if ((len = fdlength(fd)) < 1) {
+    errno = ENOEXEC;
+
+    return -1;
+  }
+  if (MAP_FAILED == (map = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0)))
+    return -1;
+  rc = syscall(SYS_init_module, map, len, opts);
+  err = errno;
+  munmap(map, len);
+  errno = err;
+
+  return rc;
+#else
+  errno = ENOSYS;
+
+  return -1;
+#endif
+}
@@ -171,6 +171,15 @@ char *basename(char *path);
 char *dirname(char *path);
 #endif
 
+// How much a malloc() block really takes, for counting a command's heap.
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#define toy_blocksize(ptr) malloc_size(ptr)
+#else
+#include <malloc.h>
+#define toy_blocksize(ptr) malloc_usable_size(ptr)
+#endif
+
 // Work out how to do endianness
 
 #if !defined(__APPLE__) && !defined(__rtems__)
@@ -251,6 +260,14 @@ static inline void endutxent(void) {;}
 #define O_PATH   010000000
 #endif
 
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
 #if defined(__SIZEOF_DOUBLE__) && defined(__SIZEOF_LONG__) \
     && __SIZEOF_DOUBLE__ <= __SIZEOF_LONG__
 typedef double FLOAT;
@@ -263,6 +280,126 @@ pid_t xfork(void);
 pid_t xvfork(void);
 #endif
 
+// Without fork() the only way to run two commands at once is threads, so
+// the pointer to the running command's context (toys) has to be thread local.
+#if CFG_TOYBOX_THREADS
+#include <pthread.h>
+#define TOYTLS __thread
+#else
+#define TOYTLS
+#endif
+
+// newlib (RTEMS) keeps stdin/stdout/stderr in per-task reentrancy state, so
+// a command in its own thread can point its stdio somewhere else without
+// touching anybody else's. glibc and friends have one global stdout.
+#if CFG_TOYBOX_THREADS && defined(__rtems__)
+#define TOYBOX_TASK_STDIO 1
+#else
+#define TOYBOX_TASK_STDIO 0
+#endif
+
+// Let the kernel copy file data for xsendfile(). These are Linux syscalls
+// (copy_file_range() via syscall() since old libcs don't wrap it), RTEMS
+// and friends get the read/write loop. cp can also share extents between
+// files on the same copy-on-write filesystem (FICLONE) and preallocate.
+#if CFG_TOYBOX_COPYFILE && defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#define TOYBOX_COPYFILE 1
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#endif
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 1
+#endif
+#else
+#define TOYBOX_COPYFILE 0
+#endif
+
+// Find the data and holes in a sparse file. Where lseek() doesn't know
+// these it fails with EINVAL and lseek_data() treats the file as all data.
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#endif
+#ifndef SEEK_HOLE
+#define SEEK_HOLE 4
+#endif
+
+// Have the device drop or zero a range of blocks (or the filesystem punch
+// a hole in a file) instead of writing zeroes over it.
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifndef BLKDISCARD
+#define BLKDISCARD _IO(0x12, 119)
+#endif
+#ifndef BLKZEROOUT
+#define BLKZEROOUT _IO(0x12, 127)
+#endif
+#ifndef BLKSECDISCARD
+#define BLKSECDISCARD _IO(0x12, 125)
+#endif
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 1
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 2
+#endif
+#endif
+
+// Read directories a big buffer at a time: getdents64() on Linux, where
+// some libcs' readdir() would otherwise make a syscall every few entries,
+// readdir() elsewhere. Entries have the readdir() d_type, or DT_UNKNOWN
+// where there's no such thing.
+#include <dirent.h>
+#ifdef DT_UNKNOWN
+#define DIRENT_TYPE(de) ((de)->d_type)
+#else
+#define DIRENT_TYPE(de) 0
+#define DT_UNKNOWN 0
+#define DT_FIFO    1
+#define DT_CHR     2
+#define DT_DIR     4
+#define DT_BLK     6
+#define DT_REG     8
+#define DT_LNK     10
+#define DT_SOCK    12
+#endif
+
+#define DIRBUF_SIZE (64*1024)
+
+struct dirbuf_ent {
+  unsigned long long ino;
+  unsigned char type;
+  char *name;
+};
+
+struct dirbuf {
+  struct dirbuf_ent ent;
+  DIR *dir;
+  char *buf;
+  int fd, size, len, pos;
+};
+
+struct dirbuf *dirbuf_open(int fd, int size);
+struct dirbuf_ent *dirbuf_read(struct dirbuf *db);
+void dirbuf_close(struct dirbuf *db);
+#define dirbuf_fd(db) ((db)->fd)
+
+// Load a kernel module from an open file. finit_module() lets the kernel
+// read the file itself (and decompress it), init_module() is the fallback.
+#ifndef MODULE_INIT_COMPRESSED_FILE
+#define MODULE_INIT_COMPRESSED_FILE 4
+#endif
+int load_module(int fd, char *name, char *opts);
+
 #ifndef major
 #define major(dev)      ((dev)>>8)
 #endif
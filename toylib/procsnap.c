@@ -0,0 +1,527 @@
+/* procsnap.c - Read the process table out of /proc in one pass.
+ *
+ * The commands that care about processes (ps, top, pidof, killall, lsof,
+ * netstat) all want some subset of the same few files per process, so one
+ * walker reads just the files the caller's flags ask for, parses them in
+ * place, and keeps the results in a column per field.
+ *
+ * See http://kernel.org/doc/Documentation/filesystems/proc.txt Table 1-4
+ * And linux kernel source fs/proc/array.c function do_task_stat()
+ * And http://kernel.org/doc/Documentation/accounting/taskstats.txt
+ */
+
+#include "toys.h"
+#ifdef __linux__
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#endif
+
+// Make room for at least one more process in every column.
+static void procsnap_grow(struct procsnap *snap)
+{
+  long size = snap->size ? 2*snap->size : 256;
+
+  snap->pid = xrealloc(snap->pid, size*sizeof(*snap->pid));
+  snap->tgid = xrealloc(snap->tgid, size*sizeof(*snap->tgid));
+  snap->uid = xrealloc(snap->uid, size*sizeof(*snap->uid));
+  snap->ruid = xrealloc(snap->ruid, size*sizeof(*snap->ruid));
+  snap->gid = xrealloc(snap->gid, size*sizeof(*snap->gid));
+  snap->rgid = xrealloc(snap->rgid, size*sizeof(*snap->rgid));
+  snap->vmlck = xrealloc(snap->vmlck, size*sizeof(*snap->vmlck));
+  snap->state = xrealloc(snap->state, size);
+  snap->name = xrealloc(snap->name, size*sizeof(*snap->name));
+  snap->cmd = xrealloc(snap->cmd, size*sizeof(*snap->cmd));
+  snap->cmdlen = xrealloc(snap->cmdlen, size*sizeof(*snap->cmdlen));
+  snap->stat = xrealloc(snap->stat, size*PROCSNAP_SLOTS*sizeof(long long));
+  snap->io = xrealloc(snap->io, size*PROCSNAP_IOS*sizeof(long long));
+  snap->size = size;
+}
+
+// Append len bytes plus a NUL to the string pool, returning their offset.
+static unsigned procsnap_pool(struct procsnap *snap, char *s, int len)
+{
+  unsigned long at = snap->used;
+
+  if (at+len+1 > snap->room) {
+    snap->room = 2*(at+len+1) > 65536 ? 2*(at+len+1) : 65536;
+    snap->pool = xrealloc(snap->pool, snap->room);
+  }
+  memcpy(snap->pool+at, s, len);
+  snap->pool[at+len] = 0;
+  snap->used += len+1;
+
+  return at;
+}
+
+// Read up to len-1 bytes of a /proc file into buf and NUL terminate it,
+// returning the length or -1 if it couldn't be opened (process went away).
+static int procsnap_file(char *path, char *buf, int len)
+{
+  int fd = open(path, O_RDONLY|O_CLOEXEC);
+
+  if (fd == -1) return -1;
+  len = readall(fd, buf, len-1);
+  close(fd);
+  if (len<0) return -1;
+  buf[len] = 0;
+
+  return len;
+}
+
+// Parse a NUL terminated "pid (name) S 1 2 3..." stat line into state, name
+// and slot[] (pid in slot[0], the field after the state in slot[1]), zeroing
+// slots the kernel didn't fill. The name can contain spaces and parentheses
+// so it ends at the last ')'. Returns the name's length, or -1 if this isn't
+// a stat line.
+int procsnap_parse_stat(char *buf, int len, long long *slot, char **name,
+  char *state)
+{
+  unsigned long long ll;
+  char *s, *end = buf+len;
+  int n, neg;
+
+  for (s = end; s>buf && *--s != ')';);
+  if (!(*name = memchr(buf, '(', s-buf)) || end-s<3) return -1;
+  *state = s[2];
+  *slot = atol(buf);
+
+  for (end = s, s += 3, n = 1; n<PROCSNAP_SLOTS; n++) {
+    while (*s == ' ') s++;
+    if ((neg = (*s == '-'))) s++;
+    if (*s<'0' || *s>'9') break;
+    for (ll = 0; *s>='0' && *s<='9'; s++) ll = ll*10+*s-'0';
+    slot[n] = neg ? -(long long)ll : (long long)ll;
+  }
+  memset(slot+n, 0, (PROCSNAP_SLOTS-n)*sizeof(long long));
+  (*name)++;
+
+  return end-*name;
+}
+
+// Pick real uid and gid (the first of each list) and VmLck out of status.
+static void procsnap_parse_status(struct procsnap *snap, long i, char *buf, int len)
+{
+  char *s = buf, *end = buf+len;
+
+  while (s<end) {
+    if (strstart(&s, "Uid:")) snap->ruid[i] = atol(s);
+    else if (strstart(&s, "Gid:")) snap->rgid[i] = atol(s);
+    else if (strstart(&s, "VmLck:")) snap->vmlck[i] = atoll(s);
+    if (!(s = memchr(s, '\n', end-s))) break;
+    s++;
+  }
+}
+
+#ifdef __linux__
+// A generic netlink message: header, then attributes.
+struct procsnap_genl {
+  struct nlmsghdr nlh;
+  struct genlmsghdr genl;
+  char attrs[2048];
+};
+
+// Find attribute type in the len bytes of them at attrs, or return NULL.
+static struct nlattr *procsnap_nla(void *attrs, int len, int type)
+{
+  struct nlattr *nla = attrs;
+
+  while (len>=NLA_HDRLEN && nla->nla_len>=NLA_HDRLEN && nla->nla_len<=len) {
+    if ((nla->nla_type&NLA_TYPE_MASK) == type) return nla;
+    len -= NLA_ALIGN(nla->nla_len);
+    nla = (void *)((char *)nla+NLA_ALIGN(nla->nla_len));
+  }
+
+  return 0;
+}
+
+// Send family a cmd with one attribute and read the answer into msg.
+// Returns the length of the answer's attributes, or -errno.
+static int procsnap_ask(int fd, struct procsnap_genl *msg, int family,
+  int cmd, int type, void *data, int len)
+{
+  static unsigned seq;
+  struct nlattr *nla = (void *)msg->attrs;
+  int got;
+
+  memset(msg, 0, sizeof(msg->nlh)+sizeof(msg->genl));
+  msg->nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN+NLA_HDRLEN+len);
+  msg->nlh.nlmsg_type = family;
+  msg->nlh.nlmsg_flags = NLM_F_REQUEST;
+  msg->nlh.nlmsg_seq = ++seq;
+  msg->genl.cmd = cmd;
+  msg->genl.version = 1;
+  nla->nla_type = type;
+  nla->nla_len = NLA_HDRLEN+len;
+  memcpy((char *)nla+NLA_HDRLEN, data, len);
+  if (0>send(fd, msg, msg->nlh.nlmsg_len, 0)) return -errno;
+
+  // Skip anything left over from a request we gave up on.
+  do if (0>(got = recv(fd, msg, sizeof(*msg), 0))) return -errno;
+  while (got>=sizeof(msg->nlh) && msg->nlh.nlmsg_seq != seq);
+  if (!NLMSG_OK(&msg->nlh, got)) return -EIO;
+  if (msg->nlh.nlmsg_type == NLMSG_ERROR) {
+    got = ((struct nlmsgerr *)NLMSG_DATA(&msg->nlh))->error;
+
+    return got ? got : -EIO;
+  }
+
+  return msg->nlh.nlmsg_len-NLMSG_LENGTH(GENL_HDRLEN);
+}
+
+// Open a socket to ask taskstats about processes, or return -1 if this
+// kernel can't (no CONFIG_TASKSTATS, or we're in another network namespace).
+static int procsnap_taskstats(unsigned short *family)
+{
+  struct procsnap_genl msg;
+  struct sockaddr_nl sa;
+  struct nlattr *nla;
+  int fd, len;
+
+  if (-1 == (fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_GENERIC)))
+    return -1;
+  memset(&sa, 0, sizeof(sa));
+  sa.nl_family = AF_NETLINK;
+  if (!connect(fd, (void *)&sa, sizeof(sa))
+      && 0<(len = procsnap_ask(fd, &msg, GENL_ID_CTRL, CTRL_CMD_GETFAMILY,
+        CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME,
+        sizeof(TASKSTATS_GENL_NAME)))
+      && (nla = procsnap_nla(msg.attrs, len, CTRL_ATTR_FAMILY_ID)))
+  {
+    memcpy(family, (char *)nla+NLA_HDRLEN, sizeof(*family));
+
+    return fd;
+  }
+  close(fd);
+
+  return -1;
+}
+
+// Fill in io[] for one thread out of taskstats' binary record (the byte
+// counts rounded down to kB), returning 0 if it won't say.
+static int procsnap_taskstats_io(struct procsnap *snap, pid_t pid,
+  long long *io)
+{
+  struct procsnap_genl msg;
+  struct taskstats ts;
+  struct nlattr *nla;
+  __u32 task = pid;
+  int len;
+
+  len = procsnap_ask(snap->tsfd, &msg, snap->tsfamily, TASKSTATS_CMD_GET,
+    TASKSTATS_CMD_ATTR_PID, &task, sizeof(task));
+
+  // It takes CAP_NET_ADMIN, so don't ask about every other process too.
+  if (len == -EPERM) {
+    close(snap->tsfd);
+    snap->tsfd = -1;
+  }
+  if (len<=0 || !(nla = procsnap_nla(msg.attrs, len, TASKSTATS_TYPE_AGGR_PID))
+      || !(nla = procsnap_nla((char *)nla+NLA_HDRLEN, nla->nla_len-NLA_HDRLEN,
+        TASKSTATS_TYPE_STATS))) return 0;
+
+  // Older kernels send a shorter struct, newer ones a longer one.
+  memset(&ts, 0, sizeof(ts));
+  if ((len = nla->nla_len-NLA_HDRLEN) > sizeof(ts)) len = sizeof(ts);
+  memcpy(&ts, (char *)nla+NLA_HDRLEN, len);
+  io[PROCSNAP_RCHAR] = ts.read_char;
+  io[PROCSNAP_WCHAR] = ts.write_char;
+  io[PROCSNAP_RBYTES] = ts.read_bytes;
+  io[PROCSNAP_WBYTES] = ts.write_bytes;
+  io[PROCSNAP_BLKIO] = ts.blkio_delay_total;
+
+  return 1;
+}
+#else
+static int procsnap_taskstats(unsigned short *family)
+{
+  return -1;
+}
+
+static int procsnap_taskstats_io(struct procsnap *snap, pid_t pid,
+  long long *io)
+{
+  return 0;
+}
+#endif
+
+// Fill in process i's io counters, from taskstats when it'll answer (one
+// binary reply instead of a file to open and parse), else from io and stat
+// in its /proc directory.
+static void procsnap_getio(struct procsnap *snap, long i, char *path,
+  int plen, long parent)
+{
+  long long *io = procsnap_io(snap, i), *stat = procsnap_stat(snap, i);
+  char *s, *end, *buf = libbuf;
+  int len, k;
+
+  memset(io, 0, PROCSNAP_IOS*sizeof(long long));
+
+  // Taskstats only counts io a thread at a time (its per process answer
+  // leaves it out, and threads that exited are gone), so a process's total
+  // comes from /proc/$PID/io.
+  if (parent != -1 && snap->tsfd != -1
+      && procsnap_taskstats_io(snap, snap->pid[i], io)) return;
+
+  strcpy(path+plen, "io");
+  if (0<(len = procsnap_file(path, buf, sizeof(libbuf)))) {
+    for (s = buf, end = buf+len; s<end; s++) {
+      for (k = 0; k<4; k++)
+        if (strstart(&s, ((char *[]){"rchar:", "wchar:", "read_bytes:",
+          "write_bytes:"})[k])) break;
+      if (k<4) io[k] = atoll(s);
+      if (!(s = memchr(s, '\n', end-s))) break;
+    }
+  }
+
+  // delayacct_blkio_ticks
+  if (snap->flags & PROCSNAP_STAT)
+    io[PROCSNAP_BLKIO] = stat[39]*(1000000000/sysconf(_SC_CLK_TCK));
+}
+
+// Add one process (or thread, if parent isn't -1) whose /proc directory is
+// the first plen bytes of path. Threads share their process's owner, status
+// and command line, so those are copied instead of read. Returns 0 if it
+// went away or the keep callback didn't want it.
+static int procsnap_add(struct procsnap *snap, char *path, int plen,
+  pid_t pid, pid_t tgid, long parent)
+{
+  long i = snap->count;
+  unsigned long used = snap->used;
+  char *buf = libbuf, *name;
+  int len;
+
+  if (i == snap->size) procsnap_grow(snap);
+  snap->pid[i] = pid;
+  snap->tgid[i] = tgid;
+  snap->state[i] = 0;
+  snap->uid[i] = snap->ruid[i] = snap->gid[i] = snap->rgid[i] = 0;
+  snap->vmlck[i] = 0;
+  snap->name[i] = snap->cmd[i] = 0;
+  snap->cmdlen[i] = 0;
+
+  if (snap->flags & PROCSNAP_STAT) {
+    strcpy(path+plen, "stat");
+    if (0>(len = procsnap_file(path, buf, sizeof(libbuf)))
+        || 0>(len = procsnap_parse_stat(buf, len, procsnap_stat(snap, i),
+          &name, snap->state+i))) goto drop;
+    snap->name[i] = procsnap_pool(snap, name, len>255 ? 255 : len);
+  }
+
+  if (parent != -1) {
+    snap->uid[i] = snap->uid[parent];
+    snap->ruid[i] = snap->ruid[parent];
+    snap->gid[i] = snap->gid[parent];
+    snap->rgid[i] = snap->rgid[parent];
+    snap->vmlck[i] = snap->vmlck[parent];
+  } else {
+    if (snap->flags & PROCSNAP_OWNER) {
+      struct stat st;
+
+      path[plen-1] = 0;
+      len = stat(path, &st);
+      path[plen-1] = '/';
+      if (len) goto drop;
+      snap->uid[i] = snap->ruid[i] = st.st_uid;
+      snap->gid[i] = snap->rgid[i] = st.st_gid;
+    }
+    if (snap->flags & PROCSNAP_STATUS) {
+      strcpy(path+plen, "status");
+      if (0<(len = procsnap_file(path, buf, sizeof(libbuf))))
+        procsnap_parse_status(snap, i, buf, len);
+    }
+  }
+
+  // Ask before reading the command line and io, which are the expensive ones.
+  if (snap->keep && !snap->keep(snap, i)) goto drop;
+
+  if (snap->flags & PROCSNAP_IO) procsnap_getio(snap, i, path, plen, parent);
+
+  if (snap->flags & PROCSNAP_CMDLINE) {
+    if (parent != -1) {
+      snap->cmd[i] = snap->cmd[parent];
+      snap->cmdlen[i] = snap->cmdlen[parent];
+    } else {
+      strcpy(path+plen, "cmdline");
+      if (0>(len = procsnap_file(path, buf, sizeof(libbuf)))) goto drop;
+      snap->cmd[i] = procsnap_pool(snap, buf, len);
+      snap->cmdlen[i] = len;
+    }
+  }
+  snap->count++;
+
+  return 1;
+
+drop:
+  snap->used = used;
+
+  return 0;
+}
+
+// Parse a /proc entry name as a pid, returning 0 if it isn't one.
+static pid_t procsnap_pid(char *name)
+{
+  pid_t pid = 0;
+
+  for (; *name>='0' && *name<='9'; name++) pid = pid*10+*name-'0';
+
+  return *name ? 0 : pid;
+}
+
+// Fill out snap (zeroed, or left over from a previous read to reuse its
+// memory) with every process in /proc, and their threads with
+// PROCSNAP_THREADS. keep can veto each one after its stat, owner and status
+// are in, before its command line is read.
+void procsnap_read(struct procsnap *snap, int flags,
+  int (*keep)(struct procsnap *snap, long i))
+{
+  struct dirbuf *dir, *task;
+  struct dirbuf_ent *ent, *tent;
+  char path[64];
+  pid_t pid, tid;
+  long i;
+  int fd, len;
+
+  // Offset 0 of the pool is the empty string, for fields not read.
+  snap->count = snap->used = 0;
+  procsnap_pool(snap, "", 0);
+  snap->flags = flags;
+  snap->keep = keep;
+  snap->tsfd = ((flags & PROCSNAP_IO) && (flags & PROCSNAP_THREADS))
+    ? procsnap_taskstats(&snap->tsfamily) : -1;
+  if (-1 == (fd = open("/proc", O_RDONLY|O_CLOEXEC))
+      || !(dir = dirbuf_open(fd, 0))) perror_exit("/proc");
+
+  while ((ent = dirbuf_read(dir))) {
+    if (!(pid = procsnap_pid(ent->name))) continue;
+    len = sprintf(path, "/proc/%d/", pid);
+    i = snap->count;
+    if (!procsnap_add(snap, path, len, pid, pid, -1)) continue;
+    if (!(flags & PROCSNAP_THREADS)) continue;
+
+    strcpy(path+len, "task");
+    if (-1 == (fd = open(path, O_RDONLY|O_CLOEXEC))) continue;
+    if (!(task = dirbuf_open(fd, 4096))) {
+      close(fd);
+      continue;
+    }
+    while ((tent = dirbuf_read(task))) {
+      if (!(tid = procsnap_pid(tent->name)) || tid == pid) continue;
+      procsnap_add(snap, path,
+        sprintf(path, "/proc/%d/task/%d/", pid, tid), tid, pid, i);
+    }
+    dirbuf_close(task);
+  }
+  dirbuf_close(dir);
+  if (snap->tsfd != -1) close(snap->tsfd);
+}
+
+void procsnap_free(struct procsnap *snap)
+{
+  free(snap->pid);
+  free(snap->tgid);
+  free(snap->uid);
+  free(snap->ruid);
+  free(snap->gid);
+  free(snap->rgid);
+  free(snap->vmlck);
+  free(snap->state);
+  free(snap->name);
+  free(snap->cmd);
+  free(snap->cmdlen);
+  free(snap->stat);
+  free(snap->io);
+  free(snap->pool);
+  memset(snap, 0, sizeof(*snap));
+}
+
+// Read smaps a 64k block at a time rather than a line at a time.
+#define SMAPS_BUF 65536
+
+static char *smaps_keys[] = {"Rss:", "Pss:", "Shared_Clean:", "Shared_Dirty:",
+  "Private_Clean:", "Private_Dirty:", "Swap:"};
+
+// Parse hex digits, leaving *s after them.
+static unsigned long long smaps_hex(char **s)
+{
+  unsigned long long n = 0;
+
+  for (; isxdigit(**s); ++*s) n = n*16+(**s>'9' ? (**s|32)-'a'+10 : **s-'0');
+
+  return n;
+}
+
+// Handle one NUL terminated line. A mapping starts with a "start-end perms
+// offset dev inode name" line and runs until the next one, so each mapping's
+// counters are complete (and it's handed to each()) when the next starts.
+static void smaps_line(struct smaps *sm, char *s, int *have,
+  void (*each)(struct smaps *sm, void *arg), void *arg)
+{
+  unsigned long long start;
+  char *ss = s;
+  int k, len;
+
+  // Keys like "AnonHugePages:" start with hex digits too, but no '-' follows.
+  start = smaps_hex(&s);
+  if (s != ss && *s == '-') {
+    if (*have) each(sm, arg);
+    *have = 1;
+    memset(sm->kb, 0, sizeof(sm->kb));
+    sm->start = start;
+    s++;
+    sm->end = smaps_hex(&s);
+    for (k = 0; *++s && *s != ' ' && k<4; k++) sm->perms[k] = *s;
+    sm->perms[k] = 0;
+    // Skip offset, dev and inode to get to the name (if any).
+    for (k = 0; k<3; k++) {
+      while (*s == ' ') s++;
+      while (*s && *s != ' ') s++;
+    }
+    while (*s == ' ') s++;
+    len = strlen(s);
+    if (len >= sizeof(sm->name)) len = sizeof(sm->name)-1;
+    memcpy(sm->name, s, len);
+    sm->name[len] = 0;
+
+    return;
+  }
+  if (!*have) return;
+
+  // Only the keys wanted, compared by fixed prefix.
+  for (s = ss, k = 0; k<SMAPS_KEYS; k++) {
+    if (*s != *smaps_keys[k]) continue;
+    len = strlen(smaps_keys[k]);
+    if (strncmp(s, smaps_keys[k], len)) continue;
+    sm->kb[k] = atoll(s+len);
+    break;
+  }
+}
+
+// Call each() for every mapping in an open smaps file, or smaps_rollup (one
+// mapping for the whole process), or maps (every counter 0), then close it.
+void procsnap_smaps(int fd, void (*each)(struct smaps *sm, void *arg),
+  void *arg)
+{
+  struct smaps sm;
+  char *buf, *s, *nl;
+  int len = 0, got, have = 0;
+
+  buf = xmalloc(SMAPS_BUF+1);
+  for (;;) {
+    if (0<(got = read(fd, buf+len, SMAPS_BUF-len))) len += got;
+    for (s = buf; s<buf+len; s = nl+1) {
+      if (!(nl = memchr(s, '\n', buf+len-s))) {
+        // Wait for the rest of a partial line unless at EOF or it's full.
+        if (got>0 && (s != buf || len<SMAPS_BUF)) break;
+        nl = buf+len;
+      }
+      *nl = 0;
+      smaps_line(&sm, s, &have, each, arg);
+    }
+    if (s>buf+len) s = buf+len;
+    memmove(buf, s, len -= s-buf);
+    if (got<=0) break;
+  }
+  if (have) each(&sm, arg);
+  free(buf);
+  close(fd);
+}
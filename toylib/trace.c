@@ -0,0 +1,159 @@
+/* trace.c - Always-on event tracing into per-thread rings.
+ *
+ * Each thread writes fixed size events into a ring of its own, so writing
+ * one takes no lock: fill in the slot, then publish it by moving the head
+ * on. Nobody else writes that ring, and a reader copies what it can see and
+ * then throws away whatever the writer could have lapped in the meantime.
+ * The rings are on a list that only ever grows, and a thread that exits
+ * leaves its ring (and the history in it) for the next thread to take.
+ */
+
+#include "toys.h"
+
+#if CFG_TOYBOX_TRACE
+
+// Must be a power of 2.
+#define TRACE_RING 256
+
+struct trace_ring {
+  struct trace_ring *next;
+  unsigned long head, from;
+  int busy, id;
+  struct trace_event ev[TRACE_RING];
+};
+
+#define TRACE_NAME(name) #name,
+const char *const trace_names[] = { TRACE_EVENTS(TRACE_NAME) };
+#undef TRACE_NAME
+
+static struct trace_ring *trace_rings;
+static int trace_count;
+static TOYTLS struct trace_ring *trace_mine;
+
+#if CFG_TOYBOX_THREADS
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+// The thread is exiting, let another have its ring.
+static void trace_release(void *ring)
+{
+  __atomic_store_n(&((struct trace_ring *)ring)->busy, 0, __ATOMIC_RELEASE);
+}
+
+static void trace_keyinit(void)
+{
+  pthread_key_create(&trace_key, trace_release);
+}
+#endif
+
+static struct trace_ring *trace_get(void)
+{
+  struct trace_ring *r;
+  int zero;
+
+  for (r = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+    zero = 0;
+    if (__atomic_compare_exchange_n(&r->busy, &zero, 1, 0, __ATOMIC_ACQUIRE,
+      __ATOMIC_RELAXED)) break;
+  }
+  if (!r) {
+    if (!(r = calloc(1, sizeof(*r)))) return 0;
+    r->busy = 1;
+    r->id = __atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED);
+    r->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_rings, &r->next, r, 0,
+      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+#if CFG_TOYBOX_THREADS
+  pthread_once(&trace_once, trace_keyinit);
+  pthread_setspecific(trace_key, r);
+#endif
+
+  return trace_mine = r;
+}
+
+// Record an event in this thread's ring. str may be NULL, and only the
+// start of a long one is kept.
+void trace_event(int type, const char *str, long long num)
+{
+  struct trace_ring *r = trace_mine;
+  struct trace_event *ev;
+  struct timespec ts;
+  unsigned long head;
+  int i = 0;
+
+  if (!r && !(r = trace_get())) return;
+  head = r->head;
+  ev = r->ev+(head&(TRACE_RING-1));
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ev->ns = ts.tv_sec*1000000000ULL+ts.tv_nsec;
+  ev->num = num;
+  ev->type = type;
+  ev->ring = r->id;
+  if (str) for (; str[i] && i<sizeof(ev->str)-1; i++) ev->str[i] = str[i];
+  ev->str[i] = 0;
+  __atomic_store_n(&r->head, head+1, __ATOMIC_RELEASE);
+}
+
+static int trace_cmp(const void *a, const void *b)
+{
+  const struct trace_event *x = a, *y = b;
+
+  return (x->ns > y->ns) - (x->ns < y->ns);
+}
+
+// Copy every ring's events since the last trace_clear() into one array,
+// oldest first. Returns NULL with *count 0 when there are none, or no
+// memory for them. Free the result.
+struct trace_event *trace_snapshot(int *count)
+{
+  struct trace_ring *r, *rings = __atomic_load_n(&trace_rings,
+    __ATOMIC_ACQUIRE);
+  struct trace_event *all;
+  unsigned long head, start, again;
+  int n = 0, i;
+
+  *count = 0;
+  for (r = rings; r; r = r->next) n++;
+  if (!n || !(all = malloc(n*sizeof(*all)*TRACE_RING))) return 0;
+  n = 0;
+  for (r = rings; r; r = r->next) {
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    start = head>TRACE_RING ? head-TRACE_RING : 0;
+    if (start<r->from) start = r->from;
+    for (i = 0; start+i<head; i++)
+      all[n+i] = r->ev[(start+i)&(TRACE_RING-1)];
+
+    // The slot of the event being written when we looked again may be torn,
+    // and everything before it was overwritten.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    again = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    if (again-start>=TRACE_RING) {
+      unsigned long lost = again-start-TRACE_RING+1;
+
+      if (lost>=i) continue;
+      memmove(all+n, all+n+lost, (i-lost)*sizeof(*all));
+      i -= lost;
+    }
+    n += i;
+  }
+  if (!n) {
+    free(all);
+    return 0;
+  }
+  qsort(all, n, sizeof(*all), trace_cmp);
+  *count = n;
+
+  return all;
+}
+
+// Forget what's in the rings so far.
+void trace_clear(void)
+{
+  struct trace_ring *r;
+
+  for (r = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); r; r = r->next)
+    r->from = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+}
+
+#endif
@@ -0,0 +1,56 @@
+/* trace.h - Always-on event tracing, see trace.c
+ *
+ * Standalone so the shell can use it without all of toys.h.
+ */
+
+#ifndef TOYLIB_TRACE_H
+#define TOYLIB_TRACE_H
+
+#include "geninc/config.h"
+
+// Every event is a string (a command's name, a file) and a number (an exit
+// status, a fd, a size), see the call sites.
+#define TRACE_EVENTS(X) X(toy_start) X(toy_end) X(builtin_enter) \
+  X(builtin_exit) X(forkshell) X(pipe_stage) X(redirect) X(stack_grow) \
+  X(dirtree_enter)
+
+#define TRACE_ENUM(name) TRACE_##name,
+enum { TRACE_EVENTS(TRACE_ENUM) TRACE_COUNT };
+#undef TRACE_ENUM
+
+struct trace_event {
+  unsigned long long ns;    // CLOCK_MONOTONIC
+  long long num;
+  unsigned short type, ring;
+  char str[28];
+};
+
+extern const char *const trace_names[];
+
+void trace_event(int type, const char *str, long long num);
+struct trace_event *trace_snapshot(int *count);
+void trace_clear(void);
+
+// Each site is also a static probe for perf and bpftrace, "shellbox:toy_start"
+// and so on, with the string and number as its two arguments. A probe costs
+// a nop until something attaches to it.
+#if CFG_TOYBOX_TRACE && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(ev, str, num) DTRACE_PROBE2(shellbox, ev, str, num)
+#endif
+#endif
+#ifndef TRACE_PROBE
+#define TRACE_PROBE(ev, str, num) do {} while (0)
+#endif
+
+#if CFG_TOYBOX_TRACE
+#define toy_trace(ev, str, num) do { \
+  TRACE_PROBE(ev, str, (long long)(num)); \
+  trace_event(TRACE_##ev, str, num); \
+} while (0)
+#else
+#define toy_trace(ev, str, num) do {} while (0)
+#endif
+
+#endif /* TOYLIB_TRACE_H */
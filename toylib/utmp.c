@@ -0,0 +1,56 @@
+/* utmp.c - Walk utmp and wtmp files mapped into memory.
+ *
+ * They're arrays of fixed size records, so instead of a read() per record
+ * through getutxent(), map the file and index it, front to back or back to
+ * front (which is how last wants wtmp), looking at each record's type before
+ * handing it out.
+ */
+
+#include "toys.h"
+
+// Map path (NULL for the utmp file of current logins). Returns -1 if it
+// couldn't be opened, leaving uf empty so walking it finds nothing.
+int utmpfile_open(struct utmpfile *uf, char *path)
+{
+  struct stat st;
+  int fd, rc = 0;
+
+  memset(uf, 0, sizeof(*uf));
+  if (-1 == (fd = open(path ? path : UTMPFILE_DEFAULT, O_RDONLY|O_CLOEXEC)))
+    return -1;
+  if (!fstat(fd, &st)) uf->count = st.st_size/sizeof(struct utmpx);
+  if (uf->count) {
+    uf->len = uf->count*sizeof(struct utmpx);
+    if (MAP_FAILED == (uf->ut = mmap(0, uf->len, PROT_READ, MAP_PRIVATE, fd, 0)))
+    {
+      memset(uf, 0, sizeof(*uf));
+      rc = -1;
+    }
+  }
+  close(fd);
+
+  return rc;
+}
+
+// Step *i to the next record (or with backward, the previous one) whose
+// ut_type is in the types bitmask (0 for any), returning NULL at the end.
+// Start *i at -1 to go forward, or uf->count to go backward.
+struct utmpx *utmpfile_next(struct utmpfile *uf, long *i, int backward,
+  unsigned types)
+{
+  struct utmpx *ut;
+  unsigned type;
+
+  for (;;) {
+    if (backward ? --*i<0 : ++*i>=uf->count) return 0;
+    ut = uf->ut+*i;
+    type = ut->ut_type;
+    if (!types || (type<32 && (types&(1<<type)))) return ut;
+  }
+}
+
+void utmpfile_close(struct utmpfile *uf)
+{
+  if (uf->len) munmap(uf->ut, uf->len);
+  memset(uf, 0, sizeof(*uf));
+}
@@ -33,6 +33,9 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "xfuncs.h"
 
@@ -40,6 +43,16 @@
 #define PATH_MAX 8192
 #endif
 
+/*
+ * Absolute paths and paths relative to AT_FDCWD need no directory change,
+ * and fchdir(AT_FDCWD) would only fail with EBADF.
+ */
+static int
+at_here(int fd, const char *path)
+{
+	return (fd == AT_FDCWD || *path == '/');
+}
+
 int
 xfaccessat(int fd, const char *path, int mode, int flag)
 {
@@ -50,6 +63,9 @@ xfaccessat(int fd, const char *path, int mode, int flag)
 		return (-1);
 	}
 
+	if (at_here(fd, path))
+		return (access(path, mode));
+
 	cfd = open(".", O_RDONLY
 #ifdef O_DIRECTORY
 		   | O_DIRECTORY
@@ -79,6 +95,10 @@ xfstatat(int fd, const char *path, struct stat *buf, int flag)
 {
 	int cfd, error, ret;
 
+	if (at_here(fd, path))
+		return (flag == AT_SYMLINK_NOFOLLOW ? lstat(path, buf) :
+		    stat(path, buf));
+
 	cfd = open(".", O_RDONLY
 #ifdef O_DIRECTORY
 		   | O_DIRECTORY
@@ -156,7 +176,18 @@ int xmkdirat(int dirfd, const char *pathname, mode_t mode)
 int
 xopenat(int fd, const char *path, int flags, ...)
 {
-	int cfd, ffd, error;
+	int cfd, ffd, error, mode = 0;
+
+	if ((flags & O_CREAT) != 0) {
+		va_list ap;
+
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+
+	if (at_here(fd, path))
+		return (open(path, flags, mode));
 
 	cfd = open(".", O_RDONLY 
 #ifdef O_DIRECTORY
@@ -173,18 +204,7 @@ xopenat(int fd, const char *path, int flags, ...)
 		return (-1);
 	}
 
-	if ((flags & O_CREAT) != 0) {
-		va_list ap;
-		int mode;
-
-		va_start(ap, flags);
-		mode = va_arg(ap, int);
-		va_end(ap);
-
-		ffd = open(path, flags, mode);
-	} else {
-		ffd = open(path, flags);
-	}
+	ffd = open(path, flags, mode);
 
 	error = errno;
 	(void)fchdir(cfd);
@@ -199,6 +219,9 @@ xfchmodat(int dirfd, const char *pathname, mode_t mode, int flags)
     (void)flags;
 	int cfd, ret, error;
 
+	if (at_here(dirfd, pathname))
+		return (chmod(pathname, mode));
+
 	cfd = open(".", O_RDONLY 
 #ifdef O_DIRECTORY
 		   | O_DIRECTORY
@@ -228,6 +251,9 @@ xreadlinkat(int dirfd, const char *pathname, char *buf, size_t bufsiz)
 {
 	int cfd, ret, error;
 
+	if (at_here(dirfd, pathname))
+		return (readlink(pathname, buf, bufsiz));
+
 	cfd = open(".", O_RDONLY 
 #ifdef O_DIRECTORY
 		   | O_DIRECTORY
@@ -257,6 +283,10 @@ xunlinkat(int dirfd, const char *pathname, int flags)
 {
 	int cfd, ret, error;
 
+	if (at_here(dirfd, pathname))
+		return (flags & AT_REMOVEDIR ? rmdir(pathname) :
+		    unlink(pathname));
+
 	cfd = open(".", O_RDONLY 
 #ifdef O_DIRECTORY
 		   | O_DIRECTORY
@@ -289,6 +319,15 @@ xfchownat(int dirfd, const char *pathname, uid_t owner, gid_t group, int flags)
 {
 	int cfd, ret, error;
 
+	if (at_here(dirfd, pathname)
+#ifdef AT_EMPTY_PATH
+	    && !(flags & AT_EMPTY_PATH)
+#endif
+	    )
+		return (flags & AT_SYMLINK_NOFOLLOW ?
+		    lchown(pathname, owner, group) :
+		    chown(pathname, owner, group));
+
 	cfd = open(".", O_RDONLY 
 #ifdef O_DIRECTORY
 		   | O_DIRECTORY
@@ -326,6 +365,9 @@ xsymlinkat(const char *oldpath, int newdirfd, const char *newpath)
 {
 	int cfd, ret, error;
 
+	if (at_here(newdirfd, newpath))
+		return (symlink(oldpath, newpath));
+
 	cfd = open(".", O_RDONLY 
 #ifdef O_DIRECTORY
 		   | O_DIRECTORY
@@ -355,6 +397,9 @@ xmknodat(int dirfd, const char *pathname, mode_t mode, dev_t dev)
 {
 	int cfd, ret, error;
 
+	if (at_here(dirfd, pathname))
+		return (mknod(pathname, mode, dev));
+
 	cfd = open(".", O_RDONLY 
 #ifdef O_DIRECTORY
 		   | O_DIRECTORY
@@ -379,15 +424,58 @@ xmknodat(int dirfd, const char *pathname, mode_t mode, dev_t dev)
 	return ret;
 }
 
+/*
+ * link() has no directory to change into for both paths at once, so the
+ * old path is made absolute first (link() doesn't follow symlinks, which
+ * is what flags without AT_SYMLINK_FOLLOW asks for anyway).
+ */
 int 
 xlinkat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags)
 {
-    (void)olddirfd;
-    (void)oldpath;
-    (void)newdirfd;
-    (void)newpath;
-    (void)flags;
-	/* implement this later. */
-	errno = EINVAL;
-	return -1;
+	char *abs, *dir;
+	int cfd, ret, error;
+
+	(void)flags;
+
+	if (at_here(olddirfd, oldpath) && at_here(newdirfd, newpath))
+		return (link(oldpath, newpath));
+
+	cfd = open(".", O_RDONLY 
+#ifdef O_DIRECTORY
+		   | O_DIRECTORY
+#endif
+		   );
+	if (cfd == -1)
+		return (-1);
+
+	abs = NULL;
+	if (*oldpath != '/') {
+		if ((dir = malloc(PATH_MAX)) == NULL ||
+		    (olddirfd != AT_FDCWD && fchdir(olddirfd) == -1) ||
+		    getcwd(dir, PATH_MAX - 1) == NULL ||
+		    (abs = malloc(strlen(dir) + strlen(oldpath) + 2)) == NULL) {
+			error = errno;
+			free(dir);
+			(void)fchdir(cfd);
+			(void)close(cfd);
+			errno = error;
+			return (-1);
+		}
+		sprintf(abs, "%s/%s", dir, oldpath);
+		free(dir);
+		(void)fchdir(cfd);
+		oldpath = abs;
+	}
+
+	if (!at_here(newdirfd, newpath) && fchdir(newdirfd) == -1)
+		ret = -1;
+	else
+		ret = link(oldpath, newpath);
+
+	error = errno;
+	free(abs);
+	(void)fchdir(cfd);
+	(void)close(cfd);
+	errno = error;
+	return ret;
 }
@@ -47,8 +47,7 @@ void xexec(char **argv)
         return;
      }
      
-     toy_init(toy, argv);
-     toy_run(toy, argv);
+     toys.exitval = toy_run(toy, argv);
   }
   else
   {
@@ -98,16 +97,78 @@ int xexecvp(const char *file, char *const argv[])
   return -1;
 }
 
+// Run argv in this process if it's a toy command (and we're not a vfork
+// child that mustn't recurse), with stdin and stdout on in and out (-1 to
+// share ours), which it then owns. Returns the command's exit value, or -1
+// if argv has to be exec()ed instead: it isn't a toy, or this libc can't
+// give one command its own stdio.
+int xrun_toy(char **argv, int in, int out)
+{
+  struct toy_list *toy;
+  int rc;
+#if TOYBOX_TASK_STDIO
+  FILE *oldin = stdin, *oldout = stdout;
+#endif
+
+  if (!CFG_TOYBOX || CFG_TOYBOX_NORECURSE || !toys.stacktop || !argv
+      || !(toy = toy_find(*argv))) return -1;
+  if (!TOYBOX_TASK_STDIO && (in != -1 || out != -1)) return -1;
+
+  // Keep what we've already written ahead of what it writes.
+  fflush(stdout);
+#if TOYBOX_TASK_STDIO
+  if (in != -1) stdin = fdopen(in, "r");
+  if (out != -1) stdout = fdopen(out, "w");
+#endif
+  rc = toy_run(toy, argv);
+#if TOYBOX_TASK_STDIO
+  if (in != -1) fclose(stdin);
+  if (out != -1) fclose(stdout);
+  stdin = oldin;
+  stdout = oldout;
+#endif
+
+  return rc;
+}
+
+// Toy commands xpopen_both() ran without a child process, under the
+// (negative) pids it handed out for xwaitpid() to collect: in a thread when
+// there's a pipe to talk to them through, otherwise already finished.
+static TOYTLS struct toy_child {
+  struct toy_child *next;
+  struct toy_thread *tt;
+  pid_t pid;
+  int exitval;
+} *toy_children;
+static TOYTLS pid_t toy_lastchild;
+
+static pid_t toy_child(struct toy_thread *tt, int exitval)
+{
+  struct toy_child *tc = xkeep(xmalloc(sizeof(struct toy_child)));
+
+  tc->next = toy_children;
+  tc->tt = tt;
+  tc->exitval = exitval;
+  if (--toy_lastchild > -2) toy_lastchild = -2;
+  tc->pid = toy_lastchild;
+  toy_children = tc;
+
+  return tc->pid;
+}
+
 // Spawn child process, capturing stdin/stdout.
 // argv[]: command to exec. If null, child re-runs original program with
 //         toys.stacktop zeroed.
 // pipes[2]: stdin, stdout of new process, only allocated if zero on way in,
 //           pass NULL to skip pipe allocation entirely.
-// return: pid of child process
+// return: pid of child process (negative if it's a toy running in-process)
 pid_t xpopen_both(char **argv, int *pipes)
 {
   int cestnepasun[4], pid;
 
+  // A toy command with nothing to redirect can just run now.
+  if (!pipes && -1 != (pid = xrun_toy(argv, -1, -1))) return toy_child(0, pid);
+
   // Make the pipes? Note this won't set either pipe to 0 because if fds are
   // allocated in order and if fd0 was free it would go to cestnepasun[0]
   if (pipes) {
@@ -116,6 +177,19 @@ pid_t xpopen_both(char **argv, int *pipes)
       if (pipe(cestnepasun+(2*pid))) perror_exit("pipe");
       pipes[pid] = cestnepasun[pid+1];
     }
+
+#if CFG_TOYBOX_THREADS
+    // A toy command with pipes to it runs in a thread, with its ends of them.
+    if (argv && toys.stacktop && !CFG_TOYBOX_NORECURSE) {
+      struct toy_list *toy = toy_find(*argv);
+      struct toy_thread *tt;
+
+      if (toy && (tt = toy_thread_start(toy, argv,
+            pipes[0] != -1 ? cestnepasun[0] : -1,
+            pipes[1] != -1 ? cestnepasun[3] : -1)))
+        return toy_child(tt, 0);
+    }
+#endif
   }
 
   // Child process.
@@ -174,8 +248,26 @@ pid_t xpopen_both(char **argv, int *pipes)
 // Wait for child process to exit, then return adjusted exit code.
 int xwaitpid(pid_t pid)
 {
+  struct toy_child **ttc, *tc;
   int status;
 
+  if (pid < -1) {
+    for (ttc = &toy_children; (tc = *ttc); ttc = &tc->next) {
+      if (tc->pid != pid) continue;
+      *ttc = tc->next;
+#if CFG_TOYBOX_THREADS
+      if (tc->tt) tc->exitval = toy_thread_join(tc->tt);
+#endif
+      status = tc->exitval;
+      free(tc);
+
+      return status;
+    }
+    errno = ECHILD;
+
+    return 127;
+  }
+
   while (-1 == waitpid(pid, &status, 0) && errno == EINTR);
 
   return WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status)+127;
@@ -214,6 +306,8 @@ int xpclose(pid_t pid, int pipe)
 // Call xpopen and wait for it to finish, keeping existing stdin/stdout.
 int xrun(char **argv)
 {
-  return xpclose_both(xpopen_both(argv, 0), 0);
+  int rc = xrun_toy(argv, -1, -1);
+
+  return rc != -1 ? rc : xpclose_both(xpopen_both(argv, 0), 0);
 }
 
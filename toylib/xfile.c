@@ -34,6 +34,15 @@ char *xmprintf(char *format, ...)
   return ret;
 }
 
+// Flush stdout if somebody could be watching it, otherwise let stdio fill
+// its buffer first (toy_run() flushes at the end). Die if writing failed.
+void xflushtty(void)
+{
+  if (!toys.ttyout) toys.ttyout = isatty(fileno(stdout)) ? 1 : -1;
+  if ((toys.ttyout>0 && fflush(stdout)) || ferror(stdout))
+    perror_exit("write");
+}
+
 void xprintf(char *format, ...)
 {
   va_list va;
@@ -41,18 +50,19 @@ void xprintf(char *format, ...)
 
   vprintf(format, va);
   va_end(va);
-  if (fflush(stdout) || ferror(stdout)) perror_exit("write");
+  xflushtty();
 }
 
 void xputs(char *s)
 {
-  if (EOF == puts(s) || fflush(stdout) || ferror(stdout)) perror_exit("write");
+  if (EOF == puts(s)) perror_exit("write");
+  xflushtty();
 }
 
 void xputc(char c)
 {
-  if (EOF == fputc(c, stdout) || fflush(stdout) || ferror(stdout))
-    perror_exit("write");
+  if (EOF == fputc(c, stdout)) perror_exit("write");
+  xflushtty();
 }
 
 void xflush(void)
@@ -76,6 +86,7 @@ int xcreate(char *path, int flags, int mode)
 {
   int fd = open(path, flags^O_CLOEXEC, mode);
   if (fd == -1) perror_exit("%s", path);
+  toy_io.opens++;
   return fd;
 }
 
@@ -119,7 +130,11 @@ FILE *xfopen(char *path, char *mode)
 // Die if there's an error other than EOF.
 size_t xread(int fd, void *buf, size_t len)
 {
-  ssize_t ret = read(fd, buf, len);
+  ssize_t ret;
+
+  toy_cancelpoint();
+  ret = read(fd, buf, len);
+  TOY_IO_READ(ret);
   if (ret < 0) perror_exit("xread");
 
   return ret;
@@ -136,6 +151,8 @@ void xreadall(int fd, void *buf, size_t len)
 
 void txwrite(int fd, void *buf, size_t len)
 {
+  // Anything stdio is still holding for this fd goes first.
+  if (fd == fileno(stdout)) xflush();
   if ((ssize_t)len != writeall(fd, buf, len)) perror_exit("txwrite");
 }
 
@@ -149,9 +166,72 @@ off_t xlseek(int fd, off_t offset, int whence)
   return offset;
 }
 
+// Where the process is, shared by every thread in it and every command the
+// shell runs: the path, and the dev:ino it led to when it was worked out.
+static struct {
+  char *path;
+  dev_t dev;
+  ino_t ino;
+} toy_cwd;
+#if CFG_TOYBOX_THREADS
+static pthread_mutex_t toy_cwd_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void toy_cwd_lock_set(int lock)
+{
+#if CFG_TOYBOX_THREADS
+  if (lock) pthread_mutex_lock(&toy_cwd_lock);
+  else pthread_mutex_unlock(&toy_cwd_lock);
+#endif
+}
+
+// Remember path as the physical path of the current directory, for whoever
+// next asks cachedcwd(). Or forget it, if path is NULL.
+void cachecwd(char *path)
+{
+  struct stat st;
+  char *old;
+
+  if (path && (*path != '/' || stat(".", &st))) path = 0;
+  if (path) path = strdup(path);
+  toy_cwd_lock_set(1);
+  old = toy_cwd.path;
+  if ((toy_cwd.path = path)) {
+    toy_cwd.dev = st.st_dev;
+    toy_cwd.ino = st.st_ino;
+  }
+  toy_cwd_lock_set(0);
+  free(old);
+}
+
+// getcwd(), but without walking ".." back to / reading every directory on
+// the way (slow on IMFS and FAT) when the last answer's still good: "." is
+// still the directory it was, and the path still leads there. That's two
+// stat()s, which also catch a chdir() or a mount or rename nobody told us
+// about. Returns a malloc()ed string, or NULL with errno set.
+char *cachedcwd(void)
+{
+  struct stat st, st2;
+  char *buf = 0;
+
+  if (stat(".", &st)) return 0;
+  toy_cwd_lock_set(1);
+  if (toy_cwd.path && toy_cwd.dev == st.st_dev && toy_cwd.ino == st.st_ino)
+    buf = strdup(toy_cwd.path);
+  toy_cwd_lock_set(0);
+  if (buf) {
+    if (!stat(buf, &st2) && st2.st_dev == st.st_dev && st2.st_ino == st.st_ino)
+      return buf;
+    free(buf);
+  }
+  if ((buf = getcwd(NULL, 0))) cachecwd(buf);
+
+  return buf;
+}
+
 char *xgetcwd(void)
 {
-  char *buf = getcwd(NULL, 0);
+  char *buf = cachedcwd();
   if (!buf) perror_exit("xgetcwd");
 
   return buf;
@@ -162,13 +242,136 @@ void xstat(char *path, struct stat *st)
   if(stat(path, st)) perror_exit("Can't stat %s", path);
 }
 
+// The directories and symlinks xabspath() has seen during this command, by
+// the inode of the directory they're in and their name, so resolving many
+// paths under the same directories only looks each one up once. It's freed
+// with the rest of the command's heap.
+struct abscache_ent {
+  struct abscache_ent *next;
+  dev_t pdev, dev;
+  ino_t pino, ino;
+  char *link, name[];   // link is the symlink's target, or 0 for a directory
+};
+
+#define ABSCACHE_SIZE 1024
+struct abscache {
+  struct abscache_ent *hash[ABSCACHE_SIZE];
+  dev_t dev;
+  ino_t ino;
+};
+
+static struct abscache_ent **abscache_find(struct abscache *ac, dev_t dev,
+  ino_t ino, char *name)
+{
+  struct abscache_ent **ae;
+  unsigned h = ino*2654435761U;
+  char *s;
+
+  for (s = name; *s; s++) h = h*33+*s;
+  for (ae = ac->hash+(h%ABSCACHE_SIZE); *ae; ae = &(*ae)->next)
+    if ((*ae)->pino==ino && (*ae)->pdev==dev && !strcmp((*ae)->name, name))
+      break;
+
+  return ae;
+}
+
+static void abscache_add(struct abscache_ent **ae, dev_t pdev, ino_t pino,
+  char *name, struct stat *st, char *link)
+{
+  int len = strlen(name)+1;
+
+  *ae = xmalloc(sizeof(**ae)+len+(link ? strlen(link)+1 : 0));
+  (*ae)->next = 0;
+  (*ae)->pdev = pdev;
+  (*ae)->pino = pino;
+  (*ae)->dev = st ? st->st_dev : 0;
+  (*ae)->ino = st ? st->st_ino : 0;
+  memcpy((*ae)->name, name, len);
+  (*ae)->link = link ? strcpy((*ae)->name+len, link) : 0;
+}
+
+// Build the path done has in reverse order.
+static char *abspath_join(struct string_list *done)
+{
+  struct string_list *dl;
+  int len = 0, i;
+  char *ret, *s;
+
+  for (dl = done; dl; dl = dl->next) len += strlen(dl->str)+1;
+  s = (ret = xmalloc(len+2))+len;
+  *s = 0;
+  for (dl = done; dl; dl = dl->next) {
+    i = strlen(dl->str);
+    memcpy(s -= i, dl->str, i);
+    *--s = '/';
+  }
+  if (!len) strcpy(ret, "/");
+
+  return ret;
+}
+
+// Resolve the entire path with one openat2() and ask /proc what it found.
+// Returns 0 when it can't, and the caller does it the long way.
+static char *abspath_openat2(char *path)
+{
+#if defined(__linux__) && defined(SYS_openat2)
+  static int broken;
+  struct {
+    unsigned long long flags, mode, resolve;
+  } how = {O_PATH|O_CLOEXEC, 0, 0x02}; // RESOLVE_NO_MAGICLINKS
+  char buf[32], *ret;
+  int fd, len;
+
+  if (broken) return 0;
+  if (-1 == (fd = syscall(SYS_openat2, AT_FDCWD, path, &how, sizeof(how)))) {
+    if (errno == ENOSYS) broken = 1;
+
+    return 0;
+  }
+  sprintf(buf, "/proc/self/fd/%d", fd);
+  ret = xmalloc(4096);
+  len = readlink(buf, ret, 4096);
+  close(fd);
+  if (len<1 || len>4095 || *ret!='/') {
+    if (len == -1 && errno == ENOENT) broken = 1;
+    free(ret);
+
+    return 0;
+  }
+  ret[len] = 0;
+
+  return ret;
+#else
+  return 0;
+#endif
+}
+
 // Cannonicalize path, even to file with one or more missing components at end.
 // if exact, require last path component to exist
 char *xabspath(char *path, int exact)
 {
   struct string_list *todo, *done = 0;
-  int try = 9999, dirfd = open("/", 0);;
-  char buf[4096], *ret;
+  struct abscache *ac = toys.abscache;
+  struct abscache_ent *none = 0, **ae;
+  struct stat st;
+  int try = 9999, dirfd = -1, fd, cached = 1;
+  char buf[4096], *ret, *link = 0;
+  dev_t dev;
+  ino_t ino;
+
+  if ((ret = abspath_openat2(path))) return ret;
+
+  // Where the walk is: the directory done names, with inode dev:ino, which
+  // dirfd has open unless it's -1, in which case it's opened from done when
+  // it's needed. Past something that isn't a directory the cache is no help.
+  if (!ac) {
+    if (stat("/", &st)) return 0;
+    ac = toys.abscache = xzalloc(sizeof(struct abscache));
+    ac->dev = st.st_dev;
+    ac->ino = st.st_ino;
+  }
+  dev = ac->dev;
+  ino = ac->ino;
 
   // If this isn't an absolute path, start with cwd.
   if (*path != '/') {
@@ -188,22 +391,51 @@ char *xabspath(char *path, int exact)
       goto error;
     }
 
-    // Removable path componenents.
-    if (!strcmp(new->str, ".") || !strcmp(new->str, "..")) {
-      int x = new->str[1];
-
+    if (!strcmp(new->str, ".")) {
       free(new);
-      if (x) {
+      continue;
+    }
+
+    // Seen it before?
+    ae = cached ? abscache_find(ac, dev, ino, new->str) : &none;
+    if (*ae && !(link = (*ae)->link)) {
+      dev = (*ae)->dev;
+      ino = (*ae)->ino;
+      if (dirfd != -1) close(dirfd);
+      dirfd = -1;
+      if (new->str[1] == '.' && !new->str[2] && *new->str == '.') {
+        free(new);
         if (done) free(llist_pop(&done));
-        len = 0;
-      } else continue;
+      } else {
+        new->next = done;
+        done = new;
+      }
+      continue;
+    }
+    if (!*ae && dirfd == -1) {
+      ret = abspath_join(done);
+      dirfd = open(ret, O_RDONLY);
+      free(ret);
+      if (dirfd == -1) goto error;
+    }
+
+    // Removable path componenents.
+    if (!strcmp(new->str, "..")) {
+      free(new);
+      if (done) free(llist_pop(&done));
+      len = 0;
 
     // Is this a symlink?
-    } else len=xreadlinkat(dirfd, new->str, buf, 4096);
+    } else if (*ae) len = strlen(strcpy(buf, link));
+    else if ((len = xreadlinkat(dirfd, new->str, buf, 4096))>0 && len<4096
+      && cached)
+    {
+      buf[len] = 0;
+      abscache_add(ae, dev, ino, new->str, 0, buf);
+    }
 
     if (len>4095) goto error;
     if (len<1) {
-      int fd;
       char *s = "..";
 
       // For .. just move dirfd
@@ -217,6 +449,11 @@ char *xabspath(char *path, int exact)
       }
       fd = xopenat(dirfd, s, 0);
       if (fd == -1 && (exact || todo || errno != ENOENT)) goto error;
+      if (fd != -1 && cached && !fstat(fd, &st) && S_ISDIR(st.st_mode)) {
+        abscache_add(ae, dev, ino, s, &st, 0);
+        dev = st.st_dev;
+        ino = st.st_ino;
+      } else cached = 0;
       close(dirfd);
       dirfd = fd;
       continue;
@@ -227,8 +464,11 @@ char *xabspath(char *path, int exact)
     if (*buf == '/') {
       llist_traverse(done, free);
       done=0;
-      close(dirfd);
-      dirfd = open("/", 0);
+      if (dirfd != -1) close(dirfd);
+      dirfd = -1;
+      dev = ac->dev;
+      ino = ac->ino;
+      cached = 1;
     }
     free(new);
 
@@ -241,36 +481,16 @@ char *xabspath(char *path, int exact)
       todo = new;
     }
   }
-  close(dirfd);
-
-  // At this point done has the path, in reverse order. Reverse list while
-  // calculating buffer length.
-
-  try = 2;
-  while (done) {
-    struct string_list *temp = llist_pop(&done);;
-
-    if (todo) try++;
-    try += strlen(temp->str);
-    temp->next = todo;
-    todo = temp;
-  }
-
-  // Assemble return buffer
+  if (dirfd != -1) close(dirfd);
 
-  ret = xmalloc(try);
-  *ret = '/';
-  ret [try = 1] = 0;
-  while (todo) {
-    if (try>1) ret[try++] = '/';
-    try = stpcpy(ret+try, todo->str) - ret;
-    free(llist_pop(&todo));
-  }
+  // At this point done has the path, in reverse order.
+  ret = abspath_join(done);
+  llist_traverse(done, free);
 
   return ret;
 
 error:
-  close(dirfd);
+  if (dirfd != -1) close(dirfd);
   llist_traverse(todo, free);
   llist_traverse(done, free);
 
@@ -357,18 +577,253 @@ void xpidfile(char *name)
   close(fd);
 }
 
-// Copy the rest of in to out and close both files.
+// Copy the rest of in to out, using buf for anything the kernel won't do
+// itself. Returns 0, or -1 if a read and 1 if a write failed (with errno).
 
-void xsendfile(int in, int out)
+int copyfd(int in, int out, char *buf, size_t size)
 {
+  char *big = 0;
   long len;
 
-  if (in<0) return;
+#if TOYBOX_COPYFILE
+  // Have the kernel move the data if it will: copy_file_range() between
+  // files, sendfile() from anything it can page in, splice() from a pipe.
+  // A method that doesn't apply fails up front (EINVAL, EXDEV, ENOSYS...)
+  // and one that dies partway leaves both offsets where it stopped, so
+  // either way just try the next. Only trust a 0 return as EOF after some
+  // data moved; the read() loop below gets the final word otherwise.
+  {
+    struct stat st;
+    int try, did;
+
+    for (try = fstat(in, &st) || !S_ISREG(st.st_mode) || !st.st_size;
+         try<3; try++)
+    {
+      for (did = 0;; did++) {
+        if (!try)
+          len = syscall(SYS_copy_file_range, in, 0, out, 0, 1<<30, 0);
+        else if (try==1) len = sendfile(out, in, 0, 1<<30);
+        else len = syscall(SYS_splice, in, 0, out, 0, 1<<30, SPLICE_F_MOVE);
+        if (len<1) break;
+        TOY_IO_READ(len);
+        TOY_IO_WRITE(len);
+      }
+      if (!len && did) return 0;
+    }
+  }
+#endif
+
+  // Start in buf so short files don't pay for an allocation, then move to
+  // a big page aligned buffer once it looks like there's real data coming.
+  for (;;) {
+    len = read(in, buf, size);
+    TOY_IO_READ(len);
+    if (len<1) break;
+    if (len != writeall(out, buf, len)) {
+      len = 1;
+      break;
+    }
+    if (!big && size < XCOPY_BUF && len == (long)size)
+      if (!posix_memalign((void **)&big, 4096, XCOPY_BUF))
+        buf = big, size = XCOPY_BUF;
+  }
+  if (big) {
+    int err = errno;
+
+    free(big);
+    errno = err;
+  }
+
+  return len<0 ? -1 : !!len;
+}
+
+// Copy the rest of in to out. With no callback copyfd() does it, letting
+// the kernel move the data when the fd types allow. Otherwise each block
+// read goes to each(out, buf, len), which writes it out however it likes.
+// Write errors are fatal, a read error returns -1 with errno set.
+
+int xcopy(int in, int out, void (*each)(int out, char *buf, long len))
+{
+  char *buf;
+  long len;
+  int rc;
+
+  if (!each) {
+    if (out == fileno(stdout)) xflush();
+    if ((rc = copyfd(in, out, libbuf, sizeof(libbuf)))>0) perror_exit("write");
+
+    return rc;
+  }
+
+  buf = xmalloc(XCOPY_BUF);
   for (;;) {
-    len = xread(in, libbuf, sizeof(libbuf));
+    len = read(in, buf, XCOPY_BUF);
+    TOY_IO_READ(len);
     if (len<1) break;
-    txwrite(out, libbuf, len);
+    each(out, buf, len);
+  }
+  rc = errno;
+  free(buf);
+  errno = rc;
+
+  return len ? -1 : 0;
+}
+
+// Copy the rest of in to out.
+
+void xsendfile(int in, int out)
+{
+  if (in<0) return;
+  if (xcopy(in, out, 0)) perror_exit("xread");
+}
+
+// Copy up to len bytes from in to out, stopping early at EOF. Reads from
+// *off (advancing it) if off isn't NULL, leaving in's file position alone
+// so threads can copy different parts of one file at once. Doesn't exit:
+// returns bytes copied or -1 with errno set.
+
+long long copyfd_len(int in, off_t *off, int out, long long len)
+{
+  long long done = 0;
+  long n = 0, chunk;
+  char *buf;
+
+#if TOYBOX_COPYFILE
+  // As in copyfd(), don't believe a 0 from copy_file_range() until some
+  // data moved, and let the read() loop finish whatever it couldn't do.
+  // When out isn't a file sendfile() can still take it, a pipe or socket.
+  {
+    struct stat st;
+    int try;
+
+    if (!fstat(in, &st) && S_ISREG(st.st_mode)) for (try = 0; try<2; try++) {
+      while (done<len) {
+        chunk = (len-done > 1<<30) ? 1<<30 : len-done;
+        if (!try) n = syscall(SYS_copy_file_range, in, off, out, 0, chunk, 0);
+        else n = sendfile(out, in, off, chunk);
+        if (n<1) break;
+        TOY_IO_READ(n);
+        TOY_IO_WRITE(n);
+        done += n;
+      }
+      if (done==len || (!n && done)) return done;
+    }
+  }
+#endif
+
+  if (!(buf = malloc(65536))) return -1;
+  while (done<len) {
+    chunk = (len-done > 65536) ? 65536 : len-done;
+    n = off ? pread(in, buf, chunk, *off) : read(in, buf, chunk);
+    TOY_IO_READ(n);
+    if (n<1) break;
+    if (n != writeall(out, buf, n)) {
+      n = -1;
+      break;
+    }
+    if (off) *off += n;
+    done += n;
+  }
+  chunk = errno;
+  free(buf);
+  errno = chunk;
+
+  return n<0 ? -1 : done;
+}
+
+// Is len (at least 1) bytes of buf all zero?
+
+int allzero(char *buf, long len)
+{
+  return !*buf && !memcmp(buf, buf+1, len-1);
+}
+
+// Find fd's next data at or after pos (which it returns) and where that run
+// of data ends (in *end), or return size if there's only hole left. Without
+// SEEK_DATA, or on something that can't seek, it's all data. Leaves fd's
+// file position alone.
+
+off_t lseek_data(int fd, off_t pos, off_t size, off_t *end)
+{
+  off_t cur = lseek(fd, 0, SEEK_CUR), data;
+
+  *end = size;
+  if (cur == -1) return pos;
+  if (-1 == (data = lseek(fd, pos, SEEK_DATA)))
+    data = (errno == ENXIO) ? size : pos;
+  else if (data >= size) data = size;
+  else if (-1 == (*end = lseek(fd, data, SEEK_HOLE)) || *end > size)
+    *end = size;
+  lseek(fd, cur, SEEK_SET);
+
+  return data;
+}
+
+// Copy the rest of in to out, leaving holes in out where in has them, so
+// only in's data gets read and written. With zeroes set, blocks of data
+// that are all zero become holes too. Anything but one regular file to
+// another goes to copyfd() instead. Returns as copyfd() does.
+
+int copyfd_sparse(int in, int out, char *buf, size_t size, int zeroes)
+{
+  struct stat st, ost;
+  off_t pos, base, data, end, off;
+  long len, i, j;
+
+  if (fstat(in, &st) || !S_ISREG(st.st_mode) || fstat(out, &ost)
+      || !S_ISREG(ost.st_mode) || -1 == (pos = lseek(in, 0, SEEK_CUR))
+      || -1 == (base = lseek(out, 0, SEEK_CUR)))
+    return copyfd(in, out, buf, size);
+
+  // base is where in's offset 0 lands in out
+  for (base -= pos; pos < st.st_size;) {
+    if ((data = lseek_data(in, pos, st.st_size, &end)) == st.st_size) {
+      pos = data;
+      break;
+    }
+    if (-1 == lseek(out, base+data, SEEK_SET)) return 1;
+    if (!zeroes) {
+      off = data;
+      if (0 > (len = copyfd_len(in, &off, out, end-data))) return -1;
+      if ((pos = data+len) < end) break;
+      continue;
+    }
+
+    // Write each run of blocks that aren't all zero, seek past the rest.
+    for (pos = data; pos < end; pos += len) {
+      if (0 > (len = pread(in, buf, (end-pos > size) ? size : end-pos, pos)))
+        return -1;
+      if (!len) goto done;
+      for (i = 0; i < len;) {
+        for (j = i; j < len && !allzero(buf+j, (len-j > 4096) ? 4096 : len-j);)
+          j += 4096;
+        if (j > len) j = len;
+        if (j > i && (-1 == lseek(out, base+pos+i, SEEK_SET)
+            || writeall(out, buf+i, j-i) != j-i)) return 1;
+        for (i = j; i < len && allzero(buf+i, (len-i > 4096) ? 4096 : len-i);)
+          i += 4096;
+      }
+    }
   }
+done:
+  // A hole at the end only exists if the file's size says so.
+  if (ftruncate(out, base+pos)) return 1;
+  lseek(in, pos, SEEK_SET);
+  lseek(out, base+pos, SEEK_SET);
+
+  return 0;
+}
+
+// Copy up to len bytes of in to out, returning how many there were.
+
+long long xsendfile_len(int in, int out, long long len)
+{
+  long long rc;
+
+  if (out == fileno(stdout)) xflush();
+  if (0>(rc = copyfd_len(in, 0, out, len))) perror_exit("copy");
+
+  return rc;
 }
 
 // parse fractional seconds with optional s/m/h/d suffix
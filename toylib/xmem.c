@@ -37,13 +37,224 @@ void xexit(void)
   exit(toys.exitval);
 }
 
+// Commands run inside the shell's process, so whatever one forgets to free
+// would stay in the shell's heap until it exits. Instead toy_run() gives
+// each command a heap: x*alloc() notes every block in it, free() and
+// realloc() (toy_free() and toy_realloc(), see lib.h) keep it current, and
+// what's left is freed when toy_run() returns, even via error_exit(). Memory
+// meant to outlive the command (a cache in a static, say) is handed to
+// xkeep(), or allocated between xkeep_all(1) and xkeep_all(0). Outside
+// toy_run(), or in a worker thread a command started, nothing's noted.
+//
+// A heap's an open addressed hash table of pointers, and points up at the
+// heap of whatever ran it (the command that called toy_run(), or started the
+// worker thread, see toy_worker_create()), since that's who'd hand it a
+// block to free. free() looks up that chain. Nothing's shared between threads
+// until a worker's heap points up at it, so until then there's no lock.
+
+#undef free
+#undef realloc
+
+#define HEAP_GONE ((void *)1)
+
+static void heap_lock(struct toy_heap *heap)
+{
+#if CFG_TOYBOX_THREADS
+  if (heap->shared) pthread_mutex_lock(&heap->lock);
+#endif
+}
+
+static void heap_unlock(struct toy_heap *heap)
+{
+#if CFG_TOYBOX_THREADS
+  if (heap->shared) pthread_mutex_unlock(&heap->lock);
+#endif
+}
+
+static unsigned heap_hash(struct toy_heap *heap, void *ptr)
+{
+  unsigned long h = (unsigned long)ptr>>4;
+
+  h *= 0x9e3779b1U;
+
+  return (h^(h>>16))&heap->mask;
+}
+
+// Note ptr, growing the table when over half full. Called with the heap
+// locked. If there's no memory for a bigger table ptr just isn't noted: it's
+// better to leak it than to fail an allocation that worked. Returns 0 then.
+static int heap_put(struct toy_heap *heap, void *ptr)
+{
+  void **old = heap->slot, **new;
+  unsigned i, j, size = old ? heap->mask+1 : 0;
+
+  if (2*(heap->used+heap->gone+1) > size) {
+    j = size ? (4*heap->used >= size ? 2*size : size) : 64;
+    if (!(new = calloc(j, sizeof(*new)))) return 0;
+    heap->slot = new;
+    heap->mask = j-1;
+    heap->used = heap->gone = 0;
+    for (i = 0; i<size; i++)
+      if (old[i] && old[i] != HEAP_GONE) heap_put(heap, old[i]);
+    free(old);
+  }
+  for (i = heap_hash(heap, ptr); heap->slot[i] && heap->slot[i] != HEAP_GONE;
+    i = (i+1)&heap->mask);
+  if (heap->slot[i]) heap->gone--;
+  heap->slot[i] = ptr;
+  heap->used++;
+
+  return 1;
+}
+
+static int heap_drop(struct toy_heap *heap, void *ptr)
+{
+  unsigned i;
+
+  if (heap->used)
+    for (i = heap_hash(heap, ptr); heap->slot[i]; i = (i+1)&heap->mask) {
+      if (heap->slot[i] != ptr) continue;
+      heap->slot[i] = HEAP_GONE;
+      heap->used--;
+      heap->gone++;
+
+      return 1;
+    }
+
+  return 0;
+}
+
+// Note ptr in heap and count its size. Called with the heap locked.
+static void heap_note(struct toy_heap *heap, void *ptr)
+{
+  if (!heap_put(heap, ptr)) return;
+  if ((heap->bytes += toy_blocksize(ptr)) > heap->peak)
+    heap->peak = heap->bytes;
+}
+
+// Forget ptr, returning the heap it was in (if any), before ptr's freed.
+// The running command's heap is the likeliest, so it's first.
+static struct toy_heap *heap_take(void *ptr)
+{
+  struct toy_heap *heap;
+  int found;
+
+  for (heap = &toys.heap; heap; heap = heap->up) {
+    if (!heap->live) continue;
+    heap_lock(heap);
+    if ((found = heap_drop(heap, ptr))) heap->bytes -= toy_blocksize(ptr);
+    heap_unlock(heap);
+    if (found) break;
+  }
+
+  return heap;
+}
+
+static void *heap_add(void *ptr)
+{
+  if (toys.heap.live && !toys.keep) {
+    heap_lock(&toys.heap);
+    heap_note(&toys.heap, ptr);
+    heap_unlock(&toys.heap);
+  }
+
+  return ptr;
+}
+
+// Start noting x*alloc() in heap, which starts empty, under up.
+void toy_heap_start(struct toy_heap *heap, struct toy_heap *up)
+{
+  heap->bytes = heap->peak = 0;
+  heap->up = up;
+  heap->shared = 0;
+  heap->live = 1;
+}
+
+// Set up the heap of a worker thread's copy of a context: it notes nothing
+// itself, but what it frees is looked for in up and the heaps above that,
+// which lock from now on. Call before starting the thread.
+void toy_heap_child(struct toy_heap *heap, struct toy_heap *up)
+{
+  memset(heap, 0, sizeof(*heap));
+  heap->up = up;
+#if CFG_TOYBOX_THREADS
+  for (; up; up = up->up) if (up->live && !up->shared) {
+    pthread_mutex_init(&up->lock, 0);
+    up->shared = 1;
+  }
+#endif
+}
+
+// Stop noting, and free everything that's still in heap. The table's kept
+// for next time unless it grew big. Any workers using it are done by now.
+void toy_heap_end(struct toy_heap *heap)
+{
+  unsigned i, size = heap->mask+1;
+
+  if (!heap->live) return;
+  heap->live = 0;
+#if CFG_TOYBOX_THREADS
+  if (heap->shared) pthread_mutex_destroy(&heap->lock);
+#endif
+  heap->shared = 0;
+
+  if (!heap->slot) return;
+  for (i = 0; heap->used && i<size; i++)
+    if (heap->slot[i] && heap->slot[i] != HEAP_GONE) {
+      free(heap->slot[i]);
+      heap->used--;
+    }
+  heap->gone = 0;
+  if (size > 1024) {
+    free(heap->slot);
+    heap->slot = 0;
+    heap->mask = 0;
+  } else memset(heap->slot, 0, size*sizeof(*heap->slot));
+}
+
+void toy_free(void *ptr)
+{
+  if (ptr) heap_take(ptr);
+  free(ptr);
+}
+
+// A block that was noted stays noted (in the same heap) when it moves.
+void *toy_realloc(void *ptr, size_t size)
+{
+  struct toy_heap *heap = ptr ? heap_take(ptr) : 0;
+  void *new = realloc(ptr, size);
+
+  if (heap && (new || size)) {
+    heap_lock(heap);
+    heap_note(heap, new ? new : ptr);
+    heap_unlock(heap);
+  }
+
+  return new;
+}
+
+// Keep ptr when the command exits, returning it.
+void *xkeep(void *ptr)
+{
+  if (ptr) heap_take(ptr);
+
+  return ptr;
+}
+
+// Keep everything this command allocates from xkeep_all(1) until the
+// matching xkeep_all(0). These nest.
+void xkeep_all(int keep)
+{
+  toys.keep += keep ? 1 : -1;
+}
+
 // Die unless we can allocate memory.
 void *xmalloc(size_t size)
 {
   void *ret = malloc(size);
   if (!ret) error_exit("xmalloc");
 
-  return ret;
+  return heap_add(ret);
 }
 
 // Die unless we can allocate prezeroed memory.
@@ -58,7 +269,8 @@ void *xzalloc(size_t size)
 // moving it.  (Notice different arguments from libc function.)
 void *xrealloc(void *ptr, size_t size)
 {
-  ptr = realloc(ptr, size);
+  if (ptr) ptr = toy_realloc(ptr, size);
+  else if ((ptr = realloc(0, size))) heap_add(ptr);
   if (!ptr) error_exit("xrealloc");
 
   return ptr;
@@ -72,7 +284,7 @@ char *xstrndup(char *s, size_t n)
   if (!ret) error_exit("xstrndup");
   ret[--n] = 0;
 
-  return ret;
+  return heap_add(ret);
 }
 
 // Die unless we can allocate a copy of this string.